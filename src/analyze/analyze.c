@@ -39,6 +39,8 @@
 #include "pager.h"
 #include "analyze-verify.h"
 #include "terminal-util.h"
+#include "def.h"
+#include "fileio.h"
 
 #define SCALE_X (0.1 / 1000.0)   /* pixels per us */
 #define SCALE_Y (20.0)
@@ -109,6 +111,8 @@ struct unit_times {
         usec_t deactivated;
         usec_t deactivating;
         usec_t time;
+        char **after;
+        bool after_set;
 };
 
 struct host_info {
@@ -194,8 +198,10 @@ static int compare_unit_start(const void *a, const void *b) {
 static void free_unit_times(struct unit_times *t, unsigned n) {
         struct unit_times *p;
 
-        for (p = t; p < t + n; p++)
+        for (p = t; p < t + n; p++) {
                 free(p->name);
+                strv_free(p->after);
+        }
 
         free(t);
 }
@@ -328,6 +334,129 @@ static void free_host_info(struct host_info *hi) {
         free(hi);
 }
 
+/* Makes the timestamps relative to the boot, and takes ownership of
+ * the unit name. Returns 0 if the unit wasn't activated and t shall
+ * not be used. */
+static int unit_times_finish(struct unit_times *t, const struct boot_times *boot_times, const char *id) {
+        assert(t);
+        assert(boot_times);
+        assert(id);
+
+        subtract_timestamp(&t->activating, boot_times->reverse_offset);
+        subtract_timestamp(&t->activated, boot_times->reverse_offset);
+        subtract_timestamp(&t->deactivating, boot_times->reverse_offset);
+        subtract_timestamp(&t->deactivated, boot_times->reverse_offset);
+
+        if (t->activated >= t->activating)
+                t->time = t->activated - t->activating;
+        else if (t->deactivated >= t->activating)
+                t->time = t->deactivated - t->activating;
+        else
+                t->time = 0;
+
+        if (t->activating == 0)
+                return 0;
+
+        t->name = strdup(id);
+        if (!t->name)
+                return log_oom();
+
+        return 1;
+}
+
+static int acquire_time_data_bulk(sd_bus *bus, const struct boot_times *boot_times, struct unit_times **out) {
+        _cleanup_bus_message_unref_ sd_bus_message *reply = NULL;
+        _cleanup_bus_error_free_ sd_bus_error error = SD_BUS_ERROR_NULL;
+        struct unit_times *unit_times = NULL;
+        size_t size = 0;
+        int r, c = 0;
+
+        /* Returns -EOPNOTSUPP if the manager doesn't know the call */
+
+        r = sd_bus_call_method(
+                        bus,
+                        "org.freedesktop.systemd1",
+                        "/org/freedesktop/systemd1",
+                        "org.freedesktop.systemd1.Manager",
+                        "ListUnitTimestamps",
+                        &error, &reply,
+                        NULL);
+        if (r < 0) {
+                if (sd_bus_error_has_name(&error, SD_BUS_ERROR_UNKNOWN_METHOD))
+                        return -EOPNOTSUPP;
+
+                log_error("Failed to list unit timestamps: %s", bus_error_message(&error, -r));
+                return r;
+        }
+
+        r = sd_bus_message_enter_container(reply, SD_BUS_TYPE_ARRAY, "(sttttas)");
+        if (r < 0) {
+                bus_log_parse_error(r);
+                goto fail;
+        }
+
+        while ((r = sd_bus_message_enter_container(reply, SD_BUS_TYPE_STRUCT, "sttttas")) > 0) {
+                _cleanup_strv_free_ char **after = NULL;
+                struct unit_times *t;
+                const char *id;
+
+                if (!GREEDY_REALLOC(unit_times, size, c+1)) {
+                        r = log_oom();
+                        goto fail;
+                }
+
+                t = unit_times+c;
+                zero(*t);
+
+                r = sd_bus_message_read(reply, "stttt",
+                                        &id,
+                                        &t->activating,
+                                        &t->activated,
+                                        &t->deactivating,
+                                        &t->deactivated);
+                if (r < 0) {
+                        bus_log_parse_error(r);
+                        goto fail;
+                }
+
+                r = sd_bus_message_read_strv(reply, &after);
+                if (r < 0) {
+                        bus_log_parse_error(r);
+                        goto fail;
+                }
+
+                r = sd_bus_message_exit_container(reply);
+                if (r < 0) {
+                        bus_log_parse_error(r);
+                        goto fail;
+                }
+
+                r = unit_times_finish(t, boot_times, id);
+                if (r < 0)
+                        goto fail;
+                if (r == 0)
+                        continue;
+
+                t->after = after;
+                t->after_set = true;
+                after = NULL;
+
+                c++;
+        }
+        if (r < 0) {
+                bus_log_parse_error(r);
+                goto fail;
+        }
+
+        *out = unit_times;
+        return c;
+
+fail:
+        if (unit_times)
+                free_unit_times(unit_times, (unsigned) c);
+        return r;
+}
+
 static int acquire_time_data(sd_bus *bus, struct unit_times **out) {
         _cleanup_bus_message_unref_ sd_bus_message *reply = NULL;
         _cleanup_bus_error_free_ sd_bus_error error = SD_BUS_ERROR_NULL;
@@ -341,6 +470,12 @@ static int acquire_time_data(sd_bus *bus, struct unit_times **out) {
         if (r < 0)
                 goto fail;
 
+        r = acquire_time_data_bulk(bus, boot_times, out);
+        if (r != -EOPNOTSUPP)
+                return r;
+
+        /* Older managers, ask for each unit separately */
+
         r = sd_bus_call_method(
                         bus,
                         "org.freedesktop.systemd1",
@@ -369,7 +504,7 @@ static int acquire_time_data(sd_bus *bus, struct unit_times **out) {
                 }
 
                 t = unit_times+c;
-                t->name = NULL;
+                zero(*t);
 
                 assert_cc(sizeof(usec_t) == sizeof(uint64_t));
 
@@ -393,26 +528,12 @@ static int acquire_time_data(sd_bus *bus, struct unit_times **out) {
                         goto fail;
                 }
 
-                subtract_timestamp(&t->activating, boot_times->reverse_offset);
-                subtract_timestamp(&t->activated, boot_times->reverse_offset);
-                subtract_timestamp(&t->deactivating, boot_times->reverse_offset);
-                subtract_timestamp(&t->deactivated, boot_times->reverse_offset);
-
-                if (t->activated >= t->activating)
-                        t->time = t->activated - t->activating;
-                else if (t->deactivated >= t->activating)
-                        t->time = t->deactivated - t->activating;
-                else
-                        t->time = 0;
-
-                if (t->activating == 0)
+                r = unit_times_finish(t, boot_times, u.id);
+                if (r < 0)
+                        goto fail;
+                if (r == 0)
                         continue;
 
-                t->name = strdup(u.id);
-                if (t->name == NULL) {
-                        r = log_oom();
-                        goto fail;
-                }
                 c++;
         }
         if (r < 0) {
@@ -773,13 +894,29 @@ static int list_dependencies_print(const char *name, unsigned int level, unsigne
         return 0;
 }
 
+static Hashmap *unit_times_hashmap;
+
 static int list_dependencies_get_dependencies(sd_bus *bus, const char *name, char ***deps) {
         _cleanup_free_ char *path = NULL;
+        struct unit_times *times;
 
         assert(bus);
         assert(name);
         assert(deps);
 
+        /* Use the After= list from the bulk reply if we got one */
+        times = hashmap_get(unit_times_hashmap, name);
+        if (times && times->after_set) {
+                char **l;
+
+                l = strv_copy(times->after);
+                if (!l)
+                        return -ENOMEM;
+
+                *deps = l;
+                return 0;
+        }
+
         path = unit_dbus_path_from_name(name);
         if (path == NULL)
                 return -ENOMEM;
@@ -787,8 +924,6 @@ static int list_dependencies_get_dependencies(sd_bus *bus, const char *name, cha
         return bus_get_unit_property_strv(bus, path, "After", deps);
 }
 
-static Hashmap *unit_times_hashmap;
-
 static int list_dependencies_compare(const void *_a, const void *_b) {
         const char **a = (const char**) _a, **b = (const char**) _b;
         usec_t usa = 0, usb = 0;
@@ -1012,6 +1147,64 @@ static int analyze_time(sd_bus *bus) {
         return 0;
 }
 
+static int analyze_readahead(void) {
+        _cleanup_free_ char *files = NULL, *bytes = NULL, *duration = NULL, *recorded = NULL, *done = NULL;
+        char ts[FORMAT_TIMESPAN_MAX], sz[FORMAT_BYTES_MAX];
+        uint64_t n_bytes = 0;
+        usec_t duration_usec = 0, recorded_usec = 0, done_usec = 0;
+        int r;
+
+        /* Both boot times are measured from kernel start until
+         * systemd-readahead-done.service ran, the recorded one on the
+         * boot that created the pack, i.e. without readahead. */
+
+        r = parse_env_file(READAHEAD_REPLAY_FILE, NEWLINE,
+                           "FILES", &files,
+                           "BYTES", &bytes,
+                           "DURATION_USEC", &duration,
+                           "RECORDED_BOOT_USEC", &recorded,
+                           NULL);
+        if (r == -ENOENT) {
+                log_error("Readahead was not replayed on this boot.");
+                return r;
+        }
+        if (r < 0)
+                return log_error_errno(r, "Failed to read " READAHEAD_REPLAY_FILE ": %m");
+
+        if (bytes)
+                (void) safe_atou64(bytes, &n_bytes);
+        if (duration)
+                (void) safe_atou64(duration, &duration_usec);
+        if (recorded)
+                (void) safe_atou64(recorded, &recorded_usec);
+
+        r = read_one_line_file(READAHEAD_DONE_FILE, &done);
+        if (r >= 0)
+                (void) safe_atou64(done, &done_usec);
+
+        printf("Replayed %s files (%s) in %s\n",
+               strna(files),
+               format_bytes(sz, sizeof(sz), n_bytes),
+               format_timespan(ts, sizeof(ts), duration_usec, USEC_PER_MSEC));
+
+        if (recorded_usec > 0)
+                printf("Boot without readahead: %s\n", format_timespan(ts, sizeof(ts), recorded_usec, USEC_PER_MSEC));
+
+        if (done_usec <= 0) {
+                printf("This boot is not done yet.\n");
+                return 0;
+        }
+
+        printf("This boot:              %s\n", format_timespan(ts, sizeof(ts), done_usec, USEC_PER_MSEC));
+
+        if (recorded_usec > done_usec)
+                printf("Gain:                   %s\n", format_timespan(ts, sizeof(ts), recorded_usec - done_usec, USEC_PER_MSEC));
+        else if (recorded_usec > 0)
+                printf("Loss:                   %s\n", format_timespan(ts, sizeof(ts), done_usec - recorded_usec, USEC_PER_MSEC));
+
+        return 0;
+}
+
 static int graph_one_property(sd_bus *bus, const UnitInfo *u, const char* prop, const char *color, char* patterns[], char* from_patterns[], char* to_patterns[]) {
         _cleanup_strv_free_ char **units = NULL;
         char **unit;
@@ -1230,6 +1423,226 @@ static int dump(sd_bus *bus, char **args) {
         return 0;
 }
 
+struct event_source_stats {
+        const char *description;
+        const char *type;
+        uint64_t n_dispatched;
+        usec_t runtime, runtime_max;
+        usec_t latency, latency_max;
+};
+
+static int compare_event_source_stats(const void *a, const void *b) {
+        const struct event_source_stats *x = a, *y = b;
+
+        if (x->runtime > y->runtime)
+                return -1;
+        if (x->runtime < y->runtime)
+                return 1;
+
+        return 0;
+}
+
+static int event_sources(sd_bus *bus, char **args) {
+        _cleanup_bus_message_unref_ sd_bus_message *reply = NULL;
+        _cleanup_bus_error_free_ sd_bus_error error = SD_BUS_ERROR_NULL;
+        _cleanup_free_ struct event_source_stats *stats = NULL;
+        size_t n = 0, n_allocated = 0, i;
+        struct event_source_stats s;
+        unsigned n_timer_elapses, n_timer_wakeups;
+        int profile, r;
+
+        if (!strv_isempty(args)) {
+                log_error("Too many arguments.");
+                return -E2BIG;
+        }
+
+        r = sd_bus_call_method(
+                        bus,
+                        "org.freedesktop.systemd1",
+                        "/org/freedesktop/systemd1",
+                        "org.freedesktop.systemd1.Manager",
+                        "GetEventSourceStatistics",
+                        &error,
+                        &reply,
+                        "");
+        if (r < 0) {
+                log_error("Failed to issue method call: %s", bus_error_message(&error, -r));
+                return r;
+        }
+
+        r = sd_bus_message_read(reply, "b", &profile);
+        if (r < 0)
+                return bus_log_parse_error(r);
+
+        r = sd_bus_message_enter_container(reply, 'a', "(ssttttt)");
+        if (r < 0)
+                return bus_log_parse_error(r);
+
+        while ((r = sd_bus_message_read(reply, "(ssttttt)",
+                                        &s.description, &s.type, &s.n_dispatched,
+                                        &s.runtime, &s.runtime_max,
+                                        &s.latency, &s.latency_max)) > 0) {
+
+                if (!GREEDY_REALLOC(stats, n_allocated, n + 1))
+                        return log_oom();
+
+                stats[n++] = s;
+        }
+        if (r < 0)
+                return bus_log_parse_error(r);
+
+        if (!profile)
+                log_notice("Event source profiling is turned off, statistics might be incomplete.\n"
+                           "Use 'systemd-analyze set-event-profiling on' to turn it on.");
+
+        qsort_safe(stats, n, sizeof(struct event_source_stats), compare_event_source_stats);
+
+        pager_open_if_enabled();
+
+        printf("%12s %12s %12s %12s %10s %-14s %s\n",
+               "RUNTIME", "MAX", "AVG-LATENCY", "MAX-LATENCY", "DISPATCHED", "TYPE", "DESCRIPTION");
+
+        for (i = 0; i < n; i++) {
+                char a[FORMAT_TIMESPAN_MAX], b[FORMAT_TIMESPAN_MAX], c[FORMAT_TIMESPAN_MAX], d[FORMAT_TIMESPAN_MAX];
+
+                printf("%12s %12s %12s %12s %10" PRIu64 " %-14s %s\n",
+                       format_timespan(a, sizeof(a), stats[i].runtime, 1),
+                       format_timespan(b, sizeof(b), stats[i].runtime_max, 1),
+                       format_timespan(c, sizeof(c), stats[i].n_dispatched > 0 ? stats[i].latency / stats[i].n_dispatched : 0, 1),
+                       format_timespan(d, sizeof(d), stats[i].latency_max, 1),
+                       stats[i].n_dispatched,
+                       stats[i].type,
+                       isempty(stats[i].description) ? "n/a" : stats[i].description);
+        }
+
+        /* Older managers don't know these, skip them quietly */
+        if (sd_bus_get_property_trivial(
+                            bus,
+                            "org.freedesktop.systemd1",
+                            "/org/freedesktop/systemd1",
+                            "org.freedesktop.systemd1.Manager",
+                            "NTimerElapses",
+                            NULL,
+                            'u', &n_timer_elapses) >= 0 &&
+            sd_bus_get_property_trivial(
+                            bus,
+                            "org.freedesktop.systemd1",
+                            "/org/freedesktop/systemd1",
+                            "org.freedesktop.systemd1.Manager",
+                            "NTimerWakeups",
+                            NULL,
+                            'u', &n_timer_wakeups) >= 0)
+                printf("\nTimer units elapsed %u times in %u wakeups, %u wakeups saved by coalescing.\n",
+                       n_timer_elapses, n_timer_wakeups, n_timer_elapses - MIN(n_timer_wakeups, n_timer_elapses));
+
+        return 0;
+}
+
+struct generator_timing {
+        const char *name;
+        usec_t duration;
+};
+
+static int compare_generator_timing(const void *a, const void *b) {
+        const struct generator_timing *x = a, *y = b;
+
+        if (x->duration > y->duration)
+                return -1;
+        if (x->duration < y->duration)
+                return 1;
+
+        return strcmp(x->name, y->name);
+}
+
+static int generators(sd_bus *bus, char **args) {
+        _cleanup_bus_message_unref_ sd_bus_message *reply = NULL;
+        _cleanup_bus_error_free_ sd_bus_error error = SD_BUS_ERROR_NULL;
+        _cleanup_free_ struct generator_timing *timings = NULL;
+        size_t n = 0, n_allocated = 0, i;
+        struct generator_timing t;
+        int r;
+
+        if (!strv_isempty(args)) {
+                log_error("Too many arguments.");
+                return -E2BIG;
+        }
+
+        r = sd_bus_call_method(
+                        bus,
+                        "org.freedesktop.systemd1",
+                        "/org/freedesktop/systemd1",
+                        "org.freedesktop.systemd1.Manager",
+                        "GetGeneratorTimings",
+                        &error,
+                        &reply,
+                        "");
+        if (r < 0) {
+                log_error("Failed to issue method call: %s", bus_error_message(&error, -r));
+                return r;
+        }
+
+        r = sd_bus_message_enter_container(reply, 'a', "(st)");
+        if (r < 0)
+                return bus_log_parse_error(r);
+
+        while ((r = sd_bus_message_read(reply, "(st)", &t.name, &t.duration)) > 0) {
+
+                if (!GREEDY_REALLOC(timings, n_allocated, n + 1))
+                        return log_oom();
+
+                timings[n++] = t;
+        }
+        if (r < 0)
+                return bus_log_parse_error(r);
+
+        qsort_safe(timings, n, sizeof(struct generator_timing), compare_generator_timing);
+
+        pager_open_if_enabled();
+
+        for (i = 0; i < n; i++) {
+                char ts[FORMAT_TIMESPAN_MAX];
+
+                printf("%16s %s\n", format_timespan(ts, sizeof(ts), timings[i].duration, USEC_PER_MSEC), timings[i].name);
+        }
+
+        return 0;
+}
+
+static int set_event_profiling(sd_bus *bus, char **args) {
+        _cleanup_bus_error_free_ sd_bus_error error = SD_BUS_ERROR_NULL;
+        int b, r;
+
+        assert(bus);
+        assert(args);
+
+        if (strv_length(args) != 1) {
+                log_error("This command expects one argument only.");
+                return -E2BIG;
+        }
+
+        b = parse_boolean(args[0]);
+        if (b < 0) {
+                log_error("Failed to parse boolean argument: %s", args[0]);
+                return -EINVAL;
+        }
+
+        r = sd_bus_call_method(
+                        bus,
+                        "org.freedesktop.systemd1",
+                        "/org/freedesktop/systemd1",
+                        "org.freedesktop.systemd1.Manager",
+                        "SetEventSourceProfiling",
+                        &error,
+                        NULL,
+                        "b", b);
+        if (r < 0) {
+                log_error("Failed to issue method call: %s", bus_error_message(&error, -r));
+                return -EIO;
+        }
+
+        return 0;
+}
+
 static int set_log_level(sd_bus *bus, char **args) {
         _cleanup_bus_error_free_ sd_bus_error error = SD_BUS_ERROR_NULL;
         int r;
@@ -1282,11 +1695,16 @@ static void help(void) {
                "Commands:\n"
                "  time                    Print time spent in the kernel\n"
                "  blame                   Print list of running units ordered by time to init\n"
+               "  readahead               Compare this boot with the recorded one without readahead\n"
                "  critical-chain          Print a tree of the time critical chain of units\n"
+               "  generators              Print list of generators ordered by time they took\n"
                "  plot                    Output SVG graphic showing service initialization\n"
                "  dot                     Output dependency graph in dot(1) format\n"
                "  set-log-level LEVEL     Set logging threshold for systemd\n"
                "  dump                    Output state serialization of service manager\n"
+               "  event-sources           Print dispatch statistics of the manager's event sources\n"
+               "  set-event-profiling BOOL\n"
+               "                          Turn event source statistics on or off\n"
                "  verify FILE...          Check unit files for correctness\n"
                , program_invocation_short_name);
 
@@ -1431,6 +1849,8 @@ int main(int argc, char *argv[]) {
                 r = verify_units(argv+optind+1,
                                  arg_user ? MANAGER_USER : MANAGER_SYSTEM,
                                  arg_man);
+        else if (streq_ptr(argv[optind], "readahead"))
+                r = analyze_readahead();
         else {
                 _cleanup_bus_flush_close_unref_ sd_bus *bus = NULL;
 
@@ -1446,6 +1866,8 @@ int main(int argc, char *argv[]) {
                         r = analyze_blame(bus);
                 else if (streq(argv[optind], "critical-chain"))
                         r = analyze_critical_chain(bus, argv+optind+1);
+                else if (streq(argv[optind], "generators"))
+                        r = generators(bus, argv+optind+1);
                 else if (streq(argv[optind], "plot"))
                         r = analyze_plot(bus);
                 else if (streq(argv[optind], "dot"))
@@ -1454,6 +1876,10 @@ int main(int argc, char *argv[]) {
                         r = dump(bus, argv+optind+1);
                 else if (streq(argv[optind], "set-log-level"))
                         r = set_log_level(bus, argv+optind+1);
+                else if (streq(argv[optind], "event-sources"))
+                        r = event_sources(bus, argv+optind+1);
+                else if (streq(argv[optind], "set-event-profiling"))
+                        r = set_event_profiling(bus, argv+optind+1);
                 else
                         log_error("Unknown operation '%s'.", argv[optind]);
         }
@@ -166,7 +166,7 @@ int main(int argc, char *argv[]) {
         } else {
                 char **l;
 
-                r = ask_password_agent(arg_message, arg_icon, arg_id, timeout,
+                r = ask_password_agent(arg_message, arg_icon, arg_id, NULL, timeout,
                                        arg_echo, arg_accept_cached, &l);
                 if (r >= 0) {
                         char **p;
@@ -982,6 +982,107 @@ static int find_next(const CalendarSpec *spec, struct tm *tm) {
         }
 }
 
+static int find_next_time_of_day(const CalendarSpec *spec, int *hour, int *minute, int *second) {
+        int h, m, s, r;
+
+        assert(spec);
+        assert(hour);
+        assert(minute);
+        assert(second);
+
+        /* Same as the time part of find_next(), but on plain
+         * integers, without mktime() normalization */
+
+        h = *hour;
+        m = *minute;
+        s = *second;
+
+        for (;;) {
+                r = find_matching_component(spec->hour, &h);
+                if (r < 0 || h >= 24)
+                        return -ENOENT;
+                if (r > 0)
+                        m = s = 0;
+
+                r = find_matching_component(spec->minute, &m);
+                if (r < 0 || m >= 60) {
+                        h++;
+                        m = s = 0;
+                        continue;
+                }
+                if (r > 0)
+                        s = 0;
+
+                r = find_matching_component(spec->second, &s);
+                if (r < 0 || s >= 60) {
+                        s = 0;
+                        if (++m >= 60) {
+                                h++;
+                                m = 0;
+                        }
+                        continue;
+                }
+
+                *hour = h;
+                *minute = m;
+                *second = s;
+                return 0;
+        }
+}
+
+static int find_next_fast(const CalendarSpec *spec, time_t t, const struct tm *tm, time_t *ret) {
+        time_t midnight;
+        unsigned d;
+
+        assert(spec);
+        assert(tm);
+        assert(ret);
+
+        /* Specs that don't restrict year, month or day (minutely,
+         * hourly, daily, weekly, "*:0/15", "Mon-Fri 9:00", ...) match
+         * on one of the next eight days. Find the time of day
+         * arithmetically, assuming the UTC offset of now, and then
+         * check the assumption with a single localtime_r(). If a DST
+         * change lies in between, the caller takes the slow path. */
+
+        if (spec->year || spec->month || spec->day)
+                return -EOPNOTSUPP;
+
+        midnight = t - (tm->tm_hour * 3600 + tm->tm_min * 60 + tm->tm_sec);
+
+        for (d = 0; d < 8; d++) {
+                int h = 0, m = 0, s = 0, wday;
+                struct tm check;
+                time_t candidate;
+
+                wday = (tm->tm_wday + d) % 7;
+                if (spec->weekdays_bits >= 0 && spec->weekdays_bits < BITS_WEEKDAYS &&
+                    !(spec->weekdays_bits & (1 << (wday == 0 ? 6 : wday - 1))))
+                        continue;
+
+                if (d == 0) {
+                        h = tm->tm_hour;
+                        m = tm->tm_min;
+                        s = tm->tm_sec;
+                }
+
+                if (find_next_time_of_day(spec, &h, &m, &s) < 0)
+                        continue;
+
+                candidate = midnight + (time_t) d * 86400 + h * 3600 + m * 60 + s;
+
+                if (!localtime_r(&candidate, &check) ||
+                    check.tm_gmtoff != tm->tm_gmtoff ||
+                    check.tm_hour != h || check.tm_min != m || check.tm_sec != s)
+                        return -EOPNOTSUPP;
+
+                *ret = candidate;
+                return 0;
+        }
+
+        return -ENOENT;
+}
+
 int calendar_spec_next_usec(const CalendarSpec *spec, usec_t usec, usec_t *next) {
         struct tm tm;
         time_t t;
@@ -993,6 +1094,14 @@ int calendar_spec_next_usec(const CalendarSpec *spec, usec_t usec, usec_t *next)
         t = (time_t) (usec / USEC_PER_SEC) + 1;
         assert_se(localtime_r(&t, &tm));
 
+        r = find_next_fast(spec, t, &tm, &t);
+        if (r >= 0) {
+                *next = (usec_t) t * USEC_PER_SEC;
+                return 0;
+        }
+        if (r != -EOPNOTSUPP)
+                return r;
+
         r = find_next(spec, &tm);
         if (r < 0)
                 return r;
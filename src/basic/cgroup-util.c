@@ -1151,12 +1151,28 @@ int cg_mangle_path(const char *path, char **result) {
         return cg_get_path(c ?: SYSTEMD_CGROUP_CONTROLLER, p ?: "/", NULL, result);
 }
 
+/* The root path, derived from PID 1's cgroup, which doesn't change
+ * while we run. It is needed for every shifted lookup, and each of
+ * the cg_pid_get_xyz() calls would otherwise parse /proc/1/cgroup in
+ * addition to the cgroup file of the PID asked for. */
+static char *root_path_cache = NULL;
+
 int cg_get_root_path(char **path) {
-        char *p, *e;
+        char *p, *e, *c;
         int r;
 
         assert(path);
 
+        c = root_path_cache;
+        if (c) {
+                p = strdup(c);
+                if (!p)
+                        return -ENOMEM;
+
+                *path = p;
+                return 0;
+        }
+
         r = cg_pid_get_path(SYSTEMD_CGROUP_CONTROLLER, 1, &p);
         if (r < 0)
                 return r;
@@ -1169,6 +1185,11 @@ int cg_get_root_path(char **path) {
         if (e)
                 *e = 0;
 
+        /* If another thread was quicker, keep its copy */
+        c = strdup(p);
+        if (c && !__sync_bool_compare_and_swap(&root_path_cache, NULL, c))
+                free(c);
+
         *path = p;
         return 0;
 }
@@ -48,6 +48,13 @@
 
 #define REBOOT_PARAM_FILE "/run/systemd/reboot-param"
 
+#define CGROUPS_AGENT_SOCKET "/run/systemd/cgroups-agent"
+
+#define READAHEAD_PACK "/.readahead"
+#define READAHEAD_RUNTIME_DIR "/run/systemd/readahead"
+#define READAHEAD_DONE_FILE READAHEAD_RUNTIME_DIR "/done"
+#define READAHEAD_REPLAY_FILE READAHEAD_RUNTIME_DIR "/replay"
+
 #ifdef HAVE_SPLIT_USR
 #define KBD_KEYMAP_DIRS                         \
         "/usr/share/keymaps/\0"                 \
@@ -215,18 +215,60 @@ int read_full_file(const char *fn, char **contents, size_t *size) {
         return read_full_stream(f, contents, size);
 }
 
+static int parse_env_line_simple(
+                const char *fname,
+                unsigned line,
+                char *p,
+                size_t n,
+                int (*push) (const char *filename, unsigned line,
+                             const char *key, const char *value, void *userdata, int *n_pushed),
+                void *userdata,
+                int *n_pushed) {
+
+        char *end = p + n, *e, *k, *v;
+
+        /* Parses a line without quotes or backslashes, the first
+         * character of which is not whitespace. Key and value are
+         * terminated in place. The key may start with '=', as the
+         * state machine would have it. */
+
+        assert(p);
+        assert(n > 0);
+
+        if (strchr(COMMENTS, *p))
+                return 0;
+
+        e = memchr(p + 1, '=', n - 1);
+        if (!e)
+                return 0;
+
+        for (v = e + 1; v < end && strchr(WHITESPACE, *v); v++)
+                ;
+
+        for (k = e; k > p && strchr(WHITESPACE, k[-1]); k--)
+                ;
+        *k = 0;
+
+        for (e = end; e > v && strchr(WHITESPACE, e[-1]); e--)
+                ;
+        *e = 0;
+
+        return push(fname, line, p, *v ? v : NULL, userdata, n_pushed);
+}
+
 static int parse_env_file_internal(
                 FILE *f,
                 const char *fname,
                 const char *newline,
                 int (*push) (const char *filename, unsigned line,
-                             const char *key, char *value, void *userdata, int *n_pushed),
+                             const char *key, const char *value, void *userdata, int *n_pushed),
                 void *userdata,
                 int *n_pushed) {
 
-        _cleanup_free_ char *contents = NULL, *key = NULL;
+        _cleanup_free_ char *contents = NULL, *key = NULL, *value = NULL;
         size_t key_alloc = 0, n_key = 0, value_alloc = 0, n_value = 0, last_value_whitespace = (size_t) -1, last_key_whitespace = (size_t) -1;
-        char *p, *value = NULL;
+        const char *special;
+        char *p;
         int r;
         unsigned line = 1;
 
@@ -253,8 +295,42 @@ static int parse_env_file_internal(
         if (r < 0)
                 return r;
 
+        special = strjoina(newline, "\\\'\"");
+
         for (p = contents; *p; p++) {
-                char c = *p;
+                char c;
+
+                if (state == PRE_KEY) {
+                        size_t n;
+
+                        /* Most lines contain neither quotes nor
+                         * escapes. Split those off in one go and
+                         * hand out key and value in place, without
+                         * going through the state machine. */
+                        p += strspn(p, WHITESPACE);
+                        if (!*p)
+                                break;
+
+                        n = strcspn(p, special);
+                        if (p[n] == 0 || strchr(newline, p[n])) {
+                                bool eol = p[n] != 0;
+
+                                if (eol)
+                                        line ++;
+
+                                r = parse_env_line_simple(fname, line, p, n, push, userdata, n_pushed);
+                                if (r < 0)
+                                        return r;
+
+                                p += n;
+                                if (!eol)
+                                        break;
+
+                                continue;
+                        }
+                }
+
+                c = *p;
 
                 switch (state) {
 
@@ -265,10 +341,8 @@ static int parse_env_file_internal(
                                 state = KEY;
                                 last_key_whitespace = (size_t) -1;
 
-                                if (!GREEDY_REALLOC(key, key_alloc, n_key+2)) {
-                                        r = -ENOMEM;
-                                        goto fail;
-                                }
+                                if (!GREEDY_REALLOC(key, key_alloc, n_key+2))
+                                        return -ENOMEM;
 
                                 key[n_key++] = c;
                         }
@@ -288,10 +362,8 @@ static int parse_env_file_internal(
                                 else if (last_key_whitespace == (size_t) -1)
                                          last_key_whitespace = n_key;
 
-                                if (!GREEDY_REALLOC(key, key_alloc, n_key+2)) {
-                                        r = -ENOMEM;
-                                        goto fail;
-                                }
+                                if (!GREEDY_REALLOC(key, key_alloc, n_key+2))
+                                        return -ENOMEM;
 
                                 key[n_key++] = c;
                         }
@@ -311,13 +383,11 @@ static int parse_env_file_internal(
                                 if (last_key_whitespace != (size_t) -1)
                                         key[last_key_whitespace] = 0;
 
-                                r = push(fname, line, key, value, userdata, n_pushed);
+                                r = push(fname, line, key, n_value > 0 ? value : NULL, userdata, n_pushed);
                                 if (r < 0)
-                                        goto fail;
+                                        return r;
 
-                                n_key = 0;
-                                value = NULL;
-                                value_alloc = n_value = 0;
+                                n_key = n_value = 0;
 
                         } else if (c == '\'')
                                 state = SINGLE_QUOTE_VALUE;
@@ -328,10 +398,8 @@ static int parse_env_file_internal(
                         else if (!strchr(WHITESPACE, c)) {
                                 state = VALUE;
 
-                                if (!GREEDY_REALLOC(value, value_alloc, n_value+2)) {
-                                        r = -ENOMEM;
-                                        goto fail;
-                                }
+                                if (!GREEDY_REALLOC(value, value_alloc, n_value+2))
+                                        return -ENOMEM;
 
                                 value[n_value++] = c;
                         }
@@ -356,13 +424,11 @@ static int parse_env_file_internal(
                                 if (last_key_whitespace != (size_t) -1)
                                         key[last_key_whitespace] = 0;
 
-                                r = push(fname, line, key, value, userdata, n_pushed);
+                                r = push(fname, line, key, n_value > 0 ? value : NULL, userdata, n_pushed);
                                 if (r < 0)
-                                        goto fail;
+                                        return r;
 
-                                n_key = 0;
-                                value = NULL;
-                                value_alloc = n_value = 0;
+                                n_key = n_value = 0;
 
                         } else if (c == '\\') {
                                 state = VALUE_ESCAPE;
@@ -373,10 +439,8 @@ static int parse_env_file_internal(
                                 else if (last_value_whitespace == (size_t) -1)
                                         last_value_whitespace = n_value;
 
-                                if (!GREEDY_REALLOC(value, value_alloc, n_value+2)) {
-                                        r = -ENOMEM;
-                                        goto fail;
-                                }
+                                if (!GREEDY_REALLOC(value, value_alloc, n_value+2))
+                                        return -ENOMEM;
 
                                 value[n_value++] = c;
                         }
@@ -388,10 +452,8 @@ static int parse_env_file_internal(
 
                         if (!strchr(newline, c)) {
                                 /* Escaped newlines we eat up entirely */
-                                if (!GREEDY_REALLOC(value, value_alloc, n_value+2)) {
-                                        r = -ENOMEM;
-                                        goto fail;
-                                }
+                                if (!GREEDY_REALLOC(value, value_alloc, n_value+2))
+                                        return -ENOMEM;
 
                                 value[n_value++] = c;
                         }
@@ -403,10 +465,8 @@ static int parse_env_file_internal(
                         else if (c == '\\')
                                 state = SINGLE_QUOTE_VALUE_ESCAPE;
                         else {
-                                if (!GREEDY_REALLOC(value, value_alloc, n_value+2)) {
-                                        r = -ENOMEM;
-                                        goto fail;
-                                }
+                                if (!GREEDY_REALLOC(value, value_alloc, n_value+2))
+                                        return -ENOMEM;
 
                                 value[n_value++] = c;
                         }
@@ -417,10 +477,8 @@ static int parse_env_file_internal(
                         state = SINGLE_QUOTE_VALUE;
 
                         if (!strchr(newline, c)) {
-                                if (!GREEDY_REALLOC(value, value_alloc, n_value+2)) {
-                                        r = -ENOMEM;
-                                        goto fail;
-                                }
+                                if (!GREEDY_REALLOC(value, value_alloc, n_value+2))
+                                        return -ENOMEM;
 
                                 value[n_value++] = c;
                         }
@@ -432,10 +490,8 @@ static int parse_env_file_internal(
                         else if (c == '\\')
                                 state = DOUBLE_QUOTE_VALUE_ESCAPE;
                         else {
-                                if (!GREEDY_REALLOC(value, value_alloc, n_value+2)) {
-                                        r = -ENOMEM;
-                                        goto fail;
-                                }
+                                if (!GREEDY_REALLOC(value, value_alloc, n_value+2))
+                                        return -ENOMEM;
 
                                 value[n_value++] = c;
                         }
@@ -446,10 +502,8 @@ static int parse_env_file_internal(
                         state = DOUBLE_QUOTE_VALUE;
 
                         if (!strchr(newline, c)) {
-                                if (!GREEDY_REALLOC(value, value_alloc, n_value+2)) {
-                                        r = -ENOMEM;
-                                        goto fail;
-                                }
+                                if (!GREEDY_REALLOC(value, value_alloc, n_value+2))
+                                        return -ENOMEM;
 
                                 value[n_value++] = c;
                         }
@@ -491,21 +545,17 @@ static int parse_env_file_internal(
                 if (last_key_whitespace != (size_t) -1)
                         key[last_key_whitespace] = 0;
 
-                r = push(fname, line, key, value, userdata, n_pushed);
+                r = push(fname, line, key, n_value > 0 ? value : NULL, userdata, n_pushed);
                 if (r < 0)
-                        goto fail;
+                        return r;
         }
 
         return 0;
-
-fail:
-        free(value);
-        return r;
 }
 
 static int parse_env_file_push(
                 const char *filename, unsigned line,
-                const char *key, char *value,
+                const char *key, const char *value,
                 void *userdata,
                 int *n_pushed) {
 
@@ -536,9 +586,18 @@ static int parse_env_file_push(
                 v = va_arg(aq, char **);
 
                 if (streq(key, k)) {
+                        char *t = NULL;
+
                         va_end(aq);
+
+                        if (value) {
+                                t = strdup(value);
+                                if (!t)
+                                        return -ENOMEM;
+                        }
+
                         free(*v);
-                        *v = value;
+                        *v = t;
 
                         if (n_pushed)
                                 (*n_pushed)++;
@@ -548,7 +607,6 @@ static int parse_env_file_push(
         }
 
         va_end(aq);
-        free(value);
 
         return 0;
 }
@@ -572,7 +630,7 @@ int parse_env_file(
 
 static int load_env_file_push(
                 const char *filename, unsigned line,
-                const char *key, char *value,
+                const char *key, const char *value,
                 void *userdata,
                 int *n_pushed) {
         char ***m = userdata;
@@ -604,7 +662,6 @@ static int load_env_file_push(
         if (n_pushed)
                 (*n_pushed)++;
 
-        free(value);
         return 0;
 }
 
@@ -627,7 +684,7 @@ int load_env_file(FILE *f, const char *fname, const char *newline, char ***rl) {
 
 static int load_env_file_push_pairs(
                 const char *filename, unsigned line,
-                const char *key, char *value,
+                const char *key, const char *value,
                 void *userdata,
                 int *n_pushed) {
         char ***m = userdata;
@@ -651,15 +708,9 @@ static int load_env_file_push_pairs(
         if (r < 0)
                 return -ENOMEM;
 
-        if (!value) {
-                r = strv_extend(m, "");
-                if (r < 0)
-                        return -ENOMEM;
-        } else {
-                r = strv_push(m, value);
-                if (r < 0)
-                        return r;
-        }
+        r = strv_extend(m, strempty(value));
+        if (r < 0)
+                return -ENOMEM;
 
         if (n_pushed)
                 (*n_pushed)++;
@@ -29,6 +29,7 @@
 #include "set.h"
 #include "macro.h"
 #include "siphash24.h"
+#include "MurmurHash2.h"
 #include "strv.h"
 #include "mempool.h"
 #include "random-util.h"
@@ -37,6 +38,14 @@
 #include "list.h"
 #endif
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define DIB_GROUP_SIZE 16U
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define DIB_GROUP_SIZE 16U
+#endif
+
 /*
  * Implementation of hashmaps.
  * Addressing: open
@@ -48,6 +57,12 @@
  * Probe sequence: linear
  *   - though theoretically worse than random probing/uniform hashing/double
  *     hashing, it is good for cache locality.
+ * Probing: grouped
+ *   - where SSE2 or NEON is available, the DIB bytes are inspected 16 at a
+ *     time, much like the control bytes of Swiss tables. Since the DIB of
+ *     an entry at distance d from our initial bucket must be exactly d for
+ *     it to be a candidate, a single vector compare against d, d+1, ...
+ *     finds both the candidates and the end of the probe sequence.
  *
  * References:
  * Celis, P. 1986. Robin Hood Hashing.
@@ -224,6 +239,7 @@ struct HashmapBase {
         unsigned n_direct_entries:3; /* Number of entries in direct storage.
                                       * Only valid if !has_indirect. */
         bool from_pool:1;            /* whether was allocated from mempool */
+        bool storage_from_pool:1;    /* whether indirect storage was allocated from storage_pool */
         HASHMAP_DEBUG_FIELDS         /* optional hashmap_debug_info */
 };
 
@@ -248,6 +264,10 @@ DEFINE_MEMPOOL(ordered_hashmap_pool, OrderedHashmap, 8);
 /* No need for a separate Set pool */
 assert_cc(sizeof(Hashmap) == sizeof(Set));
 
+/* Indirect storage is always a power of two in size, so only the
+ * smallest tables end up in the 128 and 256 byte classes. */
+static DEFINE_MEMPOOL_CLASSES(storage_pool, 16);
+
 struct hashmap_type_info {
         size_t head_size;
         size_t entry_size;
@@ -291,6 +311,18 @@ const struct hash_ops string_hash_ops = {
         .compare = string_compare_func
 };
 
+unsigned long fast_string_hash_func(const void *p, const uint8_t hash_key[HASH_KEY_SIZE]) {
+        uint32_t seed;
+
+        memcpy(&seed, hash_key, sizeof(seed));
+        return MurmurHash2(p, strlen(p), seed);
+}
+
+const struct hash_ops fast_string_hash_ops = {
+        .hash = fast_string_hash_func,
+        .compare = string_compare_func
+};
+
 unsigned long trivial_hash_func(const void *p, const uint8_t hash_key[HASH_KEY_SIZE]) {
         uint64_t u;
         siphash24((uint8_t*) &u, &p, sizeof(p), hash_key);
@@ -373,6 +405,20 @@ static char *storage_ptr(HashmapBase *h) {
                                : h->direct.storage;
 }
 
+static size_t storage_size(HashmapBase *h) {
+        assert(h->has_indirect);
+
+        /* resize_buckets() fits as many buckets as possible into a power of two */
+        return 1U << log2u_round_up(n_buckets(h) * (hashmap_type_info[h->type].entry_size + sizeof(dib_raw_t)));
+}
+
+static void storage_free(HashmapBase *h) {
+        if (h->storage_from_pool)
+                mempool_classes_free(&storage_pool, h->indirect.storage, storage_size(h));
+        else
+                free(h->indirect.storage);
+}
+
 static uint8_t *hash_key(HashmapBase *h) {
         return h->has_indirect ? h->indirect.hash_key
                                : shared_hash_key;
@@ -383,6 +429,18 @@ static unsigned base_bucket_hash(HashmapBase *h, const void *p) {
 }
 #define bucket_hash(h, p) base_bucket_hash(HASHMAP_BASE(h), p)
 
+size_t hashmap_trim_pools(void) {
+        size_t n;
+
+        assert(is_main_thread());
+
+        n = mempool_trim(&hashmap_pool);
+        n += mempool_trim(&ordered_hashmap_pool);
+        n += mempool_classes_trim(&storage_pool);
+
+        return n;
+}
+
 static void get_hash_key(uint8_t hash_key[HASH_KEY_SIZE], bool reuse_is_ok) {
         static uint8_t current[HASH_KEY_SIZE];
         static bool current_initialized = false;
@@ -473,11 +531,86 @@ static void bucket_set_dib(HashmapBase *h, unsigned idx, unsigned dib) {
         dib_raw_ptr(h)[idx] = dib != DIB_FREE ? MIN(dib, DIB_RAW_OVERFLOW) : DIB_RAW_FREE;
 }
 
+#ifdef DIB_GROUP_SIZE
+#if defined(__SSE2__)
+static unsigned dib_group_mask(__m128i v) {
+        return (unsigned) _mm_movemask_epi8(v);
+}
+#else
+static unsigned dib_group_mask(uint8x16_t v) {
+        static const uint8_t bits[16] = { 1, 2, 4, 8, 16, 32, 64, 128,
+                                          1, 2, 4, 8, 16, 32, 64, 128 };
+        uint8x16_t m;
+
+        m = vandq_u8(v, vld1q_u8(bits));
+        return vaddv_u8(vget_low_u8(m)) | ((unsigned) vaddv_u8(vget_high_u8(m)) << 8);
+}
+#endif
+
+/*
+ * Inspects DIB_GROUP_SIZE consecutive DIB bytes. The first one is expected
+ * to hold 'distance' if the probe sequence continues through it, the next
+ * one 'distance + 1', and so on.
+ * Returns: a bitmask of the buckets where the probe sequence ends, i.e.
+ *          free buckets, buckets yet to be rehashed and wealthier entries.
+ *          In *ret_match, a bitmask of the buckets at exactly the expected
+ *          distance.
+ * Caller must ensure: distance + DIB_GROUP_SIZE <= DIB_RAW_OVERFLOW, so that
+ *                     overflowed DIBs are never mistaken for a match.
+ */
+static unsigned dib_group_probe(const dib_raw_t *dibs, unsigned distance, unsigned *ret_match) {
+#if defined(__SSE2__)
+        __m128i d, expect;
+
+        d = _mm_loadu_si128((const __m128i*) dibs);
+        expect = _mm_add_epi8(_mm_set1_epi8((char) distance),
+                              _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15));
+
+        *ret_match = dib_group_mask(_mm_cmpeq_epi8(d, expect));
+
+        /* unsigned d < expect, or d >= DIB_RAW_REHASH */
+        return (dib_group_mask(_mm_cmpeq_epi8(_mm_max_epu8(d, expect), expect)) & ~*ret_match) |
+               dib_group_mask(_mm_cmpeq_epi8(_mm_max_epu8(d, _mm_set1_epi8((char) DIB_RAW_REHASH)), d));
+#else
+        static const uint8_t lanes[16] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 };
+        uint8x16_t d, expect;
+
+        d = vld1q_u8(dibs);
+        expect = vaddq_u8(vdupq_n_u8((uint8_t) distance), vld1q_u8(lanes));
+
+        *ret_match = dib_group_mask(vceqq_u8(d, expect));
+
+        return dib_group_mask(vorrq_u8(vcltq_u8(d, expect),
+                                       vcgeq_u8(d, vdupq_n_u8(DIB_RAW_REHASH))));
+#endif
+}
+
+/* Returns: a bitmask of the buckets in use among DIB_GROUP_SIZE consecutive ones. */
+static unsigned dib_group_used(const dib_raw_t *dibs) {
+#if defined(__SSE2__)
+        return ~dib_group_mask(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) dibs),
+                                              _mm_set1_epi8((char) DIB_RAW_FREE))) & 0xffffU;
+#else
+        return ~dib_group_mask(vceqq_u8(vld1q_u8(dibs), vdupq_n_u8(DIB_RAW_FREE))) & 0xffffU;
+#endif
+}
+#endif
+
 static unsigned skip_free_buckets(HashmapBase *h, unsigned idx) {
         dib_raw_t *dibs;
 
         dibs = dib_raw_ptr(h);
 
+#ifdef DIB_GROUP_SIZE
+        for ( ; idx + DIB_GROUP_SIZE <= n_buckets(h); idx += DIB_GROUP_SIZE) {
+                unsigned used;
+
+                used = dib_group_used(dibs + idx);
+                if (used)
+                        return idx + __builtin_ctz(used);
+        }
+#endif
+
         for ( ; idx < n_buckets(h); idx++)
                 if (dibs[idx] != DIB_RAW_FREE)
                         return idx;
@@ -918,7 +1051,7 @@ void internal_hashmap_clear(HashmapBase *h) {
                 return;
 
         if (h->has_indirect) {
-                free(h->indirect.storage);
+                storage_free(h);
                 h->has_indirect = false;
         }
 
@@ -982,7 +1115,25 @@ static bool hashmap_put_robin_hood(HashmapBase *h, unsigned idx,
 
         dibs = dib_raw_ptr(h);
 
-        for (distance = 0; ; distance++) {
+        for (distance = 0; ; distance++, idx = next_idx(h, idx)) {
+#ifdef DIB_GROUP_SIZE
+                if (idx + DIB_GROUP_SIZE <= n_buckets(h) &&
+                    distance + DIB_GROUP_SIZE <= DIB_RAW_OVERFLOW) {
+                        unsigned match, stop;
+
+                        /* Skip ahead over entries that are not wealthier than us. */
+                        stop = dib_group_probe(dibs + idx, distance, &match);
+                        if (stop == 0) {
+                                idx = (idx + DIB_GROUP_SIZE - 1) % n_buckets(h);
+                                distance += DIB_GROUP_SIZE - 1;
+                                continue;
+                        }
+
+                        idx += __builtin_ctz(stop);
+                        distance += __builtin_ctz(stop);
+                }
+#endif
+
                 raw_dib = dibs[idx];
                 if (raw_dib == DIB_RAW_FREE || raw_dib == DIB_RAW_REHASH) {
                         if (raw_dib == DIB_RAW_REHASH)
@@ -1014,8 +1165,6 @@ static bool hashmap_put_robin_hood(HashmapBase *h, unsigned idx,
 
                         distance = dib;
                 }
-
-                idx = next_idx(h, idx);
         }
 }
 
@@ -1091,7 +1240,7 @@ static int resize_buckets(HashmapBase *h, unsigned entries_add) {
         unsigned idx, optimal_idx;
         unsigned old_n_buckets, new_n_buckets, n_rehashed, new_n_entries;
         uint8_t new_shift;
-        bool rehash_next;
+        bool rehash_next, use_pool;
 
         assert(h);
 
@@ -1127,14 +1276,24 @@ static int resize_buckets(HashmapBase *h, unsigned entries_add) {
                         new_n_buckets * (hi->entry_size + sizeof(dib_raw_t)),
                         2 * sizeof(struct direct_storage)));
 
-        /* Realloc storage (buckets and DIB array). */
-        new_storage = realloc(h->has_indirect ? h->indirect.storage : NULL,
-                              1U << new_shift);
+        /* Realloc storage (buckets and DIB array). Like the hashmap
+         * heads, small storage is only pooled on the main thread. */
+        use_pool = !h->has_indirect && is_main_thread();
+        if (use_pool)
+                new_storage = mempool_classes_alloc(&storage_pool, 1U << new_shift);
+        else if (!h->has_indirect)
+                new_storage = malloc(1U << new_shift);
+        else if (h->storage_from_pool)
+                new_storage = mempool_classes_realloc(&storage_pool, h->indirect.storage,
+                                                      storage_size(h), 1U << new_shift);
+        else
+                new_storage = realloc(h->indirect.storage, 1U << new_shift);
         if (!new_storage)
                 return -ENOMEM;
 
         /* Must upgrade direct to indirect storage. */
         if (!h->has_indirect) {
+                h->storage_from_pool = use_pool;
                 memcpy(new_storage, h->direct.storage,
                        old_n_buckets * (hi->entry_size + sizeof(dib_raw_t)));
                 h->indirect.n_entries = h->n_direct_entries;
@@ -1229,6 +1388,32 @@ static unsigned base_bucket_scan(HashmapBase *h, unsigned idx, const void *key)
         assert(idx < n_buckets(h));
 
         for (distance = 0; ; distance++) {
+#ifdef DIB_GROUP_SIZE
+                /* No DIB_RAW_REHASH entries exist outside of resize_buckets(),
+                 * so every stop in the group really ends the probe sequence. */
+                if (idx + DIB_GROUP_SIZE <= n_buckets(h) &&
+                    distance + DIB_GROUP_SIZE <= DIB_RAW_OVERFLOW) {
+                        unsigned match, stop;
+
+                        stop = dib_group_probe(dibs + idx, distance, &match);
+                        if (stop)
+                                match &= (stop & -stop) - 1;
+
+                        for (; match; match &= match - 1) {
+                                e = bucket_at(h, idx + __builtin_ctz(match));
+                                if (h->hash_ops->compare(e->key, key) == 0)
+                                        return idx + __builtin_ctz(match);
+                        }
+
+                        if (stop)
+                                return IDX_NIL;
+
+                        idx = (idx + DIB_GROUP_SIZE) % n_buckets(h);
+                        distance += DIB_GROUP_SIZE - 1;
+                        continue;
+                }
+#endif
+
                 if (dibs[idx] == DIB_RAW_FREE)
                         return IDX_NIL;
 
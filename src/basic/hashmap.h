@@ -79,6 +79,14 @@ unsigned long string_hash_func(const void *p, const uint8_t hash_key[HASH_KEY_SI
 int string_compare_func(const void *a, const void *b) _pure_;
 extern const struct hash_ops string_hash_ops;
 
+/* Like string_hash_ops, but uses MurmurHash2 instead of SipHash. This
+ * is considerably cheaper for short keys, but it is not designed to
+ * withstand hash flooding even though it is seeded from the hashmap's
+ * key. Only use it for maps whose keys come from trusted, internal
+ * sources, never for anything clients or the network can fill. */
+unsigned long fast_string_hash_func(const void *p, const uint8_t hash_key[HASH_KEY_SIZE]) _pure_;
+extern const struct hash_ops fast_string_hash_ops;
+
 /* This will compare the passed pointers directly, and will not
  * dereference them. This is hence not useful for strings or
  * suchlike. */
@@ -139,6 +147,10 @@ extern const struct hash_ops devt_hash_ops = {
 # define HASHMAP_DEBUG_PASS_ARGS
 #endif
 
+/* Returns pool memory that no hashmap uses anymore to the allocator.
+ * Must be called on the main thread. Returns the number of bytes freed. */
+size_t hashmap_trim_pools(void);
+
 Hashmap *internal_hashmap_new(const struct hash_ops *hash_ops  HASHMAP_DEBUG_PARAMS);
 OrderedHashmap *internal_ordered_hashmap_new(const struct hash_ops *hash_ops  HASHMAP_DEBUG_PARAMS);
 #define hashmap_new(ops) internal_hashmap_new(ops  HASHMAP_DEBUG_SRC_ARGS)
@@ -42,6 +42,18 @@
 
 #define SNDBUF_SIZE (8*1024*1024)
 
+/* While buffering is enabled, messages for the journal are collected
+ * here and sent with a single sendmmsg() by log_flush() */
+#define LOG_BUFFER_MESSAGES_MAX 64U
+#define LOG_BUFFER_SIZE_MAX (64U*1024U)
+
+typedef struct BufferedMessage {
+        int level;
+        size_t offset;
+        size_t size;
+        size_t message_offset;
+} BufferedMessage;
+
 static LogTarget log_target = LOG_TARGET_CONSOLE;
 static int log_max_level = LOG_INFO;
 static int log_facility = LOG_DAEMON;
@@ -58,6 +70,13 @@ static bool show_location = false;
 
 static bool upgrade_syslog_to_journal = false;
 
+static bool log_buffered = false;
+static pid_t log_buffer_pid = 0;
+static char log_buffer[LOG_BUFFER_SIZE_MAX];
+static size_t log_buffer_size = 0;
+static BufferedMessage log_buffer_messages[LOG_BUFFER_MESSAGES_MAX];
+static unsigned log_buffer_n_messages = 0;
+
 /* Akin to glibc's __abort_msg; which is private and we hence cannot
  * use here. */
 static char *log_abort_msg = NULL;
@@ -289,6 +308,8 @@ void log_set_target(LogTarget target) {
 }
 
 void log_close(void) {
+        log_flush();
+
         log_close_journal();
         log_close_syslog();
         log_close_kmsg();
@@ -297,6 +318,11 @@ void log_close(void) {
 
 void log_forget_fds(void) {
         console_fd = kmsg_fd = syslog_fd = journal_fd = -1;
+
+        /* What is buffered belongs to the parent */
+        log_buffered = false;
+        log_buffer_n_messages = 0;
+        log_buffer_size = 0;
 }
 
 void log_set_max_level(int level) {
@@ -503,6 +529,124 @@ static int log_do_header(
         return 0;
 }
 
+static bool log_buffer_owned(void) {
+
+        /* A forked off child must neither send what its parent
+         * buffered, nor buffer itself, as it might exit or exec
+         * without flushing */
+
+        if (log_buffer_pid == getpid())
+                return true;
+
+        log_buffered = false;
+        log_buffer_n_messages = 0;
+        log_buffer_size = 0;
+
+        return false;
+}
+
+static int log_buffer_message(int level, const char *header, const char *buffer) {
+        BufferedMessage *m;
+        size_t h, b, size;
+        char *p;
+
+        h = strlen(header);
+        b = strlen(buffer);
+        size = h + strlen("MESSAGE=") + b + 1;
+
+        if (size > LOG_BUFFER_SIZE_MAX)
+                return 0;
+
+        if (log_buffer_n_messages >= LOG_BUFFER_MESSAGES_MAX ||
+            log_buffer_size + size > LOG_BUFFER_SIZE_MAX)
+                log_flush();
+
+        m = log_buffer_messages + log_buffer_n_messages++;
+        m->level = level;
+        m->offset = log_buffer_size;
+        m->size = size;
+        m->message_offset = m->offset + h + strlen("MESSAGE=");
+
+        p = mempcpy(log_buffer + m->offset, header, h);
+        p = mempcpy(p, "MESSAGE=", strlen("MESSAGE="));
+        p = mempcpy(p, buffer, b);
+        *p = '\n';
+
+        log_buffer_size += size;
+
+        return 1;
+}
+
+void log_flush(void) {
+        struct mmsghdr mmsg[LOG_BUFFER_MESSAGES_MAX] = {};
+        struct iovec iovec[LOG_BUFFER_MESSAGES_MAX];
+        unsigned i, n = 0;
+
+        if (log_buffer_n_messages <= 0)
+                return;
+
+        if (!log_buffer_owned())
+                return;
+
+        for (i = 0; i < log_buffer_n_messages; i++) {
+                iovec[i].iov_base = log_buffer + log_buffer_messages[i].offset;
+                iovec[i].iov_len = log_buffer_messages[i].size;
+
+                mmsg[i].msg_hdr.msg_iov = iovec + i;
+                mmsg[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        while (journal_fd >= 0 && n < log_buffer_n_messages) {
+                int k;
+
+                k = sendmmsg(journal_fd, mmsg + n, log_buffer_n_messages - n, MSG_NOSIGNAL);
+                if (k < 0) {
+                        if (errno != EAGAIN)
+                                log_close_journal();
+                        log_open_kmsg();
+                        break;
+                }
+
+                n += k;
+        }
+
+        /* Whatever didn't make it to the journal goes where
+         * log_dispatch() would have put it */
+        for (i = n; i < log_buffer_n_messages; i++) {
+                BufferedMessage *m = log_buffer_messages + i;
+                char *text = log_buffer + m->message_offset;
+                int k = 0;
+
+                /* Replace the trailing newline */
+                log_buffer[m->offset + m->size - 1] = 0;
+
+                if (log_target == LOG_TARGET_AUTO ||
+                    log_target == LOG_TARGET_JOURNAL_OR_KMSG) {
+
+                        k = write_to_kmsg(m->level, 0, NULL, 0, NULL, NULL, NULL, text);
+                        if (k < 0) {
+                                log_close_kmsg();
+                                log_open_console();
+                        }
+                }
+
+                if (k <= 0)
+                        (void) write_to_console(m->level, 0, NULL, 0, NULL, NULL, NULL, text);
+        }
+
+        log_buffer_n_messages = 0;
+        log_buffer_size = 0;
+}
+
+void log_set_buffered(bool b) {
+
+        if (!b)
+                log_flush();
+
+        log_buffered = b;
+        log_buffer_pid = getpid();
+}
+
 static int write_to_journal(
                 int level,
                 int error,
@@ -522,6 +666,18 @@ static int write_to_journal(
 
         log_do_header(header, sizeof(header), level, error, file, line, func, object_field, object);
 
+        /* Warnings and anything more important go out right away,
+         * after what was buffered before */
+        if (log_buffered &&
+            LOG_PRI(level) > LOG_WARNING &&
+            log_buffer_owned() &&
+            log_buffer_message(level, header, buffer) > 0)
+                return 1;
+
+        log_flush();
+        if (journal_fd < 0)
+                return 0;
+
         IOVEC_SET_STRING(iovec[0], header);
         IOVEC_SET_STRING(iovec[1], "MESSAGE=");
         IOVEC_SET_STRING(iovec[2], buffer);
@@ -865,6 +1021,9 @@ int log_struct_internal(
 
                 mh.msg_iovlen = n;
 
+                /* Keep the order with what was buffered before */
+                log_flush();
+
                 (void) sendmsg(journal_fd, &mh, MSG_NOSIGNAL);
 
         finish:
@@ -73,6 +73,11 @@ void log_close_journal(void);
 void log_close_kmsg(void);
 void log_close_console(void);
 
+/* Only for single-threaded programs that call log_flush() regularly,
+ * e.g. before waiting in their event loop */
+void log_set_buffered(bool b);
+void log_flush(void);
+
 void log_parse_environment(void);
 
 int log_internal(
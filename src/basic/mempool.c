@@ -28,8 +28,18 @@ struct pool {
         struct pool *next;
         unsigned n_tiles;
         unsigned n_used;
+        unsigned n_free;  /* only valid during mempool_trim() */
 };
 
+static uint8_t *pool_first_tile(struct pool *p) {
+        return ((uint8_t*) p) + ALIGN(sizeof(struct pool));
+}
+
+static bool pool_contains(struct mempool *mp, struct pool *p, void *tile) {
+        return (uint8_t*) tile >= pool_first_tile(p) &&
+               (uint8_t*) tile < pool_first_tile(p) + p->n_used * mp->tile_size;
+}
+
 void* mempool_alloc_tile(struct mempool *mp) {
         unsigned i;
 
@@ -71,7 +81,7 @@ void* mempool_alloc_tile(struct mempool *mp) {
 
         i = mp->first_pool->n_used++;
 
-        return ((uint8_t*) mp->first_pool) + ALIGN(sizeof(struct pool)) + i*mp->tile_size;
+        return pool_first_tile(mp->first_pool) + i*mp->tile_size;
 }
 
 void* mempool_alloc0_tile(struct mempool *mp) {
@@ -88,8 +98,6 @@ void mempool_free_tile(struct mempool *mp, void *p) {
         mp->freelist = p;
 }
 
-#ifdef VALGRIND
-
 void mempool_drop(struct mempool *mp) {
         struct pool *p = mp->first_pool;
         while (p) {
@@ -98,6 +106,143 @@ void mempool_drop(struct mempool *mp) {
                 free(p);
                 p = n;
         }
+
+        mp->first_pool = NULL;
+        mp->freelist = NULL;
+}
+
+size_t mempool_trim(struct mempool *mp) {
+        struct pool *p, **pp;
+        void **f, *tile;
+        size_t n_released = 0;
+
+        /* Returns pools of which every tile sits on the freelist to
+         * the allocator. This walks the whole freelist, so it is meant
+         * to be called occasionally, not after every free. */
+
+        for (p = mp->first_pool; p; p = p->next)
+                p->n_free = 0;
+
+        for (tile = mp->freelist; tile; tile = * (void**) tile)
+                for (p = mp->first_pool; p; p = p->next)
+                        if (pool_contains(mp, p, tile)) {
+                                p->n_free++;
+                                break;
+                        }
+
+        /* Unlink the tiles of pools that are about to go away */
+        f = &mp->freelist;
+        while (*f) {
+                for (p = mp->first_pool; p; p = p->next)
+                        if (pool_contains(mp, p, *f))
+                                break;
+
+                if (p && p->n_free == p->n_used)
+                        *f = * (void**) *f;
+                else
+                        f = (void**) *f;
+        }
+
+        pp = &mp->first_pool;
+        while (*pp) {
+                p = *pp;
+
+                if (p->n_free == p->n_used) {
+                        *pp = p->next;
+                        n_released += ALIGN(sizeof(struct pool)) + p->n_tiles * mp->tile_size;
+                        free(p);
+                } else
+                        pp = &p->next;
+        }
+
+        return n_released;
+}
+
+static struct mempool *mempool_class(struct mempool_classes *c, size_t size) {
+        /* Maps (size + 15) / 16 to the index of the smallest fitting class */
+        static const uint8_t class_index[MEMPOOL_CLASS_SIZE_MAX / 16 + 1] = {
+                0, 0, 1, 2, 3, 4, 4, 5, 5, 6, 6, 6, 6, 7, 7, 7, 7,
+        };
+
+        if (size > MEMPOOL_CLASS_SIZE_MAX)
+                return NULL;
+
+        return &c->pools[class_index[(size + 15) / 16]];
+}
+
+void* mempool_classes_alloc(struct mempool_classes *c, size_t size) {
+        struct mempool *mp;
+
+        mp = mempool_class(c, size);
+        if (!mp)
+                return malloc(size);
+
+        return mempool_alloc_tile(mp);
+}
+
+void* mempool_classes_alloc0(struct mempool_classes *c, size_t size) {
+        void *p;
+
+        p = mempool_classes_alloc(c, size);
+        if (p)
+                memzero(p, size);
+        return p;
+}
+
+void* mempool_classes_realloc(struct mempool_classes *c, void *p, size_t old_size, size_t new_size) {
+        struct mempool *old_mp, *new_mp;
+        void *q;
+
+        if (!p)
+                return mempool_classes_alloc(c, new_size);
+
+        old_mp = mempool_class(c, old_size);
+        new_mp = mempool_class(c, new_size);
+
+        if (old_mp == new_mp) {
+                /* Either both are large, or the tile is big enough already */
+                if (!old_mp)
+                        return realloc(p, new_size);
+
+                return p;
+        }
+
+        q = mempool_classes_alloc(c, new_size);
+        if (!q)
+                return NULL;
+
+        memcpy(q, p, MIN(old_size, new_size));
+        mempool_classes_free(c, p, old_size);
+
+        return q;
 }
 
-#endif
+void mempool_classes_free(struct mempool_classes *c, void *p, size_t size) {
+        struct mempool *mp;
+
+        if (!p)
+                return;
+
+        mp = mempool_class(c, size);
+        if (!mp)
+                free(p);
+        else
+                mempool_free_tile(mp, p);
+}
+
+void mempool_classes_drop(struct mempool_classes *c) {
+        unsigned i;
+
+        for (i = 0; i < _MEMPOOL_CLASS_MAX; i++)
+                mempool_drop(&c->pools[i]);
+}
+
+size_t mempool_classes_trim(struct mempool_classes *c) {
+        size_t n = 0;
+        unsigned i;
+
+        for (i = 0; i < _MEMPOOL_CLASS_MAX; i++)
+                n += mempool_trim(&c->pools[i]);
+
+        return n;
+}
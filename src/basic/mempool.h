@@ -43,7 +43,39 @@ struct mempool pool_name = { \
         .at_least = alloc_at_least, \
 }
 
-
-#ifdef VALGRIND
 void mempool_drop(struct mempool *mp);
-#endif
+size_t mempool_trim(struct mempool *mp);
+
+/* A set of pools for a few fixed tile sizes. Requests are rounded up to
+ * the next size class, anything larger than the biggest one is passed
+ * on to malloc(). The size has to be passed again on free, there is no
+ * per-allocation header. Like the pools themselves this is not
+ * thread-safe. */
+#define _MEMPOOL_CLASS_MAX 8
+#define MEMPOOL_CLASS_SIZE_MAX 256U
+
+struct mempool_classes {
+        struct mempool pools[_MEMPOOL_CLASS_MAX];
+};
+
+#define DEFINE_MEMPOOL_CLASSES(classes_name, alloc_at_least) \
+struct mempool_classes classes_name = { \
+        .pools = { \
+                { .tile_size = 16,  .at_least = alloc_at_least }, \
+                { .tile_size = 32,  .at_least = alloc_at_least }, \
+                { .tile_size = 48,  .at_least = alloc_at_least }, \
+                { .tile_size = 64,  .at_least = alloc_at_least }, \
+                { .tile_size = 96,  .at_least = alloc_at_least }, \
+                { .tile_size = 128, .at_least = alloc_at_least }, \
+                { .tile_size = 192, .at_least = alloc_at_least }, \
+                { .tile_size = 256, .at_least = alloc_at_least }, \
+        }, \
+}
+
+void* mempool_classes_alloc(struct mempool_classes *c, size_t size);
+void* mempool_classes_alloc0(struct mempool_classes *c, size_t size);
+void* mempool_classes_realloc(struct mempool_classes *c, void *p, size_t old_size, size_t new_size);
+void mempool_classes_free(struct mempool_classes *c, void *p, size_t size);
+
+void mempool_classes_drop(struct mempool_classes *c);
+size_t mempool_classes_trim(struct mempool_classes *c);
@@ -31,6 +31,7 @@
 #include <errno.h>
 #include <linux/oom.h>
 #include <linux/input.h>
+#include <linux/keyctl.h>
 #include <linux/if_link.h>
 #include <linux/loop.h>
 #include <linux/audit.h>
@@ -163,6 +164,89 @@ static inline int memfd_create(const char *name, unsigned int flags) {
 }
 #endif
 
+/* The io_uring system calls got the same number on all architectures
+ * except for the ones with ABI offsets */
+#ifndef __NR_io_uring_setup
+#  if defined __alpha__
+#    define __NR_io_uring_setup 535
+#  elif defined _MIPS_SIM
+#    if _MIPS_SIM == _MIPS_SIM_ABI32
+#      define __NR_io_uring_setup 4425
+#    endif
+#    if _MIPS_SIM == _MIPS_SIM_NABI32
+#      define __NR_io_uring_setup 6425
+#    endif
+#    if _MIPS_SIM == _MIPS_SIM_ABI64
+#      define __NR_io_uring_setup 5425
+#    endif
+#  else
+#    define __NR_io_uring_setup 425
+#  endif
+#endif
+
+#ifndef __NR_io_uring_enter
+#  define __NR_io_uring_enter (__NR_io_uring_setup + 1)
+#endif
+
+#ifndef __NR_close_range
+#  if defined __alpha__
+#    define __NR_close_range 546
+#  elif defined _MIPS_SIM
+#    if _MIPS_SIM == _MIPS_SIM_ABI32
+#      define __NR_close_range 4436
+#    endif
+#    if _MIPS_SIM == _MIPS_SIM_NABI32
+#      define __NR_close_range 6436
+#    endif
+#    if _MIPS_SIM == _MIPS_SIM_ABI64
+#      define __NR_close_range 5436
+#    endif
+#  else
+#    define __NR_close_range 436
+#  endif
+#endif
+
+#ifndef HAVE_CLOSE_RANGE
+static inline int close_range(unsigned first, unsigned last, int flags) {
+        return syscall(__NR_close_range, first, last, flags);
+}
+#endif
+
+#ifndef __NR_copy_file_range
+#  if defined __x86_64__
+#    define __NR_copy_file_range 326
+#  elif defined __i386__
+#    define __NR_copy_file_range 377
+#  elif defined __arm__
+#    define __NR_copy_file_range 391
+#  elif defined __aarch64__
+#    define __NR_copy_file_range 285
+#  elif defined __s390__
+#    define __NR_copy_file_range 375
+#  elif defined __powerpc__
+#    define __NR_copy_file_range 379
+#  elif defined _MIPS_SIM
+#    if _MIPS_SIM == _MIPS_SIM_ABI32
+#      define __NR_copy_file_range 4360
+#    endif
+#    if _MIPS_SIM == _MIPS_SIM_NABI32
+#      define __NR_copy_file_range 6324
+#    endif
+#    if _MIPS_SIM == _MIPS_SIM_ABI64
+#      define __NR_copy_file_range 5320
+#    endif
+#  else
+#    warning "__NR_copy_file_range unknown for your architecture"
+#    define __NR_copy_file_range 0xffffffff
+#  endif
+#endif
+
+#ifndef HAVE_COPY_FILE_RANGE
+static inline ssize_t copy_file_range(int fd_in, loff_t *off_in, int fd_out, loff_t *off_out, size_t len, unsigned flags) {
+        return syscall(__NR_copy_file_range, fd_in, off_in, fd_out, off_out, len, flags);
+}
+#endif
+
 #ifndef __NR_getrandom
 #  if defined __x86_64__
 #    define __NR_getrandom 318
@@ -588,6 +672,14 @@ static inline int name_to_handle_at(int fd, const char *name, struct file_handle
 #  define SO_REUSEPORT 15
 #endif
 
+#ifndef SO_ATTACH_REUSEPORT_CBPF
+#  define SO_ATTACH_REUSEPORT_CBPF 51
+#endif
+
+#ifndef SO_MEMINFO
+#  define SO_MEMINFO 55
+#endif
+
 #ifndef EVIOCREVOKE
 #  define EVIOCREVOKE _IOW('E', 0x91, int)
 #endif
@@ -1036,6 +1128,34 @@ static inline int kcmp(pid_t pid1, pid_t pid2, int type, unsigned long idx1, uns
 #define KCMP_FILE 0
 #endif
 
+#if !HAVE_DECL_KEYCTL
+typedef int32_t key_serial_t;
+
+static inline long keyctl(int cmd, unsigned long arg2, unsigned long arg3, unsigned long arg4, unsigned long arg5) {
+        return syscall(__NR_keyctl, cmd, arg2, arg3, arg4, arg5);
+}
+
+static inline key_serial_t add_key(const char *type, const char *description, const void *payload, size_t plen, key_serial_t ringid) {
+        return syscall(__NR_add_key, type, description, payload, plen, ringid);
+}
+
+static inline key_serial_t request_key(const char *type, const char *description, const char *callout_info, key_serial_t destringid) {
+        return syscall(__NR_request_key, type, description, callout_info, destringid);
+}
+#endif
+
+#ifndef KEYCTL_READ
+#define KEYCTL_READ 11
+#endif
+
+#ifndef KEYCTL_SET_TIMEOUT
+#define KEYCTL_SET_TIMEOUT 15
+#endif
+
+#ifndef KEY_SPEC_USER_KEYRING
+#define KEY_SPEC_USER_KEYRING -4
+#endif
+
 #ifndef INPUT_PROP_POINTING_STICK
 #define INPUT_PROP_POINTING_STICK 0x05
 #endif
@@ -68,107 +68,139 @@ int prioq_ensure_allocated(Prioq **q, compare_func_t compare_func) {
         return 0;
 }
 
-static void swap(Prioq *q, unsigned j, unsigned k) {
-        void *saved_data;
-        unsigned *saved_idx;
+/* Items are kept in a 4-ary heap. Compared to a binary heap it is
+ * half as deep, and the children of each item are adjacent in memory,
+ * which makes shuffling down cheaper on the cache. */
+#define PRIOQ_ARITY 4U
 
+static void set_item(Prioq *q, unsigned k, struct prioq_item item) {
         assert(q);
-        assert(j < q->n_items);
         assert(k < q->n_items);
 
-        assert(!q->items[j].idx || *(q->items[j].idx) == j);
-        assert(!q->items[k].idx || *(q->items[k].idx) == k);
-
-        saved_data = q->items[j].data;
-        saved_idx = q->items[j].idx;
-        q->items[j].data = q->items[k].data;
-        q->items[j].idx = q->items[k].idx;
-        q->items[k].data = saved_data;
-        q->items[k].idx = saved_idx;
-
-        if (q->items[j].idx)
-                *q->items[j].idx = j;
-
-        if (q->items[k].idx)
-                *q->items[k].idx = k;
+        q->items[k] = item;
+        if (item.idx)
+                *item.idx = k;
 }
 
 static unsigned shuffle_up(Prioq *q, unsigned idx) {
+        struct prioq_item i;
+
         assert(q);
+        assert(idx < q->n_items);
+
+        /* Instead of swapping at every level we move the parents down
+         * and put the item into the remaining hole at the end */
+
+        i = q->items[idx];
 
         while (idx > 0) {
                 unsigned k;
 
-                k = (idx-1)/2;
+                k = (idx-1) / PRIOQ_ARITY;
 
-                if (q->compare_func(q->items[k].data, q->items[idx].data) < 0)
+                if (q->compare_func(q->items[k].data, i.data) < 0)
                         break;
 
-                swap(q, idx, k);
+                set_item(q, idx, q->items[k]);
                 idx = k;
         }
 
+        set_item(q, idx, i);
+
         return idx;
 }
 
 static unsigned shuffle_down(Prioq *q, unsigned idx) {
+        struct prioq_item i;
+
         assert(q);
+        assert(idx < q->n_items);
 
-        for (;;) {
-                unsigned j, k, s;
+        i = q->items[idx];
 
-                k = (idx+1)*2; /* right child */
-                j = k-1;       /* left child */
+        for (;;) {
+                unsigned j, k, s, end;
 
-                if (j >= q->n_items)
+                /* Do we have any children? (Written this way to avoid
+                 * overflowing when calculating the first child's index) */
+                if (q->n_items < 2 ||
+                    idx > (q->n_items - 2) / PRIOQ_ARITY)
                         break;
 
-                if (q->compare_func(q->items[j].data, q->items[idx].data) < 0)
-
-                        /* So our left child is smaller than we are, let's
-                         * remember this fact */
-                        s = j;
-                else
-                        s = idx;
-
-                if (k < q->n_items &&
-                    q->compare_func(q->items[k].data, q->items[s].data) < 0)
-
-                        /* So our right child is smaller than we are, let's
-                         * remember this fact */
-                        s = k;
+                j = idx * PRIOQ_ARITY + 1;
+                end = MIN(j + PRIOQ_ARITY, q->n_items);
 
-                /* s now points to the smallest of the three items */
+                /* Find the smallest child */
+                s = j;
+                for (k = j + 1; k < end; k++)
+                        if (q->compare_func(q->items[k].data, q->items[s].data) < 0)
+                                s = k;
 
-                if (s == idx)
-                        /* No swap necessary, we're done */
+                if (q->compare_func(q->items[s].data, i.data) >= 0)
+                        /* No child is smaller than we are, we're done */
                         break;
 
-                swap(q, idx, s);
+                set_item(q, idx, q->items[s]);
                 idx = s;
         }
 
+        set_item(q, idx, i);
+
         return idx;
 }
 
-int prioq_put(Prioq *q, void *data, unsigned *idx) {
-        struct prioq_item *i;
+static void heapify(Prioq *q) {
         unsigned k;
 
         assert(q);
 
-        if (q->n_items >= q->n_allocated) {
-                unsigned n;
-                struct prioq_item *j;
+        /* Restores the heap property for the whole array bottom-up,
+         * in O(n), starting at the parent of the last item */
 
-                n = MAX((q->n_items+1) * 2, 16u);
-                j = realloc(q->items, sizeof(struct prioq_item) * n);
-                if (!j)
-                        return -ENOMEM;
+        if (q->n_items < 2)
+                return;
 
-                q->items = j;
-                q->n_allocated = n;
-        }
+        k = (q->n_items - 2) / PRIOQ_ARITY + 1;
+        while (k > 0)
+                shuffle_down(q, --k);
+}
+
+static int grow(Prioq *q, unsigned n_add) {
+        struct prioq_item *j;
+        unsigned n;
+
+        assert(q);
+
+        if (q->n_items + n_add < q->n_items)
+                return -ENOMEM;
+
+        if (q->n_items + n_add <= q->n_allocated)
+                return 0;
+
+        n = MAX((q->n_items + n_add) * 2, 16u);
+        if (n < q->n_items + n_add)
+                n = q->n_items + n_add;
+
+        j = realloc_multiply(q->items, sizeof(struct prioq_item), n);
+        if (!j)
+                return -ENOMEM;
+
+        q->items = j;
+        q->n_allocated = n;
+
+        return 0;
+}
+
+int prioq_put(Prioq *q, void *data, unsigned *idx) {
+        struct prioq_item *i;
+        unsigned k;
+        int r;
+
+        assert(q);
+
+        r = grow(q, 1);
+        if (r < 0)
+                return r;
 
         k = q->n_items++;
         i = q->items + k;
@@ -183,6 +215,39 @@ int prioq_put(Prioq *q, void *data, unsigned *idx) {
         return 0;
 }
 
+int prioq_put_many(Prioq *q, void **data, unsigned **idx, unsigned n) {
+        unsigned k, n_old;
+        int r;
+
+        assert(q);
+        assert(data || n == 0);
+
+        /* Like prioq_put() for each item, but when the queue grows at
+         * least twofold it is cheaper to rebuild it in one go. idx may
+         * be NULL if none of the items needs an index. */
+
+        r = grow(q, n);
+        if (r < 0)
+                return r;
+
+        n_old = q->n_items;
+        q->n_items += n;
+
+        for (k = 0; k < n; k++)
+                set_item(q, n_old + k, (struct prioq_item) {
+                                .data = data[k],
+                                .idx = idx ? idx[k] : NULL,
+                        });
+
+        if (n >= n_old)
+                heapify(q);
+        else
+                for (k = n_old; k < q->n_items; k++)
+                        shuffle_up(q, k);
+
+        return 0;
+}
+
 static void remove_item(Prioq *q, struct prioq_item *i) {
         struct prioq_item *l;
 
@@ -266,6 +331,42 @@ int prioq_reshuffle(Prioq *q, void *data, unsigned *idx) {
         return 1;
 }
 
+unsigned prioq_reshuffle_many(Prioq *q, void **data, unsigned **idx, unsigned n) {
+        unsigned k, found = 0;
+
+        assert(q);
+        assert(data || n == 0);
+
+        /* Reshuffles a number of items whose priority changed, for
+         * example all timers after a clock jump. Returns the number of
+         * items that were actually in the queue. Once a sizable part of
+         * the queue is affected, rebuilding it is cheaper than
+         * reshuffling every item on its own. */
+
+        if (n >= q->n_items / PRIOQ_ARITY) {
+                for (k = 0; k < n; k++)
+                        if (find_item(q, data[k], idx ? idx[k] : NULL))
+                                found++;
+
+                heapify(q);
+                return found;
+        }
+
+        for (k = 0; k < n; k++)
+                if (prioq_reshuffle(q, data[k], idx ? idx[k] : NULL) > 0)
+                        found++;
+
+        return found;
+}
+
+void prioq_reshuffle_all(Prioq *q) {
+
+        if (!q)
+                return;
+
+        heapify(q);
+}
+
 void *prioq_peek(Prioq *q) {
 
         if (!q)
@@ -62,6 +62,44 @@ int get_process_state(pid_t pid) {
         return (unsigned char) state;
 }
 
+int get_process_start_time(pid_t pid, unsigned long long *ret) {
+        const char *p;
+        unsigned long long t;
+        int r;
+        _cleanup_free_ char *line = NULL;
+
+        assert(pid >= 0);
+        assert(ret);
+
+        /* Returns the start time of the process in clock ticks since
+         * boot, which together with the PID identifies a process
+         * uniquely */
+
+        p = procfs_file_alloca(pid, "stat");
+
+        r = read_one_line_file(p, &line);
+        if (r == -ENOENT)
+                return -ESRCH;
+        if (r < 0)
+                return r;
+
+        p = strrchr(line, ')');
+        if (!p)
+                return -EIO;
+
+        p++;
+
+        /* Skip fields 3 (state) to 21, the start time is field 22 */
+        if (sscanf(p, " %*c"
+                   " %*s %*s %*s %*s %*s %*s %*s %*s %*s"
+                   " %*s %*s %*s %*s %*s %*s %*s %*s %*s"
+                   " %llu", &t) != 1)
+                return -EIO;
+
+        *ret = t;
+        return 0;
+}
+
 int get_process_comm(pid_t pid, char **name) {
         const char *p;
         int r;
@@ -42,6 +42,7 @@
         })
 
 int get_process_state(pid_t pid);
+int get_process_start_time(pid_t pid, unsigned long long *ret);
 int get_process_comm(pid_t pid, char **name);
 int get_process_cmdline(pid_t pid, size_t max_length, bool comm_fallback, char **line);
 int get_process_exe(pid_t pid, char **name);
@@ -720,3 +720,148 @@ bool strv_fnmatch(char* const* patterns, const char *s, int flags) {
 
         return false;
 }
+
+struct StrvArenaChunk {
+        StrvArenaChunk *next;
+        size_t size;
+        size_t used;
+        char data[];
+};
+
+#define STRV_ARENA_CHUNK_MIN 256U
+
+static char *strv_builder_alloc(StrvBuilder *b, size_t size) {
+        StrvArenaChunk *c = b->chunks;
+
+        if (!c || c->size - c->used < size) {
+                size_t n;
+
+                /* Double the chunk size each time, so that the number of
+                 * chunks stays logarithmic in the total size */
+                n = MAX(c ? c->size * 2 : STRV_ARENA_CHUNK_MIN, size);
+                if (n > SIZE_MAX - offsetof(StrvArenaChunk, data))
+                        return NULL;
+
+                c = malloc(offsetof(StrvArenaChunk, data) + n);
+                if (!c)
+                        return NULL;
+
+                c->next = b->chunks;
+                c->size = n;
+                c->used = 0;
+                b->chunks = c;
+        }
+
+        c->used += size;
+        return c->data + c->used - size;
+}
+
+static int strv_builder_push(StrvBuilder *b, char *value) {
+        if (!GREEDY_REALLOC(b->l, b->n_allocated, b->n + 2))
+                return -ENOMEM;
+
+        b->l[b->n++] = value;
+        b->l[b->n] = NULL;
+
+        return 0;
+}
+
+int strv_builder_add_length(StrvBuilder *b, const char *value, size_t l) {
+        char *v;
+
+        assert(b);
+        assert(value);
+
+        if (l >= SIZE_MAX)
+                return -ENOMEM;
+
+        v = strv_builder_alloc(b, l + 1);
+        if (!v)
+                return -ENOMEM;
+
+        *((char*) mempcpy(v, value, l)) = 0;
+
+        return strv_builder_push(b, v);
+}
+
+int strv_builder_add(StrvBuilder *b, const char *value) {
+        if (!value)
+                return 0;
+
+        return strv_builder_add_length(b, value, strlen(value));
+}
+
+int strv_builder_addf(StrvBuilder *b, const char *format, ...) {
+        va_list ap;
+        char *v;
+        int k;
+
+        assert(b);
+        assert(format);
+
+        va_start(ap, format);
+        k = vsnprintf(NULL, 0, format, ap);
+        va_end(ap);
+
+        if (k < 0)
+                return -ENOMEM;
+
+        v = strv_builder_alloc(b, k + 1);
+        if (!v)
+                return -ENOMEM;
+
+        va_start(ap, format);
+        vsnprintf(v, k + 1, format, ap);
+        va_end(ap);
+
+        return strv_builder_push(b, v);
+}
+
+int strv_builder_add_strv(StrvBuilder *b, char **l) {
+        char **s;
+        int r;
+
+        assert(b);
+
+        if (!GREEDY_REALLOC(b->l, b->n_allocated, b->n + strv_length(l) + 1))
+                return -ENOMEM;
+
+        STRV_FOREACH(s, l) {
+                r = strv_builder_add(b, *s);
+                if (r < 0)
+                        return r;
+        }
+
+        return 0;
+}
+
+char **strv_builder_get(StrvBuilder *b) {
+        assert(b);
+
+        /* The returned array and its strings belong to the builder */
+
+        if (!b->l && !GREEDY_REALLOC0(b->l, b->n_allocated, 1))
+                return NULL;
+
+        return b->l;
+}
+
+char **strv_builder_to_strv(StrvBuilder *b) {
+        assert(b);
+
+        return strv_copy(b->l);
+}
+
+void strv_builder_done(StrvBuilder *b) {
+        assert(b);
+
+        while (b->chunks) {
+                StrvArenaChunk *c = b->chunks;
+
+                b->chunks = c->next;
+                free(c);
+        }
+
+        b->l = mfree(b->l);
+        b->n = b->n_allocated = 0;
+}
@@ -154,3 +154,27 @@ static inline bool strv_fnmatch_or_empty(char* const* patterns, const char *s, i
         return strv_isempty(patterns) ||
                strv_fnmatch(patterns, s, flags);
 }
+
+/* Collects strings into a NULL-terminated array, without allocating
+ * each string separately: the strings are copied into a few chunks
+ * of growing size, and everything is released at once by
+ * strv_builder_done(). Use strv_builder_to_strv() when a regular strv
+ * that outlives the builder is needed. */
+typedef struct StrvArenaChunk StrvArenaChunk;
+
+typedef struct StrvBuilder {
+        char **l;
+        size_t n, n_allocated;
+        StrvArenaChunk *chunks;
+} StrvBuilder;
+
+int strv_builder_add(StrvBuilder *b, const char *value);
+int strv_builder_add_length(StrvBuilder *b, const char *value, size_t l);
+int strv_builder_addf(StrvBuilder *b, const char *format, ...) _printf_(2,3);
+int strv_builder_add_strv(StrvBuilder *b, char **l);
+
+char **strv_builder_get(StrvBuilder *b);
+char **strv_builder_to_strv(StrvBuilder *b);
+
+void strv_builder_done(StrvBuilder *b);
+#define _cleanup_strv_builder_done_ _cleanup_(strv_builder_done)
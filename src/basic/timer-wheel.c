@@ -0,0 +1,194 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include "util.h"
+#include "timer-wheel.h"
+
+/* Times are counted in ticks of 1024us. Each level of the wheel has
+ * 64 slots, each slot of a level spans all 64 slots of the level
+ * below it. Nine levels are enough to cover all of usec_t. */
+#define TICK_SHIFT 10
+#define SLOT_BITS 6
+#define SLOTS (1U << SLOT_BITS)
+#define LEVELS 9
+
+/*
+ * All entries have a tick not before the wheel's base tick (or are
+ * filed as if they were due at the base tick, if they were added
+ * late). An entry is filed on the level of the most significant
+ * digit in which its tick differs from the base, hence everything on
+ * level 0 is due in the current span of 64 ticks, everything on
+ * level 1 in the current span of 64*64 ticks, and so on. Whenever
+ * level 0 runs empty, the base moves forward to the first occupied
+ * slot of the lowest occupied level, and the entries of that slot are
+ * spread out over the levels below.
+ */
+
+struct TimerWheel {
+        uint64_t base;
+        unsigned n_entries;
+        uint64_t occupied[LEVELS];
+        TimerWheelEntry *buckets[LEVELS * SLOTS];
+};
+
+TimerWheel *timer_wheel_new(void) {
+        return new0(TimerWheel, 1);
+}
+
+TimerWheel *timer_wheel_free(TimerWheel *w) {
+        unsigned i;
+
+        if (!w)
+                return NULL;
+
+        /* Unlink whatever is left, so that nobody refers to us
+         * anymore */
+        for (i = 0; i < ELEMENTSOF(w->buckets); i++)
+                while (w->buckets[i])
+                        timer_wheel_remove(w, w->buckets[i]);
+
+        free(w);
+        return NULL;
+}
+
+static void wheel_link(TimerWheel *w, TimerWheelEntry *e) {
+        uint64_t t, x;
+        unsigned level, slot;
+
+        t = e->when >> TICK_SHIFT;
+        if (t < w->base)
+                t = w->base;
+
+        x = t ^ w->base;
+        level = x == 0 ? 0 : (unsigned) (63 - __builtin_clzll(x)) / SLOT_BITS;
+        assert(level < LEVELS);
+
+        slot = (t >> (level * SLOT_BITS)) & (SLOTS - 1);
+
+        e->bucket = level * SLOTS + slot;
+        LIST_PREPEND(entries, w->buckets[e->bucket], e);
+        w->occupied[level] |= UINT64_C(1) << slot;
+}
+
+static void wheel_unlink(TimerWheel *w, TimerWheelEntry *e) {
+        unsigned idx = e->bucket;
+
+        LIST_REMOVE(entries, w->buckets[idx], e);
+        e->bucket = TIMER_WHEEL_IDX_NULL;
+
+        if (!w->buckets[idx])
+                w->occupied[idx / SLOTS] &= ~(UINT64_C(1) << (idx % SLOTS));
+}
+
+void timer_wheel_put(TimerWheel *w, TimerWheelEntry *e, usec_t when) {
+        assert(w);
+        assert(e);
+        assert(!timer_wheel_entry_linked(e));
+
+        /* An empty wheel can start over anywhere */
+        if (w->n_entries == 0)
+                w->base = when >> TICK_SHIFT;
+
+        e->when = when;
+        wheel_link(w, e);
+        w->n_entries++;
+}
+
+void timer_wheel_remove(TimerWheel *w, TimerWheelEntry *e) {
+        assert(w);
+        assert(e);
+
+        if (!timer_wheel_entry_linked(e))
+                return;
+
+        wheel_unlink(w, e);
+
+        assert(w->n_entries > 0);
+        w->n_entries--;
+}
+
+static void wheel_cascade(TimerWheel *w, unsigned level, unsigned slot) {
+        unsigned shift = level * SLOT_BITS;
+        TimerWheelEntry *l;
+
+        /* Move the base to the beginning of the slot, keeping the
+         * digits above the level */
+        w->base = (w->base & ~((UINT64_C(1) << (shift + SLOT_BITS)) - 1)) | ((uint64_t) slot << shift);
+
+        l = w->buckets[level * SLOTS + slot];
+        w->buckets[level * SLOTS + slot] = NULL;
+        w->occupied[level] &= ~(UINT64_C(1) << slot);
+
+        while (l) {
+                TimerWheelEntry *e = l;
+
+                LIST_REMOVE(entries, l, e);
+                wheel_link(w, e);
+        }
+}
+
+TimerWheelEntry *timer_wheel_first_bucket(TimerWheel *w) {
+        assert(w);
+
+        while (w->n_entries > 0) {
+                unsigned level, slot;
+
+                if (w->occupied[0] != 0) {
+                        slot = __builtin_ctzll(w->occupied[0]);
+                        w->base = (w->base & ~(uint64_t) (SLOTS - 1)) | slot;
+
+                        return w->buckets[slot];
+                }
+
+                for (level = 1; level < LEVELS; level++)
+                        if (w->occupied[level] != 0)
+                                break;
+
+                assert(level < LEVELS);
+
+                slot = __builtin_ctzll(w->occupied[level]);
+                wheel_cascade(w, level, slot);
+        }
+
+        return NULL;
+}
+
+TimerWheelEntry *timer_wheel_peek(TimerWheel *w) {
+        TimerWheelEntry *i, *first = NULL;
+
+        assert(w);
+
+        LIST_FOREACH(entries, i, timer_wheel_first_bucket(w))
+                if (!first || i->when < first->when)
+                        first = i;
+
+        return first;
+}
+
+unsigned timer_wheel_size(TimerWheel *w) {
+        assert(w);
+
+        return w->n_entries;
+}
+
+bool timer_wheel_isempty(TimerWheel *w) {
+        assert(w);
+
+        return w->n_entries == 0;
+}
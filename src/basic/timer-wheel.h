@@ -0,0 +1,60 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+#pragma once
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include "list.h"
+#include "time-util.h"
+
+/* A hierarchical timer wheel: entries are sorted into buckets by the
+ * time they are due, which makes adding and removing them O(1). Only
+ * the bucket that is due first is ever looked at in detail. */
+
+typedef struct TimerWheel TimerWheel;
+typedef struct TimerWheelEntry TimerWheelEntry;
+
+#define TIMER_WHEEL_IDX_NULL ((unsigned) -1)
+
+struct TimerWheelEntry {
+        LIST_FIELDS(TimerWheelEntry, entries);
+        usec_t when;
+        unsigned bucket;
+};
+
+TimerWheel *timer_wheel_new(void);
+TimerWheel *timer_wheel_free(TimerWheel *w);
+
+static inline void timer_wheel_entry_init(TimerWheelEntry *e) {
+        LIST_INIT(entries, e);
+        e->when = 0;
+        e->bucket = TIMER_WHEEL_IDX_NULL;
+}
+
+static inline bool timer_wheel_entry_linked(const TimerWheelEntry *e) {
+        return e->bucket != TIMER_WHEEL_IDX_NULL;
+}
+
+void timer_wheel_put(TimerWheel *w, TimerWheelEntry *e, usec_t when);
+void timer_wheel_remove(TimerWheel *w, TimerWheelEntry *e);
+
+TimerWheelEntry *timer_wheel_first_bucket(TimerWheel *w);
+TimerWheelEntry *timer_wheel_peek(TimerWheel *w);
+
+unsigned timer_wheel_size(TimerWheel *w) _pure_;
+bool timer_wheel_isempty(TimerWheel *w) _pure_;
@@ -52,6 +52,12 @@
 #include "utf8.h"
 #include "util.h"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 bool unichar_is_valid(uint32_t ch) {
 
         if (ch >= 0x110000) /* End of unicode space */
@@ -141,6 +147,86 @@ int utf8_encoded_to_unichar(const char *str) {
         return unichar;
 }
 
+static inline bool ascii_is_plain(uint8_t c, bool printable) {
+        if (printable)
+                return c >= ' ' && c < 0x7F;
+
+        return c < 0x80;
+}
+
+/*
+ * Returns the number of leading bytes of p that are ASCII, and if
+ * 'printable' is set, neither control characters nor DEL either.
+ * These need no decoding, and make up most of what we validate, so
+ * they are skipped 16 bytes (or a word) at a time. Tabs and newlines
+ * end the span, the caller decides about those.
+ */
+static inline size_t ascii_span(const uint8_t *p, size_t n, bool printable) {
+        size_t i = 0;
+
+        /* Don't bother with runs of non-ASCII characters */
+        if (n == 0 || !ascii_is_plain(p[0], printable))
+                return 0;
+
+#if defined(__SSE2__)
+        for (; i + 16 <= n; i += 16) {
+                __m128i v;
+                unsigned m;
+
+                v = _mm_loadu_si128((const __m128i*) (p + i));
+
+                /* Signed comparison, so that bytes >= 0x80 are below ' ', too */
+                if (printable)
+                        v = _mm_or_si128(_mm_cmplt_epi8(v, _mm_set1_epi8(' ')),
+                                         _mm_cmpeq_epi8(v, _mm_set1_epi8(0x7F)));
+
+                m = (unsigned) _mm_movemask_epi8(v);
+                if (m != 0)
+                        return i + __builtin_ctz(m);
+        }
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+        for (; i + 16 <= n; i += 16) {
+                uint8x16_t v;
+
+                v = vld1q_u8(p + i);
+
+                if (printable) {
+                        if (vmaxvq_u8(vorrq_u8(vcltq_u8(v, vdupq_n_u8(' ')),
+                                               vcgeq_u8(v, vdupq_n_u8(0x7F)))) != 0)
+                                break;
+                } else if (vmaxvq_u8(v) >= 0x80)
+                        break;
+        }
+#else
+        {
+                const size_t ones = (size_t) -1 / 0xFF, highs = ones * 0x80;
+
+                for (; i + sizeof(size_t) <= n; i += sizeof(size_t)) {
+                        size_t w, bad;
+
+                        memcpy(&w, p + i, sizeof(w));
+
+                        /* Any byte >= 0x80, and if requested any byte
+                         * < ' ' or == 0x7F. Exact as to whether there is
+                         * one, not as to where, the loop below finds it. */
+                        bad = w;
+                        if (printable)
+                                bad |= ((w - ones * ' ') & ~w) |
+                                       (((w ^ (ones * 0x7F)) - ones) & ~(w ^ (ones * 0x7F)));
+
+                        if (bad & highs)
+                                break;
+                }
+        }
+#endif
+
+        for (; i < n; i++)
+                if (!ascii_is_plain(p[i], printable))
+                        break;
+
+        return i;
+}
+
 bool utf8_is_printable_newline(const char* str, size_t length, bool newline) {
         const char *p;
 
@@ -148,6 +234,13 @@ bool utf8_is_printable_newline(const char* str, size_t length, bool newline) {
 
         for (p = str; length;) {
                 int encoded_len, val;
+                size_t n;
+
+                n = ascii_span((const uint8_t*) p, length, true);
+                p += n;
+                length -= n;
+                if (length == 0)
+                        break;
 
                 encoded_len = utf8_encoded_valid_unichar(p);
                 if (encoded_len < 0 ||
@@ -168,13 +261,21 @@ bool utf8_is_printable_newline(const char* str, size_t length, bool newline) {
 }
 
 const char *utf8_is_valid(const char *str) {
-        const uint8_t *p;
+        const uint8_t *p, *e;
 
         assert(str);
 
-        for (p = (const uint8_t*) str; *p; ) {
+        /* strlen() is vectorized already, and gives us a bound for
+         * the ASCII spans */
+        e = (const uint8_t*) str + strlen(str);
+
+        for (p = (const uint8_t*) str; p < e; ) {
                 int len;
 
+                p += ascii_span(p, e - p, false);
+                if (p >= e)
+                        break;
+
                 len = utf8_encoded_valid_unichar((const char *)p);
                 if (len < 0)
                         return NULL;
@@ -252,13 +353,13 @@ char *utf8_escape_non_printable(const char *str) {
 }
 
 char *ascii_is_valid(const char *str) {
-        const char *p;
+        size_t l;
 
         assert(str);
 
-        for (p = str; *p; p++)
-                if ((unsigned char) *p >= 128)
-                        return NULL;
+        l = strlen(str);
+        if (ascii_span((const uint8_t*) str, l, false) != l)
+                return NULL;
 
         return (char*) str;
 }
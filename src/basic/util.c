@@ -1983,6 +1983,44 @@ _pure_ static bool fd_in_set(int fd, const int fdset[], unsigned n_fdset) {
         return false;
 }
 
+static int cmp_int(const void *_a, const void *_b) {
+        const int *a = _a, *b = _b;
+
+        return *a < *b ? -1 : *a > *b ? 1 : 0;
+}
+
+static int close_all_fds_by_range(const int except[], unsigned n_except) {
+        int sorted[n_except + 1];
+        unsigned i, n = 0, start = 3;
+
+        /* Close everything between the fds we shall keep, in as few
+         * calls as possible */
+
+        for (i = 0; i < n_except; i++)
+                if (except[i] >= 3)
+                        sorted[n++] = except[i];
+
+        qsort_safe(sorted, n, sizeof(int), cmp_int);
+
+        for (i = 0; i < n; i++) {
+                unsigned fd = (unsigned) sorted[i];
+
+                if (fd < start)
+                        continue;
+
+                if (fd > start)
+                        if (close_range(start, fd - 1, 0) < 0)
+                                return -errno;
+
+                start = fd + 1;
+        }
+
+        if (close_range(start, (unsigned) -1, 0) < 0)
+                return -errno;
+
+        return 0;
+}
+
 int close_all_fds(const int except[], unsigned n_except) {
         _cleanup_closedir_ DIR *d = NULL;
         struct dirent *de;
@@ -1990,6 +2028,12 @@ int close_all_fds(const int except[], unsigned n_except) {
 
         assert(n_except == 0 || except);
 
+        r = close_all_fds_by_range(except, n_except);
+        if (r != -ENOSYS)
+                return r;
+
+        r = 0;
+
         d = opendir("/proc/self/fd");
         if (!d) {
                 int fd;
@@ -2877,7 +2921,12 @@ bool dirent_is_file_with_suffix(const struct dirent *de, const char *suffix) {
         return endswith(de->d_name, suffix);
 }
 
-static int do_execute(char **directories, usec_t timeout, char *argv[]) {
+typedef struct ExecuteChild {
+        usec_t start;
+        char path[];
+} ExecuteChild;
+
+static int do_execute(char **directories, usec_t timeout, char *argv[], int timing_fd) {
         _cleanup_hashmap_free_free_ Hashmap *pids = NULL;
         _cleanup_set_free_free_ Set *seen = NULL;
         char **directory;
@@ -2911,7 +2960,8 @@ static int do_execute(char **directories, usec_t timeout, char *argv[]) {
                 }
 
                 FOREACH_DIRENT(de, d, break) {
-                        _cleanup_free_ char *path = NULL;
+                        _cleanup_free_ ExecuteChild *c = NULL;
+                        size_t l;
                         pid_t pid;
                         int r;
 
@@ -2927,15 +2977,20 @@ static int do_execute(char **directories, usec_t timeout, char *argv[]) {
                         if (r < 0)
                                 return log_oom();
 
-                        path = strjoin(*directory, "/", de->d_name, NULL);
-                        if (!path)
+                        l = strlen(*directory) + 1 + strlen(de->d_name) + 1;
+                        c = malloc(offsetof(ExecuteChild, path) + l);
+                        if (!c)
                                 return log_oom();
 
-                        if (null_or_empty_path(path)) {
-                                log_debug("%s is empty (a mask).", path);
+                        strcpy(stpcpy(stpcpy(c->path, *directory), "/"), de->d_name);
+
+                        if (null_or_empty_path(c->path)) {
+                                log_debug("%s is empty (a mask).", c->path);
                                 continue;
                         }
 
+                        c->start = now(CLOCK_MONOTONIC);
+
                         pid = fork();
                         if (pid < 0) {
                                 log_error_errno(errno, "Failed to fork: %m");
@@ -2946,22 +3001,22 @@ static int do_execute(char **directories, usec_t timeout, char *argv[]) {
                                 assert_se(prctl(PR_SET_PDEATHSIG, SIGTERM) == 0);
 
                                 if (!argv) {
-                                        _argv[0] = path;
+                                        _argv[0] = c->path;
                                         _argv[1] = NULL;
                                         argv = _argv;
                                 } else
-                                        argv[0] = path;
+                                        argv[0] = c->path;
 
-                                execv(path, argv);
-                                return log_error_errno(errno, "Failed to execute %s: %m", path);
+                                execv(c->path, argv);
+                                return log_error_errno(errno, "Failed to execute %s: %m", c->path);
                         }
 
-                        log_debug("Spawned %s as " PID_FMT ".", path, pid);
+                        log_debug("Spawned %s as " PID_FMT ".", c->path, pid);
 
-                        r = hashmap_put(pids, UINT_TO_PTR(pid), path);
+                        r = hashmap_put(pids, UINT_TO_PTR(pid), c);
                         if (r < 0)
                                 return log_oom();
-                        path = NULL;
+                        c = NULL;
                 }
         }
 
@@ -2972,23 +3027,44 @@ static int do_execute(char **directories, usec_t timeout, char *argv[]) {
         if (timeout != USEC_INFINITY)
                 alarm((timeout + USEC_PER_SEC - 1) / USEC_PER_SEC);
 
+        /* Reap the children in the order they finish, so that the
+         * time each one took is accurate, regardless of the order
+         * they were started in. */
+
         while (!hashmap_isempty(pids)) {
-                _cleanup_free_ char *path = NULL;
-                pid_t pid;
+                _cleanup_free_ ExecuteChild *c = NULL;
+                char ts[FORMAT_TIMESPAN_MAX];
+                siginfo_t si = {};
+                usec_t t;
+
+                if (waitid(P_ALL, 0, &si, WEXITED|WNOWAIT) < 0) {
+                        if (errno == EINTR)
+                                continue;
+
+                        return log_error_errno(errno, "Failed to wait for children: %m");
+                }
+
+                t = now(CLOCK_MONOTONIC);
+
+                c = hashmap_remove(pids, UINT_TO_PTR(si.si_pid));
+                if (!c) {
+                        /* Not ours, reap it anyway */
+                        (void) wait_for_terminate(si.si_pid, NULL);
+                        continue;
+                }
 
-                pid = PTR_TO_UINT(hashmap_first_key(pids));
-                assert(pid > 0);
+                wait_for_terminate_and_warn(c->path, si.si_pid, true);
 
-                path = hashmap_remove(pids, UINT_TO_PTR(pid));
-                assert(path);
+                log_debug("%s finished after %s.", c->path, format_timespan(ts, sizeof(ts), t - c->start, USEC_PER_MSEC));
 
-                wait_for_terminate_and_warn(path, pid, true);
+                if (timing_fd >= 0)
+                        (void) dprintf(timing_fd, "%s " USEC_FMT "\n", basename(c->path), t - c->start);
         }
 
         return 0;
 }
 
-void execute_directories(const char* const* directories, usec_t timeout, char *argv[]) {
+void execute_directories(const char* const* directories, usec_t timeout, char *argv[], int timing_fd) {
         pid_t executor_pid;
         int r;
         char *name;
@@ -3002,7 +3078,8 @@ void execute_directories(const char* const* directories, usec_t timeout, char *a
         /* Executes all binaries in the directories in parallel and waits
          * for them to finish. Optionally a timeout is applied. If a file
          * with the same name exists in more than one directory, the
-         * earliest one wins. */
+         * earliest one wins. If timing_fd is valid a line with the name
+         * of each binary and the time it took to run is written to it. */
 
         executor_pid = fork();
         if (executor_pid < 0) {
@@ -3010,7 +3087,7 @@ void execute_directories(const char* const* directories, usec_t timeout, char *a
                 return;
 
         } else if (executor_pid == 0) {
-                r = do_execute(dirs, timeout, argv);
+                r = do_execute(dirs, timeout, argv, timing_fd);
                 _exit(r < 0 ? EXIT_FAILURE : EXIT_SUCCESS);
         }
 
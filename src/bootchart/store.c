@@ -38,6 +38,7 @@
 #include "bootchart.h"
 #include "cgroup-util.h"
 #include "fileio.h"
+#include "hashmap.h"
 
 /*
  * Alloc a static 4k buffer for stdio - primarily used to increase
@@ -47,6 +48,11 @@
 static char smaps_buf[4096];
 static int skip = 0;
 
+/* The processes we know of by pid, and the end of the list, so that
+ * neither finding a process nor appending one needs to walk it */
+static Hashmap *ps_by_pid = NULL;
+static struct ps_struct *ps_last = NULL;
+
 double gettime_ns(void) {
         struct timespec n;
 
@@ -90,6 +96,46 @@ static int pid_cmdline_strscpy(int procfd, char *buffer, size_t buf_len, int pid
         return 0;
 }
 
+static ssize_t pread_grow(int fd, char **buf, size_t *allocated) {
+        ssize_t n;
+
+        /* Reads the whole file into a buffer that is kept for the
+         * next time, and grows as needed */
+
+        if (!GREEDY_REALLOC(*buf, *allocated, 4096))
+                return -ENOMEM;
+
+        for (;;) {
+                n = pread(fd, *buf, *allocated - 1, 0);
+                if (n < 0)
+                        return -errno;
+
+                if ((size_t) n < *allocated - 1)
+                        break;
+
+                if (!GREEDY_REALLOC(*buf, *allocated, *allocated + 1))
+                        return -ENOMEM;
+        }
+
+        (*buf)[n] = '\0';
+        return n;
+}
+
+static int pid_is_multithreaded(int procfd, int pid) {
+        char filename[PATH_MAX];
+        struct stat st;
+
+        /* The link count of /proc/[pid]/task is 2 plus the number of
+         * threads, which spares walking it for the majority of
+         * processes that have just one */
+
+        sprintf(filename, "%d/task", pid);
+        if (fstatat(procfd, filename, &st, 0) < 0)
+                return -errno;
+
+        return st.st_nlink > 3;
+}
+
 int log_sample(DIR *proc,
                int sample,
                struct ps_struct *ps_first,
@@ -98,7 +144,9 @@ int log_sample(DIR *proc,
                int *cpus) {
 
         static int vmstat = -1;
-        _cleanup_free_ char *buf_schedstat = NULL;
+        static int schedstat = -1;
+        static char *buf_schedstat = NULL;
+        static size_t buf_schedstat_size = 0;
         char buf[4096];
         char key[256];
         char val[256];
@@ -159,9 +207,15 @@ vmstat_next:
         }
 
         /* Parse "/proc/schedstat" for overall CPU utilization */
-        r = read_full_file("/proc/schedstat", &buf_schedstat, NULL);
-        if (r < 0)
-            return log_error_errno(r, "Unable to read schedstat: %m");
+        if (schedstat < 0) {
+                schedstat = openat(procfd, "schedstat", O_RDONLY|O_CLOEXEC);
+                if (schedstat < 0)
+                        return log_error_errno(errno, "Failed to open /proc/schedstat: %m");
+        }
+
+        n = pread_grow(schedstat, &buf_schedstat, &buf_schedstat_size);
+        if (n < 0)
+                return log_error_errno(n, "Unable to read schedstat: %m");
 
         m = buf_schedstat;
         while (m) {
@@ -214,28 +268,38 @@ schedstat_next:
                 if (pid >= MAXPIDS)
                         continue;
 
-                ps = ps_first;
-                while (ps->next_ps) {
-                        ps = ps->next_ps;
-                        if (ps->pid == pid)
-                                break;
-                }
+                ps = hashmap_get(ps_by_pid, INT_TO_PTR(pid));
 
-                /* end of our LL? then append a new record */
-                if (ps->pid != pid) {
+                /* not known yet? then append a new record */
+                if (!ps) {
                         _cleanup_fclose_ FILE *st = NULL;
                         char t[32];
                         struct ps_struct *parent;
 
-                        ps->next_ps = new0(struct ps_struct, 1);
-                        if (!ps->next_ps)
+                        if (!ps_last)
+                                ps_last = ps_first;
+
+                        r = hashmap_ensure_allocated(&ps_by_pid, &trivial_hash_ops);
+                        if (r < 0)
+                                return log_oom();
+
+                        ps = new0(struct ps_struct, 1);
+                        if (!ps)
                                 return log_oom();
 
-                        ps = ps->next_ps;
                         ps->pid = pid;
                         ps->sched = -1;
                         ps->schedstat = -1;
 
+                        r = hashmap_put(ps_by_pid, INT_TO_PTR(pid), ps);
+                        if (r < 0) {
+                                free(ps);
+                                return log_oom();
+                        }
+
+                        ps_last->next_ps = ps;
+                        ps_last = ps;
+
                         ps->sample = new0(struct ps_sched_struct, 1);
                         if (!ps->sample)
                                 return log_oom();
@@ -326,11 +390,8 @@ schedstat_next:
                         if (ps->ppid == 0)
                                 ps->ppid = 1;
 
-                        parent = ps_first;
-                        while ((parent->next_ps && parent->pid != ps->ppid))
-                                parent = parent->next_ps;
-
-                        if (parent->pid != ps->ppid) {
+                        parent = hashmap_get(ps_by_pid, INT_TO_PTR(ps->ppid));
+                        if (!parent) {
                                 /* orphan */
                                 ps->ppid = 1;
                                 parent = ps_first->next_ps;
@@ -404,7 +465,7 @@ schedstat_next:
 
                 /* Browse directory "/proc/[pid]/task" to know the thread ids of process [pid] */
                 snprintf(filename, sizeof(filename), PID_FMT "/task", pid);
-                taskfd = openat(procfd, filename, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+                taskfd = pid_is_multithreaded(procfd, pid) > 0 ? openat(procfd, filename, O_RDONLY|O_DIRECTORY|O_CLOEXEC) : -1;
                 if (taskfd >= 0) {
                         _cleanup_closedir_ DIR *taskdir = NULL;
 
@@ -445,7 +506,7 @@ schedstat_next:
                                 r = safe_atolli(rt, &delta_rt);
                                 if (r < 0)
                                     continue;
-                                r = safe_atolli(rt, &delta_wt);
+                                r = safe_atolli(wt, &delta_wt);
                                 if (r < 0)
                                     continue;
                                 ps->sample->runtime  += delta_rt;
@@ -28,6 +28,7 @@
 #include "bus-xml-policy.h"
 #include "sd-login.h"
 #include "formats-util.h"
+#include "siphash24.h"
 
 static void policy_item_free(PolicyItem *i) {
         assert(i);
@@ -756,10 +757,197 @@ static int check_policy_items(PolicyItem *items, const struct policy_check_filte
         return verdict;
 }
 
-static int policy_check(Policy *p, const struct policy_check_filter *filter) {
+/* The verdicts of the individual item lists for one filter. Only
+ * which of the console lists applies can change while the policy
+ * stays the same, hence this is what we cache. */
+struct policy_verdicts {
+        int base;
+        int on_console;
+        int no_console;
+        int mandatory;
+};
+
+struct PolicyCache {
+        Hashmap *entries;
+        uint64_t generation;
+};
+
+struct policy_cache_entry {
+        struct policy_verdicts verdicts;
+        size_t key_size;
+        uint8_t key[];
+};
+
+#define POLICY_CACHE_MAX 4096
+
+static void policy_check_lists(Policy *p, const struct policy_check_filter *filter, struct policy_verdicts *ret) {
 
         PolicyItem *items;
-        int verdict, v;
+        int v;
+
+        assert(p);
+        assert(filter);
+        assert(ret);
+
+        ret->base = check_policy_items(p->default_items, filter);
+
+        if (filter->gid != GID_INVALID) {
+                items = hashmap_get(p->group_items, UINT32_TO_PTR(filter->gid));
+                if (items) {
+                        v = check_policy_items(items, filter);
+                        if (v != DUNNO)
+                                ret->base = v;
+                }
+        }
+
+        if (filter->uid != UID_INVALID) {
+                items = hashmap_get(p->user_items, UINT32_TO_PTR(filter->uid));
+                if (items) {
+                        v = check_policy_items(items, filter);
+                        if (v != DUNNO)
+                                ret->base = v;
+                }
+        }
+
+        ret->on_console = check_policy_items(p->on_console_items, filter);
+        ret->no_console = check_policy_items(p->no_console_items, filter);
+        ret->mandatory = check_policy_items(p->mandatory_items, filter);
+}
+
+static int policy_verdicts_combine(const struct policy_verdicts *v, const struct policy_check_filter *filter) {
+        int verdict, c;
+
+        assert(v);
+        assert(filter);
+
+        verdict = v->base;
+
+        /* Only look at the seats if it makes a difference */
+        if (v->on_console == v->no_console)
+                c = v->on_console;
+        else if (filter->uid != UID_INVALID && sd_uid_get_seats(filter->uid, -1, NULL) > 0)
+                c = v->on_console;
+        else
+                c = v->no_console;
+        if (c != DUNNO)
+                verdict = c;
+
+        if (v->mandatory != DUNNO)
+                verdict = v->mandatory;
+
+        return verdict;
+}
+
+static size_t filter_key_append(uint8_t *k, size_t i, const char *s) {
+        size_t l;
+
+        /* Distinguish NULL from the empty string */
+        if (k)
+                k[i] = !!s;
+        i++;
+
+        if (!s)
+                return i;
+
+        l = strlen(s) + 1;
+        if (k)
+                memcpy(k + i, s, l);
+
+        return i + l;
+}
+
+static size_t filter_key(const struct policy_check_filter *filter, uint8_t *k) {
+        struct {
+                PolicyItemClass class;
+                uid_t uid;
+                gid_t gid;
+                int message_type;
+        } fixed = {
+                .class = filter->class,
+                .uid = filter->uid,
+                .gid = filter->gid,
+                .message_type = filter->message_type,
+        };
+        size_t i;
+
+        /* Serializes the filter into k, or if k is NULL, only
+         * determines the size needed */
+
+        if (k)
+                memcpy(k, &fixed, sizeof(fixed));
+        i = sizeof(fixed);
+
+        i = filter_key_append(k, i, filter->name);
+        i = filter_key_append(k, i, filter->interface);
+        i = filter_key_append(k, i, filter->path);
+        i = filter_key_append(k, i, filter->member);
+
+        return i;
+}
+
+static unsigned long policy_cache_entry_hash_func(const void *p, const uint8_t hash_key[HASH_KEY_SIZE]) {
+        const struct policy_cache_entry *e = p;
+        uint64_t u;
+
+        siphash24((uint8_t*) &u, e->key, e->key_size, hash_key);
+
+        return (unsigned long) u;
+}
+
+static int policy_cache_entry_compare_func(const void *a, const void *b) {
+        const struct policy_cache_entry *x = a, *y = b;
+
+        if (x->key_size != y->key_size)
+                return x->key_size < y->key_size ? -1 : 1;
+
+        return memcmp(x->key, y->key, x->key_size);
+}
+
+static const struct hash_ops policy_cache_entry_hash_ops = {
+        .hash = policy_cache_entry_hash_func,
+        .compare = policy_cache_entry_compare_func,
+};
+
+int policy_cache_new(PolicyCache **ret) {
+        PolicyCache *c;
+
+        assert(ret);
+
+        c = new0(PolicyCache, 1);
+        if (!c)
+                return -ENOMEM;
+
+        c->entries = hashmap_new(&policy_cache_entry_hash_ops);
+        if (!c->entries) {
+                free(c);
+                return -ENOMEM;
+        }
+
+        *ret = c;
+        return 0;
+}
+
+PolicyCache *policy_cache_free(PolicyCache *c) {
+        if (!c)
+                return NULL;
+
+        hashmap_free_free(c->entries);
+        free(c);
+
+        return NULL;
+}
+
+void policy_cache_flush(PolicyCache *c) {
+        if (!c)
+                return;
+
+        hashmap_clear_free(c->entries);
+}
+
+static int policy_check(Policy *p, PolicyCache *cache, const struct policy_check_filter *filter) {
+
+        struct policy_cache_entry *e = NULL;
+        struct policy_verdicts v;
 
         assert(p);
         assert(filter);
@@ -778,38 +966,42 @@ static int policy_check(Policy *p, const struct policy_check_filter *filter) {
          *  Later rules override earlier rules.
          */
 
-        verdict = check_policy_items(p->default_items, filter);
+        if (cache) {
+                struct policy_cache_entry *found;
+                size_t sz;
 
-        if (filter->gid != GID_INVALID) {
-                items = hashmap_get(p->group_items, UINT32_TO_PTR(filter->gid));
-                if (items) {
-                        v = check_policy_items(items, filter);
-                        if (v != DUNNO)
-                                verdict = v;
+                /* Forget everything we learnt from an older version
+                 * of the policy */
+                if (cache->generation != p->generation) {
+                        policy_cache_flush(cache);
+                        cache->generation = p->generation;
                 }
-        }
 
-        if (filter->uid != UID_INVALID) {
-                items = hashmap_get(p->user_items, UINT32_TO_PTR(filter->uid));
-                if (items) {
-                        v = check_policy_items(items, filter);
-                        if (v != DUNNO)
-                                verdict = v;
+                sz = filter_key(filter, NULL);
+                e = malloc(offsetof(struct policy_cache_entry, key) + sz);
+                if (e) {
+                        e->key_size = filter_key(filter, e->key);
+
+                        found = hashmap_get(cache->entries, e);
+                        if (found) {
+                                free(e);
+                                return policy_verdicts_combine(&found->verdicts, filter);
+                        }
                 }
         }
 
-        if (filter->uid != UID_INVALID && sd_uid_get_seats(filter->uid, -1, NULL) > 0)
-                v = check_policy_items(p->on_console_items, filter);
-        else
-                v = check_policy_items(p->no_console_items, filter);
-        if (v != DUNNO)
-                verdict = v;
+        policy_check_lists(p, filter, &v);
 
-        v = check_policy_items(p->mandatory_items, filter);
-        if (v != DUNNO)
-                verdict = v;
+        if (e) {
+                if (hashmap_size(cache->entries) >= POLICY_CACHE_MAX)
+                        policy_cache_flush(cache);
 
-        return verdict;
+                e->verdicts = v;
+                if (hashmap_put(cache->entries, e, e) < 0)
+                        free(e);
+        }
+
+        return policy_verdicts_combine(&v, filter);
 }
 
 bool policy_check_own(Policy *p, uid_t uid, gid_t gid, const char *name) {
@@ -826,7 +1018,7 @@ bool policy_check_own(Policy *p, uid_t uid, gid_t gid, const char *name) {
         assert(p);
         assert(name);
 
-        verdict = policy_check(p, &filter);
+        verdict = policy_check(p, NULL, &filter);
 
         log_full(LOG_AUTH | (verdict != ALLOW ? LOG_WARNING : LOG_DEBUG),
                  "Ownership permission check for uid=" UID_FMT " gid=" GID_FMT" name=%s: %s",
@@ -846,13 +1038,13 @@ bool policy_check_hello(Policy *p, uid_t uid, gid_t gid) {
         assert(p);
 
         filter.class = POLICY_ITEM_USER;
-        verdict = policy_check(p, &filter);
+        verdict = policy_check(p, NULL, &filter);
 
         if (verdict != DENY) {
                 int v;
 
                 filter.class = POLICY_ITEM_GROUP;
-                v = policy_check(p, &filter);
+                v = policy_check(p, NULL, &filter);
                 if (v != DUNNO)
                         verdict = v;
         }
@@ -864,17 +1056,19 @@ bool policy_check_hello(Policy *p, uid_t uid, gid_t gid) {
         return verdict == ALLOW;
 }
 
-bool policy_check_one_recv(Policy *p,
-                           uid_t uid,
-                           gid_t gid,
-                           int message_type,
-                           const char *name,
-                           const char *path,
-                           const char *interface,
-                           const char *member) {
+static bool policy_check_one(Policy *p,
+                             PolicyCache *cache,
+                             PolicyItemClass class,
+                             uid_t uid,
+                             gid_t gid,
+                             int message_type,
+                             const char *name,
+                             const char *path,
+                             const char *interface,
+                             const char *member) {
 
         struct policy_check_filter filter = {
-                .class        = POLICY_ITEM_RECV,
+                .class        = class,
                 .uid          = uid,
                 .gid          = gid,
                 .message_type = message_type,
@@ -886,10 +1080,23 @@ bool policy_check_one_recv(Policy *p,
 
         assert(p);
 
-        return policy_check(p, &filter) == ALLOW;
+        return policy_check(p, cache, &filter) == ALLOW;
+}
+
+bool policy_check_one_recv(Policy *p,
+                           uid_t uid,
+                           gid_t gid,
+                           int message_type,
+                           const char *name,
+                           const char *path,
+                           const char *interface,
+                           const char *member) {
+
+        return policy_check_one(p, NULL, POLICY_ITEM_RECV, uid, gid, message_type, name, path, interface, member);
 }
 
 bool policy_check_recv(Policy *p,
+                       PolicyCache *cache,
                        uid_t uid,
                        gid_t gid,
                        int message_type,
@@ -907,18 +1114,18 @@ bool policy_check_recv(Policy *p,
         assert(p);
 
         if (set_isempty(names) && strv_isempty(namesv)) {
-                allow = policy_check_one_recv(p, uid, gid, message_type, NULL, path, interface, member);
+                allow = policy_check_one(p, cache, POLICY_ITEM_RECV, uid, gid, message_type, NULL, path, interface, member);
         } else {
                 SET_FOREACH(n, names, i) {
                         last = n;
-                        allow = policy_check_one_recv(p, uid, gid, message_type, n, path, interface, member);
+                        allow = policy_check_one(p, cache, POLICY_ITEM_RECV, uid, gid, message_type, n, path, interface, member);
                         if (allow)
                                 break;
                 }
                 if (!allow) {
                         STRV_FOREACH(nv, namesv) {
                                 last = *nv;
-                                allow = policy_check_one_recv(p, uid, gid, message_type, *nv, path, interface, member);
+                                allow = policy_check_one(p, cache, POLICY_ITEM_RECV, uid, gid, message_type, *nv, path, interface, member);
                                 if (allow)
                                         break;
                         }
@@ -942,23 +1149,11 @@ bool policy_check_one_send(Policy *p,
                            const char *interface,
                            const char *member) {
 
-        struct policy_check_filter filter = {
-                .class        = POLICY_ITEM_SEND,
-                .uid          = uid,
-                .gid          = gid,
-                .message_type = message_type,
-                .name         = name,
-                .interface    = interface,
-                .path         = path,
-                .member       = member,
-        };
-
-        assert(p);
-
-        return policy_check(p, &filter) == ALLOW;
+        return policy_check_one(p, NULL, POLICY_ITEM_SEND, uid, gid, message_type, name, path, interface, member);
 }
 
 bool policy_check_send(Policy *p,
+                       PolicyCache *cache,
                        uid_t uid,
                        gid_t gid,
                        int message_type,
@@ -977,18 +1172,18 @@ bool policy_check_send(Policy *p,
         assert(p);
 
         if (set_isempty(names) && strv_isempty(namesv)) {
-                allow = policy_check_one_send(p, uid, gid, message_type, NULL, path, interface, member);
+                allow = policy_check_one(p, cache, POLICY_ITEM_SEND, uid, gid, message_type, NULL, path, interface, member);
         } else {
                 SET_FOREACH(n, names, i) {
                         last = n;
-                        allow = policy_check_one_send(p, uid, gid, message_type, n, path, interface, member);
+                        allow = policy_check_one(p, cache, POLICY_ITEM_SEND, uid, gid, message_type, n, path, interface, member);
                         if (allow)
                                 break;
                 }
                 if (!allow) {
                         STRV_FOREACH(nv, namesv) {
                                 last = *nv;
-                                allow = policy_check_one_send(p, uid, gid, message_type, *nv, path, interface, member);
+                                allow = policy_check_one(p, cache, POLICY_ITEM_SEND, uid, gid, message_type, *nv, path, interface, member);
                                 if (allow)
                                         break;
                         }
@@ -1238,6 +1433,9 @@ static int shared_policy_reload_unlocked(SharedPolicy *sp, char **configuration)
 
         pthread_rwlock_wrlock(&sp->rwlock);
         memcpy(&old, &sp->buffer, sizeof(old));
+        /* Make the per-connection decision caches drop what they
+         * learnt from the old policy */
+        buffer.generation = old.generation + 1;
         memcpy(&sp->buffer, &buffer, sizeof(buffer));
         free_old = !!sp->policy;
         sp->policy = &sp->buffer;
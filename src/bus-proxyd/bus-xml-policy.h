@@ -73,8 +73,14 @@ typedef struct Policy {
         LIST_HEAD(PolicyItem, no_console_items);
         Hashmap *user_items;
         Hashmap *group_items;
+
+        /* Bumped whenever the shared policy is reloaded */
+        uint64_t generation;
 } Policy;
 
+/* Per-connection cache of policy decisions */
+typedef struct PolicyCache PolicyCache;
+
 typedef struct SharedPolicy {
         char **configuration;
         pthread_mutex_t lock;
@@ -99,6 +105,7 @@ bool policy_check_one_recv(Policy *p,
                            const char *interface,
                            const char *member);
 bool policy_check_recv(Policy *p,
+                       PolicyCache *cache,
                        uid_t uid,
                        gid_t gid,
                        int message_type,
@@ -117,6 +124,7 @@ bool policy_check_one_send(Policy *p,
                            const char *interface,
                            const char *member);
 bool policy_check_send(Policy *p,
+                       PolicyCache *cache,
                        uid_t uid,
                        gid_t gid,
                        int message_type,
@@ -130,6 +138,12 @@ bool policy_check_send(Policy *p,
 
 void policy_dump(Policy *p);
 
+int policy_cache_new(PolicyCache **ret);
+PolicyCache *policy_cache_free(PolicyCache *c);
+void policy_cache_flush(PolicyCache *c);
+
+DEFINE_TRIVIAL_CLEANUP_FUNC(PolicyCache*, policy_cache_free);
+
 const char* policy_item_type_to_string(PolicyItemType t) _const_;
 PolicyItemType policy_item_type_from_string(const char *s) _pure_;
 
@@ -27,6 +27,7 @@
 #include <string.h>
 #include <errno.h>
 #include <poll.h>
+#include <fcntl.h>
 
 #include "log.h"
 #include "util.h"
@@ -129,6 +130,11 @@ static int proxy_create_local(Proxy *p, int in_fd, int out_fd, bool negotiate_fd
         if (r < 0)
                 return log_error_errno(r, "Failed to set credential negotiation: %m");
 
+        /* Don't let the client pass bodies as memfds if a dbus1
+         * destination can't take them, so that we can forward its
+         * messages as they are */
+        b->refuse_memfd = !p->destination_bus->is_kernel && !p->destination_bus->can_memfd;
+
         r = sd_bus_set_anonymous(b, true);
         if (r < 0)
                 return log_error_errno(r, "Failed to set anonymous authentication: %m");
@@ -276,6 +282,7 @@ Proxy *proxy_free(Proxy *p) {
         sd_bus_flush_close_unref(p->local_bus);
         sd_bus_flush_close_unref(p->destination_bus);
         set_free_free(p->owned_names);
+        policy_cache_free(p->policy_cache);
         free(p);
 
         return NULL;
@@ -293,6 +300,10 @@ int proxy_set_policy(Proxy *p, SharedPolicy *sp, char **configuration) {
         if (!p->destination_bus->is_kernel)
                 return 0;
 
+        r = policy_cache_new(&p->policy_cache);
+        if (r < 0)
+                return log_oom();
+
         p->policy = sp;
 
         policy = shared_policy_acquire(sp);
@@ -425,7 +436,7 @@ static int handle_policy_error(sd_bus_message *m, int r) {
         return r;
 }
 
-static int process_policy_unlocked(sd_bus *from, sd_bus *to, sd_bus_message *m, Policy *policy, const struct ucred *our_ucred, Set *owned_names) {
+static int process_policy_unlocked(sd_bus *from, sd_bus *to, sd_bus_message *m, Policy *policy, PolicyCache *cache, const struct ucred *our_ucred, Set *owned_names) {
         int r;
 
         assert(from);
@@ -485,8 +496,8 @@ static int process_policy_unlocked(sd_bus *from, sd_bus *to, sd_bus_message *m,
                 }
 
                 /* First check whether the sender can send the message to our name */
-                if (policy_check_send(policy, sender_uid, sender_gid, m->header->type, owned_names, NULL, m->path, m->interface, m->member, false, NULL) &&
-                    policy_check_recv(policy, our_ucred->uid, our_ucred->gid, m->header->type, NULL, sender_names, m->path, m->interface, m->member, false))
+                if (policy_check_send(policy, cache, sender_uid, sender_gid, m->header->type, owned_names, NULL, m->path, m->interface, m->member, false, NULL) &&
+                    policy_check_recv(policy, cache, our_ucred->uid, our_ucred->gid, m->header->type, NULL, sender_names, m->path, m->interface, m->member, false))
                         return 0;
 
                 /* Return an error back to the caller */
@@ -538,7 +549,7 @@ static int process_policy_unlocked(sd_bus *from, sd_bus *to, sd_bus_message *m,
                          * the message. Therefore, skip policy checks in this
                          * case. */
                         return 0;
-                } else if (policy_check_send(policy, our_ucred->uid, our_ucred->gid, m->header->type, NULL, destination_names, m->path, m->interface, m->member, true, &n)) {
+                } else if (policy_check_send(policy, cache, our_ucred->uid, our_ucred->gid, m->header->type, NULL, destination_names, m->path, m->interface, m->member, true, &n)) {
                         if (n) {
                                 /* If we made a receiver decision, then remember which
                                  * name's policy we used, and to which unique ID it
@@ -556,7 +567,7 @@ static int process_policy_unlocked(sd_bus *from, sd_bus *to, sd_bus_message *m,
                                         return r;
                         }
 
-                        if (policy_check_recv(policy, destination_uid, destination_gid, m->header->type, owned_names, NULL, m->path, m->interface, m->member, true))
+                        if (policy_check_recv(policy, cache, destination_uid, destination_gid, m->header->type, owned_names, NULL, m->path, m->interface, m->member, true))
                                 return 0;
                 }
 
@@ -571,14 +582,14 @@ static int process_policy_unlocked(sd_bus *from, sd_bus *to, sd_bus_message *m,
         return 0;
 }
 
-static int process_policy(sd_bus *from, sd_bus *to, sd_bus_message *m, SharedPolicy *sp, const struct ucred *our_ucred, Set *owned_names) {
+static int process_policy(sd_bus *from, sd_bus *to, sd_bus_message *m, SharedPolicy *sp, PolicyCache *cache, const struct ucred *our_ucred, Set *owned_names) {
         Policy *policy;
         int r;
 
         assert(sp);
 
         policy = shared_policy_acquire(sp);
-        r = process_policy_unlocked(from, to, m, policy, our_ucred, owned_names);
+        r = process_policy_unlocked(from, to, m, policy, cache, our_ucred, owned_names);
         shared_policy_release(sp, policy);
 
         return r;
@@ -755,7 +766,7 @@ static int proxy_process_destination_to_local(Proxy *p) {
         patch_sender(p->destination_bus, m);
 
         if (p->policy) {
-                r = process_policy(p->destination_bus, p->local_bus, m, p->policy, &p->local_creds, p->owned_names);
+                r = process_policy(p->destination_bus, p->local_bus, m, p->policy, p->policy_cache, &p->local_creds, p->owned_names);
                 if (r == -ECONNRESET || r == -ENOTCONN)
                         return r;
                 if (r < 0)
@@ -847,7 +858,7 @@ static int proxy_process_local_to_destination(Proxy *p) {
 
         for (;;) {
                 if (p->policy) {
-                        r = process_policy(p->local_bus, p->destination_bus, m, p->policy, &p->local_creds, p->owned_names);
+                        r = process_policy(p->local_bus, p->destination_bus, m, p->policy, p->policy_cache, &p->local_creds, p->owned_names);
                         if (r == -ECONNRESET || r == -ENOTCONN)
                                 return r;
                         if (r < 0)
@@ -890,6 +901,355 @@ int proxy_match(sd_bus_message *m, void *userdata, sd_bus_error *error) {
         return 0; /* make sure to continue processing it in further handlers */
 }
 
+/*
+ * Once the client said hello to a destination that isn't kdbus there is
+ * nothing left for us to do to the messages: there's no driver to emulate,
+ * no policy to enforce and no sender to patch, and both sides speak the
+ * same dbus1 wire format. Hence, as soon as both connections are idle we
+ * stop parsing messages altogether and just move the bytes from one fd to
+ * the other, via splice() if no fds need to be passed along.
+ */
+
+#define PROXY_RAW_CHUNK (128U * 1024U)
+
+typedef struct ProxyStream {
+        int in_fd;
+        int out_fd;
+        bool can_fds;
+        bool out_socket;
+        bool eof;
+
+        int pipe[2];
+        size_t n_pipe;
+
+        uint8_t *buffer;
+        size_t n_buffer;
+        size_t i_buffer;
+
+        int *fds;
+        unsigned n_fds;
+} ProxyStream;
+
+static bool proxy_can_forward_raw(Proxy *p) {
+        sd_bus *l = p->local_bus, *d = p->destination_bus;
+
+        assert(p);
+
+        if (!p->got_hello || p->policy)
+                return false;
+
+        if (d->is_kernel || l->is_kernel)
+                return false;
+
+        if (l->state != BUS_RUNNING || d->state != BUS_RUNNING)
+                return false;
+
+        /* Whatever one side negotiated, the other side must have
+         * agreed on too, as we won't translate anything anymore. */
+        if (l->can_fds != d->can_fds || l->can_memfd != d->can_memfd)
+                return false;
+
+        /* Only switch over at a message boundary, with nothing
+         * queued or half-read on either side */
+        if (l->rqueue_size > 0 || l->wqueue_size > 0 || l->rbuffer_size > 0 || l->n_fds > 0)
+                return false;
+        if (d->rqueue_size > 0 || d->wqueue_size > 0 || d->rbuffer_size > 0 || d->n_fds > 0)
+                return false;
+
+        return true;
+}
+
+static int proxy_stream_init(ProxyStream *s, sd_bus *from, sd_bus *to) {
+        assert(s);
+
+        s->in_fd = from->input_fd;
+        s->out_fd = to->output_fd;
+        s->can_fds = from->can_fds;
+        s->out_socket = true;
+        s->pipe[0] = s->pipe[1] = -1;
+
+        /* fds cannot be passed through a pipe, hence use splice()
+         * only if there are none to pass */
+        if (!s->can_fds && pipe2(s->pipe, O_CLOEXEC|O_NONBLOCK) >= 0)
+                return 0;
+
+        s->buffer = malloc(PROXY_RAW_CHUNK);
+        if (!s->buffer)
+                return -ENOMEM;
+
+        return 0;
+}
+
+static void proxy_stream_done(ProxyStream *s) {
+        assert(s);
+
+        safe_close_pair(s->pipe);
+        free(s->buffer);
+        close_many(s->fds, s->n_fds);
+        free(s->fds);
+}
+
+static bool proxy_stream_pending(ProxyStream *s) {
+        return s->n_pipe > 0 || s->i_buffer < s->n_buffer;
+}
+
+static int proxy_stream_drop_pipe(ProxyStream *s) {
+        ssize_t k;
+
+        /* Some fd types don't support splice(), copy through
+         * userspace then, including whatever is left in the pipe */
+
+        s->buffer = malloc(PROXY_RAW_CHUNK);
+        if (!s->buffer)
+                return -ENOMEM;
+
+        if (s->n_pipe > 0) {
+                k = read(s->pipe[0], s->buffer, s->n_pipe);
+                if (k < 0)
+                        return -errno;
+                if ((size_t) k != s->n_pipe)
+                        return -EIO;
+
+                s->n_buffer = s->n_pipe;
+                s->i_buffer = 0;
+                s->n_pipe = 0;
+        }
+
+        safe_close_pair(s->pipe);
+        return 0;
+}
+
+static int proxy_stream_read_fds(ProxyStream *s, struct msghdr *mh) {
+        struct cmsghdr *cmsg;
+
+        CMSG_FOREACH(cmsg, mh)
+                if (cmsg->cmsg_level == SOL_SOCKET &&
+                    cmsg->cmsg_type == SCM_RIGHTS) {
+                        int n, *f;
+
+                        n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+
+                        f = realloc(s->fds, sizeof(int) * (s->n_fds + n));
+                        if (!f) {
+                                close_many((int*) CMSG_DATA(cmsg), n);
+                                return -ENOMEM;
+                        }
+
+                        memcpy(f + s->n_fds, CMSG_DATA(cmsg), n * sizeof(int));
+                        s->fds = f;
+                        s->n_fds += n;
+                }
+
+        return 0;
+}
+
+static int proxy_stream_read(ProxyStream *s) {
+        ssize_t k;
+        int r;
+
+        assert(s);
+
+        if (s->eof || proxy_stream_pending(s))
+                return 0;
+
+        if (s->pipe[1] >= 0) {
+                k = splice(s->in_fd, NULL, s->pipe[1], NULL, PROXY_RAW_CHUNK, SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+                if (k < 0 && errno == EINVAL) {
+                        r = proxy_stream_drop_pipe(s);
+                        if (r < 0)
+                                return r;
+
+                        return proxy_stream_read(s);
+                }
+                if (k > 0)
+                        s->n_pipe = k;
+        } else if (s->can_fds) {
+                union {
+                        struct cmsghdr cmsghdr;
+                        uint8_t buf[CMSG_SPACE(sizeof(int) * BUS_FDS_MAX)];
+                } control;
+                struct iovec iov = {
+                        .iov_base = s->buffer,
+                        .iov_len = PROXY_RAW_CHUNK,
+                };
+                struct msghdr mh = {
+                        .msg_iov = &iov,
+                        .msg_iovlen = 1,
+                        .msg_control = &control,
+                        .msg_controllen = sizeof(control),
+                };
+
+                k = recvmsg(s->in_fd, &mh, MSG_DONTWAIT|MSG_CMSG_CLOEXEC);
+                if (k >= 0) {
+                        r = proxy_stream_read_fds(s, &mh);
+                        if (r < 0)
+                                return r;
+                }
+        } else
+                k = read(s->in_fd, s->buffer, PROXY_RAW_CHUNK);
+
+        if (k < 0)
+                return errno == EAGAIN ? 0 : -errno;
+        if (k == 0)
+                s->eof = true;
+        else if (s->pipe[1] < 0) {
+                s->n_buffer = k;
+                s->i_buffer = 0;
+        }
+
+        return 1;
+}
+
+static int proxy_stream_write(ProxyStream *s) {
+        ssize_t k;
+        int r;
+
+        assert(s);
+
+        if (s->n_pipe > 0) {
+                k = splice(s->pipe[0], NULL, s->out_fd, NULL, s->n_pipe, SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+                if (k < 0 && errno == EINVAL) {
+                        r = proxy_stream_drop_pipe(s);
+                        if (r < 0)
+                                return r;
+
+                        return proxy_stream_write(s);
+                }
+                if (k < 0)
+                        return errno == EAGAIN ? 0 : -errno;
+
+                s->n_pipe -= k;
+                return 1;
+        }
+
+        if (s->i_buffer >= s->n_buffer)
+                return 0;
+
+        if (s->out_socket) {
+                struct iovec iov = {
+                        .iov_base = s->buffer + s->i_buffer,
+                        .iov_len = s->n_buffer - s->i_buffer,
+                };
+                struct msghdr mh = {
+                        .msg_iov = &iov,
+                        .msg_iovlen = 1,
+                };
+                struct cmsghdr *control;
+
+                /* The fds go out with the first byte that came in
+                 * together with them, so the peer gets them before
+                 * (or with) the message they belong to */
+                if (s->n_fds > 0) {
+                        mh.msg_control = control = alloca(CMSG_SPACE(sizeof(int) * s->n_fds));
+                        mh.msg_controllen = control->cmsg_len = CMSG_LEN(sizeof(int) * s->n_fds);
+                        control->cmsg_level = SOL_SOCKET;
+                        control->cmsg_type = SCM_RIGHTS;
+                        memcpy(CMSG_DATA(control), s->fds, sizeof(int) * s->n_fds);
+                }
+
+                k = sendmsg(s->out_fd, &mh, MSG_DONTWAIT|MSG_NOSIGNAL);
+                if (k < 0 && errno == ENOTSOCK) {
+                        s->out_socket = false;
+                        k = write(s->out_fd, iov.iov_base, iov.iov_len);
+                }
+        } else
+                k = write(s->out_fd, s->buffer + s->i_buffer, s->n_buffer - s->i_buffer);
+
+        if (k < 0)
+                return errno == EAGAIN ? 0 : -errno;
+
+        /* Either passed on, or not passable to a non-socket at all */
+        close_many(s->fds, s->n_fds);
+        s->fds = mfree(s->fds);
+        s->n_fds = 0;
+
+        s->i_buffer += k;
+        return 1;
+}
+
+static void proxy_stream_poll(ProxyStream *s, struct pollfd *in, struct pollfd *out) {
+        *in = (struct pollfd) { .fd = -1 };
+        *out = (struct pollfd) { .fd = -1 };
+
+        if (proxy_stream_pending(s))
+                *out = (struct pollfd) { .fd = s->out_fd, .events = POLLOUT };
+        else if (!s->eof)
+                *in = (struct pollfd) { .fd = s->in_fd, .events = POLLIN };
+}
+
+static int proxy_forward_raw(Proxy *p) {
+        ProxyStream streams[2] = {
+                { .pipe = { -1, -1 } },
+                { .pipe = { -1, -1 } },
+        };
+        unsigned i;
+        int r;
+
+        assert(p);
+
+        log_debug("Nothing to translate between client and destination anymore, forwarding raw data.");
+
+        r = proxy_stream_init(&streams[0], p->local_bus, p->destination_bus);
+        if (r < 0)
+                goto finish;
+
+        r = proxy_stream_init(&streams[1], p->destination_bus, p->local_bus);
+        if (r < 0)
+                goto finish;
+
+        for (;;) {
+                struct pollfd pollfd[4];
+                bool busy = false;
+
+                for (i = 0; i < 2; i++) {
+                        r = proxy_stream_read(&streams[i]);
+                        if (r < 0)
+                                goto finish;
+                        if (r > 0)
+                                busy = true;
+
+                        r = proxy_stream_write(&streams[i]);
+                        if (r < 0)
+                                goto finish;
+                        if (r > 0)
+                                busy = true;
+
+                        /* Either side hung up, and everything it sent
+                         * is passed on: we are done */
+                        if (streams[i].eof && !proxy_stream_pending(&streams[i])) {
+                                r = 0;
+                                goto finish;
+                        }
+                }
+
+                if (busy)
+                        continue;
+
+                proxy_stream_poll(&streams[0], &pollfd[0], &pollfd[1]);
+                proxy_stream_poll(&streams[1], &pollfd[2], &pollfd[3]);
+
+                r = poll(pollfd, ELEMENTSOF(pollfd), -1);
+                if (r < 0) {
+                        if (errno == EINTR)
+                                continue;
+
+                        r = -errno;
+                        goto finish;
+                }
+        }
+
+finish:
+        proxy_stream_done(&streams[0]);
+        proxy_stream_done(&streams[1]);
+
+        if (r == -ECONNRESET || r == -EPIPE)
+                return 0;
+        if (r < 0)
+                return log_error_errno(r, "Failed to forward raw data: %m");
+
+        return 0;
+}
+
 int proxy_run(Proxy *p) {
         int r;
 
@@ -898,6 +1258,9 @@ int proxy_run(Proxy *p) {
         for (;;) {
                 bool busy = false;
 
+                if (proxy_can_forward_raw(p))
+                        return proxy_forward_raw(p);
+
                 if (p->got_hello) {
                         /* Read messages from bus, to pass them on to our client */
                         r = proxy_process_destination_to_local(p);
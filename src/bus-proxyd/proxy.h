@@ -39,6 +39,7 @@ struct Proxy {
 
         Set *owned_names;
         SharedPolicy *policy;
+        PolicyCache *policy_cache;
 
         LIST_HEAD(ProxyActivation, activations);
         size_t n_activations;
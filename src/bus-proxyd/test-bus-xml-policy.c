@@ -60,6 +60,27 @@ static int show_policy(const char *fn) {
         return 0;
 }
 
+static void test_policy_cache(Policy *p) {
+        _cleanup_(policy_cache_freep) PolicyCache *cache = NULL;
+        unsigned i;
+
+        assert_se(policy_cache_new(&cache) >= 0);
+
+        /* Cached decisions must match the uncached ones, also after
+         * the policy has been reloaded */
+        for (i = 0; i < 4; i++) {
+                assert_se(policy_check_send(p, cache, 0, 0, SD_BUS_MESSAGE_METHOD_CALL, NULL, STRV_MAKE("org.test.test1"), "/an/object/path", "org.test.int2", "Member", true, NULL) == false);
+                assert_se(policy_check_send(p, cache, 0, 0, SD_BUS_MESSAGE_METHOD_CALL, NULL, STRV_MAKE("org.test.test1"), "/an/object/path", "org.foo.FooBroadcastInterface", "Member", true, NULL) == true);
+                assert_se(policy_check_send(p, cache, 100, 0, SD_BUS_MESSAGE_METHOD_CALL, NULL, STRV_MAKE("org.test.test1"), "/an/object/path", "org.foo.FooBroadcastInterface", "Member", true, NULL) == false);
+                assert_se(policy_check_recv(p, cache, 100, 0, SD_BUS_MESSAGE_METHOD_CALL, NULL, STRV_MAKE("org.foo.FooService"), "/an/object/path", "org.foo.FooBroadcastInterface", "Member", true) == true);
+                assert_se(policy_check_recv(p, cache, 100, 0, SD_BUS_MESSAGE_METHOD_CALL, NULL, STRV_MAKE("org.foo.FooService"), "/an/object/path", "org.foo.FooBroadcastInterface2", "Member", true) == false);
+                assert_se(policy_check_recv(p, cache, 100, 0, SD_BUS_MESSAGE_METHOD_CALL, NULL, STRV_MAKE("org.foo.FooService2", "org.foo.FooService"), "/an/object/path", "org.foo.FooBroadcastInterface", "Member", true) == true);
+
+                if (i == 1)
+                        p->generation++;
+        }
+}
+
 int main(int argc, char *argv[]) {
 
         Policy p = {};
@@ -163,6 +184,8 @@ int main(int argc, char *argv[]) {
         assert_se(policy_check_one_recv(&p, 100, 0, SD_BUS_MESSAGE_METHOD_CALL, "org.foo.FooService", "/an/object/path", "org.foo.FooBroadcastInterface2", "Member") == false);
         assert_se(policy_check_one_recv(&p, 100, 0, SD_BUS_MESSAGE_METHOD_CALL, "org.foo.FooService2", "/an/object/path", "org.foo.FooBroadcastInterface", "Member") == false);
 
+        test_policy_cache(&p);
+
         policy_free(&p);
 
         return EXIT_SUCCESS;
@@ -20,10 +20,30 @@
 ***/
 
 #include <stdlib.h>
+#include <sys/socket.h>
 
 #include "sd-bus.h"
 #include "log.h"
 #include "bus-util.h"
+#include "def.h"
+#include "socket-util.h"
+
+static int send_datagram(const char *cgroup) {
+        static const union sockaddr_union sa = {
+                .un.sun_family = AF_UNIX,
+                .un.sun_path = CGROUPS_AGENT_SOCKET,
+        };
+        _cleanup_close_ int fd = -1;
+
+        fd = socket(AF_UNIX, SOCK_DGRAM|SOCK_CLOEXEC, 0);
+        if (fd < 0)
+                return -errno;
+
+        if (sendto(fd, cgroup, strlen(cgroup), 0, &sa.sa, offsetof(struct sockaddr_un, sun_path) + strlen(sa.un.sun_path)) < 0)
+                return -errno;
+
+        return 0;
+}
 
 int main(int argc, char *argv[]) {
         _cleanup_bus_flush_close_unref_ sd_bus *bus = NULL;
@@ -38,6 +58,13 @@ int main(int argc, char *argv[]) {
         log_parse_environment();
         log_open();
 
+        /* Preferably, hand the event to PID 1 with a single datagram */
+        r = send_datagram(argv[1]);
+        if (r >= 0)
+                return EXIT_SUCCESS;
+
+        log_debug_errno(r, "Failed to send cgroups agent datagram, falling back to D-Bus: %m");
+
         /* We send this event to the private D-Bus socket and then the
          * system instance will forward this to the system bus. We do
          * this to avoid an activation loop when we start dbus when we
@@ -62,6 +62,13 @@ typedef struct Group {
         uint64_t io_input, io_output;
         nsec_t io_timestamp;
         uint64_t io_input_bps, io_output_bps;
+
+        /* The attribute files are kept open between iterations, and
+         * simply read again from the start */
+        int pids_fd;
+        int cpu_fd;
+        int memory_fd;
+        int io_fd;
 } Group;
 
 static unsigned arg_depth = 3;
@@ -94,10 +101,81 @@ static enum {
 static void group_free(Group *g) {
         assert(g);
 
+        safe_close(g->pids_fd);
+        safe_close(g->cpu_fd);
+        safe_close(g->memory_fd);
+        safe_close(g->io_fd);
+
         free(g->path);
         free(g);
 }
 
+static int group_read_attribute(
+                int *fd,
+                const char *controller,
+                const char *path,
+                const char *attribute,
+                char *buf,
+                size_t size) {
+
+        ssize_t n;
+        int r;
+
+        assert(fd);
+        assert(buf);
+        assert(size > 0);
+
+        /* Opens the attribute file on first use, afterwards just
+         * rereads it with pread(), which makes the kernel regenerate
+         * the contents. Returns -ENOENT if the group went away, and
+         * -EFBIG if the buffer was too small. */
+
+        if (*fd < 0) {
+                _cleanup_free_ char *p = NULL;
+
+                r = cg_get_path(controller, path, attribute, &p);
+                if (r < 0)
+                        return r;
+
+                *fd = open(p, O_RDONLY|O_CLOEXEC|O_NOCTTY);
+                if (*fd < 0)
+                        return -errno;
+        }
+
+        n = pread(*fd, buf, size - 1, 0);
+        if (n < 0) {
+                /* Removed cgroups return ENODEV on open files. Close
+                 * it, in case the group is created again later. */
+                if (errno == ENODEV) {
+                        *fd = safe_close(*fd);
+                        return -ENOENT;
+                }
+                return -errno;
+        }
+        if ((size_t) n >= size - 1)
+                return -EFBIG;
+
+        buf[n] = 0;
+        return 0;
+}
+
+static int group_read_uint64(
+                int *fd,
+                const char *controller,
+                const char *path,
+                const char *attribute,
+                uint64_t *ret) {
+
+        char buf[DECIMAL_STR_MAX(uint64_t) + 2];
+        int r;
+
+        r = group_read_attribute(fd, controller, path, attribute, buf, sizeof(buf));
+        if (r < 0)
+                return r;
+
+        return safe_atou64(strstrip(buf), ret);
+}
+
 static void group_hashmap_clear(Hashmap *h) {
         Group *g;
 
@@ -143,6 +221,8 @@ static int process(
                         if (!g)
                                 return -ENOMEM;
 
+                        g->pids_fd = g->cpu_fd = g->memory_fd = g->io_fd = -1;
+
                         g->path = strdup(path);
                         if (!g->path) {
                                 group_free(g);
@@ -186,44 +266,26 @@ static int process(
                         g->n_tasks_valid = true;
 
         } else if (streq(controller, "pids") && arg_count == COUNT_PIDS) {
-                _cleanup_free_ char *p = NULL, *v = NULL;
 
-                r = cg_get_path(controller, path, "pids.current", &p);
-                if (r < 0)
-                        return r;
-
-                r = read_one_line_file(p, &v);
+                r = group_read_uint64(&g->pids_fd, controller, path, "pids.current", &g->n_tasks);
                 if (r == -ENOENT)
                         return 0;
                 if (r < 0)
                         return r;
 
-                r = safe_atou64(v, &g->n_tasks);
-                if (r < 0)
-                        return r;
-
                 if (g->n_tasks > 0)
                         g->n_tasks_valid = true;
 
         } else if (streq(controller, "cpuacct") && cg_unified() <= 0) {
-                _cleanup_free_ char *p = NULL, *v = NULL;
                 uint64_t new_usage;
                 nsec_t timestamp;
 
-                r = cg_get_path(controller, path, "cpuacct.usage", &p);
-                if (r < 0)
-                        return r;
-
-                r = read_one_line_file(p, &v);
+                r = group_read_uint64(&g->cpu_fd, controller, path, "cpuacct.usage", &new_usage);
                 if (r == -ENOENT)
                         return 0;
                 if (r < 0)
                         return r;
 
-                r = safe_atou64(v, &new_usage);
-                if (r < 0)
-                        return r;
-
                 timestamp = now_nsec(CLOCK_MONOTONIC);
 
                 if (g->cpu_iteration == iteration - 1 &&
@@ -245,51 +307,54 @@ static int process(
                 g->cpu_iteration = iteration;
 
         } else if (streq(controller, "memory")) {
-                _cleanup_free_ char *p = NULL, *v = NULL;
-
-                if (cg_unified() <= 0)
-                        r = cg_get_path(controller, path, "memory.usage_in_bytes", &p);
-                else
-                        r = cg_get_path(controller, path, "memory.current", &p);
-                if (r < 0)
-                        return r;
 
-                r = read_one_line_file(p, &v);
+                r = group_read_uint64(&g->memory_fd, controller, path,
+                                      cg_unified() <= 0 ? "memory.usage_in_bytes" : "memory.current",
+                                      &g->memory);
                 if (r == -ENOENT)
                         return 0;
                 if (r < 0)
                         return r;
 
-                r = safe_atou64(v, &g->memory);
-                if (r < 0)
-                        return r;
-
                 if (g->memory > 0)
                         g->memory_valid = true;
 
         } else if (streq(controller, "blkio") && cg_unified() <= 0) {
-                _cleanup_fclose_ FILE *f = NULL;
-                _cleanup_free_ char *p = NULL;
+                static char *buf = NULL;
+                static size_t buf_size = 0;
                 uint64_t wr = 0, rd = 0;
                 nsec_t timestamp;
+                char *line, *state;
 
-                r = cg_get_path(controller, path, "blkio.io_service_bytes", &p);
-                if (r < 0)
-                        return r;
+                /* The buffer is shared by all groups and only ever
+                 * grows, as the file has one block of lines per
+                 * device */
+                for (;;) {
+                        size_t n;
+                        char *nb;
 
-                f = fopen(p, "re");
-                if (!f) {
-                        if (errno == ENOENT)
-                                return 0;
-                        return -errno;
+                        if (buf_size > 0) {
+                                r = group_read_attribute(&g->io_fd, controller, path, "blkio.io_service_bytes", buf, buf_size);
+                                if (r != -EFBIG)
+                                        break;
+                        }
+
+                        n = MAX(buf_size * 2, (size_t) 4096);
+                        nb = realloc(buf, n);
+                        if (!nb)
+                                return -ENOMEM;
+
+                        buf = nb;
+                        buf_size = n;
                 }
+                if (r == -ENOENT)
+                        return 0;
+                if (r < 0)
+                        return r;
 
-                for (;;) {
-                        char line[LINE_MAX], *l;
+                for (line = strtok_r(buf, NEWLINE, &state); line; line = strtok_r(NULL, NEWLINE, &state)) {
                         uint64_t k, *q;
-
-                        if (!fgets(line, sizeof(line), f))
-                                break;
+                        char *l;
 
                         l = strstrip(line);
                         l += strcspn(l, WHITESPACE);
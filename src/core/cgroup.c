@@ -21,10 +21,14 @@
 
 #include <fcntl.h>
 #include <fnmatch.h>
+#include <sys/socket.h>
 
 #include "cgroup-util.h"
+#include "def.h"
+#include "mkdir.h"
 #include "path-util.h"
 #include "process-util.h"
+#include "socket-util.h"
 #include "special.h"
 
 #include "cgroup.h"
@@ -185,12 +189,72 @@ static int lookup_blkio_device(const char *p, dev_t *dev) {
         return 0;
 }
 
-static int whitelist_device(const char *path, const char *node, const char *acc) {
+/* Attributes of a cgroup are written relative to a directory fd per
+ * controller hierarchy, which we open only once for all of them. */
+typedef struct CGroupAttributeWriter {
+        const char *path;
+        int dir_fd[_CGROUP_CONTROLLER_MAX];
+} CGroupAttributeWriter;
+
+static void cgroup_attribute_writer_init(CGroupAttributeWriter *w, const char *path) {
+        CGroupController c;
+
+        assert(w);
+        assert(path);
+
+        w->path = path;
+
+        for (c = 0; c < _CGROUP_CONTROLLER_MAX; c++)
+                w->dir_fd[c] = -1;
+}
+
+static void cgroup_attribute_writer_done(CGroupAttributeWriter *w) {
+        CGroupController c;
+
+        assert(w);
+
+        for (c = 0; c < _CGROUP_CONTROLLER_MAX; c++)
+                w->dir_fd[c] = safe_close(w->dir_fd[c]);
+}
+
+static int cgroup_attribute_write(CGroupAttributeWriter *w, CGroupController c, const char *attribute, const char *value) {
+        _cleanup_close_ int fd = -1;
+
+        assert(w);
+        assert(c >= 0);
+        assert(c < _CGROUP_CONTROLLER_MAX);
+        assert(attribute);
+        assert(value);
+
+        if (w->dir_fd[c] < 0) {
+                _cleanup_free_ char *p = NULL;
+                int r;
+
+                r = cg_get_path(cgroup_controller_to_string(c), w->path, NULL, &p);
+                if (r < 0)
+                        return r;
+
+                w->dir_fd[c] = open(p, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+                if (w->dir_fd[c] < 0)
+                        return -errno;
+        }
+
+        fd = openat(w->dir_fd[c], attribute, O_WRONLY|O_CLOEXEC|O_NOCTTY);
+        if (fd < 0)
+                return -errno;
+
+        if (!endswith(value, "\n"))
+                value = strjoina(value, "\n");
+
+        return loop_write(fd, value, strlen(value), false);
+}
+
+static int whitelist_device(CGroupAttributeWriter *writer, const char *node, const char *acc) {
         char buf[2+DECIMAL_STR_MAX(dev_t)*2+2+4];
         struct stat st;
         int r;
 
-        assert(path);
+        assert(writer);
         assert(acc);
 
         if (stat(node, &st) < 0) {
@@ -209,21 +273,21 @@ static int whitelist_device(const char *path, const char *node, const char *acc)
                 major(st.st_rdev), minor(st.st_rdev),
                 acc);
 
-        r = cg_set_attribute("devices", path, "devices.allow", buf);
+        r = cgroup_attribute_write(writer, CGROUP_CONTROLLER_DEVICES, "devices.allow", buf);
         if (r < 0)
                 log_full_errno(IN_SET(r, -ENOENT, -EROFS, -EINVAL) ? LOG_DEBUG : LOG_WARNING, r,
-                               "Failed to set devices.allow on %s: %m", path);
+                               "Failed to set devices.allow on %s: %m", writer->path);
 
         return r;
 }
 
-static int whitelist_major(const char *path, const char *name, char type, const char *acc) {
+static int whitelist_major(CGroupAttributeWriter *writer, const char *name, char type, const char *acc) {
         _cleanup_fclose_ FILE *f = NULL;
         char line[LINE_MAX];
         bool good = false;
         int r;
 
-        assert(path);
+        assert(writer);
         assert(acc);
         assert(type == 'b' || type == 'c');
 
@@ -280,10 +344,10 @@ static int whitelist_major(const char *path, const char *name, char type, const
                         maj,
                         acc);
 
-                r = cg_set_attribute("devices", path, "devices.allow", buf);
+                r = cgroup_attribute_write(writer, CGROUP_CONTROLLER_DEVICES, "devices.allow", buf);
                 if (r < 0)
                         log_full_errno(IN_SET(r, -ENOENT, -EROFS, -EINVAL) ? LOG_DEBUG : LOG_WARNING, r,
-                                       "Failed to set devices.allow on %s: %m", path);
+                                       "Failed to set devices.allow on %s: %m", writer->path);
         }
 
         return 0;
@@ -294,6 +358,7 @@ fail:
 }
 
 void cgroup_context_apply(CGroupContext *c, CGroupMask mask, const char *path, uint32_t netclass, ManagerState state) {
+        CGroupAttributeWriter writer;
         bool is_root;
         int r;
 
@@ -310,6 +375,8 @@ void cgroup_context_apply(CGroupContext *c, CGroupMask mask, const char *path, u
                 /* Make sure we don't try to display messages with an empty path. */
                 path = "/";
 
+        cgroup_attribute_writer_init(&writer, path);
+
         /* We generally ignore errors caused by read-only mounted
          * cgroup trees (assuming we are running in a container then),
          * and missing cgroups, i.e. EROFS and ENOENT. */
@@ -320,22 +387,22 @@ void cgroup_context_apply(CGroupContext *c, CGroupMask mask, const char *path, u
                 sprintf(buf, "%" PRIu64 "\n",
                         IN_SET(state, MANAGER_STARTING, MANAGER_INITIALIZING) && c->startup_cpu_shares != CGROUP_CPU_SHARES_INVALID ? c->startup_cpu_shares :
                         c->cpu_shares != CGROUP_CPU_SHARES_INVALID ? c->cpu_shares : CGROUP_CPU_SHARES_DEFAULT);
-                r = cg_set_attribute("cpu", path, "cpu.shares", buf);
+                r = cgroup_attribute_write(&writer, CGROUP_CONTROLLER_CPU, "cpu.shares", buf);
                 if (r < 0)
                         log_full_errno(IN_SET(r, -ENOENT, -EROFS) ? LOG_DEBUG : LOG_WARNING, r,
                                        "Failed to set cpu.shares on %s: %m", path);
 
                 sprintf(buf, USEC_FMT "\n", CGROUP_CPU_QUOTA_PERIOD_USEC);
-                r = cg_set_attribute("cpu", path, "cpu.cfs_period_us", buf);
+                r = cgroup_attribute_write(&writer, CGROUP_CONTROLLER_CPU, "cpu.cfs_period_us", buf);
                 if (r < 0)
                         log_full_errno(IN_SET(r, -ENOENT, -EROFS) ? LOG_DEBUG : LOG_WARNING, r,
                                        "Failed to set cpu.cfs_period_us on %s: %m", path);
 
                 if (c->cpu_quota_per_sec_usec != USEC_INFINITY) {
                         sprintf(buf, USEC_FMT "\n", c->cpu_quota_per_sec_usec * CGROUP_CPU_QUOTA_PERIOD_USEC / USEC_PER_SEC);
-                        r = cg_set_attribute("cpu", path, "cpu.cfs_quota_us", buf);
+                        r = cgroup_attribute_write(&writer, CGROUP_CONTROLLER_CPU, "cpu.cfs_quota_us", buf);
                 } else
-                        r = cg_set_attribute("cpu", path, "cpu.cfs_quota_us", "-1");
+                        r = cgroup_attribute_write(&writer, CGROUP_CONTROLLER_CPU, "cpu.cfs_quota_us", "-1");
                 if (r < 0)
                         log_full_errno(IN_SET(r, -ENOENT, -EROFS) ? LOG_DEBUG : LOG_WARNING, r,
                                        "Failed to set cpu.cfs_quota_us on %s: %m", path);
@@ -351,7 +418,7 @@ void cgroup_context_apply(CGroupContext *c, CGroupMask mask, const char *path, u
                         sprintf(buf, "%" PRIu64 "\n",
                                 IN_SET(state, MANAGER_STARTING, MANAGER_INITIALIZING) && c->startup_blockio_weight != CGROUP_BLKIO_WEIGHT_INVALID ? c->startup_blockio_weight :
                                 c->blockio_weight != CGROUP_BLKIO_WEIGHT_INVALID ? c->blockio_weight : CGROUP_BLKIO_WEIGHT_DEFAULT);
-                        r = cg_set_attribute("blkio", path, "blkio.weight", buf);
+                        r = cgroup_attribute_write(&writer, CGROUP_CONTROLLER_BLKIO, "blkio.weight", buf);
                         if (r < 0)
                                 log_full_errno(IN_SET(r, -ENOENT, -EROFS) ? LOG_DEBUG : LOG_WARNING, r,
                                                "Failed to set blkio.weight on %s: %m", path);
@@ -365,7 +432,7 @@ void cgroup_context_apply(CGroupContext *c, CGroupMask mask, const char *path, u
                                         continue;
 
                                 sprintf(buf, "%u:%u %" PRIu64 "\n", major(dev), minor(dev), w->weight);
-                                r = cg_set_attribute("blkio", path, "blkio.weight_device", buf);
+                                r = cgroup_attribute_write(&writer, CGROUP_CONTROLLER_BLKIO, "blkio.weight_device", buf);
                                 if (r < 0)
                                         log_full_errno(IN_SET(r, -ENOENT, -EROFS) ? LOG_DEBUG : LOG_WARNING, r,
                                                        "Failed to set blkio.weight_device on %s: %m", path);
@@ -384,7 +451,7 @@ void cgroup_context_apply(CGroupContext *c, CGroupMask mask, const char *path, u
                         a = b->read ? "blkio.throttle.read_bps_device" : "blkio.throttle.write_bps_device";
 
                         sprintf(buf, "%u:%u %" PRIu64 "\n", major(dev), minor(dev), b->bandwidth);
-                        r = cg_set_attribute("blkio", path, a, buf);
+                        r = cgroup_attribute_write(&writer, CGROUP_CONTROLLER_BLKIO, a, buf);
                         if (r < 0)
                                 log_full_errno(IN_SET(r, -ENOENT, -EROFS) ? LOG_DEBUG : LOG_WARNING, r,
                                                "Failed to set %s on %s: %m", a, path);
@@ -398,15 +465,15 @@ void cgroup_context_apply(CGroupContext *c, CGroupMask mask, const char *path, u
                         sprintf(buf, "%" PRIu64 "\n", c->memory_limit);
 
                         if (cg_unified() <= 0)
-                                r = cg_set_attribute("memory", path, "memory.limit_in_bytes", buf);
+                                r = cgroup_attribute_write(&writer, CGROUP_CONTROLLER_MEMORY, "memory.limit_in_bytes", buf);
                         else
-                                r = cg_set_attribute("memory", path, "memory.max", buf);
+                                r = cgroup_attribute_write(&writer, CGROUP_CONTROLLER_MEMORY, "memory.max", buf);
 
                 } else {
                         if (cg_unified() <= 0)
-                                r = cg_set_attribute("memory", path, "memory.limit_in_bytes", "-1");
+                                r = cgroup_attribute_write(&writer, CGROUP_CONTROLLER_MEMORY, "memory.limit_in_bytes", "-1");
                         else
-                                r = cg_set_attribute("memory", path, "memory.max", "max");
+                                r = cgroup_attribute_write(&writer, CGROUP_CONTROLLER_MEMORY, "memory.max", "max");
                 }
 
                 if (r < 0)
@@ -422,9 +489,9 @@ void cgroup_context_apply(CGroupContext *c, CGroupMask mask, const char *path, u
                  * here. */
 
                 if (c->device_allow || c->device_policy != CGROUP_AUTO)
-                        r = cg_set_attribute("devices", path, "devices.deny", "a");
+                        r = cgroup_attribute_write(&writer, CGROUP_CONTROLLER_DEVICES, "devices.deny", "a");
                 else
-                        r = cg_set_attribute("devices", path, "devices.allow", "a");
+                        r = cgroup_attribute_write(&writer, CGROUP_CONTROLLER_DEVICES, "devices.allow", "a");
                 if (r < 0)
                         log_full_errno(IN_SET(r, -ENOENT, -EROFS, -EINVAL) ? LOG_DEBUG : LOG_WARNING, r,
                                        "Failed to reset devices.list on %s: %m", path);
@@ -443,11 +510,11 @@ void cgroup_context_apply(CGroupContext *c, CGroupMask mask, const char *path, u
                         const char *x, *y;
 
                         NULSTR_FOREACH_PAIR(x, y, auto_devices)
-                                whitelist_device(path, x, y);
+                                whitelist_device(&writer, x, y);
 
-                        whitelist_major(path, "pts", 'c', "rw");
-                        whitelist_major(path, "kdbus", 'c', "rw");
-                        whitelist_major(path, "kdbus/*", 'c', "rw");
+                        whitelist_major(&writer, "pts", 'c', "rw");
+                        whitelist_major(&writer, "kdbus", 'c', "rw");
+                        whitelist_major(&writer, "kdbus/*", 'c', "rw");
                 }
 
                 LIST_FOREACH(device_allow, a, c->device_allow) {
@@ -467,11 +534,11 @@ void cgroup_context_apply(CGroupContext *c, CGroupMask mask, const char *path, u
                         acc[k++] = 0;
 
                         if (startswith(a->path, "/dev/"))
-                                whitelist_device(path, a->path, acc);
+                                whitelist_device(&writer, a->path, acc);
                         else if (startswith(a->path, "block-"))
-                                whitelist_major(path, a->path + 6, 'b', acc);
+                                whitelist_major(&writer, a->path + 6, 'b', acc);
                         else if (startswith(a->path, "char-"))
-                                whitelist_major(path, a->path + 5, 'c', acc);
+                                whitelist_major(&writer, a->path + 5, 'c', acc);
                         else
                                 log_debug("Ignoring device %s while writing cgroup attribute.", a->path);
                 }
@@ -483,9 +550,9 @@ void cgroup_context_apply(CGroupContext *c, CGroupMask mask, const char *path, u
                         char buf[DECIMAL_STR_MAX(uint64_t) + 2];
 
                         sprintf(buf, "%" PRIu64 "\n", c->tasks_max);
-                        r = cg_set_attribute("pids", path, "pids.max", buf);
+                        r = cgroup_attribute_write(&writer, CGROUP_CONTROLLER_PIDS, "pids.max", buf);
                 } else
-                        r = cg_set_attribute("pids", path, "pids.max", "max");
+                        r = cgroup_attribute_write(&writer, CGROUP_CONTROLLER_PIDS, "pids.max", "max");
 
                 if (r < 0)
                         log_full_errno(IN_SET(r, -ENOENT, -EROFS) ? LOG_DEBUG : LOG_WARNING, r,
@@ -497,11 +564,94 @@ void cgroup_context_apply(CGroupContext *c, CGroupMask mask, const char *path, u
 
                 sprintf(buf, "%" PRIu32, netclass);
 
-                r = cg_set_attribute("net_cls", path, "net_cls.classid", buf);
+                r = cgroup_attribute_write(&writer, CGROUP_CONTROLLER_NET_CLS, "net_cls.classid", buf);
                 if (r < 0)
                         log_full_errno(IN_SET(r, -ENOENT, -EROFS) ? LOG_DEBUG : LOG_WARNING, r,
                                        "Failed to set net_cls.classid on %s: %m", path);
         }
+
+        cgroup_attribute_writer_done(&writer);
+}
+
+static void digest_add(uint64_t *h, const void *p, size_t n) {
+        const uint8_t *q = p;
+
+        /* FNV-1a */
+        for (; n > 0; n--, q++) {
+                *h ^= *q;
+                *h *= UINT64_C(0x100000001b3);
+        }
+}
+
+static void digest_add_string(uint64_t *h, const char *s) {
+        digest_add(h, s, strlen(s) + 1);
+}
+
+/* Returns a digest of everything cgroup_context_apply() would write
+ * with the same arguments, never 0 */
+static uint64_t cgroup_context_digest(CGroupContext *c, CGroupMask mask, const char *path, uint32_t netclass, ManagerState state) {
+        uint64_t h = UINT64_C(0xcbf29ce484222325);
+        bool startup;
+
+        assert(c);
+        assert(path);
+
+        startup = IN_SET(state, MANAGER_STARTING, MANAGER_INITIALIZING);
+
+        digest_add(&h, &mask, sizeof(mask));
+        digest_add_string(&h, path);
+
+        if (mask & CGROUP_MASK_CPU) {
+                uint64_t shares;
+
+                shares = startup && c->startup_cpu_shares != CGROUP_CPU_SHARES_INVALID ? c->startup_cpu_shares : c->cpu_shares;
+                digest_add(&h, &shares, sizeof(shares));
+                digest_add(&h, &c->cpu_quota_per_sec_usec, sizeof(c->cpu_quota_per_sec_usec));
+        }
+
+        if (mask & CGROUP_MASK_BLKIO) {
+                CGroupBlockIODeviceWeight *w;
+                CGroupBlockIODeviceBandwidth *b;
+                uint64_t weight;
+
+                weight = startup && c->startup_blockio_weight != CGROUP_BLKIO_WEIGHT_INVALID ? c->startup_blockio_weight : c->blockio_weight;
+                digest_add(&h, &weight, sizeof(weight));
+
+                LIST_FOREACH(device_weights, w, c->blockio_device_weights) {
+                        digest_add_string(&h, w->path);
+                        digest_add(&h, &w->weight, sizeof(w->weight));
+                }
+
+                LIST_FOREACH(device_bandwidths, b, c->blockio_device_bandwidths) {
+                        digest_add_string(&h, b->path);
+                        digest_add(&h, &b->read, sizeof(b->read));
+                        digest_add(&h, &b->bandwidth, sizeof(b->bandwidth));
+                }
+        }
+
+        if (mask & CGROUP_MASK_MEMORY)
+                digest_add(&h, &c->memory_limit, sizeof(c->memory_limit));
+
+        if (mask & CGROUP_MASK_DEVICES) {
+                CGroupDeviceAllow *a;
+
+                digest_add(&h, &c->device_policy, sizeof(c->device_policy));
+
+                LIST_FOREACH(device_allow, a, c->device_allow) {
+                        char acc[3] = { a->r, a->w, a->m };
+
+                        digest_add_string(&h, a->path);
+                        digest_add(&h, acc, sizeof(acc));
+                }
+        }
+
+        if (mask & CGROUP_MASK_PIDS)
+                digest_add(&h, &c->tasks_max, sizeof(c->tasks_max));
+
+        if (mask & CGROUP_MASK_NET_CLS)
+                digest_add(&h, &netclass, sizeof(netclass));
+
+        return h ?: 1;
 }
 
 CGroupMask cgroup_context_get_mask(CGroupContext *c) {
@@ -585,7 +735,7 @@ CGroupMask unit_get_members_mask(Unit *u) {
                 Unit *member;
                 Iterator i;
 
-                SET_FOREACH(member, u->dependencies[UNIT_BEFORE], i) {
+                UNIT_FOREACH_DEPENDENCY(member, u, UNIT_BEFORE, i) {
 
                         if (member == u)
                                 continue;
@@ -777,7 +927,7 @@ int unit_set_cgroup_path(Unit *u, const char *path) {
 }
 
 int unit_watch_cgroup(Unit *u) {
-        _cleanup_free_ char *populated = NULL;
+        _cleanup_free_ char *events = NULL;
         int r;
 
         assert(u);
@@ -803,11 +953,22 @@ int unit_watch_cgroup(Unit *u) {
         if (r < 0)
                 return log_oom();
 
-        r = cg_get_path(SYSTEMD_CGROUP_CONTROLLER, u->cgroup_path, "cgroup.populated", &populated);
+        /* Newer kernels report the populated state in
+         * "cgroup.events", older ones in "cgroup.populated". */
+        r = cg_get_path(SYSTEMD_CGROUP_CONTROLLER, u->cgroup_path, "cgroup.events", &events);
         if (r < 0)
                 return log_oom();
 
-        u->cgroup_inotify_wd = inotify_add_watch(u->manager->cgroup_inotify_fd, populated, IN_MODIFY);
+        u->cgroup_inotify_wd = inotify_add_watch(u->manager->cgroup_inotify_fd, events, IN_MODIFY);
+        if (u->cgroup_inotify_wd < 0 && errno == ENOENT) {
+                events = mfree(events);
+
+                r = cg_get_path(SYSTEMD_CGROUP_CONTROLLER, u->cgroup_path, "cgroup.populated", &events);
+                if (r < 0)
+                        return log_oom();
+
+                u->cgroup_inotify_wd = inotify_add_watch(u->manager->cgroup_inotify_fd, events, IN_MODIFY);
+        }
         if (u->cgroup_inotify_wd < 0) {
 
                 if (errno == ENOENT) /* If the directory is already
@@ -1009,6 +1170,8 @@ int unit_remove_from_netclass_cgroup(Unit *u) {
  * Returns 0 on success and < 0 on failure. */
 static int unit_realize_cgroup_now(Unit *u, ManagerState state) {
         CGroupMask target_mask, enable_mask;
+        CGroupContext *c;
+        uint64_t digest;
         int r;
 
         assert(u);
@@ -1035,8 +1198,15 @@ static int unit_realize_cgroup_now(Unit *u, ManagerState state) {
         if (r < 0)
                 return r;
 
-        /* Finally, apply the necessary attributes. */
-        cgroup_context_apply(unit_get_cgroup_context(u), target_mask, u->cgroup_path, u->cgroup_netclass_id, state);
+        /* Finally, apply the necessary attributes, unless we know
+         * that exactly these are in place already, for example
+         * because only our siblings changed, or we were reloaded. */
+        c = unit_get_cgroup_context(u);
+        digest = cgroup_context_digest(c, target_mask, u->cgroup_path, u->cgroup_netclass_id, state);
+        if (digest != u->cgroup_applied_digest) {
+                cgroup_context_apply(c, target_mask, u->cgroup_path, u->cgroup_netclass_id, state);
+                u->cgroup_applied_digest = digest;
+        }
 
         return 0;
 }
@@ -1082,7 +1252,7 @@ static void unit_queue_siblings(Unit *u) {
                 Iterator i;
                 Unit *m;
 
-                SET_FOREACH(m, slice->dependencies[UNIT_BEFORE], i) {
+                UNIT_FOREACH_DEPENDENCY(m, slice, UNIT_BEFORE, i) {
                         if (m == u)
                                 continue;
 
@@ -1143,6 +1313,11 @@ void unit_release_cgroup(Unit *u) {
                 u->cgroup_path = mfree(u->cgroup_path);
         }
 
+        u->cgroup_applied_digest = 0;
+
+        u->sampled_memory_current = u->sampled_tasks_current = (uint64_t) -1;
+        u->sampled_cpu_usage = (nsec_t) -1;
+
         if (u->cgroup_inotify_wd >= 0) {
                 if (inotify_rm_watch(u->manager->cgroup_inotify_fd, u->cgroup_inotify_wd) < 0)
                         log_unit_debug_errno(u, errno, "Failed to remove cgroup inotify watch %i for %s, ignoring", u->cgroup_inotify_wd, u->id);
@@ -1309,6 +1484,39 @@ int unit_notify_cgroup_empty(Unit *u) {
         return 0;
 }
 
+static void unit_add_to_cgroup_empty_queue(Unit *u) {
+        assert(u);
+
+        if (u->in_cgroup_empty_queue)
+                return;
+
+        LIST_PREPEND(cgroup_empty_queue, u->manager->cgroup_empty_queue, u);
+        u->in_cgroup_empty_queue = true;
+}
+
+unsigned manager_dispatch_cgroup_empty_queue(Manager *m) {
+        unsigned n = 0;
+        Unit *u;
+
+        assert(m);
+
+        /* Empty notifications are only queued by the event handlers,
+         * so that a unit whose cgroup generated a burst of them is
+         * checked only once. */
+
+        while ((u = m->cgroup_empty_queue)) {
+                assert(u->in_cgroup_empty_queue);
+
+                LIST_REMOVE(cgroup_empty_queue, m->cgroup_empty_queue, u);
+                u->in_cgroup_empty_queue = false;
+
+                (void) unit_notify_cgroup_empty(u);
+                n++;
+        }
+
+        return n;
+}
+
 static int on_cgroup_inotify_event(sd_event_source *s, int fd, uint32_t revents, void *userdata) {
         Manager *m = userdata;
 
@@ -1348,9 +1556,119 @@ static int on_cgroup_inotify_event(sd_event_source *s, int fd, uint32_t revents,
                                  * this here safely. */
                                 continue;
 
-                        (void) unit_notify_cgroup_empty(u);
+                        unit_add_to_cgroup_empty_queue(u);
+                }
+        }
+}
+
+static int on_cgroups_agent(sd_event_source *s, int fd, uint32_t revents, void *userdata) {
+        Manager *m = userdata;
+
+        assert(s);
+        assert(fd >= 0);
+        assert(m);
+
+        for (;;) {
+                char buf[PATH_MAX+1];
+                struct iovec iovec = {
+                        .iov_base = buf,
+                        .iov_len = sizeof(buf)-1,
+                };
+                union {
+                        struct cmsghdr cmsghdr;
+                        uint8_t buf[CMSG_SPACE(sizeof(struct ucred))];
+                } control = {};
+                struct msghdr msghdr = {
+                        .msg_iov = &iovec,
+                        .msg_iovlen = 1,
+                        .msg_control = &control,
+                        .msg_controllen = sizeof(control),
+                };
+                struct cmsghdr *cmsg;
+                struct ucred *ucred = NULL;
+                ssize_t n;
+
+                n = recvmsg(fd, &msghdr, MSG_DONTWAIT|MSG_CMSG_CLOEXEC);
+                if (n < 0) {
+                        if (errno == EINTR || errno == EAGAIN)
+                                return 0;
+
+                        return log_error_errno(errno, "Failed to read cgroups agent message: %m");
+                }
+
+                CMSG_FOREACH(cmsg, &msghdr)
+                        if (cmsg->cmsg_level == SOL_SOCKET &&
+                            cmsg->cmsg_type == SCM_CREDENTIALS &&
+                            cmsg->cmsg_len == CMSG_LEN(sizeof(struct ucred)))
+                                ucred = (struct ucred*) CMSG_DATA(cmsg);
+
+                if (!ucred || ucred->uid != 0) {
+                        log_warning("Received cgroups agent message without valid credentials, ignoring.");
+                        continue;
+                }
+
+                if (n == 0 || (msghdr.msg_flags & MSG_TRUNC)) {
+                        log_warning("Received cgroups agent message of invalid size, ignoring.");
+                        continue;
                 }
+
+                buf[n] = 0;
+
+                (void) manager_notify_cgroup_empty(m, buf);
+        }
+}
+
+static int manager_setup_cgroups_agent(Manager *m) {
+        static const union sockaddr_union sa = {
+                .un.sun_family = AF_UNIX,
+                .un.sun_path = CGROUPS_AGENT_SOCKET,
+        };
+        static const int one = 1;
+        int r;
+
+        assert(m);
+
+        /* The kernel still forks off the release agent for each
+         * empty cgroup, but at least it can hand the notification
+         * over with a single datagram, instead of having to connect
+         * and authenticate to our private bus first. */
+
+        if (m->cgroups_agent_fd < 0) {
+                _cleanup_close_ int fd = -1;
+
+                m->cgroups_agent_event_source = sd_event_source_unref(m->cgroups_agent_event_source);
+
+                fd = socket(AF_UNIX, SOCK_DGRAM|SOCK_CLOEXEC|SOCK_NONBLOCK, 0);
+                if (fd < 0)
+                        return log_error_errno(errno, "Failed to allocate cgroups agent socket: %m");
+
+                (void) mkdir_parents_label(sa.un.sun_path, 0755);
+                (void) unlink(sa.un.sun_path);
+
+                if (bind(fd, &sa.sa, offsetof(struct sockaddr_un, sun_path) + strlen(sa.un.sun_path)) < 0)
+                        return log_error_errno(errno, "bind(%s) failed: %m", sa.un.sun_path);
+
+                if (setsockopt(fd, SOL_SOCKET, SO_PASSCRED, &one, sizeof(one)) < 0)
+                        return log_error_errno(errno, "SO_PASSCRED failed: %m");
+
+                m->cgroups_agent_fd = fd;
+                fd = -1;
+        }
+
+        if (!m->cgroups_agent_event_source) {
+                r = sd_event_add_io(m->event, &m->cgroups_agent_event_source, m->cgroups_agent_fd, EPOLLIN, on_cgroups_agent, m);
+                if (r < 0)
+                        return log_error_errno(r, "Failed to allocate cgroups agent event source: %m");
+
+                /* Process cgroups agent messages after SIGCHLD, just like the inotify events */
+                r = sd_event_source_set_priority(m->cgroups_agent_event_source, SD_EVENT_PRIORITY_IDLE - 5);
+                if (r < 0)
+                        return log_error_errno(r, "Failed to set priority of cgroups agent event source: %m");
+
+                (void) sd_event_source_set_description(m->cgroups_agent_event_source, "manager-cgroups-agent");
         }
+
+        return 0;
 }
 
 int manager_setup_cgroup(Manager *m) {
@@ -1442,6 +1760,10 @@ int manager_setup_cgroup(Manager *m) {
                                 log_debug("Installed release agent.");
                         else if (r == 0)
                                 log_debug("Release agent already installed.");
+
+                        r = manager_setup_cgroups_agent(m);
+                        if (r < 0)
+                                return r;
                 }
 
                 /* 4. Make sure we are in the special "init.scope" unit in the root slice. */
@@ -1491,6 +1813,11 @@ void manager_shutdown_cgroup(Manager *m, bool delete) {
         m->cgroup_inotify_event_source = sd_event_source_unref(m->cgroup_inotify_event_source);
         m->cgroup_inotify_fd = safe_close(m->cgroup_inotify_fd);
 
+        m->cgroups_agent_event_source = sd_event_source_unref(m->cgroups_agent_event_source);
+        m->cgroups_agent_fd = safe_close(m->cgroups_agent_fd);
+
+        m->accounting_sample_event_source = sd_event_source_unref(m->accounting_sample_event_source);
+
         m->pin_cgroupfs_fd = safe_close(m->pin_cgroupfs_fd);
 
         m->cgroup_root = mfree(m->cgroup_root);
@@ -1571,7 +1898,8 @@ int manager_notify_cgroup_empty(Manager *m, const char *cgroup) {
         if (!u)
                 return 0;
 
-        return unit_notify_cgroup_empty(u);
+        unit_add_to_cgroup_empty_queue(u);
+        return 1;
 }
 
 int unit_get_memory_current(Unit *u, uint64_t *ret) {
@@ -1666,6 +1994,78 @@ int unit_get_cpu_usage(Unit *u, nsec_t *ret) {
         return 0;
 }
 
+void unit_sample_accounting(Unit *u) {
+        assert(u);
+
+        if (unit_get_memory_current(u, &u->sampled_memory_current) < 0)
+                u->sampled_memory_current = (uint64_t) -1;
+
+        if (unit_get_tasks_current(u, &u->sampled_tasks_current) < 0)
+                u->sampled_tasks_current = (uint64_t) -1;
+
+        if (unit_get_cpu_usage(u, &u->sampled_cpu_usage) < 0)
+                u->sampled_cpu_usage = (nsec_t) -1;
+}
+
+static int on_accounting_sample(sd_event_source *s, uint64_t usec, void *userdata) {
+        Manager *m = userdata;
+        Iterator i;
+        Unit *u;
+        int r;
+
+        assert(s);
+        assert(m);
+
+        HASHMAP_FOREACH(u, m->cgroup_unit, i)
+                unit_sample_accounting(u);
+
+        m->accounting_sample_timestamp = now(CLOCK_MONOTONIC);
+
+        r = sd_event_source_set_time(s, usec + m->accounting_sample_usec);
+        if (r < 0)
+                return log_error_errno(r, "Failed to reschedule accounting sampling: %m");
+
+        return sd_event_source_set_enabled(s, SD_EVENT_ONESHOT);
+}
+
+int manager_setup_accounting_sample(Manager *m) {
+        int r;
+
+        assert(m);
+
+        /* Reading the accounting attributes of all units in one go
+         * every now and then is much cheaper than doing so for each
+         * property query of a monitoring tool. The sampled values
+         * are handed out by the ListUnitAccounting() bus call. */
+
+        if (m->accounting_sample_usec <= 0 || m->test_run) {
+                m->accounting_sample_event_source = sd_event_source_unref(m->accounting_sample_event_source);
+                m->accounting_sample_timestamp = 0;
+                return 0;
+        }
+
+        if (m->accounting_sample_event_source) {
+                r = sd_event_source_set_time(m->accounting_sample_event_source, now(CLOCK_MONOTONIC) + m->accounting_sample_usec);
+                if (r < 0)
+                        return log_error_errno(r, "Failed to reschedule accounting sampling: %m");
+
+                return sd_event_source_set_enabled(m->accounting_sample_event_source, SD_EVENT_ONESHOT);
+        }
+
+        r = sd_event_add_time(
+                        m->event,
+                        &m->accounting_sample_event_source,
+                        CLOCK_MONOTONIC,
+                        now(CLOCK_MONOTONIC) + m->accounting_sample_usec, m->accounting_sample_usec / 10,
+                        on_accounting_sample, m);
+        if (r < 0)
+                return log_error_errno(r, "Failed to allocate accounting sampling timer: %m");
+
+        (void) sd_event_source_set_description(m->accounting_sample_event_source, "manager-accounting-sample");
+
+        return 0;
+}
+
 int unit_reset_cpu_usage(Unit *u) {
         nsec_t ns;
         int r;
@@ -41,6 +41,7 @@
 #include "dbus-execute.h"
 #include "bus-common-errors.h"
 #include "formats-util.h"
+#include "event-util.h"
 
 static int property_get_version(
                 sd_bus *bus,
@@ -628,7 +629,7 @@ static int transient_unit_from_message(
                 return r;
 
         if (u->load_state != UNIT_NOT_FOUND ||
-            set_size(u->dependencies[UNIT_REFERENCED_BY]) > 0)
+            unit_first_dependency(u, UNIT_REFERENCED_BY))
                 return sd_bus_error_setf(error, BUS_ERROR_UNIT_EXISTS, "Unit %s already exists.", name);
 
         /* OK, the unit failed to load and is unreferenced, now let's
@@ -842,7 +843,53 @@ static int method_reset_failed(sd_bus_message *message, void *userdata, sd_bus_e
         return sd_bus_reply_method_return(message, NULL);
 }
 
-static int list_units_filtered(sd_bus_message *message, void *userdata, sd_bus_error *error, char **states) {
+static int reply_unit_info(sd_bus_message *reply, Unit *u) {
+        _cleanup_free_ char *unit_path = NULL, *job_path = NULL;
+        Unit *following;
+
+        following = unit_following(u);
+
+        unit_path = unit_dbus_path(u);
+        if (!unit_path)
+                return -ENOMEM;
+
+        if (u->job) {
+                job_path = job_dbus_path(u->job);
+                if (!job_path)
+                        return -ENOMEM;
+        }
+
+        return sd_bus_message_append(
+                        reply, "(ssssssouso)",
+                        u->id,
+                        unit_description(u),
+                        unit_load_state_to_string(u->load_state),
+                        unit_active_state_to_string(unit_active_state(u)),
+                        unit_sub_state_to_string(u),
+                        following ? following->id : "",
+                        unit_path,
+                        u->job ? u->job->id : 0,
+                        u->job ? job_type_to_string(u->job->type) : "",
+                        job_path ? job_path : "/");
+}
+
+static bool unit_matches_filter(Unit *u, char **states, char **patterns) {
+        assert(u);
+
+        if (!strv_isempty(states) &&
+            !strv_contains(states, unit_load_state_to_string(u->load_state)) &&
+            !strv_contains(states, unit_active_state_to_string(unit_active_state(u))) &&
+            !strv_contains(states, unit_sub_state_to_string(u)))
+                return false;
+
+        if (!strv_isempty(patterns) &&
+            !strv_fnmatch(patterns, u->id, FNM_NOESCAPE))
+                return false;
+
+        return true;
+}
+
+static int list_units_filtered(sd_bus_message *message, void *userdata, sd_bus_error *error, char **states, char **patterns) {
         _cleanup_bus_message_unref_ sd_bus_message *reply = NULL;
         Manager *m = userdata;
         const char *k;
@@ -867,47 +914,34 @@ static int list_units_filtered(sd_bus_message *message, void *userdata, sd_bus_e
         if (r < 0)
                 return r;
 
-        HASHMAP_FOREACH_KEY(u, k, m->units, i) {
-                _cleanup_free_ char *unit_path = NULL, *job_path = NULL;
-                Unit *following;
+        if (strv_equal(states, STRV_MAKE("failed"))) {
+                /* Health checks commonly ask just for the failed
+                 * units, which we keep track of anyway, hence don't
+                 * look at all the others. No load state is called
+                 * "failed", and a unit in the "failed" sub state is
+                 * always in the "failed" active state too. */
 
-                if (k != u->id)
-                        continue;
+                SET_FOREACH(u, m->failed_units, i) {
+                        if (!unit_matches_filter(u, states, patterns))
+                                continue;
 
-                following = unit_following(u);
-
-                if (!strv_isempty(states) &&
-                    !strv_contains(states, unit_load_state_to_string(u->load_state)) &&
-                    !strv_contains(states, unit_active_state_to_string(unit_active_state(u))) &&
-                    !strv_contains(states, unit_sub_state_to_string(u)))
-                        continue;
+                        r = reply_unit_info(reply, u);
+                        if (r < 0)
+                                return r;
+                }
+        } else
+                HASHMAP_FOREACH_KEY(u, k, m->units, i) {
+                        if (k != u->id)
+                                continue;
 
-                unit_path = unit_dbus_path(u);
-                if (!unit_path)
-                        return -ENOMEM;
+                        if (!unit_matches_filter(u, states, patterns))
+                                continue;
 
-                if (u->job) {
-                        job_path = job_dbus_path(u->job);
-                        if (!job_path)
-                                return -ENOMEM;
+                        r = reply_unit_info(reply, u);
+                        if (r < 0)
+                                return r;
                 }
 
-                r = sd_bus_message_append(
-                                reply, "(ssssssouso)",
-                                u->id,
-                                unit_description(u),
-                                unit_load_state_to_string(u->load_state),
-                                unit_active_state_to_string(unit_active_state(u)),
-                                unit_sub_state_to_string(u),
-                                following ? following->id : "",
-                                unit_path,
-                                u->job ? u->job->id : 0,
-                                u->job ? job_type_to_string(u->job->type) : "",
-                                job_path ? job_path : "/");
-                if (r < 0)
-                        return r;
-        }
-
         r = sd_bus_message_close_container(reply);
         if (r < 0)
                 return r;
@@ -916,7 +950,7 @@ static int list_units_filtered(sd_bus_message *message, void *userdata, sd_bus_e
 }
 
 static int method_list_units(sd_bus_message *message, void *userdata, sd_bus_error *error) {
-        return list_units_filtered(message, userdata, error, NULL);
+        return list_units_filtered(message, userdata, error, NULL, NULL);
 }
 
 static int method_list_units_filtered(sd_bus_message *message, void *userdata, sd_bus_error *error) {
@@ -927,7 +961,152 @@ static int method_list_units_filtered(sd_bus_message *message, void *userdata, s
         if (r < 0)
                 return r;
 
-        return list_units_filtered(message, userdata, error, states);
+        return list_units_filtered(message, userdata, error, states, NULL);
+}
+
+static int method_list_units_by_patterns(sd_bus_message *message, void *userdata, sd_bus_error *error) {
+        _cleanup_strv_free_ char **states = NULL, **patterns = NULL;
+        int r;
+
+        r = sd_bus_message_read_strv(message, &states);
+        if (r < 0)
+                return r;
+
+        r = sd_bus_message_read_strv(message, &patterns);
+        if (r < 0)
+                return r;
+
+        return list_units_filtered(message, userdata, error, states, patterns);
+}
+
+static int method_list_unit_accounting(sd_bus_message *message, void *userdata, sd_bus_error *error) {
+        _cleanup_bus_message_unref_ sd_bus_message *reply = NULL;
+        Manager *m = userdata;
+        bool sampled;
+        Iterator i;
+        Unit *u;
+        int r;
+
+        assert(message);
+        assert(m);
+
+        /* Anyone can call this method */
+
+        r = mac_selinux_access_check(message, "status", error);
+        if (r < 0)
+                return r;
+
+        r = sd_bus_message_new_method_return(message, &reply);
+        if (r < 0)
+                return r;
+
+        /* Without periodic sampling configured, read the current
+         * values, so that callers at least save the round-trips */
+        sampled = m->accounting_sample_timestamp > 0;
+
+        r = sd_bus_message_append(reply, "t", sampled ? m->accounting_sample_timestamp : now(CLOCK_MONOTONIC));
+        if (r < 0)
+                return r;
+
+        r = sd_bus_message_open_container(reply, 'a', "(sttt)");
+        if (r < 0)
+                return r;
+
+        HASHMAP_FOREACH(u, m->cgroup_unit, i) {
+                if (!sampled)
+                        unit_sample_accounting(u);
+
+                r = sd_bus_message_append(
+                                reply, "(sttt)",
+                                u->id,
+                                u->sampled_memory_current,
+                                u->sampled_tasks_current,
+                                (uint64_t) u->sampled_cpu_usage);
+                if (r < 0)
+                        return r;
+        }
+
+        r = sd_bus_message_close_container(reply);
+        if (r < 0)
+                return r;
+
+        return sd_bus_send(NULL, reply, NULL);
+}
+
+static int method_list_unit_timestamps(sd_bus_message *message, void *userdata, sd_bus_error *error) {
+        _cleanup_bus_message_unref_ sd_bus_message *reply = NULL;
+        Manager *m = userdata;
+        const char *k;
+        Iterator i;
+        Unit *u;
+        int r;
+
+        assert(message);
+        assert(m);
+
+        /* Anyone can call this method */
+
+        r = mac_selinux_access_check(message, "status", error);
+        if (r < 0)
+                return r;
+
+        r = sd_bus_message_new_method_return(message, &reply);
+        if (r < 0)
+                return r;
+
+        /* The monotonic activation timestamps and After= edges of
+         * all units in one reply, i.e. everything systemd-analyze
+         * needs, instead of four property reads per unit */
+
+        r = sd_bus_message_open_container(reply, 'a', "(sttttas)");
+        if (r < 0)
+                return r;
+
+        HASHMAP_FOREACH_KEY(u, k, m->units, i) {
+                Iterator j;
+                Unit *other;
+
+                if (k != u->id)
+                        continue;
+
+                r = sd_bus_message_open_container(reply, 'r', "sttttas");
+                if (r < 0)
+                        return r;
+
+                r = sd_bus_message_append(
+                                reply, "stttt",
+                                u->id,
+                                u->inactive_exit_timestamp.monotonic,
+                                u->active_enter_timestamp.monotonic,
+                                u->active_exit_timestamp.monotonic,
+                                u->inactive_enter_timestamp.monotonic);
+                if (r < 0)
+                        return r;
+
+                r = sd_bus_message_open_container(reply, 'a', "s");
+                if (r < 0)
+                        return r;
+
+                UNIT_FOREACH_DEPENDENCY(other, u, UNIT_AFTER, j) {
+                        r = sd_bus_message_append(reply, "s", other->id);
+                        if (r < 0)
+                                return r;
+                }
+
+                r = sd_bus_message_close_container(reply);
+                if (r < 0)
+                        return r;
+
+                r = sd_bus_message_close_container(reply);
+                if (r < 0)
+                        return r;
+        }
+
+        r = sd_bus_message_close_container(reply);
+        if (r < 0)
+                return r;
+
+        return sd_bus_send(NULL, reply, NULL);
 }
 
 static int method_list_jobs(sd_bus_message *message, void *userdata, sd_bus_error *error) {
@@ -1064,6 +1243,7 @@ static int method_dump(sd_bus_message *message, void *userdata, sd_bus_error *er
 
         manager_dump_units(m, f, NULL);
         manager_dump_jobs(m, f, NULL);
+        manager_dump_memory(m, f, NULL);
 
         r = fflush_and_check(f);
         if (r < 0)
@@ -1072,6 +1252,123 @@ static int method_dump(sd_bus_message *message, void *userdata, sd_bus_error *er
         return sd_bus_reply_method_return(message, "s", dump);
 }
 
+static int method_get_event_source_statistics(sd_bus_message *message, void *userdata, sd_bus_error *error) {
+        _cleanup_bus_message_unref_ sd_bus_message *reply = NULL;
+        EventSourceStatistics *stats = NULL;
+        Manager *m = userdata;
+        unsigned i, n;
+        int r;
+
+        assert(message);
+        assert(m);
+
+        /* Anyone can call this method */
+
+        r = mac_selinux_access_check(message, "status", error);
+        if (r < 0)
+                return r;
+
+        r = sd_bus_message_new_method_return(message, &reply);
+        if (r < 0)
+                return r;
+
+        r = sd_bus_message_append(reply, "b", sd_event_get_profile(m->event) > 0);
+        if (r < 0)
+                return r;
+
+        r = event_get_statistics(m->event, &stats, &n);
+        if (r < 0)
+                return r;
+
+        r = sd_bus_message_open_container(reply, 'a', "(ssttttt)");
+        if (r < 0)
+                goto finish;
+
+        for (i = 0; i < n; i++) {
+                r = sd_bus_message_append(
+                                reply, "(ssttttt)",
+                                strempty(stats[i].description),
+                                stats[i].type,
+                                stats[i].n_dispatched,
+                                stats[i].runtime,
+                                stats[i].runtime_max,
+                                stats[i].latency,
+                                stats[i].latency_max);
+                if (r < 0)
+                        goto finish;
+        }
+
+        r = sd_bus_message_close_container(reply);
+        if (r < 0)
+                goto finish;
+
+        r = sd_bus_send(NULL, reply, NULL);
+
+finish:
+        event_statistics_free(stats, n);
+        return r;
+}
+
+static int method_get_generator_timings(sd_bus_message *message, void *userdata, sd_bus_error *error) {
+        _cleanup_bus_message_unref_ sd_bus_message *reply = NULL;
+        Manager *m = userdata;
+        unsigned i;
+        int r;
+
+        assert(message);
+        assert(m);
+
+        /* Anyone can call this method */
+
+        r = mac_selinux_access_check(message, "status", error);
+        if (r < 0)
+                return r;
+
+        r = sd_bus_message_new_method_return(message, &reply);
+        if (r < 0)
+                return r;
+
+        r = sd_bus_message_open_container(reply, 'a', "(st)");
+        if (r < 0)
+                return r;
+
+        for (i = 0; i < m->n_generator_timings; i++) {
+                r = sd_bus_message_append(reply, "(st)", m->generator_timings[i].name, m->generator_timings[i].duration);
+                if (r < 0)
+                        return r;
+        }
+
+        r = sd_bus_message_close_container(reply);
+        if (r < 0)
+                return r;
+
+        return sd_bus_send(NULL, reply, NULL);
+}
+
+static int method_set_event_source_profiling(sd_bus_message *message, void *userdata, sd_bus_error *error) {
+        Manager *m = userdata;
+        int b, r;
+
+        assert(message);
+        assert(m);
+
+        r = mac_selinux_access_check(message, "reload", error);
+        if (r < 0)
+                return r;
+
+        r = sd_bus_message_read(message, "b", &b);
+        if (r < 0)
+                return r;
+
+        r = sd_event_set_profile(m->event, b);
+        if (r < 0)
+                return r;
+
+        log_debug("Event source profiling %s.", b ? "enabled" : "disabled");
+
+        return sd_bus_reply_method_return(message, NULL);
+}
+
 static int method_create_snapshot(sd_bus_message *message, void *userdata, sd_bus_error *error) {
         _cleanup_free_ char *path = NULL;
         Manager *m = userdata;
@@ -1166,6 +1463,48 @@ static int method_reload(sd_bus_message *message, void *userdata, sd_bus_error *
         return 1;
 }
 
+static int method_reload_if_changed(sd_bus_message *message, void *userdata, sd_bus_error *error) {
+        Manager *m = userdata;
+        int r;
+
+        assert(message);
+        assert(m);
+
+        r = mac_selinux_access_check(message, "reload", error);
+        if (r < 0)
+                return r;
+
+        r = bus_verify_reload_daemon_async(m, message, error);
+        if (r < 0)
+                return r;
+        if (r == 0)
+                return 1; /* No authorization for now, but the async polkit stuff will call us again when it has it */
+
+        /* If no unit file or drop-in changed since the last reload
+         * there's nothing a reload could pick up, hence skip it. Note
+         * that generators are not rerun in that case. */
+
+        if (!manager_unit_files_changed(m)) {
+                log_debug("No unit files changed, skipping reload.");
+                return sd_bus_reply_method_return(message, "b", false);
+        }
+
+        assert(!m->queued_message);
+        r = sd_bus_message_new_method_return(message, &m->queued_message);
+        if (r < 0)
+                return r;
+
+        r = sd_bus_message_append(m->queued_message, "b", true);
+        if (r < 0) {
+                m->queued_message = sd_bus_message_unref(m->queued_message);
+                return r;
+        }
+
+        m->exit_code = MANAGER_RELOAD;
+
+        return 1;
+}
+
 static int method_reexecute(sd_bus_message *message, void *userdata, sd_bus_error *error) {
         Manager *m = userdata;
         int r;
@@ -1948,6 +2287,8 @@ const sd_bus_vtable bus_manager_vtable[] = {
         SD_BUS_PROPERTY("NJobs", "u", property_get_n_jobs, 0, 0),
         SD_BUS_PROPERTY("NInstalledJobs", "u", bus_property_get_unsigned, offsetof(Manager, n_installed_jobs), 0),
         SD_BUS_PROPERTY("NFailedJobs", "u", bus_property_get_unsigned, offsetof(Manager, n_failed_jobs), 0),
+        SD_BUS_PROPERTY("NTimerElapses", "u", bus_property_get_unsigned, offsetof(Manager, n_timer_elapses), 0),
+        SD_BUS_PROPERTY("NTimerWakeups", "u", bus_property_get_unsigned, offsetof(Manager, n_timer_wakeups), 0),
         SD_BUS_PROPERTY("Progress", "d", property_get_progress, 0, 0),
         SD_BUS_PROPERTY("Environment", "as", NULL, offsetof(Manager, environment), 0),
         SD_BUS_PROPERTY("ConfirmSpawn", "b", bus_property_get_bool, offsetof(Manager, confirm_spawn), SD_BUS_VTABLE_PROPERTY_CONST),
@@ -1982,13 +2323,20 @@ const sd_bus_vtable bus_manager_vtable[] = {
         SD_BUS_METHOD("ResetFailed", NULL, NULL, method_reset_failed, SD_BUS_VTABLE_UNPRIVILEGED),
         SD_BUS_METHOD("ListUnits", NULL, "a(ssssssouso)", method_list_units, SD_BUS_VTABLE_UNPRIVILEGED),
         SD_BUS_METHOD("ListUnitsFiltered", "as", "a(ssssssouso)", method_list_units_filtered, SD_BUS_VTABLE_UNPRIVILEGED),
+        SD_BUS_METHOD("ListUnitsByPatterns", "asas", "a(ssssssouso)", method_list_units_by_patterns, SD_BUS_VTABLE_UNPRIVILEGED),
+        SD_BUS_METHOD("ListUnitAccounting", NULL, "ta(sttt)", method_list_unit_accounting, SD_BUS_VTABLE_UNPRIVILEGED),
+        SD_BUS_METHOD("ListUnitTimestamps", NULL, "a(sttttas)", method_list_unit_timestamps, SD_BUS_VTABLE_UNPRIVILEGED),
         SD_BUS_METHOD("ListJobs", NULL, "a(usssoo)", method_list_jobs, SD_BUS_VTABLE_UNPRIVILEGED),
         SD_BUS_METHOD("Subscribe", NULL, NULL, method_subscribe, SD_BUS_VTABLE_UNPRIVILEGED),
         SD_BUS_METHOD("Unsubscribe", NULL, NULL, method_unsubscribe, SD_BUS_VTABLE_UNPRIVILEGED),
         SD_BUS_METHOD("Dump", NULL, "s", method_dump, SD_BUS_VTABLE_UNPRIVILEGED),
+        SD_BUS_METHOD("GetEventSourceStatistics", NULL, "ba(ssttttt)", method_get_event_source_statistics, SD_BUS_VTABLE_UNPRIVILEGED),
+        SD_BUS_METHOD("SetEventSourceProfiling", "b", NULL, method_set_event_source_profiling, 0),
+        SD_BUS_METHOD("GetGeneratorTimings", NULL, "a(st)", method_get_generator_timings, SD_BUS_VTABLE_UNPRIVILEGED),
         SD_BUS_METHOD("CreateSnapshot", "sb", "o", method_create_snapshot, SD_BUS_VTABLE_UNPRIVILEGED),
         SD_BUS_METHOD("RemoveSnapshot", "s", NULL, method_remove_snapshot, SD_BUS_VTABLE_UNPRIVILEGED),
         SD_BUS_METHOD("Reload", NULL, NULL, method_reload, SD_BUS_VTABLE_UNPRIVILEGED),
+        SD_BUS_METHOD("ReloadIfChanged", NULL, "b", method_reload_if_changed, SD_BUS_VTABLE_UNPRIVILEGED),
         SD_BUS_METHOD("Reexecute", NULL, NULL, method_reexecute, SD_BUS_VTABLE_UNPRIVILEGED),
         SD_BUS_METHOD("Exit", NULL, NULL, method_exit, 0),
         SD_BUS_METHOD("Reboot", NULL, NULL, method_reboot, SD_BUS_VTABLE_CAPABILITY(CAP_SYS_BOOT)),
@@ -28,6 +28,7 @@
 #include "dbus-device.h"
 #include "path-util.h"
 #include "udev-util.h"
+#include "libudev-private.h"
 #include "unit.h"
 #include "swap.h"
 #include "device.h"
@@ -679,30 +680,30 @@ fail:
         return r;
 }
 
-static int device_dispatch_io(sd_event_source *source, int fd, uint32_t revents, void *userdata) {
-        _cleanup_udev_device_unref_ struct udev_device *dev = NULL;
-        Manager *m = userdata;
-        const char *action, *sysfs;
-        int r;
+/* The maximum number of udev events we read in one go */
+#define DEVICE_EVENTS_MAX 256U
 
-        assert(m);
+typedef struct DeviceEvent {
+        struct udev_device *dev;
 
-        if (revents != EPOLLIN) {
-                static RATELIMIT_DEFINE(limit, 10*USEC_PER_SEC, 5);
+        /* A remove event for the same device was superseded by this one */
+        bool removed;
+} DeviceEvent;
 
-                if (!ratelimit_test(&limit))
-                        log_error_errno(errno, "Failed to get udev event: %m");
-                if (!(revents & EPOLLIN))
-                        return 0;
-        }
+static void device_event_free(DeviceEvent *e) {
+        if (!e)
+                return;
 
-        /*
-         * libudev might filter-out devices which pass the bloom
-         * filter, so getting NULL here is not necessarily an error.
-         */
-        dev = udev_monitor_receive_device(m->udev_monitor);
-        if (!dev)
-                return 0;
+        udev_device_unref(e->dev);
+        free(e);
+}
+
+static int device_queue_event(OrderedHashmap *events, struct udev_device *dev) {
+        const char *sysfs, *action;
+        DeviceEvent *e;
+
+        assert(events);
+        assert(dev);
 
         sysfs = udev_device_get_syspath(dev);
         if (!sysfs) {
@@ -710,32 +711,90 @@ static int device_dispatch_io(sd_event_source *source, int fd, uint32_t revents,
                 return 0;
         }
 
-        action = udev_device_get_action(dev);
+        /* Only the last event for a device matters, except that we
+         * still need to forget about the device if it was removed in
+         * between */
+        e = ordered_hashmap_get(events, sysfs);
+        if (e) {
+                struct udev_device *old = e->dev;
+                int r;
+
+                /* The key points into the old device object */
+                r = ordered_hashmap_remove_and_replace(events, sysfs, sysfs, e);
+                if (r < 0)
+                        return r;
+
+                action = udev_device_get_action(old);
+                if (streq_ptr(action, "remove"))
+                        e->removed = true;
+
+                e->dev = udev_device_ref(dev);
+                udev_device_unref(old);
+
+                return 0;
+        }
+
+        e = new0(DeviceEvent, 1);
+        if (!e)
+                return -ENOMEM;
+
+        e->dev = udev_device_ref(dev);
+
+        if (ordered_hashmap_put(events, sysfs, e) < 0) {
+                device_event_free(e);
+                return -ENOMEM;
+        }
+
+        return 0;
+}
+
+static void device_process_removed(Manager *m, struct udev_device *dev) {
+        int r;
+
+        assert(m);
+        assert(dev);
+
+        r = swap_process_device_remove(m, dev);
+        if (r < 0)
+                log_error_errno(r, "Failed to process swap device remove event: %m");
+
+        /* If we get notified that a device was removed by
+         * udev, then it's completely gone, hence unset all
+         * found bits */
+        device_update_found_by_sysfs(m, udev_device_get_syspath(dev), false, DEVICE_FOUND_UDEV|DEVICE_FOUND_MOUNT|DEVICE_FOUND_SWAP, true);
+}
+
+static void device_process_event(Manager *m, DeviceEvent *e) {
+        const char *action, *sysfs;
+        int r;
+
+        assert(m);
+        assert(e);
+
+        sysfs = udev_device_get_syspath(e->dev);
+
+        action = udev_device_get_action(e->dev);
         if (!action) {
                 log_error("Failed to get udev action string.");
-                return 0;
+                return;
         }
 
         if (streq(action, "remove"))  {
-                r = swap_process_device_remove(m, dev);
-                if (r < 0)
-                        log_error_errno(r, "Failed to process swap device remove event: %m");
+                device_process_removed(m, e->dev);
+                return;
+        }
 
-                /* If we get notified that a device was removed by
-                 * udev, then it's completely gone, hence unset all
-                 * found bits */
-                device_update_found_by_sysfs(m, sysfs, false, DEVICE_FOUND_UDEV|DEVICE_FOUND_MOUNT|DEVICE_FOUND_SWAP, true);
+        if (e->removed)
+                device_process_removed(m, e->dev);
 
-        } else if (device_is_ready(dev)) {
+        if (device_is_ready(e->dev)) {
 
-                (void) device_process_new(m, dev);
+                (void) device_process_new(m, e->dev);
 
-                r = swap_process_device_new(m, dev);
+                r = swap_process_device_new(m, e->dev);
                 if (r < 0)
                         log_error_errno(r, "Failed to process swap device new event: %m");
 
-                manager_dispatch_load_queue(m);
-
                 /* The device is found now, set the udev found bit */
                 device_update_found_by_sysfs(m, sysfs, true, DEVICE_FOUND_UDEV, true);
 
@@ -746,6 +805,70 @@ static int device_dispatch_io(sd_event_source *source, int fd, uint32_t revents,
 
                 device_update_found_by_sysfs(m, sysfs, false, DEVICE_FOUND_UDEV, true);
         }
+}
+
+static int device_dispatch_io(sd_event_source *source, int fd, uint32_t revents, void *userdata) {
+        _cleanup_ordered_hashmap_free_ OrderedHashmap *events = NULL;
+        Manager *m = userdata;
+        DeviceEvent *e;
+        unsigned n;
+
+        assert(m);
+
+        if (revents != EPOLLIN) {
+                static RATELIMIT_DEFINE(limit, 10*USEC_PER_SEC, 5);
+
+                if (!ratelimit_test(&limit))
+                        log_error_errno(errno, "Failed to get udev event: %m");
+                if (!(revents & EPOLLIN))
+                        return 0;
+        }
+
+        events = ordered_hashmap_new(&string_hash_ops);
+        if (!events)
+                return log_oom();
+
+        /* Read everything that is queued right now, up to a limit, so
+         * that we process every device only once even when it is
+         * flooding us with change events, for example during a SAN
+         * rescan. Whatever is left we'll get in the next iteration. */
+        for (n = 0; n < DEVICE_EVENTS_MAX; ) {
+                struct udev_device *devs[16];
+                int k, i, r = 0;
+
+                /*
+                 * libudev might filter-out devices which pass the bloom
+                 * filter, so getting none here is not necessarily an error.
+                 */
+                k = udev_monitor_receive_devices(m->udev_monitor, devs, MIN(ELEMENTSOF(devs), DEVICE_EVENTS_MAX - n));
+                if (k == -EAGAIN)
+                        break;
+                if (k <= 0) {
+                        n++;
+                        continue;
+                }
+
+                for (i = 0; i < k; i++) {
+                        if (r >= 0)
+                                r = device_queue_event(events, devs[i]);
+
+                        udev_device_unref(devs[i]);
+                }
+
+                if (r < 0) {
+                        log_oom();
+                        break;
+                }
+
+                n += k;
+        }
+
+        while ((e = ordered_hashmap_steal_first(events))) {
+                device_process_event(m, e);
+                device_event_free(e);
+        }
+
+        manager_dispatch_load_queue(m);
 
         return 0;
 }
@@ -24,10 +24,12 @@
 #include <unistd.h>
 #include <string.h>
 #include <signal.h>
+#include <sched.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <sys/prctl.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <grp.h>
 #include <poll.h>
 #include <glob.h>
@@ -265,15 +267,15 @@ static int connect_journal_socket(int fd, uid_t uid, gid_t gid) {
         return r;
 }
 
-static int connect_logger_as(const ExecContext *context, ExecOutput output, const char *ident, const char *unit_id, int nfd, uid_t uid, gid_t gid) {
-        int fd, r;
+static int open_logger(const ExecContext *context, ExecOutput output, const char *ident, const char *unit_id, uid_t uid, gid_t gid, int flags) {
+        _cleanup_close_ int fd = -1;
+        int r;
 
         assert(context);
         assert(output < _EXEC_OUTPUT_MAX);
         assert(ident);
-        assert(nfd >= 0);
 
-        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        fd = socket(AF_UNIX, SOCK_STREAM|flags, 0);
         if (fd < 0)
                 return -errno;
 
@@ -281,10 +283,8 @@ static int connect_logger_as(const ExecContext *context, ExecOutput output, cons
         if (r < 0)
                 return r;
 
-        if (shutdown(fd, SHUT_RD) < 0) {
-                safe_close(fd);
+        if (shutdown(fd, SHUT_RD) < 0)
                 return -errno;
-        }
 
         fd_inc_sndbuf(fd, SNDBUF_SIZE);
 
@@ -304,6 +304,27 @@ static int connect_logger_as(const ExecContext *context, ExecOutput output, cons
                 output == EXEC_OUTPUT_KMSG || output == EXEC_OUTPUT_KMSG_AND_CONSOLE,
                 is_terminal_output(output));
 
+        if (flags & SOCK_NONBLOCK) {
+                r = fd_nonblock(fd, false);
+                if (r < 0)
+                        return r;
+        }
+
+        r = fd;
+        fd = -1;
+
+        return r;
+}
+
+static int connect_logger_as(const ExecContext *context, ExecOutput output, const char *ident, const char *unit_id, int nfd, uid_t uid, gid_t gid) {
+        int fd, r;
+
+        assert(nfd >= 0);
+
+        fd = open_logger(context, output, ident, unit_id, uid, gid, 0);
+        if (fd < 0)
+                return fd;
+
         if (fd != nfd) {
                 r = dup2(fd, nfd) < 0 ? -errno : nfd;
                 safe_close(fd);
@@ -1183,63 +1204,56 @@ static int build_environment(
                 const char *home,
                 const char *username,
                 const char *shell,
-                char ***ret) {
+                StrvBuilder *env) {
 
-        _cleanup_strv_free_ char **our_env = NULL;
-        unsigned n_env = 0;
-        char *x;
+        int r;
 
         assert(c);
-        assert(ret);
+        assert(env);
 
-        our_env = new0(char*, 10);
-        if (!our_env)
-                return -ENOMEM;
+        /* The variables are only needed until they are merged into
+         * the final environment, hence collect them in an arena */
 
         if (n_fds > 0) {
-                if (asprintf(&x, "LISTEN_PID="PID_FMT, getpid()) < 0)
-                        return -ENOMEM;
-                our_env[n_env++] = x;
+                r = strv_builder_addf(env, "LISTEN_PID="PID_FMT, getpid());
+                if (r < 0)
+                        return r;
 
-                if (asprintf(&x, "LISTEN_FDS=%u", n_fds) < 0)
-                        return -ENOMEM;
-                our_env[n_env++] = x;
+                r = strv_builder_addf(env, "LISTEN_FDS=%u", n_fds);
+                if (r < 0)
+                        return r;
         }
 
         if (watchdog_usec > 0) {
-                if (asprintf(&x, "WATCHDOG_PID="PID_FMT, getpid()) < 0)
-                        return -ENOMEM;
-                our_env[n_env++] = x;
+                r = strv_builder_addf(env, "WATCHDOG_PID="PID_FMT, getpid());
+                if (r < 0)
+                        return r;
 
-                if (asprintf(&x, "WATCHDOG_USEC="USEC_FMT, watchdog_usec) < 0)
-                        return -ENOMEM;
-                our_env[n_env++] = x;
+                r = strv_builder_addf(env, "WATCHDOG_USEC="USEC_FMT, watchdog_usec);
+                if (r < 0)
+                        return r;
         }
 
         if (home) {
-                x = strappend("HOME=", home);
-                if (!x)
-                        return -ENOMEM;
-                our_env[n_env++] = x;
+                r = strv_builder_addf(env, "HOME=%s", home);
+                if (r < 0)
+                        return r;
         }
 
         if (username) {
-                x = strappend("LOGNAME=", username);
-                if (!x)
-                        return -ENOMEM;
-                our_env[n_env++] = x;
+                r = strv_builder_addf(env, "LOGNAME=%s", username);
+                if (r < 0)
+                        return r;
 
-                x = strappend("USER=", username);
-                if (!x)
-                        return -ENOMEM;
-                our_env[n_env++] = x;
+                r = strv_builder_addf(env, "USER=%s", username);
+                if (r < 0)
+                        return r;
         }
 
         if (shell) {
-                x = strappend("SHELL=", shell);
-                if (!x)
-                        return -ENOMEM;
-                our_env[n_env++] = x;
+                r = strv_builder_addf(env, "SHELL=%s", shell);
+                if (r < 0)
+                        return r;
         }
 
         if (is_terminal_input(c->std_input) ||
@@ -1247,18 +1261,11 @@ static int build_environment(
             c->std_error == EXEC_OUTPUT_TTY ||
             c->tty_path) {
 
-                x = strdup(default_term_for_tty(tty_path(c)));
-                if (!x)
-                        return -ENOMEM;
-                our_env[n_env++] = x;
+                r = strv_builder_add(env, default_term_for_tty(tty_path(c)));
+                if (r < 0)
+                        return r;
         }
 
-        our_env[n_env++] = NULL;
-        assert(n_env <= 10);
-
-        *ret = our_env;
-        our_env = NULL;
-
         return 0;
 }
 
@@ -1304,7 +1311,8 @@ static int exec_child(
                 char **files_env,
                 int *exit_status) {
 
-        _cleanup_strv_free_ char **our_env = NULL, **pam_env = NULL, **final_env = NULL, **final_argv = NULL;
+        _cleanup_strv_builder_done_ StrvBuilder our_env = {};
+        _cleanup_strv_free_ char **pam_env = NULL, **final_env = NULL, **final_argv = NULL;
         _cleanup_free_ char *mac_selinux_context_net = NULL;
         const char *username = NULL, *home = NULL, *shell = NULL;
         unsigned n_dont_close = 0;
@@ -1840,7 +1848,7 @@ static int exec_child(
 
         final_env = strv_env_merge(5,
                                    params->environment,
-                                   our_env,
+                                   strv_builder_get(&our_env),
                                    context->environment,
                                    files_env,
                                    pam_env,
@@ -1878,6 +1886,480 @@ static int exec_child(
         return -errno;
 }
 
+/* Spawning with clone(CLONE_VM|CLONE_VFORK) avoids copying our page
+ * tables, which dominates the cost of fork() for a large PID 1. The
+ * child shares our memory until it calls execve(), hence it must not
+ * allocate memory, log or modify any of our state. We thus use this
+ * only for execution contexts whose setup boils down to plain system
+ * calls, and prepare everything else here in the parent. */
+
+#define EXEC_VFORK_STACK_SIZE (64U*1024U)
+
+typedef struct ExecVforkChild {
+        const ExecContext *context;
+        const ExecParameters *params;
+        const char *path;
+        char **argv;
+        char **envp;
+        const char *working_directory;
+
+        /* Installed as fds 0, 1, 2 in the child, -1 means keep ours */
+        int stdio[3];
+        int cgroup_fd;
+
+        char oom_score_adjust[DECIMAL_STR_MAX(int)];
+
+        /* Written by the child if it fails before execve() */
+        int error;
+        int exit_status;
+} ExecVforkChild;
+
+static bool exec_output_may_vfork(ExecOutput o) {
+        return
+                o == EXEC_OUTPUT_INHERIT ||
+                o == EXEC_OUTPUT_NULL ||
+                o == EXEC_OUTPUT_SYSLOG ||
+                o == EXEC_OUTPUT_KMSG ||
+                o == EXEC_OUTPUT_JOURNAL;
+}
+
+static bool exec_context_may_vfork(
+                const ExecContext *context,
+                const ExecParameters *params,
+                ExecRuntime *runtime,
+                int socket_fd,
+                unsigned n_fds) {
+
+        assert(context);
+        assert(params);
+
+        if (socket_fd >= 0 || n_fds > 0)
+                return false;
+
+        if (params->confirm_spawn ||
+            params->idle_pipe ||
+            params->watchdog_usec > 0 ||
+            params->bus_endpoint_fd >= 0)
+                return false;
+
+        /* User and group lookups might involve NSS, which we must
+         * not do in a child that shares our memory */
+        if (context->user ||
+            context->group ||
+            context->supplementary_groups ||
+            context->pam_name)
+                return false;
+
+        if (context->std_input != EXEC_INPUT_NULL ||
+            !exec_output_may_vfork(context->std_output) ||
+            !exec_output_may_vfork(context->std_error))
+                return false;
+
+        if (context->tty_path ||
+            context->tty_reset ||
+            context->tty_vhangup ||
+            context->tty_vt_disallocate ||
+            context->utmp_id)
+                return false;
+
+        if (context->root_directory ||
+            !strv_isempty(context->runtime_directory) ||
+            context->private_network ||
+            exec_needs_mount_namespace(context, params, runtime))
+                return false;
+
+        if (params->apply_permissions) {
+#ifdef SMACK_DEFAULT_PROCESS_LABEL
+                return false;
+#endif
+
+                if (context->capabilities ||
+                    context->capability_bounding_set_drop ||
+                    context->smack_process_label ||
+                    context->selinux_context ||
+                    context->apparmor_profile)
+                        return false;
+
+                if (context->syscall_whitelist ||
+                    !set_isempty(context->syscall_filter) ||
+                    !set_isempty(context->syscall_archs) ||
+                    context->address_families_whitelist ||
+                    !set_isempty(context->address_families))
+                        return false;
+        }
+
+        return true;
+}
+
+static int exec_vfork_open_output(Unit *unit, const ExecContext *context, ExecOutput o, const char *ident, int *ret) {
+        int fd;
+
+        assert(unit);
+        assert(context);
+        assert(ret);
+
+        switch (o) {
+
+        case EXEC_OUTPUT_INHERIT:
+                /* If we are not PID 1 our children inherit our STDOUT */
+                if (getpid() != 1) {
+                        *ret = -1;
+                        return 0;
+                }
+
+                /* fall through */
+
+        case EXEC_OUTPUT_NULL:
+                fd = open("/dev/null", O_WRONLY|O_NOCTTY|O_CLOEXEC);
+                if (fd < 0)
+                        return -errno;
+                break;
+
+        case EXEC_OUTPUT_SYSLOG:
+        case EXEC_OUTPUT_KMSG:
+        case EXEC_OUTPUT_JOURNAL:
+                /* Don't block on a busy journal, let the forked
+                 * child handle that instead */
+                fd = open_logger(context, o, ident, unit->id, UID_INVALID, GID_INVALID, SOCK_CLOEXEC|SOCK_NONBLOCK);
+                if (fd < 0)
+                        return fd;
+                break;
+
+        default:
+                assert_not_reached("Unexpected output type");
+        }
+
+        *ret = fd;
+        return 0;
+}
+
+static int exec_vfork_child_setup(ExecVforkChild *c, int *exit_status) {
+        static const int stdio_exit_status[3] = {
+                EXIT_STDIN,
+                EXIT_STDOUT,
+                EXIT_STDERR,
+        };
+        const ExecContext *context = c->context;
+        int i, r;
+
+        (void) default_signals(SIGNALS_CRASH_HANDLER,
+                               SIGNALS_IGNORE, -1);
+
+        if (context->ignore_sigpipe)
+                (void) ignore_signals(SIGPIPE, -1);
+
+        r = reset_signal_mask();
+        if (r < 0) {
+                *exit_status = EXIT_SIGNAL_MASK;
+                return r;
+        }
+
+        for (i = 0; i < 3; i++) {
+                if (c->stdio[i] < 0 || c->stdio[i] == i)
+                        continue;
+
+                if (dup2(c->stdio[i], i) < 0) {
+                        *exit_status = stdio_exit_status[i];
+                        return -errno;
+                }
+        }
+
+        if (c->cgroup_fd >= 0)
+                if (write(c->cgroup_fd, "0\n", 2) < 0) {
+                        *exit_status = EXIT_CGROUP;
+                        return -errno;
+                }
+
+        if (close_range(3, (unsigned) -1, 0) < 0) {
+                struct rlimit rl;
+                int fd;
+
+                if (errno != ENOSYS) {
+                        *exit_status = EXIT_FDS;
+                        return -errno;
+                }
+
+                if (getrlimit(RLIMIT_NOFILE, &rl) < 0) {
+                        *exit_status = EXIT_FDS;
+                        return -errno;
+                }
+
+                for (fd = 3; fd < (int) MIN(rl.rlim_cur, (rlim_t) INT_MAX); fd++)
+                        (void) close(fd);
+        }
+
+        if (!context->same_pgrp)
+                if (setsid() < 0) {
+                        *exit_status = EXIT_SETSID;
+                        return -errno;
+                }
+
+        if (context->oom_score_adjust_set) {
+                int fd;
+
+                /* Silently skip over EPERM here too, see
+                 * exec_child() */
+                fd = open("/proc/self/oom_score_adj", O_WRONLY|O_CLOEXEC|O_NOCTTY);
+                if (fd >= 0) {
+                        r = write(fd, c->oom_score_adjust, strlen(c->oom_score_adjust)) < 0 ? -errno : 0;
+                        (void) close(fd);
+                } else
+                        r = -errno;
+
+                if (r < 0 && r != -EPERM && r != -EACCES) {
+                        *exit_status = EXIT_OOM_ADJUST;
+                        return r;
+                }
+        }
+
+        if (context->nice_set)
+                if (setpriority(PRIO_PROCESS, 0, context->nice) < 0) {
+                        *exit_status = EXIT_NICE;
+                        return -errno;
+                }
+
+        if (context->cpu_sched_set) {
+                struct sched_param param = {
+                        .sched_priority = context->cpu_sched_priority,
+                };
+
+                if (sched_setscheduler(0,
+                                       context->cpu_sched_policy |
+                                       (context->cpu_sched_reset_on_fork ?
+                                        SCHED_RESET_ON_FORK : 0),
+                                       &param) < 0) {
+                        *exit_status = EXIT_SETSCHEDULER;
+                        return -errno;
+                }
+        }
+
+        if (context->cpuset)
+                if (sched_setaffinity(0, CPU_ALLOC_SIZE(context->cpuset_ncpus), context->cpuset) < 0) {
+                        *exit_status = EXIT_CPUAFFINITY;
+                        return -errno;
+                }
+
+        if (context->ioprio_set)
+                if (ioprio_set(IOPRIO_WHO_PROCESS, 0, context->ioprio) < 0) {
+                        *exit_status = EXIT_IOPRIO;
+                        return -errno;
+                }
+
+        if (context->timer_slack_nsec != NSEC_INFINITY)
+                if (prctl(PR_SET_TIMERSLACK, context->timer_slack_nsec) < 0) {
+                        *exit_status = EXIT_TIMERSLACK;
+                        return -errno;
+                }
+
+        if (context->personality != PERSONALITY_INVALID)
+                if (personality(context->personality) < 0) {
+                        *exit_status = EXIT_PERSONALITY;
+                        return -errno;
+                }
+
+        umask(context->umask);
+
+        if (chdir(c->working_directory) < 0 &&
+            !context->working_directory_missing_ok) {
+                *exit_status = EXIT_CHDIR;
+                return -errno;
+        }
+
+        if (c->params->apply_permissions) {
+
+                for (i = 0; i < _RLIMIT_MAX; i++) {
+                        if (!context->rlimit[i])
+                                continue;
+
+                        if (setrlimit_closest(i, context->rlimit[i]) < 0) {
+                                *exit_status = EXIT_LIMITS;
+                                return -errno;
+                        }
+                }
+
+                if (prctl(PR_GET_SECUREBITS) != context->secure_bits)
+                        if (prctl(PR_SET_SECUREBITS, context->secure_bits) < 0) {
+                                *exit_status = EXIT_SECUREBITS;
+                                return -errno;
+                        }
+
+                if (context->no_new_privileges)
+                        if (prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) < 0) {
+                                *exit_status = EXIT_NO_NEW_PRIVILEGES;
+                                return -errno;
+                        }
+        }
+
+        execve(c->path, c->argv, c->envp);
+        *exit_status = EXIT_EXEC;
+        return -errno;
+}
+
+static int exec_vfork_child(void *userdata) {
+        ExecVforkChild *c = userdata;
+        int exit_status = EXIT_FAILURE;
+
+        /* We only get here again if execve() failed. Leave the
+         * logging to the parent, it can see our memory. */
+        c->error = exec_vfork_child_setup(c, &exit_status);
+        c->exit_status = exit_status;
+
+        _exit(exit_status);
+}
+
+static int exec_spawn_vfork(
+                Unit *unit,
+                ExecCommand *command,
+                const ExecContext *context,
+                const ExecParameters *params,
+                char **argv,
+                char **files_env,
+                pid_t *ret) {
+
+        _cleanup_strv_builder_done_ StrvBuilder our_env = {};
+        _cleanup_strv_free_ char **final_env = NULL, **final_argv = NULL;
+        _cleanup_close_ int cgroup_fd = -1;
+        ExecVforkChild c = {
+                .context = context,
+                .params = params,
+                .path = command->path,
+                .working_directory = context->working_directory ?: "/",
+                .stdio = { -1, -1, -1 },
+                .cgroup_fd = -1,
+        };
+        sigset_t all, saved;
+        void *stack;
+        pid_t pid;
+        int i, r;
+
+        assert(unit);
+        assert(command);
+        assert(context);
+        assert(params);
+        assert(ret);
+
+        r = build_environment(context, 0, 0, NULL, NULL, NULL, &our_env);
+        if (r < 0)
+                return r;
+
+        final_env = strv_env_merge(4,
+                                   params->environment,
+                                   strv_builder_get(&our_env),
+                                   context->environment,
+                                   files_env,
+                                   NULL);
+        if (!final_env)
+                return -ENOMEM;
+
+        final_argv = replace_env_argv(argv, final_env);
+        if (!final_argv)
+                return -ENOMEM;
+
+        final_env = strv_env_clean(final_env);
+
+        c.argv = final_argv;
+        c.envp = final_env;
+
+        if (params->cgroup_path) {
+                _cleanup_free_ char *fs = NULL;
+
+                r = cg_get_path(SYSTEMD_CGROUP_CONTROLLER, params->cgroup_path, "cgroup.procs", &fs);
+                if (r < 0)
+                        return r;
+
+                cgroup_fd = open(fs, O_WRONLY|O_CLOEXEC|O_NOCTTY);
+                if (cgroup_fd < 0)
+                        return -errno;
+
+                c.cgroup_fd = cgroup_fd;
+        }
+
+        if (context->oom_score_adjust_set)
+                xsprintf(c.oom_score_adjust, "%i", context->oom_score_adjust);
+
+        c.stdio[STDIN_FILENO] = open("/dev/null", O_RDONLY|O_NOCTTY|O_CLOEXEC);
+        if (c.stdio[STDIN_FILENO] < 0) {
+                r = -errno;
+                goto finish;
+        }
+
+        r = exec_vfork_open_output(unit, context, context->std_output, basename(command->path), &c.stdio[STDOUT_FILENO]);
+        if (r < 0)
+                goto finish;
+
+        /* Same rules as setup_output() for STDERR, with input always
+         * being /dev/null */
+        if (context->std_error == EXEC_OUTPUT_INHERIT &&
+            context->std_output == EXEC_OUTPUT_INHERIT &&
+            getpid() != 1)
+                c.stdio[STDERR_FILENO] = -1;
+        else if (context->std_error == context->std_output ||
+                 context->std_error == EXEC_OUTPUT_INHERIT)
+                c.stdio[STDERR_FILENO] = STDOUT_FILENO;
+        else {
+                r = exec_vfork_open_output(unit, context, context->std_error, basename(command->path), &c.stdio[STDERR_FILENO]);
+                if (r < 0)
+                        goto finish;
+        }
+
+        if (_unlikely_(log_get_max_level() >= LOG_DEBUG)) {
+                _cleanup_free_ char *line;
+
+                line = exec_command_line(final_argv);
+                if (line)
+                        log_struct(LOG_DEBUG,
+                                   LOG_UNIT_ID(unit),
+                                   "EXECUTABLE=%s", command->path,
+                                   LOG_UNIT_MESSAGE(unit, "Executing: %s", line),
+                                   NULL);
+        }
+
+        stack = mmap(NULL, EXEC_VFORK_STACK_SIZE, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_STACK, -1, 0);
+        if (stack == MAP_FAILED) {
+                r = -errno;
+                goto finish;
+        }
+
+        /* Make sure none of our signal handlers runs in the child
+         * before it reset them */
+        assert_se(sigfillset(&all) >= 0);
+        assert_se(sigprocmask(SIG_SETMASK, &all, &saved) >= 0);
+
+        pid = clone(exec_vfork_child, (uint8_t*) stack + EXEC_VFORK_STACK_SIZE, CLONE_VM|CLONE_VFORK|SIGCHLD, &c);
+        r = pid < 0 ? -errno : 0;
+
+        assert_se(sigprocmask(SIG_SETMASK, &saved, NULL) >= 0);
+        (void) munmap(stack, EXEC_VFORK_STACK_SIZE);
+
+        if (r < 0)
+                goto finish;
+
+        /* The child has either called execve() successfully or exited */
+        if (c.error < 0)
+                log_struct_errno(LOG_ERR, c.error,
+                                 LOG_MESSAGE_ID(SD_MESSAGE_SPAWN_FAILED),
+                                 LOG_UNIT_ID(unit),
+                                 LOG_UNIT_MESSAGE(unit, "Failed at step %s spawning %s: %m",
+                                                  exit_status_to_string(c.exit_status, EXIT_STATUS_SYSTEMD),
+                                                  command->path),
+                                 "EXECUTABLE=%s", command->path,
+                                 NULL);
+
+        /* The child only joined our own hierarchy, move it into the
+         * controller hierarchies now */
+        if (params->cgroup_path)
+                (void) cg_attach_everywhere(params->cgroup_supported, params->cgroup_path, pid, NULL, NULL);
+
+        *ret = pid;
+
+finish:
+        for (i = 0; i < 3; i++)
+                if (c.stdio[i] > STDERR_FILENO)
+                        safe_close(c.stdio[i]);
+
+        return r;
+}
+
 int exec_spawn(Unit *unit,
                ExecCommand *command,
                const ExecContext *context,
@@ -1929,9 +2411,20 @@ int exec_spawn(Unit *unit,
                    LOG_UNIT_MESSAGE(unit, "About to execute: %s", line),
                    "EXECUTABLE=%s", command->path,
                    NULL);
+
+        if (exec_context_may_vfork(context, params, runtime, socket_fd, n_fds)) {
+                r = exec_spawn_vfork(unit, command, context, params, argv, files_env, &pid);
+                if (r >= 0) {
+                        log_unit_debug(unit, "Spawned %s as "PID_FMT, command->path, pid);
+                        goto finish;
+                }
+
+                log_unit_debug_errno(unit, r, "Failed to spawn %s without copying our memory, forking instead: %m", command->path);
+        }
+
         pid = fork();
         if (pid < 0)
-                return log_unit_error_errno(unit, r, "Failed to fork: %m");
+                return log_unit_error_errno(unit, errno, "Failed to fork: %m");
 
         if (pid == 0) {
                 int exit_status;
@@ -1971,6 +2464,7 @@ int exec_spawn(Unit *unit,
         if (params->cgroup_path)
                 (void) cg_attach(SYSTEMD_CGROUP_CONTROLLER, params->cgroup_path, pid);
 
+finish:
         exec_status_start(&command->exec_status, pid);
 
         *ret = pid;
@@ -77,6 +77,7 @@ void job_free(Job *j) {
         assert(!j->transaction_next);
         assert(!j->subject_list);
         assert(!j->object_list);
+        assert(!j->in_gc_queue);
 
         if (j->in_run_queue)
                 LIST_REMOVE(run_queue, j->manager->run_queue, j);
@@ -456,7 +457,7 @@ static bool job_is_runnable(Job *j) {
                  * dependencies, regardless whether they are
                  * starting or stopping something. */
 
-                SET_FOREACH(other, j->unit->dependencies[UNIT_AFTER], i)
+                UNIT_FOREACH_DEPENDENCY(other, j->unit, UNIT_AFTER, i)
                         if (other->job)
                                 return false;
         }
@@ -464,7 +465,7 @@ static bool job_is_runnable(Job *j) {
         /* Also, if something else is being stopped and we should
          * change state after it, then let's wait. */
 
-        SET_FOREACH(other, j->unit->dependencies[UNIT_BEFORE], i)
+        UNIT_FOREACH_DEPENDENCY(other, j->unit, UNIT_BEFORE, i)
                 if (other->job &&
                     (other->job->type == JOB_STOP ||
                      other->job->type == JOB_RESTART))
@@ -778,7 +779,7 @@ static void job_fail_dependencies(Unit *u, UnitDependency d) {
 
         assert(u);
 
-        SET_FOREACH(other, u->dependencies[d], i) {
+        UNIT_FOREACH_DEPENDENCY(other, u, d, i) {
                 Job *j = other->job;
 
                 if (!j)
@@ -862,10 +863,10 @@ int job_finish_and_invalidate(Job *j, JobResult result, bool recursive) {
 
 finish:
         /* Try to start the next jobs that can be started */
-        SET_FOREACH(other, u->dependencies[UNIT_AFTER], i)
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_AFTER, i)
                 if (other->job)
                         job_add_to_run_queue(other->job);
-        SET_FOREACH(other, u->dependencies[UNIT_BEFORE], i)
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_BEFORE, i)
                 if (other->job)
                         job_add_to_run_queue(other->job);
 
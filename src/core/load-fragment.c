@@ -873,8 +873,11 @@ int config_parse_exec_cpu_affinity(const char *unit,
                                    void *userdata) {
 
         ExecContext *c = data;
+        Unit *u = userdata;
+        _cleanup_free_ char *k = NULL;
         const char *word, *state;
         size_t l;
+        int r;
 
         assert(filename);
         assert(lvalue);
@@ -889,9 +892,16 @@ int config_parse_exec_cpu_affinity(const char *unit,
                 return 0;
         }
 
-        FOREACH_WORD_QUOTED(word, l, rvalue, state) {
+        /* Resolve specifiers, so that instances of a template can
+         * be pinned to the CPU named by their instance string */
+        r = unit_full_printf(u, rvalue, &k);
+        if (r < 0) {
+                log_syntax(unit, LOG_ERR, filename, line, r, "Failed to resolve unit specifiers on %s, ignoring: %m", rvalue);
+                return 0;
+        }
+
+        FOREACH_WORD_QUOTED(word, l, k, state) {
                 _cleanup_free_ char *t = NULL;
-                int r;
                 unsigned cpu;
 
                 t = strndup(word, l);
@@ -908,7 +918,7 @@ int config_parse_exec_cpu_affinity(const char *unit,
 
                 if (r < 0 || cpu >= c->cpuset_ncpus) {
                         log_syntax(unit, LOG_ERR, filename, line, ERANGE,
-                                   "Failed to parse CPU affinity '%s', ignoring: %s", t, rvalue);
+                                   "Failed to parse CPU affinity '%s', ignoring: %s", t, k);
                         return 0;
                 }
 
@@ -1426,7 +1436,7 @@ int config_parse_trigger_unit(
         assert(rvalue);
         assert(data);
 
-        if (!set_isempty(u->dependencies[UNIT_TRIGGERS])) {
+        if (UNIT_TRIGGER(u)) {
                 log_syntax(unit, LOG_ERR, filename, line, EINVAL,
                            "Multiple units to trigger specified, ignoring: %s", rvalue);
                 return 0;
@@ -1520,7 +1530,6 @@ int config_parse_path_spec(const char *unit,
         s->path = path_kill_slashes(k);
         k = NULL;
         s->type = b;
-        s->inotify_fd = -1;
 
         LIST_PREPEND(spec, p->specs, s);
 
@@ -1927,6 +1936,8 @@ int config_parse_environ(const char *unit,
         const char *word, *state;
         size_t l;
         _cleanup_free_ char *k = NULL;
+        _cleanup_strv_builder_done_ StrvBuilder assignments = {};
+        char **x;
         int r;
 
         assert(filename);
@@ -1953,7 +1964,6 @@ int config_parse_environ(const char *unit,
 
         FOREACH_WORD_QUOTED(word, l, k, state) {
                 _cleanup_free_ char *n = NULL;
-                char **x;
 
                 r = cunescape_length(word, l, 0, &n);
                 if (r < 0) {
@@ -1966,16 +1976,24 @@ int config_parse_environ(const char *unit,
                         continue;
                 }
 
-                x = strv_env_set(*env, n);
+                r = strv_builder_add(&assignments, n);
+                if (r < 0)
+                        return log_oom();
+        }
+        if (!isempty(state))
+                log_syntax(unit, LOG_ERR, filename, line, EINVAL,
+                           "Trailing garbage, ignoring.");
+
+        /* Merge all assignments of the line at once, rather than
+         * copying the whole environment for each of them */
+        if (assignments.n > 0) {
+                x = strv_env_merge(2, *env, strv_builder_get(&assignments));
                 if (!x)
                         return log_oom();
 
                 strv_free(*env);
                 *env = x;
         }
-        if (!isempty(state))
-                log_syntax(unit, LOG_ERR, filename, line, EINVAL,
-                           "Trailing garbage, ignoring.");
 
         return 0;
 }
@@ -2221,6 +2239,44 @@ int config_parse_unit_requires_mounts_for(
         return 0;
 }
 
+int config_parse_unit_source_path(
+                const char *unit,
+                const char *filename,
+                unsigned line,
+                const char *section,
+                unsigned section_line,
+                const char *lvalue,
+                int ltype,
+                const char *rvalue,
+                void *data,
+                void *userdata) {
+
+        _cleanup_free_ char *p = NULL;
+        Unit *u = userdata;
+        char *k;
+        int r;
+
+        assert(filename);
+        assert(lvalue);
+        assert(rvalue);
+        assert(u);
+
+        /* Like config_parse_path(), but the result is interned, as
+         * all units made by the same generator share it */
+        r = config_parse_path(unit, filename, line, section, section_line, lvalue, ltype, rvalue, &p, userdata);
+        if (r < 0 || !p)
+                return r;
+
+        r = manager_intern_string(u->manager, p, &k);
+        if (r < 0)
+                return log_oom();
+
+        manager_release_string(u->manager, u->source_path);
+        u->source_path = k;
+
+        return 0;
+}
+
 int config_parse_documentation(const char *unit,
                                const char *filename,
                                unsigned line,
@@ -3476,7 +3532,7 @@ static int load_from_path(Unit *u, const char *path) {
         _cleanup_set_free_free_ Set *symlink_names = NULL;
         _cleanup_fclose_ FILE *f = NULL;
         _cleanup_free_ char *filename = NULL;
-        char *id = NULL;
+        char *id = NULL, *k;
         Unit *merged;
         struct stat st;
 
@@ -3501,10 +3557,20 @@ static int load_from_path(Unit *u, const char *path) {
                 }
 
         } else  {
+                unsigned mask = 0;
                 char **p;
 
+                /* If we know in which directories the name exists,
+                 * only look there */
+                if (u->manager->unit_path_index)
+                        mask = PTR_TO_UINT(hashmap_get(u->manager->unit_path_index, path));
+
                 STRV_FOREACH(p, u->manager->lookup_paths.unit_path) {
 
+                        if (u->manager->unit_path_index &&
+                            !(mask & (1U << (p - u->manager->lookup_paths.unit_path))))
+                                continue;
+
                         /* Instead of opening the path right away, we manually
                          * follow all symlinks and add their name to our unit
                          * name set while doing so */
@@ -3563,9 +3629,12 @@ static int load_from_path(Unit *u, const char *path) {
                         return r;
         }
 
-        free(u->fragment_path);
-        u->fragment_path = filename;
-        filename = NULL;
+        r = manager_intern_string(u->manager, filename, &k);
+        if (r < 0)
+                return r;
+
+        manager_release_string(u->manager, u->fragment_path);
+        u->fragment_path = k;
 
         u->fragment_mtime = timespec_load(&st.st_mtim);
 
@@ -3627,7 +3696,7 @@ int unit_load_fragment(Unit *u) {
                         /* Hmm, this didn't work? Then let's get rid
                          * of the fragment path stored for us, so that
                          * we don't point to an invalid location. */
-                        u->fragment_path = mfree(u->fragment_path);
+                        u->fragment_path = manager_release_string(u->manager, u->fragment_path);
         }
 
         /* Look for a template */
@@ -3683,6 +3752,7 @@ void unit_dump_config_items(FILE *f) {
                 { config_parse_string,                "STRING" },
                 { config_parse_path,                  "PATH" },
                 { config_parse_unit_path_printf,      "PATH" },
+                { config_parse_unit_source_path,      "PATH" },
                 { config_parse_strv,                  "STRING [...]" },
                 { config_parse_exec_nice,             "NICE" },
                 { config_parse_exec_oom_score_adjust, "OOMSCOREADJUST" },
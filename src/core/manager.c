@@ -23,6 +23,7 @@
 #include <string.h>
 #include <signal.h>
 #include <sys/wait.h>
+#include <malloc.h>
 #include <unistd.h>
 #include <sys/inotify.h>
 #include <sys/epoll.h>
@@ -40,6 +41,8 @@
 #include "sd-daemon.h"
 #include "sd-messages.h"
 
+#include "async.h"
+
 #include "hashmap.h"
 #include "macro.h"
 #include "strv.h"
@@ -80,6 +83,18 @@
 #define JOBS_IN_PROGRESS_PERIOD_USEC (USEC_PER_SEC / 3)
 #define JOBS_IN_PROGRESS_PERIOD_DIVISOR 3
 
+/* Unreferenced units are collected right away, but the full GC sweep
+ * only runs once this many units are queued, or the oldest one has
+ * waited this long */
+#define GC_QUEUE_ENTRIES_MAX 16
+#define GC_QUEUE_USEC_MAX (1*USEC_PER_SEC)
+
+/* The number of threads reading unit files into the page cache at boot */
+#define UNIT_PREFETCH_THREADS 4U
+
+/* The number of notification datagrams we read with a single recvmmsg() */
+#define NOTIFY_BATCH_MAX 16U
+
 static int manager_dispatch_notify_fd(sd_event_source *source, int fd, uint32_t revents, void *userdata);
 static int manager_dispatch_signal_fd(sd_event_source *source, int fd, uint32_t revents, void *userdata);
 static int manager_dispatch_time_change_fd(sd_event_source *source, int fd, uint32_t revents, void *userdata);
@@ -88,6 +103,8 @@ static int manager_dispatch_jobs_in_progress(sd_event_source *source, usec_t use
 static int manager_dispatch_run_queue(sd_event_source *source, void *userdata);
 static int manager_run_generators(Manager *m);
 static void manager_undo_generators(Manager *m);
+static void manager_free_generator_timings(Manager *m);
+static void manager_free_unit_path_cache(Manager *m);
 
 static void manager_watch_jobs_in_progress(Manager *m) {
         usec_t next;
@@ -563,6 +580,7 @@ int manager_new(ManagerRunningAs running_as, bool test_run, Manager **_m) {
         m->running_as = running_as;
         m->exit_code = _MANAGER_EXIT_CODE_INVALID;
         m->default_timer_accuracy_usec = USEC_PER_MINUTE;
+        m->default_timer_accuracy_on_battery_usec = USEC_PER_MINUTE;
 
         /* Prepare log fields we can use for structured logging */
         m->unit_log_field = unit_log_fields[running_as];
@@ -572,7 +590,7 @@ int manager_new(ManagerRunningAs running_as, bool test_run, Manager **_m) {
 
         m->pin_cgroupfs_fd = m->notify_fd = m->signal_fd = m->time_change_fd =
                 m->dev_autofs_fd = m->private_listen_fd = m->kdbus_fd = m->utab_inotify_fd =
-                m->cgroup_inotify_fd = -1;
+                m->cgroup_inotify_fd = m->cgroups_agent_fd = m->path_inotify_fd = -1;
         m->current_job_id = 1; /* start as id #1, so that we can leave #0 around as "null-like" value */
 
         m->ask_password_inotify_fd = -1;
@@ -585,6 +603,7 @@ int manager_new(ManagerRunningAs running_as, bool test_run, Manager **_m) {
 
         /* Reboot immediately if the user hits C-A-D more often than 7x per 2s */
         RATELIMIT_INIT(m->ctrl_alt_del_ratelimit, 2 * USEC_PER_SEC, 7);
+        RATELIMIT_INIT(m->dbus_signal_ratelimit, 0, 0);
 
         r = manager_default_environment(m);
         if (r < 0)
@@ -809,11 +828,15 @@ static void unit_gc_sweep(Unit *u, unsigned gc_marker) {
         if (unit_check_gc(u))
                 goto good;
 
+        /* Nobody references us, no need to look further */
+        if (u->n_referenced_by == 0)
+                goto bad;
+
         u->gc_marker = gc_marker + GC_OFFSET_IN_PATH;
 
         is_bad = true;
 
-        SET_FOREACH(other, u->dependencies[UNIT_REFERENCED_BY], i) {
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_REFERENCED_BY, i) {
                 unit_gc_sweep(other, gc_marker);
 
                 if (other->gc_marker == gc_marker + GC_OFFSET_GOOD)
@@ -843,6 +866,37 @@ good:
         u->gc_marker = gc_marker + GC_OFFSET_GOOD;
 }
 
+static unsigned manager_dispatch_gc_queue_unreferenced(Manager *m) {
+        Unit *u, *next;
+        unsigned n = 0;
+
+        assert(m);
+
+        /* Only handle the units we can decide on without walking
+         * the dependencies, and leave the rest queued */
+
+        LIST_FOREACH_SAFE(gc_queue, u, next, m->gc_queue) {
+                assert(u->in_gc_queue);
+
+                if (!u->in_cleanup_queue && !unit_check_gc(u)) {
+                        if (u->n_referenced_by > 0)
+                                continue;
+
+                        if (u->id)
+                                log_unit_debug(u, "Collecting.");
+                        unit_add_to_cleanup_queue(u);
+                }
+
+                LIST_REMOVE(gc_queue, m->gc_queue, u);
+                u->in_gc_queue = false;
+                m->n_in_gc_queue--;
+
+                n++;
+        }
+
+        return n;
+}
+
 static unsigned manager_dispatch_gc_queue(Manager *m) {
         Unit *u;
         unsigned n = 0;
@@ -850,6 +904,10 @@ static unsigned manager_dispatch_gc_queue(Manager *m) {
 
         assert(m);
 
+        if (m->n_in_gc_queue < GC_QUEUE_ENTRIES_MAX &&
+            m->gc_queue_timestamp + GC_QUEUE_USEC_MAX > now(CLOCK_MONOTONIC))
+                return manager_dispatch_gc_queue_unreferenced(m);
+
         /* log_debug("Running GC..."); */
 
         m->gc_marker += _GC_OFFSET_MAX;
@@ -924,6 +982,7 @@ Manager* manager_free(Manager *m) {
         manager_shutdown_cgroup(m, m->exit_code != MANAGER_REEXECUTE);
 
         manager_undo_generators(m);
+        manager_free_generator_timings(m);
 
         bus_done(m);
 
@@ -944,6 +1003,7 @@ Manager* manager_free(Manager *m) {
 
         safe_close(m->signal_fd);
         safe_close(m->notify_fd);
+        free(m->notify_buffer);
         safe_close(m->time_change_fd);
         safe_close(m->kdbus_fd);
 
@@ -960,7 +1020,7 @@ Manager* manager_free(Manager *m) {
         strv_free(m->environment);
 
         hashmap_free(m->cgroup_unit);
-        set_free_free(m->unit_path_cache);
+        manager_free_unit_path_cache(m);
 
         hashmap_free(m->cgroup_netclass_registry);
 
@@ -973,6 +1033,9 @@ Manager* manager_free(Manager *m) {
         assert(hashmap_isempty(m->units_requiring_mounts_for));
         hashmap_free(m->units_requiring_mounts_for);
 
+        assert(hashmap_isempty(m->interned_strings));
+        hashmap_free(m->interned_strings);
+
         free(m);
         return NULL;
 }
@@ -1026,14 +1089,85 @@ static void manager_coldplug(Manager *m) {
         }
 }
 
+static void stamp_update(uint64_t *stamp, const void *p, size_t l) {
+        const uint8_t *b = p;
+
+        /* FNV-1a, we only need to notice changes here */
+        for (; l > 0; l--, b++)
+                *stamp = (*stamp ^ *b) * UINT64_C(0x100000001b3);
+}
+
+static uint64_t manager_unit_path_stamp(Manager *m) {
+        uint64_t stamp = UINT64_C(0xcbf29ce484222325);
+        char **i;
+
+        assert(m);
+
+        /* Folds the modification times of all unit directories and
+         * their subdirectories (drop-in, .wants/ and .requires/
+         * directories) into a single value. It changes whenever unit
+         * files, drop-ins or links are added, removed or renamed.
+         * Files edited in place are caught by unit_need_daemon_reload()
+         * instead. */
+
+        STRV_FOREACH(i, m->lookup_paths.unit_path) {
+                _cleanup_closedir_ DIR *d = NULL;
+                struct dirent *de;
+                struct stat st;
+                usec_t t = 0;
+
+                stamp_update(&stamp, *i, strlen(*i) + 1);
+
+                d = opendir(*i);
+                if (d && fstat(dirfd(d), &st) >= 0) {
+                        t = timespec_load(&st.st_mtim);
+                        stamp_update(&stamp, &st.st_ino, sizeof(st.st_ino));
+                }
+                stamp_update(&stamp, &t, sizeof(t));
+
+                if (!d)
+                        continue;
+
+                while ((de = readdir(d))) {
+                        if (hidden_file(de->d_name))
+                                continue;
+
+                        if (!IN_SET(de->d_type, DT_DIR, DT_LNK, DT_UNKNOWN))
+                                continue;
+
+                        if (fstatat(dirfd(d), de->d_name, &st, 0) < 0 ||
+                            !S_ISDIR(st.st_mode))
+                                continue;
+
+                        t = timespec_load(&st.st_mtim);
+                        stamp_update(&stamp, de->d_name, strlen(de->d_name) + 1);
+                        stamp_update(&stamp, &st.st_ino, sizeof(st.st_ino));
+                        stamp_update(&stamp, &t, sizeof(t));
+                }
+        }
+
+        return stamp;
+}
+
+static void manager_free_unit_path_cache(Manager *m) {
+        assert(m);
+
+        /* The index borrows its keys from the cache, free it first */
+        m->unit_path_index = hashmap_free(m->unit_path_index);
+
+        set_free_free(m->unit_path_cache);
+        m->unit_path_cache = NULL;
+}
+
 static void manager_build_unit_path_cache(Manager *m) {
         char **i;
         _cleanup_closedir_ DIR *d = NULL;
+        unsigned k;
         int r;
 
         assert(m);
 
-        set_free_free(m->unit_path_cache);
+        manager_free_unit_path_cache(m);
 
         m->unit_path_cache = set_new(&string_hash_ops);
         if (!m->unit_path_cache) {
@@ -1041,6 +1175,15 @@ static void manager_build_unit_path_cache(Manager *m) {
                 return;
         }
 
+        /* Additionally index the entries by name, with a mask of the
+         * unit directories they were found in, so that looking up a
+         * unit file doesn't need to probe each directory in turn. */
+        if (strv_length(m->lookup_paths.unit_path) <= sizeof(unsigned) * 8) {
+                m->unit_path_index = hashmap_new(&string_hash_ops);
+                if (!m->unit_path_index)
+                        log_warning("Failed to allocate unit path index, ignoring.");
+        }
+
         /* This simply builds a list of files we know exist, so that
          * we don't always have to go to disk */
 
@@ -1048,6 +1191,7 @@ static void manager_build_unit_path_cache(Manager *m) {
                 struct dirent *de;
 
                 d = opendir(*i);
+                k = i - m->lookup_paths.unit_path;
                 if (!d) {
                         if (errno != ENOENT)
                                 log_error_errno(errno, "Failed to open directory %s: %m", *i);
@@ -1069,19 +1213,89 @@ static void manager_build_unit_path_cache(Manager *m) {
                         r = set_consume(m->unit_path_cache, p);
                         if (r < 0)
                                 goto fail;
+
+                        if (r > 0 && m->unit_path_index) {
+                                const char *name;
+                                unsigned mask;
+
+                                name = p + strlen(p) - strlen(de->d_name);
+                                mask = PTR_TO_UINT(hashmap_get(m->unit_path_index, name));
+
+                                r = hashmap_replace(m->unit_path_index, name, UINT_TO_PTR(mask | (1U << k)));
+                                if (r < 0)
+                                        goto fail;
+                        }
                 }
 
                 closedir(d);
                 d = NULL;
         }
 
+        m->unit_path_stamp = manager_unit_path_stamp(m);
+
         return;
 
 fail:
         log_error_errno(r, "Failed to build unit path cache: %m");
 
-        set_free_free(m->unit_path_cache);
-        m->unit_path_cache = NULL;
+        manager_free_unit_path_cache(m);
+}
+
+static void *unit_prefetch_thread(void *p) {
+        _cleanup_strv_free_ char **paths = p;
+        char **i;
+
+        STRV_FOREACH(i, paths) {
+                _cleanup_close_ int fd = -1;
+                struct stat st;
+
+                fd = open(*i, O_RDONLY|O_CLOEXEC|O_NOCTTY|O_NONBLOCK|O_NOATIME);
+                if (fd < 0)
+                        continue;
+
+                if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode))
+                        continue;
+
+                (void) readahead(fd, 0, st.st_size);
+        }
+
+        return NULL;
+}
+
+static void manager_prefetch_unit_files(Manager *m) {
+        char **paths[UNIT_PREFETCH_THREADS] = {};
+        Iterator i;
+        unsigned k = 0;
+        char *p;
+        int r;
+
+        assert(m);
+
+        /* Loading units is strictly serial, and on a cold cache each
+         * unit file read waits for the disk. Hence let a few threads
+         * pull all unit files we know about into the page cache in
+         * parallel, while we are busy with the first ones. Parsing
+         * and applying the settings stays in the main thread. */
+
+        if (m->test_run || m->running_as != MANAGER_SYSTEM)
+                return;
+
+        SET_FOREACH(p, m->unit_path_cache, i)
+                if (strv_extend(&paths[k++ % UNIT_PREFETCH_THREADS], p) < 0) {
+                        log_oom();
+                        break;
+                }
+
+        for (k = 0; k < UNIT_PREFETCH_THREADS; k++) {
+                if (!paths[k])
+                        continue;
+
+                r = asynchronous_job(unit_prefetch_thread, paths[k]);
+                if (r < 0) {
+                        log_debug_errno(r, "Failed to start unit file prefetch thread, ignoring: %m");
+                        strv_free(paths[k]);
+                }
+        }
 }
 
 
@@ -1129,6 +1343,9 @@ int manager_startup(Manager *m, FILE *serialization, FDSet *fds) {
 
         manager_build_unit_path_cache(m);
 
+        if (!serialization)
+                manager_prefetch_unit_files(m);
+
         /* If we will deserialize make sure that during enumeration
          * this is already known, so we increase the counter here
          * already */
@@ -1169,6 +1386,8 @@ int manager_startup(Manager *m, FILE *serialization, FDSet *fds) {
         /* Third, fire things up! */
         manager_coldplug(m);
 
+        (void) manager_setup_accounting_sample(m);
+
         if (serialization) {
                 assert(m->n_reloading > 0);
                 m->n_reloading --;
@@ -1331,10 +1550,10 @@ int manager_load_unit_prepare(
                 return -ENOMEM;
 
         if (path) {
-                ret->fragment_path = strdup(path);
-                if (!ret->fragment_path) {
+                r = manager_intern_string(m, path, &ret->fragment_path);
+                if (r < 0) {
                         unit_free(ret);
-                        return -ENOMEM;
+                        return r;
                 }
         }
 
@@ -1404,6 +1623,72 @@ void manager_dump_units(Manager *s, FILE *f, const char *prefix) {
                         unit_dump(u, f, prefix);
 }
 
+void manager_dump_memory(Manager *s, FILE *f, const char *prefix) {
+        struct {
+                unsigned n_units;
+                unsigned n_loaded;
+                unsigned n_dependencies;
+                size_t allocated;
+        } stats[_UNIT_TYPE_MAX] = {};
+        size_t strings_allocated = 0;
+        unsigned strings_references = 0;
+        char buf[FORMAT_BYTES_MAX];
+        UnitType t;
+        Iterator i;
+        const char *k;
+        void *v;
+        Unit *u;
+
+        assert(s);
+        assert(f);
+
+        prefix = strempty(prefix);
+
+        /* Only counts what is allocated for the unit objects and
+         * their own strings, not the hashmap storage for their names
+         * and dependencies, of which we only show the number */
+        HASHMAP_FOREACH_KEY(u, k, s->units, i) {
+                if (u->id != k)
+                        continue;
+
+                stats[u->type].n_units++;
+                if (u->load_state == UNIT_LOADED)
+                        stats[u->type].n_loaded++;
+
+                stats[u->type].allocated += malloc_usable_size(u) +
+                        malloc_usable_size(u->id) +
+                        malloc_usable_size(u->instance) +
+                        malloc_usable_size(u->description);
+
+                stats[u->type].n_dependencies += hashmap_size(u->dependencies);
+        }
+
+        fprintf(f, "%s-> Memory:\n", prefix);
+
+        for (t = 0; t < _UNIT_TYPE_MAX; t++) {
+                if (stats[t].n_units == 0)
+                        continue;
+
+                fprintf(f,
+                        "%s\t%s: %u units (%u loaded), %zu bytes per object, %u dependencies, %s allocated\n",
+                        prefix, unit_type_to_string(t),
+                        stats[t].n_units, stats[t].n_loaded,
+                        unit_vtable[t]->object_size,
+                        stats[t].n_dependencies,
+                        format_bytes(buf, sizeof(buf), stats[t].allocated));
+        }
+
+        HASHMAP_FOREACH_KEY(v, k, s->interned_strings, i) {
+                strings_allocated += malloc_usable_size((char*) k);
+                strings_references += PTR_TO_UINT(v);
+        }
+
+        fprintf(f,
+                "%s\tinterned strings: %u strings, %u references, %s allocated\n",
+                prefix, hashmap_size(s->interned_strings), strings_references,
+                format_bytes(buf, sizeof(buf), strings_allocated));
+}
+
 void manager_clear_jobs(Manager *m) {
         Job *j;
 
@@ -1452,6 +1737,13 @@ static unsigned manager_dispatch_dbus_queue(Manager *m) {
         while ((u = m->dbus_unit_queue)) {
                 assert(u->in_dbus_queue);
 
+                /* UnitNew is never delayed, but change signals
+                 * are subject to the configured rate limit. Units
+                 * we skip here stay queued, so that further changes
+                 * are merged into a single signal later on. */
+                if (u->sent_dbus_new_signal && !ratelimit_test(&m->dbus_signal_ratelimit))
+                        break;
+
                 bus_unit_send_change_signal(u);
                 n++;
         }
@@ -1477,19 +1769,9 @@ static unsigned manager_dispatch_dbus_queue(Manager *m) {
         return n;
 }
 
-static void manager_invoke_notify_message(Manager *m, Unit *u, pid_t pid, char *buf, size_t n, FDSet *fds) {
-        _cleanup_strv_free_ char **tags = NULL;
-
+static void manager_invoke_notify_message(Manager *m, Unit *u, pid_t pid, char **tags, FDSet *fds) {
         assert(m);
         assert(u);
-        assert(buf);
-        assert(n > 0);
-
-        tags = strv_split(buf, "\n\r");
-        if (!tags) {
-                log_oom();
-                return;
-        }
 
         if (UNIT_VTABLE(u)->notify_message)
                 UNIT_VTABLE(u)->notify_message(u, pid, tags, fds);
@@ -1497,10 +1779,163 @@ static void manager_invoke_notify_message(Manager *m, Unit *u, pid_t pid, char *
                 log_unit_debug(u, "Got notification message for unit. Ignoring.");
 }
 
+typedef struct NotifyMessage {
+        pid_t pid;
+        char **tags;
+        FDSet *fds;
+} NotifyMessage;
+
+static void notify_message_done(NotifyMessage *n) {
+        assert(n);
+
+        n->tags = strv_free(n->tags);
+        n->fds = fdset_free(n->fds);
+}
+
+static int notify_message_parse(NotifyMessage *ret, struct msghdr *msghdr, char *buf, size_t n) {
+        _cleanup_fdset_free_ FDSet *fds = NULL;
+        struct ucred *ucred = NULL;
+        struct cmsghdr *cmsg;
+        int *fd_array = NULL;
+        unsigned n_fds = 0;
+        char **tags;
+        int r;
+
+        assert(ret);
+        assert(msghdr);
+        assert(buf);
+
+        CMSG_FOREACH(cmsg, msghdr) {
+                if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+
+                        fd_array = (int*) CMSG_DATA(cmsg);
+                        n_fds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+
+                } else if (cmsg->cmsg_level == SOL_SOCKET &&
+                           cmsg->cmsg_type == SCM_CREDENTIALS &&
+                           cmsg->cmsg_len == CMSG_LEN(sizeof(struct ucred))) {
+
+                        ucred = (struct ucred*) CMSG_DATA(cmsg);
+                }
+        }
+
+        if (n_fds > 0) {
+                assert(fd_array);
+
+                r = fdset_new_array(&fds, fd_array, n_fds);
+                if (r < 0) {
+                        close_many(fd_array, n_fds);
+                        return log_oom();
+                }
+        }
+
+        if (!ucred || ucred->pid <= 0) {
+                log_warning("Received notify message without valid credentials. Ignoring.");
+                return 0;
+        }
+
+        if (msghdr->msg_flags & MSG_TRUNC) {
+                log_warning("Received notify message exceeded maximum size. Ignoring.");
+                return 0;
+        }
+
+        buf[n] = 0;
+
+        tags = strv_split(buf, "\n\r");
+        if (!tags)
+                return log_oom();
+
+        *ret = (NotifyMessage) {
+                .pid = ucred->pid,
+                .tags = tags,
+                .fds = fds,
+        };
+        fds = NULL;
+
+        return 1;
+}
+
+static bool notify_message_superseded(const NotifyMessage *n, const NotifyMessage *later) {
+        bool watchdog = false;
+        char **i;
+
+        assert(n);
+        assert(later);
+
+        /* A message that only updates the status text (and possibly
+         * pets the watchdog) is pointless if a later message from
+         * the same process in the same batch does the same again:
+         * only the last status text would ever be visible. */
+
+        if (n->pid != later->pid)
+                return false;
+        if (!fdset_isempty(n->fds))
+                return false;
+
+        STRV_FOREACH(i, n->tags) {
+                if (streq(*i, "WATCHDOG=1"))
+                        watchdog = true;
+                else if (!startswith(*i, "STATUS="))
+                        return false;
+        }
+
+        if (watchdog && !strv_contains(later->tags, "WATCHDOG=1"))
+                return false;
+
+        STRV_FOREACH(i, later->tags)
+                if (startswith(*i, "STATUS="))
+                        return true;
+
+        return false;
+}
+
+static void manager_dispatch_notify_message(Manager *m, NotifyMessage *n, Hashmap **pid_cache) {
+        Unit *u1, *u2, *u3;
+        bool found = false;
+
+        assert(m);
+        assert(n);
+        assert(pid_cache);
+
+        /* Looking up the unit by cgroup means reading
+         * /proc/$PID/cgroup, hence remember the result for the
+         * remaining messages of this wakeup. */
+        u1 = hashmap_get(*pid_cache, PID_TO_PTR(n->pid));
+        if (!u1) {
+                u1 = manager_get_unit_by_pid_cgroup(m, n->pid);
+                if (u1 && hashmap_ensure_allocated(pid_cache, NULL) >= 0)
+                        (void) hashmap_put(*pid_cache, PID_TO_PTR(n->pid), u1);
+        }
+
+        /* Notify every unit that might be interested, but try
+         * to avoid notifying the same one multiple times. */
+        if (u1) {
+                manager_invoke_notify_message(m, u1, n->pid, n->tags, n->fds);
+                found = true;
+        }
+
+        u2 = hashmap_get(m->watch_pids1, PID_TO_PTR(n->pid));
+        if (u2 && u2 != u1) {
+                manager_invoke_notify_message(m, u2, n->pid, n->tags, n->fds);
+                found = true;
+        }
+
+        u3 = hashmap_get(m->watch_pids2, PID_TO_PTR(n->pid));
+        if (u3 && u3 != u2 && u3 != u1) {
+                manager_invoke_notify_message(m, u3, n->pid, n->tags, n->fds);
+                found = true;
+        }
+
+        if (!found)
+                log_warning("Cannot find unit for notify message of PID "PID_FMT".", n->pid);
+
+        if (fdset_size(n->fds) > 0)
+                log_warning("Got auxiliary fds with notification message, closing all.");
+}
+
 static int manager_dispatch_notify_fd(sd_event_source *source, int fd, uint32_t revents, void *userdata) {
+        _cleanup_hashmap_free_ Hashmap *pid_cache = NULL;
         Manager *m = userdata;
-        ssize_t n;
-        int r;
 
         assert(m);
         assert(m->notify_fd == fd);
@@ -1510,100 +1945,72 @@ static int manager_dispatch_notify_fd(sd_event_source *source, int fd, uint32_t
                 return 0;
         }
 
+        if (!m->notify_buffer) {
+                m->notify_buffer = new(char, NOTIFY_BATCH_MAX * (NOTIFY_BUFFER_MAX+1));
+                if (!m->notify_buffer)
+                        return log_oom();
+        }
+
         for (;;) {
-                _cleanup_fdset_free_ FDSet *fds = NULL;
-                char buf[NOTIFY_BUFFER_MAX+1];
-                struct iovec iovec = {
-                        .iov_base = buf,
-                        .iov_len = sizeof(buf)-1,
-                };
                 union {
                         struct cmsghdr cmsghdr;
                         uint8_t buf[CMSG_SPACE(sizeof(struct ucred)) +
                                     CMSG_SPACE(sizeof(int) * NOTIFY_FD_MAX)];
-                } control = {};
-                struct msghdr msghdr = {
-                        .msg_iov = &iovec,
-                        .msg_iovlen = 1,
-                        .msg_control = &control,
-                        .msg_controllen = sizeof(control),
-                };
-                struct cmsghdr *cmsg;
-                struct ucred *ucred = NULL;
-                bool found = false;
-                Unit *u1, *u2, *u3;
-                int *fd_array = NULL;
-                unsigned n_fds = 0;
-
-                n = recvmsg(m->notify_fd, &msghdr, MSG_DONTWAIT|MSG_CMSG_CLOEXEC);
-                if (n < 0) {
-                        if (errno == EAGAIN || errno == EINTR)
-                                break;
-
-                        return -errno;
-                }
-
-                CMSG_FOREACH(cmsg, &msghdr) {
-                        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
-
-                                fd_array = (int*) CMSG_DATA(cmsg);
-                                n_fds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
-
-                        } else if (cmsg->cmsg_level == SOL_SOCKET &&
-                                   cmsg->cmsg_type == SCM_CREDENTIALS &&
-                                   cmsg->cmsg_len == CMSG_LEN(sizeof(struct ucred))) {
-
-                                ucred = (struct ucred*) CMSG_DATA(cmsg);
-                        }
-                }
-
-                if (n_fds > 0) {
-                        assert(fd_array);
+                } control[NOTIFY_BATCH_MAX] = {};
+                struct iovec iovec[NOTIFY_BATCH_MAX];
+                struct mmsghdr msgs[NOTIFY_BATCH_MAX];
+                NotifyMessage messages[NOTIFY_BATCH_MAX] = {};
+                unsigned i, j;
+                int k;
+
+                for (i = 0; i < NOTIFY_BATCH_MAX; i++) {
+                        iovec[i] = (struct iovec) {
+                                .iov_base = m->notify_buffer + i * (NOTIFY_BUFFER_MAX+1),
+                                .iov_len = NOTIFY_BUFFER_MAX, /* Leave room for trailing NUL we add later */
+                        };
 
-                        r = fdset_new_array(&fds, fd_array, n_fds);
-                        if (r < 0) {
-                                close_many(fd_array, n_fds);
-                                return log_oom();
-                        }
+                        msgs[i] = (struct mmsghdr) {
+                                .msg_hdr.msg_iov = iovec + i,
+                                .msg_hdr.msg_iovlen = 1,
+                                .msg_hdr.msg_control = control + i,
+                                .msg_hdr.msg_controllen = sizeof(control[i]),
+                        };
                 }
 
-                if (!ucred || ucred->pid <= 0) {
-                        log_warning("Received notify message without valid credentials. Ignoring.");
-                        continue;
-                }
+                /* Drain the socket in batches, so that services
+                 * sending frequent WATCHDOG=1 or STATUS= updates
+                 * don't cost us one syscall per datagram. */
+                k = recvmmsg(m->notify_fd, msgs, NOTIFY_BATCH_MAX, MSG_DONTWAIT|MSG_CMSG_CLOEXEC, NULL);
+                if (k < 0) {
+                        if (errno == EAGAIN || errno == EINTR)
+                                break;
 
-                if ((size_t) n >= sizeof(buf)) {
-                        log_warning("Received notify message exceeded maximum size. Ignoring.");
-                        continue;
+                        return -errno;
                 }
 
-                buf[n] = 0;
+                /* Messages we failed to parse are left with a zero PID and skipped below */
+                for (i = 0; i < (unsigned) k; i++)
+                        (void) notify_message_parse(messages + i, &msgs[i].msg_hdr, iovec[i].iov_base, msgs[i].msg_len);
 
-                /* Notify every unit that might be interested, but try
-                 * to avoid notifying the same one multiple times. */
-                u1 = manager_get_unit_by_pid_cgroup(m, ucred->pid);
-                if (u1) {
-                        manager_invoke_notify_message(m, u1, ucred->pid, buf, n, fds);
-                        found = true;
-                }
+                for (i = 0; i < (unsigned) k; i++) {
+                        if (messages[i].pid <= 0)
+                                continue;
 
-                u2 = hashmap_get(m->watch_pids1, PID_TO_PTR(ucred->pid));
-                if (u2 && u2 != u1) {
-                        manager_invoke_notify_message(m, u2, ucred->pid, buf, n, fds);
-                        found = true;
-                }
+                        for (j = i + 1; j < (unsigned) k; j++)
+                                if (messages[j].pid > 0 &&
+                                    notify_message_superseded(messages + i, messages + j))
+                                        break;
+                        if (j < (unsigned) k)
+                                continue;
 
-                u3 = hashmap_get(m->watch_pids2, PID_TO_PTR(ucred->pid));
-                if (u3 && u3 != u2 && u3 != u1) {
-                        manager_invoke_notify_message(m, u3, ucred->pid, buf, n, fds);
-                        found = true;
+                        manager_dispatch_notify_message(m, messages + i, &pid_cache);
                 }
 
-                if (!found)
-                        log_warning("Cannot find unit for notify message of PID "PID_FMT".", ucred->pid);
+                for (i = 0; i < (unsigned) k; i++)
+                        notify_message_done(messages + i);
 
-                if (fdset_size(fds) > 0)
-                        log_warning("Got auxiliary fds with notification message, closing all.");
+                if ((unsigned) k < NOTIFY_BATCH_MAX)
+                        break;
         }
 
         return 0;
@@ -1815,6 +2222,7 @@ static int manager_dispatch_signal_fd(sd_event_source *source, int fd, uint32_t
 
                         manager_dump_units(m, f, "\t");
                         manager_dump_jobs(m, f, "\t");
+                        manager_dump_memory(m, f, "\t");
 
                         r = fflush_and_check(f);
                         if (r < 0) {
@@ -1991,8 +2399,7 @@ int manager_loop(Manager *m) {
         m->exit_code = MANAGER_OK;
 
         /* Release the path cache */
-        set_free_free(m->unit_path_cache);
-        m->unit_path_cache = NULL;
+        manager_free_unit_path_cache(m);
 
         manager_check_finished(m);
 
@@ -2002,6 +2409,10 @@ int manager_loop(Manager *m) {
         if (r < 0)
                 return r;
 
+        /* Send log messages to the journal in batches, whenever we
+         * are about to wait for events or the batch is full */
+        log_set_buffered(true);
+
         while (m->exit_code == MANAGER_OK) {
                 usec_t wait_usec;
 
@@ -2027,6 +2438,9 @@ int manager_loop(Manager *m) {
                 if (manager_dispatch_cgroup_queue(m) > 0)
                         continue;
 
+                if (manager_dispatch_cgroup_empty_queue(m) > 0)
+                        continue;
+
                 if (manager_dispatch_dbus_queue(m) > 0)
                         continue;
 
@@ -2038,11 +2452,36 @@ int manager_loop(Manager *m) {
                 } else
                         wait_usec = USEC_INFINITY;
 
+                /* Wake up again for the batched GC sweep */
+                if (m->gc_queue) {
+                        usec_t n, until;
+
+                        n = now(CLOCK_MONOTONIC);
+                        until = m->gc_queue_timestamp + GC_QUEUE_USEC_MAX;
+                        wait_usec = MIN(wait_usec, until > n ? until - n : 1);
+                }
+
+                /* Wake up again when the rate limit on unit change
+                 * signals lets us flush the rest of the queue */
+                if (m->dbus_unit_queue && m->dbus_signal_ratelimit.begin > 0) {
+                        usec_t n, until;
+
+                        n = now(CLOCK_MONOTONIC);
+                        until = m->dbus_signal_ratelimit.begin + m->dbus_signal_ratelimit.interval + 1;
+                        wait_usec = MIN(wait_usec, until > n ? until - n : 1);
+                }
+
+                log_flush();
+
                 r = sd_event_run(m->event, wait_usec);
-                if (r < 0)
+                if (r < 0) {
+                        log_set_buffered(false);
                         return log_error_errno(r, "Failed to run event loop: %m");
+                }
         }
 
+        log_set_buffered(false);
+
         return m->exit_code;
 }
 
@@ -2210,7 +2649,38 @@ int manager_open_serialization(Manager *m, FILE **_f) {
         return 0;
 }
 
-int manager_serialize(Manager *m, FILE *f, FDSet *fds, bool switching_root) {
+static int unit_serialize_framed(Unit *u, FILE *f, FDSet *fds, bool serialize_jobs) {
+        _cleanup_fclose_ FILE *mf = NULL;
+        _cleanup_free_ char *buf = NULL;
+        size_t size = 0;
+        int r;
+
+        assert(u);
+        assert(f);
+
+        /* Writes the unit's items prefixed by their total size, so
+         * that the reader can skip or resynchronize after a unit it
+         * fails to deserialize */
+
+        mf = open_memstream(&buf, &size);
+        if (!mf)
+                return -ENOMEM;
+
+        r = unit_serialize(u, mf, fds, serialize_jobs);
+        if (r < 0)
+                return r;
+
+        r = fflush_and_check(mf);
+        if (r < 0)
+                return r;
+
+        fprintf(f, "%s\n%zu\n", u->id, size);
+        fwrite(buf, 1, size, f);
+
+        return 0;
+}
+
+int manager_serialize(Manager *m, FILE *f, FDSet *fds, bool switching_root, bool framed) {
         Iterator i;
         Unit *u;
         const char *t;
@@ -2223,6 +2693,11 @@ int manager_serialize(Manager *m, FILE *f, FDSet *fds, bool switching_root) {
 
         m->n_reloading ++;
 
+        /* The framed format is only understood by ourselves, hence
+         * only use it if we are going to read it back ourselves */
+        if (framed)
+                fprintf(f, "serialization-format=%u\n", SERIALIZATION_FORMAT_FRAMED);
+
         fprintf(f, "current-job-id=%"PRIu32"\n", m->current_job_id);
         fprintf(f, "taint-usr=%s\n", yes_no(m->taint_usr));
         fprintf(f, "n-installed-jobs=%u\n", m->n_installed_jobs);
@@ -2285,11 +2760,15 @@ int manager_serialize(Manager *m, FILE *f, FDSet *fds, bool switching_root) {
                 if (u->id != t)
                         continue;
 
-                /* Start marker */
-                fputs(u->id, f);
-                fputc('\n', f);
+                if (framed)
+                        r = unit_serialize_framed(u, f, fds, !switching_root);
+                else {
+                        /* Start marker */
+                        fputs(u->id, f);
+                        fputc('\n', f);
 
-                r = unit_serialize(u, f, fds, !switching_root);
+                        r = unit_serialize(u, f, fds, !switching_root);
+                }
                 if (r < 0) {
                         m->n_reloading --;
                         return r;
@@ -2309,7 +2788,59 @@ int manager_serialize(Manager *m, FILE *f, FDSet *fds, bool switching_root) {
         return 0;
 }
 
+static int manager_deserialize_units_framed(Manager *m, FILE *f, FDSet *fds) {
+        int r;
+
+        assert(m);
+        assert(f);
+
+        for (;;) {
+                char name[UNIT_NAME_MAX+2], size_str[DECIMAL_STR_MAX(uint64_t)+2];
+                uint64_t size;
+                off_t start;
+                Unit *u;
+
+                /* Start marker, followed by the size of the unit's items */
+                if (!fgets(name, sizeof(name), f) ||
+                    !fgets(size_str, sizeof(size_str), f)) {
+                        if (feof(f))
+                                return 0;
+
+                        return -errno;
+                }
+
+                char_array_0(name);
+                char_array_0(size_str);
+
+                r = safe_atou64(strstrip(size_str), &size);
+                if (r < 0)
+                        return log_debug_errno(r, "Failed to parse serialization size of %s: %m", strstrip(name));
+
+                start = ftello(f);
+                if (start < 0)
+                        return -errno;
+
+                r = manager_load_unit(m, strstrip(name), NULL, NULL, &u);
+                if (r < 0)
+                        log_debug_errno(r, "Failed to load serialized unit %s, skipping: %m", name);
+                else {
+                        r = unit_deserialize(u, f, fds);
+                        if (r < 0)
+                                return r;
+
+                        if (ftello(f) == start + (off_t) size)
+                                continue;
+
+                        log_unit_debug(u, "Deserialization did not consume the unit's state, resynchronizing.");
+                }
+
+                if (fseeko(f, start + (off_t) size, SEEK_SET) < 0)
+                        return -errno;
+        }
+}
+
 int manager_deserialize(Manager *m, FILE *f, FDSet *fds) {
+        unsigned format = SERIALIZATION_FORMAT_TEXT;
         int r = 0;
 
         assert(m);
@@ -2337,7 +2868,16 @@ int manager_deserialize(Manager *m, FILE *f, FDSet *fds) {
                 if (l[0] == 0)
                         break;
 
-                if (startswith(l, "current-job-id=")) {
+                if (startswith(l, "serialization-format=")) {
+
+                        if (safe_atou(l+21, &format) < 0 ||
+                            !IN_SET(format, SERIALIZATION_FORMAT_TEXT, SERIALIZATION_FORMAT_FRAMED)) {
+                                log_error("Unsupported serialization format %s.", l+21);
+                                r = -EINVAL;
+                                goto finish;
+                        }
+
+                } else if (startswith(l, "current-job-id=")) {
                         uint32_t id;
 
                         if (safe_atou32(l+15, &id) < 0)
@@ -2455,6 +2995,11 @@ int manager_deserialize(Manager *m, FILE *f, FDSet *fds) {
                 }
         }
 
+        if (format == SERIALIZATION_FORMAT_FRAMED) {
+                r = manager_deserialize_units_framed(m, f, fds);
+                goto finish;
+        }
+
         for (;;) {
                 Unit *u;
                 char name[UNIT_NAME_MAX+2];
@@ -2491,7 +3036,10 @@ finish:
 }
 
 int manager_reload(Manager *m) {
+        char timespan[FORMAT_TIMESPAN_MAX];
         int r, q;
+        size_t n;
+        usec_t ts;
         _cleanup_fclose_ FILE *f = NULL;
         _cleanup_fdset_free_ FDSet *fds = NULL;
 
@@ -2510,12 +3058,16 @@ int manager_reload(Manager *m) {
                 return -ENOMEM;
         }
 
-        r = manager_serialize(m, f, fds, false);
+        ts = now(CLOCK_MONOTONIC);
+
+        r = manager_serialize(m, f, fds, false, true);
         if (r < 0) {
                 m->n_reloading --;
                 return r;
         }
 
+        log_debug("Serialized state in %s.", format_timespan(timespan, sizeof(timespan), now(CLOCK_MONOTONIC) - ts, USEC_PER_MSEC/10));
+
         if (fseeko(f, 0, SEEK_SET) < 0) {
                 m->n_reloading --;
                 return -errno;
@@ -2548,9 +3100,11 @@ int manager_reload(Manager *m) {
                 r = q;
 
         /* Second, deserialize our stored data */
+        ts = now(CLOCK_MONOTONIC);
         q = manager_deserialize(m, f, fds);
         if (q < 0 && r >= 0)
                 r = q;
+        log_debug("Deserialized state in %s.", format_timespan(timespan, sizeof(timespan), now(CLOCK_MONOTONIC) - ts, USEC_PER_MSEC/10));
 
         fclose(f);
         f = NULL;
@@ -2563,14 +3117,50 @@ int manager_reload(Manager *m) {
         /* Third, fire things up! */
         manager_coldplug(m);
 
+        (void) manager_setup_accounting_sample(m);
+
         assert(m->n_reloading > 0);
         m->n_reloading--;
 
         m->send_reloading_done = true;
 
+        /* All units were freed and loaded again, which may have left
+         * pooled hashmap memory unused */
+        n = hashmap_trim_pools();
+        if (n > 0)
+                log_debug("Released %zu bytes of unused hashmap pool memory.", n);
+
         return r;
 }
 
+bool manager_unit_files_changed(Manager *m) {
+        Iterator i;
+        const char *k;
+        Unit *u;
+
+        assert(m);
+
+        /* Checks whether a reload would pick up anything new from
+         * unit files or drop-ins. This does not consider generators
+         * and their inputs, or the manager configuration. */
+
+        if (manager_unit_path_stamp(m) != m->unit_path_stamp)
+                return true;
+
+        HASHMAP_FOREACH_KEY(u, k, m->units, i) {
+                if (u->id != k)
+                        continue;
+
+                if (u->load_state == UNIT_STUB)
+                        continue;
+
+                if (unit_need_daemon_reload(u))
+                        return true;
+        }
+
+        return false;
+}
+
 bool manager_is_reloading_or_reexecuting(Manager *m) {
         assert(m);
 
@@ -2786,14 +3376,69 @@ static void trim_generator_dir(Manager *m, char **generator) {
         return;
 }
 
+static void manager_free_generator_timings(Manager *m) {
+        unsigned i;
+
+        assert(m);
+
+        for (i = 0; i < m->n_generator_timings; i++)
+                free(m->generator_timings[i].name);
+
+        m->generator_timings = mfree(m->generator_timings);
+        m->n_generator_timings = 0;
+}
+
+static int manager_read_generator_timings(Manager *m, int fd) {
+        _cleanup_fclose_ FILE *f = NULL;
+        size_t n_allocated = 0;
+        char line[LINE_MAX];
+
+        assert(m);
+        assert(fd >= 0);
+
+        f = fdopen(fd, "re");
+        if (!f) {
+                safe_close(fd);
+                return -errno;
+        }
+
+        FOREACH_LINE(line, f, return -errno) {
+                _cleanup_free_ char *name = NULL;
+                const char *p = line;
+                uint64_t t;
+                int r;
+
+                r = extract_first_word(&p, &name, NULL, 0);
+                if (r <= 0)
+                        continue;
+
+                if (safe_atou64(strstrip((char*) p), &t) < 0)
+                        continue;
+
+                if (!GREEDY_REALLOC(m->generator_timings, n_allocated, m->n_generator_timings + 1))
+                        return -ENOMEM;
+
+                m->generator_timings[m->n_generator_timings++] = (GeneratorTiming) {
+                        .name = name,
+                        .duration = t,
+                };
+                name = NULL;
+        }
+
+        return 0;
+}
+
 static int manager_run_generators(Manager *m) {
         _cleanup_strv_free_ char **paths = NULL;
+        _cleanup_close_pair_ int timing[2] = { -1, -1 };
         const char *argv[5];
         char **path;
         int r;
 
         assert(m);
 
+        manager_free_generator_timings(m);
+
         if (m->test_run)
                 return 0;
 
@@ -2831,8 +3476,25 @@ static int manager_run_generators(Manager *m) {
         argv[3] = m->generator_unit_path_late;
         argv[4] = NULL;
 
+        /* The generators' timings are collected through a pipe,
+         * which is non-blocking so that the executor can never hang
+         * on it, we'd rather lose some of the timings. */
+        if (pipe2(timing, O_CLOEXEC|O_NONBLOCK) < 0)
+                log_warning_errno(errno, "Failed to allocate generator timing pipe, ignoring: %m");
+
         RUN_WITH_UMASK(0022)
-                execute_directories((const char* const*) paths, DEFAULT_TIMEOUT_USEC, (char**) argv);
+                execute_directories((const char* const*) paths, DEFAULT_TIMEOUT_USEC, (char**) argv, timing[1]);
+
+        if (timing[0] >= 0) {
+                int q;
+
+                timing[1] = safe_close(timing[1]);
+
+                q = manager_read_generator_timings(m, timing[0]);
+                timing[0] = -1;
+                if (q < 0)
+                        log_warning_errno(q, "Failed to read generator timings, ignoring: %m");
+        }
 
 finish:
         trim_generator_dir(m, &m->generator_unit_path);
@@ -3049,6 +3711,63 @@ Set *manager_get_units_requiring_mounts_for(Manager *m, const char *path) {
         return hashmap_get(m->units_requiring_mounts_for, streq(p, "/") ? "" : p);
 }
 
+int manager_intern_string(Manager *m, const char *s, char **ret) {
+        char *k;
+        void *v;
+        int r;
+
+        assert(m);
+        assert(s);
+        assert(ret);
+
+        v = hashmap_get2(m->interned_strings, s, (void**) &k);
+        if (v) {
+                assert_se(hashmap_update(m->interned_strings, k, UINT_TO_PTR(PTR_TO_UINT(v) + 1)) >= 0);
+                *ret = k;
+                return 0;
+        }
+
+        r = hashmap_ensure_allocated(&m->interned_strings, &string_hash_ops);
+        if (r < 0)
+                return r;
+
+        k = strdup(s);
+        if (!k)
+                return -ENOMEM;
+
+        r = hashmap_put(m->interned_strings, k, UINT_TO_PTR(1));
+        if (r < 0) {
+                free(k);
+                return r;
+        }
+
+        *ret = k;
+        return 1;
+}
+
+char *manager_release_string(Manager *m, char *s) {
+        unsigned n;
+        char *k;
+
+        assert(m);
+
+        if (!s)
+                return NULL;
+
+        n = PTR_TO_UINT(hashmap_get2(m->interned_strings, s, (void**) &k));
+        assert(n > 0);
+        assert(k == s);
+
+        if (n > 1)
+                assert_se(hashmap_update(m->interned_strings, k, UINT_TO_PTR(n - 1)) >= 0);
+        else {
+                hashmap_remove(m->interned_strings, k);
+                free(k);
+        }
+
+        return NULL;
+}
+
 const char *manager_get_runtime_prefix(Manager *m) {
         assert(m);
 
@@ -68,6 +68,11 @@ typedef enum StatusType {
         STATUS_TYPE_EMERGENCY,
 } StatusType;
 
+typedef struct GeneratorTiming {
+        char *name;
+        usec_t duration;
+} GeneratorTiming;
+
 #include "job.h"
 #include "path-lookup.h"
 #include "execute.h"
@@ -109,6 +114,9 @@ struct Manager {
         /* Units that should be realized */
         LIST_HEAD(Unit, cgroup_queue);
 
+        /* Units whose cgroup might have run empty */
+        LIST_HEAD(Unit, cgroup_empty_queue);
+
         sd_event *event;
 
         /* We use two hash tables here, since the same PID might be
@@ -131,6 +139,7 @@ struct Manager {
         char *notify_socket;
         int notify_fd;
         sd_event_source *notify_event_source;
+        char *notify_buffer;
 
         int signal_fd;
         sd_event_source *signal_event_source;
@@ -144,6 +153,8 @@ struct Manager {
 
         LookupPaths lookup_paths;
         Set *unit_path_cache;
+        Hashmap *unit_path_index;
+        uint64_t unit_path_stamp;
 
         char **environment;
 
@@ -168,6 +179,10 @@ struct Manager {
         char *generator_unit_path_early;
         char *generator_unit_path_late;
 
+        /* How long each generator took during the last run */
+        GeneratorTiming *generator_timings;
+        unsigned n_generator_timings;
+
         struct udev* udev;
 
         /* Data specific to the device subsystem */
@@ -181,6 +196,11 @@ struct Manager {
         int utab_inotify_fd;
         sd_event_source *mount_utab_event_source;
 
+        /* The mount table as we processed it last, see mount.c */
+        Hashmap *mountinfo_cache;
+        usec_t mount_last_rescan;
+        sd_event_source *mount_rescan_event_source;
+
         /* Data specific to the swap filesystem */
         FILE *proc_swaps;
         sd_event_source *swap_event_source;
@@ -224,12 +244,23 @@ struct Manager {
         sd_event_source *cgroup_inotify_event_source;
         Hashmap *cgroup_inotify_wd_unit;
 
+        /* On the legacy hierarchy the release agent reports empty
+         * cgroups to us via this datagram socket */
+        int cgroups_agent_fd;
+        sd_event_source *cgroups_agent_event_source;
+
+        /* Periodic sampling of the unit accounting data */
+        usec_t accounting_sample_usec;
+        usec_t accounting_sample_timestamp;
+        sd_event_source *accounting_sample_event_source;
+
         /* Make sure the user cannot accidentally unmount our cgroup
          * file system */
         int pin_cgroupfs_fd;
 
         int gc_marker;
         unsigned n_in_gc_queue;
+        usec_t gc_queue_timestamp;
 
         /* Flags */
         ManagerRunningAs running_as;
@@ -264,6 +295,7 @@ struct Manager {
         bool default_tasks_accounting;
 
         usec_t default_timer_accuracy_usec;
+        usec_t default_timer_accuracy_on_battery_usec;
 
         struct rlimit *rlimit[_RLIMIT_MAX];
 
@@ -273,11 +305,24 @@ struct Manager {
         unsigned n_installed_jobs;
         unsigned n_failed_jobs;
 
+        /* How often timer units elapsed, and in how many wakeups of
+         * the event loop that happened */
+        unsigned n_timer_elapses;
+        unsigned n_timer_wakeups;
+        usec_t timer_last_wakeup;
+
         /* Jobs in progress watching */
         unsigned n_running_jobs;
         unsigned n_on_console;
         unsigned jobs_in_progress_iteration;
 
+        /* All path unit and PID file watches share one inotify
+         * object, events are routed by watch descriptor. */
+        int path_inotify_fd;
+        sd_event_source *path_inotify_event_source;
+        Hashmap *path_inotify_wd_specs; /* wd => Set of PathSpec objects */
+        Set *path_inotify_pending;
+
         /* Do we have any outstanding password prompts? */
         int have_ask_password;
         int ask_password_inotify_fd;
@@ -295,6 +340,12 @@ struct Manager {
          * value where Unit objects are contained. */
         Hashmap *units_requiring_mounts_for;
 
+        /* Strings many units refer to, like the fragment path of a
+         * template shared by all its instances, or the source path
+         * of generated units. Maps the string to its reference
+         * count. */
+        Hashmap *interned_strings;
+
         /* Reference to the kdbus bus control fd */
         int kdbus_fd;
 
@@ -304,6 +355,10 @@ struct Manager {
         /* When the user hits C-A-D more than 7 times per 2s, reboot immediately... */
         RateLimit ctrl_alt_del_ratelimit;
 
+        /* Limits how many unit change signals we send, units over
+         * the limit stay in the D-Bus queue and are merged there */
+        RateLimit dbus_signal_ratelimit;
+
         const char *unit_log_field;
         const char *unit_log_format_string;
 
@@ -336,6 +391,7 @@ int manager_add_job_by_name(Manager *m, JobType type, const char *name, JobMode
 
 void manager_dump_units(Manager *s, FILE *f, const char *prefix);
 void manager_dump_jobs(Manager *s, FILE *f, const char *prefix);
+void manager_dump_memory(Manager *s, FILE *f, const char *prefix);
 
 void manager_clear_jobs(Manager *m);
 
@@ -348,10 +404,19 @@ int manager_loop(Manager *m);
 
 int manager_open_serialization(Manager *m, FILE **_f);
 
-int manager_serialize(Manager *m, FILE *f, FDSet *fds, bool switching_root);
+/* Versions of the serialization written by manager_serialize(). The
+ * framed format prefixes each unit's items with their size; it is only
+ * used when the same binary reads the state back, i.e. on reload. */
+enum {
+        SERIALIZATION_FORMAT_TEXT = 1,
+        SERIALIZATION_FORMAT_FRAMED = 2,
+};
+
+int manager_serialize(Manager *m, FILE *f, FDSet *fds, bool switching_root, bool framed);
 int manager_deserialize(Manager *m, FILE *f, FDSet *fds);
 
 int manager_reload(Manager *m);
+bool manager_unit_files_changed(Manager *m);
 
 bool manager_is_reloading_or_reexecuting(Manager *m) _pure_;
 
@@ -374,6 +439,9 @@ void manager_flip_auto_status(Manager *m, bool enable);
 
 Set *manager_get_units_requiring_mounts_for(Manager *m, const char *path);
 
+int manager_intern_string(Manager *m, const char *s, char **ret);
+char *manager_release_string(Manager *m, char *s);
+
 const char *manager_get_runtime_prefix(Manager *m);
 
 ManagerState manager_state(Manager *m);
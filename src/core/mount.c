@@ -44,6 +44,9 @@
 
 #define RETRY_UMOUNT_MAX 32
 
+/* Minimum time between two rescans of the mount table */
+#define MOUNT_RESCAN_INTERVAL_USEC (100 * USEC_PER_MSEC)
+
 DEFINE_TRIVIAL_CLEANUP_FUNC(struct libmnt_table*, mnt_free_table);
 DEFINE_TRIVIAL_CLEANUP_FUNC(struct libmnt_iter*, mnt_free_iter);
 
@@ -65,6 +68,7 @@ static const UnitActiveState state_translation_table[_MOUNT_STATE_MAX] = {
 
 static int mount_dispatch_timer(sd_event_source *source, usec_t usec, void *userdata);
 static int mount_dispatch_io(sd_event_source *source, int fd, uint32_t revents, void *userdata);
+static void mount_flush_rescan(Manager *m);
 
 static bool mount_needs_network(const char *options, const char *fstype) {
         if (fstab_test_option(options, "_netdev\0"))
@@ -565,7 +569,7 @@ static int mount_notify_automount(Mount *m, MountState old_state, MountState sta
 
         assert(m);
 
-        SET_FOREACH(p, UNIT(m)->dependencies[UNIT_TRIGGERED_BY], i)
+        UNIT_FOREACH_DEPENDENCY(p, UNIT(m), UNIT_TRIGGERED_BY, i)
                 if (p->type == UNIT_AUTOMOUNT) {
                          r = automount_update_mount(AUTOMOUNT(p), old_state, state);
                          if (r < 0)
@@ -1127,6 +1131,8 @@ static void mount_sigchld_event(Unit *u, pid_t pid, int code, int status) {
         if (pid != m->control_pid)
                 return;
 
+        mount_flush_rescan(u->manager);
+
         m->control_pid = 0;
 
         if (is_clean_exit(code, status, NULL))
@@ -1320,7 +1326,8 @@ static int mount_setup_unit(
                 const char *where,
                 const char *options,
                 const char *fstype,
-                bool set_flags) {
+                bool set_flags,
+                Unit **ret) {
 
         _cleanup_free_ char *e = NULL, *w = NULL, *o = NULL, *f = NULL;
         bool load_extras = false;
@@ -1334,6 +1341,9 @@ static int mount_setup_unit(
         assert(where);
         assert(options);
         assert(fstype);
+        assert(ret);
+
+        *ret = NULL;
 
         /* Ignore API mount points. They should never be referenced in
          * dependencies ever. */
@@ -1369,11 +1379,9 @@ static int mount_setup_unit(
                         goto fail;
                 }
 
-                u->source_path = strdup("/proc/self/mountinfo");
-                if (!u->source_path) {
-                        r = -ENOMEM;
+                r = manager_intern_string(m, "/proc/self/mountinfo", &u->source_path);
+                if (r < 0)
                         goto fail;
-                }
 
                 if (m->running_as == MANAGER_SYSTEM) {
                         const char* target;
@@ -1467,6 +1475,7 @@ static int mount_setup_unit(
         if (changed)
                 unit_add_to_dbus_queue(u);
 
+        *ret = u;
         return 0;
 
 fail:
@@ -1478,9 +1487,109 @@ fail:
         return r;
 }
 
+/* We keep the raw fields of each entry of the mount table as we
+ * processed it last time, keyed by mount point, together with the
+ * mount unit it resulted in, if any. The kernel escapes whitespace in
+ * all of these, hence we simply join them with spaces. */
+static char *mountinfo_cache_entry(const char *device, const char *options, const char *fstype, Unit *u) {
+        return strjoin(device, " ", options, " ", fstype, " ", u ? u->id : "", NULL);
+}
+
+static const char *mountinfo_cache_match(const char *entry, const char *device, const char *options, const char *fstype) {
+        const char *fields[] = { device, options, fstype };
+        unsigned k;
+
+        /* Returns the unit name recorded for the entry, if it
+         * matches the specified fields */
+
+        for (k = 0; k < ELEMENTSOF(fields); k++) {
+                entry = startswith(entry, fields[k]);
+                if (!entry || *entry != ' ')
+                        return NULL;
+
+                entry++;
+        }
+
+        return entry;
+}
+
+static int mountinfo_cache_put(Hashmap *cache, const char *path, char *entry) {
+        _cleanup_free_ char *p = NULL;
+        char *old;
+        int r;
+
+        /* Takes possession of entry, also on failure */
+
+        old = hashmap_get(cache, path);
+        if (old) {
+                r = hashmap_update(cache, path, entry);
+                if (r < 0) {
+                        free(entry);
+                        return r;
+                }
+
+                free(old);
+                return 0;
+        }
+
+        p = strdup(path);
+        if (!p) {
+                free(entry);
+                return -ENOMEM;
+        }
+
+        r = hashmap_put(cache, p, entry);
+        if (r < 0) {
+                free(entry);
+                return r;
+        }
+
+        p = NULL;
+        return 0;
+}
+
+static bool mountinfo_cache_reuse(Manager *m, Hashmap *cache, const char *device, const char *path, const char *options, const char *fstype) {
+        const char *id;
+        char *entry, *key;
+        Unit *u = NULL;
+
+        /* If an entry is unchanged since the last time, and its unit
+         * still knows about it, there's nothing to do but to mark it
+         * as still mounted. An entry showing up twice in the table is
+         * always processed fully, so that the last one wins. */
+
+        if (hashmap_contains(cache, path))
+                return false;
+
+        entry = hashmap_get2(m->mountinfo_cache, path, (void**) &key);
+        if (!entry)
+                return false;
+
+        id = mountinfo_cache_match(entry, device, options, fstype);
+        if (!id)
+                return false;
+
+        if (!isempty(id)) {
+                u = manager_get_unit(m, id);
+                if (!u || !MOUNT(u)->from_proc_self_mountinfo)
+                        return false;
+        }
+
+        if (hashmap_put(cache, key, entry) < 0)
+                return false;
+
+        hashmap_remove(m->mountinfo_cache, path);
+
+        if (u)
+                MOUNT(u)->is_mounted = true;
+
+        return true;
+}
+
 static int mount_load_proc_self_mountinfo(Manager *m, bool set_flags) {
         _cleanup_(mnt_free_tablep) struct libmnt_table *t = NULL;
         _cleanup_(mnt_free_iterp) struct libmnt_iter *i = NULL;
+        _cleanup_hashmap_free_free_free_ Hashmap *cache = NULL;
         int r = 0;
 
         assert(m);
@@ -1493,6 +1602,10 @@ static int mount_load_proc_self_mountinfo(Manager *m, bool set_flags) {
         if (!i)
                 return log_oom();
 
+        cache = hashmap_new(&string_hash_ops);
+        if (!cache)
+                return log_oom();
+
         r = mnt_table_parse_mtab(t, NULL);
         if (r < 0)
                 return log_error_errno(r, "Failed to parse /proc/self/mountinfo: %m");
@@ -1502,6 +1615,7 @@ static int mount_load_proc_self_mountinfo(Manager *m, bool set_flags) {
                 const char *device, *path, *options, *fstype;
                 _cleanup_free_ char *d = NULL, *p = NULL;
                 struct libmnt_fs *fs;
+                Unit *u;
                 int k;
 
                 k = mnt_table_next_fs(t, i, &fs);
@@ -1518,6 +1632,10 @@ static int mount_load_proc_self_mountinfo(Manager *m, bool set_flags) {
                 if (!device || !path)
                         continue;
 
+                if (set_flags &&
+                    mountinfo_cache_reuse(m, cache, device, path, strempty(options), strempty(fstype)))
+                        continue;
+
                 if (cunescape(device, UNESCAPE_RELAX, &d) < 0)
                         return log_oom();
 
@@ -1526,11 +1644,23 @@ static int mount_load_proc_self_mountinfo(Manager *m, bool set_flags) {
 
                 (void) device_found_node(m, d, true, DEVICE_FOUND_MOUNT, set_flags);
 
-                k = mount_setup_unit(m, d, p, options, fstype, set_flags);
-                if (r == 0 && k < 0)
-                        r = k;
+                k = mount_setup_unit(m, d, p, options, fstype, set_flags, &u);
+                if (k < 0) {
+                        if (r == 0)
+                                r = k;
+
+                        continue;
+                }
+
+                k = mountinfo_cache_put(cache, path, mountinfo_cache_entry(device, strempty(options), strempty(fstype), u));
+                if (k < 0)
+                        return log_oom();
         }
 
+        hashmap_free_free_free(m->mountinfo_cache);
+        m->mountinfo_cache = cache;
+        cache = NULL;
+
         return r;
 }
 
@@ -1539,6 +1669,9 @@ static void mount_shutdown(Manager *m) {
 
         m->mount_event_source = sd_event_source_unref(m->mount_event_source);
         m->mount_utab_event_source = sd_event_source_unref(m->mount_utab_event_source);
+        m->mount_rescan_event_source = sd_event_source_unref(m->mount_rescan_event_source);
+
+        m->mountinfo_cache = hashmap_free_free_free(m->mountinfo_cache);
 
         m->proc_self_mountinfo = safe_fclose(m->proc_self_mountinfo);
         m->utab_inotify_fd = safe_close(m->utab_inotify_fd);
@@ -1620,57 +1753,19 @@ fail:
         return r;
 }
 
-static int mount_dispatch_io(sd_event_source *source, int fd, uint32_t revents, void *userdata) {
+static int mount_rescan(Manager *m) {
         _cleanup_set_free_ Set *around = NULL, *gone = NULL;
-        Manager *m = userdata;
         const char *what;
         Iterator i;
         Unit *u;
         int r;
 
         assert(m);
-        assert(revents & (EPOLLPRI | EPOLLIN));
 
-        /* The manager calls this for every fd event happening on the
-         * /proc/self/mountinfo file, which informs us about mounting
-         * table changes, and for /run/mount events which we watch
-         * for mount options. */
-
-        if (fd == m->utab_inotify_fd) {
-                bool rescan = false;
+        m->mount_last_rescan = now(CLOCK_MONOTONIC);
 
-                /* FIXME: We *really* need to replace this with
-                 * libmount's own API for this, we should not hardcode
-                 * internal behaviour of libmount here. */
-
-                for (;;) {
-                        union inotify_event_buffer buffer;
-                        struct inotify_event *e;
-                        ssize_t l;
-
-                        l = read(fd, &buffer, sizeof(buffer));
-                        if (l < 0) {
-                                if (errno == EAGAIN || errno == EINTR)
-                                        break;
-
-                                log_error_errno(errno, "Failed to read utab inotify: %m");
-                                break;
-                        }
-
-                        FOREACH_INOTIFY_EVENT(e, buffer, l) {
-                                /* Only care about changes to utab,
-                                 * but we have to monitor the
-                                 * directory to reliably get
-                                 * notifications about when utab is
-                                 * replaced using rename(2) */
-                                if ((e->mask & IN_Q_OVERFLOW) || streq(e->name, "utab"))
-                                        rescan = true;
-                        }
-                }
-
-                if (!rescan)
-                        return 0;
-        }
+        if (m->mount_rescan_event_source)
+                (void) sd_event_source_set_enabled(m->mount_rescan_event_source, SD_EVENT_OFF);
 
         r = mount_load_proc_self_mountinfo(m, true);
         if (r < 0) {
@@ -1748,19 +1843,27 @@ static int mount_dispatch_io(sd_event_source *source, int fd, uint32_t revents,
                         }
                 }
 
-                if (mount->is_mounted &&
-                    mount->from_proc_self_mountinfo &&
-                    mount->parameters_proc_self_mountinfo.what) {
-
-                        if (set_ensure_allocated(&around, &string_hash_ops) < 0 ||
-                            set_put(around, mount->parameters_proc_self_mountinfo.what) < 0)
-                                log_oom();
-                }
-
                 /* Reset the flags for later calls */
                 mount->is_mounted = mount->just_mounted = mount->just_changed = false;
         }
 
+        if (set_isempty(gone))
+                return 0;
+
+        /* Only the mount points still around know about their
+         * device now */
+        LIST_FOREACH(units_by_type, u, m->units_by_type[UNIT_MOUNT]) {
+                Mount *mount = MOUNT(u);
+
+                if (!mount->from_proc_self_mountinfo ||
+                    !mount->parameters_proc_self_mountinfo.what)
+                        continue;
+
+                if (set_ensure_allocated(&around, &string_hash_ops) < 0 ||
+                    set_put(around, mount->parameters_proc_self_mountinfo.what) < 0)
+                        log_oom();
+        }
+
         SET_FOREACH(what, gone, i) {
                 if (set_contains(around, what))
                         continue;
@@ -1772,6 +1875,130 @@ static int mount_dispatch_io(sd_event_source *source, int fd, uint32_t revents,
         return 0;
 }
 
+static int mount_dispatch_rescan(sd_event_source *source, usec_t usec, void *userdata) {
+        Manager *m = userdata;
+
+        assert(m);
+
+        return mount_rescan(m);
+}
+
+static int mount_schedule_rescan(Manager *m, usec_t when) {
+        int r;
+
+        assert(m);
+
+        if (m->mount_rescan_event_source) {
+                int enabled;
+
+                r = sd_event_source_get_enabled(m->mount_rescan_event_source, &enabled);
+                if (r < 0)
+                        return r;
+                if (enabled != SD_EVENT_OFF)
+                        return 0;
+
+                r = sd_event_source_set_time(m->mount_rescan_event_source, when);
+                if (r < 0)
+                        return r;
+
+                return sd_event_source_set_enabled(m->mount_rescan_event_source, SD_EVENT_ONESHOT);
+        }
+
+        r = sd_event_add_time(m->event, &m->mount_rescan_event_source, CLOCK_MONOTONIC, when, 0, mount_dispatch_rescan, m);
+        if (r < 0)
+                return r;
+
+        r = sd_event_source_set_priority(m->mount_rescan_event_source, -10);
+        if (r < 0)
+                return r;
+
+        (void) sd_event_source_set_description(m->mount_rescan_event_source, "mount-rescan");
+
+        return 0;
+}
+
+static void mount_flush_rescan(Manager *m) {
+        int enabled;
+
+        assert(m);
+
+        /* Process a pending rescan right away, so that the exit of
+         * mount(8) is never seen before the changes it made. */
+
+        if (!m->mount_rescan_event_source)
+                return;
+
+        if (sd_event_source_get_enabled(m->mount_rescan_event_source, &enabled) < 0 ||
+            enabled == SD_EVENT_OFF)
+                return;
+
+        (void) mount_rescan(m);
+}
+
+static int mount_dispatch_io(sd_event_source *source, int fd, uint32_t revents, void *userdata) {
+        Manager *m = userdata;
+        usec_t n;
+        int r;
+
+        assert(m);
+        assert(revents & (EPOLLPRI | EPOLLIN));
+
+        /* The manager calls this for every fd event happening on the
+         * /proc/self/mountinfo file, which informs us about mounting
+         * table changes, and for /run/mount events which we watch
+         * for mount options. */
+
+        if (fd == m->utab_inotify_fd) {
+                bool rescan = false;
+
+                /* FIXME: We *really* need to replace this with
+                 * libmount's own API for this, we should not hardcode
+                 * internal behaviour of libmount here. */
+
+                for (;;) {
+                        union inotify_event_buffer buffer;
+                        struct inotify_event *e;
+                        ssize_t l;
+
+                        l = read(fd, &buffer, sizeof(buffer));
+                        if (l < 0) {
+                                if (errno == EAGAIN || errno == EINTR)
+                                        break;
+
+                                log_error_errno(errno, "Failed to read utab inotify: %m");
+                                break;
+                        }
+
+                        FOREACH_INOTIFY_EVENT(e, buffer, l) {
+                                /* Only care about changes to utab,
+                                 * but we have to monitor the
+                                 * directory to reliably get
+                                 * notifications about when utab is
+                                 * replaced using rename(2) */
+                                if ((e->mask & IN_Q_OVERFLOW) || streq(e->name, "utab"))
+                                        rescan = true;
+                        }
+                }
+
+                if (!rescan)
+                        return 0;
+        }
+
+        /* Coalesce bursts of changes, for example from container
+         * managers setting up many mounts at once, as each rescan
+         * has to go through the whole table */
+        n = now(CLOCK_MONOTONIC);
+        if (n < m->mount_last_rescan + MOUNT_RESCAN_INTERVAL_USEC) {
+                r = mount_schedule_rescan(m, m->mount_last_rescan + MOUNT_RESCAN_INTERVAL_USEC);
+                if (r >= 0)
+                        return 0;
+
+                log_warning_errno(r, "Failed to schedule rescan of the mount table, rescanning right away: %m");
+        }
+
+        return mount_rescan(m);
+}
+
 static void mount_reset_failed(Unit *u) {
         Mount *m = MOUNT(u);
 
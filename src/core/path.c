@@ -41,9 +41,126 @@ static const UnitActiveState state_translation_table[_PATH_STATE_MAX] = {
         [PATH_FAILED] = UNIT_FAILED
 };
 
-static int path_dispatch_io(sd_event_source *source, int fd, uint32_t revents, void *userdata);
+static int path_dispatch_inotify(PathSpec *s, bool changed);
 
-int path_spec_watch(PathSpec *s, sd_event_io_handler_t handler) {
+static int path_inotify_dispatch(sd_event_source *source, int fd, uint32_t revents, void *userdata);
+
+static int path_inotify_setup(Manager *m) {
+        int r;
+
+        assert(m);
+
+        if (m->path_inotify_fd >= 0)
+                return 0;
+
+        m->path_inotify_fd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+        if (m->path_inotify_fd < 0)
+                return -errno;
+
+        r = sd_event_add_io(m->event, &m->path_inotify_event_source, m->path_inotify_fd, EPOLLIN, path_inotify_dispatch, m);
+        if (r < 0) {
+                m->path_inotify_fd = safe_close(m->path_inotify_fd);
+                return r;
+        }
+
+        (void) sd_event_source_set_description(m->path_inotify_event_source, "path");
+
+        return 0;
+}
+
+static void path_inotify_release(Manager *m, PathSpec *s, int wd) {
+        Set *specs;
+
+        assert(m);
+        assert(s);
+
+        /* The watch descriptor might have been dropped by the kernel
+         * already, or even reused for another inode meanwhile, hence
+         * only remove the watch if we were actually its last user */
+
+        specs = hashmap_get(m->path_inotify_wd_specs, INT_TO_PTR(wd));
+        if (!specs)
+                return;
+
+        (void) set_remove(specs, s);
+        if (!set_isempty(specs))
+                return;
+
+        (void) hashmap_remove(m->path_inotify_wd_specs, INT_TO_PTR(wd));
+        set_free(specs);
+
+        (void) inotify_rm_watch(m->path_inotify_fd, wd);
+}
+
+static int path_spec_add_watch(PathSpec *s, const char *path, uint32_t mask) {
+        Manager *m;
+        Set *specs;
+        size_t i;
+        int wd, r;
+
+        assert(s);
+        assert(s->unit);
+
+        m = s->unit->manager;
+
+        /* Other specs might watch the same inode, so never replace
+         * their mask. Events are filtered by what each spec asked for
+         * in path_inotify_dispatch(). */
+        wd = inotify_add_watch(m->path_inotify_fd, path, mask|IN_MASK_ADD);
+        if (wd < 0)
+                return -errno;
+
+        for (i = 0; i < s->n_watches; i++)
+                if (s->watches[i].wd == wd) {
+                        s->watches[i].mask = mask;
+                        return wd;
+                }
+
+        if (!GREEDY_REALLOC(s->watches, s->n_watches_allocated, s->n_watches + 1)) {
+                r = -ENOMEM;
+                goto fail;
+        }
+
+        r = hashmap_ensure_allocated(&m->path_inotify_wd_specs, NULL);
+        if (r < 0)
+                goto fail;
+
+        specs = hashmap_get(m->path_inotify_wd_specs, INT_TO_PTR(wd));
+        if (!specs) {
+                specs = set_new(NULL);
+                if (!specs) {
+                        r = -ENOMEM;
+                        goto fail;
+                }
+
+                r = hashmap_put(m->path_inotify_wd_specs, INT_TO_PTR(wd), specs);
+                if (r < 0) {
+                        set_free(specs);
+                        goto fail;
+                }
+        }
+
+        r = set_put(specs, s);
+        if (r < 0)
+                goto fail;
+
+        s->watches[s->n_watches++] = (PathSpecWatch) {
+                .wd = wd,
+                .mask = mask,
+        };
+
+        return wd;
+
+fail:
+        if (hashmap_get(m->path_inotify_wd_specs, INT_TO_PTR(wd)))
+                path_inotify_release(m, s, wd);
+        else
+                (void) inotify_rm_watch(m->path_inotify_fd, wd);
+
+        return r;
+}
+
+int path_spec_watch(PathSpec *s, path_spec_handler_t handler) {
 
         static const int flags_table[_PATH_TYPE_MAX] = {
                 [PATH_EXISTS] = IN_DELETE_SELF|IN_MOVE_SELF|IN_ATTRIB,
@@ -53,27 +170,30 @@ int path_spec_watch(PathSpec *s, sd_event_io_handler_t handler) {
                 [PATH_DIRECTORY_NOT_EMPTY] = IN_DELETE_SELF|IN_MOVE_SELF|IN_ATTRIB|IN_CREATE|IN_MOVED_TO
         };
 
+        _cleanup_free_ PathSpecWatch *old = NULL;
         bool exists = false;
         char *slash, *oldslash = NULL;
+        size_t n_old = 0, i, j;
         int r;
 
         assert(s);
         assert(s->unit);
         assert(handler);
 
-        path_spec_unwatch(s);
-
-        s->inotify_fd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
-        if (s->inotify_fd < 0) {
-                r = -errno;
-                goto fail;
-        }
-
-        r = sd_event_add_io(s->unit->manager->event, &s->event_source, s->inotify_fd, EPOLLIN, handler, s);
+        r = path_inotify_setup(s->unit->manager);
         if (r < 0)
                 goto fail;
 
-        (void) sd_event_source_set_description(s->event_source, "path");
+        /* Keep the watches we already hold until the path has been
+         * walked again, so that watches that are still needed are
+         * simply reused instead of being removed and recreated. */
+        old = s->watches;
+        n_old = s->n_watches;
+        s->watches = NULL;
+        s->n_watches = s->n_watches_allocated = 0;
+
+        s->handler = handler;
+        s->primary_wd = -1;
 
         /* This assumes the path was passed through path_kill_slashes()! */
 
@@ -91,15 +211,15 @@ int path_spec_watch(PathSpec *s, sd_event_io_handler_t handler) {
                 } else
                         flags = flags_table[s->type];
 
-                r = inotify_add_watch(s->inotify_fd, s->path, flags);
+                r = path_spec_add_watch(s, s->path, flags);
                 if (r < 0) {
-                        if (errno == EACCES || errno == ENOENT) {
+                        if (r == -EACCES || r == -ENOENT) {
                                 if (cut)
                                         *cut = tmp;
                                 break;
                         }
 
-                        r = log_warning_errno(errno, "Failed to add watch on %s: %s", s->path, errno == ENOSPC ? "too many watches" : strerror(-r));
+                        log_warning_errno(r, "Failed to add watch on %s: %s", s->path, r == -ENOSPC ? "too many watches" : strerror(-r));
                         if (cut)
                                 *cut = tmp;
                         goto fail;
@@ -113,7 +233,7 @@ int path_spec_watch(PathSpec *s, sd_event_io_handler_t handler) {
                                 char tmp2 = *cut2;
                                 *cut2 = '\0';
 
-                                inotify_add_watch(s->inotify_fd, s->path, IN_MOVE_SELF);
+                                (void) path_spec_add_watch(s, s->path, IN_MOVE_SELF);
                                 /* Error is ignored, the worst can happen is
                                    we get spurious events. */
 
@@ -134,51 +254,169 @@ int path_spec_watch(PathSpec *s, sd_event_io_handler_t handler) {
         }
 
         if (!exists) {
-                r = log_error_errno(errno, "Failed to add watch on any of the components of %s: %m", s->path);
+                r = log_error_errno(r, "Failed to add watch on any of the components of %s: %m", s->path);
                 /* either EACCESS or ENOENT */
                 goto fail;
         }
 
+        /* Now drop what is not needed anymore */
+        for (i = 0; i < n_old; i++) {
+                for (j = 0; j < s->n_watches; j++)
+                        if (s->watches[j].wd == old[i].wd)
+                                break;
+
+                if (j >= s->n_watches)
+                        path_inotify_release(s->unit->manager, s, old[i].wd);
+        }
+
         return 0;
 
 fail:
+        for (i = 0; i < n_old; i++)
+                path_inotify_release(s->unit->manager, s, old[i].wd);
+
         path_spec_unwatch(s);
         return r;
 }
 
 void path_spec_unwatch(PathSpec *s) {
+        Manager *m;
+        size_t i;
+
+        assert(s);
+        assert(s->unit);
+
+        m = s->unit->manager;
+
+        for (i = 0; i < s->n_watches; i++)
+                path_inotify_release(m, s, s->watches[i].wd);
+
+        s->watches = mfree(s->watches);
+        s->n_watches = s->n_watches_allocated = 0;
+        s->primary_wd = -1;
+
+        (void) set_remove(m->path_inotify_pending, s);
+        s->pending_changed = false;
+}
+
+static void path_spec_queue(PathSpec *s, int wd, uint32_t mask) {
+        Manager *m;
+        size_t i;
+
         assert(s);
+        assert(s->unit);
 
-        s->event_source = sd_event_source_unref(s->event_source);
-        s->inotify_fd = safe_close(s->inotify_fd);
+        m = s->unit->manager;
+
+        /* Queue overflows and removed watches concern everybody,
+         * everything else only the specs which asked for it */
+        if (wd >= 0 && !(mask & IN_IGNORED)) {
+                for (i = 0; i < s->n_watches; i++)
+                        if (s->watches[i].wd == wd)
+                                break;
+
+                if (i >= s->n_watches || !(s->watches[i].mask & mask))
+                        return;
+        }
+
+        if (set_ensure_allocated(&m->path_inotify_pending, NULL) < 0 ||
+            set_put(m->path_inotify_pending, s) < 0) {
+                log_oom();
+                return;
+        }
+
+        if ((s->type == PATH_CHANGED || s->type == PATH_MODIFIED) &&
+            s->primary_wd == wd)
+                s->pending_changed = true;
 }
 
-int path_spec_fd_event(PathSpec *s, uint32_t revents) {
-        union inotify_event_buffer buffer;
-        struct inotify_event *e;
-        ssize_t l;
-        int r = 0;
+static int path_inotify_dispatch(sd_event_source *source, int fd, uint32_t revents, void *userdata) {
+        Manager *m = userdata;
+        PathSpec *s;
+
+        assert(m);
+        assert(fd >= 0);
 
         if (revents != EPOLLIN) {
                 log_error("Got invalid poll event on inotify.");
-                return -EINVAL;
+                return 0;
         }
 
-        l = read(s->inotify_fd, &buffer, sizeof(buffer));
-        if (l < 0) {
-                if (errno == EAGAIN || errno == EINTR)
-                        return 0;
+        for (;;) {
+                union inotify_event_buffer buffer;
+                struct inotify_event *e;
+                ssize_t l;
+
+                l = read(fd, &buffer, sizeof(buffer));
+                if (l < 0) {
+                        if (errno != EAGAIN && errno != EINTR)
+                                log_error_errno(errno, "Failed to read inotify event: %m");
+
+                        break;
+                }
+
+                FOREACH_INOTIFY_EVENT(e, buffer, l) {
+                        Iterator i;
+                        Set *specs;
+
+                        if (e->wd < 0) {
+                                Iterator j;
 
-                return log_error_errno(errno, "Failed to read inotify event: %m");
+                                /* The queue overflowed, we don't know
+                                 * anymore what happened, recheck all */
+                                HASHMAP_FOREACH(specs, m->path_inotify_wd_specs, i)
+                                        SET_FOREACH(s, specs, j)
+                                                path_spec_queue(s, e->wd, e->mask);
+
+                                continue;
+                        }
+
+                        specs = hashmap_get(m->path_inotify_wd_specs, INT_TO_PTR(e->wd));
+                        if (!specs)
+                                /* Events queued before the watch was
+                                 * removed, ignore */
+                                continue;
+
+                        SET_FOREACH(s, specs, i)
+                                path_spec_queue(s, e->wd, e->mask);
+
+                        if (e->mask & IN_IGNORED) {
+                                /* The kernel dropped the watch, the
+                                 * specs will reestablish theirs when
+                                 * dispatched */
+                                (void) hashmap_remove(m->path_inotify_wd_specs, INT_TO_PTR(e->wd));
+                                set_free(specs);
+                        }
+                }
         }
 
-        FOREACH_INOTIFY_EVENT(e, buffer, l) {
-                if ((s->type == PATH_CHANGED || s->type == PATH_MODIFIED) &&
-                    s->primary_wd == e->wd)
-                        r = 1;
+        /* Dispatch only after the events have been read completely,
+         * so that each spec is handled once even if many of its
+         * watches triggered. Handlers might unwatch other specs,
+         * which then drop out of the pending set. */
+        while ((s = set_steal_first(m->path_inotify_pending))) {
+                bool changed = s->pending_changed;
+
+                s->pending_changed = false;
+                (void) s->handler(s, changed);
         }
 
-        return r;
+        return 0;
+}
+
+static void path_shutdown(Manager *m) {
+        Set *specs;
+
+        assert(m);
+
+        m->path_inotify_pending = set_free(m->path_inotify_pending);
+
+        while ((specs = hashmap_steal_first(m->path_inotify_wd_specs)))
+                set_free(specs);
+        m->path_inotify_wd_specs = hashmap_free(m->path_inotify_wd_specs);
+
+        m->path_inotify_event_source = sd_event_source_unref(m->path_inotify_event_source);
+        m->path_inotify_fd = safe_close(m->path_inotify_fd);
 }
 
 static bool path_spec_check_good(PathSpec *s, bool initial) {
@@ -240,7 +478,7 @@ static void path_spec_dump(PathSpec *s, FILE *f, const char *prefix) {
 
 void path_spec_done(PathSpec *s) {
         assert(s);
-        assert(s->inotify_fd == -1);
+        assert(!s->watches);
 
         free(s->path);
 }
@@ -338,7 +576,7 @@ static int path_load(Unit *u) {
 
         if (u->load_state == UNIT_LOADED) {
 
-                if (set_isempty(u->dependencies[UNIT_TRIGGERS])) {
+                if (!UNIT_TRIGGER(u)) {
                         Unit *x;
 
                         r = unit_load_related_unit(u, ".service", &x);
@@ -406,7 +644,7 @@ static int path_watch(Path *p) {
         assert(p);
 
         LIST_FOREACH(spec, s, p->specs) {
-                r = path_spec_watch(s, path_dispatch_io);
+                r = path_spec_watch(s, path_dispatch_inotify);
                 if (r < 0)
                         return r;
         }
@@ -634,14 +872,11 @@ _pure_ static const char *path_sub_state_to_string(Unit *u) {
         return path_state_to_string(PATH(u)->state);
 }
 
-static int path_dispatch_io(sd_event_source *source, int fd, uint32_t revents, void *userdata) {
-        PathSpec *s = userdata;
+static int path_dispatch_inotify(PathSpec *s, bool changed) {
         Path *p;
-        int changed;
 
         assert(s);
         assert(s->unit);
-        assert(fd >= 0);
 
         p = PATH(s->unit);
 
@@ -651,19 +886,6 @@ static int path_dispatch_io(sd_event_source *source, int fd, uint32_t revents, v
 
         /* log_debug("inotify wakeup on %s.", u->id); */
 
-        LIST_FOREACH(spec, s, p->specs)
-                if (path_spec_owns_inotify_fd(s, fd))
-                        break;
-
-        if (!s) {
-                log_error("Got event on unknown fd.");
-                goto fail;
-        }
-
-        changed = path_spec_fd_event(s, revents);
-        if (changed < 0)
-                goto fail;
-
         /* If we are already running, then remember that one event was
          * dispatched so that we restart the service only if something
          * actually changed on disk */
@@ -675,10 +897,6 @@ static int path_dispatch_io(sd_event_source *source, int fd, uint32_t revents, v
                 path_enter_waiting(p, false, true);
 
         return 0;
-
-fail:
-        path_enter_dead(p, PATH_FAILURE_RESOURCES);
-        return 0;
 }
 
 static void path_trigger_notify(Unit *u, Unit *other) {
@@ -753,6 +971,8 @@ const UnitVTable path_vtable = {
         .done = path_done,
         .load = path_load,
 
+        .shutdown = path_shutdown,
+
         .coldplug = path_coldplug,
 
         .dump = path_dump,
@@ -45,31 +45,40 @@ typedef enum PathType {
         _PATH_TYPE_INVALID = -1
 } PathType;
 
+/* Called with changed set if the event was on the watched path
+ * itself and the spec is of type PATH_CHANGED or PATH_MODIFIED */
+typedef int (*path_spec_handler_t)(PathSpec *s, bool changed);
+
+typedef struct PathSpecWatch {
+        int wd;
+        uint32_t mask;
+} PathSpecWatch;
+
 typedef struct PathSpec {
         Unit *unit;
 
         char *path;
 
-        sd_event_source *event_source;
-
         LIST_FIELDS(struct PathSpec, spec);
 
         PathType type;
-        int inotify_fd;
+
+        /* Watch descriptors on the manager's shared inotify object,
+         * with the events this spec is interested in on each */
+        PathSpecWatch *watches;
+        size_t n_watches, n_watches_allocated;
         int primary_wd;
 
+        path_spec_handler_t handler;
+        bool pending_changed;
+
         bool previous_exists;
 } PathSpec;
 
-int path_spec_watch(PathSpec *s, sd_event_io_handler_t handler);
+int path_spec_watch(PathSpec *s, path_spec_handler_t handler);
 void path_spec_unwatch(PathSpec *s);
-int path_spec_fd_event(PathSpec *s, uint32_t events);
 void path_spec_done(PathSpec *s);
 
-static inline bool path_spec_owns_inotify_fd(PathSpec *s, int fd) {
-        return s->inotify_fd == fd;
-}
-
 typedef enum PathResult {
         PATH_SUCCESS,
         PATH_FAILURE_RESOURCES,
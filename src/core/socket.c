@@ -28,6 +28,7 @@
 #include <arpa/inet.h>
 #include <netinet/tcp.h>
 #include <mqueue.h>
+#include <linux/filter.h>
 
 #include "sd-event.h"
 #include "log.h"
@@ -302,13 +303,81 @@ _pure_ static bool socket_has_exec(Socket *s) {
         return false;
 }
 
+static int socket_add_instance_ports(Socket *s) {
+        _cleanup_free_ char *prefix = NULL;
+        SocketPort *p;
+        unsigned i;
+        int r;
+
+        assert(s);
+
+        /* For ReusePortInstances=N every listening address is opened
+         * N times with SO_REUSEPORT, and each copy is handed to its
+         * own instance of the template service, so that the kernel
+         * balances the load between them. The copies are inserted
+         * right after the original, so that they are bound in
+         * instance order, which makes the instance number match the
+         * socket's index in the kernel's reuseport group. */
+
+        LIST_FOREACH(port, p, s->ports) {
+                SocketPort *last = p;
+
+                if (p->type != SOCKET_SOCKET || p->instance > 0)
+                        continue;
+
+                for (i = 1; i < s->reuse_port_instances; i++) {
+                        SocketPort *n;
+
+                        n = new0(SocketPort, 1);
+                        if (!n)
+                                return -ENOMEM;
+
+                        n->socket = s;
+                        n->type = p->type;
+                        n->fd = -1;
+                        n->address = p->address;
+                        n->instance = i;
+
+                        LIST_INSERT_AFTER(port, s->ports, last, n);
+                        last = n;
+                }
+        }
+
+        r = unit_name_to_prefix(UNIT(s)->id, &prefix);
+        if (r < 0)
+                return r;
+
+        for (i = 0; i < s->reuse_port_instances; i++) {
+                _cleanup_free_ char *name = NULL;
+                Unit *x;
+
+                if (asprintf(&name, "%s@%u.service", prefix, i) < 0)
+                        return -ENOMEM;
+
+                r = manager_load_unit(UNIT(s)->manager, name, NULL, NULL, &x);
+                if (r < 0)
+                        return r;
+
+                r = unit_add_two_dependencies(UNIT(s), UNIT_BEFORE, UNIT_TRIGGERS, x, true);
+                if (r < 0)
+                        return r;
+        }
+
+        return 0;
+}
+
 static int socket_add_extras(Socket *s) {
         Unit *u = UNIT(s);
         int r;
 
         assert(s);
 
-        if (have_non_accept_socket(s)) {
+        if (s->reuse_port_instances > 1) {
+                r = socket_add_instance_ports(s);
+                if (r < 0)
+                        return r;
+
+        } else if (have_non_accept_socket(s)) {
 
                 if (!UNIT_DEREF(s->service)) {
                         Unit *x;
@@ -415,6 +484,27 @@ static int socket_verify(Socket *s) {
                 return -EINVAL;
         }
 
+        if (s->reuse_port_instances > 1) {
+                SocketPort *p;
+
+                if (s->accept || !s->reuse_port) {
+                        log_unit_error(UNIT(s), "ReusePortInstances= requires ReusePort=yes and Accept=no. Refusing.");
+                        return -EINVAL;
+                }
+
+                if (UNIT_DEREF(s->service)) {
+                        log_unit_error(UNIT(s), "Explicit service configuration for sockets with ReusePortInstances= not supported. Refusing.");
+                        return -EINVAL;
+                }
+
+                LIST_FOREACH(port, p, s->ports)
+                        if (p->type != SOCKET_SOCKET ||
+                            !IN_SET(socket_address_family(&p->address), AF_INET, AF_INET6)) {
+                                log_unit_error(UNIT(s), "ReusePortInstances= is only supported for IP sockets. Refusing.");
+                                return -EINVAL;
+                        }
+        }
+
         if (s->exec_context.pam_name && s->kill_context.kill_mode != KILL_CONTROL_GROUP) {
                 log_unit_error(UNIT(s), "Unit has PAM enabled. Kill mode must be set to 'control-group'. Refusing.");
                 return -EINVAL;
@@ -581,6 +671,13 @@ static void socket_dump(Unit *u, FILE *f, const char *prefix) {
                         "%sReusePort: %s\n",
                          prefix, yes_no(s->reuse_port));
 
+        if (s->reuse_port_instances > 1)
+                fprintf(f,
+                        "%sReusePortInstances: %u\n"
+                        "%sReusePortSteerByCPU: %s\n",
+                        prefix, s->reuse_port_instances,
+                        prefix, yes_no(s->reuse_port_steer_by_cpu));
+
         if (s->smack)
                 fprintf(f,
                         "%sSmackLabel: %s\n",
@@ -1124,6 +1221,40 @@ static int socket_symlink(Socket *s) {
         return 0;
 }
 
+static int socket_attach_steering(Socket *s) {
+        SocketPort *p;
+
+        assert(s);
+
+        /* Route each connection or datagram to the instance with the
+         * number of the CPU it arrived on, modulo the number of
+         * instances. Combined with CPUAffinity=%i in the template
+         * this keeps a flow on one CPU from the NIC queue to the
+         * process. The program applies to the whole reuseport group,
+         * hence attach it to the first socket of each address
+         * only. */
+
+        LIST_FOREACH(port, p, s->ports) {
+                struct sock_filter code[] = {
+                        BPF_STMT(BPF_LD|BPF_W|BPF_ABS, SKF_AD_OFF + SKF_AD_CPU),
+                        BPF_STMT(BPF_ALU|BPF_MOD|BPF_K, s->reuse_port_instances),
+                        BPF_STMT(BPF_RET|BPF_A, 0),
+                };
+                struct sock_fprog prog = {
+                        .len = ELEMENTSOF(code),
+                        .filter = code,
+                };
+
+                if (p->fd < 0 || p->instance > 0)
+                        continue;
+
+                if (setsockopt(p->fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) < 0)
+                        return log_unit_warning_errno(UNIT(s), errno, "Failed to attach reuseport steering program: %m");
+        }
+
+        return 0;
+}
+
 static int socket_open_fds(Socket *s) {
         SocketPort *p;
         int r;
@@ -1224,6 +1355,12 @@ static int socket_open_fds(Socket *s) {
                         assert_not_reached("Unknown port type");
         }
 
+        if (s->reuse_port_steer_by_cpu) {
+                r = socket_attach_steering(s);
+                if (r < 0)
+                        goto rollback;
+        }
+
         mac_selinux_free(label);
         return 0;
 
@@ -1787,13 +1924,26 @@ static void socket_enter_running(Socket *s, int cfd) {
 
                 /* If there's already a start pending don't bother to
                  * do anything */
-                SET_FOREACH(other, UNIT(s)->dependencies[UNIT_TRIGGERS], i)
+                UNIT_FOREACH_DEPENDENCY(other, UNIT(s), UNIT_TRIGGERS, i)
                         if (unit_active_or_pending(other)) {
                                 pending = true;
                                 break;
                         }
 
-                if (!pending) {
+                if (s->reuse_port_instances > 1) {
+
+                        /* Start all instances that aren't running,
+                         * each of them has its own fds to serve */
+                        UNIT_FOREACH_DEPENDENCY(other, UNIT(s), UNIT_TRIGGERS, i) {
+                                if (unit_active_or_pending(other))
+                                        continue;
+
+                                r = manager_add_job(UNIT(s)->manager, JOB_START, other, JOB_REPLACE, true, &error, NULL);
+                                if (r < 0)
+                                        goto fail;
+                        }
+
+                } else if (!pending) {
                         if (!UNIT_ISSET(s->service)) {
                                 log_unit_error(UNIT(s), "Service to activate vanished, refusing activation.");
                                 r = -ENOENT;
@@ -2157,8 +2307,10 @@ static int socket_deserialize_item(Unit *u, const char *key, const char *value,
                         log_unit_debug(u, "Failed to parse socket value: %s", value);
                 else {
 
+                        /* Copies for ReusePortInstances= share the
+                         * address, but were serialized in order */
                         LIST_FOREACH(port, p, s->ports)
-                                if (socket_address_is(&p->address, value+skip, type))
+                                if (p->fd < 0 && socket_address_is(&p->address, value+skip, type))
                                         break;
 
                         if (p) {
@@ -2493,7 +2645,26 @@ static int socket_dispatch_timer(sd_event_source *source, usec_t usec, void *use
         return 0;
 }
 
-int socket_collect_fds(Socket *s, int **fds, unsigned *n_fds) {
+static bool socket_port_for_unit(Socket *s, SocketPort *p, Unit *u) {
+        unsigned instance;
+
+        assert(s);
+        assert(p);
+
+        if (p->fd < 0)
+                return false;
+
+        if (s->reuse_port_instances <= 1)
+                return true;
+
+        /* Each instance only gets its own copy of the fds */
+        if (!u || !u->instance || safe_atou(u->instance, &instance) < 0)
+                return false;
+
+        return p->instance == instance;
+}
+
+int socket_collect_fds(Socket *s, Unit *u, int **fds, unsigned *n_fds) {
         int *rfds;
         unsigned rn_fds, k;
         SocketPort *p;
@@ -2506,7 +2677,7 @@ int socket_collect_fds(Socket *s, int **fds, unsigned *n_fds) {
 
         rn_fds = 0;
         LIST_FOREACH(port, p, s->ports)
-                if (p->fd >= 0)
+                if (socket_port_for_unit(s, p, u))
                         rn_fds++;
 
         if (rn_fds <= 0) {
@@ -2521,7 +2692,7 @@ int socket_collect_fds(Socket *s, int **fds, unsigned *n_fds) {
 
         k = 0;
         LIST_FOREACH(port, p, s->ports)
-                if (p->fd >= 0)
+                if (socket_port_for_unit(s, p, u))
                         rfds[k++] = p->fd;
 
         assert(k == rn_fds);
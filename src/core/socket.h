@@ -86,6 +86,10 @@ typedef struct SocketPort {
         char *path;
         sd_event_source *event_source;
 
+        /* With ReusePortInstances= each address is listed once per
+         * service instance, this is the instance the fd is for */
+        unsigned instance;
+
         LIST_FIELDS(struct SocketPort, port);
 } SocketPort;
 
@@ -156,6 +160,8 @@ struct Socket {
         char *bind_to_device;
         char *tcp_congestion;
         bool reuse_port;
+        unsigned reuse_port_instances;
+        bool reuse_port_steer_by_cpu;
         long mq_maxmsg;
         long mq_msgsize;
 
@@ -171,7 +177,7 @@ struct Socket {
 };
 
 /* Called from the service code when collecting fds */
-int socket_collect_fds(Socket *s, int **fds, unsigned *n_fds);
+int socket_collect_fds(Socket *s, Unit *u, int **fds, unsigned *n_fds);
 
 /* Called from the service code when a per-connection service ended */
 void socket_connection_unref(Socket *s);
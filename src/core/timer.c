@@ -29,6 +29,8 @@
 #include "bus-util.h"
 #include "bus-error.h"
 
+#define TIMER_WAKEUP_WINDOW_USEC (5 * USEC_PER_MSEC)
+
 static const UnitActiveState state_translation_table[_TIMER_STATE_MAX] = {
         [TIMER_DEAD] = UNIT_INACTIVE,
         [TIMER_WAITING] = UNIT_ACTIVE,
@@ -169,7 +171,7 @@ static int timer_load(Unit *u) {
 
         if (u->load_state == UNIT_LOADED) {
 
-                if (set_isempty(u->dependencies[UNIT_TRIGGERS])) {
+                if (!UNIT_TRIGGER(u)) {
                         Unit *x;
 
                         r = unit_load_related_unit(u, ".service", &x);
@@ -302,9 +304,29 @@ static usec_t monotonic_to_boottime(usec_t t) {
                 return 0;
 }
 
+static usec_t timer_get_accuracy(Timer *t) {
+        Manager *m;
+
+        assert(t);
+
+        m = UNIT(t)->manager;
+
+        /* On battery, let timers that didn't ask for a specific
+         * accuracy slip further, so that more of them can be
+         * dispatched in a single wakeup */
+        if (t->accuracy_usec != m->default_timer_accuracy_usec ||
+            m->default_timer_accuracy_on_battery_usec <= t->accuracy_usec)
+                return t->accuracy_usec;
+
+        if (on_ac_power() != 0)
+                return t->accuracy_usec;
+
+        return m->default_timer_accuracy_on_battery_usec;
+}
+
 static void timer_enter_waiting(Timer *t, bool initial) {
         bool found_monotonic = false, found_realtime = false;
-        usec_t ts_realtime, ts_monotonic;
+        usec_t ts_realtime, ts_monotonic, accuracy;
         usec_t base = 0;
         TimerValue *v;
         int r;
@@ -415,6 +437,8 @@ static void timer_enter_waiting(Timer *t, bool initial) {
                 return;
         }
 
+        accuracy = timer_get_accuracy(t);
+
         if (found_monotonic) {
                 char buf[FORMAT_TIMESPAN_MAX];
 
@@ -425,6 +449,10 @@ static void timer_enter_waiting(Timer *t, bool initial) {
                         if (r < 0)
                                 goto fail;
 
+                        r = sd_event_source_set_time_accuracy(t->monotonic_event_source, accuracy);
+                        if (r < 0)
+                                goto fail;
+
                         r = sd_event_source_set_enabled(t->monotonic_event_source, SD_EVENT_ONESHOT);
                         if (r < 0)
                                 goto fail;
@@ -434,7 +462,7 @@ static void timer_enter_waiting(Timer *t, bool initial) {
                                         UNIT(t)->manager->event,
                                         &t->monotonic_event_source,
                                         t->wake_system ? CLOCK_BOOTTIME_ALARM : CLOCK_MONOTONIC,
-                                        t->next_elapse_monotonic_or_boottime, t->accuracy_usec,
+                                        t->next_elapse_monotonic_or_boottime, accuracy,
                                         timer_dispatch, t);
                         if (r < 0)
                                 goto fail;
@@ -458,6 +486,10 @@ static void timer_enter_waiting(Timer *t, bool initial) {
                         if (r < 0)
                                 goto fail;
 
+                        r = sd_event_source_set_time_accuracy(t->realtime_event_source, accuracy);
+                        if (r < 0)
+                                goto fail;
+
                         r = sd_event_source_set_enabled(t->realtime_event_source, SD_EVENT_ONESHOT);
                         if (r < 0)
                                 goto fail;
@@ -466,7 +498,7 @@ static void timer_enter_waiting(Timer *t, bool initial) {
                                         UNIT(t)->manager->event,
                                         &t->realtime_event_source,
                                         t->wake_system ? CLOCK_REALTIME_ALARM : CLOCK_REALTIME,
-                                        t->next_elapse_realtime, t->accuracy_usec,
+                                        t->next_elapse_realtime, accuracy,
                                         timer_dispatch, t);
                         if (r < 0)
                                 goto fail;
@@ -637,12 +669,24 @@ _pure_ static const char *timer_sub_state_to_string(Unit *u) {
 
 static int timer_dispatch(sd_event_source *s, uint64_t usec, void *userdata) {
         Timer *t = TIMER(userdata);
+        Manager *m;
+        usec_t ts;
 
         assert(t);
 
         if (t->state != TIMER_WAITING)
                 return 0;
 
+        /* Timers whose accuracy windows overlap are dispatched in one
+         * go. Count those that are dispatched within a few ms of each
+         * other as one wakeup. */
+        m = UNIT(t)->manager;
+        assert_se(sd_event_now(m->event, CLOCK_MONOTONIC, &ts) >= 0);
+        if (m->n_timer_wakeups == 0 || ts > m->timer_last_wakeup + TIMER_WAKEUP_WINDOW_USEC)
+                m->n_timer_wakeups++;
+        m->timer_last_wakeup = ts;
+        m->n_timer_elapses++;
+
         log_unit_debug(UNIT(t), "Timer elapsed.");
         timer_enter_running(t);
         return 0;
@@ -21,6 +21,7 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <string.h>
 #include <sys/mount.h>
 #include <sys/swap.h>
@@ -36,12 +37,29 @@
 #include "libudev.h"
 #include "udev-util.h"
 
+/* Upper limit of threads unmounting or detaching concurrently */
+#define WORKERS_MAX 16
+
 typedef struct MountPoint {
         char *path;
         dev_t devnum;
+        int id, parent_id;
+        unsigned depth;
+        bool read_only;
+        int result;
         LIST_FIELDS(struct MountPoint, mount_point);
 } MountPoint;
 
+typedef int (*mount_point_op_t)(MountPoint *m, void *userdata);
+
+typedef struct Batch {
+        MountPoint **points;
+        unsigned n_points;
+        unsigned next;
+        mount_point_op_t op;
+        void *userdata;
+} Batch;
+
 static void mount_point_free(MountPoint **head, MountPoint *m) {
         assert(head);
         assert(m);
@@ -74,11 +92,11 @@ static int mount_points_list_get(MountPoint **head) {
                 _cleanup_free_ char *path = NULL;
                 char *p = NULL;
                 MountPoint *m;
-                int k;
+                int id, parent_id, k;
 
                 k = fscanf(proc_self_mountinfo,
-                           "%*s "       /* (1) mount id */
-                           "%*s "       /* (2) parent id */
+                           "%i "        /* (1) mount id */
+                           "%i "        /* (2) parent id */
                            "%*s "       /* (3) major:minor */
                            "%*s "       /* (4) root */
                            "%ms "       /* (5) mount point */
@@ -89,8 +107,10 @@ static int mount_points_list_get(MountPoint **head) {
                            "%*s"        /* (10) mount source */
                            "%*s"        /* (11) mount options 2 */
                            "%*[^\n]",   /* some rubbish at the end */
+                           &id,
+                           &parent_id,
                            &path);
-                if (k != 1) {
+                if (k != 3) {
                         if (k == EOF)
                                 break;
 
@@ -125,12 +145,96 @@ static int mount_points_list_get(MountPoint **head) {
                 }
 
                 m->path = p;
+                m->id = id;
+                m->parent_id = parent_id;
                 LIST_PREPEND(mount_point, *head, m);
         }
 
         return 0;
 }
 
+static int mount_point_id_compare(const void *a, const void *b) {
+        const MountPoint *x = *(const MountPoint**) a, *y = *(const MountPoint**) b;
+
+        if (x->id < y->id)
+                return -1;
+        if (x->id > y->id)
+                return 1;
+
+        return 0;
+}
+
+static int mount_point_depth_compare(const void *a, const void *b) {
+        const MountPoint *x = *(const MountPoint**) a, *y = *(const MountPoint**) b;
+
+        /* Deepest first, and within one level the most recently
+         * mounted first */
+
+        if (x->depth > y->depth)
+                return -1;
+        if (x->depth < y->depth)
+                return 1;
+
+        return -mount_point_id_compare(a, b);
+}
+
+static int mount_points_list_sort(MountPoint **head) {
+        _cleanup_free_ MountPoint **points = NULL;
+        unsigned n = 0, i;
+        MountPoint *m;
+
+        assert(head);
+
+        /* Orders the mount points by their depth in the tree the
+         * parent ids in mountinfo form, so that everything mounted
+         * on top of a mount point is unmounted before the mount
+         * point itself is tried. Mount points of the same depth
+         * cannot be on top of each other, hence may be unmounted in
+         * parallel. */
+
+        LIST_FOREACH(mount_point, m, *head)
+                n++;
+
+        if (n == 0)
+                return 0;
+
+        points = new(MountPoint*, n);
+        if (!points)
+                return -ENOMEM;
+
+        i = 0;
+        LIST_FOREACH(mount_point, m, *head)
+                points[i++] = m;
+
+        qsort_safe(points, n, sizeof(MountPoint*), mount_point_id_compare);
+
+        for (i = 0; i < n; i++) {
+                unsigned depth = 0;
+
+                m = points[i];
+                while (depth < n && m->parent_id != m->id) {
+                        MountPoint key = { .id = m->parent_id }, *k = &key, **parent;
+
+                        parent = bsearch(&k, points, n, sizeof(MountPoint*), mount_point_id_compare);
+                        if (!parent)
+                                break;
+
+                        m = *parent;
+                        depth++;
+                }
+
+                points[i]->depth = depth;
+        }
+
+        qsort_safe(points, n, sizeof(MountPoint*), mount_point_depth_compare);
+
+        *head = NULL;
+        for (i = n; i > 0; i--)
+                LIST_PREPEND(mount_point, *head, points[i-1]);
+
+        return 0;
+}
+
 static int swap_list_get(MountPoint **head) {
         _cleanup_fclose_ FILE *proc_swaps = NULL;
         unsigned int i;
@@ -302,7 +406,7 @@ static int dm_list_get(MountPoint **head) {
                 if (!node)
                         return -ENOMEM;
 
-                m = new(MountPoint, 1);
+                m = new0(MountPoint, 1);
                 if (!m) {
                         free(node);
                         return -ENOMEM;
@@ -356,81 +460,191 @@ static int delete_dm(dev_t devnum) {
         return r >= 0 ? 0 : -errno;
 }
 
+static void *batch_thread(void *p) {
+        Batch *b = p;
+
+        for (;;) {
+                unsigned i;
+
+                i = __sync_fetch_and_add(&b->next, 1);
+                if (i >= b->n_points)
+                        break;
+
+                b->points[i]->result = b->op(b->points[i], b->userdata);
+        }
+
+        return NULL;
+}
+
+static void mount_points_run(MountPoint **points, unsigned n_points, mount_point_op_t op, void *userdata) {
+        pthread_t threads[WORKERS_MAX-1];
+        unsigned n_threads = 0, i;
+        Batch b = {
+                .points = points,
+                .n_points = n_points,
+                .op = op,
+                .userdata = userdata,
+        };
+
+        /* Runs op on all the points, from up to WORKERS_MAX threads,
+         * the calling one included. If no threads can be created we
+         * simply do everything here. The ops only store their result
+         * in the points, all logging is left to the caller. */
+
+        if (n_points == 0)
+                return;
+
+        while (n_threads < MIN(n_points, (unsigned) WORKERS_MAX) - 1) {
+                if (pthread_create(&threads[n_threads], NULL, batch_thread, &b) != 0)
+                        break;
+
+                n_threads++;
+        }
+
+        batch_thread(&b);
+
+        for (i = 0; i < n_threads; i++)
+                (void) pthread_join(threads[i], NULL);
+}
+
+static bool mount_point_keep(MountPoint *m) {
+        /* Skip / and /usr since we cannot unmount that anyway, since
+         * we are running from it. They have already been remounted
+         * ro. */
+        return path_equal(m->path, "/")
+#ifndef HAVE_SPLIT_USR
+                || path_equal(m->path, "/usr")
+#endif
+                ;
+}
+
+static int mount_point_umount(MountPoint *m, void *userdata) {
+        bool remount = *(bool*) userdata;
+
+        if (remount && !m->read_only) {
+                /* We always try to remount directories read-only
+                 * first, before we go on and umount them.
+                 *
+                 * Mount points can be stacked. If a mount point is
+                 * stacked below / or /usr, we cannot umount or
+                 * remount it directly, since there is no way to refer
+                 * to the underlying mount. There's nothing we can do
+                 * about it for the general case, but we can do
+                 * something about it if it is aliased somehwere else
+                 * via a bind mount. If we explicitly remount the super
+                 * block of that alias read-only we hence should be
+                 * relatively safe regarding keeping the fs we can
+                 * otherwise not see dirty. */
+                if (mount(NULL, m->path, NULL, MS_REMOUNT|MS_RDONLY, NULL) >= 0)
+                        m->read_only = true;
+        }
+
+        if (mount_point_keep(m))
+                return 0;
+
+        /* Trying to umount. We don't force here since we rely on busy
+         * NFS and FUSE file systems to return EBUSY until we closed
+         * everything on top of them. */
+        if (umount2(m->path, 0) < 0)
+                return -errno;
+
+        return 1;
+}
+
 static int mount_points_list_umount(MountPoint **head, bool *changed, bool log_error) {
-        MountPoint *m, *n;
+        _cleanup_free_ MountPoint **batch = NULL;
+        MountPoint *m, *n, *next;
+        unsigned n_batch = 0, i;
         int n_failed = 0;
+        bool remount;
 
         assert(head);
 
-        LIST_FOREACH_SAFE(mount_point, m, n, *head) {
-
-                /* If we are in a container, don't attempt to
-                   read-only mount anything as that brings no real
-                   benefits, but might confuse the host, as we remount
-                   the superblock here, not the bind mound. */
-                if (detect_container() <= 0)  {
-                        /* We always try to remount directories
-                         * read-only first, before we go on and umount
-                         * them.
-                         *
-                         * Mount points can be stacked. If a mount
-                         * point is stacked below / or /usr, we
-                         * cannot umount or remount it directly,
-                         * since there is no way to refer to the
-                         * underlying mount. There's nothing we can do
-                         * about it for the general case, but we can
-                         * do something about it if it is aliased
-                         * somehwere else via a bind mount. If we
-                         * explicitly remount the super block of that
-                         * alias read-only we hence should be
-                         * relatively safe regarding keeping the fs we
-                         * can otherwise not see dirty. */
-                        (void) mount(NULL, m->path, NULL, MS_REMOUNT|MS_RDONLY, NULL);
+        /* If we are in a container, don't attempt to read-only mount
+         * anything as that brings no real benefits, but might confuse
+         * the host, as we remount the superblock here, not the bind
+         * mound. */
+        remount = detect_container() <= 0;
+
+        LIST_FOREACH(mount_point, m, *head)
+                n_batch++;
+
+        batch = new(MountPoint*, n_batch);
+        if (n_batch > 0 && !batch)
+                return -ENOMEM;
+
+        /* The list is sorted by depth, one level after the other is
+         * handled, each in parallel. */
+        for (m = *head; m; m = next) {
+
+                n_batch = 0;
+                for (next = m; next && next->depth == m->depth; next = next->mount_point_next) {
+                        if (!mount_point_keep(next))
+                                log_info("Unmounting %s.", next->path);
+
+                        batch[n_batch++] = next;
                 }
 
-                /* Skip / and /usr since we cannot unmount that
-                 * anyway, since we are running from it. They have
-                 * already been remounted ro. */
-                if (path_equal(m->path, "/")
-#ifndef HAVE_SPLIT_USR
-                    || path_equal(m->path, "/usr")
-#endif
-                )
-                        continue;
+                mount_points_run(batch, n_batch, mount_point_umount, &remount);
 
-                /* Trying to umount. We don't force here since we rely
-                 * on busy NFS and FUSE file systems to return EBUSY
-                 * until we closed everything on top of them. */
-                log_info("Unmounting %s.", m->path);
-                if (umount2(m->path, 0) == 0) {
-                        if (changed)
-                                *changed = true;
+                for (i = 0; i < n_batch; i++) {
+                        n = batch[i];
 
-                        mount_point_free(head, m);
-                } else if (log_error) {
-                        log_warning_errno(errno, "Could not unmount %s: %m", m->path);
-                        n_failed++;
+                        if (mount_point_keep(n))
+                                continue;
+
+                        if (n->result >= 0) {
+                                if (changed)
+                                        *changed = true;
+
+                                mount_point_free(head, n);
+                        } else if (log_error) {
+                                log_warning_errno(n->result, "Could not unmount %s: %m", n->path);
+                                n_failed++;
+                        }
                 }
         }
 
         return n_failed;
 }
 
+static int mount_point_swapoff(MountPoint *m, void *userdata) {
+        return swapoff(m->path) < 0 ? -errno : 0;
+}
+
 static int swap_points_list_off(MountPoint **head, bool *changed) {
-        MountPoint *m, *n;
+        _cleanup_free_ MountPoint **batch = NULL;
+        unsigned n_batch = 0, i;
+        MountPoint *m;
         int n_failed = 0;
 
         assert(head);
 
-        LIST_FOREACH_SAFE(mount_point, m, n, *head) {
+        LIST_FOREACH(mount_point, m, *head)
+                n_batch++;
+
+        batch = new(MountPoint*, n_batch);
+        if (n_batch > 0 && !batch)
+                return -ENOMEM;
+
+        n_batch = 0;
+        LIST_FOREACH(mount_point, m, *head) {
                 log_info("Deactivating swap %s.", m->path);
-                if (swapoff(m->path) == 0) {
+                batch[n_batch++] = m;
+        }
+
+        mount_points_run(batch, n_batch, mount_point_swapoff, NULL);
+
+        for (i = 0; i < n_batch; i++) {
+                m = batch[i];
+
+                if (m->result >= 0) {
                         if (changed)
                                 *changed = true;
 
                         mount_point_free(head, m);
                 } else {
-                        log_warning_errno(errno, "Could not deactivate swap %s: %m", m->path);
+                        log_warning_errno(m->result, "Could not deactivate swap %s: %m", m->path);
                         n_failed++;
                 }
         }
@@ -438,17 +652,30 @@ static int swap_points_list_off(MountPoint **head, bool *changed) {
         return n_failed;
 }
 
+static int mount_point_delete_loopback(MountPoint *m, void *userdata) {
+        return delete_loopback(m->path);
+}
+
 static int loopback_points_list_detach(MountPoint **head, bool *changed) {
-        MountPoint *m, *n;
+        _cleanup_free_ MountPoint **batch = NULL;
+        unsigned n_batch = 0, i;
         int n_failed = 0, k;
         struct stat root_st;
+        MountPoint *m;
 
         assert(head);
 
         k = lstat("/", &root_st);
 
-        LIST_FOREACH_SAFE(mount_point, m, n, *head) {
-                int r;
+        LIST_FOREACH(mount_point, m, *head)
+                n_batch++;
+
+        batch = new(MountPoint*, n_batch);
+        if (n_batch > 0 && !batch)
+                return -ENOMEM;
+
+        n_batch = 0;
+        LIST_FOREACH(mount_point, m, *head) {
                 struct stat loopback_st;
 
                 if (k >= 0 &&
@@ -460,14 +687,21 @@ static int loopback_points_list_detach(MountPoint **head, bool *changed) {
                 }
 
                 log_info("Detaching loopback %s.", m->path);
-                r = delete_loopback(m->path);
-                if (r >= 0) {
-                        if (r > 0 && changed)
+                batch[n_batch++] = m;
+        }
+
+        mount_points_run(batch, n_batch, mount_point_delete_loopback, NULL);
+
+        for (i = 0; i < n_batch; i++) {
+                m = batch[i];
+
+                if (m->result >= 0) {
+                        if (m->result > 0 && changed)
                                 *changed = true;
 
                         mount_point_free(head, m);
                 } else {
-                        log_warning_errno(errno, "Could not detach loopback %s: %m", m->path);
+                        log_warning_errno(m->result, "Could not detach loopback %s: %m", m->path);
                         n_failed++;
                 }
         }
@@ -475,18 +709,30 @@ static int loopback_points_list_detach(MountPoint **head, bool *changed) {
         return n_failed;
 }
 
+static int mount_point_delete_dm(MountPoint *m, void *userdata) {
+        return delete_dm(m->devnum);
+}
+
 static int dm_points_list_detach(MountPoint **head, bool *changed) {
-        MountPoint *m, *n;
+        _cleanup_free_ MountPoint **batch = NULL;
+        unsigned n_batch = 0, i;
         int n_failed = 0, k;
         struct stat root_st;
+        MountPoint *m;
 
         assert(head);
 
         k = lstat("/", &root_st);
 
-        LIST_FOREACH_SAFE(mount_point, m, n, *head) {
-                int r;
+        LIST_FOREACH(mount_point, m, *head)
+                n_batch++;
+
+        batch = new(MountPoint*, n_batch);
+        if (n_batch > 0 && !batch)
+                return -ENOMEM;
 
+        n_batch = 0;
+        LIST_FOREACH(mount_point, m, *head) {
                 if (k >= 0 &&
                     major(root_st.st_dev) != 0 &&
                     root_st.st_dev == m->devnum) {
@@ -495,14 +741,23 @@ static int dm_points_list_detach(MountPoint **head, bool *changed) {
                 }
 
                 log_info("Detaching DM %u:%u.", major(m->devnum), minor(m->devnum));
-                r = delete_dm(m->devnum);
-                if (r >= 0) {
+                batch[n_batch++] = m;
+        }
+
+        /* Devices stacked on each other fail with EBUSY here until
+         * the upper ones are gone, they are retried by the caller */
+        mount_points_run(batch, n_batch, mount_point_delete_dm, NULL);
+
+        for (i = 0; i < n_batch; i++) {
+                m = batch[i];
+
+                if (m->result >= 0) {
                         if (changed)
                                 *changed = true;
 
                         mount_point_free(head, m);
                 } else {
-                        log_warning_errno(errno, "Could not detach DM %s: %m", m->path);
+                        log_warning_errno(m->result, "Could not detach DM %s: %m", m->path);
                         n_failed++;
                 }
         }
@@ -520,6 +775,10 @@ int umount_all(bool *changed) {
         if (r < 0)
                 goto end;
 
+        r = mount_points_list_sort(&mp_list_head);
+        if (r < 0)
+                goto end;
+
         /* retry umount, until nothing can be umounted anymore */
         do {
                 umount_changed = false;
@@ -92,6 +92,8 @@ Unit *unit_new(Manager *m, size_t size) {
         u->unit_file_preset = -1;
         u->on_failure_job_mode = JOB_REPLACE;
         u->cgroup_inotify_wd = -1;
+        u->sampled_memory_current = u->sampled_tasks_current = (uint64_t) -1;
+        u->sampled_cpu_usage = (nsec_t) -1;
 
         RATELIMIT_INIT(u->auto_stop_ratelimit, 10 * USEC_PER_SEC, 16);
 
@@ -354,6 +356,9 @@ void unit_add_to_gc_queue(Unit *u) {
         if (unit_check_gc(u))
                 return;
 
+        if (u->manager->n_in_gc_queue == 0)
+                u->manager->gc_queue_timestamp = now(CLOCK_MONOTONIC);
+
         LIST_PREPEND(gc_queue, u->manager->gc_queue, u);
         u->in_gc_queue = true;
 
@@ -378,25 +383,38 @@ void unit_add_to_dbus_queue(Unit *u) {
         u->in_dbus_queue = true;
 }
 
-static void bidi_set_free(Unit *u, Set *s) {
-        Iterator i;
-        Unit *other;
+static void unit_update_referenced_by(Unit *u, unsigned old_mask, unsigned new_mask) {
+        bool had, has;
 
         assert(u);
 
-        /* Frees the set and makes sure we are dropped from the
-         * inverse pointers */
+        had = old_mask & UNIT_DEPENDENCY_MASK(UNIT_REFERENCED_BY);
+        has = new_mask & UNIT_DEPENDENCY_MASK(UNIT_REFERENCED_BY);
 
-        SET_FOREACH(other, s, i) {
-                UnitDependency d;
+        if (!had && has)
+                u->n_referenced_by++;
+        else if (had && !has) {
+                assert(u->n_referenced_by > 0);
+                u->n_referenced_by--;
+        }
+}
 
-                for (d = 0; d < _UNIT_DEPENDENCY_MAX; d++)
-                        set_remove(other->dependencies[d], u);
+static void unit_free_dependencies(Unit *u) {
+        Iterator i;
+        Unit *other;
+        void *v;
 
+        assert(u);
+
+        /* Frees the dependencies and makes sure we are dropped from
+         * the inverse pointers */
+
+        HASHMAP_FOREACH_KEY(v, other, u->dependencies, i) {
+                unit_update_referenced_by(other, PTR_TO_UINT(hashmap_remove(other->dependencies, u)), 0);
                 unit_add_to_gc_queue(other);
         }
 
-        set_free(s);
+        u->dependencies = hashmap_free(u->dependencies);
 }
 
 static void unit_remove_transient(Unit *u) {
@@ -476,7 +494,6 @@ static void unit_done(Unit *u) {
 }
 
 void unit_free(Unit *u) {
-        UnitDependency d;
         Iterator i;
         char *t;
 
@@ -508,8 +525,7 @@ void unit_free(Unit *u) {
                 job_free(j);
         }
 
-        for (d = 0; d < _UNIT_DEPENDENCY_MAX; d++)
-                bidi_set_free(u, u->dependencies[d]);
+        unit_free_dependencies(u);
 
         if (u->type != _UNIT_TYPE_INVALID)
                 LIST_REMOVE(units_by_type, u->manager->units_by_type[u->type], u);
@@ -531,6 +547,9 @@ void unit_free(Unit *u) {
         if (u->in_cgroup_queue)
                 LIST_REMOVE(cgroup_queue, u->manager->cgroup_queue, u);
 
+        if (u->in_cgroup_empty_queue)
+                LIST_REMOVE(cgroup_empty_queue, u->manager->cgroup_empty_queue, u);
+
         unit_release_cgroup(u);
 
         (void) manager_update_failed_units(u->manager, u, false);
@@ -538,8 +557,8 @@ void unit_free(Unit *u) {
 
         free(u->description);
         strv_free(u->documentation);
-        free(u->fragment_path);
-        free(u->source_path);
+        manager_release_string(u->manager, u->fragment_path);
+        manager_release_string(u->manager, u->source_path);
         strv_free(u->dropin_paths);
         free(u->instance);
 
@@ -622,68 +641,98 @@ static int merge_names(Unit *u, Unit *other) {
         return 0;
 }
 
-static int reserve_dependencies(Unit *u, Unit *other, UnitDependency d) {
+static int reserve_dependencies(Unit *u, Unit *other) {
         unsigned n_reserve;
 
         assert(u);
         assert(other);
-        assert(d < _UNIT_DEPENDENCY_MAX);
 
         /*
-         * If u does not have this dependency set allocated, there is no need
-         * to reserve anything. In that case other's set will be transferred
-         * as a whole to u by complete_move().
+         * If u does not have any dependencies allocated, there is no need
+         * to reserve anything. In that case other's hashmap will be
+         * transferred as a whole to u by merge_dependencies().
          */
-        if (!u->dependencies[d])
+        if (!u->dependencies)
                 return 0;
 
         /* merge_dependencies() will skip a u-on-u dependency */
-        n_reserve = set_size(other->dependencies[d]) - !!set_get(other->dependencies[d], u);
+        n_reserve = hashmap_size(other->dependencies) - !!hashmap_get(other->dependencies, u);
 
-        return set_reserve(u->dependencies[d], n_reserve);
+        return hashmap_reserve(u->dependencies, n_reserve);
 }
 
-static void merge_dependencies(Unit *u, Unit *other, const char *other_id, UnitDependency d) {
+static void warn_about_dependency_mask(Unit *u, const char *other_id, unsigned mask) {
+        UnitDependency d;
+
+        for (d = 0; d < _UNIT_DEPENDENCY_MAX; d++)
+                if (mask & UNIT_DEPENDENCY_MASK(d))
+                        maybe_warn_about_dependency(u, other_id, d);
+}
+
+static void merge_dependencies(Unit *u, Unit *other, const char *other_id) {
         Iterator i;
         Unit *back;
+        void *v;
         int r;
 
         assert(u);
         assert(other);
-        assert(d < _UNIT_DEPENDENCY_MAX);
 
         /* Fix backwards pointers */
-        SET_FOREACH(back, other->dependencies[d], i) {
-                UnitDependency k;
-
-                for (k = 0; k < _UNIT_DEPENDENCY_MAX; k++) {
-                        /* Do not add dependencies between u and itself */
-                        if (back == u) {
-                                if (set_remove(back->dependencies[k], other))
-                                        maybe_warn_about_dependency(u, other_id, k);
-                        } else {
-                                r = set_remove_and_put(back->dependencies[k], other, u);
-                                if (r == -EEXIST)
-                                        set_remove(back->dependencies[k], other);
-                                else
-                                        assert(r >= 0 || r == -ENOENT);
-                        }
+        HASHMAP_FOREACH_KEY(v, back, other->dependencies, i) {
+                unsigned mask, old;
+
+                /* Do not add dependencies between u and itself */
+                if (back == u) {
+                        mask = PTR_TO_UINT(hashmap_remove(back->dependencies, other));
+                        warn_about_dependency_mask(u, other_id, mask);
+                        continue;
+                }
+
+                mask = unit_dependency_mask(back, other);
+                if (mask == 0)
+                        continue;
+
+                old = unit_dependency_mask(back, u);
+                if (old != 0) {
+                        hashmap_remove(back->dependencies, other);
+                        assert_se(hashmap_update(back->dependencies, u, UINT_TO_PTR(old | mask)) >= 0);
+                } else {
+                        r = hashmap_remove_and_put(back->dependencies, other, u, UINT_TO_PTR(mask));
+                        assert(r >= 0);
                 }
         }
 
         /* Also do not move dependencies on u to itself */
-        back = set_remove(other->dependencies[d], u);
-        if (back)
-                maybe_warn_about_dependency(u, other_id, d);
+        warn_about_dependency_mask(u, other_id, PTR_TO_UINT(hashmap_remove(other->dependencies, u)));
+
+        if (!u->dependencies) {
+                u->dependencies = other->dependencies;
+                other->dependencies = NULL;
+        } else {
+                /* The puts cannot fail. The caller must have performed a reservation. */
+                HASHMAP_FOREACH_KEY(v, back, other->dependencies, i) {
+                        unsigned old;
+
+                        old = unit_dependency_mask(u, back);
+                        if (old != 0)
+                                assert_se(hashmap_update(u->dependencies, back, UINT_TO_PTR(old | PTR_TO_UINT(v))) >= 0);
+                        else
+                                assert_se(hashmap_put(u->dependencies, back, v) > 0);
+                }
 
-        /* The move cannot fail. The caller must have performed a reservation. */
-        assert_se(complete_move(&u->dependencies[d], &other->dependencies[d]) == 0);
+                other->dependencies = hashmap_free(other->dependencies);
+        }
 
-        other->dependencies[d] = set_free(other->dependencies[d]);
+        /* Merging is rare, hence simply recount the references of
+         * everything involved */
+        u->n_referenced_by = unit_count_dependencies(u, UNIT_REFERENCED_BY);
+        HASHMAP_FOREACH_KEY(v, back, u->dependencies, i)
+                back->n_referenced_by = unit_count_dependencies(back, UNIT_REFERENCED_BY);
+        other->n_referenced_by = 0;
 }
 
 int unit_merge(Unit *u, Unit *other) {
-        UnitDependency d;
         const char *other_id = NULL;
         int r;
 
@@ -720,15 +769,13 @@ int unit_merge(Unit *u, Unit *other) {
                 other_id = strdupa(other->id);
 
         /* Make reservations to ensure merge_dependencies() won't fail */
-        for (d = 0; d < _UNIT_DEPENDENCY_MAX; d++) {
-                r = reserve_dependencies(u, other, d);
-                /*
-                 * We don't rollback reservations if we fail. We don't have
-                 * a way to undo reservations. A reservation is not a leak.
-                 */
-                if (r < 0)
-                        return r;
-        }
+        r = reserve_dependencies(u, other);
+        /*
+         * We don't rollback reservations if we fail. We don't have
+         * a way to undo reservations. A reservation is not a leak.
+         */
+        if (r < 0)
+                return r;
 
         /* Merge names */
         r = merge_names(u, other);
@@ -740,8 +787,7 @@ int unit_merge(Unit *u, Unit *other) {
                 unit_ref_set(other->refs, u);
 
         /* Merge dependencies */
-        for (d = 0; d < _UNIT_DEPENDENCY_MAX; d++)
-                merge_dependencies(u, other, other_id, d);
+        merge_dependencies(u, other, other_id);
 
         other->load_state = UNIT_MERGED;
         other->merged_into = u;
@@ -970,7 +1016,7 @@ void unit_dump(Unit *u, FILE *f, const char *prefix) {
         for (d = 0; d < _UNIT_DEPENDENCY_MAX; d++) {
                 Unit *other;
 
-                SET_FOREACH(other, u->dependencies[d], i)
+                UNIT_FOREACH_DEPENDENCY(other, u, d, i)
                         fprintf(f, "%s\t%s: %s\n", prefix, unit_dependency_to_string(d), other->id);
         }
 
@@ -1088,7 +1134,7 @@ int unit_add_default_target_dependency(Unit *u, Unit *target) {
                 return 0;
 
         /* Don't create loops */
-        if (set_get(target->dependencies[UNIT_BEFORE], u))
+        if (unit_has_dependency(target, UNIT_BEFORE, u))
                 return 0;
 
         return unit_add_dependency(target, UNIT_AFTER, u, true);
@@ -1113,7 +1159,7 @@ static int unit_add_target_dependencies(Unit *u) {
         assert(u);
 
         for (k = 0; k < ELEMENTSOF(deps); k++)
-                SET_FOREACH(target, u->dependencies[deps[k]], i) {
+                UNIT_FOREACH_DEPENDENCY(target, u, deps[k], i) {
                         r = unit_add_default_target_dependency(u, target);
                         if (r < 0)
                                 return r;
@@ -1239,7 +1285,7 @@ int unit_load(Unit *u) {
                 if (r < 0)
                         goto fail;
 
-                if (u->on_failure_job_mode == JOB_ISOLATE && set_size(u->dependencies[UNIT_ON_FAILURE]) > 1) {
+                if (u->on_failure_job_mode == JOB_ISOLATE && unit_count_dependencies(u, UNIT_ON_FAILURE) > 1) {
                         log_unit_error(u, "More than one OnFailure= dependencies specified but OnFailureJobMode=isolate set. Refusing.");
                         r = -EINVAL;
                         goto fail;
@@ -1618,7 +1664,7 @@ static void unit_check_unneeded(Unit *u) {
                 return;
 
         for (j = 0; j < ELEMENTSOF(needed_dependencies); j++)
-                SET_FOREACH(other, u->dependencies[needed_dependencies[j]], i)
+                UNIT_FOREACH_DEPENDENCY(other, u, needed_dependencies[j], i)
                         if (unit_active_or_pending(other))
                                 return;
 
@@ -1652,7 +1698,7 @@ static void unit_check_binds_to(Unit *u) {
         if (unit_active_state(u) != UNIT_ACTIVE)
                 return;
 
-        SET_FOREACH(other, u->dependencies[UNIT_BINDS_TO], i) {
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_BINDS_TO, i) {
                 if (other->job)
                         continue;
 
@@ -1690,31 +1736,31 @@ static void retroactively_start_dependencies(Unit *u) {
         assert(u);
         assert(UNIT_IS_ACTIVE_OR_ACTIVATING(unit_active_state(u)));
 
-        SET_FOREACH(other, u->dependencies[UNIT_REQUIRES], i)
-                if (!set_get(u->dependencies[UNIT_AFTER], other) &&
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_REQUIRES, i)
+                if (!unit_has_dependency(u, UNIT_AFTER, other) &&
                     !UNIT_IS_ACTIVE_OR_ACTIVATING(unit_active_state(other)))
                         manager_add_job(u->manager, JOB_START, other, JOB_REPLACE, true, NULL, NULL);
 
-        SET_FOREACH(other, u->dependencies[UNIT_BINDS_TO], i)
-                if (!set_get(u->dependencies[UNIT_AFTER], other) &&
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_BINDS_TO, i)
+                if (!unit_has_dependency(u, UNIT_AFTER, other) &&
                     !UNIT_IS_ACTIVE_OR_ACTIVATING(unit_active_state(other)))
                         manager_add_job(u->manager, JOB_START, other, JOB_REPLACE, true, NULL, NULL);
 
-        SET_FOREACH(other, u->dependencies[UNIT_REQUIRES_OVERRIDABLE], i)
-                if (!set_get(u->dependencies[UNIT_AFTER], other) &&
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_REQUIRES_OVERRIDABLE, i)
+                if (!unit_has_dependency(u, UNIT_AFTER, other) &&
                     !UNIT_IS_ACTIVE_OR_ACTIVATING(unit_active_state(other)))
                         manager_add_job(u->manager, JOB_START, other, JOB_FAIL, false, NULL, NULL);
 
-        SET_FOREACH(other, u->dependencies[UNIT_WANTS], i)
-                if (!set_get(u->dependencies[UNIT_AFTER], other) &&
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_WANTS, i)
+                if (!unit_has_dependency(u, UNIT_AFTER, other) &&
                     !UNIT_IS_ACTIVE_OR_ACTIVATING(unit_active_state(other)))
                         manager_add_job(u->manager, JOB_START, other, JOB_FAIL, false, NULL, NULL);
 
-        SET_FOREACH(other, u->dependencies[UNIT_CONFLICTS], i)
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_CONFLICTS, i)
                 if (!UNIT_IS_INACTIVE_OR_DEACTIVATING(unit_active_state(other)))
                         manager_add_job(u->manager, JOB_STOP, other, JOB_REPLACE, true, NULL, NULL);
 
-        SET_FOREACH(other, u->dependencies[UNIT_CONFLICTED_BY], i)
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_CONFLICTED_BY, i)
                 if (!UNIT_IS_INACTIVE_OR_DEACTIVATING(unit_active_state(other)))
                         manager_add_job(u->manager, JOB_STOP, other, JOB_REPLACE, true, NULL, NULL);
 }
@@ -1727,7 +1773,7 @@ static void retroactively_stop_dependencies(Unit *u) {
         assert(UNIT_IS_INACTIVE_OR_DEACTIVATING(unit_active_state(u)));
 
         /* Pull down units which are bound to us recursively if enabled */
-        SET_FOREACH(other, u->dependencies[UNIT_BOUND_BY], i)
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_BOUND_BY, i)
                 if (!UNIT_IS_INACTIVE_OR_DEACTIVATING(unit_active_state(other)))
                         manager_add_job(u->manager, JOB_STOP, other, JOB_REPLACE, true, NULL, NULL);
 }
@@ -1740,22 +1786,22 @@ static void check_unneeded_dependencies(Unit *u) {
         assert(UNIT_IS_INACTIVE_OR_DEACTIVATING(unit_active_state(u)));
 
         /* Garbage collect services that might not be needed anymore, if enabled */
-        SET_FOREACH(other, u->dependencies[UNIT_REQUIRES], i)
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_REQUIRES, i)
                 if (!UNIT_IS_INACTIVE_OR_DEACTIVATING(unit_active_state(other)))
                         unit_check_unneeded(other);
-        SET_FOREACH(other, u->dependencies[UNIT_REQUIRES_OVERRIDABLE], i)
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_REQUIRES_OVERRIDABLE, i)
                 if (!UNIT_IS_INACTIVE_OR_DEACTIVATING(unit_active_state(other)))
                         unit_check_unneeded(other);
-        SET_FOREACH(other, u->dependencies[UNIT_WANTS], i)
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_WANTS, i)
                 if (!UNIT_IS_INACTIVE_OR_DEACTIVATING(unit_active_state(other)))
                         unit_check_unneeded(other);
-        SET_FOREACH(other, u->dependencies[UNIT_REQUISITE], i)
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_REQUISITE, i)
                 if (!UNIT_IS_INACTIVE_OR_DEACTIVATING(unit_active_state(other)))
                         unit_check_unneeded(other);
-        SET_FOREACH(other, u->dependencies[UNIT_REQUISITE_OVERRIDABLE], i)
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_REQUISITE_OVERRIDABLE, i)
                 if (!UNIT_IS_INACTIVE_OR_DEACTIVATING(unit_active_state(other)))
                         unit_check_unneeded(other);
-        SET_FOREACH(other, u->dependencies[UNIT_BINDS_TO], i)
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_BINDS_TO, i)
                 if (!UNIT_IS_INACTIVE_OR_DEACTIVATING(unit_active_state(other)))
                         unit_check_unneeded(other);
 }
@@ -1766,12 +1812,12 @@ void unit_start_on_failure(Unit *u) {
 
         assert(u);
 
-        if (set_size(u->dependencies[UNIT_ON_FAILURE]) <= 0)
+        if (unit_count_dependencies(u, UNIT_ON_FAILURE) <= 0)
                 return;
 
         log_unit_info(u, "Triggering OnFailure= dependencies.");
 
-        SET_FOREACH(other, u->dependencies[UNIT_ON_FAILURE], i) {
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_ON_FAILURE, i) {
                 int r;
 
                 r = manager_add_job(u->manager, JOB_START, other, u->on_failure_job_mode, true, NULL, NULL);
@@ -1786,7 +1832,7 @@ void unit_trigger_notify(Unit *u) {
 
         assert(u);
 
-        SET_FOREACH(other, u->dependencies[UNIT_TRIGGERED_BY], i)
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_TRIGGERED_BY, i)
                 if (UNIT_VTABLE(other)->trigger_notify)
                         UNIT_VTABLE(other)->trigger_notify(other, u);
 }
@@ -2118,6 +2164,63 @@ static void maybe_warn_about_dependency(Unit *u, const char *other, UnitDependen
                 log_unit_warning(u, "Dependency %s=%s dropped, merged into %s", unit_dependency_to_string(dependency), strna(other), u->id);
 }
 
+Unit *unit_first_dependency(Unit *u, UnitDependency d) {
+        Unit *other;
+        Iterator i;
+
+        assert(u);
+
+        UNIT_FOREACH_DEPENDENCY(other, u, d, i)
+                return other;
+
+        return NULL;
+}
+
+unsigned unit_count_dependencies(Unit *u, UnitDependency d) {
+        unsigned n = 0;
+        Unit *other;
+        Iterator i;
+
+        assert(u);
+
+        UNIT_FOREACH_DEPENDENCY(other, u, d, i)
+                n++;
+
+        return n;
+}
+
+static int unit_add_dependency_mask(Unit *u, Unit *other, unsigned mask, unsigned *ret_old) {
+        unsigned old;
+        int r;
+
+        assert(u);
+        assert(other);
+
+        old = unit_dependency_mask(u, other);
+        if (ret_old)
+                *ret_old = old;
+
+        if ((old & mask) == mask)
+                return 0;
+
+        /* Updating an existing entry never allocates, hence this is
+         * safe while iterating over the dependencies */
+        if (old != 0)
+                r = hashmap_update(u->dependencies, other, UINT_TO_PTR(old | mask));
+        else {
+                r = hashmap_ensure_allocated(&u->dependencies, NULL);
+                if (r < 0)
+                        return r;
+
+                r = hashmap_put(u->dependencies, other, UINT_TO_PTR(mask));
+        }
+        if (r < 0)
+                return r;
+
+        unit_update_referenced_by(u, old, old | mask);
+        return r;
+}
+
 int unit_add_dependency(Unit *u, UnitDependency d, Unit *other, bool add_reference) {
 
         static const UnitDependency inverse_table[_UNIT_DEPENDENCY_MAX] = {
@@ -2148,8 +2251,9 @@ int unit_add_dependency(Unit *u, UnitDependency d, Unit *other, bool add_referen
                 [UNIT_RELOAD_PROPAGATED_FROM] = UNIT_PROPAGATES_RELOAD_TO,
                 [UNIT_JOINS_NAMESPACE_OF] = UNIT_JOINS_NAMESPACE_OF,
         };
-        int r, q = 0, v = 0, w = 0;
+        unsigned mask, inverse_mask, old;
         Unit *orig_u = u, *orig_other = other;
+        int r;
 
         assert(u);
         assert(d >= 0 && d < _UNIT_DEPENDENCY_MAX);
@@ -2165,64 +2269,35 @@ int unit_add_dependency(Unit *u, UnitDependency d, Unit *other, bool add_referen
                 return 0;
         }
 
-        r = set_ensure_allocated(&u->dependencies[d], NULL);
-        if (r < 0)
-                return r;
+        mask = UNIT_DEPENDENCY_MASK(d);
+        inverse_mask = 0;
 
-        if (inverse_table[d] != _UNIT_DEPENDENCY_INVALID) {
-                r = set_ensure_allocated(&other->dependencies[inverse_table[d]], NULL);
-                if (r < 0)
-                        return r;
-        }
+        if (inverse_table[d] != _UNIT_DEPENDENCY_INVALID && inverse_table[d] != d)
+                inverse_mask |= UNIT_DEPENDENCY_MASK(inverse_table[d]);
 
         if (add_reference) {
-                r = set_ensure_allocated(&u->dependencies[UNIT_REFERENCES], NULL);
-                if (r < 0)
-                        return r;
-
-                r = set_ensure_allocated(&other->dependencies[UNIT_REFERENCED_BY], NULL);
-                if (r < 0)
-                        return r;
+                mask |= UNIT_DEPENDENCY_MASK(UNIT_REFERENCES);
+                inverse_mask |= UNIT_DEPENDENCY_MASK(UNIT_REFERENCED_BY);
         }
 
-        q = set_put(u->dependencies[d], other);
-        if (q < 0)
-                return q;
-
-        if (inverse_table[d] != _UNIT_DEPENDENCY_INVALID && inverse_table[d] != d) {
-                v = set_put(other->dependencies[inverse_table[d]], u);
-                if (v < 0) {
-                        r = v;
-                        goto fail;
-                }
-        }
+        r = unit_add_dependency_mask(u, other, mask, &old);
+        if (r < 0)
+                return r;
 
-        if (add_reference) {
-                w = set_put(u->dependencies[UNIT_REFERENCES], other);
-                if (w < 0) {
-                        r = w;
-                        goto fail;
-                }
+        r = unit_add_dependency_mask(other, u, inverse_mask, NULL);
+        if (r < 0) {
+                /* Restore what we had before */
+                unit_update_referenced_by(u, old | mask, old);
+                if (old == 0)
+                        hashmap_remove(u->dependencies, other);
+                else
+                        assert_se(hashmap_update(u->dependencies, other, UINT_TO_PTR(old)) >= 0);
 
-                r = set_put(other->dependencies[UNIT_REFERENCED_BY], u);
-                if (r < 0)
-                        goto fail;
+                return r;
         }
 
         unit_add_to_dbus_queue(u);
         return 0;
-
-fail:
-        if (q > 0)
-                set_remove(u->dependencies[d], other);
-
-        if (v > 0)
-                set_remove(other->dependencies[inverse_table[d]], u);
-
-        if (w > 0)
-                set_remove(u->dependencies[UNIT_REFERENCES], other);
-
-        return r;
 }
 
 int unit_add_two_dependencies(Unit *u, UnitDependency d, UnitDependency e, Unit *other, bool add_reference) {
@@ -2604,6 +2679,9 @@ int unit_serialize(Unit *u, FILE *f, FDSet *fds, bool serialize_jobs) {
                 unit_serialize_item(u, f, "cgroup", u->cgroup_path);
         unit_serialize_item(u, f, "cgroup-realized", yes_no(u->cgroup_realized));
 
+        if (u->cgroup_applied_digest != 0)
+                unit_serialize_item_format(u, f, "cgroup-applied-digest", "%" PRIu64, u->cgroup_applied_digest);
+
         if (u->cgroup_netclass_id)
                 unit_serialize_item_format(u, f, "netclass-id", "%" PRIu32, u->cgroup_netclass_id);
 
@@ -2793,6 +2871,13 @@ int unit_deserialize(Unit *u, FILE *f, FDSet *fds) {
                         else
                                 u->cgroup_realized = b;
 
+                        continue;
+                } else if (streq(l, "cgroup-applied-digest")) {
+
+                        r = safe_atou64(v, &u->cgroup_applied_digest);
+                        if (r < 0)
+                                log_unit_debug(u, "Failed to parse cgroup applied digest %s, ignoring.", v);
+
                         continue;
                 } else if (streq(l, "netclass-id")) {
                         r = safe_atou32(v, &u->cgroup_netclass_id);
@@ -3453,7 +3538,7 @@ int unit_make_transient(Unit *u) {
         u->load_state = UNIT_STUB;
         u->load_error = 0;
         u->transient = true;
-        u->fragment_path = mfree(u->fragment_path);
+        u->fragment_path = manager_release_string(u->manager, u->fragment_path);
 
         return 0;
 }
@@ -3660,7 +3745,7 @@ int unit_setup_exec_runtime(Unit *u) {
                 return 0;
 
         /* Try to get it from somebody else */
-        SET_FOREACH(other, u->dependencies[UNIT_JOINS_NAMESPACE_OF], i) {
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_JOINS_NAMESPACE_OF, i) {
 
                 *rt = unit_get_exec_runtime(other);
                 if (*rt) {
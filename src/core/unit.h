@@ -30,6 +30,7 @@ typedef struct UnitVTable UnitVTable;
 typedef enum UnitActiveState UnitActiveState;
 typedef struct UnitRef UnitRef;
 typedef struct UnitStatusMessageFormats UnitStatusMessageFormats;
+typedef struct UnitBusState UnitBusState;
 
 #include "list.h"
 #include "condition.h"
@@ -83,6 +84,26 @@ struct UnitRef {
         LIST_FIELDS(UnitRef, refs);
 };
 
+struct UnitBusState {
+        /* The generic unit properties as last announced on the bus,
+         * so that PropertiesChanged only carries what changed since */
+
+        UnitActiveState active_state;
+        const char *sub_state;
+
+        dual_timestamp inactive_exit_timestamp;
+        dual_timestamp active_enter_timestamp;
+        dual_timestamp active_exit_timestamp;
+        dual_timestamp inactive_enter_timestamp;
+
+        uint32_t job_id;
+
+        bool condition_result;
+        bool assert_result;
+        dual_timestamp condition_timestamp;
+        dual_timestamp assert_timestamp;
+};
+
 struct Unit {
         Manager *manager;
 
@@ -94,7 +115,16 @@ struct Unit {
         char *instance;
 
         Set *names;
-        Set *dependencies[_UNIT_DEPENDENCY_MAX];
+
+        /* Maps each unit we have any dependency on to a mask of
+         * UNIT_DEPENDENCY_MASK() bits of the dependency types. Use
+         * UNIT_FOREACH_DEPENDENCY() and friends to access it. */
+        Hashmap *dependencies;
+
+        /* The number of units with UNIT_REFERENCED_BY in the above,
+         * so that GC can recognize unreferenced units without walking
+         * the dependencies */
+        unsigned n_referenced_by;
 
         char **requires_mounts_for;
 
@@ -138,6 +168,8 @@ struct Unit {
         dual_timestamp active_exit_timestamp;
         dual_timestamp inactive_enter_timestamp;
 
+        UnitBusState sent_bus_state;
+
         UnitRef slice;
 
         /* Per type list */
@@ -161,6 +193,9 @@ struct Unit {
         /* CGroup realize members queue */
         LIST_FIELDS(Unit, cgroup_queue);
 
+        /* CGroup empty check queue */
+        LIST_FIELDS(Unit, cgroup_empty_queue);
+
         /* Units with the same CGroup netclass */
         LIST_FIELDS(Unit, cgroup_netclass);
 
@@ -185,6 +220,11 @@ struct Unit {
         /* Where the cpuacct.usage cgroup counter was at the time the unit was started */
         nsec_t cpuacct_usage_base;
 
+        /* Accounting values as of the last periodic sample, (uint64_t) -1 if unknown */
+        uint64_t sampled_memory_current;
+        uint64_t sampled_tasks_current;
+        nsec_t sampled_cpu_usage;
+
         /* Counterparts in the cgroup filesystem */
         char *cgroup_path;
         CGroupMask cgroup_realized_mask;
@@ -192,6 +232,9 @@ struct Unit {
         CGroupMask cgroup_members_mask;
         int cgroup_inotify_wd;
 
+        /* Digest of the attributes last written to the cgroup, 0 if unknown */
+        uint64_t cgroup_applied_digest;
+
         uint32_t cgroup_netclass_id;
 
         /* How to start OnFailure units */
@@ -230,6 +273,7 @@ struct Unit {
         bool in_cleanup_queue:1;
         bool in_gc_queue:1;
         bool in_cgroup_queue:1;
+        bool in_cgroup_empty_queue:1;
 
         bool sent_dbus_new_signal:1;
 
@@ -449,7 +493,40 @@ extern const UnitVTable * const unit_vtable[_UNIT_TYPE_MAX];
 #define UNIT_HAS_CGROUP_CONTEXT(u) (UNIT_VTABLE(u)->cgroup_context_offset > 0)
 #define UNIT_HAS_KILL_CONTEXT(u) (UNIT_VTABLE(u)->kill_context_offset > 0)
 
-#define UNIT_TRIGGER(u) ((Unit*) set_first((u)->dependencies[UNIT_TRIGGERS]))
+#define UNIT_DEPENDENCY_MASK(d) (1U << (d))
+assert_cc(_UNIT_DEPENDENCY_MAX <= sizeof(unsigned) * 8);
+
+static inline unsigned unit_dependency_mask(Unit *u, Unit *other) {
+        return PTR_TO_UINT(hashmap_get(u->dependencies, other));
+}
+
+static inline bool unit_has_dependency(Unit *u, UnitDependency d, Unit *other) {
+        return unit_dependency_mask(u, other) & UNIT_DEPENDENCY_MASK(d);
+}
+
+static inline bool unit_iterate_dependencies(Unit *u, UnitDependency d, Iterator *i, Unit **ret) {
+        const void *k;
+        void *v;
+
+        while (hashmap_iterate(u->dependencies, i, &v, &k))
+                if (PTR_TO_UINT(v) & UNIT_DEPENDENCY_MASK(d)) {
+                        *ret = (Unit*) k;
+                        return true;
+                }
+
+        *ret = NULL;
+        return false;
+}
+
+/* It is safe to add dependencies on units that are already
+ * dependencies of any type while iterating, but not on new ones. */
+#define UNIT_FOREACH_DEPENDENCY(other, u, d, i) \
+        for ((i) = ITERATOR_FIRST; unit_iterate_dependencies((u), (d), &(i), &(other)); )
+
+Unit *unit_first_dependency(Unit *u, UnitDependency d);
+unsigned unit_count_dependencies(Unit *u, UnitDependency d);
+
+#define UNIT_TRIGGER(u) unit_first_dependency((u), UNIT_TRIGGERS)
 
 DEFINE_CAST(SERVICE, Service);
 DEFINE_CAST(SOCKET, Socket);
@@ -33,6 +33,8 @@
 #include "sd-device.h"
 
 #include "util.h"
+#include "strv.h"
+#include "mkdir.h"
 #include "process-util.h"
 #include "signal-util.h"
 #include "special.h"
@@ -43,6 +45,11 @@
 #include "path-util.h"
 #include "socket-util.h"
 
+#define FSCK_LOCK_DIR "/run/systemd/fsck"
+
+/* How deep to follow stacked block devices (dm on md on ...) */
+#define SLAVES_DEPTH_MAX 8
+
 /* exit codes as defined in fsck(8) */
 enum {
         FSCK_SUCCESS = 0,
@@ -268,9 +275,153 @@ static int fsck_progress_socket(void) {
         return fd;
 }
 
+static int collect_spindles(sd_device *dev, char ***disks, unsigned depth) {
+        _cleanup_closedir_ DIR *d = NULL;
+        const char *devtype, *syspath, *sysname, *rotational, *slaves;
+        sd_device *whole = dev;
+        struct dirent *de;
+        bool leaf = true;
+        int r;
+
+        assert(dev);
+        assert(disks);
+
+        if (depth > SLAVES_DEPTH_MAX)
+                return -ELOOP;
+
+        /* Partitions live on the disk they are part of */
+        if (sd_device_get_devtype(dev, &devtype) >= 0 && streq(devtype, "partition")) {
+                r = sd_device_get_parent_with_subsystem_devtype(dev, "block", "disk", &whole);
+                if (r < 0)
+                        return r;
+        }
+
+        r = sd_device_get_syspath(whole, &syspath);
+        if (r < 0)
+                return r;
+
+        /* Device mapper, MD and friends list the devices they are
+         * built from in slaves/, follow them down to the disks */
+        slaves = strjoina(syspath, "/slaves");
+        d = opendir(slaves);
+        if (d) {
+                FOREACH_DIRENT(de, d, return -errno) {
+                        _cleanup_device_unref_ sd_device *slave = NULL;
+                        const char *p;
+
+                        p = strjoina(slaves, "/", de->d_name);
+                        r = sd_device_new_from_syspath(&slave, p);
+                        if (r < 0)
+                                return r;
+
+                        r = collect_spindles(slave, disks, depth + 1);
+                        if (r < 0)
+                                return r;
+
+                        leaf = false;
+                }
+        } else if (errno != ENOENT)
+                return -errno;
+
+        if (!leaf)
+                return 0;
+
+        /* Seeking is only expensive on rotating media, other disks
+         * can well be checked in parallel */
+        if (sd_device_get_sysattr_value(whole, "queue/rotational", &rotational) >= 0 &&
+            streq(rotational, "0"))
+                return 0;
+
+        r = sd_device_get_sysname(whole, &sysname);
+        if (r < 0)
+                return r;
+
+        if (strv_contains(*disks, sysname))
+                return 0;
+
+        return strv_extend(disks, sysname);
+}
+
+static int lock_spindles(sd_device *dev, int **ret_fds, unsigned *ret_n_fds) {
+        _cleanup_strv_free_ char **disks = NULL;
+        _cleanup_free_ int *fds = NULL;
+        unsigned n_fds = 0, i;
+        char **disk;
+        int r;
+
+        assert(dev);
+        assert(ret_fds);
+        assert(ret_n_fds);
+
+        /* Checks on different physical disks may run in parallel,
+         * but checks on the same rotating disk are serialized, also
+         * when the file systems are on different partitions or on
+         * stacked devices sharing the disk. Instances coordinate
+         * via lock files named after the disks, which are always
+         * taken in the same order to avoid deadlocks. */
+
+        r = collect_spindles(dev, &disks, 0);
+        if (r < 0)
+                return r;
+
+        strv_sort(disks);
+
+        fds = new(int, strv_length(disks));
+        if (!fds && !strv_isempty(disks))
+                return -ENOMEM;
+
+        r = mkdir_p(FSCK_LOCK_DIR, 0755);
+        if (r < 0)
+                return r;
+
+        STRV_FOREACH(disk, disks) {
+                const char *p;
+                int fd;
+
+                p = strjoina(FSCK_LOCK_DIR "/", *disk, ".lock");
+                fd = open(p, O_RDWR|O_CREAT|O_CLOEXEC|O_NOCTTY, 0600);
+                if (fd < 0) {
+                        r = -errno;
+                        goto fail;
+                }
+
+                if (flock(fd, LOCK_EX|LOCK_NB) < 0) {
+                        if (errno != EWOULDBLOCK) {
+                                r = -errno;
+                                safe_close(fd);
+                                goto fail;
+                        }
+
+                        log_info("Waiting for other file system checks on %s to finish.", *disk);
+
+                        if (flock(fd, LOCK_EX) < 0) {
+                                r = -errno;
+                                safe_close(fd);
+                                goto fail;
+                        }
+                }
+
+                fds[n_fds++] = fd;
+        }
+
+        *ret_fds = fds;
+        *ret_n_fds = n_fds;
+        fds = NULL;
+
+        return 0;
+
+fail:
+        for (i = 0; i < n_fds; i++)
+                safe_close(fds[i]);
+
+        return r;
+}
+
 int main(int argc, char *argv[]) {
         _cleanup_close_pair_ int progress_pipe[2] = { -1, -1 };
         _cleanup_device_unref_ sd_device *dev = NULL;
+        _cleanup_free_ int *lock_fds = NULL;
+        unsigned n_lock_fds = 0;
         const char *device, *type;
         bool root_directory;
         siginfo_t status;
@@ -374,6 +525,10 @@ int main(int argc, char *argv[]) {
                         log_warning_errno(r, "Couldn't detect if fsck.%s may be used for %s: %m", type, device);
         }
 
+        r = lock_spindles(dev, &lock_fds, &n_lock_fds);
+        if (r < 0)
+                log_warning_errno(r, "Failed to serialize with other file system checks on the same disk, ignoring: %m");
+
         if (arg_show_progress) {
                 if (pipe(progress_pipe) < 0) {
                         r = log_error_errno(errno, "pipe(): %m");
@@ -479,5 +634,7 @@ int main(int argc, char *argv[]) {
                 (void) touch("/run/systemd/quotacheck");
 
 finish:
+        close_many(lock_fds, n_lock_fds);
+
         return r < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
 }
@@ -250,7 +250,7 @@ static int tar_export_on_defer(sd_event_source *s, void *userdata) {
         return tar_export_process(i);
 }
 
-int tar_export_start(TarExport *e, const char *path, int fd, ImportCompressType compress) {
+int tar_export_start(TarExport *e, const char *path, int fd, ImportCompressType compress, bool btrfs_send, const char *parent) {
         _cleanup_close_ int sfd = -1;
         int r;
 
@@ -259,6 +259,7 @@ int tar_export_start(TarExport *e, const char *path, int fd, ImportCompressType
         assert(fd >= 0);
         assert(compress < _IMPORT_COMPRESS_TYPE_MAX);
         assert(compress != IMPORT_COMPRESS_UNKNOWN);
+        assert(!parent || btrfs_send);
 
         if (e->output_fd >= 0)
                 return -EBUSY;
@@ -270,6 +271,28 @@ int tar_export_start(TarExport *e, const char *path, int fd, ImportCompressType
         if (fstat(sfd, &e->st) < 0)
                 return -errno;
 
+        if (btrfs_send) {
+                r = btrfs_is_subvol(sfd);
+                if (r < 0)
+                        return r;
+                if (r == 0)
+                        return -EMEDIUMTYPE;
+        }
+
+        if (parent) {
+                _cleanup_close_ int pfd = -1;
+
+                pfd = open(parent, O_DIRECTORY|O_RDONLY|O_NOCTTY|O_CLOEXEC);
+                if (pfd < 0)
+                        return -errno;
+
+                r = btrfs_subvol_get_read_only_fd(pfd);
+                if (r < 0)
+                        return r;
+                if (r == 0)
+                        return -EROFS;
+        }
+
         r = fd_nonblock(fd, true);
         if (r < 0)
                 return r;
@@ -283,21 +306,30 @@ int tar_export_start(TarExport *e, const char *path, int fd, ImportCompressType
         if (e->st.st_ino == 256) { /* might be a btrfs subvolume? */
                 BtrfsQuotaInfo q;
 
+                /* An incremental stream is only as large as the
+                 * changes, so the quota tells us nothing then */
                 r = btrfs_subvol_get_quota_fd(sfd, &q);
-                if (r >= 0)
+                if (r >= 0 && !parent)
                         e->quota_referenced = q.referenced;
 
                 e->temp_path = mfree(e->temp_path);
 
-                r = tempfn_random(path, NULL, &e->temp_path);
-                if (r < 0)
-                        return r;
-
-                /* Let's try to make a snapshot, if we can, so that the export is atomic */
-                r = btrfs_subvol_snapshot_fd(sfd, e->temp_path, BTRFS_SNAPSHOT_READ_ONLY|BTRFS_SNAPSHOT_RECURSIVE);
-                if (r < 0) {
-                        log_debug_errno(r, "Couldn't create snapshot %s of %s, not exporting atomically: %m", e->temp_path, path);
-                        e->temp_path = mfree(e->temp_path);
+                /* A read-only subvolume is sent as it is, so that it
+                 * can serve as parent for the next incremental export */
+                if (!btrfs_send || btrfs_subvol_get_read_only_fd(sfd) <= 0) {
+                        r = tempfn_random(path, NULL, &e->temp_path);
+                        if (r < 0)
+                                return r;
+
+                        /* Let's try to make a snapshot, if we can, so that the export is atomic */
+                        r = btrfs_subvol_snapshot_fd(sfd, e->temp_path, BTRFS_SNAPSHOT_READ_ONLY|BTRFS_SNAPSHOT_RECURSIVE);
+                        if (r < 0) {
+                                if (btrfs_send)
+                                        return log_error_errno(r, "Couldn't create snapshot %s of %s to send: %m", e->temp_path, path);
+
+                                log_debug_errno(r, "Couldn't create snapshot %s of %s, not exporting atomically: %m", e->temp_path, path);
+                                e->temp_path = mfree(e->temp_path);
+                        }
                 }
         }
 
@@ -316,7 +348,10 @@ int tar_export_start(TarExport *e, const char *path, int fd, ImportCompressType
         if (r < 0)
                 return r;
 
-        e->tar_fd = import_fork_tar_c(e->temp_path ?: e->path, &e->tar_pid);
+        if (btrfs_send)
+                e->tar_fd = import_fork_btrfs_send(e->temp_path ?: e->path, parent, &e->tar_pid);
+        else
+                e->tar_fd = import_fork_tar_c(e->temp_path ?: e->path, &e->tar_pid);
         if (e->tar_fd < 0) {
                 e->output_event_source = sd_event_source_unref(e->output_event_source);
                 return e->tar_fd;
@@ -33,6 +33,7 @@
 #include "export-raw.h"
 
 static ImportCompressType arg_compress = IMPORT_COMPRESS_UNKNOWN;
+static const char *arg_parent = NULL;
 
 static void determine_compression_from_filename(const char *p) {
 
@@ -50,6 +51,8 @@ static void determine_compression_from_filename(const char *p) {
                 arg_compress = IMPORT_COMPRESS_GZIP;
         else if (endswith(p, ".bz2"))
                 arg_compress = IMPORT_COMPRESS_BZIP2;
+        else if (endswith(p, ".zst"))
+                arg_compress = IMPORT_COMPRESS_ZSTD;
         else
                 arg_compress = IMPORT_COMPRESS_UNCOMPRESSED;
 }
@@ -73,11 +76,34 @@ static void on_tar_finished(TarExport *export, int error, void *userdata) {
 static int export_tar(int argc, char *argv[], void *userdata) {
         _cleanup_(tar_export_unrefp) TarExport *export = NULL;
         _cleanup_event_unref_ sd_event *event = NULL;
-        _cleanup_(image_unrefp) Image *image = NULL;
-        const char *path = NULL, *local = NULL;
+        _cleanup_(image_unrefp) Image *image = NULL, *parent_image = NULL;
+        const char *path = NULL, *local = NULL, *parent = NULL;
         _cleanup_close_ int open_fd = -1;
+        bool btrfs_send;
         int r, fd;
 
+        btrfs_send = streq(argv[0], "btrfs");
+
+        if (arg_parent) {
+                if (!btrfs_send) {
+                        log_error("--parent= is only supported for btrfs exports.");
+                        return -EINVAL;
+                }
+
+                if (machine_name_is_valid(arg_parent)) {
+                        r = image_find(arg_parent, &parent_image);
+                        if (r < 0)
+                                return log_error_errno(r, "Failed to look for machine %s: %m", arg_parent);
+                        if (r == 0) {
+                                log_error("Machine image %s not found.", arg_parent);
+                                return -ENOENT;
+                        }
+
+                        parent = parent_image->path;
+                } else
+                        parent = arg_parent;
+        }
+
         if (machine_name_is_valid(argv[1])) {
                 r = image_find(argv[1], &image);
                 if (r < 0)
@@ -101,7 +127,7 @@ static int export_tar(int argc, char *argv[], void *userdata) {
         if (path) {
                 open_fd = open(path, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC|O_NOCTTY, 0666);
                 if (open_fd < 0)
-                        return log_error_errno(errno, "Failed to open tar image for export: %m");
+                        return log_error_errno(errno, "Failed to open %s image for export: %m", btrfs_send ? "btrfs" : "tar");
 
                 fd = open_fd;
 
@@ -127,7 +153,11 @@ static int export_tar(int argc, char *argv[], void *userdata) {
         if (r < 0)
                 return log_error_errno(r, "Failed to allocate exporter: %m");
 
-        r = tar_export_start(export, local, fd, arg_compress);
+        r = tar_export_start(export, local, fd, arg_compress, btrfs_send, parent);
+        if (r == -EMEDIUMTYPE)
+                return log_error_errno(r, "Image %s is not a btrfs subvolume, cannot send it.", local);
+        if (r == -EROFS)
+                return log_error_errno(r, "Parent %s is not a read-only btrfs subvolume.", parent);
         if (r < 0)
                 return log_error_errno(r, "Failed to export image: %m");
 
@@ -224,10 +254,13 @@ static int help(int argc, char *argv[], void *userdata) {
                "Export container or virtual machine images.\n\n"
                "  -h --help                    Show this help\n"
                "     --version                 Show package version\n"
-               "     --format=FORMAT           Select format\n\n"
+               "     --format=FORMAT           Select format\n"
+               "     --parent=NAME             Only send changes relative to this\n"
+               "                               read-only btrfs snapshot\n\n"
                "Commands:\n"
                "  tar NAME [FILE]              Export a TAR image\n"
-               "  raw NAME [FILE]              Export a RAW image\n",
+               "  raw NAME [FILE]              Export a RAW image\n"
+               "  btrfs NAME [FILE]            Export a btrfs send stream\n",
                program_invocation_short_name);
 
         return 0;
@@ -238,12 +271,14 @@ static int parse_argv(int argc, char *argv[]) {
         enum {
                 ARG_VERSION = 0x100,
                 ARG_FORMAT,
+                ARG_PARENT,
         };
 
         static const struct option options[] = {
                 { "help",    no_argument,       NULL, 'h'         },
                 { "version", no_argument,       NULL, ARG_VERSION },
                 { "format",  required_argument, NULL, ARG_FORMAT  },
+                { "parent",  required_argument, NULL, ARG_PARENT  },
                 {}
         };
 
@@ -273,12 +308,18 @@ static int parse_argv(int argc, char *argv[]) {
                                 arg_compress = IMPORT_COMPRESS_GZIP;
                         else if (streq(optarg, "bzip2"))
                                 arg_compress = IMPORT_COMPRESS_BZIP2;
+                        else if (streq(optarg, "zstd"))
+                                arg_compress = IMPORT_COMPRESS_ZSTD;
                         else {
                                 log_error("Unknown format: %s", optarg);
                                 return -EINVAL;
                         }
                         break;
 
+                case ARG_PARENT:
+                        arg_parent = optarg;
+                        break;
+
                 case '?':
                         return -EINVAL;
 
@@ -292,9 +333,10 @@ static int parse_argv(int argc, char *argv[]) {
 static int export_main(int argc, char *argv[]) {
 
         static const Verb verbs[] = {
-                { "help", VERB_ANY, VERB_ANY, 0, help       },
-                { "tar",  2,        3,        0, export_tar },
-                { "raw",  2,        3,        0, export_raw },
+                { "help",  VERB_ANY, VERB_ANY, 0, help       },
+                { "tar",   2,        3,        0, export_tar },
+                { "raw",   2,        3,        0, export_raw },
+                { "btrfs", 2,        3,        0, export_tar },
                 {}
         };
 
@@ -223,3 +223,100 @@ int import_fork_tar_c(const char *path, pid_t *ret) {
 
         return r;
 }
+
+static int import_fork_btrfs(char * const *argv, bool send, pid_t *ret) {
+        _cleanup_close_pair_ int pipefd[2] = { -1, -1 };
+        pid_t pid;
+        int r;
+
+        assert(argv);
+        assert(ret);
+
+        if (pipe2(pipefd, O_CLOEXEC) < 0)
+                return log_error_errno(errno, "Failed to create pipe for btrfs: %m");
+
+        pid = fork();
+        if (pid < 0)
+                return log_error_errno(errno, "Failed to fork off btrfs: %m");
+
+        if (pid == 0) {
+                int null_fd, pipe_fd;
+
+                /* Child */
+
+                (void) reset_all_signal_handlers();
+                (void) reset_signal_mask();
+                assert_se(prctl(PR_SET_PDEATHSIG, SIGTERM) == 0);
+
+                /* "btrfs send" writes the stream to stdout, "btrfs
+                 * receive" reads it from stdin */
+                pipe_fd = send ? STDOUT_FILENO : STDIN_FILENO;
+
+                pipefd[send ? 0 : 1] = safe_close(pipefd[send ? 0 : 1]);
+
+                if (dup2(pipefd[send ? 1 : 0], pipe_fd) != pipe_fd) {
+                        log_error_errno(errno, "Failed to dup2() fd: %m");
+                        _exit(EXIT_FAILURE);
+                }
+
+                null_fd = open("/dev/null", (send ? O_RDONLY : O_WRONLY)|O_NOCTTY);
+                if (null_fd < 0) {
+                        log_error_errno(errno, "Failed to open /dev/null: %m");
+                        _exit(EXIT_FAILURE);
+                }
+
+                if (dup2(null_fd, send ? STDIN_FILENO : STDOUT_FILENO) < 0) {
+                        log_error_errno(errno, "Failed to dup2() fd: %m");
+                        _exit(EXIT_FAILURE);
+                }
+
+                fd_cloexec(STDIN_FILENO, false);
+                fd_cloexec(STDOUT_FILENO, false);
+                fd_cloexec(STDERR_FILENO, false);
+
+                if (unshare(CLONE_NEWNET) < 0)
+                        log_error_errno(errno, "Failed to lock btrfs into network namespace, ignoring: %m");
+
+                /* Both directions need CAP_SYS_ADMIN for the send and
+                 * receive ioctls, hence no point in dropping any
+                 * capabilities here */
+
+                execvp("btrfs", argv);
+                log_error_errno(errno, "Failed to execute btrfs: %m");
+                _exit(EXIT_FAILURE);
+        }
+
+        pipefd[send ? 1 : 0] = safe_close(pipefd[send ? 1 : 0]);
+        r = pipefd[send ? 0 : 1];
+        pipefd[send ? 0 : 1] = -1;
+
+        *ret = pid;
+
+        return r;
+}
+
+int import_fork_btrfs_send(const char *path, const char *parent, pid_t *ret) {
+        const char *argv[] = { "btrfs", "send", "-q", NULL, NULL, NULL, NULL };
+
+        assert(path);
+
+        /* The parent must be a read-only subvolume that the
+         * receiving side already has, so that only the changes
+         * relative to it are sent */
+        if (parent) {
+                argv[3] = "-p";
+                argv[4] = parent;
+                argv[5] = path;
+        } else
+                argv[3] = path;
+
+        return import_fork_btrfs((char**) argv, true, ret);
+}
+
+int import_fork_btrfs_receive(const char *path, pid_t *ret) {
+        const char *argv[] = { "btrfs", "receive", "-q", path, NULL };
+
+        assert(path);
+
+        return import_fork_btrfs((char**) argv, false, ret);
+}
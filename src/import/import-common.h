@@ -26,3 +26,6 @@ int import_make_read_only(const char *path);
 
 int import_fork_tar_c(const char *path, pid_t *ret);
 int import_fork_tar_x(const char *path, pid_t *ret);
+
+int import_fork_btrfs_send(const char *path, const char *parent, pid_t *ret);
+int import_fork_btrfs_receive(const char *path, pid_t *ret);
@@ -22,6 +22,45 @@
 #include "util.h"
 #include "import-compress.h"
 
+/* Multi-threaded decoding needs liblzma 5.4 */
+#if LZMA_VERSION >= UINT32_C(50040002)
+#define HAVE_LZMA_DECODER_MT 1
+#endif
+
+static int xz_decoder_init(lzma_stream *xz) {
+        lzma_ret xzr;
+
+#ifdef HAVE_LZMA_DECODER_MT
+        long n;
+
+        /* Blocks are decoded in parallel, as long as the encoder
+         * recorded their sizes, which multi-threaded "xz -T" does.
+         * Streams that are a single block are decoded on the calling
+         * thread, as before. */
+        n = sysconf(_SC_NPROCESSORS_ONLN);
+        if (n > 1) {
+                lzma_mt mt = {
+                        .flags = LZMA_TELL_UNSUPPORTED_CHECK|LZMA_CONCATENATED,
+                        .threads = MIN((uint32_t) n, 16U),
+                        .memlimit_threading = lzma_physmem() / 4,
+                        .memlimit_stop = UINT64_MAX,
+                };
+
+                xzr = lzma_stream_decoder_mt(xz, &mt);
+                if (xzr == LZMA_OK)
+                        return 0;
+
+                log_debug("Failed to set up multi-threaded XZ decoder, using single thread.");
+        }
+#endif
+
+        xzr = lzma_stream_decoder(xz, UINT64_MAX, LZMA_TELL_UNSUPPORTED_CHECK|LZMA_CONCATENATED);
+        if (xzr != LZMA_OK)
+                return -EIO;
+
+        return 0;
+}
+
 void import_compress_free(ImportCompress *c) {
         assert(c);
 
@@ -38,6 +77,14 @@ void import_compress_free(ImportCompress *c) {
                 else
                         BZ2_bzDecompressEnd(&c->bzip2);
         }
+#ifdef HAVE_ZSTD
+        else if (c->type == IMPORT_COMPRESS_ZSTD) {
+                if (c->encoding)
+                        ZSTD_freeCStream(c->zstd.cstream);
+                else
+                        ZSTD_freeDStream(c->zstd.dstream);
+        }
+#endif
 
         c->type = IMPORT_COMPRESS_UNKNOWN;
 }
@@ -52,6 +99,9 @@ int import_uncompress_detect(ImportCompress *c, const void *data, size_t size) {
         static const uint8_t bzip2_signature[] = {
                 'B', 'Z', 'h'
         };
+        static const uint8_t zstd_signature[] = {
+                0x28, 0xb5, 0x2f, 0xfd
+        };
 
         int r;
 
@@ -60,19 +110,18 @@ int import_uncompress_detect(ImportCompress *c, const void *data, size_t size) {
         if (c->type != IMPORT_COMPRESS_UNKNOWN)
                 return 1;
 
-        if (size < MAX3(sizeof(xz_signature),
-                        sizeof(gzip_signature),
-                        sizeof(bzip2_signature)))
+        if (size < MAX(MAX3(sizeof(xz_signature),
+                            sizeof(gzip_signature),
+                            sizeof(bzip2_signature)),
+                       sizeof(zstd_signature)))
                 return 0;
 
         assert(data);
 
         if (memcmp(data, xz_signature, sizeof(xz_signature)) == 0) {
-                lzma_ret xzr;
-
-                xzr = lzma_stream_decoder(&c->xz, UINT64_MAX, LZMA_TELL_UNSUPPORTED_CHECK);
-                if (xzr != LZMA_OK)
-                        return -EIO;
+                r = xz_decoder_init(&c->xz);
+                if (r < 0)
+                        return r;
 
                 c->type = IMPORT_COMPRESS_XZ;
 
@@ -89,6 +138,17 @@ int import_uncompress_detect(ImportCompress *c, const void *data, size_t size) {
                         return -EIO;
 
                 c->type = IMPORT_COMPRESS_BZIP2;
+
+        } else if (memcmp(data, zstd_signature, sizeof(zstd_signature)) == 0) {
+#ifdef HAVE_ZSTD
+                c->zstd.dstream = ZSTD_createDStream();
+                if (!c->zstd.dstream)
+                        return -ENOMEM;
+
+                c->type = IMPORT_COMPRESS_ZSTD;
+#else
+                return -EPROTONOSUPPORT;
+#endif
         } else
                 c->type = IMPORT_COMPRESS_UNCOMPRESSED;
 
@@ -128,7 +188,7 @@ int import_uncompress(ImportCompress *c, const void *data, size_t size, ImportCo
                 c->xz.next_in = data;
                 c->xz.avail_in = size;
 
-                while (c->xz.avail_in > 0) {
+                for (;;) {
                         uint8_t buffer[16 * 1024];
                         lzma_ret lzr;
 
@@ -142,6 +202,10 @@ int import_uncompress(ImportCompress *c, const void *data, size_t size, ImportCo
                         r = callback(buffer, sizeof(buffer) - c->xz.avail_out, userdata);
                         if (r < 0)
                                 return r;
+
+                        /* With a full buffer there might be more output pending */
+                        if (c->xz.avail_in == 0 && c->xz.avail_out > 0)
+                                break;
                 }
 
                 break;
@@ -160,6 +224,11 @@ int import_uncompress(ImportCompress *c, const void *data, size_t size, ImportCo
                         if (r != Z_OK && r != Z_STREAM_END)
                                 return -EIO;
 
+                        /* Parallel compressors write independent
+                         * members one after the other */
+                        if (r == Z_STREAM_END && inflateReset(&c->gzip) != Z_OK)
+                                return -EIO;
+
                         r = callback(buffer, sizeof(buffer) - c->gzip.avail_out, userdata);
                         if (r < 0)
                                 return r;
@@ -173,6 +242,7 @@ int import_uncompress(ImportCompress *c, const void *data, size_t size, ImportCo
 
                 while (c->bzip2.avail_in > 0) {
                         uint8_t buffer[16 * 1024];
+                        size_t n;
 
                         c->bzip2.next_out = (char*) buffer;
                         c->bzip2.avail_out = sizeof(buffer);
@@ -181,12 +251,63 @@ int import_uncompress(ImportCompress *c, const void *data, size_t size, ImportCo
                         if (r != BZ_OK && r != BZ_STREAM_END)
                                 return -EIO;
 
-                        r = callback(buffer, sizeof(buffer) - c->bzip2.avail_out, userdata);
+                        n = sizeof(buffer) - c->bzip2.avail_out;
+
+                        /* Same for pbzip2, which writes independent
+                         * streams */
+                        if (r == BZ_STREAM_END) {
+                                bz_stream next = {
+                                        .next_in = c->bzip2.next_in,
+                                        .avail_in = c->bzip2.avail_in,
+                                };
+
+                                BZ2_bzDecompressEnd(&c->bzip2);
+                                c->bzip2 = next;
+
+                                r = BZ2_bzDecompressInit(&c->bzip2, 0, 0);
+                                if (r != BZ_OK) {
+                                        c->type = IMPORT_COMPRESS_UNKNOWN;
+                                        return -EIO;
+                                }
+                        }
+
+                        r = callback(buffer, n, userdata);
+                        if (r < 0)
+                                return r;
+                }
+
+                break;
+
+#ifdef HAVE_ZSTD
+        case IMPORT_COMPRESS_ZSTD: {
+                ZSTD_inBuffer input = {
+                        .src = data,
+                        .size = size,
+                };
+
+                for (;;) {
+                        uint8_t buffer[16 * 1024];
+                        ZSTD_outBuffer output = {
+                                .dst = buffer,
+                                .size = sizeof(buffer),
+                        };
+                        size_t k;
+
+                        k = ZSTD_decompressStream(c->zstd.dstream, &output, &input);
+                        if (ZSTD_isError(k))
+                                return -EIO;
+
+                        r = callback(buffer, output.pos, userdata);
                         if (r < 0)
                                 return r;
+
+                        if (input.pos >= input.size && output.pos < output.size)
+                                break;
                 }
 
                 break;
+        }
+#endif
 
         default:
                 assert_not_reached("Unknown compression");
@@ -195,6 +316,42 @@ int import_uncompress(ImportCompress *c, const void *data, size_t size, ImportCo
         return 1;
 }
 
+int import_uncompress_finish(ImportCompress *c, ImportCompressCallback callback, void *userdata) {
+        int r;
+
+        assert(c);
+        assert(callback);
+
+        if (c->encoding)
+                return -EINVAL;
+
+        if (c->type != IMPORT_COMPRESS_XZ)
+                return 0;
+
+        /* The multi-threaded decoder might still be sitting on
+         * decoded blocks; this also catches truncated input */
+        c->xz.avail_in = 0;
+
+        for (;;) {
+                uint8_t buffer[16 * 1024];
+                lzma_ret lzr;
+
+                c->xz.next_out = buffer;
+                c->xz.avail_out = sizeof(buffer);
+
+                lzr = lzma_code(&c->xz, LZMA_FINISH);
+                if (lzr != LZMA_OK && lzr != LZMA_STREAM_END)
+                        return -EIO;
+
+                r = callback(buffer, sizeof(buffer) - c->xz.avail_out, userdata);
+                if (r < 0)
+                        return r;
+
+                if (lzr == LZMA_STREAM_END)
+                        return 0;
+        }
+}
+
 int import_compress_init(ImportCompress *c, ImportCompressType t) {
         int r;
 
@@ -229,6 +386,25 @@ int import_compress_init(ImportCompress *c, ImportCompressType t) {
                 c->type = IMPORT_COMPRESS_BZIP2;
                 break;
 
+#ifdef HAVE_ZSTD
+        case IMPORT_COMPRESS_ZSTD: {
+                size_t k;
+
+                c->zstd.cstream = ZSTD_createCStream();
+                if (!c->zstd.cstream)
+                        return -ENOMEM;
+
+                k = ZSTD_initCStream(c->zstd.cstream, 3);
+                if (ZSTD_isError(k)) {
+                        ZSTD_freeCStream(c->zstd.cstream);
+                        return -EIO;
+                }
+
+                c->type = IMPORT_COMPRESS_ZSTD;
+                break;
+        }
+#endif
+
         case IMPORT_COMPRESS_UNCOMPRESSED:
                 c->type = IMPORT_COMPRESS_UNCOMPRESSED;
                 break;
@@ -347,6 +523,37 @@ int import_compress(ImportCompress *c, const void *data, size_t size, void **buf
 
                 break;
 
+#ifdef HAVE_ZSTD
+        case IMPORT_COMPRESS_ZSTD: {
+                ZSTD_inBuffer input = {
+                        .src = data,
+                        .size = size,
+                };
+
+                while (input.pos < input.size) {
+                        ZSTD_outBuffer output;
+                        size_t k;
+
+                        r = enlarge_buffer(buffer, buffer_size, buffer_allocated);
+                        if (r < 0)
+                                return r;
+
+                        output = (ZSTD_outBuffer) {
+                                .dst = (uint8_t*) *buffer + *buffer_size,
+                                .size = *buffer_allocated - *buffer_size,
+                        };
+
+                        k = ZSTD_compressStream(c->zstd.cstream, &output, &input);
+                        if (ZSTD_isError(k))
+                                return -EIO;
+
+                        *buffer_size += output.pos;
+                }
+
+                break;
+        }
+#endif
+
         case IMPORT_COMPRESS_UNCOMPRESSED:
 
                 if (*buffer_allocated < size) {
@@ -449,6 +656,34 @@ int import_compress_finish(ImportCompress *c, void **buffer, size_t *buffer_size
 
                 break;
 
+#ifdef HAVE_ZSTD
+        case IMPORT_COMPRESS_ZSTD: {
+                size_t k;
+
+                do {
+                        ZSTD_outBuffer output;
+
+                        r = enlarge_buffer(buffer, buffer_size, buffer_allocated);
+                        if (r < 0)
+                                return r;
+
+                        output = (ZSTD_outBuffer) {
+                                .dst = (uint8_t*) *buffer + *buffer_size,
+                                .size = *buffer_allocated - *buffer_size,
+                        };
+
+                        /* Returns how much is still left to flush */
+                        k = ZSTD_endStream(c->zstd.cstream, &output);
+                        if (ZSTD_isError(k))
+                                return -EIO;
+
+                        *buffer_size += output.pos;
+                } while (k > 0);
+
+                break;
+        }
+#endif
+
         case IMPORT_COMPRESS_UNCOMPRESSED:
                 break;
 
@@ -465,6 +700,7 @@ static const char* const import_compress_type_table[_IMPORT_COMPRESS_TYPE_MAX] =
         [IMPORT_COMPRESS_XZ] = "xz",
         [IMPORT_COMPRESS_GZIP] = "gzip",
         [IMPORT_COMPRESS_BZIP2] = "bzip2",
+        [IMPORT_COMPRESS_ZSTD] = "zstd",
 };
 
 DEFINE_STRING_TABLE_LOOKUP(import_compress_type, ImportCompressType);
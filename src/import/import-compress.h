@@ -26,6 +26,9 @@
 #include <lzma.h>
 #include <zlib.h>
 #include <bzlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
 
 #include "macro.h"
 
@@ -35,6 +38,7 @@ typedef enum ImportCompressType {
         IMPORT_COMPRESS_XZ,
         IMPORT_COMPRESS_GZIP,
         IMPORT_COMPRESS_BZIP2,
+        IMPORT_COMPRESS_ZSTD,
         _IMPORT_COMPRESS_TYPE_MAX,
         _IMPORT_COMPRESS_TYPE_INVALID = -1,
 } ImportCompressType;
@@ -46,6 +50,12 @@ typedef struct ImportCompress {
                 lzma_stream xz;
                 z_stream gzip;
                 bz_stream bzip2;
+#ifdef HAVE_ZSTD
+                struct {
+                        ZSTD_CStream *cstream;
+                        ZSTD_DStream *dstream;
+                } zstd;
+#endif
         };
 } ImportCompress;
 
@@ -55,6 +65,7 @@ void import_compress_free(ImportCompress *c);
 
 int import_uncompress_detect(ImportCompress *c, const void *data, size_t size);
 int import_uncompress(ImportCompress *c, const void *data, size_t size, ImportCompressCallback callback, void *userdata);
+int import_uncompress_finish(ImportCompress *c, ImportCompressCallback callback, void *userdata);
 
 int import_compress_init(ImportCompress *c, ImportCompressType t);
 int import_compress(ImportCompress *c, const void *data, size_t size, void **buffer, size_t *buffer_size, size_t *buffer_allocated);
@@ -72,6 +72,7 @@ struct RawImport {
 
         unsigned last_percent;
         RateLimit progress_rate_limit;
+        usec_t start_usec;
 };
 
 RawImport* raw_import_unref(RawImport *i) {
@@ -121,6 +122,7 @@ int raw_import_new(
 
         RATELIMIT_INIT(i->progress_rate_limit, 100 * USEC_PER_MSEC, 1);
         i->last_percent = (unsigned) -1;
+        i->start_usec = now(CLOCK_MONOTONIC);
 
         i->image_root = strdup(image_root ?: "/var/lib/machines");
         if (!i->image_root)
@@ -143,7 +145,10 @@ int raw_import_new(
 }
 
 static void raw_import_report_progress(RawImport *i) {
+        char bytes[FORMAT_BYTES_MAX];
         unsigned percent;
+        usec_t n;
+
         assert(i);
 
         /* We have no size information, unless the source is a regular file */
@@ -162,7 +167,14 @@ static void raw_import_report_progress(RawImport *i) {
                 return;
 
         sd_notifyf(false, "X_IMPORT_PROGRESS=%u", percent);
-        log_info("Imported %u%%.", percent);
+
+        /* Unpacking is what takes the time, so that is the rate to show */
+        n = now(CLOCK_MONOTONIC);
+        if (n > i->start_usec + USEC_PER_SEC)
+                log_info("Imported %u%%, unpacking at %s/s.", percent,
+                         format_bytes(bytes, sizeof(bytes), (uint64_t) ((double) i->written_uncompressed / ((double) (n - i->start_usec) / USEC_PER_SEC))));
+        else
+                log_info("Imported %u%%.", percent);
 
         i->last_percent = percent;
 }
@@ -356,6 +368,12 @@ static int raw_import_process(RawImport *i) {
                         goto finish;
                 }
 
+                r = import_uncompress_finish(&i->compress, raw_import_write, i);
+                if (r < 0) {
+                        log_error_errno(r, "Failed to decode and write: %m");
+                        goto finish;
+                }
+
                 r = raw_import_finish(i);
                 goto finish;
         }
@@ -50,6 +50,7 @@ struct TarImport {
         bool force_local;
         bool read_only;
         bool grow_machine_directory;
+        bool btrfs_receive;
 
         char *temp_path;
         char *final_path;
@@ -75,6 +76,7 @@ struct TarImport {
 
         unsigned last_percent;
         RateLimit progress_rate_limit;
+        usec_t start_usec;
 };
 
 TarImport* tar_import_unref(TarImport *i) {
@@ -129,6 +131,7 @@ int tar_import_new(
 
         RATELIMIT_INIT(i->progress_rate_limit, 100 * USEC_PER_MSEC, 1);
         i->last_percent = (unsigned) -1;
+        i->start_usec = now(CLOCK_MONOTONIC);
 
         i->image_root = strdup(image_root ?: "/var/lib/machines");
         if (!i->image_root)
@@ -151,7 +154,10 @@ int tar_import_new(
 }
 
 static void tar_import_report_progress(TarImport *i) {
+        char bytes[FORMAT_BYTES_MAX];
         unsigned percent;
+        usec_t n;
+
         assert(i);
 
         /* We have no size information, unless the source is a regular file */
@@ -170,11 +176,69 @@ static void tar_import_report_progress(TarImport *i) {
                 return;
 
         sd_notifyf(false, "X_IMPORT_PROGRESS=%u", percent);
-        log_info("Imported %u%%.", percent);
+
+        /* Unpacking is what takes the time, so that is the rate to show */
+        n = now(CLOCK_MONOTONIC);
+        if (n > i->start_usec + USEC_PER_SEC)
+                log_info("Imported %u%%, unpacking at %s/s.", percent,
+                         format_bytes(bytes, sizeof(bytes), (uint64_t) ((double) i->written_uncompressed / ((double) (n - i->start_usec) / USEC_PER_SEC))));
+        else
+                log_info("Imported %u%%.", percent);
 
         i->last_percent = percent;
 }
 
+static int tar_import_finish_btrfs(TarImport *i) {
+        _cleanup_closedir_ DIR *d = NULL;
+        _cleanup_free_ char *received = NULL;
+        struct dirent *de;
+        int r;
+
+        assert(i);
+
+        /* "btrfs receive" names the subvolume after the one that was
+         * sent, and we received into an empty directory, hence the
+         * only entry in there is the image */
+
+        d = opendir(i->temp_path);
+        if (!d)
+                return log_error_errno(errno, "Failed to open %s: %m", i->temp_path);
+
+        FOREACH_DIRENT_ALL(de, d, return log_error_errno(errno, "Failed to read %s: %m", i->temp_path)) {
+                if (streq(de->d_name, ".") || streq(de->d_name, ".."))
+                        continue;
+
+                if (received) {
+                        log_error("Stream contained more than one subvolume.");
+                        return -EBADMSG;
+                }
+
+                received = strjoin(i->temp_path, "/", de->d_name, NULL);
+                if (!received)
+                        return log_oom();
+        }
+
+        if (!received) {
+                log_error("Stream did not contain a subvolume.");
+                return -EBADMSG;
+        }
+
+        if (i->force_local)
+                (void) rm_rf(i->final_path, REMOVE_ROOT|REMOVE_PHYSICAL|REMOVE_SUBVOLUME);
+
+        /* The received subvolume stays read-only: making it writable
+         * would break it as parent for later incremental streams.
+         * Clone it to get a writable image. */
+        r = rename_noreplace(AT_FDCWD, received, AT_FDCWD, i->final_path);
+        if (r < 0)
+                return log_error_errno(r, "Failed to move image into place: %m");
+
+        (void) rmdir(i->temp_path);
+        i->temp_path = mfree(i->temp_path);
+
+        return 0;
+}
+
 static int tar_import_finish(TarImport *i) {
         int r;
 
@@ -186,12 +250,17 @@ static int tar_import_finish(TarImport *i) {
         i->tar_fd = safe_close(i->tar_fd);
 
         if (i->tar_pid > 0) {
-                r = wait_for_terminate_and_warn("tar", i->tar_pid, true);
+                r = wait_for_terminate_and_warn(i->btrfs_receive ? "btrfs" : "tar", i->tar_pid, true);
                 i->tar_pid = 0;
                 if (r < 0)
                         return r;
+                if (i->btrfs_receive && r > 0)
+                        return -EIO;
         }
 
+        if (i->btrfs_receive)
+                return tar_import_finish_btrfs(i);
+
         if (i->read_only) {
                 r = import_make_read_only(i->temp_path);
                 if (r < 0)
@@ -229,6 +298,17 @@ static int tar_import_fork_tar(TarImport *i) {
 
         (void) mkdir_parents_label(i->temp_path, 0700);
 
+        if (i->btrfs_receive) {
+                if (mkdir(i->temp_path, 0700) < 0)
+                        return log_error_errno(errno, "Failed to create directory %s: %m", i->temp_path);
+
+                i->tar_fd = import_fork_btrfs_receive(i->temp_path, &i->tar_pid);
+                if (i->tar_fd < 0)
+                        return i->tar_fd;
+
+                return 0;
+        }
+
         r = btrfs_subvol_make(i->temp_path);
         if (r == -ENOTTY) {
                 if (mkdir(i->temp_path, 0755) < 0)
@@ -284,6 +364,12 @@ static int tar_import_process(TarImport *i) {
                         goto finish;
                 }
 
+                r = import_uncompress_finish(&i->compress, tar_import_write, i);
+                if (r < 0) {
+                        log_error_errno(r, "Failed to decode and write: %m");
+                        goto finish;
+                }
+
                 r = tar_import_finish(i);
                 goto finish;
         }
@@ -338,7 +424,7 @@ static int tar_import_on_defer(sd_event_source *s, void *userdata) {
         return tar_import_process(i);
 }
 
-int tar_import_start(TarImport *i, int fd, const char *local, bool force_local, bool read_only) {
+int tar_import_start(TarImport *i, int fd, const char *local, bool force_local, bool read_only, bool btrfs_receive) {
         int r;
 
         assert(i);
@@ -360,6 +446,21 @@ int tar_import_start(TarImport *i, int fd, const char *local, bool force_local,
                 return r;
         i->force_local = force_local;
         i->read_only = read_only;
+        i->btrfs_receive = btrfs_receive;
+
+        if (btrfs_receive) {
+                _cleanup_close_ int rfd = -1;
+
+                rfd = open(i->image_root, O_DIRECTORY|O_RDONLY|O_NOCTTY|O_CLOEXEC);
+                if (rfd < 0)
+                        return -errno;
+
+                r = btrfs_is_filesystem(rfd);
+                if (r < 0)
+                        return r;
+                if (r == 0)
+                        return -EMEDIUMTYPE;
+        }
 
         if (fstat(fd, &i->st) < 0)
                 return -errno;
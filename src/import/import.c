@@ -58,8 +58,11 @@ static int import_tar(int argc, char *argv[], void *userdata) {
         const char *path = NULL, *local = NULL;
         _cleanup_free_ char *ll = NULL;
         _cleanup_close_ int open_fd = -1;
+        bool btrfs_receive;
         int r, fd;
 
+        btrfs_receive = streq(argv[0], "btrfs");
+
         if (argc >= 2)
                 path = argv[1];
         if (isempty(path) || streq(path, "-"))
@@ -73,7 +76,10 @@ static int import_tar(int argc, char *argv[], void *userdata) {
                 local = NULL;
 
         if (local) {
-                r = tar_strip_suffixes(local, &ll);
+                if (btrfs_receive)
+                        r = btrfs_strip_suffixes(local, &ll);
+                else
+                        r = tar_strip_suffixes(local, &ll);
                 if (r < 0)
                         return log_oom();
 
@@ -99,7 +105,7 @@ static int import_tar(int argc, char *argv[], void *userdata) {
         if (path) {
                 open_fd = open(path, O_RDONLY|O_CLOEXEC|O_NOCTTY);
                 if (open_fd < 0)
-                        return log_error_errno(errno, "Failed to open tar image to import: %m");
+                        return log_error_errno(errno, "Failed to open %s image to import: %m", btrfs_receive ? "btrfs" : "tar");
 
                 fd = open_fd;
 
@@ -125,7 +131,9 @@ static int import_tar(int argc, char *argv[], void *userdata) {
         if (r < 0)
                 return log_error_errno(r, "Failed to allocate importer: %m");
 
-        r = tar_import_start(import, fd, local, arg_force, arg_read_only);
+        r = tar_import_start(import, fd, local, arg_force, arg_read_only, btrfs_receive);
+        if (r == -EMEDIUMTYPE)
+                return log_error_errno(r, "%s is not on btrfs, cannot receive into it.", arg_image_root);
         if (r < 0)
                 return log_error_errno(r, "Failed to import image: %m");
 
@@ -243,7 +251,9 @@ static int help(int argc, char *argv[], void *userdata) {
                "     --read-only              Create a read-only image\n\n"
                "Commands:\n"
                "  tar FILE [NAME]             Import a TAR image\n"
-               "  raw FILE [NAME]             Import a RAW image\n",
+               "  raw FILE [NAME]             Import a RAW image\n"
+               "  btrfs FILE [NAME]           Import a btrfs send stream as a\n"
+               "                              read-only image\n",
                program_invocation_short_name);
 
         return 0;
@@ -309,9 +319,10 @@ static int parse_argv(int argc, char *argv[]) {
 static int import_main(int argc, char *argv[]) {
 
         static const Verb verbs[] = {
-                { "help", VERB_ANY, VERB_ANY, 0, help       },
-                { "tar",  2,        3,        0, import_tar },
-                { "raw",  2,        3,        0, import_raw },
+                { "help",  VERB_ANY, VERB_ANY, 0, help       },
+                { "tar",   2,        3,        0, import_tar },
+                { "raw",   2,        3,        0, import_raw },
+                { "btrfs", 2,        3,        0, import_tar },
                 {}
         };
 
@@ -26,6 +26,7 @@
 #include "copy.h"
 #include "rm-rf.h"
 #include "btrfs-util.h"
+#include "mkdir.h"
 #include "capability.h"
 #include "pull-job.h"
 #include "pull-common.h"
@@ -149,6 +150,106 @@ int pull_make_local_copy(const char *final, const char *image_root, const char *
         return 0;
 }
 
+int pull_cache_path(const char *image_root, const char *digest, char **ret) {
+        char *path;
+
+        assert(digest);
+        assert(ret);
+
+        if (strlen(digest) != 64 || !in_charset(digest, "0123456789abcdef"))
+                return -EINVAL;
+
+        if (!image_root)
+                image_root = "/var/lib/machines";
+
+        path = strjoin(image_root, "/.cache/sha256-", digest, NULL);
+        if (!path)
+                return -ENOMEM;
+
+        *ret = path;
+        return 0;
+}
+
+int pull_cache_add(const char *image_root, const char *digest, const char *path) {
+        _cleanup_free_ char *cache_path = NULL;
+        int r;
+
+        assert(digest);
+        assert(path);
+
+        r = pull_cache_path(image_root, digest, &cache_path);
+        if (r < 0)
+                return r;
+
+        if (access(cache_path, F_OK) >= 0)
+                return 0;
+
+        (void) mkdir_parents_label(cache_path, 0700);
+
+        /* Only worth it if it is for free, a copy would double the
+         * space the image needs */
+        r = btrfs_subvol_snapshot(path, cache_path, BTRFS_SNAPSHOT_READ_ONLY);
+        if (r == -ENOTTY) {
+                log_debug("Not on btrfs, not adding %s to cache.", path);
+                return 0;
+        }
+        if (r < 0)
+                return log_warning_errno(r, "Failed to add %s to cache: %m", path);
+
+        log_debug("Added %s to cache as %s.", path, cache_path);
+        return 1;
+}
+
+int pull_find_checksum(PullJob *checksum_job, const char *url, char **ret) {
+        _cleanup_free_ char *fn = NULL;
+        const char *p, *e, *end, *suffix;
+        size_t n;
+        int r;
+
+        assert(checksum_job);
+        assert(url);
+        assert(ret);
+
+        if (checksum_job->state != PULL_JOB_DONE || !checksum_job->payload)
+                return 0;
+
+        r = import_url_last_component(url, &fn);
+        if (r < 0)
+                return r;
+
+        if (!filename_is_valid(fn))
+                return 0;
+
+        /* Lines look like "<64 hex digits> *<file name>" */
+        suffix = strjoina(" *", fn);
+        n = strlen(suffix);
+
+        end = (const char*) checksum_job->payload + checksum_job->payload_size;
+        for (p = (const char*) checksum_job->payload; p < end; p = e + 1) {
+                _cleanup_free_ char *digest = NULL;
+
+                e = memchr(p, '\n', end - p);
+                if (!e)
+                        break;
+
+                if ((size_t) (e - p) != 64 + n || memcmp(p + 64, suffix, n) != 0)
+                        continue;
+
+                digest = strndup(p, 64);
+                if (!digest)
+                        return -ENOMEM;
+
+                if (!in_charset(digest, "0123456789abcdef"))
+                        continue;
+
+                *ret = digest;
+                digest = NULL;
+                return 1;
+        }
+
+        return 0;
+}
+
 int pull_make_path(const char *url, const char *etag, const char *image_root, const char *prefix, const char *suffix, char **ret) {
         _cleanup_free_ char *escaped_url = NULL;
         char *path;
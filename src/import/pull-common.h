@@ -32,6 +32,11 @@ int pull_find_old_etags(const char *url, const char *root, int dt, const char *p
 
 int pull_make_path(const char *url, const char *etag, const char *image_root, const char *prefix, const char *suffix, char **ret);
 
+/* Verified downloads, keyed by their SHA256 */
+int pull_cache_path(const char *image_root, const char *digest, char **ret);
+int pull_cache_add(const char *image_root, const char *digest, const char *path);
+int pull_find_checksum(PullJob *checksum_job, const char *url, char **ret);
+
 int pull_make_settings_job(PullJob **ret, const char *url, CurlGlue *glue, PullJobFinished on_finished, void *userdata);
 int pull_make_verification_jobs(PullJob **ret_checksum_job, PullJob **ret_signature_job, ImportVerify verify, const char *url, CurlGlue *glue, PullJobFinished on_finished, void *userdata);
 
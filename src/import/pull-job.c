@@ -22,13 +22,61 @@
 #include <sys/xattr.h>
 
 #include "strv.h"
+#include "list.h"
 #include "machine-pool.h"
 #include "pull-job.h"
 
+/* Size of the ranges a download over several connections is split into */
+#define PULL_JOB_RANGE_SIZE (8LLU * 1024LLU * 1024LLU)
+
+struct PullJobRange {
+        PullJob *job;
+
+        CURL *curl;
+        struct curl_slist *request_header;
+
+        uint64_t offset;
+        uint64_t size;
+        uint64_t received;
+
+        /* Received, but not written yet */
+        uint8_t *data;
+        size_t data_size;
+        size_t data_allocated;
+
+        bool done;
+
+        LIST_FIELDS(PullJobRange, ranges);
+};
+
+static PullJobRange* pull_job_range_free(PullJobRange *r) {
+        if (!r)
+                return NULL;
+
+        curl_glue_remove_and_free(r->job->glue, r->curl);
+        curl_slist_free_all(r->request_header);
+
+        free(r->data);
+        free(r);
+
+        return NULL;
+}
+
+DEFINE_TRIVIAL_CLEANUP_FUNC(PullJobRange*, pull_job_range_free);
+
 PullJob* pull_job_unref(PullJob *j) {
+        PullJobRange *r;
+
         if (!j)
                 return NULL;
 
+        while ((r = j->ranges)) {
+                LIST_REMOVE(ranges, j->ranges, r);
+                pull_job_range_free(r);
+        }
+
+        sd_event_source_unref(j->ranges_event_source);
+
         curl_glue_remove_and_free(j->glue, j->curl);
         curl_slist_free_all(j->request_header);
 
@@ -70,47 +118,16 @@ static void pull_job_finish(PullJob *j, int ret) {
                 j->on_finished(j);
 }
 
-void pull_job_curl_on_finished(CurlGlue *g, CURL *curl, CURLcode result) {
-        PullJob *j = NULL;
-        CURLcode code;
-        long status;
-        int r;
-
-        if (curl_easy_getinfo(curl, CURLINFO_PRIVATE, (char **)&j) != CURLE_OK)
-                return;
-
-        if (!j || j->state == PULL_JOB_DONE || j->state == PULL_JOB_FAILED)
-                return;
+static int pull_job_write_uncompressed(const void *p, size_t sz, void *userdata);
 
-        if (result != CURLE_OK) {
-                log_error("Transfer failed: %s", curl_easy_strerror(result));
-                r = -EIO;
-                goto finish;
-        }
+static void pull_job_complete(PullJob *j) {
+        int r;
 
-        code = curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
-        if (code != CURLE_OK) {
-                log_error("Failed to retrieve response code: %s", curl_easy_strerror(code));
-                r = -EIO;
-                goto finish;
-        } else if (status == 304) {
-                log_info("Image already downloaded. Skipping download.");
-                j->etag_exists = true;
-                r = 0;
-                goto finish;
-        } else if (status >= 300) {
-                log_error("HTTP request to %s failed with code %li.", j->url, status);
-                r = -EIO;
-                goto finish;
-        } else if (status < 200) {
-                log_error("HTTP request to %s finished with unexpected code %li.", j->url, status);
-                r = -EIO;
-                goto finish;
-        }
+        assert(j);
 
-        if (j->state != PULL_JOB_RUNNING) {
-                log_error("Premature connection termination.");
-                r = -EIO;
+        r = import_uncompress_finish(&j->compress, pull_job_write_uncompressed, j);
+        if (r < 0) {
+                log_error_errno(r, "Failed to decode and write: %m");
                 goto finish;
         }
 
@@ -171,6 +188,261 @@ finish:
         pull_job_finish(j, r);
 }
 
+static int pull_job_write_compressed(PullJob *j, void *p, size_t sz);
+static int pull_job_progress_callback(void *userdata, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow);
+
+static size_t pull_job_range_write_callback(void *contents, size_t size, size_t nmemb, void *userdata);
+
+static int pull_job_add_ranges(PullJob *j) {
+        int r;
+
+        assert(j);
+
+        /* Keep the number of ranges in memory bounded, finished ones
+         * waiting for their predecessors count too */
+        while (j->n_ranges + !j->head_done < j->n_connections &&
+               j->range_next < j->range_total) {
+                _cleanup_(pull_job_range_freep) PullJobRange *range = NULL;
+                char spec[DECIMAL_STR_MAX(uint64_t) * 2 + 2];
+
+                range = new0(PullJobRange, 1);
+                if (!range)
+                        return log_oom();
+
+                range->job = j;
+                range->offset = j->range_next;
+                range->size = MIN(j->range_size, j->range_total - j->range_next);
+
+                r = curl_glue_make(&range->curl, j->url, j);
+                if (r < 0)
+                        return r;
+
+                xsprintf(spec, "%" PRIu64 "-%" PRIu64, range->offset, range->offset + range->size - 1);
+                if (curl_easy_setopt(range->curl, CURLOPT_RANGE, spec) != CURLE_OK)
+                        return -EIO;
+
+                /* Make sure all ranges come from the same file */
+                if (j->etag) {
+                        _cleanup_free_ char *hdr = NULL;
+
+                        hdr = strappend("If-Match: ", j->etag);
+                        if (!hdr)
+                                return log_oom();
+
+                        range->request_header = curl_slist_new(hdr, NULL);
+                        if (!range->request_header)
+                                return log_oom();
+
+                        if (curl_easy_setopt(range->curl, CURLOPT_HTTPHEADER, range->request_header) != CURLE_OK)
+                                return -EIO;
+                }
+
+                if (curl_easy_setopt(range->curl, CURLOPT_WRITEFUNCTION, pull_job_range_write_callback) != CURLE_OK)
+                        return -EIO;
+
+                if (curl_easy_setopt(range->curl, CURLOPT_WRITEDATA, range) != CURLE_OK)
+                        return -EIO;
+
+                if (curl_easy_setopt(range->curl, CURLOPT_XFERINFOFUNCTION, pull_job_progress_callback) != CURLE_OK)
+                        return -EIO;
+
+                if (curl_easy_setopt(range->curl, CURLOPT_XFERINFODATA, j) != CURLE_OK)
+                        return -EIO;
+
+                if (curl_easy_setopt(range->curl, CURLOPT_NOPROGRESS, 0) != CURLE_OK)
+                        return -EIO;
+
+                r = curl_glue_add(j->glue, range->curl);
+                if (r < 0)
+                        return r;
+
+                LIST_APPEND(ranges, j->ranges, range);
+                j->n_ranges++;
+                j->range_next += range->size;
+
+                range = NULL;
+        }
+
+        return 0;
+}
+
+/* Feeds whatever is in order to the decompressor, and starts more
+ * ranges for the room this made. Completes the job once everything
+ * has been written. */
+static int pull_job_flush_ranges(PullJob *j) {
+        PullJobRange *range;
+        int r;
+
+        assert(j);
+
+        if (!j->head_done)
+                return 0;
+
+        while ((range = j->ranges)) {
+                if (range->data_size > 0) {
+                        r = pull_job_write_compressed(j, range->data, range->data_size);
+                        if (r < 0)
+                                return r;
+
+                        range->data_size = 0;
+                }
+
+                if (!range->done)
+                        break;
+
+                LIST_REMOVE(ranges, j->ranges, range);
+                j->n_ranges--;
+                pull_job_range_free(range);
+        }
+
+        r = pull_job_add_ranges(j);
+        if (r < 0)
+                return r;
+
+        if (!j->ranges)
+                pull_job_complete(j);
+
+        return 0;
+}
+
+static void pull_job_range_on_finished(PullJob *j, CURL *curl, CURLcode result) {
+        PullJobRange *range;
+        int r;
+
+        assert(j);
+
+        LIST_FOREACH(ranges, range, j->ranges)
+                if (range->curl == curl)
+                        break;
+        if (!range)
+                return;
+
+        if (result != CURLE_OK) {
+                log_error("Transfer failed: %s", curl_easy_strerror(result));
+                r = -EIO;
+                goto finish;
+        }
+
+        if (range->received != range->size) {
+                log_error("Download of range %" PRIu64 "-%" PRIu64 " of %s truncated.",
+                          range->offset, range->offset + range->size - 1, j->url);
+                r = -EIO;
+                goto finish;
+        }
+
+        range->done = true;
+        curl_glue_remove_and_free(j->glue, range->curl);
+        range->curl = NULL;
+
+        r = pull_job_flush_ranges(j);
+        if (r < 0)
+                goto finish;
+
+        return;
+
+finish:
+        pull_job_finish(j, r);
+}
+
+/* Stops the transfer, for content that turned out to be available
+ * locally. The job counts as done, but on_finished is not called. */
+void pull_job_cancel(PullJob *j) {
+        PullJobRange *range;
+
+        assert(j);
+
+        if (PULL_JOB_IS_COMPLETE(j))
+                return;
+
+        while ((range = j->ranges)) {
+                LIST_REMOVE(ranges, j->ranges, range);
+                pull_job_range_free(range);
+        }
+        j->n_ranges = 0;
+
+        j->ranges_event_source = sd_event_source_unref(j->ranges_event_source);
+
+        curl_glue_remove_and_free(j->glue, j->curl);
+        j->curl = NULL;
+
+        j->disk_fd = safe_close(j->disk_fd);
+
+        j->state = PULL_JOB_DONE;
+}
+
+void pull_job_curl_on_finished(CurlGlue *g, CURL *curl, CURLcode result) {
+        PullJob *j = NULL;
+        CURLcode code;
+        long status;
+        int r;
+
+        if (curl_easy_getinfo(curl, CURLINFO_PRIVATE, (char **)&j) != CURLE_OK)
+                return;
+
+        if (!j || j->state == PULL_JOB_DONE || j->state == PULL_JOB_FAILED)
+                return;
+
+        if (curl != j->curl) {
+                pull_job_range_on_finished(j, curl, result);
+                return;
+        }
+
+        if (result != CURLE_OK) {
+                log_error("Transfer failed: %s", curl_easy_strerror(result));
+                r = -EIO;
+                goto finish;
+        }
+
+        code = curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+        if (code != CURLE_OK) {
+                log_error("Failed to retrieve response code: %s", curl_easy_strerror(code));
+                r = -EIO;
+                goto finish;
+        } else if (status == 304) {
+                log_info("Image already downloaded. Skipping download.");
+                j->etag_exists = true;
+                r = 0;
+                goto finish;
+        } else if (status >= 300) {
+                log_error("HTTP request to %s failed with code %li.", j->url, status);
+                r = -EIO;
+                goto finish;
+        } else if (status < 200) {
+                log_error("HTTP request to %s finished with unexpected code %li.", j->url, status);
+                r = -EIO;
+                goto finish;
+        }
+
+        if (j->state != PULL_JOB_RUNNING) {
+                log_error("Premature connection termination.");
+                r = -EIO;
+                goto finish;
+        }
+
+        if (j->range_total != (uint64_t) -1) {
+                /* Only the first range came in over this connection */
+                if (j->written_compressed != MIN(j->range_size, j->range_total)) {
+                        log_error("Download truncated.");
+                        r = -EIO;
+                        goto finish;
+                }
+
+                j->head_done = true;
+
+                r = pull_job_flush_ranges(j);
+                if (r < 0)
+                        goto finish;
+
+                return;
+        }
+
+        pull_job_complete(j);
+        return;
+
+finish:
+        pull_job_finish(j, r);
+}
+
 static int pull_job_write_uncompressed(const void *p, size_t sz, void *userdata) {
         PullJob *j = userdata;
         ssize_t n;
@@ -331,6 +603,116 @@ static int pull_job_detect_compression(PullJob *j) {
         return 0;
 }
 
+static size_t pull_job_range_write_callback(void *contents, size_t size, size_t nmemb, void *userdata) {
+        PullJobRange *range = userdata;
+        size_t sz = size * nmemb;
+        PullJob *j;
+        long status;
+        int r;
+
+        assert(contents);
+        assert(range);
+
+        j = range->job;
+
+        if (PULL_JOB_IS_COMPLETE(j)) {
+                r = -ESTALE;
+                goto fail;
+        }
+
+        /* A server not honouring the range would send us everything */
+        if (curl_easy_getinfo(range->curl, CURLINFO_RESPONSE_CODE, &status) != CURLE_OK || status != 206) {
+                log_error("HTTP range request to %s failed.", j->url);
+                r = -EIO;
+                goto fail;
+        }
+
+        if (range->received + sz > range->size) {
+                log_error("Range response too long.");
+                r = -EIO;
+                goto fail;
+        }
+
+        if (!GREEDY_REALLOC(range->data, range->data_allocated, range->data_size + sz)) {
+                r = log_oom();
+                goto fail;
+        }
+
+        memcpy(range->data + range->data_size, contents, sz);
+        range->data_size += sz;
+        range->received += sz;
+
+        /* The first outstanding range goes straight through */
+        if (range == j->ranges) {
+                r = pull_job_flush_ranges(j);
+                if (r < 0)
+                        goto fail;
+        }
+
+        return sz;
+
+fail:
+        pull_job_finish(j, r);
+        return 0;
+}
+
+static int pull_job_on_ranges_defer(sd_event_source *s, void *userdata) {
+        PullJob *j = userdata;
+        int r;
+
+        assert(j);
+
+        j->ranges_event_source = sd_event_source_unref(j->ranges_event_source);
+
+        if (PULL_JOB_IS_COMPLETE(j))
+                return 0;
+
+        r = pull_job_add_ranges(j);
+        if (r < 0)
+                pull_job_finish(j, r);
+
+        return 0;
+}
+
+static int pull_job_check_ranges(PullJob *j) {
+        char bytes[FORMAT_BYTES_MAX];
+        long status;
+
+        assert(j);
+
+        j->ranges_checked = true;
+
+        if (j->n_connections <= 1)
+                return 0;
+
+        if (j->range_total != (uint64_t) -1) {
+                if (curl_easy_getinfo(j->curl, CURLINFO_RESPONSE_CODE, &status) != CURLE_OK)
+                        return -EIO;
+
+                if (status == 206) {
+                        /* Content-Length only covers the first range */
+                        j->content_length = j->range_total;
+                        j->range_next = MIN(j->range_size, j->range_total);
+
+                        log_info("Downloading %s for %s over up to %u connections.",
+                                 format_bytes(bytes, sizeof(bytes), j->content_length), j->url, j->n_connections);
+
+                        /* curl does not let us add transfers from
+                         * within its callbacks */
+                        return sd_event_add_defer(j->glue->event, &j->ranges_event_source, pull_job_on_ranges_defer, j);
+                }
+
+                j->range_total = (uint64_t) -1;
+        }
+
+        log_debug("Server does not support range requests, downloading %s over a single connection.", j->url);
+
+        if (j->content_length != (uint64_t) -1)
+                log_info("Downloading %s for %s.", format_bytes(bytes, sizeof(bytes), j->content_length), j->url);
+
+        return 0;
+}
+
 static size_t pull_job_write_callback(void *contents, size_t size, size_t nmemb, void *userdata) {
         PullJob *j = userdata;
         size_t sz = size * nmemb;
@@ -339,6 +721,12 @@ static size_t pull_job_write_callback(void *contents, size_t size, size_t nmemb,
         assert(contents);
         assert(j);
 
+        if (!j->ranges_checked && IN_SET(j->state, PULL_JOB_ANALYZING, PULL_JOB_RUNNING)) {
+                r = pull_job_check_ranges(j);
+                if (r < 0)
+                        goto fail;
+        }
+
         switch (j->state) {
 
         case PULL_JOB_ANALYZING:
@@ -385,7 +773,7 @@ fail:
 static size_t pull_job_header_callback(void *contents, size_t size, size_t nmemb, void *userdata) {
         PullJob *j = userdata;
         size_t sz = size * nmemb;
-        _cleanup_free_ char *length = NULL, *last_modified = NULL;
+        _cleanup_free_ char *length = NULL, *last_modified = NULL, *content_range = NULL;
         char *etag;
         int r;
 
@@ -435,7 +823,32 @@ static size_t pull_job_header_callback(void *contents, size_t size, size_t nmemb
                                 goto fail;
                         }
 
-                        log_info("Downloading %s for %s.", format_bytes(bytes, sizeof(bytes), j->content_length), j->url);
+                        /* Logged once we know whether ranges are used */
+                        if (j->n_connections <= 1)
+                                log_info("Downloading %s for %s.", format_bytes(bytes, sizeof(bytes), j->content_length), j->url);
+                }
+
+                return sz;
+        }
+
+        r = curl_header_strdup(contents, sz, "Content-Range:", &content_range);
+        if (r < 0) {
+                log_oom();
+                goto fail;
+        }
+        if (r > 0) {
+                const char *total;
+
+                /* "bytes 0-8388607/1234567890" */
+                total = strrchr(content_range, '/');
+                if (j->n_connections > 1 && startswith(content_range, "bytes ") && total &&
+                    safe_atou64(total + 1, &j->range_total) >= 0) {
+
+                        if (j->range_total > j->compressed_max) {
+                                log_error("Content too large.");
+                                r = -EFBIG;
+                                goto fail;
+                        }
                 }
 
                 return sz;
@@ -471,6 +884,12 @@ static int pull_job_progress_callback(void *userdata, curl_off_t dltotal, curl_o
 
         assert(j);
 
+        /* Each connection only sees its own range */
+        if (j->range_total != (uint64_t) -1) {
+                dltotal = j->range_total;
+                dlnow = j->written_compressed;
+        }
+
         if (dltotal <= 0)
                 return 0;
 
@@ -523,6 +942,9 @@ int pull_job_new(PullJob **ret, const char *url, CurlGlue *glue, void *userdata)
         j->userdata = userdata;
         j->glue = glue;
         j->content_length = (uint64_t) -1;
+        j->n_connections = 1;
+        j->range_size = PULL_JOB_RANGE_SIZE;
+        j->range_total = (uint64_t) -1;
         j->start_usec = now(CLOCK_MONOTONIC);
         j->compressed_max = j->uncompressed_max = 8LLU * 1024LLU * 1024LLU * 1024LLU; /* 8GB */
 
@@ -577,6 +999,17 @@ int pull_job_begin(PullJob *j) {
                 }
         }
 
+        if (j->n_connections > 1) {
+                char spec[DECIMAL_STR_MAX(uint64_t) + 3];
+
+                /* Ask for the first range only; if the server replies
+                 * with a partial response, the rest is requested in
+                 * parallel once we know the full size. */
+                xsprintf(spec, "0-%" PRIu64, j->range_size - 1);
+                if (curl_easy_setopt(j->curl, CURLOPT_RANGE, spec) != CURLE_OK)
+                        return -EIO;
+        }
+
         if (j->request_header) {
                 if (curl_easy_setopt(j->curl, CURLOPT_HTTPHEADER, j->request_header) != CURLE_OK)
                         return -EIO;
@@ -28,6 +28,7 @@
 #include "import-compress.h"
 
 typedef struct PullJob PullJob;
+typedef struct PullJobRange PullJobRange;
 
 typedef void (*PullJobFinished)(PullJob *job);
 typedef int (*PullJobOpenDisk)(PullJob *job);
@@ -44,6 +45,9 @@ typedef enum PullJobState {
         _PULL_JOB_STATE_INVALID = -1,
 } PullJobState;
 
+/* Upper limit for parallel range requests of one download */
+#define PULL_JOB_CONNECTIONS_MAX 16U
+
 #define PULL_JOB_IS_COMPLETE(j) (IN_SET((j)->state, PULL_JOB_DONE, PULL_JOB_FAILED))
 
 typedef enum PullJobCompression {
@@ -105,12 +109,27 @@ struct PullJob {
 
         bool grow_machine_directory;
         uint64_t written_since_last_grow;
+
+        /* With more than one connection, the download is split into
+         * ranges that are fetched in parallel and fed to the
+         * decompressor in order. The first range is fetched over
+         * ->curl, the others are in ->ranges. */
+        unsigned n_connections;
+        uint64_t range_size;
+        uint64_t range_total;
+        uint64_t range_next;
+        bool ranges_checked;
+        bool head_done;
+        PullJobRange *ranges;
+        unsigned n_ranges;
+        sd_event_source *ranges_event_source;
 };
 
 int pull_job_new(PullJob **job, const char *url, CurlGlue *glue, void *userdata);
 PullJob* pull_job_unref(PullJob *job);
 
 int pull_job_begin(PullJob *j);
+void pull_job_cancel(PullJob *j);
 
 void pull_job_curl_on_finished(CurlGlue *g, CURL *curl, CURLcode result);
 
@@ -71,6 +71,7 @@ struct TarPull {
 
         char *final_path;
         char *temp_path;
+        char *cache_path;
 
         char *settings_path;
         char *settings_temp_path;
@@ -106,6 +107,7 @@ TarPull* tar_pull_unref(TarPull *i) {
         }
 
         free(i->final_path);
+        free(i->cache_path);
         free(i->settings_path);
         free(i->image_root);
         free(i->local);
@@ -227,7 +229,7 @@ static int tar_pull_make_local_copy(TarPull *i) {
                         return log_oom();
         }
 
-        r = pull_make_local_copy(i->final_path, i->image_root, i->local, i->force_local);
+        r = pull_make_local_copy(i->cache_path ?: i->final_path, i->image_root, i->local, i->force_local);
         if (r < 0)
                 return r;
 
@@ -271,6 +273,59 @@ static bool tar_pull_is_done(TarPull *i) {
         return true;
 }
 
+static int tar_pull_try_cache(TarPull *i) {
+        _cleanup_free_ char *digest = NULL, *cache_path = NULL;
+        int r;
+
+        assert(i);
+        assert(i->tar_job);
+        assert(i->checksum_job);
+
+        /* The checksum list arrived before the image: if we
+         * already unpacked an image with the same SHA256 earlier,
+         * there is no need to download it again. */
+
+        if (PULL_JOB_IS_COMPLETE(i->tar_job) || !i->local)
+                return 0;
+
+        r = pull_find_checksum(i->checksum_job, i->tar_job->url, &digest);
+        if (r <= 0)
+                return r;
+
+        r = pull_cache_path(i->image_root, digest, &cache_path);
+        if (r < 0)
+                return r;
+
+        if (access(cache_path, F_OK) < 0)
+                return 0;
+
+        log_info("Image with SHA256 %s found in cache, not downloading.", digest);
+
+        pull_job_cancel(i->tar_job);
+
+        if (i->tar_pid > 0) {
+                (void) kill_and_sigcont(i->tar_pid, SIGKILL);
+                (void) wait_for_terminate(i->tar_pid, NULL);
+                i->tar_pid = 0;
+        }
+
+        if (i->temp_path) {
+                (void) rm_rf(i->temp_path, REMOVE_ROOT|REMOVE_PHYSICAL|REMOVE_SUBVOLUME);
+                i->temp_path = mfree(i->temp_path);
+        }
+
+        /* Let pull_verify() check the signature on the checksum
+         * list as usual, the cache entry was verified when added */
+        free(i->tar_job->checksum);
+        i->tar_job->checksum = digest;
+        digest = NULL;
+
+        i->cache_path = cache_path;
+        cache_path = NULL;
+
+        return 1;
+}
+
 static void tar_pull_job_on_finished(PullJob *j) {
         TarPull *i;
         int r;
@@ -299,6 +354,12 @@ static void tar_pull_job_on_finished(PullJob *j) {
          * successfully, or the download was skipped because we
          * already have the etag. */
 
+        if (j == i->checksum_job) {
+                r = tar_pull_try_cache(i);
+                if (r < 0)
+                        log_debug_errno(r, "Failed to look up image in cache, ignoring: %m");
+        }
+
         if (!tar_pull_is_done(i))
                 return;
 
@@ -328,17 +389,22 @@ static void tar_pull_job_on_finished(PullJob *j) {
 
                 tar_pull_report_progress(i, TAR_FINALIZING);
 
-                r = import_make_read_only(i->temp_path);
-                if (r < 0)
-                        goto finish;
+                if (!i->cache_path) {
+                        r = import_make_read_only(i->temp_path);
+                        if (r < 0)
+                                goto finish;
 
-                r = rename_noreplace(AT_FDCWD, i->temp_path, AT_FDCWD, i->final_path);
-                if (r < 0) {
-                        log_error_errno(r, "Failed to rename to final image name: %m");
-                        goto finish;
-                }
+                        r = rename_noreplace(AT_FDCWD, i->temp_path, AT_FDCWD, i->final_path);
+                        if (r < 0) {
+                                log_error_errno(r, "Failed to rename to final image name: %m");
+                                goto finish;
+                        }
 
-                i->temp_path = mfree(i->temp_path);
+                        i->temp_path = mfree(i->temp_path);
+
+                        if (i->tar_job->checksum)
+                                (void) pull_cache_add(i->image_root, i->tar_job->checksum, i->final_path);
+                }
 
                 if (i->settings_job &&
                     i->settings_job->error == 0 &&
@@ -464,13 +530,15 @@ int tar_pull_start(
                 const char *local,
                 bool force_local,
                 ImportVerify verify,
-                bool settings) {
+                bool settings,
+                unsigned connections) {
 
         int r;
 
         assert(i);
         assert(verify < _IMPORT_VERIFY_MAX);
         assert(verify >= 0);
+        assert(connections >= 1);
 
         if (!http_url_is_valid(url))
                 return -EINVAL;
@@ -499,6 +567,7 @@ int tar_pull_start(
         i->tar_job->on_progress = tar_pull_job_on_progress;
         i->tar_job->calc_checksum = verify != IMPORT_VERIFY_NO;
         i->tar_job->grow_machine_directory = i->grow_machine_directory;
+        i->tar_job->n_connections = connections;
 
         r = pull_find_old_etags(url, i->image_root, DT_DIR, ".tar-", NULL, &i->tar_job->old_etags);
         if (r < 0)
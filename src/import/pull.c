@@ -32,12 +32,14 @@
 #include "pull-tar.h"
 #include "pull-raw.h"
 #include "pull-dkr.h"
+#include "pull-job.h"
 
 static bool arg_force = false;
 static const char *arg_image_root = "/var/lib/machines";
 static ImportVerify arg_verify = IMPORT_VERIFY_SIGNATURE;
 static const char* arg_dkr_index_url = DEFAULT_DKR_INDEX_URL;
 static bool arg_settings = true;
+static unsigned arg_connections = 1;
 
 static int interrupt_signal_handler(sd_event_source *s, const struct signalfd_siginfo *si, void *userdata) {
         log_notice("Transfer aborted.");
@@ -119,7 +121,7 @@ static int pull_tar(int argc, char *argv[], void *userdata) {
         if (r < 0)
                 return log_error_errno(r, "Failed to allocate puller: %m");
 
-        r = tar_pull_start(pull, url, local, arg_force, arg_verify, arg_settings);
+        r = tar_pull_start(pull, url, local, arg_force, arg_verify, arg_settings, arg_connections);
         if (r < 0)
                 return log_error_errno(r, "Failed to pull image: %m");
 
@@ -205,7 +207,7 @@ static int pull_raw(int argc, char *argv[], void *userdata) {
         if (r < 0)
                 return log_error_errno(r, "Failed to allocate puller: %m");
 
-        r = raw_pull_start(pull, url, local, arg_force, arg_verify, arg_settings);
+        r = raw_pull_start(pull, url, local, arg_force, arg_verify, arg_settings, arg_connections);
         if (r < 0)
                 return log_error_errno(r, "Failed to pull image: %m");
 
@@ -335,6 +337,8 @@ static int help(int argc, char *argv[], void *userdata) {
                "     --verify=MODE            Verify downloaded image, one of: 'no',\n"
                "                              'checksum', 'signature'\n"
                "     --settings=BOOL          Download settings file with image\n"
+               "     --connections=N          Download image over up to N connections\n"
+               "                              in parallel\n"
                "     --image-root=PATH        Image root directory\n"
                "     --dkr-index-url=URL      Specify index URL to use for downloads\n\n"
                "Commands:\n"
@@ -355,6 +359,7 @@ static int parse_argv(int argc, char *argv[]) {
                 ARG_IMAGE_ROOT,
                 ARG_VERIFY,
                 ARG_SETTINGS,
+                ARG_CONNECTIONS,
         };
 
         static const struct option options[] = {
@@ -365,6 +370,7 @@ static int parse_argv(int argc, char *argv[]) {
                 { "image-root",      required_argument, NULL, ARG_IMAGE_ROOT      },
                 { "verify",          required_argument, NULL, ARG_VERIFY          },
                 { "settings",        required_argument, NULL, ARG_SETTINGS        },
+                { "connections",     required_argument, NULL, ARG_CONNECTIONS     },
                 {}
         };
 
@@ -419,6 +425,15 @@ static int parse_argv(int argc, char *argv[]) {
                         arg_settings = r;
                         break;
 
+                case ARG_CONNECTIONS:
+                        r = safe_atou(optarg, &arg_connections);
+                        if (r < 0 || arg_connections < 1 || arg_connections > PULL_JOB_CONNECTIONS_MAX) {
+                                log_error("Invalid number of connections '%s'", optarg);
+                                return -EINVAL;
+                        }
+
+                        break;
+
                 case '?':
                         return -EINVAL;
 
@@ -19,9 +19,11 @@
   along with systemd; If not, see <http://www.gnu.org/licenses/>.
 ***/
 
+#include <pthread.h>
 #include <zlib.h>
 
 #include "util.h"
+#include "missing.h"
 #include "sparse-endian.h"
 #include "qcow2-util.h"
 #include "btrfs-util.h"
@@ -79,31 +81,153 @@ static uint32_t HEADER_HEADER_LENGTH(const Header *h) {
         return be32toh(h->header_length);
 }
 
-static int copy_cluster(
-                int sfd, uint64_t soffset,
-                int dfd, uint64_t doffset,
-                uint64_t cluster_size,
-                void *buffer) {
+/* Adjacent uncompressed clusters are copied in one go, up to this size */
+#define EXTENT_MAX (8U*1024U*1024U)
+
+/* Compressed clusters are collected and inflated in batches of this
+ * many, spread over up to THREADS_MAX threads */
+#define BATCH_MAX 256U
+#define THREADS_MAX 8U
+
+typedef struct CompressedCluster {
+        uint64_t soffset;
+        uint64_t doffset;
+        uint64_t compressed_size;
+} CompressedCluster;
+
+typedef struct Convert {
+        int sfd;
+        int dfd;
+        uint64_t cluster_size;
+
+        /* Pending run of uncompressed clusters */
+        uint64_t extent_soffset;
+        uint64_t extent_doffset;
+        uint64_t extent_size;
+        void *extent_buffer;
+
+        /* Pending compressed clusters */
+        CompressedCluster batch[BATCH_MAX];
+        unsigned n_batch;
+        unsigned n_threads;
+
+        /* Remember what the file systems could not do for us */
+        bool no_clone;
+        bool no_copy_file_range;
+} Convert;
+
+typedef struct Worker {
+        Convert *convert;
+        pthread_t thread;
+        unsigned first;
+        unsigned n;
+        int r;
+} Worker;
+
+/* The raw file starts out empty, so zeroes need not be written */
+static int write_nonzero_clusters(int dfd, const void *buffer, uint64_t size, uint64_t doffset, uint64_t cluster_size) {
+        uint64_t done;
+        ssize_t l;
+
+        for (done = 0; done < size; done += cluster_size) {
+                const uint8_t *p = (const uint8_t*) buffer + done;
+                uint64_t n;
+
+                n = MIN(cluster_size, size - done);
+
+                if (p[0] == 0 && memcmp(p, p + 1, n - 1) == 0)
+                        continue;
+
+                l = pwrite(dfd, p, n, doffset + done);
+                if (l < 0)
+                        return -errno;
+                if ((uint64_t) l != n)
+                        return -EIO;
+        }
+
+        return 0;
+}
 
+static int flush_extent(Convert *c) {
+        uint64_t size;
         ssize_t l;
         int r;
 
-        r = btrfs_clone_range(sfd, soffset, dfd, doffset, cluster_size);
-        if (r >= 0)
-                return r;
+        assert(c);
 
-        l = pread(sfd, buffer, cluster_size, soffset);
-        if (l < 0)
-                return -errno;
-        if ((uint64_t) l != cluster_size)
-                return -EIO;
+        size = c->extent_size;
+        if (size == 0)
+                return 0;
+
+        c->extent_size = 0;
 
-        l = pwrite(dfd, buffer, cluster_size, doffset);
+        if (!c->no_clone) {
+                r = btrfs_clone_range(c->sfd, c->extent_soffset, c->dfd, c->extent_doffset, size);
+                if (r >= 0)
+                        return r;
+
+                c->no_clone = true;
+        }
+
+        if (!c->no_copy_file_range) {
+                loff_t so = c->extent_soffset, dof = c->extent_doffset;
+
+                /* Let the kernel do it, this shares blocks where the
+                 * file system can, and otherwise skips the round trip
+                 * through userspace */
+                while (size > 0) {
+                        l = copy_file_range(c->sfd, &so, c->dfd, &dof, size, 0);
+                        if (l < 0) {
+                                if (!IN_SET(errno, ENOSYS, EXDEV, EINVAL, EOPNOTSUPP, EBADF))
+                                        return -errno;
+
+                                c->no_copy_file_range = true;
+                                break;
+                        }
+                        if (l == 0)
+                                return -EIO;
+
+                        size -= l;
+                }
+
+                if (size == 0)
+                        return 0;
+
+                /* Fall back for the rest */
+                c->extent_soffset = so;
+                c->extent_doffset = dof;
+        }
+
+        l = pread(c->sfd, c->extent_buffer, size, c->extent_soffset);
         if (l < 0)
                 return -errno;
-        if ((uint64_t) l != cluster_size)
+        if ((uint64_t) l != size)
                 return -EIO;
 
+        return write_nonzero_clusters(c->dfd, c->extent_buffer, size, c->extent_doffset, c->cluster_size);
+}
+
+static int add_cluster(Convert *c, uint64_t soffset, uint64_t doffset) {
+        int r;
+
+        assert(c);
+
+        if (c->extent_size > 0 &&
+            c->extent_soffset + c->extent_size == soffset &&
+            c->extent_doffset + c->extent_size == doffset &&
+            c->extent_size + c->cluster_size <= EXTENT_MAX) {
+                c->extent_size += c->cluster_size;
+                return 0;
+        }
+
+        r = flush_extent(c);
+        if (r < 0)
+                return r;
+
+        c->extent_soffset = soffset;
+        c->extent_doffset = doffset;
+        c->extent_size = c->cluster_size;
+
         return 0;
 }
 
@@ -153,11 +277,98 @@ static int decompress_cluster(
         if (r != Z_STREAM_END || sz != cluster_size)
                 return -EIO;
 
-        l = pwrite(dfd, buffer2, cluster_size, doffset);
-        if (l < 0)
-                return -errno;
-        if ((uint64_t) l != cluster_size)
-                return -EIO;
+        return write_nonzero_clusters(dfd, buffer2, cluster_size, doffset, cluster_size);
+}
+
+static void *worker_thread(void *p) {
+        _cleanup_free_ void *buffer1 = NULL, *buffer2 = NULL;
+        Worker *w = p;
+        Convert *c = w->convert;
+        unsigned i;
+
+        buffer1 = malloc(c->cluster_size);
+        buffer2 = malloc(c->cluster_size);
+        if (!buffer1 || !buffer2) {
+                w->r = -ENOMEM;
+                return NULL;
+        }
+
+        /* Only positioned I/O, so the workers need no locking */
+        for (i = w->first; i < w->first + w->n; i++) {
+                w->r = decompress_cluster(
+                                c->sfd, c->batch[i].soffset,
+                                c->dfd, c->batch[i].doffset,
+                                c->batch[i].compressed_size, c->cluster_size,
+                                buffer1, buffer2);
+                if (w->r < 0)
+                        break;
+        }
+
+        return NULL;
+}
+
+static int flush_batch(Convert *c) {
+        Worker workers[THREADS_MAX] = {};
+        unsigned n_threads, n_started = 0, i;
+        int r = 0, k;
+
+        assert(c);
+
+        if (c->n_batch == 0)
+                return 0;
+
+        /* Don't bother with threads for a handful of clusters */
+        n_threads = CLAMP(c->n_batch / 16, 1U, c->n_threads);
+
+        for (i = 0; i < n_threads; i++) {
+                workers[i].convert = c;
+                workers[i].first = c->n_batch * i / n_threads;
+                workers[i].n = c->n_batch * (i + 1) / n_threads - workers[i].first;
+        }
+
+        /* The first share is done on this thread */
+        for (i = 1; i < n_threads; i++) {
+                k = pthread_create(&workers[i].thread, NULL, worker_thread, workers + i);
+                if (k != 0) {
+                        r = -k;
+                        break;
+                }
+
+                n_started++;
+        }
+
+        if (r == 0) {
+                worker_thread(workers);
+                r = workers[0].r;
+        }
+
+        for (i = 1; i <= n_started; i++) {
+                (void) pthread_join(workers[i].thread, NULL);
+
+                if (r >= 0 && workers[i].r < 0)
+                        r = workers[i].r;
+        }
+
+        c->n_batch = 0;
+        return r;
+}
+
+static int add_compressed_cluster(Convert *c, uint64_t soffset, uint64_t doffset, uint64_t compressed_size) {
+        assert(c);
+
+        if (c->n_batch >= BATCH_MAX) {
+                int r;
+
+                r = flush_batch(c);
+                if (r < 0)
+                        return r;
+        }
+
+        c->batch[c->n_batch++] = (CompressedCluster) {
+                .soffset = soffset,
+                .doffset = doffset,
+                .compressed_size = compressed_size,
+        };
 
         return 0;
 }
@@ -246,11 +457,12 @@ static int verify_header(const Header *header) {
 }
 
 int qcow2_convert(int qcow2_fd, int raw_fd) {
-        _cleanup_free_ void *buffer1 = NULL, *buffer2 = NULL;
+        _cleanup_free_ Convert *c = NULL;
         _cleanup_free_ be64_t *l1_table = NULL, *l2_table = NULL;
         uint64_t sz, i;
         Header header;
         ssize_t l;
+        long n;
         int r;
 
         l = pread(qcow2_fd, &header, sizeof(header), 0);
@@ -271,13 +483,16 @@ int qcow2_convert(int qcow2_fd, int raw_fd) {
         if (!l2_table)
                 return -ENOMEM;
 
-        buffer1 = malloc(HEADER_CLUSTER_SIZE(&header));
-        if (!buffer1)
+        c = new0(Convert, 1);
+        if (!c)
                 return -ENOMEM;
 
-        buffer2 = malloc(HEADER_CLUSTER_SIZE(&header));
-        if (!buffer2)
-                return -ENOMEM;
+        c->sfd = qcow2_fd;
+        c->dfd = raw_fd;
+        c->cluster_size = HEADER_CLUSTER_SIZE(&header);
+
+        n = sysconf(_SC_NPROCESSORS_ONLN);
+        c->n_threads = CLAMP(n, 1L, (long) THREADS_MAX);
 
         /* Empty the file if it exists, we rely on zero bits */
         if (ftruncate(raw_fd, 0) < 0)
@@ -293,20 +508,26 @@ int qcow2_convert(int qcow2_fd, int raw_fd) {
         if ((uint64_t) l != sz)
                 return -EIO;
 
+        (void) posix_fadvise(qcow2_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
         for (i = 0; i < HEADER_L1_SIZE(&header); i ++) {
                 uint64_t l2_begin, j;
 
                 r = normalize_offset(&header, l1_table[i], &l2_begin, NULL, NULL);
                 if (r < 0)
-                        return r;
+                        goto finish;
                 if (r == 0)
                         continue;
 
                 l = pread(qcow2_fd, l2_table, HEADER_CLUSTER_SIZE(&header), l2_begin);
-                if (l < 0)
-                        return -errno;
-                if ((uint64_t) l != HEADER_CLUSTER_SIZE(&header))
-                        return -EIO;
+                if (l < 0) {
+                        r = -errno;
+                        goto finish;
+                }
+                if ((uint64_t) l != HEADER_CLUSTER_SIZE(&header)) {
+                        r = -EIO;
+                        goto finish;
+                }
 
                 for (j = 0; j < HEADER_L2_SIZE(&header); j++) {
                         uint64_t data_begin, p, compressed_size;
@@ -316,27 +537,37 @@ int qcow2_convert(int qcow2_fd, int raw_fd) {
 
                         r = normalize_offset(&header, l2_table[j], &data_begin, &compressed, &compressed_size);
                         if (r < 0)
-                                return r;
-                        if (r == 0)
+                                goto finish;
+                        if (r == 0) /* Holes stay holes */
                                 continue;
 
                         if (compressed)
-                                r = decompress_cluster(
-                                                qcow2_fd, data_begin,
-                                                raw_fd, p,
-                                                compressed_size, HEADER_CLUSTER_SIZE(&header),
-                                                buffer1, buffer2);
-                        else
-                                r = copy_cluster(
-                                                qcow2_fd, data_begin,
-                                                raw_fd, p,
-                                                HEADER_CLUSTER_SIZE(&header), buffer1);
+                                r = add_compressed_cluster(c, data_begin, p, compressed_size);
+                        else {
+                                if (!c->extent_buffer) {
+                                        c->extent_buffer = malloc(EXTENT_MAX);
+                                        if (!c->extent_buffer) {
+                                                r = -ENOMEM;
+                                                goto finish;
+                                        }
+                                }
+
+                                r = add_cluster(c, data_begin, p);
+                        }
                         if (r < 0)
-                                return r;
+                                goto finish;
                 }
         }
 
-        return 0;
+        r = flush_extent(c);
+        if (r < 0)
+                goto finish;
+
+        r = flush_batch(c);
+
+finish:
+        free(c->extent_buffer);
+        return r;
 }
 
 int qcow2_detect(int fd) {
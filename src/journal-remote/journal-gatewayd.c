@@ -34,8 +34,13 @@
 #include "sd-journal.h"
 #include "sd-daemon.h"
 #include "sd-bus.h"
+#include "sd-event.h"
 #include "log.h"
 #include "util.h"
+#include "hashmap.h"
+#include "list.h"
+#include "strv.h"
+#include "signal-util.h"
 #include "bus-util.h"
 #include "logs-show.h"
 #include "microhttpd-util.h"
@@ -48,8 +53,21 @@ static char *arg_key_pem = NULL;
 static char *arg_cert_pem = NULL;
 static char *arg_trust_pem = NULL;
 
-typedef struct RequestMeta {
+static sd_event *gateway_event = NULL;
+static struct MHD_Daemon *gateway_daemon = NULL;
+
+/* Followers with the same filter share one watch, keyed by the filter */
+static Hashmap *journal_watches = NULL;
+
+typedef struct JournalWatch JournalWatch;
+typedef struct RequestMeta RequestMeta;
+
+struct RequestMeta {
         sd_journal *journal;
+        struct MHD_Connection *connection;
+
+        /* The matches added to the journal, so that it can be reopened */
+        char **matches;
 
         OutputMode mode;
 
@@ -68,7 +86,25 @@ typedef struct RequestMeta {
 
         uint64_t n_fields;
         bool n_fields_set;
-} RequestMeta;
+
+        JournalWatch *watch;
+        LIST_FIELDS(RequestMeta, followers);
+
+        bool suspended;   /* waiting for the watch to resume the connection */
+        bool changed;     /* the journal changed since the watch woke us up last */
+        bool reopen;      /* journal files were added or removed */
+};
+
+/* Following connections do not wait on their own journal, which would
+ * need an inotify instance each. Instead they are suspended, and one
+ * journal per filter watches for changes and resumes them. */
+struct JournalWatch {
+        char *filter;
+        sd_journal *journal;
+        sd_event_source *event;
+
+        LIST_HEAD(RequestMeta, followers);
+};
 
 static const char* const mime_types[_OUTPUT_MODE_MAX] = {
         [OUTPUT_SHORT] = "text/plain",
@@ -92,6 +128,34 @@ static RequestMeta *request_meta(void **connection_cls) {
         return m;
 }
 
+static void journal_watch_free(JournalWatch *w) {
+        if (!w)
+                return;
+
+        assert(!w->followers);
+
+        hashmap_remove(journal_watches, w->filter);
+
+        sd_event_source_unref(w->event);
+        sd_journal_close(w->journal);
+
+        free(w->filter);
+        free(w);
+}
+
+static void journal_watch_detach(RequestMeta *m) {
+        JournalWatch *w = m->watch;
+
+        if (!w)
+                return;
+
+        LIST_REMOVE(followers, w->followers, m);
+        m->watch = NULL;
+
+        if (!w->followers)
+                journal_watch_free(w);
+}
+
 static void request_meta_free(
                 void *cls,
                 struct MHD_Connection *connection,
@@ -103,21 +167,249 @@ static void request_meta_free(
         if (!m)
                 return;
 
+        journal_watch_detach(m);
+
         sd_journal_close(m->journal);
 
         safe_fclose(m->tmp);
 
+        strv_free(m->matches);
         free(m->cursor);
         free(m);
 }
 
+static int open_journal_matches(sd_journal **ret, char **matches) {
+        sd_journal *j;
+        char **match;
+        int r;
+
+        r = sd_journal_open(&j, SD_JOURNAL_LOCAL_ONLY|SD_JOURNAL_SYSTEM);
+        if (r < 0)
+                return r;
+
+        STRV_FOREACH(match, matches) {
+                r = sd_journal_add_match(j, *match, 0);
+                if (r < 0) {
+                        sd_journal_close(j);
+                        return r;
+                }
+        }
+
+        *ret = j;
+        return 0;
+}
+
 static int open_journal(RequestMeta *m) {
         assert(m);
 
         if (m->journal)
                 return 0;
 
-        return sd_journal_open(&m->journal, SD_JOURNAL_LOCAL_ONLY|SD_JOURNAL_SYSTEM);
+        return open_journal_matches(&m->journal, m->matches);
+}
+
+static int request_meta_add_match(RequestMeta *m, const char *match) {
+        int r;
+
+        assert(m);
+        assert(match);
+
+        r = sd_journal_add_match(m->journal, match, 0);
+        if (r < 0)
+                return r;
+
+        return strv_extend(&m->matches, match);
+}
+
+static int request_meta_seek(RequestMeta *m) {
+        assert(m);
+
+        if (m->cursor)
+                return sd_journal_seek_cursor(m->journal, m->cursor);
+        else if (m->n_skip >= 0)
+                return sd_journal_seek_head(m->journal);
+        else
+                return sd_journal_seek_tail(m->journal);
+}
+
+static int request_meta_refresh(RequestMeta *m) {
+        _cleanup_free_ char *cursor = NULL;
+        int r;
+
+        assert(m);
+
+        /* Reposition the journal at the entry we sent last, so that
+         * the entries appended in the meantime are looked at, and
+         * reopen it if files came or went */
+
+        m->changed = false;
+
+        r = sd_journal_get_cursor(m->journal, &cursor);
+        if (r < 0 && r != -EADDRNOTAVAIL)
+                return r;
+
+        if (m->reopen) {
+                m->reopen = false;
+
+                sd_journal_close(m->journal);
+                m->journal = NULL;
+
+                r = open_journal(m);
+                if (r < 0)
+                        return r;
+        }
+
+        if (!cursor)
+                /* Nothing was sent yet, start over */
+                return request_meta_seek(m);
+
+        r = sd_journal_seek_cursor(m->journal, cursor);
+        if (r < 0)
+                return r;
+
+        r = sd_journal_next(m->journal);
+        if (r <= 0)
+                return r;
+
+        r = sd_journal_test_cursor(m->journal, cursor);
+        if (r < 0)
+                return r;
+        if (r == 0)
+                /* The entry is gone, we are at the one after it,
+                 * which hasn't been sent yet */
+                return sd_journal_previous(m->journal);
+
+        return 0;
+}
+
+static void journal_watch_wake(JournalWatch *w, bool reopen) {
+        RequestMeta *m;
+
+        assert(w);
+
+        LIST_FOREACH(followers, m, w->followers) {
+                m->changed = true;
+                if (reopen)
+                        m->reopen = true;
+
+                if (m->suspended) {
+                        m->suspended = false;
+                        MHD_resume_connection(m->connection);
+                }
+        }
+}
+
+static int dispatch_journal_watch(sd_event_source *event,
+                                  int fd,
+                                  uint32_t revents,
+                                  void *userdata) {
+        JournalWatch *w = userdata;
+        bool reopen = false;
+        int r;
+
+        assert(w);
+
+        r = sd_journal_process(w->journal);
+        if (r < 0) {
+                /* Let the followers find out for themselves */
+                log_warning_errno(r, "Failed to process journal events: %m");
+                reopen = true;
+        } else if (r == SD_JOURNAL_NOP)
+                return 0;
+        else if (r == SD_JOURNAL_INVALIDATE)
+                reopen = true;
+        else {
+                /* Only wake up the followers if there is
+                 * something new for their filter */
+                r = sd_journal_next(w->journal);
+                if (r == 0)
+                        return 0;
+                if (r < 0)
+                        log_warning_errno(r, "Failed to advance journal pointer: %m");
+        }
+
+        /* The followers look at the new entries themselves */
+        r = sd_journal_seek_tail(w->journal);
+        if (r >= 0)
+                r = sd_journal_previous(w->journal);
+        if (r < 0)
+                log_warning_errno(r, "Failed to seek to end of journal: %m");
+
+        journal_watch_wake(w, reopen);
+
+        /* Let the resumed connections run right away. Note that
+         * they might be freed, and w with them. */
+        if (MHD_run(gateway_daemon) == MHD_NO)
+                log_error("MHD_run failed!");
+
+        return 0;
+}
+
+static int journal_watch_attach(RequestMeta *m) {
+        _cleanup_strv_free_ char **sorted = NULL;
+        _cleanup_free_ char *filter = NULL;
+        JournalWatch *w;
+        int r, fd;
+
+        assert(m);
+        assert(!m->watch);
+
+        sorted = strv_copy(m->matches);
+        if (!sorted)
+                return -ENOMEM;
+
+        filter = strv_join(strv_sort(sorted), "\n");
+        if (!filter)
+                return -ENOMEM;
+
+        w = hashmap_get(journal_watches, filter);
+        if (!w) {
+                r = hashmap_ensure_allocated(&journal_watches, &string_hash_ops);
+                if (r < 0)
+                        return r;
+
+                w = new0(JournalWatch, 1);
+                if (!w)
+                        return -ENOMEM;
+
+                w->filter = filter;
+                filter = NULL;
+
+                r = open_journal_matches(&w->journal, m->matches);
+                if (r < 0)
+                        goto fail;
+
+                fd = sd_journal_get_fd(w->journal);
+                if (fd < 0) {
+                        r = fd;
+                        goto fail;
+                }
+
+                r = sd_journal_seek_tail(w->journal);
+                if (r >= 0)
+                        r = sd_journal_previous(w->journal);
+                if (r < 0)
+                        goto fail;
+
+                r = sd_event_add_io(gateway_event, &w->event, fd,
+                                    sd_journal_get_events(w->journal),
+                                    dispatch_journal_watch, w);
+                if (r < 0)
+                        goto fail;
+
+                r = hashmap_put(journal_watches, w->filter, w);
+                if (r < 0)
+                        goto fail;
+        }
+
+        LIST_PREPEND(followers, w->followers, m);
+        m->watch = w;
+
+        return 0;
+
+fail:
+        journal_watch_free(w);
+        return r;
 }
 
 static int request_meta_ensure_tmp(RequestMeta *m) {
@@ -180,13 +472,20 @@ static ssize_t request_reader_entries(
                 } else if (r == 0) {
 
                         if (m->follow) {
-                                r = sd_journal_wait(m->journal, (uint64_t) -1);
-                                if (r < 0) {
-                                        log_error_errno(r, "Couldn't wait for journal event: %m");
-                                        return MHD_CONTENT_READER_END_WITH_ERROR;
+                                if (m->changed) {
+                                        r = request_meta_refresh(m);
+                                        if (r < 0) {
+                                                log_error_errno(r, "Failed to refresh journal: %m");
+                                                return MHD_CONTENT_READER_END_WITH_ERROR;
+                                        }
+
+                                        continue;
                                 }
 
-                                continue;
+                                /* Wait for the watch to resume us */
+                                MHD_suspend_connection(m->connection);
+                                m->suspended = true;
+                                return 0;
                         }
 
                         return MHD_CONTENT_READER_END_OF_STREAM;
@@ -413,7 +712,7 @@ static int request_parse_arguments_iterator(
                         }
 
                         sd_id128_to_string(bid, match + 9);
-                        r = sd_journal_add_match(m->journal, match, sizeof(match)-1);
+                        r = request_meta_add_match(m, match);
                         if (r < 0) {
                                 m->argument_parse_error = r;
                                 return MHD_NO;
@@ -429,7 +728,7 @@ static int request_parse_arguments_iterator(
                 return MHD_NO;
         }
 
-        r = sd_journal_add_match(m->journal, p, 0);
+        r = request_meta_add_match(m, p);
         if (r < 0) {
                 m->argument_parse_error = r;
                 return MHD_NO;
@@ -483,15 +782,18 @@ static int request_handler_entries(
                 m->n_entries_set = true;
         }
 
-        if (m->cursor)
-                r = sd_journal_seek_cursor(m->journal, m->cursor);
-        else if (m->n_skip >= 0)
-                r = sd_journal_seek_head(m->journal);
-        else if (m->n_skip < 0)
-                r = sd_journal_seek_tail(m->journal);
+        r = request_meta_seek(m);
         if (r < 0)
                 return mhd_respond(connection, MHD_HTTP_BAD_REQUEST, "Failed to seek in journal.\n");
 
+        if (m->follow) {
+                m->connection = connection;
+
+                r = journal_watch_attach(m);
+                if (r < 0)
+                        return mhd_respondf(connection, MHD_HTTP_INTERNAL_SERVER_ERROR, "Failed to watch journal: %s\n", strerror(-r));
+        }
+
         response = MHD_create_response_from_callback(MHD_SIZE_UNKNOWN, 4*1024, request_reader_entries, m, NULL);
         if (!response)
                 return respond_oom(connection);
@@ -975,7 +1277,47 @@ static int parse_argv(int argc, char *argv[]) {
         return 1;
 }
 
+static int dispatch_http_event(sd_event_source *event,
+                               int fd,
+                               uint32_t revents,
+                               void *userdata) {
+        struct MHD_Daemon *d = userdata;
+        int r;
+
+        assert(d);
+
+        r = MHD_run(d);
+        if (r == MHD_NO) {
+                log_error("MHD_run failed!");
+                return -EINVAL;
+        }
+
+        return 1; /* work to do */
+}
+
+static void stop_followers(void) {
+        JournalWatch *w;
+        RequestMeta *m;
+        Iterator i;
+
+        /* microhttpd refuses to stop with suspended connections,
+         * hence let them finish */
+        HASHMAP_FOREACH(w, journal_watches, i)
+                LIST_FOREACH(followers, m, w->followers) {
+                        m->follow = false;
+
+                        if (m->suspended) {
+                                m->suspended = false;
+                                MHD_resume_connection(m->connection);
+                        }
+                }
+
+        MHD_run(gateway_daemon);
+}
+
 int main(int argc, char *argv[]) {
+        sd_event_source *http_event = NULL, *sigterm_event = NULL, *sigint_event = NULL;
+        const union MHD_DaemonInfo *info;
         struct MHD_Daemon *d = NULL;
         int r, n;
 
@@ -995,6 +1337,25 @@ int main(int argc, char *argv[]) {
         if (r < 0)
                 return EXIT_FAILURE;
 
+        r = sd_event_default(&gateway_event);
+        if (r < 0) {
+                log_error_errno(r, "Failed to allocate event loop: %m");
+                return EXIT_FAILURE;
+        }
+
+        assert_se(sigprocmask_many(SIG_SETMASK, NULL, SIGINT, SIGTERM, -1) >= 0);
+
+        r = sd_event_add_signal(gateway_event, &sigterm_event, SIGTERM, NULL, NULL);
+        if (r >= 0)
+                r = sd_event_add_signal(gateway_event, &sigint_event, SIGINT, NULL, NULL);
+        if (r < 0) {
+                log_error_errno(r, "Failed to install signal handlers: %m");
+                r = EXIT_FAILURE;
+                goto finish;
+        }
+
+        r = EXIT_FAILURE;
+
         n = sd_listen_fds(1);
         if (n < 0) {
                 log_error_errno(n, "Failed to determine passed sockets: %m");
@@ -1014,7 +1375,7 @@ int main(int argc, char *argv[]) {
                         { MHD_OPTION_END, 0, NULL },
                         { MHD_OPTION_END, 0, NULL }};
                 int opts_pos = 2;
-                int flags = MHD_USE_THREAD_PER_CONNECTION|MHD_USE_POLL|MHD_USE_DEBUG;
+                int flags = MHD_USE_EPOLL_LINUX_ONLY|MHD_USE_SUSPEND_RESUME|MHD_USE_DEBUG;
 
                 if (n > 0)
                         opts[opts_pos++] = (struct MHD_OptionItem)
@@ -1045,13 +1406,44 @@ int main(int argc, char *argv[]) {
                 goto finish;
         }
 
-        pause();
+        gateway_daemon = d;
 
-        r = EXIT_SUCCESS;
+        info = MHD_get_daemon_info(d, MHD_DAEMON_INFO_EPOLL_FD_LINUX_ONLY);
+        if (!info) {
+                log_error("µhttp returned NULL daemon info");
+                goto finish;
+        }
+
+        r = sd_event_add_io(gateway_event, &http_event,
+                            info->listen_fd, EPOLLIN,
+                            dispatch_http_event, d);
+        if (r < 0) {
+                log_error_errno(r, "Failed to add event callback: %m");
+                r = EXIT_FAILURE;
+                goto finish;
+        }
+
+        r = sd_event_loop(gateway_event);
+        if (r < 0) {
+                log_error_errno(r, "Failed to run event loop: %m");
+                r = EXIT_FAILURE;
+        } else
+                r = EXIT_SUCCESS;
 
 finish:
-        if (d)
+        if (d) {
+                stop_followers();
                 MHD_stop_daemon(d);
+        }
+
+        /* All connections are gone, and with them the watches */
+        assert(hashmap_isempty(journal_watches));
+        hashmap_free(journal_watches);
+
+        sd_event_source_unref(http_event);
+        sd_event_source_unref(sigterm_event);
+        sd_event_source_unref(sigint_event);
+        sd_event_unref(gateway_event);
 
         return r;
 }
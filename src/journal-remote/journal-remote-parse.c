@@ -24,6 +24,10 @@
 
 #define LINE_CHUNK 8*1024u
 
+/* How much compressed data is inflated at most before the entries in
+ * it are processed */
+#define INFLATE_CHUNK (16*LINE_CHUNK)
+
 void source_free(RemoteSource *source) {
         if (!source)
                 return;
@@ -37,6 +41,13 @@ void source_free(RemoteSource *source) {
         free(source->buf);
         iovw_free_contents(&source->iovw);
 
+#ifdef HAVE_ZLIB
+        if (source->gzip) {
+                inflateEnd(source->gzip);
+                free(source->gzip);
+        }
+#endif
+
         log_debug("Writer ref count %i", source->writer->n_ref);
         writer_unref(source->writer);
 
@@ -74,6 +85,16 @@ RemoteSource* source_new(int fd, bool passive_fd, char *name, Writer *writer) {
 static char* realloc_buffer(RemoteSource *source, size_t size) {
         char *b, *old = source->buf;
 
+        /* Without live data there is nothing to carry over, hence
+         * don't let realloc() copy the stale contents */
+        if (source->filled == 0 && size > source->size) {
+                assert(source->iovw.count == 0);
+
+                source->buf = mfree(source->buf);
+                source->size = 0;
+                old = NULL;
+        }
+
         b = GREEDY_REALLOC(source->buf, source->size, size);
         if (!b)
                 return NULL;
@@ -147,9 +168,82 @@ static int get_line(RemoteSource *source, char **line, size_t *size) {
         return 1;
 }
 
-int push_data(RemoteSource *source, const char *data, size_t size) {
+int source_enable_gzip(RemoteSource *source) {
+#ifdef HAVE_ZLIB
+        z_stream *z;
+
+        assert(source);
+        assert(source->passive_fd);
+
+        if (source->gzip)
+                return 0;
+
+        z = new0(z_stream, 1);
+        if (!z)
+                return -ENOMEM;
+
+        /* 16 + MAX_WBITS accepts the gzip format only */
+        if (inflateInit2(z, 16 + MAX_WBITS) != Z_OK) {
+                free(z);
+                return -ENOMEM;
+        }
+
+        source->gzip = z;
+        return 0;
+#else
+        return -EOPNOTSUPP;
+#endif
+}
+
+#ifdef HAVE_ZLIB
+static int push_data_gzip(RemoteSource *source, const char *data, size_t size, size_t *consumed) {
+        z_stream *z = source->gzip;
+        size_t limit;
+
+        z->next_in = (Bytef*) data;
+        z->avail_in = size;
+
+        /* Inflate only a bit at a time, so that the entries can be
+         * processed before the next part is inflated, and a small
+         * upload can't make us allocate a huge buffer */
+        limit = source->filled + INFLATE_CHUNK;
+
+        while (z->avail_in > 0 && source->filled < limit) {
+                int r;
+
+                if (!realloc_buffer(source, limit))
+                        return log_oom();
+
+                z->next_out = (Bytef*) source->buf + source->filled;
+                z->avail_out = limit - source->filled;
+
+                r = inflate(z, Z_NO_FLUSH);
+                source->filled = (char*) z->next_out - source->buf;
+
+                if (r == Z_STREAM_END) {
+                        /* Concatenated gzip members are allowed */
+                        if (inflateReset(z) != Z_OK)
+                                return -EIO;
+                } else if (r != Z_OK) {
+                        log_error("Failed to decompress received data: %s", strna(z->msg));
+                        return -EBADMSG;
+                }
+        }
+
+        *consumed = size - z->avail_in;
+        return 0;
+}
+#endif
+
+int push_data(RemoteSource *source, const char *data, size_t size, size_t *consumed) {
         assert(source);
         assert(source->state != STATE_EOF);
+        assert(consumed);
+
+#ifdef HAVE_ZLIB
+        if (source->gzip)
+                return push_data_gzip(source, data, size, consumed);
+#endif
 
         if (!realloc_buffer(source, source->filled + size)) {
                 log_error("Failed to store received data of size %zu "
@@ -161,6 +255,7 @@ int push_data(RemoteSource *source, const char *data, size_t size) {
         memcpy(source->buf + source->filled, data, size);
         source->filled += size;
 
+        *consumed = size;
         return 0;
 }
 
@@ -454,7 +549,7 @@ int process_source(RemoteSource *source, bool compress, bool seal) {
 
         if (!source->iovw.count) {
                 log_warning("Entry with no payload, skipping");
-                goto freeing;
+                goto finish;
         }
 
         assert(source->iovw.iovec);
@@ -467,8 +562,10 @@ int process_source(RemoteSource *source, bool compress, bool seal) {
         else
                 r = 1;
 
- freeing:
-        iovw_free_contents(&source->iovw);
+ finish:
+        /* The fields point into the buffer, and were used by the
+         * writer already, the array is reused for the next entry */
+        iovw_reset(&source->iovw);
 
         /* possibly reset buffer position */
         remain = source->filled - source->offset;
@@ -482,8 +579,11 @@ int process_source(RemoteSource *source, bool compress, bool seal) {
                 source->filled = remain;
         }
 
+        /* Shrink only once the buffer is drained, so that a large
+         * entry doesn't make us copy the data following it back and
+         * forth */
         target = source->size;
-        while (target > 16 * LINE_CHUNK && remain < target / 2)
+        while (remain == 0 && target > 16 * LINE_CHUNK)
                 target /= 2;
         if (target < source->size) {
                 char *tmp;
@@ -21,6 +21,10 @@
 
 #pragma once
 
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
 #include "sd-event.h"
 #include "journal-remote-write.h"
 
@@ -53,6 +57,10 @@ typedef struct RemoteSource {
 
         Writer *writer;
 
+#ifdef HAVE_ZLIB
+        z_stream *gzip;    /* set if the data is pushed gzip compressed */
+#endif
+
         sd_event_source *event;
         sd_event_source *buffer_event;
 } RemoteSource;
@@ -66,5 +74,6 @@ static inline size_t source_non_empty(RemoteSource *source) {
 }
 
 void source_free(RemoteSource *source);
-int push_data(RemoteSource *source, const char *data, size_t size);
+int source_enable_gzip(RemoteSource *source);
+int push_data(RemoteSource *source, const char *data, size_t size, size_t *consumed);
 int process_source(RemoteSource *source, bool compress, bool seal);
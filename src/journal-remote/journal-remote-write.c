@@ -19,8 +19,45 @@
   along with systemd; If not, see <http://www.gnu.org/licenses/>.
 ***/
 
+#include <pthread.h>
+
+#include "list.h"
 #include "journal-remote.h"
 
+/* How much parsed data may be queued for one shard's thread, before
+ * the event loop waits for it */
+#define WRITER_SHARD_QUEUE_SIZE_MAX (16U*1024U*1024U)
+
+typedef struct WriteRequest WriteRequest;
+
+struct WriteRequest {
+        Writer *writer;
+        dual_timestamp ts;
+        bool compress:1;
+        bool seal:1;
+        bool close:1;   /* free the writer, instead of writing */
+        size_t size;
+
+        LIST_FIELDS(WriteRequest, requests);
+
+        unsigned n_iovec;
+        struct iovec iovec[];
+};
+
+struct WriterShard {
+        pthread_t thread;
+
+        /* Protects the fields below */
+        pthread_mutex_t lock;
+        pthread_cond_t queue_cond;
+        pthread_cond_t space_cond;
+
+        LIST_HEAD(WriteRequest, queue);
+        WriteRequest *queue_tail;
+        size_t queue_size;
+        bool stop;
+};
+
 int iovw_put(struct iovec_wrapper *iovw, void* data, size_t len) {
         if (!GREEDY_REALLOC(iovw->iovec, iovw->size_bytes, iovw->count + 1))
                 return log_oom();
@@ -34,6 +71,11 @@ void iovw_free_contents(struct iovec_wrapper *iovw) {
         iovw->size_bytes = iovw->count = 0;
 }
 
+/* Forgets the entries, but keeps the array for the next ones */
+void iovw_reset(struct iovec_wrapper *iovw) {
+        iovw->count = 0;
+}
+
 size_t iovw_size(struct iovec_wrapper *iovw) {
         size_t n = 0, i;
 
@@ -87,24 +129,84 @@ Writer* writer_new(RemoteServer *server) {
         return w;
 }
 
-Writer* writer_free(Writer *w) {
-        if (!w)
-                return NULL;
+static void writer_close(Writer *w) {
+        assert(w);
 
         if (w->journal) {
                 log_debug("Closing journal file %s.", w->journal->path);
                 journal_file_close(w->journal);
         }
 
-        if (w->server && w->hashmap_key)
-                hashmap_remove(w->server->writers, w->hashmap_key);
-
         free(w->hashmap_key);
 
         if (w->mmap)
                 mmap_cache_unref(w->mmap);
 
         free(w);
+}
+
+static void shard_enqueue(WriterShard *s, WriteRequest *r) {
+        assert(s);
+        assert(r);
+
+        assert_se(pthread_mutex_lock(&s->lock) == 0);
+
+        while (s->queue_size > 0 && s->queue_size + r->size > WRITER_SHARD_QUEUE_SIZE_MAX)
+                assert_se(pthread_cond_wait(&s->space_cond, &s->lock) == 0);
+
+        LIST_INSERT_AFTER(requests, s->queue, s->queue_tail, r);
+        s->queue_tail = r;
+        s->queue_size += r->size;
+
+        assert_se(pthread_cond_signal(&s->queue_cond) == 0);
+        assert_se(pthread_mutex_unlock(&s->lock) == 0);
+}
+
+static void shard_drain(WriterShard *s) {
+        assert(s);
+
+        /* The queue size drops only after the thread is done with
+         * the requests it took */
+        assert_se(pthread_mutex_lock(&s->lock) == 0);
+
+        while (s->queue_size > 0)
+                assert_se(pthread_cond_wait(&s->space_cond, &s->lock) == 0);
+
+        assert_se(pthread_mutex_unlock(&s->lock) == 0);
+}
+
+Writer* writer_free(Writer *w) {
+        WriteRequest *r;
+
+        if (!w)
+                return NULL;
+
+        /* The hashmap belongs to the event loop thread, the rest of
+         * the writer to the shard, if there is one */
+        if (w->server && w->hashmap_key)
+                hashmap_remove(w->server->writers, w->hashmap_key);
+
+        if (!w->shard) {
+                writer_close(w);
+                return NULL;
+        }
+
+        /* Queue the close after the entries still pending. The
+         * request can't be dropped, hence on OOM wait until these
+         * are written, and close right here. */
+        r = new0(WriteRequest, 1);
+        if (!r) {
+                log_oom();
+                shard_drain(w->shard);
+                writer_close(w);
+                return NULL;
+        }
+
+        r->writer = w;
+        r->close = true;
+        r->size = sizeof(WriteRequest);
+
+        shard_enqueue(w->shard, r);
 
         return NULL;
 }
@@ -123,16 +225,17 @@ Writer* writer_ref(Writer *w) {
         return w;
 }
 
-int writer_write(Writer *w,
-                 struct iovec_wrapper *iovw,
-                 dual_timestamp *ts,
-                 bool compress,
-                 bool seal) {
+static int writer_write_now(Writer *w,
+                            struct iovec *iovec,
+                            unsigned n_iovec,
+                            dual_timestamp *ts,
+                            bool compress,
+                            bool seal) {
         int r;
 
         assert(w);
-        assert(iovw);
-        assert(iovw->count > 0);
+        assert(iovec);
+        assert(n_iovec > 0);
 
         if (journal_file_rotate_suggested(w->journal, 0)) {
                 log_info("%s: Journal header limits reached or header out-of-date, rotating",
@@ -142,13 +245,10 @@ int writer_write(Writer *w,
                         return r;
         }
 
-        r = journal_file_append_entry(w->journal, ts, iovw->iovec, iovw->count,
+        r = journal_file_append_entry(w->journal, ts, iovec, n_iovec,
                                       &w->seqnum, NULL, NULL);
-        if (r >= 0) {
-                if (w->server)
-                        w->server->event_count += 1;
+        if (r >= 0)
                 return 1;
-        }
 
         log_debug_errno(r, "%s: Write failed, rotating: %m", w->journal->path);
         r = do_rotate(&w->journal, compress, seal);
@@ -158,12 +258,176 @@ int writer_write(Writer *w,
                 log_debug("%s: Successfully rotated journal", w->journal->path);
 
         log_debug("Retrying write.");
-        r = journal_file_append_entry(w->journal, ts, iovw->iovec, iovw->count,
+        r = journal_file_append_entry(w->journal, ts, iovec, n_iovec,
                                       &w->seqnum, NULL, NULL);
         if (r < 0)
                 return r;
 
+        return 1;
+}
+
+int writer_write(Writer *w,
+                 struct iovec_wrapper *iovw,
+                 dual_timestamp *ts,
+                 bool compress,
+                 bool seal) {
+        WriteRequest *r;
+        size_t size, i;
+        uint8_t *p;
+        int k;
+
+        assert(w);
+        assert(iovw);
+        assert(iovw->count > 0);
+
+        if (!w->shard) {
+                k = writer_write_now(w, iovw->iovec, iovw->count, ts, compress, seal);
+                if (k >= 0 && w->server)
+                        w->server->event_count += 1;
+
+                return k;
+        }
+
+        /* The iovecs point into the receive buffer of the source,
+         * which is reused for the next entry, hence copy the data
+         * right behind the iovec array */
+        size = offsetof(WriteRequest, iovec) + iovw->count * sizeof(struct iovec) + iovw_size(iovw);
+
+        r = malloc(size);
+        if (!r)
+                return log_oom();
+
+        *r = (WriteRequest) {
+                .writer = w,
+                .ts = *ts,
+                .compress = compress,
+                .seal = seal,
+                .size = size,
+                .n_iovec = iovw->count,
+        };
+
+        p = (uint8_t*) (r->iovec + iovw->count);
+        for (i = 0; i < iovw->count; i++) {
+                r->iovec[i].iov_base = p;
+                r->iovec[i].iov_len = iovw->iovec[i].iov_len;
+                p = mempcpy(p, iovw->iovec[i].iov_base, iovw->iovec[i].iov_len);
+        }
+
+        shard_enqueue(w->shard, r);
+
+        /* Counted as soon as it is handed over, errors are logged
+         * by the shard */
         if (w->server)
                 w->server->event_count += 1;
+
         return 1;
 }
+
+static void shard_process(WriteRequest *batch) {
+        WriteRequest *r;
+        int k;
+
+        while ((r = batch)) {
+                LIST_REMOVE(requests, batch, r);
+
+                if (r->close)
+                        writer_close(r->writer);
+                else {
+                        k = writer_write_now(r->writer, r->iovec, r->n_iovec, &r->ts, r->compress, r->seal);
+                        if (k < 0)
+                                log_error_errno(k, "Failed to write entry, ignoring: %m");
+                }
+
+                free(r);
+        }
+}
+
+static void *shard_thread(void *p) {
+        WriterShard *s = p;
+
+        assert_se(pthread_mutex_lock(&s->lock) == 0);
+
+        for (;;) {
+                WriteRequest *batch, *i;
+                size_t size = 0;
+
+                while (!s->queue && !s->stop)
+                        assert_se(pthread_cond_wait(&s->queue_cond, &s->lock) == 0);
+
+                if (!s->queue)
+                        break;
+
+                /* Take the whole queue at once, and process it
+                 * without holding the lock */
+                batch = s->queue;
+                s->queue = s->queue_tail = NULL;
+
+                assert_se(pthread_mutex_unlock(&s->lock) == 0);
+
+                LIST_FOREACH(requests, i, batch)
+                        size += i->size;
+
+                shard_process(batch);
+
+                assert_se(pthread_mutex_lock(&s->lock) == 0);
+
+                assert(s->queue_size >= size);
+                s->queue_size -= size;
+                assert_se(pthread_cond_broadcast(&s->space_cond) == 0);
+        }
+
+        assert_se(pthread_mutex_unlock(&s->lock) == 0);
+
+        return NULL;
+}
+
+int writer_shard_new(WriterShard **ret) {
+        WriterShard *s;
+        int r;
+
+        assert(ret);
+
+        s = new0(WriterShard, 1);
+        if (!s)
+                return -ENOMEM;
+
+        assert_se(pthread_mutex_init(&s->lock, NULL) == 0);
+        assert_se(pthread_cond_init(&s->queue_cond, NULL) == 0);
+        assert_se(pthread_cond_init(&s->space_cond, NULL) == 0);
+
+        /* The thread inherits our signal mask, which blocks all the
+         * signals we handle via signalfd() */
+        r = pthread_create(&s->thread, NULL, shard_thread, s);
+        if (r != 0) {
+                pthread_cond_destroy(&s->space_cond);
+                pthread_cond_destroy(&s->queue_cond);
+                pthread_mutex_destroy(&s->lock);
+                free(s);
+                return -r;
+        }
+
+        *ret = s;
+        return 0;
+}
+
+WriterShard* writer_shard_free(WriterShard *s) {
+        if (!s)
+                return NULL;
+
+        /* Let the thread write out whatever is still queued */
+        assert_se(pthread_mutex_lock(&s->lock) == 0);
+        s->stop = true;
+        assert_se(pthread_cond_signal(&s->queue_cond) == 0);
+        assert_se(pthread_mutex_unlock(&s->lock) == 0);
+
+        assert_se(pthread_join(s->thread, NULL) == 0);
+
+        assert(!s->queue);
+
+        pthread_cond_destroy(&s->space_cond);
+        pthread_cond_destroy(&s->queue_cond);
+        pthread_mutex_destroy(&s->lock);
+
+        free(s);
+        return NULL;
+}
@@ -25,6 +25,7 @@
 #include "journal-file.h"
 
 typedef struct RemoteServer RemoteServer;
+typedef struct WriterShard WriterShard;
 
 struct iovec_wrapper {
         struct iovec *iovec;
@@ -34,6 +35,7 @@ struct iovec_wrapper {
 
 int iovw_put(struct iovec_wrapper *iovw, void* data, size_t len);
 void iovw_free_contents(struct iovec_wrapper *iovw);
+void iovw_reset(struct iovec_wrapper *iovw);
 size_t iovw_size(struct iovec_wrapper *iovw);
 void iovw_rebase(struct iovec_wrapper *iovw, char *old, char *new);
 
@@ -47,6 +49,10 @@ typedef struct Writer {
 
         uint64_t seqnum;
 
+        /* If set, entries are written by the thread of this shard,
+         * which also closes the journal file eventually */
+        WriterShard *shard;
+
         int n_ref;
 } Writer;
 
@@ -65,6 +71,9 @@ int writer_write(Writer *s,
                  bool compress,
                  bool seal);
 
+int writer_shard_new(WriterShard **ret);
+WriterShard* writer_shard_free(WriterShard *s);
+
 typedef enum JournalWriteSplitMode {
         JOURNAL_WRITE_SPLIT_NONE,
         JOURNAL_WRITE_SPLIT_HOST,
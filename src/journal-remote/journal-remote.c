@@ -65,6 +65,7 @@ static int http_socket = -1, https_socket = -1;
 static char** arg_gnutls_log = NULL;
 
 static JournalWriteSplitMode arg_split_mode = JOURNAL_WRITE_SPLIT_HOST;
+static unsigned arg_writer_threads = 0;
 static char* arg_output = NULL;
 
 static char *arg_key = NULL;
@@ -271,6 +272,11 @@ static int get_writer(RemoteServer *s, const char *host,
                 r = hashmap_put(s->writers, w->hashmap_key ?: key, w);
                 if (r < 0)
                         return r;
+
+                /* All entries of one output file are written by the
+                 * same thread, hence stay in order */
+                if (s->n_shards > 0)
+                        w->shard = s->shards[s->next_shard++ % s->n_shards];
         }
 
         *writer = w;
@@ -507,34 +513,46 @@ static int process_http_upload(
         log_trace("%s: connection %p, %zu bytes",
                   __func__, connection, *upload_data_size);
 
-        if (*upload_data_size) {
+        if (*upload_data_size)
                 log_trace("Received %zu bytes", *upload_data_size);
+        else
+                finished = true;
 
-                r = push_data(source, upload_data, *upload_data_size);
-                if (r < 0)
-                        return mhd_respond_oom(connection);
+        /* Compressed data is pushed in parts, each followed by
+         * processing the entries in it */
+        do {
+                if (*upload_data_size) {
+                        size_t n;
 
-                *upload_data_size = 0;
-        } else
-                finished = true;
+                        r = push_data(source, upload_data, *upload_data_size, &n);
+                        if (r == -EBADMSG)
+                                return mhd_respond(connection, MHD_HTTP_BAD_REQUEST,
+                                                   "Failed to decompress data.\n");
+                        if (r < 0)
+                                return mhd_respond_oom(connection);
 
-        for (;;) {
-                r = process_source(source, arg_compress, arg_seal);
-                if (r == -EAGAIN)
-                        break;
-                else if (r < 0) {
-                        log_warning("Failed to process data for connection %p", connection);
-                        if (r == -E2BIG)
-                                return mhd_respondf(connection,
-                                                    MHD_HTTP_REQUEST_ENTITY_TOO_LARGE,
-                                                    "Entry is too large, maximum is %u bytes.\n",
-                                                    DATA_SIZE_MAX);
-                        else
-                                return mhd_respondf(connection,
-                                                    MHD_HTTP_UNPROCESSABLE_ENTITY,
-                                                    "Processing failed: %s.", strerror(-r));
+                        upload_data += n;
+                        *upload_data_size -= n;
                 }
-        }
+
+                for (;;) {
+                        r = process_source(source, arg_compress, arg_seal);
+                        if (r == -EAGAIN)
+                                break;
+                        else if (r < 0) {
+                                log_warning("Failed to process data for connection %p", connection);
+                                if (r == -E2BIG)
+                                        return mhd_respondf(connection,
+                                                            MHD_HTTP_REQUEST_ENTITY_TOO_LARGE,
+                                                            "Entry is too large, maximum is %u bytes.\n",
+                                                            DATA_SIZE_MAX);
+                                else
+                                        return mhd_respondf(connection,
+                                                            MHD_HTTP_UNPROCESSABLE_ENTITY,
+                                                            "Processing failed: %s.", strerror(-r));
+                        }
+                }
+        } while (*upload_data_size > 0);
 
         if (!finished)
                 return MHD_YES;
@@ -564,6 +582,7 @@ static int request_handler(
 
         const char *header;
         int r, code, fd;
+        bool gzip = false;
         _cleanup_free_ char *hostname = NULL;
 
         assert(connection);
@@ -593,6 +612,16 @@ static int request_handler(
                                    "Content-Type: application/vnd.fdo.journal"
                                    " is required.\n");
 
+        header = MHD_lookup_connection_value(connection,
+                                             MHD_HEADER_KIND, "Content-Encoding");
+        if (header && !streq(header, "identity")) {
+                if (!streq(header, "gzip"))
+                        return mhd_respond(connection, MHD_HTTP_UNSUPPORTED_MEDIA_TYPE,
+                                           "Content-Encoding: gzip or identity"
+                                           " is required.\n");
+                gzip = true;
+        }
+
         {
                 const union MHD_ConnectionInfo *ci;
 
@@ -629,6 +658,16 @@ static int request_handler(
                                    strerror(-r));
 
         hostname = NULL;
+
+        if (gzip) {
+                r = source_enable_gzip(*connection_cls);
+                if (r == -EOPNOTSUPP)
+                        return mhd_respond(connection, MHD_HTTP_UNSUPPORTED_MEDIA_TYPE,
+                                           "Content-Encoding: gzip is not supported.\n");
+                else if (r < 0)
+                        return respond_oom(connection);
+        }
+
         return MHD_YES;
 }
 
@@ -785,6 +824,31 @@ static int dispatch_http_event(sd_event_source *event,
  **********************************************************************
  **********************************************************************/
 
+static int setup_writer_shards(RemoteServer *s) {
+        unsigned i;
+        int r;
+
+        assert(s);
+
+        if (arg_writer_threads <= 0)
+                return 0;
+
+        s->shards = new0(WriterShard*, arg_writer_threads);
+        if (!s->shards)
+                return log_oom();
+
+        for (i = 0; i < arg_writer_threads; i++) {
+                r = writer_shard_new(&s->shards[i]);
+                if (r < 0)
+                        return log_error_errno(r, "Failed to start writer thread: %m");
+
+                s->n_shards++;
+        }
+
+        log_debug("Writing from %u threads.", s->n_shards);
+        return 0;
+}
+
 static int setup_signals(RemoteServer *s) {
         int r;
 
@@ -845,6 +909,12 @@ static int remoteserver_init(RemoteServer *s,
         if (r < 0)
                 return r;
 
+        /* After setup_signals(), so that the threads inherit the
+         * blocked signals */
+        r = setup_writer_shards(s);
+        if (r < 0)
+                return r;
+
         n = sd_listen_fds(true);
         if (n < 0)
                 return log_error_errno(n, "Failed to read listening file descriptors from environment: %m");
@@ -990,6 +1060,11 @@ static void server_destroy(RemoteServer *s) {
         writer_unref(s->_single_writer);
         hashmap_free(s->writers);
 
+        /* Writes out everything still queued, and closes the files */
+        for (i = 0; i < s->n_shards; i++)
+                writer_shard_free(s->shards[i]);
+        free(s->shards);
+
         sd_event_source_unref(s->sigterm_event);
         sd_event_source_unref(s->sigint_event);
         sd_event_source_unref(s->listen_event);
@@ -1175,6 +1250,7 @@ static int parse_config(void) {
                 { "Remote",  "ServerKeyFile",          config_parse_path,             0, &arg_key        },
                 { "Remote",  "ServerCertificateFile",  config_parse_path,             0, &arg_cert       },
                 { "Remote",  "TrustedCertificateFile", config_parse_path,             0, &arg_trust      },
+                { "Remote",  "WriterThreads",          config_parse_unsigned,         0, &arg_writer_threads },
                 {}};
 
         return config_parse_many(PKGSYSCONFDIR "/journal-remote.conf",
@@ -1205,6 +1281,7 @@ static void help(void) {
                "     --gnutls-log=CATEGORY...\n"
                "                            Specify a list of gnutls logging categories\n"
                "     --split-mode=none|host How many output files to create\n"
+               "     --writer-threads=N     Write output files from N threads (default: 0)\n"
                "\n"
                "Note: file descriptors from sd_listen_fds() will be consumed, too.\n"
                , program_invocation_short_name);
@@ -1225,6 +1302,7 @@ static int parse_argv(int argc, char *argv[]) {
                 ARG_CERT,
                 ARG_TRUST,
                 ARG_GNUTLS_LOG,
+                ARG_WRITER_THREADS,
         };
 
         static const struct option options[] = {
@@ -1243,6 +1321,7 @@ static int parse_argv(int argc, char *argv[]) {
                 { "cert",         required_argument, NULL, ARG_CERT         },
                 { "trust",        required_argument, NULL, ARG_TRUST        },
                 { "gnutls-log",   required_argument, NULL, ARG_GNUTLS_LOG   },
+                { "writer-threads", required_argument, NULL, ARG_WRITER_THREADS },
                 {}
         };
 
@@ -1407,6 +1486,15 @@ static int parse_argv(int argc, char *argv[]) {
 
                         break;
 
+                case ARG_WRITER_THREADS:
+                        r = safe_atou(optarg, &arg_writer_threads);
+                        if (r < 0) {
+                                log_error("Failed to parse --writer-threads= parameter.");
+                                return -EINVAL;
+                        }
+
+                        break;
+
                 case ARG_GNUTLS_LOG: {
 #ifdef HAVE_GNUTLS
                         const char *word, *state;
@@ -50,6 +50,9 @@ struct RemoteServer {
         Writer *_single_writer;
         uint64_t event_count;
 
+        WriterShard **shards;
+        unsigned n_shards, next_shard;
+
         bool check_trust;
         Hashmap *daemons;
 };
@@ -42,6 +42,9 @@
 #define TRUST_FILE    CERTIFICATE_ROOT "/ca/trusted.pem"
 #define DEFAULT_PORT  19532
 
+/* How much of the export stream is compressed in one go */
+#define COMPRESS_BUFFER_SIZE (64U*1024U)
+
 static const char* arg_url = NULL;
 static const char *arg_key = NULL;
 static const char *arg_cert = NULL;
@@ -55,6 +58,7 @@ static const char *arg_machine = NULL;
 static bool arg_merge = false;
 static int arg_follow = -1;
 static const char *arg_save_state = NULL;
+static bool arg_compress = false;
 
 static void close_fd_input(Uploader *u);
 
@@ -176,17 +180,114 @@ static int load_cursor_state(Uploader *u) {
 
 
 
+#ifdef HAVE_ZLIB
+static size_t compressed_input_callback(void *buf, size_t size, size_t nmemb, void *userp) {
+        Uploader *u = userp;
+        z_stream *z;
+        int r;
+
+        assert(u);
+        assert(nmemb <= SSIZE_MAX / size);
+
+        z = &u->zstream;
+        z->next_out = buf;
+        z->avail_out = size * nmemb;
+
+        while (z->avail_out > 0 && !u->compress_finished) {
+                bool partial = false;
+
+                if (z->avail_in == 0 && !u->input_eof) {
+                        size_t n;
+
+                        /* Fills the buffer with as many entries as fit */
+                        n = u->input_callback(u->compress_buffer, 1, COMPRESS_BUFFER_SIZE, u->input_data);
+                        if (n == CURL_READFUNC_ABORT)
+                                return n;
+
+                        if (n == 0)
+                                u->input_eof = true;
+
+                        /* Don't sit on data while waiting for more
+                         * input, the peer shall see it right away */
+                        partial = n < COMPRESS_BUFFER_SIZE;
+
+                        z->next_in = u->compress_buffer;
+                        z->avail_in = n;
+                }
+
+                r = deflate(z, u->input_eof ? Z_FINISH : partial ? Z_SYNC_FLUSH : Z_NO_FLUSH);
+                if (r == Z_STREAM_END)
+                        u->compress_finished = true;
+                else if (r != Z_OK && r != Z_BUF_ERROR) {
+                        log_error("Failed to compress upload: %s", strna(z->msg));
+                        return CURL_READFUNC_ABORT;
+                }
+
+                /* Hand over what we have, once the input ran dry */
+                if (partial && z->avail_out < size * nmemb)
+                        break;
+        }
+
+        return size * nmemb - z->avail_out;
+}
+
+static int setup_compression(Uploader *u) {
+        assert(u);
+
+        if (!u->compress_buffer) {
+                u->compress_buffer = malloc(COMPRESS_BUFFER_SIZE);
+                if (!u->compress_buffer)
+                        return log_oom();
+        }
+
+        /* Every upload is a request of its own, with a gzip stream
+         * of its own */
+        if (u->zstream_active) {
+                deflateEnd(&u->zstream);
+                u->zstream_active = false;
+        }
+
+        zero(u->zstream);
+
+        /* 16 + MAX_WBITS selects the gzip format, and the fastest
+         * level keeps the CPU cost below the one of TLS */
+        if (deflateInit2(&u->zstream, Z_BEST_SPEED, Z_DEFLATED, 16 + MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+                log_error("Failed to initialize compression: %s", strna(u->zstream.msg));
+                return -EIO;
+        }
+
+        u->zstream_active = true;
+        u->input_eof = u->compress_finished = false;
+
+        return 0;
+}
+#endif
+
 int start_upload(Uploader *u,
-                 size_t (*input_callback)(void *ptr,
-                                          size_t size,
-                                          size_t nmemb,
-                                          void *userdata),
+                 UploadInputCallback input_callback,
                  void *data) {
         CURLcode code;
+        UploadInputCallback callback = input_callback;
 
         assert(u);
         assert(input_callback);
 
+        u->input_callback = input_callback;
+        u->input_data = data;
+
+#ifdef HAVE_ZLIB
+        if (arg_compress) {
+                int r;
+
+                r = setup_compression(u);
+                if (r < 0)
+                        return r;
+
+                callback = compressed_input_callback;
+                data = u;
+        }
+#endif
+
         if (!u->header) {
                 struct curl_slist *h;
 
@@ -206,6 +307,14 @@ int start_upload(Uploader *u,
                         return log_oom();
                 }
 
+                if (arg_compress) {
+                        h = curl_slist_append(h, "Content-Encoding: gzip");
+                        if (!h) {
+                                curl_slist_free_all(h);
+                                return log_oom();
+                        }
+                }
+
                 u->header = h;
         }
 
@@ -233,7 +342,7 @@ int start_upload(Uploader *u,
                             LOG_ERR, return -EXFULL);
 
                 /* set where to read from */
-                easy_setopt(curl, CURLOPT_READFUNCTION, input_callback,
+                easy_setopt(curl, CURLOPT_READFUNCTION, callback,
                             LOG_ERR, return -EXFULL);
 
                 easy_setopt(curl, CURLOPT_READDATA, data,
@@ -469,6 +578,12 @@ static void destroy_uploader(Uploader *u) {
         curl_slist_free_all(u->header);
         free(u->answer);
 
+#ifdef HAVE_ZLIB
+        if (u->zstream_active)
+                deflateEnd(&u->zstream);
+        free(u->compress_buffer);
+#endif
+
         free(u->last_cursor);
         free(u->current_cursor);
 
@@ -533,6 +648,7 @@ static int parse_config(void) {
                 { "Upload",  "ServerKeyFile",          config_parse_path,   0, &arg_key    },
                 { "Upload",  "ServerCertificateFile",  config_parse_path,   0, &arg_cert   },
                 { "Upload",  "TrustedCertificateFile", config_parse_path,   0, &arg_trust  },
+                { "Upload",  "Compress",               config_parse_bool,   0, &arg_compress },
                 {}};
 
         return config_parse_many(PKGSYSCONFDIR "/journal-upload.conf",
@@ -565,6 +681,7 @@ static void help(void) {
                "     --follow[=BOOL]        Do [not] wait for input\n"
                "     --save-state[=FILE]    Save uploaded cursors (default \n"
                "                            " STATE_FILE ")\n"
+               "     --compress[=BOOL]      Compress the upload with gzip (default: no)\n"
                "  -h --help                 Show this help and exit\n"
                "     --version              Print version string and exit\n"
                , program_invocation_short_name);
@@ -583,6 +700,7 @@ static int parse_argv(int argc, char *argv[]) {
                 ARG_AFTER_CURSOR,
                 ARG_FOLLOW,
                 ARG_SAVE_STATE,
+                ARG_COMPRESS,
         };
 
         static const struct option options[] = {
@@ -602,6 +720,7 @@ static int parse_argv(int argc, char *argv[]) {
                 { "after-cursor", required_argument, NULL, ARG_AFTER_CURSOR   },
                 { "follow",       optional_argument, NULL, ARG_FOLLOW         },
                 { "save-state",   optional_argument, NULL, ARG_SAVE_STATE     },
+                { "compress",     optional_argument, NULL, ARG_COMPRESS       },
                 {}
         };
 
@@ -732,6 +851,20 @@ static int parse_argv(int argc, char *argv[]) {
                         arg_save_state = optarg ?: STATE_FILE;
                         break;
 
+                case ARG_COMPRESS:
+                        if (optarg) {
+                                r = parse_boolean(optarg);
+                                if (r < 0) {
+                                        log_error("Failed to parse --compress= parameter.");
+                                        return -EINVAL;
+                                }
+
+                                arg_compress = !!r;
+                        } else
+                                arg_compress = true;
+
+                        break;
+
                 case '?':
                         log_error("Unknown option %s.", argv[optind-1]);
                         return -EINVAL;
@@ -754,6 +887,13 @@ static int parse_argv(int argc, char *argv[]) {
                 return -EINVAL;
         }
 
+#ifndef HAVE_ZLIB
+        if (arg_compress) {
+                log_error("Compression is not available.");
+                return -EOPNOTSUPP;
+        }
+#endif
+
         if (optind < argc && (arg_directory || arg_file || arg_machine || arg_journal_type)) {
                 log_error("Input arguments make no sense with journal input.");
                 return -EINVAL;
@@ -1,5 +1,9 @@
 #pragma once
 
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
 #include <inttypes.h>
 
 #include "sd-journal.h"
@@ -19,6 +23,8 @@ typedef enum {
         ENTRY_DONE,                 /* Need to move to a new field. */
 } entry_state;
 
+typedef size_t (*UploadInputCallback)(void *ptr, size_t size, size_t nmemb, void *userdata);
+
 typedef struct Uploader {
         sd_event *events;
         sd_event_source *sigint_event, *sigterm_event;
@@ -33,6 +39,19 @@ typedef struct Uploader {
         sd_event_source *input_event;
         uint64_t timeout;
 
+        /* the source of the export stream of the current upload */
+        UploadInputCallback input_callback;
+        void *input_data;
+
+#ifdef HAVE_ZLIB
+        /* gzip state of the current upload */
+        z_stream zstream;
+        bool zstream_active;
+        bool input_eof;
+        bool compress_finished;
+        uint8_t *compress_buffer;
+#endif
+
         /* fd stuff */
         int input;
 
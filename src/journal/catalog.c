@@ -588,6 +588,73 @@ finish:
         return r;
 }
 
+void catalog_cache_done(CatalogCache *c) {
+        assert(c);
+
+        if (c->p)
+                munmap(c->p, c->st.st_size);
+
+        zero(*c);
+}
+
+static bool catalog_cache_valid(CatalogCache *c, const struct stat *st) {
+        assert(c);
+        assert(st);
+
+        /* catalog_update() replaces the database atomically, hence a
+         * changed inode is what we are looking for, but let's be
+         * careful in case somebody modified it in place */
+        return c->p &&
+                c->st.st_dev == st->st_dev &&
+                c->st.st_ino == st->st_ino &&
+                c->st.st_size == st->st_size &&
+                c->st.st_mtim.tv_sec == st->st_mtim.tv_sec &&
+                c->st.st_mtim.tv_nsec == st->st_mtim.tv_nsec;
+}
+
+int catalog_get_cached(CatalogCache *c, const char* database, sd_id128_t id, char **_text) {
+        struct stat st;
+        const char *s;
+        char *text;
+        int r;
+
+        assert(c);
+        assert(_text);
+
+        /* Like catalog_get(), but keeps the database mapped, so that
+         * each lookup only costs a stat() */
+
+        if (stat(database, &st) < 0) {
+                catalog_cache_done(c);
+                return -errno;
+        }
+
+        if (!catalog_cache_valid(c, &st)) {
+                _cleanup_close_ int fd = -1;
+                void *p;
+
+                catalog_cache_done(c);
+
+                r = open_mmap(database, &fd, &st, &p);
+                if (r < 0)
+                        return r;
+
+                c->p = p;
+                c->st = st;
+        }
+
+        s = find_id(c->p, id);
+        if (!s)
+                return -ENOENT;
+
+        text = strdup(s);
+        if (!text)
+                return -ENOMEM;
+
+        *_text = text;
+        return 0;
+}
+
 static char *find_header(const char *s, const char *header) {
 
         for (;;) {
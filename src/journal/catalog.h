@@ -22,14 +22,24 @@
 ***/
 
 #include <stdbool.h>
+#include <sys/stat.h>
 
 #include "sd-id128.h"
 #include "hashmap.h"
 #include "strbuf.h"
 
+/* A mapping of the catalog database kept around between lookups, it
+ * is replaced when the file on disk changes */
+typedef struct CatalogCache {
+        void *p;
+        struct stat st;
+} CatalogCache;
+
 int catalog_import_file(Hashmap *h, struct strbuf *sb, const char *path);
 int catalog_update(const char* database, const char* root, const char* const* dirs);
 int catalog_get(const char* database, sd_id128_t id, char **data);
+int catalog_get_cached(CatalogCache *c, const char* database, sd_id128_t id, char **data);
+void catalog_cache_done(CatalogCache *c);
 int catalog_list(FILE *f, const char* database, bool oneline);
 int catalog_list_items(FILE *f, const char* database, bool oneline, char **items);
 int catalog_file_lang(const char *filename, char **lang);
@@ -31,6 +31,11 @@
 #  include <lz4.h>
 #endif
 
+#ifdef HAVE_ZSTD
+#  include <zstd.h>
+#  include <zdict.h>
+#endif
+
 #include "compress.h"
 #include "macro.h"
 #include "util.h"
@@ -39,9 +44,22 @@
 
 #define ALIGN_8(l) ALIGN_TO(l, sizeof(size_t))
 
+#ifdef HAVE_ZSTD
+DEFINE_TRIVIAL_CLEANUP_FUNC(ZSTD_CStream*, ZSTD_freeCStream);
+DEFINE_TRIVIAL_CLEANUP_FUNC(ZSTD_DStream*, ZSTD_freeDStream);
+
+struct CompressDictionary {
+        ZSTD_CDict *cdict;
+        ZSTD_DDict *ddict;
+        ZSTD_CCtx *cctx;
+        ZSTD_DCtx *dctx;
+};
+#endif
+
 static const char* const object_compressed_table[_OBJECT_COMPRESSED_MAX] = {
         [OBJECT_COMPRESSED_XZ] = "XZ",
         [OBJECT_COMPRESSED_LZ4] = "LZ4",
+        [OBJECT_COMPRESSED_ZSTD] = "ZSTD",
 };
 
 DEFINE_STRING_TABLE_LOOKUP(object_compressed, int);
@@ -109,6 +127,32 @@ int compress_blob_lz4(const void *src, uint64_t src_size, void *dst, size_t *dst
 #endif
 }
 
+int compress_blob_zstd(const void *src, uint64_t src_size, void *dst, size_t *dst_size) {
+#ifdef HAVE_ZSTD
+        size_t k;
+
+        assert(src);
+        assert(src_size > 0);
+        assert(dst);
+        assert(dst_size);
+
+        /* Returns < 0 if we couldn't compress the data or the
+         * compressed result is longer than the original */
+
+        if (src_size < 9)
+                return -ENOBUFS;
+
+        k = ZSTD_compress(dst, src_size - 1, src, src_size, ZSTD_COMPRESSION_LEVEL);
+        if (ZSTD_isError(k))
+                return -ENOBUFS;
+
+        *dst_size = k;
+        return 0;
+#else
+        return -EPROTONOSUPPORT;
+#endif
+}
+
 
 int decompress_blob_xz(const void *src, uint64_t src_size,
                        void **dst, size_t *dst_alloc_size, size_t* dst_size, size_t dst_max) {
@@ -210,6 +254,79 @@ int decompress_blob_lz4(const void *src, uint64_t src_size,
 #endif
 }
 
+int decompress_blob_zstd(const void *src, uint64_t src_size,
+                         void **dst, size_t *dst_alloc_size, size_t* dst_size, size_t dst_max) {
+
+#ifdef HAVE_ZSTD
+        unsigned long long size;
+        size_t k;
+
+        assert(src);
+        assert(src_size > 0);
+        assert(dst);
+        assert(dst_alloc_size);
+        assert(dst_size);
+        assert(*dst_alloc_size == 0 || *dst);
+
+        /* We always compress with ZSTD_compress(), which stores the
+         * uncompressed size in the frame header. */
+        size = ZSTD_getFrameContentSize(src, src_size);
+        if (size == ZSTD_CONTENTSIZE_ERROR || size == ZSTD_CONTENTSIZE_UNKNOWN)
+                return -EBADMSG;
+
+        if (dst_max > 0 && size > dst_max)
+                size = dst_max;
+        if (size > SIZE_MAX)
+                return -E2BIG;
+
+        if (!greedy_realloc(dst, dst_alloc_size, MAX(size, 1u), 1))
+                return -ENOMEM;
+
+        if (dst_max > 0) {
+                _cleanup_(ZSTD_freeDStreamp) ZSTD_DStream *ds = NULL;
+                ZSTD_inBuffer input = {
+                        .src = src,
+                        .size = src_size,
+                };
+                ZSTD_outBuffer output = {
+                        .dst = *dst,
+                        .size = size,
+                };
+
+                /* Only the first dst_max bytes are wanted, hence
+                 * decompress only as much as fits */
+
+                ds = ZSTD_createDStream();
+                if (!ds)
+                        return -ENOMEM;
+
+                k = ZSTD_initDStream(ds);
+                if (ZSTD_isError(k))
+                        return -ENOMEM;
+
+                while (output.pos < output.size) {
+                        k = ZSTD_decompressStream(ds, &output, &input);
+                        if (ZSTD_isError(k))
+                                return -EBADMSG;
+                        if (k == 0 || input.pos >= input.size)
+                                break;
+                }
+
+                *dst_size = output.pos;
+                return 0;
+        }
+
+        k = ZSTD_decompress(*dst, size, src, src_size);
+        if (ZSTD_isError(k) || k != size)
+                return -EBADMSG;
+
+        *dst_size = k;
+        return 0;
+#else
+        return -EPROTONOSUPPORT;
+#endif
+}
+
 int decompress_blob(int compression,
                     const void *src, uint64_t src_size,
                     void **dst, size_t *dst_alloc_size, size_t* dst_size, size_t dst_max) {
@@ -219,6 +336,9 @@ int decompress_blob(int compression,
         else if (compression == OBJECT_COMPRESSED_LZ4)
                 return decompress_blob_lz4(src, src_size,
                                            dst, dst_alloc_size, dst_size, dst_max);
+        else if (compression == OBJECT_COMPRESSED_ZSTD)
+                return decompress_blob_zstd(src, src_size,
+                                            dst, dst_alloc_size, dst_size, dst_max);
         else
                 return -EBADMSG;
 }
@@ -323,6 +443,71 @@ int decompress_startswith_lz4(const void *src, uint64_t src_size,
 #endif
 }
 
+int decompress_startswith_zstd(const void *src, uint64_t src_size,
+                               void **buffer, size_t *buffer_size,
+                               const void *prefix, size_t prefix_len,
+                               uint8_t extra) {
+#ifdef HAVE_ZSTD
+        _cleanup_(ZSTD_freeDStreamp) ZSTD_DStream *ds = NULL;
+        ZSTD_inBuffer input = {
+                .src = src,
+                .size = src_size,
+        };
+        ZSTD_outBuffer output = {};
+        unsigned long long size;
+        size_t k;
+
+        /* Checks whether the decompressed blob starts with the
+         * mentioned prefix. The byte extra needs to follow the
+         * prefix */
+
+        assert(src);
+        assert(src_size > 0);
+        assert(buffer);
+        assert(buffer_size);
+        assert(prefix);
+        assert(*buffer_size == 0 || *buffer);
+
+        size = ZSTD_getFrameContentSize(src, src_size);
+        if (size == ZSTD_CONTENTSIZE_ERROR || size == ZSTD_CONTENTSIZE_UNKNOWN)
+                return -EBADMSG;
+
+        /* Decompressed text too short to match the prefix and extra */
+        if (size < prefix_len + 1)
+                return 0;
+
+        if (!(greedy_realloc(buffer, buffer_size, ALIGN_8(prefix_len + 1), 1)))
+                return -ENOMEM;
+
+        ds = ZSTD_createDStream();
+        if (!ds)
+                return -ENOMEM;
+
+        k = ZSTD_initDStream(ds);
+        if (ZSTD_isError(k))
+                return -ENOMEM;
+
+        output.dst = *buffer;
+        output.size = prefix_len + 1;
+
+        while (output.pos < output.size) {
+                k = ZSTD_decompressStream(ds, &output, &input);
+                if (ZSTD_isError(k))
+                        return -EBADMSG;
+                if (k == 0 || input.pos >= input.size)
+                        break;
+        }
+
+        if (output.pos < prefix_len + 1)
+                return 0;
+
+        return memcmp(*buffer, prefix, prefix_len) == 0 &&
+                ((const uint8_t*) *buffer)[prefix_len] == extra;
+#else
+        return -EPROTONOSUPPORT;
+#endif
+}
+
 int decompress_startswith(int compression,
                           const void *src, uint64_t src_size,
                           void **buffer, size_t *buffer_size,
@@ -338,6 +523,11 @@ int decompress_startswith(int compression,
                                                  buffer, buffer_size,
                                                  prefix, prefix_len,
                                                  extra);
+        else if (compression == OBJECT_COMPRESSED_ZSTD)
+                return decompress_startswith_zstd(src, src_size,
+                                                  buffer, buffer_size,
+                                                  prefix, prefix_len,
+                                                  extra);
         else
                 return -EBADMSG;
 }
@@ -496,6 +686,104 @@ int compress_stream_lz4(int fdf, int fdt, uint64_t max_bytes) {
 #endif
 }
 
+int compress_stream_zstd(int fdf, int fdt, uint64_t max_bytes) {
+
+#ifdef HAVE_ZSTD
+        _cleanup_(ZSTD_freeCStreamp) ZSTD_CStream *cs = NULL;
+        _cleanup_free_ void *in_buff = NULL, *out_buff = NULL;
+        size_t in_allocsize, out_allocsize, k;
+        uint64_t total_in = 0, total_out = 0;
+
+        assert(fdf >= 0);
+        assert(fdt >= 0);
+
+        /* Create the context and buffers */
+        in_allocsize = ZSTD_CStreamInSize();
+        out_allocsize = ZSTD_CStreamOutSize();
+        in_buff = malloc(in_allocsize);
+        out_buff = malloc(out_allocsize);
+        cs = ZSTD_createCStream();
+        if (!cs || !out_buff || !in_buff)
+                return log_oom();
+
+        k = ZSTD_initCStream(cs, ZSTD_COMPRESSION_LEVEL);
+        if (ZSTD_isError(k)) {
+                log_error("Failed to initialize ZSTD encoder: %s", ZSTD_getErrorName(k));
+                return -EINVAL;
+        }
+
+        for (;;) {
+                ZSTD_inBuffer input = {
+                        .src = in_buff,
+                };
+                size_t m = in_allocsize;
+                ssize_t n;
+
+                if (max_bytes != (uint64_t) -1 && (uint64_t) m > max_bytes - total_in)
+                        m = (size_t) (max_bytes - total_in);
+
+                n = read(fdf, in_buff, m);
+                if (n < 0)
+                        return -errno;
+                if (n == 0)
+                        break;
+
+                total_in += n;
+                input.size = n;
+
+                /* Compress until the input buffer is used up */
+                while (input.pos < input.size) {
+                        ZSTD_outBuffer output = {
+                                .dst = out_buff,
+                                .size = out_allocsize,
+                        };
+                        int r;
+
+                        k = ZSTD_compressStream(cs, &output, &input);
+                        if (ZSTD_isError(k)) {
+                                log_error("ZSTD compression failed: %s", ZSTD_getErrorName(k));
+                                return -EBADMSG;
+                        }
+
+                        r = loop_write(fdt, out_buff, output.pos, false);
+                        if (r < 0)
+                                return r;
+
+                        total_out += output.pos;
+                }
+        }
+
+        /* Flush out whatever is still buffered in the encoder */
+        do {
+                ZSTD_outBuffer output = {
+                        .dst = out_buff,
+                        .size = out_allocsize,
+                };
+                int r;
+
+                k = ZSTD_endStream(cs, &output);
+                if (ZSTD_isError(k)) {
+                        log_error("ZSTD compression failed: %s", ZSTD_getErrorName(k));
+                        return -EBADMSG;
+                }
+
+                r = loop_write(fdt, out_buff, output.pos, false);
+                if (r < 0)
+                        return r;
+
+                total_out += output.pos;
+        } while (k > 0);
+
+        log_debug("ZSTD compression finished (%"PRIu64" -> %"PRIu64" bytes, %.1f%%)",
+                  total_in, total_out,
+                  (double) total_out / total_in * 100);
+
+        return 0;
+#else
+        return -EPROTONOSUPPORT;
+#endif
+}
+
 int decompress_stream_xz(int fdf, int fdt, uint64_t max_bytes) {
 
 #ifdef HAVE_XZ
@@ -646,12 +934,226 @@ int decompress_stream_lz4(int fdf, int fdt, uint64_t max_bytes) {
 #endif
 }
 
+int decompress_stream_zstd(int fdf, int fdt, uint64_t max_bytes) {
+
+#ifdef HAVE_ZSTD
+        _cleanup_(ZSTD_freeDStreamp) ZSTD_DStream *ds = NULL;
+        _cleanup_free_ void *in_buff = NULL, *out_buff = NULL;
+        size_t in_allocsize, out_allocsize, k;
+        uint64_t total_in = 0, total_out = 0;
+
+        assert(fdf >= 0);
+        assert(fdt >= 0);
+
+        /* Create the context and buffers */
+        in_allocsize = ZSTD_DStreamInSize();
+        out_allocsize = ZSTD_DStreamOutSize();
+        in_buff = malloc(in_allocsize);
+        out_buff = malloc(out_allocsize);
+        ds = ZSTD_createDStream();
+        if (!ds || !out_buff || !in_buff)
+                return log_oom();
+
+        k = ZSTD_initDStream(ds);
+        if (ZSTD_isError(k)) {
+                log_error("Failed to initialize ZSTD decoder: %s", ZSTD_getErrorName(k));
+                return -ENOMEM;
+        }
+
+        for (;;) {
+                ZSTD_inBuffer input = {
+                        .src = in_buff,
+                };
+                ssize_t n;
+
+                n = read(fdf, in_buff, in_allocsize);
+                if (n < 0)
+                        return -errno;
+                if (n == 0)
+                        break;
+
+                total_in += n;
+                input.size = n;
+
+                /* Decompress until the input buffer is used up */
+                while (input.pos < input.size) {
+                        ZSTD_outBuffer output = {
+                                .dst = out_buff,
+                                .size = out_allocsize,
+                        };
+                        int r;
+
+                        k = ZSTD_decompressStream(ds, &output, &input);
+                        if (ZSTD_isError(k)) {
+                                log_error("ZSTD decompression failed: %s", ZSTD_getErrorName(k));
+                                return -EBADMSG;
+                        }
+
+                        total_out += output.pos;
+
+                        if (max_bytes != (uint64_t) -1 && total_out > max_bytes) {
+                                log_debug("Decompressed stream longer than %"PRIu64" bytes", max_bytes);
+                                return -EFBIG;
+                        }
+
+                        r = loop_write(fdt, out_buff, output.pos, false);
+                        if (r < 0)
+                                return r;
+                }
+        }
+
+        log_debug("ZSTD decompression finished (%"PRIu64" -> %"PRIu64" bytes, %.1f%%)",
+                  total_in, total_out,
+                  (double) total_out / total_in * 100);
+
+        return 0;
+#else
+        log_error("Cannot decompress file. Compiled without ZSTD support.");
+        return -EPROTONOSUPPORT;
+#endif
+}
+
 int decompress_stream(const char *filename, int fdf, int fdt, uint64_t max_bytes) {
 
         if (endswith(filename, ".lz4"))
                 return decompress_stream_lz4(fdf, fdt, max_bytes);
         else if (endswith(filename, ".xz"))
                 return decompress_stream_xz(fdf, fdt, max_bytes);
+        else if (endswith(filename, ".zst"))
+                return decompress_stream_zstd(fdf, fdt, max_bytes);
         else
                 return -EPROTONOSUPPORT;
 }
+
+int compress_dictionary_train(const void *samples, const size_t sample_sizes[], unsigned n_samples,
+                              void *dict, size_t *dict_size) {
+#ifdef HAVE_ZSTD
+        size_t k;
+
+        assert(samples);
+        assert(sample_sizes);
+        assert(dict);
+        assert(dict_size);
+
+        /* Trains a dictionary from the concatenated samples. On
+         * input *dict_size is the size of the dict buffer, on output
+         * the size of the dictionary actually generated. */
+
+        k = ZDICT_trainFromBuffer(dict, *dict_size, samples, sample_sizes, n_samples);
+        if (ZDICT_isError(k)) {
+                log_debug("Failed to train ZSTD dictionary: %s", ZDICT_getErrorName(k));
+                return -ENODATA;
+        }
+
+        *dict_size = k;
+        return 0;
+#else
+        return -EPROTONOSUPPORT;
+#endif
+}
+
+int compress_dictionary_new(const void *dict, size_t dict_size, CompressDictionary **ret) {
+#ifdef HAVE_ZSTD
+        _cleanup_(compress_dictionary_freep) CompressDictionary *d = NULL;
+
+        assert(dict);
+        assert(dict_size > 0);
+        assert(ret);
+
+        d = new0(CompressDictionary, 1);
+        if (!d)
+                return -ENOMEM;
+
+        d->cdict = ZSTD_createCDict(dict, dict_size, ZSTD_COMPRESSION_LEVEL);
+        d->ddict = ZSTD_createDDict(dict, dict_size);
+        d->cctx = ZSTD_createCCtx();
+        d->dctx = ZSTD_createDCtx();
+        if (!d->cdict || !d->ddict || !d->cctx || !d->dctx)
+                return -ENOMEM;
+
+        *ret = d;
+        d = NULL;
+
+        return 0;
+#else
+        return -EPROTONOSUPPORT;
+#endif
+}
+
+CompressDictionary* compress_dictionary_free(CompressDictionary *d) {
+#ifdef HAVE_ZSTD
+        if (!d)
+                return NULL;
+
+        ZSTD_freeCDict(d->cdict);
+        ZSTD_freeDDict(d->ddict);
+        ZSTD_freeCCtx(d->cctx);
+        ZSTD_freeDCtx(d->dctx);
+        free(d);
+#endif
+        return NULL;
+}
+
+int compress_blob_zstd_dictionary(CompressDictionary *d, const void *src, uint64_t src_size, void *dst, size_t *dst_size) {
+#ifdef HAVE_ZSTD
+        size_t k;
+
+        assert(d);
+        assert(src);
+        assert(src_size > 0);
+        assert(dst);
+        assert(dst_size);
+
+        /* Returns < 0 if we couldn't compress the data or the
+         * compressed result is longer than the original */
+
+        if (src_size < 2)
+                return -ENOBUFS;
+
+        k = ZSTD_compress_usingCDict(d->cctx, dst, src_size - 1, src, src_size, d->cdict);
+        if (ZSTD_isError(k))
+                return -ENOBUFS;
+
+        *dst_size = k;
+        return 0;
+#else
+        return -EPROTONOSUPPORT;
+#endif
+}
+
+int decompress_blob_zstd_dictionary(CompressDictionary *d, const void *src, uint64_t src_size,
+                                    void **dst, size_t *dst_alloc_size, size_t* dst_size, size_t dst_max) {
+#ifdef HAVE_ZSTD
+        unsigned long long size;
+        size_t k;
+
+        assert(d);
+        assert(src);
+        assert(src_size > 0);
+        assert(dst);
+        assert(dst_alloc_size);
+        assert(dst_size);
+        assert(*dst_alloc_size == 0 || *dst);
+
+        /* Objects compressed with a dictionary are small, hence
+         * always decompress them in full, even if dst_max is set. */
+
+        size = ZSTD_getFrameContentSize(src, src_size);
+        if (size == ZSTD_CONTENTSIZE_ERROR || size == ZSTD_CONTENTSIZE_UNKNOWN)
+                return -EBADMSG;
+        if (size > SIZE_MAX)
+                return -E2BIG;
+
+        if (!greedy_realloc(dst, dst_alloc_size, MAX(size, 1u), 1))
+                return -ENOMEM;
+
+        k = ZSTD_decompress_usingDDict(d->dctx, *dst, size, src, src_size, d->ddict);
+        if (ZSTD_isError(k) || k != size)
+                return -EBADMSG;
+
+        *dst_size = dst_max > 0 ? MIN(k, dst_max) : k;
+        return 0;
+#else
+        return -EPROTONOSUPPORT;
+#endif
+}
@@ -24,16 +24,25 @@
 #include <unistd.h>
 
 #include "journal-def.h"
+#include "macro.h"
 
 const char* object_compressed_to_string(int compression);
 int object_compressed_from_string(const char *compression);
 
 int compress_blob_xz(const void *src, uint64_t src_size, void *dst, size_t *dst_size);
 int compress_blob_lz4(const void *src, uint64_t src_size, void *dst, size_t *dst_size);
+int compress_blob_zstd(const void *src, uint64_t src_size, void *dst, size_t *dst_size);
+
+/* Use the library's default trade-off between speed and ratio */
+#define ZSTD_COMPRESSION_LEVEL 0
 
 static inline int compress_blob(const void *src, uint64_t src_size, void *dst, size_t *dst_size) {
         int r;
-#ifdef HAVE_LZ4
+#if defined(HAVE_ZSTD)
+        r = compress_blob_zstd(src, src_size, dst, dst_size);
+        if (r == 0)
+                return OBJECT_COMPRESSED_ZSTD;
+#elif defined(HAVE_LZ4)
         r = compress_blob_lz4(src, src_size, dst, dst_size);
         if (r == 0)
                 return OBJECT_COMPRESSED_LZ4;
@@ -49,6 +58,8 @@ int decompress_blob_xz(const void *src, uint64_t src_size,
                        void **dst, size_t *dst_alloc_size, size_t* dst_size, size_t dst_max);
 int decompress_blob_lz4(const void *src, uint64_t src_size,
                         void **dst, size_t *dst_alloc_size, size_t* dst_size, size_t dst_max);
+int decompress_blob_zstd(const void *src, uint64_t src_size,
+                         void **dst, size_t *dst_alloc_size, size_t* dst_size, size_t dst_max);
 int decompress_blob(int compression,
                     const void *src, uint64_t src_size,
                     void **dst, size_t *dst_alloc_size, size_t* dst_size, size_t dst_max);
@@ -61,6 +72,10 @@ int decompress_startswith_lz4(const void *src, uint64_t src_size,
                               void **buffer, size_t *buffer_size,
                               const void *prefix, size_t prefix_len,
                               uint8_t extra);
+int decompress_startswith_zstd(const void *src, uint64_t src_size,
+                               void **buffer, size_t *buffer_size,
+                               const void *prefix, size_t prefix_len,
+                               uint8_t extra);
 int decompress_startswith(int compression,
                           const void *src, uint64_t src_size,
                           void **buffer, size_t *buffer_size,
@@ -69,11 +84,16 @@ int decompress_startswith(int compression,
 
 int compress_stream_xz(int fdf, int fdt, uint64_t max_bytes);
 int compress_stream_lz4(int fdf, int fdt, uint64_t max_bytes);
+int compress_stream_zstd(int fdf, int fdt, uint64_t max_bytes);
 
 int decompress_stream_xz(int fdf, int fdt, uint64_t max_size);
 int decompress_stream_lz4(int fdf, int fdt, uint64_t max_size);
+int decompress_stream_zstd(int fdf, int fdt, uint64_t max_size);
 
-#ifdef HAVE_LZ4
+#if defined(HAVE_ZSTD)
+#  define compress_stream compress_stream_zstd
+#  define COMPRESSED_EXT ".zst"
+#elif defined(HAVE_LZ4)
 #  define compress_stream compress_stream_lz4
 #  define COMPRESSED_EXT ".lz4"
 #else
@@ -82,3 +102,17 @@ int decompress_stream_lz4(int fdf, int fdt, uint64_t max_size);
 #endif
 
 int decompress_stream(const char *filename, int fdf, int fdt, uint64_t max_bytes);
+
+/* A trained compression dictionary, used for compressing many small
+ * but similar blobs, such as the data objects of a journal file */
+typedef struct CompressDictionary CompressDictionary;
+
+int compress_dictionary_train(const void *samples, const size_t sample_sizes[], unsigned n_samples,
+                              void *dict, size_t *dict_size);
+int compress_dictionary_new(const void *dict, size_t dict_size, CompressDictionary **ret);
+CompressDictionary* compress_dictionary_free(CompressDictionary *d);
+DEFINE_TRIVIAL_CLEANUP_FUNC(CompressDictionary*, compress_dictionary_free);
+
+int compress_blob_zstd_dictionary(CompressDictionary *d, const void *src, uint64_t src_size, void *dst, size_t *dst_size);
+int decompress_blob_zstd_dictionary(CompressDictionary *d, const void *src, uint64_t src_size,
+                                    void **dst, size_t *dst_alloc_size, size_t* dst_size, size_t dst_max);
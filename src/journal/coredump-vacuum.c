@@ -19,6 +19,7 @@
   along with systemd; If not, see <http://www.gnu.org/licenses/>.
 ***/
 
+#include <sys/file.h>
 #include <sys/statvfs.h>
 
 #include "util.h"
@@ -33,22 +34,56 @@
 #define DEFAULT_KEEP_FREE_UPPER (uint64_t) (4ULL*1024ULL*1024ULL*1024ULL) /* 4 GiB */
 #define DEFAULT_KEEP_FREE (uint64_t) (1024ULL*1024ULL)                    /* 1 MB */
 
+/* Sizes and ages of the coredumps we have seen before, so that only
+ * new files need to be looked at. Coredumps are never modified after
+ * they have been put in place, hence the name identifies the file. */
+#define USAGE_FILE ".usage"
+
+typedef struct CoredumpFile {
+        char *name;
+        uid_t uid;
+        uint64_t inode;
+        uint64_t size;
+        usec_t mtime;
+        bool seen;
+} CoredumpFile;
+
 struct vacuum_candidate {
         unsigned n_files;
-        char *oldest_file;
-        usec_t oldest_mtime;
+        CoredumpFile **files;   /* oldest first */
+        size_t n_allocated;
+        unsigned oldest;
 };
 
+static void coredump_file_free(CoredumpFile *f) {
+        if (!f)
+                return;
+
+        free(f->name);
+        free(f);
+}
+
+DEFINE_TRIVIAL_CLEANUP_FUNC(CoredumpFile*, coredump_file_free);
+
+static void coredump_file_hashmap_free(Hashmap *h) {
+        CoredumpFile *f;
+
+        while ((f = hashmap_steal_first(h)))
+                coredump_file_free(f);
+
+        hashmap_free(h);
+}
+
+DEFINE_TRIVIAL_CLEANUP_FUNC(Hashmap*, coredump_file_hashmap_free);
+
 static void vacuum_candidate_free(struct vacuum_candidate *c) {
         if (!c)
                 return;
 
-        free(c->oldest_file);
+        free(c->files);
         free(c);
 }
 
-DEFINE_TRIVIAL_CLEANUP_FUNC(struct vacuum_candidate*, vacuum_candidate_free);
-
 static void vacuum_candidate_hasmap_free(Hashmap *h) {
         struct vacuum_candidate *c;
 
@@ -82,6 +117,198 @@ static int uid_from_file_name(const char *filename, uid_t *uid) {
         return parse_uid(u, uid);
 }
 
+static int parse_usage_line(char *l, CoredumpFile **ret) {
+        _cleanup_(coredump_file_freep) CoredumpFile *f = NULL;
+        uint64_t *fields[3];
+        unsigned i;
+        int r;
+
+        /* "inode size mtime name" */
+
+        f = new0(CoredumpFile, 1);
+        if (!f)
+                return -ENOMEM;
+
+        fields[0] = &f->inode;
+        fields[1] = &f->size;
+        fields[2] = &f->mtime;
+
+        for (i = 0; i < ELEMENTSOF(fields); i++) {
+                char *e;
+
+                e = strchr(l, ' ');
+                if (!e)
+                        return -EINVAL;
+                *e = 0;
+
+                r = safe_atou64(l, fields[i]);
+                if (r < 0)
+                        return r;
+
+                l = e + 1;
+        }
+
+        r = uid_from_file_name(l, &f->uid);
+        if (r < 0)
+                return r;
+
+        f->name = strdup(l);
+        if (!f->name)
+                return -ENOMEM;
+
+        *ret = f;
+        f = NULL;
+
+        return 0;
+}
+
+static int load_usage(int fd, Hashmap *h) {
+        _cleanup_fclose_ FILE *f = NULL;
+        char line[LINE_MAX];
+        int copy;
+
+        assert(fd >= 0);
+        assert(h);
+
+        copy = fcntl(fd, F_DUPFD_CLOEXEC, 3);
+        if (copy < 0)
+                return -errno;
+
+        f = fdopen(copy, "r");
+        if (!f) {
+                safe_close(copy);
+                return -errno;
+        }
+
+        FOREACH_LINE(line, f, return -errno) {
+                CoredumpFile *c;
+                int r;
+
+                truncate_nl(line);
+
+                r = parse_usage_line(line, &c);
+                if (r < 0)
+                        return r;
+
+                r = hashmap_put(h, c->name, c);
+                if (r < 0) {
+                        coredump_file_free(c);
+                        return r;
+                }
+        }
+
+        return 0;
+}
+
+static int save_usage(int fd, Hashmap *h) {
+        _cleanup_fclose_ FILE *f = NULL;
+        CoredumpFile *c;
+        Iterator i;
+        int copy;
+
+        assert(fd >= 0);
+
+        if (ftruncate(fd, 0) < 0)
+                return -errno;
+
+        copy = fcntl(fd, F_DUPFD_CLOEXEC, 3);
+        if (copy < 0)
+                return -errno;
+
+        f = fdopen(copy, "w");
+        if (!f) {
+                safe_close(copy);
+                return -errno;
+        }
+
+        rewind(f);
+
+        HASHMAP_FOREACH(c, h, i)
+                fprintf(f, "%" PRIu64 " %" PRIu64 " " USEC_FMT " %s\n",
+                        c->inode, c->size, c->mtime, c->name);
+
+        return fflush_and_check(f);
+}
+
+static int update_usage(DIR *d, Hashmap *h) {
+        CoredumpFile *c;
+        struct dirent *de;
+        Iterator i;
+        int r;
+
+        assert(d);
+        assert(h);
+
+        /* Only files we don't know yet need to be stat()ed */
+
+        FOREACH_DIRENT(de, d, return -errno) {
+                _cleanup_(coredump_file_freep) CoredumpFile *n = NULL;
+                struct stat st;
+                uid_t uid;
+
+                r = uid_from_file_name(de->d_name, &uid);
+                if (r < 0)
+                        continue;
+
+                c = hashmap_get(h, de->d_name);
+                if (c) {
+                        c->seen = true;
+                        continue;
+                }
+
+                if (fstatat(dirfd(d), de->d_name, &st, AT_NO_AUTOMOUNT|AT_SYMLINK_NOFOLLOW) < 0) {
+                        if (errno == ENOENT)
+                                continue;
+
+                        log_warning("Failed to stat /var/lib/systemd/coredump/%s", de->d_name);
+                        continue;
+                }
+
+                if (!S_ISREG(st.st_mode))
+                        continue;
+
+                n = new0(CoredumpFile, 1);
+                if (!n)
+                        return -ENOMEM;
+
+                n->name = strdup(de->d_name);
+                if (!n->name)
+                        return -ENOMEM;
+
+                n->uid = uid;
+                n->inode = (uint64_t) st.st_ino;
+                n->size = (uint64_t) st.st_blocks * 512;
+                n->mtime = timespec_load(&st.st_mtim);
+                n->seen = true;
+
+                r = hashmap_put(h, n->name, n);
+                if (r < 0)
+                        return r;
+
+                n = NULL;
+        }
+
+        /* Forget about the files that are gone */
+        HASHMAP_FOREACH(c, h, i)
+                if (!c->seen) {
+                        hashmap_remove(h, c->name);
+                        coredump_file_free(c);
+                }
+
+        return 0;
+}
+
+static int coredump_file_compare(const void *a, const void *b) {
+        const CoredumpFile *x = *(const CoredumpFile**) a, *y = *(const CoredumpFile**) b;
+
+        if (x->mtime < y->mtime)
+                return -1;
+        if (x->mtime > y->mtime)
+                return 1;
+
+        return 0;
+}
+
 static bool vacuum_necessary(int fd, uint64_t sum, uint64_t keep_free, uint64_t max_use) {
         uint64_t fs_size = 0, fs_free = (uint64_t) -1;
         struct statvfs sv;
@@ -130,8 +357,15 @@ static bool vacuum_necessary(int fd, uint64_t sum, uint64_t keep_free, uint64_t
 }
 
 int coredump_vacuum(int exclude_fd, uint64_t keep_free, uint64_t max_use) {
+        _cleanup_(coredump_file_hashmap_freep) Hashmap *files = NULL;
+        _cleanup_(vacuum_candidate_hasmap_freep) Hashmap *candidates = NULL;
         _cleanup_closedir_ DIR *d = NULL;
-        struct stat exclude_st;
+        _cleanup_close_ int usage_fd = -1;
+        struct stat exclude_st, dir_st;
+        struct vacuum_candidate *c;
+        CoredumpFile *f;
+        uint64_t sum = 0;
+        Iterator i;
         int r;
 
         if (keep_free == 0 && max_use == 0)
@@ -157,90 +391,84 @@ int coredump_vacuum(int exclude_fd, uint64_t keep_free, uint64_t max_use) {
                 return -errno;
         }
 
-        for (;;) {
-                _cleanup_(vacuum_candidate_hasmap_freep) Hashmap *h = NULL;
-                struct vacuum_candidate *worst = NULL;
-                struct dirent *de;
-                uint64_t sum = 0;
-
-                rewinddir(d);
-
-                FOREACH_DIRENT(de, d, goto fail) {
-                        struct vacuum_candidate *c;
-                        struct stat st;
-                        uid_t uid;
-                        usec_t t;
-
-                        r = uid_from_file_name(de->d_name, &uid);
-                        if (r < 0)
-                                continue;
-
-                        if (fstatat(dirfd(d), de->d_name, &st, AT_NO_AUTOMOUNT|AT_SYMLINK_NOFOLLOW) < 0) {
-                                if (errno == ENOENT)
-                                        continue;
-
-                                log_warning("Failed to stat /var/lib/systemd/coredump/%s", de->d_name);
-                                continue;
-                        }
-
-                        if (!S_ISREG(st.st_mode))
-                                continue;
-
-                        if (exclude_fd >= 0 &&
-                            exclude_st.st_dev == st.st_dev &&
-                            exclude_st.st_ino == st.st_ino)
-                                continue;
+        if (fstat(dirfd(d), &dir_st) < 0)
+                return log_error_errno(errno, "Failed to fstat(): %m");
+
+        files = hashmap_new(&string_hash_ops);
+        if (!files)
+                return log_oom();
+
+        /* Other instances might be vacuuming at the same time, the
+         * lock on the usage file serializes them */
+        usage_fd = openat(dirfd(d), USAGE_FILE, O_RDWR|O_CREAT|O_CLOEXEC|O_NOCTTY|O_NOFOLLOW, 0600);
+        if (usage_fd < 0)
+                log_debug_errno(errno, "Failed to open coredump usage file, ignoring: %m");
+        else if (flock(usage_fd, LOCK_EX) < 0) {
+                log_debug_errno(errno, "Failed to lock coredump usage file, ignoring: %m");
+                usage_fd = safe_close(usage_fd);
+        } else {
+                r = load_usage(usage_fd, files);
+                if (r == -ENOMEM)
+                        return log_oom();
+                if (r < 0) {
+                        log_debug_errno(r, "Failed to parse coredump usage file, rescanning: %m");
+
+                        while ((f = hashmap_steal_first(files)))
+                                coredump_file_free(f);
+                }
+        }
 
-                        r = hashmap_ensure_allocated(&h, NULL);
-                        if (r < 0)
+        r = update_usage(d, files);
+        if (r == -ENOMEM)
+                return log_oom();
+        if (r < 0)
+                return log_error_errno(r, "Failed to read directory: %m");
+
+        candidates = hashmap_new(NULL);
+        if (!candidates)
+                return log_oom();
+
+        HASHMAP_FOREACH(f, files, i) {
+                if (exclude_fd >= 0 &&
+                    exclude_st.st_dev == dir_st.st_dev &&
+                    (uint64_t) exclude_st.st_ino == f->inode)
+                        continue;
+
+                c = hashmap_get(candidates, UINT32_TO_PTR(f->uid));
+                if (!c) {
+                        c = new0(struct vacuum_candidate, 1);
+                        if (!c)
                                 return log_oom();
 
-                        t = timespec_load(&st.st_mtim);
-
-                        c = hashmap_get(h, UINT32_TO_PTR(uid));
-                        if (c) {
-
-                                if (t < c->oldest_mtime) {
-                                        char *n;
-
-                                        n = strdup(de->d_name);
-                                        if (!n)
-                                                return log_oom();
-
-                                        free(c->oldest_file);
-                                        c->oldest_file = n;
-                                        c->oldest_mtime = t;
-                                }
-
-                        } else {
-                                _cleanup_(vacuum_candidate_freep) struct vacuum_candidate *n = NULL;
-
-                                n = new0(struct vacuum_candidate, 1);
-                                if (!n)
-                                        return log_oom();
+                        r = hashmap_put(candidates, UINT32_TO_PTR(f->uid), c);
+                        if (r < 0) {
+                                free(c);
+                                return log_oom();
+                        }
+                }
 
-                                n->oldest_file = strdup(de->d_name);
-                                if (!n->oldest_file)
-                                        return log_oom();
+                if (!GREEDY_REALLOC(c->files, c->n_allocated, c->n_files + 1))
+                        return log_oom();
 
-                                n->oldest_mtime = t;
+                c->files[c->n_files++] = f;
+                sum += f->size;
+        }
 
-                                r = hashmap_put(h, UINT32_TO_PTR(uid), n);
-                                if (r < 0)
-                                        return log_oom();
+        HASHMAP_FOREACH(c, candidates, i)
+                qsort_safe(c->files, c->n_files, sizeof(CoredumpFile*), coredump_file_compare);
 
-                                c = n;
-                                n = NULL;
-                        }
+        for (;;) {
+                struct vacuum_candidate *worst = NULL;
 
-                        c->n_files++;
+                HASHMAP_FOREACH(c, candidates, i) {
+                        if (c->oldest >= c->n_files)
+                                continue;
 
                         if (!worst ||
-                            worst->n_files < c->n_files ||
-                            (worst->n_files == c->n_files && c->oldest_mtime < worst->oldest_mtime))
+                            worst->n_files - worst->oldest < c->n_files - c->oldest ||
+                            (worst->n_files - worst->oldest == c->n_files - c->oldest &&
+                             c->files[c->oldest]->mtime < worst->files[worst->oldest]->mtime))
                                 worst = c;
-
-                        sum += st.st_blocks * 512;
                 }
 
                 if (!worst)
@@ -248,22 +476,32 @@ int coredump_vacuum(int exclude_fd, uint64_t keep_free, uint64_t max_use) {
 
                 r = vacuum_necessary(dirfd(d), sum, keep_free, max_use);
                 if (r <= 0)
-                        return r;
+                        break;
 
-                if (unlinkat(dirfd(d), worst->oldest_file, 0) < 0) {
+                f = worst->files[worst->oldest++];
 
-                        if (errno == ENOENT)
-                                continue;
+                if (unlinkat(dirfd(d), f->name, 0) < 0) {
 
-                        log_error_errno(errno, "Failed to remove file %s: %m", worst->oldest_file);
-                        return -errno;
+                        if (errno != ENOENT) {
+                                r = log_error_errno(errno, "Failed to remove file %s: %m", f->name);
+                                break;
+                        }
                 } else
-                        log_info("Removed old coredump %s.", worst->oldest_file);
+                        log_info("Removed old coredump %s.", f->name);
+
+                sum -= f->size;
+
+                hashmap_remove(files, f->name);
+                coredump_file_free(f);
         }
 
-        return 0;
+        if (usage_fd >= 0) {
+                int k;
+
+                k = save_usage(usage_fd, files);
+                if (k < 0)
+                        log_debug_errno(k, "Failed to write coredump usage file, ignoring: %m");
+        }
 
-fail:
-        log_error_errno(errno, "Failed to read directory: %m");
-        return -errno;
+        return r < 0 ? r : 0;
 }
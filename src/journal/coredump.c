@@ -20,8 +20,10 @@
 ***/
 
 #include <errno.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <stdio.h>
+#include <sys/mman.h>
 #include <sys/prctl.h>
 #include <sys/xattr.h>
 
@@ -65,6 +67,10 @@
  * size. See DATA_SIZE_MAX in journald-native.c. */
 assert_cc(JOURNAL_SIZE_MAX <= DATA_SIZE_MAX);
 
+/* The size we try to grow the pipe from the kernel to, so that it
+ * can write more of the coredump at once */
+#define PIPE_SIZE (1024*1024)
+
 enum {
         INFO_PID,
         INFO_UID,
@@ -280,6 +286,27 @@ static int make_filename(const char *info[_INFO_LEN], char **ret) {
         return 0;
 }
 
+static void release_coredump_pipe(void) {
+        int fd;
+
+        /* The kernel keeps the crashed process around until we
+         * close the pipe (if kernel.core_pipe_limit is set). We have
+         * read all of the data, so let it go now and not only once
+         * we are done with compressing and logging. Put /dev/null in
+         * place so the fd isn't reused for something else. */
+
+        fd = open("/dev/null", O_RDONLY|O_CLOEXEC|O_NOCTTY);
+        if (fd < 0) {
+                safe_close(STDIN_FILENO);
+                return;
+        }
+
+        if (dup2(fd, STDIN_FILENO) < 0)
+                safe_close(STDIN_FILENO);
+
+        safe_close(fd);
+}
+
 static int save_external_coredump(
                 const char *info[_INFO_LEN],
                 uid_t uid,
@@ -311,7 +338,12 @@ static int save_external_coredump(
         if (fd < 0)
                 return log_error_errno(errno, "Failed to create coredump file %s: %m", tmp);
 
+        /* Best effort only, the limit might be lower */
+        (void) fcntl(STDIN_FILENO, F_SETPIPE_SZ, PIPE_SIZE);
+
         r = copy_bytes(STDIN_FILENO, fd, arg_process_size_max, false);
+        if (r >= 0)
+                release_coredump_pipe();
         if (r == -EFBIG) {
                 log_error("Coredump of %s (%s) is larger than configured processing limit, refusing.", info[INFO_PID], info[INFO_COMM]);
                 goto fail;
@@ -333,7 +365,7 @@ static int save_external_coredump(
                 goto fail;
         }
 
-#if defined(HAVE_XZ) || defined(HAVE_LZ4)
+#if defined(HAVE_XZ) || defined(HAVE_LZ4) || defined(HAVE_ZSTD)
         /* If we will remove the coredump anyway, do not compress. */
         if (maybe_remove_external_coredump(NULL, st.st_size) == 0
             && arg_compress) {
@@ -405,37 +437,42 @@ fail:
         return r;
 }
 
-static int allocate_journal_field(int fd, size_t size, char **ret, size_t *ret_size) {
-        _cleanup_free_ char *field = NULL;
-        ssize_t n;
+static int map_journal_field(int fd, size_t size, void **ret_map, size_t *ret_map_size, struct iovec *ret) {
+        size_t ps, length;
+        uint8_t *p;
+        int r;
 
         assert(fd >= 0);
+        assert(ret_map);
+        assert(ret_map_size);
         assert(ret);
-        assert(ret_size);
 
-        if (lseek(fd, 0, SEEK_SET) == (off_t) -1)
-                return log_warning_errno(errno, "Failed to seek: %m");
+        /* Instead of reading the core into memory, map the file
+         * right behind an anonymous page which ends in the field
+         * name, so that it can be passed on as one continuous field
+         * without copying. */
 
-        field = malloc(9 + size);
-        if (!field) {
-                log_warning("Failed to allocate memory for coredump, coredump will not be stored.");
-                return -ENOMEM;
-        }
+        ps = page_size();
+        length = ps + PAGE_ALIGN(size);
 
-        memcpy(field, "COREDUMP=", 9);
+        p = mmap(NULL, length, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED)
+                return log_warning_errno(errno, "Failed to allocate memory for coredump, coredump will not be stored: %m");
 
-        n = read(fd, field + 9, size);
-        if (n < 0)
-                return log_error_errno((int) n, "Failed to read core data: %m");
-        if ((size_t) n < size) {
-                log_error("Core data too short.");
-                return -EIO;
+        if (size > 0 &&
+            mmap(p + ps, size, PROT_READ, MAP_PRIVATE|MAP_FIXED, fd, 0) == MAP_FAILED) {
+                r = -errno;
+                munmap(p, length);
+                return log_error_errno(r, "Failed to map core data: %m");
         }
 
-        *ret = field;
-        *ret_size = size + 9;
+        memcpy(p + ps - 9, "COREDUMP=", 9);
 
-        field = NULL;
+        ret->iov_base = p + ps - 9;
+        ret->iov_len = size + 9;
+
+        *ret_map = p;
+        *ret_map_size = length;
 
         return 0;
 }
@@ -534,7 +571,7 @@ int main(int argc, char* argv[]) {
 
         /* The larger ones we allocate on the heap */
         _cleanup_free_ char
-                *core_timestamp = NULL,  *core_message = NULL, *coredump_data = NULL, *core_owner_uid = NULL,
+                *core_timestamp = NULL,  *core_message = NULL, *core_owner_uid = NULL,
                 *core_open_fds = NULL, *core_proc_status = NULL, *core_proc_maps = NULL, *core_proc_limits = NULL,
                 *core_proc_cgroup = NULL, *core_environ = NULL;
 
@@ -542,9 +579,11 @@ int main(int argc, char* argv[]) {
         const char *info[_INFO_LEN];
 
         _cleanup_close_ int coredump_fd = -1;
+        void *coredump_map = NULL;
+        size_t coredump_map_size = 0;
 
         struct iovec iovec[26];
-        uint64_t coredump_size;
+        uint64_t coredump_size = 0;
         int r, j = 0;
         uid_t uid, owner_uid;
         gid_t gid;
@@ -840,17 +879,14 @@ log:
 
         /* Optionally store the entire coredump in the journal */
         if (IN_SET(arg_storage, COREDUMP_STORAGE_JOURNAL, COREDUMP_STORAGE_BOTH) &&
+            coredump_fd >= 0 &&
             coredump_size <= arg_journal_size_max) {
-                size_t sz = 0;
 
                 /* Store the coredump itself in the journal */
 
-                r = allocate_journal_field(coredump_fd, (size_t) coredump_size, &coredump_data, &sz);
-                if (r >= 0) {
-                        iovec[j].iov_base = coredump_data;
-                        iovec[j].iov_len = sz;
+                r = map_journal_field(coredump_fd, (size_t) coredump_size, &coredump_map, &coredump_map_size, &iovec[j]);
+                if (r >= 0)
                         j++;
-                }
         }
 
         r = sd_journal_sendv(iovec, j);
@@ -858,5 +894,8 @@ log:
                 log_error_errno(r, "Failed to log coredump: %m");
 
 finish:
+        if (coredump_map)
+                munmap(coredump_map, coredump_map_size);
+
         return r < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
 }
@@ -79,6 +79,8 @@ int journal_file_append_tag(JournalFile *f) {
 
 int journal_file_hmac_start(JournalFile *f) {
         uint8_t key[256 / 8]; /* Let's pass 256 bit from FSPRG to HMAC */
+        uint64_t epoch;
+
         assert(f);
 
         if (!f->seal)
@@ -87,10 +89,25 @@ int journal_file_hmac_start(JournalFile *f) {
         if (f->hmac_running)
                 return 0;
 
-        /* Prepare HMAC for next cycle */
+        /* Prepare HMAC for next cycle. Resetting keeps the key, so
+         * it only needs to be derived and set again when the epoch
+         * changed since. */
         gcry_md_reset(f->hmac);
-        FSPRG_GetKey(f->fsprg_state, key, sizeof(key), 0);
-        gcry_md_setkey(f->hmac, key, sizeof(key));
+
+        epoch = FSPRG_GetEpoch(f->fsprg_state);
+        if (!f->hmac_keyed || f->hmac_key_epoch != epoch) {
+
+                if (f->fsprg_next_state &&
+                    memcmp(f->fsprg_next_state, f->fsprg_state, f->fsprg_state_size) == 0)
+                        memcpy(key, f->fsprg_next_key, sizeof(key));
+                else
+                        FSPRG_GetKey(f->fsprg_state, key, sizeof(key), 0);
+
+                gcry_md_setkey(f->hmac, key, sizeof(key));
+
+                f->hmac_keyed = true;
+                f->hmac_key_epoch = epoch;
+        }
 
         f->hmac_running = true;
 
@@ -160,11 +177,49 @@ int journal_file_fsprg_evolve(JournalFile *f, uint64_t realtime) {
                 if (epoch == goal)
                         return 0;
 
-                FSPRG_Evolve(f->fsprg_state);
+                /* Use the state prepared ahead of time, if there
+                 * is one for the next epoch */
+                if (f->fsprg_next_state &&
+                    FSPRG_GetEpoch(f->fsprg_next_state) == epoch + 1)
+                        memcpy(f->fsprg_state, f->fsprg_next_state, f->fsprg_state_size);
+                else
+                        FSPRG_Evolve(f->fsprg_state);
+
                 epoch = FSPRG_GetEpoch(f->fsprg_state);
         }
 }
 
+int journal_file_fsprg_prepare(JournalFile *f) {
+        uint64_t epoch;
+
+        assert(f);
+
+        /* Evolves a copy of the FSPRG state to the next epoch and
+         * derives its HMAC key, so that neither has to be done on
+         * the append path when the epoch changes. Meant to be called
+         * whenever the writer is idle. */
+
+        if (!f->seal || !f->writable)
+                return 0;
+
+        epoch = FSPRG_GetEpoch(f->fsprg_state);
+
+        if (f->fsprg_next_state) {
+                if (FSPRG_GetEpoch(f->fsprg_next_state) == epoch + 1)
+                        return 0;
+        } else {
+                f->fsprg_next_state = malloc(f->fsprg_state_size);
+                if (!f->fsprg_next_state)
+                        return -ENOMEM;
+        }
+
+        memcpy(f->fsprg_next_state, f->fsprg_state, f->fsprg_state_size);
+        FSPRG_Evolve(f->fsprg_next_state);
+        FSPRG_GetKey(f->fsprg_next_state, f->fsprg_next_key, sizeof(f->fsprg_next_key), 0);
+
+        return 1;
+}
+
 int journal_file_fsprg_seek(JournalFile *f, uint64_t goal) {
         void *msk;
         uint64_t epoch;
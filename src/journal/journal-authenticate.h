@@ -39,5 +39,6 @@ int journal_file_parse_verification_key(JournalFile *f, const char *key);
 
 int journal_file_fsprg_evolve(JournalFile *f, uint64_t realtime);
 int journal_file_fsprg_seek(JournalFile *f, uint64_t epoch);
+int journal_file_fsprg_prepare(JournalFile *f);
 
 bool journal_file_next_evolve_usec(JournalFile *f, usec_t *u);
@@ -45,6 +45,10 @@ typedef struct EntryObject EntryObject;
 typedef struct HashTableObject HashTableObject;
 typedef struct EntryArrayObject EntryArrayObject;
 typedef struct TagObject TagObject;
+typedef struct DictionaryObject DictionaryObject;
+typedef struct BloomFilterObject BloomFilterObject;
+typedef struct ColumnObject ColumnObject;
+typedef struct ColumnRun ColumnRun;
 
 typedef struct EntryItem EntryItem;
 typedef struct HashItem HashItem;
@@ -61,6 +65,9 @@ typedef enum ObjectType {
         OBJECT_FIELD_HASH_TABLE,
         OBJECT_ENTRY_ARRAY,
         OBJECT_TAG,
+        OBJECT_DICTIONARY,
+        OBJECT_BLOOM_FILTER,
+        OBJECT_COLUMN,
         _OBJECT_TYPE_MAX
 } ObjectType;
 
@@ -68,10 +75,11 @@ typedef enum ObjectType {
 enum {
         OBJECT_COMPRESSED_XZ = 1 << 0,
         OBJECT_COMPRESSED_LZ4 = 1 << 1,
+        OBJECT_COMPRESSED_ZSTD = 1 << 2,
         _OBJECT_COMPRESSED_MAX
 };
 
-#define OBJECT_COMPRESSION_MASK (OBJECT_COMPRESSED_XZ | OBJECT_COMPRESSED_LZ4)
+#define OBJECT_COMPRESSION_MASK (OBJECT_COMPRESSED_XZ | OBJECT_COMPRESSED_LZ4 | OBJECT_COMPRESSED_ZSTD)
 
 struct ObjectHeader {
         uint8_t type;
@@ -140,6 +148,35 @@ struct TagObject {
         uint8_t tag[TAG_LENGTH]; /* SHA-256 HMAC */
 } _packed_;
 
+struct DictionaryObject {
+        ObjectHeader object;
+        le64_t n_samples; /* number of data objects the dictionary was trained on */
+        uint8_t payload[];
+} _packed_;
+
+struct BloomFilterObject {
+        ObjectHeader object;
+        le64_t n_hashes; /* number of bits set per data object */
+        le64_t n_items;  /* number of data objects added */
+        le64_t bits[];
+} _packed_;
+
+/* A run of consecutive entries (in entry array order) that carry the
+ * same value of the column's field. data_offset is 0 for entries
+ * lacking the field. */
+struct ColumnRun {
+        le64_t data_offset;
+        le64_t n_entries;
+} _packed_;
+
+struct ColumnObject {
+        ObjectHeader object;
+        le64_t next_column_offset;
+        le64_t field_offset;
+        le64_t n_entries; /* sum of all runs, equals n_entries of the file */
+        ColumnRun runs[];
+} _packed_;
+
 union Object {
         ObjectHeader object;
         DataObject data;
@@ -148,6 +185,9 @@ union Object {
         HashTableObject hash_table;
         EntryArrayObject entry_array;
         TagObject tag;
+        DictionaryObject dictionary;
+        BloomFilterObject bloom_filter;
+        ColumnObject column;
 };
 
 enum {
@@ -161,29 +201,43 @@ enum {
 enum {
         HEADER_INCOMPATIBLE_COMPRESSED_XZ = 1 << 0,
         HEADER_INCOMPATIBLE_COMPRESSED_LZ4 = 1 << 1,
+        HEADER_INCOMPATIBLE_COMPRESSED_ZSTD = 1 << 2,
+        HEADER_INCOMPATIBLE_ZSTD_DICTIONARY = 1 << 3,
 };
 
-#define HEADER_INCOMPATIBLE_ANY (HEADER_INCOMPATIBLE_COMPRESSED_XZ|HEADER_INCOMPATIBLE_COMPRESSED_LZ4)
+#define HEADER_INCOMPATIBLE_ANY (HEADER_INCOMPATIBLE_COMPRESSED_XZ|HEADER_INCOMPATIBLE_COMPRESSED_LZ4|HEADER_INCOMPATIBLE_COMPRESSED_ZSTD|HEADER_INCOMPATIBLE_ZSTD_DICTIONARY)
+
+#ifdef HAVE_XZ
+#  define HEADER_INCOMPATIBLE_SUPPORTED_XZ HEADER_INCOMPATIBLE_COMPRESSED_XZ
+#else
+#  define HEADER_INCOMPATIBLE_SUPPORTED_XZ 0
+#endif
+
+#ifdef HAVE_LZ4
+#  define HEADER_INCOMPATIBLE_SUPPORTED_LZ4 HEADER_INCOMPATIBLE_COMPRESSED_LZ4
+#else
+#  define HEADER_INCOMPATIBLE_SUPPORTED_LZ4 0
+#endif
 
-#if defined(HAVE_XZ) && defined(HAVE_LZ4)
-#  define HEADER_INCOMPATIBLE_SUPPORTED HEADER_INCOMPATIBLE_ANY
-#elif defined(HAVE_XZ)
-#  define HEADER_INCOMPATIBLE_SUPPORTED HEADER_INCOMPATIBLE_COMPRESSED_XZ
-#elif defined(HAVE_LZ4)
-#  define HEADER_INCOMPATIBLE_SUPPORTED HEADER_INCOMPATIBLE_COMPRESSED_LZ4
+#ifdef HAVE_ZSTD
+#  define HEADER_INCOMPATIBLE_SUPPORTED_ZSTD (HEADER_INCOMPATIBLE_COMPRESSED_ZSTD|HEADER_INCOMPATIBLE_ZSTD_DICTIONARY)
 #else
-#  define HEADER_INCOMPATIBLE_SUPPORTED 0
+#  define HEADER_INCOMPATIBLE_SUPPORTED_ZSTD 0
 #endif
 
+#define HEADER_INCOMPATIBLE_SUPPORTED (HEADER_INCOMPATIBLE_SUPPORTED_XZ|HEADER_INCOMPATIBLE_SUPPORTED_LZ4|HEADER_INCOMPATIBLE_SUPPORTED_ZSTD)
+
 enum {
-        HEADER_COMPATIBLE_SEALED = 1
+        HEADER_COMPATIBLE_SEALED = 1 << 0,
+        HEADER_COMPATIBLE_BLOOM_FILTER = 1 << 1,
+        HEADER_COMPATIBLE_COLUMNS = 1 << 2,
 };
 
-#define HEADER_COMPATIBLE_ANY HEADER_COMPATIBLE_SEALED
+#define HEADER_COMPATIBLE_ANY (HEADER_COMPATIBLE_SEALED|HEADER_COMPATIBLE_BLOOM_FILTER|HEADER_COMPATIBLE_COLUMNS)
 #ifdef HAVE_GCRYPT
-#  define HEADER_COMPATIBLE_SUPPORTED HEADER_COMPATIBLE_SEALED
+#  define HEADER_COMPATIBLE_SUPPORTED (HEADER_COMPATIBLE_SEALED|HEADER_COMPATIBLE_BLOOM_FILTER|HEADER_COMPATIBLE_COLUMNS)
 #else
-#  define HEADER_COMPATIBLE_SUPPORTED 0
+#  define HEADER_COMPATIBLE_SUPPORTED (HEADER_COMPATIBLE_BLOOM_FILTER|HEADER_COMPATIBLE_COLUMNS)
 #endif
 
 #define HEADER_SIGNATURE ((char[]) { 'L', 'P', 'K', 'S', 'H', 'H', 'R', 'H' })
@@ -219,8 +273,14 @@ struct Header {
         /* Added in 189 */
         le64_t n_tags;
         le64_t n_entry_arrays;
-
-        /* Size: 240 */
+        /* Added in 227 */
+        le64_t data_hash_chain_depth;
+        le64_t field_hash_chain_depth;
+        le64_t dictionary_offset;
+        le64_t bloom_filter_offset;
+        le64_t columns_offset;
+
+        /* Size: 280 */
 } _packed_;
 
 #define FSS_HEADER_SIGNATURE ((char[]) { 'K', 'S', 'H', 'H', 'R', 'H', 'L', 'P' })
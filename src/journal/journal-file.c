@@ -22,6 +22,7 @@
 #include <sys/mman.h>
 #include <errno.h>
 #include <sys/uio.h>
+#include <sys/xattr.h>
 #include <unistd.h>
 #include <sys/statvfs.h>
 #include <fcntl.h>
@@ -35,12 +36,42 @@
 #include "lookup3.h"
 #include "compress.h"
 #include "random-util.h"
+#include "event-util.h"
 
 #define DEFAULT_DATA_HASH_TABLE_SIZE (2047ULL*sizeof(HashItem))
 #define DEFAULT_FIELD_HASH_TABLE_SIZE (333ULL*sizeof(HashItem))
 
 #define COMPRESSION_SIZE_THRESHOLD (512ULL)
 
+/* With a trained dictionary even small objects compress well */
+#define COMPRESSION_DICTIONARY_SIZE_THRESHOLD (64ULL)
+
+/* Bounds for training a compression dictionary from the data objects
+ * of the file we rotate away from */
+#define DICTIONARY_SAMPLES_MIN 256U
+#define DICTIONARY_SAMPLES_MAX 8192U
+#define DICTIONARY_SAMPLES_SIZE_MAX (1024ULL*1024ULL)          /* 1 MiB */
+#define DICTIONARY_SAMPLE_SIZE_MIN 8ULL
+#define DICTIONARY_SAMPLE_SIZE_MAX (4ULL*1024ULL)              /* 4 KiB */
+#define DICTIONARY_SIZE_MAX (16ULL*1024ULL)                    /* 16 KiB */
+
+/* With 10 bits per data object and 7 hash functions the bloom filter
+ * has a false positive rate below 1% */
+#define BLOOM_FILTER_BITS_PER_ITEM 10ULL
+#define BLOOM_FILTER_N_HASHES 7ULL
+#define BLOOM_FILTER_SIZE_MIN 512ULL
+#define BLOOM_FILTER_SIZE_MAX (4ULL*1024ULL*1024ULL)           /* 4 MiB */
+
+/* Fields we store as columns in archived files, since they are the
+ * ones aggregate queries typically group by */
+static const char * const column_fields[] = {
+        "PRIORITY",
+        "_SYSTEMD_UNIT",
+        "_SYSTEMD_USER_UNIT",
+        "SYSLOG_IDENTIFIER",
+        "_TRANSPORT",
+};
+
 /* This is the minimum journal file size */
 #define JOURNAL_FILE_SIZE_MIN (4ULL*1024ULL*1024ULL)           /* 4 MiB */
 
@@ -63,8 +94,21 @@
 /* n_data was the first entry we added after the initial file format design */
 #define HEADER_SIZE_MIN ALIGN64(offsetof(Header, n_data))
 
-/* How many entries to keep in the entry array chain cache at max */
-#define CHAIN_CACHE_MAX 20
+/* How many entries to keep in the entry array chain cache initially,
+ * and up to how many it may grow when many chains are used at the
+ * same time (for example by many matches) */
+#define CHAIN_CACHE_MIN 20
+#define CHAIN_CACHE_MAX 1024
+
+/* Check every this many lookups whether the chain cache is too small */
+#define CHAIN_CACHE_WINDOW 256
+
+/* Suggest rotation once a hash chain in one of the hash tables got
+ * longer than this, as lookups get slower and slower otherwise */
+#define HASH_CHAIN_DEPTH_MAX 100
+
+/* How many recently used data objects to remember per writable file at max */
+#define DATA_CACHE_MAX 128
 
 /* How much to increase the journal file size at once each time we allocate something new. */
 #define FILE_SIZE_INCREASE (8ULL*1024ULL*1024ULL)              /* 8MB */
@@ -137,6 +181,18 @@ void journal_file_close(JournalFile *f) {
                 journal_file_append_tag(f);
 #endif
 
+        if (f->post_change_timer) {
+                int enabled;
+
+                /* Don't leave followers waiting for a notification
+                 * that was still pending */
+                if (sd_event_source_get_enabled(f->post_change_timer, &enabled) >= 0 &&
+                    enabled == SD_EVENT_ONESHOT)
+                        journal_file_post_change(f);
+
+                sd_event_source_unref(f->post_change_timer);
+        }
+
         journal_file_set_offline(f);
 
         if (f->mmap && f->fd >= 0)
@@ -161,11 +217,16 @@ void journal_file_close(JournalFile *f) {
                 mmap_cache_unref(f->mmap);
 
         ordered_hashmap_free_free(f->chain_cache);
+        ordered_hashmap_free_free(f->data_cache);
 
-#if defined(HAVE_XZ) || defined(HAVE_LZ4)
+#if defined(HAVE_XZ) || defined(HAVE_LZ4) || defined(HAVE_ZSTD)
         free(f->compress_buffer);
 #endif
 
+#ifdef HAVE_ZSTD
+        compress_dictionary_free(f->compress_dictionary);
+#endif
+
 #ifdef HAVE_GCRYPT
         if (f->fss_file)
                 munmap(f->fss_file, PAGE_ALIGN(f->fss_file_size));
@@ -173,6 +234,7 @@ void journal_file_close(JournalFile *f) {
                 free(f->fsprg_state);
 
         free(f->fsprg_seed);
+        free(f->fsprg_next_state);
 
         if (f->hmac)
                 gcry_md_close(f->hmac);
@@ -193,7 +255,8 @@ static int journal_file_init_header(JournalFile *f, JournalFile *template) {
 
         h.incompatible_flags |= htole32(
                 f->compress_xz * HEADER_INCOMPATIBLE_COMPRESSED_XZ |
-                f->compress_lz4 * HEADER_INCOMPATIBLE_COMPRESSED_LZ4);
+                f->compress_lz4 * HEADER_INCOMPATIBLE_COMPRESSED_LZ4 |
+                f->compress_zstd * HEADER_INCOMPATIBLE_COMPRESSED_ZSTD);
 
         h.compatible_flags = htole32(
                 f->seal * HEADER_COMPATIBLE_SEALED);
@@ -330,6 +393,7 @@ static int journal_file_verify_header(JournalFile *f) {
 
         f->compress_xz = JOURNAL_HEADER_COMPRESSED_XZ(f->header);
         f->compress_lz4 = JOURNAL_HEADER_COMPRESSED_LZ4(f->header);
+        f->compress_zstd = JOURNAL_HEADER_COMPRESSED_ZSTD(f->header);
 
         f->seal = JOURNAL_HEADER_SEALED(f->header);
 
@@ -469,6 +533,9 @@ static uint64_t minimum_header_size(Object *o) {
                 [OBJECT_FIELD_HASH_TABLE] = sizeof(HashTableObject),
                 [OBJECT_ENTRY_ARRAY] = sizeof(EntryArrayObject),
                 [OBJECT_TAG] = sizeof(TagObject),
+                [OBJECT_DICTIONARY] = sizeof(DictionaryObject),
+                [OBJECT_BLOOM_FILTER] = sizeof(BloomFilterObject),
+                [OBJECT_COLUMN] = sizeof(ColumnObject),
         };
 
         if (o->object.type >= ELEMENTSOF(table) || table[o->object.type] <= 0)
@@ -803,7 +870,7 @@ int journal_file_find_field_object_with_hash(
                 const void *field, uint64_t size, uint64_t hash,
                 Object **ret, uint64_t *offset) {
 
-        uint64_t p, osize, h, m;
+        uint64_t p, osize, h, m, depth = 0;
         int r;
 
         assert(f);
@@ -846,9 +913,17 @@ int journal_file_find_field_object_with_hash(
                         return 1;
                 }
 
+                depth++;
                 p = le64toh(o->field.next_hash_offset);
         }
 
+        /* Remember the longest chain we had to walk in full, so that
+         * we can suggest rotation before lookups get too slow */
+        if (f->writable &&
+            JOURNAL_HEADER_CONTAINS(f->header, field_hash_chain_depth) &&
+            depth > le64toh(f->header->field_hash_chain_depth))
+                f->header->field_hash_chain_depth = htole64(depth);
+
         return 0;
 }
 
@@ -869,12 +944,621 @@ int journal_file_find_field_object(
                                                         ret, offset);
 }
 
+#ifdef HAVE_ZSTD
+static int journal_file_load_dictionary(JournalFile *f) {
+        uint64_t p, l;
+        Object *o;
+        int r;
+
+        assert(f);
+
+        if (f->compress_dictionary)
+                return 1;
+
+        if (!JOURNAL_HEADER_ZSTD_DICTIONARY(f->header) ||
+            !JOURNAL_HEADER_CONTAINS(f->header, dictionary_offset))
+                return 0;
+
+        p = le64toh(f->header->dictionary_offset);
+        if (p <= 0)
+                return -EBADMSG;
+
+        r = journal_file_move_to_object(f, OBJECT_DICTIONARY, p, &o);
+        if (r < 0)
+                return r;
+
+        l = le64toh(o->object.size);
+        if (l <= offsetof(Object, dictionary.payload))
+                return -EBADMSG;
+
+        r = compress_dictionary_new(o->dictionary.payload, l - offsetof(Object, dictionary.payload), &f->compress_dictionary);
+        if (r < 0)
+                return r;
+
+        return 1;
+}
+
+static int journal_file_setup_dictionary(JournalFile *f, JournalFile *template) {
+        _cleanup_free_ void *samples = NULL, *dict = NULL;
+        _cleanup_free_ size_t *sizes = NULL;
+        size_t samples_allocated = 0, sizes_allocated = 0, total = 0, dict_size = DICTIONARY_SIZE_MAX;
+        unsigned n = 0;
+        uint64_t m, i, p;
+        Object *o;
+        int r;
+
+        assert(f);
+        assert(template);
+
+        /* Trains a compression dictionary from the uncompressed data
+         * objects of the file we are rotating away from, and stores
+         * it in the new file. Small objects, which normally are not
+         * worth compressing, are then compressed with it. */
+
+        if (!template->header ||
+            le64toh(template->header->data_hash_table_size) <= 0 ||
+            (JOURNAL_HEADER_CONTAINS(template->header, n_data) &&
+             le64toh(template->header->n_data) < DICTIONARY_SAMPLES_MIN))
+                return 0;
+
+        r = journal_file_map_data_hash_table(template);
+        if (r < 0)
+                return r;
+
+        m = le64toh(template->header->data_hash_table_size) / sizeof(HashItem);
+
+        for (i = 0; i < m && n < DICTIONARY_SAMPLES_MAX && total < DICTIONARY_SAMPLES_SIZE_MAX; i++) {
+
+                p = le64toh(template->data_hash_table[i].head_hash_offset);
+
+                while (p > 0 && n < DICTIONARY_SAMPLES_MAX && total < DICTIONARY_SAMPLES_SIZE_MAX) {
+                        uint64_t l;
+
+                        r = journal_file_move_to_object(template, OBJECT_DATA, p, &o);
+                        if (r < 0)
+                                return r;
+
+                        l = le64toh(o->object.size) - offsetof(Object, data.payload);
+
+                        if (!(o->object.flags & OBJECT_COMPRESSION_MASK) &&
+                            l >= DICTIONARY_SAMPLE_SIZE_MIN &&
+                            l <= DICTIONARY_SAMPLE_SIZE_MAX) {
+
+                                if (!GREEDY_REALLOC(samples, samples_allocated, total + l) ||
+                                    !GREEDY_REALLOC(sizes, sizes_allocated, n + 1))
+                                        return -ENOMEM;
+
+                                memcpy((uint8_t*) samples + total, o->data.payload, l);
+                                sizes[n++] = l;
+                                total += l;
+                        }
+
+                        p = le64toh(o->data.next_hash_offset);
+                }
+        }
+
+        if (n < DICTIONARY_SAMPLES_MIN)
+                return 0;
+
+        dict = malloc(dict_size);
+        if (!dict)
+                return -ENOMEM;
+
+        r = compress_dictionary_train(samples, sizes, n, dict, &dict_size);
+        if (r < 0) {
+                /* Not enough variety or too little data, just go on
+                 * without a dictionary */
+                log_debug("Failed to train compression dictionary for %s, ignoring: %s", f->path, strerror(-r));
+                return 0;
+        }
+
+        r = compress_dictionary_new(dict, dict_size, &f->compress_dictionary);
+        if (r < 0)
+                return r;
+
+        r = journal_file_append_object(f, OBJECT_DICTIONARY, offsetof(Object, dictionary.payload) + dict_size, &o, &p);
+        if (r < 0) {
+                f->compress_dictionary = compress_dictionary_free(f->compress_dictionary);
+                return r;
+        }
+
+        o->dictionary.n_samples = htole64(n);
+        memcpy(o->dictionary.payload, dict, dict_size);
+
+        f->header->dictionary_offset = htole64(p);
+        f->header->incompatible_flags |= htole32(HEADER_INCOMPATIBLE_ZSTD_DICTIONARY);
+
+        log_debug("Trained %zu byte compression dictionary from %u data objects for %s.", dict_size, n, f->path);
+
+        return 1;
+}
+#endif
+
+int journal_file_decompress(
+                JournalFile *f,
+                int compression,
+                const void *src, uint64_t src_size,
+                void **dst, size_t *dst_alloc_size, size_t *dst_size, size_t dst_max) {
+
+        assert(f);
+
+#ifdef HAVE_ZSTD
+        if (compression == OBJECT_COMPRESSED_ZSTD && JOURNAL_HEADER_ZSTD_DICTIONARY(f->header)) {
+                int r;
+
+                r = journal_file_load_dictionary(f);
+                if (r < 0)
+                        return r;
+
+                return decompress_blob_zstd_dictionary(f->compress_dictionary, src, src_size,
+                                                       dst, dst_alloc_size, dst_size, dst_max);
+        }
+#endif
+
+        return decompress_blob(compression, src, src_size, dst, dst_alloc_size, dst_size, dst_max);
+}
+
+int journal_file_decompress_startswith(
+                JournalFile *f,
+                int compression,
+                const void *src, uint64_t src_size,
+                void **buffer, size_t *buffer_size,
+                const void *prefix, size_t prefix_len,
+                uint8_t extra) {
+
+        assert(f);
+
+#ifdef HAVE_ZSTD
+        if (compression == OBJECT_COMPRESSED_ZSTD && JOURNAL_HEADER_ZSTD_DICTIONARY(f->header)) {
+                size_t rsize = 0;
+                int r;
+
+                r = journal_file_decompress(f, compression, src, src_size, buffer, buffer_size, &rsize, 0);
+                if (r < 0)
+                        return r;
+
+                return rsize >= prefix_len + 1 &&
+                        memcmp(*buffer, prefix, prefix_len) == 0 &&
+                        ((const uint8_t*) *buffer)[prefix_len] == extra;
+        }
+#endif
+
+        return decompress_startswith(compression, src, src_size, buffer, buffer_size, prefix, prefix_len, extra);
+}
+
+static uint64_t bloom_filter_bit(uint64_t hash, uint64_t i, uint64_t n_bits) {
+
+        /* Derive the k bit positions from the two halves of the
+         * 64bit data hash, by double hashing */
+        return ((hash & 0xFFFFFFFFULL) + i * ((hash >> 32) | 1ULL)) % n_bits;
+}
+
+static int journal_file_append_bloom_filter(JournalFile *f) {
+        _cleanup_free_ le64_t *bits = NULL;
+        uint64_t n_items = 0, n_words, n_bits, size, m, i, p, q;
+        Object *o;
+        int r;
+
+        assert(f);
+        assert(f->writable);
+
+        /* Adds a bloom filter of the hashes of all data objects to
+         * the file. This is done when the file is archived, since
+         * it won't change anymore afterwards. Readers use it to
+         * skip files that cannot contain a match. */
+
+        if (f->seal ||
+            !JOURNAL_HEADER_CONTAINS(f->header, bloom_filter_offset) ||
+            le64toh(f->header->data_hash_table_size) <= 0)
+                return 0;
+
+        size = le64toh(f->header->n_data) * BLOOM_FILTER_BITS_PER_ITEM / 8;
+        size = ALIGN64(CLAMP(size, BLOOM_FILTER_SIZE_MIN, BLOOM_FILTER_SIZE_MAX));
+        n_words = size / sizeof(le64_t);
+        n_bits = n_words * 64;
+
+        bits = new0(le64_t, n_words);
+        if (!bits)
+                return -ENOMEM;
+
+        r = journal_file_map_data_hash_table(f);
+        if (r < 0)
+                return r;
+
+        m = le64toh(f->header->data_hash_table_size) / sizeof(HashItem);
+
+        for (i = 0; i < m; i++) {
+
+                p = le64toh(f->data_hash_table[i].head_hash_offset);
+                while (p > 0) {
+                        uint64_t h, k;
+
+                        r = journal_file_move_to_object(f, OBJECT_DATA, p, &o);
+                        if (r < 0)
+                                return r;
+
+                        h = le64toh(o->data.hash);
+                        for (k = 0; k < BLOOM_FILTER_N_HASHES; k++) {
+                                uint64_t b = bloom_filter_bit(h, k, n_bits);
+
+                                bits[b / 64] |= htole64(1ULL << (b % 64));
+                        }
+
+                        n_items++;
+                        p = le64toh(o->data.next_hash_offset);
+                }
+        }
+
+        r = journal_file_append_object(f, OBJECT_BLOOM_FILTER, offsetof(Object, bloom_filter.bits) + size, &o, &q);
+        if (r < 0)
+                return r;
+
+        o->bloom_filter.n_hashes = htole64(BLOOM_FILTER_N_HASHES);
+        o->bloom_filter.n_items = htole64(n_items);
+        memcpy(o->bloom_filter.bits, bits, size);
+
+        f->header->bloom_filter_offset = htole64(q);
+        f->header->compatible_flags |= htole32(HEADER_COMPATIBLE_BLOOM_FILTER);
+
+        return 1;
+}
+
+int journal_file_bloom_filter_check(JournalFile *f, uint64_t hash) {
+        uint64_t p, n_bits, n_hashes, k;
+        Object *o;
+        int r;
+
+        assert(f);
+
+        /* Returns 0 if the file definitely contains no data object
+         * with the specified hash, 1 if it might. */
+
+        if (!JOURNAL_HEADER_BLOOM_FILTER(f->header) ||
+            !JOURNAL_HEADER_CONTAINS(f->header, bloom_filter_offset))
+                return 1;
+
+        p = le64toh(f->header->bloom_filter_offset);
+        if (p <= 0)
+                return 1;
+
+        r = journal_file_move_to_object(f, OBJECT_BLOOM_FILTER, p, &o);
+        if (r < 0)
+                return r;
+
+        n_bits = (le64toh(o->object.size) - offsetof(Object, bloom_filter.bits)) / sizeof(le64_t) * 64;
+        n_hashes = le64toh(o->bloom_filter.n_hashes);
+        if (n_bits <= 0 || n_hashes <= 0 || n_hashes > 64)
+                return -EBADMSG;
+
+        for (k = 0; k < n_hashes; k++) {
+                uint64_t b = bloom_filter_bit(hash, k, n_bits);
+
+                if (!(le64toh(o->bloom_filter.bits[b / 64]) & (1ULL << (b % 64))))
+                        return 0;
+        }
+
+        return 1;
+}
+
+static int journal_file_collect_entries(JournalFile *f, uint64_t extra, uint64_t first, uint64_t n, uint64_t *entries, uint64_t *n_collected) {
+        uint64_t a, k = 0;
+        int r;
+
+        assert(f);
+        assert(entries);
+
+        /* Reads the offsets of up to n entries from an entry array
+         * chain, optionally preceded by an extra inline entry as data
+         * objects have it */
+
+        if (extra > 0 && n > 0) {
+                entries[k++] = extra;
+                n--;
+        }
+
+        a = first;
+        while (a > 0 && n > 0) {
+                uint64_t m, i;
+                Object *o;
+
+                r = journal_file_move_to_object(f, OBJECT_ENTRY_ARRAY, a, &o);
+                if (r < 0)
+                        return r;
+
+                m = MIN(journal_file_entry_array_n_items(o), n);
+                for (i = 0; i < m; i++) {
+                        uint64_t p = le64toh(o->entry_array.items[i]);
+
+                        /* Entry arrays are preallocated, hence
+                         * the rest of this array is unused */
+                        if (p == 0)
+                                break;
+
+                        entries[k++] = p;
+                }
+
+                if (i < m)
+                        break;
+
+                n -= m;
+                a = le64toh(o->entry_array.next_entry_array_offset);
+        }
+
+        *n_collected = k;
+        return 0;
+}
+
+static int compare_uint64(const void *_a, const void *_b) {
+        uint64_t a = *(const uint64_t*) _a, b = *(const uint64_t*) _b;
+
+        return a < b ? -1 : (a > b ? 1 : 0);
+}
+
+static int journal_file_append_column(JournalFile *f, const char *field, const uint64_t *entries, uint64_t n_entries, uint64_t *values) {
+        _cleanup_free_ uint64_t *data_entries = NULL;
+        size_t data_entries_allocated = 0;
+        uint64_t field_offset, p, q, i, n_runs;
+        Object *o;
+        int r;
+
+        assert(f);
+        assert(field);
+        assert(entries);
+        assert(values);
+
+        r = journal_file_find_field_object(f, field, strlen(field), &o, &field_offset);
+        if (r <= 0)
+                return r;
+
+        memzero(values, n_entries * sizeof(uint64_t));
+
+        /* Assign each data object of the field to the entries
+         * referencing it. Entries carrying the field more than once
+         * are attributed to one of the values. */
+        p = le64toh(o->field.head_data_offset);
+        while (p > 0) {
+                uint64_t n, extra, first, k, j;
+
+                r = journal_file_move_to_object(f, OBJECT_DATA, p, &o);
+                if (r < 0)
+                        return r;
+
+                n = le64toh(o->data.n_entries);
+                extra = le64toh(o->data.entry_offset);
+                first = le64toh(o->data.entry_array_offset);
+                q = le64toh(o->data.next_field_offset);
+
+                if (!GREEDY_REALLOC(data_entries, data_entries_allocated, MAX(n, 1u)))
+                        return -ENOMEM;
+
+                r = journal_file_collect_entries(f, extra, first, n, data_entries, &k);
+                if (r < 0)
+                        return r;
+
+                for (j = 0; j < k; j++) {
+                        const uint64_t *e;
+
+                        e = bsearch(&data_entries[j], entries, n_entries, sizeof(uint64_t), compare_uint64);
+                        if (!e)
+                                return -EBADMSG;
+
+                        values[e - entries] = p;
+                }
+
+                p = q;
+        }
+
+        /* Run-length encode in place */
+        n_runs = 0;
+        for (i = 0; i < n_entries; i++)
+                if (i == 0 || values[i] != values[i-1])
+                        n_runs++;
+
+        r = journal_file_append_object(f, OBJECT_COLUMN, offsetof(Object, column.runs) + n_runs * sizeof(ColumnRun), &o, &q);
+        if (r < 0)
+                return r;
+
+        o->column.next_column_offset = f->header->columns_offset;
+        o->column.field_offset = htole64(field_offset);
+        o->column.n_entries = htole64(n_entries);
+
+        n_runs = 0;
+        for (i = 0; i < n_entries; i++) {
+                if (i == 0 || values[i] != values[i-1]) {
+                        o->column.runs[n_runs].data_offset = htole64(values[i]);
+                        o->column.runs[n_runs].n_entries = 0;
+                        n_runs++;
+                }
+
+                o->column.runs[n_runs-1].n_entries = htole64(le64toh(o->column.runs[n_runs-1].n_entries) + 1);
+        }
+
+        f->header->columns_offset = htole64(q);
+        f->header->compatible_flags |= htole32(HEADER_COMPATIBLE_COLUMNS);
+
+        return 1;
+}
+
+static int journal_file_append_columns(JournalFile *f) {
+        _cleanup_free_ uint64_t *entries = NULL, *values = NULL;
+        uint64_t n_entries, k;
+        unsigned i;
+        bool any = false;
+        int r;
+
+        assert(f);
+        assert(f->writable);
+
+        /* Stores the values of a few popular fields of all entries
+         * as run-length encoded columns, aligned to the entry array.
+         * Like the bloom filter this is done when the file is
+         * archived. */
+
+        if (f->seal ||
+            !JOURNAL_HEADER_CONTAINS(f->header, columns_offset) ||
+            le64toh(f->header->field_hash_table_size) <= 0)
+                return 0;
+
+        n_entries = le64toh(f->header->n_entries);
+        if (n_entries <= 0)
+                return 0;
+
+        entries = new(uint64_t, n_entries);
+        values = new(uint64_t, n_entries);
+        if (!entries || !values)
+                return -ENOMEM;
+
+        r = journal_file_collect_entries(f, 0, le64toh(f->header->entry_array_offset), n_entries, entries, &k);
+        if (r < 0)
+                return r;
+        if (k != n_entries)
+                return -EBADMSG;
+
+        for (i = 0; i < ELEMENTSOF(column_fields); i++) {
+                r = journal_file_append_column(f, column_fields[i], entries, n_entries, values);
+                if (r < 0)
+                        return r;
+                if (r > 0)
+                        any = true;
+        }
+
+        return any;
+}
+
+int journal_file_find_column(JournalFile *f, const void *field, uint64_t size, Object **ret, uint64_t *offset) {
+        uint64_t field_offset, p;
+        Object *o;
+        int r;
+
+        assert(f);
+        assert(field && size > 0);
+
+        /* Returns 0 if there's no column for the field, in which case
+         * the caller has to look at the entries themselves */
+
+        if (!JOURNAL_HEADER_COLUMNS(f->header) ||
+            !JOURNAL_HEADER_CONTAINS(f->header, columns_offset))
+                return 0;
+
+        r = journal_file_find_field_object(f, field, size, NULL, &field_offset);
+        if (r <= 0)
+                return r;
+
+        p = le64toh(f->header->columns_offset);
+        while (p > 0) {
+                r = journal_file_move_to_object(f, OBJECT_COLUMN, p, &o);
+                if (r < 0)
+                        return r;
+
+                if (le64toh(o->column.field_offset) == field_offset) {
+                        if (le64toh(o->column.n_entries) != le64toh(f->header->n_entries))
+                                return -EBADMSG;
+
+                        if (ret)
+                                *ret = o;
+                        if (offset)
+                                *offset = p;
+
+                        return 1;
+                }
+
+                p = le64toh(o->column.next_column_offset);
+        }
+
+        return 0;
+}
+
+typedef struct DataCacheItem {
+        uint64_t hash;
+        uint64_t offset;
+} DataCacheItem;
+
+static void data_cache_put(JournalFile *f, uint64_t hash, uint64_t offset) {
+        DataCacheItem *ci;
+
+        assert(f);
+
+        if (!f->data_cache)
+                return;
+
+        ci = ordered_hashmap_get(f->data_cache, &hash);
+        if (ci) {
+                /* On hash collisions simply remember the most
+                 * recently used object */
+                ci->offset = offset;
+                return;
+        }
+
+        if (ordered_hashmap_size(f->data_cache) >= DATA_CACHE_MAX) {
+                ci = ordered_hashmap_steal_first(f->data_cache);
+                assert(ci);
+        } else {
+                ci = new(DataCacheItem, 1);
+                if (!ci)
+                        return;
+        }
+
+        ci->hash = hash;
+        ci->offset = offset;
+
+        if (ordered_hashmap_put(f->data_cache, &ci->hash, ci) < 0)
+                free(ci);
+}
+
+static int data_cache_find(
+                JournalFile *f,
+                const void *data, uint64_t size, uint64_t hash,
+                Object **ret, uint64_t *offset) {
+
+        DataCacheItem *ci;
+        Object *o;
+        int r;
+
+        assert(f);
+
+        /* Looks for the data object in the cache of recently used
+         * data objects, so that fields that show up in almost every
+         * entry don't require walking the hash chain each time. Only
+         * uncompressed objects are ever put into the cache. */
+
+        if (!f->data_cache)
+                return 0;
+
+        ci = ordered_hashmap_get(f->data_cache, &hash);
+        if (!ci)
+                return 0;
+
+        r = journal_file_move_to_object(f, OBJECT_DATA, ci->offset, &o);
+        if (r < 0)
+                return r;
+
+        if (le64toh(o->data.hash) != hash ||
+            (o->object.flags & OBJECT_COMPRESSION_MASK) ||
+            le64toh(o->object.size) != offsetof(Object, data.payload) + size ||
+            memcmp(o->data.payload, data, size) != 0)
+                return 0;
+
+        /* Move the item to the end, so that the least recently used
+         * one is evicted first */
+        assert_se(ordered_hashmap_remove(f->data_cache, &ci->hash) == ci);
+        if (ordered_hashmap_put(f->data_cache, &ci->hash, ci) < 0)
+                free(ci);
+
+        if (ret)
+                *ret = o;
+
+        if (offset)
+                *offset = ci->offset;
+
+        return 1;
+}
+
 int journal_file_find_data_object_with_hash(
                 JournalFile *f,
                 const void *data, uint64_t size, uint64_t hash,
                 Object **ret, uint64_t *offset) {
 
-        uint64_t p, osize, h, m;
+        uint64_t p, osize, h, m, depth = 0;
         int r;
 
         assert(f);
@@ -884,6 +1568,10 @@ int journal_file_find_data_object_with_hash(
         if (le64toh(f->header->data_hash_table_size) <= 0)
                 return 0;
 
+        r = data_cache_find(f, data, size, hash, ret, offset);
+        if (r != 0)
+                return r;
+
         /* Map the data hash table, if it isn't mapped yet. */
         r = journal_file_map_data_hash_table(f);
         if (r < 0)
@@ -909,7 +1597,7 @@ int journal_file_find_data_object_with_hash(
                         goto next;
 
                 if (o->object.flags & OBJECT_COMPRESSION_MASK) {
-#if defined(HAVE_XZ) || defined(HAVE_LZ4)
+#if defined(HAVE_XZ) || defined(HAVE_LZ4) || defined(HAVE_ZSTD)
                         uint64_t l;
                         size_t rsize = 0;
 
@@ -919,8 +1607,8 @@ int journal_file_find_data_object_with_hash(
 
                         l -= offsetof(Object, data.payload);
 
-                        r = decompress_blob(o->object.flags & OBJECT_COMPRESSION_MASK,
-                                            o->data.payload, l, &f->compress_buffer, &f->compress_buffer_size, &rsize, 0);
+                        r = journal_file_decompress(f, o->object.flags & OBJECT_COMPRESSION_MASK,
+                                                    o->data.payload, l, &f->compress_buffer, &f->compress_buffer_size, &rsize, 0);
                         if (r < 0)
                                 return r;
 
@@ -941,6 +1629,8 @@ int journal_file_find_data_object_with_hash(
                 } else if (le64toh(o->object.size) == osize &&
                            memcmp(o->data.payload, data, size) == 0) {
 
+                        data_cache_put(f, hash, p);
+
                         if (ret)
                                 *ret = o;
 
@@ -951,9 +1641,15 @@ int journal_file_find_data_object_with_hash(
                 }
 
         next:
+                depth++;
                 p = le64toh(o->data.next_hash_offset);
         }
 
+        if (f->writable &&
+            JOURNAL_HEADER_CONTAINS(f->header, data_hash_chain_depth) &&
+            depth > le64toh(f->header->data_hash_chain_depth))
+                f->header->data_hash_chain_depth = htole64(depth);
+
         return 0;
 }
 
@@ -1073,8 +1769,20 @@ static int journal_file_append_data(
 
         o->data.hash = htole64(hash);
 
-#if defined(HAVE_XZ) || defined(HAVE_LZ4)
-        if (f->compress_xz &&
+#if defined(HAVE_XZ) || defined(HAVE_LZ4) || defined(HAVE_ZSTD)
+#ifdef HAVE_ZSTD
+        if (f->compress_dictionary &&
+            size >= COMPRESSION_DICTIONARY_SIZE_THRESHOLD) {
+                size_t rsize = 0;
+
+                if (compress_blob_zstd_dictionary(f->compress_dictionary, data, size, o->data.payload, &rsize) == 0) {
+                        compression = OBJECT_COMPRESSED_ZSTD;
+                        o->object.size = htole64(offsetof(Object, data.payload) + rsize);
+                        o->object.flags |= compression;
+                }
+        } else
+#endif
+        if (JOURNAL_FILE_COMPRESS(f) &&
             size >= COMPRESSION_SIZE_THRESHOLD) {
                 size_t rsize = 0;
 
@@ -1097,12 +1805,23 @@ static int journal_file_append_data(
         if (r < 0)
                 return r;
 
+        if (!compression)
+                data_cache_put(f, hash, p);
+
         /* The linking might have altered the window, so let's
          * refresh our pointer */
         r = journal_file_move_to_object(f, OBJECT_DATA, p, &o);
         if (r < 0)
                 return r;
 
+#ifdef HAVE_GCRYPT
+        /* Before the field object is appended: the HMAC covers the
+         * objects in the order they are in the file */
+        r = journal_file_hmac_put_object(f, OBJECT_DATA, o, p);
+        if (r < 0)
+                return r;
+#endif
+
         if (!data)
                 eq = NULL;
         else
@@ -1121,12 +1840,6 @@ static int journal_file_append_data(
                 fo->field.head_data_offset = le64toh(p);
         }
 
-#ifdef HAVE_GCRYPT
-        r = journal_file_hmac_put_object(f, OBJECT_DATA, o, p);
-        if (r < 0)
-                return r;
-#endif
-
         if (ret)
                 *ret = o;
 
@@ -1372,24 +2085,109 @@ static int journal_file_append_entry_internal(
         if (ret)
                 *ret = o;
 
-        if (offset)
-                *offset = np;
+        if (offset)
+                *offset = np;
+
+        return 0;
+}
+
+void journal_file_post_change(JournalFile *f) {
+        assert(f);
+
+        /* inotify() does not receive IN_MODIFY events from file
+         * accesses done via mmap(). After each access we hence
+         * trigger IN_MODIFY by truncating the journal file to its
+         * current size which triggers IN_MODIFY. */
+
+        __sync_synchronize();
+
+        if (ftruncate(f->fd, f->last_stat.st_size) < 0)
+                log_error_errno(errno, "Failed to truncate file to its own size: %m");
+}
+
+static int post_change_thunk(sd_event_source *timer, uint64_t usec, void *userdata) {
+        assert(userdata);
+
+        journal_file_post_change(userdata);
+
+        return 1;
+}
+
+static void schedule_post_change(JournalFile *f) {
+        sd_event_source *timer;
+        int enabled, r;
+        uint64_t now;
+
+        assert(f);
+
+        timer = f->post_change_timer;
+        if (!timer)
+                goto fail;
+
+        r = sd_event_source_get_enabled(timer, &enabled);
+        if (r < 0) {
+                log_debug_errno(r, "Failed to get ftruncate timer state: %m");
+                goto fail;
+        }
+
+        /* A notification is pending already, it will cover this
+         * change too */
+        if (enabled == SD_EVENT_ONESHOT)
+                return;
+
+        r = sd_event_now(sd_event_source_get_event(timer), CLOCK_MONOTONIC, &now);
+        if (r < 0) {
+                log_debug_errno(r, "Failed to get clock's now for scheduling ftruncate: %m");
+                goto fail;
+        }
+
+        r = sd_event_source_set_time(timer, now + f->post_change_timer_period);
+        if (r < 0) {
+                log_debug_errno(r, "Failed to set time for scheduling ftruncate: %m");
+                goto fail;
+        }
+
+        r = sd_event_source_set_enabled(timer, SD_EVENT_ONESHOT);
+        if (r < 0) {
+                log_debug_errno(r, "Failed to enable scheduled ftruncate: %m");
+                goto fail;
+        }
 
-        return 0;
+        return;
+
+fail:
+        /* On failure, let's simply post the change immediately. */
+        journal_file_post_change(f);
 }
 
-void journal_file_post_change(JournalFile *f) {
+int journal_file_enable_post_change_timer(JournalFile *f, sd_event *e, usec_t t) {
+        _cleanup_event_source_unref_ sd_event_source *timer = NULL;
+        int r;
+
         assert(f);
+        assert_return(!f->post_change_timer, -EINVAL);
+        assert(e);
+        assert(t);
 
-        /* inotify() does not receive IN_MODIFY events from file
-         * accesses done via mmap(). After each access we hence
-         * trigger IN_MODIFY by truncating the journal file to its
-         * current size which triggers IN_MODIFY. */
+        /* Coalesces the IN_MODIFY notifications of all changes done
+         * within the period t into one, so that followers of a busy
+         * file wake up at most once per period, instead of once per
+         * entry. The timer is driven by the event loop e, hence all
+         * appends have to happen on the thread running it. */
 
-        __sync_synchronize();
+        r = sd_event_add_time(e, &timer, CLOCK_MONOTONIC, 0, 0, post_change_thunk, f);
+        if (r < 0)
+                return r;
 
-        if (ftruncate(f->fd, f->last_stat.st_size) < 0)
-                log_error_errno(errno, "Failed to truncate file to its own size: %m");
+        r = sd_event_source_set_enabled(timer, SD_EVENT_OFF);
+        if (r < 0)
+                return r;
+
+        f->post_change_timer = timer;
+        timer = NULL;
+        f->post_change_timer_period = t;
+
+        return r;
 }
 
 static int entry_item_cmp(const void *_a, const void *_b) {
@@ -1402,7 +2200,7 @@ static int entry_item_cmp(const void *_a, const void *_b) {
         return 0;
 }
 
-int journal_file_append_entry(JournalFile *f, const dual_timestamp *ts, const struct iovec iovec[], unsigned n_iovec, uint64_t *seqnum, Object **ret, uint64_t *offset) {
+static int journal_file_append_entry_one(JournalFile *f, const dual_timestamp *ts, const struct iovec iovec[], unsigned n_iovec, uint64_t *seqnum, Object **ret, uint64_t *offset) {
         unsigned i;
         EntryItem *items;
         int r;
@@ -1447,7 +2245,16 @@ int journal_file_append_entry(JournalFile *f, const dual_timestamp *ts, const st
          * times for rotating media. */
         qsort_safe(items, n_iovec, sizeof(EntryItem), entry_item_cmp);
 
-        r = journal_file_append_entry_internal(f, ts, xor_hash, items, n_iovec, seqnum, ret, offset);
+        return journal_file_append_entry_internal(f, ts, xor_hash, items, n_iovec, seqnum, ret, offset);
+}
+
+int journal_file_append_entry(JournalFile *f, const dual_timestamp *ts, const struct iovec iovec[], unsigned n_iovec, uint64_t *seqnum, Object **ret, uint64_t *offset) {
+        int r;
+
+        assert(f);
+        assert(iovec || n_iovec == 0);
+
+        r = journal_file_append_entry_one(f, ts, iovec, n_iovec, seqnum, ret, offset);
 
         /* If the memory mapping triggered a SIGBUS then we return an
          * IO error and ignore the error code passed down to us, since
@@ -1457,7 +2264,39 @@ int journal_file_append_entry(JournalFile *f, const dual_timestamp *ts, const st
         if (mmap_cache_got_sigbus(f->mmap, f->fd))
                 r = -EIO;
 
-        journal_file_post_change(f);
+        schedule_post_change(f);
+
+        return r;
+}
+
+int journal_file_append_entries(JournalFile *f, const JournalFileEntry entries[], unsigned n_entries, uint64_t *seqnum, unsigned *n_appended) {
+        unsigned i;
+        int r = 0;
+
+        assert(f);
+        assert(entries || n_entries == 0);
+
+        /* Appends a series of entries in one go. This is equivalent
+         * to calling journal_file_append_entry() for each of them,
+         * except that the SIGBUS check and the post-change
+         * notification are done only once for the whole batch. On
+         * failure the entries written so far stay in the file, and
+         * their number is returned in n_appended. */
+
+        for (i = 0; i < n_entries; i++) {
+                r = journal_file_append_entry_one(f, entries[i].ts, entries[i].iovec, entries[i].n_iovec, seqnum, NULL, NULL);
+                if (r < 0)
+                        break;
+        }
+
+        if (mmap_cache_got_sigbus(f->mmap, f->fd))
+                r = -EIO;
+
+        if (i > 0)
+                schedule_post_change(f);
+
+        if (n_appended)
+                *n_appended = i;
 
         return r;
 }
@@ -1470,8 +2309,41 @@ typedef struct ChainCacheItem {
         uint64_t last_index; /* the last index we looked at, to optimize locality when bisecting */
 } ChainCacheItem;
 
+static ChainCacheItem *chain_cache_get(JournalFile *f, uint64_t first) {
+        ChainCacheItem *ci;
+
+        assert(f);
+
+        /* If a good part of the lookups in the last window had to
+         * evict another chain, we are iterating through more chains
+         * at a time than we can remember, let the cache grow */
+        if (++f->chain_cache_lookups >= CHAIN_CACHE_WINDOW) {
+                if (f->chain_cache_evictions * 4 > f->chain_cache_lookups &&
+                    f->chain_cache_max < CHAIN_CACHE_MAX) {
+                        f->chain_cache_max = MIN(f->chain_cache_max * 2, CHAIN_CACHE_MAX);
+                        log_debug("Growing entry array chain cache of %s to %u entries.", f->path, f->chain_cache_max);
+                }
+
+                f->chain_cache_lookups = f->chain_cache_evictions = 0;
+        }
+
+        ci = ordered_hashmap_get(f->chain_cache, &first);
+        if (!ci)
+                return NULL;
+
+        /* Move the item to the end, so that the least recently used
+         * one is evicted first */
+        assert_se(ordered_hashmap_remove(f->chain_cache, &ci->first) == ci);
+        if (ordered_hashmap_put(f->chain_cache, &ci->first, ci) < 0) {
+                free(ci);
+                return NULL;
+        }
+
+        return ci;
+}
+
 static void chain_cache_put(
-                OrderedHashmap *h,
+                JournalFile *f,
                 ChainCacheItem *ci,
                 uint64_t first,
                 uint64_t array,
@@ -1479,15 +2351,19 @@ static void chain_cache_put(
                 uint64_t total,
                 uint64_t last_index) {
 
+        assert(f);
+
         if (!ci) {
                 /* If the chain item to cache for this chain is the
                  * first one it's not worth caching anything */
                 if (array == first)
                         return;
 
-                if (ordered_hashmap_size(h) >= CHAIN_CACHE_MAX) {
-                        ci = ordered_hashmap_steal_first(h);
+                if (ordered_hashmap_size(f->chain_cache) >= f->chain_cache_max) {
+                        ci = ordered_hashmap_steal_first(f->chain_cache);
                         assert(ci);
+
+                        f->chain_cache_evictions++;
                 } else {
                         ci = new(ChainCacheItem, 1);
                         if (!ci)
@@ -1496,7 +2372,7 @@ static void chain_cache_put(
 
                 ci->first = first;
 
-                if (ordered_hashmap_put(h, &ci->first, ci) < 0) {
+                if (ordered_hashmap_put(f->chain_cache, &ci->first, ci) < 0) {
                         free(ci);
                         return;
                 }
@@ -1525,7 +2401,7 @@ static int generic_array_get(
         a = first;
 
         /* Try the chain cache first */
-        ci = ordered_hashmap_get(f->chain_cache, &first);
+        ci = chain_cache_get(f, first);
         if (ci && i > ci->total) {
                 a = ci->array;
                 i -= ci->total;
@@ -1554,7 +2430,7 @@ static int generic_array_get(
 
 found:
         /* Let's cache this item for the next invocation */
-        chain_cache_put(f->chain_cache, ci, first, a, le64toh(o->entry_array.items[0]), t, i);
+        chain_cache_put(f, ci, first, a, le64toh(o->entry_array.items[0]), t, i);
 
         r = journal_file_move_to_object(f, OBJECT_ENTRY, p, &o);
         if (r < 0)
@@ -1628,7 +2504,7 @@ static int generic_array_bisect(
         /* Start with the first array in the chain */
         a = first;
 
-        ci = ordered_hashmap_get(f->chain_cache, &first);
+        ci = chain_cache_get(f, first);
         if (ci && n > ci->total) {
                 /* Ah, we have iterated this bisection array chain
                  * previously! Let's see if we can skip ahead in the
@@ -1787,7 +2663,7 @@ found:
                 return 0;
 
         /* Let's cache this item for the next invocation */
-        chain_cache_put(f->chain_cache, ci, first, a, le64toh(array->entry_array.items[0]), t, subtract_one ? (i > 0 ? i-1 : (uint64_t) -1) : i);
+        chain_cache_put(f, ci, first, a, le64toh(array->entry_array.items[0]), t, subtract_one ? (i > 0 ? i-1 : (uint64_t) -1) : i);
 
         if (subtract_one && i == 0)
                 p = last_p;
@@ -1951,6 +2827,30 @@ static int test_object_realtime(JournalFile *f, uint64_t p, uint64_t needle) {
                 return TEST_RIGHT;
 }
 
+int journal_file_entry_index_by_realtime(JournalFile *f, uint64_t realtime, uint64_t *ret) {
+        uint64_t i;
+        int r;
+
+        assert(f);
+        assert(ret);
+
+        /* Returns the index of the first entry at or after realtime
+         * in the entry array, or n_entries if there is none */
+
+        r = generic_array_bisect(f,
+                                 le64toh(f->header->entry_array_offset),
+                                 le64toh(f->header->n_entries),
+                                 realtime,
+                                 test_object_realtime,
+                                 DIRECTION_DOWN,
+                                 NULL, NULL, &i);
+        if (r < 0)
+                return r;
+
+        *ret = r > 0 ? i : le64toh(f->header->n_entries);
+        return 0;
+}
+
 int journal_file_move_to_entry_by_realtime(
                 JournalFile *f,
                 uint64_t realtime,
@@ -2359,6 +3259,52 @@ int journal_file_move_to_entry_by_seqnum_for_data(
                                              ret, offset, NULL);
 }
 
+int journal_file_count_entries_for_data(
+                JournalFile *f,
+                uint64_t data_offset,
+                uint64_t since,
+                uint64_t until,
+                uint64_t *ret) {
+
+        uint64_t n, a = 0, b, extra, first;
+        Object *d;
+        int r;
+
+        assert(f);
+        assert(ret);
+
+        /* Counts the entries referencing the data object whose
+         * realtime timestamp lies in [since, until) */
+
+        r = journal_file_move_to_object(f, OBJECT_DATA, data_offset, &d);
+        if (r < 0)
+                return r;
+
+        n = le64toh(d->data.n_entries);
+        extra = le64toh(d->data.entry_offset);
+        first = le64toh(d->data.entry_array_offset);
+        b = n;
+
+        if (since > 0) {
+                r = generic_array_bisect_plus_one(f, extra, first, n, since, test_object_realtime, DIRECTION_DOWN, NULL, NULL, &a);
+                if (r < 0)
+                        return r;
+                if (r == 0)
+                        a = n;
+        }
+
+        if (until != (uint64_t) -1) {
+                r = generic_array_bisect_plus_one(f, extra, first, n, until, test_object_realtime, DIRECTION_DOWN, NULL, NULL, &b);
+                if (r < 0)
+                        return r;
+                if (r == 0)
+                        b = n;
+        }
+
+        *ret = b > a ? b - a : 0;
+        return 0;
+}
+
 int journal_file_move_to_entry_by_realtime_for_data(
                 JournalFile *f,
                 uint64_t data_offset,
@@ -2439,6 +3385,23 @@ void journal_file_dump(JournalFile *f) {
                                le64toh(o->tag.epoch));
                         break;
 
+                case OBJECT_DICTIONARY:
+                        printf("Type: OBJECT_DICTIONARY n_samples=%"PRIu64"\n",
+                               le64toh(o->dictionary.n_samples));
+                        break;
+
+                case OBJECT_BLOOM_FILTER:
+                        printf("Type: OBJECT_BLOOM_FILTER n_hashes=%"PRIu64" n_items=%"PRIu64"\n",
+                               le64toh(o->bloom_filter.n_hashes),
+                               le64toh(o->bloom_filter.n_items));
+                        break;
+
+                case OBJECT_COLUMN:
+                        printf("Type: OBJECT_COLUMN field_offset=%"PRIu64" n_runs=%"PRIu64"\n",
+                               le64toh(o->column.field_offset),
+                               (le64toh(o->object.size) - offsetof(Object, column.runs)) / sizeof(ColumnRun));
+                        break;
+
                 default:
                         printf("Type: unknown (%i)\n", o->object.type);
                         break;
@@ -2482,8 +3445,8 @@ void journal_file_print_header(JournalFile *f) {
                "Boot ID: %s\n"
                "Sequential Number ID: %s\n"
                "State: %s\n"
-               "Compatible Flags:%s%s\n"
-               "Incompatible Flags:%s%s%s\n"
+               "Compatible Flags:%s%s%s%s\n"
+               "Incompatible Flags:%s%s%s%s%s\n"
                "Header size: %"PRIu64"\n"
                "Arena size: %"PRIu64"\n"
                "Data Hash Table Size: %"PRIu64"\n"
@@ -2505,9 +3468,13 @@ void journal_file_print_header(JournalFile *f) {
                f->header->state == STATE_ONLINE ? "ONLINE" :
                f->header->state == STATE_ARCHIVED ? "ARCHIVED" : "UNKNOWN",
                JOURNAL_HEADER_SEALED(f->header) ? " SEALED" : "",
+               JOURNAL_HEADER_BLOOM_FILTER(f->header) ? " BLOOM-FILTER" : "",
+               JOURNAL_HEADER_COLUMNS(f->header) ? " COLUMNS" : "",
                (le32toh(f->header->compatible_flags) & ~HEADER_COMPATIBLE_ANY) ? " ???" : "",
                JOURNAL_HEADER_COMPRESSED_XZ(f->header) ? " COMPRESSED-XZ" : "",
                JOURNAL_HEADER_COMPRESSED_LZ4(f->header) ? " COMPRESSED-LZ4" : "",
+               JOURNAL_HEADER_COMPRESSED_ZSTD(f->header) ? " COMPRESSED-ZSTD" : "",
+               JOURNAL_HEADER_ZSTD_DICTIONARY(f->header) ? " ZSTD-DICTIONARY" : "",
                (le32toh(f->header->incompatible_flags) & ~HEADER_INCOMPATIBLE_ANY) ? " ???" : "",
                le64toh(f->header->header_size),
                le64toh(f->header->arena_size),
@@ -2541,6 +3508,14 @@ void journal_file_print_header(JournalFile *f) {
                 printf("Entry Array Objects: %"PRIu64"\n",
                        le64toh(f->header->n_entry_arrays));
 
+        if (JOURNAL_HEADER_CONTAINS(f->header, field_hash_chain_depth))
+                printf("Deepest Field Hash Chain: %"PRIu64"\n",
+                       le64toh(f->header->field_hash_chain_depth));
+
+        if (JOURNAL_HEADER_CONTAINS(f->header, data_hash_chain_depth))
+                printf("Deepest Data Hash Chain: %"PRIu64"\n",
+                       le64toh(f->header->data_hash_chain_depth));
+
         if (fstat(f->fd, &st) >= 0)
                 printf("Disk usage: %s\n", format_bytes(bytes, sizeof(bytes), (uint64_t) st.st_blocks * 512ULL));
 }
@@ -2617,7 +3592,9 @@ int journal_file_open(
         f->flags = flags;
         f->prot = prot_from_flags(flags);
         f->writable = (flags & O_ACCMODE) != O_RDONLY;
-#if defined(HAVE_LZ4)
+#if defined(HAVE_ZSTD)
+        f->compress_zstd = compress;
+#elif defined(HAVE_LZ4)
         f->compress_lz4 = compress;
 #elif defined(HAVE_XZ)
         f->compress_xz = compress;
@@ -2648,6 +3625,16 @@ int journal_file_open(
                 goto fail;
         }
 
+        f->chain_cache_max = CHAIN_CACHE_MIN;
+
+        if (f->writable) {
+                f->data_cache = ordered_hashmap_new(&uint64_hash_ops);
+                if (!f->data_cache) {
+                        r = -ENOMEM;
+                        goto fail;
+                }
+        }
+
         f->fd = open(f->path, f->flags|O_CLOEXEC, f->mode);
         if (f->fd < 0) {
                 r = -errno;
@@ -2747,6 +3734,16 @@ int journal_file_open(
                 if (r < 0)
                         goto fail;
 
+#ifdef HAVE_ZSTD
+                /* Sealed files don't get a dictionary, since it would
+                 * have to be covered by the first tag */
+                if (f->compress_zstd && !f->seal && template) {
+                        r = journal_file_setup_dictionary(f, template);
+                        if (r < 0)
+                                log_debug("Failed to set up compression dictionary for %s, ignoring: %s", f->path, strerror(-r));
+                }
+#endif
+
 #ifdef HAVE_GCRYPT
                 r = journal_file_append_first_tag(f);
                 if (r < 0)
@@ -2771,6 +3768,29 @@ fail:
         return r;
 }
 
+static void journal_file_archive(JournalFile *f) {
+        int r;
+
+        assert(f);
+
+        /* The file won't change anymore, hence summarize its data
+         * objects for readers */
+        r = journal_file_append_bloom_filter(f);
+        if (r < 0)
+                log_debug_errno(r, "Failed to add bloom filter to %s, ignoring: %m", f->path);
+
+        r = journal_file_append_columns(f);
+        if (r < 0)
+                log_debug_errno(r, "Failed to add columns to %s, ignoring: %m", f->path);
+
+        f->header->state = STATE_ARCHIVED;
+
+        /* Currently, btrfs is not very good with out write patterns
+         * and fragments heavily. Let's defrag our journal files when
+         * we archive them */
+        f->defrag_on_close = true;
+}
+
 int journal_file_rotate(JournalFile **f, bool compress, bool seal) {
         _cleanup_free_ char *p = NULL;
         size_t l;
@@ -2804,14 +3824,17 @@ int journal_file_rotate(JournalFile **f, bool compress, bool seal) {
         if (r < 0 && errno != ENOENT)
                 return -errno;
 
-        old_file->header->state = STATE_ARCHIVED;
-
-        /* Currently, btrfs is not very good with out write patterns
-         * and fragments heavily. Let's defrag our journal files when
-         * we archive them */
-        old_file->defrag_on_close = true;
+        journal_file_archive(old_file);
 
         r = journal_file_open(old_file->path, old_file->flags, old_file->mode, compress, seal, NULL, old_file->mmap, old_file, &new_file);
+        if (r >= 0 && old_file->post_change_timer) {
+                r = journal_file_enable_post_change_timer(new_file, sd_event_source_get_event(old_file->post_change_timer), old_file->post_change_timer_period);
+                if (r < 0) {
+                        journal_file_close(new_file);
+                        new_file = NULL;
+                }
+        }
+
         journal_file_close(old_file);
 
         *f = new_file;
@@ -2927,11 +3950,11 @@ int journal_file_copy_entry(JournalFile *from, JournalFile *to, Object *o, uint6
                         return -E2BIG;
 
                 if (o->object.flags & OBJECT_COMPRESSION_MASK) {
-#if defined(HAVE_XZ) || defined(HAVE_LZ4)
+#if defined(HAVE_XZ) || defined(HAVE_LZ4) || defined(HAVE_ZSTD)
                         size_t rsize = 0;
 
-                        r = decompress_blob(o->object.flags & OBJECT_COMPRESSION_MASK,
-                                            o->data.payload, l, &from->compress_buffer, &from->compress_buffer_size, &rsize, 0);
+                        r = journal_file_decompress(from, o->object.flags & OBJECT_COMPRESSION_MASK,
+                                                    o->data.payload, l, &from->compress_buffer, &from->compress_buffer_size, &rsize, 0);
                         if (r < 0)
                                 return r;
 
@@ -2964,6 +3987,191 @@ int journal_file_copy_entry(JournalFile *from, JournalFile *to, Object *o, uint6
         return r;
 }
 
+static int journal_file_truncate_tail(JournalFile *f) {
+        uint64_t p, end;
+        Object *o;
+        int r;
+
+        assert(f);
+
+        /* Drops the space journal_file_allocate() reserved beyond
+         * the last object */
+
+        p = le64toh(f->header->tail_object_offset);
+        if (p == 0)
+                return 0;
+
+        r = journal_file_move_to_object(f, OBJECT_UNUSED, p, &o);
+        if (r < 0)
+                return r;
+
+        end = PAGE_ALIGN(p + ALIGN64(le64toh(o->object.size)));
+        if (end >= (uint64_t) f->last_stat.st_size)
+                return 0;
+
+        f->header->arena_size = htole64(end - le64toh(f->header->header_size));
+
+        if (ftruncate(f->fd, end) < 0)
+                return -errno;
+
+        return journal_file_fstat(f);
+}
+
+static void journal_file_copy_attributes(JournalFile *from, JournalFile *to) {
+        _cleanup_free_ char *acl = NULL;
+        int n;
+
+        assert(from);
+        assert(to);
+
+        if (fchmod(to->fd, from->last_stat.st_mode & 07777) < 0)
+                log_debug_errno(errno, "Failed to set access mode of %s, ignoring: %m", to->path);
+
+        if (fchown(to->fd, from->last_stat.st_uid, from->last_stat.st_gid) < 0)
+                log_debug_errno(errno, "Failed to set ownership of %s, ignoring: %m", to->path);
+
+        /* journald grants users access to their own journal files
+         * via ACLs, carry them over verbatim */
+        n = fgetxattr_malloc(from->fd, "system.posix_acl_access", &acl);
+        if (n < 0) {
+                if (n != -ENODATA && n != -EOPNOTSUPP)
+                        log_debug_errno(n, "Failed to read ACL of %s, ignoring: %m", from->path);
+                return;
+        }
+
+        if (fsetxattr(to->fd, "system.posix_acl_access", acl, n, 0) < 0)
+                log_debug_errno(errno, "Failed to set ACL of %s, ignoring: %m", to->path);
+}
+
+int journal_file_compact(JournalFile *from, bool compress, MMapCache *mmap_cache, uint64_t *ret_saved) {
+        _cleanup_free_ char *t = NULL;
+        JournalMetrics metrics = {
+                .max_use = (uint64_t) -1,
+                .min_size = (uint64_t) -1,
+                .keep_free = 0,
+        };
+        JournalFile *to = NULL;
+        uint64_t p = 0, seqnum, old_size, new_size;
+        size_t l;
+        Object *o;
+        int r;
+
+        assert(from);
+
+        /* Rewrites an archived journal file entry by entry into a
+         * fresh file, with hash tables sized for the data actually
+         * stored, no allocation slack at the end, and (optionally)
+         * compression of all fields above the threshold. Sequence
+         * numbers and the sequence number ID are retained, hence
+         * readers see the very same entries afterwards. */
+
+        if (from->header->state != STATE_ARCHIVED)
+                return -EBUSY;
+
+        /* The seal covers the exact layout of the file */
+        if (JOURNAL_HEADER_SEALED(from->header))
+                return -EPERM;
+
+        if (!endswith(from->path, ".journal"))
+                return -EINVAL;
+
+        r = journal_file_fstat(from);
+        if (r < 0)
+                return r;
+
+        old_size = (uint64_t) from->last_stat.st_size;
+
+        /* The hash table is sized from max_size, hence derive it from
+         * the number of data objects we are going to store */
+        if (JOURNAL_HEADER_CONTAINS(from->header, n_data))
+                metrics.max_size = le64toh(from->header->n_data) * 768;
+        else
+                metrics.max_size = old_size;
+
+        /* Use a name readers and vacuuming will leave alone until
+         * the file is complete */
+        l = strlen(from->path);
+        if (asprintf(&t, "%.*s.compact.journal~", (int) l - 8, from->path) < 0)
+                return -ENOMEM;
+
+        /* Leftover of an interrupted run? */
+        (void) unlink(t);
+
+        r = journal_file_open(t, O_RDWR|O_CREAT|O_EXCL, from->last_stat.st_mode & 07777, compress, false, &metrics, mmap_cache, from, &to);
+        if (r < 0)
+                return r;
+
+        /* We copy the original sequence numbers, hence start from
+         * scratch instead of continuing the template's counter */
+        to->header->tail_entry_seqnum = 0;
+
+        /* There's no point in growing beyond the original */
+        to->metrics.max_size = PAGE_ALIGN(old_size);
+
+        for (;;) {
+                r = journal_file_next_entry(from, p, DIRECTION_DOWN, &o, &p);
+                if (r < 0)
+                        goto fail;
+                if (r == 0)
+                        break;
+
+                seqnum = le64toh(o->entry.seqnum) - 1;
+
+                r = journal_file_copy_entry(from, to, o, p, &seqnum, NULL, NULL);
+                if (r == -E2BIG) {
+                        r = 0;
+                        goto fail;
+                }
+                if (r < 0)
+                        goto fail;
+        }
+
+        if (le64toh(to->header->n_entries) != le64toh(from->header->n_entries)) {
+                r = -EBADMSG;
+                goto fail;
+        }
+
+        journal_file_archive(to);
+
+        r = journal_file_truncate_tail(to);
+        if (r < 0)
+                goto fail;
+
+        journal_file_copy_attributes(from, to);
+
+        new_size = (uint64_t) to->last_stat.st_size;
+        if (new_size >= old_size) {
+                r = 0;
+                goto fail;
+        }
+
+        if (fsync(to->fd) < 0) {
+                r = -errno;
+                goto fail;
+        }
+
+        if (rename(t, from->path) < 0) {
+                r = -errno;
+                goto fail;
+        }
+
+        journal_file_close(to);
+
+        if (ret_saved)
+                *ret_saved = old_size - new_size;
+
+        return 1;
+
+fail:
+        journal_file_close(to);
+        (void) unlink(t);
+
+        if (r == 0 && ret_saved)
+                *ret_saved = 0;
+
+        return r;
+}
+
 void journal_default_metrics(JournalMetrics *m, int fd) {
         uint64_t fs_size = 0;
         struct statvfs ss;
@@ -3140,6 +4348,24 @@ bool journal_file_rotate_suggested(JournalFile *f, usec_t max_file_usec) {
                         return true;
                 }
 
+        /* The fill level doesn't tell us anything about how the
+         * objects are distributed over the hash table. If we ever
+         * had to walk an overly long hash chain, lookups got slow,
+         * hence suggest rotation in that case, too. */
+        if (JOURNAL_HEADER_CONTAINS(f->header, data_hash_chain_depth) &&
+            le64toh(f->header->data_hash_chain_depth) > HASH_CHAIN_DEPTH_MAX) {
+                log_debug("Data hash table of %s has deepest hash chain of length %"PRIu64", suggesting rotation.",
+                          f->path, le64toh(f->header->data_hash_chain_depth));
+                return true;
+        }
+
+        if (JOURNAL_HEADER_CONTAINS(f->header, field_hash_chain_depth) &&
+            le64toh(f->header->field_hash_chain_depth) > HASH_CHAIN_DEPTH_MAX) {
+                log_debug("Field hash table of %s has deepest hash chain of length %"PRIu64", suggesting rotation.",
+                          f->path, le64toh(f->header->field_hash_chain_depth));
+                return true;
+        }
+
         /* Are the data objects properly indexed by field objects? */
         if (JOURNAL_HEADER_CONTAINS(f->header, n_data) &&
             JOURNAL_HEADER_CONTAINS(f->header, n_fields) &&
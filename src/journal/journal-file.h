@@ -27,6 +27,7 @@
 #include <gcrypt.h>
 #endif
 
+#include "sd-event.h"
 #include "sd-id128.h"
 
 #include "sparse-endian.h"
@@ -34,6 +35,7 @@
 #include "macro.h"
 #include "mmap-cache.h"
 #include "hashmap.h"
+#include "compress.h"
 
 typedef struct JournalMetrics {
         uint64_t max_use;
@@ -62,6 +64,12 @@ typedef enum LocationType {
         LOCATION_SEEK
 } LocationType;
 
+typedef struct JournalFileEntry {
+        const dual_timestamp *ts;
+        const struct iovec *iovec;
+        unsigned n_iovec;
+} JournalFileEntry;
+
 typedef struct JournalFile {
         int fd;
 
@@ -72,6 +80,7 @@ typedef struct JournalFile {
         bool writable:1;
         bool compress_xz:1;
         bool compress_lz4:1;
+        bool compress_zstd:1;
         bool seal:1;
         bool defrag_on_close:1;
 
@@ -80,6 +89,10 @@ typedef struct JournalFile {
         direction_t last_direction;
         LocationType location_type;
         uint64_t last_n_entries;
+        unsigned files_queue_idx;
+
+        sd_event_source *post_change_timer;
+        usec_t post_change_timer_period;
 
         char *path;
         struct stat last_stat;
@@ -100,16 +113,27 @@ typedef struct JournalFile {
         MMapCache *mmap;
 
         OrderedHashmap *chain_cache;
+        unsigned chain_cache_max;
+        unsigned chain_cache_lookups, chain_cache_evictions;
+        OrderedHashmap *data_cache;
 
-#if defined(HAVE_XZ) || defined(HAVE_LZ4)
+#if defined(HAVE_XZ) || defined(HAVE_LZ4) || defined(HAVE_ZSTD)
         void *compress_buffer;
         size_t compress_buffer_size;
 #endif
 
+#ifdef HAVE_ZSTD
+        CompressDictionary *compress_dictionary;
+#endif
+
 #ifdef HAVE_GCRYPT
         gcry_md_hd_t hmac;
         bool hmac_running;
 
+        /* The epoch the HMAC key currently set in hmac belongs to */
+        bool hmac_keyed;
+        uint64_t hmac_key_epoch;
+
         FSSHeader *fss_file;
         size_t fss_file_size;
 
@@ -119,6 +143,11 @@ typedef struct JournalFile {
         void *fsprg_state;
         size_t fsprg_state_size;
 
+        /* fsprg_state evolved by one epoch ahead of time, and the
+         * HMAC key of that epoch */
+        void *fsprg_next_state;
+        uint8_t fsprg_next_key[256 / 8];
+
         void *fsprg_seed;
         size_t fsprg_seed_size;
 #endif
@@ -177,12 +206,36 @@ static inline bool VALID_EPOCH(uint64_t u) {
 #define JOURNAL_HEADER_SEALED(h) \
         (!!(le32toh((h)->compatible_flags) & HEADER_COMPATIBLE_SEALED))
 
+#define JOURNAL_HEADER_BLOOM_FILTER(h) \
+        (!!(le32toh((h)->compatible_flags) & HEADER_COMPATIBLE_BLOOM_FILTER))
+
+#define JOURNAL_HEADER_COLUMNS(h) \
+        (!!(le32toh((h)->compatible_flags) & HEADER_COMPATIBLE_COLUMNS))
+
 #define JOURNAL_HEADER_COMPRESSED_XZ(h) \
         (!!(le32toh((h)->incompatible_flags) & HEADER_INCOMPATIBLE_COMPRESSED_XZ))
 
 #define JOURNAL_HEADER_COMPRESSED_LZ4(h) \
         (!!(le32toh((h)->incompatible_flags) & HEADER_INCOMPATIBLE_COMPRESSED_LZ4))
 
+#define JOURNAL_HEADER_COMPRESSED_ZSTD(h) \
+        (!!(le32toh((h)->incompatible_flags) & HEADER_INCOMPATIBLE_COMPRESSED_ZSTD))
+
+#define JOURNAL_HEADER_ZSTD_DICTIONARY(h) \
+        (!!(le32toh((h)->incompatible_flags) & HEADER_INCOMPATIBLE_ZSTD_DICTIONARY))
+
+/* Whether new data objects in this file shall be compressed with the
+ * algorithm compress_blob() picks */
+#if defined(HAVE_ZSTD)
+#  define JOURNAL_FILE_COMPRESS(f) ((f)->compress_zstd)
+#elif defined(HAVE_LZ4)
+#  define JOURNAL_FILE_COMPRESS(f) ((f)->compress_lz4)
+#elif defined(HAVE_XZ)
+#  define JOURNAL_FILE_COMPRESS(f) ((f)->compress_xz)
+#else
+#  define JOURNAL_FILE_COMPRESS(f) false
+#endif
+
 int journal_file_move_to_object(JournalFile *f, ObjectType type, uint64_t offset, Object **ret);
 
 uint64_t journal_file_entry_n_items(Object *o) _pure_;
@@ -191,9 +244,18 @@ uint64_t journal_file_hash_table_n_items(Object *o) _pure_;
 
 int journal_file_append_object(JournalFile *f, ObjectType type, uint64_t size, Object **ret, uint64_t *offset);
 int journal_file_append_entry(JournalFile *f, const dual_timestamp *ts, const struct iovec iovec[], unsigned n_iovec, uint64_t *seqno, Object **ret, uint64_t *offset);
+int journal_file_append_entries(JournalFile *f, const JournalFileEntry entries[], unsigned n_entries, uint64_t *seqno, unsigned *n_appended);
+
+int journal_file_decompress(JournalFile *f, int compression, const void *src, uint64_t src_size, void **dst, size_t *dst_alloc_size, size_t *dst_size, size_t dst_max);
+int journal_file_decompress_startswith(JournalFile *f, int compression, const void *src, uint64_t src_size, void **buffer, size_t *buffer_size, const void *prefix, size_t prefix_len, uint8_t extra);
 
 int journal_file_find_data_object(JournalFile *f, const void *data, uint64_t size, Object **ret, uint64_t *offset);
 int journal_file_find_data_object_with_hash(JournalFile *f, const void *data, uint64_t size, uint64_t hash, Object **ret, uint64_t *offset);
+int journal_file_bloom_filter_check(JournalFile *f, uint64_t hash);
+
+int journal_file_find_column(JournalFile *f, const void *field, uint64_t size, Object **ret, uint64_t *offset);
+int journal_file_entry_index_by_realtime(JournalFile *f, uint64_t realtime, uint64_t *ret);
+int journal_file_count_entries_for_data(JournalFile *f, uint64_t data_offset, uint64_t since, uint64_t until, uint64_t *ret);
 
 int journal_file_find_field_object(JournalFile *f, const void *field, uint64_t size, Object **ret, uint64_t *offset);
 int journal_file_find_field_object_with_hash(JournalFile *f, const void *field, uint64_t size, uint64_t hash, Object **ret, uint64_t *offset);
@@ -220,8 +282,10 @@ void journal_file_dump(JournalFile *f);
 void journal_file_print_header(JournalFile *f);
 
 int journal_file_rotate(JournalFile **f, bool compress, bool seal);
+int journal_file_compact(JournalFile *from, bool compress, MMapCache *mmap_cache, uint64_t *ret_saved);
 
 void journal_file_post_change(JournalFile *f);
+int journal_file_enable_post_change_timer(JournalFile *f, sd_event *e, usec_t t);
 
 void journal_default_metrics(JournalMetrics *m, int fd);
 
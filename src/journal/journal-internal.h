@@ -31,7 +31,9 @@
 #include "list.h"
 #include "hashmap.h"
 #include "set.h"
+#include "prioq.h"
 #include "journal-file.h"
+#include "catalog.h"
 #include "sd-journal.h"
 
 typedef struct Match Match;
@@ -83,6 +85,20 @@ struct Directory {
         bool is_root;
 };
 
+typedef struct ColumnValue {
+        uint64_t n_entries;
+        size_t size;
+        uint8_t data[];
+} ColumnValue;
+
+typedef struct FieldIndexItem {
+        uint64_t object_offset;
+        uint32_t field_hash;
+        uint32_t field_length;
+        bool indexed; /* false for compressed objects and overly
+                         long field names, which are always checked */
+} FieldIndexItem;
+
 struct sd_journal {
         char *path;
         char *prefix;
@@ -95,6 +111,12 @@ struct sd_journal {
         JournalFile *current_file;
         uint64_t current_field;
 
+        /* All files that have a candidate entry in the current
+         * iteration direction, ordered by that entry */
+        Prioq *files_queue;
+        direction_t files_queue_direction;
+        bool files_queue_valid;
+
         Match *level0, *level1, *level2;
 
         pid_t original_pid;
@@ -106,6 +128,10 @@ struct sd_journal {
         char *unique_field;
         JournalFile *unique_file;
         uint64_t unique_offset;
+        Set *unique_values; /* ColumnValue objects returned so far */
+
+        OrderedHashmap *column_values;
+        Iterator column_iterator;
 
         int flags;
 
@@ -118,9 +144,19 @@ struct sd_journal {
 
         size_t data_threshold;
 
+        /* Field names of the data objects of the current entry, so
+         * that repeated sd_journal_get_data() calls don't need to
+         * look at all of the objects every time */
+        JournalFile *field_index_file;
+        uint64_t field_index_offset;
+        FieldIndexItem *field_index;
+        size_t n_field_index, n_field_index_allocated;
+
         Hashmap *directories_by_path;
         Hashmap *directories_by_wd;
 
+        CatalogCache catalog_cache;
+
         Set *errors;
 };
 
@@ -74,6 +74,104 @@ retry:
         return fd;
 }
 
+/* The datagram socket is connected to journald once, so that the
+ * kernel doesn't have to resolve the socket path and check its
+ * permissions for every single message. If journald is restarted
+ * the peer goes away, and we connect again. */
+
+static bool journal_connected = false;
+
+static int journal_connect(int fd) {
+        union sockaddr_union sa = {
+                .un.sun_family = AF_UNIX,
+                .un.sun_path = "/run/systemd/journal/socket",
+        };
+
+        if (connect(fd, &sa.sa, offsetof(struct sockaddr_un, sun_path) + strlen(sa.un.sun_path)) < 0)
+                return -errno;
+
+        journal_connected = true;
+        return 0;
+}
+
+static int journal_sendmsg(int fd, const struct msghdr *mh, int flags) {
+        unsigned attempt;
+        int r;
+
+        for (attempt = 0;; attempt++) {
+                if (!journal_connected) {
+                        r = journal_connect(fd);
+                        if (r < 0)
+                                return r;
+                }
+
+                if (sendmsg(fd, mh, flags) >= 0)
+                        return 0;
+
+                if (attempt > 0 || !IN_SET(errno, ECONNREFUSED, ENOTCONN))
+                        return -errno;
+
+                journal_connected = false;
+        }
+}
+
+/* If $SYSTEMD_JOURNAL_NONBLOCK is set, latency sensitive callers
+ * never wait for a backed up journald: messages that don't fit into
+ * the socket buffer are dropped and counted, and the count is
+ * reported with the next message that makes it through. */
+
+static unsigned n_dropped = 0;
+
+static bool journal_nonblock(void) {
+        static int cached = -1;
+        const char *e;
+
+        if (cached >= 0)
+                return cached;
+
+        e = secure_getenv("SYSTEMD_JOURNAL_NONBLOCK");
+        cached = e && parse_boolean(e) > 0;
+
+        return cached;
+}
+
+static void journal_report_dropped(int fd) {
+        char message[] = "MESSAGE=Dropped 4294967295 log messages, journal socket was congested.\n";
+        char priority[] = "PRIORITY=4\n";
+        struct iovec iov[2];
+        struct msghdr mh = {
+                .msg_iov = iov,
+                .msg_iovlen = ELEMENTSOF(iov),
+        };
+        char digits[DECIMAL_STR_MAX(unsigned)], *p;
+        unsigned n, m;
+        size_t l;
+
+        n = __sync_fetch_and_and(&n_dropped, 0);
+        if (n == 0)
+                return;
+
+        /* Format by hand, we must stay async signal safe */
+        p = digits + sizeof(digits);
+        m = n;
+        do {
+                *(--p) = '0' + m % 10;
+                m /= 10;
+        } while (m > 0);
+
+        l = digits + sizeof(digits) - p;
+        memcpy(message + strlen("MESSAGE=Dropped "), p, l);
+        memmove(message + strlen("MESSAGE=Dropped ") + l,
+                message + strlen("MESSAGE=Dropped 4294967295"),
+                sizeof(message) - strlen("MESSAGE=Dropped 4294967295"));
+
+        IOVEC_SET_STRING(iov[0], message);
+        IOVEC_SET_STRING(iov[1], priority);
+
+        if (journal_sendmsg(fd, &mh, MSG_NOSIGNAL|MSG_DONTWAIT) < 0)
+                __sync_fetch_and_add(&n_dropped, n);
+}
+
 _public_ int sd_journal_print(int priority, const char *format, ...) {
         int r;
         va_list ap;
@@ -203,15 +301,7 @@ _public_ int sd_journal_sendv(const struct iovec *iov, int n) {
         struct iovec *w;
         uint64_t *l;
         int i, j = 0;
-        struct sockaddr_un sa = {
-                .sun_family = AF_UNIX,
-                .sun_path = "/run/systemd/journal/socket",
-        };
-        struct msghdr mh = {
-                .msg_name = &sa,
-                .msg_namelen = offsetof(struct sockaddr_un, sun_path) + strlen(sa.sun_path),
-        };
-        ssize_t k;
+        struct msghdr mh = {};
         union {
                 struct cmsghdr cmsghdr;
                 uint8_t buf[CMSG_SPACE(sizeof(int))];
@@ -219,6 +309,7 @@ _public_ int sd_journal_sendv(const struct iovec *iov, int n) {
         struct cmsghdr *cmsg;
         bool have_syslog_identifier = false;
         bool seal = true;
+        bool nonblock;
 
         assert_return(iov, -EINVAL);
         assert_return(n > 0, -EINVAL);
@@ -294,16 +385,28 @@ _public_ int sd_journal_sendv(const struct iovec *iov, int n) {
         mh.msg_iov = w;
         mh.msg_iovlen = j;
 
-        k = sendmsg(fd, &mh, MSG_NOSIGNAL);
-        if (k >= 0)
+        nonblock = journal_nonblock();
+
+        r = journal_sendmsg(fd, &mh, MSG_NOSIGNAL|(nonblock ? MSG_DONTWAIT : 0));
+        if (r >= 0) {
+                if (nonblock)
+                        journal_report_dropped(fd);
+
                 return 0;
+        }
 
         /* Fail silently if the journal is not available */
-        if (errno == ENOENT)
+        if (r == -ENOENT)
                 return 0;
 
-        if (errno != EMSGSIZE && errno != ENOBUFS)
-                return -errno;
+        /* The socket buffer is full, journald is backed up */
+        if (nonblock && r == -EAGAIN) {
+                __sync_fetch_and_add(&n_dropped, 1);
+                return 0;
+        }
+
+        if (r != -EMSGSIZE && r != -ENOBUFS)
+                return r;
 
         /* Message doesn't fit... Let's dump the data in a memfd or
          * temporary file and just pass a file descriptor of it to the
@@ -350,11 +453,13 @@ _public_ int sd_journal_sendv(const struct iovec *iov, int n) {
 
         mh.msg_controllen = cmsg->cmsg_len;
 
-        k = sendmsg(fd, &mh, MSG_NOSIGNAL);
-        if (k < 0)
-                return -errno;
+        r = journal_sendmsg(fd, &mh, MSG_NOSIGNAL|(nonblock ? MSG_DONTWAIT : 0));
+        if (nonblock && r == -EAGAIN) {
+                __sync_fetch_and_add(&n_dropped, 1);
+                return 0;
+        }
 
-        return 0;
+        return r;
 }
 
 static int fill_iovec_perror_and_send(const char *message, int skip, struct iovec iov[]) {
@@ -20,12 +20,16 @@
 ***/
 
 #include <fcntl.h>
+#include <sys/inotify.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
 #include "journal-def.h"
 #include "journal-file.h"
 #include "journal-vacuum.h"
+#include "hashmap.h"
+#include "prioq.h"
+#include "set.h"
 #include "sd-id128.h"
 #include "util.h"
 
@@ -38,6 +42,27 @@ struct vacuum_info {
         uint64_t seqnum;
 
         bool have_seqnum;
+        bool empty;
+
+        unsigned queue_idx;
+};
+
+struct VacuumIndex {
+        char *directory;
+        int dir_fd;
+        int inotify_fd;
+
+        /* All vacuumable files by name */
+        Hashmap *files;
+
+        /* Non-empty files, oldest first */
+        Prioq *queue;
+
+        /* Empty files, which are always vacuumed */
+        Set *empty;
+
+        /* Total disk usage of the files in the queue */
+        uint64_t usage;
 };
 
 static int vacuum_compare(const void *_a, const void *_b) {
@@ -141,189 +166,438 @@ static int journal_file_empty(int dir_fd, const char *name) {
         return le64toh(n_entries) <= 0;
 }
 
-int journal_directory_vacuum(
-                const char *directory,
-                uint64_t max_use,
-                usec_t max_retention_usec,
-                usec_t *oldest_usec,
-                bool verbose) {
+static void vacuum_info_free(struct vacuum_info *v) {
+        if (!v)
+                return;
 
-        _cleanup_closedir_ DIR *d = NULL;
-        int r = 0;
-        struct vacuum_info *list = NULL;
-        unsigned n_list = 0, i;
-        size_t n_allocated = 0;
-        uint64_t sum = 0, freed = 0;
-        usec_t retention_limit = 0;
-        char sbytes[FORMAT_BYTES_MAX];
+        free(v->filename);
+        free(v);
+}
+
+static int vacuum_info_new(int dir_fd, const char *directory, const char *name, struct vacuum_info **ret) {
+        struct vacuum_info *v;
+        size_t q;
+        struct stat st;
+        unsigned long long seqnum = 0, realtime;
+        sd_id128_t seqnum_id = {};
+        bool have_seqnum;
+        char *n;
 
+        assert(dir_fd >= 0);
         assert(directory);
+        assert(name);
+        assert(ret);
 
-        if (max_use <= 0 && max_retention_usec <= 0)
+        /* Returns 0 if the file is not one we would vacuum */
+
+        q = strlen(name);
+
+        if (endswith(name, ".journal")) {
+
+                /* Vacuum archived files */
+
+                if (q < 1 + 32 + 1 + 16 + 1 + 16 + 8)
+                        return 0;
+
+                if (name[q-8-16-1] != '-' ||
+                    name[q-8-16-1-16-1] != '-' ||
+                    name[q-8-16-1-16-1-32-1] != '@')
+                        return 0;
+
+                n = strndupa(name + q-8-16-1-16-1-32, 32);
+                if (sd_id128_from_string(n, &seqnum_id) < 0)
+                        return 0;
+
+                if (sscanf(name + q-8-16-1-16, "%16llx-%16llx.journal", &seqnum, &realtime) != 2)
+                        return 0;
+
+                have_seqnum = true;
+
+        } else if (endswith(name, ".journal~")) {
+                unsigned long long tmp;
+
+                /* Vacuum corrupted files */
+
+                if (q < 1 + 16 + 1 + 16 + 8 + 1)
+                        return 0;
+
+                if (name[q-1-8-16-1] != '-' ||
+                    name[q-1-8-16-1-16-1] != '@')
+                        return 0;
+
+                if (sscanf(name + q-1-8-16-1-16, "%16llx-%16llx.journal~", &realtime, &tmp) != 2)
+                        return 0;
+
+                have_seqnum = false;
+        } else
+                /* We do not vacuum active files or unknown files! */
                 return 0;
 
-        if (max_retention_usec > 0) {
-                retention_limit = now(CLOCK_REALTIME);
-                if (retention_limit > max_retention_usec)
-                        retention_limit -= max_retention_usec;
+        if (fstatat(dir_fd, name, &st, AT_SYMLINK_NOFOLLOW) < 0)
+                return 0;
+
+        if (!S_ISREG(st.st_mode))
+                return 0;
+
+        v = new0(struct vacuum_info, 1);
+        if (!v)
+                return -ENOMEM;
+
+        v->filename = strdup(name);
+        if (!v->filename) {
+                free(v);
+                return -ENOMEM;
+        }
+
+        v->usage = 512UL * (uint64_t) st.st_blocks;
+        v->seqnum = seqnum;
+        v->seqnum_id = seqnum_id;
+        v->have_seqnum = have_seqnum;
+        v->queue_idx = PRIOQ_IDX_NULL;
+
+        /* Always vacuum empty non-online files. */
+        v->empty = journal_file_empty(dir_fd, name) != 0;
+        if (!v->empty)
+                patch_realtime(directory, name, &st, &realtime);
+
+        v->realtime = realtime;
+
+        *ret = v;
+        return 1;
+}
+
+static void vacuum_index_drop(VacuumIndex *i, struct vacuum_info *v) {
+        assert(i);
+        assert(v);
+
+        hashmap_remove(i->files, v->filename);
+
+        if (v->empty)
+                set_remove(i->empty, v);
+        else {
+                prioq_remove(i->queue, v, &v->queue_idx);
+
+                if (v->usage < i->usage)
+                        i->usage -= v->usage;
                 else
-                        max_retention_usec = retention_limit = 0;
+                        i->usage = 0;
+        }
+
+        vacuum_info_free(v);
+}
+
+void vacuum_index_remove(VacuumIndex *i, const char *filename) {
+        struct vacuum_info *v;
+
+        assert(i);
+        assert(filename);
+
+        v = hashmap_get(i->files, filename);
+        if (v)
+                vacuum_index_drop(i, v);
+}
+
+int vacuum_index_add(VacuumIndex *i, const char *filename) {
+        struct vacuum_info *v;
+        int r;
+
+        assert(i);
+        assert(filename);
+
+        /* A file replaced under the same name (e.g. by compaction)
+         * is accounted anew */
+        vacuum_index_remove(i, filename);
+
+        r = vacuum_info_new(i->dir_fd, i->directory, filename, &v);
+        if (r <= 0)
+                return r;
+
+        r = hashmap_put(i->files, v->filename, v);
+        if (r < 0) {
+                vacuum_info_free(v);
+                return r;
+        }
+
+        if (v->empty)
+                r = set_put(i->empty, v);
+        else
+                r = prioq_put(i->queue, v, &v->queue_idx);
+        if (r < 0) {
+                hashmap_remove(i->files, v->filename);
+                vacuum_info_free(v);
+                return r;
+        }
+
+        if (!v->empty)
+                i->usage += v->usage;
+
+        return 1;
+}
+
+static void vacuum_index_clear(VacuumIndex *i) {
+        struct vacuum_info *v;
+
+        assert(i);
+
+        while ((v = hashmap_first(i->files)))
+                vacuum_index_drop(i, v);
+}
+
+static int vacuum_index_scan(VacuumIndex *i) {
+        _cleanup_closedir_ DIR *d = NULL;
+        struct dirent *de;
+        int fd, r;
+
+        assert(i);
+
+        vacuum_index_clear(i);
+
+        fd = fcntl(i->dir_fd, F_DUPFD_CLOEXEC, 3);
+        if (fd < 0)
+                return -errno;
+
+        d = fdopendir(fd);
+        if (!d) {
+                safe_close(fd);
+                return -errno;
+        }
+
+        FOREACH_DIRENT_ALL(de, d, return -errno) {
+                r = vacuum_index_add(i, de->d_name);
+                if (r < 0)
+                        return r;
         }
 
-        d = opendir(directory);
-        if (!d)
+        return 0;
+}
+
+int vacuum_index_new(const char *directory, bool watch, VacuumIndex **ret) {
+        _cleanup_(vacuum_index_freep) VacuumIndex *i = NULL;
+        int r;
+
+        assert(directory);
+        assert(ret);
+
+        /* Builds an index of the vacuumable files in the directory.
+         * If watch is true the index follows changes to the
+         * directory through inotify, so that it can be reused for
+         * subsequent vacuuming without rescanning the directory. */
+
+        i = new0(VacuumIndex, 1);
+        if (!i)
+                return -ENOMEM;
+
+        i->dir_fd = i->inotify_fd = -1;
+
+        i->directory = strdup(directory);
+        if (!i->directory)
+                return -ENOMEM;
+
+        i->files = hashmap_new(&string_hash_ops);
+        i->queue = prioq_new(vacuum_compare);
+        i->empty = set_new(NULL);
+        if (!i->files || !i->queue || !i->empty)
+                return -ENOMEM;
+
+        i->dir_fd = open(directory, O_RDONLY|O_CLOEXEC|O_DIRECTORY);
+        if (i->dir_fd < 0)
                 return -errno;
 
-        for (;;) {
-                struct dirent *de;
-                size_t q;
-                struct stat st;
-                char *p;
-                unsigned long long seqnum = 0, realtime;
-                sd_id128_t seqnum_id;
-                bool have_seqnum;
-
-                errno = 0;
-                de = readdir(d);
-                if (!de && errno != 0) {
-                        r = -errno;
-                        goto finish;
-                }
+        if (watch) {
+                i->inotify_fd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+                if (i->inotify_fd < 0)
+                        return -errno;
+
+                /* Start watching before the scan, so that we don't
+                 * miss anything in between */
+                if (inotify_add_watch(i->inotify_fd, directory,
+                                      IN_MOVED_TO|IN_CLOSE_WRITE|IN_DELETE|IN_MOVED_FROM|
+                                      IN_DELETE_SELF|IN_MOVE_SELF|IN_ONLYDIR) < 0)
+                        return -errno;
+        }
 
-                if (!de)
-                        break;
+        r = vacuum_index_scan(i);
+        if (r < 0)
+                return r;
 
-                if (fstatat(dirfd(d), de->d_name, &st, AT_SYMLINK_NOFOLLOW) < 0)
-                        continue;
+        *ret = i;
+        i = NULL;
 
-                if (!S_ISREG(st.st_mode))
-                        continue;
+        return 0;
+}
 
-                q = strlen(de->d_name);
+VacuumIndex* vacuum_index_free(VacuumIndex *i) {
+        if (!i)
+                return NULL;
 
-                if (endswith(de->d_name, ".journal")) {
+        vacuum_index_clear(i);
 
-                        /* Vacuum archived files */
+        hashmap_free(i->files);
+        prioq_free(i->queue);
+        set_free(i->empty);
 
-                        if (q < 1 + 32 + 1 + 16 + 1 + 16 + 8)
-                                continue;
+        safe_close(i->dir_fd);
+        safe_close(i->inotify_fd);
 
-                        if (de->d_name[q-8-16-1] != '-' ||
-                            de->d_name[q-8-16-1-16-1] != '-' ||
-                            de->d_name[q-8-16-1-16-1-32-1] != '@')
-                                continue;
+        free(i->directory);
+        free(i);
 
-                        p = strdup(de->d_name);
-                        if (!p) {
-                                r = -ENOMEM;
-                                goto finish;
-                        }
+        return NULL;
+}
 
-                        de->d_name[q-8-16-1-16-1] = 0;
-                        if (sd_id128_from_string(de->d_name + q-8-16-1-16-1-32, &seqnum_id) < 0) {
-                                free(p);
-                                continue;
-                        }
+int vacuum_index_process(VacuumIndex *i) {
+        bool rescan = false;
+        int r;
 
-                        if (sscanf(de->d_name + q-8-16-1-16, "%16llx-%16llx.journal", &seqnum, &realtime) != 2) {
-                                free(p);
-                                continue;
-                        }
+        assert(i);
 
-                        have_seqnum = true;
+        /* Applies all pending directory change notifications. Returns
+         * -ENOENT if the directory itself is gone, in which case the
+         * index should be freed. */
 
-                } else if (endswith(de->d_name, ".journal~")) {
-                        unsigned long long tmp;
+        if (i->inotify_fd < 0)
+                return 0;
 
-                        /* Vacuum corrupted files */
+        for (;;) {
+                union inotify_event_buffer buffer;
+                struct inotify_event *e;
+                ssize_t l;
 
-                        if (q < 1 + 16 + 1 + 16 + 8 + 1)
-                                continue;
+                l = read(i->inotify_fd, &buffer, sizeof(buffer));
+                if (l < 0) {
+                        if (errno == EAGAIN || errno == EINTR)
+                                break;
 
-                        if (de->d_name[q-1-8-16-1] != '-' ||
-                            de->d_name[q-1-8-16-1-16-1] != '@')
-                                continue;
+                        return -errno;
+                }
 
-                        p = strdup(de->d_name);
-                        if (!p) {
-                                r = -ENOMEM;
-                                goto finish;
-                        }
+                FOREACH_INOTIFY_EVENT(e, buffer, l) {
+                        if (e->mask & (IN_DELETE_SELF|IN_MOVE_SELF|IN_IGNORED))
+                                return -ENOENT;
 
-                        if (sscanf(de->d_name + q-1-8-16-1-16, "%16llx-%16llx.journal~", &realtime, &tmp) != 2) {
-                                free(p);
+                        if (e->mask & IN_Q_OVERFLOW) {
+                                rescan = true;
                                 continue;
                         }
 
-                        have_seqnum = false;
-                } else
-                        /* We do not vacuum active files or unknown files! */
-                        continue;
+                        if (rescan || e->len <= 0)
+                                continue;
 
-                if (journal_file_empty(dirfd(d), p)) {
-                        /* Always vacuum empty non-online files. */
+                        if (e->mask & (IN_DELETE|IN_MOVED_FROM))
+                                vacuum_index_remove(i, e->name);
+                        else {
+                                r = vacuum_index_add(i, e->name);
+                                if (r < 0)
+                                        return r;
+                        }
+                }
+        }
 
-                        uint64_t size = 512UL * (uint64_t) st.st_blocks;
+        if (rescan) {
+                log_debug("Lost track of changes in %s, rescanning.", i->directory);
+                return vacuum_index_scan(i);
+        }
 
-                        if (unlinkat(dirfd(d), p, 0) >= 0) {
-                                log_full(verbose ? LOG_INFO : LOG_DEBUG, "Deleted empty archived journal %s/%s (%s).", directory, p, format_bytes(sbytes, sizeof(sbytes), size));
-                                freed += size;
-                        } else if (errno != ENOENT)
-                                log_warning_errno(errno, "Failed to delete empty archived journal %s/%s: %m", directory, p);
+        return 0;
+}
 
-                        free(p);
-                        continue;
-                }
+int vacuum_index_vacuum(
+                VacuumIndex *i,
+                uint64_t max_use,
+                usec_t max_retention_usec,
+                usec_t *oldest_usec,
+                bool verbose) {
 
-                patch_realtime(directory, p, &st, &realtime);
+        _cleanup_free_ struct vacuum_info **failed = NULL;
+        size_t n_failed = 0, n_failed_allocated = 0, k;
+        struct vacuum_info *v;
+        uint64_t freed = 0;
+        usec_t retention_limit = 0;
+        char sbytes[FORMAT_BYTES_MAX];
+        int r;
 
-                if (!GREEDY_REALLOC(list, n_allocated, n_list + 1)) {
-                        free(p);
-                        r = -ENOMEM;
-                        goto finish;
-                }
+        assert(i);
 
-                list[n_list].filename = p;
-                list[n_list].usage = 512UL * (uint64_t) st.st_blocks;
-                list[n_list].seqnum = seqnum;
-                list[n_list].realtime = realtime;
-                list[n_list].seqnum_id = seqnum_id;
-                list[n_list].have_seqnum = have_seqnum;
+        if (max_use <= 0 && max_retention_usec <= 0)
+                return 0;
 
-                sum += list[n_list].usage;
+        r = vacuum_index_process(i);
+        if (r < 0)
+                return r;
 
-                n_list ++;
+        if (max_retention_usec > 0) {
+                retention_limit = now(CLOCK_REALTIME);
+                if (retention_limit > max_retention_usec)
+                        retention_limit -= max_retention_usec;
+                else
+                        max_retention_usec = retention_limit = 0;
         }
 
-        qsort_safe(list, n_list, sizeof(struct vacuum_info), vacuum_compare);
+        while ((v = set_first(i->empty))) {
+                if (unlinkat(i->dir_fd, v->filename, 0) >= 0) {
+                        log_full(verbose ? LOG_INFO : LOG_DEBUG, "Deleted empty archived journal %s/%s (%s).", i->directory, v->filename, format_bytes(sbytes, sizeof(sbytes), v->usage));
+                        freed += v->usage;
+                } else if (errno != ENOENT)
+                        log_warning_errno(errno, "Failed to delete empty archived journal %s/%s: %m", i->directory, v->filename);
 
-        for (i = 0; i < n_list; i++) {
-                if ((max_retention_usec <= 0 || list[i].realtime >= retention_limit) &&
-                    (max_use <= 0 || sum <= max_use))
+                vacuum_index_drop(i, v);
+        }
+
+        /* Files are popped oldest first, hence this only touches the
+         * files actually removed */
+        while ((v = prioq_peek(i->queue))) {
+                if ((max_retention_usec <= 0 || v->realtime >= retention_limit) &&
+                    (max_use <= 0 || i->usage <= max_use))
                         break;
 
-                if (unlinkat(dirfd(d), list[i].filename, 0) >= 0) {
-                        log_full(verbose ? LOG_INFO : LOG_DEBUG, "Deleted archived journal %s/%s (%s).", directory, list[i].filename, format_bytes(sbytes, sizeof(sbytes), list[i].usage));
-                        freed += list[i].usage;
+                if (unlinkat(i->dir_fd, v->filename, 0) >= 0) {
+                        log_full(verbose ? LOG_INFO : LOG_DEBUG, "Deleted archived journal %s/%s (%s).", i->directory, v->filename, format_bytes(sbytes, sizeof(sbytes), v->usage));
+                        freed += v->usage;
+                } else if (errno != ENOENT) {
+                        log_warning_errno(errno, "Failed to delete archived journal %s/%s: %m", i->directory, v->filename);
 
-                        if (list[i].usage < sum)
-                                sum -= list[i].usage;
-                        else
-                                sum = 0;
+                        /* Skip it for now, but keep accounting for it */
+                        if (GREEDY_REALLOC(failed, n_failed_allocated, n_failed + 1)) {
+                                prioq_remove(i->queue, v, &v->queue_idx);
+                                failed[n_failed++] = v;
+                                continue;
+                        }
+                }
 
-                } else if (errno != ENOENT)
-                        log_warning_errno(errno, "Failed to delete archived journal %s/%s: %m", directory, list[i].filename);
+                vacuum_index_drop(i, v);
         }
 
-        if (oldest_usec && i < n_list && (*oldest_usec == 0 || list[i].realtime < *oldest_usec))
-                *oldest_usec = list[i].realtime;
+        v = prioq_peek(i->queue);
+        if (oldest_usec && v && (*oldest_usec == 0 || v->realtime < *oldest_usec))
+                *oldest_usec = v->realtime;
 
-finish:
-        for (i = 0; i < n_list; i++)
-                free(list[i].filename);
-        free(list);
+        for (k = 0; k < n_failed; k++)
+                if (prioq_put(i->queue, failed[k], &failed[k]->queue_idx) < 0)
+                        vacuum_index_drop(i, failed[k]);
 
         log_full(verbose ? LOG_INFO : LOG_DEBUG, "Vacuuming done, freed %s of archived journals on disk.", format_bytes(sbytes, sizeof(sbytes), freed));
 
-        return r;
+        return 0;
+}
+
+int journal_directory_vacuum(
+                const char *directory,
+                uint64_t max_use,
+                usec_t max_retention_usec,
+                usec_t *oldest_usec,
+                bool verbose) {
+
+        _cleanup_(vacuum_index_freep) VacuumIndex *i = NULL;
+        int r;
+
+        assert(directory);
+
+        if (max_use <= 0 && max_retention_usec <= 0)
+                return 0;
+
+        r = vacuum_index_new(directory, false, &i);
+        if (r < 0)
+                return r;
+
+        return vacuum_index_vacuum(i, max_use, max_retention_usec, oldest_usec, verbose);
 }
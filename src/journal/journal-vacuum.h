@@ -22,4 +22,21 @@
 ***/
 
 
+#include <stdbool.h>
+#include <inttypes.h>
+
+#include "macro.h"
+#include "time-util.h"
+
+typedef struct VacuumIndex VacuumIndex;
+
+int vacuum_index_new(const char *directory, bool watch, VacuumIndex **ret);
+VacuumIndex* vacuum_index_free(VacuumIndex *i);
+DEFINE_TRIVIAL_CLEANUP_FUNC(VacuumIndex*, vacuum_index_free);
+
+int vacuum_index_add(VacuumIndex *i, const char *filename);
+void vacuum_index_remove(VacuumIndex *i, const char *filename);
+int vacuum_index_process(VacuumIndex *i);
+int vacuum_index_vacuum(VacuumIndex *i, uint64_t max_use, usec_t max_retention_usec, usec_t *oldest_usec, bool verbose);
+
 int journal_directory_vacuum(const char *directory, uint64_t max_use, usec_t max_retention_usec, usec_t *oldest_usec, bool vacuum);
@@ -156,10 +156,10 @@ static int journal_file_object_verify(JournalFile *f, uint64_t offset, Object *o
                         _cleanup_free_ void *b = NULL;
                         size_t alloc = 0, b_size;
 
-                        r = decompress_blob(compression,
-                                            o->data.payload,
-                                            le64toh(o->object.size) - offsetof(Object, data.payload),
-                                            &b, &alloc, &b_size, 0);
+                        r = journal_file_decompress(f, compression,
+                                                    o->data.payload,
+                                                    le64toh(o->object.size) - offsetof(Object, data.payload),
+                                                    &b, &alloc, &b_size, 0);
                         if (r < 0) {
                                 error(offset, "%s decompression failed: %s",
                                       object_compressed_to_string(compression), strerror(-r));
@@ -347,53 +347,117 @@ static int journal_file_object_verify(JournalFile *f, uint64_t offset, Object *o
                         return -EBADMSG;
                 }
 
+                break;
+
+        case OBJECT_DICTIONARY:
+                if (le64toh(o->object.size) <= offsetof(DictionaryObject, payload)) {
+                        error(offset,
+                              "Invalid object dictionary size: %"PRIu64,
+                              le64toh(o->object.size));
+                        return -EBADMSG;
+                }
+
+                if (le64toh(o->dictionary.n_samples) <= 0) {
+                        error(offset, "Dictionary object without samples");
+                        return -EBADMSG;
+                }
+
+                break;
+
+        case OBJECT_BLOOM_FILTER:
+                if (le64toh(o->object.size) <= offsetof(BloomFilterObject, bits) ||
+                    (le64toh(o->object.size) - offsetof(BloomFilterObject, bits)) % sizeof(le64_t) != 0) {
+                        error(offset,
+                              "Invalid object bloom filter size: %"PRIu64,
+                              le64toh(o->object.size));
+                        return -EBADMSG;
+                }
+
+                if (le64toh(o->bloom_filter.n_hashes) <= 0 || le64toh(o->bloom_filter.n_hashes) > 64) {
+                        error(offset,
+                              "Invalid bloom filter hash count: %"PRIu64,
+                              le64toh(o->bloom_filter.n_hashes));
+                        return -EBADMSG;
+                }
+
+                break;
+
+        case OBJECT_COLUMN: {
+                uint64_t i, n_runs, sum = 0;
+
+                if (le64toh(o->object.size) < offsetof(ColumnObject, runs) ||
+                    (le64toh(o->object.size) - offsetof(ColumnObject, runs)) % sizeof(ColumnRun) != 0) {
+                        error(offset,
+                              "Invalid object column size: %"PRIu64,
+                              le64toh(o->object.size));
+                        return -EBADMSG;
+                }
+
+                if (!VALID64(le64toh(o->column.field_offset)) ||
+                    !VALID64(le64toh(o->column.next_column_offset))) {
+                        error(offset, "Invalid offset in column object");
+                        return -EBADMSG;
+                }
+
+                n_runs = (le64toh(o->object.size) - offsetof(ColumnObject, runs)) / sizeof(ColumnRun);
+                for (i = 0; i < n_runs; i++) {
+                        if (le64toh(o->column.runs[i].n_entries) <= 0 ||
+                            !VALID64(le64toh(o->column.runs[i].data_offset))) {
+                                error(offset, "Invalid column run %"PRIu64, i);
+                                return -EBADMSG;
+                        }
+
+                        sum += le64toh(o->column.runs[i].n_entries);
+                }
+
+                if (sum != le64toh(o->column.n_entries)) {
+                        error(offset,
+                              "Column runs cover %"PRIu64" entries, but column claims %"PRIu64,
+                              sum, le64toh(o->column.n_entries));
+                        return -EBADMSG;
+                }
+
                 break;
         }
+        }
 
         return 0;
 }
 
-static int write_uint64(int fd, uint64_t p) {
-        ssize_t k;
+static int append_uint64(uint64_t **array, size_t *allocated, uint64_t n, uint64_t p) {
+        assert(array);
+        assert(allocated);
+
+        /* Objects are visited in file order, hence the arrays end up
+         * sorted and can be bisected */
 
-        k = write(fd, &p, sizeof(p));
-        if (k < 0)
-                return -errno;
-        if (k != sizeof(p))
-                return -EIO;
+        if (!GREEDY_REALLOC(*array, *allocated, n + 1))
+                return -ENOMEM;
 
+        (*array)[n] = p;
         return 0;
 }
 
-static int contains_uint64(MMapCache *m, int fd, uint64_t n, uint64_t p) {
+static int contains_uint64(const uint64_t *array, uint64_t n, uint64_t p) {
         uint64_t a, b;
-        int r;
 
-        assert(m);
-        assert(fd >= 0);
+        assert(array || n == 0);
 
         /* Bisection ... */
 
         a = 0; b = n;
         while (a < b) {
-                uint64_t c, *z;
+                uint64_t c;
 
                 c = (a + b) / 2;
 
-                r = mmap_cache_get(m, fd, PROT_READ|PROT_WRITE, 0, false, c * sizeof(uint64_t), sizeof(uint64_t), NULL, (void **) &z);
-                if (r < 0)
-                        return r;
-
-                if (*z == p)
+                if (array[c] == p)
                         return 1;
 
-                if (a + 1 >= b)
-                        return 0;
-
-                if (p < *z)
+                if (p < array[c])
                         b = c;
                 else
-                        a = c;
+                        a = c + 1;
         }
 
         return 0;
@@ -401,7 +465,7 @@ static int contains_uint64(MMapCache *m, int fd, uint64_t n, uint64_t p) {
 
 static int entry_points_to_data(
                 JournalFile *f,
-                int entry_fd,
+                const uint64_t *entry_offsets,
                 uint64_t n_entries,
                 uint64_t entry_p,
                 uint64_t data_p) {
@@ -412,9 +476,9 @@ static int entry_points_to_data(
         bool found = false;
 
         assert(f);
-        assert(entry_fd >= 0);
+        assert(entry_offsets || n_entries == 0);
 
-        if (!contains_uint64(f->mmap, entry_fd, n_entries, entry_p)) {
+        if (!contains_uint64(entry_offsets, n_entries, entry_p)) {
                 error(data_p, "Data object references invalid entry at "OFSfmt, entry_p);
                 return -EBADMSG;
         }
@@ -488,16 +552,16 @@ static int entry_points_to_data(
 static int verify_data(
                 JournalFile *f,
                 Object *o, uint64_t p,
-                int entry_fd, uint64_t n_entries,
-                int entry_array_fd, uint64_t n_entry_arrays) {
+                const uint64_t *entry_offsets, uint64_t n_entries,
+                const uint64_t *entry_array_offsets, uint64_t n_entry_arrays) {
 
         uint64_t i, n, a, last, q;
         int r;
 
         assert(f);
         assert(o);
-        assert(entry_fd >= 0);
-        assert(entry_array_fd >= 0);
+        assert(entry_offsets || n_entries == 0);
+        assert(entry_array_offsets || n_entry_arrays == 0);
 
         n = le64toh(o->data.n_entries);
         a = le64toh(o->data.entry_array_offset);
@@ -515,7 +579,7 @@ static int verify_data(
         assert(o->data.entry_offset);
 
         last = q = le64toh(o->data.entry_offset);
-        r = entry_points_to_data(f, entry_fd, n_entries, q, p);
+        r = entry_points_to_data(f, entry_offsets, n_entries, q, p);
         if (r < 0)
                 return r;
 
@@ -528,7 +592,7 @@ static int verify_data(
                         return -EBADMSG;
                 }
 
-                if (!contains_uint64(f->mmap, entry_array_fd, n_entry_arrays, a)) {
+                if (!contains_uint64(entry_array_offsets, n_entry_arrays, a)) {
                         error(p, "Invalid array offset "OFSfmt, a);
                         return -EBADMSG;
                 }
@@ -553,7 +617,7 @@ static int verify_data(
                         }
                         last = q;
 
-                        r = entry_points_to_data(f, entry_fd, n_entries, q, p);
+                        r = entry_points_to_data(f, entry_offsets, n_entries, q, p);
                         if (r < 0)
                                 return r;
 
@@ -571,9 +635,9 @@ static int verify_data(
 
 static int verify_hash_table(
                 JournalFile *f,
-                int data_fd, uint64_t n_data,
-                int entry_fd, uint64_t n_entries,
-                int entry_array_fd, uint64_t n_entry_arrays,
+                const uint64_t *data_offsets, uint64_t n_data,
+                const uint64_t *entry_offsets, uint64_t n_entries,
+                const uint64_t *entry_array_offsets, uint64_t n_entry_arrays,
                 usec_t *last_usec,
                 bool show_progress) {
 
@@ -581,9 +645,9 @@ static int verify_hash_table(
         int r;
 
         assert(f);
-        assert(data_fd >= 0);
-        assert(entry_fd >= 0);
-        assert(entry_array_fd >= 0);
+        assert(data_offsets || n_data == 0);
+        assert(entry_offsets || n_entries == 0);
+        assert(entry_array_offsets || n_entry_arrays == 0);
         assert(last_usec);
 
         n = le64toh(f->header->data_hash_table_size) / sizeof(HashItem);
@@ -605,7 +669,7 @@ static int verify_hash_table(
                         Object *o;
                         uint64_t next;
 
-                        if (!contains_uint64(f->mmap, data_fd, n_data, p)) {
+                        if (!contains_uint64(data_offsets, n_data, p)) {
                                 error(p, "Invalid data object at hash entry %"PRIu64" of %"PRIu64, i, n);
                                 return -EBADMSG;
                         }
@@ -625,7 +689,7 @@ static int verify_hash_table(
                                 return -EBADMSG;
                         }
 
-                        r = verify_data(f, o, p, entry_fd, n_entries, entry_array_fd, n_entry_arrays);
+                        r = verify_data(f, o, p, entry_offsets, n_entries, entry_array_offsets, n_entry_arrays);
                         if (r < 0)
                                 return r;
 
@@ -677,14 +741,14 @@ static int data_object_in_hash_table(JournalFile *f, uint64_t hash, uint64_t p)
 static int verify_entry(
                 JournalFile *f,
                 Object *o, uint64_t p,
-                int data_fd, uint64_t n_data) {
+                const uint64_t *data_offsets, uint64_t n_data) {
 
         uint64_t i, n;
         int r;
 
         assert(f);
         assert(o);
-        assert(data_fd >= 0);
+        assert(data_offsets || n_data == 0);
 
         n = journal_file_entry_n_items(o);
         for (i = 0; i < n; i++) {
@@ -694,7 +758,7 @@ static int verify_entry(
                 q = le64toh(o->entry.items[i].object_offset);
                 h = le64toh(o->entry.items[i].hash);
 
-                if (!contains_uint64(f->mmap, data_fd, n_data, q)) {
+                if (!contains_uint64(data_offsets, n_data, q)) {
                         error(p, "Invalid data object of entry");
                         return -EBADMSG;
                 }
@@ -722,9 +786,9 @@ static int verify_entry(
 
 static int verify_entry_array(
                 JournalFile *f,
-                int data_fd, uint64_t n_data,
-                int entry_fd, uint64_t n_entries,
-                int entry_array_fd, uint64_t n_entry_arrays,
+                const uint64_t *data_offsets, uint64_t n_data,
+                const uint64_t *entry_offsets, uint64_t n_entries,
+                const uint64_t *entry_array_offsets, uint64_t n_entry_arrays,
                 usec_t *last_usec,
                 bool show_progress) {
 
@@ -732,9 +796,9 @@ static int verify_entry_array(
         int r;
 
         assert(f);
-        assert(data_fd >= 0);
-        assert(entry_fd >= 0);
-        assert(entry_array_fd >= 0);
+        assert(data_offsets || n_data == 0);
+        assert(entry_offsets || n_entries == 0);
+        assert(entry_array_offsets || n_entry_arrays == 0);
         assert(last_usec);
 
         n = le64toh(f->header->n_entries);
@@ -751,7 +815,7 @@ static int verify_entry_array(
                         return -EBADMSG;
                 }
 
-                if (!contains_uint64(f->mmap, entry_array_fd, n_entry_arrays, a)) {
+                if (!contains_uint64(entry_array_offsets, n_entry_arrays, a)) {
                         error(a, "Invalid array %"PRIu64" of %"PRIu64, i, n);
                         return -EBADMSG;
                 }
@@ -777,7 +841,7 @@ static int verify_entry_array(
                         }
                         last = p;
 
-                        if (!contains_uint64(f->mmap, entry_fd, n_entries, p)) {
+                        if (!contains_uint64(entry_offsets, n_entries, p)) {
                                 error(a, "Invalid array entry at %"PRIu64" of %"PRIu64, i, n);
                                 return -EBADMSG;
                         }
@@ -786,7 +850,7 @@ static int verify_entry_array(
                         if (r < 0)
                                 return r;
 
-                        r = verify_entry(f, o, p, data_fd, n_data);
+                        r = verify_entry(f, o, p, data_offsets, n_data);
                         if (r < 0)
                                 return r;
 
@@ -816,7 +880,8 @@ int journal_file_verify(
         bool entry_seqnum_set = false, entry_monotonic_set = false, entry_realtime_set = false, found_main_entry_array = false;
         uint64_t n_weird = 0, n_objects = 0, n_entries = 0, n_data = 0, n_fields = 0, n_data_hash_tables = 0, n_field_hash_tables = 0, n_entry_arrays = 0, n_tags = 0;
         usec_t last_usec = 0;
-        int data_fd = -1, entry_fd = -1, entry_array_fd = -1;
+        _cleanup_free_ uint64_t *data_offsets = NULL, *entry_offsets = NULL, *entry_array_offsets = NULL;
+        size_t data_allocated = 0, entry_allocated = 0, entry_array_allocated = 0;
         unsigned i;
         bool found_last = false;
 #ifdef HAVE_GCRYPT
@@ -837,25 +902,6 @@ int journal_file_verify(
         } else if (f->seal)
                 return -ENOKEY;
 
-        data_fd = open_tmpfile("/var/tmp", O_RDWR | O_CLOEXEC);
-        if (data_fd < 0) {
-                r = log_error_errno(errno, "Failed to create data file: %m");
-                goto fail;
-        }
-
-        entry_fd = open_tmpfile("/var/tmp", O_RDWR | O_CLOEXEC);
-        if (entry_fd < 0) {
-                r = log_error_errno(errno, "Failed to create entry file: %m");
-                goto fail;
-        }
-
-        entry_array_fd = open_tmpfile("/var/tmp", O_RDWR | O_CLOEXEC);
-        if (entry_array_fd < 0) {
-                r = log_error_errno(errno,
-                                    "Failed to create entry array file: %m");
-                goto fail;
-        }
-
         if (le32toh(f->header->compatible_flags) & ~HEADER_COMPATIBLE_SUPPORTED) {
                 log_error("Cannot verify file with unknown extensions.");
                 r = -EOPNOTSUPP;
@@ -901,8 +947,9 @@ int journal_file_verify(
                         goto fail;
                 }
 
-                if ((o->object.flags & OBJECT_COMPRESSED_XZ) &&
-                    (o->object.flags & OBJECT_COMPRESSED_LZ4)) {
+                if (!!(o->object.flags & OBJECT_COMPRESSED_XZ) +
+                    !!(o->object.flags & OBJECT_COMPRESSED_LZ4) +
+                    !!(o->object.flags & OBJECT_COMPRESSED_ZSTD) > 1) {
                         error(p, "Objected with double compression");
                         r = -EINVAL;
                         goto fail;
@@ -920,10 +967,16 @@ int journal_file_verify(
                         goto fail;
                 }
 
+                if ((o->object.flags & OBJECT_COMPRESSED_ZSTD) && !JOURNAL_HEADER_COMPRESSED_ZSTD(f->header)) {
+                        error(p, "ZSTD compressed object in file without ZSTD compression");
+                        r = -EBADMSG;
+                        goto fail;
+                }
+
                 switch (o->object.type) {
 
                 case OBJECT_DATA:
-                        r = write_uint64(data_fd, p);
+                        r = append_uint64(&data_offsets, &data_allocated, n_data, p);
                         if (r < 0)
                                 goto fail;
 
@@ -941,7 +994,7 @@ int journal_file_verify(
                                 goto fail;
                         }
 
-                        r = write_uint64(entry_fd, p);
+                        r = append_uint64(&entry_offsets, &entry_allocated, n_entries, p);
                         if (r < 0)
                                 goto fail;
 
@@ -1028,7 +1081,7 @@ int journal_file_verify(
                         break;
 
                 case OBJECT_ENTRY_ARRAY:
-                        r = write_uint64(entry_array_fd, p);
+                        r = append_uint64(&entry_array_offsets, &entry_array_allocated, n_entry_arrays, p);
                         if (r < 0)
                                 goto fail;
 
@@ -1133,6 +1186,63 @@ int journal_file_verify(
                         n_tags ++;
                         break;
 
+                case OBJECT_DICTIONARY:
+                        if (!JOURNAL_HEADER_ZSTD_DICTIONARY(f->header) ||
+                            p != le64toh(f->header->dictionary_offset)) {
+                                error(p, "Dictionary object not referenced by header");
+                                r = -EBADMSG;
+                                goto fail;
+                        }
+
+                        break;
+
+                case OBJECT_BLOOM_FILTER:
+                        if (!JOURNAL_HEADER_BLOOM_FILTER(f->header) ||
+                            p != le64toh(f->header->bloom_filter_offset)) {
+                                error(p, "Bloom filter object not referenced by header");
+                                r = -EBADMSG;
+                                goto fail;
+                        }
+
+                        if (le64toh(o->bloom_filter.n_items) != n_data) {
+                                error(p, "Bloom filter covers %"PRIu64" data objects, but file has %"PRIu64,
+                                      le64toh(o->bloom_filter.n_items), n_data);
+                                r = -EBADMSG;
+                                goto fail;
+                        }
+
+                        break;
+
+                case OBJECT_COLUMN: {
+                        uint64_t i, n_runs;
+
+                        if (!JOURNAL_HEADER_COLUMNS(f->header)) {
+                                error(p, "Column object in file without columns");
+                                r = -EBADMSG;
+                                goto fail;
+                        }
+
+                        if (le64toh(o->column.n_entries) != n_entries) {
+                                error(p, "Column covers %"PRIu64" entries, but file has %"PRIu64,
+                                      le64toh(o->column.n_entries), n_entries);
+                                r = -EBADMSG;
+                                goto fail;
+                        }
+
+                        n_runs = (le64toh(o->object.size) - offsetof(ColumnObject, runs)) / sizeof(ColumnRun);
+                        for (i = 0; i < n_runs; i++) {
+                                uint64_t q = le64toh(o->column.runs[i].data_offset);
+
+                                if (q > 0 && !contains_uint64(data_offsets, n_data, q)) {
+                                        error(p, "Column run references invalid data object");
+                                        r = -EBADMSG;
+                                        goto fail;
+                                }
+                        }
+
+                        break;
+                }
+
                 default:
                         n_weird ++;
                 }
@@ -1227,18 +1337,18 @@ int journal_file_verify(
          * referenced is consistent. */
 
         r = verify_entry_array(f,
-                               data_fd, n_data,
-                               entry_fd, n_entries,
-                               entry_array_fd, n_entry_arrays,
+                               data_offsets, n_data,
+                               entry_offsets, n_entries,
+                               entry_array_offsets, n_entry_arrays,
                                &last_usec,
                                show_progress);
         if (r < 0)
                 goto fail;
 
         r = verify_hash_table(f,
-                              data_fd, n_data,
-                              entry_fd, n_entries,
-                              entry_array_fd, n_entry_arrays,
+                              data_offsets, n_data,
+                              entry_offsets, n_entries,
+                              entry_array_offsets, n_entry_arrays,
                               &last_usec,
                               show_progress);
         if (r < 0)
@@ -1247,14 +1357,6 @@ int journal_file_verify(
         if (show_progress)
                 flush_progress();
 
-        mmap_cache_close_fd(f->mmap, data_fd);
-        mmap_cache_close_fd(f->mmap, entry_fd);
-        mmap_cache_close_fd(f->mmap, entry_array_fd);
-
-        safe_close(data_fd);
-        safe_close(entry_fd);
-        safe_close(entry_array_fd);
-
         if (first_contained)
                 *first_contained = le64toh(f->header->head_entry_realtime);
         if (last_validated)
@@ -1274,20 +1376,5 @@ fail:
                   (unsigned long long) f->last_stat.st_size,
                   100 * p / f->last_stat.st_size);
 
-        if (data_fd >= 0) {
-                mmap_cache_close_fd(f->mmap, data_fd);
-                safe_close(data_fd);
-        }
-
-        if (entry_fd >= 0) {
-                mmap_cache_close_fd(f->mmap, entry_fd);
-                safe_close(entry_fd);
-        }
-
-        if (entry_array_fd >= 0) {
-                mmap_cache_close_fd(f->mmap, entry_array_fd);
-                safe_close(entry_array_fd);
-        }
-
         return r;
 }
@@ -31,6 +31,7 @@
 #include <getopt.h>
 #include <signal.h>
 #include <poll.h>
+#include <pthread.h>
 #include <sys/stat.h>
 #include <sys/inotify.h>
 #include <linux/fs.h>
@@ -122,13 +123,19 @@ static enum {
         ACTION_UPDATE_CATALOG,
         ACTION_LIST_BOOTS,
         ACTION_FLUSH,
+        ACTION_STATISTICS,
         ACTION_VACUUM,
+        ACTION_COMPACT,
 } arg_action = ACTION_SHOW;
 
 typedef struct BootId {
         sd_id128_t id;
         uint64_t first;
         uint64_t last;
+        sd_id128_t first_seqnum_id;
+        uint64_t first_seqnum;
+        sd_id128_t last_seqnum_id;
+        uint64_t last_seqnum;
         LIST_FIELDS(struct BootId, boot_list);
 } BootId;
 
@@ -236,7 +243,9 @@ static void help(void) {
                "     --disk-usage          Show total disk usage of all journal files\n"
                "     --vacuum-size=BYTES   Reduce disk usage below specified size\n"
                "     --vacuum-time=TIME    Remove journal files older than specified date\n"
+               "     --compact             Rewrite archived journal files densely packed\n"
                "     --flush               Flush all journal data from /run into /var\n"
+               "     --stats               Show journal daemon statistics\n"
                "     --header              Show journal header information\n"
                "     --list-catalog        Show all message IDs in the catalog\n"
                "     --dump-catalog        Show entries in the message catalog\n"
@@ -278,8 +287,10 @@ static int parse_argv(int argc, char *argv[]) {
                 ARG_FORCE,
                 ARG_UTC,
                 ARG_FLUSH,
+                ARG_STATISTICS,
                 ARG_VACUUM_SIZE,
                 ARG_VACUUM_TIME,
+                ARG_COMPACT,
         };
 
         static const struct option options[] = {
@@ -331,8 +342,10 @@ static int parse_argv(int argc, char *argv[]) {
                 { "machine",        required_argument, NULL, 'M'                },
                 { "utc",            no_argument,       NULL, ARG_UTC            },
                 { "flush",          no_argument,       NULL, ARG_FLUSH          },
+                { "stats",          no_argument,       NULL, ARG_STATISTICS     },
                 { "vacuum-size",    required_argument, NULL, ARG_VACUUM_SIZE    },
                 { "vacuum-time",    required_argument, NULL, ARG_VACUUM_TIME    },
+                { "compact",        no_argument,       NULL, ARG_COMPACT        },
                 {}
         };
 
@@ -549,6 +562,10 @@ static int parse_argv(int argc, char *argv[]) {
                         arg_action = ACTION_VACUUM;
                         break;
 
+                case ARG_COMPACT:
+                        arg_action = ACTION_COMPACT;
+                        break;
+
 #ifdef HAVE_GCRYPT
                 case ARG_FORCE:
                         arg_force = true;
@@ -699,6 +716,10 @@ static int parse_argv(int argc, char *argv[]) {
                         arg_action = ACTION_FLUSH;
                         break;
 
+                case ARG_STATISTICS:
+                        arg_action = ACTION_STATISTICS;
+                        break;
+
                 case '?':
                         return -EINVAL;
 
@@ -861,83 +882,128 @@ static void boot_id_free_all(BootId *l) {
         }
 }
 
-static int discover_next_boot(
-                sd_journal *j,
-                BootId **boot,
-                bool advance_older,
-                bool read_realtime) {
+static int boot_id_compare(const void *a, const void *b) {
+        const BootId *x = *(BootId**) a, *y = *(BootId**) b;
 
-        int r;
-        char match[9+32+1] = "_BOOT_ID=";
-        _cleanup_free_ BootId *next_boot = NULL;
+        /* Order boots the way sd_journal interleaves their first
+         * entries: by sequence number if both were written by the
+         * same journal writer, by wallclock otherwise. */
+        if (sd_id128_equal(x->first_seqnum_id, y->first_seqnum_id)) {
+                if (x->first_seqnum != y->first_seqnum)
+                        return x->first_seqnum < y->first_seqnum ? -1 : 1;
+        }
 
-        assert(j);
-        assert(boot);
+        if (x->first != y->first)
+                return x->first < y->first ? -1 : 1;
 
-        /* We expect the journal to be on the last position of a boot
-         * (in relation to the direction we are going), so that the next
-         * invocation of sd_journal_next/previous will be from a different
-         * boot. We then collect any information we desire and then jump
-         * to the last location of the new boot by using a _BOOT_ID match
-         * coming from the other journal direction. */
+        return 0;
+}
 
-        /* Make sure we aren't restricted by any _BOOT_ID matches, so that
-         * we can actually advance to a *different* boot. */
-        sd_journal_flush_matches(j);
+static bool boot_position_before(
+                sd_id128_t seqnum_id_a, uint64_t seqnum_a, uint64_t realtime_a,
+                sd_id128_t seqnum_id_b, uint64_t seqnum_b, uint64_t realtime_b) {
 
-        if (advance_older)
-                r = sd_journal_previous(j);
-        else
-                r = sd_journal_next(j);
-        if (r < 0)
-                return r;
-        else if (r == 0)
-                return 0; /* End of journal, yay. */
+        if (sd_id128_equal(seqnum_id_a, seqnum_id_b))
+                return seqnum_a < seqnum_b;
 
-        next_boot = new0(BootId, 1);
-        if (!next_boot)
-                return -ENOMEM;
+        return realtime_a < realtime_b;
+}
 
-        r = sd_journal_get_monotonic_usec(j, NULL, &next_boot->id);
-        if (r < 0)
+static int boot_index_add_file(JournalFile *f, BootId ***boots, size_t *n_boots, size_t *n_allocated) {
+        Object *o;
+        uint64_t p;
+        int r;
+
+        assert(f);
+        assert(boots);
+        assert(n_boots);
+        assert(n_allocated);
+
+        /* Every file keeps one data object per _BOOT_ID= value, each
+         * linked to its first and last entry in the file, so one pass
+         * over them yields the boots of the file with their first and
+         * last timestamps, without any seeking through the entries. */
+
+        r = journal_file_find_field_object(f, "_BOOT_ID", strlen("_BOOT_ID"), &o, NULL);
+        if (r <= 0)
                 return r;
 
-        if (read_realtime) {
-                r = sd_journal_get_realtime_usec(j, &next_boot->first);
+        p = le64toh(o->field.head_data_offset);
+        while (p > 0) {
+                uint64_t next, first_seqnum, first_realtime, last_seqnum, last_realtime;
+                BootId *b = NULL;
+                sd_id128_t id;
+                size_t i;
+
+                r = journal_file_move_to_object(f, OBJECT_DATA, p, &o);
                 if (r < 0)
                         return r;
-        }
 
-        /* Now seek to the last occurrence of this boot ID. */
-        sd_id128_to_string(next_boot->id, match + 9);
-        r = sd_journal_add_match(j, match, sizeof(match) - 1);
-        if (r < 0)
-                return r;
+                next = le64toh(o->data.next_field_offset);
 
-        if (advance_older)
-                r = sd_journal_seek_head(j);
-        else
-                r = sd_journal_seek_tail(j);
-        if (r < 0)
-                return r;
+                r = journal_file_next_entry_for_data(f, NULL, 0, p, DIRECTION_DOWN, &o, NULL);
+                if (r < 0)
+                        return r;
+                if (r == 0) {
+                        p = next;
+                        continue;
+                }
 
-        if (advance_older)
-                r = sd_journal_next(j);
-        else
-                r = sd_journal_previous(j);
-        if (r < 0)
-                return r;
-        else if (r == 0)
-                return -ENODATA; /* This shouldn't happen. We just came from this very boot ID. */
+                id = o->entry.boot_id;
+                first_seqnum = le64toh(o->entry.seqnum);
+                first_realtime = le64toh(o->entry.realtime);
 
-        if (read_realtime) {
-                r = sd_journal_get_realtime_usec(j, &next_boot->last);
+                r = journal_file_next_entry_for_data(f, NULL, 0, p, DIRECTION_UP, &o, NULL);
                 if (r < 0)
                         return r;
-        }
+                if (r == 0)
+                        return -ENODATA;
+
+                last_seqnum = le64toh(o->entry.seqnum);
+                last_realtime = le64toh(o->entry.realtime);
+
+                /* Boots usually continue in the next archived file, hence
+                 * look at the most recently added ones first */
+                for (i = *n_boots; i > 0; i--)
+                        if (sd_id128_equal((*boots)[i-1]->id, id)) {
+                                b = (*boots)[i-1];
+                                break;
+                        }
+
+                if (!b) {
+                        if (!GREEDY_REALLOC(*boots, *n_allocated, *n_boots + 1))
+                                return -ENOMEM;
+
+                        b = new0(BootId, 1);
+                        if (!b)
+                                return -ENOMEM;
+
+                        b->id = id;
+                        b->first_seqnum_id = b->last_seqnum_id = f->header->seqnum_id;
+                        b->first_seqnum = first_seqnum;
+                        b->first = first_realtime;
+                        b->last_seqnum = last_seqnum;
+                        b->last = last_realtime;
+
+                        (*boots)[(*n_boots)++] = b;
+                } else {
+                        if (boot_position_before(f->header->seqnum_id, first_seqnum, first_realtime,
+                                                 b->first_seqnum_id, b->first_seqnum, b->first)) {
+                                b->first_seqnum_id = f->header->seqnum_id;
+                                b->first_seqnum = first_seqnum;
+                                b->first = first_realtime;
+                        }
+
+                        if (boot_position_before(b->last_seqnum_id, b->last_seqnum, b->last,
+                                                 f->header->seqnum_id, last_seqnum, last_realtime)) {
+                                b->last_seqnum_id = f->header->seqnum_id;
+                                b->last_seqnum = last_seqnum;
+                                b->last = last_realtime;
+                        }
+                }
 
-        *boot = next_boot;
-        next_boot = NULL;
+                p = next;
+        }
 
         return 0;
 }
@@ -948,100 +1014,65 @@ static int get_boots(
                 BootId *query_ref_boot,
                 int ref_boot_offset) {
 
-        bool skip_once;
+        BootId **all = NULL, *head = NULL, *tail = NULL;
+        size_t n_all = 0, n_allocated = 0, i;
+        JournalFile *f;
+        Iterator it;
         int r, count = 0;
-        BootId *head = NULL, *tail = NULL;
-        const bool advance_older = query_ref_boot && ref_boot_offset <= 0;
 
         assert(j);
 
-        /* Adjust for the asymmetry that offset 0 is
-         * the last (and current) boot, while 1 is considered the
-         * (chronological) first boot in the journal. */
-        skip_once = query_ref_boot && sd_id128_is_null(query_ref_boot->id) && ref_boot_offset < 0;
+        ORDERED_HASHMAP_FOREACH(f, j->files, it) {
+                r = boot_index_add_file(f, &all, &n_all, &n_allocated);
+                if (r < 0)
+                        goto finish;
+        }
 
-        /* Advance to the earliest/latest occurrence of our reference
-         * boot ID (taking our lookup direction into account), so that
-         * discover_next_boot() can do its job.
-         * If no reference is given, the journal head/tail will do,
-         * they're "virtual" boots after all. */
-        if (query_ref_boot && !sd_id128_is_null(query_ref_boot->id)) {
-                char match[9+32+1] = "_BOOT_ID=";
+        qsort_safe(all, n_all, sizeof(BootId*), boot_id_compare);
 
-                sd_journal_flush_matches(j);
+        if (query_ref_boot) {
+                ssize_t k;
 
-                sd_id128_to_string(query_ref_boot->id, match + 9);
-                r = sd_journal_add_match(j, match, sizeof(match) - 1);
-                if (r < 0)
-                        return r;
+                /* Adjust for the asymmetry that offset 0 is
+                 * the last (and current) boot, while 1 is considered the
+                 * (chronological) first boot in the journal. */
+                if (sd_id128_is_null(query_ref_boot->id))
+                        k = ref_boot_offset > 0 ? ref_boot_offset - 1 : (ssize_t) n_all - 1 + ref_boot_offset;
+                else {
+                        for (i = 0; i < n_all; i++)
+                                if (sd_id128_equal(all[i]->id, query_ref_boot->id))
+                                        break;
 
-                if (advance_older)
-                        r = sd_journal_seek_head(j);
-                else
-                        r = sd_journal_seek_tail(j);
-                if (r < 0)
-                        return r;
+                        k = i < n_all ? (ssize_t) i + ref_boot_offset : -1;
+                }
 
-                if (advance_older)
-                        r = sd_journal_next(j);
-                else
-                        r = sd_journal_previous(j);
-                if (r < 0)
-                        return r;
-                else if (r == 0)
-                        goto finish;
-                else if (ref_boot_offset == 0) {
+                if (k >= 0 && k < (ssize_t) n_all) {
+                        query_ref_boot->id = all[k]->id;
                         count = 1;
-                        goto finish;
                 }
         } else {
-                if (advance_older)
-                        r = sd_journal_seek_tail(j);
-                else
-                        r = sd_journal_seek_head(j);
-                if (r < 0)
-                        return r;
-
-                /* No sd_journal_next/previous here. */
-        }
-
-        for (;;) {
-                _cleanup_free_ BootId *current = NULL;
-
-                r = discover_next_boot(j, &current, advance_older, !query_ref_boot);
-                if (r < 0) {
-                        boot_id_free_all(head);
-                        return r;
+                for (i = 0; i < n_all; i++) {
+                        LIST_INSERT_AFTER(boot_list, head, tail, all[i]);
+                        tail = all[i];
+                        all[i] = NULL;
                 }
 
-                if (!current)
-                        break;
-
-                if (query_ref_boot) {
-                        if (!skip_once)
-                                ref_boot_offset += advance_older ? 1 : -1;
-                        skip_once = false;
-
-                        if (ref_boot_offset == 0) {
-                                count = 1;
-                                query_ref_boot->id = current->id;
-                                break;
-                        }
-                } else {
-                        LIST_INSERT_AFTER(boot_list, head, tail, current);
-                        tail = current;
-                        current = NULL;
-                        count++;
-                }
+                count = n_all;
         }
 
+        r = count;
+
 finish:
-        if (boots)
-                *boots = head;
+        for (i = 0; i < n_all; i++)
+                free(all[i]);
+        free(all);
 
-        sd_journal_flush_matches(j);
+        if (r < 0)
+                boot_id_free_all(head);
+        else if (boots)
+                *boots = head;
 
-        return count;
+        return r;
 }
 
 static int list_boots(sd_journal *j) {
@@ -1557,7 +1588,101 @@ finish:
 #endif
 }
 
+/* Operations whose result does not depend on the order in which files
+ * are looked at are spread over at most this many threads */
+#define WORKERS_MAX 16U
+
+static unsigned n_workers(unsigned n_files) {
+        long n;
+
+        n = sysconf(_SC_NPROCESSORS_ONLN);
+        if (n <= 0)
+                n = 1;
+
+        return MIN3((unsigned) n, n_files, WORKERS_MAX);
+}
+
+static int verify_file(JournalFile *f, bool show_progress) {
+        usec_t first = 0, validated = 0, last = 0;
+        int k;
+
+#ifdef HAVE_GCRYPT
+        if (!arg_verify_key && JOURNAL_HEADER_SEALED(f->header))
+                log_notice("Journal file %s has sealing enabled but verification key has not been passed using --verify-key=.", f->path);
+#endif
+
+        k = journal_file_verify(f, arg_verify_key, &first, &validated, &last, show_progress);
+        if (k == -EINVAL)
+                return k;
+        else if (k < 0)
+                log_warning("FAIL: %s (%s)", f->path, strerror(-k));
+        else {
+                char a[FORMAT_TIMESTAMP_MAX], b[FORMAT_TIMESTAMP_MAX], c[FORMAT_TIMESPAN_MAX];
+                log_info("PASS: %s", f->path);
+
+                if (arg_verify_key && JOURNAL_HEADER_SEALED(f->header)) {
+                        if (validated > 0) {
+                                log_info("=> Validated from %s to %s, final %s entries not sealed.",
+                                         format_timestamp_maybe_utc(a, sizeof(a), first),
+                                         format_timestamp_maybe_utc(b, sizeof(b), validated),
+                                         format_timespan(c, sizeof(c), last > validated ? last - validated : 0, 0));
+                        } else if (last > 0)
+                                log_info("=> No sealing yet, %s of entries not sealed.",
+                                         format_timespan(c, sizeof(c), last - first, 0));
+                        else
+                                log_info("=> No sealing yet, no entries in file.");
+                }
+        }
+
+        return k;
+}
+
+typedef struct VerifyWork {
+        JournalFile **files;
+        unsigned n_files;
+        unsigned next;
+        int aborted;
+        int result;
+        pthread_mutex_t mutex;
+} VerifyWork;
+
+static void *verify_thread(void *userdata) {
+        VerifyWork *w = userdata;
+
+        for (;;) {
+                unsigned idx;
+                int k;
+
+                idx = __sync_fetch_and_add(&w->next, 1);
+                if (idx >= w->n_files)
+                        break;
+
+                if (__sync_fetch_and_or(&w->aborted, 0))
+                        break;
+
+                k = verify_file(w->files[idx], false);
+                if (k >= 0)
+                        continue;
+
+                pthread_mutex_lock(&w->mutex);
+                if (k == -EINVAL) {
+                        __sync_fetch_and_or(&w->aborted, 1);
+                        w->result = k;
+                } else if (w->result != -EINVAL)
+                        w->result = k;
+                pthread_mutex_unlock(&w->mutex);
+        }
+
+        return NULL;
+}
+
 static int verify(sd_journal *j) {
+        _cleanup_free_ JournalFile **files = NULL;
+        _cleanup_free_ pthread_t *threads = NULL;
+        VerifyWork w = {
+                .mutex = PTHREAD_MUTEX_INITIALIZER,
+        };
+        unsigned n, k, n_threads = 0;
         int r = 0;
         Iterator i;
         JournalFile *f;
@@ -1566,41 +1691,180 @@ static int verify(sd_journal *j) {
 
         log_show_color(true);
 
+        /* The sealing verification keeps its state in a single
+         * journal-global gcrypt context, hence stay serial if a key
+         * is used. */
+        n = ordered_hashmap_size(j->files);
+        if (!arg_verify_key)
+                n = n_workers(n);
+        else
+                n = 1;
+
+        if (n <= 1) {
+                ORDERED_HASHMAP_FOREACH(f, j->files, i) {
+                        int q;
+
+                        q = verify_file(f, true);
+                        if (q == -EINVAL)
+                                /* If the key was invalid give up right-away. */
+                                return q;
+                        else if (q < 0)
+                                r = q;
+                }
+
+                return r;
+        }
+
+        files = new(JournalFile*, ordered_hashmap_size(j->files));
+        threads = new(pthread_t, n - 1);
+        if (!files || !threads)
+                return log_oom();
+
+        ORDERED_HASHMAP_FOREACH(f, j->files, i)
+                files[w.n_files++] = f;
+
+        for (k = 0; k < n - 1; k++) {
+                r = pthread_create(threads + n_threads, NULL, verify_thread, &w);
+                if (r != 0) {
+                        log_debug_errno(r, "Failed to start verification thread, continuing with fewer: %m");
+                        break;
+                }
+
+                n_threads++;
+        }
+
+        verify_thread(&w);
+
+        for (k = 0; k < n_threads; k++)
+                pthread_join(threads[k], NULL);
+
+        return w.result;
+}
+
+typedef struct UniqueWork {
+        char **paths;
+        Set *values;
+        int result;
+} UniqueWork;
+
+static void *unique_thread(void *userdata) {
+        _cleanup_journal_close_ sd_journal *j = NULL;
+        UniqueWork *w = userdata;
+        const void *data;
+        size_t size;
+        int r;
+
+        r = sd_journal_open_files(&j, (const char**) w->paths, 0);
+        if (r < 0)
+                goto finish;
+
+        r = sd_journal_set_data_threshold(j, 0);
+        if (r < 0)
+                goto finish;
+
+        r = sd_journal_query_unique(j, arg_field);
+        if (r < 0)
+                goto finish;
+
+        SD_JOURNAL_FOREACH_UNIQUE(j, data, size) {
+                const void *eq;
+                char *v;
+
+                eq = memchr(data, '=', size);
+                if (eq)
+                        v = strndup((const char*) eq + 1, size - ((const uint8_t*) eq - (const uint8_t*) data + 1));
+                else
+                        v = strndup(data, size);
+                if (!v) {
+                        r = -ENOMEM;
+                        goto finish;
+                }
+
+                r = set_consume(w->values, v);
+                if (r < 0)
+                        goto finish;
+        }
+
+        r = 0;
+
+finish:
+        w->result = r;
+        return NULL;
+}
+
+/* The unique values of a field are collected from groups of files in
+ * parallel, and merged into one set afterwards. Each group is opened
+ * as a journal of its own, so that no state is shared between the
+ * threads. */
+static int query_unique_parallel(sd_journal *j, unsigned n, Set **ret) {
+        _cleanup_set_free_free_ Set *values = NULL;
+        UniqueWork *work;
+        pthread_t *threads;
+        unsigned k, m = 0, n_threads = 0;
+        Iterator i;
+        JournalFile *f;
+        int r = 0;
+
+        assert(j);
+        assert(n > 1);
+        assert(ret);
+
+        values = set_new(&string_hash_ops);
+        if (!values)
+                return log_oom();
+
+        work = newa0(UniqueWork, n);
+        threads = newa(pthread_t, n);
+
+        for (k = 0; k < n; k++) {
+                work[k].values = set_new(&string_hash_ops);
+                if (!work[k].values) {
+                        r = log_oom();
+                        goto finish;
+                }
+        }
+
         ORDERED_HASHMAP_FOREACH(f, j->files, i) {
-                int k;
-                usec_t first = 0, validated = 0, last = 0;
+                r = strv_extend(&work[m++ % n].paths, f->path);
+                if (r < 0) {
+                        log_oom();
+                        goto finish;
+                }
+        }
 
-#ifdef HAVE_GCRYPT
-                if (!arg_verify_key && JOURNAL_HEADER_SEALED(f->header))
-                        log_notice("Journal file %s has sealing enabled but verification key has not been passed using --verify-key=.", f->path);
-#endif
+        for (k = 0; k < n; k++) {
+                r = pthread_create(threads + k, NULL, unique_thread, work + k);
+                if (r != 0) {
+                        r = log_error_errno(r, "Failed to start query thread: %m");
+                        break;
+                }
 
-                k = journal_file_verify(f, arg_verify_key, &first, &validated, &last, true);
-                if (k == -EINVAL) {
-                        /* If the key was invalid give up right-away. */
-                        return k;
-                } else if (k < 0) {
-                        log_warning("FAIL: %s (%s)", f->path, strerror(-k));
-                        r = k;
-                } else {
-                        char a[FORMAT_TIMESTAMP_MAX], b[FORMAT_TIMESTAMP_MAX], c[FORMAT_TIMESPAN_MAX];
-                        log_info("PASS: %s", f->path);
-
-                        if (arg_verify_key && JOURNAL_HEADER_SEALED(f->header)) {
-                                if (validated > 0) {
-                                        log_info("=> Validated from %s to %s, final %s entries not sealed.",
-                                                 format_timestamp_maybe_utc(a, sizeof(a), first),
-                                                 format_timestamp_maybe_utc(b, sizeof(b), validated),
-                                                 format_timespan(c, sizeof(c), last > validated ? last - validated : 0, 0));
-                                } else if (last > 0)
-                                        log_info("=> No sealing yet, %s of entries not sealed.",
-                                                 format_timespan(c, sizeof(c), last - first, 0));
-                                else
-                                        log_info("=> No sealing yet, no entries in file.");
-                        }
+                n_threads++;
+        }
+
+        for (k = 0; k < n_threads; k++) {
+                pthread_join(threads[k], NULL);
+
+                if (r >= 0 && work[k].result < 0)
+                        r = log_error_errno(work[k].result, "Failed to query unique data objects: %m");
+                if (r >= 0) {
+                        r = set_move(values, work[k].values);
+                        if (r < 0)
+                                log_oom();
                 }
         }
 
+        if (r >= 0) {
+                *ret = values;
+                values = NULL;
+        }
+
+finish:
+        for (k = 0; k < n; k++) {
+                set_free_free(work[k].values);
+                strv_free(work[k].paths);
+        }
+
         return r;
 }
 
@@ -1772,6 +2036,82 @@ static int flush_to_var(void) {
         return 0;
 }
 
+static int show_statistics(void) {
+        _cleanup_bus_error_free_ sd_bus_error error = SD_BUS_ERROR_NULL;
+        _cleanup_bus_flush_close_unref_ sd_bus *bus = NULL;
+        _cleanup_close_ int watch_fd = -1;
+        _cleanup_free_ char *text = NULL;
+        struct stat old = {}, st;
+        usec_t timeout;
+        int r;
+
+        /* Ask the daemon to dump its counters with SIGRTMIN+1 and wait
+         * for the statistics file to be replaced */
+        if (stat("/run/systemd/journal/statistics", &old) < 0 && errno != ENOENT)
+                return log_error_errno(errno, "Failed to stat /run/systemd/journal/statistics: %m");
+
+        mkdir_p("/run/systemd/journal", 0755);
+
+        watch_fd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+        if (watch_fd < 0)
+                return log_error_errno(errno, "Failed to create inotify watch: %m");
+
+        r = inotify_add_watch(watch_fd, "/run/systemd/journal", IN_MOVED_TO|IN_DONT_FOLLOW|IN_ONLYDIR);
+        if (r < 0)
+                return log_error_errno(errno, "Failed to watch journal directory: %m");
+
+        r = bus_open_system_systemd(&bus);
+        if (r < 0)
+                return log_error_errno(r, "Failed to get D-Bus connection: %m");
+
+        r = sd_bus_call_method(
+                        bus,
+                        "org.freedesktop.systemd1",
+                        "/org/freedesktop/systemd1",
+                        "org.freedesktop.systemd1.Manager",
+                        "KillUnit",
+                        &error,
+                        NULL,
+                        "ssi", "systemd-journald.service", "main", SIGRTMIN+1);
+        if (r < 0) {
+                log_error("Failed to kill journal service: %s", bus_error_message(&error, r));
+                return r;
+        }
+
+        timeout = now(CLOCK_MONOTONIC) + 10 * USEC_PER_SEC;
+
+        for (;;) {
+                usec_t n;
+
+                if (stat("/run/systemd/journal/statistics", &st) >= 0) {
+                        if (st.st_ino != old.st_ino || st.st_dev != old.st_dev)
+                                break;
+                } else if (errno != ENOENT)
+                        return log_error_errno(errno, "Failed to stat /run/systemd/journal/statistics: %m");
+
+                n = now(CLOCK_MONOTONIC);
+                if (n >= timeout) {
+                        log_error("Timed out waiting for the journal daemon to write its statistics.");
+                        return -ETIME;
+                }
+
+                r = fd_wait_for_event(watch_fd, POLLIN, timeout - n);
+                if (r < 0)
+                        return log_error_errno(r, "Failed to wait for event: %m");
+
+                r = flush_fd(watch_fd);
+                if (r < 0)
+                        return log_error_errno(r, "Failed to flush inotify events: %m");
+        }
+
+        r = read_full_file("/run/systemd/journal/statistics", &text, NULL);
+        if (r < 0)
+                return log_error_errno(r, "Failed to read /run/systemd/journal/statistics: %m");
+
+        fputs(text, stdout);
+        return 0;
+}
+
 int main(int argc, char *argv[]) {
         int r;
         _cleanup_journal_close_ sd_journal *j = NULL;
@@ -1807,6 +2147,11 @@ int main(int argc, char *argv[]) {
                 goto finish;
         }
 
+        if (arg_action == ACTION_STATISTICS) {
+                r = show_statistics();
+                goto finish;
+        }
+
         if (arg_action == ACTION_SETUP_KEYS) {
                 r = setup_keys();
                 goto finish;
@@ -1905,6 +2250,42 @@ int main(int argc, char *argv[]) {
                 goto finish;
         }
 
+        if (arg_action == ACTION_COMPACT) {
+                char sbytes[FORMAT_BYTES_MAX];
+                uint64_t sum = 0;
+                JournalFile *f;
+                Iterator i;
+
+                ORDERED_HASHMAP_FOREACH(f, j->files, i) {
+                        uint64_t saved = 0;
+                        int q;
+
+                        if (f->header->state != STATE_ARCHIVED)
+                                continue;
+
+                        q = journal_file_compact(f, true, j->mmap, &saved);
+                        if (q == -EPERM) {
+                                log_debug("Not compacting sealed file %s.", f->path);
+                                continue;
+                        }
+                        if (q < 0) {
+                                log_error_errno(q, "Failed to compact %s: %m", f->path);
+                                r = q;
+                                continue;
+                        }
+                        if (q == 0) {
+                                log_debug("Compacting %s would not save any space, skipping.", f->path);
+                                continue;
+                        }
+
+                        log_info("Compacted %s, freed %s.", f->path, format_bytes(sbytes, sizeof(sbytes), saved));
+                        sum += saved;
+                }
+
+                log_info("Compacting archived journal files freed %s in total.", format_bytes(sbytes, sizeof(sbytes), sum));
+                goto finish;
+        }
+
         if (arg_action == ACTION_LIST_BOOTS) {
                 r = list_boots(j);
                 goto finish;
@@ -1953,6 +2334,29 @@ int main(int argc, char *argv[]) {
         if (arg_field) {
                 const void *data;
                 size_t size;
+                unsigned n;
+
+                n = n_workers(ordered_hashmap_size(j->files));
+                if (n > 1) {
+                        _cleanup_set_free_free_ Set *values = NULL;
+                        const char *v;
+                        Iterator it;
+
+                        r = query_unique_parallel(j, n, &values);
+                        if (r < 0)
+                                goto finish;
+
+                        SET_FOREACH(v, values, it) {
+                                if (arg_lines >= 0 && n_shown >= arg_lines)
+                                        break;
+
+                                puts(v);
+                                n_shown ++;
+                        }
+
+                        r = 0;
+                        goto finish;
+                }
 
                 r = sd_journal_set_data_threshold(j, 0);
                 if (r < 0) {
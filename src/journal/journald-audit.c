@@ -351,6 +351,8 @@ static void process_audit_string(Server *s, int type, const char *data, size_t s
         if (!data)
                 return;
 
+        server_count_received(s, SERVER_SOURCE_AUDIT, size);
+
         /* Note that the input buffer is NUL terminated, but let's
          * check whether there is a spurious NUL byte */
         if (memchr(data, 0, size))
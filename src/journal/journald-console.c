@@ -56,9 +56,9 @@ void server_forward_console(
         struct timespec ts;
         char tbuf[sizeof("[] ")-1 + DECIMAL_STR_MAX(ts.tv_sec) + DECIMAL_STR_MAX(ts.tv_nsec)-3 + 1];
         char header_pid[sizeof("[]: ")-1 + DECIMAL_STR_MAX(pid_t)];
-        int n = 0, fd;
+        int n = 0, i;
+        size_t l = 0;
         _cleanup_free_ char *ident_buf = NULL;
-        const char *tty;
 
         assert(s);
         assert(message);
@@ -97,16 +97,50 @@ void server_forward_console(
         IOVEC_SET_STRING(iovec[n++], message);
         IOVEC_SET_STRING(iovec[n++], "\n");
 
+        for (i = 0; i < n; i++)
+                l += iovec[i].iov_len;
+
+        if (s->n_forward_console_queue >= FORWARD_QUEUE_MAX ||
+            s->forward_console_buffer_used + l > FORWARD_QUEUE_BYTES_MAX)
+                server_flush_forward_console(s);
+
+        if (!GREEDY_REALLOC(s->forward_console_buffer, s->forward_console_buffer_allocated, s->forward_console_buffer_used + l))
+                return;
+
+        for (i = 0; i < n; i++) {
+                memcpy(s->forward_console_buffer + s->forward_console_buffer_used, iovec[i].iov_base, iovec[i].iov_len);
+                s->forward_console_buffer_used += iovec[i].iov_len;
+        }
+
+        s->n_forward_console_queue++;
+        server_schedule_forward(s);
+}
+
+void server_flush_forward_console(Server *s) {
+        const char *tty;
+        int fd, r;
+
+        assert(s);
+
+        if (s->n_forward_console_queue <= 0)
+                return;
+
+        /* Open the terminal once for all queued lines, and write them
+         * in one go */
+
         tty = s->tty_path ? s->tty_path : "/dev/console";
 
         fd = open_terminal(tty, O_WRONLY|O_NOCTTY|O_CLOEXEC);
-        if (fd < 0) {
+        if (fd < 0)
                 log_debug_errno(errno, "Failed to open %s for logging: %m", tty);
-                return;
-        }
+        else {
+                r = loop_write(fd, s->forward_console_buffer, s->forward_console_buffer_used, false);
+                if (r < 0)
+                        log_debug_errno(r, "Failed to write to %s for logging: %m", tty);
 
-        if (writev(fd, iovec, n) < 0)
-                log_debug_errno(errno, "Failed to write to %s for logging: %m", tty);
+                safe_close(fd);
+        }
 
-        safe_close(fd);
+        s->n_forward_console_queue = 0;
+        s->forward_console_buffer_used = 0;
 }
@@ -0,0 +1,181 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  Copyright 2015 Lennart Poettering
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifdef HAVE_SELINUX
+#include <selinux/selinux.h>
+#endif
+
+#include "audit.h"
+#include "cgroup-util.h"
+#include "hashmap.h"
+#include "process-util.h"
+#include "selinux-util.h"
+#include "util.h"
+#include "journald-context.h"
+
+/* How many clients to keep metadata around for, the least recently
+ * used one is evicted first */
+#define CLIENT_CONTEXT_CACHE_MAX 256U
+
+/* Metadata such as the command line or the cgroup may change during
+ * the lifetime of a process, hence refresh it every now and then */
+#define CLIENT_CONTEXT_MAX_AGE_USEC (1*USEC_PER_SEC)
+
+static void client_context_reset(ClientContext *c) {
+        assert(c);
+
+        c->comm = mfree(c->comm);
+        c->exe = mfree(c->exe);
+        c->cmdline = mfree(c->cmdline);
+        c->capeff = mfree(c->capeff);
+        c->cgroup = mfree(c->cgroup);
+        c->session = mfree(c->session);
+        c->unit = mfree(c->unit);
+        c->user_unit = mfree(c->user_unit);
+        c->slice = mfree(c->slice);
+        c->label = mfree(c->label);
+
+        c->uid_valid = c->gid_valid = false;
+        c->audit_session_valid = c->audit_loginuid_valid = false;
+        c->owner_uid_valid = false;
+}
+
+static ClientContext* client_context_free(ClientContext *c) {
+        if (!c)
+                return NULL;
+
+        client_context_reset(c);
+        free(c);
+
+        return NULL;
+}
+
+static void client_context_read(Server *s, ClientContext *c) {
+        assert(s);
+        assert(c);
+
+        client_context_reset(c);
+
+        c->uid_valid = get_process_uid(c->pid, &c->uid) >= 0;
+        c->gid_valid = get_process_gid(c->pid, &c->gid) >= 0;
+
+        (void) get_process_comm(c->pid, &c->comm);
+        (void) get_process_exe(c->pid, &c->exe);
+        (void) get_process_cmdline(c->pid, 0, false, &c->cmdline);
+        (void) get_process_capeff(c->pid, &c->capeff);
+
+#ifdef HAVE_AUDIT
+        c->audit_session_valid = audit_session_from_pid(c->pid, &c->audit_session) >= 0;
+        c->audit_loginuid_valid = audit_loginuid_from_pid(c->pid, &c->audit_loginuid) >= 0;
+#endif
+
+        if (cg_pid_get_path_shifted(c->pid, s->cgroup_root, &c->cgroup) >= 0) {
+                (void) cg_path_get_session(c->cgroup, &c->session);
+                c->owner_uid_valid = cg_path_get_owner_uid(c->cgroup, &c->owner_uid) >= 0;
+                (void) cg_path_get_unit(c->cgroup, &c->unit);
+                (void) cg_path_get_user_unit(c->cgroup, &c->user_unit);
+                (void) cg_path_get_slice(c->cgroup, &c->slice);
+        }
+
+#ifdef HAVE_SELINUX
+        if (mac_selinux_use()) {
+                security_context_t con;
+
+                if (getpidcon(c->pid, &con) >= 0) {
+                        c->label = strdup(con);
+                        freecon(con);
+                }
+        }
+#endif
+
+        c->timestamp = now(CLOCK_MONOTONIC);
+}
+
+int client_context_get(Server *s, pid_t pid, ClientContext **ret) {
+        unsigned long long start_time = 0;
+        bool alive;
+        ClientContext *c;
+        int r;
+
+        assert(s);
+        assert(pid > 0);
+        assert(ret);
+
+        /* The start time tells us whether the PID got recycled since
+         * we looked last. If we can't read it the process is gone
+         * already, in which case whatever we cached about it is
+         * still the best information we can get. */
+        alive = get_process_start_time(pid, &start_time) >= 0;
+
+        c = ordered_hashmap_get(s->client_contexts, PID_TO_PTR(pid));
+        if (c) {
+                /* Move it to the end, so that the least recently
+                 * used one is evicted first. Since the cache holds
+                 * more than two entries, the contexts of sender and
+                 * object of a message never evict each other. */
+                assert_se(ordered_hashmap_remove(s->client_contexts, PID_TO_PTR(pid)) == c);
+
+                if (alive &&
+                    (c->start_time != start_time ||
+                     c->timestamp + CLIENT_CONTEXT_MAX_AGE_USEC < now(CLOCK_MONOTONIC))) {
+                        c->start_time = start_time;
+                        client_context_read(s, c);
+                }
+        } else {
+                r = ordered_hashmap_ensure_allocated(&s->client_contexts, NULL);
+                if (r < 0)
+                        return r;
+
+                if (ordered_hashmap_size(s->client_contexts) >= CLIENT_CONTEXT_CACHE_MAX) {
+                        c = ordered_hashmap_steal_first(s->client_contexts);
+                        assert(c);
+                        client_context_reset(c);
+                } else {
+                        c = new0(ClientContext, 1);
+                        if (!c)
+                                return -ENOMEM;
+                }
+
+                c->pid = pid;
+                c->start_time = start_time;
+                client_context_read(s, c);
+        }
+
+        r = ordered_hashmap_put(s->client_contexts, PID_TO_PTR(pid), c);
+        if (r < 0) {
+                client_context_free(c);
+                return r;
+        }
+
+        *ret = c;
+        return 0;
+}
+
+void client_context_flush_all(Server *s) {
+        ClientContext *c;
+
+        assert(s);
+
+        while ((c = ordered_hashmap_steal_first(s->client_contexts)))
+                client_context_free(c);
+
+        s->client_contexts = ordered_hashmap_free(s->client_contexts);
+}
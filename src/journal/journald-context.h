@@ -0,0 +1,68 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+#pragma once
+
+/***
+  This file is part of systemd.
+
+  Copyright 2015 Lennart Poettering
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include "time-util.h"
+#include "journald-server.h"
+
+typedef struct ClientContext ClientContext;
+
+/* Metadata about a client process, as read from /proc and its
+ * cgroup. journald caches these per PID, so that they don't need
+ * to be read again for every single message. */
+struct ClientContext {
+        pid_t pid;
+        unsigned long long start_time;
+        usec_t timestamp;
+
+        uid_t uid;
+        gid_t gid;
+        bool uid_valid:1;
+        bool gid_valid:1;
+
+        char *comm;
+        char *exe;
+        char *cmdline;
+        char *capeff;
+
+        uint32_t audit_session;
+        uid_t audit_loginuid;
+        bool audit_session_valid:1;
+        bool audit_loginuid_valid:1;
+
+        char *cgroup;
+        char *session;
+        uid_t owner_uid;
+        bool owner_uid_valid:1;
+        char *unit;
+        char *user_unit;
+        char *slice;
+
+        char *label;
+};
+
+int client_context_get(Server *s, pid_t pid, ClientContext **ret);
+void client_context_flush_all(Server *s);
@@ -24,6 +24,7 @@
 #include <fcntl.h>
 #include <sys/mman.h>
 #include <sys/socket.h>
+#include <sys/sysmacros.h>
 
 #include "systemd/sd-messages.h"
 #include <libudev.h>
@@ -33,6 +34,8 @@
 #include "journald-syslog.h"
 #include "formats-util.h"
 #include "process-util.h"
+#include "strv.h"
+#include "hashmap.h"
 
 void server_forward_kmsg(
         Server *s,
@@ -105,6 +108,138 @@ static bool is_us(const char *pid) {
         return t == getpid();
 }
 
+/* How many devices to keep the udev metadata of around, the least
+ * recently used one is evicted first */
+#define KERNEL_DEVICE_CACHE_MAX 128U
+
+typedef struct KernelDevice {
+        char *id;
+        char **fields;
+} KernelDevice;
+
+static KernelDevice* kernel_device_free(KernelDevice *d) {
+        if (!d)
+                return NULL;
+
+        free(d->id);
+        strv_free(d->fields);
+        free(d);
+
+        return NULL;
+}
+
+static int kernel_device_read(Server *s, KernelDevice *d) {
+        _cleanup_strv_free_ char **fields = NULL;
+        struct udev_device *ud;
+        struct udev_list_entry *ll;
+        const char *g;
+        unsigned j = 0;
+        int r = 0;
+
+        assert(s);
+        assert(d);
+
+        ud = udev_device_new_from_device_id(s->udev, d->id);
+        if (!ud)
+                return -ENODEV;
+
+        g = udev_device_get_devnode(ud);
+        if (g) {
+                r = strv_consume(&fields, strappend("_UDEV_DEVNODE=", g));
+                if (r < 0)
+                        goto finish;
+        }
+
+        g = udev_device_get_sysname(ud);
+        if (g) {
+                r = strv_consume(&fields, strappend("_UDEV_SYSNAME=", g));
+                if (r < 0)
+                        goto finish;
+        }
+
+        ll = udev_device_get_devlinks_list_entry(ud);
+        udev_list_entry_foreach(ll, ll) {
+
+                if (j >= N_IOVEC_UDEV_FIELDS)
+                        break;
+
+                g = udev_list_entry_get_name(ll);
+                if (g) {
+                        r = strv_consume(&fields, strappend("_UDEV_DEVLINK=", g));
+                        if (r < 0)
+                                goto finish;
+                }
+
+                j++;
+        }
+
+        strv_free(d->fields);
+        d->fields = fields;
+        fields = NULL;
+
+finish:
+        udev_device_unref(ud);
+        return r;
+}
+
+static int kernel_device_get(Server *s, const char *id, KernelDevice **ret) {
+        KernelDevice *d;
+        int r;
+
+        assert(s);
+        assert(id);
+        assert(ret);
+
+        d = ordered_hashmap_get(s->kernel_devices, id);
+        if (d) {
+                /* Move it to the end, so that the least recently
+                 * used one is evicted first */
+                assert_se(ordered_hashmap_remove(s->kernel_devices, id) == d);
+
+                /* Without the monitor we never learn about renames
+                 * or removals, hence refresh the entry every time */
+                if (!s->udev_monitor) {
+                        r = kernel_device_read(s, d);
+                        if (r < 0) {
+                                kernel_device_free(d);
+                                return r;
+                        }
+                }
+        } else {
+                r = ordered_hashmap_ensure_allocated(&s->kernel_devices, &string_hash_ops);
+                if (r < 0)
+                        return r;
+
+                if (ordered_hashmap_size(s->kernel_devices) >= KERNEL_DEVICE_CACHE_MAX)
+                        kernel_device_free(ordered_hashmap_steal_first(s->kernel_devices));
+
+                d = new0(KernelDevice, 1);
+                if (!d)
+                        return -ENOMEM;
+
+                d->id = strdup(id);
+                if (!d->id) {
+                        kernel_device_free(d);
+                        return -ENOMEM;
+                }
+
+                r = kernel_device_read(s, d);
+                if (r < 0) {
+                        kernel_device_free(d);
+                        return r;
+                }
+        }
+
+        r = ordered_hashmap_put(s->kernel_devices, d->id, d);
+        if (r < 0) {
+                kernel_device_free(d);
+                return r;
+        }
+
+        *ret = d;
+        return 0;
+}
+
 static void dev_kmsg_record(Server *s, const char *p, size_t l) {
         struct iovec iovec[N_IOVEC_META_FIELDS + 7 + N_IOVEC_KERNEL_FIELDS + 2 + N_IOVEC_UDEV_FIELDS];
         char *message = NULL, *syslog_priority = NULL, *syslog_pid = NULL, *syslog_facility = NULL, *syslog_identifier = NULL, *source_time = NULL;
@@ -122,6 +257,8 @@ static void dev_kmsg_record(Server *s, const char *p, size_t l) {
         if (l <= 0)
                 return;
 
+        server_count_received(s, SERVER_SOURCE_KMSG, l);
+
         e = memchr(p, ',', l);
         if (!e)
                 return;
@@ -217,53 +354,14 @@ static void dev_kmsg_record(Server *s, const char *p, size_t l) {
         }
 
         if (kernel_device) {
-                struct udev_device *ud;
-
-                ud = udev_device_new_from_device_id(s->udev, kernel_device);
-                if (ud) {
-                        const char *g;
-                        struct udev_list_entry *ll;
-                        char *b;
-
-                        g = udev_device_get_devnode(ud);
-                        if (g) {
-                                b = strappend("_UDEV_DEVNODE=", g);
-                                if (b) {
-                                        IOVEC_SET_STRING(iovec[n++], b);
-                                        z++;
-                                }
-                        }
-
-                        g = udev_device_get_sysname(ud);
-                        if (g) {
-                                b = strappend("_UDEV_SYSNAME=", g);
-                                if (b) {
-                                        IOVEC_SET_STRING(iovec[n++], b);
-                                        z++;
-                                }
-                        }
-
-                        j = 0;
-                        ll = udev_device_get_devlinks_list_entry(ud);
-                        udev_list_entry_foreach(ll, ll) {
-
-                                if (j > N_IOVEC_UDEV_FIELDS)
-                                        break;
-
-                                g = udev_list_entry_get_name(ll);
-                                if (g) {
-                                        b = strappend("_UDEV_DEVLINK=", g);
-                                        if (b) {
-                                                IOVEC_SET_STRING(iovec[n++], b);
-                                                z++;
-                                        }
-                                }
-
-                                j++;
-                        }
-
-                        udev_device_unref(ud);
-                }
+                KernelDevice *d;
+                char **g;
+
+                /* The strings are owned by the cache, hence they are
+                 * not counted in z */
+                if (kernel_device_get(s, kernel_device, &d) >= 0)
+                        STRV_FOREACH(g, d->fields)
+                                IOVEC_SET_STRING(iovec[n++], *g);
         }
 
         if (asprintf(&source_time, "_SOURCE_MONOTONIC_TIMESTAMP=%llu", usec) >= 0)
@@ -464,3 +562,117 @@ int server_open_kernel_seqnum(Server *s) {
 
         return 0;
 }
+
+static char *kernel_device_id(struct udev_device *ud) {
+        const char *subsystem, *sysname, *ifindex;
+        dev_t devnum;
+        char *id = NULL;
+
+        assert(ud);
+
+        /* The same format the kernel uses for DEVICE= in /dev/kmsg
+         * records, see udev_device_new_from_device_id() */
+
+        subsystem = udev_device_get_subsystem(ud);
+        if (!subsystem)
+                return NULL;
+
+        devnum = udev_device_get_devnum(ud);
+        if (major(devnum) > 0) {
+                if (asprintf(&id, "%c%u:%u", streq(subsystem, "block") ? 'b' : 'c', major(devnum), minor(devnum)) < 0)
+                        return NULL;
+
+                return id;
+        }
+
+        ifindex = udev_device_get_property_value(ud, "IFINDEX");
+        if (ifindex && !streq(ifindex, "0"))
+                return strappend("n", ifindex);
+
+        sysname = udev_device_get_sysname(ud);
+        if (!sysname)
+                return NULL;
+
+        if (asprintf(&id, "+%s:%s", subsystem, sysname) < 0)
+                return NULL;
+
+        return id;
+}
+
+static int dispatch_udev_monitor(sd_event_source *es, int fd, uint32_t revents, void *userdata) {
+        Server *s = userdata;
+        struct udev_device *ud;
+        _cleanup_free_ char *id = NULL;
+
+        assert(s);
+
+        ud = udev_monitor_receive_device(s->udev_monitor);
+        if (!ud) {
+                /* We might have missed events, don't trust
+                 * anything we cached */
+                server_flush_kernel_devices(s);
+                return 0;
+        }
+
+        /* Any event may change the node name or the symlinks, and
+         * the first one after "add" is when udev has filled them in */
+        id = kernel_device_id(ud);
+        if (id)
+                kernel_device_free(ordered_hashmap_remove(s->kernel_devices, id));
+        else
+                server_flush_kernel_devices(s);
+
+        udev_device_unref(ud);
+        return 0;
+}
+
+int server_open_kernel_device_monitor(Server *s) {
+        int r;
+
+        assert(s);
+        assert(s->udev);
+
+        /* Without udev running (e.g. in containers) we never get
+         * any events, and simply look up each device every time */
+        s->udev_monitor = udev_monitor_new_from_netlink(s->udev, "udev");
+        if (!s->udev_monitor) {
+                log_debug("Failed to create udev monitor, not caching kernel device metadata.");
+                return 0;
+        }
+
+        r = udev_monitor_enable_receiving(s->udev_monitor);
+        if (r < 0) {
+                log_debug_errno(r, "Failed to enable udev monitor, not caching kernel device metadata: %m");
+                goto fail;
+        }
+
+        r = sd_event_add_io(s->event, &s->udev_monitor_event_source, udev_monitor_get_fd(s->udev_monitor), EPOLLIN, dispatch_udev_monitor, s);
+        if (r < 0) {
+                log_error_errno(r, "Failed to add udev monitor fd to event loop: %m");
+                goto fail;
+        }
+
+        /* Invalidate before we look at any further kmsg records */
+        r = sd_event_source_set_priority(s->udev_monitor_event_source, SD_EVENT_PRIORITY_IMPORTANT+5);
+        if (r < 0) {
+                log_error_errno(r, "Failed to adjust priority of udev monitor event source: %m");
+                goto fail;
+        }
+
+        return 0;
+
+fail:
+        s->udev_monitor_event_source = sd_event_source_unref(s->udev_monitor_event_source);
+        s->udev_monitor = udev_monitor_unref(s->udev_monitor);
+
+        return 0;
+}
+
+void server_flush_kernel_devices(Server *s) {
+        KernelDevice *d;
+
+        assert(s);
+
+        while ((d = ordered_hashmap_steal_first(s->kernel_devices)))
+                kernel_device_free(d);
+}
@@ -29,3 +29,6 @@ int server_flush_dev_kmsg(Server *s);
 void server_forward_kmsg(Server *s, int priority, const char *identifier, const char *message, const struct ucred *ucred);
 
 int server_open_kernel_seqnum(Server *s);
+
+int server_open_kernel_device_monitor(Server *s);
+void server_flush_kernel_devices(Server *s);
@@ -92,6 +92,8 @@ void server_process_native_message(
         assert(s);
         assert(buffer || buffer_size == 0);
 
+        server_count_received(s, SERVER_SOURCE_NATIVE, buffer_size);
+
         p = buffer;
         remaining = buffer_size;
 
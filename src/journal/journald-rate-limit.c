@@ -23,14 +23,10 @@
 #include <errno.h>
 
 #include "journald-rate-limit.h"
-#include "list.h"
 #include "util.h"
 #include "hashmap.h"
-#include "random-util.h"
 
 #define POOLS_MAX 5
-#define BUCKETS_MAX 127
-#define GROUPS_MAX 2047
 
 static const int priority_map[] = {
         [LOG_EMERG]   = 0,
@@ -46,101 +42,113 @@ static const int priority_map[] = {
 typedef struct JournalRateLimitPool JournalRateLimitPool;
 typedef struct JournalRateLimitGroup JournalRateLimitGroup;
 
+/* Each pool is a token bucket holding up to burst tokens that refills
+ * at burst tokens per interval. To keep this in integers, tokens are
+ * counted in units of 1/interval, hence a message costs interval. */
 struct JournalRateLimitPool {
-        usec_t begin;
-        unsigned num;
+        usec_t last;
+        uint64_t tokens;
+
+        /* Suppressed since we last reported about it, and when that was */
         unsigned suppressed;
+        usec_t reported;
 };
 
 struct JournalRateLimitGroup {
-        JournalRateLimit *parent;
-
         char *id;
         JournalRateLimitPool pools[POOLS_MAX];
-        unsigned long hash;
 
-        LIST_FIELDS(JournalRateLimitGroup, bucket);
-        LIST_FIELDS(JournalRateLimitGroup, lru);
+        /* All messages ever suppressed in this group */
+        uint64_t n_suppressed;
 };
 
 struct JournalRateLimit {
         usec_t interval;
         unsigned burst;
+        unsigned groups_max;
 
-        JournalRateLimitGroup* buckets[BUCKETS_MAX];
-        JournalRateLimitGroup *lru, *lru_tail;
-
-        unsigned n_groups;
-
-        uint8_t hash_key[16];
+        /* Least recently used groups first */
+        OrderedHashmap *groups;
 };
 
-JournalRateLimit *journal_rate_limit_new(usec_t interval, unsigned burst) {
+JournalRateLimit *journal_rate_limit_new(usec_t interval, unsigned burst, unsigned groups_max) {
         JournalRateLimit *r;
 
         assert(interval > 0 || burst == 0);
+        assert(groups_max > 0);
 
         r = new0(JournalRateLimit, 1);
         if (!r)
                 return NULL;
 
+        r->groups = ordered_hashmap_new(&string_hash_ops);
+        if (!r->groups) {
+                free(r);
+                return NULL;
+        }
+
         r->interval = interval;
         r->burst = burst;
-
-        random_bytes(r->hash_key, sizeof(r->hash_key));
+        r->groups_max = groups_max;
 
         return r;
 }
 
 static void journal_rate_limit_group_free(JournalRateLimitGroup *g) {
-        assert(g);
-
-        if (g->parent) {
-                assert(g->parent->n_groups > 0);
+        if (!g)
+                return;
 
-                if (g->parent->lru_tail == g)
-                        g->parent->lru_tail = g->lru_prev;
+        free(g->id);
+        free(g);
+}
 
-                LIST_REMOVE(lru, g->parent->lru, g);
-                LIST_REMOVE(bucket, g->parent->buckets[g->hash % BUCKETS_MAX], g);
+static void journal_rate_limit_flush(JournalRateLimit *r) {
+        JournalRateLimitGroup *g;
 
-                g->parent->n_groups --;
-        }
+        assert(r);
 
-        free(g->id);
-        free(g);
+        while ((g = ordered_hashmap_steal_first(r->groups)))
+                journal_rate_limit_group_free(g);
 }
 
 void journal_rate_limit_free(JournalRateLimit *r) {
         assert(r);
 
-        while (r->lru)
-                journal_rate_limit_group_free(r->lru);
-
+        journal_rate_limit_flush(r);
+        ordered_hashmap_free(r->groups);
         free(r);
 }
 
-_pure_ static bool journal_rate_limit_group_expired(JournalRateLimitGroup *g, usec_t ts) {
+_pure_ static bool journal_rate_limit_group_expired(JournalRateLimit *r, JournalRateLimitGroup *g, usec_t ts) {
         unsigned i;
 
+        assert(r);
         assert(g);
 
+        /* After an interval without messages, all buckets are full
+         * again, hence the group carries no state worth keeping,
+         * unless there are suppressed messages still to report */
+
         for (i = 0; i < POOLS_MAX; i++)
-                if (g->pools[i].begin + g->parent->interval >= ts)
+                if (g->pools[i].last + r->interval >= ts ||
+                    g->pools[i].suppressed > 0)
                         return false;
 
         return true;
 }
 
 static void journal_rate_limit_vacuum(JournalRateLimit *r, usec_t ts) {
+        JournalRateLimitGroup *g;
+
         assert(r);
 
         /* Makes room for at least one new item, but drop all
-         * expored items too. */
+         * expired items too. */
 
-        while (r->n_groups >= GROUPS_MAX ||
-               (r->lru_tail && journal_rate_limit_group_expired(r->lru_tail, ts)))
-                journal_rate_limit_group_free(r->lru_tail);
+        while ((g = ordered_hashmap_first(r->groups)) &&
+               (ordered_hashmap_size(r->groups) >= r->groups_max ||
+                journal_rate_limit_group_expired(r, g, ts)))
+                journal_rate_limit_group_free(ordered_hashmap_steal_first(r->groups));
 }
 
 static JournalRateLimitGroup* journal_rate_limit_group_new(JournalRateLimit *r, const char *id, usec_t ts) {
@@ -157,17 +165,11 @@ static JournalRateLimitGroup* journal_rate_limit_group_new(JournalRateLimit *r,
         if (!g->id)
                 goto fail;
 
-        g->hash = string_hash_func(g->id, r->hash_key);
-
         journal_rate_limit_vacuum(r, ts);
 
-        LIST_PREPEND(bucket, r->buckets[g->hash % BUCKETS_MAX], g);
-        LIST_PREPEND(lru, r->lru, g);
-        if (!g->lru_next)
-                r->lru_tail = g;
-        r->n_groups ++;
+        if (ordered_hashmap_put(r->groups, g->id, g) < 0)
+                goto fail;
 
-        g->parent = r;
         return g;
 
 fail:
@@ -204,9 +206,9 @@ static unsigned burst_modulate(unsigned burst, uint64_t available) {
 }
 
 int journal_rate_limit_test(JournalRateLimit *r, const char *id, int priority, uint64_t available) {
-        unsigned long h;
         JournalRateLimitGroup *g;
         JournalRateLimitPool *p;
+        uint64_t capacity;
         unsigned burst;
         usec_t ts;
 
@@ -219,17 +221,16 @@ int journal_rate_limit_test(JournalRateLimit *r, const char *id, int priority, u
                 return 1;
 
         burst = burst_modulate(r->burst, available);
+        capacity = (uint64_t) burst * r->interval;
 
         ts = now(CLOCK_MONOTONIC);
 
-        h = string_hash_func(id, r->hash_key);
-        g = r->buckets[h % BUCKETS_MAX];
-
-        LIST_FOREACH(bucket, g, g)
-                if (streq(g->id, id))
-                        break;
-
-        if (!g) {
+        g = ordered_hashmap_get(r->groups, id);
+        if (g) {
+                /* Move it to the end of the LRU list */
+                assert_se(ordered_hashmap_remove(r->groups, g->id) == g);
+                assert_se(ordered_hashmap_put(r->groups, g->id, g) >= 0);
+        } else {
                 g = journal_rate_limit_group_new(r, id, ts);
                 if (!g)
                         return -ENOMEM;
@@ -237,29 +238,49 @@ int journal_rate_limit_test(JournalRateLimit *r, const char *id, int priority, u
 
         p = &g->pools[priority_map[priority]];
 
-        if (p->begin <= 0) {
-                p->suppressed = 0;
-                p->num = 1;
-                p->begin = ts;
-                return 1;
+        if (p->last <= 0) {
+                p->tokens = capacity;
+                p->reported = ts;
+        } else
+                p->tokens = MIN(capacity, p->tokens + MIN(ts - p->last, r->interval) * burst);
+
+        p->last = ts;
+
+        if (p->tokens < r->interval) {
+                p->suppressed++;
+                g->n_suppressed++;
+                return 0;
         }
 
-        if (p->begin + r->interval < ts) {
+        p->tokens -= r->interval;
+
+        /* Report suppressed messages at most once per interval, so
+         * that a steady flood doesn't turn into a flood of
+         * suppression notices */
+        if (p->suppressed > 0 && p->reported + r->interval <= ts) {
                 unsigned s;
 
                 s = p->suppressed;
                 p->suppressed = 0;
-                p->num = 1;
-                p->begin = ts;
+                p->reported = ts;
 
                 return 1 + s;
         }
 
-        if (p->num <= burst) {
-                p->num++;
-                return 1;
-        }
+        return 1;
+}
+
+int journal_rate_limit_get_suppressed(JournalRateLimit *r, const char *id, uint64_t *ret) {
+        JournalRateLimitGroup *g;
+
+        assert(r);
+        assert(id);
+        assert(ret);
+
+        g = ordered_hashmap_get(r->groups, id);
+        if (!g)
+                return -ENOENT;
 
-        p->suppressed++;
+        *ret = g->n_suppressed;
         return 0;
 }
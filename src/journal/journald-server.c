@@ -22,6 +22,7 @@
 #include <sys/signalfd.h>
 #include <sys/ioctl.h>
 #include <linux/sockios.h>
+#include <linux/sock_diag.h>
 #include <sys/statvfs.h>
 #include <sys/mman.h>
 
@@ -54,9 +55,12 @@
 #include "journald-rate-limit.h"
 #include "journald-kmsg.h"
 #include "journald-syslog.h"
+#include "journald-console.h"
 #include "journald-stream.h"
 #include "journald-native.h"
 #include "journald-audit.h"
+#include "journald-context.h"
+#include "journald-writer.h"
 #include "journald-server.h"
 
 #define USER_JOURNALS_MAX 1024
@@ -64,10 +68,22 @@
 #define DEFAULT_SYNC_INTERVAL_USEC (5*USEC_PER_MINUTE)
 #define DEFAULT_RATE_LIMIT_INTERVAL (30*USEC_PER_SEC)
 #define DEFAULT_RATE_LIMIT_BURST 1000
+#define DEFAULT_RATE_LIMIT_GROUPS_MAX 16384
 #define DEFAULT_MAX_FILE_USEC USEC_PER_MONTH
+#define DEFAULT_LINE_MAX (48*1024)
+#define MIN_LINE_MAX 79
 
 #define RECHECK_AVAILABLE_SPACE_USEC (30*USEC_PER_SEC)
 
+/* Followers are notified about new entries at most this often */
+#define POST_CHANGE_TIMER_INTERVAL_USEC (250*USEC_PER_MSEC)
+
+/* How many datagrams to read from the native, syslog and audit
+ * sockets per wakeup, and how large each receive slot is */
+#define DATAGRAM_BATCH_MAX 16U
+#define DATAGRAM_SLOT_SIZE (16U*1024U)
+#define DATAGRAM_SLOT_SIZE_MAX (64U*1024U)
+
 static const char* const storage_table[_STORAGE_MAX] = {
         [STORAGE_AUTO] = "auto",
         [STORAGE_VOLATILE] = "volatile",
@@ -87,7 +103,42 @@ static const char* const split_mode_table[_SPLIT_MAX] = {
 DEFINE_STRING_TABLE_LOOKUP(split_mode, SplitMode);
 DEFINE_CONFIG_PARSE_ENUM(config_parse_split_mode, split_mode, SplitMode, "Failed to parse split mode setting");
 
-static uint64_t available_space(Server *s, bool verbose) {
+static const char* const server_source_table[_SERVER_SOURCE_MAX] = {
+        [SERVER_SOURCE_NATIVE] = "native",
+        [SERVER_SOURCE_SYSLOG] = "syslog",
+        [SERVER_SOURCE_STDOUT] = "stdout",
+        [SERVER_SOURCE_KMSG] = "kernel",
+        [SERVER_SOURCE_AUDIT] = "audit",
+        [SERVER_SOURCE_DRIVER] = "driver",
+};
+
+DEFINE_STRING_TABLE_LOOKUP(server_source, ServerSource);
+
+/* Don't keep track of more cgroups than this, messages dropped for
+ * further ones only show up in the total */
+#define RATE_LIMITED_CGROUPS_MAX 1024U
+
+static void timing_statistics_add(TimingStatistics *t, usec_t begin) {
+        uint64_t d, m;
+        unsigned b = 0;
+
+        assert(t);
+
+        d = now(CLOCK_MONOTONIC) - begin;
+
+        while (b < TIMING_HISTOGRAM_BUCKETS - 1 && d >= (UINT64_C(1) << b))
+                b++;
+
+        __sync_fetch_and_add(&t->count, 1);
+        __sync_fetch_and_add(&t->total_usec, d);
+        __sync_fetch_and_add(&t->buckets[b], 1);
+
+        m = t->max_usec;
+        while (d > m && !__sync_bool_compare_and_swap(&t->max_usec, m, d))
+                m = t->max_usec;
+}
+
+static uint64_t do_available_space(Server *s, bool verbose) {
         char ids[33];
         _cleanup_free_ char *p = NULL;
         sd_id128_t machine;
@@ -101,10 +152,6 @@ static uint64_t available_space(Server *s, bool verbose) {
 
         ts = now(CLOCK_MONOTONIC);
 
-        if (s->cached_available_space_timestamp + RECHECK_AVAILABLE_SPACE_USEC > ts
-            && !verbose)
-                return s->cached_available_space;
-
         r = sd_id128_get_machine(&machine);
         if (r < 0)
                 return 0;
@@ -190,6 +237,36 @@ static uint64_t available_space(Server *s, bool verbose) {
         return s->cached_available_space;
 }
 
+static uint64_t available_space(Server *s, bool verbose) {
+        uint64_t r;
+
+        if (s->cached_available_space_timestamp + RECHECK_AVAILABLE_SPACE_USEC > now(CLOCK_MONOTONIC)
+            && !verbose)
+                return s->cached_available_space;
+
+        writer_lock_journals(s->writer);
+        r = do_available_space(s, verbose);
+        writer_unlock_journals(s->writer);
+
+        return r;
+}
+
+static void server_setup_post_change_timer(Server *s, JournalFile *f) {
+        int r;
+
+        assert(s);
+        assert(f);
+
+        /* The writer thread appends outside of the event loop, hence
+         * it has to notify followers right away */
+        if (s->write_thread)
+                return;
+
+        r = journal_file_enable_post_change_timer(f, s->event, POST_CHANGE_TIMER_INTERVAL_USEC);
+        if (r < 0)
+                log_debug_errno(r, "Failed to enable coalesced change notifications for %s, ignoring: %m", f->path);
+}
+
 void server_fix_perms(Server *s, JournalFile *f, uid_t uid) {
         int r;
 #ifdef HAVE_ACL
@@ -285,6 +362,7 @@ static JournalFile* find_journal(Server *s, uid_t uid) {
                 return s->system_journal;
 
         server_fix_perms(s, f, uid);
+        server_setup_post_change_timer(s, f);
 
         r = ordered_hashmap_put(s->user_journals, UINT32_TO_PTR(uid), f);
         if (r < 0) {
@@ -324,10 +402,15 @@ void server_rotate(Server *s) {
         JournalFile *f;
         void *k;
         Iterator i;
+        usec_t begin;
         int r;
 
         log_debug("Rotating...");
 
+        writer_lock_journals(s->writer);
+
+        begin = now(CLOCK_MONOTONIC);
+
         do_rotate(s, &s->runtime_journal, "runtime", false, 0);
         do_rotate(s, &s->system_journal, "system", s->seal, 0);
 
@@ -339,14 +422,23 @@ void server_rotate(Server *s) {
                         /* Old file has been closed and deallocated */
                         ordered_hashmap_remove(s->user_journals, k);
         }
+
+        timing_statistics_add(&s->stats.rotate, begin);
+
+        writer_unlock_journals(s->writer);
 }
 
 void server_sync(Server *s) {
         JournalFile *f;
         void *k;
         Iterator i;
+        usec_t begin;
         int r;
 
+        writer_lock_journals(s->writer);
+
+        begin = now(CLOCK_MONOTONIC);
+
         if (s->system_journal) {
                 r = journal_file_set_offline(s->system_journal);
                 if (r < 0)
@@ -366,6 +458,10 @@ void server_sync(Server *s) {
         }
 
         s->sync_scheduled = false;
+
+        timing_statistics_add(&s->stats.sync, begin);
+
+        writer_unlock_journals(s->writer);
 }
 
 static void do_vacuum(
@@ -373,7 +469,8 @@ static void do_vacuum(
                 const char *id,
                 JournalFile *f,
                 const char* path,
-                JournalMetrics *metrics) {
+                JournalMetrics *metrics,
+                VacuumIndex **index) {
 
         const char *p;
         int r;
@@ -382,9 +479,33 @@ static void do_vacuum(
                 return;
 
         p = strjoina(path, id);
-        r = journal_directory_vacuum(p, metrics->max_use, s->max_retention_usec, &s->oldest_file_usec, false);
-        if (r < 0 && r != -ENOENT)
-                log_error_errno(r, "Failed to vacuum %s: %m", p);
+
+        /* We vacuum on every rotation, hence keep an index of the
+         * directory around, which follows changes via inotify,
+         * instead of rescanning it each time */
+        if (!*index) {
+                r = vacuum_index_new(p, true, index);
+                if (r == -ENOENT)
+                        return;
+                if (r < 0) {
+                        log_warning_errno(r, "Failed to index %s, vacuuming without index: %m", p);
+
+                        r = journal_directory_vacuum(p, metrics->max_use, s->max_retention_usec, &s->oldest_file_usec, false);
+                        if (r < 0 && r != -ENOENT)
+                                log_error_errno(r, "Failed to vacuum %s: %m", p);
+                        return;
+                }
+        }
+
+        r = vacuum_index_vacuum(*index, metrics->max_use, s->max_retention_usec, &s->oldest_file_usec, false);
+        if (r < 0) {
+                /* Start from scratch next time, for example if the
+                 * directory got removed */
+                *index = vacuum_index_free(*index);
+
+                if (r != -ENOENT)
+                        log_error_errno(r, "Failed to vacuum %s: %m", p);
+        }
 }
 
 void server_vacuum(Server *s) {
@@ -403,10 +524,14 @@ void server_vacuum(Server *s) {
         }
         sd_id128_to_string(machine, ids);
 
-        do_vacuum(s, ids, s->system_journal, "/var/log/journal/", &s->system_metrics);
-        do_vacuum(s, ids, s->runtime_journal, "/run/log/journal/", &s->runtime_metrics);
+        writer_lock_journals(s->writer);
+
+        do_vacuum(s, ids, s->system_journal, "/var/log/journal/", &s->system_metrics, &s->system_vacuum_index);
+        do_vacuum(s, ids, s->runtime_journal, "/run/log/journal/", &s->runtime_metrics, &s->runtime_vacuum_index);
 
         s->cached_available_space_timestamp = 0;
+
+        writer_unlock_journals(s->writer);
 }
 
 static void server_cache_machine_id(Server *s) {
@@ -488,7 +613,7 @@ static bool shall_try_append_again(JournalFile *f, int r) {
         return true;
 }
 
-static void write_to_journal(Server *s, uid_t uid, struct iovec *iovec, unsigned n, int priority) {
+static int write_entry(Server *s, uid_t uid, struct iovec *iovec, unsigned n) {
         JournalFile *f;
         bool vacuumed = false;
         int r;
@@ -499,7 +624,7 @@ static void write_to_journal(Server *s, uid_t uid, struct iovec *iovec, unsigned
 
         f = find_journal(s, uid);
         if (!f)
-                return;
+                return -EIO;
 
         if (journal_file_rotate_suggested(f, s->max_file_usec)) {
                 log_debug("%s: Journal header limits reached or header out-of-date, rotating.", f->path);
@@ -509,32 +634,55 @@ static void write_to_journal(Server *s, uid_t uid, struct iovec *iovec, unsigned
 
                 f = find_journal(s, uid);
                 if (!f)
-                        return;
+                        return -EIO;
         }
 
         r = journal_file_append_entry(f, NULL, iovec, n, &s->seqnum, NULL, NULL);
-        if (r >= 0) {
-                server_schedule_sync(s, priority);
-                return;
-        }
+        if (r >= 0)
+                return r;
 
-        if (vacuumed || !shall_try_append_again(f, r)) {
-                log_error_errno(r, "Failed to write entry (%d items, %zu bytes), ignoring: %m", n, IOVEC_TOTAL_SIZE(iovec, n));
-                return;
-        }
+        if (vacuumed || !shall_try_append_again(f, r))
+                return log_error_errno(r, "Failed to write entry (%d items, %zu bytes), ignoring: %m", n, IOVEC_TOTAL_SIZE(iovec, n));
 
         server_rotate(s);
         server_vacuum(s);
 
         f = find_journal(s, uid);
         if (!f)
-                return;
+                return -EIO;
 
         log_debug("Retrying write.");
         r = journal_file_append_entry(f, NULL, iovec, n, &s->seqnum, NULL, NULL);
         if (r < 0)
-                log_error_errno(r, "Failed to write entry (%d items, %zu bytes) despite vacuuming, ignoring: %m", n, IOVEC_TOTAL_SIZE(iovec, n));
-        else
+                return log_error_errno(r, "Failed to write entry (%d items, %zu bytes) despite vacuuming, ignoring: %m", n, IOVEC_TOTAL_SIZE(iovec, n));
+
+        return r;
+}
+
+int server_write_entry(Server *s, uid_t uid, struct iovec *iovec, unsigned n) {
+        usec_t begin;
+        int r;
+
+        begin = now(CLOCK_MONOTONIC);
+        r = write_entry(s, uid, iovec, n);
+        timing_statistics_add(&s->stats.write, begin);
+
+        return r;
+}
+
+static void write_to_journal(Server *s, uid_t uid, struct iovec *iovec, unsigned n, int priority) {
+        int r;
+
+        assert(s);
+
+        if (s->writer) {
+                r = writer_enqueue(s->writer, uid, iovec, n, priority);
+                if (r < 0)
+                        log_error_errno(r, "Failed to queue entry (%d items, %zu bytes), ignoring: %m", n, IOVEC_TOTAL_SIZE(iovec, n));
+                return;
+        }
+
+        if (server_write_entry(s, uid, iovec, n) >= 0)
                 server_schedule_sync(s, priority);
 }
 
@@ -556,11 +704,8 @@ static void dispatch_message_real(
                 o_uid[sizeof("OBJECT_UID=") + DECIMAL_STR_MAX(uid_t)],
                 o_gid[sizeof("OBJECT_GID=") + DECIMAL_STR_MAX(gid_t)],
                 o_owner_uid[sizeof("OBJECT_SYSTEMD_OWNER_UID=") + DECIMAL_STR_MAX(uid_t)];
-        uid_t object_uid;
-        gid_t object_gid;
+        ClientContext *c = NULL, *o;
         char *x;
-        int r;
-        char *t, *c;
         uid_t realuid = 0, owner = 0, journal_uid;
         bool owner_valid = false;
 #ifdef HAVE_AUDIT
@@ -568,9 +713,6 @@ static void dispatch_message_real(
                 audit_loginuid[sizeof("_AUDIT_LOGINUID=") + DECIMAL_STR_MAX(uid_t)],
                 o_audit_session[sizeof("OBJECT_AUDIT_SESSION=") + DECIMAL_STR_MAX(uint32_t)],
                 o_audit_loginuid[sizeof("OBJECT_AUDIT_LOGINUID=") + DECIMAL_STR_MAX(uid_t)];
-
-        uint32_t audit;
-        uid_t loginuid;
 #endif
 
         assert(s);
@@ -590,94 +732,78 @@ static void dispatch_message_real(
                 sprintf(gid, "_GID="GID_FMT, ucred->gid);
                 IOVEC_SET_STRING(iovec[n++], gid);
 
-                r = get_process_comm(ucred->pid, &t);
-                if (r >= 0) {
-                        x = strjoina("_COMM=", t);
-                        free(t);
-                        IOVEC_SET_STRING(iovec[n++], x);
-                }
+                if (ucred->pid > 0 && client_context_get(s, ucred->pid, &c) >= 0) {
 
-                r = get_process_exe(ucred->pid, &t);
-                if (r >= 0) {
-                        x = strjoina("_EXE=", t);
-                        free(t);
-                        IOVEC_SET_STRING(iovec[n++], x);
-                }
+                        if (c->comm) {
+                                x = strjoina("_COMM=", c->comm);
+                                IOVEC_SET_STRING(iovec[n++], x);
+                        }
 
-                r = get_process_cmdline(ucred->pid, 0, false, &t);
-                if (r >= 0) {
-                        x = strjoina("_CMDLINE=", t);
-                        free(t);
-                        IOVEC_SET_STRING(iovec[n++], x);
-                }
+                        if (c->exe) {
+                                x = strjoina("_EXE=", c->exe);
+                                IOVEC_SET_STRING(iovec[n++], x);
+                        }
 
-                r = get_process_capeff(ucred->pid, &t);
-                if (r >= 0) {
-                        x = strjoina("_CAP_EFFECTIVE=", t);
-                        free(t);
-                        IOVEC_SET_STRING(iovec[n++], x);
-                }
+                        if (c->cmdline) {
+                                x = strjoina("_CMDLINE=", c->cmdline);
+                                IOVEC_SET_STRING(iovec[n++], x);
+                        }
+
+                        if (c->capeff) {
+                                x = strjoina("_CAP_EFFECTIVE=", c->capeff);
+                                IOVEC_SET_STRING(iovec[n++], x);
+                        }
 
 #ifdef HAVE_AUDIT
-                r = audit_session_from_pid(ucred->pid, &audit);
-                if (r >= 0) {
-                        sprintf(audit_session, "_AUDIT_SESSION=%"PRIu32, audit);
-                        IOVEC_SET_STRING(iovec[n++], audit_session);
-                }
+                        if (c->audit_session_valid) {
+                                sprintf(audit_session, "_AUDIT_SESSION=%"PRIu32, c->audit_session);
+                                IOVEC_SET_STRING(iovec[n++], audit_session);
+                        }
 
-                r = audit_loginuid_from_pid(ucred->pid, &loginuid);
-                if (r >= 0) {
-                        sprintf(audit_loginuid, "_AUDIT_LOGINUID="UID_FMT, loginuid);
-                        IOVEC_SET_STRING(iovec[n++], audit_loginuid);
-                }
+                        if (c->audit_loginuid_valid) {
+                                sprintf(audit_loginuid, "_AUDIT_LOGINUID="UID_FMT, c->audit_loginuid);
+                                IOVEC_SET_STRING(iovec[n++], audit_loginuid);
+                        }
 #endif
+                }
 
-                r = cg_pid_get_path_shifted(ucred->pid, s->cgroup_root, &c);
-                if (r >= 0) {
-                        char *session = NULL;
-
-                        x = strjoina("_SYSTEMD_CGROUP=", c);
+                if (c && c->cgroup) {
+                        x = strjoina("_SYSTEMD_CGROUP=", c->cgroup);
                         IOVEC_SET_STRING(iovec[n++], x);
 
-                        r = cg_path_get_session(c, &t);
-                        if (r >= 0) {
-                                session = strjoina("_SYSTEMD_SESSION=", t);
-                                free(t);
-                                IOVEC_SET_STRING(iovec[n++], session);
+                        if (c->session) {
+                                x = strjoina("_SYSTEMD_SESSION=", c->session);
+                                IOVEC_SET_STRING(iovec[n++], x);
                         }
 
-                        if (cg_path_get_owner_uid(c, &owner) >= 0) {
+                        if (c->owner_uid_valid) {
+                                owner = c->owner_uid;
                                 owner_valid = true;
 
                                 sprintf(owner_uid, "_SYSTEMD_OWNER_UID="UID_FMT, owner);
                                 IOVEC_SET_STRING(iovec[n++], owner_uid);
                         }
 
-                        if (cg_path_get_unit(c, &t) >= 0) {
-                                x = strjoina("_SYSTEMD_UNIT=", t);
-                                free(t);
+                        if (c->unit) {
+                                x = strjoina("_SYSTEMD_UNIT=", c->unit);
                                 IOVEC_SET_STRING(iovec[n++], x);
-                        } else if (unit_id && !session) {
+                        } else if (unit_id && !c->session) {
                                 x = strjoina("_SYSTEMD_UNIT=", unit_id);
                                 IOVEC_SET_STRING(iovec[n++], x);
                         }
 
-                        if (cg_path_get_user_unit(c, &t) >= 0) {
-                                x = strjoina("_SYSTEMD_USER_UNIT=", t);
-                                free(t);
+                        if (c->user_unit) {
+                                x = strjoina("_SYSTEMD_USER_UNIT=", c->user_unit);
                                 IOVEC_SET_STRING(iovec[n++], x);
-                        } else if (unit_id && session) {
+                        } else if (unit_id && c->session) {
                                 x = strjoina("_SYSTEMD_USER_UNIT=", unit_id);
                                 IOVEC_SET_STRING(iovec[n++], x);
                         }
 
-                        if (cg_path_get_slice(c, &t) >= 0) {
-                                x = strjoina("_SYSTEMD_SLICE=", t);
-                                free(t);
+                        if (c->slice) {
+                                x = strjoina("_SYSTEMD_SLICE=", c->slice);
                                 IOVEC_SET_STRING(iovec[n++], x);
                         }
-
-                        free(c);
                 } else if (unit_id) {
                         x = strjoina("_SYSTEMD_UNIT=", unit_id);
                         IOVEC_SET_STRING(iovec[n++], x);
@@ -690,99 +816,76 @@ static void dispatch_message_real(
 
                                 *((char*) mempcpy(stpcpy(x, "_SELINUX_CONTEXT="), label, label_len)) = 0;
                                 IOVEC_SET_STRING(iovec[n++], x);
-                        } else {
-                                security_context_t con;
-
-                                if (getpidcon(ucred->pid, &con) >= 0) {
-                                        x = strjoina("_SELINUX_CONTEXT=", con);
-
-                                        freecon(con);
-                                        IOVEC_SET_STRING(iovec[n++], x);
-                                }
+                        } else if (c && c->label) {
+                                x = strjoina("_SELINUX_CONTEXT=", c->label);
+                                IOVEC_SET_STRING(iovec[n++], x);
                         }
                 }
 #endif
         }
         assert(n <= m);
 
-        if (object_pid) {
-                r = get_process_uid(object_pid, &object_uid);
-                if (r >= 0) {
-                        sprintf(o_uid, "OBJECT_UID="UID_FMT, object_uid);
+        if (object_pid > 0 && client_context_get(s, object_pid, &o) >= 0) {
+                if (o->uid_valid) {
+                        sprintf(o_uid, "OBJECT_UID="UID_FMT, o->uid);
                         IOVEC_SET_STRING(iovec[n++], o_uid);
                 }
 
-                r = get_process_gid(object_pid, &object_gid);
-                if (r >= 0) {
-                        sprintf(o_gid, "OBJECT_GID="GID_FMT, object_gid);
+                if (o->gid_valid) {
+                        sprintf(o_gid, "OBJECT_GID="GID_FMT, o->gid);
                         IOVEC_SET_STRING(iovec[n++], o_gid);
                 }
 
-                r = get_process_comm(object_pid, &t);
-                if (r >= 0) {
-                        x = strjoina("OBJECT_COMM=", t);
-                        free(t);
+                if (o->comm) {
+                        x = strjoina("OBJECT_COMM=", o->comm);
                         IOVEC_SET_STRING(iovec[n++], x);
                 }
 
-                r = get_process_exe(object_pid, &t);
-                if (r >= 0) {
-                        x = strjoina("OBJECT_EXE=", t);
-                        free(t);
+                if (o->exe) {
+                        x = strjoina("OBJECT_EXE=", o->exe);
                         IOVEC_SET_STRING(iovec[n++], x);
                 }
 
-                r = get_process_cmdline(object_pid, 0, false, &t);
-                if (r >= 0) {
-                        x = strjoina("OBJECT_CMDLINE=", t);
-                        free(t);
+                if (o->cmdline) {
+                        x = strjoina("OBJECT_CMDLINE=", o->cmdline);
                         IOVEC_SET_STRING(iovec[n++], x);
                 }
 
 #ifdef HAVE_AUDIT
-                r = audit_session_from_pid(object_pid, &audit);
-                if (r >= 0) {
-                        sprintf(o_audit_session, "OBJECT_AUDIT_SESSION=%"PRIu32, audit);
+                if (o->audit_session_valid) {
+                        sprintf(o_audit_session, "OBJECT_AUDIT_SESSION=%"PRIu32, o->audit_session);
                         IOVEC_SET_STRING(iovec[n++], o_audit_session);
                 }
 
-                r = audit_loginuid_from_pid(object_pid, &loginuid);
-                if (r >= 0) {
-                        sprintf(o_audit_loginuid, "OBJECT_AUDIT_LOGINUID="UID_FMT, loginuid);
+                if (o->audit_loginuid_valid) {
+                        sprintf(o_audit_loginuid, "OBJECT_AUDIT_LOGINUID="UID_FMT, o->audit_loginuid);
                         IOVEC_SET_STRING(iovec[n++], o_audit_loginuid);
                 }
 #endif
 
-                r = cg_pid_get_path_shifted(object_pid, s->cgroup_root, &c);
-                if (r >= 0) {
-                        x = strjoina("OBJECT_SYSTEMD_CGROUP=", c);
+                if (o->cgroup) {
+                        x = strjoina("OBJECT_SYSTEMD_CGROUP=", o->cgroup);
                         IOVEC_SET_STRING(iovec[n++], x);
 
-                        r = cg_path_get_session(c, &t);
-                        if (r >= 0) {
-                                x = strjoina("OBJECT_SYSTEMD_SESSION=", t);
-                                free(t);
+                        if (o->session) {
+                                x = strjoina("OBJECT_SYSTEMD_SESSION=", o->session);
                                 IOVEC_SET_STRING(iovec[n++], x);
                         }
 
-                        if (cg_path_get_owner_uid(c, &owner) >= 0) {
-                                sprintf(o_owner_uid, "OBJECT_SYSTEMD_OWNER_UID="UID_FMT, owner);
+                        if (o->owner_uid_valid) {
+                                sprintf(o_owner_uid, "OBJECT_SYSTEMD_OWNER_UID="UID_FMT, o->owner_uid);
                                 IOVEC_SET_STRING(iovec[n++], o_owner_uid);
                         }
 
-                        if (cg_path_get_unit(c, &t) >= 0) {
-                                x = strjoina("OBJECT_SYSTEMD_UNIT=", t);
-                                free(t);
+                        if (o->unit) {
+                                x = strjoina("OBJECT_SYSTEMD_UNIT=", o->unit);
                                 IOVEC_SET_STRING(iovec[n++], x);
                         }
 
-                        if (cg_path_get_user_unit(c, &t) >= 0) {
-                                x = strjoina("OBJECT_SYSTEMD_USER_UNIT=", t);
-                                free(t);
+                        if (o->user_unit) {
+                                x = strjoina("OBJECT_SYSTEMD_USER_UNIT=", o->user_unit);
                                 IOVEC_SET_STRING(iovec[n++], x);
                         }
-
-                        free(c);
                 }
         }
         assert(n <= m);
@@ -842,6 +945,8 @@ void server_driver_message(Server *s, sd_id128_t message_id, const char *format,
         va_end(ap);
         IOVEC_SET_STRING(iovec[n++], buffer);
 
+        server_count_received(s, SERVER_SOURCE_DRIVER, strlen(buffer + 8));
+
         if (!sd_id128_equal(message_id, SD_ID128_NULL)) {
                 snprintf(mid, sizeof(mid), LOG_MESSAGE_ID(message_id));
                 IOVEC_SET_STRING(iovec[n++], mid);
@@ -854,6 +959,35 @@ void server_driver_message(Server *s, sd_id128_t message_id, const char *format,
         dispatch_message_real(s, iovec, n, ELEMENTSOF(iovec), &ucred, NULL, NULL, 0, NULL, LOG_INFO, 0);
 }
 
+static void count_rate_limited(Server *s, const char *path) {
+        unsigned n;
+        char *k;
+
+        assert(s);
+        assert(path);
+
+        s->stats.n_rate_limited++;
+
+        n = PTR_TO_UINT(hashmap_get(s->stats.rate_limited, path));
+        if (n > 0) {
+                (void) hashmap_update(s->stats.rate_limited, path, UINT_TO_PTR(n + 1));
+                return;
+        }
+
+        if (hashmap_size(s->stats.rate_limited) >= RATE_LIMITED_CGROUPS_MAX)
+                return;
+
+        if (hashmap_ensure_allocated(&s->stats.rate_limited, &string_hash_ops) < 0)
+                return;
+
+        k = strdup(path);
+        if (!k)
+                return;
+
+        if (hashmap_put(s->stats.rate_limited, k, UINT_TO_PTR(1)) < 0)
+                free(k);
+}
+
 void server_dispatch_message(
                 Server *s,
                 struct iovec *iovec, unsigned n, unsigned m,
@@ -908,8 +1042,10 @@ void server_dispatch_message(
         rl = journal_rate_limit_test(s->rate_limit, path,
                                      priority & LOG_PRIMASK, available_space(s, false));
 
-        if (rl == 0)
+        if (rl == 0) {
+                count_rate_limited(s, path);
                 return;
+        }
 
         /* Write a suppression message if we suppressed something */
         if (rl > 1)
@@ -953,9 +1089,10 @@ static int system_journal_open(Server *s, bool flush_requested) {
                 fn = strjoina(fn, "/system.journal");
                 r = journal_file_open_reliably(fn, O_RDWR|O_CREAT, 0640, s->compress, s->seal, &s->system_metrics, s->mmap, NULL, &s->system_journal);
 
-                if (r >= 0)
+                if (r >= 0) {
                         server_fix_perms(s, s->system_journal, 0);
-                else if (r < 0) {
+                        server_setup_post_change_timer(s, s->system_journal);
+                } else if (r < 0) {
                         if (r != -ENOENT && r != -EROFS)
                                 log_warning_errno(r, "Failed to open system journal: %m");
 
@@ -1002,8 +1139,10 @@ static int system_journal_open(Server *s, bool flush_requested) {
                                 return log_error_errno(r, "Failed to open runtime journal: %m");
                 }
 
-                if (s->runtime_journal)
+                if (s->runtime_journal) {
                         server_fix_perms(s, s->runtime_journal, 0);
+                        server_setup_post_change_timer(s, s->runtime_journal);
+                }
         }
 
         available_space(s, true);
@@ -1011,7 +1150,7 @@ static int system_journal_open(Server *s, bool flush_requested) {
         return r;
 }
 
-int server_flush_to_var(Server *s) {
+static int do_flush_to_var(Server *s) {
         sd_id128_t machine;
         sd_journal *j = NULL;
         char ts[FORMAT_TIMESPAN_MAX];
@@ -1104,78 +1243,50 @@ finish:
         return r;
 }
 
-int server_process_datagram(sd_event_source *es, int fd, uint32_t revents, void *userdata) {
-        Server *s = userdata;
-        struct ucred *ucred = NULL;
-        struct timeval *tv = NULL;
-        struct cmsghdr *cmsg;
-        char *label = NULL;
-        size_t label_len = 0, m;
-        struct iovec iovec;
-        ssize_t n;
-        int *fds = NULL, v = 0;
-        unsigned n_fds = 0;
-
-        union {
-                struct cmsghdr cmsghdr;
-
-                /* We use NAME_MAX space for the SELinux label
-                 * here. The kernel currently enforces no
-                 * limit, but according to suggestions from
-                 * the SELinux people this will change and it
-                 * will probably be identical to NAME_MAX. For
-                 * now we use that, but this should be updated
-                 * one day when the final limit is known. */
-                uint8_t buf[CMSG_SPACE(sizeof(struct ucred)) +
-                            CMSG_SPACE(sizeof(struct timeval)) +
-                            CMSG_SPACE(sizeof(int)) + /* fd */
-                            CMSG_SPACE(NAME_MAX)]; /* selinux label */
-        } control = {};
-
-        union sockaddr_union sa = {};
-
-        struct msghdr msghdr = {
-                .msg_iov = &iovec,
-                .msg_iovlen = 1,
-                .msg_control = &control,
-                .msg_controllen = sizeof(control),
-                .msg_name = &sa,
-                .msg_namelen = sizeof(sa),
-        };
+int server_flush_to_var(Server *s) {
+        int r;
 
         assert(s);
-        assert(fd == s->native_fd || fd == s->syslog_fd || fd == s->audit_fd);
 
-        if (revents != EPOLLIN) {
-                log_error("Got invalid event from epoll for datagram fd: %"PRIx32, revents);
-                return -EIO;
-        }
-
-        /* Try to get the right size, if we can. (Not all
-         * sockets support SIOCINQ, hence we just try, but
-         * don't rely on it. */
-        (void) ioctl(fd, SIOCINQ, &v);
+        writer_lock_journals(s->writer);
+        r = do_flush_to_var(s);
+        writer_unlock_journals(s->writer);
 
-        /* Fix it up, if it is too small. We use the same fixed value as auditd here. Awful! */
-        m = PAGE_ALIGN(MAX3((size_t) v + 1,
-                            (size_t) LINE_MAX,
-                            ALIGN(sizeof(struct nlmsghdr)) + ALIGN((size_t) MAX_AUDIT_MESSAGE_LENGTH)) + 1);
-
-        if (!GREEDY_REALLOC(s->buffer, s->buffer_size, m))
-                return log_oom();
-
-        iovec.iov_base = s->buffer;
-        iovec.iov_len = s->buffer_size - 1; /* Leave room for trailing NUL we add later */
+        return r;
+}
 
-        n = recvmsg(fd, &msghdr, MSG_DONTWAIT|MSG_CMSG_CLOEXEC);
-        if (n < 0) {
-                if (errno == EINTR || errno == EAGAIN)
-                        return 0;
+typedef union DatagramControl {
+        struct cmsghdr cmsghdr;
+
+        /* We use NAME_MAX space for the SELinux label
+         * here. The kernel currently enforces no
+         * limit, but according to suggestions from
+         * the SELinux people this will change and it
+         * will probably be identical to NAME_MAX. For
+         * now we use that, but this should be updated
+         * one day when the final limit is known. */
+        uint8_t buf[CMSG_SPACE(sizeof(struct ucred)) +
+                    CMSG_SPACE(sizeof(struct timeval)) +
+                    CMSG_SPACE(sizeof(int)) + /* fd */
+                    CMSG_SPACE(NAME_MAX)]; /* selinux label */
+} DatagramControl;
+
+static void server_process_datagram_one(
+                Server *s,
+                int fd,
+                struct msghdr *msghdr,
+                char *buffer,
+                size_t n) {
 
-                return log_error_errno(errno, "recvmsg() failed: %m");
-        }
+        struct ucred *ucred = NULL;
+        struct timeval *tv = NULL;
+        struct cmsghdr *cmsg;
+        char *label = NULL;
+        size_t label_len = 0;
+        int *fds = NULL;
+        unsigned n_fds = 0;
 
-        CMSG_FOREACH(cmsg, &msghdr) {
+        CMSG_FOREACH(cmsg, msghdr) {
 
                 if (cmsg->cmsg_level == SOL_SOCKET &&
                     cmsg->cmsg_type == SCM_CREDENTIALS &&
@@ -1197,17 +1308,22 @@ int server_process_datagram(sd_event_source *es, int fd, uint32_t revents, void
         }
 
         /* And a trailing NUL, just in case */
-        s->buffer[n] = 0;
+        buffer[n] = 0;
 
         if (fd == s->syslog_fd) {
+                /* A cut-off syslog line is still worth logging */
                 if (n > 0 && n_fds == 0)
-                        server_process_syslog_message(s, strstrip(s->buffer), ucred, tv, label, label_len);
+                        server_process_syslog_message(s, strstrip(buffer), ucred, tv, label, label_len);
                 else if (n_fds > 0)
                         log_warning("Got file descriptors via syslog socket. Ignoring.");
 
-        } else if (fd == s->native_fd) {
+        } else if (msghdr->msg_flags & MSG_TRUNC)
+                log_warning("Got truncated datagram of %zu bytes on %s socket. Ignoring.",
+                            n, fd == s->native_fd ? "native" : "audit");
+
+        else if (fd == s->native_fd) {
                 if (n > 0 && n_fds == 0)
-                        server_process_native_message(s, s->buffer, n, ucred, tv, label, label_len);
+                        server_process_native_message(s, buffer, n, ucred, tv, label, label_len);
                 else if (n == 0 && n_fds == 1)
                         server_process_native_file(s, fds[0], ucred, tv, label, label_len);
                 else if (n_fds > 0)
@@ -1217,12 +1333,78 @@ int server_process_datagram(sd_event_source *es, int fd, uint32_t revents, void
                 assert(fd == s->audit_fd);
 
                 if (n > 0 && n_fds == 0)
-                        server_process_audit_message(s, s->buffer, n, ucred, &sa, msghdr.msg_namelen);
+                        server_process_audit_message(s, buffer, n, ucred, msghdr->msg_name, msghdr->msg_namelen);
                 else if (n_fds > 0)
                         log_warning("Got file descriptors via audit socket. Ignoring.");
         }
 
         close_many(fds, n_fds);
+}
+
+int server_process_datagram(sd_event_source *es, int fd, uint32_t revents, void *userdata) {
+        Server *s = userdata;
+        DatagramControl control[DATAGRAM_BATCH_MAX] = {};
+        union sockaddr_union sa[DATAGRAM_BATCH_MAX] = {};
+        struct iovec iovec[DATAGRAM_BATCH_MAX];
+        struct mmsghdr msgs[DATAGRAM_BATCH_MAX];
+        size_t m;
+        unsigned n_slots, i;
+        int k, v = 0;
+
+        assert(s);
+        assert(fd == s->native_fd || fd == s->syslog_fd || fd == s->audit_fd);
+
+        if (revents != EPOLLIN) {
+                log_error("Got invalid event from epoll for datagram fd: %"PRIx32, revents);
+                return -EIO;
+        }
+
+        /* Try to get the right size, if we can. (Not all
+         * sockets support SIOCINQ, hence we just try, but
+         * don't rely on it. */
+        (void) ioctl(fd, SIOCINQ, &v);
+
+        /* Fix it up, if it is too small. We use the same fixed value as auditd here. Awful! */
+        m = PAGE_ALIGN(MAX3((size_t) v + 1,
+                            (size_t) DATAGRAM_SLOT_SIZE,
+                            ALIGN(sizeof(struct nlmsghdr)) + ALIGN((size_t) MAX_AUDIT_MESSAGE_LENGTH)) + 1);
+
+        /* SIOCINQ only tells us about the first datagram in the
+         * queue. If that one is unusually large we read it on its
+         * own, otherwise we drain as many as fit into the slots of
+         * the preallocated buffer in a single call. */
+        n_slots = m > DATAGRAM_SLOT_SIZE_MAX ? 1 : DATAGRAM_BATCH_MAX;
+
+        if (!GREEDY_REALLOC(s->buffer, s->buffer_size, m * n_slots))
+                return log_oom();
+
+        for (i = 0; i < n_slots; i++) {
+                iovec[i] = (struct iovec) {
+                        .iov_base = s->buffer + i * m,
+                        .iov_len = m - 1, /* Leave room for trailing NUL we add later */
+                };
+
+                msgs[i] = (struct mmsghdr) {
+                        .msg_hdr.msg_iov = iovec + i,
+                        .msg_hdr.msg_iovlen = 1,
+                        .msg_hdr.msg_control = control + i,
+                        .msg_hdr.msg_controllen = sizeof(control[i]),
+                        .msg_hdr.msg_name = sa + i,
+                        .msg_hdr.msg_namelen = sizeof(sa[i]),
+                };
+        }
+
+        k = recvmmsg(fd, msgs, n_slots, MSG_DONTWAIT|MSG_CMSG_CLOEXEC, NULL);
+        if (k < 0) {
+                if (errno == EINTR || errno == EAGAIN)
+                        return 0;
+
+                return log_error_errno(errno, "recvmmsg() failed: %m");
+        }
+
+        for (i = 0; i < (unsigned) k; i++)
+                server_process_datagram_one(s, fd, &msgs[i].msg_hdr, s->buffer + i * m, MIN((size_t) msgs[i].msg_len, m - 1));
+
         return 0;
 }
 
@@ -1254,6 +1436,154 @@ static int dispatch_sigusr2(sd_event_source *es, const struct signalfd_siginfo *
         return 0;
 }
 
+void server_count_received(Server *s, ServerSource source, size_t size) {
+        assert(s);
+        assert(source >= 0);
+        assert(source < _SERVER_SOURCE_MAX);
+
+        s->stats.n_received[source]++;
+        s->stats.n_received_bytes[source] += size;
+}
+
+static void timing_statistics_dump(FILE *f, const char *name, const TimingStatistics *t) {
+        bool first = true;
+        unsigned b;
+
+        fprintf(f,
+                "%sCount=%"PRIu64"\n"
+                "%sTotalUSec=%"PRIu64"\n"
+                "%sMaxUSec=%"PRIu64"\n",
+                name, t->count,
+                name, t->total_usec,
+                name, t->max_usec);
+
+        /* Only list the buckets that saw anything, as upper bound
+         * in us and count, the last one is open */
+        fprintf(f, "%sHistogram=", name);
+        for (b = 0; b < TIMING_HISTOGRAM_BUCKETS; b++) {
+                if (t->buckets[b] <= 0)
+                        continue;
+
+                if (!first)
+                        fputc(' ', f);
+                first = false;
+
+                if (b == TIMING_HISTOGRAM_BUCKETS - 1)
+                        fprintf(f, "inf:%"PRIu64, t->buckets[b]);
+                else
+                        fprintf(f, "%"PRIu64":%"PRIu64, UINT64_C(1) << b, t->buckets[b]);
+        }
+        fputc('\n', f);
+}
+
+static void socket_queue_dump(FILE *f, const char *name, int fd) {
+        uint32_t meminfo[SK_MEMINFO_VARS] = {};
+        socklen_t l = sizeof(meminfo);
+
+        if (fd < 0)
+                return;
+
+        /* SIOCINQ only covers the first datagram, hence ask for the
+         * memory used by everything queued instead */
+        if (getsockopt(fd, SOL_SOCKET, SO_MEMINFO, meminfo, &l) < 0)
+                return;
+
+        fprintf(f,
+                "%sQueueBytes=%"PRIu32"\n"
+                "%sQueueDrops=%"PRIu32"\n",
+                name, meminfo[SK_MEMINFO_RMEM_ALLOC],
+                name, meminfo[SK_MEMINFO_DROPS]);
+}
+
+int server_write_statistics(Server *s) {
+        _cleanup_free_ char *temp_path = NULL;
+        _cleanup_fclose_ FILE *f = NULL;
+        uint64_t total = 0;
+        usec_t n, since;
+        ServerSource source;
+        Iterator i;
+        const char *path;
+        void *v;
+        int r;
+
+        assert(s);
+
+        for (source = 0; source < _SERVER_SOURCE_MAX; source++)
+                total += s->stats.n_received[source];
+
+        n = now(CLOCK_MONOTONIC);
+        since = s->stats.last_dump_usec > 0 ? s->stats.last_dump_usec : s->stats.start_usec;
+
+        r = fopen_temporary("/run/systemd/journal/statistics", &f, &temp_path);
+        if (r < 0)
+                goto fail;
+
+        fprintf(f,
+                "UptimeUSec="USEC_FMT"\n"
+                "Received=%"PRIu64"\n"
+                "ReceivedPerSecond=%"PRIu64"\n",
+                n - s->stats.start_usec,
+                total,
+                n > since ? (total - s->stats.last_dump_received) * USEC_PER_SEC / (n - since) : 0);
+
+        for (source = 0; source < _SERVER_SOURCE_MAX; source++) {
+                const char *name = server_source_to_string(source);
+
+                fprintf(f,
+                        "Received.%s=%"PRIu64"\n"
+                        "ReceivedBytes.%s=%"PRIu64"\n",
+                        name, s->stats.n_received[source],
+                        name, s->stats.n_received_bytes[source]);
+        }
+
+        fprintf(f, "RateLimited=%"PRIu64"\n", s->stats.n_rate_limited);
+        HASHMAP_FOREACH_KEY(v, path, s->stats.rate_limited, i)
+                fprintf(f, "RateLimited.%s=%u\n", path, PTR_TO_UINT(v));
+
+        fprintf(f, "ForwardSyslogMissed=%u\n", s->n_forward_syslog_missed);
+
+        timing_statistics_dump(f, "Write", &s->stats.write);
+        timing_statistics_dump(f, "Sync", &s->stats.sync);
+        timing_statistics_dump(f, "Rotate", &s->stats.rotate);
+
+        socket_queue_dump(f, "Native", s->native_fd);
+        socket_queue_dump(f, "Syslog", s->syslog_fd);
+        socket_queue_dump(f, "Audit", s->audit_fd);
+        fprintf(f, "StdoutStreams=%u\n", s->n_stdout_streams);
+
+        r = fflush_and_check(f);
+        if (r < 0)
+                goto fail;
+
+        if (rename(temp_path, "/run/systemd/journal/statistics") < 0) {
+                r = -errno;
+                goto fail;
+        }
+
+        s->stats.last_dump_usec = n;
+        s->stats.last_dump_received = total;
+
+        return 0;
+
+fail:
+        if (temp_path)
+                (void) unlink(temp_path);
+
+        return log_error_errno(r, "Failed to write statistics: %m");
+}
+
+static int dispatch_sigrtmin1(sd_event_source *es, const struct signalfd_siginfo *si, void *userdata) {
+        Server *s = userdata;
+
+        assert(s);
+
+        log_debug("Received request to dump statistics from PID %"PRIu32, si->ssi_pid);
+
+        (void) server_write_statistics(s);
+
+        return 0;
+}
+
 static int dispatch_sigterm(sd_event_source *es, const struct signalfd_siginfo *si, void *userdata) {
         Server *s = userdata;
 
@@ -1270,7 +1600,7 @@ static int setup_signals(Server *s) {
 
         assert(s);
 
-        assert(sigprocmask_many(SIG_SETMASK, NULL, SIGINT, SIGTERM, SIGUSR1, SIGUSR2, -1) >= 0);
+        assert(sigprocmask_many(SIG_SETMASK, NULL, SIGINT, SIGTERM, SIGUSR1, SIGUSR2, SIGRTMIN+1, -1) >= 0);
 
         r = sd_event_add_signal(s->event, &s->sigusr1_event_source, SIGUSR1, dispatch_sigusr1, s);
         if (r < 0)
@@ -1288,6 +1618,10 @@ static int setup_signals(Server *s) {
         if (r < 0)
                 return r;
 
+        r = sd_event_add_signal(s->event, &s->sigrtmin1_event_source, SIGRTMIN+1, dispatch_sigrtmin1, s);
+        if (r < 0)
+                return r;
+
         return 0;
 }
 
@@ -1411,6 +1745,48 @@ int server_schedule_sync(Server *s, int priority) {
         return 0;
 }
 
+void server_flush_forward(Server *s) {
+        assert(s);
+
+        server_flush_forward_syslog(s);
+        server_flush_forward_console(s);
+}
+
+static int dispatch_forward(sd_event_source *es, void *userdata) {
+        Server *s = userdata;
+
+        assert(s);
+
+        server_flush_forward(s);
+        return 0;
+}
+
+void server_schedule_forward(Server *s) {
+        int r;
+
+        assert(s);
+
+        if (!s->forward_event_source) {
+                r = sd_event_add_defer(s->event, &s->forward_event_source, dispatch_forward, s);
+                if (r < 0)
+                        goto fail;
+
+                /* Run only after all sockets and streams have been
+                 * drained, so that a burst is forwarded in one go */
+                r = sd_event_source_set_priority(s->forward_event_source, SD_EVENT_PRIORITY_NORMAL+20);
+                if (r < 0)
+                        goto fail;
+        }
+
+        r = sd_event_source_set_enabled(s->forward_event_source, SD_EVENT_ONESHOT);
+        if (r >= 0)
+                return;
+
+fail:
+        log_debug_errno(r, "Failed to schedule forwarding, forwarding right away: %m");
+        server_flush_forward(s);
+}
+
 static int dispatch_hostname_change(sd_event_source *es, int fd, uint32_t revents, void *userdata) {
         Server *s = userdata;
 
@@ -1457,6 +1833,7 @@ int server_init(Server *s) {
         assert(s);
 
         zero(*s);
+        s->stats.start_usec = now(CLOCK_MONOTONIC);
         s->syslog_fd = s->native_fd = s->stdout_fd = s->dev_kmsg_fd = s->audit_fd = s->hostname_fd = -1;
         s->compress = true;
         s->seal = true;
@@ -1466,11 +1843,14 @@ int server_init(Server *s) {
 
         s->rate_limit_interval = DEFAULT_RATE_LIMIT_INTERVAL;
         s->rate_limit_burst = DEFAULT_RATE_LIMIT_BURST;
+        s->rate_limit_groups_max = DEFAULT_RATE_LIMIT_GROUPS_MAX;
 
         s->forward_to_wall = true;
 
         s->max_file_usec = DEFAULT_MAX_FILE_USEC;
 
+        s->line_max = DEFAULT_LINE_MAX;
+
         s->max_level_store = LOG_DEBUG;
         s->max_level_syslog = LOG_DEBUG;
         s->max_level_kmsg = LOG_NOTICE;
@@ -1488,6 +1868,16 @@ int server_init(Server *s) {
                 s->rate_limit_interval = s->rate_limit_burst = 0;
         }
 
+        if (s->rate_limit_groups_max == 0) {
+                log_debug("Raising rate limit group limit from 0 to 1");
+                s->rate_limit_groups_max = 1;
+        }
+
+        if (s->line_max < MIN_LINE_MAX) {
+                log_debug("Raising line length limit from %zu to %i", s->line_max, MIN_LINE_MAX);
+                s->line_max = MIN_LINE_MAX;
+        }
+
         mkdir_p("/run/systemd/journal", 0755);
 
         s->user_journals = ordered_hashmap_new(NULL);
@@ -1602,7 +1992,11 @@ int server_init(Server *s) {
         if (!s->udev)
                 return -ENOMEM;
 
-        s->rate_limit = journal_rate_limit_new(s->rate_limit_interval, s->rate_limit_burst);
+        r = server_open_kernel_device_monitor(s);
+        if (r < 0)
+                return r;
+
+        s->rate_limit = journal_rate_limit_new(s->rate_limit_interval, s->rate_limit_burst, s->rate_limit_groups_max);
         if (!s->rate_limit)
                 return -ENOMEM;
 
@@ -1618,6 +2012,12 @@ int server_init(Server *s) {
         if (r < 0)
                 return r;
 
+        if (s->write_thread) {
+                r = writer_new(s, &s->writer);
+                if (r < 0)
+                        log_warning_errno(r, "Failed to start journal writer thread, writing synchronously: %m");
+        }
+
         return 0;
 }
 
@@ -1627,13 +2027,26 @@ void server_maybe_append_tags(Server *s) {
         Iterator i;
         usec_t n;
 
+        /* The writer thread does this after each batch anyway, so
+         * don't wait for it if it is busy */
+        if (!writer_trylock_journals(s->writer))
+                return;
+
         n = now(CLOCK_REALTIME);
 
-        if (s->system_journal)
+        /* Also get the next epoch's key ready, so that the append
+         * path doesn't have to compute it when the epoch changes */
+        if (s->system_journal) {
                 journal_file_maybe_append_tag(s->system_journal, n);
+                journal_file_fsprg_prepare(s->system_journal);
+        }
 
-        ORDERED_HASHMAP_FOREACH(f, s->user_journals, i)
+        ORDERED_HASHMAP_FOREACH(f, s->user_journals, i) {
                 journal_file_maybe_append_tag(f, n);
+                journal_file_fsprg_prepare(f);
+        }
+
+        writer_unlock_journals(s->writer);
 #endif
 }
 
@@ -1641,6 +2054,9 @@ void server_done(Server *s) {
         JournalFile *f;
         assert(s);
 
+        /* Write out what is still queued before closing the files */
+        s->writer = writer_free(s->writer);
+
         while (s->stdout_streams)
                 stdout_stream_free(s->stdout_streams);
 
@@ -1655,6 +2071,15 @@ void server_done(Server *s) {
 
         ordered_hashmap_free(s->user_journals);
 
+        vacuum_index_free(s->system_vacuum_index);
+        vacuum_index_free(s->runtime_vacuum_index);
+
+        client_context_flush_all(s);
+
+        server_flush_forward(s);
+        free(s->forward_syslog_buffer);
+        free(s->forward_console_buffer);
+
         sd_event_source_unref(s->syslog_event_source);
         sd_event_source_unref(s->native_event_source);
         sd_event_source_unref(s->stdout_event_source);
@@ -1665,7 +2090,10 @@ void server_done(Server *s) {
         sd_event_source_unref(s->sigusr2_event_source);
         sd_event_source_unref(s->sigterm_event_source);
         sd_event_source_unref(s->sigint_event_source);
+        sd_event_source_unref(s->sigrtmin1_event_source);
         sd_event_source_unref(s->hostname_event_source);
+        sd_event_source_unref(s->udev_monitor_event_source);
+        sd_event_source_unref(s->forward_event_source);
         sd_event_unref(s->event);
 
         safe_close(s->syslog_fd);
@@ -1689,5 +2117,11 @@ void server_done(Server *s) {
         if (s->mmap)
                 mmap_cache_unref(s->mmap);
 
+        server_flush_kernel_devices(s);
+        ordered_hashmap_free(s->kernel_devices);
+
+        udev_monitor_unref(s->udev_monitor);
         udev_unref(s->udev);
+
+        hashmap_free_free(s->stats.rate_limited);
 }
@@ -23,9 +23,11 @@
 
 #include <stdbool.h>
 #include <sys/types.h>
+#include <sys/socket.h>
 
 #include "sd-event.h"
 #include "journal-file.h"
+#include "journal-vacuum.h"
 #include "hashmap.h"
 #include "audit.h"
 #include "journald-rate-limit.h"
@@ -48,7 +50,63 @@ typedef enum SplitMode {
         _SPLIT_INVALID = -1
 } SplitMode;
 
+typedef enum ServerSource {
+        SERVER_SOURCE_NATIVE,
+        SERVER_SOURCE_SYSLOG,
+        SERVER_SOURCE_STDOUT,
+        SERVER_SOURCE_KMSG,
+        SERVER_SOURCE_AUDIT,
+        SERVER_SOURCE_DRIVER,
+        _SERVER_SOURCE_MAX,
+        _SERVER_SOURCE_INVALID = -1
+} ServerSource;
+
+/* Bucket i counts operations that took less than 2^i us, the last one
+ * also everything slower than that */
+#define TIMING_HISTOGRAM_BUCKETS 24
+
+typedef struct TimingStatistics {
+        uint64_t count;
+        uint64_t total_usec;
+        uint64_t max_usec;
+        uint64_t buckets[TIMING_HISTOGRAM_BUCKETS];
+} TimingStatistics;
+
+typedef struct ServerStatistics {
+        usec_t start_usec;
+
+        uint64_t n_received[_SERVER_SOURCE_MAX];
+        uint64_t n_received_bytes[_SERVER_SOURCE_MAX];
+
+        /* Messages dropped by the rate limiter, in total and per
+         * cgroup path */
+        uint64_t n_rate_limited;
+        Hashmap *rate_limited;
+
+        /* The write and sync timings are also updated from the
+         * writer thread, hence only touch them atomically */
+        TimingStatistics write;
+        TimingStatistics sync;
+        TimingStatistics rotate;
+
+        usec_t last_dump_usec;
+        uint64_t last_dump_received;
+} ServerStatistics;
+
 typedef struct StdoutStream StdoutStream;
+typedef struct Writer Writer;
+
+/* Forwarded messages are queued and written out in batches once the
+ * sockets have been drained, or when the queue is full */
+#define FORWARD_QUEUE_MAX 64U
+#define FORWARD_QUEUE_BYTES_MAX (256U*1024U)
+
+typedef struct ForwardSyslogMessage {
+        size_t offset;
+        size_t length;
+        struct ucred ucred;
+        bool ucred_valid;
+} ForwardSyslogMessage;
 
 typedef struct Server {
         int syslog_fd;
@@ -71,6 +129,7 @@ typedef struct Server {
         sd_event_source *sigterm_event_source;
         sd_event_source *sigint_event_source;
         sd_event_source *hostname_event_source;
+        sd_event_source *sigrtmin1_event_source;
 
         JournalFile *runtime_journal;
         JournalFile *system_journal;
@@ -85,12 +144,21 @@ typedef struct Server {
         usec_t sync_interval_usec;
         usec_t rate_limit_interval;
         unsigned rate_limit_burst;
+        unsigned rate_limit_groups_max;
 
         JournalMetrics runtime_metrics;
         JournalMetrics system_metrics;
 
+        VacuumIndex *runtime_vacuum_index;
+        VacuumIndex *system_vacuum_index;
+
+        OrderedHashmap *client_contexts;
+
+        Writer *writer;
+
         bool compress;
         bool seal;
+        bool write_thread;
 
         bool forward_to_kmsg;
         bool forward_to_syslog;
@@ -100,6 +168,19 @@ typedef struct Server {
         unsigned n_forward_syslog_missed;
         usec_t last_warn_forward_syslog_missed;
 
+        sd_event_source *forward_event_source;
+
+        ForwardSyslogMessage forward_syslog_queue[FORWARD_QUEUE_MAX];
+        unsigned n_forward_syslog_queue;
+        char *forward_syslog_buffer;
+        size_t forward_syslog_buffer_allocated;
+        size_t forward_syslog_buffer_used;
+
+        char *forward_console_buffer;
+        size_t forward_console_buffer_allocated;
+        size_t forward_console_buffer_used;
+        unsigned n_forward_console_queue;
+
         uint64_t cached_available_space;
         usec_t cached_available_space_timestamp;
 
@@ -111,9 +192,12 @@ typedef struct Server {
 
         LIST_HEAD(StdoutStream, stdout_streams);
         unsigned n_stdout_streams;
+        size_t stdout_streams_memory;
 
         char *tty_path;
 
+        size_t line_max;
+
         int max_level_store;
         int max_level_syslog;
         int max_level_kmsg;
@@ -130,6 +214,11 @@ typedef struct Server {
         uint64_t *kernel_seqnum;
 
         struct udev *udev;
+        struct udev_monitor *udev_monitor;
+        sd_event_source *udev_monitor_event_source;
+
+        /* udev metadata of kernel devices referenced by kmsg records */
+        OrderedHashmap *kernel_devices;
 
         bool sync_scheduled;
 
@@ -137,6 +226,8 @@ typedef struct Server {
         char boot_id_field[sizeof("_BOOT_ID=") + 32];
         char *hostname_field;
 
+        ServerStatistics stats;
+
         /* Cached cgroup root, so that we don't have to query that all the time */
         char *cgroup_root;
 } Server;
@@ -162,13 +253,21 @@ int config_parse_split_mode(const char *unit, const char *filename, unsigned lin
 const char *split_mode_to_string(SplitMode s) _const_;
 SplitMode split_mode_from_string(const char *s) _pure_;
 
+const char *server_source_to_string(ServerSource s) _const_;
+ServerSource server_source_from_string(const char *s) _pure_;
+
 void server_fix_perms(Server *s, JournalFile *f, uid_t uid);
 int server_init(Server *s);
 void server_done(Server *s);
+int server_write_entry(Server *s, uid_t uid, struct iovec *iovec, unsigned n);
 void server_sync(Server *s);
 void server_vacuum(Server *s);
 void server_rotate(Server *s);
 int server_schedule_sync(Server *s, int priority);
+void server_schedule_forward(Server *s);
+void server_flush_forward(Server *s);
 int server_flush_to_var(Server *s);
 void server_maybe_append_tags(Server *s);
+void server_count_received(Server *s, ServerSource source, size_t size);
+int server_write_statistics(Server *s);
 int server_process_datagram(sd_event_source *es, int fd, uint32_t revents, void *userdata);
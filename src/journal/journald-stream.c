@@ -39,7 +39,15 @@
 #include "journald-console.h"
 #include "journald-wall.h"
 
-#define STDOUT_STREAMS_MAX 4096
+/* The memory all stdout streams may use together, counting both the
+ * stream objects and their line buffers. Idle streams hold no line
+ * buffer, hence this permits many tens of thousands of connections. */
+#define STDOUT_STREAMS_MEMORY_MAX (128U*1024U*1024U)
+
+/* We keep this much room in front of the stream buffer, so that the
+ * MESSAGE= prefix can be written right before each line without
+ * copying it */
+#define STDOUT_STREAM_HEADROOM (sizeof("MESSAGE=")-1)
 
 typedef enum StdoutStreamState {
         STDOUT_STREAM_IDENTIFIER,
@@ -70,7 +78,12 @@ struct StdoutStream {
 
         bool fdstore:1;
 
-        char buffer[LINE_MAX+1];
+        /* Unparsed data lives at buffer + STDOUT_STREAM_HEADROOM + offset,
+         * and is length bytes long. The buffer grows on demand up to
+         * the configured line length. */
+        char *buffer;
+        size_t allocated;
+        size_t offset;
         size_t length;
 
         sd_event_source *event_source;
@@ -88,6 +101,9 @@ void stdout_stream_free(StdoutStream *s) {
                 assert(s->server->n_stdout_streams > 0);
                 s->server->n_stdout_streams --;
                 LIST_REMOVE(stdout_stream, s->server->stdout_streams, s);
+
+                assert(s->server->stdout_streams_memory >= sizeof(StdoutStream) + s->allocated);
+                s->server->stdout_streams_memory -= sizeof(StdoutStream) + s->allocated;
         }
 
         if (s->event_source) {
@@ -100,6 +116,7 @@ void stdout_stream_free(StdoutStream *s) {
         free(s->identifier);
         free(s->unit_id);
         free(s->state_file);
+        free(s->buffer);
 
         free(s);
 }
@@ -208,12 +225,13 @@ fail:
         return log_error_errno(r, "Failed to save stream data %s: %m", s->state_file);
 }
 
-static int stdout_stream_log(StdoutStream *s, const char *p) {
+static int stdout_stream_log(StdoutStream *s, char *p) {
         struct iovec iovec[N_IOVEC_META_FIELDS + 5];
         int priority;
         char syslog_priority[] = "PRIORITY=\0";
         char syslog_facility[sizeof("SYSLOG_FACILITY=")-1 + DECIMAL_STR_MAX(int) + 1];
-        _cleanup_free_ char *message = NULL, *syslog_identifier = NULL;
+        _cleanup_free_ char *syslog_identifier = NULL;
+        char *message;
         unsigned n = 0;
         size_t label_len;
 
@@ -223,10 +241,12 @@ static int stdout_stream_log(StdoutStream *s, const char *p) {
         if (isempty(p))
                 return 0;
 
+        server_count_received(s->server, SERVER_SOURCE_STDOUT, strlen(p));
+
         priority = s->priority;
 
         if (s->level_prefix)
-                syslog_parse_priority(&p, &priority, false);
+                syslog_parse_priority((const char**) &p, &priority, false);
 
         if (s->forward_to_syslog || s->server->forward_to_syslog)
                 server_forward_syslog(s->server, syslog_fixup_facility(priority), s->identifier, p, &s->ucred, NULL);
@@ -256,9 +276,12 @@ static int stdout_stream_log(StdoutStream *s, const char *p) {
                         IOVEC_SET_STRING(iovec[n++], syslog_identifier);
         }
 
-        message = strappend("MESSAGE=", p);
-        if (message)
-                IOVEC_SET_STRING(iovec[n++], message);
+        /* Everything in front of the line has been consumed
+         * already, hence we can overwrite it with the field name */
+        message = p - strlen("MESSAGE=");
+        assert(message >= s->buffer);
+        memcpy(message, "MESSAGE=", strlen("MESSAGE="));
+        IOVEC_SET_STRING(iovec[n++], message);
 
         label_len = s->label ? strlen(s->label) : 0;
         server_dispatch_message(s->server, iovec, n, ELEMENTSOF(iovec), &s->ucred, NULL, s->label, label_len, s->unit_id, priority, 0);
@@ -365,14 +388,29 @@ static int stdout_stream_line(StdoutStream *s, char *p) {
         assert_not_reached("Unknown stream state");
 }
 
+static char *stdout_stream_data(StdoutStream *s) {
+        return s->buffer + STDOUT_STREAM_HEADROOM;
+}
+
+static size_t stdout_stream_capacity(StdoutStream *s) {
+        size_t n;
+
+        /* Room for data, not counting headroom and the trailing NUL */
+        n = s->allocated > STDOUT_STREAM_HEADROOM + 1 ? s->allocated - STDOUT_STREAM_HEADROOM - 1 : 0;
+
+        return MIN(n, s->server->line_max);
+}
+
 static int stdout_stream_scan(StdoutStream *s, bool force_flush) {
+        size_t remaining, line_max;
         char *p;
-        size_t remaining;
         int r;
 
         assert(s);
 
-        p = s->buffer;
+        line_max = s->server->line_max;
+
+        p = stdout_stream_data(s) + s->offset;
         remaining = s->length;
         for (;;) {
                 char *end;
@@ -381,8 +419,11 @@ static int stdout_stream_scan(StdoutStream *s, bool force_flush) {
                 end = memchr(p, '\n', remaining);
                 if (end)
                         skip = end - p + 1;
-                else if (remaining >= sizeof(s->buffer) - 1) {
-                        end = p + sizeof(s->buffer) - 1;
+                else if (remaining >= line_max) {
+                        /* The buffer never holds more than a line
+                         * worth of data, hence there's always room
+                         * for the NUL byte here */
+                        end = p + remaining;
                         skip = remaining;
                 } else
                         break;
@@ -407,16 +448,77 @@ static int stdout_stream_scan(StdoutStream *s, bool force_flush) {
                 remaining = 0;
         }
 
-        if (p > s->buffer) {
-                memmove(s->buffer, p, remaining);
-                s->length = remaining;
+        /* Lines are parsed in place, we only remember where the
+         * unparsed rest starts and move it to the front when we run
+         * out of room at the end */
+        s->offset = remaining > 0 ? (size_t) (p - stdout_stream_data(s)) : 0;
+        s->length = remaining;
+
+        return 0;
+}
+
+static bool stdout_streams_memory_available(Server *s, size_t n) {
+        assert(s);
+
+        return s->stdout_streams_memory <= STDOUT_STREAMS_MEMORY_MAX &&
+                n <= STDOUT_STREAMS_MEMORY_MAX - s->stdout_streams_memory;
+}
+
+static void stdout_stream_release_buffer(StdoutStream *s) {
+        assert(s);
+        assert(s->length == 0);
+
+        s->buffer = mfree(s->buffer);
+        s->server->stdout_streams_memory -= s->allocated;
+        s->allocated = 0;
+        s->offset = 0;
+}
+
+static int stdout_stream_make_room(StdoutStream *s) {
+        size_t capacity, wanted, n;
+        char *b;
+
+        assert(s);
+
+        capacity = stdout_stream_capacity(s);
+
+        /* Only move the unparsed rest to the front if there's little
+         * room left behind it, so that this happens rarely */
+        if (s->offset > 0 && capacity - s->offset - s->length < capacity / 4) {
+                memmove(stdout_stream_data(s), stdout_stream_data(s) + s->offset, s->length);
+                s->offset = 0;
+                return 0;
+        }
+
+        if (s->offset + s->length < capacity)
+                return 0;
+
+        /* Start out small, and double until we reach the line length */
+        wanted = MIN(MAX(capacity * 2, (size_t) LINE_MAX), s->server->line_max);
+        assert(wanted > s->length);
+
+        n = STDOUT_STREAM_HEADROOM + wanted + 1;
+        if (!stdout_streams_memory_available(s->server, n - s->allocated)) {
+                /* No memory left to grow the buffer, hence cut the
+                 * line off at what we have so far */
+                log_debug("Stream memory limit reached, flushing incomplete line.");
+                return stdout_stream_scan(s, true);
         }
 
+        b = realloc(s->buffer, n);
+        if (!b)
+                return log_oom();
+
+        s->server->stdout_streams_memory += n - s->allocated;
+        s->buffer = b;
+        s->allocated = n;
+
         return 0;
 }
 
 static int stdout_stream_process(sd_event_source *es, int fd, uint32_t revents, void *userdata) {
         StdoutStream *s = userdata;
+        size_t room;
         ssize_t l;
         int r;
 
@@ -427,7 +529,13 @@ static int stdout_stream_process(sd_event_source *es, int fd, uint32_t revents,
                 goto terminate;
         }
 
-        l = read(s->fd, s->buffer+s->length, sizeof(s->buffer)-1-s->length);
+        r = stdout_stream_make_room(s);
+        if (r < 0)
+                goto terminate;
+
+        room = stdout_stream_capacity(s) - s->offset - s->length;
+
+        l = read(s->fd, stdout_stream_data(s) + s->offset + s->length, room);
         if (l < 0) {
 
                 if (errno == EAGAIN)
@@ -447,6 +555,12 @@ static int stdout_stream_process(sd_event_source *es, int fd, uint32_t revents,
         if (r < 0)
                 goto terminate;
 
+        /* If we consumed everything and the read did not fill the
+         * buffer, the stream is likely idle now. Drop the buffer so
+         * that idle streams cost no more than the stream object. */
+        if (s->length == 0 && (size_t) l < room)
+                stdout_stream_release_buffer(s);
+
         return 1;
 
 terminate:
@@ -493,6 +607,7 @@ static int stdout_stream_install(Server *s, int fd, StdoutStream **ret) {
         stream->server = s;
         LIST_PREPEND(stdout_stream, s->stdout_streams, stream);
         s->n_stdout_streams ++;
+        s->stdout_streams_memory += sizeof(StdoutStream);
 
         if (ret)
                 *ret = stream;
@@ -523,8 +638,9 @@ static int stdout_stream_new(sd_event_source *es, int listen_fd, uint32_t revent
                 return -errno;
         }
 
-        if (s->n_stdout_streams >= STDOUT_STREAMS_MAX) {
-                log_warning("Too many stdout streams, refusing connection.");
+        if (!stdout_streams_memory_available(s, sizeof(StdoutStream) + LINE_MAX)) {
+                log_warning("Too many stdout streams (%u, using %zu bytes), refusing connection.",
+                            s->n_stdout_streams, s->stdout_streams_memory);
                 return 0;
         }
 
@@ -609,8 +725,9 @@ static int stdout_stream_restore(Server *s, const char *fname, int fd) {
         assert(fname);
         assert(fd >= 0);
 
-        if (s->n_stdout_streams >= STDOUT_STREAMS_MAX) {
-                log_warning("Too many stdout streams, refusing restoring of stream.");
+        if (!stdout_streams_memory_available(s, sizeof(StdoutStream) + LINE_MAX)) {
+                log_warning("Too many stdout streams (%u, using %zu bytes), refusing restoring of stream.",
+                            s->n_stdout_streams, s->stdout_streams_memory);
                 return -ENOBUFS;
         }
 
@@ -37,78 +37,146 @@
 /* Warn once every 30s if we missed syslog message */
 #define WARN_FORWARD_SYSLOG_MISSED_USEC (30 * USEC_PER_SEC)
 
-static void forward_syslog_iovec(Server *s, const struct iovec *iovec, unsigned n_iovec, const struct ucred *ucred, const struct timeval *tv) {
+static int forward_syslog_send(Server *s, struct mmsghdr *mh, unsigned n) {
+        unsigned i = 0;
+        int r;
+
+        while (i < n) {
+                struct cmsghdr *cmsg;
+                struct ucred u;
+
+                r = sendmmsg(s->syslog_fd, mh + i, n - i, MSG_NOSIGNAL);
+                if (r > 0) {
+                        i += r;
+                        continue;
+                }
+
+                /* The socket is full? I guess the syslog
+                 * implementation is too slow, and we shouldn't wait
+                 * for that... */
+                if (errno == EAGAIN) {
+                        s->n_forward_syslog_missed += n - i;
+                        return 0;
+                }
+
+                /* Nobody listening, no point in trying the rest */
+                if (errno == ENOENT)
+                        return 0;
+
+                cmsg = CMSG_FIRSTHDR(&mh[i].msg_hdr);
+                if (cmsg && (errno == ESRCH || errno == EPERM)) {
+                        memcpy(&u, CMSG_DATA(cmsg), sizeof(struct ucred));
+
+                        /* Hmm, presumably the sender process vanished
+                         * by now, or we don't have CAP_SYS_AMDIN, so
+                         * let's fix it as good as we can, and retry */
+                        if (u.pid != getpid()) {
+                                u.pid = getpid();
+                                memcpy(CMSG_DATA(cmsg), &u, sizeof(struct ucred));
+                                continue;
+                        }
+                }
+
+                log_debug_errno(errno, "Failed to forward syslog message: %m");
+                i++;
+        }
+
+        return 0;
+}
+
+void server_flush_forward_syslog(Server *s) {
 
         static const union sockaddr_union sa = {
                 .un.sun_family = AF_UNIX,
                 .un.sun_path = "/run/systemd/journal/syslog",
         };
-        struct msghdr msghdr = {
-                .msg_iov = (struct iovec *) iovec,
-                .msg_iovlen = n_iovec,
-                .msg_name = (struct sockaddr*) &sa.sa,
-                .msg_namelen = offsetof(union sockaddr_union, un.sun_path)
-                               + strlen("/run/systemd/journal/syslog"),
-        };
-        struct cmsghdr *cmsg;
+        struct mmsghdr mh[FORWARD_QUEUE_MAX] = {};
+        struct iovec iovec[FORWARD_QUEUE_MAX];
         union {
                 struct cmsghdr cmsghdr;
                 uint8_t buf[CMSG_SPACE(sizeof(struct ucred))];
-        } control;
+        } control[FORWARD_QUEUE_MAX];
+        unsigned i;
 
         assert(s);
-        assert(iovec);
-        assert(n_iovec > 0);
 
-        if (ucred) {
-                zero(control);
-                msghdr.msg_control = &control;
-                msghdr.msg_controllen = sizeof(control);
-
-                cmsg = CMSG_FIRSTHDR(&msghdr);
-                cmsg->cmsg_level = SOL_SOCKET;
-                cmsg->cmsg_type = SCM_CREDENTIALS;
-                cmsg->cmsg_len = CMSG_LEN(sizeof(struct ucred));
-                memcpy(CMSG_DATA(cmsg), ucred, sizeof(struct ucred));
-                msghdr.msg_controllen = cmsg->cmsg_len;
+        if (s->n_forward_syslog_queue <= 0)
+                return;
+
+        /* Forward the syslog messages we received via /dev/log to
+         * /run/systemd/syslog, all queued ones with a single
+         * sendmmsg() if possible. Unfortunately we currently can't
+         * set the SO_TIMESTAMP auxiliary data, and hence we don't. */
+
+        for (i = 0; i < s->n_forward_syslog_queue; i++) {
+                ForwardSyslogMessage *m = s->forward_syslog_queue + i;
+                struct msghdr *msghdr = &mh[i].msg_hdr;
+
+                iovec[i].iov_base = s->forward_syslog_buffer + m->offset;
+                iovec[i].iov_len = m->length;
+
+                msghdr->msg_iov = iovec + i;
+                msghdr->msg_iovlen = 1;
+                msghdr->msg_name = (struct sockaddr*) &sa.sa;
+                msghdr->msg_namelen = offsetof(union sockaddr_union, un.sun_path)
+                                      + strlen("/run/systemd/journal/syslog");
+
+                if (m->ucred_valid) {
+                        struct cmsghdr *cmsg;
+
+                        zero(control[i]);
+                        msghdr->msg_control = &control[i];
+                        msghdr->msg_controllen = sizeof(control[i]);
+
+                        cmsg = CMSG_FIRSTHDR(msghdr);
+                        cmsg->cmsg_level = SOL_SOCKET;
+                        cmsg->cmsg_type = SCM_CREDENTIALS;
+                        cmsg->cmsg_len = CMSG_LEN(sizeof(struct ucred));
+                        memcpy(CMSG_DATA(cmsg), &m->ucred, sizeof(struct ucred));
+                        msghdr->msg_controllen = cmsg->cmsg_len;
+                }
         }
 
-        /* Forward the syslog message we received via /dev/log to
-         * /run/systemd/syslog. Unfortunately we currently can't set
-         * the SO_TIMESTAMP auxiliary data, and hence we don't. */
+        (void) forward_syslog_send(s, mh, s->n_forward_syslog_queue);
 
-        if (sendmsg(s->syslog_fd, &msghdr, MSG_NOSIGNAL) >= 0)
-                return;
+        s->n_forward_syslog_queue = 0;
+        s->forward_syslog_buffer_used = 0;
+}
 
-        /* The socket is full? I guess the syslog implementation is
-         * too slow, and we shouldn't wait for that... */
-        if (errno == EAGAIN) {
-                s->n_forward_syslog_missed++;
-                return;
-        }
+static void forward_syslog_iovec(Server *s, const struct iovec *iovec, unsigned n_iovec, const struct ucred *ucred, const struct timeval *tv) {
+        ForwardSyslogMessage *m;
+        size_t l = 0;
+        unsigned i;
 
-        if (ucred && (errno == ESRCH || errno == EPERM)) {
-                struct ucred u;
+        assert(s);
+        assert(iovec);
+        assert(n_iovec > 0);
 
-                /* Hmm, presumably the sender process vanished
-                 * by now, or we don't have CAP_SYS_AMDIN, so
-                 * let's fix it as good as we can, and retry */
+        for (i = 0; i < n_iovec; i++)
+                l += iovec[i].iov_len;
 
-                u = *ucred;
-                u.pid = getpid();
-                memcpy(CMSG_DATA(cmsg), &u, sizeof(struct ucred));
+        if (s->n_forward_syslog_queue >= FORWARD_QUEUE_MAX ||
+            s->forward_syslog_buffer_used + l > FORWARD_QUEUE_BYTES_MAX)
+                server_flush_forward_syslog(s);
 
-                if (sendmsg(s->syslog_fd, &msghdr, MSG_NOSIGNAL) >= 0)
-                        return;
+        if (!GREEDY_REALLOC(s->forward_syslog_buffer, s->forward_syslog_buffer_allocated, s->forward_syslog_buffer_used + l)) {
+                s->n_forward_syslog_missed++;
+                return;
+        }
 
-                if (errno == EAGAIN) {
-                        s->n_forward_syslog_missed++;
-                        return;
-                }
+        m = s->forward_syslog_queue + s->n_forward_syslog_queue++;
+        m->offset = s->forward_syslog_buffer_used;
+        m->length = l;
+        m->ucred_valid = !!ucred;
+        if (ucred)
+                m->ucred = *ucred;
+
+        for (i = 0; i < n_iovec; i++) {
+                memcpy(s->forward_syslog_buffer + s->forward_syslog_buffer_used, iovec[i].iov_base, iovec[i].iov_len);
+                s->forward_syslog_buffer_used += iovec[i].iov_len;
         }
 
-        if (errno != ENOENT)
-                log_debug_errno(errno, "Failed to forward syslog message: %m");
+        server_schedule_forward(s);
 }
 
 static void forward_syslog_raw(Server *s, int priority, const char *buffer, const struct ucred *ucred, const struct timeval *tv) {
@@ -330,6 +398,8 @@ void server_process_syslog_message(
         assert(s);
         assert(buf);
 
+        server_count_received(s, SERVER_SOURCE_SYSLOG, strlen(buf));
+
         orig = buf;
         syslog_parse_priority(&buf, &priority, true);
 
@@ -0,0 +1,291 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  Copyright 2015 Lennart Poettering
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <pthread.h>
+
+#include "list.h"
+#include "journald-writer.h"
+
+/* How much queued data the event loop may get ahead of the writer
+ * thread. If this is exceeded, the event loop waits for the thread,
+ * exactly like it would wait for the disk without the thread. */
+#define WRITER_QUEUE_SIZE_MAX (32U*1024U*1024U)
+
+typedef struct WriteRequest WriteRequest;
+
+struct WriteRequest {
+        uid_t uid;
+        int priority;
+        size_t size;
+
+        LIST_FIELDS(WriteRequest, requests);
+
+        unsigned n_iovec;
+        struct iovec iovec[];
+};
+
+/* How often this thread holds the journal lock */
+static thread_local unsigned journal_lock_depth = 0;
+
+struct Writer {
+        Server *server;
+        pthread_t thread;
+
+        /* Protects all journal files and their bookkeeping in Server */
+        pthread_mutex_t journal_lock;
+
+        /* Protects the fields below */
+        pthread_mutex_t queue_lock;
+        pthread_cond_t queue_cond;
+        pthread_cond_t space_cond;
+
+        LIST_HEAD(WriteRequest, queue);
+        WriteRequest *queue_tail;
+        size_t queue_size;
+        bool stop;
+};
+
+void writer_lock_journals(Writer *w) {
+        if (!w)
+                return;
+
+        assert_se(pthread_mutex_lock(&w->journal_lock) == 0);
+        journal_lock_depth ++;
+}
+
+bool writer_trylock_journals(Writer *w) {
+        int r;
+
+        if (!w)
+                return true;
+
+        r = pthread_mutex_trylock(&w->journal_lock);
+        assert(r == 0 || r == EBUSY);
+        if (r != 0)
+                return false;
+
+        journal_lock_depth ++;
+        return true;
+}
+
+void writer_unlock_journals(Writer *w) {
+        if (!w)
+                return;
+
+        assert(journal_lock_depth > 0);
+        journal_lock_depth --;
+        assert_se(pthread_mutex_unlock(&w->journal_lock) == 0);
+}
+
+static void writer_process(Writer *w, WriteRequest *batch, usec_t *sync_deadline) {
+        Server *s = w->server;
+        bool sync_now = false;
+        WriteRequest *r;
+
+        writer_lock_journals(w);
+
+        while ((r = batch)) {
+                LIST_REMOVE(requests, batch, r);
+
+                if (server_write_entry(s, r->uid, r->iovec, r->n_iovec) >= 0) {
+                        /* Same policy as server_schedule_sync() */
+                        if (r->priority <= LOG_CRIT)
+                                sync_now = true;
+                        else if (s->sync_interval_usec > 0 && *sync_deadline == USEC_INFINITY)
+                                *sync_deadline = now(CLOCK_MONOTONIC) + s->sync_interval_usec;
+                }
+
+                free(r);
+        }
+
+        if (sync_now || now(CLOCK_MONOTONIC) >= *sync_deadline) {
+                server_sync(s);
+                *sync_deadline = USEC_INFINITY;
+        }
+
+        server_maybe_append_tags(s);
+
+        writer_unlock_journals(w);
+}
+
+static void *writer_thread(void *p) {
+        Writer *w = p;
+        usec_t sync_deadline = USEC_INFINITY;
+
+        assert_se(pthread_mutex_lock(&w->queue_lock) == 0);
+
+        for (;;) {
+                WriteRequest *batch, *i;
+                size_t size = 0;
+
+                while (!w->queue && !w->stop && now(CLOCK_MONOTONIC) < sync_deadline) {
+                        struct timespec ts;
+
+                        if (sync_deadline == USEC_INFINITY)
+                                assert_se(pthread_cond_wait(&w->queue_cond, &w->queue_lock) == 0);
+                        else
+                                (void) pthread_cond_timedwait(&w->queue_cond, &w->queue_lock, timespec_store(&ts, sync_deadline));
+                }
+
+                if (w->stop && !w->queue)
+                        break;
+
+                /* Take the whole queue at once, and process it
+                 * without holding the queue lock */
+                batch = w->queue;
+                w->queue = w->queue_tail = NULL;
+
+                assert_se(pthread_mutex_unlock(&w->queue_lock) == 0);
+
+                LIST_FOREACH(requests, i, batch)
+                        size += i->size;
+
+                writer_process(w, batch, &sync_deadline);
+
+                assert_se(pthread_mutex_lock(&w->queue_lock) == 0);
+
+                assert(w->queue_size >= size);
+                w->queue_size -= size;
+                assert_se(pthread_cond_broadcast(&w->space_cond) == 0);
+        }
+
+        assert_se(pthread_mutex_unlock(&w->queue_lock) == 0);
+
+        return NULL;
+}
+
+int writer_enqueue(Writer *w, uid_t uid, const struct iovec *iovec, unsigned n, int priority) {
+        WriteRequest *r;
+        size_t size;
+        unsigned i;
+        uint8_t *p;
+
+        assert(w);
+        assert(iovec || n == 0);
+
+        size = offsetof(WriteRequest, iovec) + n * sizeof(struct iovec) + IOVEC_TOTAL_SIZE(iovec, n);
+
+        r = malloc(size);
+        if (!r)
+                return -ENOMEM;
+
+        r->uid = uid;
+        r->priority = priority;
+        r->size = size;
+        r->n_iovec = n;
+
+        /* The data is copied right behind the iovec array, since
+         * the message is usually assembled on the stack of the
+         * caller */
+        p = (uint8_t*) (r->iovec + n);
+        for (i = 0; i < n; i++) {
+                r->iovec[i].iov_base = p;
+                r->iovec[i].iov_len = iovec[i].iov_len;
+                p = mempcpy(p, iovec[i].iov_base, iovec[i].iov_len);
+        }
+
+        assert_se(pthread_mutex_lock(&w->queue_lock) == 0);
+
+        /* Don't wait for the thread if we hold the journal lock
+         * ourselves, for example when logging about a flush, as the
+         * thread can't make progress then */
+        while (journal_lock_depth == 0 &&
+               w->queue_size > 0 && w->queue_size + size > WRITER_QUEUE_SIZE_MAX)
+                assert_se(pthread_cond_wait(&w->space_cond, &w->queue_lock) == 0);
+
+        LIST_INSERT_AFTER(requests, w->queue, w->queue_tail, r);
+        w->queue_tail = r;
+        w->queue_size += size;
+
+        assert_se(pthread_cond_signal(&w->queue_cond) == 0);
+        assert_se(pthread_mutex_unlock(&w->queue_lock) == 0);
+
+        return 0;
+}
+
+int writer_new(Server *s, Writer **ret) {
+        pthread_mutexattr_t ma;
+        pthread_condattr_t ca;
+        Writer *w;
+        int r;
+
+        assert(s);
+        assert(ret);
+
+        w = new0(Writer, 1);
+        if (!w)
+                return -ENOMEM;
+
+        w->server = s;
+
+        assert_se(pthread_mutexattr_init(&ma) == 0);
+        assert_se(pthread_mutexattr_settype(&ma, PTHREAD_MUTEX_RECURSIVE) == 0);
+        assert_se(pthread_mutex_init(&w->journal_lock, &ma) == 0);
+        assert_se(pthread_mutexattr_destroy(&ma) == 0);
+
+        assert_se(pthread_mutex_init(&w->queue_lock, NULL) == 0);
+
+        /* Sync deadlines are on CLOCK_MONOTONIC */
+        assert_se(pthread_condattr_init(&ca) == 0);
+        assert_se(pthread_condattr_setclock(&ca, CLOCK_MONOTONIC) == 0);
+        assert_se(pthread_cond_init(&w->queue_cond, &ca) == 0);
+        assert_se(pthread_condattr_destroy(&ca) == 0);
+
+        assert_se(pthread_cond_init(&w->space_cond, NULL) == 0);
+
+        /* The thread inherits our signal mask, which blocks all the
+         * signals we handle via signalfd() */
+        r = pthread_create(&w->thread, NULL, writer_thread, w);
+        if (r != 0) {
+                pthread_cond_destroy(&w->space_cond);
+                pthread_cond_destroy(&w->queue_cond);
+                pthread_mutex_destroy(&w->queue_lock);
+                pthread_mutex_destroy(&w->journal_lock);
+                free(w);
+                return -r;
+        }
+
+        *ret = w;
+        return 0;
+}
+
+Writer* writer_free(Writer *w) {
+        if (!w)
+                return NULL;
+
+        /* Let the thread write out whatever is still queued */
+        assert_se(pthread_mutex_lock(&w->queue_lock) == 0);
+        w->stop = true;
+        assert_se(pthread_cond_signal(&w->queue_cond) == 0);
+        assert_se(pthread_mutex_unlock(&w->queue_lock) == 0);
+
+        assert_se(pthread_join(w->thread, NULL) == 0);
+
+        assert(!w->queue);
+
+        pthread_cond_destroy(&w->space_cond);
+        pthread_cond_destroy(&w->queue_cond);
+        pthread_mutex_destroy(&w->queue_lock);
+        pthread_mutex_destroy(&w->journal_lock);
+
+        free(w);
+        return NULL;
+}
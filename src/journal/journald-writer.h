@@ -0,0 +1,45 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+#pragma once
+
+/***
+  This file is part of systemd.
+
+  Copyright 2015 Lennart Poettering
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <stdbool.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "journald-server.h"
+
+/* An optional thread that performs all journal file writes, syncs and
+ * rotations, so that a slow disk does not stall reading from the
+ * sockets. The event loop only parses and enriches messages and queues
+ * copies of them for the thread. */
+
+int writer_new(Server *s, Writer **ret);
+Writer* writer_free(Writer *w);
+
+int writer_enqueue(Writer *w, uid_t uid, const struct iovec *iovec, unsigned n, int priority);
+
+/* Serialize access to the journal files between the event loop and the
+ * writer thread. These are no-ops if w is NULL, i.e. if there is no
+ * writer thread. The lock is recursive. */
+void writer_lock_journals(Writer *w);
+bool writer_trylock_journals(Writer *w);
+void writer_unlock_journals(Writer *w);
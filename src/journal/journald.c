@@ -26,6 +26,7 @@
 
 #include "journal-authenticate.h"
 #include "journald-server.h"
+#include "journald-writer.h"
 #include "journald-kmsg.h"
 #include "journald-syslog.h"
 
@@ -91,15 +92,20 @@ int main(int argc, char *argv[]) {
                 }
 
 #ifdef HAVE_GCRYPT
-                if (server.system_journal) {
+                /* The writer thread appends tags after each batch, if
+                 * it is busy right now there's no need to wake up */
+                if (writer_trylock_journals(server.writer)) {
                         usec_t u;
 
-                        if (journal_file_next_evolve_usec(server.system_journal, &u)) {
+                        if (server.system_journal &&
+                            journal_file_next_evolve_usec(server.system_journal, &u)) {
                                 if (n >= u)
                                         t = 0;
                                 else
                                         t = MIN(t, u - n);
                         }
+
+                        writer_unlock_journals(server.writer);
                 }
 #endif
 
@@ -20,6 +20,7 @@
 ***/
 
 #include <errno.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <sys/mman.h>
 
@@ -33,6 +34,7 @@
 
 typedef struct Window Window;
 typedef struct Context Context;
+typedef struct ContextSet ContextSet;
 typedef struct FileDescriptor FileDescriptor;
 
 struct Window {
@@ -57,12 +59,27 @@ struct Window {
 
 struct Context {
         MMapCache *cache;
+        ContextSet *set;
         unsigned id;
         Window *window;
 
+        /* Where the last window of this context was placed, and how
+         * large the next one should be, see context_place_window() */
+        uint64_t last_offset;
+        uint64_t last_size;
+        uint64_t window_size;
+        unsigned n_sequential;
+
         LIST_FIELDS(Context, by_window);
 };
 
+/* Each thread has its own set of contexts, so that threads sharing a
+ * cache don't unmap each other's windows while they are in use */
+struct ContextSet {
+        pthread_t thread;
+        Context *contexts[MMAP_CACHE_MAX_CONTEXTS];
+};
+
 struct FileDescriptor {
         MMapCache *cache;
         int fd;
@@ -74,11 +91,16 @@ struct MMapCache {
         int n_ref;
         unsigned n_windows;
 
-        unsigned n_hit, n_missed;
-
+        unsigned n_hit, n_missed, n_remapped, n_readahead;
 
         Hashmap *fds;
-        Context *contexts[MMAP_CACHE_MAX_CONTEXTS];
+
+        /* The contexts of the thread that created the cache, and of
+         * all other threads that used it */
+        ContextSet main_set;
+        Hashmap *thread_sets;
+
+        pthread_mutex_t lock;
 
         LIST_HEAD(Window, unused);
         Window *last_unused;
@@ -89,10 +111,19 @@ struct MMapCache {
 #ifdef ENABLE_DEBUG_MMAP_CACHE
 /* Tiny windows increase mmap activity and the chance of exposing unsafe use. */
 # define WINDOW_SIZE (page_size())
+# define WINDOW_SIZE_MIN WINDOW_SIZE
+# define WINDOW_SIZE_MAX WINDOW_SIZE
 #else
 # define WINDOW_SIZE (8ULL*1024ULL*1024ULL)
+# define WINDOW_SIZE_MIN (1ULL*1024ULL*1024ULL)
+/* Don't let WINDOWS_MIN large windows exhaust the address space on 32bit */
+# define WINDOW_SIZE_MAX (sizeof(void*) > 4 ? 64ULL*1024ULL*1024ULL : WINDOW_SIZE)
 #endif
 
+/* After this many sequential window misses in a row, ask the kernel
+ * to read ahead the new windows */
+#define SEQUENTIAL_READAHEAD 2
+
 MMapCache* mmap_cache_new(void) {
         MMapCache *m;
 
@@ -100,15 +131,24 @@ MMapCache* mmap_cache_new(void) {
         if (!m)
                 return NULL;
 
+        if (pthread_mutex_init(&m->lock, NULL) != 0) {
+                free(m);
+                return NULL;
+        }
+
         m->n_ref = 1;
+        m->main_set.thread = pthread_self();
         return m;
 }
 
 MMapCache* mmap_cache_ref(MMapCache *m) {
         assert(m);
-        assert(m->n_ref > 0);
 
+        assert_se(pthread_mutex_lock(&m->lock) == 0);
+        assert(m->n_ref > 0);
         m->n_ref ++;
+        assert_se(pthread_mutex_unlock(&m->lock) == 0);
+
         return m;
 }
 
@@ -190,6 +230,7 @@ static Window *window_add(MMapCache *m) {
                 w = m->last_unused;
                 window_unlink(w);
                 zero(*w);
+                m->n_remapped++;
         }
 
         w->cache = m;
@@ -246,12 +287,52 @@ static void context_attach_window(Context *c, Window *w) {
         LIST_PREPEND(by_window, w->contexts, c);
 }
 
+static ContextSet *context_set_get(MMapCache *m, bool create) {
+        pthread_t self;
+        ContextSet *s;
+        int r;
+
+        assert(m);
+
+        self = pthread_self();
+
+        if (pthread_equal(m->main_set.thread, self))
+                return &m->main_set;
+
+        s = hashmap_get(m->thread_sets, ULONG_TO_PTR(self));
+        if (s || !create)
+                return s;
+
+        r = hashmap_ensure_allocated(&m->thread_sets, NULL);
+        if (r < 0)
+                return NULL;
+
+        s = new0(ContextSet, 1);
+        if (!s)
+                return NULL;
+
+        s->thread = self;
+
+        r = hashmap_put(m->thread_sets, ULONG_TO_PTR(self), s);
+        if (r < 0) {
+                free(s);
+                return NULL;
+        }
+
+        return s;
+}
+
 static Context *context_add(MMapCache *m, unsigned id) {
+        ContextSet *s;
         Context *c;
 
         assert(m);
 
-        c = m->contexts[id];
+        s = context_set_get(m, true);
+        if (!s)
+                return NULL;
+
+        c = s->contexts[id];
         if (c)
                 return c;
 
@@ -260,10 +341,10 @@ static Context *context_add(MMapCache *m, unsigned id) {
                 return NULL;
 
         c->cache = m;
+        c->set = s;
         c->id = id;
 
-        assert(!m->contexts[id]);
-        m->contexts[id] = c;
+        s->contexts[id] = c;
 
         return c;
 }
@@ -273,14 +354,24 @@ static void context_free(Context *c) {
 
         context_detach_window(c);
 
-        if (c->cache) {
-                assert(c->cache->contexts[c->id] == c);
-                c->cache->contexts[c->id] = NULL;
+        if (c->set) {
+                assert(c->set->contexts[c->id] == c);
+                c->set->contexts[c->id] = NULL;
         }
 
         free(c);
 }
 
+static void context_set_free_contexts(ContextSet *s) {
+        unsigned i;
+
+        assert(s);
+
+        for (i = 0; i < MMAP_CACHE_MAX_CONTEXTS; i++)
+                if (s->contexts[i])
+                        context_free(s->contexts[i]);
+}
+
 static void fd_free(FileDescriptor *f) {
         assert(f);
 
@@ -326,13 +417,18 @@ static FileDescriptor* fd_add(MMapCache *m, int fd) {
 
 static void mmap_cache_free(MMapCache *m) {
         FileDescriptor *f;
-        int i;
+        ContextSet *s;
 
         assert(m);
 
-        for (i = 0; i < MMAP_CACHE_MAX_CONTEXTS; i++)
-                if (m->contexts[i])
-                        context_free(m->contexts[i]);
+        context_set_free_contexts(&m->main_set);
+
+        while ((s = hashmap_steal_first(m->thread_sets))) {
+                context_set_free_contexts(s);
+                free(s);
+        }
+
+        hashmap_free(m->thread_sets);
 
         while ((f = hashmap_first(m->fds)))
                 fd_free(f);
@@ -342,20 +438,51 @@ static void mmap_cache_free(MMapCache *m) {
         while (m->unused)
                 window_free(m->unused);
 
+        pthread_mutex_destroy(&m->lock);
         free(m);
 }
 
 MMapCache* mmap_cache_unref(MMapCache *m) {
+        bool gone;
+
         assert(m);
-        assert(m->n_ref > 0);
 
+        assert_se(pthread_mutex_lock(&m->lock) == 0);
+        assert(m->n_ref > 0);
         m->n_ref --;
-        if (m->n_ref == 0)
+        gone = m->n_ref == 0;
+        assert_se(pthread_mutex_unlock(&m->lock) == 0);
+
+        if (gone)
                 mmap_cache_free(m);
 
         return NULL;
 }
 
+void mmap_cache_thread_done(MMapCache *m) {
+        ContextSet *s;
+
+        assert(m);
+
+        /* Releases the contexts of the calling thread, so that its
+         * windows may be reused. Threads sharing a cache should call
+         * this before they exit. */
+
+        assert_se(pthread_mutex_lock(&m->lock) == 0);
+
+        s = context_set_get(m, false);
+        if (s) {
+                context_set_free_contexts(s);
+
+                if (s != &m->main_set) {
+                        assert_se(hashmap_remove(m->thread_sets, ULONG_TO_PTR(s->thread)) == s);
+                        free(s);
+                }
+        }
+
+        assert_se(pthread_mutex_unlock(&m->lock) == 0);
+}
+
 static int make_room(MMapCache *m) {
         assert(m);
 
@@ -363,9 +490,74 @@ static int make_room(MMapCache *m) {
                 return 0;
 
         window_free(m->last_unused);
+        m->n_remapped++;
         return 1;
 }
 
+static int context_place_window(Context *c, uint64_t offset, size_t size, uint64_t *ret_offset, uint64_t *ret_size) {
+        uint64_t woffset, wsize, end;
+        int direction = 0;
+
+        assert(c);
+        assert(size > 0);
+        assert(ret_offset);
+        assert(ret_size);
+
+        /* Figures out where to map a new window for the specified
+         * range, based on where the previous window of this context
+         * was placed. If the new range directly follows (or
+         * precedes) the previous window we are probably scanning
+         * through the file, hence grow the window and place it
+         * entirely ahead of the range. Otherwise we are doing random
+         * lookups, hence shrink the window and center it around the
+         * range. Returns the scan direction: > 0 forward, < 0
+         * backward, 0 random. */
+
+        end = c->last_offset + c->last_size;
+
+        if (c->window_size == 0)
+                c->window_size = WINDOW_SIZE;
+        else if (offset >= end && offset < end + c->window_size)
+                direction = 1;
+        else if (offset + size <= c->last_offset && offset + size + c->window_size > c->last_offset)
+                direction = -1;
+
+        if (direction != 0) {
+                c->n_sequential++;
+                c->window_size = MIN(c->window_size * 2, (uint64_t) WINDOW_SIZE_MAX);
+        } else {
+                c->n_sequential = 0;
+                c->window_size = MAX(c->window_size / 2, (uint64_t) WINDOW_SIZE_MIN);
+        }
+
+        woffset = offset & ~((uint64_t) page_size() - 1ULL);
+        wsize = size + (offset - woffset);
+        wsize = PAGE_ALIGN(wsize);
+
+        if (wsize < c->window_size) {
+                uint64_t delta;
+
+                if (direction > 0)
+                        delta = 0;
+                else if (direction < 0)
+                        delta = c->window_size - wsize;
+                else
+                        delta = PAGE_ALIGN((c->window_size - wsize) / 2);
+
+                if (delta > woffset)
+                        woffset = 0;
+                else
+                        woffset -= delta;
+
+                wsize = c->window_size;
+        }
+
+        *ret_offset = woffset;
+        *ret_size = wsize;
+
+        return direction;
+}
+
 static int try_context(
                 MMapCache *m,
                 int fd,
@@ -376,6 +568,7 @@ static int try_context(
                 size_t size,
                 void **ret) {
 
+        ContextSet *s;
         Context *c;
 
         assert(m);
@@ -384,7 +577,11 @@ static int try_context(
         assert(size > 0);
         assert(ret);
 
-        c = m->contexts[context];
+        s = context_set_get(m, false);
+        if (!s)
+                return 0;
+
+        c = s->contexts[context];
         if (!c)
                 return 0;
 
@@ -471,7 +668,7 @@ static int add_mmap(
         FileDescriptor *f;
         Window *w;
         void *d;
-        int r;
+        int r, direction;
 
         assert(m);
         assert(m->n_ref > 0);
@@ -479,22 +676,11 @@ static int add_mmap(
         assert(size > 0);
         assert(ret);
 
-        woffset = offset & ~((uint64_t) page_size() - 1ULL);
-        wsize = size + (offset - woffset);
-        wsize = PAGE_ALIGN(wsize);
-
-        if (wsize < WINDOW_SIZE) {
-                uint64_t delta;
-
-                delta = PAGE_ALIGN((WINDOW_SIZE - wsize) / 2);
-
-                if (delta > offset)
-                        woffset = 0;
-                else
-                        woffset -= delta;
+        c = context_add(m, context);
+        if (!c)
+                return -ENOMEM;
 
-                wsize = WINDOW_SIZE;
-        }
+        direction = context_place_window(c, offset, size, &woffset, &wsize);
 
         if (st) {
                 /* Memory maps that are larger then the files
@@ -522,9 +708,16 @@ static int add_mmap(
                         return -ENOMEM;
         }
 
-        c = context_add(m, context);
-        if (!c)
-                goto outofmem;
+        if (direction != 0 && c->n_sequential >= SEQUENTIAL_READAHEAD) {
+                /* We are scanning, get the kernel to read the new
+                 * window in before we fault on it page by page. This
+                 * is purely an optimization, so ignore failures. */
+                (void) madvise(d, wsize, MADV_WILLNEED);
+                m->n_readahead++;
+        }
+
+        c->last_offset = woffset;
+        c->last_size = wsize;
 
         f = fd_add(m, fd);
         if (!f)
@@ -575,36 +768,66 @@ int mmap_cache_get(
         assert(ret);
         assert(context < MMAP_CACHE_MAX_CONTEXTS);
 
+        assert_se(pthread_mutex_lock(&m->lock) == 0);
+
         /* Check whether the current context is the right one already */
         r = try_context(m, fd, prot, context, keep_always, offset, size, ret);
         if (r != 0) {
                 m->n_hit ++;
-                return r;
+                goto finish;
         }
 
         /* Search for a matching mmap */
         r = find_mmap(m, fd, prot, context, keep_always, offset, size, ret);
         if (r != 0) {
                 m->n_hit ++;
-                return r;
+                goto finish;
         }
 
         m->n_missed++;
 
         /* Create a new mmap */
-        return add_mmap(m, fd, prot, context, keep_always, offset, size, st, ret);
+        r = add_mmap(m, fd, prot, context, keep_always, offset, size, st, ret);
+
+finish:
+        assert_se(pthread_mutex_unlock(&m->lock) == 0);
+        return r;
+}
+
+static unsigned mmap_cache_counter(MMapCache *m, const unsigned *counter) {
+        unsigned n;
+
+        assert(m);
+
+        assert_se(pthread_mutex_lock(&m->lock) == 0);
+        n = *counter;
+        assert_se(pthread_mutex_unlock(&m->lock) == 0);
+
+        return n;
 }
 
 unsigned mmap_cache_get_hit(MMapCache *m) {
         assert(m);
 
-        return m->n_hit;
+        return mmap_cache_counter(m, &m->n_hit);
 }
 
 unsigned mmap_cache_get_missed(MMapCache *m) {
         assert(m);
 
-        return m->n_missed;
+        return mmap_cache_counter(m, &m->n_missed);
+}
+
+unsigned mmap_cache_get_remapped(MMapCache *m) {
+        assert(m);
+
+        return mmap_cache_counter(m, &m->n_remapped);
+}
+
+unsigned mmap_cache_get_readahead(MMapCache *m) {
+        assert(m);
+
+        return mmap_cache_counter(m, &m->n_readahead);
 }
 
 static void mmap_cache_process_sigbus(MMapCache *m) {
@@ -672,17 +895,21 @@ static void mmap_cache_process_sigbus(MMapCache *m) {
 
 bool mmap_cache_got_sigbus(MMapCache *m, int fd) {
         FileDescriptor *f;
+        bool b;
 
         assert(m);
         assert(fd >= 0);
 
+        assert_se(pthread_mutex_lock(&m->lock) == 0);
+
         mmap_cache_process_sigbus(m);
 
         f = hashmap_get(m->fds, INT_TO_PTR(fd + 1));
-        if (!f)
-                return false;
+        b = f && f->sigbus;
 
-        return f->sigbus;
+        assert_se(pthread_mutex_unlock(&m->lock) == 0);
+
+        return b;
 }
 
 void mmap_cache_close_fd(MMapCache *m, int fd) {
@@ -695,11 +922,13 @@ void mmap_cache_close_fd(MMapCache *m, int fd) {
          * that we don't end up with a SIGBUS entry we cannot relate
          * to any existing memory map */
 
+        assert_se(pthread_mutex_lock(&m->lock) == 0);
+
         mmap_cache_process_sigbus(m);
 
         f = hashmap_get(m->fds, INT_TO_PTR(fd + 1));
-        if (!f)
-                return;
+        if (f)
+                fd_free(f);
 
-        fd_free(f);
+        assert_se(pthread_mutex_unlock(&m->lock) == 0);
 }
@@ -24,8 +24,10 @@
 #include <stdbool.h>
 #include <sys/stat.h>
 
-/* One context per object type, plus one of the header, plus one "additional" one */
-#define MMAP_CACHE_MAX_CONTEXTS 9
+/* One context per object type, plus one of the header, plus one
+ * "additional" one. Contexts are per thread, so that a cache may be
+ * shared between threads. */
+#define MMAP_CACHE_MAX_CONTEXTS 12
 
 typedef struct MMapCache MMapCache;
 
@@ -44,8 +46,11 @@ int mmap_cache_get(
         struct stat *st,
         void **ret);
 void mmap_cache_close_fd(MMapCache *m, int fd);
+void mmap_cache_thread_done(MMapCache *m);
 
 unsigned mmap_cache_get_hit(MMapCache *m);
 unsigned mmap_cache_get_missed(MMapCache *m);
+unsigned mmap_cache_get_remapped(MMapCache *m);
+unsigned mmap_cache_get_readahead(MMapCache *m);
 
 bool mmap_cache_got_sigbus(MMapCache *m, int fd);
@@ -44,6 +44,7 @@
 #include "fileio.h"
 #include "formats-util.h"
 #include "hostname-util.h"
+#include "siphash24.h"
 
 #define JOURNAL_FILES_MAX 7168
 
@@ -53,6 +54,10 @@
 
 #define DEFAULT_DATA_THRESHOLD (64*1024)
 
+/* Field names longer than this are not indexed, data objects with
+ * them are always compared in full */
+#define FIELD_INDEX_NAME_MAX 256
+
 static void remove_file_real(sd_journal *j, JournalFile *f);
 
 static bool journal_pid_changed(sd_journal *j) {
@@ -79,6 +84,14 @@ static int set_put_error(sd_journal *j, int r) {
         return set_put(j->errors, INT_TO_PTR(r));
 }
 
+static void invalidate_files_queue(sd_journal *j) {
+        assert(j);
+
+        /* The candidate entries of the files changed, hence the
+         * queue needs to be rebuilt on the next iteration step */
+        j->files_queue_valid = false;
+}
+
 static void detach_location(sd_journal *j) {
         Iterator i;
         JournalFile *f;
@@ -88,6 +101,8 @@ static void detach_location(sd_journal *j) {
         j->current_file = NULL;
         j->current_field = 0;
 
+        invalidate_files_queue(j);
+
         ORDERED_HASHMAP_FOREACH(f, j->files, i)
                 journal_file_reset_location(f);
 }
@@ -485,6 +500,12 @@ static int next_for_match(
         if (m->type == MATCH_DISCRETE) {
                 uint64_t dp;
 
+                /* Archived files might tell us cheaply that they
+                 * don't contain the data at all */
+                r = journal_file_bloom_filter_check(f, le64toh(m->le_hash));
+                if (r == 0)
+                        return 0;
+
                 r = journal_file_find_data_object_with_hash(f, m->data, m->size, le64toh(m->le_hash), NULL, &dp);
                 if (r <= 0)
                         return r;
@@ -717,6 +738,40 @@ static int next_with_matches(
                               direction, ret, offset);
 }
 
+static bool file_may_contain_location(sd_journal *j, JournalFile *f, direction_t direction) {
+        uint64_t head, tail;
+
+        assert(j);
+        assert(f);
+
+        /* Checks whether the header of the file rules out that it
+         * contains any entry beyond the current location, so that we
+         * can skip the file entirely instead of bisecting its entry
+         * arrays. This only covers locations that are looked up by
+         * realtime, i.e. where find_location_with_matches() will not
+         * use seqnums or monotonic timestamps. */
+
+        if (!IN_SET(j->current_location.type, LOCATION_SEEK, LOCATION_DISCRETE))
+                return true;
+
+        if (!j->current_location.realtime_set || j->current_location.monotonic_set)
+                return true;
+
+        if (j->current_location.seqnum_set && sd_id128_equal(j->current_location.seqnum_id, f->header->seqnum_id))
+                return true;
+
+        if (le64toh(f->header->n_entries) <= 0)
+                return true;
+
+        head = le64toh(f->header->head_entry_realtime);
+        tail = le64toh(f->header->tail_entry_realtime);
+
+        if (direction == DIRECTION_DOWN)
+                return tail >= j->current_location.realtime;
+        else
+                return head <= j->current_location.realtime;
+}
+
 static int next_beyond_location(sd_journal *j, JournalFile *f, direction_t direction) {
         Object *c;
         uint64_t cp, n_entries;
@@ -749,6 +804,9 @@ static int next_beyond_location(sd_journal *j, JournalFile *f, direction_t direc
         } else {
                 f->last_direction = direction;
 
+                if (!file_may_contain_location(j, f, direction))
+                        return 0;
+
                 r = find_location_with_matches(j, f, direction, &c, &cp);
                 if (r <= 0)
                         return r;
@@ -785,17 +843,30 @@ static int next_beyond_location(sd_journal *j, JournalFile *f, direction_t direc
         }
 }
 
-static int real_journal_next(sd_journal *j, direction_t direction) {
-        JournalFile *f, *new_file = NULL;
+static int files_queue_compare_down(const void *a, const void *b) {
+        return journal_file_compare_locations((JournalFile*) a, (JournalFile*) b);
+}
+
+static int files_queue_compare_up(const void *a, const void *b) {
+        return journal_file_compare_locations((JournalFile*) b, (JournalFile*) a);
+}
+
+static int rebuild_files_queue(sd_journal *j, direction_t direction) {
+        JournalFile *f;
         Iterator i;
-        Object *o;
         int r;
 
-        assert_return(j, -EINVAL);
-        assert_return(!journal_pid_changed(j), -ECHILD);
+        assert(j);
+
+        /* Looks for the next candidate entry in every file, and
+         * orders all files that have one */
+
+        j->files_queue = prioq_free(j->files_queue);
+        j->files_queue = prioq_new(direction == DIRECTION_DOWN ? files_queue_compare_down : files_queue_compare_up);
+        if (!j->files_queue)
+                return -ENOMEM;
 
         ORDERED_HASHMAP_FOREACH(f, j->files, i) {
-                bool found;
 
                 r = next_beyond_location(j, f, direction);
                 if (r < 0) {
@@ -807,22 +878,75 @@ static int real_journal_next(sd_journal *j, direction_t direction) {
                         continue;
                 }
 
+                r = prioq_put(j->files_queue, f, &f->files_queue_idx);
+                if (r < 0)
+                        return r;
+        }
+
+        j->files_queue_direction = direction;
+        j->files_queue_valid = true;
+
+        return 0;
+}
+
+static int real_journal_next(sd_journal *j, direction_t direction) {
+        JournalFile *new_file;
+        Object *o;
+        int r;
+
+        assert_return(j, -EINVAL);
+        assert_return(!journal_pid_changed(j), -ECHILD);
+
+        if (!j->files_queue_valid || j->files_queue_direction != direction) {
+                r = rebuild_files_queue(j, direction);
+                if (r < 0) {
+                        invalidate_files_queue(j);
+                        return r;
+                }
+        }
+
+        /* Only the files at the front of the queue need to be looked
+         * at: the file we picked the current entry from needs to be
+         * advanced, and any other file whose candidate is the very
+         * same entry (which happens when an entry exists in more
+         * than one file) needs to skip it too. All other candidates
+         * are beyond the current location already. */
+        for (;;) {
+                uint64_t offset;
+                LocationType type;
+
+                new_file = prioq_peek(j->files_queue);
                 if (!new_file)
-                        found = true;
-                else {
-                        int k;
+                        break;
 
-                        k = journal_file_compare_locations(f, new_file);
+                offset = new_file->current_offset;
+                type = new_file->location_type;
 
-                        found = direction == DIRECTION_DOWN ? k < 0 : k > 0;
+                r = next_beyond_location(j, new_file, direction);
+                if (r <= 0) {
+                        assert_se(prioq_remove(j->files_queue, new_file, &new_file->files_queue_idx) > 0);
+
+                        if (r < 0) {
+                                log_debug_errno(r, "Can't iterate through %s, ignoring: %m", new_file->path);
+                                remove_file_real(j, new_file);
+                        } else
+                                new_file->location_type = LOCATION_TAIL;
+
+                        continue;
                 }
 
-                if (found)
-                        new_file = f;
+                if (type == LOCATION_SEEK && new_file->current_offset == offset)
+                        break;
+
+                prioq_reshuffle(j->files_queue, new_file, &new_file->files_queue_idx);
         }
 
-        if (!new_file)
+        if (!new_file) {
+                /* Make sure the next call looks at all files again,
+                 * in case they grew in the meantime */
+                invalidate_files_queue(j);
                 return 0;
+        }
 
         r = journal_file_move_to_object(new_file, OBJECT_ENTRY, new_file->current_offset, &o);
         if (r < 0)
@@ -1227,6 +1351,7 @@ static int add_any_file(sd_journal *j, const char *path) {
         check_network(j, f->fd);
 
         j->current_invalidate_counter ++;
+        invalidate_files_queue(j);
 
         return 0;
 }
@@ -1286,6 +1411,9 @@ static void remove_file_real(sd_journal *j, JournalFile *f) {
                 j->current_field = 0;
         }
 
+        if (j->field_index_file == f)
+                j->field_index_file = NULL;
+
         if (j->unique_file == f) {
                 /* Jump to the next unique_file or NULL if that one was last */
                 j->unique_file = ordered_hashmap_next(j->files, j->unique_file->path);
@@ -1297,6 +1425,7 @@ static void remove_file_real(sd_journal *j, JournalFile *f) {
         journal_file_close(f);
 
         j->current_invalidate_counter ++;
+        invalidate_files_queue(j);
 }
 
 static int add_directory(sd_journal *j, const char *prefix, const char *dirname) {
@@ -1751,6 +1880,7 @@ _public_ void sd_journal_close(sd_journal *j) {
                 journal_file_close(f);
 
         ordered_hashmap_free(j->files);
+        prioq_free(j->files_queue);
 
         while ((d = hashmap_first(j->directories_by_path)))
                 remove_directory(j, d);
@@ -1764,13 +1894,19 @@ _public_ void sd_journal_close(sd_journal *j) {
         safe_close(j->inotify_fd);
 
         if (j->mmap) {
-                log_debug("mmap cache statistics: %u hit, %u miss", mmap_cache_get_hit(j->mmap), mmap_cache_get_missed(j->mmap));
+                log_debug("mmap cache statistics: %u hit, %u miss, %u remap, %u readahead",
+                          mmap_cache_get_hit(j->mmap), mmap_cache_get_missed(j->mmap),
+                          mmap_cache_get_remapped(j->mmap), mmap_cache_get_readahead(j->mmap));
                 mmap_cache_unref(j->mmap);
         }
 
         free(j->path);
         free(j->prefix);
         free(j->unique_field);
+        set_free_free(j->unique_values);
+        ordered_hashmap_free_free(j->column_values);
+        free(j->field_index);
+        catalog_cache_done(&j->catalog_cache);
         set_free(j->errors);
         free(j);
 }
@@ -1864,10 +2000,72 @@ static bool field_is_valid(const char *field) {
         return true;
 }
 
+static int field_index_update(sd_journal *j, JournalFile *f) {
+        uint64_t i, n;
+        Object *o;
+        int r;
+
+        assert(j);
+        assert(f);
+
+        if (j->field_index_file == f && j->field_index_offset == f->current_offset)
+                return 0;
+
+        j->field_index_file = NULL;
+
+        r = journal_file_move_to_object(f, OBJECT_ENTRY, f->current_offset, &o);
+        if (r < 0)
+                return r;
+
+        n = journal_file_entry_n_items(o);
+        if (!GREEDY_REALLOC(j->field_index, j->n_field_index_allocated, n))
+                return -ENOMEM;
+
+        for (i = 0; i < n; i++) {
+                FieldIndexItem *item = j->field_index + i;
+                const uint8_t *eq;
+                uint64_t p, l;
+                le64_t le_hash;
+
+                p = le64toh(o->entry.items[i].object_offset);
+                le_hash = o->entry.items[i].hash;
+                r = journal_file_move_to_object(f, OBJECT_DATA, p, &o);
+                if (r < 0)
+                        return r;
+
+                if (le_hash != o->data.hash)
+                        return -EBADMSG;
+
+                l = le64toh(o->object.size) - offsetof(Object, data.payload);
+
+                item->object_offset = p;
+                item->indexed = false;
+
+                if (!(o->object.flags & OBJECT_COMPRESSION_MASK)) {
+                        eq = memchr(o->data.payload, '=', MIN(l, (uint64_t) FIELD_INDEX_NAME_MAX + 1));
+                        if (eq) {
+                                item->field_length = eq - o->data.payload;
+                                item->field_hash = jenkins_hashlittle(o->data.payload, item->field_length, 0);
+                                item->indexed = true;
+                        }
+                }
+
+                r = journal_file_move_to_object(f, OBJECT_ENTRY, f->current_offset, &o);
+                if (r < 0)
+                        return r;
+        }
+
+        j->n_field_index = n;
+        j->field_index_file = f;
+        j->field_index_offset = f->current_offset;
+
+        return 0;
+}
+
 _public_ int sd_journal_get_data(sd_journal *j, const char *field, const void **data, size_t *size) {
         JournalFile *f;
-        uint64_t i, n;
-        size_t field_length;
+        uint32_t field_hash;
+        size_t field_length, i;
         int r;
         Object *o;
 
@@ -1885,44 +2083,46 @@ _public_ int sd_journal_get_data(sd_journal *j, const char *field, const void **
         if (f->current_offset <= 0)
                 return -EADDRNOTAVAIL;
 
-        r = journal_file_move_to_object(f, OBJECT_ENTRY, f->current_offset, &o);
+        /* The field names of the entry are indexed on first access,
+         * so that only objects with a matching name need to be
+         * looked at */
+        r = field_index_update(j, f);
         if (r < 0)
                 return r;
 
         field_length = strlen(field);
+        field_hash = jenkins_hashlittle(field, field_length, 0);
 
-        n = journal_file_entry_n_items(o);
-        for (i = 0; i < n; i++) {
-                uint64_t p, l;
-                le64_t le_hash;
+        for (i = 0; i < j->n_field_index; i++) {
+                FieldIndexItem *item = j->field_index + i;
+                uint64_t l;
                 size_t t;
                 int compression;
 
-                p = le64toh(o->entry.items[i].object_offset);
-                le_hash = o->entry.items[i].hash;
-                r = journal_file_move_to_object(f, OBJECT_DATA, p, &o);
+                if (item->indexed &&
+                    (item->field_length != field_length || item->field_hash != field_hash))
+                        continue;
+
+                r = journal_file_move_to_object(f, OBJECT_DATA, item->object_offset, &o);
                 if (r < 0)
                         return r;
 
-                if (le_hash != o->data.hash)
-                        return -EBADMSG;
-
                 l = le64toh(o->object.size) - offsetof(Object, data.payload);
 
                 compression = o->object.flags & OBJECT_COMPRESSION_MASK;
                 if (compression) {
-#if defined(HAVE_XZ) || defined(HAVE_LZ4)
-                        if (decompress_startswith(compression,
-                                                  o->data.payload, l,
-                                                  &f->compress_buffer, &f->compress_buffer_size,
-                                                  field, field_length, '=')) {
+#if defined(HAVE_XZ) || defined(HAVE_LZ4) || defined(HAVE_ZSTD)
+                        if (journal_file_decompress_startswith(f, compression,
+                                                               o->data.payload, l,
+                                                               &f->compress_buffer, &f->compress_buffer_size,
+                                                               field, field_length, '=')) {
 
                                 size_t rsize;
 
-                                r = decompress_blob(compression,
-                                                    o->data.payload, l,
-                                                    &f->compress_buffer, &f->compress_buffer_size, &rsize,
-                                                    j->data_threshold);
+                                r = journal_file_decompress(f, compression,
+                                                            o->data.payload, l,
+                                                            &f->compress_buffer, &f->compress_buffer_size, &rsize,
+                                                            j->data_threshold);
                                 if (r < 0)
                                         return r;
 
@@ -1948,10 +2148,6 @@ _public_ int sd_journal_get_data(sd_journal *j, const char *field, const void **
 
                         return 0;
                 }
-
-                r = journal_file_move_to_object(f, OBJECT_ENTRY, f->current_offset, &o);
-                if (r < 0)
-                        return r;
         }
 
         return -ENOENT;
@@ -1971,13 +2167,13 @@ static int return_data(sd_journal *j, JournalFile *f, Object *o, const void **da
 
         compression = o->object.flags & OBJECT_COMPRESSION_MASK;
         if (compression) {
-#if defined(HAVE_XZ) || defined(HAVE_LZ4)
+#if defined(HAVE_XZ) || defined(HAVE_LZ4) || defined(HAVE_ZSTD)
                 size_t rsize;
                 int r;
 
-                r = decompress_blob(compression,
-                                    o->data.payload, l, &f->compress_buffer,
-                                    &f->compress_buffer_size, &rsize, j->data_threshold);
+                r = journal_file_decompress(f, compression,
+                                            o->data.payload, l, &f->compress_buffer,
+                                            &f->compress_buffer_size, &rsize, j->data_threshold);
                 if (r < 0)
                         return r;
 
@@ -2046,6 +2242,262 @@ _public_ void sd_journal_restart_data(sd_journal *j) {
         j->current_field = 0;
 }
 
+static unsigned long column_value_hash_func(const void *p, const uint8_t hash_key[HASH_KEY_SIZE]) {
+        const ColumnValue *v = p;
+        uint64_t u;
+
+        siphash24((uint8_t*) &u, v->data, v->size, hash_key);
+
+        return (unsigned long) u;
+}
+
+static int column_value_compare_func(const void *_a, const void *_b) {
+        const ColumnValue *a = _a, *b = _b;
+
+        if (a->size != b->size)
+                return a->size < b->size ? -1 : 1;
+
+        return memcmp(a->data, b->data, a->size);
+}
+
+static const struct hash_ops column_value_hash_ops = {
+        .hash = column_value_hash_func,
+        .compare = column_value_compare_func
+};
+
+static int column_add_value(sd_journal *j, JournalFile *f, uint64_t data_offset, uint64_t n) {
+        _cleanup_free_ ColumnValue *v = NULL;
+        ColumnValue *existing;
+        const void *data;
+        size_t size;
+        Object *o;
+        int r;
+
+        assert(j);
+        assert(f);
+
+        if (n <= 0)
+                return 0;
+
+        r = journal_file_move_to_object(f, OBJECT_DATA, data_offset, &o);
+        if (r < 0)
+                return r;
+
+        r = return_data(j, f, o, &data, &size);
+        if (r < 0)
+                return r;
+
+        v = malloc(offsetof(ColumnValue, data) + size);
+        if (!v)
+                return -ENOMEM;
+
+        v->n_entries = n;
+        v->size = size;
+        memcpy(v->data, data, size);
+
+        existing = ordered_hashmap_get(j->column_values, v);
+        if (existing) {
+                existing->n_entries += n;
+                return 0;
+        }
+
+        r = ordered_hashmap_put(j->column_values, v, v);
+        if (r < 0)
+                return r;
+
+        v = NULL;
+        return 0;
+}
+
+static int compare_column_runs(const void *_a, const void *_b) {
+        const ColumnRun *a = _a, *b = _b;
+
+        if (a->data_offset != b->data_offset)
+                return a->data_offset < b->data_offset ? -1 : 1;
+
+        return 0;
+}
+
+static int column_query_file(sd_journal *j, JournalFile *f, const char *field, size_t field_length, uint64_t since, uint64_t until) {
+        uint64_t p;
+        Object *o;
+        int r;
+
+        assert(j);
+        assert(f);
+        assert(field);
+
+        if (le64toh(f->header->n_entries) <= 0)
+                return 0;
+
+        if (le64toh(f->header->tail_entry_realtime) < since ||
+            le64toh(f->header->head_entry_realtime) >= until)
+                return 0;
+
+        r = journal_file_find_column(f, field, field_length, &o, &p);
+        if (r < 0)
+                return r;
+        if (r > 0) {
+                _cleanup_free_ ColumnRun *runs = NULL;
+                uint64_t a = 0, b, i, n_runs, k = 0, idx = 0;
+
+                /* Fast path: the file carries a column for the
+                 * field, hence sum up the runs overlapping with the
+                 * index range the time window maps to */
+
+                b = le64toh(f->header->n_entries);
+
+                if (since > 0) {
+                        r = journal_file_entry_index_by_realtime(f, since, &a);
+                        if (r < 0)
+                                return r;
+                }
+
+                if (until != (uint64_t) -1) {
+                        r = journal_file_entry_index_by_realtime(f, until, &b);
+                        if (r < 0)
+                                return r;
+                }
+
+                if (a >= b)
+                        return 0;
+
+                r = journal_file_move_to_object(f, OBJECT_COLUMN, p, &o);
+                if (r < 0)
+                        return r;
+
+                n_runs = (le64toh(o->object.size) - offsetof(Object, column.runs)) / sizeof(ColumnRun);
+
+                runs = new(ColumnRun, n_runs);
+                if (!runs)
+                        return -ENOMEM;
+
+                for (i = 0; i < n_runs && idx < b; i++) {
+                        uint64_t d, n, from, to;
+
+                        d = le64toh(o->column.runs[i].data_offset);
+                        n = le64toh(o->column.runs[i].n_entries);
+
+                        from = MAX(idx, a);
+                        to = MIN(idx + n, b);
+                        idx += n;
+
+                        if (d == 0 || from >= to)
+                                continue;
+
+                        runs[k].data_offset = d;
+                        runs[k].n_entries = to - from;
+                        k++;
+                }
+
+                /* Merge the runs of each value, so that we decode
+                 * every data object only once */
+                qsort_safe(runs, k, sizeof(ColumnRun), compare_column_runs);
+
+                for (i = 0; i < k; ) {
+                        uint64_t n = 0, d = runs[i].data_offset;
+
+                        for (; i < k && runs[i].data_offset == d; i++)
+                                n += runs[i].n_entries;
+
+                        r = column_add_value(j, f, d, n);
+                        if (r < 0)
+                                return r;
+                }
+
+                return 0;
+        }
+
+        /* Slow path: count the entries of each data object of the
+         * field within the time window */
+
+        r = journal_file_find_field_object(f, field, field_length, &o, &p);
+        if (r <= 0)
+                return r;
+
+        p = le64toh(o->field.head_data_offset);
+        while (p > 0) {
+                uint64_t n;
+
+                r = journal_file_count_entries_for_data(f, p, since, until, &n);
+                if (r < 0)
+                        return r;
+
+                r = column_add_value(j, f, p, n);
+                if (r < 0)
+                        return r;
+
+                r = journal_file_move_to_object(f, OBJECT_DATA, p, &o);
+                if (r < 0)
+                        return r;
+
+                p = le64toh(o->data.next_field_offset);
+        }
+
+        return 0;
+}
+
+_public_ int sd_journal_query_column(sd_journal *j, const char *field, uint64_t since, uint64_t until) {
+        JournalFile *f;
+        Iterator i;
+        int r;
+
+        assert_return(j, -EINVAL);
+        assert_return(!journal_pid_changed(j), -ECHILD);
+        assert_return(!isempty(field), -EINVAL);
+        assert_return(field_is_valid(field), -EINVAL);
+
+        /* Counts the entries carrying each value of the field, whose
+         * realtime timestamp lies in [since, until). Matches are not
+         * taken into account, like for sd_journal_query_unique(). */
+
+        ordered_hashmap_free_free(j->column_values);
+
+        j->column_values = ordered_hashmap_new(&column_value_hash_ops);
+        if (!j->column_values)
+                return -ENOMEM;
+
+        ORDERED_HASHMAP_FOREACH(f, j->files, i) {
+                r = column_query_file(j, f, field, strlen(field), since, until);
+                if (r == -ENOMEM)
+                        return r;
+                if (r < 0)
+                        log_debug_errno(r, "Failed to query column %s of %s, skipping: %m", field, f->path);
+        }
+
+        j->column_iterator = ITERATOR_FIRST;
+
+        return 0;
+}
+
+_public_ int sd_journal_enumerate_column(sd_journal *j, const void **data, size_t *l, uint64_t *n) {
+        ColumnValue *v;
+
+        assert_return(j, -EINVAL);
+        assert_return(!journal_pid_changed(j), -ECHILD);
+        assert_return(data, -EINVAL);
+        assert_return(l, -EINVAL);
+        assert_return(j->column_values, -EINVAL);
+
+        if (!ordered_hashmap_iterate(j->column_values, &j->column_iterator, (void**) &v, NULL))
+                return 0;
+
+        *data = v->data;
+        *l = v->size;
+
+        if (n)
+                *n = v->n_entries;
+
+        return 1;
+}
+
+_public_ void sd_journal_restart_column(sd_journal *j) {
+        if (!j)
+                return;
+
+        j->column_iterator = ITERATOR_FIRST;
+}
+
 _public_ int sd_journal_get_fd(sd_journal *j) {
         int r;
 
@@ -2203,6 +2655,10 @@ _public_ int sd_journal_process(sd_journal *j) {
 
                 got_something = true;
 
+                /* Files might have grown, make sure their new
+                 * entries are considered */
+                invalidate_files_queue(j);
+
                 FOREACH_INOTIFY_EVENT(e, buffer, l)
                         process_inotify_event(j, e);
         }
@@ -2390,6 +2846,7 @@ _public_ int sd_journal_query_unique(sd_journal *j, const char *field) {
         j->unique_file = NULL;
         j->unique_offset = 0;
         j->unique_file_lost = false;
+        j->unique_values = set_free_free(j->unique_values);
 
         return 0;
 }
@@ -2416,13 +2873,17 @@ _public_ int sd_journal_enumerate_unique(sd_journal *j, const void **data, size_
                 j->unique_offset = 0;
         }
 
+        if (!j->unique_values) {
+                j->unique_values = set_new(&column_value_hash_ops);
+                if (!j->unique_values)
+                        return -ENOMEM;
+        }
+
         for (;;) {
-                JournalFile *of;
-                Iterator i;
+                _cleanup_free_ ColumnValue *v = NULL;
                 Object *o;
                 const void *odata;
                 size_t ol;
-                bool found;
                 int r;
 
                 /* Proceed to next data object in the field's linked list */
@@ -2483,37 +2944,27 @@ _public_ int sd_journal_enumerate_unique(sd_journal *j, const void **data, size_
                         return -EBADMSG;
                 }
 
-                /* OK, now let's see if we already returned this data
-                 * object by checking if it exists in the earlier
-                 * traversed files. */
-                found = false;
-                ORDERED_HASHMAP_FOREACH(of, j->files, i) {
-                        Object *oo;
-                        uint64_t op;
-
-                        if (of == j->unique_file)
-                                break;
-
-                        /* Skip this file it didn't have any fields
-                         * indexed */
-                        if (JOURNAL_HEADER_CONTAINS(of->header, n_fields) &&
-                            le64toh(of->header->n_fields) <= 0)
-                                continue;
-
-                        r = journal_file_find_data_object_with_hash(of, odata, ol, le64toh(o->data.hash), &oo, &op);
-                        if (r < 0)
-                                return r;
+                /* Within a file the field's data objects are distinct
+                 * already, across files we remember what we returned
+                 * so far, instead of looking the value up in all
+                 * earlier traversed files again. */
+                v = malloc(offsetof(ColumnValue, data) + ol);
+                if (!v)
+                        return -ENOMEM;
 
-                        if (r > 0)
-                                found = true;
-                }
+                v->n_entries = 0;
+                v->size = ol;
+                memcpy(v->data, odata, ol);
 
-                if (found)
-                        continue;
-
-                r = return_data(j, j->unique_file, o, data, l);
+                r = set_put(j->unique_values, v);
                 if (r < 0)
                         return r;
+                if (r == 0)
+                        continue;
+
+                *data = v->data;
+                *l = v->size;
+                v = NULL;
 
                 return 1;
         }
@@ -2526,6 +2977,7 @@ _public_ void sd_journal_restart_unique(sd_journal *j) {
         j->unique_file = NULL;
         j->unique_offset = 0;
         j->unique_file_lost = false;
+        j->unique_values = set_free_free(j->unique_values);
 }
 
 _public_ int sd_journal_reliable_fd(sd_journal *j) {
@@ -2578,7 +3030,7 @@ _public_ int sd_journal_get_catalog(sd_journal *j, char **ret) {
         if (r < 0)
                 return r;
 
-        r = catalog_get(CATALOG_DATABASE, id, &text);
+        r = catalog_get_cached(&j->catalog_cache, CATALOG_DATABASE, id, &text);
         if (r < 0)
                 return r;
 
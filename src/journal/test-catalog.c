@@ -150,6 +150,22 @@ static void test_catalog_file_lang(void) {
         assert_se(streq(lang4, "ru_RU"));
 }
 
+static void test_catalog_cached(const char *expected) {
+        CatalogCache c = {};
+        unsigned i;
+
+        for (i = 0; i < 2; i++) {
+                _cleanup_free_ char *text = NULL;
+
+                assert_se(catalog_get_cached(&c, database, SD_MESSAGE_COREDUMP, &text) >= 0);
+                assert_se(streq(text, expected));
+                assert_se(c.p);
+        }
+
+        catalog_cache_done(&c);
+        assert_se(!c.p);
+}
+
 int main(int argc, char *argv[]) {
         _cleanup_free_ char *text = NULL;
         int r;
@@ -174,6 +190,8 @@ int main(int argc, char *argv[]) {
         assert_se(catalog_get(database, SD_MESSAGE_COREDUMP, &text) >= 0);
         printf(">>>%s<<<\n", text);
 
+        test_catalog_cached(text);
+
         if (database)
                 unlink(database);
 
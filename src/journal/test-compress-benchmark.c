@@ -108,6 +108,9 @@ int main(int argc, char *argv[]) {
 #endif
 #ifdef HAVE_LZ4
         test_compress_decompress("LZ4", compress_blob_lz4, decompress_blob_lz4);
+#endif
+#ifdef HAVE_ZSTD
+        test_compress_decompress("ZSTD", compress_blob_zstd, decompress_blob_zstd);
 #endif
         return 0;
 }
@@ -196,6 +196,50 @@ static void test_compress_stream(int compression,
         assert_se(unlink(pattern2) == 0);
 }
 
+#ifdef HAVE_ZSTD
+static void test_compress_dictionary(void) {
+        _cleanup_(compress_dictionary_freep) CompressDictionary *d = NULL;
+        _cleanup_free_ char *samples = NULL, *decompressed = NULL;
+        size_t sizes[1024], total = 0, dict_size = 16 * 1024, csize, dsize, alloc = 0;
+        char dict[16 * 1024], compressed[512];
+        const char *msg = "MESSAGE=Started Session 4242 of user lennart.";
+        unsigned i;
+        int r;
+
+        log_debug("/* testing zstd dictionary compression */");
+
+        samples = malloc(ELEMENTSOF(sizes) * 64);
+        assert_se(samples);
+
+        for (i = 0; i < ELEMENTSOF(sizes); i++) {
+                int k;
+
+                k = sprintf(samples + total, "MESSAGE=Started Session %u of user %s.", i, i % 2 ? "root" : "lennart");
+                sizes[i] = k;
+                total += k;
+        }
+
+        r = compress_dictionary_train(samples, sizes, ELEMENTSOF(sizes), dict, &dict_size);
+        if (r < 0) {
+                log_info_errno(r, "Dictionary training failed, skipping: %m");
+                return;
+        }
+
+        assert_se(compress_dictionary_new(dict, dict_size, &d) >= 0);
+
+        assert_se(compress_blob_zstd_dictionary(d, msg, strlen(msg), compressed, &csize) == 0);
+        assert_se(csize < strlen(msg));
+
+        assert_se(decompress_blob_zstd_dictionary(d, compressed, csize, (void**) &decompressed, &alloc, &dsize, 0) == 0);
+        assert_se(dsize == strlen(msg));
+        assert_se(memcmp(decompressed, msg, dsize) == 0);
+
+        assert_se(decompress_blob_zstd_dictionary(d, compressed, csize, (void**) &decompressed, &alloc, &dsize, 8) == 0);
+        assert_se(dsize == 8);
+        assert_se(memcmp(decompressed, "MESSAGE=", 8) == 0);
+}
+#endif
+
 int main(int argc, char *argv[]) {
         const char text[] =
                 "text\0foofoofoofoo AAAA aaaaaaaaa ghost busters barbarbar FFF"
@@ -243,5 +287,23 @@ int main(int argc, char *argv[]) {
         log_info("/* LZ4 test skipped */");
 #endif
 
+#ifdef HAVE_ZSTD
+        test_compress_decompress(OBJECT_COMPRESSED_ZSTD, compress_blob_zstd, decompress_blob_zstd,
+                                 text, sizeof(text), false);
+        test_compress_decompress(OBJECT_COMPRESSED_ZSTD, compress_blob_zstd, decompress_blob_zstd,
+                                 data, sizeof(data), true);
+        test_decompress_startswith(OBJECT_COMPRESSED_ZSTD,
+                                   compress_blob_zstd, decompress_startswith_zstd,
+                                   text, sizeof(text), false);
+        test_decompress_startswith(OBJECT_COMPRESSED_ZSTD,
+                                   compress_blob_zstd, decompress_startswith_zstd,
+                                   data, sizeof(data), true);
+        test_compress_stream(OBJECT_COMPRESSED_ZSTD, "zstdcat",
+                             compress_stream_zstd, decompress_stream_zstd, argv[0]);
+        test_compress_dictionary();
+#else
+        log_info("/* ZSTD test skipped */");
+#endif
+
         return 0;
 }
@@ -151,6 +151,7 @@ static void setup_interleaved(void) {
 static void test_skip(void (*setup)(void)) {
         char t[] = "/tmp/journal-skip-XXXXXX";
         sd_journal *j;
+        uint64_t second, third;
         int r;
 
         assert_se(mkdtemp(t));
@@ -192,6 +193,38 @@ static void test_skip(void (*setup)(void)) {
         test_check_numbers_up(j, 4);
         sd_journal_close(j);
 
+        /* Seek to the realtime of the third entry, iterate down,
+         * then back up from the realtime of the second entry.
+         */
+        assert_ret(sd_journal_open_directory(&j, t, 0));
+        assert_ret(sd_journal_seek_head(j));
+        assert_ret(r = sd_journal_next_skip(j, 2));
+        assert_se(r == 2);
+        assert_ret(sd_journal_get_realtime_usec(j, &second));
+        assert_ret(sd_journal_next(j));
+        assert_ret(sd_journal_get_realtime_usec(j, &third));
+
+        assert_ret(sd_journal_seek_realtime_usec(j, third));
+        assert_ret(r = sd_journal_next(j));
+        assert_se(r == 1);
+        test_check_number(j, 3);
+        assert_ret(r = sd_journal_next(j));
+        assert_se(r == 1);
+        test_check_number(j, 4);
+        assert_ret(r = sd_journal_next(j));
+        assert_se(r == 0);
+
+        assert_ret(sd_journal_seek_realtime_usec(j, second));
+        assert_ret(r = sd_journal_previous(j));
+        assert_se(r == 1);
+        test_check_number(j, 2);
+        assert_ret(r = sd_journal_previous(j));
+        assert_se(r == 1);
+        test_check_number(j, 1);
+        assert_ret(r = sd_journal_previous(j));
+        assert_se(r == 0);
+        sd_journal_close(j);
+
         log_info("Done...");
 
         if (arg_keep)
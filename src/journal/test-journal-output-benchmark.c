@@ -0,0 +1,118 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  Copyright 2015 Lennart Poettering
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <fcntl.h>
+
+#include "sd-journal.h"
+#include "macro.h"
+#include "journal-file.h"
+#include "journal-internal.h"
+#include "logs-show.h"
+#include "rm-rf.h"
+
+#define N_ENTRIES 20000
+
+static void make_journal(const char *fn, unsigned n) {
+        JournalFile *f;
+        dual_timestamp ts;
+        unsigned i;
+
+        assert_se(journal_file_open(fn, O_RDWR|O_CREAT, 0644, true, false, NULL, NULL, NULL, &f) >= 0);
+
+        for (i = 0; i < n; i++) {
+                char message[LINE_MAX], pid[sizeof("_PID=") + DECIMAL_STR_MAX(unsigned)];
+                struct iovec iovec[12];
+                unsigned k = 0;
+
+                xsprintf(message, "MESSAGE=Benchmark message %u with a \"quoted\" part and some more text", i);
+                xsprintf(pid, "_PID=%u", 1000 + i % 97);
+
+                IOVEC_SET_STRING(iovec[k++], message);
+                IOVEC_SET_STRING(iovec[k++], pid);
+                IOVEC_SET_STRING(iovec[k++], "PRIORITY=6");
+                IOVEC_SET_STRING(iovec[k++], "SYSLOG_FACILITY=3");
+                IOVEC_SET_STRING(iovec[k++], "SYSLOG_IDENTIFIER=benchmark");
+                IOVEC_SET_STRING(iovec[k++], "_UID=1000");
+                IOVEC_SET_STRING(iovec[k++], "_GID=1000");
+                IOVEC_SET_STRING(iovec[k++], "_COMM=benchmark");
+                IOVEC_SET_STRING(iovec[k++], "_SYSTEMD_UNIT=benchmark.service");
+                IOVEC_SET_STRING(iovec[k++], "_TRANSPORT=journal");
+                IOVEC_SET_STRING(iovec[k++], "TAG=one");
+                IOVEC_SET_STRING(iovec[k++], "TAG=two");
+
+                dual_timestamp_get(&ts);
+                assert_se(journal_file_append_entry(f, &ts, iovec, k, NULL, NULL, NULL) >= 0);
+        }
+
+        journal_file_close(f);
+}
+
+static void test_output_mode(const char *path, OutputMode mode, unsigned n) {
+        _cleanup_fclose_ FILE *f = NULL;
+        sd_journal *j;
+        unsigned i = 0;
+        usec_t t;
+
+        f = fopen("/dev/null", "we");
+        assert_se(f);
+
+        assert_se(sd_journal_open_directory(&j, path, 0) >= 0);
+
+        t = now(CLOCK_MONOTONIC);
+
+        SD_JOURNAL_FOREACH(j) {
+                assert_se(output_journal(f, j, mode, 0, OUTPUT_FULL_WIDTH, NULL) >= 0);
+                i++;
+        }
+
+        t = now(CLOCK_MONOTONIC) - t;
+
+        assert_se(i == n);
+        log_info("%-16s %8.0f entries/s", output_mode_to_string(mode), (double) i * USEC_PER_SEC / MAX(t, 1u));
+
+        sd_journal_close(j);
+}
+
+int main(int argc, char *argv[]) {
+        char dn[] = "/var/tmp/test-journal-output-benchmark.XXXXXX";
+        _cleanup_free_ char *fn = NULL;
+        unsigned n = N_ENTRIES;
+        OutputMode mode;
+
+        log_set_max_level(LOG_INFO);
+        log_parse_environment();
+
+        if (argc > 1)
+                assert_se(safe_atou(argv[1], &n) >= 0);
+
+        assert_se(mkdtemp(dn));
+        fn = strappend(dn, "/test.journal");
+        assert_se(fn);
+
+        make_journal(fn, n);
+
+        for (mode = 0; mode < _OUTPUT_MODE_MAX; mode++)
+                test_output_mode(dn, mode, n);
+
+        assert_se(rm_rf(dn, REMOVE_ROOT|REMOVE_PHYSICAL) >= 0);
+
+        return 0;
+}
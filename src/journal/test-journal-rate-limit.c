@@ -0,0 +1,126 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  Copyright 2015 Lennart Poettering
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <syslog.h>
+
+#include "journald-rate-limit.h"
+#include "macro.h"
+
+static void test_burst(void) {
+        JournalRateLimit *r;
+        uint64_t n;
+        unsigned i;
+
+        /* Little space available, so that the burst is not modulated */
+        r = journal_rate_limit_new(USEC_PER_HOUR, 10, 16);
+        assert_se(r);
+
+        for (i = 0; i < 10; i++)
+                assert_se(journal_rate_limit_test(r, "foo.service", LOG_INFO, 0) == 1);
+
+        for (i = 0; i < 5; i++)
+                assert_se(journal_rate_limit_test(r, "foo.service", LOG_INFO, 0) == 0);
+
+        /* Other groups and priorities have separate buckets */
+        assert_se(journal_rate_limit_test(r, "bar.service", LOG_INFO, 0) == 1);
+        assert_se(journal_rate_limit_test(r, "foo.service", LOG_ERR, 0) == 1);
+
+        assert_se(journal_rate_limit_get_suppressed(r, "foo.service", &n) >= 0);
+        assert_se(n == 5);
+        assert_se(journal_rate_limit_get_suppressed(r, "bar.service", &n) >= 0);
+        assert_se(n == 0);
+        assert_se(journal_rate_limit_get_suppressed(r, "baz.service", &n) == -ENOENT);
+
+        journal_rate_limit_free(r);
+}
+
+static void test_refill(void) {
+        JournalRateLimit *r;
+        unsigned i, passed = 0, reported = 0;
+        usec_t start;
+        int k;
+
+        /* 100 messages per 100ms, i.e. one per ms */
+        r = journal_rate_limit_new(100 * USEC_PER_MSEC, 100, 16);
+        assert_se(r);
+
+        start = now(CLOCK_MONOTONIC);
+
+        for (i = 0; now(CLOCK_MONOTONIC) < start + 300 * USEC_PER_MSEC; i++) {
+                k = journal_rate_limit_test(r, "foo.service", LOG_INFO, 0);
+                assert_se(k >= 0);
+
+                if (k > 0)
+                        passed ++;
+                if (k > 1)
+                        reported += k - 1;
+
+                if (i % 64 == 0)
+                        usleep(100);
+        }
+
+        /* The bucket refills continuously, hence more than the
+         * initial burst passes, but not much more than the rate */
+        assert_se(passed > 100);
+        assert_se(passed <= 100 + 300 + 1);
+        assert_se(reported > 0);
+        assert_se(reported + passed <= i);
+
+        journal_rate_limit_free(r);
+}
+
+static void test_groups_max(void) {
+        JournalRateLimit *r;
+        char id[16];
+        uint64_t n;
+        unsigned i;
+
+        r = journal_rate_limit_new(USEC_PER_HOUR, 1, 4);
+        assert_se(r);
+
+        assert_se(journal_rate_limit_test(r, "0", LOG_INFO, 0) == 1);
+        assert_se(journal_rate_limit_test(r, "0", LOG_INFO, 0) == 0);
+
+        /* Keep "0" the most recently used group */
+        for (i = 1; i < 4; i++) {
+                xsprintf(id, "%u", i);
+                assert_se(journal_rate_limit_test(r, id, LOG_INFO, 0) == 1);
+                assert_se(journal_rate_limit_test(r, "0", LOG_INFO, 0) == 0);
+        }
+
+        /* This evicts "1", the least recently used group */
+        xsprintf(id, "%u", i);
+        assert_se(journal_rate_limit_test(r, id, LOG_INFO, 0) == 1);
+
+        assert_se(journal_rate_limit_get_suppressed(r, "0", &n) >= 0);
+        assert_se(n == 4);
+        assert_se(journal_rate_limit_get_suppressed(r, "1", &n) == -ENOENT);
+
+        journal_rate_limit_free(r);
+}
+
+int main(int argc, char *argv[]) {
+        test_burst();
+        test_refill();
+        test_groups_max();
+
+        return 0;
+}
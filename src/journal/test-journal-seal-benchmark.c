@@ -0,0 +1,258 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/mount.h>
+
+#include "sd-id128.h"
+#include "macro.h"
+#include "mkdir.h"
+#include "random-util.h"
+#include "util.h"
+#include "journal-authenticate.h"
+#include "journal-file.h"
+#include "journal-verify.h"
+#include "fsprg.h"
+
+/* Not a correctness test: appends the same entries to an unsealed and
+ * to a sealed journal file and compares the rates. The sealing key
+ * is generated in a private mount namespace with tmpfs mounted over
+ * /var/log/journal, hence this needs root. The sealed file is
+ * verified afterwards. */
+
+static unsigned arg_size = 128;
+static unsigned arg_fields = 4;
+static unsigned arg_entries = 200000;
+static usec_t arg_interval = 100 * USEC_PER_MSEC;
+static bool arg_prepare = true;
+
+/* How often to do what journald does after each batch of entries */
+#define BATCH_SIZE 256U
+
+static int setup_namespace(void) {
+        if (unshare(CLONE_NEWNS) < 0)
+                return -errno;
+
+        if (mount(NULL, "/", NULL, MS_SLAVE|MS_REC, NULL) < 0)
+                return -errno;
+
+        (void) mkdir_p("/var/log/journal", 0755);
+
+        if (mount("tmpfs", "/var/log/journal", "tmpfs", MS_NOSUID|MS_NODEV, "mode=0755") < 0)
+                return -errno;
+
+        return 0;
+}
+
+static void setup_keys(char **ret) {
+        _cleanup_free_ char *p = NULL, *key = NULL;
+        _cleanup_close_ int fd = -1;
+        size_t mpk_size, seed_size, state_size, i;
+        uint8_t *mpk, *seed, *state;
+        sd_id128_t machine, boot;
+        FSSHeader h = {};
+        uint64_t n;
+        char *k;
+
+        /* Like journalctl --setup-keys, but with an arbitrary
+         * interval and a seed that doesn't drain /dev/random */
+
+        assert_se(sd_id128_get_machine(&machine) >= 0);
+        assert_se(sd_id128_get_boot(&boot) >= 0);
+
+        assert_se(asprintf(&p, "/var/log/journal/" SD_ID128_FORMAT_STR, SD_ID128_FORMAT_VAL(machine)) >= 0);
+        assert_se(mkdir_p(p, 0755) >= 0);
+
+        free(p);
+        assert_se(asprintf(&p, "/var/log/journal/" SD_ID128_FORMAT_STR "/fss", SD_ID128_FORMAT_VAL(machine)) >= 0);
+
+        mpk_size = FSPRG_mskinbytes(FSPRG_RECOMMENDED_SECPAR);
+        mpk = alloca(mpk_size);
+
+        seed_size = FSPRG_RECOMMENDED_SEEDLEN;
+        seed = alloca(seed_size);
+
+        state_size = FSPRG_stateinbytes(FSPRG_RECOMMENDED_SECPAR);
+        state = alloca(state_size);
+
+        random_bytes(seed, seed_size);
+
+        FSPRG_GenMK(NULL, mpk, seed, seed_size, FSPRG_RECOMMENDED_SECPAR);
+        FSPRG_GenState0(state, mpk, seed, seed_size);
+
+        n = now(CLOCK_REALTIME) / arg_interval;
+
+        memcpy(h.signature, "KSHHRHLP", 8);
+        h.machine_id = machine;
+        h.boot_id = boot;
+        h.header_size = htole64(sizeof(h));
+        h.start_usec = htole64(n * arg_interval);
+        h.interval_usec = htole64(arg_interval);
+        h.fsprg_secpar = htole16(FSPRG_RECOMMENDED_SECPAR);
+        h.fsprg_state_size = htole64(state_size);
+
+        fd = open(p, O_WRONLY|O_CREAT|O_EXCL|O_CLOEXEC|O_NOCTTY, 0600);
+        assert_se(fd >= 0);
+        assert_se(loop_write(fd, &h, sizeof(h), false) >= 0);
+        assert_se(loop_write(fd, state, state_size, false) >= 0);
+
+        /* The verification key, in the format journalctl prints */
+        key = new(char, seed_size * 2 + 1 + DECIMAL_STR_MAX(uint64_t) * 2 + 2);
+        assert_se(key);
+
+        for (i = 0, k = key; i < seed_size; i++) {
+                *k++ = hexchar(seed[i] >> 4);
+                *k++ = hexchar(seed[i] & 15);
+        }
+        sprintf(k, "/%llx-%llx", (unsigned long long) n, (unsigned long long) arg_interval);
+
+        *ret = key;
+        key = NULL;
+}
+
+static usec_t append_entries(const char *fn, bool seal, const char *payload) {
+        JournalFile *f;
+        struct iovec *iovec;
+        char **fields;
+        usec_t ts;
+        unsigned n, i;
+
+        assert_se(journal_file_open(fn, O_RDWR|O_CREAT, 0644, false, seal, NULL, NULL, NULL, &f) == 0);
+        assert_se(!!f->seal == seal);
+
+        iovec = newa(struct iovec, arg_fields + 1);
+        fields = newa0(char*, arg_fields + 1);
+
+        ts = now(CLOCK_MONOTONIC);
+
+        for (n = 0; n < arg_entries; n++) {
+                char *message;
+
+                /* A new MESSAGE= data object each time, and a few
+                 * fields that are mostly deduplicated */
+                assert_se(asprintf(&message, "MESSAGE=%u %s", n, payload) >= 0);
+                IOVEC_SET_STRING(iovec[0], message);
+
+                for (i = 0; i < arg_fields; i++) {
+                        free(fields[i]);
+                        assert_se(asprintf(&fields[i], "BENCHMARK_FIELD_%u=%u", i, (n / (i + 1)) % 64) >= 0);
+                        IOVEC_SET_STRING(iovec[i + 1], fields[i]);
+                }
+
+                assert_se(journal_file_append_entry(f, NULL, iovec, arg_fields + 1, NULL, NULL, NULL) == 0);
+                free(message);
+
+                if (n % BATCH_SIZE == BATCH_SIZE - 1) {
+                        journal_file_maybe_append_tag(f, 0);
+                        if (arg_prepare)
+                                journal_file_fsprg_prepare(f);
+                }
+        }
+
+        journal_file_close(f);
+
+        ts = now(CLOCK_MONOTONIC) - ts;
+
+        for (i = 0; i < arg_fields; i++)
+                free(fields[i]);
+
+        return ts;
+}
+
+int main(int argc, char *argv[]) {
+        _cleanup_free_ char *payload = NULL, *key = NULL;
+        char t[] = "/var/log/journal/benchmark-XXXXXX";
+        char a[FORMAT_TIMESPAN_MAX], b[FORMAT_TIMESPAN_MAX];
+        usec_t unsealed, sealed;
+        JournalFile *f;
+        unsigned i;
+        int r;
+
+        log_parse_environment();
+        log_open();
+
+        for (i = 1; i < (unsigned) argc; i++) {
+                const char *v;
+
+                if ((v = startswith(argv[i], "size=")))
+                        assert_se(safe_atou(v, &arg_size) >= 0 && arg_size > 0);
+                else if ((v = startswith(argv[i], "fields=")))
+                        assert_se(safe_atou(v, &arg_fields) >= 0);
+                else if ((v = startswith(argv[i], "entries=")))
+                        assert_se(safe_atou(v, &arg_entries) >= 0 && arg_entries > 0);
+                else if ((v = startswith(argv[i], "interval=")))
+                        assert_se(parse_sec(v, &arg_interval) >= 0 && arg_interval > 0);
+                else if ((v = startswith(argv[i], "prepare="))) {
+                        r = parse_boolean(v);
+                        assert_se(r >= 0);
+                        arg_prepare = r;
+                } else {
+                        log_error("Usage: %s [size=BYTES] [fields=N] [entries=N] [interval=TIME] [prepare=BOOL]", program_invocation_short_name);
+                        return EXIT_FAILURE;
+                }
+        }
+
+        /* journal_file_open requires a valid machine id */
+        if (access("/etc/machine-id", F_OK) != 0)
+                return EXIT_TEST_SKIP;
+
+        if (getuid() != 0) {
+                log_notice("Not running as root, skipping.");
+                return EXIT_TEST_SKIP;
+        }
+
+        r = setup_namespace();
+        if (r < 0) {
+                log_notice_errno(r, "Failed to set up private /var/log/journal, skipping: %m");
+                return EXIT_TEST_SKIP;
+        }
+
+        setup_keys(&key);
+
+        assert_se(mkdtemp(t));
+        assert_se(chdir(t) >= 0);
+
+        payload = new(char, arg_size + 1);
+        assert_se(payload);
+        for (i = 0; i < arg_size; i++)
+                payload[i] = 'a' + i % 26;
+        payload[arg_size] = 0;
+
+        log_info("Appending %u entries of %u bytes with %u extra fields, sealing interval %s.",
+                 arg_entries, arg_size, arg_fields, format_timespan(a, sizeof(a), arg_interval, 0));
+
+        unsealed = append_entries("unsealed.journal", false, payload);
+        sealed = append_entries("sealed.journal", true, payload);
+
+        log_info("unsealed: %s, %.0f entries/sec",
+                 format_timespan(a, sizeof(a), unsealed, USEC_PER_MSEC),
+                 (double) arg_entries * USEC_PER_SEC / MAX(unsealed, 1U));
+        log_info("sealed:   %s, %.0f entries/sec, %+.1f%% time",
+                 format_timespan(b, sizeof(b), sealed, USEC_PER_MSEC),
+                 (double) arg_entries * USEC_PER_SEC / MAX(sealed, 1U),
+                 100.0 * ((double) sealed - (double) unsealed) / MAX(unsealed, 1U));
+
+        assert_se(journal_file_open("sealed.journal", O_RDONLY, 0644, false, true, NULL, NULL, NULL, &f) == 0);
+        assert_se(journal_file_verify(f, key, NULL, NULL, NULL, false) >= 0);
+        log_info("sealed: %"PRIu64" tags, verified", le64toh(f->header->n_tags));
+        journal_file_close(f);
+
+        return 0;
+}
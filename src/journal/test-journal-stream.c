@@ -186,8 +186,27 @@ int main(int argc, char *argv[]) {
         verify_contents(j, 0);
 
         assert_se(sd_journal_query_unique(j, "NUMBER") >= 0);
-        SD_JOURNAL_FOREACH_UNIQUE(j, data, l)
+        i = 0;
+        SD_JOURNAL_FOREACH_UNIQUE(j, data, l) {
                 printf("%.*s\n", (int) l, (const char*) data);
+                i++;
+        }
+        assert_se(i == N_ENTRIES);
+
+        /* Both values show up in all three files, but are returned once */
+        assert_se(sd_journal_query_unique(j, "MAGIC") >= 0);
+        i = 0;
+        SD_JOURNAL_FOREACH_UNIQUE(j, data, l) {
+                assert_se(l == strlen("MAGIC=quux") || l == strlen("MAGIC=waldo"));
+                i++;
+        }
+        assert_se(i == 2);
+
+        /* Restarting forgets the values returned before */
+        i = 0;
+        SD_JOURNAL_FOREACH_UNIQUE(j, data, l)
+                i++;
+        assert_se(i == 2);
 
         assert_se(rm_rf(t, REMOVE_ROOT|REMOVE_PHYSICAL) >= 0);
 
@@ -22,11 +22,18 @@
 #include <fcntl.h>
 #include <unistd.h>
 
+#include "sd-event.h"
+#include "sd-journal.h"
 #include "log.h"
 #include "rm-rf.h"
 #include "journal-file.h"
+#include "journal-internal.h"
 #include "journal-authenticate.h"
 #include "journal-vacuum.h"
+#include "journal-verify.h"
+#include "lookup3.h"
+#include "util.h"
+#include "event-util.h"
 
 static bool arg_keep = false;
 
@@ -124,6 +131,418 @@ static void test_non_empty(void) {
         puts("------------------------------------------------------------");
 }
 
+static void test_append_entries(void) {
+        dual_timestamp ts;
+        JournalFile *f;
+        struct iovec iovec[3];
+        JournalFileEntry entries[3];
+        static const char test[] = "TEST1=1", test2[] = "TEST2=2";
+        Object *o;
+        uint64_t p, seqnum = 0;
+        unsigned n = 0;
+        char t[] = "/tmp/journal-XXXXXX";
+
+        log_set_max_level(LOG_DEBUG);
+
+        assert_se(mkdtemp(t));
+        assert_se(chdir(t) >= 0);
+
+        assert_se(journal_file_open("test.journal", O_RDWR|O_CREAT, 0666, true, false, NULL, NULL, NULL, &f) == 0);
+
+        dual_timestamp_get(&ts);
+
+        iovec[0].iov_base = (void*) test;
+        iovec[0].iov_len = strlen(test);
+        iovec[1].iov_base = (void*) test2;
+        iovec[1].iov_len = strlen(test2);
+        iovec[2] = iovec[0];
+
+        entries[0] = (JournalFileEntry) { &ts, &iovec[0], 1 };
+        entries[1] = (JournalFileEntry) { &ts, &iovec[1], 1 };
+        entries[2] = (JournalFileEntry) { &ts, &iovec[0], 2 };
+
+        assert_se(journal_file_append_entries(f, entries, 0, &seqnum, &n) == 0);
+        assert_se(n == 0);
+
+        assert_se(journal_file_append_entries(f, entries, 3, &seqnum, &n) == 0);
+        assert_se(n == 3);
+        assert_se(seqnum == 3);
+        assert_se(le64toh(f->header->n_entries) == 3);
+        assert_se(le64toh(f->header->n_data) == 2);
+
+        assert_se(journal_file_next_entry(f, 0, DIRECTION_DOWN, &o, &p) == 1);
+        assert_se(le64toh(o->entry.seqnum) == 1);
+        assert_se(journal_file_entry_n_items(o) == 1);
+
+        assert_se(journal_file_next_entry(f, p, DIRECTION_DOWN, &o, &p) == 1);
+        assert_se(le64toh(o->entry.seqnum) == 2);
+
+        assert_se(journal_file_next_entry(f, p, DIRECTION_DOWN, &o, &p) == 1);
+        assert_se(le64toh(o->entry.seqnum) == 3);
+        assert_se(journal_file_entry_n_items(o) == 2);
+
+        assert_se(journal_file_next_entry(f, p, DIRECTION_DOWN, &o, &p) == 0);
+
+        assert_se(journal_file_find_data_object(f, test2, strlen(test2), NULL, &p) == 1);
+        assert_se(journal_file_next_entry_for_data(f, NULL, 0, p, DIRECTION_UP, &o, NULL) == 1);
+        assert_se(le64toh(o->entry.seqnum) == 3);
+
+        journal_file_close(f);
+
+        if (arg_keep)
+                log_info("Not removing %s", t);
+        else
+                assert_se(rm_rf(t, REMOVE_ROOT|REMOVE_PHYSICAL) >= 0);
+
+        puts("------------------------------------------------------------");
+}
+
+static void test_post_change_timer(void) {
+        _cleanup_event_unref_ sd_event *e = NULL;
+        dual_timestamp ts;
+        JournalFile *f;
+        struct iovec iovec;
+        static const char test[] = "TEST1=1";
+        int enabled;
+        char t[] = "/tmp/journal-XXXXXX";
+
+        log_set_max_level(LOG_DEBUG);
+
+        assert_se(mkdtemp(t));
+        assert_se(chdir(t) >= 0);
+
+        assert_se(sd_event_new(&e) >= 0);
+
+        assert_se(journal_file_open("test.journal", O_RDWR|O_CREAT, 0666, true, false, NULL, NULL, NULL, &f) == 0);
+        assert_se(journal_file_enable_post_change_timer(f, e, USEC_PER_MSEC) >= 0);
+
+        iovec.iov_base = (void*) test;
+        iovec.iov_len = strlen(test);
+
+        /* Both appends are covered by one notification */
+        dual_timestamp_get(&ts);
+        assert_se(journal_file_append_entry(f, &ts, &iovec, 1, NULL, NULL, NULL) == 0);
+        assert_se(sd_event_source_get_enabled(f->post_change_timer, &enabled) >= 0);
+        assert_se(enabled == SD_EVENT_ONESHOT);
+
+        assert_se(journal_file_append_entry(f, &ts, &iovec, 1, NULL, NULL, NULL) == 0);
+        assert_se(sd_event_source_get_enabled(f->post_change_timer, &enabled) >= 0);
+        assert_se(enabled == SD_EVENT_ONESHOT);
+
+        assert_se(sd_event_run(e, USEC_INFINITY) > 0);
+        assert_se(sd_event_source_get_enabled(f->post_change_timer, &enabled) >= 0);
+        assert_se(enabled == SD_EVENT_OFF);
+
+        /* The timer is carried over to the rotated file */
+        assert_se(journal_file_rotate(&f, true, false) >= 0);
+        assert_se(f->post_change_timer);
+        assert_se(f->post_change_timer_period == USEC_PER_MSEC);
+
+        assert_se(journal_file_append_entry(f, &ts, &iovec, 1, NULL, NULL, NULL) == 0);
+        assert_se(sd_event_source_get_enabled(f->post_change_timer, &enabled) >= 0);
+        assert_se(enabled == SD_EVENT_ONESHOT);
+
+        journal_file_close(f);
+
+        if (arg_keep)
+                log_info("Not removing %s", t);
+        else
+                assert_se(rm_rf(t, REMOVE_ROOT|REMOVE_PHYSICAL) >= 0);
+
+        puts("------------------------------------------------------------");
+}
+
+static void test_bloom_filter(void) {
+        _cleanup_closedir_ DIR *d = NULL;
+        dual_timestamp ts;
+        JournalFile *f;
+        struct iovec iovec;
+        struct dirent *de;
+        static const char test[] = "TEST1=1", test2[] = "TEST2=2";
+        unsigned n = 0;
+        char t[] = "/tmp/journal-XXXXXX";
+
+        log_set_max_level(LOG_DEBUG);
+
+        assert_se(mkdtemp(t));
+        assert_se(chdir(t) >= 0);
+
+        assert_se(journal_file_open("test.journal", O_RDWR|O_CREAT, 0666, true, false, NULL, NULL, NULL, &f) == 0);
+
+        dual_timestamp_get(&ts);
+
+        iovec.iov_base = (void*) test;
+        iovec.iov_len = strlen(test);
+        assert_se(journal_file_append_entry(f, &ts, &iovec, 1, NULL, NULL, NULL) == 0);
+
+        iovec.iov_base = (void*) test2;
+        iovec.iov_len = strlen(test2);
+        assert_se(journal_file_append_entry(f, &ts, &iovec, 1, NULL, NULL, NULL) == 0);
+
+        /* Files get their bloom filter when they are archived */
+        assert_se(!JOURNAL_HEADER_BLOOM_FILTER(f->header));
+        assert_se(journal_file_bloom_filter_check(f, hash64("quux", 4)) == 1);
+
+        assert_se(journal_file_rotate(&f, true, false) >= 0);
+        journal_file_close(f);
+
+        assert_se(d = opendir("."));
+
+        FOREACH_DIRENT(de, d, assert_not_reached("readdir failed")) {
+                if (!startswith(de->d_name, "test@"))
+                        continue;
+
+                assert_se(journal_file_open(de->d_name, O_RDONLY, 0, false, false, NULL, NULL, NULL, &f) == 0);
+
+                assert_se(JOURNAL_HEADER_BLOOM_FILTER(f->header));
+                assert_se(journal_file_bloom_filter_check(f, hash64(test, strlen(test))) == 1);
+                assert_se(journal_file_bloom_filter_check(f, hash64(test2, strlen(test2))) == 1);
+                assert_se(journal_file_bloom_filter_check(f, hash64("quux", 4)) == 0);
+                assert_se(journal_file_verify(f, NULL, NULL, NULL, NULL, false) >= 0);
+
+                journal_file_close(f);
+                n++;
+        }
+
+        assert_se(n == 1);
+
+        if (arg_keep)
+                log_info("Not removing %s", t);
+        else
+                assert_se(rm_rf(t, REMOVE_ROOT|REMOVE_PHYSICAL) >= 0);
+
+        puts("------------------------------------------------------------");
+}
+
+static void test_compact(void) {
+        _cleanup_closedir_ DIR *d = NULL;
+        dual_timestamp ts;
+        JournalFile *f;
+        struct iovec iovec;
+        struct dirent *de;
+        char data[32];
+        uint64_t p = 0, saved = 0;
+        sd_id128_t seqnum_id;
+        Object *o;
+        unsigned i, n = 0;
+        char t[] = "/tmp/journal-XXXXXX";
+
+        log_set_max_level(LOG_DEBUG);
+
+        assert_se(mkdtemp(t));
+        assert_se(chdir(t) >= 0);
+
+        assert_se(journal_file_open("test.journal", O_RDWR|O_CREAT, 0666, true, false, NULL, NULL, NULL, &f) == 0);
+
+        for (i = 0; i < 100; i++) {
+                dual_timestamp_get(&ts);
+
+                xsprintf(data, "NUMBER=%u", i);
+                iovec.iov_base = data;
+                iovec.iov_len = strlen(data);
+                assert_se(journal_file_append_entry(f, &ts, &iovec, 1, NULL, NULL, NULL) == 0);
+        }
+
+        /* Active files are never touched */
+        assert_se(journal_file_compact(f, true, NULL, &saved) == -EBUSY);
+
+        seqnum_id = f->header->seqnum_id;
+
+        assert_se(journal_file_rotate(&f, true, false) >= 0);
+        journal_file_close(f);
+
+        assert_se(d = opendir("."));
+
+        FOREACH_DIRENT(de, d, assert_not_reached("readdir failed")) {
+                if (!startswith(de->d_name, "test@"))
+                        continue;
+
+                assert_se(journal_file_open(de->d_name, O_RDONLY, 0, false, false, NULL, NULL, NULL, &f) == 0);
+                assert_se(journal_file_compact(f, true, NULL, &saved) == 1);
+                assert_se(saved > 0);
+                journal_file_close(f);
+
+                assert_se(journal_file_open(de->d_name, O_RDONLY, 0, false, false, NULL, NULL, NULL, &f) == 0);
+                assert_se(f->header->state == STATE_ARCHIVED);
+                assert_se(sd_id128_equal(f->header->seqnum_id, seqnum_id));
+                assert_se(le64toh(f->header->n_entries) == 100);
+                assert_se(journal_file_verify(f, NULL, NULL, NULL, NULL, false) >= 0);
+
+                for (i = 0; i < 100; i++) {
+                        assert_se(journal_file_next_entry(f, p, DIRECTION_DOWN, &o, &p) == 1);
+                        assert_se(le64toh(o->entry.seqnum) == i + 1);
+                }
+                assert_se(journal_file_next_entry(f, p, DIRECTION_DOWN, &o, &p) == 0);
+
+                /* The second run has nothing left to gain */
+                assert_se(journal_file_compact(f, true, NULL, &saved) == 0);
+                assert_se(saved == 0);
+
+                journal_file_close(f);
+                n++;
+        }
+
+        assert_se(n == 1);
+
+        if (arg_keep)
+                log_info("Not removing %s", t);
+        else
+                assert_se(rm_rf(t, REMOVE_ROOT|REMOVE_PHYSICAL) >= 0);
+
+        puts("------------------------------------------------------------");
+}
+
+static void check_column(const char *dir, uint64_t since, uint64_t until, uint64_t n3, uint64_t n6) {
+        _cleanup_journal_close_ sd_journal *j = NULL;
+        const void *data;
+        size_t l;
+        uint64_t n;
+        unsigned k = 0;
+
+        assert_se(sd_journal_open_directory(&j, dir, 0) >= 0);
+        assert_se(sd_journal_query_column(j, "PRIORITY", since, until) >= 0);
+
+        SD_JOURNAL_FOREACH_COLUMN(j, data, l, n) {
+                if (l == strlen("PRIORITY=3") && memcmp(data, "PRIORITY=3", l) == 0)
+                        assert_se(n == n3);
+                else if (l == strlen("PRIORITY=6") && memcmp(data, "PRIORITY=6", l) == 0)
+                        assert_se(n == n6);
+                else
+                        assert_not_reached("unexpected value");
+                k++;
+        }
+
+        assert_se(k == (n3 > 0) + (n6 > 0));
+}
+
+static void test_columns(void) {
+        _cleanup_closedir_ DIR *d = NULL;
+        struct dirent *de;
+        dual_timestamp ts;
+        JournalFile *f;
+        struct iovec iovec[2];
+        static const char p3[] = "PRIORITY=3", p6[] = "PRIORITY=6", m[] = "MESSAGE=foo";
+        usec_t start;
+        unsigned i;
+        char t[] = "/tmp/journal-XXXXXX";
+
+        log_set_max_level(LOG_DEBUG);
+
+        assert_se(mkdtemp(t));
+        assert_se(chdir(t) >= 0);
+
+        assert_se(journal_file_open("test.journal", O_RDWR|O_CREAT, 0666, true, false, NULL, NULL, NULL, &f) == 0);
+
+        dual_timestamp_get(&ts);
+        start = ts.realtime;
+
+        /* Runs of 3 entries at priority 3, followed by 7 at 6, the
+         * very first entry has no priority at all */
+        for (i = 0; i < 100; i++) {
+                ts.realtime = start + i;
+                ts.monotonic++;
+
+                iovec[0].iov_base = (void*) m;
+                iovec[0].iov_len = strlen(m);
+                iovec[1].iov_base = (void*) (i % 10 < 3 ? p3 : p6);
+                iovec[1].iov_len = strlen(iovec[1].iov_base);
+                assert_se(journal_file_append_entry(f, &ts, iovec, i == 0 ? 1 : 2, NULL, NULL, NULL) == 0);
+        }
+
+        assert_se(!JOURNAL_HEADER_COLUMNS(f->header));
+        assert_se(journal_file_find_column(f, "PRIORITY", strlen("PRIORITY"), NULL, NULL) == 0);
+
+        /* Active files are scanned per data object */
+        check_column(t, 0, (uint64_t) -1, 29, 70);
+        check_column(t, start + 10, start + 20, 3, 7);
+        check_column(t, start + 95, (uint64_t) -1, 0, 5);
+
+        assert_se(journal_file_rotate(&f, true, false) >= 0);
+        journal_file_close(f);
+
+        /* Archived ones have a column, and give the same answers */
+        check_column(t, 0, (uint64_t) -1, 29, 70);
+        check_column(t, start + 10, start + 20, 3, 7);
+        check_column(t, start + 95, (uint64_t) -1, 0, 5);
+        check_column(t, start + 200, (uint64_t) -1, 0, 0);
+
+        assert_se(d = opendir("."));
+
+        FOREACH_DIRENT(de, d, assert_not_reached("readdir failed")) {
+                if (!startswith(de->d_name, "test@"))
+                        continue;
+
+                assert_se(journal_file_open(de->d_name, O_RDONLY, 0, false, false, NULL, NULL, NULL, &f) == 0);
+                assert_se(JOURNAL_HEADER_COLUMNS(f->header));
+                assert_se(journal_file_find_column(f, "PRIORITY", strlen("PRIORITY"), NULL, NULL) == 1);
+                assert_se(journal_file_find_column(f, "MESSAGE", strlen("MESSAGE"), NULL, NULL) == 0);
+                assert_se(journal_file_verify(f, NULL, NULL, NULL, NULL, false) >= 0);
+                journal_file_close(f);
+        }
+
+        if (arg_keep)
+                log_info("Not removing %s", t);
+        else
+                assert_se(rm_rf(t, REMOVE_ROOT|REMOVE_PHYSICAL) >= 0);
+
+        puts("------------------------------------------------------------");
+}
+
+static void test_vacuum_index(void) {
+        _cleanup_(vacuum_index_freep) VacuumIndex *i = NULL;
+        _cleanup_closedir_ DIR *d = NULL;
+        struct dirent *de;
+        dual_timestamp ts;
+        JournalFile *f;
+        struct iovec iovec;
+        static const char test[] = "TEST1=1";
+        usec_t oldest = 0;
+        unsigned k;
+        char t[] = "/tmp/journal-XXXXXX";
+
+        log_set_max_level(LOG_DEBUG);
+
+        assert_se(mkdtemp(t));
+        assert_se(chdir(t) >= 0);
+
+        assert_se(journal_file_open("test.journal", O_RDWR|O_CREAT, 0666, true, false, NULL, NULL, NULL, &f) == 0);
+
+        iovec.iov_base = (void*) test;
+        iovec.iov_len = strlen(test);
+
+        for (k = 0; k < 2; k++) {
+                dual_timestamp_get(&ts);
+                assert_se(journal_file_append_entry(f, &ts, &iovec, 1, NULL, NULL, NULL) == 0);
+                assert_se(journal_file_rotate(&f, true, false) >= 0);
+        }
+
+        assert_se(vacuum_index_new(t, true, &i) >= 0);
+
+        /* The index learns about this one via inotify */
+        dual_timestamp_get(&ts);
+        assert_se(journal_file_append_entry(f, &ts, &iovec, 1, NULL, NULL, NULL) == 0);
+        assert_se(journal_file_rotate(&f, true, false) >= 0);
+
+        /* Nothing to do within the limits */
+        assert_se(vacuum_index_vacuum(i, (uint64_t) -1, 0, &oldest, true) >= 0);
+        assert_se(oldest > 0);
+
+        assert_se(vacuum_index_vacuum(i, 1, 0, NULL, true) >= 0);
+
+        assert_se(d = opendir("."));
+        FOREACH_DIRENT(de, d, assert_not_reached("readdir failed"))
+                assert_se(!startswith(de->d_name, "test@"));
+
+        journal_file_close(f);
+
+        if (arg_keep)
+                log_info("Not removing %s", t);
+        else
+                assert_se(rm_rf(t, REMOVE_ROOT|REMOVE_PHYSICAL) >= 0);
+
+        puts("------------------------------------------------------------");
+}
+
 static void test_empty(void) {
         JournalFile *f1, *f2, *f3, *f4;
         char t[] = "/tmp/journal-XXXXXX";
@@ -174,6 +593,12 @@ int main(int argc, char *argv[]) {
                 return EXIT_TEST_SKIP;
 
         test_non_empty();
+        test_append_entries();
+        test_post_change_timer();
+        test_bloom_filter();
+        test_compact();
+        test_columns();
+        test_vacuum_index();
         test_empty();
 
         return 0;
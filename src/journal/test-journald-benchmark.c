@@ -0,0 +1,320 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mount.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+#include "sd-event.h"
+#include "macro.h"
+#include "mkdir.h"
+#include "socket-util.h"
+#include "util.h"
+#include "journald-server.h"
+
+/* Not a correctness test: runs a journald server in this process, in a
+ * private mount namespace with tmpfs mounted over its directories in
+ * /run, and floods one of its sockets from a number of producer
+ * threads. Needs root. */
+
+typedef enum Transport {
+        TRANSPORT_NATIVE,
+        TRANSPORT_SYSLOG,
+        TRANSPORT_STDOUT,
+} Transport;
+
+static Transport arg_transport = TRANSPORT_NATIVE;
+static unsigned arg_size = 128;
+static unsigned arg_fields = 0;
+static unsigned arg_producers = 4;
+static unsigned arg_messages = 200000;
+
+typedef struct Producer {
+        pthread_t thread;
+        unsigned index;
+        unsigned n_messages;
+        char *payload;
+} Producer;
+
+static int producer_connect(int type, const char *path) {
+        union sockaddr_union sa = {
+                .un.sun_family = AF_UNIX,
+        };
+        int fd;
+
+        strncpy(sa.un.sun_path, path, sizeof(sa.un.sun_path));
+
+        fd = socket(AF_UNIX, type|SOCK_CLOEXEC, 0);
+        if (fd < 0)
+                return -errno;
+
+        /* Datagrams block once the server's queue is full, hence no
+         * message is lost */
+        if (connect(fd, &sa.sa, offsetof(struct sockaddr_un, sun_path) + strlen(path)) < 0) {
+                safe_close(fd);
+                return -errno;
+        }
+
+        return fd;
+}
+
+static char *make_native(Producer *p) {
+        _cleanup_free_ char *fields = NULL;
+        char *m;
+        unsigned i;
+
+        fields = strdup("");
+        assert_se(fields);
+
+        for (i = 0; i < arg_fields; i++) {
+                char *t;
+
+                assert_se(asprintf(&t, "%sBENCHMARK_FIELD_%u=value %u of producer %u\n", fields, i, i, p->index) >= 0);
+                free(fields);
+                fields = t;
+        }
+
+        assert_se(asprintf(&m, "MESSAGE=%s\nPRIORITY=6\nSYSLOG_IDENTIFIER=benchmark\n%s", p->payload, fields) >= 0);
+        return m;
+}
+
+static void *producer_thread(void *userdata) {
+        Producer *p = userdata;
+        _cleanup_free_ char *m = NULL;
+        _cleanup_close_ int fd = -1;
+        unsigned i;
+
+        switch (arg_transport) {
+
+        case TRANSPORT_NATIVE:
+                fd = producer_connect(SOCK_DGRAM, "/run/systemd/journal/socket");
+                m = make_native(p);
+                break;
+
+        case TRANSPORT_SYSLOG:
+                fd = producer_connect(SOCK_DGRAM, "/run/systemd/journal/dev-log");
+                assert_se(asprintf(&m, "<14>benchmark[%u]: %s", p->index + 1, p->payload) >= 0);
+                break;
+
+        case TRANSPORT_STDOUT:
+                fd = producer_connect(SOCK_STREAM, "/run/systemd/journal/stdout");
+                assert_se(asprintf(&m, "%s\n", p->payload) >= 0);
+
+                /* identifier, unit, priority, level prefix, forward
+                 * to syslog, kmsg, console */
+                if (fd >= 0)
+                        assert_se(loop_write(fd, "benchmark\n\n6\n0\n0\n0\n0\n", strlen("benchmark\n\n6\n0\n0\n0\n0\n"), false) >= 0);
+                break;
+        }
+
+        assert_se(fd >= 0);
+
+        for (i = 0; i < p->n_messages; i++) {
+                if (arg_transport == TRANSPORT_STDOUT)
+                        assert_se(loop_write(fd, m, strlen(m), false) >= 0);
+                else
+                        assert_se(send(fd, m, strlen(m), MSG_NOSIGNAL) >= 0);
+        }
+
+        return NULL;
+}
+
+static int setup_namespace(void) {
+        static const char * const dirs[] = {
+                "/run/systemd/journal",
+                "/run/log/journal",
+        };
+        unsigned i;
+
+        if (unshare(CLONE_NEWNS) < 0)
+                return -errno;
+
+        if (mount(NULL, "/", NULL, MS_SLAVE|MS_REC, NULL) < 0)
+                return -errno;
+
+        for (i = 0; i < ELEMENTSOF(dirs); i++) {
+                (void) mkdir_p(dirs[i], 0755);
+
+                if (mount("tmpfs", dirs[i], "tmpfs", MS_NOSUID|MS_NODEV, "mode=0755") < 0)
+                        return -errno;
+        }
+
+        return 0;
+}
+
+static usec_t thread_cpu_usec(void) {
+        struct rusage ru;
+
+        assert_se(getrusage(RUSAGE_THREAD, &ru) >= 0);
+        return timeval_load(&ru.ru_utime) + timeval_load(&ru.ru_stime);
+}
+
+static uint64_t timing_percentile(const TimingStatistics *t, unsigned percent) {
+        uint64_t n = 0;
+        unsigned b;
+
+        /* The upper bound of the histogram bucket the percentile
+         * falls into */
+        for (b = 0; b < TIMING_HISTOGRAM_BUCKETS; b++) {
+                n += t->buckets[b];
+                if (n * 100 >= t->count * percent)
+                        return b < TIMING_HISTOGRAM_BUCKETS - 1 ? UINT64_C(1) << b : t->max_usec;
+        }
+
+        return t->max_usec;
+}
+
+static ServerSource transport_source(Transport t) {
+        switch (t) {
+
+        case TRANSPORT_NATIVE:
+                return SERVER_SOURCE_NATIVE;
+
+        case TRANSPORT_SYSLOG:
+                return SERVER_SOURCE_SYSLOG;
+
+        case TRANSPORT_STDOUT:
+                return SERVER_SOURCE_STDOUT;
+        }
+
+        assert_not_reached("Unknown transport");
+}
+
+int main(int argc, char *argv[]) {
+        _cleanup_free_ Producer *producers = NULL;
+        _cleanup_free_ char *payload = NULL;
+        Server server;
+        ServerSource source;
+        uint64_t n, expected, bytes;
+        usec_t ts, cpu;
+        unsigned i;
+        int r;
+
+        log_parse_environment();
+        log_open();
+
+        for (i = 1; i < (unsigned) argc; i++) {
+                const char *v;
+
+                if (streq(argv[i], "native"))
+                        arg_transport = TRANSPORT_NATIVE;
+                else if (streq(argv[i], "syslog"))
+                        arg_transport = TRANSPORT_SYSLOG;
+                else if (streq(argv[i], "stdout"))
+                        arg_transport = TRANSPORT_STDOUT;
+                else if ((v = startswith(argv[i], "size=")))
+                        assert_se(safe_atou(v, &arg_size) >= 0 && arg_size > 0 && arg_size < LINE_MAX);
+                else if ((v = startswith(argv[i], "fields=")))
+                        assert_se(safe_atou(v, &arg_fields) >= 0);
+                else if ((v = startswith(argv[i], "producers=")))
+                        assert_se(safe_atou(v, &arg_producers) >= 0 && arg_producers > 0);
+                else if ((v = startswith(argv[i], "messages=")))
+                        assert_se(safe_atou(v, &arg_messages) >= 0 && arg_messages > 0);
+                else {
+                        log_error("Usage: %s [native|syslog|stdout] [size=BYTES] [fields=N] [producers=N] [messages=N]", program_invocation_short_name);
+                        return EXIT_FAILURE;
+                }
+        }
+
+        if (getuid() != 0) {
+                log_notice("Not running as root, skipping.");
+                return EXIT_TEST_SKIP;
+        }
+
+        r = setup_namespace();
+        if (r < 0) {
+                log_notice_errno(r, "Failed to set up private /run directories, skipping: %m");
+                return EXIT_TEST_SKIP;
+        }
+
+        r = server_init(&server);
+        if (r < 0) {
+                log_error_errno(r, "Failed to start server: %m");
+                return EXIT_FAILURE;
+        }
+
+        /* Only measure what we send ourselves: no kernel or audit
+         * messages, no rate limiting, no forwarding */
+        sd_event_source_set_enabled(server.dev_kmsg_event_source, SD_EVENT_OFF);
+        sd_event_source_set_enabled(server.audit_event_source, SD_EVENT_OFF);
+        journal_rate_limit_free(server.rate_limit);
+        server.rate_limit = NULL;
+        server.forward_to_syslog = server.forward_to_kmsg = server.forward_to_console = server.forward_to_wall = false;
+
+        payload = new(char, arg_size + 1);
+        assert_se(payload);
+        for (i = 0; i < arg_size; i++)
+                payload[i] = 'a' + i % 26;
+        payload[arg_size] = 0;
+
+        source = transport_source(arg_transport);
+        n = arg_messages / arg_producers * arg_producers;
+        expected = server.stats.n_received[source] + n;
+
+        producers = new0(Producer, arg_producers);
+        assert_se(producers);
+
+        log_info("Sending %"PRIu64" messages of %u bytes with %u extra fields from %u producers.",
+                 n, arg_size, arg_fields, arg_producers);
+
+        zero(server.stats.write);
+        bytes = server.stats.n_received_bytes[source];
+        cpu = thread_cpu_usec();
+        ts = now(CLOCK_MONOTONIC);
+
+        for (i = 0; i < arg_producers; i++) {
+                producers[i].index = i;
+                producers[i].n_messages = arg_messages / arg_producers;
+                producers[i].payload = payload;
+                assert_se(pthread_create(&producers[i].thread, NULL, producer_thread, producers + i) == 0);
+        }
+
+        while (server.stats.n_received[source] < expected)
+                assert_se(sd_event_run(server.event, USEC_PER_SEC) >= 0);
+
+        /* Make sure everything queued for the writer thread hit the
+         * journal files, too */
+        server_sync(&server);
+
+        ts = now(CLOCK_MONOTONIC) - ts;
+        cpu = thread_cpu_usec() - cpu;
+
+        for (i = 0; i < arg_producers; i++)
+                assert_se(pthread_join(producers[i].thread, NULL) == 0);
+
+        bytes = server.stats.n_received_bytes[source] - bytes;
+
+        log_info("%"PRIu64" messages in %s: %.0f msgs/sec, %.1f MB/sec, %.2f us CPU/msg in the server thread",
+                 n, format_timespan((char[FORMAT_TIMESPAN_MAX]) {}, FORMAT_TIMESPAN_MAX, ts, USEC_PER_MSEC),
+                 (double) n * USEC_PER_SEC / MAX(ts, 1U),
+                 (double) bytes * USEC_PER_SEC / MAX(ts, 1U) / (1024 * 1024),
+                 (double) cpu / n);
+
+        log_info("Append latency: %"PRIu64" entries, avg %.1f us, p99 <= %"PRIu64" us, max %"PRIu64" us",
+                 server.stats.write.count,
+                 (double) server.stats.write.total_usec / MAX(server.stats.write.count, 1U),
+                 timing_percentile(&server.stats.write, 99),
+                 server.stats.write.max_usec);
+
+        server_done(&server);
+
+        return 0;
+}
@@ -23,15 +23,68 @@
 #include <sys/mman.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <pthread.h>
 
 #include "macro.h"
 #include "util.h"
 #include "mmap-cache.h"
 
+#define N_THREADS 4
+#define THREAD_FILE_SIZE (32U*1024U*1024U)
+
+static MMapCache *shared = NULL;
+static int shared_fd = -1;
+
+static void *thread_func(void *arg) {
+        unsigned i, k = PTR_TO_UINT(arg);
+        struct stat st;
+
+        assert_se(fstat(shared_fd, &st) >= 0);
+
+        /* Every thread uses the same context ids, but gets its
+         * own windows, hence pointers stay valid */
+        for (i = 0; i < 4096; i++) {
+                uint64_t o = ((uint64_t) (i * 7919 + k * 104729) * 4096) % THREAD_FILE_SIZE;
+                uint8_t *p;
+
+                assert_se(mmap_cache_get(shared, shared_fd, PROT_READ, i % 3, false, o, 1, &st, (void**) &p) >= 0);
+                assert_se(*p == (uint8_t) (o / 4096));
+        }
+
+        mmap_cache_thread_done(shared);
+        return NULL;
+}
+
+static void test_threads(int fd) {
+        pthread_t t[N_THREADS];
+        uint8_t page[4096];
+        unsigned i;
+
+        for (i = 0; i < THREAD_FILE_SIZE / 4096; i++) {
+                memset(page, (uint8_t) i, sizeof(page));
+                assert_se(pwrite(fd, page, sizeof(page), (off_t) i * 4096) == sizeof(page));
+        }
+
+        assert_se(shared = mmap_cache_new());
+        shared_fd = fd;
+
+        for (i = 0; i < N_THREADS; i++)
+                assert_se(pthread_create(t + i, NULL, thread_func, UINT_TO_PTR(i)) == 0);
+
+        for (i = 0; i < N_THREADS; i++)
+                assert_se(pthread_join(t[i], NULL) == 0);
+
+        assert_se(mmap_cache_get_hit(shared) + mmap_cache_get_missed(shared) == N_THREADS * 4096);
+
+        shared = mmap_cache_unref(shared);
+}
+
 int main(int argc, char *argv[]) {
         int x, y, z, r;
         char px[] = "/tmp/testmmapXXXXXXX", py[] = "/tmp/testmmapYXXXXXX", pz[] = "/tmp/testmmapZXXXXXX";
         MMapCache *m;
+        struct stat st;
+        uint64_t i;
         void *p, *q;
 
         assert_se(m = mmap_cache_new());
@@ -71,6 +124,24 @@ int main(int argc, char *argv[]) {
 
         mmap_cache_unref(m);
 
+        /* Sequential scans should get increasingly large windows */
+        assert_se(m = mmap_cache_new());
+        assert_se(ftruncate(y, 256ULL*1024ULL*1024ULL) >= 0);
+        assert_se(fstat(y, &st) >= 0);
+
+        for (i = 0; i < 256ULL*1024ULL*1024ULL; i += 1024ULL*1024ULL) {
+                r = mmap_cache_get(m, y, PROT_READ, 0, false, i, 2, &st, &p);
+                assert_se(r >= 0);
+        }
+
+        assert_se(mmap_cache_get_hit(m) + mmap_cache_get_missed(m) == 256);
+        assert_se(mmap_cache_get_missed(m) < 256 / 8);
+        assert_se(mmap_cache_get_readahead(m) > 0);
+
+        mmap_cache_unref(m);
+
+        test_threads(z);
+
         safe_close(x);
         safe_close(y);
         safe_close(z);
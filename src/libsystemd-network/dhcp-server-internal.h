@@ -26,6 +26,7 @@
 #include "sd-dhcp-server.h"
 
 #include "hashmap.h"
+#include "prioq.h"
 #include "util.h"
 #include "log.h"
 
@@ -43,6 +44,7 @@ typedef struct DHCPLease {
         be32_t gateway;
         uint8_t chaddr[16];
         usec_t expiration;
+        unsigned prioq_idx;
 } DHCPLease;
 
 struct sd_dhcp_server {
@@ -67,8 +69,13 @@ struct sd_dhcp_server {
         unsigned n_ntp, n_dns;
 
         Hashmap *leases_by_client_id;
+        Prioq *leases_by_expiration;
         DHCPLease **bound_leases;
         DHCPLease invalid_lease;
+        uint32_t pool_free;
+
+        char *lease_file;
+        sd_event_source *save_leases;
 
         uint32_t max_lease_time, default_lease_time;
 };
@@ -20,6 +20,8 @@
   along with systemd; If not, see <http://www.gnu.org/licenses/>.
 ***/
 
+#include "siphash24.h"
+
 #include "lldp-internal.h"
 
 /* We store maximum 1K chassis entries */
@@ -28,6 +30,46 @@
 /* Maximum Ports can be attached to any chassis */
 #define LLDP_MIB_MAX_PORT_PER_CHASSIS 32
 
+/* Maximum neighbours we store for one local port, over all chassis.
+ * Each keeps its full LLDPDU around, so this bounds our memory use on
+ * ports facing a busy switch. */
+#define LLDP_MIB_MAX_NEIGHBOURS 128
+
+static unsigned long chassis_id_hash_func(const void *p,
+                                          const uint8_t hash_key[HASH_KEY_SIZE]) {
+        uint64_t u;
+        const lldp_chassis_id *id = p;
+
+        assert(id);
+
+        siphash24((uint8_t *) &u, id->data, id->length, hash_key);
+
+        return (unsigned long) u;
+}
+
+static int chassis_id_compare_func(const void *_a, const void *_b) {
+        const lldp_chassis_id *a, *b;
+
+        a = _a;
+        b = _b;
+
+        assert(!a->length || a->data);
+        assert(!b->length || b->data);
+
+        if (a->type != b->type)
+                return -1;
+
+        if (a->length != b->length)
+                return a->length < b->length ? -1 : 1;
+
+        return memcmp(a->data, b->data, a->length);
+}
+
+const struct hash_ops chassis_id_hash_ops = {
+        .hash = chassis_id_hash_func,
+        .compare = chassis_id_compare_func
+};
+
 int lldp_read_chassis_id(tlv_packet *tlv,
                          uint8_t *type,
                          uint16_t *length,
@@ -232,7 +274,10 @@ int lldp_read_system_capability(tlv_packet *tlv, uint16_t *data) {
 /* 10.5.5.2.2 mibUpdateObjects ()
  * The mibUpdateObjects () procedure updates the MIB objects corresponding to
  * the TLVs contained in the received LLDPDU for the LLDP remote system
- * indicated by the LLDP remote systems update process defined in 10.3.5 */
+ * indicated by the LLDP remote systems update process defined in 10.3.5.
+ *
+ * Returns 1 if the neighbour sent something new, 0 if the LLDPDU only
+ * refreshed its TTL. */
 
 int lldp_mib_update_objects(lldp_chassis *c, tlv_packet *tlv) {
         lldp_neighbour_port *p;
@@ -259,12 +304,17 @@ int lldp_mib_update_objects(lldp_chassis *c, tlv_packet *tlv) {
 
                         p->until = ttl * USEC_PER_SEC + now(clock_boottime_or_monotonic());
 
+                        r = p->packet->length != tlv->length ||
+                            memcmp(p->packet->pdu, tlv->pdu, tlv->length) != 0;
+                        if (r)
+                                p->generation = ++c->generation->current;
+
                         tlv_packet_free(p->packet);
                         p->packet = tlv;
 
                         prioq_reshuffle(p->c->by_expiry, p, &p->prioq_idx);
 
-                        return 0;
+                        return r;
                 }
         }
 
@@ -290,15 +340,17 @@ int lldp_mib_remove_objects(lldp_chassis *c, tlv_packet *tlv) {
                 /* Find the port */
                 if (p->type == type && p->length == length && !memcmp(p->data, data, p->length)) {
                         lldp_neighbour_port_remove_and_free(p);
-                        break;
+                        return 1;
                 }
         }
 
         return 0;
 }
 
+/* Returns 1 if the neighbour table changed, 0 otherwise */
 int lldp_mib_add_objects(Prioq *by_expiry,
                          Hashmap *neighbour_mib,
+                         lldp_mib_generation *generation,
                          tlv_packet *tlv) {
         _cleanup_lldp_neighbour_port_free_ lldp_neighbour_port *p = NULL;
         _cleanup_lldp_chassis_free_ lldp_chassis *c = NULL;
@@ -310,6 +362,7 @@ int lldp_mib_add_objects(Prioq *by_expiry,
 
         assert_return(by_expiry, -EINVAL);
         assert_return(neighbour_mib, -EINVAL);
+        assert_return(generation, -EINVAL);
         assert_return(tlv, -EINVAL);
 
         r = lldp_read_chassis_id(tlv, &subtype, &length, &data);
@@ -343,7 +396,13 @@ int lldp_mib_add_objects(Prioq *by_expiry,
                         goto drop;
                 }
 
-                r = lldp_chassis_new(tlv, by_expiry, neighbour_mib, &c);
+                if (prioq_size(by_expiry) >= LLDP_MIB_MAX_NEIGHBOURS) {
+                        log_lldp("Exceeding number of neighbours: %u. Dropping ...",
+                                 prioq_size(by_expiry));
+                        goto drop;
+                }
+
+                r = lldp_chassis_new(tlv, by_expiry, neighbour_mib, generation, &c);
                 if (r < 0)
                         goto drop;
 
@@ -360,7 +419,7 @@ int lldp_mib_add_objects(Prioq *by_expiry,
                 if (ttl == 0) {
                         log_lldp("TTL value 0 received . Deleting associated Port ...");
 
-                        lldp_mib_remove_objects(c, tlv);
+                        r = lldp_mib_remove_objects(c, tlv);
 
                         c = NULL;
                         goto drop;
@@ -380,6 +439,14 @@ int lldp_mib_add_objects(Prioq *by_expiry,
                         c = NULL;
                         goto drop;
                 }
+
+                if (prioq_size(by_expiry) >= LLDP_MIB_MAX_NEIGHBOURS) {
+                        log_lldp("Exceeding number of neighbours: %u. Dropping ...",
+                                 prioq_size(by_expiry));
+
+                        c = NULL;
+                        goto drop;
+                }
         }
 
         /* This is a new port */
@@ -395,10 +462,12 @@ int lldp_mib_add_objects(Prioq *by_expiry,
         LIST_PREPEND(port, c->ports, p);
         c->n_ref ++;
 
+        p->generation = ++generation->current;
+
         p = NULL;
         c = NULL;
 
-        return 0;
+        return 1;
 
  drop:
         tlv_packet_free(tlv);
@@ -417,6 +486,8 @@ void lldp_neighbour_port_remove_and_free(lldp_neighbour_port *p) {
 
         c = p->c;
 
+        c->generation->removed = ++c->generation->current;
+
         prioq_remove(c->by_expiry, p, &p->prioq_idx);
 
         LIST_REMOVE(port, c->ports, p);
@@ -496,6 +567,7 @@ void lldp_chassis_free(lldp_chassis *c) {
 int lldp_chassis_new(tlv_packet *tlv,
                      Prioq *by_expiry,
                      Hashmap *neighbour_mib,
+                     lldp_mib_generation *generation,
                      lldp_chassis **ret) {
         _cleanup_lldp_chassis_free_ lldp_chassis *c = NULL;
         uint16_t length;
@@ -525,6 +597,7 @@ int lldp_chassis_new(tlv_packet *tlv,
 
         c->by_expiry = by_expiry;
         c->neighbour_mib = neighbour_mib;
+        c->generation = generation;
 
         *ret = c;
         c = NULL;
@@ -22,6 +22,7 @@
 
 #pragma once
 
+#include "hashmap.h"
 #include "log.h"
 #include "list.h"
 #include "lldp-tlv.h"
@@ -31,6 +32,16 @@ typedef struct lldp_neighbour_port lldp_neighbour_port;
 typedef struct lldp_chassis lldp_chassis;
 typedef struct lldp_chassis_id lldp_chassis_id;
 typedef struct lldp_agent_statistics lldp_agent_statistics;
+typedef struct lldp_mib_generation lldp_mib_generation;
+
+/* Bumped on every change to the neighbour table, so that readers can
+ * ask for just the neighbours that changed since they last looked */
+struct lldp_mib_generation {
+        uint64_t current;
+
+        /* Last change that removed a neighbour */
+        uint64_t removed;
+};
 
 struct lldp_neighbour_port {
         uint8_t type;
@@ -39,6 +50,7 @@ struct lldp_neighbour_port {
         uint16_t length;
         usec_t until;
 
+        uint64_t generation;
         unsigned prioq_idx;
 
         lldp_chassis *c;
@@ -68,6 +80,7 @@ struct lldp_chassis {
 
         Prioq *by_expiry;
         Hashmap *neighbour_mib;
+        lldp_mib_generation *generation;
 
         LIST_HEAD(lldp_neighbour_port, ports);
 };
@@ -75,6 +88,7 @@ struct lldp_chassis {
 int lldp_chassis_new(tlv_packet *tlv,
                      Prioq *by_expiry,
                      Hashmap *neighbour_mib,
+                     lldp_mib_generation *generation,
                      lldp_chassis **ret);
 
 void lldp_chassis_free(lldp_chassis *c);
@@ -83,9 +97,11 @@ DEFINE_TRIVIAL_CLEANUP_FUNC(lldp_chassis *, lldp_chassis_free);
 #define _cleanup_lldp_chassis_free_ _cleanup_(lldp_chassis_freep)
 
 int lldp_mib_update_objects(lldp_chassis *c, tlv_packet *tlv);
-int lldp_mib_add_objects(Prioq *by_expiry, Hashmap *neighbour_mib, tlv_packet *tlv);
+int lldp_mib_add_objects(Prioq *by_expiry, Hashmap *neighbour_mib, lldp_mib_generation *generation, tlv_packet *tlv);
 int lldp_mib_remove_objects(lldp_chassis *c, tlv_packet *tlv);
 
+extern const struct hash_ops chassis_id_hash_ops;
+
 int lldp_read_chassis_id(tlv_packet *tlv, uint8_t *type, uint16_t *length, uint8_t **data);
 int lldp_read_port_id(tlv_packet *tlv, uint8_t *type, uint16_t *length, uint8_t **data);
 int lldp_read_ttl(tlv_packet *tlv, uint16_t *ttl);
@@ -257,6 +257,7 @@ int tlv_packet_parse_pdu(tlv_packet *m, uint16_t size) {
         assert_return(size, -EINVAL);
 
         p = m->pdu;
+        m->length = size;
 
         /* extract ethernet herader */
         memcpy(&m->mac, p, ETH_ALEN);
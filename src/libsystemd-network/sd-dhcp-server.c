@@ -21,9 +21,11 @@
 ***/
 
 #include <sys/ioctl.h>
+#include <arpa/inet.h>
 
 #include "in-addr-util.h"
 #include "siphash24.h"
+#include "fileio.h"
 
 #include "sd-dhcp-server.h"
 #include "dhcp-server-internal.h"
@@ -32,6 +34,9 @@
 #define DHCP_DEFAULT_LEASE_TIME_USEC USEC_PER_HOUR
 #define DHCP_MAX_LEASE_TIME_USEC (USEC_PER_HOUR*12)
 
+/* how long to collect lease changes before writing the lease file */
+#define DHCP_SAVE_LEASES_DELAY_USEC USEC_PER_SEC
+
 /* configures the server's address and subnet, and optionally the pool's size and offset into the subnet
  * the whole pool must fit into the subnet, and may not contain the first (any) nor last (broadcast) address
  * moreover, the server's own address may be in the pool, and is in that case reserved in order not to
@@ -82,13 +87,16 @@ int sd_dhcp_server_configure_pool(sd_dhcp_server *server, struct in_addr *addres
 
         server->pool_offset = offset;
         server->pool_size = size;
+        server->pool_free = size;
 
         server->address = address->s_addr;
         server->netmask = netmask;
         server->subnet = address->s_addr & netmask;
 
-        if (server_off >= offset && server_off - offset < size)
+        if (server_off >= offset && server_off - offset < size) {
                 server->bound_leases[server_off - offset] = &server->invalid_lease;
+                server->pool_free--;
+        }
 
         return 0;
 }
@@ -177,6 +185,9 @@ sd_dhcp_server *sd_dhcp_server_unref(sd_dhcp_server *server) {
         while ((lease = hashmap_steal_first(server->leases_by_client_id)))
                 dhcp_lease_free(lease);
         hashmap_free(server->leases_by_client_id);
+        prioq_free(server->leases_by_expiration);
+
+        free(server->lease_file);
 
         free(server->bound_leases);
         free(server);
@@ -244,9 +255,309 @@ sd_event *sd_dhcp_server_get_event(sd_dhcp_server *server) {
         return server->event;
 }
 
+static int get_pool_offset(sd_dhcp_server *server, be32_t requested_ip) {
+        assert(server);
+
+        if (!server->pool_size)
+                return -EINVAL;
+
+        if (be32toh(requested_ip) < (be32toh(server->subnet) | server->pool_offset) ||
+            be32toh(requested_ip) >= (be32toh(server->subnet) | (server->pool_offset + server->pool_size)))
+                return -ERANGE;
+
+        return be32toh(requested_ip & ~server->netmask) - server->pool_offset;
+}
+
+static int lease_compare_expiration(const void *a, const void *b) {
+        const DHCPLease *x = a, *y = b;
+
+        if (x->expiration < y->expiration)
+                return -1;
+        if (x->expiration > y->expiration)
+                return 1;
+
+        return 0;
+}
+
+/* Records the lease in all the lookup structures. The slot in the
+ * pool must be free. */
+static int dhcp_server_bind_lease(sd_dhcp_server *server, DHCPLease *lease, int pool_offset) {
+        int r;
+
+        assert(server);
+        assert(lease);
+        assert(pool_offset >= 0);
+        assert(!server->bound_leases[pool_offset]);
+
+        r = prioq_ensure_allocated(&server->leases_by_expiration, lease_compare_expiration);
+        if (r < 0)
+                return r;
+
+        r = hashmap_put(server->leases_by_client_id, &lease->client_id, lease);
+        if (r < 0)
+                return r;
+
+        r = prioq_put(server->leases_by_expiration, lease, &lease->prioq_idx);
+        if (r < 0) {
+                hashmap_remove(server->leases_by_client_id, &lease->client_id);
+                return r;
+        }
+
+        server->bound_leases[pool_offset] = lease;
+        server->pool_free--;
+
+        return 0;
+}
+
+static void dhcp_server_drop_lease(sd_dhcp_server *server, DHCPLease *lease) {
+        int pool_offset;
+
+        assert(server);
+        assert(lease);
+
+        pool_offset = get_pool_offset(server, lease->address);
+        if (pool_offset >= 0 && server->bound_leases[pool_offset] == lease) {
+                server->bound_leases[pool_offset] = NULL;
+                server->pool_free++;
+        }
+
+        hashmap_remove(server->leases_by_client_id, &lease->client_id);
+        prioq_remove(server->leases_by_expiration, lease, &lease->prioq_idx);
+
+        dhcp_lease_free(lease);
+}
+
+/* Expired leases are dropped lazily whenever a message comes in, the
+ * oldest ones are found without looking at any of the others */
+static bool dhcp_server_expire_leases(sd_dhcp_server *server, usec_t time_now) {
+        DHCPLease *lease;
+        bool expired = false;
+
+        assert(server);
+
+        while ((lease = prioq_peek(server->leases_by_expiration))) {
+                if (lease->expiration > time_now)
+                        break;
+
+                log_dhcp_server(server, "EXPIRED (0x%x)", be32toh(lease->address));
+
+                dhcp_server_drop_lease(server, lease);
+                expired = true;
+        }
+
+        return expired;
+}
+
+static int dhcp_server_save_leases(sd_dhcp_server *server) {
+        _cleanup_free_ char *temp_path = NULL;
+        _cleanup_fclose_ FILE *f = NULL;
+        DHCPLease *lease;
+        Iterator i;
+        usec_t time_now, realtime_now;
+        int r;
+
+        assert(server);
+
+        if (!server->lease_file)
+                return 0;
+
+        r = sd_event_now(server->event, clock_boottime_or_monotonic(), &time_now);
+        if (r < 0)
+                return r;
+
+        realtime_now = now(CLOCK_REALTIME);
+
+        r = fopen_temporary(server->lease_file, &f, &temp_path);
+        if (r < 0)
+                goto fail;
+
+        fchmod(fileno(f), 0644);
+
+        fprintf(f,
+                "# This is private data. Do not parse.\n");
+
+        /* one lease per line: address, hardware address, gateway,
+         * client id and the expiration in CLOCK_REALTIME, so that it
+         * survives a reboot */
+        HASHMAP_FOREACH(lease, server->leases_by_client_id, i) {
+                _cleanup_free_ char *client_id = NULL, *chaddr = NULL;
+                char address[INET_ADDRSTRLEN], gateway[INET_ADDRSTRLEN];
+
+                if (lease->expiration <= time_now)
+                        continue;
+
+                client_id = hexmem(lease->client_id.data, lease->client_id.length);
+                chaddr = hexmem(lease->chaddr, ETH_ALEN);
+                if (!client_id || !chaddr) {
+                        r = -ENOMEM;
+                        goto fail;
+                }
+
+                fprintf(f, "%s %s %s %s "USEC_FMT"\n",
+                        inet_ntop(AF_INET, &lease->address, address, sizeof(address)),
+                        chaddr,
+                        inet_ntop(AF_INET, &lease->gateway, gateway, sizeof(gateway)),
+                        client_id,
+                        realtime_now + (lease->expiration - time_now));
+        }
+
+        r = fflush_and_check(f);
+        if (r < 0)
+                goto fail;
+
+        if (rename(temp_path, server->lease_file) < 0) {
+                r = -errno;
+                goto fail;
+        }
+
+        return 0;
+
+fail:
+        if (temp_path)
+                (void) unlink(temp_path);
+
+        return log_error_errno(r, "Failed to save DHCP server leases to %s: %m", server->lease_file);
+}
+
+static int dhcp_server_load_leases(sd_dhcp_server *server) {
+        _cleanup_fclose_ FILE *f = NULL;
+        usec_t time_now, realtime_now;
+        char line[LINE_MAX];
+        unsigned n = 0;
+        int r;
+
+        assert(server);
+
+        if (!server->lease_file)
+                return 0;
+
+        f = fopen(server->lease_file, "re");
+        if (!f)
+                return errno == ENOENT ? 0 : -errno;
+
+        r = sd_event_now(server->event, clock_boottime_or_monotonic(), &time_now);
+        if (r < 0)
+                return r;
+
+        realtime_now = now(CLOCK_REALTIME);
+
+        FOREACH_LINE(line, f, return -errno) {
+                char address[INET_ADDRSTRLEN], chaddr[2 * ETH_ALEN + 1], gateway[INET_ADDRSTRLEN], client_id[2 * 255 + 1];
+                _cleanup_free_ void *chaddr_data = NULL;
+                DHCPLease *lease;
+                uint64_t expiration;
+                size_t chaddr_len;
+                int pool_offset;
+
+                if (line[0] == '#')
+                        continue;
+
+                if (sscanf(line, "%15s %12s %15s %510s %" SCNu64, address, chaddr, gateway, client_id, &expiration) != 5)
+                        continue;
+
+                if (expiration <= realtime_now)
+                        continue;
+
+                lease = new0(DHCPLease, 1);
+                if (!lease)
+                        return -ENOMEM;
+
+                if (inet_pton(AF_INET, address, &lease->address) <= 0 ||
+                    inet_pton(AF_INET, gateway, &lease->gateway) <= 0 ||
+                    unhexmem(chaddr, strlen(chaddr), &chaddr_data, &chaddr_len) < 0 ||
+                    chaddr_len != ETH_ALEN ||
+                    unhexmem(client_id, strlen(client_id), &lease->client_id.data, &lease->client_id.length) < 0 ||
+                    lease->client_id.length == 0) {
+                        dhcp_lease_free(lease);
+                        continue;
+                }
+
+                memcpy(lease->chaddr, chaddr_data, ETH_ALEN);
+                lease->expiration = time_now + (expiration - realtime_now);
+
+                /* the pool might have been configured differently
+                 * when the lease was handed out */
+                pool_offset = get_pool_offset(server, lease->address);
+                if (pool_offset < 0 ||
+                    server->bound_leases[pool_offset] ||
+                    hashmap_get(server->leases_by_client_id, &lease->client_id)) {
+                        dhcp_lease_free(lease);
+                        continue;
+                }
+
+                r = dhcp_server_bind_lease(server, lease, pool_offset);
+                if (r < 0) {
+                        dhcp_lease_free(lease);
+                        return r;
+                }
+
+                n++;
+        }
+
+        log_dhcp_server(server, "LOADED %u leases", n);
+
+        return 0;
+}
+
+static int dhcp_server_save_leases_handler(sd_event_source *s, uint64_t usec, void *userdata) {
+        sd_dhcp_server *server = userdata;
+
+        assert(server);
+
+        server->save_leases = sd_event_source_unref(server->save_leases);
+
+        (void) dhcp_server_save_leases(server);
+
+        return 0;
+}
+
+/* Writing thousands of leases on every single ACK would not go well
+ * with a storm of clients booting, so changes are collected for a bit */
+static int dhcp_server_schedule_save_leases(sd_dhcp_server *server) {
+        usec_t time_now;
+        int r;
+
+        assert(server);
+
+        if (!server->lease_file || server->save_leases)
+                return 0;
+
+        r = sd_event_now(server->event, clock_boottime_or_monotonic(), &time_now);
+        if (r < 0)
+                return r;
+
+        r = sd_event_add_time(server->event, &server->save_leases,
+                              clock_boottime_or_monotonic(),
+                              time_now + DHCP_SAVE_LEASES_DELAY_USEC, 0,
+                              dhcp_server_save_leases_handler, server);
+        if (r < 0)
+                return r;
+
+        r = sd_event_source_set_priority(server->save_leases, server->event_priority);
+        if (r < 0)
+                return r;
+
+        (void) sd_event_source_set_description(server->save_leases, "dhcp-server-save-leases");
+
+        return 0;
+}
+
+int sd_dhcp_server_set_lease_file(sd_dhcp_server *server, const char *path) {
+        assert_return(server, -EINVAL);
+        assert_return(!server->receive_message, -EBUSY);
+
+        return free_and_strdup(&server->lease_file, path);
+}
+
 int sd_dhcp_server_stop(sd_dhcp_server *server) {
         assert_return(server, -EINVAL);
 
+        /* write out whatever is still pending */
+        if (server->save_leases) {
+                server->save_leases = sd_event_source_unref(server->save_leases);
+                (void) dhcp_server_save_leases(server);
+        }
+
         server->receive_message =
                 sd_event_source_unref(server->receive_message);
 
@@ -681,25 +992,13 @@ static int ensure_sane_request(sd_dhcp_server *server, DHCPRequest *req, DHCPMes
         return 0;
 }
 
-static int get_pool_offset(sd_dhcp_server *server, be32_t requested_ip) {
-        assert(server);
-
-        if (!server->pool_size)
-                return -EINVAL;
-
-        if (be32toh(requested_ip) < (be32toh(server->subnet) | server->pool_offset) ||
-            be32toh(requested_ip) >= (be32toh(server->subnet) | (server->pool_offset + server->pool_size)))
-                return -ERANGE;
-
-        return be32toh(requested_ip & ~server->netmask) - server->pool_offset;
-}
-
 #define HASH_KEY SD_ID128_MAKE(0d,1d,fe,bd,f1,24,bd,b3,47,f1,dd,6e,73,21,93,30)
 
 int dhcp_server_handle_message(sd_dhcp_server *server, DHCPMessage *message,
                                size_t length) {
         _cleanup_dhcp_request_free_ DHCPRequest *req = NULL;
         DHCPLease *existing_lease;
+        usec_t time_now = 0;
         int type, r;
 
         assert(server);
@@ -723,6 +1022,13 @@ int dhcp_server_handle_message(sd_dhcp_server *server, DHCPMessage *message,
                 /* this only fails on critical errors */
                 return r;
 
+        r = sd_event_now(server->event, clock_boottime_or_monotonic(), &time_now);
+        if (r < 0)
+                return r;
+
+        if (dhcp_server_expire_leases(server, time_now))
+                (void) dhcp_server_schedule_save_leases(server);
+
         existing_lease = hashmap_get(server->leases_by_client_id,
                                      &req->client_id);
 
@@ -742,7 +1048,7 @@ int dhcp_server_handle_message(sd_dhcp_server *server, DHCPMessage *message,
                 /* for now pick a random free address from the pool */
                 if (existing_lease)
                         address = existing_lease->address;
-                else {
+                else if (server->pool_free > 0) {
                         uint32_t next_offer;
 
                         /* even with no persistence of leases, we try to offer the same client
@@ -843,11 +1149,12 @@ int dhcp_server_handle_message(sd_dhcp_server *server, DHCPMessage *message,
                 if (pool_offset >= 0 &&
                     server->bound_leases[pool_offset] == existing_lease) {
                         DHCPLease *lease;
-                        usec_t time_now = 0;
 
                         if (!existing_lease) {
                                 lease = new0(DHCPLease, 1);
-                                lease->address = req->requested_ip;
+                                if (!lease)
+                                        return -ENOMEM;
+                                lease->address = address;
                                 lease->client_id.data = memdup(req->client_id.data,
                                                                req->client_id.length);
                                 if (!lease->client_id.data) {
@@ -861,17 +1168,6 @@ int dhcp_server_handle_message(sd_dhcp_server *server, DHCPMessage *message,
                         } else
                                 lease = existing_lease;
 
-                        r = sd_event_now(server->event,
-                                         clock_boottime_or_monotonic(),
-                                         &time_now);
-                        if (r < 0) {
-                                if (!existing_lease)
-                                        dhcp_lease_free(lease);
-                                return r;
-                        }
-
-                        lease->expiration = req->lifetime * USEC_PER_SEC + time_now;
-
                         r = server_send_ack(server, req, address);
                         if (r < 0) {
                                 /* this only fails on critical errors */
@@ -886,9 +1182,19 @@ int dhcp_server_handle_message(sd_dhcp_server *server, DHCPMessage *message,
                                 log_dhcp_server(server, "ACK (0x%x)",
                                                 be32toh(req->message->xid));
 
-                                server->bound_leases[pool_offset] = lease;
-                                hashmap_put(server->leases_by_client_id,
-                                            &lease->client_id, lease);
+                                lease->expiration = req->lifetime * USEC_PER_SEC + time_now;
+
+                                if (existing_lease)
+                                        prioq_reshuffle(server->leases_by_expiration, lease, &lease->prioq_idx);
+                                else {
+                                        r = dhcp_server_bind_lease(server, lease, pool_offset);
+                                        if (r < 0) {
+                                                dhcp_lease_free(lease);
+                                                return r;
+                                        }
+                                }
+
+                                (void) dhcp_server_schedule_save_leases(server);
 
                                 return DHCP_ACK;
                         }
@@ -926,9 +1232,9 @@ int dhcp_server_handle_message(sd_dhcp_server *server, DHCPMessage *message,
                         return 0;
 
                 if (server->bound_leases[pool_offset] == existing_lease) {
-                        server->bound_leases[pool_offset] = NULL;
-                        hashmap_remove(server->leases_by_client_id, existing_lease);
-                        dhcp_lease_free(existing_lease);
+                        dhcp_server_drop_lease(server, existing_lease);
+
+                        (void) dhcp_server_schedule_save_leases(server);
 
                         return 1;
                 } else
@@ -1002,6 +1308,10 @@ int sd_dhcp_server_start(sd_dhcp_server *server) {
         assert_return(server->fd == -1, -EBUSY);
         assert_return(server->address != htobe32(INADDR_ANY), -EUNATCH);
 
+        r = dhcp_server_load_leases(server);
+        if (r < 0)
+                log_dhcp_server(server, "could not load leases: %s", strerror(-r));
+
         r = socket(AF_PACKET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
         if (r < 0) {
                 r = -errno;
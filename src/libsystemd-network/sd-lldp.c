@@ -22,8 +22,8 @@
 
 #include <arpa/inet.h>
 
-#include "siphash24.h"
 #include "hashmap.h"
+#include "strv.h"
 
 #include "lldp-tlv.h"
 #include "lldp-port.h"
@@ -32,6 +32,15 @@
 #include "lldp-internal.h"
 #include "lldp-util.h"
 
+/* Neighbours are free to add as many optional and organizationally
+ * specific TLVs as fit into a frame. We only care for a handful, so
+ * don't keep more than this around per neighbour. */
+#define LLDP_MAX_TLVS 64
+
+/* Don't tell the user about changes to the neighbour table more often
+ * than this; changes in between are reported together */
+#define LLDP_NOTIFY_INTERVAL_USEC (1 * USEC_PER_SEC)
+
 typedef enum LLDPAgentRXState {
         LLDP_AGENT_RX_WAIT_PORT_OPERATIONAL = 4,
         LLDP_AGENT_RX_DELETE_AGED_INFO,
@@ -59,6 +68,12 @@ struct sd_lldp {
 
         Prioq *by_expiry;
         Hashmap *neighbour_mib;
+        lldp_mib_generation generation;
+
+        sd_event_source *timer;
+
+        sd_event_source *notify_event_source;
+        usec_t notify_last;
 
         sd_lldp_cb_t cb;
 
@@ -68,51 +83,20 @@ struct sd_lldp {
         lldp_agent_statistics statistics;
 };
 
-static unsigned long chassis_id_hash_func(const void *p,
-                                          const uint8_t hash_key[HASH_KEY_SIZE]) {
-        uint64_t u;
-        const lldp_chassis_id *id = p;
-
-        assert(id);
-
-        siphash24((uint8_t *) &u, id->data, id->length, hash_key);
-
-        return (unsigned long) u;
-}
-
-static int chassis_id_compare_func(const void *_a, const void *_b) {
-        const lldp_chassis_id *a, *b;
-
-        a = _a;
-        b = _b;
-
-        assert(!a->length || a->data);
-        assert(!b->length || b->data);
-
-        if (a->type != b->type)
-                return -1;
-
-        if (a->length != b->length)
-                return a->length < b->length ? -1 : 1;
-
-        return memcmp(a->data, b->data, a->length);
-}
-
-static const struct hash_ops chassis_id_hash_ops = {
-        .hash = chassis_id_hash_func,
-        .compare = chassis_id_compare_func
-};
-
 static void lldp_mib_delete_objects(sd_lldp *lldp);
 static void lldp_set_state(sd_lldp *lldp, LLDPAgentRXState state);
-static void lldp_run_state_machine(sd_lldp *ll);
+static void lldp_notify(sd_lldp *lldp);
+static int lldp_start_timer(sd_lldp *lldp);
 
 static int lldp_receive_frame(sd_lldp *lldp, tlv_packet *tlv) {
+        uint64_t generation;
         int r;
 
         assert(lldp);
         assert(tlv);
 
+        generation = lldp->generation.current;
+
         /* Remove expired packets */
         if (prioq_size(lldp->by_expiry) > 0) {
 
@@ -121,7 +105,7 @@ static int lldp_receive_frame(sd_lldp *lldp, tlv_packet *tlv) {
                 lldp_mib_delete_objects(lldp);
         }
 
-        r = lldp_mib_add_objects(lldp->by_expiry, lldp->neighbour_mib, tlv);
+        r = lldp_mib_add_objects(lldp->by_expiry, lldp->neighbour_mib, &lldp->generation, tlv);
         if (r < 0)
                 goto out;
 
@@ -137,6 +121,15 @@ static int lldp_receive_frame(sd_lldp *lldp, tlv_packet *tlv) {
         if (r < 0)
                 log_lldp("Receive frame failed: %s", strerror(-r));
 
+        /* Most frames merely refresh the TTL of a neighbour we already
+         * know about, only tell the user if something changed */
+        if (lldp->generation.current != generation)
+                lldp_notify(lldp);
+
+        r = lldp_start_timer(lldp);
+        if (r < 0)
+                log_lldp("Failed to start expiry timer: %s", strerror(-r));
+
         lldp_set_state(lldp, LLDP_AGENT_RX_WAIT_FOR_FRAME);
 
         return 0;
@@ -174,6 +167,14 @@ int lldp_handle_packet(tlv_packet *tlv, uint16_t length) {
 
         for (i = 1, l = 0; l <= length; i++) {
 
+                if (i > LLDP_MAX_TLVS) {
+                        log_lldp("More than %d TLVs received . Dropping ...",
+                                 LLDP_MAX_TLVS);
+
+                        lldp->statistics.stats_frames_discarded_total ++;
+                        goto out;
+                }
+
                 memcpy(&t, p, sizeof(uint16_t));
 
                 type = ntohs(t) >> 9;
@@ -361,15 +362,115 @@ static void lldp_set_state(sd_lldp *lldp, LLDPAgentRXState state) {
         assert(state < _LLDP_AGENT_RX_STATE_MAX);
 
         lldp->rx_state = state;
+}
+
+static int lldp_notify_handler(sd_event_source *s, uint64_t usec, void *userdata) {
+        sd_lldp *lldp = userdata;
+
+        assert(lldp);
+
+        lldp->notify_event_source = sd_event_source_unref(lldp->notify_event_source);
+        lldp->notify_last = now(clock_boottime_or_monotonic());
+
+        if (lldp->cb)
+                lldp->cb(lldp, UPDATE_INFO, lldp->userdata);
+
+        return 0;
+}
+
+static void lldp_notify(sd_lldp *lldp) {
+        usec_t n;
+        int r;
+
+        assert(lldp);
+
+        if (!lldp->cb)
+                return;
+
+        /* A notification is already pending, it will cover this change too */
+        if (lldp->notify_event_source)
+                return;
+
+        n = now(clock_boottime_or_monotonic());
+
+        if (lldp->port->event && lldp->notify_last + LLDP_NOTIFY_INTERVAL_USEC > n) {
+                r = sd_event_add_time(lldp->port->event, &lldp->notify_event_source,
+                                      clock_boottime_or_monotonic(),
+                                      lldp->notify_last + LLDP_NOTIFY_INTERVAL_USEC, 0,
+                                      lldp_notify_handler, lldp);
+                if (r >= 0) {
+                        (void) sd_event_source_set_priority(lldp->notify_event_source, lldp->port->event_priority);
+                        (void) sd_event_source_set_description(lldp->notify_event_source, "lldp-notify");
 
-        lldp_run_state_machine(lldp);
+                        return;
+                }
+
+                log_lldp("Failed to defer notification: %s", strerror(-r));
+        }
+
+        lldp->notify_last = n;
+
+        lldp->cb(lldp, UPDATE_INFO, lldp->userdata);
 }
 
-static void lldp_run_state_machine(sd_lldp *lldp) {
+static int lldp_timer_handler(sd_event_source *s, uint64_t usec, void *userdata) {
+        sd_lldp *lldp = userdata;
+        uint64_t generation;
+        int r;
+
+        assert(lldp);
+
+        lldp->timer = sd_event_source_unref(lldp->timer);
+
+        generation = lldp->generation.current;
+
+        lldp_mib_delete_objects(lldp);
+
+        if (lldp->generation.current != generation)
+                lldp_notify(lldp);
+
+        r = lldp_start_timer(lldp);
+        if (r < 0)
+                log_lldp("Failed to restart expiry timer: %s", strerror(-r));
+
+        return 0;
+}
+
+/* Wake up when the next neighbour's TTL runs out, so that it goes away
+ * even if nothing else is received on the port */
+static int lldp_start_timer(sd_lldp *lldp) {
+        lldp_neighbour_port *p;
+        int r;
+
+        assert(lldp);
+        assert(lldp->port);
+
+        p = prioq_peek(lldp->by_expiry);
+        if (!p) {
+                lldp->timer = sd_event_source_unref(lldp->timer);
+                return 0;
+        }
+
+        if (lldp->timer)
+                return sd_event_source_set_time(lldp->timer, p->until);
+
+        if (!lldp->port->event)
+                return 0;
+
+        r = sd_event_add_time(lldp->port->event, &lldp->timer,
+                              clock_boottime_or_monotonic(),
+                              p->until, USEC_PER_SEC,
+                              lldp_timer_handler, lldp);
+        if (r < 0)
+                return r;
 
-        if (lldp->rx_state == LLDP_AGENT_RX_UPDATE_INFO)
-                if (lldp->cb)
-                        lldp->cb(lldp, LLDP_AGENT_RX_UPDATE_INFO, lldp->userdata);
+        r = sd_event_source_set_priority(lldp->timer, lldp->port->event_priority);
+        if (r < 0)
+                return r;
+
+        (void) sd_event_source_set_description(lldp->timer, "lldp-timer");
+
+        return 0;
 }
 
 /* 10.5.5.2.1 mibDeleteObjects ()
@@ -423,124 +524,126 @@ static void lldp_mib_objects_flush(sd_lldp *lldp) {
         assert(prioq_size(lldp->by_expiry) == 0);
 }
 
-int sd_lldp_save(sd_lldp *lldp, const char *lldp_file) {
-        _cleanup_free_ char *temp_path = NULL;
-        _cleanup_fclose_ FILE *f = NULL;
+/* Returns 0 and no string if the neighbour should not be reported */
+static int lldp_neighbour_port_to_string(lldp_neighbour_port *p, usec_t time, char **ret) {
+        _cleanup_free_ char *s = NULL;
         uint8_t *mac, *port_id, type;
-        lldp_neighbour_port *p;
         uint16_t data = 0, length = 0;
         char buf[LINE_MAX];
-        lldp_chassis *c;
-        usec_t time;
-        Iterator i;
+        char *k, *t;
         int r;
 
-        assert(lldp);
-        assert(lldp_file);
+        assert(p);
+        assert(ret);
 
-        r = fopen_temporary(lldp_file, &f, &temp_path);
+        /* Don't write expired packets */
+        if (p->until <= time)
+                return 0;
+
+        r = lldp_read_chassis_id(p->packet, &type, &length, &mac);
         if (r < 0)
-                goto fail;
+                return 0;
 
-        fchmod(fileno(f), 0644);
+        sprintf(buf, "'_Chassis=%02x:%02x:%02x:%02x:%02x:%02x' '_CType=%d' ",
+                mac[0], mac[1], mac[2], mac[3], mac[4], mac[5], type);
 
-        HASHMAP_FOREACH(c, lldp->neighbour_mib, i) {
-                LIST_FOREACH(port, p, c->ports) {
-                        _cleanup_free_ char *s = NULL;
-                        char *k, *t;
+        s = strdup(buf);
+        if (!s)
+                return -ENOMEM;
 
-                        r = lldp_read_chassis_id(p->packet, &type, &length, &mac);
-                        if (r < 0)
-                                continue;
+        r = lldp_read_port_id(p->packet, &type, &length, &port_id);
+        if (r < 0)
+                return 0;
+
+        if (type != LLDP_PORT_SUBTYPE_MAC_ADDRESS) {
+                k = strndup((char *) port_id, length -1);
+                if (!k)
+                        return -ENOMEM;
+
+                sprintf(buf, "'_Port=%s' '_PType=%d' ", k , type);
+                free(k);
+        } else {
+                mac = port_id;
+                sprintf(buf, "'_Port=%02x:%02x:%02x:%02x:%02x:%02x' '_PType=%d' ",
+                        mac[0], mac[1], mac[2], mac[3], mac[4], mac[5], type);
+        }
 
-                        sprintf(buf, "'_Chassis=%02x:%02x:%02x:%02x:%02x:%02x' '_CType=%d' ",
-                                mac[0], mac[1], mac[2], mac[3], mac[4], mac[5], type);
+        k = strappend(s, buf);
+        if (!k)
+                return -ENOMEM;
 
-                        s = strdup(buf);
-                        if (!s) {
-                                r = -ENOMEM;
-                                goto fail;
-                        }
+        free(s);
+        s = k;
 
-                        r = lldp_read_port_id(p->packet, &type, &length, &port_id);
-                        if (r < 0)
-                                continue;
+        sprintf(buf, "'_TTL="USEC_FMT"' ", p->until);
 
-                        if (type != LLDP_PORT_SUBTYPE_MAC_ADDRESS) {
-                                k = strndup((char *) port_id, length -1);
-                                if (!k) {
-                                        r = -ENOMEM;
-                                        goto fail;
-                                }
-
-                                sprintf(buf, "'_Port=%s' '_PType=%d' ", k , type);
-                                free(k);
-                        } else {
-                                mac = port_id;
-                                sprintf(buf, "'_Port=%02x:%02x:%02x:%02x:%02x:%02x' '_PType=%d' ",
-                                        mac[0], mac[1], mac[2], mac[3], mac[4], mac[5], type);
-                        }
+        k = strappend(s, buf);
+        if (!k)
+                return -ENOMEM;
 
-                        k = strappend(s, buf);
-                        if (!k) {
-                                r = -ENOMEM;
-                                goto fail;
-                        }
+        free(s);
+        s = k;
 
-                        free(s);
-                        s = k;
+        r = lldp_read_system_name(p->packet, &length, &k);
+        if (r < 0)
+                k = strappend(s, "'_NAME=N/A' ");
+        else {
+                t = strndup(k, length);
+                if (!t)
+                        return -ENOMEM;
 
-                        time = now(clock_boottime_or_monotonic());
+                k = strjoin(s, "'_NAME=", t, "' ", NULL);
+                free(t);
+        }
 
-                        /* Don't write expired packets */
-                        if (time - p->until <= 0)
-                                continue;
+        if (!k)
+                return -ENOMEM;
 
-                        sprintf(buf, "'_TTL="USEC_FMT"' ", p->until);
+        free(s);
+        s = k;
 
-                        k = strappend(s, buf);
-                        if (!k) {
-                                r = -ENOMEM;
-                                goto fail;
-                        }
+        (void) lldp_read_system_capability(p->packet, &data);
 
-                        free(s);
-                        s = k;
+        sprintf(buf, "'_CAP=%x'", data);
 
-                        r = lldp_read_system_name(p->packet, &length, &k);
-                        if (r < 0)
-                                k = strappend(s, "'_NAME=N/A' ");
-                        else {
-                                t = strndup(k, length);
-                                if (!t) {
-                                        r = -ENOMEM;
-                                        goto fail;
-                                }
-
-                                k = strjoin(s, "'_NAME=", t, "' ", NULL);
-                                free(t);
-                        }
+        k = strappend(s, buf);
+        if (!k)
+                return -ENOMEM;
 
-                        if (!k) {
-                                r = -ENOMEM;
-                                goto fail;
-                        }
+        *ret = k;
 
-                        free(s);
-                        s = k;
+        return 1;
+}
 
-                        (void) lldp_read_system_capability(p->packet, &data);
+int sd_lldp_save(sd_lldp *lldp, const char *lldp_file) {
+        _cleanup_free_ char *temp_path = NULL;
+        _cleanup_fclose_ FILE *f = NULL;
+        lldp_neighbour_port *p;
+        lldp_chassis *c;
+        usec_t time;
+        Iterator i;
+        int r;
 
-                        sprintf(buf, "'_CAP=%x'", data);
+        assert(lldp);
+        assert(lldp_file);
 
-                        k = strappend(s, buf);
-                        if (!k) {
-                                r = -ENOMEM;
-                                goto fail;
-                        }
+        r = fopen_temporary(lldp_file, &f, &temp_path);
+        if (r < 0)
+                goto fail;
 
-                        free(s);
-                        s = k;
+        fchmod(fileno(f), 0644);
+
+        time = now(clock_boottime_or_monotonic());
+
+        HASHMAP_FOREACH(c, lldp->neighbour_mib, i) {
+                LIST_FOREACH(port, p, c->ports) {
+                        _cleanup_free_ char *s = NULL;
+
+                        r = lldp_neighbour_port_to_string(p, time, &s);
+                        if (r < 0)
+                                goto fail;
+                        if (r == 0)
+                                continue;
 
                         fprintf(f, "%s\n", s);
                 }
@@ -564,6 +667,64 @@ int sd_lldp_save(sd_lldp *lldp, const char *lldp_file) {
         return log_error_errno(r, "Failed to save lldp data %s: %m", lldp_file);
 }
 
+int sd_lldp_get_generation(sd_lldp *lldp, uint64_t *generation) {
+        assert_return(lldp, -EINVAL);
+        assert_return(generation, -EINVAL);
+
+        *generation = lldp->generation.current;
+
+        return 0;
+}
+
+int sd_lldp_get_neighbors(sd_lldp *lldp, uint64_t since, uint64_t *generation, char ***ret) {
+        _cleanup_strv_free_ char **l = NULL;
+        lldp_neighbour_port *p;
+        lldp_chassis *c;
+        bool complete;
+        usec_t time;
+        Iterator i;
+        int r;
+
+        assert_return(lldp, -EINVAL);
+        assert_return(ret, -EINVAL);
+
+        /* Neighbours that went away cannot be listed, so if anything
+         * was removed since the caller last looked, hand out the whole
+         * table. Same if the generation is not one of ours. */
+        complete = since == 0 ||
+                   since < lldp->generation.removed ||
+                   since > lldp->generation.current;
+
+        time = now(clock_boottime_or_monotonic());
+
+        HASHMAP_FOREACH(c, lldp->neighbour_mib, i) {
+                LIST_FOREACH(port, p, c->ports) {
+                        char *s;
+
+                        if (!complete && p->generation <= since)
+                                continue;
+
+                        r = lldp_neighbour_port_to_string(p, time, &s);
+                        if (r < 0)
+                                return r;
+                        if (r == 0)
+                                continue;
+
+                        r = strv_consume(&l, s);
+                        if (r < 0)
+                                return r;
+                }
+        }
+
+        if (generation)
+                *generation = lldp->generation.current;
+
+        *ret = l;
+        l = NULL;
+
+        return complete;
+}
+
 int sd_lldp_start(sd_lldp *lldp) {
         int r;
 
@@ -602,6 +763,9 @@ int sd_lldp_stop(sd_lldp *lldp) {
         if (r < 0)
                 return r;
 
+        lldp->timer = sd_event_source_unref(lldp->timer);
+        lldp->notify_event_source = sd_event_source_unref(lldp->notify_event_source);
+
         lldp_mib_objects_flush(lldp);
 
         return 0;
@@ -630,6 +794,9 @@ int sd_lldp_detach_event(sd_lldp *lldp) {
 
         assert_return(lldp, -EINVAL);
 
+        lldp->timer = sd_event_source_unref(lldp->timer);
+        lldp->notify_event_source = sd_event_source_unref(lldp->notify_event_source);
+
         lldp->port->event = sd_event_unref(lldp->port->event);
 
         return 0;
@@ -652,6 +819,9 @@ void sd_lldp_free(sd_lldp *lldp) {
         /* Drop all packets */
         lldp_mib_objects_flush(lldp);
 
+        sd_event_source_unref(lldp->timer);
+        sd_event_source_unref(lldp->notify_event_source);
+
         lldp_port_free(lldp->port);
 
         hashmap_free(lldp->neighbour_mib);
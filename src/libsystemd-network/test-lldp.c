@@ -28,6 +28,7 @@
 #include "macro.h"
 #include "lldp.h"
 #include "lldp-tlv.h"
+#include "lldp-internal.h"
 
 #define TEST_LLDP_PORT "em1"
 #define TEST_LLDP_TYPE_SYSTEM_NAME "systemd-lldp"
@@ -37,7 +38,7 @@ static struct ether_addr mac_addr = {
         .ether_addr_octet = {'A', 'B', 'C', '1', '2', '3'}
 };
 
-static int lldp_build_tlv_packet(tlv_packet **ret) {
+static int lldp_build_tlv_packet(uint16_t ttl, tlv_packet **ret) {
         _cleanup_tlv_packet_free_ tlv_packet *m = NULL;
         const uint8_t lldp_dst[] = LLDP_MULTICAST_ADDR;
         struct ether_header ether = {
@@ -70,7 +71,7 @@ static int lldp_build_tlv_packet(tlv_packet **ret) {
         /* ttl */
         assert_se(lldp_tlv_packet_open_container(m, LLDP_TYPE_TTL) >= 0);
 
-        assert_se(tlv_packet_append_u16(m, 170) >= 0);
+        assert_se(tlv_packet_append_u16(m, ttl) >= 0);
 
         assert_se(lldp_tlv_packet_close_container(m) >= 0);
 
@@ -215,11 +216,69 @@ static int lldp_parse_tlv_packet(tlv_packet *m, int len) {
         return 0;
 }
 
+static int expiry_compare(const void *a, const void *b) {
+        const lldp_neighbour_port *p = a, *q = b;
+
+        return p->until < q->until ? -1 : p->until > q->until;
+}
+
+static void add_neighbour(Prioq *by_expiry, Hashmap *mib, lldp_mib_generation *generation,
+                          uint16_t ttl, int changed) {
+        tlv_packet *tlv;
+
+        assert_se(lldp_build_tlv_packet(ttl, &tlv) >= 0);
+        assert_se(tlv_packet_parse_pdu(tlv, tlv->length) >= 0);
+
+        assert_se(lldp_mib_add_objects(by_expiry, mib, generation, tlv) == changed);
+}
+
+static void test_mib_generation(void) {
+        lldp_mib_generation generation = {};
+        Prioq *by_expiry;
+        Hashmap *mib;
+
+        mib = hashmap_new(&chassis_id_hash_ops);
+        assert_se(mib);
+
+        by_expiry = prioq_new(expiry_compare);
+        assert_se(by_expiry);
+
+        /* a new neighbour */
+        add_neighbour(by_expiry, mib, &generation, 170, 1);
+        assert_se(generation.current == 1);
+        assert_se(generation.removed == 0);
+        assert_se(prioq_size(by_expiry) == 1);
+
+        /* the same LLDPDU again merely refreshes it */
+        add_neighbour(by_expiry, mib, &generation, 170, 0);
+        assert_se(generation.current == 1);
+        assert_se(prioq_size(by_expiry) == 1);
+
+        /* anything else in it is a change */
+        add_neighbour(by_expiry, mib, &generation, 120, 1);
+        assert_se(generation.current == 2);
+        assert_se(prioq_size(by_expiry) == 1);
+
+        /* a TTL of zero removes the neighbour */
+        add_neighbour(by_expiry, mib, &generation, 0, 1);
+        assert_se(generation.current == 3);
+        assert_se(generation.removed == 3);
+        assert_se(prioq_size(by_expiry) == 0);
+        assert_se(hashmap_size(mib) == 0);
+
+        /* which is no change if we don't know it */
+        add_neighbour(by_expiry, mib, &generation, 0, 0);
+        assert_se(generation.current == 3);
+
+        prioq_free(by_expiry);
+        hashmap_free(mib);
+}
+
 int main(int argc, char *argv[]) {
         _cleanup_tlv_packet_free_ tlv_packet *tlv = NULL;
 
         /* form a packet */
-        lldp_build_tlv_packet(&tlv);
+        lldp_build_tlv_packet(170, &tlv);
 
         /* parse the packet */
         tlv_packet_parse_pdu(tlv, tlv->length);
@@ -227,5 +286,7 @@ int main(int argc, char *argv[]) {
         /* verify */
         lldp_parse_tlv_packet(tlv, tlv->length);
 
+        test_mib_generation();
+
         return 0;
 }
@@ -555,10 +555,23 @@ int bus_pcap_header(size_t snaplen, FILE *f) {
         return fflush_and_check(f);
 }
 
+static void pcap_frame_header(sd_bus_message *m, size_t snaplen, pcaprec_hdr_t *hdr) {
+        struct timeval tv;
+
+        if (m->realtime != 0)
+                timeval_store(&tv, m->realtime);
+        else
+                assert_se(gettimeofday(&tv, NULL) >= 0);
+
+        hdr->ts_sec = tv.tv_sec;
+        hdr->ts_usec = tv.tv_usec;
+        hdr->orig_len = BUS_MESSAGE_SIZE(m);
+        hdr->incl_len = MIN(hdr->orig_len, snaplen);
+}
+
 int bus_message_pcap_frame(sd_bus_message *m, size_t snaplen, FILE *f) {
         struct bus_body_part *part;
         pcaprec_hdr_t hdr = {};
-        struct timeval tv;
         unsigned i;
         size_t w;
 
@@ -569,15 +582,7 @@ int bus_message_pcap_frame(sd_bus_message *m, size_t snaplen, FILE *f) {
         assert(snaplen > 0);
         assert((size_t) (uint32_t) snaplen == snaplen);
 
-        if (m->realtime != 0)
-                timeval_store(&tv, m->realtime);
-        else
-                assert_se(gettimeofday(&tv, NULL) >= 0);
-
-        hdr.ts_sec = tv.tv_sec;
-        hdr.ts_usec = tv.tv_usec;
-        hdr.orig_len = BUS_MESSAGE_SIZE(m);
-        hdr.incl_len = MIN(hdr.orig_len, snaplen);
+        pcap_frame_header(m, snaplen, &hdr);
 
         /* write the pcap header */
         fwrite(&hdr, 1, sizeof(hdr), f);
@@ -599,3 +604,41 @@ int bus_message_pcap_frame(sd_bus_message *m, size_t snaplen, FILE *f) {
 
         return fflush_and_check(f);
 }
+
+size_t bus_message_pcap_frame_size(sd_bus_message *m, size_t snaplen) {
+        assert(m);
+
+        return sizeof(pcaprec_hdr_t) + MIN((size_t) BUS_MESSAGE_SIZE(m), snaplen);
+}
+
+void bus_message_pcap_frame_to_buffer(sd_bus_message *m, size_t snaplen, void *buffer) {
+        struct bus_body_part *part;
+        pcaprec_hdr_t hdr = {};
+        uint8_t *p = buffer;
+        unsigned i;
+        size_t w;
+
+        /* Like bus_message_pcap_frame(), but serializes into a buffer
+         * of bus_message_pcap_frame_size() bytes */
+
+        assert(m);
+        assert(buffer);
+        assert(snaplen > 0);
+        assert((size_t) (uint32_t) snaplen == snaplen);
+
+        pcap_frame_header(m, snaplen, &hdr);
+        p = mempcpy(p, &hdr, sizeof(hdr));
+
+        w = MIN(BUS_MESSAGE_BODY_BEGIN(m), snaplen);
+        p = mempcpy(p, m->header, w);
+        snaplen -= w;
+
+        MESSAGE_FOREACH_PART(part, i, m) {
+                if (snaplen <= 0)
+                        break;
+
+                w = MIN(part->size, snaplen);
+                p = mempcpy(p, part->data, w);
+                snaplen -= w;
+        }
+}
@@ -25,6 +25,7 @@
 #include <pthread.h>
 
 #include "hashmap.h"
+#include "mempool.h"
 #include "prioq.h"
 #include "list.h"
 #include "util.h"
@@ -110,6 +111,17 @@ struct node_vtable {
         const sd_bus_vtable *vtable;
         sd_bus_object_find_t find;
 
+        /* The properties GetAll() shall return, NULL terminated */
+        const sd_bus_vtable **properties;
+
+        /* Whether changes to all of these properties are signalled,
+         * so that their serialization may be cached */
+        bool properties_cacheable;
+
+        /* The <interface> body for introspection, generated on
+         * first use */
+        char *introspection;
+
         unsigned last_iteration;
 
         LIST_FIELDS(struct node_vtable, vtables);
@@ -195,6 +207,8 @@ struct sd_bus {
 
         bool is_kernel:1;
         bool can_fds:1;
+        bool can_memfd:1;
+        bool refuse_memfd:1;
         bool bus_client:1;
         bool ucred_valid:1;
         bool is_server:1;
@@ -240,6 +254,9 @@ struct sd_bus {
         Hashmap *vtable_methods;
         Hashmap *vtable_properties;
 
+        /* Serialized properties for GetManagedObjects(), by path */
+        Hashmap *object_cache;
+
         union sockaddr_union sockaddr;
         socklen_t sockaddr_size;
 
@@ -286,6 +303,22 @@ struct sd_bus {
         struct memfd_cache memfd_cache[MEMFD_CACHE_MAX];
         unsigned n_memfd_cache;
 
+        /* Messages we create are allocated from this pool. They might
+         * be freed in another thread too, see above. */
+        pthread_mutex_t message_pool_mutex;
+        struct mempool message_pool;
+
+        /* If the bus is marked thread-safe, threads other than the
+         * owner may send messages and issue synchronous method
+         * calls. The write queue, the cookie counter and the table of
+         * calls waiting in other threads are protected by this
+         * lock. Replies are read and routed by the owner thread
+         * only. */
+        bool thread_safe;
+        pthread_mutex_t lock;
+        pthread_t owner_thread;
+        Hashmap *thread_calls;
+
         pid_t original_pid;
 
         uint64_t hello_flags;
@@ -321,6 +354,11 @@ struct sd_bus {
 
         sd_bus_track *track_queue;
 
+        /* All names tracked by any sd_bus_track object of this bus,
+         * and the one NameOwnerChanged match they share */
+        Hashmap *track_items;
+        sd_bus_slot *track_match;
+
         LIST_HEAD(sd_bus_slot, slots);
 };
 
@@ -370,6 +408,20 @@ int bus_rqueue_make_room(sd_bus *bus);
 
 bool bus_pid_changed(sd_bus *bus);
 
+static inline bool bus_foreign_thread(sd_bus *bus) {
+        return bus->thread_safe && !pthread_equal(pthread_self(), bus->owner_thread);
+}
+
+static inline void bus_lock(sd_bus *bus) {
+        if (bus->thread_safe)
+                assert_se(pthread_mutex_lock(&bus->lock) == 0);
+}
+
+static inline void bus_unlock(sd_bus *bus) {
+        if (bus->thread_safe)
+                assert_se(pthread_mutex_unlock(&bus->lock) == 0);
+}
+
 char *bus_address_escape(const char *v);
 
 #define OBJECT_PATH_FOREACH_PREFIX(prefix, path)                        \
@@ -65,10 +65,16 @@ static inline bool BUS_MATCH_IS_COMPARE(enum bus_match_node_type t) {
         return t >= BUS_MATCH_SENDER && t <= BUS_MATCH_ARG_HAS_LAST;
 }
 
+static inline bool BUS_MATCH_CAN_HASH_PREFIX(enum bus_match_node_type t) {
+        return t == BUS_MATCH_PATH_NAMESPACE ||
+                (t >= BUS_MATCH_ARG_NAMESPACE && t <= BUS_MATCH_ARG_NAMESPACE_LAST);
+}
+
 static inline bool BUS_MATCH_CAN_HASH(enum bus_match_node_type t) {
         return (t >= BUS_MATCH_MESSAGE_TYPE && t <= BUS_MATCH_PATH) ||
                 (t >= BUS_MATCH_ARG && t <= BUS_MATCH_ARG_LAST) ||
-                (t >= BUS_MATCH_ARG_HAS && t <= BUS_MATCH_ARG_HAS_LAST);
+                (t >= BUS_MATCH_ARG_HAS && t <= BUS_MATCH_ARG_HAS_LAST) ||
+                BUS_MATCH_CAN_HASH_PREFIX(t);
 }
 
 static void bus_match_node_free(struct bus_match_node *node) {
@@ -252,6 +258,66 @@ static bool value_node_same(
         }
 }
 
+static int bus_match_run_prefixes(
+                sd_bus *bus,
+                struct bus_match_node *node,
+                const char *test_str,
+                sd_bus_message *m) {
+
+        _cleanup_free_ char *allocated = NULL;
+        char separator, *buf;
+        size_t l, k;
+        int r;
+
+        assert(node);
+        assert(BUS_MATCH_CAN_HASH_PREFIX(node->type));
+
+        if (!test_str)
+                return 0;
+
+        /* Namespace matches are hashed by their value too. A value
+         * matches the namespaces that are equal to it, or a prefix
+         * of it that ends right before or right after a separator,
+         * hence look up exactly those prefixes, each one once. */
+
+        separator = node->type == BUS_MATCH_PATH_NAMESPACE ? '/' : '.';
+
+        l = strlen(test_str);
+        if (l < 4096)
+                buf = strndupa(test_str, l);
+        else {
+                buf = allocated = strndup(test_str, l);
+                if (!buf)
+                        return -ENOMEM;
+        }
+
+        for (k = 0; k <= l; k++) {
+                struct bus_match_node *found;
+                char c;
+
+                if (k < l &&
+                    test_str[k] != separator &&
+                    (k == 0 || test_str[k-1] != separator))
+                        continue;
+
+                c = buf[k];
+                buf[k] = 0;
+                found = hashmap_get(node->compare.children, buf);
+                buf[k] = c;
+
+                if (found) {
+                        r = bus_match_run(bus, found, m);
+                        if (r != 0)
+                                return r;
+
+                        if (bus && bus->match_callbacks_modified)
+                                return 0;
+                }
+        }
+
+        return 0;
+}
+
 int bus_match_run(
                 sd_bus *bus,
                 struct bus_match_node *node,
@@ -384,7 +450,13 @@ int bus_match_run(
                 assert_not_reached("Unknown match type.");
         }
 
-        if (BUS_MATCH_CAN_HASH(node->type)) {
+        if (BUS_MATCH_CAN_HASH_PREFIX(node->type)) {
+
+                r = bus_match_run_prefixes(bus, node, test_str, m);
+                if (r != 0)
+                        return r;
+
+        } else if (BUS_MATCH_CAN_HASH(node->type)) {
                 struct bus_match_node *found;
 
                 /* Lookup via hash table, nice! So let's jump directly. */
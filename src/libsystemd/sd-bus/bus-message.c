@@ -119,7 +119,16 @@ static void message_reset_containers(sd_bus_message *m) {
         m->root_container.index = 0;
 }
 
+static void *message_inline_body(sd_bus_message *m) {
+        assert(m->from_pool);
+
+        return (uint8_t*) m + ALIGN(sizeof(sd_bus_message)) + BUS_MESSAGE_INLINE_HEADER_SIZE;
+}
+
 static void message_free(sd_bus_message *m) {
+        bool unpinned;
+        sd_bus *bus;
+
         assert(m);
 
         if (m->free_header)
@@ -133,7 +142,10 @@ static void message_free(sd_bus_message *m) {
         if (m->free_kdbus)
                 free(m->kdbus);
 
-        sd_bus_unref(m->bus);
+        /* Drop the bus only once we are done with the message, as
+         * it might be allocated from the bus' pool */
+        bus = m->bus;
+        unpinned = m->bus_unpinned;
 
         if (m->free_fds) {
                 close_many(m->fds, m->n_fds);
@@ -151,7 +163,29 @@ static void message_free(sd_bus_message *m) {
         free(m->root_container.peeked_signature);
 
         bus_creds_done(&m->creds);
-        free(m);
+
+        if (m->from_pool) {
+                assert_se(pthread_mutex_lock(&bus->message_pool_mutex) == 0);
+                mempool_free_tile(&bus->message_pool, m);
+                assert_se(pthread_mutex_unlock(&bus->message_pool_mutex) == 0);
+        } else
+                free(m);
+
+        if (!unpinned)
+                sd_bus_unref(bus);
+}
+
+void bus_message_unpin_bus(sd_bus_message *m) {
+        assert(m);
+        assert(m->bus);
+        assert(!m->bus_unpinned);
+
+        /* For messages the bus keeps for itself: they must not keep
+         * the bus alive, and hence need to be released before it
+         * goes away. */
+
+        m->bus_unpinned = true;
+        sd_bus_unref(m->bus);
 }
 
 static void *message_extend_fields(sd_bus_message *m, size_t align, size_t sz, bool add_offset) {
@@ -178,7 +212,11 @@ static void *message_extend_fields(sd_bus_message *m, size_t align, size_t sz, b
                 np = realloc(m->header, ALIGN8(new_size));
                 if (!np)
                         goto poison;
-        } else {
+        } else if (m->from_pool &&
+                   ALIGN8(new_size) <= BUS_MESSAGE_INLINE_HEADER_SIZE)
+                /* Still fits into the room behind the message */
+                np = m->header;
+        else {
                 /* Initially, the header is allocated as part of of
                  * the sd_bus_message itself, let's replace it by
                  * dynamic data */
@@ -187,7 +225,8 @@ static void *message_extend_fields(sd_bus_message *m, size_t align, size_t sz, b
                 if (!np)
                         goto poison;
 
-                memcpy(np, m->header, sizeof(struct bus_header));
+                memcpy(np, m->header, old_size);
+                m->free_header = true;
         }
 
         /* Zero out padding */
@@ -206,8 +245,6 @@ static void *message_extend_fields(sd_bus_message *m, size_t align, size_t sz, b
         m->sender = adjust_pointer(m->sender, op, old_size, m->header);
         m->error.name = adjust_pointer(m->error.name, op, old_size, m->header);
 
-        m->free_header = true;
-
         if (add_offset) {
                 if (m->n_header_offsets >= ELEMENTSOF(m->header_offsets))
                         goto poison;
@@ -475,7 +512,7 @@ int bus_message_from_header(
         if (!m)
                 return -ENOMEM;
 
-        m->n_ref = 1;
+        m->n_ref = REFCNT_INIT;
         m->sealed = true;
         m->header = header;
         m->header_accessible = header_accessible;
@@ -590,16 +627,72 @@ fail:
         return r;
 }
 
+int bus_message_from_malloc_and_memfd(
+                sd_bus *bus,
+                void *buffer,
+                size_t length,
+                int memfd,
+                size_t memfd_size,
+                int *fds,
+                unsigned n_fds,
+                const char *label,
+                sd_bus_message **ret) {
+
+        sd_bus_message *m;
+        int r;
+
+        assert(memfd >= 0);
+
+        /* Like bus_message_from_malloc(), but the buffer only
+         * contains the header, and the body is in the memfd */
+
+        r = bus_message_from_header(
+                        bus,
+                        buffer, length,
+                        buffer, length,
+                        length + memfd_size,
+                        fds, n_fds,
+                        label,
+                        0, &m);
+        if (r < 0)
+                return r;
+
+        if (memfd_size > 0) {
+                m->n_body_parts = 1;
+                m->body.memfd = memfd;
+                m->body.size = memfd_size;
+                m->body.sealed = true;
+        }
+
+        r = bus_message_parse_fields(m);
+        if (r < 0) {
+                /* Leave the memfd to the caller, like the other fds */
+                bus_body_part_unmap(&m->body);
+                m->n_body_parts = 0;
+                message_free(m);
+                return r;
+        }
+
+        m->free_header = true;
+        m->free_fds = true;
+
+        *ret = m;
+        return 0;
+}
+
 static sd_bus_message *message_new(sd_bus *bus, uint8_t type) {
         sd_bus_message *m;
 
         assert(bus);
 
-        m = malloc0(ALIGN(sizeof(sd_bus_message)) + sizeof(struct bus_header));
+        assert_se(pthread_mutex_lock(&bus->message_pool_mutex) == 0);
+        m = mempool_alloc0_tile(&bus->message_pool);
+        assert_se(pthread_mutex_unlock(&bus->message_pool_mutex) == 0);
         if (!m)
                 return NULL;
 
-        m->n_ref = 1;
+        m->n_ref = REFCNT_INIT;
+        m->from_pool = true;
         m->header = (struct bus_header*) ((uint8_t*) m + ALIGN(sizeof(struct sd_bus_message)));
         m->header->endian = BUS_NATIVE_ENDIAN;
         m->header->type = type;
@@ -917,8 +1010,7 @@ fail:
 _public_ sd_bus_message* sd_bus_message_ref(sd_bus_message *m) {
         assert_return(m, NULL);
 
-        assert(m->n_ref > 0);
-        m->n_ref++;
+        assert_se(REFCNT_INC(m->n_ref) >= 2);
 
         return m;
 }
@@ -928,10 +1020,7 @@ _public_ sd_bus_message* sd_bus_message_unref(sd_bus_message *m) {
         if (!m)
                 return NULL;
 
-        assert(m->n_ref > 0);
-        m->n_ref--;
-
-        if (m->n_ref > 0)
+        if (REFCNT_DEC(m->n_ref) > 0)
                 return NULL;
 
         message_free(m);
@@ -1270,14 +1359,34 @@ static int part_make_space(
 
                 part->munmap_this = true;
         } else {
-                if (part->allocated == 0 || sz > part->allocated) {
+                if (part->allocated == 0 &&
+                    part == &m->body &&
+                    m->from_pool &&
+                    sz <= BUS_MESSAGE_INLINE_BODY_SIZE) {
+
+                        /* Small bodies go into the room behind the message */
+                        part->data = message_inline_body(m);
+                        part->allocated = BUS_MESSAGE_INLINE_BODY_SIZE;
+
+                } else if (part->allocated == 0 || sz > part->allocated) {
                         size_t new_allocated;
 
                         new_allocated = sz > 0 ? 2 * sz : 64;
-                        n = realloc(part->data, new_allocated);
-                        if (!n) {
-                                m->poisoned = true;
-                                return -ENOMEM;
+
+                        if (part->data && !part->free_this) {
+                                n = malloc(new_allocated);
+                                if (!n) {
+                                        m->poisoned = true;
+                                        return -ENOMEM;
+                                }
+
+                                memcpy(n, part->data, part->size);
+                        } else {
+                                n = realloc(part->data, new_allocated);
+                                if (!n) {
+                                        m->poisoned = true;
+                                        return -ENOMEM;
+                                }
                         }
 
                         part->data = n;
@@ -1747,6 +1856,7 @@ static int bus_message_open_array(
                 sd_bus_message *m,
                 struct bus_container *c,
                 const char *contents,
+                const BusSignatureElement *e,
                 uint32_t **array_size,
                 size_t *begin,
                 bool *need_offsets) {
@@ -1761,7 +1871,9 @@ static int bus_message_open_array(
         assert(begin);
         assert(need_offsets);
 
-        if (!signature_is_single(contents, true))
+        /* If we have a plan element for the array, its contents
+         * have been validated already */
+        if (!e && !signature_is_single(contents, true))
                 return -EINVAL;
 
         if (c->signature && c->signature[c->index]) {
@@ -1793,7 +1905,7 @@ static int bus_message_open_array(
         }
 
         if (BUS_MESSAGE_IS_GVARIANT(m)) {
-                alignment = bus_gvariant_get_alignment(contents);
+                alignment = e ? e->contents_alignment : bus_gvariant_get_alignment(contents);
                 if (alignment < 0)
                         return alignment;
 
@@ -1801,7 +1913,7 @@ static int bus_message_open_array(
                 if (!message_extend_body(m, alignment, 0, false, false))
                         return -ENOMEM;
 
-                r = bus_gvariant_is_fixed_size(contents);
+                r = e ? e->contents_fixed : bus_gvariant_is_fixed_size(contents);
                 if (r < 0)
                         return r;
 
@@ -1904,6 +2016,7 @@ static int bus_message_open_struct(
                 sd_bus_message *m,
                 struct bus_container *c,
                 const char *contents,
+                const BusSignatureElement *e,
                 size_t *begin,
                 bool *need_offsets) {
 
@@ -1916,7 +2029,7 @@ static int bus_message_open_struct(
         assert(begin);
         assert(need_offsets);
 
-        if (!signature_is_valid(contents, false))
+        if (!e && !signature_is_valid(contents, false))
                 return -EINVAL;
 
         if (c->signature && c->signature[c->index]) {
@@ -1948,14 +2061,14 @@ static int bus_message_open_struct(
         if (BUS_MESSAGE_IS_GVARIANT(m)) {
                 int alignment;
 
-                alignment = bus_gvariant_get_alignment(contents);
+                alignment = e ? e->contents_alignment : bus_gvariant_get_alignment(contents);
                 if (alignment < 0)
                         return alignment;
 
                 if (!message_extend_body(m, alignment, 0, false, false))
                         return -ENOMEM;
 
-                r = bus_gvariant_is_fixed_size(contents);
+                r = e ? e->contents_fixed : bus_gvariant_is_fixed_size(contents);
                 if (r < 0)
                         return r;
 
@@ -1977,6 +2090,7 @@ static int bus_message_open_dict_entry(
                 sd_bus_message *m,
                 struct bus_container *c,
                 const char *contents,
+                const BusSignatureElement *e,
                 size_t *begin,
                 bool *need_offsets) {
 
@@ -1988,7 +2102,7 @@ static int bus_message_open_dict_entry(
         assert(begin);
         assert(need_offsets);
 
-        if (!signature_is_pair(contents))
+        if (!e && !signature_is_pair(contents))
                 return -EINVAL;
 
         if (c->enclosing != SD_BUS_TYPE_ARRAY)
@@ -2009,14 +2123,14 @@ static int bus_message_open_dict_entry(
         if (BUS_MESSAGE_IS_GVARIANT(m)) {
                 int alignment;
 
-                alignment = bus_gvariant_get_alignment(contents);
+                alignment = e ? e->contents_alignment : bus_gvariant_get_alignment(contents);
                 if (alignment < 0)
                         return alignment;
 
                 if (!message_extend_body(m, alignment, 0, false, false))
                         return -ENOMEM;
 
-                r = bus_gvariant_is_fixed_size(contents);
+                r = e ? e->contents_fixed : bus_gvariant_is_fixed_size(contents);
                 if (r < 0)
                         return r;
 
@@ -2031,10 +2145,11 @@ static int bus_message_open_dict_entry(
         return 0;
 }
 
-_public_ int sd_bus_message_open_container(
+static int message_open_container(
                 sd_bus_message *m,
                 char type,
-                const char *contents) {
+                const char *contents,
+                const BusSignatureElement *e) {
 
         struct bus_container *c, *w;
         uint32_t *array_size = NULL;
@@ -2043,10 +2158,12 @@ _public_ int sd_bus_message_open_container(
         bool need_offsets = false;
         int r;
 
-        assert_return(m, -EINVAL);
-        assert_return(!m->sealed, -EPERM);
-        assert_return(contents, -EINVAL);
-        assert_return(!m->poisoned, -ESTALE);
+        assert(m);
+        assert(!m->sealed);
+        assert(contents);
+
+        if (m->poisoned)
+                return -ESTALE;
 
         /* Make sure we have space for one more container */
         if (!GREEDY_REALLOC(m->containers, m->containers_allocated, m->n_containers + 1)) {
@@ -2068,13 +2185,13 @@ _public_ int sd_bus_message_open_container(
         before = m->body_size;
 
         if (type == SD_BUS_TYPE_ARRAY)
-                r = bus_message_open_array(m, c, contents, &array_size, &begin, &need_offsets);
+                r = bus_message_open_array(m, c, contents, e, &array_size, &begin, &need_offsets);
         else if (type == SD_BUS_TYPE_VARIANT)
                 r = bus_message_open_variant(m, c, contents);
         else if (type == SD_BUS_TYPE_STRUCT)
-                r = bus_message_open_struct(m, c, contents, &begin, &need_offsets);
+                r = bus_message_open_struct(m, c, contents, e, &begin, &need_offsets);
         else if (type == SD_BUS_TYPE_DICT_ENTRY)
-                r = bus_message_open_dict_entry(m, c, contents, &begin, &need_offsets);
+                r = bus_message_open_dict_entry(m, c, contents, e, &begin, &need_offsets);
         else
                 r = -EINVAL;
 
@@ -2098,6 +2215,19 @@ _public_ int sd_bus_message_open_container(
         return 0;
 }
 
+_public_ int sd_bus_message_open_container(
+                sd_bus_message *m,
+                char type,
+                const char *contents) {
+
+        assert_return(m, -EINVAL);
+        assert_return(!m->sealed, -EPERM);
+        assert_return(contents, -EINVAL);
+        assert_return(!m->poisoned, -ESTALE);
+
+        return message_open_container(m, type, contents, NULL);
+}
+
 static int bus_message_close_array(sd_bus_message *m, struct bus_container *c) {
 
         assert(m);
@@ -2308,18 +2438,20 @@ _public_ int sd_bus_message_close_container(sd_bus_message *m) {
 }
 
 typedef struct {
+        const BusSignaturePlan *plan;
         const char *types;
         unsigned n_struct;
         unsigned n_array;
 } TypeStack;
 
-static int type_stack_push(TypeStack *stack, unsigned max, unsigned *i, const char *types, unsigned n_struct, unsigned n_array) {
+static int type_stack_push(TypeStack *stack, unsigned max, unsigned *i, const BusSignaturePlan *plan, const char *types, unsigned n_struct, unsigned n_array) {
         assert(stack);
         assert(max > 0);
 
         if (*i >= max)
                 return -EINVAL;
 
+        stack[*i].plan = plan;
         stack[*i].types = types;
         stack[*i].n_struct = n_struct;
         stack[*i].n_array = n_array;
@@ -2328,9 +2460,10 @@ static int type_stack_push(TypeStack *stack, unsigned max, unsigned *i, const ch
         return 0;
 }
 
-static int type_stack_pop(TypeStack *stack, unsigned max, unsigned *i, const char **types, unsigned *n_struct, unsigned *n_array) {
+static int type_stack_pop(TypeStack *stack, unsigned max, unsigned *i, const BusSignaturePlan **plan, const char **types, unsigned *n_struct, unsigned *n_array) {
         assert(stack);
         assert(max > 0);
+        assert(plan);
         assert(types);
         assert(n_struct);
         assert(n_array);
@@ -2339,6 +2472,7 @@ static int type_stack_pop(TypeStack *stack, unsigned max, unsigned *i, const cha
                 return 0;
 
         (*i)--;
+        *plan = stack[*i].plan;
         *types = stack[*i].types;
         *n_struct = stack[*i].n_struct;
         *n_array = stack[*i].n_array;
@@ -2346,6 +2480,17 @@ static int type_stack_pop(TypeStack *stack, unsigned max, unsigned *i, const cha
         return 1;
 }
 
+/* Walk the plan's copy of the signature, if there is one, so that
+ * the positions we pass to bus_signature_plan_element() are in it */
+static const char *type_plan_get(const char *types, const BusSignaturePlan **plan) {
+        assert(types);
+        assert(plan);
+
+        *plan = bus_signature_plan_get(types);
+
+        return *plan ? (*plan)->signature : types;
+}
+
 int bus_message_append_ap(
                 sd_bus_message *m,
                 const char *types,
@@ -2354,6 +2499,7 @@ int bus_message_append_ap(
         unsigned n_array, n_struct;
         TypeStack stack[BUS_CONTAINER_DEPTH];
         unsigned stack_ptr = 0;
+        const BusSignaturePlan *plan;
         int r;
 
         assert(m);
@@ -2361,14 +2507,17 @@ int bus_message_append_ap(
         if (!types)
                 return 0;
 
+        types = type_plan_get(types, &plan);
+
         n_array = (unsigned) -1;
         n_struct = strlen(types);
 
         for (;;) {
+                const BusSignatureElement *e;
                 const char *t;
 
                 if (n_array == 0 || (n_array == (unsigned) -1 && n_struct == 0)) {
-                        r = type_stack_pop(stack, ELEMENTSOF(stack), &stack_ptr, &types, &n_struct, &n_array);
+                        r = type_stack_pop(stack, ELEMENTSOF(stack), &stack_ptr, &plan, &types, &n_struct, &n_array);
                         if (r < 0)
                                 return r;
                         if (r == 0)
@@ -2452,18 +2601,27 @@ int bus_message_append_ap(
                 case SD_BUS_TYPE_ARRAY: {
                         size_t k;
 
-                        r = signature_element_length(t + 1, &k);
-                        if (r < 0)
-                                return r;
-
-                        {
-                                char s[k + 1];
-                                memcpy(s, t + 1, k);
-                                s[k] = 0;
+                        e = bus_signature_plan_element(plan, t);
+                        if (e) {
+                                k = e->length - 1;
 
-                                r = sd_bus_message_open_container(m, SD_BUS_TYPE_ARRAY, s);
+                                r = message_open_container(m, SD_BUS_TYPE_ARRAY, e->contents, e);
                                 if (r < 0)
                                         return r;
+                        } else {
+                                r = signature_element_length(t + 1, &k);
+                                if (r < 0)
+                                        return r;
+
+                                {
+                                        char s[k + 1];
+                                        memcpy(s, t + 1, k);
+                                        s[k] = 0;
+
+                                        r = sd_bus_message_open_container(m, SD_BUS_TYPE_ARRAY, s);
+                                        if (r < 0)
+                                                return r;
+                                }
                         }
 
                         if (n_array == (unsigned) -1) {
@@ -2471,7 +2629,7 @@ int bus_message_append_ap(
                                 n_struct -= k;
                         }
 
-                        r = type_stack_push(stack, ELEMENTSOF(stack), &stack_ptr, types, n_struct, n_array);
+                        r = type_stack_push(stack, ELEMENTSOF(stack), &stack_ptr, plan, types, n_struct, n_array);
                         if (r < 0)
                                 return r;
 
@@ -2493,12 +2651,12 @@ int bus_message_append_ap(
                         if (r < 0)
                                 return r;
 
-                        r = type_stack_push(stack, ELEMENTSOF(stack), &stack_ptr, types, n_struct, n_array);
+                        r = type_stack_push(stack, ELEMENTSOF(stack), &stack_ptr, plan, types, n_struct, n_array);
                         if (r < 0)
                                 return r;
 
-                        types = s;
-                        n_struct = strlen(s);
+                        types = type_plan_get(s, &plan);
+                        n_struct = strlen(types);
                         n_array = (unsigned) -1;
 
                         break;
@@ -2508,19 +2666,28 @@ int bus_message_append_ap(
                 case SD_BUS_TYPE_DICT_ENTRY_BEGIN: {
                         size_t k;
 
-                        r = signature_element_length(t, &k);
-                        if (r < 0)
-                                return r;
-
-                        {
-                                char s[k - 1];
+                        e = bus_signature_plan_element(plan, t);
+                        if (e) {
+                                k = e->length;
 
-                                memcpy(s, t + 1, k - 2);
-                                s[k - 2] = 0;
-
-                                r = sd_bus_message_open_container(m, *t == SD_BUS_TYPE_STRUCT_BEGIN ? SD_BUS_TYPE_STRUCT : SD_BUS_TYPE_DICT_ENTRY, s);
+                                r = message_open_container(m, *t == SD_BUS_TYPE_STRUCT_BEGIN ? SD_BUS_TYPE_STRUCT : SD_BUS_TYPE_DICT_ENTRY, e->contents, e);
+                                if (r < 0)
+                                        return r;
+                        } else {
+                                r = signature_element_length(t, &k);
                                 if (r < 0)
                                         return r;
+
+                                {
+                                        char s[k - 1];
+
+                                        memcpy(s, t + 1, k - 2);
+                                        s[k - 2] = 0;
+
+                                        r = sd_bus_message_open_container(m, *t == SD_BUS_TYPE_STRUCT_BEGIN ? SD_BUS_TYPE_STRUCT : SD_BUS_TYPE_DICT_ENTRY, s);
+                                        if (r < 0)
+                                                return r;
+                                }
                         }
 
                         if (n_array == (unsigned) -1) {
@@ -2528,7 +2695,7 @@ int bus_message_append_ap(
                                 n_struct -= k - 1;
                         }
 
-                        r = type_stack_push(stack, ELEMENTSOF(stack), &stack_ptr, types, n_struct, n_array);
+                        r = type_stack_push(stack, ELEMENTSOF(stack), &stack_ptr, plan, types, n_struct, n_array);
                         if (r < 0)
                                 return r;
 
@@ -3606,6 +3773,7 @@ static int bus_message_enter_array(
                 sd_bus_message *m,
                 struct bus_container *c,
                 const char *contents,
+                const BusSignatureElement *e,
                 uint32_t **array_size,
                 size_t *item_size,
                 size_t **offsets,
@@ -3623,7 +3791,7 @@ static int bus_message_enter_array(
         assert(offsets);
         assert(n_offsets);
 
-        if (!signature_is_single(contents, true))
+        if (!e && !signature_is_single(contents, true))
                 return -EINVAL;
 
         if (!c->signature || c->signature[c->index] == 0)
@@ -3664,10 +3832,10 @@ static int bus_message_enter_array(
                 *offsets = NULL;
                 *n_offsets = 0;
 
-        } else if (bus_gvariant_is_fixed_size(contents)) {
+        } else if (e ? e->contents_fixed : bus_gvariant_is_fixed_size(contents)) {
 
                 /* gvariant: fixed length array */
-                *item_size = bus_gvariant_get_size(contents);
+                *item_size = e ? e->contents_size : bus_gvariant_get_size(contents);
                 *offsets = NULL;
                 *n_offsets = 0;
 
@@ -3802,6 +3970,7 @@ static int bus_message_enter_variant(
 static int build_struct_offsets(
                 sd_bus_message *m,
                 const char *signature,
+                const BusSignatureElement *elements,
                 size_t size,
                 size_t *item_size,
                 size_t **offsets,
@@ -3846,27 +4015,24 @@ static int build_struct_offsets(
 
         p = signature;
         while (*p != 0) {
-                size_t n;
+                BusSignatureElement buf;
+                const BusSignatureElement *e;
 
-                r = signature_element_length(p, &n);
-                if (r < 0)
-                        return r;
+                if (elements)
+                        e = elements + (p - signature);
                 else {
-                        char t[n+1];
-
-                        memcpy(t, p, n);
-                        t[n] = 0;
+                        r = signature_element_layout(p, &buf);
+                        if (r < 0)
+                                return r;
 
-                        r = bus_gvariant_is_fixed_size(t);
+                        e = &buf;
                 }
 
-                if (r < 0)
-                        return r;
-                if (r == 0 && p[n] != 0) /* except the last item */
+                if (e->size < 0 && p[e->length] != 0) /* except the last item */
                         n_variable ++;
                 n_total++;
 
-                p += n;
+                p += e->length;
         }
 
         if (size < n_variable * sz)
@@ -3888,53 +4054,50 @@ static int build_struct_offsets(
         /* Second, loop again and build an offset table */
         p = signature;
         while (*p != 0) {
-                size_t n, offset;
-                int k;
+                BusSignatureElement buf;
+                const BusSignatureElement *e;
+                size_t offset;
 
-                r = signature_element_length(p, &n);
-                if (r < 0)
-                        return r;
+                if (elements)
+                        e = elements + (p - signature);
                 else {
-                        char t[n+1];
-
-                        memcpy(t, p, n);
-                        t[n] = 0;
+                        r = signature_element_layout(p, &buf);
+                        if (r < 0)
+                                return r;
 
-                        k = bus_gvariant_get_size(t);
-                        if (k < 0) {
-                                size_t x;
+                        e = &buf;
+                }
 
-                                /* variable size */
-                                if (v > 0) {
-                                        v--;
+                if (e->size < 0) {
+                        size_t x;
 
-                                        x = bus_gvariant_read_word_le((uint8_t*) q + v*sz, sz);
-                                        if (x >= size)
-                                                return -EBADMSG;
-                                        if (m->rindex + x < previous)
-                                                return -EBADMSG;
-                                } else
-                                        /* The last item's end
-                                         * is determined from
-                                         * the start of the
-                                         * offset array */
-                                        x = size - (n_variable * sz);
+                        /* variable size */
+                        if (v > 0) {
+                                v--;
 
-                                offset = m->rindex + x;
+                                x = bus_gvariant_read_word_le((uint8_t*) q + v*sz, sz);
+                                if (x >= size)
+                                        return -EBADMSG;
+                                if (m->rindex + x < previous)
+                                        return -EBADMSG;
+                        } else
+                                /* The last item's end
+                                 * is determined from
+                                 * the start of the
+                                 * offset array */
+                                x = size - (n_variable * sz);
 
-                        } else {
-                                size_t align;
+                        offset = m->rindex + x;
 
-                                /* fixed size */
-                                align = bus_gvariant_get_alignment(t);
-                                assert(align > 0);
+                } else {
+                        /* fixed size */
+                        assert(e->alignment > 0);
 
-                                offset = (*n_offsets == 0 ? m->rindex  : ALIGN_TO((*offsets)[*n_offsets-1], align)) + k;
-                        }
+                        offset = (*n_offsets == 0 ? m->rindex  : ALIGN_TO((*offsets)[*n_offsets-1], (size_t) e->alignment)) + e->size;
                 }
 
                 previous = (*offsets)[(*n_offsets)++] = offset;
-                p += n;
+                p += e->length;
         }
 
         assert(v == 0);
@@ -3948,6 +4111,7 @@ static int enter_struct_or_dict_entry(
                 sd_bus_message *m,
                 struct bus_container *c,
                 const char *contents,
+                const BusSignatureElement *e,
                 size_t *item_size,
                 size_t **offsets,
                 size_t *n_offsets) {
@@ -3969,8 +4133,9 @@ static int enter_struct_or_dict_entry(
                         return r;
 
         } else
-                /* gvariant with contents */
-                return build_struct_offsets(m, contents, c->item_size, item_size, offsets, n_offsets);
+                /* gvariant with contents, which follow the struct or
+                 * dict entry itself in the plan */
+                return build_struct_offsets(m, contents, e ? e + 1 : NULL, c->item_size, item_size, offsets, n_offsets);
 
         return 0;
 }
@@ -3979,6 +4144,7 @@ static int bus_message_enter_struct(
                 sd_bus_message *m,
                 struct bus_container *c,
                 const char *contents,
+                const BusSignatureElement *e,
                 size_t *item_size,
                 size_t **offsets,
                 size_t *n_offsets) {
@@ -3993,7 +4159,7 @@ static int bus_message_enter_struct(
         assert(offsets);
         assert(n_offsets);
 
-        if (!signature_is_valid(contents, false))
+        if (!e && !signature_is_valid(contents, false))
                 return -EINVAL;
 
         if (!c->signature || c->signature[c->index] == 0)
@@ -4006,7 +4172,7 @@ static int bus_message_enter_struct(
             c->signature[c->index + 1 + l] != SD_BUS_TYPE_STRUCT_END)
                 return -ENXIO;
 
-        r = enter_struct_or_dict_entry(m, c, contents, item_size, offsets, n_offsets);
+        r = enter_struct_or_dict_entry(m, c, contents, e, item_size, offsets, n_offsets);
         if (r < 0)
                 return r;
 
@@ -4020,6 +4186,7 @@ static int bus_message_enter_dict_entry(
                 sd_bus_message *m,
                 struct bus_container *c,
                 const char *contents,
+                const BusSignatureElement *e,
                 size_t *item_size,
                 size_t **offsets,
                 size_t *n_offsets) {
@@ -4031,7 +4198,7 @@ static int bus_message_enter_dict_entry(
         assert(c);
         assert(contents);
 
-        if (!signature_is_pair(contents))
+        if (!e && !signature_is_pair(contents))
                 return -EINVAL;
 
         if (c->enclosing != SD_BUS_TYPE_ARRAY)
@@ -4047,7 +4214,7 @@ static int bus_message_enter_dict_entry(
             c->signature[c->index + 1 + l] != SD_BUS_TYPE_DICT_ENTRY_END)
                 return -ENXIO;
 
-        r = enter_struct_or_dict_entry(m, c, contents, item_size, offsets, n_offsets);
+        r = enter_struct_or_dict_entry(m, c, contents, e, item_size, offsets, n_offsets);
         if (r < 0)
                 return r;
 
@@ -4057,9 +4224,12 @@ static int bus_message_enter_dict_entry(
         return 1;
 }
 
-_public_ int sd_bus_message_enter_container(sd_bus_message *m,
-                                            char type,
-                                            const char *contents) {
+static int message_enter_container(
+                sd_bus_message *m,
+                char type,
+                const char *contents,
+                const BusSignatureElement *e) {
+
         struct bus_container *c, *w;
         uint32_t *array_size = NULL;
         char *signature;
@@ -4068,28 +4238,9 @@ _public_ int sd_bus_message_enter_container(sd_bus_message *m,
         size_t n_offsets = 0, item_size = 0;
         int r;
 
-        assert_return(m, -EINVAL);
-        assert_return(m->sealed, -EPERM);
-        assert_return(type != 0 || !contents, -EINVAL);
-
-        if (type == 0 || !contents) {
-                const char *cc;
-                char tt;
-
-                /* Allow entering into anonymous containers */
-                r = sd_bus_message_peek_type(m, &tt, &cc);
-                if (r < 0)
-                        return r;
-
-                if (type != 0 && type != tt)
-                        return -ENXIO;
-
-                if (contents && !streq(contents, cc))
-                        return -ENXIO;
-
-                type = tt;
-                contents = cc;
-        }
+        assert(m);
+        assert(m->sealed);
+        assert(contents);
 
         /*
          * We enforce a global limit on container depth, that is much
@@ -4129,13 +4280,13 @@ _public_ int sd_bus_message_enter_container(sd_bus_message *m,
         before = m->rindex;
 
         if (type == SD_BUS_TYPE_ARRAY)
-                r = bus_message_enter_array(m, c, contents, &array_size, &item_size, &offsets, &n_offsets);
+                r = bus_message_enter_array(m, c, contents, e, &array_size, &item_size, &offsets, &n_offsets);
         else if (type == SD_BUS_TYPE_VARIANT)
                 r = bus_message_enter_variant(m, c, contents, &item_size);
         else if (type == SD_BUS_TYPE_STRUCT)
-                r = bus_message_enter_struct(m, c, contents, &item_size, &offsets, &n_offsets);
+                r = bus_message_enter_struct(m, c, contents, e, &item_size, &offsets, &n_offsets);
         else if (type == SD_BUS_TYPE_DICT_ENTRY)
-                r = bus_message_enter_dict_entry(m, c, contents, &item_size, &offsets, &n_offsets);
+                r = bus_message_enter_dict_entry(m, c, contents, e, &item_size, &offsets, &n_offsets);
         else
                 r = -EINVAL;
 
@@ -4172,6 +4323,37 @@ _public_ int sd_bus_message_enter_container(sd_bus_message *m,
         return 1;
 }
 
+_public_ int sd_bus_message_enter_container(sd_bus_message *m,
+                                            char type,
+                                            const char *contents) {
+        int r;
+
+        assert_return(m, -EINVAL);
+        assert_return(m->sealed, -EPERM);
+        assert_return(type != 0 || !contents, -EINVAL);
+
+        if (type == 0 || !contents) {
+                const char *cc;
+                char tt;
+
+                /* Allow entering into anonymous containers */
+                r = sd_bus_message_peek_type(m, &tt, &cc);
+                if (r < 0)
+                        return r;
+
+                if (type != 0 && type != tt)
+                        return -ENXIO;
+
+                if (contents && !streq(contents, cc))
+                        return -ENXIO;
+
+                type = tt;
+                contents = cc;
+        }
+
+        return message_enter_container(m, type, contents, NULL);
+}
+
 _public_ int sd_bus_message_exit_container(sd_bus_message *m) {
         struct bus_container *c;
         unsigned saved;
@@ -4425,6 +4607,7 @@ static int message_read_ap(
         TypeStack stack[BUS_CONTAINER_DEPTH];
         unsigned stack_ptr = 0;
         unsigned n_loop = 0;
+        const BusSignaturePlan *plan;
         int r;
 
         assert(m);
@@ -4432,6 +4615,8 @@ static int message_read_ap(
         if (isempty(types))
                 return 0;
 
+        types = type_plan_get(types, &plan);
+
         /* Ideally, we'd just call ourselves recursively on every
          * complex type. However, the state of a va_list that is
          * passed to a function is undefined after that function
@@ -4443,12 +4628,13 @@ static int message_read_ap(
         n_struct = strlen(types); /* length of current struct contents signature */
 
         for (;;) {
+                const BusSignatureElement *e;
                 const char *t;
 
                 n_loop++;
 
                 if (n_array == 0 || (n_array == (unsigned) -1 && n_struct == 0)) {
-                        r = type_stack_pop(stack, ELEMENTSOF(stack), &stack_ptr, &types, &n_struct, &n_array);
+                        r = type_stack_pop(stack, ELEMENTSOF(stack), &stack_ptr, &plan, &types, &n_struct, &n_array);
                         if (r < 0)
                                 return r;
                         if (r == 0)
@@ -4503,32 +4689,39 @@ static int message_read_ap(
                 case SD_BUS_TYPE_ARRAY: {
                         size_t k;
 
-                        r = signature_element_length(t + 1, &k);
-                        if (r < 0)
-                                return r;
-
-                        {
-                                char s[k + 1];
-                                memcpy(s, t + 1, k);
-                                s[k] = 0;
+                        e = bus_signature_plan_element(plan, t);
+                        if (e) {
+                                k = e->length - 1;
 
-                                r = sd_bus_message_enter_container(m, SD_BUS_TYPE_ARRAY, s);
+                                r = message_enter_container(m, SD_BUS_TYPE_ARRAY, e->contents, e);
+                        } else {
+                                r = signature_element_length(t + 1, &k);
                                 if (r < 0)
                                         return r;
-                                if (r == 0) {
-                                        if (n_loop <= 1)
-                                                return 0;
 
-                                        return -ENXIO;
+                                {
+                                        char s[k + 1];
+                                        memcpy(s, t + 1, k);
+                                        s[k] = 0;
+
+                                        r = sd_bus_message_enter_container(m, SD_BUS_TYPE_ARRAY, s);
                                 }
                         }
+                        if (r < 0)
+                                return r;
+                        if (r == 0) {
+                                if (n_loop <= 1)
+                                        return 0;
+
+                                return -ENXIO;
+                        }
 
                         if (n_array == (unsigned) -1) {
                                 types += k;
                                 n_struct -= k;
                         }
 
-                        r = type_stack_push(stack, ELEMENTSOF(stack), &stack_ptr, types, n_struct, n_array);
+                        r = type_stack_push(stack, ELEMENTSOF(stack), &stack_ptr, plan, types, n_struct, n_array);
                         if (r < 0)
                                 return r;
 
@@ -4556,12 +4749,12 @@ static int message_read_ap(
                                 return -ENXIO;
                         }
 
-                        r = type_stack_push(stack, ELEMENTSOF(stack), &stack_ptr, types, n_struct, n_array);
+                        r = type_stack_push(stack, ELEMENTSOF(stack), &stack_ptr, plan, types, n_struct, n_array);
                         if (r < 0)
                                 return r;
 
-                        types = s;
-                        n_struct = strlen(s);
+                        types = type_plan_get(s, &plan);
+                        n_struct = strlen(types);
                         n_array = (unsigned) -1;
 
                         break;
@@ -4571,31 +4764,38 @@ static int message_read_ap(
                 case SD_BUS_TYPE_DICT_ENTRY_BEGIN: {
                         size_t k;
 
-                        r = signature_element_length(t, &k);
-                        if (r < 0)
-                                return r;
-
-                        {
-                                char s[k - 1];
-                                memcpy(s, t + 1, k - 2);
-                                s[k - 2] = 0;
+                        e = bus_signature_plan_element(plan, t);
+                        if (e) {
+                                k = e->length;
 
-                                r = sd_bus_message_enter_container(m, *t == SD_BUS_TYPE_STRUCT_BEGIN ? SD_BUS_TYPE_STRUCT : SD_BUS_TYPE_DICT_ENTRY, s);
+                                r = message_enter_container(m, *t == SD_BUS_TYPE_STRUCT_BEGIN ? SD_BUS_TYPE_STRUCT : SD_BUS_TYPE_DICT_ENTRY, e->contents, e);
+                        } else {
+                                r = signature_element_length(t, &k);
                                 if (r < 0)
                                         return r;
-                                if (r == 0) {
-                                        if (n_loop <= 1)
-                                                return 0;
-                                        return -ENXIO;
+
+                                {
+                                        char s[k - 1];
+                                        memcpy(s, t + 1, k - 2);
+                                        s[k - 2] = 0;
+
+                                        r = sd_bus_message_enter_container(m, *t == SD_BUS_TYPE_STRUCT_BEGIN ? SD_BUS_TYPE_STRUCT : SD_BUS_TYPE_DICT_ENTRY, s);
                                 }
                         }
+                        if (r < 0)
+                                return r;
+                        if (r == 0) {
+                                if (n_loop <= 1)
+                                        return 0;
+                                return -ENXIO;
+                        }
 
                         if (n_array == (unsigned) -1) {
                                 types += k - 1;
                                 n_struct -= k - 1;
                         }
 
-                        r = type_stack_push(stack, ELEMENTSOF(stack), &stack_ptr, types, n_struct, n_array);
+                        r = type_stack_push(stack, ELEMENTSOF(stack), &stack_ptr, plan, types, n_struct, n_array);
                         if (r < 0)
                                 return r;
 
@@ -5517,6 +5717,7 @@ int bus_message_parse_fields(sd_bus_message *m) {
                 r = build_struct_offsets(
                                 m,
                                 m->root_container.signature,
+                                NULL,
                                 m->user_body_size,
                                 &m->root_container.item_size,
                                 &m->root_container.offsets,
@@ -26,6 +26,7 @@
 #include <sys/socket.h>
 
 #include "macro.h"
+#include "refcnt.h"
 #include "sd-bus.h"
 #include "time-util.h"
 #include "bus-creds.h"
@@ -67,7 +68,7 @@ struct bus_body_part {
 };
 
 struct sd_bus_message {
-        unsigned n_ref;
+        RefCount n_ref;
 
         sd_bus *bus;
 
@@ -97,6 +98,8 @@ struct sd_bus_message {
         bool free_fds:1;
         bool release_kdbus:1;
         bool poisoned:1;
+        bool from_pool:1;
+        bool bus_unpinned:1;
 
         /* The first and last bytes of the message */
         struct bus_header *header;
@@ -148,6 +151,14 @@ struct sd_bus_message {
         unsigned n_header_offsets;
 };
 
+/* Messages allocated from the bus' pool have room for the header
+ * with its fields and a small body right behind them, so that typical
+ * messages need no further allocations */
+#define BUS_MESSAGE_INLINE_HEADER_SIZE 256
+#define BUS_MESSAGE_INLINE_BODY_SIZE 256
+#define BUS_MESSAGE_POOL_TILE_SIZE                                      \
+        (ALIGN(sizeof(sd_bus_message)) + BUS_MESSAGE_INLINE_HEADER_SIZE + BUS_MESSAGE_INLINE_BODY_SIZE)
+
 static inline bool BUS_MESSAGE_NEED_BSWAP(sd_bus_message *m) {
         return m->header->endian != BUS_NATIVE_ENDIAN;
 }
@@ -193,6 +204,7 @@ static inline bool BUS_MESSAGE_IS_GVARIANT(sd_bus_message *m) {
 }
 
 int bus_message_seal(sd_bus_message *m, uint64_t serial, usec_t timeout);
+void bus_message_unpin_bus(sd_bus_message *m);
 int bus_message_get_blob(sd_bus_message *m, void **buffer, size_t *sz);
 int bus_message_read_strv_extend(sd_bus_message *m, char ***l);
 
@@ -223,6 +235,17 @@ int bus_message_get_arg_strv(sd_bus_message *m, unsigned i, char ***strv);
 
 int bus_message_append_ap(sd_bus_message *m, const char *types, va_list ap);
 
+int bus_message_from_malloc_and_memfd(
+                sd_bus *bus,
+                void *buffer,
+                size_t length,
+                int memfd,
+                size_t memfd_size,
+                int *fds,
+                unsigned n_fds,
+                const char *label,
+                sd_bus_message **ret);
+
 int bus_message_parse_fields(sd_bus_message *m);
 
 struct bus_body_part *message_append_part(sd_bus_message *m);
@@ -740,28 +740,17 @@ static int vtable_append_all_properties(
                 void *userdata,
                 sd_bus_error *error) {
 
-        const sd_bus_vtable *v;
+        const sd_bus_vtable **v;
         int r;
 
         assert(bus);
         assert(reply);
         assert(path);
         assert(c);
+        assert(c->properties);
 
-        if (c->vtable[0].flags & SD_BUS_VTABLE_HIDDEN)
-                return 1;
-
-        for (v = c->vtable+1; v->type != _SD_BUS_VTABLE_END; v++) {
-                if (v->type != _SD_BUS_VTABLE_PROPERTY && v->type != _SD_BUS_VTABLE_WRITABLE_PROPERTY)
-                        continue;
-
-                if (v->flags & SD_BUS_VTABLE_HIDDEN)
-                        continue;
-
-                if (v->flags & SD_BUS_VTABLE_PROPERTY_EXPLICIT)
-                        continue;
-
-                r = vtable_append_one_property(bus, reply, path, c, v, userdata, error);
+        for (v = c->properties; *v; v++) {
+                r = vtable_append_one_property(bus, reply, path, c, *v, userdata, error);
                 if (r < 0)
                         return r;
                 if (bus->nodes_modified)
@@ -894,6 +883,42 @@ static int bus_node_exists(
         return 0;
 }
 
+static int node_vtable_get_introspection(struct node_vtable *c, const char **ret) {
+        _cleanup_free_ char *s = NULL;
+        struct introspect intro = {};
+        size_t size = 0;
+        int r;
+
+        assert(c);
+        assert(ret);
+
+        /* The vtable is immutable, hence so is its introspection
+         * data. Generate it once, and reuse it for every call. */
+
+        if (!c->introspection) {
+                intro.f = open_memstream(&s, &size);
+                if (!intro.f)
+                        return -ENOMEM;
+
+                r = introspect_write_interface(&intro, c->vtable);
+                if (r >= 0) {
+                        fflush(intro.f);
+                        if (ferror(intro.f))
+                                r = -ENOMEM;
+                }
+
+                fclose(intro.f);
+                if (r < 0)
+                        return r;
+
+                c->introspection = s;
+                s = NULL;
+        }
+
+        *ret = c->introspection;
+        return 0;
+}
+
 static int process_introspect(
                 sd_bus *bus,
                 sd_bus_message *m,
@@ -932,6 +957,8 @@ static int process_introspect(
         empty = set_isempty(s);
 
         LIST_FOREACH(vtables, c, n->vtables) {
+                const char *x;
+
                 if (require_fallback && !c->is_fallback)
                         continue;
 
@@ -960,10 +987,12 @@ static int process_introspect(
                         fprintf(intro.f, " <interface name=\"%s\">\n", c->interface);
                 }
 
-                r = introspect_write_interface(&intro, c->vtable);
+                r = node_vtable_get_introspection(c, &x);
                 if (r < 0)
                         goto finish;
 
+                fputs(x, intro.f);
+
                 previous_interface = c->interface;
         }
 
@@ -1003,6 +1032,214 @@ finish:
         return r;
 }
 
+struct cached_properties {
+        struct node_vtable *vtable;
+        void *userdata;
+        sd_bus_message *message;
+
+        LIST_FIELDS(struct cached_properties, properties);
+};
+
+struct cached_object {
+        char *path;
+        LIST_HEAD(struct cached_properties, properties);
+};
+
+static void cached_object_free(struct cached_object *o) {
+        struct cached_properties *p;
+
+        if (!o)
+                return;
+
+        while ((p = o->properties)) {
+                LIST_REMOVE(properties, o->properties, p);
+                sd_bus_message_unref(p->message);
+                free(p);
+        }
+
+        free(o->path);
+        free(o);
+}
+
+void bus_object_cache_invalidate(sd_bus *bus, const char *path) {
+        assert(bus);
+        assert(path);
+
+        cached_object_free(hashmap_remove(bus->object_cache, path));
+}
+
+void bus_object_cache_flush(sd_bus *bus) {
+        struct cached_object *o;
+
+        assert(bus);
+
+        while ((o = hashmap_steal_first(bus->object_cache)))
+                cached_object_free(o);
+}
+
+static int object_cache_add(
+                sd_bus *bus,
+                const char *path,
+                struct node_vtable *c,
+                void *userdata,
+                sd_bus_message *message) {
+
+        struct cached_object *o;
+        struct cached_properties *p;
+        int r;
+
+        assert(bus);
+        assert(path);
+        assert(c);
+        assert(message);
+
+        o = hashmap_get(bus->object_cache, path);
+        if (!o) {
+                r = hashmap_ensure_allocated(&bus->object_cache, &string_hash_ops);
+                if (r < 0)
+                        return r;
+
+                o = new0(struct cached_object, 1);
+                if (!o)
+                        return -ENOMEM;
+
+                o->path = strdup(path);
+                if (!o->path) {
+                        free(o);
+                        return -ENOMEM;
+                }
+
+                r = hashmap_put(bus->object_cache, o->path, o);
+                if (r < 0) {
+                        cached_object_free(o);
+                        return r;
+                }
+        }
+
+        LIST_FOREACH(properties, p, o->properties)
+                if (p->vtable == c)
+                        break;
+
+        if (p)
+                /* Replace what we cached for a previous object */
+                sd_bus_message_unref(p->message);
+        else {
+                p = new0(struct cached_properties, 1);
+                if (!p)
+                        return -ENOMEM;
+
+                p->vtable = c;
+                LIST_PREPEND(properties, o->properties, p);
+        }
+
+        p->userdata = userdata;
+        p->message = sd_bus_message_ref(message);
+
+        /* Don't let the cache keep the bus alive, it is flushed
+         * before the bus is freed */
+        bus_message_unpin_bus(message);
+
+        return 0;
+}
+
+static sd_bus_message *object_cache_get(sd_bus *bus, const char *path, struct node_vtable *c, void *userdata) {
+        struct cached_object *o;
+        struct cached_properties *p;
+
+        assert(bus);
+        assert(path);
+        assert(c);
+
+        o = hashmap_get(bus->object_cache, path);
+        if (!o)
+                return NULL;
+
+        /* If the object was replaced by a different one, the old
+         * entry is useless */
+        LIST_FOREACH(properties, p, o->properties)
+                if (p->vtable == c)
+                        return p->userdata == userdata ? p->message : NULL;
+
+        return NULL;
+}
+
+static int object_manager_append_properties(
+                sd_bus *bus,
+                sd_bus_message *reply,
+                const char *path,
+                struct node_vtable *c,
+                void *userdata,
+                sd_bus_error *error) {
+
+        _cleanup_bus_message_unref_ sd_bus_message *t = NULL;
+        sd_bus_message *cached;
+        int r;
+
+        assert(bus);
+        assert(reply);
+        assert(path);
+        assert(c);
+
+        /* Properties whose changes are signalled can be serialized
+         * once, and then be copied from the cache until the next
+         * PropertiesChanged, InterfacesAdded or InterfacesRemoved
+         * signal for the object. */
+
+        if (!c->properties_cacheable)
+                return vtable_append_all_properties(bus, reply, path, c, userdata, error);
+
+        cached = object_cache_get(bus, path, c, userdata);
+        if (!cached) {
+                /* The message is only used as a container, it is
+                 * never sent */
+                r = sd_bus_message_new_signal(bus, &t, path, c->interface, "PropertiesChanged");
+                if (r < 0)
+                        return r;
+
+                r = sd_bus_message_open_container(t, 'a', "{sv}");
+                if (r < 0)
+                        return r;
+
+                r = vtable_append_all_properties(bus, t, path, c, userdata, error);
+                if (r < 0)
+                        return r;
+                if (bus->nodes_modified)
+                        return 0;
+
+                r = sd_bus_message_close_container(t);
+                if (r < 0)
+                        return r;
+
+                r = bus_seal_synthetic_message(bus, t);
+                if (r < 0)
+                        return r;
+
+                r = object_cache_add(bus, path, c, userdata, t);
+                if (r < 0)
+                        return r;
+
+                cached = t;
+        }
+
+        r = sd_bus_message_rewind(cached, true);
+        if (r < 0)
+                return r;
+
+        r = sd_bus_message_enter_container(cached, 'a', "{sv}");
+        if (r < 0)
+                return r;
+
+        r = sd_bus_message_copy(reply, cached, true);
+        if (r < 0)
+                return r;
+
+        r = sd_bus_message_exit_container(cached);
+        if (r < 0)
+                return r;
+
+        return 1;
+}
+
 static int object_manager_serialize_path(
                 sd_bus *bus,
                 sd_bus_message *reply,
@@ -1089,7 +1326,7 @@ static int object_manager_serialize_path(
                                 return r;
                 }
 
-                r = vtable_append_all_properties(bus, reply, path, i, u, error);
+                r = object_manager_append_properties(bus, reply, path, i, u, error);
                 if (r < 0)
                         return r;
                 if (bus->nodes_modified)
@@ -1635,6 +1872,7 @@ static int add_object_vtable_internal(
         sd_bus_slot *s = NULL;
         struct node_vtable *i, *existing = NULL;
         const sd_bus_vtable *v;
+        unsigned n_properties = 0;
         struct node *n;
         int r;
 
@@ -1688,6 +1926,7 @@ static int add_object_vtable_internal(
         s->node_vtable.is_fallback = fallback;
         s->node_vtable.vtable = vtable;
         s->node_vtable.find = find;
+        s->node_vtable.properties_cacheable = true;
 
         s->node_vtable.interface = strdup(interface);
         if (!s->node_vtable.interface) {
@@ -1778,6 +2017,13 @@ static int add_object_vtable_internal(
                                 goto fail;
                         }
 
+                        if (!(v->flags & (SD_BUS_VTABLE_HIDDEN|SD_BUS_VTABLE_PROPERTY_EXPLICIT))) {
+                                n_properties++;
+
+                                if (!(v->flags & (SD_BUS_VTABLE_PROPERTY_CONST|SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE|SD_BUS_VTABLE_PROPERTY_EMITS_INVALIDATION)))
+                                        s->node_vtable.properties_cacheable = false;
+                        }
+
                         break;
                 }
 
@@ -1798,6 +2044,25 @@ static int add_object_vtable_internal(
                 }
         }
 
+        /* Remember the properties GetAll() returns, so that we
+         * don't have to look through the whole vtable each time */
+        if (vtable[0].flags & SD_BUS_VTABLE_HIDDEN)
+                n_properties = 0;
+
+        s->node_vtable.properties = new(const sd_bus_vtable*, n_properties + 1);
+        if (!s->node_vtable.properties) {
+                r = -ENOMEM;
+                goto fail;
+        }
+
+        n_properties = 0;
+        if (!(vtable[0].flags & SD_BUS_VTABLE_HIDDEN))
+                for (v = vtable+1; v->type != _SD_BUS_VTABLE_END; v++)
+                        if (IN_SET(v->type, _SD_BUS_VTABLE_PROPERTY, _SD_BUS_VTABLE_WRITABLE_PROPERTY) &&
+                            !(v->flags & (SD_BUS_VTABLE_HIDDEN|SD_BUS_VTABLE_PROPERTY_EXPLICIT)))
+                                s->node_vtable.properties[n_properties++] = v;
+        s->node_vtable.properties[n_properties] = NULL;
+
         s->node_vtable.node = n;
         LIST_INSERT_AFTER(vtables, n->vtables, existing, &s->node_vtable);
         bus->nodes_modified = true;
@@ -2114,6 +2379,8 @@ _public_ int sd_bus_emit_properties_changed_strv(
         if (names && names[0] == NULL)
                 return 0;
 
+        bus_object_cache_invalidate(bus, path);
+
         do {
                 bus->nodes_modified = false;
 
@@ -2336,6 +2603,8 @@ _public_ int sd_bus_emit_object_added(sd_bus *bus, const char *path) {
         if (!BUS_IS_OPEN(bus->state))
                 return -ENOTCONN;
 
+        bus_object_cache_invalidate(bus, path);
+
         r = bus_find_parent_object_manager(bus, &object_manager, path);
         if (r < 0)
                 return r;
@@ -2506,6 +2775,8 @@ _public_ int sd_bus_emit_object_removed(sd_bus *bus, const char *path) {
         if (!BUS_IS_OPEN(bus->state))
                 return -ENOTCONN;
 
+        bus_object_cache_invalidate(bus, path);
+
         r = bus_find_parent_object_manager(bus, &object_manager, path);
         if (r < 0)
                 return r;
@@ -2659,6 +2930,8 @@ _public_ int sd_bus_emit_interfaces_added_strv(sd_bus *bus, const char *path, ch
         if (!BUS_IS_OPEN(bus->state))
                 return -ENOTCONN;
 
+        bus_object_cache_invalidate(bus, path);
+
         if (strv_isempty(interfaces))
                 return 0;
 
@@ -2742,6 +3015,8 @@ _public_ int sd_bus_emit_interfaces_removed_strv(sd_bus *bus, const char *path,
         if (!BUS_IS_OPEN(bus->state))
                 return -ENOTCONN;
 
+        bus_object_cache_invalidate(bus, path);
+
         if (strv_isempty(interfaces))
                 return 0;
 
@@ -25,3 +25,6 @@
 
 int bus_process_object(sd_bus *bus, sd_bus_message *m);
 void bus_node_gc(sd_bus *b, struct node *n);
+
+void bus_object_cache_invalidate(sd_bus *bus, const char *path);
+void bus_object_cache_flush(sd_bus *bus);
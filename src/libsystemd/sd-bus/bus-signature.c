@@ -19,11 +19,25 @@
   along with systemd; If not, see <http://www.gnu.org/licenses/>.
 ***/
 
+#include <pthread.h>
+
 #include <util.h>
 
+#include "bus-gvariant.h"
 #include "bus-signature.h"
 #include "bus-type.h"
 
+/* Signature plans are never freed, so the cache is bounded. Programs
+ * usually only use a handful of different format strings. This is
+ * shared between all threads, hence no Hashmap, as those may only be
+ * used from the main thread or privately by other threads. */
+#define PLAN_CACHE_SIZE 512U
+#define PLAN_CACHE_MAX (PLAN_CACHE_SIZE / 2)
+
+static pthread_mutex_t plan_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static BusSignaturePlan *plan_cache[PLAN_CACHE_SIZE] = {};
+static unsigned plan_cache_n = 0;
+
 static int signature_element_length_internal(
                 const char *s,
                 bool allow_dict_entry,
@@ -158,3 +172,144 @@ bool signature_is_valid(const char *s, bool allow_dict_entry) {
 
         return p - s <= 255;
 }
+
+/* Fills in the length and GVariant layout of the complete type at s,
+ * but not the contents */
+int signature_element_layout(const char *s, BusSignatureElement *e) {
+        size_t l;
+        char *t;
+        int r;
+
+        assert(e);
+
+        r = signature_element_length(s, &l);
+        if (r < 0)
+                return r;
+
+        t = strndupa(s, l);
+
+        r = bus_gvariant_get_alignment(t);
+        if (r < 0)
+                return r;
+
+        *e = (BusSignatureElement) {
+                .length = l,
+                .alignment = r,
+                .size = bus_gvariant_get_size(t),
+        };
+
+        return 0;
+}
+
+static void plan_free(BusSignaturePlan *plan) {
+        size_t i, n;
+
+        if (!plan)
+                return;
+
+        n = strlen(plan->signature);
+        for (i = 0; i < n; i++)
+                free((char*) plan->elements[i].contents);
+
+        free(plan->signature);
+        free(plan);
+}
+
+static BusSignaturePlan *plan_compile(const char *signature) {
+        BusSignaturePlan *plan;
+        size_t i, n;
+
+        assert(signature);
+
+        if (!signature_is_valid(signature, true))
+                return NULL;
+
+        n = strlen(signature);
+
+        plan = malloc0(offsetof(BusSignaturePlan, elements) + n * sizeof(BusSignatureElement));
+        if (!plan)
+                return NULL;
+
+        plan->signature = strdup(signature);
+        if (!plan->signature)
+                goto fail;
+
+        /* In a valid signature every character except the closing
+         * brackets begins a complete type */
+        for (i = 0; i < n; i++) {
+                BusSignatureElement *e = plan->elements + i;
+                const char *p = signature + i;
+
+                if (IN_SET(*p, SD_BUS_TYPE_STRUCT_END, SD_BUS_TYPE_DICT_ENTRY_END))
+                        continue;
+
+                if (signature_element_layout(p, e) < 0)
+                        goto fail;
+
+                if (*p == SD_BUS_TYPE_ARRAY)
+                        e->contents = strndup(p + 1, e->length - 1);
+                else if (IN_SET(*p, SD_BUS_TYPE_STRUCT_BEGIN, SD_BUS_TYPE_DICT_ENTRY_BEGIN))
+                        e->contents = strndup(p + 1, e->length - 2);
+                else
+                        continue;
+
+                if (!e->contents)
+                        goto fail;
+
+                e->contents_alignment = bus_gvariant_get_alignment(e->contents);
+                if (e->contents_alignment < 0)
+                        goto fail;
+                e->contents_size = bus_gvariant_get_size(e->contents);
+                e->contents_fixed = bus_gvariant_is_fixed_size(e->contents) > 0;
+        }
+
+        return plan;
+
+fail:
+        plan_free(plan);
+        return NULL;
+}
+
+/*
+ * Returns the plan for a signature: the length, contents and GVariant
+ * layout of each complete type in it, so that the variadic message
+ * functions need not parse the same signatures over and over again.
+ * Returns NULL if the signature is not valid, or if the cache is
+ * full, in which case the caller has to do it the slow way.
+ */
+const BusSignaturePlan *bus_signature_plan_get(const char *signature) {
+        BusSignaturePlan *plan = NULL;
+        unsigned h = 2166136261U;
+        const char *p;
+
+        assert(signature);
+
+        /* FNV-1a, signatures are short */
+        for (p = signature; *p; p++)
+                h = (h ^ (uint8_t) *p) * 16777619U;
+
+        assert_se(pthread_mutex_lock(&plan_cache_mutex) == 0);
+
+        /* Linear probing, never more than half full, nothing is ever
+         * removed */
+        for (h %= PLAN_CACHE_SIZE; plan_cache[h]; h = (h + 1) % PLAN_CACHE_SIZE)
+                if (streq(plan_cache[h]->signature, signature)) {
+                        plan = plan_cache[h];
+                        goto finish;
+                }
+
+        if (plan_cache_n >= PLAN_CACHE_MAX)
+                goto finish;
+
+        plan = plan_compile(signature);
+        if (!plan)
+                goto finish;
+
+        plan_cache[h] = plan;
+        plan_cache_n++;
+
+finish:
+        assert_se(pthread_mutex_unlock(&plan_cache_mutex) == 0);
+
+        return plan;
+}
@@ -28,3 +28,34 @@ bool signature_is_pair(const char *s);
 bool signature_is_valid(const char *s, bool allow_dict_entry);
 
 int signature_element_length(const char *s, size_t *l);
+
+typedef struct BusSignatureElement {
+        /* Length of the complete type starting here, and its GVariant
+         * alignment and size (negative if it is not of fixed size) */
+        unsigned length;
+        int alignment;
+        int size;
+
+        /* Arrays, structs and dict entries only: the signature of
+         * their contents, NUL-terminated, and its GVariant layout */
+        const char *contents;
+        int contents_alignment;
+        int contents_size;
+        bool contents_fixed;
+} BusSignatureElement;
+
+typedef struct BusSignaturePlan {
+        char *signature;
+
+        /* Indexed by position in the signature, only valid where a
+         * complete type begins */
+        BusSignatureElement elements[];
+} BusSignaturePlan;
+
+int signature_element_layout(const char *s, BusSignatureElement *e);
+
+const BusSignaturePlan *bus_signature_plan_get(const char *signature);
+
+static inline const BusSignatureElement *bus_signature_plan_element(const BusSignaturePlan *plan, const char *p) {
+        return plan ? plan->elements + (p - plan->signature) : NULL;
+}
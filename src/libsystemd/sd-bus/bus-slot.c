@@ -170,7 +170,12 @@ void bus_slot_disconnect(sd_bus_slot *slot) {
                         }
                 }
 
+                /* The cache might reference this vtable */
+                bus_object_cache_flush(slot->bus);
+
                 free(slot->node_vtable.interface);
+                free(slot->node_vtable.properties);
+                free(slot->node_vtable.introspection);
 
                 if (slot->node_vtable.node) {
                         LIST_REMOVE(vtables, slot->node_vtable.node->vtables, &slot->node_vtable);
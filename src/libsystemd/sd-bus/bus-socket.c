@@ -31,6 +31,7 @@
 #include "utf8.h"
 #include "formats-util.h"
 #include "signal-util.h"
+#include "memfd-util.h"
 
 #include "sd-bus.h"
 #include "bus-socket.h"
@@ -39,6 +40,14 @@
 
 #define SNDBUF_SIZE (8*1024*1024)
 
+/* We read up to this much at once, so that a burst of small messages
+ * only costs us a single recvmsg() */
+#define RBUFFER_SIZE (64*1024)
+
+/* We coalesce up to this many iovecs of queued messages into a single
+ * sendmsg() */
+#define WRITE_IOVEC_MAX 64
+
 static void iovec_advance(struct iovec iov[], unsigned *idx, size_t size) {
 
         while (size > 0) {
@@ -168,15 +177,15 @@ static int bus_socket_write_auth(sd_bus *b) {
 }
 
 static int bus_socket_auth_verify_client(sd_bus *b) {
-        char *e, *f, *start;
+        char *e, *f, *g, *start;
         sd_id128_t peer;
         unsigned i;
         int r;
 
         assert(b);
 
-        /* We expect two response lines: "OK" and possibly
-         * "AGREE_UNIX_FD" */
+        /* We expect three response lines: "OK" and possibly
+         * "AGREE_UNIX_FD" and "EXTENSION_AGREE_MEMFD" */
 
         e = memmem_safe(b->rbuffer, b->rbuffer_size, "\r\n", 2);
         if (!e)
@@ -187,9 +196,13 @@ static int bus_socket_auth_verify_client(sd_bus *b) {
                 if (!f)
                         return 0;
 
-                start = f + 2;
+                g = memmem(f + 2, b->rbuffer_size - (f - (char*) b->rbuffer) - 2, "\r\n", 2);
+                if (!g)
+                        return 0;
+
+                start = g + 2;
         } else {
-                f = NULL;
+                f = g = NULL;
                 start = e + 2;
         }
 
@@ -222,13 +235,19 @@ static int bus_socket_auth_verify_client(sd_bus *b) {
 
         b->server_id = peer;
 
-        /* And possibly check the second line, too */
+        /* And possibly check the second and third line, too */
 
         if (f)
                 b->can_fds =
                         (f - e == strlen("\r\nAGREE_UNIX_FD")) &&
                         memcmp(e + 2, "AGREE_UNIX_FD", strlen("AGREE_UNIX_FD")) == 0;
 
+        if (g)
+                b->can_memfd =
+                        b->can_fds &&
+                        (g - f == strlen("\r\nEXTENSION_AGREE_MEMFD")) &&
+                        memcmp(f + 2, "EXTENSION_AGREE_MEMFD", strlen("EXTENSION_AGREE_MEMFD")) == 0;
+
         b->rbuffer_size -= (start - (char*) b->rbuffer);
         memmove(b->rbuffer, start, b->rbuffer_size);
 
@@ -474,6 +493,13 @@ static int bus_socket_auth_verify_server(sd_bus *b) {
                                 b->can_fds = true;
                                 r = bus_socket_auth_write(b, "AGREE_UNIX_FD\r\n");
                         }
+                } else if (line_equals(line, l, "EXTENSION_NEGOTIATE_MEMFD")) {
+                        if (b->auth == _BUS_AUTH_INVALID || !b->can_fds || b->refuse_memfd)
+                                r = bus_socket_auth_write(b, "ERROR\r\n");
+                        else {
+                                b->can_memfd = true;
+                                r = bus_socket_auth_write(b, "EXTENSION_AGREE_MEMFD\r\n");
+                        }
                 } else
                         r = bus_socket_auth_write(b, "ERROR\r\n");
 
@@ -633,8 +659,10 @@ static int bus_socket_start_auth_client(sd_bus *b) {
         if (!b->auth_buffer)
                 return -ENOMEM;
 
+        /* Peers that don't know about passing bodies as memfd will
+         * answer the extension with ERROR, which is fine */
         if (b->hello_flags & KDBUS_HELLO_ACCEPT_FD)
-                auth_suffix = "\r\nNEGOTIATE_UNIX_FD\r\nBEGIN\r\n";
+                auth_suffix = "\r\nNEGOTIATE_UNIX_FD\r\nEXTENSION_NEGOTIATE_MEMFD\r\nBEGIN\r\n";
         else
                 auth_suffix = "\r\nBEGIN\r\n";
 
@@ -817,16 +845,197 @@ int bus_socket_write_message(sd_bus *bus, sd_bus_message *m, size_t *idx) {
         return 1;
 }
 
-static int bus_socket_read_message_need(sd_bus *bus, size_t *need) {
+int bus_socket_write_messages(sd_bus *bus, sd_bus_message **messages, unsigned n_messages, size_t *idx) {
+        struct iovec iov[WRITE_IOVEC_MAX];
+        unsigned n_iov = 0, i, j;
+        ssize_t k;
+        int r;
+
+        assert(bus);
+        assert(messages);
+        assert(n_messages > 0);
+        assert(idx);
+        assert(bus->state == BUS_RUNNING || bus->state == BUS_HELLO);
+
+        /* Writes as many of the queued messages as possible with a
+         * single syscall. *idx is the offset into the concatenation
+         * of all messages. Messages carrying fds are always written
+         * on their own, so that the fds are attached to their first
+         * bytes, and never merged with anything before. */
+
+        for (i = 0; i < n_messages; i++) {
+                sd_bus_message *m = messages[i];
+
+                if (m->n_fds > 0)
+                        break;
+
+                r = bus_message_setup_iovec(m);
+                if (r < 0) {
+                        if (i == 0)
+                                return r;
+                        break;
+                }
+
+                if (n_iov + m->n_iovec > ELEMENTSOF(iov))
+                        break;
+
+                memcpy(iov + n_iov, m->iovec, m->n_iovec * sizeof(struct iovec));
+                n_iov += m->n_iovec;
+        }
+
+        if (i <= 1)
+                return bus_socket_write_message(bus, messages[0], idx);
+
+        j = 0;
+        iovec_advance(iov, &j, *idx);
+
+        if (bus->prefer_writev)
+                k = writev(bus->output_fd, iov + j, n_iov - j);
+        else {
+                struct msghdr mh = {
+                        .msg_iov = iov + j,
+                        .msg_iovlen = n_iov - j,
+                };
+
+                k = sendmsg(bus->output_fd, &mh, MSG_DONTWAIT|MSG_NOSIGNAL);
+                if (k < 0 && errno == ENOTSOCK) {
+                        bus->prefer_writev = true;
+                        k = writev(bus->output_fd, iov + j, n_iov - j);
+                }
+        }
+
+        if (k < 0)
+                return errno == EAGAIN ? 0 : -errno;
+
+        *idx += (size_t) k;
+        return 1;
+}
+
+static bool message_body_is_memfd(sd_bus_message *m) {
+        uint64_t sz;
+
+        assert(m);
+
+        if (m->n_body_parts != 1)
+                return false;
+        if (m->body.memfd < 0 || m->body.memfd_offset != 0)
+                return false;
+        if (memfd_get_sealed(m->body.memfd) <= 0)
+                return false;
+        if (memfd_get_size(m->body.memfd, &sz) < 0)
+                return false;
+
+        return sz == m->body_size;
+}
+
+int bus_socket_pack_memfd(sd_bus *bus, sd_bus_message **m) {
+        _cleanup_close_ int memfd = -1;
+        _cleanup_free_ struct bus_header *h = NULL;
+        _cleanup_free_ int *fds = NULL;
+        struct bus_body_part *part;
+        sd_bus_message *n;
+        unsigned i;
+        size_t sz;
+        int r;
+
+        assert(bus);
+        assert(m);
+        assert(*m);
+        assert((*m)->sealed);
+
+        /* If the peer agreed to it, replaces a message with a large
+         * body by one that carries the body in a sealed memfd, so
+         * that it isn't copied through the socket buffers. */
+
+        if (!bus->can_memfd)
+                return 0;
+        if (BUS_MESSAGE_IS_GVARIANT(*m))
+                return 0;
+        if ((*m)->body_size < MEMFD_MIN_SIZE)
+                return 0;
+        if ((*m)->n_fds >= BUS_FDS_MAX)
+                return 0;
+
+        if (message_body_is_memfd(*m)) {
+                /* The body already is a single sealed memfd, for
+                 * example because we received it that way. Just
+                 * pass it on. */
+                memfd = fcntl((*m)->body.memfd, F_DUPFD_CLOEXEC, 3);
+                if (memfd < 0)
+                        return -errno;
+        } else {
+                memfd = memfd_new(bus->description);
+                if (memfd == -ENOSYS)
+                        return 0;
+                if (memfd < 0)
+                        return memfd;
+
+                MESSAGE_FOREACH_PART(part, i, *m) {
+                        r = bus_body_part_map(part);
+                        if (r < 0)
+                                return r;
+
+                        r = loop_write(memfd, part->data, part->size, false);
+                        if (r < 0)
+                                return r;
+                }
+
+                r = memfd_set_sealed(memfd);
+                if (r < 0)
+                        return r;
+        }
+
+        sz = BUS_MESSAGE_BODY_BEGIN(*m);
+        h = memdup((*m)->header, sz);
+        if (!h)
+                return -ENOMEM;
+
+        h->flags |= BUS_MESSAGE_MEMFD_BODY;
+        h->dbus1.body_size = 0;
+
+        fds = new(int, (*m)->n_fds + 1);
+        if (!fds)
+                return -ENOMEM;
+
+        for (i = 0; i < (*m)->n_fds; i++) {
+                fds[i] = fcntl((*m)->fds[i], F_DUPFD_CLOEXEC, 3);
+                if (fds[i] < 0) {
+                        r = -errno;
+                        close_many(fds, i);
+                        return r;
+                }
+        }
+
+        fds[i] = memfd;
+
+        r = bus_message_from_header(bus, h, sz, h, sz, sz, fds, (*m)->n_fds + 1, NULL, 0, &n);
+        if (r < 0) {
+                close_many(fds, (*m)->n_fds);
+                return r;
+        }
+
+        n->free_header = true;
+        n->free_fds = true;
+        n->timeout = (*m)->timeout;
+        h = NULL;
+        fds = NULL;
+        memfd = -1;
+
+        sd_bus_message_unref(*m);
+        *m = n;
+
+        return 1;
+}
+
+static int message_need(const void *p, size_t size, size_t *need) {
         uint32_t a, b;
         uint8_t e;
         uint64_t sum;
 
-        assert(bus);
+        assert(p || size == 0);
         assert(need);
-        assert(bus->state == BUS_RUNNING || bus->state == BUS_HELLO);
 
-        if (bus->rbuffer_size < sizeof(struct bus_header)) {
+        if (size < sizeof(struct bus_header)) {
                 *need = sizeof(struct bus_header) + 8;
 
                 /* Minimum message size:
@@ -848,10 +1057,11 @@ static int bus_socket_read_message_need(sd_bus *bus, size_t *need) {
                 return 0;
         }
 
-        a = ((const uint32_t*) bus->rbuffer)[1];
-        b = ((const uint32_t*) bus->rbuffer)[3];
+        /* Messages in the read buffer are not necessarily aligned */
+        memcpy(&a, (const uint8_t*) p + 4, sizeof(a));
+        memcpy(&b, (const uint8_t*) p + 12, sizeof(b));
 
-        e = ((const uint8_t*) bus->rbuffer)[0];
+        e = ((const uint8_t*) p)[0];
         if (e == BUS_LITTLE_ENDIAN) {
                 a = le32toh(a);
                 b = le32toh(b);
@@ -869,48 +1079,299 @@ static int bus_socket_read_message_need(sd_bus *bus, size_t *need) {
         return 0;
 }
 
-static int bus_socket_make_message(sd_bus *bus, size_t size) {
+static int bus_socket_read_message_need(sd_bus *bus, size_t *need) {
+        assert(bus);
+        assert(bus->state == BUS_RUNNING || bus->state == BUS_HELLO);
+
+        return message_need(bus->rbuffer, bus->rbuffer_size, need);
+}
+
+static uint32_t read_uint32(const uint8_t *p, bool big_endian) {
+        uint32_t u;
+
+        memcpy(&u, p, sizeof(u));
+        return big_endian ? be32toh(u) : le32toh(u);
+}
+
+static int message_peek_unix_fds(const uint8_t *p, size_t size, unsigned *ret) {
+        bool big_endian = p[0] == BUS_BIG_ENDIAN;
+        size_t i, end;
+        uint32_t fields_size;
+        unsigned n = 0;
+
+        assert(p);
+        assert(size >= sizeof(struct bus_header));
+        assert(ret);
+
+        /* Finds the UNIX_FDS header field of a dbus1 message that
+         * hasn't been parsed yet, so that we know how many of the
+         * received fds belong to it. Returns -EOPNOTSUPP for fields
+         * of types we cannot skip without a full parser. */
+
+        fields_size = read_uint32(p + offsetof(struct bus_header, dbus1.fields_size), big_endian);
+        if (fields_size > size - sizeof(struct bus_header))
+                return -EBADMSG;
+
+        i = sizeof(struct bus_header);
+        end = i + fields_size;
+
+        while (i < end) {
+                uint8_t code, l;
+                char type;
+                uint32_t u;
+
+                i = ALIGN8(i);
+                if (i + 4 > end)
+                        return -EBADMSG;
+
+                code = p[i++];
+
+                /* Only single-character signatures, i.e. basic types */
+                if (p[i] != 1 || p[i + 2] != 0)
+                        return -EOPNOTSUPP;
+                type = p[i + 1];
+                i += 3;
+
+                switch (type) {
+
+                case SD_BUS_TYPE_BYTE:
+                        i += 1;
+                        break;
+
+                case SD_BUS_TYPE_INT16:
+                case SD_BUS_TYPE_UINT16:
+                        i = ALIGN_TO(i, 2) + 2;
+                        break;
+
+                case SD_BUS_TYPE_BOOLEAN:
+                case SD_BUS_TYPE_INT32:
+                case SD_BUS_TYPE_UINT32:
+                case SD_BUS_TYPE_UNIX_FD:
+                        i = ALIGN4(i);
+                        if (i + 4 > end)
+                                return -EBADMSG;
+
+                        u = read_uint32(p + i, big_endian);
+                        if (code == BUS_MESSAGE_HEADER_UNIX_FDS && type == SD_BUS_TYPE_UINT32)
+                                n = u;
+                        i += 4;
+                        break;
+
+                case SD_BUS_TYPE_INT64:
+                case SD_BUS_TYPE_UINT64:
+                case SD_BUS_TYPE_DOUBLE:
+                        i = ALIGN8(i) + 8;
+                        break;
+
+                case SD_BUS_TYPE_STRING:
+                case SD_BUS_TYPE_OBJECT_PATH:
+                        i = ALIGN4(i);
+                        if (i + 4 > end)
+                                return -EBADMSG;
+
+                        u = read_uint32(p + i, big_endian);
+                        if (u >= end)
+                                return -EBADMSG;
+                        i += 4 + u + 1;
+                        break;
+
+                case SD_BUS_TYPE_SIGNATURE:
+                        l = p[i];
+                        i += 1 + l + 1;
+                        break;
+
+                default:
+                        return -EOPNOTSUPP;
+                }
+
+                if (i > end)
+                        return -EBADMSG;
+        }
+
+        *ret = n;
+        return 0;
+}
+
+static int message_take_memfd_body(void *b, int memfd, size_t size, size_t *ret) {
+        struct bus_header *h = b;
+        uint64_t sz;
+        int r;
+
+        assert(b);
+        assert(ret);
+
+        /* Make sure the sender can't change the body after the
+         * fact, then patch the header back to what it would look
+         * like if the body had been sent inline */
+
+        r = memfd_get_sealed(memfd);
+        if (r < 0)
+                return r;
+        if (r == 0)
+                return -EBADMSG;
+
+        r = memfd_get_size(memfd, &sz);
+        if (r < 0)
+                return r;
+
+        if (h->dbus1.body_size != 0)
+                return -EBADMSG;
+        if (sz > BUS_MESSAGE_SIZE_MAX - size)
+                return -ENOBUFS;
+
+        h->flags &= ~BUS_MESSAGE_MEMFD_BODY;
+        h->dbus1.body_size = h->endian == BUS_BIG_ENDIAN ? htobe32((uint32_t) sz) : htole32((uint32_t) sz);
+
+        *ret = (size_t) sz;
+        return 0;
+}
+
+static int bus_socket_make_message(sd_bus *bus, size_t offset, size_t size) {
+        const uint8_t *p = (const uint8_t*) bus->rbuffer + offset;
+        size_t memfd_size = 0;
+        bool memfd_body;
         sd_bus_message *t;
+        unsigned n_fds;
+        int *fds;
         void *b;
         int r;
 
         assert(bus);
-        assert(bus->rbuffer_size >= size);
+        assert(bus->rbuffer_size >= offset + size);
         assert(bus->state == BUS_RUNNING || bus->state == BUS_HELLO);
 
         r = bus_rqueue_make_room(bus);
         if (r < 0)
                 return r;
 
-        if (bus->rbuffer_size > size) {
-                b = memdup((const uint8_t*) bus->rbuffer + size,
-                           bus->rbuffer_size - size);
-                if (!b)
+        /* Figure out how many of the fds we got belong to this
+         * message. If we can't tell, or they don't add up, we pass
+         * all of them along, and let the parser complain. */
+        n_fds = bus->n_fds;
+        memfd_body = bus->can_memfd && (((const struct bus_header*) p)->flags & BUS_MESSAGE_MEMFD_BODY);
+        if (memfd_body) {
+                unsigned n;
+
+                /* The body memfd follows the fds of the message */
+                r = message_peek_unix_fds(p, size, &n);
+                if (r < 0)
+                        return -EBADMSG;
+                if (n >= n_fds)
+                        return -EBADMSG;
+
+                n_fds = n + 1;
+        } else if (n_fds > 0) {
+                unsigned n;
+
+                r = message_peek_unix_fds(p, size, &n);
+                if (r >= 0 && n < n_fds)
+                        n_fds = n;
+        }
+
+        if (n_fds == bus->n_fds)
+                fds = bus->fds;
+        else if (n_fds == 0)
+                fds = NULL;
+        else {
+                fds = newdup(int, bus->fds, n_fds);
+                if (!fds)
                         return -ENOMEM;
-        } else
-                b = NULL;
+        }
+
+        /* If the message fills the (large enough) buffer completely,
+         * take it over as is, otherwise copy it out */
+        if (!memfd_body && offset == 0 && size == bus->rbuffer_size && size >= RBUFFER_SIZE / 2)
+                b = bus->rbuffer;
+        else {
+                b = memdup(p, size);
+                if (!b) {
+                        if (fds != bus->fds)
+                                free(fds);
+                        return -ENOMEM;
+                }
+        }
 
-        r = bus_message_from_malloc(bus,
-                                    bus->rbuffer, size,
-                                    bus->fds, bus->n_fds,
-                                    NULL,
-                                    &t);
+        if (memfd_body) {
+                r = message_take_memfd_body(b, fds[n_fds - 1], size, &memfd_size);
+                if (r >= 0)
+                        r = bus_message_from_malloc_and_memfd(bus,
+                                                              b, size,
+                                                              fds[n_fds - 1], memfd_size,
+                                                              fds, n_fds - 1,
+                                                              NULL,
+                                                              &t);
+        } else
+                r = bus_message_from_malloc(bus,
+                                            b, size,
+                                            fds, n_fds,
+                                            NULL,
+                                            &t);
         if (r < 0) {
-                free(b);
+                if (b != bus->rbuffer)
+                        free(b);
+                if (fds != bus->fds)
+                        free(fds);
                 return r;
         }
 
-        bus->rbuffer = b;
-        bus->rbuffer_size -= size;
+        if (b == bus->rbuffer) {
+                bus->rbuffer = NULL;
+                bus->rbuffer_size = 0;
+        }
 
-        bus->fds = NULL;
-        bus->n_fds = 0;
+        if (fds == bus->fds) {
+                bus->fds = NULL;
+                bus->n_fds = 0;
+        } else if (n_fds > 0) {
+                bus->n_fds -= n_fds;
+                memmove(bus->fds, bus->fds + n_fds, sizeof(int) * bus->n_fds);
+        }
 
         bus->rqueue[bus->rqueue_size++] = t;
 
         return 1;
 }
 
+static int bus_socket_make_messages(sd_bus *bus) {
+        size_t offset = 0, need;
+        int r, ret = 0;
+
+        assert(bus);
+
+        /* Turns all complete messages in the read buffer into
+         * message objects, and then moves the remaining partial
+         * message to the front of the buffer, once. */
+
+        for (;;) {
+                r = message_need((const uint8_t*) bus->rbuffer + offset, bus->rbuffer_size - offset, &need);
+                if (r < 0)
+                        break;
+
+                if (bus->rbuffer_size - offset < need)
+                        break;
+
+                r = bus_socket_make_message(bus, offset, need);
+                if (r < 0)
+                        break;
+
+                ret = 1;
+
+                if (!bus->rbuffer)
+                        break;
+
+                offset += need;
+        }
+
+        if (offset > 0) {
+                bus->rbuffer_size -= offset;
+                memmove(bus->rbuffer, (uint8_t*) bus->rbuffer + offset, bus->rbuffer_size);
+        }
+
+        /* Report errors only if we didn't make any progress, we'll
+         * get them again on the next invocation anyway */
+        return ret > 0 ? ret : r;
+}
+
 int bus_socket_read_message(sd_bus *bus) {
         struct msghdr mh;
         struct iovec iov = {};
@@ -932,16 +1393,18 @@ int bus_socket_read_message(sd_bus *bus) {
                 return r;
 
         if (bus->rbuffer_size >= need)
-                return bus_socket_make_message(bus, need);
+                return bus_socket_make_messages(bus);
 
-        b = realloc(bus->rbuffer, need);
+        /* Read more than we need, so that we get any further queued
+         * messages in the same go */
+        b = realloc(bus->rbuffer, MAX(need, (size_t) RBUFFER_SIZE));
         if (!b)
                 return -ENOMEM;
 
         bus->rbuffer = b;
 
         iov.iov_base = (uint8_t*) bus->rbuffer + bus->rbuffer_size;
-        iov.iov_len = need - bus->rbuffer_size;
+        iov.iov_len = MAX(need, (size_t) RBUFFER_SIZE) - bus->rbuffer_size;
 
         if (bus->prefer_readv)
                 k = readv(bus->input_fd, &iov, 1);
@@ -1004,7 +1467,7 @@ int bus_socket_read_message(sd_bus *bus) {
                 return r;
 
         if (bus->rbuffer_size >= need)
-                return bus_socket_make_message(bus, need);
+                return bus_socket_make_messages(bus);
 
         return 1;
 }
@@ -23,6 +23,11 @@
 
 #include "sd-bus.h"
 
+/* Private extension between sd-bus peers: if set in the flags of a
+ * dbus1 message, the body is not sent inline, but as sealed memfd
+ * passed as additional fd after the ones listed in UNIX_FDS */
+#define BUS_MESSAGE_MEMFD_BODY 0x80
+
 void bus_socket_setup(sd_bus *b);
 
 int bus_socket_connect(sd_bus *b);
@@ -31,8 +36,11 @@ int bus_socket_take_fd(sd_bus *b);
 int bus_socket_start_auth(sd_bus *b);
 
 int bus_socket_write_message(sd_bus *bus, sd_bus_message *m, size_t *idx);
+int bus_socket_write_messages(sd_bus *bus, sd_bus_message **messages, unsigned n_messages, size_t *idx);
 int bus_socket_read_message(sd_bus *bus);
 
+int bus_socket_pack_memfd(sd_bus *bus, sd_bus_message **m);
+
 int bus_socket_process_opening(sd_bus *b);
 int bus_socket_process_authenticating(sd_bus *b);
 
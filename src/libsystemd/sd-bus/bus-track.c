@@ -24,6 +24,14 @@
 #include "bus-internal.h"
 #include "bus-track.h"
 
+typedef struct BusTrackItem BusTrackItem;
+
+struct BusTrackItem {
+        sd_bus_track *track;
+        char *name;
+        LIST_FIELDS(BusTrackItem, items_by_name);
+};
+
 struct sd_bus_track {
         unsigned n_ref;
         sd_bus *bus;
@@ -36,25 +44,15 @@ struct sd_bus_track {
         bool modified;
 };
 
-#define MATCH_PREFIX                                        \
+/* Instead of one match per tracked name, all tracking objects of a
+ * bus share one match for all name changes, and look up the affected
+ * names in bus->track_items */
+#define MATCH_NAME_OWNER_CHANGED                            \
         "type='signal',"                                    \
         "sender='org.freedesktop.DBus',"                    \
         "path='/org/freedesktop/DBus',"                     \
         "interface='org.freedesktop.DBus',"                 \
-        "member='NameOwnerChanged',"                        \
-        "arg0='"
-
-#define MATCH_SUFFIX \
-        "'"
-
-#define MATCH_FOR_NAME(name)                                            \
-        ({                                                              \
-                char *_x;                                               \
-                size_t _l = strlen(name);                               \
-                _x = alloca(strlen(MATCH_PREFIX)+_l+strlen(MATCH_SUFFIX)+1); \
-                strcpy(stpcpy(stpcpy(_x, MATCH_PREFIX), name), MATCH_SUFFIX); \
-                _x;                                                     \
-        })
+        "member='NameOwnerChanged'"
 
 static void bus_track_add_to_queue(sd_bus_track *track) {
         assert(track);
@@ -143,25 +141,94 @@ _public_ sd_bus_track* sd_bus_track_unref(sd_bus_track *track) {
 }
 
 static int on_name_owner_changed(sd_bus_message *message, void *userdata, sd_bus_error *error) {
-        sd_bus_track *track = userdata;
+        sd_bus *bus = userdata;
         const char *name, *old, *new;
+        BusTrackItem *i;
         int r;
 
         assert(message);
-        assert(track);
+        assert(bus);
 
         r = sd_bus_message_read(message, "sss", &name, &old, &new);
         if (r < 0)
                 return 0;
 
-        sd_bus_track_remove_name(track, name);
+        while ((i = hashmap_get(bus->track_items, name)))
+                sd_bus_track_remove_name(i->track, name);
+
+        return 0;
+}
+
+static BusTrackItem* track_item_free(BusTrackItem *i) {
+        if (!i)
+                return NULL;
+
+        free(i->name);
+        free(i);
+
+        return NULL;
+}
+
+DEFINE_TRIVIAL_CLEANUP_FUNC(BusTrackItem*, track_item_free);
+
+static int track_item_link(sd_bus *bus, BusTrackItem *i) {
+        BusTrackItem *head;
+        int r;
+
+        assert(bus);
+        assert(i);
+
+        r = hashmap_ensure_allocated(&bus->track_items, &string_hash_ops);
+        if (r < 0)
+                return r;
+
+        if (!bus->track_match) {
+                r = sd_bus_add_match(bus, &bus->track_match, MATCH_NAME_OWNER_CHANGED, on_name_owner_changed, bus);
+                if (r < 0)
+                        return r;
+        }
+
+        head = hashmap_get(bus->track_items, i->name);
+        LIST_PREPEND(items_by_name, head, i);
+
+        r = hashmap_replace(bus->track_items, head->name, head);
+        if (r < 0) {
+                LIST_REMOVE(items_by_name, head, i);
+                if (hashmap_isempty(bus->track_items))
+                        bus->track_match = sd_bus_slot_unref(bus->track_match);
+                return r;
+        }
+
         return 0;
 }
 
+static void track_item_unlink(sd_bus *bus, BusTrackItem *i) {
+        BusTrackItem *head;
+
+        assert(bus);
+        assert(i);
+
+        head = hashmap_get(bus->track_items, i->name);
+        assert(head);
+
+        LIST_REMOVE(items_by_name, head, i);
+
+        /* The entry is keyed by the name of the first item, hence
+         * needs updating when that one goes away. Replacing an
+         * existing key cannot fail. */
+        if (head)
+                assert_se(hashmap_replace(bus->track_items, head->name, head) == 0);
+        else
+                hashmap_remove(bus->track_items, i->name);
+
+        /* Stop receiving all name changes when nothing is tracked
+         * anymore */
+        if (hashmap_isempty(bus->track_items))
+                bus->track_match = sd_bus_slot_unref(bus->track_match);
+}
+
 _public_ int sd_bus_track_add_name(sd_bus_track *track, const char *name) {
-        _cleanup_bus_slot_unref_ sd_bus_slot *slot = NULL;
-        _cleanup_free_ char *n = NULL;
-        const char *match;
+        _cleanup_(track_item_freep) BusTrackItem *i = NULL;
         int r;
 
         assert_return(track, -EINVAL);
@@ -171,32 +238,39 @@ _public_ int sd_bus_track_add_name(sd_bus_track *track, const char *name) {
         if (r < 0)
                 return r;
 
-        n = strdup(name);
-        if (!n)
+        if (hashmap_get(track->names, name))
+                return 0;
+
+        i = new0(BusTrackItem, 1);
+        if (!i)
                 return -ENOMEM;
 
-        /* First, subscribe to this name */
-        match = MATCH_FOR_NAME(n);
-        r = sd_bus_add_match(track->bus, &slot, match, on_name_owner_changed, track);
+        i->track = track;
+        i->name = strdup(name);
+        if (!i->name)
+                return -ENOMEM;
+
+        r = hashmap_put(track->names, i->name, i);
         if (r < 0)
                 return r;
 
-        r = hashmap_put(track->names, n, slot);
-        if (r == -EEXIST)
-                return 0;
-        if (r < 0)
+        /* First, subscribe to this name */
+        r = track_item_link(track->bus, i);
+        if (r < 0) {
+                hashmap_remove(track->names, i->name);
                 return r;
+        }
 
         /* Second, check if it is currently existing, or maybe
          * doesn't, or maybe disappeared already. */
-        r = sd_bus_get_name_creds(track->bus, n, 0, NULL);
+        r = sd_bus_get_name_creds(track->bus, i->name, 0, NULL);
         if (r < 0) {
-                hashmap_remove(track->names, n);
+                hashmap_remove(track->names, i->name);
+                track_item_unlink(track->bus, i);
                 return r;
         }
 
-        n = NULL;
-        slot = NULL;
+        i = NULL;
 
         bus_track_remove_from_queue(track);
         track->modified = true;
@@ -205,18 +279,19 @@ _public_ int sd_bus_track_add_name(sd_bus_track *track, const char *name) {
 }
 
 _public_ int sd_bus_track_remove_name(sd_bus_track *track, const char *name) {
-        _cleanup_bus_slot_unref_ sd_bus_slot *slot = NULL;
-        _cleanup_free_ char *n = NULL;
+        _cleanup_(track_item_freep) BusTrackItem *i = NULL;
 
         assert_return(name, -EINVAL);
 
         if (!track)
                 return 0;
 
-        slot = hashmap_remove2(track->names, (char*) name, (void**) &n);
-        if (!slot)
+        i = hashmap_remove(track->names, (char*) name);
+        if (!i)
                 return 0;
 
+        track_item_unlink(track->bus, i);
+
         if (hashmap_isempty(track->names))
                 bus_track_add_to_queue(track);
 
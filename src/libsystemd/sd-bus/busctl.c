@@ -20,6 +20,7 @@
 ***/
 
 #include <getopt.h>
+#include <pthread.h>
 
 #include "strv.h"
 #include "util.h"
@@ -50,6 +51,7 @@ static BusTransport arg_transport = BUS_TRANSPORT_LOCAL;
 static char *arg_host = NULL;
 static bool arg_user = false;
 static size_t arg_snaplen = 4096;
+static size_t arg_buffer_size = 0;
 static bool arg_list = false;
 static bool arg_quiet = false;
 static bool arg_verbose = false;
@@ -1075,7 +1077,254 @@ static int message_pcap(sd_bus_message *m, FILE *f) {
         return bus_message_pcap_frame(m, arg_snaplen, f);
 }
 
-static int monitor(sd_bus *bus, char *argv[], int (*dump)(sd_bus_message *m, FILE *f)) {
+/* With --buffer-size= captured messages are serialized into a
+ * number of buffers, which a separate thread writes out one by one
+ * as they fill up. That way a slow reader of our output doesn't hold
+ * up reading from the bus. If the writer falls behind for too long,
+ * messages are dropped and counted, rather than queued up without
+ * bounds. */
+
+#define CAPTURE_BUFFERS 16U
+
+/* How long to keep a partially filled buffer back while the writer
+ * thread is busy with others */
+#define CAPTURE_FLUSH_USEC (100 * USEC_PER_MSEC)
+
+typedef struct CaptureBuffer {
+        uint8_t *data;
+        size_t used;
+} CaptureBuffer;
+
+typedef struct CaptureRing {
+        pthread_t thread;
+        pthread_mutex_t mutex;
+        pthread_cond_t cond;
+
+        CaptureBuffer buffers[CAPTURE_BUFFERS];
+        size_t buffer_size;
+
+        /* The writer thread owns the n_queued buffers starting at
+         * first, the main thread fills the one right after them */
+        unsigned first;
+        unsigned n_queued;
+        bool done;
+        int error;
+
+        uint64_t n_captured;
+        uint64_t n_dropped;
+        uint64_t n_dropped_bytes;
+} CaptureRing;
+
+static volatile sig_atomic_t capture_interrupted = false;
+
+static void capture_sigint(int sig) {
+        capture_interrupted = true;
+}
+
+static void *capture_ring_thread(void *p) {
+        CaptureRing *ring = p;
+
+        for (;;) {
+                CaptureBuffer *b;
+                int r;
+
+                assert_se(pthread_mutex_lock(&ring->mutex) == 0);
+
+                while (ring->n_queued == 0 && !ring->done)
+                        assert_se(pthread_cond_wait(&ring->cond, &ring->mutex) == 0);
+
+                if (ring->n_queued == 0) {
+                        assert_se(pthread_mutex_unlock(&ring->mutex) == 0);
+                        return NULL;
+                }
+
+                b = ring->buffers + ring->first;
+
+                assert_se(pthread_mutex_unlock(&ring->mutex) == 0);
+
+                r = loop_write(STDOUT_FILENO, b->data, b->used, false);
+
+                assert_se(pthread_mutex_lock(&ring->mutex) == 0);
+
+                b->used = 0;
+                ring->first = (ring->first + 1) % CAPTURE_BUFFERS;
+                ring->n_queued--;
+
+                if (r < 0)
+                        ring->error = r;
+
+                assert_se(pthread_mutex_unlock(&ring->mutex) == 0);
+
+                if (r < 0)
+                        return NULL;
+        }
+}
+
+static int capture_ring_start(CaptureRing *ring) {
+        unsigned i;
+        int r;
+
+        assert(ring);
+
+        zero(*ring);
+
+        /* Each buffer needs to fit at least one frame, including
+         * its pcap record header */
+        ring->buffer_size = MAX(DIV_ROUND_UP(arg_buffer_size, CAPTURE_BUFFERS), arg_snaplen + 16);
+
+        for (i = 0; i < CAPTURE_BUFFERS; i++) {
+                ring->buffers[i].data = malloc(ring->buffer_size);
+                if (!ring->buffers[i].data)
+                        return log_oom();
+        }
+
+        assert_se(pthread_mutex_init(&ring->mutex, NULL) == 0);
+        assert_se(pthread_cond_init(&ring->cond, NULL) == 0);
+
+        r = pthread_create(&ring->thread, NULL, capture_ring_thread, ring);
+        if (r > 0) {
+                ring->thread = 0;
+                return log_error_errno(r, "Failed to start writer thread: %m");
+        }
+
+        return 0;
+}
+
+static int capture_ring_next(CaptureRing *ring, bool queue, CaptureBuffer **ret) {
+        CaptureBuffer *b = NULL;
+        int r;
+
+        /* Returns the buffer to fill, or NULL if the writer thread
+         * still owns all of them. If queue is true, the current
+         * buffer is handed to the writer thread first, if it has
+         * anything in it. */
+
+        assert_se(pthread_mutex_lock(&ring->mutex) == 0);
+
+        r = ring->error;
+
+        if (r >= 0 && ring->n_queued < CAPTURE_BUFFERS) {
+                b = ring->buffers + (ring->first + ring->n_queued) % CAPTURE_BUFFERS;
+
+                if (queue && b->used > 0) {
+                        ring->n_queued++;
+                        assert_se(pthread_cond_signal(&ring->cond) == 0);
+
+                        if (ring->n_queued < CAPTURE_BUFFERS)
+                                b = ring->buffers + (ring->first + ring->n_queued) % CAPTURE_BUFFERS;
+                        else
+                                b = NULL;
+                }
+        }
+
+        assert_se(pthread_mutex_unlock(&ring->mutex) == 0);
+
+        if (ret)
+                *ret = b;
+
+        return r;
+}
+
+static int capture_ring_idle(CaptureRing *ring) {
+        CaptureBuffer *b;
+        int r;
+
+        /* Hands the partially filled buffer to the writer thread, but
+         * only if the latter has nothing else to do. Otherwise it is
+         * better to keep filling it up, as every buffer queued takes
+         * its full size from the ring until it is written out.
+         * Returns > 0 if data is left in the buffer. */
+
+        assert_se(pthread_mutex_lock(&ring->mutex) == 0);
+
+        r = ring->error;
+
+        if (r >= 0 && ring->n_queued < CAPTURE_BUFFERS) {
+                b = ring->buffers + (ring->first + ring->n_queued) % CAPTURE_BUFFERS;
+
+                if (b->used > 0) {
+                        if (ring->n_queued == 0) {
+                                ring->n_queued++;
+                                assert_se(pthread_cond_signal(&ring->cond) == 0);
+                        } else
+                                r = 1;
+                }
+        }
+
+        assert_se(pthread_mutex_unlock(&ring->mutex) == 0);
+
+        return r;
+}
+
+static int capture_ring_push(CaptureRing *ring, sd_bus_message *m) {
+        CaptureBuffer *b;
+        size_t sz;
+        int r;
+
+        sz = bus_message_pcap_frame_size(m, arg_snaplen);
+
+        r = capture_ring_next(ring, false, &b);
+        if (r >= 0 && b && b->used + sz > ring->buffer_size)
+                r = capture_ring_next(ring, true, &b);
+        if (r < 0)
+                return log_error_errno(r, "Couldn't write capture file: %m");
+
+        if (!b) {
+                if (ring->n_dropped == 0)
+                        log_warning("Capture buffer full, dropping messages.");
+
+                ring->n_dropped++;
+                ring->n_dropped_bytes += sz;
+                return 0;
+        }
+
+        bus_message_pcap_frame_to_buffer(m, arg_snaplen, b->data + b->used);
+        b->used += sz;
+        ring->n_captured++;
+
+        return 0;
+}
+
+static int capture_ring_finish(CaptureRing *ring) {
+        char buf[FORMAT_BYTES_MAX];
+        unsigned i;
+        int r;
+
+        assert(ring);
+
+        if (ring->buffer_size <= 0)
+                return 0;
+
+        if (ring->thread != 0) {
+                (void) capture_ring_next(ring, true, NULL);
+
+                assert_se(pthread_mutex_lock(&ring->mutex) == 0);
+                ring->done = true;
+                assert_se(pthread_cond_signal(&ring->cond) == 0);
+                assert_se(pthread_mutex_unlock(&ring->mutex) == 0);
+
+                assert_se(pthread_join(ring->thread, NULL) == 0);
+                ring->thread = 0;
+
+                assert_se(pthread_cond_destroy(&ring->cond) == 0);
+                assert_se(pthread_mutex_destroy(&ring->mutex) == 0);
+        }
+
+        for (i = 0; i < CAPTURE_BUFFERS; i++)
+                ring->buffers[i].data = mfree(ring->buffers[i].data);
+
+        r = ring->error;
+        if (r < 0)
+                return log_error_errno(r, "Couldn't write capture file: %m");
+
+        log_info("Captured %" PRIu64 " messages, dropped %" PRIu64 " (%s).",
+                 ring->n_captured, ring->n_dropped,
+                 format_bytes(buf, sizeof(buf), ring->n_dropped_bytes));
+
+        return 0;
+}
+
+static int monitor(sd_bus *bus, char *argv[], int (*dump)(sd_bus_message *m, FILE *f), CaptureRing *ring) {
         bool added_something = false;
         char **i;
         int r;
@@ -1117,14 +1366,24 @@ static int monitor(sd_bus *bus, char *argv[], int (*dump)(sd_bus_message *m, FIL
 
         for (;;) {
                 _cleanup_bus_message_unref_ sd_bus_message *m = NULL;
+                uint64_t timeout = (uint64_t) -1;
+
+                if (capture_interrupted)
+                        return 0;
 
                 r = sd_bus_process(bus, &m);
                 if (r < 0)
                         return log_error_errno(r, "Failed to process bus: %m");
 
                 if (m) {
-                        dump(m, stdout);
-                        fflush(stdout);
+                        if (ring) {
+                                r = capture_ring_push(ring, m);
+                                if (r < 0)
+                                        return r;
+                        } else {
+                                dump(m, stdout);
+                                fflush(stdout);
+                        }
 
                         if (sd_bus_message_is_signal(m, "org.freedesktop.DBus.Local", "Disconnected") > 0) {
                                 log_info("Connection terminated, exiting.");
@@ -1137,14 +1396,27 @@ static int monitor(sd_bus *bus, char *argv[], int (*dump)(sd_bus_message *m, FIL
                 if (r > 0)
                         continue;
 
-                r = sd_bus_wait(bus, (uint64_t) -1);
+                if (ring) {
+                        /* Nothing to read right now, so write out
+                         * what we have */
+                        r = capture_ring_idle(ring);
+                        if (r < 0)
+                                return log_error_errno(r, "Couldn't write capture file: %m");
+                        if (r > 0)
+                                timeout = CAPTURE_FLUSH_USEC;
+                }
+
+                r = sd_bus_wait(bus, timeout);
+                if (r == -EINTR && capture_interrupted)
+                        continue;
                 if (r < 0)
                         return log_error_errno(r, "Failed to wait for bus: %m");
         }
 }
 
 static int capture(sd_bus *bus, char *argv[]) {
-        int r;
+        CaptureRing ring = {};
+        int r, q;
 
         if (isatty(fileno(stdout)) > 0) {
                 log_error("Refusing to write message data to console, please redirect output to a file.");
@@ -1153,9 +1425,30 @@ static int capture(sd_bus *bus, char *argv[]) {
 
         bus_pcap_header(arg_snaplen, stdout);
 
-        r = monitor(bus, argv, message_pcap);
+        if (arg_buffer_size > 0) {
+                struct sigaction sa = {
+                        .sa_handler = capture_sigint,
+                        .sa_flags = SA_RESETHAND,
+                };
+
+                r = capture_ring_start(&ring);
+                if (r < 0)
+                        goto finish;
+
+                /* Write out what is buffered on the first SIGINT or
+                 * SIGTERM, the second one kills us as usual */
+                assert_se(sigaction(SIGINT, &sa, NULL) >= 0);
+                assert_se(sigaction(SIGTERM, &sa, NULL) >= 0);
+        }
+
+        r = monitor(bus, argv, message_pcap, arg_buffer_size > 0 ? &ring : NULL);
+
+finish:
+        q = capture_ring_finish(&ring);
         if (r < 0)
                 return r;
+        if (q < 0)
+                return q;
 
         if (ferror(stdout)) {
                 log_error("Couldn't write capture file.");
@@ -1685,6 +1978,8 @@ static int help(void) {
                "     --activatable        Only show activatable names\n"
                "     --match=MATCH        Only show matching messages\n"
                "     --size=SIZE          Maximum length of captured packet\n"
+               "     --buffer-size=SIZE   Buffer captured packets in memory, and write\n"
+               "                          them out from a separate thread\n"
                "     --list               Don't show tree, but simple object path list\n"
                "     --quiet              Don't show method call reply\n"
                "     --verbose            Show result values in long format\n"
@@ -1728,6 +2023,7 @@ static int parse_argv(int argc, char *argv[]) {
                 ARG_ACQUIRED,
                 ARG_ACTIVATABLE,
                 ARG_SIZE,
+                ARG_BUFFER_SIZE,
                 ARG_LIST,
                 ARG_VERBOSE,
                 ARG_EXPECT_REPLY,
@@ -1753,6 +2049,7 @@ static int parse_argv(int argc, char *argv[]) {
                 { "host",         required_argument, NULL, 'H'              },
                 { "machine",      required_argument, NULL, 'M'              },
                 { "size",         required_argument, NULL, ARG_SIZE         },
+                { "buffer-size",  required_argument, NULL, ARG_BUFFER_SIZE  },
                 { "list",         no_argument,       NULL, ARG_LIST         },
                 { "quiet",        no_argument,       NULL, 'q'              },
                 { "verbose",      no_argument,       NULL, ARG_VERBOSE      },
@@ -1840,6 +2137,24 @@ static int parse_argv(int argc, char *argv[]) {
                         break;
                 }
 
+                case ARG_BUFFER_SIZE: {
+                        uint64_t sz;
+
+                        r = parse_size(optarg, 1024, &sz);
+                        if (r < 0) {
+                                log_error("Failed to parse buffer size: %s", optarg);
+                                return r;
+                        }
+
+                        if ((uint64_t) (size_t) sz != sz) {
+                                log_error("Buffer size out of range.");
+                                return -E2BIG;
+                        }
+
+                        arg_buffer_size = (size_t) sz;
+                        break;
+                }
+
                 case ARG_LIST:
                         arg_list = true;
                         break;
@@ -1931,7 +2246,7 @@ static int busctl_main(sd_bus *bus, int argc, char *argv[]) {
                 return list_bus_names(bus, argv + optind);
 
         if (streq(argv[optind], "monitor"))
-                return monitor(bus, argv + optind, message_dump);
+                return monitor(bus, argv + optind, message_dump, NULL);
 
         if (streq(argv[optind], "capture"))
                 return capture(bus, argv + optind);
@@ -69,6 +69,30 @@ static int bus_poll(sd_bus *bus, bool need_more, uint64_t timeout_usec);
 static int attach_io_events(sd_bus *b);
 static void detach_io_events(sd_bus *b);
 
+struct thread_call {
+        uint64_t cookie;
+        pthread_cond_t cond;
+        sd_bus_message *reply;
+        int error;
+        bool done;
+};
+
+static void bus_fail_thread_calls(sd_bus *b, int error) {
+        struct thread_call *c;
+
+        assert(b);
+        assert(error < 0);
+
+        /* Wake up all threads waiting in sd_bus_call() for a reply
+         * that will never come. Called with the lock taken. */
+
+        while ((c = hashmap_steal_first(b->thread_calls))) {
+                c->error = error;
+                c->done = true;
+                assert_se(pthread_cond_signal(&c->cond) == 0);
+        }
+}
+
 static void bus_close_fds(sd_bus *b) {
         assert(b);
 
@@ -154,13 +178,33 @@ static void bus_free(sd_bus *b) {
         hashmap_free_free(b->vtable_methods);
         hashmap_free_free(b->vtable_properties);
 
+        bus_object_cache_flush(b);
+        hashmap_free(b->object_cache);
+
         assert(hashmap_isempty(b->nodes));
         hashmap_free(b->nodes);
 
+        /* Each tracked name keeps a reference to the bus via its
+         * tracking object, hence none of them can be around anymore */
+        assert(hashmap_isempty(b->track_items));
+        assert(!b->track_match);
+        hashmap_free(b->track_items);
+
         bus_kernel_flush_memfd(b);
 
         assert_se(pthread_mutex_destroy(&b->memfd_cache_mutex) == 0);
 
+        /* Threads waiting for replies keep a reference to the bus,
+         * hence none of them can be around anymore */
+        assert(hashmap_isempty(b->thread_calls));
+        hashmap_free(b->thread_calls);
+        assert_se(pthread_mutex_destroy(&b->lock) == 0);
+
+        /* All messages keep a reference to the bus, hence none of
+         * them can be around anymore */
+        mempool_drop(&b->message_pool);
+        assert_se(pthread_mutex_destroy(&b->message_pool_mutex) == 0);
+
         free(b);
 }
 
@@ -183,6 +227,12 @@ _public_ int sd_bus_new(sd_bus **ret) {
 
         assert_se(pthread_mutex_init(&r->memfd_cache_mutex, NULL) == 0);
 
+        r->message_pool.tile_size = BUS_MESSAGE_POOL_TILE_SIZE;
+        r->message_pool.at_least = 16;
+        assert_se(pthread_mutex_init(&r->message_pool_mutex, NULL) == 0);
+
+        assert_se(pthread_mutex_init(&r->lock, NULL) == 0);
+
         /* We guarantee that wqueue always has space for at least one
          * entry */
         if (!GREEDY_REALLOC(r->wqueue, r->wqueue_allocated, 1)) {
@@ -355,6 +405,26 @@ _public_ int sd_bus_set_trusted(sd_bus *bus, int b) {
         return 0;
 }
 
+_public_ int sd_bus_set_thread_safe(sd_bus *bus, int b) {
+        assert_return(bus, -EINVAL);
+        assert_return(bus->state == BUS_UNSET, -EPERM);
+        assert_return(!bus_pid_changed(bus), -ECHILD);
+
+        /* The thread enabling this is the one that is expected to
+         * process the connection, i.e. read and dispatch incoming
+         * messages. */
+        bus->thread_safe = !!b;
+        bus->owner_thread = pthread_self();
+        return 0;
+}
+
+_public_ int sd_bus_is_thread_safe(sd_bus *bus) {
+        assert_return(bus, -EINVAL);
+        assert_return(!bus_pid_changed(bus), -ECHILD);
+
+        return bus->thread_safe;
+}
+
 _public_ int sd_bus_set_description(sd_bus *bus, const char *description) {
         assert_return(bus, -EINVAL);
         assert_return(bus->state == BUS_UNSET, -EPERM);
@@ -434,12 +504,16 @@ static int bus_send_hello(sd_bus *bus) {
 int bus_start_running(sd_bus *bus) {
         assert(bus);
 
-        if (bus->bus_client && !bus->is_kernel) {
+        /* Other threads decide whether they can write out what they
+         * queued based on this, hence take the lock */
+        bus_lock(bus);
+
+        if (bus->bus_client && !bus->is_kernel)
                 bus->state = BUS_HELLO;
-                return 1;
-        }
+        else
+                bus->state = BUS_RUNNING;
 
-        bus->state = BUS_RUNNING;
+        bus_unlock(bus);
         return 1;
 }
 
@@ -1436,7 +1510,13 @@ _public_ void sd_bus_close(sd_bus *bus) {
 
         /* Drop all queued messages so that they drop references to
          * the bus object and the bus may be freed */
+        bus_lock(bus);
         bus_reset_queues(bus);
+        bus_fail_thread_calls(bus, -ECONNRESET);
+        bus_unlock(bus);
+
+        /* The cached messages reference the bus too */
+        bus_object_cache_flush(bus);
 
         if (!bus->is_kernel)
                 bus_close_fds(bus);
@@ -1605,6 +1685,21 @@ int bus_seal_synthetic_message(sd_bus *b, sd_bus_message *m) {
         return bus_message_seal(m, 0xFFFFFFFFULL, 0);
 }
 
+static void log_sent_message(sd_bus_message *m) {
+        assert(m);
+
+        log_debug("Sent message type=%s sender=%s destination=%s object=%s interface=%s member=%s cookie=%" PRIu64 " reply_cookie=%" PRIu64 " error=%s",
+                  bus_message_type_to_string(m->header->type),
+                  strna(sd_bus_message_get_sender(m)),
+                  strna(sd_bus_message_get_destination(m)),
+                  strna(sd_bus_message_get_path(m)),
+                  strna(sd_bus_message_get_interface(m)),
+                  strna(sd_bus_message_get_member(m)),
+                  BUS_MESSAGE_COOKIE(m),
+                  m->reply_cookie,
+                  strna(m->error.message));
+}
+
 static int bus_write_message(sd_bus *bus, sd_bus_message *m, bool hint_sync_call, size_t *idx) {
         int r;
 
@@ -1620,49 +1715,53 @@ static int bus_write_message(sd_bus *bus, sd_bus_message *m, bool hint_sync_call
                 return r;
 
         if (bus->is_kernel || *idx >= BUS_MESSAGE_SIZE(m))
-                log_debug("Sent message type=%s sender=%s destination=%s object=%s interface=%s member=%s cookie=%" PRIu64 " reply_cookie=%" PRIu64 " error=%s",
-                          bus_message_type_to_string(m->header->type),
-                          strna(sd_bus_message_get_sender(m)),
-                          strna(sd_bus_message_get_destination(m)),
-                          strna(sd_bus_message_get_path(m)),
-                          strna(sd_bus_message_get_interface(m)),
-                          strna(sd_bus_message_get_member(m)),
-                          BUS_MESSAGE_COOKIE(m),
-                          m->reply_cookie,
-                          strna(m->error.message));
+                log_sent_message(m);
 
         return r;
 }
 
-static int dispatch_wqueue(sd_bus *bus) {
+static int dispatch_wqueue_unlocked(sd_bus *bus) {
         int r, ret = 0;
 
         assert(bus);
         assert(bus->state == BUS_RUNNING || bus->state == BUS_HELLO);
 
         while (bus->wqueue_size > 0) {
+                unsigned n = 0;
 
-                r = bus_write_message(bus, bus->wqueue[0], false, &bus->windex);
+                if (bus->is_kernel)
+                        r = bus_write_message(bus, bus->wqueue[0], false, &bus->windex);
+                else
+                        /* Write as many of the queued messages as
+                         * we can in one go */
+                        r = bus_socket_write_messages(bus, bus->wqueue, bus->wqueue_size, &bus->windex);
                 if (r < 0)
                         return r;
                 else if (r == 0)
                         /* Didn't do anything this time */
                         return ret;
-                else if (bus->is_kernel || bus->windex >= BUS_MESSAGE_SIZE(bus->wqueue[0])) {
-                        /* Fully written. Let's drop the entry from
-                         * the queue.
-                         *
-                         * This isn't particularly optimized, but
-                         * well, this is supposed to be our worst-case
-                         * buffer only, and the socket buffer is
-                         * supposed to be our primary buffer, and if
-                         * it got full, then all bets are off
-                         * anyway. */
-
-                        bus->wqueue_size --;
-                        sd_bus_message_unref(bus->wqueue[0]);
-                        memmove(bus->wqueue, bus->wqueue + 1, sizeof(sd_bus_message*) * bus->wqueue_size);
+
+                if (bus->is_kernel) {
                         bus->windex = 0;
+                        n = 1;
+                } else
+                        while (n < bus->wqueue_size && bus->windex >= BUS_MESSAGE_SIZE(bus->wqueue[n])) {
+                                bus->windex -= BUS_MESSAGE_SIZE(bus->wqueue[n]);
+                                log_sent_message(bus->wqueue[n]);
+                                n++;
+                        }
+
+                if (n > 0) {
+                        unsigned i;
+
+                        /* Fully written. Let's drop the entries
+                         * from the queue, with a single move. */
+
+                        for (i = 0; i < n; i++)
+                                sd_bus_message_unref(bus->wqueue[i]);
+
+                        bus->wqueue_size -= n;
+                        memmove(bus->wqueue, bus->wqueue + n, sizeof(sd_bus_message*) * bus->wqueue_size);
 
                         ret = 1;
                 }
@@ -1671,6 +1770,18 @@ static int dispatch_wqueue(sd_bus *bus) {
         return ret;
 }
 
+static int dispatch_wqueue(sd_bus *bus) {
+        int r;
+
+        assert(bus);
+
+        bus_lock(bus);
+        r = dispatch_wqueue_unlocked(bus);
+        bus_unlock(bus);
+
+        return r;
+}
+
 static int bus_read_message(sd_bus *bus, bool hint_priority, int64_t priority) {
         assert(bus);
 
@@ -1724,44 +1835,61 @@ static int dispatch_rqueue(sd_bus *bus, bool hint_priority, int64_t priority, sd
         }
 }
 
-static int bus_send_internal(sd_bus *bus, sd_bus_message *_m, uint64_t *cookie, bool hint_sync_call) {
-        _cleanup_bus_message_unref_ sd_bus_message *m = sd_bus_message_ref(_m);
+static int flush_wqueue_unlocked(sd_bus *bus) {
         int r;
 
-        assert_return(m, -EINVAL);
-
-        if (!bus)
-                bus = m->bus;
+        assert(bus);
 
-        assert_return(!bus_pid_changed(bus), -ECHILD);
-        assert_return(!bus->is_kernel || !(bus->hello_flags & KDBUS_HELLO_MONITOR), -EROFS);
+        /* Other threads can't rely on the owner thread to write
+         * out what they queued, hence they wait for the queue to
+         * drain before returning. */
 
-        if (!BUS_IS_OPEN(bus->state))
-                return -ENOTCONN;
+        while (bus->wqueue_size > 0) {
+                r = dispatch_wqueue_unlocked(bus);
+                if (r < 0)
+                        return r;
+                if (r > 0)
+                        continue;
 
-        if (m->n_fds > 0) {
-                r = sd_bus_can_send(bus, SD_BUS_TYPE_UNIX_FD);
+                r = fd_wait_for_event(bus->output_fd, POLLOUT, (usec_t) -1);
                 if (r < 0)
                         return r;
-                if (r == 0)
-                        return -EOPNOTSUPP;
         }
 
+        return 0;
+}
+
+static int bus_send_unlocked(sd_bus *bus, sd_bus_message **_m, uint64_t *cookie, bool hint_sync_call) {
+        sd_bus_message *m;
+        int r;
+
+        assert(bus);
+        assert(_m);
+        assert(*_m);
+
         /* If the cookie number isn't kept, then we know that no reply
          * is expected */
-        if (!cookie && !m->sealed)
-                m->header->flags |= BUS_MESSAGE_NO_REPLY_EXPECTED;
+        if (!cookie && !(*_m)->sealed)
+                (*_m)->header->flags |= BUS_MESSAGE_NO_REPLY_EXPECTED;
 
-        r = bus_seal_message(bus, m, 0);
+        r = bus_seal_message(bus, *_m, 0);
         if (r < 0)
                 return r;
 
         /* Remarshall if we have to. This will possibly unref the
          * message and place a replacement in m */
-        r = bus_remarshal_message(bus, &m);
+        r = bus_remarshal_message(bus, _m);
         if (r < 0)
                 return r;
 
+        if (!bus->is_kernel && !(*_m)->dont_send) {
+                r = bus_socket_pack_memfd(bus, _m);
+                if (r < 0)
+                        return r;
+        }
+
+        m = *_m;
+
         /* If this is a reply and no reply was requested, then let's
          * suppress this, if we can */
         if (m->dont_send)
@@ -1803,6 +1931,18 @@ static int bus_send_internal(sd_bus *bus, sd_bus_message *_m, uint64_t *cookie,
                 bus->wqueue[bus->wqueue_size ++] = sd_bus_message_ref(m);
         }
 
+        if (bus_foreign_thread(bus) && (bus->state == BUS_RUNNING || bus->state == BUS_HELLO)) {
+                r = flush_wqueue_unlocked(bus);
+                if (r < 0) {
+                        if (r == -ENOTCONN || r == -ECONNRESET || r == -EPIPE || r == -ESHUTDOWN) {
+                                bus_enter_closing(bus);
+                                return -ECONNRESET;
+                        }
+
+                        return r;
+                }
+        }
+
 finish:
         if (cookie)
                 *cookie = BUS_MESSAGE_COOKIE(m);
@@ -1810,6 +1950,36 @@ finish:
         return 1;
 }
 
+static int bus_send_internal(sd_bus *bus, sd_bus_message *_m, uint64_t *cookie, bool hint_sync_call) {
+        _cleanup_bus_message_unref_ sd_bus_message *m = sd_bus_message_ref(_m);
+        int r;
+
+        assert_return(m, -EINVAL);
+
+        if (!bus)
+                bus = m->bus;
+
+        assert_return(!bus_pid_changed(bus), -ECHILD);
+        assert_return(!bus->is_kernel || !(bus->hello_flags & KDBUS_HELLO_MONITOR), -EROFS);
+
+        if (!BUS_IS_OPEN(bus->state))
+                return -ENOTCONN;
+
+        if (m->n_fds > 0) {
+                r = sd_bus_can_send(bus, SD_BUS_TYPE_UNIX_FD);
+                if (r < 0)
+                        return r;
+                if (r == 0)
+                        return -EOPNOTSUPP;
+        }
+
+        bus_lock(bus);
+        r = bus_send_unlocked(bus, &m, cookie, hint_sync_call);
+        bus_unlock(bus);
+
+        return r;
+}
+
 _public_ int sd_bus_send(sd_bus *bus, sd_bus_message *m, uint64_t *cookie) {
         return bus_send_internal(bus, m, cookie, false);
 }
@@ -1886,6 +2056,7 @@ _public_ int sd_bus_call_async(
                 bus = m->bus;
 
         assert_return(!bus_pid_changed(bus), -ECHILD);
+        assert_return(!bus_foreign_thread(bus), -EPERM);
         assert_return(!bus->is_kernel || !(bus->hello_flags & KDBUS_HELLO_MONITOR), -EROFS);
 
         if (!BUS_IS_OPEN(bus->state))
@@ -1899,7 +2070,9 @@ _public_ int sd_bus_call_async(
         if (r < 0)
                 return r;
 
+        bus_lock(bus);
         r = bus_seal_message(bus, m, usec);
+        bus_unlock(bus);
         if (r < 0)
                 return r;
 
@@ -1965,6 +2138,97 @@ int bus_ensure_running(sd_bus *bus) {
         }
 }
 
+static int bus_call_from_thread(
+                sd_bus *bus,
+                sd_bus_message *_m,
+                uint64_t usec,
+                sd_bus_error *error,
+                sd_bus_message **reply) {
+
+        _cleanup_bus_message_unref_ sd_bus_message *m = sd_bus_message_ref(_m), *incoming = NULL;
+        struct thread_call c = {};
+        pthread_condattr_t attr;
+        usec_t timeout;
+        int r;
+
+        assert(bus);
+        assert(bus_foreign_thread(bus));
+
+        /* We may not touch the read queue from this thread, hence
+         * register the cookie and let the owner thread hand the
+         * reply over to us when it dispatches it. */
+
+        assert_se(pthread_condattr_init(&attr) == 0);
+        assert_se(pthread_condattr_setclock(&attr, CLOCK_MONOTONIC) == 0);
+        assert_se(pthread_cond_init(&c.cond, &attr) == 0);
+        assert_se(pthread_condattr_destroy(&attr) == 0);
+
+        sd_bus_ref(bus);
+        bus_lock(bus);
+
+        r = hashmap_ensure_allocated(&bus->thread_calls, &uint64_hash_ops);
+        if (r < 0)
+                goto finish;
+
+        r = bus_seal_message(bus, m, usec);
+        if (r < 0)
+                goto finish;
+
+        r = bus_send_unlocked(bus, &m, &c.cookie, true);
+        if (r < 0)
+                goto finish;
+
+        r = hashmap_put(bus->thread_calls, &c.cookie, &c);
+        if (r < 0)
+                goto finish;
+
+        timeout = calc_elapse(m->timeout);
+
+        while (!c.done) {
+                struct timespec ts;
+
+                if (timeout == 0) {
+                        assert_se(pthread_cond_wait(&c.cond, &bus->lock) == 0);
+                        continue;
+                }
+
+                r = pthread_cond_timedwait(&c.cond, &bus->lock, timespec_store(&ts, timeout));
+                if (r == ETIMEDOUT && !c.done) {
+                        assert_se(hashmap_remove(bus->thread_calls, &c.cookie) == &c);
+                        r = -ETIMEDOUT;
+                        goto finish;
+                }
+                assert(r == 0 || r == ETIMEDOUT);
+        }
+
+        r = c.error;
+        incoming = c.reply;
+
+finish:
+        bus_unlock(bus);
+        sd_bus_unref(bus);
+        assert_se(pthread_cond_destroy(&c.cond) == 0);
+
+        if (r < 0)
+                return sd_bus_error_set_errno(error, r);
+
+        if (incoming->header->type == SD_BUS_MESSAGE_METHOD_ERROR)
+                return sd_bus_error_copy(error, &incoming->error);
+
+        if (incoming->header->type != SD_BUS_MESSAGE_METHOD_RETURN)
+                return sd_bus_error_set_errno(error, -EIO);
+
+        if (incoming->n_fds > 0 && !(bus->hello_flags & KDBUS_HELLO_ACCEPT_FD))
+                return sd_bus_error_setf(error, SD_BUS_ERROR_INCONSISTENT_MESSAGE, "Reply message contained file descriptors which I couldn't accept. Sorry.");
+
+        if (reply) {
+                *reply = incoming;
+                incoming = NULL;
+        }
+
+        return 1;
+}
+
 _public_ int sd_bus_call(
                 sd_bus *bus,
                 sd_bus_message *_m,
@@ -1994,13 +2258,18 @@ _public_ int sd_bus_call(
                 goto fail;
         }
 
+        if (bus_foreign_thread(bus))
+                return bus_call_from_thread(bus, m, usec, error, reply);
+
         r = bus_ensure_running(bus);
         if (r < 0)
                 goto fail;
 
         i = bus->rqueue_size;
 
+        bus_lock(bus);
         r = bus_seal_message(bus, m, usec);
+        bus_unlock(bus);
         if (r < 0)
                 goto fail;
 
@@ -2312,6 +2581,25 @@ static int process_reply(sd_bus *bus, sd_bus_message *m) {
         if (m->destination && bus->unique_name && !streq_ptr(m->destination, bus->unique_name))
                 return 0;
 
+        if (bus->thread_safe) {
+                struct thread_call *t;
+
+                /* Hand replies to calls made from other threads
+                 * over to them */
+
+                bus_lock(bus);
+                t = hashmap_remove(bus->thread_calls, &m->reply_cookie);
+                if (t) {
+                        t->reply = sd_bus_message_ref(m);
+                        t->done = true;
+                        assert_se(pthread_cond_signal(&t->cond) == 0);
+                }
+                bus_unlock(bus);
+
+                if (t)
+                        return 1;
+        }
+
         c = ordered_hashmap_remove(bus->reply_callbacks, &m->reply_cookie);
         if (!c)
                 return 0;
@@ -2642,6 +2930,10 @@ static int process_closing(sd_bus *bus, sd_bus_message **ret) {
         assert(bus);
         assert(bus->state == BUS_CLOSING);
 
+        bus_lock(bus);
+        bus_fail_thread_calls(bus, -ECONNRESET);
+        bus_unlock(bus);
+
         c = ordered_hashmap_first(bus->reply_callbacks);
         if (c) {
                 _cleanup_bus_error_free_ sd_bus_error error_buffer = SD_BUS_ERROR_NULL;
@@ -23,16 +23,26 @@
 
 #include "def.h"
 #include "util.h"
+#include "strv.h"
 #include "time-util.h"
+#include "process-util.h"
 
 #include "sd-bus.h"
 #include "bus-kernel.h"
 #include "bus-internal.h"
+#include "bus-message.h"
 #include "bus-util.h"
+#include "bus-proxyd/proxy.h"
 
 #define MAX_SIZE (2*1024*1024)
 
+/* Parameters of the latency, fanout, objects and proxy modes */
+#define PIPELINE_DEPTH 64
+#define N_SUBSCRIBERS 8
+#define N_OBJECTS 256
+
 static usec_t arg_loop_usec = 100 * USEC_PER_MSEC;
+static bool arg_json = false;
 
 typedef enum Type {
         TYPE_KDBUS,
@@ -40,6 +50,114 @@ typedef enum Type {
         TYPE_DIRECT,
 } Type;
 
+static const char *type_to_string(Type type) {
+        switch (type) {
+        case TYPE_KDBUS:
+                return "kdbus";
+        case TYPE_LEGACY:
+                return "legacy";
+        case TYPE_DIRECT:
+                return "direct";
+        }
+
+        return NULL;
+}
+
+/* One result per line, either tab separated or as a JSON object, so
+ * that runs can be compared by scripts to catch regressions */
+static void print_header(void) {
+        if (!arg_json)
+                printf("TEST\tTRANSPORT\tPARAM\tMETRIC\tVALUE\n");
+}
+
+static void print_result(const char *test, const char *transport, size_t param, const char *metric, double value) {
+        if (arg_json)
+                printf("{ \"test\" : \"%s\", \"transport\" : \"%s\", \"param\" : %zu, \"metric\" : \"%s\", \"value\" : %.3f }\n",
+                       test, transport, param, metric, value);
+        else
+                printf("%s\t%s\t%zu\t%s\t%.3f\n", test, transport, param, metric, value);
+
+        fflush(stdout);
+}
+
+static double per_sec(unsigned n, usec_t usec) {
+        return (double) n * USEC_PER_SEC / usec;
+}
+
+static int property_get_number(
+                sd_bus *bus,
+                const char *path,
+                const char *interface,
+                const char *property,
+                sd_bus_message *reply,
+                void *userdata,
+                sd_bus_error *error) {
+
+        return sd_bus_message_append(reply, "u", (uint32_t) strlen(property));
+}
+
+static int property_get_string(
+                sd_bus *bus,
+                const char *path,
+                const char *interface,
+                const char *property,
+                sd_bus_message *reply,
+                void *userdata,
+                sd_bus_error *error) {
+
+        return sd_bus_message_append(reply, "s", path);
+}
+
+#define BENCHMARK_PROPERTIES(n)                                         \
+        SD_BUS_PROPERTY("Number" #n, "u", property_get_number, 0, SD_BUS_VTABLE_PROPERTY_CONST), \
+        SD_BUS_PROPERTY("String" #n, "s", property_get_string, 0, SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE)
+
+static const sd_bus_vtable object_vtable[] = {
+        SD_BUS_VTABLE_START(0),
+        BENCHMARK_PROPERTIES(0),
+        BENCHMARK_PROPERTIES(1),
+        BENCHMARK_PROPERTIES(2),
+        BENCHMARK_PROPERTIES(3),
+        BENCHMARK_PROPERTIES(4),
+        BENCHMARK_PROPERTIES(5),
+        BENCHMARK_PROPERTIES(6),
+        BENCHMARK_PROPERTIES(7),
+        SD_BUS_VTABLE_END
+};
+
+static int object_find(sd_bus *bus, const char *path, const char *interface, void *userdata, void **found, sd_bus_error *error) {
+        const char *e;
+        unsigned n;
+
+        e = startswith(path, "/bench/");
+        if (!e)
+                return 0;
+
+        if (safe_atou(e, &n) < 0 || n >= N_OBJECTS)
+                return 0;
+
+        *found = NULL;
+        return 1;
+}
+
+static int object_enumerate(sd_bus *bus, const char *prefix, void *userdata, char ***nodes, sd_bus_error *error) {
+        _cleanup_strv_free_ char **l = NULL;
+        unsigned i;
+
+        l = new0(char*, N_OBJECTS + 1);
+        if (!l)
+                return -ENOMEM;
+
+        for (i = 0; i < N_OBJECTS; i++)
+                if (asprintf(&l[i], "/bench/%u", i) < 0)
+                        return -ENOMEM;
+
+        *nodes = l;
+        l = NULL;
+
+        return 0;
+}
+
 static void server(sd_bus *b, size_t *result) {
         int r;
 
@@ -240,10 +358,352 @@ static void client_chart(Type type, const char *address, const char *server_name
         sd_bus_unref(b);
 }
 
+static sd_bus *client_connect(const char *address, int fd, bool bus_client) {
+        sd_bus *b;
+
+        assert_se(sd_bus_new(&b) >= 0);
+
+        if (address)
+                assert_se(sd_bus_set_address(b, address) >= 0);
+        else
+                assert_se(sd_bus_set_fd(b, fd, fd) >= 0);
+
+        assert_se(sd_bus_set_bus_client(b, bus_client) >= 0);
+
+        assert_se(sd_bus_start(b) >= 0);
+
+        return b;
+}
+
+static void client_exit(sd_bus *b, const char *server_name) {
+        _cleanup_bus_message_unref_ sd_bus_message *x = NULL;
+
+        assert_se(sd_bus_message_new_method_call(b, &x, server_name, "/", "benchmark.server", "Exit") >= 0);
+        assert_se(sd_bus_message_append(x, "t", (uint64_t) 0) >= 0);
+        assert_se(sd_bus_send(b, x, NULL) >= 0);
+        assert_se(sd_bus_flush(b) >= 0);
+}
+
+static usec_t measure_ping(sd_bus *b, const char *server_name, unsigned *ret) {
+        usec_t t, n;
+        unsigned i;
+
+        t = now(CLOCK_MONOTONIC);
+        for (i = 0;; i++) {
+                assert_se(sd_bus_call_method(b, server_name, "/", "benchmark.server", "Ping", NULL, NULL, NULL) >= 0);
+
+                n = now(CLOCK_MONOTONIC);
+                if (n >= t + arg_loop_usec)
+                        break;
+        }
+
+        *ret = i + 1;
+        return n - t;
+}
+
+static int pipeline_reply(sd_bus_message *m, void *userdata, sd_bus_error *error) {
+        unsigned *pending = userdata;
+
+        assert_se(!sd_bus_message_is_method_error(m, NULL));
+
+        (*pending)--;
+        return 0;
+}
+
+static void client_latency(Type type, const char *address, const char *server_name, int fd) {
+        const char *transport = type_to_string(type);
+        unsigned n_calls, pending = 0;
+        size_t csize;
+        usec_t t, n;
+        sd_bus *b;
+
+        b = client_connect(address, fd, type != TYPE_DIRECT);
+
+        /* Synchronous round trips, one call at a time */
+        t = measure_ping(b, server_name, &n_calls);
+        print_result("latency", transport, 0, "calls-per-sec", per_sec(n_calls, t));
+        print_result("latency", transport, 0, "usec-per-call", (double) t / n_calls);
+
+        /* Keep a number of calls in flight, which is what busy
+         * services see */
+        t = now(CLOCK_MONOTONIC);
+        for (n_calls = 0;;) {
+                while (pending < PIPELINE_DEPTH) {
+                        assert_se(sd_bus_call_method_async(b, NULL, server_name, "/", "benchmark.server", "Ping", pipeline_reply, &pending, NULL) >= 0);
+                        pending++;
+                        n_calls++;
+                }
+
+                while (sd_bus_process(b, NULL) > 0)
+                        ;
+
+                n = now(CLOCK_MONOTONIC);
+                if (n >= t + arg_loop_usec)
+                        break;
+
+                if (pending >= PIPELINE_DEPTH)
+                        assert_se(sd_bus_wait(b, USEC_INFINITY) >= 0);
+        }
+
+        while (pending > 0) {
+                int r;
+
+                r = sd_bus_process(b, NULL);
+                assert_se(r >= 0);
+
+                if (r == 0)
+                        assert_se(sd_bus_wait(b, USEC_INFINITY) >= 0);
+        }
+
+        n = now(CLOCK_MONOTONIC);
+        print_result("pipelined", transport, PIPELINE_DEPTH, "calls-per-sec", per_sec(n_calls, n - t));
+
+        /* Throughput of method calls with a payload */
+        for (csize = 4096; csize <= MAX_SIZE; csize *= 16) {
+                t = now(CLOCK_MONOTONIC);
+                for (n_calls = 0;; n_calls++) {
+                        transaction(b, csize, server_name);
+
+                        n = now(CLOCK_MONOTONIC);
+                        if (n >= t + arg_loop_usec)
+                                break;
+                }
+
+                n_calls++;
+                print_result("throughput", transport, csize, "calls-per-sec", per_sec(n_calls, n - t));
+                print_result("throughput", transport, csize, "mbytes-per-sec", per_sec(n_calls, n - t) * csize / (1024 * 1024));
+        }
+
+        client_exit(b, server_name);
+        sd_bus_unref(b);
+}
+
+static void measure_call(sd_bus *b, const char *server_name, const char *test, const char *transport,
+                         const char *path, const char *interface, const char *member, const char *types, ...) {
+        usec_t t, n;
+        unsigned i;
+
+        t = now(CLOCK_MONOTONIC);
+        for (i = 0;; i++) {
+                _cleanup_bus_message_unref_ sd_bus_message *m = NULL, *reply = NULL;
+                va_list ap;
+
+                assert_se(sd_bus_message_new_method_call(b, &m, server_name, path, interface, member) >= 0);
+
+                if (types) {
+                        va_start(ap, types);
+                        assert_se(bus_message_append_ap(m, types, ap) >= 0);
+                        va_end(ap);
+                }
+
+                assert_se(sd_bus_call(b, m, 0, NULL, &reply) >= 0);
+
+                n = now(CLOCK_MONOTONIC);
+                if (n >= t + arg_loop_usec)
+                        break;
+        }
+
+        print_result(test, transport, N_OBJECTS, "calls-per-sec", per_sec(i + 1, n - t));
+}
+
+static void client_objects(Type type, const char *address, const char *server_name, int fd) {
+        const char *transport = type_to_string(type);
+        sd_bus *b;
+
+        b = client_connect(address, fd, type != TYPE_DIRECT);
+
+        assert_se(sd_bus_call_method(b, server_name, "/", "benchmark.server", "Ping", NULL, NULL, NULL) >= 0);
+
+        measure_call(b, server_name, "get", transport,
+                     "/bench/0", "org.freedesktop.DBus.Properties", "Get", "ss", "benchmark.object", "String7");
+        measure_call(b, server_name, "getall", transport,
+                     "/bench/0", "org.freedesktop.DBus.Properties", "GetAll", "s", "benchmark.object");
+        measure_call(b, server_name, "getmanagedobjects", transport,
+                     "/bench", "org.freedesktop.DBus.ObjectManager", "GetManagedObjects", NULL);
+
+        client_exit(b, server_name);
+        sd_bus_unref(b);
+}
+
+static void client_proxy(Type type, const char *address, const char *server_name) {
+        const char *transport = type_to_string(type);
+        _cleanup_close_pair_ int pair[2] = { -1, -1 };
+        unsigned n_direct, n_proxied;
+        usec_t t_direct, t_proxied;
+        sd_bus *b, *c;
+        pid_t pid;
+
+        b = client_connect(address, -1, true);
+
+        t_direct = measure_ping(b, server_name, &n_direct);
+        print_result("proxy", transport, 0, "direct-usec-per-call", (double) t_direct / n_direct);
+
+        /* Run the same round trips through a bus proxy, as
+         * systemd-stdio-bridge would set one up */
+        assert_se(socketpair(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0, pair) >= 0);
+
+        pid = fork();
+        assert_se(pid >= 0);
+
+        if (pid == 0) {
+                _cleanup_(proxy_freep) Proxy *p = NULL;
+
+                safe_close(pair[0]);
+                sd_bus_unref(b);
+
+                assert_se(proxy_new(&p, pair[1], pair[1], address) >= 0);
+                _exit(proxy_run(p) < 0 ? EXIT_FAILURE : EXIT_SUCCESS);
+        }
+
+        pair[1] = safe_close(pair[1]);
+
+        c = client_connect(NULL, pair[0], true);
+        pair[0] = -1;
+
+        t_proxied = measure_ping(c, server_name, &n_proxied);
+        print_result("proxy", transport, 0, "proxied-usec-per-call", (double) t_proxied / n_proxied);
+        print_result("proxy", transport, 0, "overhead-percent",
+                     100.0 * ((double) t_proxied / n_proxied - (double) t_direct / n_direct) / ((double) t_direct / n_direct));
+
+        sd_bus_flush_close_unref(c);
+        assert_se(wait_for_terminate_and_warn("proxy", pid, true) == EXIT_SUCCESS);
+
+        client_exit(b, server_name);
+        sd_bus_unref(b);
+}
+
+static int subscriber_signal(sd_bus_message *m, void *userdata, sd_bus_error *error) {
+        unsigned *n = userdata;
+
+        if (sd_bus_message_is_signal(m, "benchmark.server", "Tick"))
+                (*n)++;
+        else if (sd_bus_message_is_signal(m, "benchmark.server", "Stop")) {
+                assert_se(sd_bus_call_method(sd_bus_message_get_bus(m), sd_bus_message_get_sender(m), "/", "benchmark.server", "Done", NULL, NULL, "u", *n) >= 0);
+                _exit(EXIT_SUCCESS);
+        }
+
+        return 0;
+}
+
+static void subscriber(const char *address, const char *server_name) {
+        _cleanup_free_ char *match = NULL;
+        unsigned n = 0;
+        sd_bus *b;
+
+        b = client_connect(address, -1, true);
+
+        match = strjoin("type='signal',sender='", server_name, "',interface='benchmark.server'", NULL);
+        assert_se(match);
+
+        assert_se(sd_bus_add_match(b, NULL, match, subscriber_signal, &n) >= 0);
+        assert_se(sd_bus_call_method(b, server_name, "/", "benchmark.server", "Ready", NULL, NULL, NULL) >= 0);
+
+        for (;;) {
+                int r;
+
+                r = sd_bus_process(b, NULL);
+                assert_se(r >= 0);
+
+                if (r == 0)
+                        assert_se(sd_bus_wait(b, USEC_INFINITY) >= 0);
+        }
+}
+
+static void client_fanout(const char *address, const char *server_name) {
+        pid_t pids[N_SUBSCRIBERS];
+        unsigned i;
+
+        for (i = 0; i < N_SUBSCRIBERS; i++) {
+                pids[i] = fork();
+                assert_se(pids[i] >= 0);
+
+                if (pids[i] == 0) {
+                        subscriber(address, server_name);
+                        _exit(EXIT_FAILURE);
+                }
+        }
+
+        for (i = 0; i < N_SUBSCRIBERS; i++)
+                assert_se(wait_for_terminate_and_warn("subscriber", pids[i], true) == EXIT_SUCCESS);
+}
+
+static sd_bus_message *server_next(sd_bus *b) {
+        for (;;) {
+                sd_bus_message *m = NULL;
+                int r;
+
+                r = sd_bus_process(b, &m);
+                assert_se(r >= 0);
+
+                if (m)
+                        return m;
+
+                if (r == 0)
+                        assert_se(sd_bus_wait(b, USEC_INFINITY) >= 0);
+        }
+}
+
+static void server_fanout(Type type, sd_bus *b) {
+        unsigned n_ready = 0, n_done = 0, n_sent, n_received = 0;
+        usec_t t, n;
+
+        /* Wait until all subscribers installed their matches */
+        while (n_ready < N_SUBSCRIBERS) {
+                _cleanup_bus_message_unref_ sd_bus_message *m = NULL;
+
+                m = server_next(b);
+                if (sd_bus_message_is_method_call(m, "benchmark.server", "Ready")) {
+                        assert_se(sd_bus_reply_method_return(m, NULL) >= 0);
+                        n_ready++;
+                }
+        }
+
+        t = now(CLOCK_MONOTONIC);
+        for (n_sent = 0; now(CLOCK_MONOTONIC) < t + arg_loop_usec; n_sent++) {
+                int r;
+
+                r = sd_bus_emit_signal(b, "/", "benchmark.server", "Tick", "u", n_sent);
+                if (r == -ENOBUFS) {
+                        /* Our write queue is full, let the bus catch up */
+                        assert_se(sd_bus_flush(b) >= 0);
+                        r = sd_bus_emit_signal(b, "/", "benchmark.server", "Tick", "u", n_sent);
+                }
+                assert_se(r >= 0);
+        }
+
+        assert_se(sd_bus_emit_signal(b, "/", "benchmark.server", "Stop", NULL) >= 0);
+
+        /* Wait until everything has been delivered everywhere */
+        while (n_done < N_SUBSCRIBERS) {
+                _cleanup_bus_message_unref_ sd_bus_message *m = NULL;
+                unsigned k;
+
+                m = server_next(b);
+                if (!sd_bus_message_is_method_call(m, "benchmark.server", "Done"))
+                        continue;
+
+                assert_se(sd_bus_message_read(m, "u", &k) > 0);
+                assert_se(sd_bus_reply_method_return(m, NULL) >= 0);
+
+                n_received += k;
+                n_done++;
+        }
+
+        n = now(CLOCK_MONOTONIC);
+
+        print_result("fanout", type_to_string(type), N_SUBSCRIBERS, "signals-per-sec", per_sec(n_sent, n - t));
+        print_result("fanout", type_to_string(type), N_SUBSCRIBERS, "deliveries-per-sec", per_sec(n_received, n - t));
+        print_result("fanout", type_to_string(type), N_SUBSCRIBERS, "lost", (double) n_sent * N_SUBSCRIBERS - n_received);
+}
+
 int main(int argc, char *argv[]) {
         enum {
                 MODE_BISECT,
                 MODE_CHART,
+                MODE_LATENCY,
+                MODE_FANOUT,
+                MODE_OBJECTS,
+                MODE_PROXY,
         } mode = MODE_BISECT;
         Type type = TYPE_KDBUS;
         int i, pair[2] = { -1, -1 };
@@ -266,6 +726,21 @@ int main(int argc, char *argv[]) {
                 } else if (streq(argv[i], "direct")) {
                         type = TYPE_DIRECT;
                         continue;
+                } else if (streq(argv[i], "latency")) {
+                        mode = MODE_LATENCY;
+                        continue;
+                } else if (streq(argv[i], "fanout")) {
+                        mode = MODE_FANOUT;
+                        continue;
+                } else if (streq(argv[i], "objects")) {
+                        mode = MODE_OBJECTS;
+                        continue;
+                } else if (streq(argv[i], "proxy")) {
+                        mode = MODE_PROXY;
+                        continue;
+                } else if (streq(argv[i], "json")) {
+                        arg_json = true;
+                        continue;
                 }
 
                 assert_se(parse_sec(argv[i], &arg_loop_usec) >= 0);
@@ -275,6 +750,12 @@ int main(int argc, char *argv[]) {
 
         assert_se(arg_loop_usec > 0);
 
+        /* Fan-out and proxying need a real bus to connect to */
+        if (IN_SET(mode, MODE_FANOUT, MODE_PROXY) && type == TYPE_DIRECT) {
+                log_error("The fanout and proxy benchmarks cannot be run on a direct connection.");
+                return EXIT_FAILURE;
+        }
+
         if (type == TYPE_KDBUS) {
                 assert_se(asprintf(&name, "deine-mutter-%u", (unsigned) getpid()) >= 0);
 
@@ -326,6 +807,18 @@ int main(int argc, char *argv[]) {
                 assert_se(server_name);
         }
 
+        if (mode == MODE_OBJECTS) {
+                assert_se(sd_bus_add_fallback_vtable(b, NULL, "/bench", "benchmark.object", object_vtable, object_find, NULL) >= 0);
+                assert_se(sd_bus_add_node_enumerator(b, NULL, "/bench", object_enumerate, NULL) >= 0);
+                assert_se(sd_bus_add_object_manager(b, NULL, "/bench") >= 0);
+        }
+
+        if (!IN_SET(mode, MODE_BISECT, MODE_CHART))
+                print_header();
+
+        /* Don't let the children write out our buffered output again */
+        fflush(stdout);
+
         sync();
         setpriority(PRIO_PROCESS, 0, -19);
 
@@ -348,8 +841,25 @@ int main(int argc, char *argv[]) {
                 case MODE_CHART:
                         client_chart(type, address, server_name, pair[1]);
                         break;
+
+                case MODE_LATENCY:
+                        client_latency(type, address, server_name, pair[1]);
+                        break;
+
+                case MODE_FANOUT:
+                        client_fanout(address, server_name);
+                        break;
+
+                case MODE_OBJECTS:
+                        client_objects(type, address, server_name, pair[1]);
+                        break;
+
+                case MODE_PROXY:
+                        client_proxy(type, address, server_name);
+                        break;
                 }
 
+                fflush(stdout);
                 _exit(0);
         }
 
@@ -357,7 +867,10 @@ int main(int argc, char *argv[]) {
         CPU_SET(1, &cpuset);
         pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
 
-        server(b, &result);
+        if (mode == MODE_FANOUT)
+                server_fanout(type, b);
+        else
+                server(b, &result);
 
         if (mode == MODE_BISECT)
                 printf("Copying/memfd are equally fast at %zu bytes\n", result);
@@ -59,7 +59,7 @@ static void test_bus_new_method_call(void) {
         printf("after message_new_method_call: refcount %u\n", REFCNT_GET(bus->n_ref));
 
         sd_bus_unref(bus);
-        printf("after bus_unref: refcount %u\n", m->n_ref);
+        printf("after bus_unref: refcount %u\n", REFCNT_GET(m->n_ref));
 }
 
 static void test_bus_new_signal(void) {
@@ -73,7 +73,7 @@ static void test_bus_new_signal(void) {
         printf("after message_new_signal: refcount %u\n", REFCNT_GET(bus->n_ref));
 
         sd_bus_unref(bus);
-        printf("after bus_unref: refcount %u\n", m->n_ref);
+        printf("after bus_unref: refcount %u\n", REFCNT_GET(m->n_ref));
 }
 
 int main(int argc, char **argv) {
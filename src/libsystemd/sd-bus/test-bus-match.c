@@ -21,6 +21,7 @@
 
 #include "log.h"
 #include "macro.h"
+#include "time-util.h"
 
 #include "bus-match.h"
 #include "bus-message.h"
@@ -77,6 +78,70 @@ static int match_add(sd_bus_slot *slots, struct bus_match_node *root, const char
         return r;
 }
 
+static unsigned n_counted;
+
+static int count_filter(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
+        n_counted++;
+        return 0;
+}
+
+#define N_BENCHMARK_MATCHES 1000
+#define N_BENCHMARK_RUNS 10000
+
+static void test_match_benchmark(sd_bus *bus) {
+        struct bus_match_node root = {
+                .type = BUS_MATCH_ROOT,
+        };
+        _cleanup_bus_message_unref_ sd_bus_message *m = NULL;
+        _cleanup_free_ sd_bus_slot *slots = NULL;
+        char ts[FORMAT_TIMESPAN_MAX];
+        usec_t t;
+        unsigned i;
+
+        /* Lots of namespace matches, the way bus proxies and
+         * monitors install them, only few of which apply */
+
+        slots = new0(sd_bus_slot, N_BENCHMARK_MATCHES * 2);
+        assert_se(slots);
+
+        for (i = 0; i < N_BENCHMARK_MATCHES * 2; i++) {
+                struct bus_match_component *components = NULL;
+                unsigned n_components = 0;
+                _cleanup_free_ char *match = NULL;
+
+                if (i < N_BENCHMARK_MATCHES)
+                        assert_se(asprintf(&match, "type='signal',path_namespace='/org/example/%u'", i) >= 0);
+                else
+                        assert_se(asprintf(&match, "type='signal',arg0namespace='org.example%u'", i - N_BENCHMARK_MATCHES) >= 0);
+
+                assert_se(bus_match_parse(match, &components, &n_components) >= 0);
+                slots[i].match_callback.callback = count_filter;
+                assert_se(bus_match_add(&root, components, n_components, &slots[i].match_callback) >= 0);
+                bus_match_parse_free(components, n_components);
+        }
+
+        assert_se(sd_bus_message_new_signal(bus, &m, "/org/example/500/sub", "org.example.Foo", "Bar") >= 0);
+        assert_se(sd_bus_message_append(m, "s", "org.example500.Waldo") >= 0);
+        assert_se(bus_message_seal(m, 1, 0) >= 0);
+
+        n_counted = 0;
+        t = now(CLOCK_MONOTONIC);
+        for (i = 0; i < N_BENCHMARK_RUNS; i++)
+                assert_se(bus_match_run(NULL, &root, m) == 0);
+        t = now(CLOCK_MONOTONIC) - t;
+
+        assert_se(n_counted == N_BENCHMARK_RUNS * 2);
+
+        log_info("%u runs against %u namespace matches took %s",
+                 N_BENCHMARK_RUNS, N_BENCHMARK_MATCHES * 2,
+                 format_timespan(ts, sizeof(ts), t, 1));
+
+        for (i = 0; i < N_BENCHMARK_MATCHES * 2; i++)
+                assert_se(bus_match_remove(&root, &slots[i].match_callback) >= 0);
+
+        bus_match_free(&root);
+}
+
 static void test_match_scope(const char *match, enum bus_match_scope scope) {
         struct bus_match_component *components = NULL;
         unsigned n_components = 0;
@@ -151,6 +216,8 @@ int main(int argc, char *argv[]) {
 
         bus_match_free(&root);
 
+        test_match_benchmark(bus);
+
         test_match_scope("interface='foobar'", BUS_MATCH_GENERIC);
         test_match_scope("", BUS_MATCH_GENERIC);
         test_match_scope("interface='org.freedesktop.DBus.Local'", BUS_MATCH_LOCAL);
@@ -28,8 +28,11 @@
 
 #include "sd-bus.h"
 #include "bus-internal.h"
+#include "bus-message.h"
 #include "bus-util.h"
 
+#define BLOB_SIZE (1024*1024)
+
 struct context {
         int fds[2];
 
@@ -92,6 +95,28 @@ static void *server(void *p) {
 
                         quit = true;
 
+                } else if (sd_bus_message_is_method_call(m, "org.freedesktop.systemd.test", "Echo")) {
+                        const void *p;
+                        size_t sz;
+
+                        /* Large bodies are passed as memfd if both sides can pass fds */
+                        assert_se((m->body.memfd >= 0) == (c->server_negotiate_unix_fds && c->client_negotiate_unix_fds));
+
+                        assert_se(sd_bus_message_read_array(m, 'y', &p, &sz) >= 0);
+                        assert_se(sz == BLOB_SIZE);
+
+                        r = sd_bus_message_new_method_return(m, &reply);
+                        if (r < 0) {
+                                log_error_errno(r, "Failed to allocate return: %m");
+                                goto fail;
+                        }
+
+                        r = sd_bus_message_append_array(reply, 'y', p, sz);
+                        if (r < 0) {
+                                log_error_errno(r, "Failed to append array: %m");
+                                goto fail;
+                        }
+
                 } else if (sd_bus_message_is_method_call(m, NULL, NULL)) {
                         r = sd_bus_message_new_method_error(
                                         m,
@@ -123,6 +148,48 @@ fail:
         return INT_TO_PTR(r);
 }
 
+static int client_echo(struct context *c, sd_bus *bus) {
+        _cleanup_bus_message_unref_ sd_bus_message *m = NULL, *reply = NULL;
+        _cleanup_bus_error_free_ sd_bus_error error = SD_BUS_ERROR_NULL;
+        _cleanup_free_ uint8_t *blob = NULL;
+        const void *p;
+        size_t sz, i;
+        int r;
+
+        blob = new(uint8_t, BLOB_SIZE);
+        assert_se(blob);
+        for (i = 0; i < BLOB_SIZE; i++)
+                blob[i] = (uint8_t) (i * 7);
+
+        r = sd_bus_message_new_method_call(
+                        bus,
+                        &m,
+                        "org.freedesktop.systemd.test",
+                        "/",
+                        "org.freedesktop.systemd.test",
+                        "Echo");
+        if (r < 0)
+                return log_error_errno(r, "Failed to allocate method call: %m");
+
+        r = sd_bus_message_append_array(m, 'y', blob, BLOB_SIZE);
+        if (r < 0)
+                return log_error_errno(r, "Failed to append array: %m");
+
+        r = sd_bus_call(bus, m, 0, &error, &reply);
+        if (r < 0) {
+                log_error("Failed to issue method call: %s", bus_error_message(&error, -r));
+                return r;
+        }
+
+        assert_se((reply->body.memfd >= 0) == (c->server_negotiate_unix_fds && c->client_negotiate_unix_fds));
+
+        assert_se(sd_bus_message_read_array(reply, 'y', &p, &sz) >= 0);
+        assert_se(sz == BLOB_SIZE);
+        assert_se(memcmp(p, blob, BLOB_SIZE) == 0);
+
+        return 0;
+}
+
 static int client(struct context *c) {
         _cleanup_bus_message_unref_ sd_bus_message *m = NULL, *reply = NULL;
         _cleanup_bus_unref_ sd_bus *bus = NULL;
@@ -135,6 +202,10 @@ static int client(struct context *c) {
         assert_se(sd_bus_set_anonymous(bus, c->client_anonymous_auth) >= 0);
         assert_se(sd_bus_start(bus) >= 0);
 
+        r = client_echo(c, bus);
+        if (r < 0)
+                return r;
+
         r = sd_bus_message_new_method_call(
                         bus,
                         &m,
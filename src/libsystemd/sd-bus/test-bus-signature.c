@@ -25,6 +25,7 @@
 #include "bus-internal.h"
 
 int main(int argc, char *argv[]) {
+        const BusSignaturePlan *plan;
         char prefix[256];
         int r;
 
@@ -138,6 +139,31 @@ int main(int argc, char *argv[]) {
         assert_se(!object_path_is_valid("/foo//bar"));
         assert_se(!object_path_is_valid("/foo/aaaäöä"));
 
+        plan = bus_signature_plan_get("sa(ssou)a{sv}t");
+        assert_se(plan);
+        assert_se(streq(plan->signature, "sa(ssou)a{sv}t"));
+        assert_se(bus_signature_plan_get("sa(ssou)a{sv}t") == plan);
+        assert_se(plan->elements[0].length == 1);
+        assert_se(!plan->elements[0].contents);
+        assert_se(plan->elements[1].length == 7);
+        assert_se(streq(plan->elements[1].contents, "(ssou)"));
+        assert_se(!plan->elements[1].contents_fixed);
+        assert_se(plan->elements[2].length == 6);
+        assert_se(streq(plan->elements[2].contents, "ssou"));
+        assert_se(plan->elements[2].contents_alignment == 4);
+        assert_se(plan->elements[6].size == 4);
+        assert_se(streq(plan->elements[9].contents, "sv"));
+        assert_se(plan->elements[13].size == 8);
+        assert_se(plan->elements[13].alignment == 8);
+        assert_se(!bus_signature_plan_get("a{vs}"));
+        assert_se(!bus_signature_plan_get("(s"));
+
+        plan = bus_signature_plan_get("a(yt)");
+        assert_se(plan);
+        assert_se(plan->elements[0].contents_fixed);
+        assert_se(plan->elements[0].contents_size == 16);
+        assert_se(plan->elements[0].contents_alignment == 8);
+
         OBJECT_PATH_FOREACH_PREFIX(prefix, "/") {
                 log_info("<%s>", prefix);
                 assert_not_reached("???");
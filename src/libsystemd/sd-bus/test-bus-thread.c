@@ -0,0 +1,189 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "log.h"
+#include "util.h"
+#include "macro.h"
+
+#include "sd-bus.h"
+#include "bus-internal.h"
+#include "bus-util.h"
+
+#define N_WORKERS 8
+#define N_CALLS 500
+
+struct context {
+        int fds[2];
+        sd_bus *client;
+        unsigned n_started;
+        unsigned n_done;
+};
+
+static void *server(void *p) {
+        struct context *c = p;
+        sd_bus *bus = NULL;
+        sd_id128_t id;
+        bool quit = false;
+        int r;
+
+        assert_se(sd_id128_randomize(&id) >= 0);
+
+        assert_se(sd_bus_new(&bus) >= 0);
+        assert_se(sd_bus_set_fd(bus, c->fds[0], c->fds[0]) >= 0);
+        assert_se(sd_bus_set_server(bus, 1, id) >= 0);
+        assert_se(sd_bus_start(bus) >= 0);
+
+        while (!quit) {
+                _cleanup_bus_message_unref_ sd_bus_message *m = NULL;
+                uint32_t u;
+
+                r = sd_bus_process(bus, &m);
+                if (r < 0) {
+                        log_error_errno(r, "Failed to process requests: %m");
+                        goto fail;
+                }
+
+                if (r == 0) {
+                        r = sd_bus_wait(bus, (uint64_t) -1);
+                        if (r < 0) {
+                                log_error_errno(r, "Failed to wait: %m");
+                                goto fail;
+                        }
+
+                        continue;
+                }
+
+                if (!m)
+                        continue;
+
+                if (sd_bus_message_is_method_call(m, "org.freedesktop.systemd.test", "Echo")) {
+                        assert_se(sd_bus_message_read(m, "u", &u) >= 0);
+                        r = sd_bus_reply_method_return(m, "u", u);
+                } else if (sd_bus_message_is_method_call(m, "org.freedesktop.systemd.test", "Exit")) {
+                        r = sd_bus_reply_method_return(m, NULL);
+                        quit = true;
+                } else if (sd_bus_message_is_method_call(m, NULL, NULL))
+                        r = sd_bus_reply_method_errorf(m, SD_BUS_ERROR_UNKNOWN_METHOD, "Unknown method.");
+                else
+                        continue;
+
+                if (r < 0) {
+                        log_error_errno(r, "Failed to send reply: %m");
+                        goto fail;
+                }
+        }
+
+        r = 0;
+
+fail:
+        if (bus) {
+                sd_bus_flush(bus);
+                sd_bus_unref(bus);
+        }
+
+        return INT_TO_PTR(r);
+}
+
+static int reply_handler(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
+        assert_not_reached("Asynchronous reply from worker thread");
+}
+
+static void *worker(void *p) {
+        struct context *c = p;
+        unsigned i, base;
+
+        base = __sync_fetch_and_add(&c->n_started, 1) * N_CALLS;
+
+        for (i = 0; i < N_CALLS; i++) {
+                _cleanup_bus_message_unref_ sd_bus_message *reply = NULL;
+                _cleanup_bus_error_free_ sd_bus_error error = SD_BUS_ERROR_NULL;
+                uint32_t u = base + i, v;
+
+                assert_se(sd_bus_call_method(c->client, "org.freedesktop.systemd.test", "/",
+                                             "org.freedesktop.systemd.test", "Echo",
+                                             &error, &reply, "u", u) >= 0);
+                assert_se(sd_bus_message_read(reply, "u", &v) >= 0);
+                assert_se(u == v);
+
+                assert_se(sd_bus_call_method(c->client, "org.freedesktop.systemd.test", "/",
+                                             "org.freedesktop.systemd.test", "NoSuchMethod",
+                                             &error, NULL, NULL) < 0);
+                assert_se(sd_bus_error_has_name(&error, SD_BUS_ERROR_UNKNOWN_METHOD));
+        }
+
+        /* Asynchronous calls are reserved to the owner thread */
+        assert_se(sd_bus_call_method_async(c->client, NULL, "org.freedesktop.systemd.test", "/",
+                                           "org.freedesktop.systemd.test", "Echo",
+                                           reply_handler, NULL, "u", 0) == -EPERM);
+
+        __sync_add_and_fetch(&c->n_done, 1);
+        return NULL;
+}
+
+int main(int argc, char *argv[]) {
+        struct context c = {};
+        pthread_t s, w[N_WORKERS];
+        unsigned i;
+        void *p;
+
+        log_set_max_level(LOG_INFO);
+
+        assert_se(socketpair(AF_UNIX, SOCK_STREAM, 0, c.fds) >= 0);
+
+        assert_se(pthread_create(&s, NULL, server, &c) == 0);
+
+        assert_se(sd_bus_new(&c.client) >= 0);
+        assert_se(sd_bus_set_fd(c.client, c.fds[1], c.fds[1]) >= 0);
+        assert_se(sd_bus_set_thread_safe(c.client, true) >= 0);
+        assert_se(sd_bus_is_thread_safe(c.client) > 0);
+        assert_se(sd_bus_start(c.client) >= 0);
+
+        for (i = 0; i < N_WORKERS; i++)
+                assert_se(pthread_create(&w[i], NULL, worker, &c) == 0);
+
+        /* The owner thread reads and routes the replies for the
+         * workers */
+        while (__sync_fetch_and_add(&c.n_done, 0) < N_WORKERS) {
+                int r;
+
+                r = sd_bus_process(c.client, NULL);
+                assert_se(r >= 0);
+                if (r > 0)
+                        continue;
+
+                assert_se(sd_bus_wait(c.client, 100 * USEC_PER_MSEC) >= 0);
+        }
+
+        for (i = 0; i < N_WORKERS; i++)
+                assert_se(pthread_join(w[i], NULL) == 0);
+
+        assert_se(sd_bus_call_method(c.client, "org.freedesktop.systemd.test", "/",
+                                     "org.freedesktop.systemd.test", "Exit",
+                                     NULL, NULL, NULL) >= 0);
+
+        assert_se(pthread_join(s, &p) == 0);
+        assert_se(PTR_TO_INT(p) >= 0);
+
+        sd_bus_flush_close_unref(c.client);
+
+        return EXIT_SUCCESS;
+}
@@ -0,0 +1,537 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "util.h"
+#include "fileio.h"
+#include "hashmap.h"
+#include "refcnt.h"
+#include "time-util.h"
+#include "device-db-pack.h"
+
+#define DATA_DIR "/run/udev/data"
+
+/* A file is only packed if the directory was last modified at least
+ * this long before we started to read it. Directory timestamps come
+ * from the coarse clock, so a change in the same tick as the one we
+ * recorded would otherwise go unnoticed. */
+#define RACY_NSEC (20 * NSEC_PER_MSEC)
+
+static const char signature[8] = { 'U', 'D', 'E', 'V', 'D', 'B', 'P', '1' };
+
+/*
+ * header | devices[n_devices] | tags[n_tags] | tag device indices | strings
+ *
+ * All offsets are from the beginning of the file, devices are sorted by
+ * id and tags by name, so both can be looked up with bsearch(). The data
+ * of each device is the unmodified content of its file in DATA_DIR.
+ */
+struct DeviceDBPackHeader {
+        uint8_t signature[8];
+        uint64_t data_mtime;
+        uint64_t n_devices;
+        uint64_t n_tags;
+        uint64_t devices_offset;
+        uint64_t tags_offset;
+        uint64_t size;
+};
+
+struct DeviceDBPackDevice {
+        uint64_t id_offset;
+        uint64_t data_offset;
+        uint64_t data_size;
+};
+
+struct DeviceDBPackTag {
+        uint64_t name_offset;
+        uint64_t devices_offset;
+        uint64_t n_devices;
+};
+
+struct DeviceDBPack {
+        /* shared by the devices of parallel enumerator threads */
+        RefCount n_ref;
+
+        const uint8_t *map;
+        size_t size;
+
+        const struct DeviceDBPackHeader *head;
+        const struct DeviceDBPackDevice *devices;
+        const struct DeviceDBPackTag *tags;
+};
+
+static nsec_t stat_mtime(const struct stat *st) {
+        return (nsec_t) st->st_mtim.tv_sec * NSEC_PER_SEC + (nsec_t) st->st_mtim.tv_nsec;
+}
+
+static int get_data_mtime(uint64_t *ret) {
+        struct stat st;
+
+        if (stat(DATA_DIR, &st) < 0)
+                return -errno;
+
+        *ret = stat_mtime(&st);
+
+        return 0;
+}
+
+int device_db_pack_is_current(uint64_t data_mtime) {
+        uint64_t mtime;
+        int r;
+
+        r = get_data_mtime(&mtime);
+        if (r < 0)
+                return r;
+
+        return mtime == data_mtime;
+}
+
+static bool range_valid(DeviceDBPack *pack, uint64_t offset, uint64_t n, uint64_t size) {
+        if (offset > pack->size)
+                return false;
+
+        if (size != 0 && n > (pack->size - offset) / size)
+                return false;
+
+        return true;
+}
+
+static const char *pack_string(DeviceDBPack *pack, uint64_t offset) {
+        if (offset >= pack->size)
+                return NULL;
+
+        if (!memchr(pack->map + offset, 0, pack->size - offset))
+                return NULL;
+
+        return (const char*) pack->map + offset;
+}
+
+int device_db_pack_open(DeviceDBPack **ret) {
+        _cleanup_device_db_pack_unref_ DeviceDBPack *pack = NULL;
+        _cleanup_close_ int fd = -1;
+        const struct DeviceDBPackHeader *head;
+        struct stat st;
+        void *map;
+        int r;
+
+        assert(ret);
+
+        fd = open(DEVICE_DB_PACK, O_RDONLY|O_CLOEXEC);
+        if (fd < 0)
+                return -errno;
+
+        if (fstat(fd, &st) < 0)
+                return -errno;
+
+        if ((size_t) st.st_size < sizeof(struct DeviceDBPackHeader))
+                return -EBADMSG;
+
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (map == MAP_FAILED)
+                return -errno;
+
+        pack = new0(DeviceDBPack, 1);
+        if (!pack) {
+                munmap(map, st.st_size);
+                return -ENOMEM;
+        }
+
+        pack->n_ref = REFCNT_INIT;
+        pack->map = map;
+        pack->size = st.st_size;
+
+        head = pack->head = map;
+
+        if (memcmp(head->signature, signature, sizeof(signature)) != 0 ||
+            head->size != pack->size ||
+            !range_valid(pack, head->devices_offset, head->n_devices, sizeof(struct DeviceDBPackDevice)) ||
+            !range_valid(pack, head->tags_offset, head->n_tags, sizeof(struct DeviceDBPackTag)))
+                return -EBADMSG;
+
+        pack->devices = (const struct DeviceDBPackDevice*) (pack->map + head->devices_offset);
+        pack->tags = (const struct DeviceDBPackTag*) (pack->map + head->tags_offset);
+
+        r = device_db_pack_is_current(head->data_mtime);
+        if (r < 0)
+                return r;
+        if (r == 0)
+                return -ESTALE;
+
+        *ret = pack;
+        pack = NULL;
+
+        return 0;
+}
+
+DeviceDBPack *device_db_pack_ref(DeviceDBPack *pack) {
+        if (pack)
+                assert_se(REFCNT_INC(pack->n_ref) >= 2);
+
+        return pack;
+}
+
+DeviceDBPack *device_db_pack_unref(DeviceDBPack *pack) {
+        if (pack && REFCNT_DEC(pack->n_ref) == 0) {
+                munmap((void*) pack->map, pack->size);
+                free(pack);
+        }
+
+        return NULL;
+}
+
+struct pack_key {
+        DeviceDBPack *pack;
+        const char *name;
+};
+
+static int device_compare(const void *_key, const void *_device) {
+        const struct pack_key *key = _key;
+        const struct DeviceDBPackDevice *device = _device;
+
+        return strcmp(key->name, strempty(pack_string(key->pack, device->id_offset)));
+}
+
+int device_db_pack_get(DeviceDBPack *pack, const char *id, const char **ret_data, size_t *ret_size) {
+        const struct DeviceDBPackDevice *device;
+        struct pack_key key = { pack, id };
+
+        assert(pack);
+        assert(id);
+
+        device = bsearch(&key, pack->devices, pack->head->n_devices, sizeof(struct DeviceDBPackDevice), device_compare);
+        if (!device)
+                return -ENOENT;
+
+        if (!range_valid(pack, device->data_offset, device->data_size, 1))
+                return -EBADMSG;
+
+        if (ret_data)
+                *ret_data = (const char*) pack->map + device->data_offset;
+        if (ret_size)
+                *ret_size = device->data_size;
+
+        return 0;
+}
+
+static int tag_compare(const void *_key, const void *_tag) {
+        const struct pack_key *key = _key;
+        const struct DeviceDBPackTag *tag = _tag;
+
+        return strcmp(key->name, strempty(pack_string(key->pack, tag->name_offset)));
+}
+
+int device_db_pack_get_tag(DeviceDBPack *pack, const char *name, const uint64_t **ret_devices, size_t *ret_n) {
+        const struct DeviceDBPackTag *tag;
+        struct pack_key key = { pack, name };
+
+        assert(pack);
+        assert(name);
+        assert(ret_devices);
+        assert(ret_n);
+
+        tag = bsearch(&key, pack->tags, pack->head->n_tags, sizeof(struct DeviceDBPackTag), tag_compare);
+        if (!tag) {
+                *ret_devices = NULL;
+                *ret_n = 0;
+                return 0;
+        }
+
+        if (!range_valid(pack, tag->devices_offset, tag->n_devices, sizeof(uint64_t)))
+                return -EBADMSG;
+
+        *ret_devices = (const uint64_t*) (pack->map + tag->devices_offset);
+        *ret_n = tag->n_devices;
+
+        return 0;
+}
+
+const char *device_db_pack_get_id(DeviceDBPack *pack, uint64_t device) {
+        assert(pack);
+
+        if (device >= pack->head->n_devices)
+                return NULL;
+
+        return pack_string(pack, pack->devices[device].id_offset);
+}
+
+typedef struct PackDevice {
+        char *id;
+        char *data;
+        size_t size;
+} PackDevice;
+
+typedef struct PackTag {
+        char *name;
+        uint64_t *devices;
+        size_t n_devices;
+        size_t n_allocated;
+} PackTag;
+
+static int pack_device_compare(const void *a, const void *b) {
+        return strcmp(((const PackDevice*) a)->id, ((const PackDevice*) b)->id);
+}
+
+static int pack_tag_compare(const void *a, const void *b) {
+        return strcmp((*(PackTag* const*) a)->name, (*(PackTag* const*) b)->name);
+}
+
+static int pack_add_tags(Hashmap *tags, PackDevice *device, uint64_t index) {
+        const char *p = device->data, *end = device->data + device->size;
+
+        while (p < end) {
+                const char *eol;
+                PackTag *tag;
+
+                eol = memchr(p, '\n', end - p);
+                if (!eol)
+                        eol = end;
+
+                if (eol - p > 2 && p[0] == 'G' && p[1] == ':') {
+                        _cleanup_free_ char *name = NULL;
+
+                        name = strndup(p + 2, eol - p - 2);
+                        if (!name)
+                                return -ENOMEM;
+
+                        tag = hashmap_get(tags, name);
+                        if (!tag) {
+                                int r;
+
+                                tag = new0(PackTag, 1);
+                                if (!tag)
+                                        return -ENOMEM;
+
+                                r = hashmap_put(tags, name, tag);
+                                if (r < 0) {
+                                        free(tag);
+                                        return r;
+                                }
+
+                                tag->name = name;
+                                name = NULL;
+                        }
+
+                        if (!GREEDY_REALLOC(tag->devices, tag->n_allocated, tag->n_devices + 1))
+                                return -ENOMEM;
+
+                        tag->devices[tag->n_devices++] = index;
+                }
+
+                p = eol + 1;
+        }
+
+        return 0;
+}
+
+/* Collect all files in DATA_DIR and write them to DEVICE_DB_PACK. Returns
+ * -EAGAIN if the directory changed too recently, or while reading it. */
+int device_db_pack_write(uint64_t *ret_data_mtime) {
+        _cleanup_closedir_ DIR *dir = NULL;
+        _cleanup_fclose_ FILE *f = NULL;
+        _cleanup_free_ char *temp_path = NULL;
+        _cleanup_free_ PackTag **sorted_tags = NULL;
+        PackDevice *devices = NULL;
+        size_t n_devices = 0, n_allocated = 0, i, j;
+        Hashmap *tags = NULL;
+        PackTag *tag;
+        Iterator it;
+        struct DeviceDBPackHeader head = {};
+        uint64_t mtime, mtime_after, offset;
+        struct dirent *de;
+        struct stat st;
+        int r;
+
+        if (stat(DATA_DIR, &st) < 0)
+                return -errno;
+
+        mtime = stat_mtime(&st);
+
+        if (mtime + RACY_NSEC > now(CLOCK_REALTIME) * NSEC_PER_USEC)
+                return -EAGAIN;
+
+        dir = opendir(DATA_DIR);
+        if (!dir)
+                return -errno;
+
+        FOREACH_DIRENT(de, dir, r = -errno; goto finish) {
+                PackDevice *device;
+
+                if (!GREEDY_REALLOC(devices, n_allocated, n_devices + 1)) {
+                        r = -ENOMEM;
+                        goto finish;
+                }
+
+                device = &devices[n_devices];
+                zero(*device);
+
+                device->id = strdup(de->d_name);
+                if (!device->id) {
+                        r = -ENOMEM;
+                        goto finish;
+                }
+
+                r = read_full_file(strjoina(DATA_DIR "/", de->d_name), &device->data, &device->size);
+                if (r < 0) {
+                        free(device->id);
+                        if (r == -ENOENT)
+                                continue;
+                        goto finish;
+                }
+
+                n_devices++;
+        }
+
+        r = get_data_mtime(&mtime_after);
+        if (r < 0)
+                goto finish;
+        if (mtime_after != mtime) {
+                r = -EAGAIN;
+                goto finish;
+        }
+
+        qsort_safe(devices, n_devices, sizeof(PackDevice), pack_device_compare);
+
+        tags = hashmap_new(&string_hash_ops);
+        if (!tags) {
+                r = -ENOMEM;
+                goto finish;
+        }
+
+        for (i = 0; i < n_devices; i++) {
+                r = pack_add_tags(tags, &devices[i], i);
+                if (r < 0)
+                        goto finish;
+        }
+
+        sorted_tags = new(PackTag*, hashmap_size(tags));
+        if (!sorted_tags) {
+                r = -ENOMEM;
+                goto finish;
+        }
+
+        j = 0;
+        HASHMAP_FOREACH(tag, tags, it)
+                sorted_tags[j++] = tag;
+
+        qsort_safe(sorted_tags, j, sizeof(PackTag*), pack_tag_compare);
+
+        /* lay out the file */
+        memcpy(head.signature, signature, sizeof(signature));
+        head.data_mtime = mtime;
+        head.n_devices = n_devices;
+        head.n_tags = j;
+        head.devices_offset = sizeof(head);
+        head.tags_offset = head.devices_offset + n_devices * sizeof(struct DeviceDBPackDevice);
+
+        offset = head.tags_offset + head.n_tags * sizeof(struct DeviceDBPackTag);
+        for (i = 0; i < head.n_tags; i++)
+                offset += sorted_tags[i]->n_devices * sizeof(uint64_t);
+        for (i = 0; i < n_devices; i++)
+                offset += strlen(devices[i].id) + 1 + devices[i].size;
+        for (i = 0; i < head.n_tags; i++)
+                offset += strlen(sorted_tags[i]->name) + 1;
+        head.size = offset;
+
+        r = fopen_temporary(DEVICE_DB_PACK, &f, &temp_path);
+        if (r < 0)
+                goto finish;
+
+        (void) fchmod(fileno(f), 0644);
+
+        fwrite(&head, sizeof(head), 1, f);
+
+        /* strings follow the tag device indices */
+        offset = head.tags_offset + head.n_tags * sizeof(struct DeviceDBPackTag);
+        for (i = 0; i < head.n_tags; i++)
+                offset += sorted_tags[i]->n_devices * sizeof(uint64_t);
+
+        for (i = 0; i < n_devices; i++) {
+                struct DeviceDBPackDevice device = {
+                        .id_offset = offset,
+                        .data_offset = offset + strlen(devices[i].id) + 1,
+                        .data_size = devices[i].size,
+                };
+
+                fwrite(&device, sizeof(device), 1, f);
+                offset = device.data_offset + device.data_size;
+        }
+
+        j = head.tags_offset + head.n_tags * sizeof(struct DeviceDBPackTag);
+        for (i = 0; i < head.n_tags; i++) {
+                struct DeviceDBPackTag t = {
+                        .name_offset = offset,
+                        .devices_offset = j,
+                        .n_devices = sorted_tags[i]->n_devices,
+                };
+
+                fwrite(&t, sizeof(t), 1, f);
+                offset += strlen(sorted_tags[i]->name) + 1;
+                j += t.n_devices * sizeof(uint64_t);
+        }
+
+        for (i = 0; i < head.n_tags; i++)
+                fwrite(sorted_tags[i]->devices, sizeof(uint64_t), sorted_tags[i]->n_devices, f);
+
+        for (i = 0; i < n_devices; i++) {
+                fwrite(devices[i].id, strlen(devices[i].id) + 1, 1, f);
+                fwrite(devices[i].data, 1, devices[i].size, f);
+        }
+
+        for (i = 0; i < head.n_tags; i++)
+                fwrite(sorted_tags[i]->name, strlen(sorted_tags[i]->name) + 1, 1, f);
+
+        r = fflush_and_check(f);
+        if (r < 0)
+                goto finish;
+
+        if (rename(temp_path, DEVICE_DB_PACK) < 0) {
+                r = -errno;
+                goto finish;
+        }
+
+        temp_path = mfree(temp_path);
+
+        if (ret_data_mtime)
+                *ret_data_mtime = mtime;
+
+        r = 0;
+
+finish:
+        if (temp_path)
+                (void) unlink(temp_path);
+
+        for (i = 0; i < n_devices; i++) {
+                free(devices[i].id);
+                free(devices[i].data);
+        }
+        free(devices);
+
+        HASHMAP_FOREACH(tag, tags, it) {
+                free(tag->name);
+                free(tag->devices);
+                free(tag);
+        }
+        hashmap_free(tags);
+
+        return r;
+}
@@ -0,0 +1,46 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+#pragma once
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include "macro.h"
+
+/* All of /run/udev/data/ in one file, written by udevd while idle. It
+ * is only valid as long as the directory was not touched since. */
+
+#define DEVICE_DB_PACK "/run/udev/data.pack"
+
+typedef struct DeviceDBPack DeviceDBPack;
+
+int device_db_pack_open(DeviceDBPack **ret);
+DeviceDBPack *device_db_pack_ref(DeviceDBPack *pack);
+DeviceDBPack *device_db_pack_unref(DeviceDBPack *pack);
+
+int device_db_pack_get(DeviceDBPack *pack, const char *id, const char **ret_data, size_t *ret_size);
+int device_db_pack_get_tag(DeviceDBPack *pack, const char *tag, const uint64_t **ret_devices, size_t *ret_n);
+const char *device_db_pack_get_id(DeviceDBPack *pack, uint64_t device);
+
+int device_db_pack_is_current(uint64_t data_mtime);
+int device_db_pack_write(uint64_t *ret_data_mtime);
+
+DEFINE_TRIVIAL_CLEANUP_FUNC(DeviceDBPack*, device_db_pack_unref);
+#define _cleanup_device_db_pack_unref_ _cleanup_(device_db_pack_unrefp)
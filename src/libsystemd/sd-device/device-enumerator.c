@@ -18,6 +18,8 @@
   along with systemd; If not, see <http://www.gnu.org/licenses/>.
 ***/
 
+#include <pthread.h>
+
 #include "util.h"
 #include "prioq.h"
 #include "strv.h"
@@ -27,8 +29,10 @@
 
 #include "device-util.h"
 #include "device-enumerator-private.h"
+#include "device-private.h"
 
 #define DEVICE_ENUMERATE_MAX_DEPTH 256
+#define DEVICE_ENUMERATE_THREADS_MAX 8
 
 typedef enum DeviceEnumerationType {
         DEVICE_ENUMERATION_TYPE_DEVICES,
@@ -53,6 +57,8 @@ struct sd_device_enumerator {
         Set *match_tag;
         sd_device *match_parent;
         bool match_allow_uninitialized;
+
+        DeviceDBPack *db_pack; /* only during a scan */
 };
 
 _public_ int sd_device_enumerator_new(sd_device_enumerator **ret) {
@@ -462,7 +468,38 @@ static bool match_sysname(sd_device_enumerator *enumerator, const char *sysname)
         return false;
 }
 
-static int enumerator_scan_dir_and_add_devices(sd_device_enumerator *enumerator, const char *basedir, const char *subdir1, const char *subdir2) {
+/* The subdirectories of a sysfs directory, shared by the threads scanning them */
+typedef struct DeviceScanQueue {
+        sd_device_enumerator *enumerator;
+        const char *basedir;
+        const char *subdir;
+        char **subdirs;
+        unsigned n_subdirs;
+        unsigned next;
+} DeviceScanQueue;
+
+/* The devices found by one thread, added to the enumerator after it finished */
+typedef struct DeviceScan {
+        DeviceScanQueue *queue;
+        sd_device **devices;
+        size_t n_devices;
+        size_t n_allocated;
+        int r;
+} DeviceScan;
+
+static int enumerator_add_scanned_device(sd_device_enumerator *enumerator, DeviceScan *scan, sd_device *device) {
+        if (!scan)
+                return device_enumerator_add_device(enumerator, device);
+
+        if (!GREEDY_REALLOC(scan->devices, scan->n_allocated, scan->n_devices + 1))
+                return -ENOMEM;
+
+        scan->devices[scan->n_devices++] = sd_device_ref(device);
+
+        return 0;
+}
+
+static int enumerator_scan_dir_and_add_devices(sd_device_enumerator *enumerator, const char *basedir, const char *subdir1, const char *subdir2, DeviceScan *scan) {
         _cleanup_closedir_ DIR *dir = NULL;
         char *path;
         struct dirent *dent;
@@ -506,6 +543,8 @@ static int enumerator_scan_dir_and_add_devices(sd_device_enumerator *enumerator,
                         continue;
                 }
 
+                device_set_db_pack(device, enumerator->db_pack);
+
                 k = sd_device_get_devnum(device, &devnum);
                 if (k < 0) {
                         r = k;
@@ -551,7 +590,7 @@ static int enumerator_scan_dir_and_add_devices(sd_device_enumerator *enumerator,
                 if (!match_sysattr(enumerator, device))
                         continue;
 
-                k = device_enumerator_add_device(enumerator, device);
+                k = enumerator_add_scanned_device(enumerator, scan, device);
                 if (k < 0)
                         r = k;
         }
@@ -582,10 +621,37 @@ static bool match_subsystem(sd_device_enumerator *enumerator, const char *subsys
         return false;
 }
 
+static void *scan_thread(void *userdata) {
+        DeviceScan *scan = userdata;
+        DeviceScanQueue *queue = scan->queue;
+        unsigned i;
+
+        while ((i = __sync_fetch_and_add(&queue->next, 1)) < queue->n_subdirs) {
+                int k;
+
+                k = enumerator_scan_dir_and_add_devices(queue->enumerator, queue->basedir, queue->subdirs[i], queue->subdir, scan);
+                if (k < 0)
+                        scan->r = k;
+        }
+
+        return NULL;
+}
+
 static int enumerator_scan_dir(sd_device_enumerator *enumerator, const char *basedir, const char *subdir, const char *subsystem) {
         _cleanup_closedir_ DIR *dir = NULL;
+        _cleanup_strv_free_ char **subdirs = NULL;
+        DeviceScanQueue queue = {
+                .enumerator = enumerator,
+                .basedir = basedir,
+                .subdir = subdir,
+        };
+        DeviceScan scans[DEVICE_ENUMERATE_THREADS_MAX] = {};
+        pthread_t threads[DEVICE_ENUMERATE_THREADS_MAX];
+        bool started[DEVICE_ENUMERATE_THREADS_MAX] = {};
+        unsigned n_threads, i;
         char *path;
         struct dirent *dent;
+        long n_cpus;
         int r = 0;
 
         path = strjoina("/sys/", basedir);
@@ -597,22 +663,105 @@ static int enumerator_scan_dir(sd_device_enumerator *enumerator, const char *bas
         log_debug("  device-enumerator: scanning %s", path);
 
         FOREACH_DIRENT_ALL(dent, dir, return -errno) {
-                int k;
-
                 if (dent->d_name[0] == '.')
                         continue;
 
                 if (!match_subsystem(enumerator, subsystem ? : dent->d_name))
                         continue;
 
-                k = enumerator_scan_dir_and_add_devices(enumerator, basedir, dent->d_name, subdir);
-                if (k < 0)
-                        r = k;
+                r = strv_extend(&subdirs, dent->d_name);
+                if (r < 0)
+                        return r;
+        }
+
+        queue.subdirs = subdirs;
+        queue.n_subdirs = strv_length(subdirs);
+
+        /* sysfs lookups are CPU bound in the kernel, so spread the
+         * subdirectories over one thread per CPU, the calling thread
+         * included */
+        n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        n_threads = MIN3((unsigned) MAX(n_cpus, 1L), (unsigned) DEVICE_ENUMERATE_THREADS_MAX, MAX(queue.n_subdirs, 1U));
+
+        for (i = 0; i < n_threads; i++) {
+                scans[i].queue = &queue;
+
+                if (i > 0)
+                        started[i] = pthread_create(&threads[i], NULL, scan_thread, &scans[i]) == 0;
+        }
+
+        /* if a thread could not be started, the others take over its share */
+        scan_thread(&scans[0]);
+
+        r = 0;
+        for (i = 0; i < n_threads; i++) {
+                size_t j;
+
+                if (started[i])
+                        (void) pthread_join(threads[i], NULL);
+
+                if (scans[i].r < 0)
+                        r = scans[i].r;
+
+                for (j = 0; j < scans[i].n_devices; j++) {
+                        int k;
+
+                        k = device_enumerator_add_device(enumerator, scans[i].devices[j]);
+                        if (k < 0)
+                                r = k;
+
+                        sd_device_unref(scans[i].devices[j]);
+                }
+
+                free(scans[i].devices);
         }
 
         return r;
 }
 
+static int enumerator_add_tagged_device(sd_device_enumerator *enumerator, const char *id) {
+        _cleanup_device_unref_ sd_device *device = NULL;
+        const char *subsystem, *sysname;
+        int r;
+
+        assert(enumerator);
+        assert(id);
+
+        r = sd_device_new_from_device_id(&device, id);
+        if (r == -ENODEV)
+                /* this is necessarily racy, so ignore missing devices */
+                return 0;
+        else if (r < 0)
+                return r;
+
+        device_set_db_pack(device, enumerator->db_pack);
+
+        r = sd_device_get_subsystem(device, &subsystem);
+        if (r < 0)
+                return r;
+
+        if (!match_subsystem(enumerator, subsystem))
+                return 0;
+
+        r = sd_device_get_sysname(device, &sysname);
+        if (r < 0)
+                return r;
+
+        if (!match_sysname(enumerator, sysname))
+                return 0;
+
+        if (!match_parent(enumerator, device))
+                return 0;
+
+        if (!match_property(enumerator, device))
+                return 0;
+
+        if (!match_sysattr(enumerator, device))
+                return 0;
+
+        return device_enumerator_add_device(enumerator, device);
+}
+
 static int enumerator_scan_devices_tag(sd_device_enumerator *enumerator, const char *tag) {
         _cleanup_closedir_ DIR *dir = NULL;
         char *path;
@@ -622,6 +771,31 @@ static int enumerator_scan_devices_tag(sd_device_enumerator *enumerator, const c
         assert(enumerator);
         assert(tag);
 
+        if (enumerator->db_pack) {
+                const uint64_t *devices;
+                size_t n, i;
+
+                /* the packed db indexes the tags of all devices */
+                r = device_db_pack_get_tag(enumerator->db_pack, tag, &devices, &n);
+                if (r < 0)
+                        return r;
+
+                for (i = 0; i < n; i++) {
+                        const char *id;
+                        int k;
+
+                        id = device_db_pack_get_id(enumerator->db_pack, devices[i]);
+                        if (!id)
+                                return -EBADMSG;
+
+                        k = enumerator_add_tagged_device(enumerator, id);
+                        if (k < 0)
+                                r = k;
+                }
+
+                return r;
+        }
+
         path = strjoina("/run/udev/tags/", tag);
 
         dir = opendir(path);
@@ -637,54 +811,14 @@ static int enumerator_scan_devices_tag(sd_device_enumerator *enumerator, const c
         /* TODO: filter away subsystems? */
 
         FOREACH_DIRENT_ALL(dent, dir, return -errno) {
-                _cleanup_device_unref_ sd_device *device = NULL;
-                const char *subsystem, *sysname;
                 int k;
 
                 if (dent->d_name[0] == '.')
                         continue;
 
-                k = sd_device_new_from_device_id(&device, dent->d_name);
-                if (k < 0) {
-                        if (k != -ENODEV)
-                                /* this is necessarily racy, so ignore missing devices */
-                                r = k;
-
-                        continue;
-                }
-
-                k = sd_device_get_subsystem(device, &subsystem);
-                if (k < 0) {
-                        r = k;
-                        continue;
-                }
-
-                if (!match_subsystem(enumerator, subsystem))
-                        continue;
-
-                k = sd_device_get_sysname(device, &sysname);
-                if (k < 0) {
-                        r = k;
-                        continue;
-                }
-
-                if (!match_sysname(enumerator, sysname))
-                        continue;
-
-                if (!match_parent(enumerator, device))
-                        continue;
-
-                if (!match_property(enumerator, device))
-                        continue;
-
-                if (!match_sysattr(enumerator, device))
-                        continue;
-
-                k = device_enumerator_add_device(enumerator, device);
-                if (k < 0) {
+                k = enumerator_add_tagged_device(enumerator, dent->d_name);
+                if (k < 0)
                         r = k;
-                        continue;
-                }
         }
 
         return r;
@@ -718,6 +852,8 @@ static int parent_add_child(sd_device_enumerator *enumerator, const char *path)
         else if (r < 0)
                 return r;
 
+        device_set_db_pack(device, enumerator->db_pack);
+
         r = sd_device_get_subsystem(device, &subsystem);
         if (r == -ENOENT)
                 return 0;
@@ -848,19 +984,21 @@ int device_enumerator_scan_devices(sd_device_enumerator *enumerator) {
         while ((device = prioq_pop(enumerator->devices)))
                 sd_device_unref(device);
 
-        if (!set_isempty(enumerator->match_tag)) {
+        /* use the packed db if it is current, instead of reading a
+         * file for every device */
+        (void) device_db_pack_open(&enumerator->db_pack);
+
+        if (!set_isempty(enumerator->match_tag))
                 r = enumerator_scan_devices_tags(enumerator);
-                if (r < 0)
-                        return r;
-        } else if (enumerator->match_parent) {
+        else if (enumerator->match_parent)
                 r = enumerator_scan_devices_children(enumerator);
-                if (r < 0)
-                        return r;
-        } else {
+        else
                 r = enumerator_scan_devices_all(enumerator);
-                if (r < 0)
-                        return r;
-        }
+
+        enumerator->db_pack = device_db_pack_unref(enumerator->db_pack);
+
+        if (r < 0)
+                return r;
 
         enumerator->scan_uptodate = true;
 
@@ -909,7 +1047,7 @@ int device_enumerator_scan_subsystems(sd_device_enumerator *enumerator) {
 
         /* modules */
         if (match_subsystem(enumerator, "module")) {
-                k = enumerator_scan_dir_and_add_devices(enumerator, "module", NULL, NULL);
+                k = enumerator_scan_dir_and_add_devices(enumerator, "module", NULL, NULL, NULL);
                 if (k < 0) {
                         log_debug_errno(k, "device-enumerator: failed to scan modules: %m");
                         r = k;
@@ -923,7 +1061,7 @@ int device_enumerator_scan_subsystems(sd_device_enumerator *enumerator) {
 
         /* subsystems (only buses support coldplug) */
         if (match_subsystem(enumerator, "subsystem")) {
-                k = enumerator_scan_dir_and_add_devices(enumerator, subsysdir, NULL, NULL);
+                k = enumerator_scan_dir_and_add_devices(enumerator, subsysdir, NULL, NULL, NULL);
                 if (k < 0) {
                         log_debug_errno(k, "device-enumerator: failed to scan subsystems: %m");
                         r = k;
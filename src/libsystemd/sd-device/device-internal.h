@@ -22,6 +22,7 @@
 
 #include "hashmap.h"
 #include "set.h"
+#include "device-db-pack.h"
 
 struct sd_device {
         uint64_t n_ref;
@@ -90,6 +91,7 @@ struct sd_device {
 
         bool uevent_loaded; /* don't reread uevent */
         bool db_loaded; /* don't reread db */
+        DeviceDBPack *db_pack; /* read the db from here instead of /run/udev/data/ */
 
         bool sealed; /* don't read more information from uevent/db */
         bool db_persist; /* don't clean up the db when switching from initrd to real root */
@@ -19,6 +19,7 @@
 ***/
 
 #include <ctype.h>
+#include <pthread.h>
 #include <sys/types.h>
 #include <net/if.h>
 
@@ -39,6 +40,47 @@
 #include "device-internal.h"
 #include "device-private.h"
 
+/* Property names and tags are a small vocabulary that repeats for every
+ * device, hence all devices of the process share one copy of each. The
+ * copies are never freed, so that they can be handed out without
+ * reference counting and compared by pointer. */
+static Set *interned_strings = NULL;
+static pthread_mutex_t interned_strings_lock = PTHREAD_MUTEX_INITIALIZER;
+
+int device_intern_string(const char *s, const char **ret) {
+        char *k;
+        int r = 0;
+
+        assert(s);
+        assert(ret);
+
+        assert_se(pthread_mutex_lock(&interned_strings_lock) == 0);
+
+        k = set_get(interned_strings, (char*) s);
+        if (!k) {
+                r = set_ensure_allocated(&interned_strings, &string_hash_ops);
+                if (r < 0)
+                        goto finish;
+
+                k = strdup(s);
+                if (!k) {
+                        r = -ENOMEM;
+                        goto finish;
+                }
+
+                r = set_consume(interned_strings, k);
+                if (r < 0)
+                        goto finish;
+        }
+
+        *ret = k;
+
+finish:
+        assert_se(pthread_mutex_unlock(&interned_strings_lock) == 0);
+
+        return r;
+}
+
 int device_add_property(sd_device *device, const char *key, const char *value) {
         int r;
 
@@ -883,8 +925,7 @@ int device_copy_properties(sd_device *device_dst, sd_device *device_src) {
 void device_cleanup_tags(sd_device *device) {
         assert(device);
 
-        set_free_free(device->tags);
-        device->tags = NULL;
+        device->tags = set_free(device->tags);
         device->property_tags_outdated = true;
         device->tags_generation ++;
 }
@@ -902,7 +943,7 @@ void device_remove_tag(sd_device *device, const char *tag) {
         assert(device);
         assert(tag);
 
-        free(set_remove(device->tags, tag));
+        set_remove(device->tags, tag);
         device->property_tags_outdated = true;
         device->tags_generation ++;
 }
@@ -985,6 +1026,13 @@ void device_set_db_persist(sd_device *device) {
         device->db_persist = true;
 }
 
+void device_set_db_pack(sd_device *device, DeviceDBPack *pack) {
+        assert(device);
+
+        device_db_pack_unref(device->db_pack);
+        device->db_pack = device_db_pack_ref(pack);
+}
+
 int device_update_db(sd_device *device) {
         const char *id;
         char *path;
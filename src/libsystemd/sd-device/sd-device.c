@@ -75,12 +75,13 @@ _public_ sd_device *sd_device_unref(sd_device *device) {
                 free(device->properties_strv);
                 free(device->properties_nulstr);
 
-                ordered_hashmap_free_free_free(device->properties);
-                ordered_hashmap_free_free_free(device->properties_db);
+                ordered_hashmap_free_free(device->properties);
+                ordered_hashmap_free_free(device->properties_db);
                 hashmap_free_free_free(device->sysattr_values);
                 set_free_free(device->sysattrs);
-                set_free_free(device->tags);
+                set_free(device->tags);
                 set_free_free(device->devlinks);
+                device_db_pack_unref(device->db_pack);
 
                 free(device);
         }
@@ -100,35 +101,32 @@ int device_add_property_aux(sd_device *device, const char *_key, const char *_va
                 properties = &device->properties;
 
         if (_value) {
-                _cleanup_free_ char *key = NULL, *value = NULL, *old_key = NULL, *old_value = NULL;
+                _cleanup_free_ char *value = NULL, *old_value = NULL;
+                const char *key;
                 int r;
 
                 r = ordered_hashmap_ensure_allocated(properties, &string_hash_ops);
                 if (r < 0)
                         return r;
 
-                key = strdup(_key);
-                if (!key)
-                        return -ENOMEM;
+                /* The keys are interned, only the values are ours */
+                r = device_intern_string(_key, &key);
+                if (r < 0)
+                        return r;
 
                 value = strdup(_value);
                 if (!value)
                         return -ENOMEM;
 
-                old_value = ordered_hashmap_get2(*properties, key, (void**) &old_key);
+                old_value = ordered_hashmap_get(*properties, key);
 
                 r = ordered_hashmap_replace(*properties, key, value);
                 if (r < 0)
                         return r;
 
-                key = NULL;
                 value = NULL;
-        } else {
-                _cleanup_free_ char *key = NULL;
-                _cleanup_free_ char *value = NULL;
-
-                value = ordered_hashmap_remove2(*properties, _key, (void**) &key);
-        }
+        } else
+                free(ordered_hashmap_remove(*properties, _key));
 
         if (!db) {
                 device->properties_generation ++;
@@ -1051,7 +1049,11 @@ int device_add_tag(sd_device *device, const char *tag) {
         if (r < 0)
                 return r;
 
-        r = set_put_strdup(device->tags, tag);
+        r = device_intern_string(tag, &tag);
+        if (r < 0)
+                return r;
+
+        r = set_put(device->tags, tag);
         if (r < 0)
                 return r;
 
@@ -1267,7 +1269,17 @@ int device_read_db_aux(sd_device *device, bool force) {
 
         path = strjoina("/run/udev/data/", id);
 
-        r = read_full_file(path, &db, &db_len);
+        if (device->db_pack) {
+                const char *data;
+
+                r = device_db_pack_get(device->db_pack, id, &data, &db_len);
+                if (r >= 0) {
+                        db = strndup(data, db_len);
+                        if (!db)
+                                return -ENOMEM;
+                }
+        } else
+                r = read_full_file(path, &db, &db_len);
         if (r < 0) {
                 if (r == -ENOENT)
                         return 0;
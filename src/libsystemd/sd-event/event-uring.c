@@ -0,0 +1,430 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <endian.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#ifdef HAVE_LINUX_IO_URING_H
+#include <linux/io_uring.h>
+#endif
+
+#include "util.h"
+#include "missing.h"
+#include "event-uring.h"
+
+#ifdef HAVE_LINUX_IO_URING_H
+
+/* We need EXT_ARG for waiting with a timeout, NODROP so that we never
+ * lose completions and CQE_SKIP to keep cancellations quiet. All of
+ * this is available since Linux 5.17. */
+#define EVENT_URING_FEATURES (IORING_FEAT_SINGLE_MMAP|IORING_FEAT_NODROP|IORING_FEAT_EXT_ARG|IORING_FEAT_CQE_SKIP)
+
+struct EventUring {
+        int fd;
+
+        void *ring;
+        size_t ring_size;
+        struct io_uring_sqe *sqes;
+        size_t sqes_size;
+
+        unsigned *sq_head, *sq_tail, *sq_mask;
+        unsigned *cq_head, *cq_tail, *cq_mask;
+        struct io_uring_cqe *cqes;
+
+        unsigned sq_entries;
+
+        /* Our tail of the submission queue, which is only made
+         * visible to the kernel when we submit */
+        unsigned sqe_tail;
+
+        /* Timeouts are passed by reference, and the kernel only
+         * reads them when submitting, hence keep one per SQE */
+        struct __kernel_timespec *timespecs;
+};
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *p) {
+        return (int) syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags, const void *arg, size_t argsz) {
+        return (int) syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+int event_uring_new(EventUring **ret, unsigned entries) {
+        struct io_uring_params p = {};
+        EventUring *u;
+        unsigned *array, i;
+        int r;
+
+        assert(ret);
+        assert(entries > 0);
+
+        u = new0(EventUring, 1);
+        if (!u)
+                return -ENOMEM;
+
+        u->ring = u->sqes = MAP_FAILED;
+
+        /* Make the completion queue larger than the submission
+         * queue, as each of our poll requests might complete more
+         * than once per iteration */
+        p.flags = IORING_SETUP_CQSIZE;
+        p.cq_entries = entries * 4;
+
+        u->fd = sys_io_uring_setup(entries, &p);
+        if (u->fd < 0) {
+                r = errno == ENOSYS ? -EOPNOTSUPP : -errno;
+                goto fail;
+        }
+
+        if ((p.features & EVENT_URING_FEATURES) != EVENT_URING_FEATURES) {
+                r = -EOPNOTSUPP;
+                goto fail;
+        }
+
+        u->ring_size = MAX(p.sq_off.array + p.sq_entries * sizeof(unsigned),
+                           p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe));
+        u->ring = mmap(NULL, u->ring_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+        if (u->ring == MAP_FAILED) {
+                r = -errno;
+                goto fail;
+        }
+
+        u->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+        u->sqes = mmap(NULL, u->sqes_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, u->fd, IORING_OFF_SQES);
+        if (u->sqes == MAP_FAILED) {
+                r = -errno;
+                goto fail;
+        }
+
+        u->timespecs = new0(struct __kernel_timespec, p.sq_entries);
+        if (!u->timespecs) {
+                r = -ENOMEM;
+                goto fail;
+        }
+
+        u->sq_head = (unsigned*) ((uint8_t*) u->ring + p.sq_off.head);
+        u->sq_tail = (unsigned*) ((uint8_t*) u->ring + p.sq_off.tail);
+        u->sq_mask = (unsigned*) ((uint8_t*) u->ring + p.sq_off.ring_mask);
+        u->cq_head = (unsigned*) ((uint8_t*) u->ring + p.cq_off.head);
+        u->cq_tail = (unsigned*) ((uint8_t*) u->ring + p.cq_off.tail);
+        u->cq_mask = (unsigned*) ((uint8_t*) u->ring + p.cq_off.ring_mask);
+        u->cqes = (struct io_uring_cqe*) ((uint8_t*) u->ring + p.cq_off.cqes);
+        u->sq_entries = p.sq_entries;
+        u->sqe_tail = *u->sq_tail;
+
+        /* We always fill the SQEs in ring order, hence the index
+         * array is simply the identity */
+        array = (unsigned*) ((uint8_t*) u->ring + p.sq_off.array);
+        for (i = 0; i < p.sq_entries; i++)
+                array[i] = i;
+
+        *ret = u;
+        return 0;
+
+fail:
+        event_uring_free(u);
+        return r;
+}
+
+EventUring *event_uring_free(EventUring *u) {
+        if (!u)
+                return NULL;
+
+        if (u->sqes != MAP_FAILED)
+                munmap(u->sqes, u->sqes_size);
+        if (u->ring != MAP_FAILED)
+                munmap(u->ring, u->ring_size);
+
+        safe_close(u->fd);
+        free(u->timespecs);
+        free(u);
+
+        return NULL;
+}
+
+int event_uring_get_fd(EventUring *u) {
+        assert(u);
+
+        return u->fd;
+}
+
+unsigned event_uring_queued(EventUring *u) {
+        assert(u);
+
+        return u->sqe_tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+}
+
+int event_uring_submit(EventUring *u) {
+        assert(u);
+
+        return event_uring_enter(u, 0);
+}
+
+static int event_uring_get_sqe(EventUring *u, struct io_uring_sqe **ret, unsigned *idx) {
+        int r;
+
+        assert(u);
+        assert(ret);
+
+        if (u->sqe_tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) >= u->sq_entries) {
+
+                /* Full, push out what we have so far */
+                r = event_uring_submit(u);
+                if (r < 0)
+                        return r;
+
+                if (u->sqe_tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) >= u->sq_entries)
+                        return -EBUSY;
+        }
+
+        *idx = u->sqe_tail & *u->sq_mask;
+        *ret = u->sqes + *idx;
+        memzero(*ret, sizeof(struct io_uring_sqe));
+        u->sqe_tail++;
+
+        return 0;
+}
+
+int event_uring_poll_add(EventUring *u, int fd, uint32_t events, bool multishot, uint64_t user_data) {
+        struct io_uring_sqe *sqe;
+        unsigned idx;
+        int r;
+
+        assert(u);
+        assert(fd >= 0);
+
+        r = event_uring_get_sqe(u, &sqe, &idx);
+        if (r < 0)
+                return r;
+
+#if __BYTE_ORDER == __BIG_ENDIAN
+        events = (events << 16) | (events >> 16);
+#endif
+
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->fd = fd;
+        sqe->poll32_events = events;
+        sqe->len = multishot ? IORING_POLL_ADD_MULTI : 0;
+        sqe->user_data = user_data;
+
+        return 0;
+}
+
+int event_uring_poll_remove(EventUring *u, uint64_t target, uint64_t user_data) {
+        struct io_uring_sqe *sqe;
+        unsigned idx;
+        int r;
+
+        assert(u);
+
+        r = event_uring_get_sqe(u, &sqe, &idx);
+        if (r < 0)
+                return r;
+
+        sqe->opcode = IORING_OP_POLL_REMOVE;
+        sqe->flags = IOSQE_CQE_SKIP_SUCCESS;
+        sqe->fd = -1;
+        sqe->addr = target;
+        sqe->user_data = user_data;
+
+        return 0;
+}
+
+int event_uring_timeout(EventUring *u, clockid_t clock, usec_t when, uint64_t user_data) {
+        struct io_uring_sqe *sqe;
+        unsigned idx;
+        int r;
+
+        assert(u);
+
+        r = event_uring_get_sqe(u, &sqe, &idx);
+        if (r < 0)
+                return r;
+
+        u->timespecs[idx] = (struct __kernel_timespec) {
+                .tv_sec = when / USEC_PER_SEC,
+                .tv_nsec = (when % USEC_PER_SEC) * NSEC_PER_USEC,
+        };
+
+        /* Never hand out the zero time */
+        if (u->timespecs[idx].tv_sec == 0 && u->timespecs[idx].tv_nsec == 0)
+                u->timespecs[idx].tv_nsec = 1;
+
+        sqe->opcode = IORING_OP_TIMEOUT;
+        sqe->fd = -1;
+        sqe->addr = (uint64_t) (uintptr_t) (u->timespecs + idx);
+        sqe->len = 1;
+        sqe->timeout_flags = IORING_TIMEOUT_ABS;
+        sqe->user_data = user_data;
+
+        switch (clock) {
+
+        case CLOCK_MONOTONIC:
+                break;
+
+        case CLOCK_REALTIME:
+                sqe->timeout_flags |= IORING_TIMEOUT_REALTIME;
+                break;
+
+        case CLOCK_BOOTTIME:
+                sqe->timeout_flags |= IORING_TIMEOUT_BOOTTIME;
+                break;
+
+        default:
+                assert_not_reached("Unsupported clock for io_uring timeouts");
+        }
+
+        return 0;
+}
+
+int event_uring_timeout_remove(EventUring *u, uint64_t target, uint64_t user_data) {
+        struct io_uring_sqe *sqe;
+        unsigned idx;
+        int r;
+
+        assert(u);
+
+        r = event_uring_get_sqe(u, &sqe, &idx);
+        if (r < 0)
+                return r;
+
+        sqe->opcode = IORING_OP_TIMEOUT_REMOVE;
+        sqe->flags = IOSQE_CQE_SKIP_SUCCESS;
+        sqe->fd = -1;
+        sqe->addr = target;
+        sqe->user_data = user_data;
+
+        return 0;
+}
+
+int event_uring_enter(EventUring *u, usec_t timeout) {
+        struct io_uring_getevents_arg arg = {};
+        struct __kernel_timespec ts;
+        unsigned to_submit, flags = 0, min_complete = 0;
+        int r;
+
+        assert(u);
+
+        /* Publish everything we queued so far */
+        to_submit = event_uring_queued(u);
+        __atomic_store_n(u->sq_tail, u->sqe_tail, __ATOMIC_RELEASE);
+
+        if (timeout > 0) {
+                flags |= IORING_ENTER_GETEVENTS;
+                min_complete = 1;
+
+                if (timeout != USEC_INFINITY) {
+                        ts.tv_sec = timeout / USEC_PER_SEC;
+                        ts.tv_nsec = (timeout % USEC_PER_SEC) * NSEC_PER_USEC;
+                        arg.ts = (uint64_t) (uintptr_t) &ts;
+
+                        flags |= IORING_ENTER_EXT_ARG;
+                }
+        } else if (to_submit == 0)
+                return 0;
+
+        r = sys_io_uring_enter(u->fd, to_submit, min_complete, flags,
+                               flags & IORING_ENTER_EXT_ARG ? &arg : NULL,
+                               flags & IORING_ENTER_EXT_ARG ? sizeof(arg) : 0);
+        if (r < 0) {
+                /* Timeouts are not errors, and if the completion
+                 * queue is backed up the caller needs to reap first
+                 * anyway */
+                if (IN_SET(errno, ETIME, EBUSY))
+                        return 0;
+
+                return -errno;
+        }
+
+        return 0;
+}
+
+bool event_uring_next(EventUring *u, uint64_t *user_data, int32_t *res, bool *more) {
+        struct io_uring_cqe *cqe;
+        unsigned head;
+
+        assert(u);
+        assert(user_data);
+        assert(res);
+
+        head = *u->cq_head;
+        if (head == __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE))
+                return false;
+
+        cqe = u->cqes + (head & *u->cq_mask);
+        *user_data = cqe->user_data;
+        *res = cqe->res;
+        if (more)
+                *more = cqe->flags & IORING_CQE_F_MORE;
+
+        __atomic_store_n(u->cq_head, head + 1, __ATOMIC_RELEASE);
+
+        return true;
+}
+
+#else
+
+int event_uring_new(EventUring **ret, unsigned entries) {
+        return -EOPNOTSUPP;
+}
+
+EventUring *event_uring_free(EventUring *u) {
+        assert(!u);
+        return NULL;
+}
+
+int event_uring_get_fd(EventUring *u) {
+        assert_not_reached("io_uring support not compiled in");
+}
+
+unsigned event_uring_queued(EventUring *u) {
+        return 0;
+}
+
+int event_uring_poll_add(EventUring *u, int fd, uint32_t events, bool multishot, uint64_t user_data) {
+        return -EOPNOTSUPP;
+}
+
+int event_uring_poll_remove(EventUring *u, uint64_t target, uint64_t user_data) {
+        return -EOPNOTSUPP;
+}
+
+int event_uring_timeout(EventUring *u, clockid_t clock, usec_t when, uint64_t user_data) {
+        return -EOPNOTSUPP;
+}
+
+int event_uring_timeout_remove(EventUring *u, uint64_t target, uint64_t user_data) {
+        return -EOPNOTSUPP;
+}
+
+int event_uring_submit(EventUring *u) {
+        return -EOPNOTSUPP;
+}
+
+int event_uring_enter(EventUring *u, usec_t timeout) {
+        return -EOPNOTSUPP;
+}
+
+bool event_uring_next(EventUring *u, uint64_t *user_data, int32_t *res, bool *more) {
+        return false;
+}
+
+#endif
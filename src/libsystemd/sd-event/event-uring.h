@@ -0,0 +1,47 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+#pragma once
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <time.h>
+
+#include "macro.h"
+#include "time-util.h"
+
+/* A minimal io_uring wrapper for the event loop. Requests are only
+ * queued in the submission ring, and handed to the kernel in one go
+ * by event_uring_enter(), which also waits for completions. If the
+ * submission ring fills up in between it is flushed early. */
+
+typedef struct EventUring EventUring;
+
+int event_uring_new(EventUring **ret, unsigned entries);
+EventUring *event_uring_free(EventUring *u);
+
+int event_uring_get_fd(EventUring *u) _pure_;
+unsigned event_uring_queued(EventUring *u);
+
+int event_uring_poll_add(EventUring *u, int fd, uint32_t events, bool multishot, uint64_t user_data);
+int event_uring_poll_remove(EventUring *u, uint64_t target, uint64_t user_data);
+int event_uring_timeout(EventUring *u, clockid_t clock, usec_t when, uint64_t user_data);
+int event_uring_timeout_remove(EventUring *u, uint64_t target, uint64_t user_data);
+
+int event_uring_submit(EventUring *u);
+int event_uring_enter(EventUring *u, usec_t timeout);
+bool event_uring_next(EventUring *u, uint64_t *user_data, int32_t *res, bool *more);
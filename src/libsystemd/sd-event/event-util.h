@@ -29,3 +29,16 @@ DEFINE_TRIVIAL_CLEANUP_FUNC(sd_event_source*, sd_event_source_unref);
 
 #define _cleanup_event_unref_ _cleanup_(sd_event_unrefp)
 #define _cleanup_event_source_unref_ _cleanup_(sd_event_source_unrefp)
+
+typedef struct EventSourceStatistics {
+        char *description;
+        const char *type;
+        uint64_t n_dispatched;
+        usec_t runtime, runtime_max;
+        usec_t latency, latency_max;
+} EventSourceStatistics;
+
+/* Returns a snapshot of the dispatch statistics of all sources of the
+ * loop, which are only collected while profiling is enabled */
+int event_get_statistics(sd_event *e, EventSourceStatistics **ret, unsigned *n);
+void event_statistics_free(EventSourceStatistics *stats, unsigned n);
@@ -27,6 +27,7 @@
 #include "sd-daemon.h"
 #include "macro.h"
 #include "prioq.h"
+#include "timer-wheel.h"
 #include "hashmap.h"
 #include "util.h"
 #include "time-util.h"
@@ -34,11 +35,32 @@
 #include "set.h"
 #include "list.h"
 #include "signal-util.h"
+#include "event-uring.h"
+#include "event-util.h"
 
 #include "sd-event.h"
 
 #define DEFAULT_ACCURACY_USEC (250 * USEC_PER_MSEC)
 
+/* How many epoll events to fetch at most in one go, and how often to
+ * go back for more in one iteration if that wasn't enough */
+#define EPOLL_QUEUE_MAX 512U
+#define EPOLL_QUEUE_ROUNDS_MAX 16U
+
+/* Size of the submission queue if the io_uring backend is used */
+#define URING_ENTRIES 256U
+
+/* The io_uring user data carries the fd in the upper 32 bits, and a
+ * generation counter in the lower ones, so that completions for
+ * requests we already withdrew can be recognized. Timeouts use the
+ * clock type instead of an fd, and requests whose completions we
+ * don't care about use a special value. */
+#define URING_SLOT_CLOCK UINT32_C(0xFFFFFF00)
+#define URING_SLOT_IGNORE UINT32_C(0xFFFFFFFF)
+#define URING_USER_DATA(slot, generation) (((uint64_t) (slot) << 32) | (uint32_t) (generation))
+
+#define FD_TO_PTR(fd) INT_TO_PTR((fd)+1)
+
 typedef enum EventSourceType {
         SOURCE_IO,
         SOURCE_TIME_REALTIME,
@@ -91,9 +113,18 @@ struct sd_event_source {
         unsigned prepare_index;
         unsigned pending_iteration;
         unsigned prepare_iteration;
+        unsigned dispatch_iteration;
 
         LIST_FIELDS(sd_event_source, sources);
 
+        /* Only maintained if profiling is enabled for the loop */
+        struct {
+                usec_t pending_since;
+                uint64_t n_dispatched;
+                usec_t runtime, runtime_max;
+                usec_t latency, latency_max;
+        } stats;
+
         union {
                 struct {
                         sd_event_io_handler_t callback;
@@ -107,6 +138,8 @@ struct sd_event_source {
                         usec_t next, accuracy;
                         unsigned earliest_index;
                         unsigned latest_index;
+                        TimerWheelEntry earliest_entry;
+                        TimerWheelEntry latest_entry;
                 } time;
                 struct {
                         sd_event_signal_handler_t callback;
@@ -141,13 +174,24 @@ struct clock_data {
          * dispatched, and one ordered by the latest times they must
          * have been dispatched. The range between the top entries in
          * the two prioqs is the time window we can freely schedule
-         * wakeups in */
+         * wakeups in. If the timer wheel is enabled for the event
+         * loop the same is done with two wheels instead, which only
+         * contain the enabled, non-pending sources. */
 
         Prioq *earliest;
         Prioq *latest;
+        TimerWheel *earliest_wheel;
+        TimerWheel *latest_wheel;
         usec_t next;
 
+        /* If the io_uring backend is used, the non-alarm clocks are
+         * armed with ring timeouts instead of a timerfd */
+        clockid_t uring_clock;
+        uint32_t uring_generation;
+
         bool needs_rearm:1;
+        bool uring_timeout:1;
+        bool uring_armed:1;
 };
 
 struct signal_data {
@@ -163,12 +207,33 @@ struct signal_data {
         sd_event_source *current;
 };
 
+/* With the io_uring backend every fd we watch is tracked by one of
+ * these. Poll requests are one-shot and are requeued after each
+ * completion, which gives us the level-triggered behaviour of epoll,
+ * except for EPOLLET where a multishot request is used instead. */
+struct uring_poll {
+        int fd;
+        uint32_t events;
+        void *data;
+        uint32_t generation;
+
+        bool armed:1;
+        bool queued:1;
+
+        LIST_FIELDS(struct uring_poll, queue);
+};
+
 struct sd_event {
         unsigned n_ref;
 
         int epoll_fd;
         int watchdog_fd;
 
+        EventUring *uring;
+        Hashmap *uring_polls; /* indexed by fd */
+        LIST_HEAD(struct uring_poll, uring_queue); /* polls that need to be (re)submitted */
+        uint32_t uring_generation;
+
         Prioq *pending;
         Prioq *prepare;
 
@@ -193,9 +258,13 @@ struct sd_event {
 
         Prioq *exit;
 
+        struct epoll_event *event_queue;
+        size_t event_queue_allocated;
+
         pid_t original_pid;
 
         unsigned iteration;
+        unsigned dispatch_budget;
         dual_timestamp timestamp;
         usec_t timestamp_boottime;
         int state;
@@ -203,6 +272,9 @@ struct sd_event {
         bool exit_requested:1;
         bool need_process_child:1;
         bool watchdog:1;
+        bool timer_wheel:1;
+        bool uring_exported:1;
+        bool profile:1;
 
         int exit_code;
 
@@ -386,6 +458,131 @@ static void free_clock_data(struct clock_data *d) {
         safe_close(d->fd);
         prioq_free(d->earliest);
         prioq_free(d->latest);
+        timer_wheel_free(d->earliest_wheel);
+        timer_wheel_free(d->latest_wheel);
+}
+
+static bool clock_data_allocated(struct clock_data *d) {
+        assert(d);
+
+        return d->earliest || d->earliest_wheel;
+}
+
+static int clock_data_allocate(sd_event *e, struct clock_data *d) {
+        assert(e);
+        assert(d);
+
+        if (e->timer_wheel) {
+                if (!d->earliest_wheel) {
+                        d->earliest_wheel = timer_wheel_new();
+                        if (!d->earliest_wheel)
+                                return -ENOMEM;
+                }
+
+                if (!d->latest_wheel) {
+                        d->latest_wheel = timer_wheel_new();
+                        if (!d->latest_wheel)
+                                return -ENOMEM;
+                }
+
+                return 0;
+        }
+
+        if (!d->earliest) {
+                d->earliest = prioq_new(earliest_time_prioq_compare);
+                if (!d->earliest)
+                        return -ENOMEM;
+        }
+
+        if (!d->latest) {
+                d->latest = prioq_new(latest_time_prioq_compare);
+                if (!d->latest)
+                        return -ENOMEM;
+        }
+
+        return 0;
+}
+
+static int clock_data_put(struct clock_data *d, sd_event_source *s) {
+        int r;
+
+        assert(d);
+        assert(s);
+
+        if (d->earliest_wheel) {
+                /* The wheels only carry armed sources */
+                if (s->enabled == SD_EVENT_OFF || s->pending)
+                        return 0;
+
+                timer_wheel_put(d->earliest_wheel, &s->time.earliest_entry, s->time.next);
+                timer_wheel_put(d->latest_wheel, &s->time.latest_entry,
+                                s->time.next > USEC_INFINITY - s->time.accuracy ? USEC_INFINITY : s->time.next + s->time.accuracy);
+                return 0;
+        }
+
+        r = prioq_put(d->earliest, s, &s->time.earliest_index);
+        if (r < 0)
+                return r;
+
+        r = prioq_put(d->latest, s, &s->time.latest_index);
+        if (r < 0) {
+                prioq_remove(d->earliest, s, &s->time.earliest_index);
+                return r;
+        }
+
+        return 0;
+}
+
+static void clock_data_remove(struct clock_data *d, sd_event_source *s) {
+        assert(d);
+        assert(s);
+
+        if (d->earliest_wheel) {
+                timer_wheel_remove(d->earliest_wheel, &s->time.earliest_entry);
+                timer_wheel_remove(d->latest_wheel, &s->time.latest_entry);
+                return;
+        }
+
+        prioq_remove(d->earliest, s, &s->time.earliest_index);
+        prioq_remove(d->latest, s, &s->time.latest_index);
+}
+
+static void clock_data_reshuffle(struct clock_data *d, sd_event_source *s) {
+        assert(d);
+        assert(s);
+
+        if (d->earliest_wheel) {
+                clock_data_remove(d, s);
+                assert_se(clock_data_put(d, s) >= 0);
+                return;
+        }
+
+        prioq_reshuffle(d->earliest, s, &s->time.earliest_index);
+        prioq_reshuffle(d->latest, s, &s->time.latest_index);
+}
+
+static sd_event_source* clock_data_peek_earliest(struct clock_data *d) {
+        TimerWheelEntry *i;
+
+        assert(d);
+
+        if (!d->earliest_wheel)
+                return prioq_peek(d->earliest);
+
+        i = timer_wheel_peek(d->earliest_wheel);
+        return i ? container_of(i, sd_event_source, time.earliest_entry) : NULL;
+}
+
+static sd_event_source* clock_data_peek_latest(struct clock_data *d) {
+        TimerWheelEntry *i;
+
+        assert(d);
+
+        if (!d->latest_wheel)
+                return prioq_peek(d->latest);
+
+        i = timer_wheel_peek(d->latest_wheel);
+        return i ? container_of(i, sd_event_source, time.latest_entry) : NULL;
 }
 
 static void event_free(sd_event *e) {
@@ -407,6 +604,9 @@ static void event_free(sd_event *e) {
         safe_close(e->epoll_fd);
         safe_close(e->watchdog_fd);
 
+        hashmap_free_free(e->uring_polls);
+        event_uring_free(e->uring);
+
         free_clock_data(&e->realtime);
         free_clock_data(&e->boottime);
         free_clock_data(&e->monotonic);
@@ -422,10 +622,12 @@ static void event_free(sd_event *e) {
 
         hashmap_free(e->child_sources);
         set_free(e->post_sources);
+        free(e->event_queue);
         free(e);
 }
 
 _public_ int sd_event_new(sd_event** ret) {
+        const char *p;
         sd_event *e;
         int r;
 
@@ -441,6 +643,13 @@ _public_ int sd_event_new(sd_event** ret) {
         e->realtime.wakeup = e->boottime.wakeup = e->monotonic.wakeup = e->realtime_alarm.wakeup = e->boottime_alarm.wakeup = WAKEUP_CLOCK_DATA;
         e->original_pid = getpid();
         e->perturb = USEC_INFINITY;
+        e->dispatch_budget = 1;
+
+        /* Allow turning on profiling for any daemon without
+         * recompiling it */
+        p = getenv("SD_EVENT_PROFILE");
+        if (p && parse_boolean(p) > 0)
+                e->profile = true;
 
         e->pending = prioq_new(pending_prioq_compare);
         if (!e->pending) {
@@ -494,6 +703,136 @@ static bool event_pid_changed(sd_event *e) {
         return e->original_pid != getpid();
 }
 
+static void uring_poll_queue(sd_event *e, struct uring_poll *p) {
+        assert(e);
+        assert(p);
+
+        if (p->queued)
+                return;
+
+        LIST_PREPEND(queue, e->uring_queue, p);
+        p->queued = true;
+}
+
+static void uring_poll_unqueue(sd_event *e, struct uring_poll *p) {
+        assert(e);
+        assert(p);
+
+        if (!p->queued)
+                return;
+
+        LIST_REMOVE(queue, e->uring_queue, p);
+        p->queued = false;
+}
+
+static int uring_poll_withdraw(sd_event *e, struct uring_poll *p) {
+        int r;
+
+        assert(e);
+        assert(p);
+
+        /* Completions for the old generation are ignored from now
+         * on, even if they are already queued */
+        if (p->armed) {
+                r = event_uring_poll_remove(e->uring,
+                                            URING_USER_DATA(p->fd, p->generation),
+                                            URING_USER_DATA(URING_SLOT_IGNORE, 0));
+                if (r < 0)
+                        return r;
+
+                p->armed = false;
+        }
+
+        p->generation = ++e->uring_generation;
+        return 0;
+}
+
+static int event_poll_ctl_uring(sd_event *e, int op, int fd, struct epoll_event *ev) {
+        struct uring_poll *p;
+        int r;
+
+        assert(e);
+        assert(e->uring);
+        assert(fd >= 0);
+
+        p = hashmap_get(e->uring_polls, FD_TO_PTR(fd));
+
+        switch (op) {
+
+        case EPOLL_CTL_ADD:
+                if (p)
+                        return -EEXIST;
+
+                r = hashmap_ensure_allocated(&e->uring_polls, NULL);
+                if (r < 0)
+                        return r;
+
+                p = new0(struct uring_poll, 1);
+                if (!p)
+                        return -ENOMEM;
+
+                p->fd = fd;
+                p->generation = ++e->uring_generation;
+
+                r = hashmap_put(e->uring_polls, FD_TO_PTR(fd), p);
+                if (r < 0) {
+                        free(p);
+                        return r;
+                }
+
+                break;
+
+        case EPOLL_CTL_MOD:
+                if (!p)
+                        return -ENOENT;
+
+                r = uring_poll_withdraw(e, p);
+                if (r < 0)
+                        return r;
+
+                break;
+
+        case EPOLL_CTL_DEL:
+                if (!p)
+                        return -ENOENT;
+
+                r = uring_poll_withdraw(e, p);
+                uring_poll_unqueue(e, p);
+                hashmap_remove(e->uring_polls, FD_TO_PTR(fd));
+                free(p);
+
+                return r;
+
+        default:
+                assert_not_reached("Invalid poll operation");
+        }
+
+        /* The actual poll request is only queued when we go to
+         * sleep next, so that changes to the same fd within one
+         * iteration are collapsed */
+        p->events = ev->events;
+        p->data = ev->data.ptr;
+        uring_poll_queue(e, p);
+
+        return 0;
+}
+
+static int event_poll_ctl(sd_event *e, int op, int fd, struct epoll_event *ev) {
+        assert(e);
+
+        /* Like epoll_ctl(), but works with either backend, and
+         * returns a negative errno. Note that with io_uring fds need
+         * to be removed explicitly before they are closed. */
+
+        if (e->uring)
+                return event_poll_ctl_uring(e, op, fd, ev);
+
+        if (epoll_ctl(e->epoll_fd, op, fd, ev) < 0)
+                return -errno;
+
+        return 0;
+}
+
 static void source_io_unregister(sd_event_source *s) {
         int r;
 
@@ -506,9 +845,9 @@ static void source_io_unregister(sd_event_source *s) {
         if (!s->io.registered)
                 return;
 
-        r = epoll_ctl(s->event->epoll_fd, EPOLL_CTL_DEL, s->io.fd, NULL);
+        r = event_poll_ctl(s->event, EPOLL_CTL_DEL, s->io.fd, NULL);
         if (r < 0)
-                log_debug_errno(errno, "Failed to remove source %s from epoll: %m", strna(s->description));
+                log_debug_errno(r, "Failed to remove source %s from epoll: %m", strna(s->description));
 
         s->io.registered = false;
 }
@@ -532,11 +871,11 @@ static int source_io_register(
                 ev.events |= EPOLLONESHOT;
 
         if (s->io.registered)
-                r = epoll_ctl(s->event->epoll_fd, EPOLL_CTL_MOD, s->io.fd, &ev);
+                r = event_poll_ctl(s->event, EPOLL_CTL_MOD, s->io.fd, &ev);
         else
-                r = epoll_ctl(s->event->epoll_fd, EPOLL_CTL_ADD, s->io.fd, &ev);
+                r = event_poll_ctl(s->event, EPOLL_CTL_ADD, s->io.fd, &ev);
         if (r < 0)
-                return -errno;
+                return r;
 
         s->io.registered = true;
 
@@ -687,11 +1026,9 @@ static int event_make_signal_data(
         ev.events = EPOLLIN;
         ev.data.ptr = d;
 
-        r = epoll_ctl(e->epoll_fd, EPOLL_CTL_ADD, d->fd, &ev);
-        if (r < 0)  {
-                r = -errno;
+        r = event_poll_ctl(e, EPOLL_CTL_ADD, d->fd, &ev);
+        if (r < 0)
                 goto fail;
-        }
 
         if (ret)
                 *ret = d;
@@ -726,6 +1063,8 @@ static void event_unmask_signal_data(sd_event *e, struct signal_data *d, int sig
                 /* If all the mask is all-zero we can get rid of the structure */
                 hashmap_remove(e->signal_data, &d->priority);
                 assert(!d->current);
+                if (e->uring)
+                        (void) event_poll_ctl(e, EPOLL_CTL_DEL, d->fd, NULL);
                 safe_close(d->fd);
                 free(d);
                 return;
@@ -811,8 +1150,7 @@ static void source_disconnect(sd_event_source *s) {
                 d = event_get_clock_data(s->event, s->type);
                 assert(d);
 
-                prioq_remove(d->earliest, s, &s->time.earliest_index);
-                prioq_remove(d->latest, s, &s->time.latest_index);
+                clock_data_remove(d, s);
                 d->needs_rearm = true;
                 break;
         }
@@ -896,6 +1234,9 @@ static int source_set_pending(sd_event_source *s, bool b) {
         if (b) {
                 s->pending_iteration = s->event->iteration;
 
+                if (s->event->profile)
+                        s->stats.pending_since = now(CLOCK_MONOTONIC);
+
                 r = prioq_put(s->event->pending, s, &s->pending_index);
                 if (r < 0) {
                         s->pending = false;
@@ -910,8 +1251,7 @@ static int source_set_pending(sd_event_source *s, bool b) {
                 d = event_get_clock_data(s->event, s->type);
                 assert(d);
 
-                prioq_reshuffle(d->earliest, s, &s->time.earliest_index);
-                prioq_reshuffle(d->latest, s, &s->time.latest_index);
+                clock_data_reshuffle(d, s);
                 d->needs_rearm = true;
         }
 
@@ -1021,8 +1361,16 @@ static int event_setup_timer_fd(
         assert(e);
         assert(d);
 
-        if (_likely_(d->fd >= 0))
+        if (_likely_(d->fd >= 0 || d->uring_timeout))
+                return 0;
+
+        /* Ring timeouts can't wake up the system, hence the alarm
+         * clocks stay with timerfds even with io_uring */
+        if (e->uring && !IN_SET(clock, CLOCK_REALTIME_ALARM, CLOCK_BOOTTIME_ALARM)) {
+                d->uring_clock = clock;
+                d->uring_timeout = true;
                 return 0;
+        }
 
         fd = timerfd_create(clock, TFD_NONBLOCK|TFD_CLOEXEC);
         if (fd < 0)
@@ -1031,10 +1379,10 @@ static int event_setup_timer_fd(
         ev.events = EPOLLIN;
         ev.data.ptr = d;
 
-        r = epoll_ctl(e->epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+        r = event_poll_ctl(e, EPOLL_CTL_ADD, fd, &ev);
         if (r < 0) {
                 safe_close(fd);
-                return -errno;
+                return r;
         }
 
         d->fd = fd;
@@ -1076,23 +1424,13 @@ _public_ int sd_event_add_time(
         d = event_get_clock_data(e, type);
         assert(d);
 
-        if (!d->earliest) {
-                d->earliest = prioq_new(earliest_time_prioq_compare);
-                if (!d->earliest)
-                        return -ENOMEM;
-        }
-
-        if (!d->latest) {
-                d->latest = prioq_new(latest_time_prioq_compare);
-                if (!d->latest)
-                        return -ENOMEM;
-        }
+        r = clock_data_allocate(e, d);
+        if (r < 0)
+                return r;
 
-        if (d->fd < 0) {
-                r = event_setup_timer_fd(e, d, clock);
-                if (r < 0)
-                        return r;
-        }
+        r = event_setup_timer_fd(e, d, clock);
+        if (r < 0)
+                return r;
 
         s = source_new(e, !ret, type);
         if (!s)
@@ -1102,16 +1440,14 @@ _public_ int sd_event_add_time(
         s->time.accuracy = accuracy == 0 ? DEFAULT_ACCURACY_USEC : accuracy;
         s->time.callback = callback;
         s->time.earliest_index = s->time.latest_index = PRIOQ_IDX_NULL;
+        timer_wheel_entry_init(&s->time.earliest_entry);
+        timer_wheel_entry_init(&s->time.latest_entry);
         s->userdata = userdata;
         s->enabled = SD_EVENT_ONESHOT;
 
         d->needs_rearm = true;
 
-        r = prioq_put(d->earliest, s, &s->time.earliest_index);
-        if (r < 0)
-                goto fail;
-
-        r = prioq_put(d->latest, s, &s->time.latest_index);
+        r = clock_data_put(d, s);
         if (r < 0)
                 goto fail;
 
@@ -1472,7 +1808,7 @@ _public_ int sd_event_source_set_io_fd(sd_event_source *s, int fd) {
                         return r;
                 }
 
-                epoll_ctl(s->event->epoll_fd, EPOLL_CTL_DEL, saved_fd, NULL);
+                (void) event_poll_ctl(s->event, EPOLL_CTL_DEL, saved_fd, NULL);
         }
 
         return 0;
@@ -1625,8 +1961,7 @@ _public_ int sd_event_source_set_enabled(sd_event_source *s, int m) {
                         d = event_get_clock_data(s->event, s->type);
                         assert(d);
 
-                        prioq_reshuffle(d->earliest, s, &s->time.earliest_index);
-                        prioq_reshuffle(d->latest, s, &s->time.latest_index);
+                        clock_data_reshuffle(d, s);
                         d->needs_rearm = true;
                         break;
                 }
@@ -1682,8 +2017,7 @@ _public_ int sd_event_source_set_enabled(sd_event_source *s, int m) {
                         d = event_get_clock_data(s->event, s->type);
                         assert(d);
 
-                        prioq_reshuffle(d->earliest, s, &s->time.earliest_index);
-                        prioq_reshuffle(d->latest, s, &s->time.latest_index);
+                        clock_data_reshuffle(d, s);
                         d->needs_rearm = true;
                         break;
                 }
@@ -1768,8 +2102,7 @@ _public_ int sd_event_source_set_time(sd_event_source *s, uint64_t usec) {
         d = event_get_clock_data(s->event, s->type);
         assert(d);
 
-        prioq_reshuffle(d->earliest, s, &s->time.earliest_index);
-        prioq_reshuffle(d->latest, s, &s->time.latest_index);
+        clock_data_reshuffle(d, s);
         d->needs_rearm = true;
 
         return 0;
@@ -1804,7 +2137,10 @@ _public_ int sd_event_source_set_time_accuracy(sd_event_source *s, uint64_t usec
         d = event_get_clock_data(s->event, s->type);
         assert(d);
 
-        prioq_reshuffle(d->latest, s, &s->time.latest_index);
+        if (d->latest_wheel)
+                clock_data_reshuffle(d, s);
+        else
+                prioq_reshuffle(d->latest, s, &s->time.latest_index);
         d->needs_rearm = true;
 
         return 0;
@@ -1957,11 +2293,63 @@ static usec_t sleep_between(sd_event *e, usec_t a, usec_t b) {
         return b;
 }
 
+static int clock_data_set_timer(sd_event *e, struct clock_data *d, usec_t t) {
+        struct itimerspec its = {};
+        uint32_t slot;
+        int r;
+
+        assert(e);
+        assert(d);
+
+        /* Arms the clock for absolute time t, or disarms it if t is
+         * USEC_INFINITY */
+
+        if (d->uring_timeout) {
+                slot = URING_SLOT_CLOCK + clock_to_event_source_type(d->uring_clock);
+
+                if (d->uring_armed) {
+                        r = event_uring_timeout_remove(e->uring,
+                                                       URING_USER_DATA(slot, d->uring_generation),
+                                                       URING_USER_DATA(URING_SLOT_IGNORE, 0));
+                        if (r < 0)
+                                return r;
+
+                        d->uring_armed = false;
+                }
+
+                d->uring_generation++;
+
+                if (t == USEC_INFINITY)
+                        return 0;
+
+                r = event_uring_timeout(e->uring, d->uring_clock, t, URING_USER_DATA(slot, d->uring_generation));
+                if (r < 0)
+                        return r;
+
+                d->uring_armed = true;
+                return 0;
+        }
+
+        assert(d->fd >= 0);
+
+        if (t == 0) {
+                /* We don' want to disarm here, just mean some time looooong ago. */
+                its.it_value.tv_sec = 0;
+                its.it_value.tv_nsec = 1;
+        } else if (t != USEC_INFINITY)
+                timespec_store(&its.it_value, t);
+
+        r = timerfd_settime(d->fd, TFD_TIMER_ABSTIME, &its, NULL);
+        if (r < 0)
+                return -errno;
+
+        return 0;
+}
+
 static int event_arm_timer(
                 sd_event *e,
                 struct clock_data *d) {
 
-        struct itimerspec its = {};
         sd_event_source *a, *b;
         usec_t t;
         int r;
@@ -1974,17 +2362,17 @@ static int event_arm_timer(
         else
                 d->needs_rearm = false;
 
-        a = prioq_peek(d->earliest);
+        a = clock_data_peek_earliest(d);
         if (!a || a->enabled == SD_EVENT_OFF) {
 
-                if (d->fd < 0)
+                if (d->fd < 0 && !d->uring_timeout)
                         return 0;
 
                 if (d->next == USEC_INFINITY)
                         return 0;
 
                 /* disarm */
-                r = timerfd_settime(d->fd, TFD_TIMER_ABSTIME, &its, NULL);
+                r = clock_data_set_timer(e, d, USEC_INFINITY);
                 if (r < 0)
                         return r;
 
@@ -1992,25 +2380,16 @@ static int event_arm_timer(
                 return 0;
         }
 
-        b = prioq_peek(d->latest);
+        b = clock_data_peek_latest(d);
         assert_se(b && b->enabled != SD_EVENT_OFF);
 
         t = sleep_between(e, a->time.next, b->time.next + b->time.accuracy);
         if (d->next == t)
                 return 0;
 
-        assert_se(d->fd >= 0);
-
-        if (t == 0) {
-                /* We don' want to disarm here, just mean some time looooong ago. */
-                its.it_value.tv_sec = 0;
-                its.it_value.tv_nsec = 1;
-        } else
-                timespec_store(&its.it_value, t);
-
-        r = timerfd_settime(d->fd, TFD_TIMER_ABSTIME, &its, NULL);
+        r = clock_data_set_timer(e, d, t);
         if (r < 0)
-                return -errno;
+                return r;
 
         d->next = t;
         return 0;
@@ -2073,7 +2452,7 @@ static int process_timer(
         assert(d);
 
         for (;;) {
-                s = prioq_peek(d->earliest);
+                s = clock_data_peek_earliest(d);
                 if (!s ||
                     s->time.next > n ||
                     s->enabled == SD_EVENT_OFF ||
@@ -2084,8 +2463,7 @@ static int process_timer(
                 if (r < 0)
                         return r;
 
-                prioq_reshuffle(d->earliest, s, &s->time.earliest_index);
-                prioq_reshuffle(d->latest, s, &s->time.latest_index);
+                clock_data_reshuffle(d, s);
                 d->needs_rearm = true;
         }
 
@@ -2220,12 +2598,39 @@ static int process_signal(sd_event *e, struct signal_data *d, uint32_t events) {
         }
 }
 
+static void source_account(sd_event_source *s, usec_t begin, usec_t end) {
+        usec_t d;
+
+        assert(s);
+
+        s->stats.n_dispatched++;
+
+        d = end - begin;
+        s->stats.runtime += d;
+        s->stats.runtime_max = MAX(s->stats.runtime_max, d);
+
+        /* Exit sources are never pending, and the pending time of
+         * sources enabled while profiling was off is not known */
+        if (s->type != SOURCE_EXIT && s->stats.pending_since > 0 && s->stats.pending_since <= begin) {
+                d = begin - s->stats.pending_since;
+                s->stats.latency += d;
+                s->stats.latency_max = MAX(s->stats.latency_max, d);
+        }
+
+        /* Defer sources stay pending, count from now on */
+        s->stats.pending_since = s->type == SOURCE_DEFER ? end : 0;
+}
+
 static int source_dispatch(sd_event_source *s) {
+        usec_t begin = 0;
         int r = 0;
 
         assert(s);
         assert(s->pending || s->type == SOURCE_EXIT);
 
+        if (s->event->profile)
+                begin = now(CLOCK_MONOTONIC);
+
         if (s->type != SOURCE_DEFER && s->type != SOURCE_EXIT) {
                 r = source_set_pending(s, false);
                 if (r < 0)
@@ -2311,6 +2716,9 @@ static int source_dispatch(sd_event_source *s) {
 
         s->dispatching = false;
 
+        if (begin > 0)
+                source_account(s, begin, now(CLOCK_MONOTONIC));
+
         if (r < 0) {
                 if (s->description)
                         log_debug_errno(r, "Event source '%s' returned error, disabling: %m", s->description);
@@ -2446,6 +2854,35 @@ static int process_watchdog(sd_event *e) {
         return arm_watchdog(e);
 }
 
+static int event_uring_queue_polls(sd_event *e) {
+        struct uring_poll *p;
+        int r;
+
+        assert(e);
+        assert(e->uring);
+
+        while ((p = e->uring_queue)) {
+                assert(!p->armed);
+
+                /* EPOLLET maps to a multishot request, which is only
+                 * triggered by new wake-ups, everything else is
+                 * level-triggered and hence one-shot and requeued
+                 * after each completion */
+                r = event_uring_poll_add(e->uring,
+                                         p->fd,
+                                         p->events & ~(EPOLLET|EPOLLONESHOT|EPOLLWAKEUP),
+                                         (p->events & (EPOLLET|EPOLLONESHOT)) == EPOLLET,
+                                         URING_USER_DATA(p->fd, p->generation));
+                if (r < 0)
+                        return r;
+
+                uring_poll_unqueue(e, p);
+                p->armed = true;
+        }
+
+        return 0;
+}
+
 _public_ int sd_event_prepare(sd_event *e) {
         int r;
 
@@ -2486,6 +2923,19 @@ _public_ int sd_event_prepare(sd_event *e) {
         if (event_next_pending(e) || e->need_process_child)
                 goto pending;
 
+        /* If somebody else polls the ring fd for us, then they need
+         * to see the completions for what we queued, hence submit
+         * it right away */
+        if (e->uring && e->uring_exported) {
+                r = event_uring_queue_polls(e);
+                if (r < 0)
+                        return r;
+
+                r = event_uring_submit(e->uring);
+                if (r < 0)
+                        return r;
+        }
+
         e->state = SD_EVENT_ARMED;
 
         return 0;
@@ -2499,38 +2949,10 @@ pending:
         return r;
 }
 
-_public_ int sd_event_wait(sd_event *e, uint64_t timeout) {
-        struct epoll_event *ev_queue;
-        unsigned ev_queue_max;
-        int r, m, i;
+static int process_epoll(sd_event *e, const struct epoll_event *ev_queue, int m) {
+        int r = 0, i;
 
-        assert_return(e, -EINVAL);
-        assert_return(!event_pid_changed(e), -ECHILD);
-        assert_return(e->state != SD_EVENT_FINISHED, -ESTALE);
-        assert_return(e->state == SD_EVENT_ARMED, -EBUSY);
-
-        if (e->exit_requested) {
-                e->state = SD_EVENT_PENDING;
-                return 1;
-        }
-
-        ev_queue_max = MAX(e->n_sources, 1u);
-        ev_queue = newa(struct epoll_event, ev_queue_max);
-
-        m = epoll_wait(e->epoll_fd, ev_queue, ev_queue_max,
-                       timeout == (uint64_t) -1 ? -1 : (int) ((timeout + USEC_PER_MSEC - 1) / USEC_PER_MSEC));
-        if (m < 0) {
-                if (errno == EINTR) {
-                        e->state = SD_EVENT_PENDING;
-                        return 1;
-                }
-
-                r = -errno;
-                goto finish;
-        }
-
-        dual_timestamp_get(&e->timestamp);
-        e->timestamp_boottime = now(CLOCK_BOOTTIME);
+        assert(e);
 
         for (i = 0; i < m; i++) {
 
@@ -2560,9 +2982,194 @@ _public_ int sd_event_wait(sd_event *e, uint64_t timeout) {
                         }
                 }
                 if (r < 0)
-                        goto finish;
+                        return r;
+        }
+
+        return 0;
+}
+
+static int event_queue_ensure(sd_event *e, size_t n) {
+        struct epoll_event *q;
+
+        assert(e);
+
+        if (e->event_queue_allocated >= n)
+                return 0;
+
+        q = realloc(e->event_queue, n * sizeof(struct epoll_event));
+        if (!q)
+                return -ENOMEM;
+
+        e->event_queue = q;
+        e->event_queue_allocated = n;
+
+        return 0;
+}
+
+static int event_wait_epoll(sd_event *e, uint64_t timeout) {
+        unsigned n_rounds = 0;
+        size_t n_queue, n_events = 0;
+        int r, m;
+
+        assert(e);
+
+        /* The event buffer is kept around between iterations. It
+         * grows with the number of sources, but only up to a
+         * limit. If it fills up while there are more sources than
+         * we fetched, we simply go back for more. */
+        r = event_queue_ensure(e, CLAMP((size_t) e->n_sources, 1U, EPOLL_QUEUE_MAX));
+        if (r < 0)
+                return r;
+
+        n_queue = e->event_queue_allocated;
+
+        m = epoll_wait(e->epoll_fd, e->event_queue, n_queue,
+                       timeout == (uint64_t) -1 ? -1 : (int) ((timeout + USEC_PER_MSEC - 1) / USEC_PER_MSEC));
+        if (m < 0)
+                return -errno;
+
+        dual_timestamp_get(&e->timestamp);
+        e->timestamp_boottime = now(CLOCK_BOOTTIME);
+
+        for (;;) {
+                r = process_epoll(e, e->event_queue, m);
+                if (r < 0)
+                        return r;
+
+                n_events += m;
+                if ((size_t) m < n_queue ||
+                    n_events >= e->n_sources ||
+                    ++n_rounds >= EPOLL_QUEUE_ROUNDS_MAX)
+                        break;
+
+                m = epoll_wait(e->epoll_fd, e->event_queue, n_queue, 0);
+                if (m < 0) {
+                        if (errno == EINTR)
+                                break;
+
+                        return -errno;
+                }
+        }
+
+        return 0;
+}
+
+static int process_uring(sd_event *e) {
+        struct uring_poll *p;
+        size_t n_queue, m = 0;
+        uint64_t user_data;
+        int32_t res;
+        bool more;
+        int r;
+
+        assert(e);
+        assert(e->uring);
+
+        r = event_queue_ensure(e, CLAMP((size_t) e->n_sources, 1U, EPOLL_QUEUE_MAX));
+        if (r < 0)
+                return r;
+
+        n_queue = e->event_queue_allocated;
+
+        /* Translate the poll completions into epoll events, so that
+         * they can be processed the same way */
+        while (event_uring_next(e->uring, &user_data, &res, &more)) {
+                uint32_t slot = user_data >> 32, generation = (uint32_t) user_data;
+
+                if (slot == URING_SLOT_IGNORE)
+                        continue;
+
+                if (slot >= URING_SLOT_CLOCK) {
+                        struct clock_data *d;
+
+                        d = event_get_clock_data(e, slot - URING_SLOT_CLOCK);
+                        assert(d);
+
+                        if (d->uring_generation != generation || !d->uring_armed)
+                                continue;
+
+                        /* The timeout elapsed, make sure it is rearmed */
+                        d->uring_armed = false;
+                        d->next = USEC_INFINITY;
+                        continue;
+                }
+
+                p = hashmap_get(e->uring_polls, FD_TO_PTR((int) slot));
+                if (!p || p->generation != generation || !p->armed)
+                        continue;
+
+                if (!more) {
+                        p->armed = false;
+
+                        if (!(p->events & EPOLLONESHOT))
+                                uring_poll_queue(e, p);
+                }
+
+                if (res == -ECANCELED)
+                        continue;
+
+                e->event_queue[m].events = res < 0 ? EPOLLERR : (uint32_t) res;
+                e->event_queue[m].data.ptr = p->data;
+
+                if (++m >= n_queue) {
+                        r = process_epoll(e, e->event_queue, m);
+                        if (r < 0)
+                                return r;
+
+                        m = 0;
+                }
+        }
+
+        return process_epoll(e, e->event_queue, m);
+}
+
+static int event_wait_uring(sd_event *e, uint64_t timeout) {
+        int r;
+
+        assert(e);
+        assert(e->uring);
+
+        /* All poll requests and timer updates that queued up since
+         * the last iteration are submitted with the same system call
+         * we wait with */
+        r = event_uring_queue_polls(e);
+        if (r < 0)
+                return r;
+
+        r = event_uring_enter(e->uring, timeout == (uint64_t) -1 ? USEC_INFINITY : timeout);
+        if (r < 0)
+                return r;
+
+        dual_timestamp_get(&e->timestamp);
+        e->timestamp_boottime = now(CLOCK_BOOTTIME);
+
+        return process_uring(e);
+}
+
+_public_ int sd_event_wait(sd_event *e, uint64_t timeout) {
+        int r;
+
+        assert_return(e, -EINVAL);
+        assert_return(!event_pid_changed(e), -ECHILD);
+        assert_return(e->state != SD_EVENT_FINISHED, -ESTALE);
+        assert_return(e->state == SD_EVENT_ARMED, -EBUSY);
+
+        if (e->exit_requested) {
+                e->state = SD_EVENT_PENDING;
+                return 1;
         }
 
+        if (e->uring)
+                r = event_wait_uring(e, timeout);
+        else
+                r = event_wait_epoll(e, timeout);
+        if (r == -EINTR) {
+                e->state = SD_EVENT_PENDING;
+                return 1;
+        }
+        if (r < 0)
+                goto finish;
+
         r = process_watchdog(e);
         if (r < 0)
                 goto finish;
@@ -2621,10 +3228,36 @@ _public_ int sd_event_dispatch(sd_event *e) {
 
         p = event_next_pending(e);
         if (p) {
+                int64_t priority = p->priority;
+                unsigned n = 0;
+
                 sd_event_ref(e);
 
                 e->state = SD_EVENT_RUNNING;
-                r = source_dispatch(p);
+
+                /* Dispatch up to the budget of pending sources in one
+                 * go, as long as they have the priority we started
+                 * with. Defer sources stay pending after being
+                 * dispatched, hence never dispatch a source twice, and
+                 * leave post sources for after everything else. */
+                for (;;) {
+                        p->dispatch_iteration = e->iteration;
+
+                        r = source_dispatch(p);
+                        if (r < 0)
+                                break;
+
+                        if (++n >= e->dispatch_budget || e->exit_requested)
+                                break;
+
+                        p = event_next_pending(e);
+                        if (!p ||
+                            p->priority != priority ||
+                            p->type == SOURCE_POST ||
+                            p->dispatch_iteration == e->iteration)
+                                break;
+                }
+
                 e->state = SD_EVENT_INITIAL;
 
                 sd_event_unref(e);
@@ -2689,6 +3322,11 @@ _public_ int sd_event_get_fd(sd_event *e) {
         assert_return(e, -EINVAL);
         assert_return(!event_pid_changed(e), -ECHILD);
 
+        if (e->uring) {
+                e->uring_exported = true;
+                return event_uring_get_fd(e->uring);
+        }
+
         return e->epoll_fd;
 }
 
@@ -2824,15 +3462,13 @@ _public_ int sd_event_set_watchdog(sd_event *e, int b) {
                 ev.events = EPOLLIN;
                 ev.data.ptr = INT_TO_PTR(SOURCE_WATCHDOG);
 
-                r = epoll_ctl(e->epoll_fd, EPOLL_CTL_ADD, e->watchdog_fd, &ev);
-                if (r < 0) {
-                        r = -errno;
+                r = event_poll_ctl(e, EPOLL_CTL_ADD, e->watchdog_fd, &ev);
+                if (r < 0)
                         goto fail;
-                }
 
         } else {
                 if (e->watchdog_fd >= 0) {
-                        epoll_ctl(e->epoll_fd, EPOLL_CTL_DEL, e->watchdog_fd, NULL);
+                        (void) event_poll_ctl(e, EPOLL_CTL_DEL, e->watchdog_fd, NULL);
                         e->watchdog_fd = safe_close(e->watchdog_fd);
                 }
         }
@@ -2851,3 +3487,172 @@ _public_ int sd_event_get_watchdog(sd_event *e) {
 
         return e->watchdog;
 }
+
+_public_ int sd_event_set_dispatch_budget(sd_event *e, unsigned budget) {
+        assert_return(e, -EINVAL);
+        assert_return(budget > 0, -EINVAL);
+        assert_return(!event_pid_changed(e), -ECHILD);
+
+        e->dispatch_budget = budget;
+        return 0;
+}
+
+_public_ int sd_event_get_dispatch_budget(sd_event *e, unsigned *budget) {
+        assert_return(e, -EINVAL);
+        assert_return(budget, -EINVAL);
+        assert_return(!event_pid_changed(e), -ECHILD);
+
+        *budget = e->dispatch_budget;
+        return 0;
+}
+
+_public_ int sd_event_set_timer_wheel(sd_event *e, int b) {
+        assert_return(e, -EINVAL);
+        assert_return(e->state != SD_EVENT_FINISHED, -ESTALE);
+        assert_return(!event_pid_changed(e), -ECHILD);
+
+        /* The backend can only be switched as long as no time
+         * sources have been added yet */
+        if (clock_data_allocated(&e->realtime) ||
+            clock_data_allocated(&e->boottime) ||
+            clock_data_allocated(&e->monotonic) ||
+            clock_data_allocated(&e->realtime_alarm) ||
+            clock_data_allocated(&e->boottime_alarm))
+                return -EBUSY;
+
+        e->timer_wheel = b;
+        return 0;
+}
+
+_public_ int sd_event_get_timer_wheel(sd_event *e) {
+        assert_return(e, -EINVAL);
+        assert_return(!event_pid_changed(e), -ECHILD);
+
+        return e->timer_wheel;
+}
+
+_public_ int sd_event_set_io_uring(sd_event *e, int b) {
+        int r;
+
+        assert_return(e, -EINVAL);
+        assert_return(e->state != SD_EVENT_FINISHED, -ESTALE);
+        assert_return(!event_pid_changed(e), -ECHILD);
+
+        if (!!e->uring == !!b)
+                return 0;
+
+        /* The backend can only be switched as long as nothing has
+         * been registered with the old one yet */
+        if (e->n_sources > 0 ||
+            e->watchdog ||
+            !hashmap_isempty(e->signal_data) ||
+            clock_data_allocated(&e->realtime) ||
+            clock_data_allocated(&e->boottime) ||
+            clock_data_allocated(&e->monotonic) ||
+            clock_data_allocated(&e->realtime_alarm) ||
+            clock_data_allocated(&e->boottime_alarm))
+                return -EBUSY;
+
+        if (b) {
+                r = event_uring_new(&e->uring, URING_ENTRIES);
+                if (r < 0)
+                        return r;
+        } else {
+                assert(hashmap_isempty(e->uring_polls));
+
+                e->uring_polls = hashmap_free(e->uring_polls);
+                e->uring = event_uring_free(e->uring);
+                e->uring_exported = false;
+        }
+
+        return 0;
+}
+
+_public_ int sd_event_get_io_uring(sd_event *e) {
+        assert_return(e, -EINVAL);
+        assert_return(!event_pid_changed(e), -ECHILD);
+
+        return !!e->uring;
+}
+
+_public_ int sd_event_set_profile(sd_event *e, int b) {
+        assert_return(e, -EINVAL);
+        assert_return(e->state != SD_EVENT_FINISHED, -ESTALE);
+        assert_return(!event_pid_changed(e), -ECHILD);
+
+        e->profile = b;
+        return 0;
+}
+
+_public_ int sd_event_get_profile(sd_event *e) {
+        assert_return(e, -EINVAL);
+        assert_return(!event_pid_changed(e), -ECHILD);
+
+        return e->profile;
+}
+
+static const char* const event_source_type_table[_SOURCE_EVENT_SOURCE_TYPE_MAX] = {
+        [SOURCE_IO] = "io",
+        [SOURCE_TIME_REALTIME] = "realtime",
+        [SOURCE_TIME_BOOTTIME] = "boottime",
+        [SOURCE_TIME_MONOTONIC] = "monotonic",
+        [SOURCE_TIME_REALTIME_ALARM] = "realtime-alarm",
+        [SOURCE_TIME_BOOTTIME_ALARM] = "boottime-alarm",
+        [SOURCE_SIGNAL] = "signal",
+        [SOURCE_CHILD] = "child",
+        [SOURCE_DEFER] = "defer",
+        [SOURCE_POST] = "post",
+        [SOURCE_EXIT] = "exit",
+        [SOURCE_WATCHDOG] = "watchdog",
+};
+
+DEFINE_PRIVATE_STRING_TABLE_LOOKUP_TO_STRING(event_source_type, int);
+
+int event_get_statistics(sd_event *e, EventSourceStatistics **ret, unsigned *ret_n) {
+        EventSourceStatistics *stats;
+        sd_event_source *s;
+        unsigned n = 0;
+
+        assert(e);
+        assert(ret);
+        assert(ret_n);
+
+        stats = new0(EventSourceStatistics, MAX(e->n_sources, 1U));
+        if (!stats)
+                return -ENOMEM;
+
+        LIST_FOREACH(sources, s, e->sources) {
+                EventSourceStatistics *i = stats + n++;
+
+                assert(n <= e->n_sources);
+
+                if (s->description) {
+                        i->description = strdup(s->description);
+                        if (!i->description) {
+                                event_statistics_free(stats, n);
+                                return -ENOMEM;
+                        }
+                }
+
+                i->type = event_source_type_to_string(s->type);
+                i->n_dispatched = s->stats.n_dispatched;
+                i->runtime = s->stats.runtime;
+                i->runtime_max = s->stats.runtime_max;
+                i->latency = s->stats.latency;
+                i->latency_max = s->stats.latency_max;
+        }
+
+        *ret = stats;
+        *ret_n = n;
+
+        return 0;
+}
+
+void event_statistics_free(EventSourceStatistics *stats, unsigned n) {
+        unsigned i;
+
+        for (i = 0; i < n; i++)
+                free(stats[i].description);
+
+        free(stats);
+}
@@ -20,10 +20,12 @@
 ***/
 
 #include "sd-event.h"
+#include "event-util.h"
 #include "log.h"
 #include "util.h"
 #include "macro.h"
 #include "signal-util.h"
+#include "time-util.h"
 
 static int prepare_handler(sd_event_source *s, void *userdata) {
         log_info("preparing %c", PTR_TO_INT(userdata));
@@ -156,7 +158,7 @@ static int exit_handler(sd_event_source *s, void *userdata) {
         return 3;
 }
 
-static void test_basic(void) {
+static void test_basic(bool uring) {
         sd_event *e = NULL;
         sd_event_source *w = NULL, *x = NULL, *y = NULL, *z = NULL, *q = NULL, *t = NULL;
         static const char ch = 'x';
@@ -167,8 +169,18 @@ static void test_basic(void) {
         assert_se(pipe(d) >= 0);
         assert_se(pipe(k) >= 0);
 
+        do_quit = got_exit = false;
+
         assert_se(sd_event_default(&e) >= 0);
 
+        if (uring && sd_event_set_io_uring(e, true) < 0) {
+                log_info("io_uring not available, skipping.");
+                sd_event_unref(e);
+                return;
+        }
+
+        assert_se(sd_event_get_io_uring(e) == uring);
+
         assert_se(sd_event_set_watchdog(e, true) >= 0);
 
         /* Test whether we cleanly can destroy an io event source from its own handler */
@@ -255,12 +267,20 @@ static int rtqueue_handler(sd_event_source *s, const struct signalfd_siginfo *si
         return 0;
 }
 
-static void test_rtqueue(void) {
+static void test_rtqueue(bool uring) {
         sd_event_source *u = NULL, *v = NULL, *s = NULL;
         sd_event *e = NULL;
 
+        last_rtqueue_sigval = n_rtqueue = 0;
+
         assert_se(sd_event_default(&e) >= 0);
 
+        if (uring && sd_event_set_io_uring(e, true) < 0) {
+                log_info("io_uring not available, skipping.");
+                sd_event_unref(e);
+                return;
+        }
+
         assert_se(sigprocmask_many(SIG_BLOCK, NULL, SIGRTMIN+2, SIGRTMIN+3, SIGUSR2, -1) >= 0);
         assert_se(sd_event_add_signal(e, &u, SIGRTMIN+2, rtqueue_handler, NULL) >= 0);
         assert_se(sd_event_add_signal(e, &v, SIGRTMIN+3, rtqueue_handler, NULL) >= 0);
@@ -304,10 +324,387 @@ static void test_rtqueue(void) {
         sd_event_unref(e);
 }
 
+static int count_handler(sd_event_source *s, int fd, uint32_t revents, void *userdata) {
+        unsigned *n = userdata;
+
+        (*n)++;
+        return 0;
+}
+
+static int count_defer_handler(sd_event_source *s, void *userdata) {
+        unsigned *n = userdata;
+
+        (*n)++;
+        return 0;
+}
+
+static void test_dispatch_budget(void) {
+        sd_event_source *x = NULL, *y = NULL, *z = NULL, *w = NULL;
+        unsigned n_x = 0, n_y = 0, n_z = 0, n_w = 0, budget;
+        int a[2], b[2], c[2];
+        sd_event *e = NULL;
+        char ch;
+
+        assert_se(sd_event_new(&e) >= 0);
+
+        assert_se(sd_event_get_dispatch_budget(e, &budget) >= 0);
+        assert_se(budget == 1);
+        assert_se(sd_event_set_dispatch_budget(e, 0) == -EINVAL);
+
+        assert_se(pipe(a) >= 0);
+        assert_se(pipe(b) >= 0);
+        assert_se(pipe(c) >= 0);
+
+        assert_se(write(a[1], "x", 1) == 1);
+        assert_se(write(b[1], "y", 1) == 1);
+        assert_se(write(c[1], "z", 1) == 1);
+
+        /* x and y share the top priority, z comes after them */
+        assert_se(sd_event_add_io(e, &x, a[0], EPOLLIN, count_handler, &n_x) >= 0);
+        assert_se(sd_event_add_io(e, &y, b[0], EPOLLIN, count_handler, &n_y) >= 0);
+        assert_se(sd_event_add_io(e, &z, c[0], EPOLLIN, count_handler, &n_z) >= 0);
+        assert_se(sd_event_source_set_priority(z, 1) >= 0);
+
+        /* One source per iteration by default */
+        assert_se(sd_event_run(e, 0) == 1);
+        assert_se(n_x + n_y == 1);
+        assert_se(n_z == 0);
+
+        n_x = n_y = 0;
+
+        /* All pending sources of the top priority, but nothing
+         * beyond it */
+        assert_se(sd_event_set_dispatch_budget(e, 16) >= 0);
+        assert_se(sd_event_run(e, 0) == 1);
+        assert_se(n_x == 1);
+        assert_se(n_y == 1);
+        assert_se(n_z == 0);
+
+        assert_se(read(a[0], &ch, 1) == 1);
+        assert_se(read(b[0], &ch, 1) == 1);
+
+        assert_se(sd_event_run(e, 0) == 1);
+        assert_se(n_x == 1);
+        assert_se(n_y == 1);
+        assert_se(n_z == 1);
+
+        assert_se(read(c[0], &ch, 1) == 1);
+
+        /* Defer sources stay pending, but are dispatched only once
+         * per iteration */
+        assert_se(sd_event_add_defer(e, &w, count_defer_handler, &n_w) >= 0);
+        assert_se(sd_event_source_set_enabled(w, SD_EVENT_ON) >= 0);
+        assert_se(sd_event_run(e, 0) == 1);
+        assert_se(n_w == 1);
+        assert_se(sd_event_run(e, 0) == 1);
+        assert_se(n_w == 2);
+
+        sd_event_source_unref(w);
+        sd_event_source_unref(x);
+        sd_event_source_unref(y);
+        sd_event_source_unref(z);
+
+        sd_event_unref(e);
+
+        safe_close_pair(a);
+        safe_close_pair(b);
+        safe_close_pair(c);
+}
+
+#define N_MANY_SOURCES 600
+
+static void test_many_sources(bool uring) {
+        sd_event_source *s[N_MANY_SOURCES] = {};
+        int fds[N_MANY_SOURCES];
+        sd_event *e = NULL;
+        unsigned i, n = 0;
+
+        assert_se(sd_event_new(&e) >= 0);
+
+        if (uring && sd_event_set_io_uring(e, true) < 0) {
+                log_info("io_uring not available, skipping.");
+                sd_event_unref(e);
+                return;
+        }
+
+        assert_se(sd_event_set_dispatch_budget(e, N_MANY_SOURCES) >= 0);
+
+        /* More ready sources than fit in the event buffer at once */
+        for (i = 0; i < N_MANY_SOURCES; i++) {
+                int p[2];
+
+                assert_se(pipe2(p, O_CLOEXEC) >= 0);
+                assert_se(write(p[1], "x", 1) == 1);
+                safe_close(p[1]);
+
+                fds[i] = p[0];
+                assert_se(sd_event_add_io(e, &s[i], fds[i], EPOLLIN, count_handler, &n) >= 0);
+        }
+
+        assert_se(sd_event_run(e, 0) == 1);
+        assert_se(n == N_MANY_SOURCES);
+
+        for (i = 0; i < N_MANY_SOURCES; i++) {
+                sd_event_source_unref(s[i]);
+                safe_close(fds[i]);
+        }
+
+        sd_event_unref(e);
+}
+
+#define N_BENCHMARK_SOURCES 64
+
+static void test_dispatch_benchmark(unsigned budget) {
+        sd_event_source *s[N_BENCHMARK_SOURCES] = {};
+        int p[N_BENCHMARK_SOURCES][2];
+        unsigned i, n = 0, n_runs = 0;
+        sd_event *e = NULL;
+        usec_t t, d;
+
+        assert_se(sd_event_new(&e) >= 0);
+        assert_se(sd_event_set_dispatch_budget(e, budget) >= 0);
+
+        /* Sources that are always ready, like a busy daemon sees
+         * them */
+        for (i = 0; i < N_BENCHMARK_SOURCES; i++) {
+                assert_se(pipe2(p[i], O_CLOEXEC) >= 0);
+                assert_se(write(p[i][1], "x", 1) == 1);
+                assert_se(sd_event_add_io(e, &s[i], p[i][0], EPOLLIN, count_handler, &n) >= 0);
+        }
+
+        t = now(CLOCK_MONOTONIC);
+        do {
+                assert_se(sd_event_run(e, 0) == 1);
+                n_runs++;
+                d = now(CLOCK_MONOTONIC) - t;
+        } while (d < 100 * USEC_PER_MSEC);
+
+        log_info("Dispatch budget %u: %u events in %u iterations, %.0f events/sec",
+                 budget, n, n_runs, (double) n * USEC_PER_SEC / d);
+
+        for (i = 0; i < N_BENCHMARK_SOURCES; i++) {
+                sd_event_source_unref(s[i]);
+                safe_close_pair(p[i]);
+        }
+
+        sd_event_unref(e);
+}
+
+static int rearm_handler(sd_event_source *s, uint64_t usec, void *userdata) {
+        unsigned *n = userdata;
+
+        (*n)++;
+
+        assert_se(sd_event_source_set_time(s, usec + 1) >= 0);
+        assert_se(sd_event_source_set_enabled(s, SD_EVENT_ONESHOT) >= 0);
+
+        return 0;
+}
+
+static void test_rearm_benchmark(bool uring) {
+        sd_event_source *s = NULL;
+        unsigned n = 0;
+        sd_event *e = NULL;
+        usec_t t, d;
+
+        assert_se(sd_event_new(&e) >= 0);
+
+        if (uring && sd_event_set_io_uring(e, true) < 0) {
+                log_info("io_uring not available, skipping.");
+                sd_event_unref(e);
+                return;
+        }
+
+        /* A timer that is rearmed every time it fires, which costs
+         * a timerfd update and read per iteration with epoll */
+        t = now(CLOCK_MONOTONIC);
+        assert_se(sd_event_add_time(e, &s, CLOCK_MONOTONIC, t, 1, rearm_handler, &n) >= 0);
+
+        do {
+                assert_se(sd_event_run(e, (uint64_t) -1) == 1);
+                d = now(CLOCK_MONOTONIC) - t;
+        } while (d < 100 * USEC_PER_MSEC);
+
+        log_info("%s: %u timer wakeups, %.0f wakeups/sec",
+                 uring ? "io_uring" : "epoll", n, (double) n * USEC_PER_SEC / d);
+
+        sd_event_source_unref(s);
+        sd_event_unref(e);
+}
+
+static int busy_handler(sd_event_source *s, void *userdata) {
+        usleep(1000);
+        return 0;
+}
+
+static void test_profile(void) {
+        EventSourceStatistics *stats;
+        sd_event_source *x = NULL, *y = NULL;
+        sd_event *e = NULL;
+        unsigned i, n;
+
+        assert_se(sd_event_new(&e) >= 0);
+        assert_se(sd_event_set_profile(e, true) >= 0);
+        assert_se(sd_event_get_profile(e) > 0);
+
+        assert_se(sd_event_add_defer(e, &x, busy_handler, NULL) >= 0);
+        assert_se(sd_event_source_set_description(x, "busy") >= 0);
+        assert_se(sd_event_source_set_enabled(x, SD_EVENT_ON) >= 0);
+        assert_se(sd_event_add_time(e, &y, CLOCK_MONOTONIC, 0, 0, NULL, NULL) >= 0);
+        assert_se(sd_event_source_set_priority(y, 10) >= 0);
+
+        for (i = 0; i < 3; i++)
+                assert_se(sd_event_run(e, 0) == 1);
+
+        assert_se(event_get_statistics(e, &stats, &n) >= 0);
+        assert_se(n == 2);
+
+        for (i = 0; i < n; i++) {
+                log_info("%s %s: %" PRIu64 " dispatches, runtime " USEC_FMT " (max " USEC_FMT "), latency " USEC_FMT " (max " USEC_FMT ")",
+                         strna(stats[i].description), stats[i].type, stats[i].n_dispatched,
+                         stats[i].runtime, stats[i].runtime_max, stats[i].latency, stats[i].latency_max);
+
+                if (streq(stats[i].type, "defer")) {
+                        assert_se(streq(stats[i].description, "busy"));
+                        assert_se(stats[i].n_dispatched == 3);
+                        assert_se(stats[i].runtime >= 3 * USEC_PER_MSEC);
+                        assert_se(stats[i].runtime_max >= USEC_PER_MSEC);
+                } else {
+                        assert_se(streq(stats[i].type, "monotonic"));
+                        assert_se(stats[i].n_dispatched == 0);
+                }
+        }
+
+        event_statistics_free(stats, n);
+
+        sd_event_source_unref(x);
+        sd_event_source_unref(y);
+        sd_event_unref(e);
+}
+
+#define N_TIMERS 64U
+#define N_BENCHMARK_TIMERS 10000U
+
+static int order_handler(sd_event_source *s, uint64_t usec, void *userdata) {
+        unsigned *n = userdata;
+        uint64_t t;
+
+        /* Timers that elapse together are dispatched in no
+         * particular order, hence only check that none fires early */
+        assert_se(sd_event_source_get_time(s, &t) >= 0);
+        assert_se(t <= now(CLOCK_MONOTONIC));
+        (*n)++;
+
+        return 0;
+}
+
+static void test_timers(bool wheel) {
+        sd_event_source *s[N_TIMERS] = {};
+        unsigned i, n_fired = 0;
+        sd_event *e = NULL;
+        usec_t t;
+
+        assert_se(sd_event_new(&e) >= 0);
+        assert_se(sd_event_set_timer_wheel(e, wheel) >= 0);
+        assert_se(sd_event_get_timer_wheel(e) == wheel);
+
+        t = now(CLOCK_MONOTONIC);
+
+        /* Timers in some random order, all due within a few ms, and
+         * every fourth one disabled again */
+        for (i = 0; i < N_TIMERS; i++) {
+                assert_se(sd_event_add_time(e, &s[i], CLOCK_MONOTONIC, t + ((i * 37) % N_TIMERS) * 100, 1, order_handler, &n_fired) >= 0);
+
+                if (i % 4 == 0)
+                        assert_se(sd_event_source_set_enabled(s[i], SD_EVENT_OFF) >= 0);
+        }
+
+        /* Once there are time sources the backend is fixed */
+        assert_se(sd_event_set_timer_wheel(e, !wheel) == -EBUSY);
+
+        /* Move one far into the future, so that it doesn't fire */
+        assert_se(sd_event_source_set_time(s[1], t + USEC_PER_YEAR) >= 0);
+
+        /* An iteration might be interrupted without dispatching
+         * anything, hence count what fired rather than iterations */
+        while (n_fired < N_TIMERS - N_TIMERS / 4 - 1)
+                assert_se(sd_event_run(e, (uint64_t) -1) >= 0);
+
+        /* And nothing else is due */
+        assert_se(sd_event_run(e, 10 * USEC_PER_MSEC) >= 0);
+        assert_se(n_fired == N_TIMERS - N_TIMERS / 4 - 1);
+
+        for (i = 0; i < N_TIMERS; i++) {
+                int enabled;
+
+                assert_se(sd_event_source_get_enabled(s[i], &enabled) >= 0);
+                assert_se(enabled == (i == 1 ? SD_EVENT_ONESHOT : SD_EVENT_OFF));
+
+                sd_event_source_unref(s[i]);
+        }
+
+        sd_event_unref(e);
+}
+
+static void test_timer_benchmark(bool wheel) {
+        char ts[FORMAT_TIMESPAN_MAX];
+        sd_event_source **s;
+        sd_event *e = NULL;
+        unsigned i, k;
+        usec_t t, d;
+
+        s = new0(sd_event_source*, N_BENCHMARK_TIMERS);
+        assert_se(s);
+
+        assert_se(sd_event_new(&e) >= 0);
+        assert_se(sd_event_set_timer_wheel(e, wheel) >= 0);
+
+        t = now(CLOCK_MONOTONIC);
+
+        for (i = 0; i < N_BENCHMARK_TIMERS; i++)
+                assert_se(sd_event_add_time(e, &s[i], CLOCK_MONOTONIC, t + USEC_PER_HOUR + i * USEC_PER_MSEC, 0, time_handler, NULL) >= 0);
+
+        /* Rearm and disarm timers the way a timeout per connection
+         * would be, without ever letting them elapse */
+        d = now(CLOCK_MONOTONIC);
+        for (k = 0; k < 10; k++)
+                for (i = 0; i < N_BENCHMARK_TIMERS; i++) {
+                        assert_se(sd_event_source_set_time(s[i], t + USEC_PER_HOUR + ((i * 7919 + k) % N_BENCHMARK_TIMERS) * USEC_PER_MSEC) >= 0);
+                        assert_se(sd_event_source_set_enabled(s[i], SD_EVENT_OFF) >= 0);
+                        assert_se(sd_event_source_set_enabled(s[i], SD_EVENT_ONESHOT) >= 0);
+                }
+        assert_se(sd_event_run(e, 0) == 0);
+        d = now(CLOCK_MONOTONIC) - d;
+
+        log_info("%s: %u timer updates in %s", wheel ? "Timer wheel" : "Prioq",
+                 3 * 10 * N_BENCHMARK_TIMERS, format_timespan(ts, sizeof(ts), d, 1));
+
+        for (i = 0; i < N_BENCHMARK_TIMERS; i++)
+                sd_event_source_unref(s[i]);
+        free(s);
+
+        sd_event_unref(e);
+}
+
 int main(int argc, char *argv[]) {
 
-        test_basic();
-        test_rtqueue();
+        test_basic(false);
+        test_basic(true);
+        test_rtqueue(false);
+        test_rtqueue(true);
+        test_dispatch_budget();
+        test_many_sources(false);
+        test_many_sources(true);
+        test_profile();
+        test_timers(false);
+        test_timers(true);
+
+        test_dispatch_benchmark(1);
+        test_dispatch_benchmark(N_BENCHMARK_SOURCES);
+        test_timer_benchmark(false);
+        test_timer_benchmark(true);
+        test_rearm_benchmark(false);
+        test_rearm_benchmark(true);
 
         return 0;
 }
@@ -49,11 +49,22 @@ struct trie_node_f {
         le64_t prefix_off;
         /* size of children entry array appended to the node */
         uint8_t children_count;
-        uint8_t padding[7];
+        /* TRIE_NODE_* flags; zero in files written by older versions */
+        uint8_t flags;
+        uint8_t padding[6];
         /* size of value entry array appended to the node */
         le64_t values_count;
 } _packed_;
 
+/* Nodes with many children, where bisecting costs several probes per
+ * character, are followed by a 256 byte index after the value array:
+ * for every character, its position in the children array plus one,
+ * or zero if there is no such child. Readers which do not know the
+ * flag skip it, as it is not part of the arrays they walk. */
+#define TRIE_NODE_CHILDREN_INDEX        (1 << 0)
+#define TRIE_NODE_CHILDREN_INDEX_MIN    16
+#define TRIE_NODE_CHILDREN_INDEX_SIZE   256
+
 /* array of child entries, follows directly the node record */
 struct trie_child_entry_f {
         /* index of the child node */
@@ -107,6 +107,13 @@ static const struct trie_value_entry_f *trie_node_values(sd_hwdb *hwdb, const st
         return (const struct trie_value_entry_f *)base;
 }
 
+static const uint8_t *trie_node_children_index(sd_hwdb *hwdb, const struct trie_node_f *node) {
+        const char *base = (const char *)trie_node_values(hwdb, node);
+
+        base += le64toh(node->values_count) * le64toh(hwdb->head->value_entry_size);
+        return (const uint8_t *)base;
+}
+
 static const struct trie_node_f *trie_node_from_off(sd_hwdb *hwdb, le64_t off) {
         return (const struct trie_node_f *)(hwdb->map + le64toh(off));
 }
@@ -126,6 +133,18 @@ static const struct trie_node_f *node_lookup_f(sd_hwdb *hwdb, const struct trie_
         struct trie_child_entry_f *child;
         struct trie_child_entry_f search;
 
+        if (node->flags & TRIE_NODE_CHILDREN_INDEX) {
+                uint8_t i;
+
+                i = trie_node_children_index(hwdb, node)[c];
+                if (i == 0)
+                        return NULL;
+
+                child = (struct trie_child_entry_f *)((const char *)trie_node_children(hwdb, node) +
+                                                      (i - 1) * le64toh(hwdb->head->child_entry_size));
+                return trie_node_from_off(hwdb, child->child_off);
+        }
+
         search.c = c;
         child = bsearch(&search, trie_node_children(hwdb, node), node->children_count,
                         le64toh(hwdb->head->child_entry_size), trie_children_cmp_f);
@@ -163,8 +182,130 @@ static int hwdb_add_property(sd_hwdb *hwdb, const char *key, const char *value)
         return 0;
 }
 
+/*
+ * Below a glob character, every value in the subtree used to be tried
+ * with fnmatch(). Instead, track the set of positions in the search
+ * string the pattern walked so far can have consumed, and skip any
+ * subtree for which that set became empty. The set is a superset of
+ * the real one (bracket expressions are treated like '?'), so
+ * fnmatch() still has the final word.
+ */
+#define GLOB_STATE_MAX 512
+
+struct glob_state {
+        uint64_t pos[GLOB_STATE_MAX / 64];
+        size_t len;
+        /* 0: outside of [...], 1: after '[', 2: after '[!', 3: inside */
+        unsigned bracket;
+};
+
+static bool glob_state_init(struct glob_state *g, const char *search) {
+        size_t len;
+
+        len = strlen(search);
+        if (len >= GLOB_STATE_MAX)
+                return false;
+
+        memzero(g, sizeof(*g));
+        g->len = len;
+        g->pos[0] = 1;
+        return true;
+}
+
+static void glob_state_advance(struct glob_state *g, const char *search, int c) {
+        uint64_t pos[ELEMENTSOF(g->pos)] = {};
+        size_t i;
+
+        /* c < 0 advances over any character */
+        for (i = 0; i < ELEMENTSOF(g->pos); i++) {
+                uint64_t w = g->pos[i];
+
+                while (w) {
+                        size_t p = i * 64 + __builtin_ctzll(w);
+
+                        w &= w - 1;
+                        if (p >= g->len)
+                                break;
+                        if (c >= 0 && (uint8_t) search[p] != c)
+                                continue;
+
+                        pos[(p + 1) / 64] |= UINT64_C(1) << ((p + 1) % 64);
+                }
+        }
+
+        memcpy(g->pos, pos, sizeof(pos));
+}
+
+static void glob_state_step(struct glob_state *g, const char *search, uint8_t c) {
+        size_t i;
+
+        switch (g->bracket) {
+
+        case 1:
+                g->bracket = (c == '!' || c == '^') ? 2 : 3;
+                return;
+
+        case 2:
+                g->bracket = 3;
+                return;
+
+        case 3:
+                if (c == ']') {
+                        g->bracket = 0;
+                        glob_state_advance(g, search, -1);
+                }
+                return;
+        }
+
+        switch (c) {
+
+        case '*':
+                /* everything from the first reachable position on */
+                for (i = 0; i < ELEMENTSOF(g->pos) && g->pos[i] == 0; i++)
+                        ;
+                if (i >= ELEMENTSOF(g->pos))
+                        return;
+
+                g->pos[i] |= ~(g->pos[i] - 1);
+                for (i++; i < ELEMENTSOF(g->pos); i++)
+                        g->pos[i] = UINT64_MAX;
+                return;
+
+        case '?':
+                glob_state_advance(g, search, -1);
+                return;
+
+        case '[':
+                g->bracket = 1;
+                return;
+
+        case '\\':
+                /* escapes the next character, which may be anything */
+                for (i = 0; i < ELEMENTSOF(g->pos); i++)
+                        g->pos[i] = UINT64_MAX;
+                return;
+
+        default:
+                glob_state_advance(g, search, c);
+        }
+}
+
+static bool glob_state_alive(const struct glob_state *g) {
+        size_t i;
+
+        for (i = 0; i < ELEMENTSOF(g->pos); i++)
+                if (g->pos[i])
+                        return true;
+        return false;
+}
+
+static bool glob_state_may_match(const struct glob_state *g) {
+        return g->bracket != 0 || (g->pos[g->len / 64] & (UINT64_C(1) << (g->len % 64)));
+}
+
 static int trie_fnmatch_f(sd_hwdb *hwdb, const struct trie_node_f *node, size_t p,
-                          struct linebuf *buf, const char *search) {
+                          struct linebuf *buf, const char *search, const struct glob_state *glob) {
+        struct glob_state g;
         size_t len;
         size_t i;
         const char *prefix;
@@ -172,19 +313,39 @@ static int trie_fnmatch_f(sd_hwdb *hwdb, const struct trie_node_f *node, size_t
 
         prefix = trie_string(hwdb, node->prefix_off);
         len = strlen(prefix + p);
+
+        if (glob) {
+                g = *glob;
+                for (i = 0; i < len; i++)
+                        glob_state_step(&g, search, prefix[p + i]);
+                if (!glob_state_alive(&g))
+                        return 0;
+        }
+
         linebuf_add(buf, prefix + p, len);
 
         for (i = 0; i < node->children_count; i++) {
                 const struct trie_child_entry_f *child = &trie_node_children(hwdb, node)[i];
+                struct glob_state gc;
+
+                if (glob) {
+                        gc = g;
+                        glob_state_step(&gc, search, child->c);
+                        if (!glob_state_alive(&gc))
+                                continue;
+                }
 
                 linebuf_add_char(buf, child->c);
-                err = trie_fnmatch_f(hwdb, trie_node_from_off(hwdb, child->child_off), 0, buf, search);
+                err = trie_fnmatch_f(hwdb, trie_node_from_off(hwdb, child->child_off), 0, buf, search,
+                                     glob ? &gc : NULL);
                 if (err < 0)
                         return err;
                 linebuf_rem_char(buf);
         }
 
-        if (le64toh(node->values_count) && fnmatch(linebuf_get(buf), search, 0) == 0)
+        if (le64toh(node->values_count) &&
+            (!glob || glob_state_may_match(&g)) &&
+            fnmatch(linebuf_get(buf), search, 0) == 0)
                 for (i = 0; i < le64toh(node->values_count); i++) {
                         err = hwdb_add_property(hwdb, trie_string(hwdb, trie_node_values(hwdb, node)[i].key_off),
                                                 trie_string(hwdb, trie_node_values(hwdb, node)[i].value_off));
@@ -196,6 +357,21 @@ static int trie_fnmatch_f(sd_hwdb *hwdb, const struct trie_node_f *node, size_t
         return 0;
 }
 
+/* start matching a glob subtree, with the glob characters already in buf */
+static int trie_fnmatch_start_f(sd_hwdb *hwdb, const struct trie_node_f *node, size_t p,
+                                struct linebuf *buf, const char *search) {
+        struct glob_state g;
+        size_t i;
+
+        if (!glob_state_init(&g, search))
+                return trie_fnmatch_f(hwdb, node, p, buf, search, NULL);
+
+        for (i = 0; i < buf->len; i++)
+                glob_state_step(&g, search, buf->bytes[i]);
+
+        return trie_fnmatch_f(hwdb, node, p, buf, search, &g);
+}
+
 static int trie_search_f(sd_hwdb *hwdb, const char *search) {
         struct linebuf buf;
         const struct trie_node_f *node;
@@ -214,7 +390,7 @@ static int trie_search_f(sd_hwdb *hwdb, const char *search) {
 
                         for (; (c = trie_string(hwdb, node->prefix_off)[p]); p++) {
                                 if (c == '*' || c == '?' || c == '[')
-                                        return trie_fnmatch_f(hwdb, node, p, &buf, search + i + p);
+                                        return trie_fnmatch_start_f(hwdb, node, p, &buf, search + i + p);
                                 if (c != search[i + p])
                                         return 0;
                         }
@@ -224,7 +400,7 @@ static int trie_search_f(sd_hwdb *hwdb, const char *search) {
                 child = node_lookup_f(hwdb, node, '*');
                 if (child) {
                         linebuf_add_char(&buf, '*');
-                        err = trie_fnmatch_f(hwdb, child, 0, &buf, search + i);
+                        err = trie_fnmatch_start_f(hwdb, child, 0, &buf, search + i);
                         if (err < 0)
                                 return err;
                         linebuf_rem_char(&buf);
@@ -233,7 +409,7 @@ static int trie_search_f(sd_hwdb *hwdb, const char *search) {
                 child = node_lookup_f(hwdb, node, '?');
                 if (child) {
                         linebuf_add_char(&buf, '?');
-                        err = trie_fnmatch_f(hwdb, child, 0, &buf, search + i);
+                        err = trie_fnmatch_start_f(hwdb, child, 0, &buf, search + i);
                         if (err < 0)
                                 return err;
                         linebuf_rem_char(&buf);
@@ -242,7 +418,7 @@ static int trie_search_f(sd_hwdb *hwdb, const char *search) {
                 child = node_lookup_f(hwdb, node, '[');
                 if (child) {
                         linebuf_add_char(&buf, '[');
-                        err = trie_fnmatch_f(hwdb, child, 0, &buf, search + i);
+                        err = trie_fnmatch_start_f(hwdb, child, 0, &buf, search + i);
                         if (err < 0)
                                 return err;
                         linebuf_rem_char(&buf);
@@ -34,8 +34,13 @@
 #define RTNL_DEFAULT_TIMEOUT ((usec_t) (25 * USEC_PER_SEC))
 
 #define RTNL_WQUEUE_MAX 1024
+#define RTNL_WQUEUE_SIZE_MAX (64*1024)
 #define RTNL_RQUEUE_MAX 64*1024
 
+/* The kernel sizes dump datagrams after the largest buffer we
+ * passed to recvmsg(), so offer it plenty of room */
+#define RTNL_RBUFFER_SIZE (32*1024)
+
 #define RTNL_CONTAINER_DEPTH 32
 
 struct reply_callback {
@@ -68,6 +73,14 @@ struct sd_netlink {
         unsigned rqueue_size;
         size_t rqueue_allocated;
 
+        /* Sealed messages collected while a batch is open, written
+         * with a single sendmsg() */
+        sd_netlink_message **wqueue;
+        unsigned wqueue_size;
+        size_t wqueue_allocated;
+        size_t wqueue_bytes;
+        unsigned n_batch;
+
         sd_netlink_message **rqueue_partial;
         unsigned rqueue_partial_size;
         size_t rqueue_partial_allocated;
@@ -82,7 +95,8 @@ struct sd_netlink {
         struct Prioq *reply_callbacks_prioq;
         Hashmap *reply_callbacks;
 
-        LIST_HEAD(struct match_callback, match_callbacks);
+        /* message type -> list of match callbacks for it */
+        Hashmap *match_callbacks;
 
         pid_t original_pid;
 
@@ -126,6 +140,7 @@ int socket_open(int family);
 int socket_bind(sd_netlink *nl);
 int socket_join_broadcast_group(sd_netlink *nl, unsigned group);
 int socket_write_message(sd_netlink *nl, sd_netlink_message *m);
+int socket_writev_message(sd_netlink *nl, sd_netlink_message **m, size_t n);
 int socket_read_message(sd_netlink *nl);
 
 int rtnl_rqueue_make_room(sd_netlink *rtnl);
@@ -103,7 +103,48 @@ int socket_write_message(sd_netlink *nl, sd_netlink_message *m) {
         return k;
 }
 
-static int socket_recv_message(int fd, struct iovec *iov, uint32_t *_group, bool peek) {
+int socket_writev_message(sd_netlink *nl, sd_netlink_message **m, size_t n) {
+        union {
+                struct sockaddr sa;
+                struct sockaddr_nl nl;
+        } addr = {
+                .nl.nl_family = AF_NETLINK,
+        };
+        struct msghdr mh = {
+                .msg_name = &addr.sa,
+                .msg_namelen = sizeof(addr),
+        };
+        struct iovec *iov;
+        ssize_t k;
+        size_t i;
+
+        assert(nl);
+        assert(m);
+        assert(n > 0);
+
+        /* The kernel processes all messages in the datagram one after
+         * the other, just as if they were sent separately */
+
+        iov = newa(struct iovec, n);
+        for (i = 0; i < n; i++) {
+                assert(m[i]->hdr);
+                assert(NLMSG_ALIGN(m[i]->hdr->nlmsg_len) == m[i]->hdr->nlmsg_len);
+
+                iov[i].iov_base = m[i]->hdr;
+                iov[i].iov_len = m[i]->hdr->nlmsg_len;
+        }
+
+        mh.msg_iov = iov;
+        mh.msg_iovlen = n;
+
+        k = sendmsg(nl->fd, &mh, 0);
+        if (k < 0)
+                return -errno;
+
+        return k;
+}
+
+static int socket_recv_message(int fd, struct iovec *iov, uint32_t *_group) {
         union sockaddr_union sender;
         uint8_t cmsg_buffer[CMSG_SPACE(sizeof(struct nl_pktinfo))];
         struct msghdr msg = {
@@ -121,7 +162,7 @@ static int socket_recv_message(int fd, struct iovec *iov, uint32_t *_group, bool
         assert(fd >= 0);
         assert(iov);
 
-        r = recvmsg(fd, &msg, MSG_TRUNC | (peek ? MSG_PEEK : 0));
+        r = recvmsg(fd, &msg, MSG_TRUNC);
         if (r < 0) {
                 /* no data */
                 if (errno == ENOBUFS)
@@ -136,13 +177,6 @@ static int socket_recv_message(int fd, struct iovec *iov, uint32_t *_group, bool
                 /* not from the kernel, ignore */
                 log_debug("rtnl: ignoring message from portid %"PRIu32, sender.nl.nl_pid);
 
-                if (peek) {
-                        /* drop the message */
-                        r = recvmsg(fd, &msg, 0);
-                        if (r < 0)
-                                return (errno == EAGAIN || errno == EINTR) ? 0 : -errno;
-                }
-
                 return 0;
         }
 
@@ -163,6 +197,55 @@ static int socket_recv_message(int fd, struct iovec *iov, uint32_t *_group, bool
         return r;
 }
 
+/* The datagram was cut short and the rest of it is gone. Make sure
+ * the next one fits, and fail the request the datagram was a reply
+ * to, rather than leaving it waiting for its timeout. */
+static int socket_handle_truncated(sd_netlink *rtnl, size_t len, uint32_t group) {
+        sd_netlink_message *m;
+        uint32_t serial, pid;
+        unsigned i;
+        int r;
+
+        assert(rtnl);
+        assert(len > rtnl->rbuffer_allocated);
+
+        log_debug("sd-netlink: dropping truncated message of %zu bytes", len);
+
+        serial = rtnl->rbuffer->nlmsg_seq;
+        pid = rtnl->rbuffer->nlmsg_pid;
+
+        if (!greedy_realloc((void **)&rtnl->rbuffer,
+                            &rtnl->rbuffer_allocated,
+                            len, sizeof(uint8_t)))
+                return -ENOMEM;
+
+        if (group || serial == 0 || pid != rtnl->sockaddr.nl.nl_pid)
+                return 0;
+
+        for (i = 0; i < rtnl->rqueue_partial_size; i++)
+                if (rtnl_message_get_serial(rtnl->rqueue_partial[i]) == serial) {
+                        sd_netlink_message_unref(rtnl->rqueue_partial[i]);
+                        memmove(rtnl->rqueue_partial + i, rtnl->rqueue_partial + i + 1,
+                                sizeof(sd_netlink_message*) * (rtnl->rqueue_partial_size - i - 1));
+                        rtnl->rqueue_partial_size --;
+                        break;
+                }
+
+        r = rtnl_message_new_synthetic_error(-EMSGSIZE, serial, &m);
+        if (r < 0)
+                return r;
+
+        r = rtnl_rqueue_make_room(rtnl);
+        if (r < 0) {
+                sd_netlink_message_unref(m);
+                return r;
+        }
+
+        rtnl->rqueue[rtnl->rqueue_size ++] = m;
+
+        return 1;
+}
+
 /* On success, the number of bytes received is returned and *ret points to the received message
  * which has a valid header and the correct size.
  * If nothing useful was received 0 is returned.
@@ -182,24 +265,12 @@ int socket_read_message(sd_netlink *rtnl) {
         assert(rtnl->rbuffer);
         assert(rtnl->rbuffer_allocated >= sizeof(struct nlmsghdr));
 
-        /* read nothing, just get the pending message size */
-        r = socket_recv_message(rtnl->fd, &iov, NULL, true);
-        if (r <= 0)
-                return r;
-        else
-                len = (size_t)r;
-
-        /* make room for the pending message */
-        if (!greedy_realloc((void **)&rtnl->rbuffer,
-                            &rtnl->rbuffer_allocated,
-                            len, sizeof(uint8_t)))
-                return -ENOMEM;
-
         iov.iov_base = rtnl->rbuffer;
         iov.iov_len = rtnl->rbuffer_allocated;
 
-        /* read the pending message */
-        r = socket_recv_message(rtnl->fd, &iov, &group, false);
+        /* read the pending message straight into the buffer, which
+         * is large enough for anything the kernel usually sends */
+        r = socket_recv_message(rtnl->fd, &iov, &group);
         if (r <= 0)
                 return r;
         else
@@ -207,7 +278,7 @@ int socket_read_message(sd_netlink *rtnl) {
 
         if (len > rtnl->rbuffer_allocated)
                 /* message did not fit in read buffer */
-                return -EIO;
+                return socket_handle_truncated(rtnl, len, group);
 
         if (NLMSG_OK(rtnl->rbuffer, len) && rtnl->rbuffer->nlmsg_flags & NLM_F_MULTI) {
                 multi_part = true;
@@ -48,12 +48,10 @@ static int sd_netlink_new(sd_netlink **ret) {
 
         rtnl->original_pid = getpid();
 
-        LIST_HEAD_INIT(rtnl->match_callbacks);
-
         /* We guarantee that the read buffer has at least space for
          * a message header */
         if (!greedy_realloc((void**)&rtnl->rbuffer, &rtnl->rbuffer_allocated,
-                            sizeof(struct nlmsghdr), sizeof(uint8_t)))
+                            RTNL_RBUFFER_SIZE, sizeof(uint8_t)))
                 return -ENOMEM;
 
         /* Change notification responses have sequence 0, so we must
@@ -169,6 +167,10 @@ sd_netlink *sd_netlink_unref(sd_netlink *rtnl) {
                         sd_netlink_message_unref(rtnl->rqueue[i]);
                 free(rtnl->rqueue);
 
+                for (i = 0; i < rtnl->wqueue_size; i++)
+                        sd_netlink_message_unref(rtnl->wqueue[i]);
+                free(rtnl->wqueue);
+
                 for (i = 0; i < rtnl->rqueue_partial_size; i++)
                         sd_netlink_message_unref(rtnl->rqueue_partial[i]);
                 free(rtnl->rqueue_partial);
@@ -182,10 +184,14 @@ sd_netlink *sd_netlink_unref(sd_netlink *rtnl) {
                 sd_event_source_unref(rtnl->time_event_source);
                 sd_event_unref(rtnl->event);
 
-                while ((f = rtnl->match_callbacks)) {
-                        LIST_REMOVE(match_callbacks, rtnl->match_callbacks, f);
-                        free(f);
-                }
+                while ((f = hashmap_steal_first(rtnl->match_callbacks)))
+                        while (f) {
+                                struct match_callback *n = f->match_callbacks_next;
+
+                                free(f);
+                                f = n;
+                        }
+                hashmap_free(rtnl->match_callbacks);
 
                 safe_close(rtnl->fd);
                 free(rtnl);
@@ -209,6 +215,91 @@ static void rtnl_seal_message(sd_netlink *rtnl, sd_netlink_message *m) {
         return;
 }
 
+static int rtnl_wqueue_flush(sd_netlink *nl) {
+        unsigned i;
+        int r;
+
+        assert(nl);
+
+        if (nl->wqueue_size == 0)
+                return 0;
+
+        r = socket_writev_message(nl, nl->wqueue, nl->wqueue_size);
+        if (r < 0) {
+                /* None of the messages made it, make sure their
+                 * reply callbacks learn about that */
+                for (i = 0; i < nl->wqueue_size; i++) {
+                        sd_netlink_message *m;
+
+                        if (rtnl_message_new_synthetic_error(r, rtnl_message_get_serial(nl->wqueue[i]), &m) < 0)
+                                continue;
+
+                        if (rtnl_rqueue_make_room(nl) < 0) {
+                                sd_netlink_message_unref(m);
+                                continue;
+                        }
+
+                        nl->rqueue[nl->rqueue_size++] = m;
+                }
+        }
+
+        for (i = 0; i < nl->wqueue_size; i++)
+                sd_netlink_message_unref(nl->wqueue[i]);
+
+        nl->wqueue_size = 0;
+        nl->wqueue_bytes = 0;
+
+        return r < 0 ? r : 0;
+}
+
+static int rtnl_wqueue_push(sd_netlink *nl, sd_netlink_message *m) {
+        int r;
+
+        assert(nl);
+        assert(m);
+
+        /* There is only so much that fits into one datagram */
+        if (nl->wqueue_size >= RTNL_WQUEUE_MAX ||
+            nl->wqueue_bytes + m->hdr->nlmsg_len > RTNL_WQUEUE_SIZE_MAX) {
+                r = rtnl_wqueue_flush(nl);
+                if (r < 0)
+                        return r;
+        }
+
+        if (!GREEDY_REALLOC(nl->wqueue, nl->wqueue_allocated, nl->wqueue_size + 1))
+                return -ENOMEM;
+
+        nl->wqueue[nl->wqueue_size++] = sd_netlink_message_ref(m);
+        nl->wqueue_bytes += m->hdr->nlmsg_len;
+
+        return 0;
+}
+
+int sd_netlink_batch_begin(sd_netlink *nl) {
+        assert_return(nl, -EINVAL);
+        assert_return(!rtnl_pid_changed(nl), -ECHILD);
+
+        /* Until the matching sd_netlink_batch_end(), messages are
+         * only queued, and then written out together. Replies are
+         * dispatched to their callbacks as usual. Batches nest. */
+
+        nl->n_batch++;
+
+        return 0;
+}
+
+int sd_netlink_batch_end(sd_netlink *nl) {
+        assert_return(nl, -EINVAL);
+        assert_return(!rtnl_pid_changed(nl), -ECHILD);
+        assert_return(nl->n_batch > 0, -EINVAL);
+
+        nl->n_batch--;
+        if (nl->n_batch > 0)
+                return 0;
+
+        return rtnl_wqueue_flush(nl);
+}
+
 int sd_netlink_send(sd_netlink *nl,
                  sd_netlink_message *message,
                  uint32_t *serial) {
@@ -221,7 +312,10 @@ int sd_netlink_send(sd_netlink *nl,
 
         rtnl_seal_message(nl, message);
 
-        r = socket_write_message(nl, message);
+        if (nl->n_batch > 0)
+                r = rtnl_wqueue_push(nl, message);
+        else
+                r = socket_write_message(nl, message);
         if (r < 0)
                 return r;
 
@@ -356,15 +450,14 @@ static int process_match(sd_netlink *rtnl, sd_netlink_message *m) {
         if (r < 0)
                 return r;
 
-        LIST_FOREACH(match_callbacks, c, rtnl->match_callbacks) {
-                if (type == c->type) {
-                        r = c->callback(rtnl, m, c->userdata);
-                        if (r != 0) {
-                                if (r < 0)
-                                        log_debug_errno(r, "sd-netlink: match callback failed: %m");
+        c = hashmap_get(rtnl->match_callbacks, UINT_TO_PTR(type));
+        LIST_FOREACH(match_callbacks, c, c) {
+                r = c->callback(rtnl, m, c->userdata);
+                if (r != 0) {
+                        if (r < 0)
+                                log_debug_errno(r, "sd-netlink: match callback failed: %m");
 
-                                break;
-                        }
+                        break;
                 }
         }
 
@@ -607,6 +700,11 @@ int sd_netlink_call(sd_netlink *rtnl,
         if (r < 0)
                 return r;
 
+        /* Don't wait for a reply to a message that is still queued */
+        r = rtnl_wqueue_flush(rtnl);
+        if (r < 0)
+                return r;
+
         timeout = calc_elapse(usec);
 
         for (;;) {
@@ -840,6 +938,7 @@ int sd_netlink_add_match(sd_netlink *rtnl,
                       sd_netlink_message_handler_t callback,
                       void *userdata) {
         _cleanup_free_ struct match_callback *c = NULL;
+        struct match_callback *head;
         int r;
 
         assert_return(rtnl, -EINVAL);
@@ -880,7 +979,18 @@ int sd_netlink_add_match(sd_netlink *rtnl,
                         return -EOPNOTSUPP;
         }
 
-        LIST_PREPEND(match_callbacks, rtnl->match_callbacks, c);
+        r = hashmap_ensure_allocated(&rtnl->match_callbacks, &trivial_hash_ops);
+        if (r < 0)
+                return r;
+
+        head = hashmap_get(rtnl->match_callbacks, UINT_TO_PTR(type));
+        LIST_PREPEND(match_callbacks, head, c);
+
+        r = hashmap_replace(rtnl->match_callbacks, UINT_TO_PTR(type), head);
+        if (r < 0) {
+                LIST_REMOVE(match_callbacks, head, c);
+                return r;
+        }
 
         c = NULL;
 
@@ -891,7 +1001,7 @@ int sd_netlink_remove_match(sd_netlink *rtnl,
                          uint16_t type,
                          sd_netlink_message_handler_t callback,
                          void *userdata) {
-        struct match_callback *c;
+        struct match_callback *c, *head;
 
         assert_return(rtnl, -EINVAL);
         assert_return(callback, -EINVAL);
@@ -904,11 +1014,17 @@ int sd_netlink_remove_match(sd_netlink *rtnl,
            the initial refcount. The latter could indeed be done for the first 32 broadcast
            groups (which incidentally is all we currently support in .socket units anyway),
            but we better not rely on only ever using 32 groups. */
-        LIST_FOREACH(match_callbacks, c, rtnl->match_callbacks)
-                if (c->callback == callback && c->type == type && c->userdata == userdata) {
-                        LIST_REMOVE(match_callbacks, rtnl->match_callbacks, c);
+        head = hashmap_get(rtnl->match_callbacks, UINT_TO_PTR(type));
+        LIST_FOREACH(match_callbacks, c, head)
+                if (c->callback == callback && c->userdata == userdata) {
+                        LIST_REMOVE(match_callbacks, head, c);
                         free(c);
 
+                        if (head)
+                                assert_se(hashmap_replace(rtnl->match_callbacks, UINT_TO_PTR(type), head) >= 0);
+                        else
+                                hashmap_remove(rtnl->match_callbacks, UINT_TO_PTR(type));
+
                         return 1;
                 }
 
@@ -290,6 +290,41 @@ static void test_pipe(int ifindex) {
         assert_se((rtnl = sd_netlink_unref(rtnl)) == NULL);
 }
 
+static void test_batch(int ifindex) {
+        _cleanup_netlink_unref_ sd_netlink *rtnl = NULL;
+        _cleanup_netlink_message_unref_ sd_netlink_message *m1 = NULL, *m2 = NULL;
+        int counter = 0;
+
+        assert_se(sd_netlink_open(&rtnl) >= 0);
+
+        assert_se(sd_rtnl_message_new_link(rtnl, &m1, RTM_GETLINK, ifindex) >= 0);
+        assert_se(sd_rtnl_message_new_link(rtnl, &m2, RTM_GETLINK, ifindex) >= 0);
+
+        assert_se(sd_netlink_batch_end(rtnl) == -EINVAL);
+
+        assert_se(sd_netlink_batch_begin(rtnl) >= 0);
+        assert_se(sd_netlink_batch_begin(rtnl) >= 0);
+
+        counter ++;
+        assert_se(sd_netlink_call_async(rtnl, m1, &pipe_handler, &counter, 0, NULL) >= 0);
+
+        counter ++;
+        assert_se(sd_netlink_call_async(rtnl, m2, &pipe_handler, &counter, 0, NULL) >= 0);
+
+        /* nothing is written before the outermost batch ends */
+        assert_se(sd_netlink_batch_end(rtnl) >= 0);
+        assert_se(sd_netlink_wait(rtnl, 100 * USEC_PER_MSEC) == 0);
+
+        assert_se(sd_netlink_batch_end(rtnl) >= 0);
+
+        while (counter > 0) {
+                assert_se(sd_netlink_wait(rtnl, 0) >= 0);
+                assert_se(sd_netlink_process(rtnl, NULL) >= 0);
+        }
+
+        assert_se((rtnl = sd_netlink_unref(rtnl)) == NULL);
+}
+
 static void test_container(void) {
         _cleanup_netlink_message_unref_ sd_netlink_message *m = NULL;
         uint16_t u16_data;
@@ -403,6 +438,8 @@ int main(void) {
 
         test_pipe(if_loopback);
 
+        test_batch(if_loopback);
+
         test_event_loop(if_loopback);
 
         test_link_configure(rtnl, if_loopback);
@@ -380,25 +380,32 @@ _public_ sd_network_monitor* sd_network_monitor_unref(sd_network_monitor *m) {
         return NULL;
 }
 
-_public_ int sd_network_monitor_flush(sd_network_monitor *m) {
+static int monitor_flush(int fd, int **ret_ifindexes, size_t *ret_n) {
+        _cleanup_free_ int *ifindexes = NULL;
+        size_t n = 0, allocated = 0;
         union inotify_event_buffer buffer;
         struct inotify_event *e;
+        bool all = false;
         ssize_t l;
-        int fd, k;
-
-        assert_return(m, -EINVAL);
-
-        fd = MONITOR_TO_FD(m);
+        int k;
 
         l = read(fd, &buffer, sizeof(buffer));
         if (l < 0) {
                 if (errno == EAGAIN || errno == EINTR)
-                        return 0;
+                        goto finish;
 
                 return -errno;
         }
 
         FOREACH_INOTIFY_EVENT(e, buffer, l) {
+                int ifindex;
+                size_t i;
+
+                if (e->mask & IN_Q_OVERFLOW) {
+                        all = true;
+                        continue;
+                }
+
                 if (e->mask & IN_ISDIR) {
                         k = monitor_add_inotify_watch(fd);
                         if (k < 0)
@@ -407,12 +414,63 @@ _public_ int sd_network_monitor_flush(sd_network_monitor *m) {
                         k = inotify_rm_watch(fd, e->wd);
                         if (k < 0)
                                 return -errno;
+
+                        /* Links might have been written before we
+                         * got to watch their directory */
+                        all = true;
+                        continue;
                 }
+
+                if (!ret_ifindexes)
+                        continue;
+
+                /* The state files are named after the ifindex */
+                if (e->len == 0 || safe_atoi(e->name, &ifindex) < 0 || ifindex <= 0)
+                        continue;
+
+                for (i = 0; i < n; i++)
+                        if (ifindexes[i] == ifindex)
+                                break;
+                if (i < n)
+                        continue;
+
+                if (!GREEDY_REALLOC(ifindexes, allocated, n + 1))
+                        return -ENOMEM;
+
+                ifindexes[n++] = ifindex;
+        }
+
+finish:
+        if (ret_ifindexes) {
+                *ret_ifindexes = ifindexes;
+                ifindexes = NULL;
+                *ret_n = n;
         }
 
+        return all;
+}
+
+_public_ int sd_network_monitor_flush(sd_network_monitor *m) {
+        int r;
+
+        assert_return(m, -EINVAL);
+
+        r = monitor_flush(MONITOR_TO_FD(m), NULL, NULL);
+        if (r < 0)
+                return r;
+
         return 0;
 }
 
+_public_ int sd_network_monitor_flush_links(sd_network_monitor *m, int **ret_ifindexes, size_t *ret_n) {
+
+        assert_return(m, -EINVAL);
+        assert_return(ret_ifindexes, -EINVAL);
+        assert_return(ret_n, -EINVAL);
+
+        return monitor_flush(MONITOR_TO_FD(m), ret_ifindexes, ret_n);
+}
+
 _public_ int sd_network_monitor_get_fd(sd_network_monitor *m) {
 
         assert_return(m, -EINVAL);
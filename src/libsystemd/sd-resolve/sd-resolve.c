@@ -39,10 +39,16 @@
 #include "sd-resolve.h"
 
 #define WORKERS_MIN 1U
-#define WORKERS_MAX 16U
+#define WORKERS_MAX 64U
+#define WORKERS_DEFAULT 16U
+#define WORKER_IDLE_USEC (10 * USEC_PER_SEC)
 #define QUERIES_MAX 256U
+#define RESPONSES_BATCH_MAX 16U
 #define BUFSIZE 10240U
 
+/* Bucket i counts latencies of [2^i, 2^(i+1)) µs */
+#define HISTOGRAM_BUCKETS 24U
+
 typedef enum {
         REQUEST_ADDRINFO,
         RESPONSE_ADDRINFO,
@@ -60,6 +66,18 @@ enum {
         _FD_MAX
 };
 
+typedef enum WorkerState {
+        WORKER_UNUSED,
+        WORKER_RUNNING,
+        WORKER_EXITED,
+} WorkerState;
+
+typedef struct Worker {
+        sd_resolve *resolve;
+        pthread_t thread;
+        WorkerState state;
+} Worker;
+
 struct sd_resolve {
         unsigned n_ref;
 
@@ -68,8 +86,16 @@ struct sd_resolve {
 
         int fds[_FD_MAX];
 
-        pthread_t workers[WORKERS_MAX];
+        /* Workers are started on demand up to workers_max, and
+         * those beyond WORKERS_MIN exit again after being idle for
+         * WORKER_IDLE_USEC. n_valid_workers is updated atomically,
+         * since workers decrement it themselves. */
+        Worker workers[WORKERS_MAX];
         unsigned n_valid_workers;
+        unsigned workers_max;
+
+        unsigned queued_histogram[HISTOGRAM_BUCKETS];
+        unsigned executing_histogram[HISTOGRAM_BUCKETS];
 
         unsigned current_id;
         sd_resolve_query* query_array[QUERIES_MAX];
@@ -95,6 +121,7 @@ struct sd_resolve_query {
         bool done:1;
         bool floating:1;
         unsigned id;
+        usec_t submitted;
 
         int ret;
         int _errno;
@@ -116,6 +143,7 @@ typedef struct RHeader {
         QueryType type;
         unsigned id;
         size_t length;
+        usec_t executing; /* time the worker spent on the request, in responses */
 } RHeader;
 
 typedef struct AddrInfoRequest {
@@ -227,6 +255,7 @@ static void *serialize_addrinfo(void *p, const struct addrinfo *ai, size_t *leng
 static int send_addrinfo_reply(
                 int out_fd,
                 unsigned id,
+                usec_t executing,
                 int ret,
                 struct addrinfo *ai,
                 int _errno,
@@ -236,6 +265,7 @@ static int send_addrinfo_reply(
                 .header.type = RESPONSE_ADDRINFO,
                 .header.id = id,
                 .header.length = sizeof(AddrInfoResponse),
+                .header.executing = executing,
                 .ret = ret,
                 ._errno = _errno,
                 ._h_errno = _h_errno,
@@ -281,6 +311,7 @@ static int send_addrinfo_reply(
 static int send_nameinfo_reply(
                 int out_fd,
                 unsigned id,
+                usec_t executing,
                 int ret,
                 const char *host,
                 const char *serv,
@@ -290,6 +321,7 @@ static int send_nameinfo_reply(
         NameInfoResponse resp = {
                 .header.type = RESPONSE_NAMEINFO,
                 .header.id = id,
+                .header.executing = executing,
                 .ret = ret,
                 ._errno = _errno,
                 ._h_errno = _h_errno,
@@ -338,6 +370,7 @@ static int handle_request(int out_fd, const Packet *packet, size_t length) {
                const AddrInfoRequest *ai_req = &packet->addrinfo_request;
                struct addrinfo hints = {}, *result = NULL;
                const char *node, *service;
+               usec_t ts;
                int ret;
 
                assert(length >= sizeof(AddrInfoRequest));
@@ -351,19 +384,22 @@ static int handle_request(int out_fd, const Packet *packet, size_t length) {
                node = ai_req->node_len ? (const char*) ai_req + sizeof(AddrInfoRequest) : NULL;
                service = ai_req->service_len ? (const char*) ai_req + sizeof(AddrInfoRequest) + ai_req->node_len : NULL;
 
+               ts = now(CLOCK_MONOTONIC);
                ret = getaddrinfo(
                                node, service,
                                ai_req->hints_valid ? &hints : NULL,
                                &result);
+               ts = now(CLOCK_MONOTONIC) - ts;
 
                /* send_addrinfo_reply() frees result */
-               return send_addrinfo_reply(out_fd, req->id, ret, result, errno, h_errno);
+               return send_addrinfo_reply(out_fd, req->id, ts, ret, result, errno, h_errno);
         }
 
         case REQUEST_NAMEINFO: {
                const NameInfoRequest *ni_req = &packet->nameinfo_request;
                char hostbuf[NI_MAXHOST], servbuf[NI_MAXSERV];
                union sockaddr_union sa;
+               usec_t ts;
                int ret;
 
                assert(length >= sizeof(NameInfoRequest));
@@ -372,12 +408,14 @@ static int handle_request(int out_fd, const Packet *packet, size_t length) {
 
                memcpy(&sa, (const uint8_t *) ni_req + sizeof(NameInfoRequest), ni_req->sockaddr_len);
 
+               ts = now(CLOCK_MONOTONIC);
                ret = getnameinfo(&sa.sa, ni_req->sockaddr_len,
                                ni_req->gethost ? hostbuf : NULL, ni_req->gethost ? sizeof(hostbuf) : 0,
                                ni_req->getserv ? servbuf : NULL, ni_req->getserv ? sizeof(servbuf) : 0,
                                ni_req->flags);
+               ts = now(CLOCK_MONOTONIC) - ts;
 
-               return send_nameinfo_reply(out_fd, req->id, ret,
+               return send_nameinfo_reply(out_fd, req->id, ts, ret,
                                ret == 0 && ni_req->gethost ? hostbuf : NULL,
                                ret == 0 && ni_req->getserv ? servbuf : NULL,
                                errno, h_errno);
@@ -394,8 +432,24 @@ static int handle_request(int out_fd, const Packet *packet, size_t length) {
         return 0;
 }
 
+static bool worker_release(sd_resolve *resolve) {
+        unsigned n;
+
+        /* Give up our slot, unless we are among the last
+         * WORKERS_MIN workers */
+        for (;;) {
+                n = __sync_fetch_and_add(&resolve->n_valid_workers, 0);
+                if (n <= WORKERS_MIN)
+                        return false;
+
+                if (__sync_bool_compare_and_swap(&resolve->n_valid_workers, n, n - 1))
+                        return true;
+        }
+}
+
 static void* thread_worker(void *p) {
-        sd_resolve *resolve = p;
+        Worker *w = p;
+        sd_resolve *resolve = w->resolve;
         sigset_t fullset;
 
         /* No signals in this thread please */
@@ -411,12 +465,33 @@ static void* thread_worker(void *p) {
                         uint8_t space[BUFSIZE];
                 } buf;
                 ssize_t length;
+                int flags = 0, r;
+
+                /* The last workers stay around for good, let them wait
+                 * without the receive timeout, so that an idle
+                 * resolver doesn't wake up periodically */
+                if (__sync_fetch_and_add(&resolve->n_valid_workers, 0) <= WORKERS_MIN) {
+                        r = fd_wait_for_event(resolve->fds[REQUEST_RECV_FD], POLLIN, USEC_INFINITY);
+                        if (r < 0 && r != -EINTR)
+                                break;
 
-                length = recv(resolve->fds[REQUEST_RECV_FD], &buf, sizeof(buf), 0);
+                        flags = MSG_DONTWAIT;
+                }
+
+                length = recv(resolve->fds[REQUEST_RECV_FD], &buf, sizeof(buf), flags);
                 if (length < 0) {
                         if (errno == EINTR)
                                 continue;
 
+                        /* Nothing to do for WORKER_IDLE_USEC */
+                        if (errno == EAGAIN) {
+                                if (flags & MSG_DONTWAIT || !worker_release(resolve))
+                                        continue;
+
+                                assert_se(__sync_bool_compare_and_swap(&w->state, WORKER_RUNNING, WORKER_EXITED));
+                                return NULL;
+                        }
+
                         break;
                 }
                 if (length == 0)
@@ -435,19 +510,32 @@ static void* thread_worker(void *p) {
 }
 
 static int start_threads(sd_resolve *resolve, unsigned extra) {
-        unsigned n;
+        unsigned n, i;
         int r;
 
         n = resolve->n_outstanding + extra;
-        n = CLAMP(n, WORKERS_MIN, WORKERS_MAX);
+        n = CLAMP(n, WORKERS_MIN, resolve->workers_max);
 
-        while (resolve->n_valid_workers < n) {
+        for (i = 0; i < WORKERS_MAX && __sync_fetch_and_add(&resolve->n_valid_workers, 0) < n; i++) {
+                Worker *w = resolve->workers + i;
 
-                r = pthread_create(&resolve->workers[resolve->n_valid_workers], NULL, thread_worker, resolve);
-                if (r != 0)
-                        return -r;
+                /* Reap workers that exited after idling */
+                if (__sync_bool_compare_and_swap(&w->state, WORKER_EXITED, WORKER_UNUSED))
+                        (void) pthread_join(w->thread, NULL);
 
-                resolve->n_valid_workers ++;
+                if (w->state != WORKER_UNUSED)
+                        continue;
+
+                w->resolve = resolve;
+                w->state = WORKER_RUNNING;
+                __sync_fetch_and_add(&resolve->n_valid_workers, 1);
+
+                r = pthread_create(&w->thread, NULL, thread_worker, w);
+                if (r != 0) {
+                        w->state = WORKER_UNUSED;
+                        __sync_fetch_and_sub(&resolve->n_valid_workers, 1);
+                        return -r;
+                }
         }
 
         return 0;
@@ -464,6 +552,7 @@ static bool resolve_pid_changed(sd_resolve *r) {
 
 _public_ int sd_resolve_new(sd_resolve **ret) {
         sd_resolve *resolve = NULL;
+        struct timeval tv;
         int i, r;
 
         assert_return(ret, -EINVAL);
@@ -474,6 +563,7 @@ _public_ int sd_resolve_new(sd_resolve **ret) {
 
         resolve->n_ref = 1;
         resolve->original_pid = getpid();
+        resolve->workers_max = WORKERS_DEFAULT;
 
         for (i = 0; i < _FD_MAX; i++)
                 resolve->fds[i] = -1;
@@ -497,6 +587,12 @@ _public_ int sd_resolve_new(sd_resolve **ret) {
 
         fd_nonblock(resolve->fds[RESPONSE_RECV_FD], true);
 
+        /* Lets idle workers wake up and check whether they are still needed */
+        if (setsockopt(resolve->fds[REQUEST_RECV_FD], SOL_SOCKET, SO_RCVTIMEO, timeval_store(&tv, WORKER_IDLE_USEC), sizeof(tv)) < 0) {
+                r = -errno;
+                goto fail;
+        }
+
         *ret = resolve;
         return 0;
 
@@ -531,6 +627,26 @@ _public_ int sd_resolve_default(sd_resolve **ret) {
         return 1;
 }
 
+_public_ int sd_resolve_set_workers_max(sd_resolve *resolve, unsigned n) {
+        assert_return(resolve, -EINVAL);
+        assert_return(n >= WORKERS_MIN, -EINVAL);
+        assert_return(!resolve_pid_changed(resolve), -ECHILD);
+
+        /* Already running workers beyond the new limit go away
+         * once they are idle */
+        resolve->workers_max = MIN(n, WORKERS_MAX);
+        return 0;
+}
+
+_public_ int sd_resolve_get_workers_max(sd_resolve *resolve, unsigned *n) {
+        assert_return(resolve, -EINVAL);
+        assert_return(n, -EINVAL);
+        assert_return(!resolve_pid_changed(resolve), -ECHILD);
+
+        *n = resolve->workers_max;
+        return 0;
+}
+
 _public_ int sd_resolve_get_tid(sd_resolve *resolve, pid_t *tid) {
         assert_return(resolve, -EINVAL);
         assert_return(tid, -EINVAL);
@@ -547,6 +663,46 @@ _public_ int sd_resolve_get_tid(sd_resolve *resolve, pid_t *tid) {
         return -ENXIO;
 }
 
+static void histogram_add(unsigned *histogram, usec_t t) {
+        unsigned i;
+
+        i = log2u((unsigned) CLAMP(t, (usec_t) 1, (usec_t) UINT_MAX));
+        histogram[MIN(i, HISTOGRAM_BUCKETS - 1)]++;
+}
+
+static usec_t histogram_percentile(const unsigned *histogram, unsigned total, unsigned percent) {
+        unsigned i, n = 0;
+
+        /* Returns the upper bound of the bucket the percentile falls into */
+        for (i = 0; i < HISTOGRAM_BUCKETS; i++) {
+                n += histogram[i];
+                if ((uint64_t) n * 100 >= (uint64_t) total * percent)
+                        break;
+        }
+
+        return (usec_t) 1 << (MIN(i, HISTOGRAM_BUCKETS - 1) + 1);
+}
+
+static void log_latency_histograms(sd_resolve *resolve) {
+        char a[FORMAT_TIMESPAN_MAX], b[FORMAT_TIMESPAN_MAX], c[FORMAT_TIMESPAN_MAX], d[FORMAT_TIMESPAN_MAX];
+        unsigned i, total = 0;
+
+        assert(resolve);
+
+        for (i = 0; i < HISTOGRAM_BUCKETS; i++)
+                total += resolve->queued_histogram[i];
+
+        if (total == 0)
+                return;
+
+        log_debug("Resolved %u queries, queued p50 <%s p99 <%s, executing p50 <%s p99 <%s.",
+                  total,
+                  format_timespan(a, sizeof(a), histogram_percentile(resolve->queued_histogram, total, 50), 0),
+                  format_timespan(b, sizeof(b), histogram_percentile(resolve->queued_histogram, total, 99), 0),
+                  format_timespan(c, sizeof(c), histogram_percentile(resolve->executing_histogram, total, 50), 0),
+                  format_timespan(d, sizeof(d), histogram_percentile(resolve->executing_histogram, total, 99), 0));
+}
+
 static void resolve_free(sd_resolve *resolve) {
         PROTECT_ERRNO;
         sd_resolve_query *q;
@@ -573,20 +729,27 @@ static void resolve_free(sd_resolve *resolve) {
                         .type = REQUEST_TERMINATE,
                         .length = sizeof(req)
                 };
+                unsigned n;
 
                 /* Send one termination packet for each worker */
-                for (i = 0; i < resolve->n_valid_workers; i++)
+                n = __sync_fetch_and_add(&resolve->n_valid_workers, 0);
+                for (i = 0; i < n; i++)
                         (void) send(resolve->fds[REQUEST_SEND_FD], &req, req.length, MSG_NOSIGNAL);
         }
 
         /* Now terminate them and wait until they are gone. */
-        for (i = 0; i < resolve->n_valid_workers; i++) {
+        for (i = 0; i < WORKERS_MAX; i++) {
+                if (resolve->workers[i].state == WORKER_UNUSED)
+                        continue;
+
                 for (;;) {
-                        if (pthread_join(resolve->workers[i], NULL) != EINTR)
+                        if (pthread_join(resolve->workers[i].thread, NULL) != EINTR)
                                 break;
                 }
         }
 
+        log_latency_histograms(resolve);
+
         /* Close all communication channels */
         for (i = 0; i < _FD_MAX; i++)
                 safe_close(resolve->fds[i]);
@@ -768,6 +931,14 @@ static int handle_response(sd_resolve *resolve, const Packet *packet, size_t len
         if (!q)
                 return 0;
 
+        if (q->submitted > 0) {
+                usec_t total;
+
+                total = now(CLOCK_MONOTONIC) - q->submitted;
+                histogram_add(resolve->executing_histogram, resp->executing);
+                histogram_add(resolve->queued_histogram, LESS_BY(total, resp->executing));
+        }
+
         switch (resp->type) {
 
         case RESPONSE_ADDRINFO: {
@@ -853,6 +1024,7 @@ _public_ int sd_resolve_process(sd_resolve *resolve) {
                 Packet packet;
                 uint8_t space[BUFSIZE];
         } buf;
+        unsigned n;
         ssize_t l;
         int r;
 
@@ -862,21 +1034,28 @@ _public_ int sd_resolve_process(sd_resolve *resolve) {
         /* We don't allow recursively invoking sd_resolve_process(). */
         assert_return(!resolve->current, -EBUSY);
 
-        l = recv(resolve->fds[RESPONSE_RECV_FD], &buf, sizeof(buf), 0);
-        if (l < 0) {
-                if (errno == EAGAIN)
-                        return 0;
+        /* Handle a batch of responses per wakeup, so that many
+         * completed queries don't cost one poll() round each */
+        for (n = 0; n < RESPONSES_BATCH_MAX; n++) {
+                l = recv(resolve->fds[RESPONSE_RECV_FD], &buf, sizeof(buf), 0);
+                if (l < 0) {
+                        if (errno == EAGAIN)
+                                break;
 
-                return -errno;
-        }
-        if (l == 0)
-                return -ECONNREFUSED;
+                        return -errno;
+                }
+                if (l == 0)
+                        return -ECONNREFUSED;
 
-        r = handle_response(resolve, &buf.packet, (size_t) l);
-        if (r < 0)
-                return r;
+                r = handle_response(resolve, &buf.packet, (size_t) l);
+                if (r < 0)
+                        return r;
 
-        return 1;
+                if (resolve->dead)
+                        break;
+        }
+
+        return n > 0;
 }
 
 _public_ int sd_resolve_wait(sd_resolve *resolve, uint64_t timeout_usec) {
@@ -923,6 +1102,7 @@ static int alloc_query(sd_resolve *resolve, bool floating, sd_resolve_query **_q
         q->resolve = resolve;
         q->floating = floating;
         q->id = resolve->current_id++;
+        q->submitted = now(CLOCK_MONOTONIC);
 
         if (!floating)
                 sd_resolve_ref(resolve);
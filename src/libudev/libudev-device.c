@@ -222,7 +222,9 @@ struct udev_device *udev_device_new(struct udev *udev) {
         udev_device->refcount = 1;
         udev_device->udev = udev;
         udev_list_init(udev, &udev_device->properties, true);
+        udev_device->properties.interned = true;
         udev_list_init(udev, &udev_device->tags, true);
+        udev_device->tags.interned = true;
         udev_list_init(udev, &udev_device->sysattrs, true);
         udev_list_init(udev, &udev_device->devlinks, true);
 
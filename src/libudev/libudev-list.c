@@ -22,6 +22,9 @@
 #include <errno.h>
 #include <string.h>
 
+#include "sd-device.h"
+#include "device-private.h"
+
 #include "libudev-private.h"
 
 /**
@@ -138,6 +141,12 @@ static int list_search(struct udev_list *list, const char *name)
         return -(first+1);
 }
 
+static void udev_list_free_name(struct udev_list *list, char *name)
+{
+        if (!list->interned)
+                free(name);
+}
+
 struct udev_list_entry *udev_list_entry_add(struct udev_list *list, const char *name, const char *value)
 {
         struct udev_list_entry *entry;
@@ -165,15 +174,25 @@ struct udev_list_entry *udev_list_entry_add(struct udev_list *list, const char *
         entry = new0(struct udev_list_entry, 1);
         if (entry == NULL)
                 return NULL;
-        entry->name = strdup(name);
-        if (entry->name == NULL) {
-                free(entry);
-                return NULL;
+        if (list->interned) {
+                const char *n;
+
+                if (device_intern_string(name, &n) < 0) {
+                        free(entry);
+                        return NULL;
+                }
+                entry->name = (char*) n;
+        } else {
+                entry->name = strdup(name);
+                if (entry->name == NULL) {
+                        free(entry);
+                        return NULL;
+                }
         }
         if (value != NULL) {
                 entry->value = strdup(value);
                 if (entry->value == NULL) {
-                        free(entry->name);
+                        udev_list_free_name(list, entry->name);
                         free(entry);
                         return NULL;
                 }
@@ -190,7 +209,7 @@ struct udev_list_entry *udev_list_entry_add(struct udev_list *list, const char *
                                 add = 64;
                         entries = realloc(list->entries, (list->entries_max + add) * sizeof(struct udev_list_entry *));
                         if (entries == NULL) {
-                                free(entry->name);
+                                udev_list_free_name(list, entry->name);
                                 free(entry->value);
                                 free(entry);
                                 return NULL;
@@ -236,7 +255,7 @@ void udev_list_entry_delete(struct udev_list_entry *entry)
         }
 
         udev_list_node_remove(&entry->node);
-        free(entry->name);
+        udev_list_free_name(entry->list, entry->name);
         free(entry->value);
         free(entry);
 }
@@ -57,6 +57,7 @@ struct udev_monitor {
         struct udev_list filter_subsystem_list;
         struct udev_list filter_tag_list;
         bool bound;
+        struct monitor_datagram *batch;
 };
 
 enum udev_monitor_netlink_group {
@@ -89,6 +90,19 @@ struct udev_monitor_netlink_header {
         unsigned int filter_tag_bloom_lo;
 };
 
+/* one received message, with its sender and credentials */
+struct monitor_datagram {
+        union {
+                struct udev_monitor_netlink_header nlh;
+                char raw[8192];
+        } buf;
+        char cred_msg[CMSG_SPACE(sizeof(struct ucred))];
+        union sockaddr_union snl;
+};
+
+/* messages received at once by udev_monitor_receive_devices() */
+#define UDEV_MONITOR_BATCH 16U
+
 static struct udev_monitor *udev_monitor_new(struct udev *udev)
 {
         struct udev_monitor *udev_monitor;
@@ -484,6 +498,7 @@ _public_ struct udev_monitor *udev_monitor_unref(struct udev_monitor *udev_monit
                 close(udev_monitor->sock);
         udev_list_cleanup(&udev_monitor->filter_subsystem_list);
         udev_list_cleanup(&udev_monitor->filter_tag_list);
+        free(udev_monitor->batch);
         free(udev_monitor);
         return NULL;
 }
@@ -518,28 +533,74 @@ _public_ int udev_monitor_get_fd(struct udev_monitor *udev_monitor)
         return udev_monitor->sock;
 }
 
-static int passes_filter(struct udev_monitor *udev_monitor, struct udev_device *udev_device)
+static bool tags_contain(const char *tags, const char *tag)
+{
+        const char *word, *state;
+        size_t l;
+
+        /* same splitting as for TAGS= in sd-device */
+        FOREACH_WORD_SEPARATOR(word, l, tags, ":", state)
+                if (l == strlen(tag) && strneq(word, tag, l))
+                        return true;
+
+        return false;
+}
+
+/*
+ * Checks the filter against the raw properties of a received message,
+ * so that events nobody asked for are dropped before a device is
+ * built for them. Devices created from a message are sealed, hence
+ * SUBSYSTEM=, DEVTYPE= and TAGS= are all there is to compare against,
+ * just like udev_device_get_subsystem(), udev_device_get_devtype() and
+ * udev_device_has_tag() would see it. Messages without SUBSYSTEM= are
+ * passed on and rejected when creating the device.
+ */
+static int passes_filter(struct udev_monitor *udev_monitor, const char *nulstr, size_t len)
 {
         struct udev_list_entry *list_entry;
+        const char *subsystem = NULL, *devtype = NULL, *end = nulstr + len, *p;
+        size_t l;
+
+        if (udev_list_get_entry(&udev_monitor->filter_subsystem_list) == NULL &&
+            udev_list_get_entry(&udev_monitor->filter_tag_list) == NULL)
+                return 1;
+
+        for (p = nulstr; p < end; p += l + 1) {
+                const char *v;
+
+                /* leave unterminated ones to udev_device_new_from_nulstr() */
+                l = strnlen(p, end - p);
+                if (l >= (size_t) (end - p))
+                        break;
+
+                v = startswith(p, "SUBSYSTEM=");
+                if (v)
+                        subsystem = v;
+                else {
+                        v = startswith(p, "DEVTYPE=");
+                        if (v)
+                                devtype = v;
+                }
+        }
+
+        if (subsystem == NULL)
+                return 1;
 
         if (udev_list_get_entry(&udev_monitor->filter_subsystem_list) == NULL)
                 goto tag;
         udev_list_entry_foreach(list_entry, udev_list_get_entry(&udev_monitor->filter_subsystem_list)) {
                 const char *subsys = udev_list_entry_get_name(list_entry);
-                const char *dsubsys = udev_device_get_subsystem(udev_device);
-                const char *devtype;
-                const char *ddevtype;
+                const char *dtype;
 
-                if (!streq(dsubsys, subsys))
+                if (!streq(subsystem, subsys))
                         continue;
 
-                devtype = udev_list_entry_get_value(list_entry);
-                if (devtype == NULL)
+                dtype = udev_list_entry_get_value(list_entry);
+                if (dtype == NULL)
                         goto tag;
-                ddevtype = udev_device_get_devtype(udev_device);
-                if (ddevtype == NULL)
+                if (devtype == NULL)
                         continue;
-                if (streq(ddevtype, devtype))
+                if (streq(devtype, dtype))
                         goto tag;
         }
         return 0;
@@ -550,89 +611,61 @@ tag:
         udev_list_entry_foreach(list_entry, udev_list_get_entry(&udev_monitor->filter_tag_list)) {
                 const char *tag = udev_list_entry_get_name(list_entry);
 
-                if (udev_device_has_tag(udev_device, tag))
-                        return 1;
+                for (p = nulstr; p < end; p += l + 1) {
+                        const char *v;
+
+                        l = strnlen(p, end - p);
+                        if (l >= (size_t) (end - p))
+                                break;
+
+                        v = startswith(p, "TAGS=");
+                        if (v && tags_contain(v, tag))
+                                return 1;
+                }
         }
         return 0;
 }
 
-/**
- * udev_monitor_receive_device:
- * @udev_monitor: udev monitor
- *
- * Receive data from the udev monitor socket, allocate a new udev
- * device, fill in the received data, and return the device.
- *
- * Only socket connections with uid=0 are accepted.
- *
- * The monitor socket is by default set to NONBLOCK. A variant of poll() on
- * the file descriptor returned by udev_monitor_get_fd() should to be used to
- * wake up when new devices arrive, or alternatively the file descriptor
- * switched into blocking mode.
- *
- * The initial refcount is 1, and needs to be decremented to
- * release the resources of the udev device.
- *
- * Returns: a new udev device, or #NULL, in case of an error
- **/
-_public_ struct udev_device *udev_monitor_receive_device(struct udev_monitor *udev_monitor)
+/*
+ * Validates a received message, and creates a device from it if it
+ * passes the filter. Returns NULL for messages to skip, and sets
+ * *filtered if the message was fine, but filtered out.
+ */
+static struct udev_device *monitor_datagram_to_device(struct udev_monitor *udev_monitor,
+                                                      struct monitor_datagram *dgram,
+                                                      const struct msghdr *smsg,
+                                                      ssize_t buflen,
+                                                      bool *filtered)
 {
         struct udev_device *udev_device;
-        struct msghdr smsg;
-        struct iovec iov;
-        char cred_msg[CMSG_SPACE(sizeof(struct ucred))];
         struct cmsghdr *cmsg;
-        union sockaddr_union snl;
         struct ucred *cred;
-        union {
-                struct udev_monitor_netlink_header nlh;
-                char raw[8192];
-        } buf;
-        ssize_t buflen;
         ssize_t bufpos;
         bool is_initialized = false;
 
-retry:
-        if (udev_monitor == NULL)
-                return NULL;
-        iov.iov_base = &buf;
-        iov.iov_len = sizeof(buf);
-        memzero(&smsg, sizeof(struct msghdr));
-        smsg.msg_iov = &iov;
-        smsg.msg_iovlen = 1;
-        smsg.msg_control = cred_msg;
-        smsg.msg_controllen = sizeof(cred_msg);
-        smsg.msg_name = &snl;
-        smsg.msg_namelen = sizeof(snl);
-
-        buflen = recvmsg(udev_monitor->sock, &smsg, 0);
-        if (buflen < 0) {
-                if (errno != EINTR)
-                        log_debug("unable to receive message");
-                return NULL;
-        }
+        *filtered = false;
 
-        if (buflen < 32 || (smsg.msg_flags & MSG_TRUNC)) {
+        if (buflen < 32 || (smsg->msg_flags & MSG_TRUNC)) {
                 log_debug("invalid message length");
                 return NULL;
         }
 
-        if (snl.nl.nl_groups == 0) {
+        if (dgram->snl.nl.nl_groups == 0) {
                 /* unicast message, check if we trust the sender */
                 if (udev_monitor->snl_trusted_sender.nl.nl_pid == 0 ||
-                    snl.nl.nl_pid != udev_monitor->snl_trusted_sender.nl.nl_pid) {
+                    dgram->snl.nl.nl_pid != udev_monitor->snl_trusted_sender.nl.nl_pid) {
                         log_debug("unicast netlink message ignored");
                         return NULL;
                 }
-        } else if (snl.nl.nl_groups == UDEV_MONITOR_KERNEL) {
-                if (snl.nl.nl_pid > 0) {
+        } else if (dgram->snl.nl.nl_groups == UDEV_MONITOR_KERNEL) {
+                if (dgram->snl.nl.nl_pid > 0) {
                         log_debug("multicast kernel netlink message from PID %"PRIu32" ignored",
-                                  snl.nl.nl_pid);
+                                  dgram->snl.nl.nl_pid);
                         return NULL;
                 }
         }
 
-        cmsg = CMSG_FIRSTHDR(&smsg);
+        cmsg = CMSG_FIRSTHDR(smsg);
         if (cmsg == NULL || cmsg->cmsg_type != SCM_CREDENTIALS) {
                 log_debug("no sender credentials received, message ignored");
                 return NULL;
@@ -644,39 +677,45 @@ retry:
                 return NULL;
         }
 
-        if (memcmp(buf.raw, "libudev", 8) == 0) {
+        if (memcmp(dgram->buf.raw, "libudev", 8) == 0) {
                 /* udev message needs proper version magic */
-                if (buf.nlh.magic != htonl(UDEV_MONITOR_MAGIC)) {
+                if (dgram->buf.nlh.magic != htonl(UDEV_MONITOR_MAGIC)) {
                         log_debug("unrecognized message signature (%x != %x)",
-                                 buf.nlh.magic, htonl(UDEV_MONITOR_MAGIC));
+                                 dgram->buf.nlh.magic, htonl(UDEV_MONITOR_MAGIC));
                         return NULL;
                 }
-                if (buf.nlh.properties_off+32 > (size_t)buflen) {
+                if (dgram->buf.nlh.properties_off+32 > (size_t)buflen) {
                         log_debug("message smaller than expected (%u > %zd)",
-                                  buf.nlh.properties_off+32, buflen);
+                                  dgram->buf.nlh.properties_off+32, buflen);
                         return NULL;
                 }
 
-                bufpos = buf.nlh.properties_off;
+                bufpos = dgram->buf.nlh.properties_off;
 
                 /* devices received from udev are always initialized */
                 is_initialized = true;
         } else {
                 /* kernel message with header */
-                bufpos = strlen(buf.raw) + 1;
+                bufpos = strlen(dgram->buf.raw) + 1;
                 if ((size_t)bufpos < sizeof("a@/d") || bufpos >= buflen) {
                         log_debug("invalid message length");
                         return NULL;
                 }
 
                 /* check message header */
-                if (strstr(buf.raw, "@/") == NULL) {
+                if (strstr(dgram->buf.raw, "@/") == NULL) {
                         log_debug("unrecognized message header");
                         return NULL;
                 }
         }
 
-        udev_device = udev_device_new_from_nulstr(udev_monitor->udev, &buf.raw[bufpos], buflen - bufpos);
+        /* skip device, if it does not pass the current filter */
+        if (!passes_filter(udev_monitor, &dgram->buf.raw[bufpos], buflen - bufpos)) {
+                *filtered = true;
+                return NULL;
+        }
+
+        udev_device = udev_device_new_from_nulstr(udev_monitor->udev, &dgram->buf.raw[bufpos], buflen - bufpos);
         if (!udev_device) {
                 log_debug("could not create device: %m");
                 return NULL;
@@ -685,25 +724,131 @@ retry:
         if (is_initialized)
                 udev_device_set_is_initialized(udev_device);
 
-        /* skip device, if it does not pass the current filter */
-        if (!passes_filter(udev_monitor, udev_device)) {
-                struct pollfd pfd[1];
-                int rc;
-
-                udev_device_unref(udev_device);
-
-                /* if something is queued, get next device */
-                pfd[0].fd = udev_monitor->sock;
-                pfd[0].events = POLLIN;
-                rc = poll(pfd, 1, 0);
-                if (rc > 0)
-                        goto retry;
+        return udev_device;
+}
+
+static void monitor_datagram_prepare(struct monitor_datagram *dgram, struct msghdr *smsg, struct iovec *iov)
+{
+        iov->iov_base = &dgram->buf;
+        iov->iov_len = sizeof(dgram->buf);
+        memzero(smsg, sizeof(struct msghdr));
+        smsg->msg_iov = iov;
+        smsg->msg_iovlen = 1;
+        smsg->msg_control = dgram->cred_msg;
+        smsg->msg_controllen = sizeof(dgram->cred_msg);
+        smsg->msg_name = &dgram->snl;
+        smsg->msg_namelen = sizeof(dgram->snl);
+}
+
+/**
+ * udev_monitor_receive_device:
+ * @udev_monitor: udev monitor
+ *
+ * Receive data from the udev monitor socket, allocate a new udev
+ * device, fill in the received data, and return the device.
+ *
+ * Only socket connections with uid=0 are accepted.
+ *
+ * The monitor socket is by default set to NONBLOCK. A variant of poll() on
+ * the file descriptor returned by udev_monitor_get_fd() should to be used to
+ * wake up when new devices arrive, or alternatively the file descriptor
+ * switched into blocking mode.
+ *
+ * The initial refcount is 1, and needs to be decremented to
+ * release the resources of the udev device.
+ *
+ * Returns: a new udev device, or #NULL, in case of an error
+ **/
+_public_ struct udev_device *udev_monitor_receive_device(struct udev_monitor *udev_monitor)
+{
+        struct udev_device *udev_device;
+        struct monitor_datagram dgram;
+        struct msghdr smsg;
+        struct iovec iov;
+        ssize_t buflen;
+        bool filtered;
+        int flags = 0;
+
+retry:
+        if (udev_monitor == NULL)
                 return NULL;
+        monitor_datagram_prepare(&dgram, &smsg, &iov);
+
+        buflen = recvmsg(udev_monitor->sock, &smsg, flags);
+        if (buflen < 0) {
+                if (errno != EINTR && errno != EAGAIN)
+                        log_debug("unable to receive message");
+                return NULL;
+        }
+
+        udev_device = monitor_datagram_to_device(udev_monitor, &dgram, &smsg, buflen, &filtered);
+
+        /* if something is queued, get next device */
+        if (!udev_device && filtered) {
+                flags = MSG_DONTWAIT;
+                goto retry;
         }
 
         return udev_device;
 }
 
+/*
+ * udev_monitor_receive_devices:
+ * @udev_monitor: udev monitor
+ * @ret: array to store received devices in
+ * @n: size of @ret
+ *
+ * Like udev_monitor_receive_device(), but receives up to @n
+ * messages at once, and stores the devices for those that are valid
+ * and pass the filter in @ret. This blocks only if the socket is in
+ * blocking mode, and nothing is queued.
+ *
+ * Returns: the number of devices stored in @ret, which may be 0 if all
+ * received messages were dropped, or a negative errno, e.g. -EAGAIN if
+ * nothing was queued.
+ */
+int udev_monitor_receive_devices(struct udev_monitor *udev_monitor, struct udev_device **ret, unsigned n)
+{
+        struct mmsghdr msgs[UDEV_MONITOR_BATCH];
+        struct iovec iovs[UDEV_MONITOR_BATCH];
+        unsigned i, c = 0;
+        int k;
+
+        assert_return(udev_monitor, -EINVAL);
+        assert_return(ret || n == 0, -EINVAL);
+
+        n = MIN(n, UDEV_MONITOR_BATCH);
+        if (n == 0)
+                return 0;
+
+        if (!udev_monitor->batch) {
+                udev_monitor->batch = new(struct monitor_datagram, UDEV_MONITOR_BATCH);
+                if (!udev_monitor->batch)
+                        return -ENOMEM;
+        }
+
+        for (i = 0; i < n; i++) {
+                monitor_datagram_prepare(udev_monitor->batch + i, &msgs[i].msg_hdr, iovs + i);
+                msgs[i].msg_len = 0;
+        }
+
+        k = recvmmsg(udev_monitor->sock, msgs, n, MSG_WAITFORONE, NULL);
+        if (k < 0)
+                return -errno;
+
+        for (i = 0; i < (unsigned) k; i++) {
+                struct udev_device *udev_device;
+                bool filtered;
+
+                udev_device = monitor_datagram_to_device(udev_monitor, udev_monitor->batch + i,
+                                                         &msgs[i].msg_hdr, msgs[i].msg_len, &filtered);
+                if (udev_device)
+                        ret[c++] = udev_device;
+        }
+
+        return c;
+}
+
 int udev_monitor_send_device(struct udev_monitor *udev_monitor,
                              struct udev_monitor *destination, struct udev_device *udev_device)
 {
@@ -80,6 +80,7 @@ int udev_monitor_allow_unicast_sender(struct udev_monitor *udev_monitor, struct
 int udev_monitor_send_device(struct udev_monitor *udev_monitor,
                              struct udev_monitor *destination, struct udev_device *udev_device);
 struct udev_monitor *udev_monitor_new_from_netlink_fd(struct udev *udev, const char *name, int fd);
+int udev_monitor_receive_devices(struct udev_monitor *udev_monitor, struct udev_device **ret, unsigned n);
 
 /* libudev-list.c */
 struct udev_list_node {
@@ -92,6 +93,7 @@ struct udev_list {
         unsigned int entries_cur;
         unsigned int entries_max;
         bool unique;
+        bool interned; /* entry names come from device_intern_string() */
 };
 void udev_list_node_init(struct udev_list_node *list);
 int udev_list_node_is_empty(struct udev_list_node *list);
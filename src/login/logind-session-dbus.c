@@ -704,7 +704,10 @@ int session_send_create_reply(Session *s, sd_bus_error *error) {
         if (!s->create_message)
                 return 0;
 
-        if (!sd_bus_error_is_set(error) && (s->scope_job || s->user->service_job))
+        /* The session scope is needed before the session may
+         * start, the user's service manager only if asked for */
+        if (!sd_bus_error_is_set(error) &&
+            (s->scope_job || (s->user->service_job && s->manager->wait_for_user_service)))
                 return 0;
 
         c = s->create_message;
@@ -717,9 +720,10 @@ int session_send_create_reply(Session *s, sd_bus_error *error) {
         if (fifo_fd < 0)
                 return fifo_fd;
 
-        /* Update the session state file before we notify the client
-         * about the result. */
+        /* Update the session and user state files before we notify
+         * the client about the result. */
         session_save(s);
+        user_save_now(s->user);
 
         p = session_bus_path(s);
         if (!p)
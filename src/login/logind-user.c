@@ -81,6 +81,11 @@ void user_free(User *u) {
         if (u->in_gc_queue)
                 LIST_REMOVE(gc_queue, u->manager->user_gc_queue, u);
 
+        /* Don't lose a pending save, for example when we are
+         * shutting down */
+        if (u->in_save_queue)
+                user_save_now(u);
+
         while (u->sessions)
                 session_free(u->sessions);
 
@@ -261,13 +266,66 @@ fail:
         return log_error_errno(r, "Failed to save user data %s: %m", u->state_file);
 }
 
+static int user_dispatch_save_queue(sd_event_source *s, void *userdata) {
+        Manager *m = userdata;
+
+        assert(m);
+
+        while (m->user_save_queue)
+                user_save_now(m->user_save_queue);
+
+        return 0;
+}
+
 int user_save(User *u) {
+        Manager *m;
+        int r;
+
         assert(u);
 
         if (!u->started)
                 return 0;
 
-        return user_save_internal (u);
+        if (u->in_save_queue)
+                return 0;
+
+        m = u->manager;
+
+        /* Writing is deferred until we are otherwise idle, so that a
+         * burst of session changes results in one write per user,
+         * instead of one per change */
+        if (!m->user_save_event_source) {
+                r = sd_event_add_defer(m->event, &m->user_save_event_source, user_dispatch_save_queue, m);
+                if (r < 0)
+                        return user_save_internal(u);
+
+                r = sd_event_source_set_priority(m->user_save_event_source, SD_EVENT_PRIORITY_IDLE);
+                if (r < 0)
+                        return user_save_internal(u);
+        }
+
+        r = sd_event_source_set_enabled(m->user_save_event_source, SD_EVENT_ONESHOT);
+        if (r < 0)
+                return user_save_internal(u);
+
+        LIST_PREPEND(save_queue, m->user_save_queue, u);
+        u->in_save_queue = true;
+
+        return 0;
+}
+
+int user_save_now(User *u) {
+        assert(u);
+
+        if (u->in_save_queue) {
+                LIST_REMOVE(save_queue, u->manager->user_save_queue, u);
+                u->in_save_queue = false;
+        }
+
+        if (!u->started)
+                return 0;
+
+        return user_save_internal(u);
 }
 
 int user_load(User *u) {
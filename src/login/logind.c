@@ -51,6 +51,7 @@ static Manager *manager_new(void) {
         m->n_autovts = 6;
         m->reserve_vt = 6;
         m->remove_ipc = true;
+        m->wait_for_user_service = true;
         m->inhibit_delay_max = 5 * USEC_PER_SEC;
         m->handle_power_key = HANDLE_POWEROFF;
         m->handle_suspend_key = HANDLE_SUSPEND;
@@ -138,6 +139,7 @@ static void manager_free(Manager *m) {
         hashmap_free(m->user_units);
         hashmap_free(m->session_units);
 
+        sd_event_source_unref(m->user_save_event_source);
         sd_event_source_unref(m->idle_action_event_source);
         sd_event_source_unref(m->inhibit_timeout_source);
         sd_event_source_unref(m->scheduled_shutdown_timeout_source);
@@ -52,6 +52,12 @@ struct Manager {
         LIST_HEAD(Session, session_gc_queue);
         LIST_HEAD(User, user_gc_queue);
 
+        /* Users whose state file needs to be written. These list
+         * all their sessions, hence are written out only once per
+         * batch of changes. */
+        LIST_HEAD(User, user_save_queue);
+        sd_event_source *user_save_event_source;
+
         struct udev *udev;
         struct udev_monitor *udev_seat_monitor, *udev_device_monitor, *udev_vcsa_monitor, *udev_button_monitor;
 
@@ -126,6 +132,7 @@ struct Manager {
         bool lid_switch_ignore_inhibited;
 
         bool remove_ipc;
+        bool wait_for_user_service;
 
         Hashmap *polkit_registry;
 
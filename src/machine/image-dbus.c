@@ -19,19 +19,215 @@
   along with systemd; If not, see <http://www.gnu.org/licenses/>.
 ***/
 
+#include <sys/inotify.h>
+
 #include "bus-label.h"
 #include "strv.h"
 #include "bus-util.h"
 #include "machine-image.h"
 #include "image-dbus.h"
 
+/* Quotas change as the image is written to, but there is no event
+ * for that, hence re-read them when they are older than this */
+#define IMAGE_USAGE_MAX_AGE_USEC (10 * USEC_PER_SEC)
+
 static BUS_DEFINE_PROPERTY_GET_ENUM(property_get_type, image_type, ImageType);
 
+static Image *image_cache_drop(Manager *m, const char *name) {
+        Image *image;
+
+        assert(m);
+        assert(name);
+
+        /* Removes the image from the cache and returns it, the
+         * caller has to unref it. The next lookup will probe it
+         * again. */
+
+        m->image_cache_complete = false;
+
+        image = hashmap_remove(m->image_cache, name);
+        if (image)
+                log_debug("Dropped image %s from cache.", name);
+
+        return image;
+}
+
+static void image_cache_flush(Manager *m) {
+        Image *i;
+
+        assert(m);
+
+        m->image_cache_complete = false;
+
+        while ((i = hashmap_steal_first(m->image_cache)))
+                image_unref(i);
+}
+
+static int image_cache_on_inotify(sd_event_source *s, int fd, uint32_t revents, void *userdata) {
+        union inotify_event_buffer buffer;
+        struct inotify_event *e;
+        Manager *m = userdata;
+        ssize_t l;
+
+        assert(m);
+
+        l = read(fd, &buffer, sizeof(buffer));
+        if (l < 0) {
+                if (errno == EAGAIN || errno == EINTR)
+                        return 0;
+
+                log_warning_errno(errno, "Failed to read image directory inotify events, flushing image cache: %m");
+                image_cache_flush(m);
+                return 0;
+        }
+
+        FOREACH_INOTIFY_EVENT(e, buffer, l) {
+                const char *name;
+                char *raw;
+
+                /* A search path directory went away or we lost
+                 * track, start from scratch */
+                if (e->mask & (IN_Q_OVERFLOW|IN_IGNORED|IN_DELETE_SELF|IN_MOVE_SELF)) {
+                        image_cache_flush(m);
+                        continue;
+                }
+
+                if (e->len <= 0)
+                        continue;
+
+                name = e->name;
+                raw = endswith(name, ".raw");
+                if (raw)
+                        name = strndupa(name, raw - name);
+
+                image_unref(image_cache_drop(m, name));
+        }
+
+        return 0;
+}
+
+static int image_cache_watch(Manager *m, bool *all) {
+        const char *path;
+        int r;
+
+        assert(m);
+        assert(all);
+
+        if (m->image_inotify_fd < 0) {
+                _cleanup_close_ int fd = -1;
+
+                fd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+                if (fd < 0)
+                        return -errno;
+
+                r = sd_event_add_io(m->event, &m->image_inotify_event_source, fd, EPOLLIN, image_cache_on_inotify, m);
+                if (r < 0)
+                        return r;
+
+                m->image_inotify_fd = fd;
+                fd = -1;
+        }
+
+        /* Adding the same watch again is cheap and has no effect,
+         * but picks up directories that did not exist so far */
+        *all = true;
+        NULSTR_FOREACH(path, image_search_path)
+                if (inotify_add_watch(m->image_inotify_fd, path,
+                                      IN_CREATE|IN_DELETE|IN_MOVE|IN_ATTRIB|IN_CLOSE_WRITE|
+                                      IN_DELETE_SELF|IN_MOVE_SELF|IN_ONLYDIR) < 0) {
+                        if (errno != ENOENT)
+                                log_debug_errno(errno, "Failed to watch %s, ignoring: %m", path);
+
+                        *all = false;
+                }
+
+        return 0;
+}
+
+int image_cache_discover(Manager *m) {
+        bool all = false;
+        Image *image;
+        Iterator i;
+        int r;
+
+        assert(m);
+
+        if (m->image_cache_complete)
+                return 0;
+
+        r = hashmap_ensure_allocated(&m->image_cache, &string_hash_ops);
+        if (r < 0)
+                return r;
+
+        r = image_cache_watch(m, &all);
+        if (r < 0)
+                log_debug_errno(r, "Failed to watch image directories, not caching images: %m");
+
+        /* Only images not in the cache yet are probed */
+        r = image_discover(m->image_cache);
+        if (r < 0)
+                return r;
+
+        HASHMAP_FOREACH(image, m->image_cache, i)
+                image->userdata = m;
+
+        /* Without a watch on every directory there is no telling
+         * when images appear, hence look again next time */
+        m->image_cache_complete = all;
+
+        return 0;
+}
+
+void image_cache_update_usage(Image *image) {
+        int r;
+
+        assert(image);
+
+        if (image->usage_timestamp > 0 &&
+            image->usage_timestamp + IMAGE_USAGE_MAX_AGE_USEC > now(CLOCK_MONOTONIC))
+                return;
+
+        r = image_read_usage(image);
+        if (r < 0 && r != -ENOTTY)
+                log_debug_errno(r, "Failed to read usage of image %s, ignoring: %m", image->name);
+}
+
+static int property_get_usage(
+                sd_bus *bus,
+                const char *path,
+                const char *interface,
+                const char *property,
+                sd_bus_message *reply,
+                void *userdata,
+                sd_bus_error *error) {
+
+        Image *image = userdata;
+        uint64_t v;
+
+        assert(bus);
+        assert(reply);
+        assert(image);
+
+        image_cache_update_usage(image);
+
+        if (streq(property, "Usage"))
+                v = image->usage;
+        else if (streq(property, "UsageExclusive"))
+                v = image->usage_exclusive;
+        else if (streq(property, "Limit"))
+                v = image->limit;
+        else
+                v = image->limit_exclusive;
+
+        return sd_bus_message_append(reply, "t", v);
+}
+
 int bus_image_method_remove(
                 sd_bus_message *message,
                 void *userdata,
                 sd_bus_error *error) {
 
+        _cleanup_(image_unrefp) Image *cached = NULL;
         Image *image = userdata;
         Manager *m = image->userdata;
         int r;
@@ -53,6 +249,8 @@ int bus_image_method_remove(
         if (r == 0)
                 return 1; /* Will call us back */
 
+        cached = image_cache_drop(m, image->name);
+
         r = image_remove(image);
         if (r < 0)
                 return r;
@@ -65,6 +263,7 @@ int bus_image_method_rename(
                 void *userdata,
                 sd_bus_error *error) {
 
+        _cleanup_(image_unrefp) Image *cached = NULL;
         Image *image = userdata;
         Manager *m = image->userdata;
         const char *new_name;
@@ -94,6 +293,10 @@ int bus_image_method_rename(
         if (r == 0)
                 return 1; /* Will call us back */
 
+        /* The cache is keyed by the name, which is about to change */
+        cached = image_cache_drop(m, image->name);
+        image_unref(image_cache_drop(m, new_name));
+
         r = image_rename(image, new_name);
         if (r < 0)
                 return r;
@@ -135,6 +338,8 @@ int bus_image_method_clone(
         if (r == 0)
                 return 1; /* Will call us back */
 
+        image_unref(image_cache_drop(m, new_name));
+
         r = image_clone(image, new_name, read_only);
         if (r < 0)
                 return r;
@@ -147,6 +352,7 @@ int bus_image_method_mark_read_only(
                 void *userdata,
                 sd_bus_error *error) {
 
+        _cleanup_(image_unrefp) Image *cached = NULL;
         Image *image = userdata;
         Manager *m = image->userdata;
         int r, read_only;
@@ -171,6 +377,8 @@ int bus_image_method_mark_read_only(
         if (r == 0)
                 return 1; /* Will call us back */
 
+        cached = image_cache_drop(m, image->name);
+
         r = image_read_only(image, read_only);
         if (r < 0)
                 return r;
@@ -183,6 +391,7 @@ int bus_image_method_set_limit(
                 void *userdata,
                 sd_bus_error *error) {
 
+        _cleanup_(image_unrefp) Image *cached = NULL;
         Image *image = userdata;
         Manager *m = image->userdata;
         uint64_t limit;
@@ -208,6 +417,8 @@ int bus_image_method_set_limit(
         if (r == 0)
                 return 1; /* Will call us back */
 
+        cached = image_cache_drop(m, image->name);
+
         r = image_set_limit(image, limit);
         if (r < 0)
                 return r;
@@ -223,10 +434,10 @@ const sd_bus_vtable image_vtable[] = {
         SD_BUS_PROPERTY("ReadOnly", "b", bus_property_get_bool, offsetof(Image, read_only), 0),
         SD_BUS_PROPERTY("CreationTimestamp", "t", NULL, offsetof(Image, crtime), 0),
         SD_BUS_PROPERTY("ModificationTimestamp", "t", NULL, offsetof(Image, mtime), 0),
-        SD_BUS_PROPERTY("Usage", "t", NULL, offsetof(Image, usage), 0),
-        SD_BUS_PROPERTY("Limit", "t", NULL, offsetof(Image, limit), 0),
-        SD_BUS_PROPERTY("UsageExclusive", "t", NULL, offsetof(Image, usage_exclusive), 0),
-        SD_BUS_PROPERTY("LimitExclusive", "t", NULL, offsetof(Image, limit_exclusive), 0),
+        SD_BUS_PROPERTY("Usage", "t", property_get_usage, 0, 0),
+        SD_BUS_PROPERTY("Limit", "t", property_get_usage, 0, 0),
+        SD_BUS_PROPERTY("UsageExclusive", "t", property_get_usage, 0, 0),
+        SD_BUS_PROPERTY("LimitExclusive", "t", property_get_usage, 0, 0),
         SD_BUS_METHOD("Remove", NULL, NULL, bus_image_method_remove, SD_BUS_VTABLE_UNPRIVILEGED),
         SD_BUS_METHOD("Rename", "s", NULL, bus_image_method_rename, SD_BUS_VTABLE_UNPRIVILEGED),
         SD_BUS_METHOD("Clone", "sb", NULL, bus_image_method_clone, SD_BUS_VTABLE_UNPRIVILEGED),
@@ -235,19 +446,6 @@ const sd_bus_vtable image_vtable[] = {
         SD_BUS_VTABLE_END
 };
 
-static int image_flush_cache(sd_event_source *s, void *userdata) {
-        Manager *m = userdata;
-        Image *i;
-
-        assert(s);
-        assert(m);
-
-        while ((i = hashmap_steal_first(m->image_cache)))
-                image_unref(i);
-
-        return 0;
-}
-
 int image_object_find(sd_bus *bus, const char *path, const char *interface, void *userdata, void **found, sd_bus_error *error) {
         _cleanup_free_ char *e = NULL;
         Manager *m = userdata;
@@ -269,39 +467,14 @@ int image_object_find(sd_bus *bus, const char *path, const char *interface, void
                 return -ENOMEM;
 
         image = hashmap_get(m->image_cache, e);
-        if (image) {
-                *found = image;
-                return 1;
-        }
-
-        r = hashmap_ensure_allocated(&m->image_cache, &string_hash_ops);
-        if (r < 0)
-                return r;
-
-        if (!m->image_cache_defer_event) {
-                r = sd_event_add_defer(m->event, &m->image_cache_defer_event, image_flush_cache, m);
-                if (r < 0)
-                        return r;
-
-                r = sd_event_source_set_priority(m->image_cache_defer_event, SD_EVENT_PRIORITY_IDLE);
+        if (!image) {
+                r = image_cache_discover(m);
                 if (r < 0)
                         return r;
-        }
-
-        r = sd_event_source_set_enabled(m->image_cache_defer_event, SD_EVENT_ONESHOT);
-        if (r < 0)
-                return r;
-
-        r = image_find(e, &image);
-        if (r <= 0)
-                return r;
-
-        image->userdata = m;
 
-        r = hashmap_put(m->image_cache, image->name, image);
-        if (r < 0) {
-                image_unref(image);
-                return r;
+                image = hashmap_get(m->image_cache, e);
+                if (!image)
+                        return 0;
         }
 
         *found = image;
@@ -321,8 +494,8 @@ char *image_bus_path(const char *name) {
 }
 
 int image_node_enumerator(sd_bus *bus, const char *path, void *userdata, char ***nodes, sd_bus_error *error) {
-        _cleanup_(image_hashmap_freep) Hashmap *images = NULL;
         _cleanup_strv_free_ char **l = NULL;
+        Manager *m = userdata;
         Image *image;
         Iterator i;
         int r;
@@ -331,15 +504,11 @@ int image_node_enumerator(sd_bus *bus, const char *path, void *userdata, char **
         assert(path);
         assert(nodes);
 
-        images = hashmap_new(&string_hash_ops);
-        if (!images)
-                return -ENOMEM;
-
-        r = image_discover(images);
+        r = image_cache_discover(m);
         if (r < 0)
                 return r;
 
-        HASHMAP_FOREACH(image, images, i) {
+        HASHMAP_FOREACH(image, m->image_cache, i) {
                 char *p;
 
                 p = image_bus_path(image->name);
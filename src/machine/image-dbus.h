@@ -27,6 +27,9 @@ extern const sd_bus_vtable image_vtable[];
 
 char *image_bus_path(const char *name);
 
+int image_cache_discover(Manager *m);
+void image_cache_update_usage(Image *image);
+
 int image_object_find(sd_bus *bus, const char *path, const char *interface, void *userdata, void **found, sd_bus_error *error);
 int image_node_enumerator(sd_bus *bus, const char *path, void *userdata, char ***nodes, sd_bus_error *error);
 
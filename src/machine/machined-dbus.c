@@ -547,7 +547,6 @@ static int method_get_machine_os_release(sd_bus_message *message, void *userdata
 
 static int method_list_images(sd_bus_message *message, void *userdata, sd_bus_error *error) {
         _cleanup_bus_message_unref_ sd_bus_message *reply = NULL;
-        _cleanup_(image_hashmap_freep) Hashmap *images = NULL;
         Manager *m = userdata;
         Image *image;
         Iterator i;
@@ -556,11 +555,7 @@ static int method_list_images(sd_bus_message *message, void *userdata, sd_bus_er
         assert(message);
         assert(m);
 
-        images = hashmap_new(&string_hash_ops);
-        if (!images)
-                return -ENOMEM;
-
-        r = image_discover(images);
+        r = image_cache_discover(m);
         if (r < 0)
                 return r;
 
@@ -572,9 +567,11 @@ static int method_list_images(sd_bus_message *message, void *userdata, sd_bus_er
         if (r < 0)
                 return r;
 
-        HASHMAP_FOREACH(image, images, i) {
+        HASHMAP_FOREACH(image, m->image_cache, i) {
                 _cleanup_free_ char *p = NULL;
 
+                image_cache_update_usage(image);
+
                 p = image_bus_path(image->name);
                 if (!p)
                         return -ENOMEM;
@@ -45,6 +45,7 @@ Manager *manager_new(void) {
         m->machines = hashmap_new(&string_hash_ops);
         m->machine_units = hashmap_new(&string_hash_ops);
         m->machine_leaders = hashmap_new(NULL);
+        m->image_inotify_fd = -1;
 
         if (!m->machines || !m->machine_units || !m->machine_leaders) {
                 manager_free(m);
@@ -80,7 +81,8 @@ void manager_free(Manager *m) {
 
         hashmap_free(m->image_cache);
 
-        sd_event_source_unref(m->image_cache_defer_event);
+        sd_event_source_unref(m->image_inotify_event_source);
+        safe_close(m->image_inotify_fd);
 
         bus_verify_polkit_async_registry_free(m->polkit_registry);
 
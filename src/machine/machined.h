@@ -44,8 +44,13 @@ struct Manager {
 
         Hashmap *polkit_registry;
 
+        /* All images in the search path, kept up-to-date via
+         * inotify, so that enumeration does not need to probe every
+         * image each time */
         Hashmap *image_cache;
-        sd_event_source *image_cache_defer_event;
+        bool image_cache_complete;
+        int image_inotify_fd;
+        sd_event_source *image_inotify_event_source;
 
         LIST_HEAD(Machine, machine_gc_queue);
 
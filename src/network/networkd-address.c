@@ -22,6 +22,7 @@
 #include <net/if.h>
 
 #include "utf8.h"
+#include "siphash24.h"
 #include "util.h"
 #include "conf-parser.h"
 #include "firewall-util.h"
@@ -633,3 +634,43 @@ bool address_equal(Address *a1, Address *a2) {
                 assert_not_reached("Invalid address family");
         }
 }
+
+static unsigned long address_hash_func(const void *b, const uint8_t hash_key[HASH_KEY_SIZE]) {
+        const Address *a = b;
+        struct {
+                int family;
+                unsigned char prefixlen;
+                union in_addr_union in_addr;
+        } key;
+        uint64_t u;
+
+        /* must agree with address_equal(), so only hash what it
+         * compares */
+        zero(key);
+        key.family = a->family;
+
+        switch (a->family) {
+        case AF_INET:
+                key.prefixlen = a->prefixlen;
+                if (a->prefixlen > 0)
+                        key.in_addr.in.s_addr = be32toh(a->in_addr.in.s_addr) >> (32 - a->prefixlen);
+                break;
+
+        case AF_INET6:
+                key.in_addr.in6 = a->in_addr.in6;
+                break;
+        }
+
+        siphash24((uint8_t*) &u, &key, sizeof(key), hash_key);
+
+        return (unsigned long) u;
+}
+
+static int address_compare_func(const void *a, const void *b) {
+        return address_equal((Address*) a, (Address*) b) ? 0 : 1;
+}
+
+const struct hash_ops address_hash_ops = {
+        .hash = address_hash_func,
+        .compare = address_compare_func
+};
@@ -28,11 +28,81 @@
 static BUS_DEFINE_PROPERTY_GET_ENUM(property_get_operational_state, link_operstate, LinkOperationalState);
 static BUS_DEFINE_PROPERTY_GET_ENUM(property_get_administrative_state, link_state, LinkState);
 
+static int property_get_lldp_generation(
+                sd_bus *bus,
+                const char *path,
+                const char *interface,
+                const char *property,
+                sd_bus_message *reply,
+                void *userdata,
+                sd_bus_error *error) {
+
+        Link *link = userdata;
+        uint64_t generation = 0;
+        int r;
+
+        assert(bus);
+        assert(reply);
+        assert(link);
+
+        if (link->lldp) {
+                r = sd_lldp_get_generation(link->lldp, &generation);
+                if (r < 0)
+                        return r;
+        }
+
+        return sd_bus_message_append(reply, "t", generation);
+}
+
+/* Returns the neighbours that changed since the given generation, or
+ * all of them if that cannot be told, along with the current
+ * generation to pass next time. */
+static int method_get_lldp_neighbors(sd_bus_message *message, void *userdata, sd_bus_error *error) {
+        _cleanup_bus_message_unref_ sd_bus_message *reply = NULL;
+        _cleanup_strv_free_ char **l = NULL;
+        Link *link = userdata;
+        uint64_t since, generation = 0;
+        bool complete = true;
+        int r;
+
+        assert(message);
+        assert(link);
+
+        r = sd_bus_message_read(message, "t", &since);
+        if (r < 0)
+                return r;
+
+        if (link->lldp) {
+                r = sd_lldp_get_neighbors(link->lldp, since, &generation, &l);
+                if (r < 0)
+                        return r;
+
+                complete = r > 0;
+        }
+
+        r = sd_bus_message_new_method_return(message, &reply);
+        if (r < 0)
+                return r;
+
+        r = sd_bus_message_append(reply, "tb", generation, complete);
+        if (r < 0)
+                return r;
+
+        r = sd_bus_message_append_strv(reply, l);
+        if (r < 0)
+                return r;
+
+        return sd_bus_send(NULL, reply, NULL);
+}
+
 const sd_bus_vtable link_vtable[] = {
         SD_BUS_VTABLE_START(0),
 
         SD_BUS_PROPERTY("OperationalState", "s", property_get_operational_state, offsetof(Link, operstate), SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE),
         SD_BUS_PROPERTY("AdministrativeState", "s", property_get_administrative_state, offsetof(Link, state), SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE),
+        SD_BUS_PROPERTY("LLDPGeneration", "t", property_get_lldp_generation, 0, SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE),
+
+        SD_BUS_METHOD("GetLLDPNeighbors", "t", "tbas", method_get_lldp_neighbors, SD_BUS_VTABLE_UNPRIVILEGED),
 
         SD_BUS_VTABLE_END
 };
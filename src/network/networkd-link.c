@@ -201,7 +201,7 @@ static int link_update_flags(Link *link, sd_netlink_message *m) {
         link->flags = flags;
         link->kernel_operstate = operstate;
 
-        link_save(link);
+        link_dirty(link);
 
         return 0;
 }
@@ -241,6 +241,7 @@ static int link_new(Manager *manager, sd_netlink_message *message, Link **ret) {
         link->state = LINK_STATE_PENDING;
         link->rtnl_extended_attrs = true;
         link->ifindex = ifindex;
+        link->added_usec = now(CLOCK_MONOTONIC);
         link->ifname = strdup(ifname);
         if (!link->ifname)
                 return -ENOMEM;
@@ -259,6 +260,11 @@ static int link_new(Manager *manager, sd_netlink_message *message, Link **ret) {
         if (r < 0)
                 return -ENOMEM;
 
+        r = asprintf(&link->dhcp_server_lease_file, "/run/systemd/netif/dhcp-server-leases/%d",
+                     link->ifindex);
+        if (r < 0)
+                return -ENOMEM;
+
         r = asprintf(&link->lldp_file, "/run/systemd/netif/lldp/%d",
                      link->ifindex);
         if (r < 0)
@@ -291,10 +297,9 @@ static void link_free(Link *link) {
         if (!link)
                 return;
 
-        while ((address = link->addresses)) {
-                LIST_REMOVE(addresses, link->addresses, address);
+        while ((address = set_steal_first(link->addresses)))
                 address_free(address);
-        }
+        set_free(link->addresses);
 
         while ((address = link->pool_addresses)) {
                 LIST_REMOVE(addresses, link->pool_addresses, address);
@@ -306,6 +311,7 @@ static void link_free(Link *link) {
         sd_dhcp_lease_unref(link->dhcp_lease);
 
         free(link->lease_file);
+        free(link->dhcp_server_lease_file);
 
         sd_lldp_free(link->lldp);
 
@@ -385,7 +391,7 @@ static void link_enter_unmanaged(Link *link) {
 
         link_set_state(link, LINK_STATE_UNMANAGED);
 
-        link_save(link);
+        link_dirty(link);
 }
 
 static int link_stop_clients(Link *link) {
@@ -443,7 +449,7 @@ void link_enter_failed(Link *link) {
 
         link_stop_clients(link);
 
-        link_save(link);
+        link_dirty(link);
 }
 
 static Address* link_find_dhcp_server_address(Link *link) {
@@ -476,15 +482,23 @@ static Address* link_find_dhcp_server_address(Link *link) {
 }
 
 static int link_enter_configured(Link *link) {
+        char total[FORMAT_TIMESPAN_MAX], udev[FORMAT_TIMESPAN_MAX];
+        usec_t n;
+
         assert(link);
         assert(link->network);
         assert(link->state == LINK_STATE_SETTING_ROUTES);
 
         log_link_info(link, "Configured");
 
+        n = now(CLOCK_MONOTONIC);
+        log_link_debug(link, "Configuration took %s, of which %s waiting for udev",
+                       format_timespan(total, sizeof(total), n - link->added_usec, USEC_PER_MSEC),
+                       format_timespan(udev, sizeof(udev), link->initialized_usec - link->added_usec, USEC_PER_MSEC));
+
         link_set_state(link, LINK_STATE_CONFIGURED);
 
-        link_save(link);
+        link_dirty(link);
 
         return 0;
 }
@@ -539,7 +553,7 @@ static int route_handler(sd_netlink *rtnl, sd_netlink_message *m, void *userdata
 
 static int link_enter_set_routes(Link *link) {
         Route *rt;
-        int r;
+        int r, k;
 
         assert(link);
         assert(link->network);
@@ -547,17 +561,28 @@ static int link_enter_set_routes(Link *link) {
 
         link_set_state(link, LINK_STATE_SETTING_ROUTES);
 
+        /* Queue all of them and hand them to the kernel in one go */
+        r = sd_netlink_batch_begin(link->manager->rtnl);
+        if (r < 0)
+                return r;
+
         LIST_FOREACH(routes, rt, link->network->static_routes) {
                 r = route_configure(rt, link, &route_handler);
-                if (r < 0) {
-                        log_link_warning_errno(link, r, "Could not set routes: %m");
-                        link_enter_failed(link);
-                        return r;
-                }
+                if (r < 0)
+                        break;
 
                 link->link_messages ++;
         }
 
+        k = sd_netlink_batch_end(link->manager->rtnl);
+        if (r >= 0)
+                r = k;
+        if (r < 0) {
+                log_link_warning_errno(link, r, "Could not set routes: %m");
+                link_enter_failed(link);
+                return r;
+        }
+
         if (link->link_messages == 0) {
                 link->static_configured = true;
                 link_client_handler(link);
@@ -708,7 +733,7 @@ static int link_push_ntp_to_dhcp_server(Link *link, sd_dhcp_server *s) {
 
 static int link_enter_set_addresses(Link *link) {
         Address *ad;
-        int r;
+        int r, k;
 
         assert(link);
         assert(link->network);
@@ -716,17 +741,28 @@ static int link_enter_set_addresses(Link *link) {
 
         link_set_state(link, LINK_STATE_SETTING_ADDRESSES);
 
+        /* Queue all of them and hand them to the kernel in one go */
+        r = sd_netlink_batch_begin(link->manager->rtnl);
+        if (r < 0)
+                return r;
+
         LIST_FOREACH(addresses, ad, link->network->static_addresses) {
                 r = address_configure(ad, link, &address_handler);
-                if (r < 0) {
-                        log_link_warning_errno(link, r, "Could not set addresses: %m");
-                        link_enter_failed(link);
-                        return r;
-                }
+                if (r < 0)
+                        break;
 
                 link->link_messages ++;
         }
 
+        k = sd_netlink_batch_end(link->manager->rtnl);
+        if (r >= 0)
+                r = k;
+        if (r < 0) {
+                log_link_warning_errno(link, r, "Could not set addresses: %m");
+                link_enter_failed(link);
+                return r;
+        }
+
         /* now that we can figure out a default address for the dhcp server,
            start it */
         if (link_dhcp4_server_enabled(link)) {
@@ -1106,7 +1142,6 @@ static int link_set_bridge(Link *link) {
 
 static void lldp_handler(sd_lldp *lldp, int event, void *userdata) {
         Link *link = userdata;
-        int r;
 
         assert(link);
         assert(link->network);
@@ -1115,10 +1150,10 @@ static void lldp_handler(sd_lldp *lldp, int event, void *userdata) {
         if (event != UPDATE_INFO)
                 return;
 
-        r = sd_lldp_save(link->lldp, link->lldp_file);
-        if (r < 0)
-                log_link_warning_errno(link, r, "Could not save LLDP: %m");
+        /* the LLDP file is written along with the state file */
+        link_dirty(link);
 
+        link_send_changed(link, "LLDPGeneration", NULL);
 }
 
 static int link_acquire_conf(Link *link) {
@@ -1424,14 +1459,14 @@ static int link_new_bound_by_list(Link *link) {
         }
 
         if (list_updated)
-                link_save(link);
+                link_dirty(link);
 
         HASHMAP_FOREACH (carrier, link->bound_by_links, i) {
                 r = link_put_carrier(carrier, link, &carrier->bound_to_links);
                 if (r < 0)
                         return r;
 
-                link_save(carrier);
+                link_dirty(carrier);
         }
 
         return 0;
@@ -1466,14 +1501,14 @@ static int link_new_bound_to_list(Link *link) {
         }
 
         if (list_updated)
-                link_save(link);
+                link_dirty(link);
 
         HASHMAP_FOREACH (carrier, link->bound_to_links, i) {
                 r = link_put_carrier(carrier, link, &carrier->bound_by_links);
                 if (r < 0)
                         return r;
 
-                link_save(carrier);
+                link_dirty(carrier);
         }
 
         return 0;
@@ -1509,7 +1544,7 @@ static void link_free_bound_to_list(Link *link) {
                 hashmap_remove(link->bound_to_links, INT_TO_PTR(bound_to->ifindex));
 
                 if (hashmap_remove(bound_to->bound_by_links, INT_TO_PTR(link->ifindex)))
-                        link_save(bound_to);
+                        link_dirty(bound_to);
         }
 
         return;
@@ -1523,7 +1558,7 @@ static void link_free_bound_by_list(Link *link) {
                 hashmap_remove(link->bound_by_links, INT_TO_PTR(bound_by->ifindex));
 
                 if (hashmap_remove(bound_by->bound_to_links, INT_TO_PTR(link->ifindex))) {
-                        link_save(bound_by);
+                        link_dirty(bound_by);
                         link_handle_bound_to_list(bound_by);
                 }
         }
@@ -1547,7 +1582,7 @@ static void link_free_carrier_maps(Link *link) {
         }
 
         if (list_updated)
-                link_save(link);
+                link_dirty(link);
 
         return;
 }
@@ -1631,7 +1666,7 @@ static int link_enter_join_netdev(Link *link) {
 
         link_set_state(link, LINK_STATE_ENSLAVING);
 
-        link_save(link);
+        link_dirty(link);
 
         if (!link->network->bridge &&
             !link->network->bond &&
@@ -1875,6 +1910,10 @@ static int link_configure(Link *link) {
                 r = sd_dhcp_server_attach_event(link->dhcp_server, NULL, 0);
                 if (r < 0)
                         return r;
+
+                r = sd_dhcp_server_set_lease_file(link->dhcp_server, link->dhcp_server_lease_file);
+                if (r < 0)
+                        return r;
         }
 
         if (link_dhcp6_enabled(link)) {
@@ -1922,6 +1961,8 @@ static int link_initialized_and_synced(sd_netlink *rtnl, sd_netlink_message *m,
 
         log_link_debug(link, "Link state is up-to-date");
 
+        link->initialized_usec = now(CLOCK_MONOTONIC);
+
         r = link_new_bound_by_list(link);
         if (r < 0)
                 return r;
@@ -2004,16 +2045,10 @@ int link_initialized(Link *link, struct udev_device *device) {
 }
 
 static Address* link_get_equal_address(Link *link, Address *needle) {
-        Address *i;
-
         assert(link);
         assert(needle);
 
-        LIST_FOREACH(addresses, i, link->addresses)
-                if (address_equal(i, needle))
-                        return i;
-
-        return NULL;
+        return set_get(link->addresses, needle);
 }
 
 int link_rtnl_process_address(sd_netlink *rtnl, sd_netlink_message *message, void *userdata) {
@@ -2148,12 +2183,19 @@ int link_rtnl_process_address(sd_netlink *rtnl, sd_netlink_message *message, voi
                 } else {
                         log_link_debug(link, "Adding address: %s/%u (valid for %s)", buf, address->prefixlen, valid_str);
 
-                        LIST_PREPEND(addresses, link->addresses, address);
+                        r = set_ensure_allocated(&link->addresses, &address_hash_ops);
+                        if (r < 0)
+                                return log_oom();
+
+                        r = set_put(link->addresses, address);
+                        if (r < 0)
+                                return log_oom();
+
                         address_establish(address, link);
 
                         address = NULL;
 
-                        link_save(link);
+                        link_dirty(link);
                 }
 
                 break;
@@ -2163,7 +2205,7 @@ int link_rtnl_process_address(sd_netlink *rtnl, sd_netlink_message *message, voi
                 if (existing) {
                         log_link_debug(link, "Removing address: %s/%u (valid for %s)", buf, address->prefixlen, valid_str);
                         address_release(existing, link);
-                        LIST_REMOVE(addresses, link->addresses, existing);
+                        set_remove(link->addresses, existing);
                         address_free(existing);
                 } else
                         log_link_warning(link, "Removing non-existent address: %s/%u (valid for %s)", buf, address->prefixlen, valid_str);
@@ -2416,10 +2458,11 @@ static void link_update_operstate(Link *link) {
                 operstate = LINK_OPERSTATE_DORMANT;
         else if (link_has_carrier(link)) {
                 Address *address;
+                Iterator i;
                 uint8_t scope = RT_SCOPE_NOWHERE;
 
                 /* if we have carrier, check what addresses we have */
-                LIST_FOREACH(addresses, address, link->addresses) {
+                SET_FOREACH(address, link->addresses, i) {
                         if (address->flags & (IFA_F_TENTATIVE | IFA_F_DEPRECATED))
                                 continue;
 
@@ -2447,6 +2490,44 @@ static void link_update_operstate(Link *link) {
         }
 }
 
+/* Schedules the state file to be written at the end of the current
+ * event loop iteration, so that a burst of changes results in one
+ * write only */
+void link_dirty(Link *link) {
+        int r;
+
+        assert(link);
+        assert(link->manager);
+
+        /* the manager state summarizes all links */
+        manager_dirty(link->manager);
+
+        r = set_ensure_allocated(&link->manager->dirty_links, NULL);
+        if (r < 0)
+                goto fail;
+
+        r = set_put(link->manager->dirty_links, link);
+        if (r < 0)
+                goto fail;
+        if (r > 0)
+                link_ref(link);
+
+        return;
+
+fail:
+        /* can't defer it, so write it out right away */
+        log_oom();
+        link_save(link);
+}
+
+void link_clean(Link *link) {
+        assert(link);
+        assert(link->manager);
+
+        if (set_remove(link->manager->dirty_links, link))
+                link_unref(link);
+}
+
 int link_save(Link *link) {
         _cleanup_free_ char *temp_path = NULL;
         _cleanup_fclose_ FILE *f = NULL;
@@ -2460,10 +2541,6 @@ int link_save(Link *link) {
 
         link_update_operstate(link);
 
-        r = manager_save(link->manager);
-        if (r < 0)
-                return r;
-
         if (link->state == LINK_STATE_LINGER) {
                 unlink(link->state_file);
                 return 0;
@@ -30,6 +30,8 @@
 #include "sd-dhcp6-client.h"
 #include "sd-lldp.h"
 
+#include "set.h"
+
 typedef struct Link Link;
 
 typedef enum LinkState {
@@ -72,6 +74,10 @@ struct Link {
         uint32_t mtu;
         struct udev_device *udev_device;
 
+        /* when the link appeared, and when udev was done with it */
+        usec_t added_usec;
+        usec_t initialized_usec;
+
         unsigned flags;
         uint8_t kernel_operstate;
 
@@ -83,7 +89,8 @@ struct Link {
         unsigned link_messages;
         unsigned enslaving;
 
-        LIST_HEAD(Address, addresses);
+        /* addresses the kernel reported, hashed like address_equal() */
+        Set *addresses;
 
         sd_dhcp_client *dhcp_client;
         sd_dhcp_lease *dhcp_lease;
@@ -101,6 +108,7 @@ struct Link {
         LIST_HEAD(Address, pool_addresses);
 
         sd_dhcp_server *dhcp_server;
+        char *dhcp_server_lease_file;
 
         sd_icmp6_nd *icmp6_router_discovery;
         sd_dhcp6_client *dhcp6_client;
@@ -131,6 +139,8 @@ int link_update(Link *link, sd_netlink_message *message);
 int link_rtnl_process_address(sd_netlink *rtnl, sd_netlink_message *message, void *userdata);
 
 int link_save(Link *link);
+void link_dirty(Link *link);
+void link_clean(Link *link);
 
 int link_carrier_reset(Link *link);
 bool link_has_carrier(Link *link);
@@ -421,6 +421,31 @@ static int manager_connect_rtnl(Manager *m) {
         return 0;
 }
 
+static int manager_dirty_handler(sd_event_source *s, void *userdata) {
+        Manager *m = userdata;
+        Link *link;
+        Iterator i;
+        int r;
+
+        assert(m);
+
+        /* The links first, saving them updates their operational
+         * state, which the manager state is derived from */
+        SET_FOREACH(link, m->dirty_links, i) {
+                r = link_save(link);
+                if (r >= 0)
+                        link_clean(link);
+        }
+
+        if (m->dirty) {
+                r = manager_save(m);
+                if (r >= 0)
+                        m->dirty = false;
+        }
+
+        return 1;
+}
+
 int manager_new(Manager **ret) {
         _cleanup_manager_free_ Manager *m = NULL;
         int r;
@@ -442,6 +467,10 @@ int manager_new(Manager **ret) {
         sd_event_add_signal(m->event, NULL, SIGTERM, NULL, NULL);
         sd_event_add_signal(m->event, NULL, SIGINT, NULL, NULL);
 
+        r = sd_event_add_post(m->event, NULL, manager_dirty_handler, m);
+        if (r < 0)
+                return r;
+
         r = manager_connect_rtnl(m);
         if (r < 0)
                 return r;
@@ -485,6 +514,10 @@ void manager_free(Manager *m) {
         sd_bus_slot_unref(m->prepare_for_sleep_slot);
         sd_event_source_unref(m->bus_retry_event_source);
 
+        while ((link = set_steal_first(m->dirty_links)))
+                link_unref(link);
+        set_free(m->dirty_links);
+
         while ((link = hashmap_first(m->links)))
                 link_unref(link);
         hashmap_free(m->links);
@@ -696,6 +729,12 @@ static void print_string_set(FILE *f, const char *field, Set *s) {
         fputc('\n', f);
 }
 
+void manager_dirty(Manager *m) {
+        assert(m);
+
+        m->dirty = true;
+}
+
 int manager_save(Manager *m) {
         _cleanup_set_free_free_ Set *dns = NULL, *ntp = NULL, *domains = NULL;
         Link *link;
@@ -181,6 +181,8 @@ int network_load(Manager *manager) {
 
         assert(manager);
 
+        network_index_free(manager);
+
         while ((network = manager->networks))
                 network_free(network);
 
@@ -207,7 +209,12 @@ void network_free(Network *network) {
         if (!network)
                 return;
 
+        /* the index refers to all networks, so let it be rebuilt */
+        if (network->manager && network->manager->networks_indexed)
+                network_index_free(network->manager);
+
         free(network->filename);
+        free(network->index_prefix);
 
         free(network->match_mac);
         strv_free(network->match_path);
@@ -287,29 +294,235 @@ int network_get_by_name(Manager *manager, const char *name, Network **ret) {
         return 0;
 }
 
+void network_index_free(Manager *manager) {
+        assert(manager);
+
+        manager->networks_by_mac = hashmap_free(manager->networks_by_mac);
+        manager->networks_by_name_prefix = hashmap_free(manager->networks_by_name_prefix);
+        manager->networks_by_driver_prefix = hashmap_free(manager->networks_by_driver_prefix);
+        LIST_HEAD_INIT(manager->networks_unindexed);
+
+        manager->networks_indexed = false;
+}
+
+static uint64_t ether_addr_to_u64(const struct ether_addr *address) {
+        uint64_t u = 0;
+
+        memcpy(&u, address, ETH_ALEN);
+
+        return u;
+}
+
+/* The longest literal prefix all of the glob patterns share */
+static int patterns_common_prefix(char **patterns, char **ret) {
+        size_t n = (size_t) -1, i;
+        char **p;
+
+        STRV_FOREACH(p, patterns) {
+                size_t k;
+
+                k = strcspn(*p, "*?[\\");
+                for (i = 0; i < MIN(n, k) && (*p)[i] == patterns[0][i]; i++)
+                        ;
+                n = i;
+        }
+
+        if (n == 0 || n == (size_t) -1) {
+                *ret = NULL;
+                return 0;
+        }
+
+        *ret = strndup(patterns[0], n);
+        if (!*ret)
+                return -ENOMEM;
+
+        return 1;
+}
+
+static int network_index_put(Hashmap **h, const struct hash_ops *hash_ops, const void *key, Network *network) {
+        Network *head;
+        int r;
+
+        r = hashmap_ensure_allocated(h, hash_ops);
+        if (r < 0)
+                return r;
+
+        head = hashmap_get(*h, key);
+        LIST_PREPEND(match_index, head, network);
+
+        /* the new head owns the key from now on */
+        return hashmap_replace(*h, key, head);
+}
+
+/* Files every network under the most selective thing it requires of
+ * a link: a MAC address, a literal prefix of the interface name, or of
+ * the driver name. Matching a link then only has to look at the few
+ * networks that can possibly apply, instead of at all of them. */
+static int network_index(Manager *manager) {
+        Network *network;
+        unsigned position = 0;
+        int r;
+
+        assert(manager);
+
+        if (manager->networks_indexed)
+                return 0;
+
+        LIST_FOREACH(networks, network, manager->networks) {
+                network->position = position++;
+                network->index_prefix = mfree(network->index_prefix);
+
+                if (network->match_mac) {
+                        network->index_mac = ether_addr_to_u64(network->match_mac);
+
+                        r = network_index_put(&manager->networks_by_mac, &uint64_hash_ops, &network->index_mac, network);
+                        if (r < 0)
+                                goto fail;
+
+                        continue;
+                }
+
+                r = patterns_common_prefix(network->match_name, &network->index_prefix);
+                if (r < 0)
+                        goto fail;
+                if (r > 0) {
+                        r = network_index_put(&manager->networks_by_name_prefix, &string_hash_ops, network->index_prefix, network);
+                        if (r < 0)
+                                goto fail;
+
+                        continue;
+                }
+
+                r = patterns_common_prefix(network->match_driver, &network->index_prefix);
+                if (r < 0)
+                        goto fail;
+                if (r > 0) {
+                        r = network_index_put(&manager->networks_by_driver_prefix, &string_hash_ops, network->index_prefix, network);
+                        if (r < 0)
+                                goto fail;
+
+                        continue;
+                }
+
+                LIST_PREPEND(match_index, manager->networks_unindexed, network);
+        }
+
+        manager->networks_indexed = true;
+
+        return 0;
+
+fail:
+        network_index_free(manager);
+        return r;
+}
+
+static int network_add_candidates(Network *head, Network ***candidates, size_t *n_allocated, size_t *n_candidates) {
+        Network *network;
+
+        LIST_FOREACH(match_index, network, head) {
+                if (!GREEDY_REALLOC(*candidates, *n_allocated, *n_candidates + 1))
+                        return -ENOMEM;
+
+                (*candidates)[(*n_candidates)++] = network;
+        }
+
+        return 0;
+}
+
+static int network_add_prefix_candidates(Hashmap *h, const char *s, Network ***candidates, size_t *n_allocated, size_t *n_candidates) {
+        char *prefix;
+        size_t i;
+        int r;
+
+        if (!h || !s)
+                return 0;
+
+        prefix = strdupa(s);
+        for (i = strlen(prefix); i > 0; i--) {
+                prefix[i] = '\0';
+
+                r = network_add_candidates(hashmap_get(h, prefix), candidates, n_allocated, n_candidates);
+                if (r < 0)
+                        return r;
+        }
+
+        return 0;
+}
+
+static int network_compare_position(const void *a, const void *b) {
+        const Network *x = *(Network**) a, *y = *(Network**) b;
+
+        if (x->position < y->position)
+                return -1;
+        if (x->position > y->position)
+                return 1;
+
+        return 0;
+}
+
 int network_get(Manager *manager, struct udev_device *device,
                 const char *ifname, const struct ether_addr *address,
                 Network **ret) {
+        _cleanup_free_ Network **candidates = NULL;
+        size_t n_candidates = 0, n_allocated = 0, i;
         Network *network;
         struct udev_device *parent;
         const char *path = NULL, *parent_driver = NULL, *driver = NULL, *devtype = NULL;
+        bool have_properties = false;
+        int r;
 
         assert(manager);
         assert(ret);
 
-        if (device) {
-                path = udev_device_get_property_value(device, "ID_PATH");
-
-                parent = udev_device_get_parent(device);
-                if (parent)
-                        parent_driver = udev_device_get_driver(parent);
+        r = network_index(manager);
+        if (r < 0)
+                return r;
 
+        if (device)
                 driver = udev_device_get_property_value(device, "ID_NET_DRIVER");
 
-                devtype = udev_device_get_devtype(device);
+        /* collect everything that might match, and check it in the
+         * order of the files, as the first match wins */
+        if (address) {
+                uint64_t mac = ether_addr_to_u64(address);
+
+                r = network_add_candidates(hashmap_get(manager->networks_by_mac, &mac), &candidates, &n_allocated, &n_candidates);
+                if (r < 0)
+                        return r;
         }
 
-        LIST_FOREACH(networks, network, manager->networks) {
+        r = network_add_prefix_candidates(manager->networks_by_name_prefix, ifname, &candidates, &n_allocated, &n_candidates);
+        if (r < 0)
+                return r;
+
+        r = network_add_prefix_candidates(manager->networks_by_driver_prefix, driver, &candidates, &n_allocated, &n_candidates);
+        if (r < 0)
+                return r;
+
+        r = network_add_candidates(manager->networks_unindexed, &candidates, &n_allocated, &n_candidates);
+        if (r < 0)
+                return r;
+
+        qsort_safe(candidates, n_candidates, sizeof(Network*), network_compare_position);
+
+        for (i = 0; i < n_candidates; i++) {
+                network = candidates[i];
+
+                /* only go to sysfs for the parent device once a
+                 * candidate actually asks for it */
+                if (device && !have_properties &&
+                    (network->match_path || network->match_driver || network->match_type)) {
+                        path = udev_device_get_property_value(device, "ID_PATH");
+
+                        parent = udev_device_get_parent(device);
+                        if (parent)
+                                parent_driver = udev_device_get_driver(parent);
+
+                        devtype = udev_device_get_devtype(device);
+
+                        have_properties = true;
+                }
+
                 if (net_match_config(network->match_mac, network->match_path,
                                      network->match_driver, network->match_type,
                                      network->match_name, network->match_host,
@@ -368,11 +581,8 @@ int network_apply(Manager *manager, Network *network, Link *link) {
                 route->protocol = RTPROT_STATIC;
         }
 
-        if (network->dns || network->ntp) {
-                r = link_save(link);
-                if (r < 0)
-                        return r;
-        }
+        if (network->dns || network->ntp)
+                link_dirty(link);
 
         return 0;
 }
@@ -144,6 +144,13 @@ struct Network {
         ResolveSupport llmnr;
 
         LIST_FIELDS(Network, networks);
+
+        /* position in the list above, and the key the network is filed
+         * under in the manager's match index */
+        unsigned position;
+        uint64_t index_mac;
+        char *index_prefix;
+        LIST_FIELDS(Network, match_index);
 };
 
 void network_free(Network *network);
@@ -152,6 +159,7 @@ DEFINE_TRIVIAL_CLEANUP_FUNC(Network*, network_free);
 #define _cleanup_network_free_ _cleanup_(network_freep)
 
 int network_load(Manager *manager);
+void network_index_free(Manager *manager);
 
 int network_get_by_name(Manager *manager, const char *name, Network **ret);
 int network_get(Manager *manager, struct udev_device *device, const char *ifname, const struct ether_addr *mac, Network **ret);
@@ -23,6 +23,7 @@
 
 #include "sd-network.h"
 
+#include "strv.h"
 #include "networkd-wait-online-link.h"
 
 int link_new(Manager *m, Link **ret, int ifindex, const char *ifname) {
@@ -75,6 +76,11 @@ Link *link_free(Link *l) {
         if (l->manager) {
                 hashmap_remove(l->manager->links, INT_TO_PTR(l->ifindex));
                 hashmap_remove(l->manager->links_by_name, l->ifname);
+
+                if (l->pending)
+                        l->manager->n_pending--;
+                if (l->ready)
+                        l->manager->n_ready--;
         }
 
         free(l->ifname);
@@ -114,6 +120,9 @@ int link_update_rtnl(Link *l, sd_netlink_message *m) {
                         return r;
         }
 
+        /* flags and name decide whether the link is ignored */
+        link_update_readiness(l);
+
         return 0;
 }
 
@@ -128,5 +137,46 @@ int link_update_monitor(Link *l) {
 
         sd_network_link_get_setup_state(l->ifindex, &l->state);
 
+        link_update_readiness(l);
+
         return 0;
 }
+
+/* Updates what the link contributes to the manager's counters, so that
+ * manager_all_configured() does not have to look at every link */
+void link_update_readiness(Link *l) {
+        bool pending = false, ready = false;
+
+        assert(l);
+        assert(l->manager);
+
+        if (!manager_ignore_link(l->manager, l)) {
+                /* not yet processed by udev, or being processed by networkd */
+                pending = !l->state || STR_IN_SET(l->state, "configuring", "pending");
+
+                /* we wait for at least one link to be ready,
+                   regardless of who manages it */
+                ready = l->operational_state &&
+                        STR_IN_SET(l->operational_state, "degraded", "routable");
+        }
+
+        if (pending != l->pending) {
+                log_debug("link %s is %s", l->ifname, pending ? "pending" : "configured or ignored");
+
+                if (pending)
+                        l->manager->n_pending++;
+                else
+                        l->manager->n_pending--;
+
+                l->pending = pending;
+        }
+
+        if (ready != l->ready) {
+                if (ready)
+                        l->manager->n_ready++;
+                else
+                        l->manager->n_ready--;
+
+                l->ready = ready;
+        }
+}
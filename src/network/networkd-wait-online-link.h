@@ -35,12 +35,17 @@ struct Link {
 
         char *operational_state;
         char *state;
+
+        /* what this link is accounted as in the manager's counters */
+        bool pending;
+        bool ready;
 };
 
 int link_new(Manager *m, Link **ret, int ifindex, const char *ifname);
 Link *link_free(Link *l);
 int link_update_rtnl(Link *l, sd_netlink_message *m);
 int link_update_monitor(Link *l);
+void link_update_readiness(Link *l);
 bool link_relevant(Link *l);
 
 DEFINE_TRIVIAL_CLEANUP_FUNC(Link*, link_free);
@@ -55,48 +55,26 @@ bool manager_ignore_link(Manager *m, Link *link) {
 }
 
 bool manager_all_configured(Manager *m) {
-        Iterator i;
-        Link *l;
         char **ifname;
-        bool one_ready = false;
 
         /* wait for all the links given on the command line to appear */
         STRV_FOREACH(ifname, m->interfaces) {
-                l = hashmap_get(m->links_by_name, *ifname);
-                if (!l) {
+                if (!hashmap_contains(m->links_by_name, *ifname)) {
                         log_debug("still waiting for %s", *ifname);
                         return false;
                 }
         }
 
         /* wait for all links networkd manages to be in admin state 'configured'
-           and at least one link to gain a carrier */
-        HASHMAP_FOREACH(l, m->links, i) {
-                if (manager_ignore_link(m, l)) {
-                        log_info("ignoring: %s", l->ifname);
-                        continue;
-                }
-
-                if (!l->state) {
-                        log_debug("link %s has not yet been processed by udev",
-                                  l->ifname);
-                        return false;
-                }
-
-                if (STR_IN_SET(l->state, "configuring", "pending")) {
-                        log_debug("link %s is being processed by networkd",
-                                  l->ifname);
-                        return false;
-                }
-
-                if (l->operational_state &&
-                    STR_IN_SET(l->operational_state, "degraded", "routable"))
-                        /* we wait for at least one link to be ready,
-                           regardless of who manages it */
-                        one_ready = true;
+           and at least one link to gain a carrier. The links keep these
+           counters up to date as their state changes, see
+           link_update_readiness(). */
+        if (m->n_pending > 0) {
+                log_debug("still waiting for %u links", m->n_pending);
+                return false;
         }
 
-        return one_ready;
+        return m->n_ready > 0;
 }
 
 static int manager_process_link(sd_netlink *rtnl, sd_netlink_message *mm, void *userdata) {
@@ -222,19 +200,36 @@ static int manager_rtnl_listen(Manager *m) {
 }
 
 static int on_network_event(sd_event_source *s, int fd, uint32_t revents, void *userdata) {
+        _cleanup_free_ int *ifindexes = NULL;
         Manager *m = userdata;
+        size_t n = 0, k;
         Iterator i;
         Link *l;
         int r;
 
         assert(m);
 
-        sd_network_monitor_flush(m->network_monitor);
+        r = sd_network_monitor_flush_links(m->network_monitor, &ifindexes, &n);
+        if (r < 0)
+                log_warning_errno(r, "Failed to flush network monitor: %m");
 
-        HASHMAP_FOREACH(l, m->links, i) {
-                r = link_update_monitor(l);
-                if (r < 0)
-                        log_warning_errno(r, "Failed to update monitor information for %i: %m", l->ifindex);
+        if (r != 0) {
+                HASHMAP_FOREACH(l, m->links, i) {
+                        r = link_update_monitor(l);
+                        if (r < 0)
+                                log_warning_errno(r, "Failed to update monitor information for %i: %m", l->ifindex);
+                }
+        } else {
+                /* only read the state of the links that changed */
+                for (k = 0; k < n; k++) {
+                        l = hashmap_get(m->links, INT_TO_PTR(ifindexes[k]));
+                        if (!l)
+                                continue;
+
+                        r = link_update_monitor(l);
+                        if (r < 0)
+                                log_warning_errno(r, "Failed to update monitor information for %i: %m", l->ifindex);
+                }
         }
 
         if (manager_all_configured(m))
@@ -44,6 +44,10 @@ struct Manager {
         sd_network_monitor *network_monitor;
         sd_event_source *network_monitor_event_source;
 
+        /* links we wait for to be configured, and links that are up */
+        unsigned n_pending;
+        unsigned n_ready;
+
         sd_event *event;
 };
 
@@ -53,10 +53,22 @@ struct Manager {
         char *state_file;
         LinkOperationalState operational_state;
 
+        /* state files are written out once per event loop iteration */
+        Set *dirty_links;
+        bool dirty;
+
         Hashmap *links;
         Hashmap *netdevs;
         Hashmap *networks_by_name;
         LIST_HEAD(Network, networks);
+
+        /* .network files filed under the one thing a link needs to
+         * have for them to possibly match, see network_get() */
+        bool networks_indexed;
+        Hashmap *networks_by_mac;
+        Hashmap *networks_by_name_prefix;
+        Hashmap *networks_by_driver_prefix;
+        LIST_HEAD(Network, networks_unindexed);
         LIST_HEAD(AddressPool, address_pools);
 
         usec_t network_dirs_ts_usec;
@@ -82,6 +94,7 @@ int manager_rtnl_enumerate_addresses(Manager *m);
 
 int manager_send_changed(Manager *m, const char *property, ...) _sentinel_;
 int manager_save(Manager *m);
+void manager_dirty(Manager *m);
 
 int manager_address_pool_acquire(Manager *m, int family, unsigned prefixlen, union in_addr_union *found);
 
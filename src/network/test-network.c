@@ -184,6 +184,105 @@ static void test_address_equality(void) {
         assert_se(!address_equal(a1, a2));
 }
 
+static void test_address_hash(void) {
+        _cleanup_address_free_ Address *a1 = NULL, *a2 = NULL, *a3 = NULL;
+        _cleanup_set_free_ Set *s = NULL;
+
+        assert_se(address_new_dynamic(&a1) >= 0);
+        assert_se(address_new_dynamic(&a2) >= 0);
+        assert_se(address_new_dynamic(&a3) >= 0);
+
+        s = set_new(&address_hash_ops);
+        assert_se(s);
+
+        a1->family = AF_INET;
+        a1->prefixlen = 10;
+        assert_se(inet_pton(AF_INET, "192.168.3.9", &a1->in_addr.in));
+        assert_se(set_put(s, a1) > 0);
+
+        /* lookups must find whatever address_equal() considers equal */
+        a2->family = AF_INET;
+        a2->prefixlen = 10;
+        assert_se(inet_pton(AF_INET, "192.168.3.10", &a2->in_addr.in));
+        assert_se(set_get(s, a2) == a1);
+
+        a2->prefixlen = 24;
+        assert_se(!set_get(s, a2));
+
+        a2->family = AF_INET6;
+        a2->prefixlen = 64;
+        assert_se(inet_pton(AF_INET6, "2001:4ca0:4f01::2", &a2->in_addr.in6));
+        assert_se(set_put(s, a2) > 0);
+
+        a3->family = AF_INET6;
+        a3->prefixlen = 8;
+        assert_se(inet_pton(AF_INET6, "2001:4ca0:4f01::2", &a3->in_addr.in6));
+        assert_se(set_get(s, a3) == a2);
+
+        assert_se(inet_pton(AF_INET6, "2001:4ca0:4f01::1", &a3->in_addr.in6));
+        assert_se(!set_get(s, a3));
+}
+
+static Network *test_network_new(Manager *manager, const char *name, const char *driver, const char *mac) {
+        Network *network;
+
+        network = new0(Network, 1);
+        assert_se(network);
+
+        network->manager = manager;
+        network->filename = strdup("test.network");
+        assert_se(network->filename);
+
+        if (name)
+                assert_se(network->match_name = strv_split(name, WHITESPACE));
+        if (driver)
+                assert_se(network->match_driver = strv_split(driver, WHITESPACE));
+        if (mac) {
+                network->match_mac = new0(struct ether_addr, 1);
+                assert_se(network->match_mac);
+                assert_se(ether_aton_r(mac, network->match_mac));
+        }
+
+        LIST_APPEND(networks, manager->networks, network);
+
+        return network;
+}
+
+static void test_network_get_index(Manager *manager) {
+        Network *veth, *by_mac, *eth0, *by_driver, *any, *network;
+        struct ether_addr mac;
+
+        veth = test_network_new(manager, "veth* vx*", NULL, NULL);
+        by_mac = test_network_new(manager, NULL, NULL, "00:11:22:33:44:55");
+        eth0 = test_network_new(manager, "eth0", NULL, NULL);
+        by_driver = test_network_new(manager, NULL, "virtio*", NULL);
+        any = test_network_new(manager, "*", NULL, NULL);
+
+        assert_se(network_get(manager, NULL, "veth0", NULL, &network) >= 0);
+        assert_se(network == veth);
+        assert_se(network_get(manager, NULL, "vxlan1", NULL, &network) >= 0);
+        assert_se(network == veth);
+
+        /* the first file wins, whatever it was filed under */
+        assert_se(ether_aton_r("00:11:22:33:44:55", &mac));
+        assert_se(network_get(manager, NULL, "eth0", &mac, &network) >= 0);
+        assert_se(network == by_mac);
+        assert_se(network_get(manager, NULL, "eth0", NULL, &network) >= 0);
+        assert_se(network == eth0);
+
+        /* no udev device, hence no driver */
+        assert_se(network_get(manager, NULL, "eth1", NULL, &network) >= 0);
+        assert_se(network == any);
+        assert_se(by_driver);
+
+        /* freeing a network drops the index */
+        network_free(any);
+        assert_se(!manager->networks_indexed);
+        assert_se(network_get(manager, NULL, "eth1", NULL, &network) == -ENOENT);
+        assert_se(network_get(manager, NULL, "veth0", NULL, &network) >= 0);
+        assert_se(network == veth);
+}
+
 int main(void) {
         _cleanup_manager_free_ Manager *manager = NULL;
         struct udev *udev;
@@ -193,9 +292,12 @@ int main(void) {
         test_deserialize_in_addr();
         test_deserialize_dhcp_routes();
         test_address_equality();
+        test_address_hash();
 
         assert_se(manager_new(&manager) >= 0);
 
+        test_network_get_index(manager);
+
         r = test_load_config(manager);
         if (r == -EPERM)
                 return EXIT_TEST_SKIP;
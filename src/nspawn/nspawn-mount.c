@@ -850,6 +850,79 @@ fail:
         return r;
 }
 
+int setup_ephemeral_overlay(
+                const char *directory,
+                bool userns, uid_t uid_shift, uid_t uid_range,
+                const char *selinux_apifs_context) {
+
+        char template[] = "/tmp/nspawn-ephemeral-XXXXXX";
+        _cleanup_free_ char *buf = NULL, *escaped_directory = NULL;
+        const char *upper, *work, *options;
+        int r;
+
+        assert(directory);
+
+        /* --ephemeral on file systems without snapshots: the tree
+         * becomes the lower layer of an overlay whose upper layer
+         * lives on a tmpfs, and all changes go away with it. */
+
+        if (!mkdtemp(template))
+                return log_error_errno(errno, "Failed to create temporary directory: %m");
+
+        options = "mode=755";
+        r = tmpfs_patch_options(options, userns, uid_shift, uid_range, selinux_apifs_context, &buf);
+        if (r < 0) {
+                r = log_oom();
+                goto fail;
+        }
+        if (r > 0)
+                options = buf;
+
+        if (mount("tmpfs", template, "tmpfs", MS_STRICTATIME, options) < 0) {
+                r = log_error_errno(errno, "Failed to mount tmpfs for ephemeral changes: %m");
+                goto fail;
+        }
+
+        upper = strjoina(template, "/upper");
+        work = strjoina(template, "/work");
+
+        if (mkdir(upper, 0755) < 0 || mkdir(work, 0700) < 0) {
+                r = log_error_errno(errno, "Failed to create overlay directories in %s: %m", template);
+                goto fail_umount;
+        }
+
+        /* The upper directory becomes the root directory */
+        if (userns && lchown(upper, uid_shift, uid_shift) < 0) {
+                r = log_error_errno(errno, "Failed to chown %s: %m", upper);
+                goto fail_umount;
+        }
+
+        escaped_directory = shell_escape(directory, ",:");
+        if (!escaped_directory) {
+                r = log_oom();
+                goto fail_umount;
+        }
+
+        options = strjoina("lowerdir=", escaped_directory, ",upperdir=", upper, ",workdir=", work);
+        if (mount("overlay", directory, "overlay", 0, options) < 0) {
+                r = log_error_errno(errno, "Failed to mount overlay on %s: %m", directory);
+                goto fail_umount;
+        }
+
+        /* The overlay keeps the tmpfs busy, we don't need it in the
+         * file system tree anymore */
+        (void) umount2(template, MNT_DETACH);
+        (void) rmdir(template);
+
+        return 0;
+
+fail_umount:
+        (void) umount(template);
+fail:
+        (void) rmdir(template);
+        return r;
+}
+
 VolatileMode volatile_mode_from_string(const char *s) {
         int b;
 
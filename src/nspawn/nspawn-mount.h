@@ -66,5 +66,6 @@ int mount_custom(const char *dest, CustomMount *mounts, unsigned n, bool userns,
 
 int setup_volatile(const char *directory, VolatileMode mode, bool userns, uid_t uid_shift, uid_t uid_range, const char *selinux_apifs_context);
 int setup_volatile_state(const char *directory, VolatileMode mode, bool userns, uid_t uid_shift, uid_t uid_range, const char *selinux_apifs_context);
+int setup_ephemeral_overlay(const char *directory, bool userns, uid_t uid_shift, uid_t uid_range, const char *selinux_apifs_context);
 
 VolatileMode volatile_mode_from_string(const char *s);
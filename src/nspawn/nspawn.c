@@ -43,6 +43,7 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include "sd-bus.h"
 #include "sd-daemon.h"
 #include "sd-id128.h"
 
@@ -51,6 +52,7 @@
 #include "blkid-util.h"
 #include "btrfs-util.h"
 #include "build.h"
+#include "bus-util.h"
 #include "cap-list.h"
 #include "capability.h"
 #include "cgroup-util.h"
@@ -116,6 +118,7 @@ static bool arg_private_network = false;
 static bool arg_read_only = false;
 static bool arg_boot = false;
 static bool arg_ephemeral = false;
+static bool arg_ephemeral_overlay = false;
 static LinkJournal arg_link_journal = LINK_AUTO;
 static bool arg_link_journal_try = false;
 static uint64_t arg_retain =
@@ -2429,6 +2432,47 @@ static int determine_uid_shift(const char *directory) {
         return 0;
 }
 
+static bool ephemeral_use_overlay(const char *directory) {
+        _cleanup_free_ char *filesystems = NULL;
+        _cleanup_close_ int fd = -1;
+
+        /* Snapshots are free on btrfs, and the tree may be "/",
+         * which cannot be used as overlay lower directory from
+         * within itself */
+        if (path_equal(directory, "/"))
+                return false;
+
+        fd = open(directory, O_RDONLY|O_DIRECTORY|O_CLOEXEC|O_NOCTTY);
+        if (fd < 0)
+                return false;
+
+        if (btrfs_is_subvol(fd) > 0)
+                return false;
+
+        /* Without overlayfs, fall back to copying the tree. If the
+         * module is not loaded yet this is overly careful, but
+         * never worse than before. */
+        if (read_full_file("/proc/filesystems", &filesystems, NULL) < 0)
+                return false;
+
+        return !!strstr(filesystems, "\toverlay\n");
+}
+
+static void log_setup_phase(const char *phase, usec_t *since) {
+        char buf[FORMAT_TIMESPAN_MAX];
+        usec_t n;
+
+        assert(phase);
+        assert(since);
+
+        /* Setup time matters when containers are started at a high
+         * rate, this shows where it goes with --log-level=debug */
+
+        n = now(CLOCK_MONOTONIC);
+        log_debug("%s took %s.", phase, format_timespan(buf, sizeof(buf), n - *since, 1));
+        *since = n;
+}
+
 static int inner_child(
                 Barrier *barrier,
                 const char *directory,
@@ -2635,6 +2679,7 @@ static int outer_child(
                 int uid_shift_socket,
                 FDSet *fds) {
 
+        usec_t ts;
         pid_t pid;
         ssize_t l;
         int r;
@@ -2645,6 +2690,8 @@ static int outer_child(
         assert(pid_socket >= 0);
         assert(kmsg_socket >= 0);
 
+        ts = now(CLOCK_MONOTONIC);
+
         cg_unified_flush();
 
         if (prctl(PR_SET_PDEATHSIG, SIGKILL) < 0)
@@ -2687,6 +2734,8 @@ static int outer_child(
         if (r < 0)
                 return r;
 
+        log_setup_phase("Mounting devices", &ts);
+
         r = determine_uid_shift(directory);
         if (r < 0)
                 return r;
@@ -2701,6 +2750,12 @@ static int outer_child(
                 }
         }
 
+        if (arg_ephemeral_overlay) {
+                r = setup_ephemeral_overlay(directory, arg_userns, arg_uid_shift, arg_uid_range, arg_selinux_apifs_context);
+                if (r < 0)
+                        return r;
+        }
+
         /* Turn directory into bind mount */
         if (mount(directory, directory, NULL, MS_BIND|MS_REC, NULL) < 0)
                 return log_error_errno(errno, "Failed to make bind mount: %m");
@@ -2723,6 +2778,8 @@ static int outer_child(
                         return log_error_errno(r, "Failed to make tree read-only: %m");
         }
 
+        log_setup_phase("Preparing directory tree", &ts);
+
         r = mount_all(directory, false, arg_uid_shift, arg_uid_range, arg_selinux_apifs_context);
         if (r < 0)
                 return r;
@@ -2745,6 +2802,8 @@ static int outer_child(
         if (r < 0)
                 return r;
 
+        log_setup_phase("Mounting API file systems and /dev", &ts);
+
         r = setup_seccomp();
         if (r < 0)
                 return r;
@@ -2761,6 +2820,8 @@ static int outer_child(
         if (r < 0)
                 return r;
 
+        log_setup_phase("Copying host configuration", &ts);
+
         r = mount_custom(directory, arg_custom_mounts, arg_n_custom_mounts, arg_userns, arg_uid_shift, arg_uid_range, arg_selinux_apifs_context);
         if (r < 0)
                 return r;
@@ -2773,6 +2834,8 @@ static int outer_child(
         if (r < 0)
                 return log_error_errno(r, "Failed to move root directory: %m");
 
+        log_setup_phase("Custom and cgroup mounts", &ts);
+
         pid = raw_clone(SIGCHLD|CLONE_NEWNS|
                         (arg_share_system ? 0 : CLONE_NEWIPC|CLONE_NEWPID|CLONE_NEWUTS) |
                         (arg_private_network ? CLONE_NEWNET : 0) |
@@ -3083,7 +3146,25 @@ int main(int argc, char *argv[]) {
                         goto finish;
                 }
 
-                if (arg_ephemeral) {
+                if (arg_ephemeral && ephemeral_use_overlay(arg_directory)) {
+
+                        /* Snapshotting would mean a full copy here,
+                         * stack a tmpfs on top of the tree instead.
+                         * The tree itself is not modified, hence
+                         * several ephemeral containers may share it. */
+                        r = image_path_lock(arg_directory, LOCK_SH|LOCK_NB, &tree_global_lock, &tree_local_lock);
+                        if (r == -EBUSY) {
+                                log_error_errno(r, "Directory tree %s is currently busy.", arg_directory);
+                                goto finish;
+                        }
+                        if (r < 0) {
+                                log_error_errno(r, "Failed to lock %s: %m", arg_directory);
+                                goto finish;
+                        }
+
+                        arg_ephemeral_overlay = true;
+
+                } else if (arg_ephemeral) {
                         _cleanup_free_ char *np = NULL;
 
                         /* If the specified path is a mount point we
@@ -3264,7 +3345,9 @@ int main(int argc, char *argv[]) {
                 _cleanup_event_unref_ sd_event *event = NULL;
                 _cleanup_(pty_forward_freep) PTYForward *forward = NULL;
                 _cleanup_netlink_unref_ sd_netlink *rtnl = NULL;
+                _cleanup_bus_unref_ sd_bus *bus = NULL;
                 char last_char = 0;
+                usec_t ts, ts_start;
 
                 r = barrier_create(&barrier);
                 if (r < 0) {
@@ -3353,9 +3436,21 @@ int main(int argc, char *argv[]) {
 
                 barrier_set_role(&barrier, BARRIER_PARENT);
 
+                ts = ts_start = now(CLOCK_MONOTONIC);
+
                 fdset_free(fds);
                 fds = NULL;
 
+                /* Connecting and authenticating takes a few round
+                 * trips, get that going while the child sets up the
+                 * mounts. register_machine() picks up the default
+                 * bus. */
+                if (arg_register) {
+                        r = sd_bus_default_system(&bus);
+                        if (r < 0)
+                                log_debug_errno(r, "Failed to connect to system bus early, ignoring: %m");
+                }
+
                 kmsg_socket_pair[1] = safe_close(kmsg_socket_pair[1]);
                 rtnl_socket_pair[1] = safe_close(rtnl_socket_pair[1]);
                 pid_socket_pair[1] = safe_close(pid_socket_pair[1]);
@@ -3385,6 +3480,8 @@ int main(int argc, char *argv[]) {
 
                 log_debug("Init process invoked as PID " PID_FMT, pid);
 
+                log_setup_phase("Setting up namespaces and mounts", &ts);
+
                 if (arg_userns) {
                         if (!barrier_place_and_sync(&barrier)) { /* #1 */
                                 log_error("Child died too early.");
@@ -3439,6 +3536,8 @@ int main(int argc, char *argv[]) {
                         r = setup_ipvlan(arg_machine, pid, arg_network_ipvlan);
                         if (r < 0)
                                 goto finish;
+
+                        log_setup_phase("Setting up network", &ts);
                 }
 
                 if (arg_register) {
@@ -3453,8 +3552,16 @@ int main(int argc, char *argv[]) {
                                         arg_kill_signal,
                                         arg_property,
                                         arg_keep_unit);
+
+                        /* register_machine() closed the bus when it
+                         * was done, let go of it so that the next
+                         * user gets a fresh connection */
+                        bus = sd_bus_unref(bus);
+
                         if (r < 0)
                                 goto finish;
+
+                        log_setup_phase("Registering machine", &ts);
                 }
 
                 r = sync_cgroup(pid, arg_unified_cgroup_hierarchy);
@@ -3471,6 +3578,8 @@ int main(int argc, char *argv[]) {
                 if (r < 0)
                         goto finish;
 
+                log_setup_phase("Setting up cgroups", &ts);
+
                 /* Notify the child that the parent is ready with all
                  * its setup (including cgroup-ification), and that
                  * the child can now hand over control to the code to
@@ -3495,6 +3604,8 @@ int main(int argc, char *argv[]) {
                         goto finish;
                 }
 
+                log_setup_phase("Container setup", &ts_start);
+
                 sd_notifyf(false,
                            "READY=1\n"
                            "STATUS=Container running.\n"
@@ -33,11 +33,14 @@
 #include "nss-util.h"
 #include "util.h"
 #include "in-addr-util.h"
+#include "socket-util.h"
+#include "resolved-def.h"
 
 NSS_GETHOSTBYNAME_PROTOTYPES(resolve);
 NSS_GETHOSTBYADDR_PROTOTYPES(resolve);
 
 #define DNS_CALL_TIMEOUT_USEC (45*USEC_PER_SEC)
+#define LOOKUP_TIMEOUT_USEC (250*USEC_PER_MSEC)
 
 typedef void (*voidfunc_t)(void);
 
@@ -110,6 +113,176 @@ static int count_addresses(sd_bus_message *m, int af, const char **canonical) {
         return c;
 }
 
+typedef union LookupReply {
+        ResolveLookupReply reply;
+        uint8_t buf[RESOLVE_LOOKUP_REPLY_SIZE_MAX];
+} LookupReply;
+
+static int lookup_fast(const char *name, int af, LookupReply *ret, const char **canonical) {
+        static const union sockaddr_union autobind = {
+                .un.sun_family = AF_UNIX,
+        };
+        union sockaddr_union sa = {
+                .un.sun_family = AF_UNIX,
+                .un.sun_path = SD_RESOLVED_LOOKUP_SOCKET,
+        };
+        union {
+                ResolveLookupRequest request;
+                uint8_t buf[RESOLVE_LOOKUP_REQUEST_SIZE_MAX];
+        } request = {};
+        _cleanup_close_ int fd = -1;
+        struct timeval tv;
+        size_t l;
+        ssize_t n;
+
+        assert(name);
+        assert(ret);
+        assert(canonical);
+
+        /* Asks resolved directly, which answers immediately if the
+         * name is in its cache. Returns SD_RESOLVED_LOOKUP_MISS or a
+         * negative error if the bus should be asked instead. */
+
+        l = strlen(name);
+        if (l > SD_RESOLVED_LOOKUP_NAME_MAX)
+                return SD_RESOLVED_LOOKUP_MISS;
+
+        request.request.family = af;
+        memcpy(request.request.name, name, l + 1);
+
+        fd = socket(AF_UNIX, SOCK_DGRAM|SOCK_CLOEXEC, 0);
+        if (fd < 0)
+                return -errno;
+
+        /* Get an abstract address, so that resolved can reply */
+        if (bind(fd, &autobind.sa, sizeof(sa_family_t)) < 0)
+                return -errno;
+
+        if (connect(fd, &sa.sa, offsetof(struct sockaddr_un, sun_path) + strlen(sa.un.sun_path)) < 0)
+                return -errno;
+
+        if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, timeval_store(&tv, LOOKUP_TIMEOUT_USEC), sizeof(tv)) < 0)
+                return -errno;
+
+        if (send(fd, &request, sizeof(ResolveLookupRequest) + l + 1, MSG_NOSIGNAL) < 0)
+                return -errno;
+
+        n = recv(fd, ret, sizeof(*ret), MSG_TRUNC);
+        if (n < 0)
+                return -errno;
+        if ((size_t) n < sizeof(ResolveLookupReply) || (size_t) n > sizeof(*ret))
+                return -EBADMSG;
+
+        if (ret->reply.status != SD_RESOLVED_LOOKUP_SUCCESS)
+                return ret->reply.status;
+
+        if (ret->reply.n_addresses > SD_RESOLVED_LOOKUP_ADDRESSES_MAX ||
+            (size_t) n <= sizeof(ResolveLookupReply) + ret->reply.n_addresses * sizeof(ResolveLookupAddress) ||
+            ret->buf[n - 1] != 0)
+                return -EBADMSG;
+
+        *canonical = (const char*) (ret->reply.addresses + ret->reply.n_addresses);
+        return SD_RESOLVED_LOOKUP_SUCCESS;
+}
+
+static int count_lookup_addresses(const LookupReply *lookup, int af) {
+        unsigned i;
+        int c = 0;
+
+        assert(lookup);
+
+        for (i = 0; i < lookup->reply.n_addresses; i++) {
+                const ResolveLookupAddress *a = lookup->reply.addresses + i;
+
+                if (a->ifindex < 0 || !IN_SET(a->family, AF_INET, AF_INET6))
+                        return -EBADMSG;
+
+                if (af != AF_UNSPEC && a->family != af)
+                        continue;
+
+                c++;
+        }
+
+        return c;
+}
+
+static enum nss_status gethostbyname4_from_lookup(
+                const char *name,
+                const LookupReply *lookup,
+                const char *canonical,
+                struct gaih_addrtuple **pat,
+                char *buffer, size_t buflen,
+                int *errnop, int *h_errnop,
+                int32_t *ttlp) {
+
+        struct gaih_addrtuple *r_tuple, *r_tuple_first = NULL;
+        size_t l, ms, idx;
+        char *r_name;
+        unsigned i;
+        int c;
+
+        c = count_lookup_addresses(lookup, AF_UNSPEC);
+        if (c < 0) {
+                *errnop = -c;
+                *h_errnop = NO_DATA;
+                return NSS_STATUS_UNAVAIL;
+        }
+        if (c == 0) {
+                *errnop = ESRCH;
+                *h_errnop = HOST_NOT_FOUND;
+                return NSS_STATUS_NOTFOUND;
+        }
+
+        if (isempty(canonical))
+                canonical = name;
+
+        l = strlen(canonical);
+        ms = ALIGN(l+1) + ALIGN(sizeof(struct gaih_addrtuple)) * c;
+        if (buflen < ms) {
+                *errnop = ENOMEM;
+                *h_errnop = TRY_AGAIN;
+                return NSS_STATUS_TRYAGAIN;
+        }
+
+        /* First, append name */
+        r_name = buffer;
+        memcpy(r_name, canonical, l+1);
+        idx = ALIGN(l+1);
+
+        /* Second, append addresses */
+        r_tuple_first = (struct gaih_addrtuple*) (buffer + idx);
+
+        for (i = 0; i < (unsigned) c; i++) {
+                const ResolveLookupAddress *a = lookup->reply.addresses + i;
+
+                r_tuple = (struct gaih_addrtuple*) (buffer + idx);
+                r_tuple->next = i == (unsigned) c-1 ? NULL : (struct gaih_addrtuple*) ((char*) r_tuple + ALIGN(sizeof(struct gaih_addrtuple)));
+                r_tuple->name = r_name;
+                r_tuple->family = a->family;
+                r_tuple->scopeid = a->ifindex;
+                memcpy(r_tuple->addr, a->address, FAMILY_ADDRESS_SIZE(a->family));
+
+                idx += ALIGN(sizeof(struct gaih_addrtuple));
+        }
+
+        assert(idx == ms);
+
+        if (*pat)
+                **pat = *r_tuple_first;
+        else
+                *pat = r_tuple_first;
+
+        if (ttlp)
+                *ttlp = 0;
+
+        /* Explicitly reset all error variables */
+        *errnop = 0;
+        *h_errnop = NETDB_SUCCESS;
+        h_errno = 0;
+
+        return NSS_STATUS_SUCCESS;
+}
+
 enum nss_status _nss_resolve_gethostbyname4_r(
                 const char *name,
                 struct gaih_addrtuple **pat,
@@ -122,6 +295,7 @@ enum nss_status _nss_resolve_gethostbyname4_r(
         struct gaih_addrtuple *r_tuple, *r_tuple_first = NULL;
         _cleanup_bus_flush_close_unref_ sd_bus *bus = NULL;
         const char *canonical = NULL;
+        LookupReply lookup;
         size_t l, ms, idx;
         char *r_name;
         int c, r, i = 0;
@@ -132,6 +306,15 @@ enum nss_status _nss_resolve_gethostbyname4_r(
         assert(errnop);
         assert(h_errnop);
 
+        r = lookup_fast(name, AF_UNSPEC, &lookup, &canonical);
+        if (r == SD_RESOLVED_LOOKUP_NXDOMAIN) {
+                *errnop = ESRCH;
+                *h_errnop = HOST_NOT_FOUND;
+                return NSS_STATUS_NOTFOUND;
+        }
+        if (r == SD_RESOLVED_LOOKUP_SUCCESS)
+                return gethostbyname4_from_lookup(name, &lookup, canonical, pat, buffer, buflen, errnop, h_errnop, ttlp);
+
         r = sd_bus_open_system(&bus);
         if (r < 0)
                 goto fail;
@@ -289,6 +472,104 @@ fail:
         return NSS_STATUS_UNAVAIL;
 }
 
+static enum nss_status gethostbyname3_from_lookup(
+                const char *name,
+                int af,
+                const LookupReply *lookup,
+                const char *canonical,
+                struct hostent *result,
+                char *buffer, size_t buflen,
+                int *errnop, int *h_errnop,
+                int32_t *ttlp,
+                char **canonp) {
+
+        char *r_name, *r_aliases, *r_addr, *r_addr_list;
+        size_t l, idx, ms, alen;
+        unsigned j;
+        int c, i = 0;
+
+        c = count_lookup_addresses(lookup, af);
+        if (c < 0) {
+                *errnop = -c;
+                *h_errnop = NO_DATA;
+                return NSS_STATUS_UNAVAIL;
+        }
+        if (c == 0) {
+                *errnop = ESRCH;
+                *h_errnop = HOST_NOT_FOUND;
+                return NSS_STATUS_NOTFOUND;
+        }
+
+        if (isempty(canonical))
+                canonical = name;
+
+        alen = FAMILY_ADDRESS_SIZE(af);
+        l = strlen(canonical);
+
+        ms = ALIGN(l+1) + c * ALIGN(alen) + (c+2) * sizeof(char*);
+
+        if (buflen < ms) {
+                *errnop = ENOMEM;
+                *h_errnop = TRY_AGAIN;
+                return NSS_STATUS_TRYAGAIN;
+        }
+
+        /* First, append name */
+        r_name = buffer;
+        memcpy(r_name, canonical, l+1);
+        idx = ALIGN(l+1);
+
+        /* Second, create empty aliases array */
+        r_aliases = buffer + idx;
+        ((char**) r_aliases)[0] = NULL;
+        idx += sizeof(char*);
+
+        /* Third, append addresses */
+        r_addr = buffer + idx;
+
+        for (j = 0; j < lookup->reply.n_addresses; j++) {
+                const ResolveLookupAddress *a = lookup->reply.addresses + j;
+
+                if (a->family != af)
+                        continue;
+
+                memcpy(r_addr + i*ALIGN(alen), a->address, alen);
+                i++;
+        }
+
+        assert(i == c);
+        idx += c * ALIGN(alen);
+
+        /* Fourth, append address pointer array */
+        r_addr_list = buffer + idx;
+        for (i = 0; i < c; i++)
+                ((char**) r_addr_list)[i] = r_addr + i*ALIGN(alen);
+
+        ((char**) r_addr_list)[i] = NULL;
+        idx += (c+1) * sizeof(char*);
+
+        assert(idx == ms);
+
+        result->h_name = r_name;
+        result->h_aliases = (char**) r_aliases;
+        result->h_addrtype = af;
+        result->h_length = alen;
+        result->h_addr_list = (char**) r_addr_list;
+
+        /* Explicitly reset all error variables */
+        *errnop = 0;
+        *h_errnop = NETDB_SUCCESS;
+        h_errno = 0;
+
+        if (ttlp)
+                *ttlp = 0;
+
+        if (canonp)
+                *canonp = r_name;
+
+        return NSS_STATUS_SUCCESS;
+}
+
 enum nss_status _nss_resolve_gethostbyname3_r(
                 const char *name,
                 int af,
@@ -304,6 +585,7 @@ enum nss_status _nss_resolve_gethostbyname3_r(
         _cleanup_bus_flush_close_unref_ sd_bus *bus = NULL;
         size_t l, idx, ms, alen;
         const char *canonical;
+        LookupReply lookup;
         int c, r, i = 0;
 
         assert(name);
@@ -320,6 +602,15 @@ enum nss_status _nss_resolve_gethostbyname3_r(
                 goto fail;
         }
 
+        r = lookup_fast(name, af, &lookup, &canonical);
+        if (r == SD_RESOLVED_LOOKUP_NXDOMAIN) {
+                *errnop = ESRCH;
+                *h_errnop = HOST_NOT_FOUND;
+                return NSS_STATUS_NOTFOUND;
+        }
+        if (r == SD_RESOLVED_LOOKUP_SUCCESS)
+                return gethostbyname3_from_lookup(name, af, &lookup, canonical, result, buffer, buflen, errnop, h_errnop, ttlp, canonp);
+
         r = sd_bus_open_system(&bus);
         if (r < 0)
                 goto fail;
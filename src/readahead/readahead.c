@@ -0,0 +1,493 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/fiemap.h>
+#include <linux/fs.h>
+#include <sys/fanotify.h>
+#include <sys/inotify.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "sd-event.h"
+
+#include "def.h"
+#include "fileio.h"
+#include "hashmap.h"
+#include "log.h"
+#include "mkdir.h"
+#include "path-util.h"
+#include "signal-util.h"
+#include "strv.h"
+#include "util.h"
+
+/* Boot-time readahead for rotating media. On a boot without a pack
+ * file "collect" records which files are opened until the boot is
+ * declared done, and writes their names sorted by their position on
+ * disk. On later boots "replay" reads them in that order, so that the
+ * disk head sweeps across the platter once instead of seeking back
+ * and forth between the services that start in parallel. */
+
+#define READAHEAD_PACK_MAGIC "systemd-readahead-pack 1"
+
+/* Don't record more than this; everything after is most likely not
+ * part of the boot anymore */
+#define READAHEAD_FILES_MAX 4096U
+#define READAHEAD_FILE_SIZE_MAX (128U*1024U*1024U)
+#define READAHEAD_COLLECT_TIMEOUT_USEC (2*USEC_PER_MINUTE)
+
+typedef struct Entry {
+        char *path;
+        dev_t dev;
+        ino_t ino;
+        uint64_t physical;
+} Entry;
+
+typedef struct Collector {
+        sd_event *event;
+        Hashmap *entries;
+        int fanotify_fd;
+        int inotify_fd;
+        usec_t boot_usec;
+} Collector;
+
+static void entry_free(Entry *e) {
+        if (!e)
+                return;
+
+        free(e->path);
+        free(e);
+}
+
+static void collector_free(Collector *c) {
+        Entry *e;
+
+        while ((e = hashmap_steal_first(c->entries)))
+                entry_free(e);
+        hashmap_free(c->entries);
+
+        sd_event_unref(c->event);
+        safe_close(c->fanotify_fd);
+        safe_close(c->inotify_fd);
+}
+
+static uint64_t file_first_block(int fd) {
+        struct {
+                struct fiemap fiemap;
+                struct fiemap_extent extent;
+        } data = {
+                .fiemap.fm_length = FIEMAP_MAX_OFFSET,
+                .fiemap.fm_extent_count = 1,
+        };
+
+        /* Sorting key for the pack: where the file starts on disk. If
+         * the file system can't tell us, the file is read first,
+         * which is as good as any other spot. */
+
+        if (ioctl(fd, FS_IOC_FIEMAP, &data) < 0)
+                return 0;
+
+        if (data.fiemap.fm_mapped_extents < 1)
+                return 0;
+
+        return data.extent.fe_physical;
+}
+
+static int collector_record(Collector *c, int fd) {
+        _cleanup_free_ char *p = NULL, *path = NULL;
+        Entry *e;
+        struct stat st;
+        int r;
+
+        if (hashmap_size(c->entries) >= READAHEAD_FILES_MAX)
+                return 0;
+
+        if (asprintf(&p, "/proc/self/fd/%i", fd) < 0)
+                return -ENOMEM;
+
+        r = readlink_malloc(p, &path);
+        if (r < 0)
+                return r;
+
+        if (!path_is_absolute(path) || endswith(path, " (deleted)"))
+                return 0;
+
+        if (hashmap_contains(c->entries, path))
+                return 0;
+
+        if (fstat(fd, &st) < 0)
+                return -errno;
+
+        if (!S_ISREG(st.st_mode) || st.st_size <= 0 || st.st_size > READAHEAD_FILE_SIZE_MAX)
+                return 0;
+
+        e = new0(Entry, 1);
+        if (!e)
+                return -ENOMEM;
+
+        e->path = path;
+        e->dev = st.st_dev;
+        e->ino = st.st_ino;
+        e->physical = file_first_block(fd);
+
+        r = hashmap_put(c->entries, e->path, e);
+        if (r < 0) {
+                free(e);
+                return r;
+        }
+
+        path = NULL;
+        return 0;
+}
+
+static int on_fanotify(sd_event_source *s, int fd, uint32_t revents, void *userdata) {
+        union {
+                struct fanotify_event_metadata metadata;
+                uint8_t buf[4096];
+        } data;
+        Collector *c = userdata;
+        struct fanotify_event_metadata *m;
+        ssize_t n;
+        int r;
+
+        n = read(fd, &data, sizeof(data));
+        if (n < 0) {
+                if (errno == EAGAIN || errno == EINTR)
+                        return 0;
+
+                return log_error_errno(errno, "Failed to read fanotify event: %m");
+        }
+
+        for (m = &data.metadata; FAN_EVENT_OK(m, n); m = FAN_EVENT_NEXT(m, n)) {
+
+                if (m->fd < 0)
+                        continue;
+
+                if (m->pid != getpid()) {
+                        r = collector_record(c, m->fd);
+                        if (r == -ENOMEM)
+                                return log_oom();
+                        if (r < 0)
+                                log_debug_errno(r, "Failed to record file, ignoring: %m");
+                }
+
+                safe_close(m->fd);
+        }
+
+        return 0;
+}
+
+static int read_done_usec(usec_t *ret) {
+        _cleanup_free_ char *s = NULL;
+        int r;
+
+        r = read_one_line_file(READAHEAD_DONE_FILE, &s);
+        if (r < 0)
+                return r;
+
+        return safe_atou64(s, ret);
+}
+
+static int on_inotify(sd_event_source *s, int fd, uint32_t revents, void *userdata) {
+        union inotify_event_buffer buffer;
+        Collector *c = userdata;
+        ssize_t l;
+
+        l = read(fd, &buffer, sizeof(buffer));
+        if (l < 0) {
+                if (errno == EAGAIN || errno == EINTR)
+                        return 0;
+
+                return log_error_errno(errno, "Failed to read inotify event: %m");
+        }
+
+        if (access(READAHEAD_DONE_FILE, F_OK) < 0)
+                return 0;
+
+        if (read_done_usec(&c->boot_usec) < 0)
+                c->boot_usec = 0;
+
+        log_debug("Boot is done, stopping collection.");
+        return sd_event_exit(sd_event_source_get_event(s), 0);
+}
+
+static int on_timeout(sd_event_source *s, uint64_t usec, void *userdata) {
+        log_debug("Collection timed out.");
+        return sd_event_exit(sd_event_source_get_event(s), 0);
+}
+
+static int entry_compare(const void *_a, const void *_b) {
+        const Entry *a = *(const Entry**) _a, *b = *(const Entry**) _b;
+
+        if (a->dev != b->dev)
+                return a->dev < b->dev ? -1 : 1;
+
+        if (a->physical != b->physical)
+                return a->physical < b->physical ? -1 : 1;
+
+        if (a->ino != b->ino)
+                return a->ino < b->ino ? -1 : 1;
+
+        return 0;
+}
+
+static int collector_write_pack(Collector *c) {
+        _cleanup_free_ Entry **list = NULL;
+        _cleanup_fclose_ FILE *f = NULL;
+        _cleanup_free_ char *t = NULL;
+        Iterator i;
+        Entry *e;
+        unsigned n = 0, k;
+        int r;
+
+        list = new(Entry*, hashmap_size(c->entries));
+        if (!list)
+                return log_oom();
+
+        HASHMAP_FOREACH(e, c->entries, i)
+                list[n++] = e;
+
+        qsort_safe(list, n, sizeof(Entry*), entry_compare);
+
+        r = fopen_temporary(READAHEAD_PACK, &f, &t);
+        if (r < 0)
+                return log_error_errno(r, "Failed to create pack file: %m");
+
+        fputs(READAHEAD_PACK_MAGIC "\n", f);
+        fprintf(f, USEC_FMT "\n", c->boot_usec);
+
+        /* File names may contain newlines, hence NUL separate them */
+        for (k = 0; k < n; k++) {
+                fputs(list[k]->path, f);
+                fputc(0, f);
+        }
+
+        r = fflush_and_check(f);
+        if (r < 0)
+                goto fail;
+
+        if (rename(t, READAHEAD_PACK) < 0) {
+                r = -errno;
+                goto fail;
+        }
+
+        log_info("Recorded %u files for readahead.", n);
+        return 0;
+
+fail:
+        unlink(t);
+        return log_error_errno(r, "Failed to write pack file: %m");
+}
+
+static int collect(void) {
+        _cleanup_(collector_free) Collector c = {
+                .fanotify_fd = -1,
+                .inotify_fd = -1,
+        };
+        const char *p;
+        int r;
+
+        if (access(READAHEAD_PACK, F_OK) >= 0) {
+                log_debug("Pack file exists already, not collecting.");
+                return 0;
+        }
+
+        c.entries = hashmap_new(&string_hash_ops);
+        if (!c.entries)
+                return log_oom();
+
+        r = mkdir_p(READAHEAD_RUNTIME_DIR, 0755);
+        if (r < 0)
+                return log_error_errno(r, "Failed to create " READAHEAD_RUNTIME_DIR ": %m");
+
+        c.fanotify_fd = fanotify_init(FAN_CLOEXEC|FAN_NONBLOCK, O_RDONLY|O_LARGEFILE|O_CLOEXEC|O_NOATIME);
+        if (c.fanotify_fd < 0)
+                return log_error_errno(errno, "Failed to create fanotify object: %m");
+
+        /* Boot files live on the root file system, or on /usr when
+         * it is split off. If /usr is no mount point this marks the
+         * root mount twice, which is harmless. */
+        FOREACH_STRING(p, "/", "/usr")
+                if (fanotify_mark(c.fanotify_fd, FAN_MARK_ADD|FAN_MARK_MOUNT, FAN_OPEN, AT_FDCWD, p) < 0)
+                        return log_error_errno(errno, "Failed to mark %s: %m", p);
+
+        c.inotify_fd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+        if (c.inotify_fd < 0)
+                return log_error_errno(errno, "Failed to create inotify object: %m");
+
+        if (inotify_add_watch(c.inotify_fd, READAHEAD_RUNTIME_DIR, IN_CREATE|IN_MOVED_TO) < 0)
+                return log_error_errno(errno, "Failed to watch " READAHEAD_RUNTIME_DIR ": %m");
+
+        r = sd_event_default(&c.event);
+        if (r < 0)
+                return log_error_errno(r, "Failed to allocate event loop: %m");
+
+        assert_se(sigprocmask_many(SIG_BLOCK, NULL, SIGTERM, SIGINT, -1) >= 0);
+        sd_event_add_signal(c.event, NULL, SIGTERM, NULL, NULL);
+        sd_event_add_signal(c.event, NULL, SIGINT, NULL, NULL);
+
+        r = sd_event_add_io(c.event, NULL, c.fanotify_fd, EPOLLIN, on_fanotify, &c);
+        if (r < 0)
+                return log_error_errno(r, "Failed to watch fanotify object: %m");
+
+        r = sd_event_add_io(c.event, NULL, c.inotify_fd, EPOLLIN, on_inotify, &c);
+        if (r < 0)
+                return log_error_errno(r, "Failed to watch inotify object: %m");
+
+        r = sd_event_add_time(c.event, NULL, CLOCK_MONOTONIC, now(CLOCK_MONOTONIC) + READAHEAD_COLLECT_TIMEOUT_USEC, 0, on_timeout, &c);
+        if (r < 0)
+                return log_error_errno(r, "Failed to add timeout: %m");
+
+        /* Maybe we were started late, after the boot was done */
+        if (read_done_usec(&c.boot_usec) < 0) {
+                r = sd_event_loop(c.event);
+                if (r < 0)
+                        return log_error_errno(r, "Event loop failed: %m");
+        }
+
+        return collector_write_pack(&c);
+}
+
+static int replay(void) {
+        _cleanup_free_ char *contents = NULL, *files = NULL, *bytes = NULL, *duration = NULL, *recorded = NULL;
+        usec_t start, boot_usec = 0;
+        uint64_t total = 0;
+        unsigned n = 0;
+        size_t size;
+        char *p, *e;
+        int r;
+
+        start = now(CLOCK_MONOTONIC);
+
+        r = read_full_file(READAHEAD_PACK, &contents, &size);
+        if (r == -ENOENT) {
+                log_debug("No pack file, not replaying.");
+                return 0;
+        }
+        if (r < 0)
+                return log_error_errno(r, "Failed to read pack file: %m");
+
+        e = contents + size;
+
+        p = startswith(contents, READAHEAD_PACK_MAGIC "\n");
+        if (!p) {
+                log_error("Pack file has unknown format, ignoring.");
+                return -EBADMSG;
+        }
+
+        p[strcspn(p, "\n")] = 0;
+        (void) safe_atou64(p, &boot_usec);
+        p += strlen(p) + 1;
+
+        /* The last entry is NUL terminated too, read_full_file()
+         * also appends one, so this can't run over the end. */
+        for (; p < e; p += strlen(p) + 1) {
+                _cleanup_close_ int fd = -1;
+                struct stat st;
+
+                if (!path_is_absolute(p))
+                        continue;
+
+                fd = open(p, O_RDONLY|O_CLOEXEC|O_NOATIME|O_NOCTTY|O_NOFOLLOW);
+                if (fd < 0)
+                        continue;
+
+                if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size <= 0)
+                        continue;
+
+                if (readahead(fd, 0, st.st_size) < 0) {
+                        log_debug_errno(errno, "Failed to read ahead %s, ignoring: %m", p);
+                        continue;
+                }
+
+                total += st.st_size;
+                n++;
+        }
+
+        /* readahead() only queues the I/O, but requests are served in
+         * order, so this is close to the time the disk was busy */
+        if (asprintf(&files, "%u", n) < 0 ||
+            asprintf(&bytes, "%" PRIu64, total) < 0 ||
+            asprintf(&duration, USEC_FMT, now(CLOCK_MONOTONIC) - start) < 0 ||
+            asprintf(&recorded, USEC_FMT, boot_usec) < 0)
+                return log_oom();
+
+        r = mkdir_p(READAHEAD_RUNTIME_DIR, 0755);
+        if (r < 0)
+                return log_error_errno(r, "Failed to create " READAHEAD_RUNTIME_DIR ": %m");
+
+        r = write_env_file(READAHEAD_REPLAY_FILE,
+                           STRV_MAKE("FILES", files,
+                                     "BYTES", bytes,
+                                     "DURATION_USEC", duration,
+                                     "RECORDED_BOOT_USEC", recorded));
+        if (r < 0)
+                log_warning_errno(r, "Failed to write " READAHEAD_REPLAY_FILE ", ignoring: %m");
+
+        log_debug("Read ahead %u files.", n);
+        return 0;
+}
+
+static int done(void) {
+        char t[DECIMAL_STR_MAX(usec_t)];
+        int r;
+
+        r = mkdir_p(READAHEAD_RUNTIME_DIR, 0755);
+        if (r < 0)
+                return log_error_errno(r, "Failed to create " READAHEAD_RUNTIME_DIR ": %m");
+
+        xsprintf(t, USEC_FMT, now(CLOCK_MONOTONIC));
+
+        /* Atomic, so that the collector never sees a partial file */
+        r = write_string_file(READAHEAD_DONE_FILE, t, WRITE_STRING_FILE_CREATE|WRITE_STRING_FILE_ATOMIC);
+        if (r < 0)
+                return log_error_errno(r, "Failed to write " READAHEAD_DONE_FILE ": %m");
+
+        return 0;
+}
+
+int main(int argc, char *argv[]) {
+        int r;
+
+        if (argc != 2) {
+                log_error("This program requires one argument.");
+                return EXIT_FAILURE;
+        }
+
+        log_set_target(LOG_TARGET_AUTO);
+        log_parse_environment();
+        log_open();
+
+        umask(0022);
+
+        if (streq(argv[1], "collect"))
+                r = collect();
+        else if (streq(argv[1], "replay"))
+                r = replay();
+        else if (streq(argv[1], "done"))
+                r = done();
+        else {
+                log_error("Unknown verb '%s'.", argv[1]);
+                r = -EINVAL;
+        }
+
+        return r < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -143,11 +143,25 @@ int config_parse_support(
 }
 
 int manager_parse_config_file(Manager *m) {
+        int r;
+
         assert(m);
 
-        return config_parse_many("/etc/systemd/resolved.conf",
-                                 CONF_DIRS_NULSTR("systemd/resolved.conf"),
-                                 "Resolve\0",
-                                 config_item_perf_lookup, resolved_gperf_lookup,
-                                 false, m);
+        r = config_parse_many("/etc/systemd/resolved.conf",
+                              CONF_DIRS_NULSTR("systemd/resolved.conf"),
+                              "Resolve\0",
+                              config_item_perf_lookup, resolved_gperf_lookup,
+                              false, m);
+        if (r < 0)
+                return r;
+
+        if (m->cache_max_entries <= 0) {
+                log_warning("CacheMaxEntries= must be positive, using %u.", DNS_CACHE_ENTRIES_MAX);
+                m->cache_max_entries = DNS_CACHE_ENTRIES_MAX;
+        }
+
+        /* the global unicast scope exists already */
+        manager_apply_cache_limits(m);
+
+        return 0;
 }
@@ -21,6 +21,8 @@
   along with systemd; If not, see <http://www.gnu.org/licenses/>.
 ***/
 
+#include <inttypes.h>
+
 #define SD_RESOLVED_DNS           ((uint64_t) 1)
 #define SD_RESOLVED_LLMNR_IPV4    ((uint64_t) 2)
 #define SD_RESOLVED_LLMNR_IPV6    ((uint64_t) 4)
@@ -28,3 +30,48 @@
 
 #define SD_RESOLVED_FLAGS_ALL     (SD_RESOLVED_DNS|SD_RESOLVED_LLMNR_IPV4|SD_RESOLVED_LLMNR_IPV6)
 #define SD_RESOLVED_FLAGS_DEFAULT SD_RESOLVED_FLAGS_ALL
+
+/* A datagram protocol on an AF_UNIX socket, for answering hostname
+ * lookups from the cache without a bus round-trip. The client sends
+ * a ResolveLookupRequest from a bound (or autobound) socket, and
+ * receives a ResolveLookupReply. Lookups that cannot be answered
+ * immediately are answered with SD_RESOLVED_LOOKUP_MISS and should
+ * be repeated via the ResolveHostname() bus call; resolved keeps the
+ * lookup going meanwhile, so the bus call will join it. */
+
+#define SD_RESOLVED_LOOKUP_SOCKET "/run/systemd/resolve/lookup"
+#define SD_RESOLVED_LOOKUP_NAME_MAX 1024
+#define SD_RESOLVED_LOOKUP_ADDRESSES_MAX 64
+
+enum {
+        SD_RESOLVED_LOOKUP_SUCCESS,
+        SD_RESOLVED_LOOKUP_NXDOMAIN,
+        SD_RESOLVED_LOOKUP_MISS,
+};
+
+typedef struct ResolveLookupRequest {
+        int32_t ifindex;
+        int32_t family;
+        uint64_t flags;
+        char name[];            /* NUL terminated */
+} ResolveLookupRequest;
+
+typedef struct ResolveLookupAddress {
+        int32_t ifindex;
+        int32_t family;
+        uint8_t address[16];
+} ResolveLookupAddress;
+
+typedef struct ResolveLookupReply {
+        uint32_t status;
+        uint32_t n_addresses;
+        ResolveLookupAddress addresses[];
+        /* followed by the NUL terminated canonical name */
+} ResolveLookupReply;
+
+#define RESOLVE_LOOKUP_REQUEST_SIZE_MAX                                 \
+        (sizeof(ResolveLookupRequest) + SD_RESOLVED_LOOKUP_NAME_MAX + 1)
+#define RESOLVE_LOOKUP_REPLY_SIZE_MAX                                   \
+        (sizeof(ResolveLookupReply) +                                   \
+         SD_RESOLVED_LOOKUP_ADDRESSES_MAX * sizeof(ResolveLookupAddress) + \
+         SD_RESOLVED_LOOKUP_NAME_MAX + 1)
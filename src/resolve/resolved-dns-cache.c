@@ -19,35 +19,123 @@
   along with systemd; If not, see <http://www.gnu.org/licenses/>.
 ***/
 
+#include "strv.h"
+#include "in-addr-util.h"
+
 #include "resolved-dns-cache.h"
 #include "resolved-dns-packet.h"
 
-/* Never cache more than 1K entries */
-#define CACHE_MAX 1024
-
 /* We never keep any item longer than 10min in our cache */
 #define CACHE_TTL_MAX_USEC (10 * USEC_PER_MINUTE)
 
+/* Refresh entries asked for at least this often during the last
+ * tenth of their TTL, if prefetching is enabled */
+#define CACHE_PREFETCH_HITS_MIN 3
+
 typedef enum DnsCacheItemType DnsCacheItemType;
-typedef struct DnsCacheItem DnsCacheItem;
 
 enum DnsCacheItemType {
         DNS_CACHE_POSITIVE,
         DNS_CACHE_NODATA,
         DNS_CACHE_NXDOMAIN,
+        _DNS_CACHE_ITEM_TYPE_MAX,
+        _DNS_CACHE_ITEM_TYPE_INVALID = -1
 };
 
 struct DnsCacheItem {
         DnsResourceKey *key;
         DnsResourceRecord *rr;
+        usec_t since;
         usec_t until;
         DnsCacheItemType type;
         unsigned prioq_idx;
+        unsigned n_hits;
+        size_t size;
         int owner_family;
         union in_addr_union owner_address;
         LIST_FIELDS(DnsCacheItem, by_key);
+        LIST_FIELDS(DnsCacheItem, lru);
 };
 
+/* Approximate memory used by an item, for CacheMaxBytes= */
+static size_t dns_cache_item_size(const DnsCacheItem *i) {
+        const DnsResourceRecord *rr = i->rr;
+        size_t size;
+        char **s;
+
+        size = sizeof(DnsCacheItem) + sizeof(DnsResourceKey) + strlen(DNS_RESOURCE_KEY_NAME(i->key)) + 1;
+        if (!rr)
+                return size;
+
+        size += sizeof(DnsResourceRecord);
+
+        switch (rr->key->type) {
+
+        case DNS_TYPE_PTR:
+        case DNS_TYPE_NS:
+        case DNS_TYPE_CNAME:
+        case DNS_TYPE_DNAME:
+                size += strlen(rr->ptr.name) + 1;
+                break;
+
+        case DNS_TYPE_SRV:
+                size += strlen(rr->srv.name) + 1;
+                break;
+
+        case DNS_TYPE_MX:
+                size += strlen(rr->mx.exchange) + 1;
+                break;
+
+        case DNS_TYPE_SOA:
+                size += strlen(rr->soa.mname) + strlen(rr->soa.rname) + 2;
+                break;
+
+        case DNS_TYPE_TXT:
+        case DNS_TYPE_SPF:
+                STRV_FOREACH(s, rr->txt.strings)
+                        size += sizeof(char*) + strlen(*s) + 1;
+                break;
+
+        case DNS_TYPE_HINFO:
+                size += strlen(rr->hinfo.cpu) + strlen(rr->hinfo.os) + 2;
+                break;
+
+        case DNS_TYPE_DS:
+                size += rr->ds.digest_size;
+                break;
+
+        case DNS_TYPE_SSHFP:
+                size += rr->sshfp.fingerprint_size;
+                break;
+
+        case DNS_TYPE_DNSKEY:
+                size += rr->dnskey.key_size;
+                break;
+
+        case DNS_TYPE_RRSIG:
+                size += strlen(rr->rrsig.signer) + 1 + rr->rrsig.signature_size;
+                break;
+
+        case DNS_TYPE_NSEC:
+                size += strlen(rr->nsec.next_domain_name) + 1;
+                break;
+
+        case DNS_TYPE_NSEC3:
+                size += rr->nsec3.salt_size + rr->nsec3.next_hashed_name_size;
+                break;
+
+        case DNS_TYPE_LOC:
+        case DNS_TYPE_A:
+        case DNS_TYPE_AAAA:
+                break;
+
+        default:
+                size += rr->generic.size;
+        }
+
+        return size;
+}
+
 static void dns_cache_item_free(DnsCacheItem *i) {
         if (!i)
                 return;
@@ -77,9 +165,27 @@ static void dns_cache_item_remove_and_free(DnsCache *c, DnsCacheItem *i) {
 
         prioq_remove(c->by_expiry, i, &i->prioq_idx);
 
+        if (c->lru_tail == i)
+                c->lru_tail = i->lru_prev;
+        LIST_REMOVE(lru, c->lru, i);
+        c->n_bytes -= i->size;
+
         dns_cache_item_free(i);
 }
 
+/* Mark an item as just used, moving it to the end of the LRU list */
+static void dns_cache_item_touch(DnsCache *c, DnsCacheItem *i) {
+        assert(c);
+        assert(i);
+
+        if (c->lru_tail == i)
+                return;
+
+        LIST_REMOVE(lru, c->lru, i);
+        LIST_INSERT_AFTER(lru, c->lru, c->lru_tail, i);
+        c->lru_tail = i;
+}
+
 void dns_cache_flush(DnsCache *c) {
         DnsCacheItem *i;
 
@@ -90,6 +196,8 @@ void dns_cache_flush(DnsCache *c) {
 
         assert(hashmap_size(c->by_key) == 0);
         assert(prioq_size(c->by_expiry) == 0);
+        assert(!c->lru);
+        assert(c->n_bytes == 0);
 
         c->by_key = hashmap_free(c->by_key);
         c->by_expiry = prioq_free(c->by_expiry);
@@ -110,6 +218,15 @@ static bool dns_cache_remove(DnsCache *c, DnsResourceKey *key) {
         return exist;
 }
 
+static bool dns_cache_is_full(DnsCache *c, unsigned add) {
+        assert(c);
+
+        if (prioq_size(c->by_expiry) + add >= c->n_max)
+                return true;
+
+        return c->bytes_max > 0 && c->n_bytes >= c->bytes_max;
+}
+
 static void dns_cache_make_space(DnsCache *c, unsigned add) {
         assert(c);
 
@@ -117,10 +234,17 @@ static void dns_cache_make_space(DnsCache *c, unsigned add) {
                 return;
 
         /* Makes space for n new entries. Note that we actually allow
-         * the cache to grow beyond CACHE_MAX, but only when we shall
-         * add more RRs to the cache than CACHE_MAX at once. In that
+         * the cache to grow beyond n_max, but only when we shall
+         * add more RRs to the cache than n_max at once. In that
          * case the cache will be emptied completely otherwise. */
 
+        if (!dns_cache_is_full(c, add))
+                return;
+
+        /* Expired entries are useless anyway, so drop them first,
+         * and only then the ones nobody asked for the longest */
+        dns_cache_prune(c);
+
         for (;;) {
                 _cleanup_(dns_resource_key_unrefp) DnsResourceKey *key = NULL;
                 DnsCacheItem *i;
@@ -128,10 +252,10 @@ static void dns_cache_make_space(DnsCache *c, unsigned add) {
                 if (prioq_size(c->by_expiry) <= 0)
                         break;
 
-                if (prioq_size(c->by_expiry) + add < CACHE_MAX)
+                if (!dns_cache_is_full(c, add))
                         break;
 
-                i = prioq_peek(c->by_expiry);
+                i = c->lru;
                 assert(i);
 
                 /* Take an extra reference to the key so that it
@@ -159,7 +283,7 @@ void dns_cache_prune(DnsCache *c) {
                 if (t <= 0)
                         t = now(clock_boottime_or_monotonic());
 
-                if (i->until > t)
+                if (i->until + c->stale_max > t)
                         break;
 
                 /* Take an extra reference to the key so that it
@@ -218,6 +342,12 @@ static int dns_cache_link_item(DnsCache *c, DnsCacheItem *i) {
                 }
         }
 
+        LIST_INSERT_AFTER(lru, c->lru, c->lru_tail, i);
+        c->lru_tail = i;
+
+        i->size = dns_cache_item_size(i);
+        c->n_bytes += i->size;
+
         return 0;
 }
 
@@ -254,6 +384,11 @@ static void dns_cache_item_update_positive(DnsCache *c, DnsCacheItem *i, DnsReso
         dns_resource_key_unref(i->key);
         i->key = dns_resource_key_ref(rr->key);
 
+        c->n_bytes -= i->size;
+        i->size = dns_cache_item_size(i);
+        c->n_bytes += i->size;
+
+        i->since = timestamp;
         i->until = timestamp + MIN(rr->ttl * USEC_PER_SEC, CACHE_TTL_MAX_USEC);
 
         prioq_reshuffle(c->by_expiry, i, &i->prioq_idx);
@@ -315,6 +450,7 @@ static int dns_cache_put_positive(
         i->type = DNS_CACHE_POSITIVE;
         i->key = dns_resource_key_ref(rr->key);
         i->rr = dns_resource_record_ref(rr);
+        i->since = timestamp;
         i->until = timestamp + MIN(i->rr->ttl * USEC_PER_SEC, CACHE_TTL_MAX_USEC);
         i->prioq_idx = PRIOQ_IDX_NULL;
         i->owner_family = owner_family;
@@ -382,6 +518,7 @@ static int dns_cache_put_negative(
 
         i->type = rcode == DNS_RCODE_SUCCESS ? DNS_CACHE_NODATA : DNS_CACHE_NXDOMAIN;
         i->key = dns_resource_key_ref(key);
+        i->since = timestamp;
         i->until = timestamp + MIN(soa_ttl * USEC_PER_SEC, CACHE_TTL_MAX_USEC);
         i->prioq_idx = PRIOQ_IDX_NULL;
         i->owner_family = owner_family;
@@ -580,6 +717,8 @@ int dns_cache_lookup(DnsCache *c, DnsResourceKey *key, int *rcode, DnsAnswer **r
 
                 log_debug("Cache miss for %s", key_str);
 
+                c->n_miss++;
+
                 *ret = NULL;
                 *rcode = DNS_RCODE_SUCCESS;
                 return 0;
@@ -590,8 +729,13 @@ int dns_cache_lookup(DnsCache *c, DnsResourceKey *key, int *rcode, DnsAnswer **r
                         n++;
                 else if (j->type == DNS_CACHE_NXDOMAIN)
                         nxdomain = true;
+
+                j->n_hits++;
+                dns_cache_item_touch(c, j);
         }
 
+        c->n_hit++;
+
         r = dns_resource_key_to_string(key, &key_str);
         if (r < 0)
                 return r;
@@ -627,6 +771,48 @@ int dns_cache_lookup(DnsCache *c, DnsResourceKey *key, int *rcode, DnsAnswer **r
         return n;
 }
 
+bool dns_cache_take_prefetch(DnsCache *c, DnsResourceKey *key, usec_t t) {
+        DnsCacheItem *first, *j;
+
+        assert(c);
+        assert(key);
+
+        /* Checks whether a positive entry is popular and about to
+         * expire, so that it is worth refreshing it before clients
+         * run into a miss. If so, its hit count starts over, so that
+         * a failing refresh is not retried on every single hit.
+         *
+         * Entries that already expired, and are only still around
+         * to be served stale, always need a refresh. */
+
+        first = dns_cache_get_by_key_follow_cname(c, key);
+        if (!first)
+                return false;
+
+        if (first->until <= t) {
+                _cleanup_free_ char *key_str = NULL;
+
+                if (dns_resource_key_to_string(key, &key_str) >= 0)
+                        log_debug("Serving stale cache entry for %s, refreshing", key_str);
+
+                return true;
+        }
+
+        if (!c->prefetch || !first->rr)
+                return false;
+
+        if (first->n_hits < CACHE_PREFETCH_HITS_MIN)
+                return false;
+
+        if (t + (first->until - first->since) / 10 < first->until)
+                return false;
+
+        LIST_FOREACH(by_key, j, first)
+                j->n_hits = 0;
+
+        return true;
+}
+
 int dns_cache_check_conflicts(DnsCache *cache, DnsResourceRecord *rr, int owner_family, const union in_addr_union *owner_address) {
         DnsCacheItem *i, *first;
         bool same_owner = true;
@@ -713,3 +899,205 @@ bool dns_cache_is_empty(DnsCache *cache) {
 
         return hashmap_isempty(cache->by_key);
 }
+
+unsigned dns_cache_size(DnsCache *cache) {
+        if (!cache)
+                return 0;
+
+        return prioq_size(cache->by_expiry);
+}
+
+static const char* const dns_cache_item_type_table[_DNS_CACHE_ITEM_TYPE_MAX] = {
+        [DNS_CACHE_POSITIVE] = "positive",
+        [DNS_CACHE_NODATA] = "nodata",
+        [DNS_CACHE_NXDOMAIN] = "nxdomain",
+};
+DEFINE_PRIVATE_STRING_TABLE_LOOKUP(dns_cache_item_type, DnsCacheItemType);
+
+static int dns_cache_serialize_item(DnsCacheItem *first, const char *prefix, FILE *f) {
+        _cleanup_(dns_packet_unrefp) DnsPacket *p = NULL;
+        _cleanup_free_ char *owner = NULL, *data = NULL;
+        usec_t until = USEC_INFINITY;
+        DnsCacheItem *j;
+        int r;
+
+        r = in_addr_to_string(first->owner_family, &first->owner_address, &owner);
+        if (r < 0)
+                return r;
+
+        r = dns_packet_new(&p, DNS_PROTOCOL_DNS, 0);
+        if (r < 0)
+                return r;
+
+        /* Negative entries just need the key, positive ones have the
+         * complete RRset, which expires with its first RR */
+        if (first->type == DNS_CACHE_POSITIVE)
+                LIST_FOREACH(by_key, j, first) {
+                        r = dns_packet_append_rr(p, j->rr, NULL);
+                        if (r < 0)
+                                return r;
+
+                        until = MIN(until, j->until);
+                }
+        else {
+                r = dns_packet_append_key(p, first->key, NULL);
+                if (r < 0)
+                        return r;
+
+                until = first->until;
+        }
+
+        data = hexmem(DNS_PACKET_DATA(p) + DNS_PACKET_HEADER_SIZE, p->size - DNS_PACKET_HEADER_SIZE);
+        if (!data)
+                return -ENOMEM;
+
+        fprintf(f, "%s %s "USEC_FMT" %s %s\n",
+                prefix,
+                dns_cache_item_type_to_string(first->type),
+                until,
+                owner,
+                data);
+
+        return 0;
+}
+
+int dns_cache_serialize(DnsCache *c, const char *prefix, FILE *f) {
+        DnsCacheItem *i;
+        Iterator iterator;
+        int r;
+
+        assert(c);
+        assert(prefix);
+        assert(f);
+
+        /* Writes one line per key. Negative entries come first, as
+         * restoring them temporarily requires a SOA for their zone,
+         * which must not replace a real one restored earlier. */
+
+        HASHMAP_FOREACH(i, c->by_key, iterator) {
+                if (i->type == DNS_CACHE_POSITIVE)
+                        continue;
+
+                r = dns_cache_serialize_item(i, prefix, f);
+                if (r < 0)
+                        return r;
+        }
+
+        HASHMAP_FOREACH(i, c->by_key, iterator) {
+                if (i->type != DNS_CACHE_POSITIVE)
+                        continue;
+
+                r = dns_cache_serialize_item(i, prefix, f);
+                if (r < 0)
+                        return r;
+        }
+
+        return 0;
+}
+
+int dns_cache_deserialize_item(DnsCache *c, const char *line, usec_t t) {
+        _cleanup_(dns_resource_key_unrefp) DnsResourceKey *key = NULL;
+        _cleanup_(dns_answer_unrefp) DnsAnswer *answer = NULL;
+        _cleanup_(dns_packet_unrefp) DnsPacket *p = NULL;
+        _cleanup_strv_free_ char **l = NULL;
+        _cleanup_free_ void *data = NULL;
+        union in_addr_union owner_address;
+        int owner_family, type;
+        usec_t until;
+        uint32_t ttl;
+        size_t size;
+        unsigned n;
+        int r;
+
+        assert(c);
+        assert(line);
+
+        /* Reads back a line written by dns_cache_serialize(). The
+         * entries get the TTL they have left, and go through
+         * dns_cache_put() like any freshly received answer. */
+
+        l = strv_split(line, WHITESPACE);
+        if (!l)
+                return -ENOMEM;
+        if (strv_length(l) != 4)
+                return -EINVAL;
+
+        type = dns_cache_item_type_from_string(l[0]);
+        if (type < 0)
+                return -EINVAL;
+
+        r = safe_atou64(l[1], &until);
+        if (r < 0)
+                return r;
+
+        r = in_addr_from_string_auto(l[2], &owner_family, &owner_address);
+        if (r < 0)
+                return r;
+
+        r = unhexmem(l[3], strlen(l[3]), &data, &size);
+        if (r < 0)
+                return r;
+
+        if (until <= t + USEC_PER_SEC)
+                return 0;
+
+        ttl = (uint32_t) MIN((until - t) / USEC_PER_SEC, (usec_t) UINT32_MAX);
+
+        r = dns_packet_new(&p, DNS_PROTOCOL_DNS, 0);
+        if (r < 0)
+                return r;
+
+        r = dns_packet_append_blob(p, data, size, NULL);
+        if (r < 0)
+                return r;
+
+        if (type != DNS_CACHE_POSITIVE) {
+                r = dns_packet_read_key(p, &key, NULL);
+                if (r < 0)
+                        return r;
+
+                /* The SOA is only needed to pass the TTL on, it is
+                 * not cached itself */
+                answer = dns_answer_new(1);
+                if (!answer)
+                        return -ENOMEM;
+
+                r = dns_answer_add_soa(answer, DNS_RESOURCE_KEY_NAME(key), ttl);
+                if (r < 0)
+                        return r;
+
+                return dns_cache_put(c, key, type == DNS_CACHE_NXDOMAIN ? DNS_RCODE_NXDOMAIN : DNS_RCODE_SUCCESS,
+                                     answer, 0, t, owner_family, &owner_address);
+        }
+
+        /* Count the RRs first, then read them for real */
+        for (n = 0; p->rindex < p->size; n++) {
+                _cleanup_(dns_resource_record_unrefp) DnsResourceRecord *rr = NULL;
+
+                r = dns_packet_read_rr(p, &rr, NULL);
+                if (r < 0)
+                        return r;
+        }
+
+        answer = dns_answer_new(n);
+        if (!answer)
+                return -ENOMEM;
+
+        dns_packet_rewind(p, DNS_PACKET_HEADER_SIZE);
+
+        while (p->rindex < p->size) {
+                _cleanup_(dns_resource_record_unrefp) DnsResourceRecord *rr = NULL;
+
+                r = dns_packet_read_rr(p, &rr, NULL);
+                if (r < 0)
+                        return r;
+
+                rr->ttl = ttl;
+
+                r = dns_answer_add(answer, rr, 0);
+                if (r < 0)
+                        return r;
+        }
+
+        return dns_cache_put(c, NULL, DNS_RCODE_SUCCESS, answer, n, t, owner_family, &owner_address);
+}
@@ -27,9 +27,27 @@
 #include "time-util.h"
 #include "list.h"
 
+/* Default size limit of each scope's cache */
+#define DNS_CACHE_ENTRIES_MAX 1024
+
+typedef struct DnsCacheItem DnsCacheItem;
+
 typedef struct DnsCache {
         Hashmap *by_key;
         Prioq *by_expiry;
+
+        /* least recently used first */
+        LIST_HEAD(DnsCacheItem, lru);
+        DnsCacheItem *lru_tail;
+
+        unsigned n_max;
+        size_t n_bytes;
+        size_t bytes_max; /* 0 for no limit */
+        bool prefetch;
+        usec_t stale_max; /* how long to serve expired entries, 0 to never do so */
+
+        uint64_t n_hit;
+        uint64_t n_miss;
 } DnsCache;
 
 #include "resolved-dns-rr.h"
@@ -41,8 +59,13 @@ void dns_cache_prune(DnsCache *c);
 
 int dns_cache_put(DnsCache *c, DnsResourceKey *key, int rcode, DnsAnswer *answer, unsigned max_rrs, usec_t timestamp, int owner_family, const union in_addr_union *owner_address);
 int dns_cache_lookup(DnsCache *c, DnsResourceKey *key, int *rcode, DnsAnswer **answer);
+bool dns_cache_take_prefetch(DnsCache *c, DnsResourceKey *key, usec_t t);
 
 int dns_cache_check_conflicts(DnsCache *cache, DnsResourceRecord *rr, int owner_family, const union in_addr_union *owner_address);
 
 void dns_cache_dump(DnsCache *cache, FILE *f);
 bool dns_cache_is_empty(DnsCache *cache);
+unsigned dns_cache_size(DnsCache *cache);
+
+int dns_cache_serialize(DnsCache *c, const char *prefix, FILE *f);
+int dns_cache_deserialize_item(DnsCache *c, const char *line, usec_t t);
@@ -1166,6 +1166,213 @@ fail:
         return r;
 }
 
+static int dns_packet_skip_name(DnsPacket *p) {
+        size_t saved_rindex;
+        int r;
+
+        assert(p);
+
+        /* Like dns_packet_read_name(), but only validates the name
+         * and moves past it, without decompressing it */
+
+        saved_rindex = p->rindex;
+
+        for (;;) {
+                uint8_t c, d;
+
+                r = dns_packet_read_uint8(p, &c, NULL);
+                if (r < 0)
+                        goto fail;
+
+                if (c == 0)
+                        return 0;
+                else if (c <= 63) {
+                        r = dns_packet_read(p, c, NULL, NULL);
+                        if (r < 0)
+                                goto fail;
+                } else if (!p->refuse_compression && (c & 0xc0) == 0xc0) {
+                        uint16_t ptr;
+
+                        r = dns_packet_read_uint8(p, &d, NULL);
+                        if (r < 0)
+                                goto fail;
+
+                        /* A pointer always ends the name */
+                        ptr = (uint16_t) (c & ~0xc0) << 8 | (uint16_t) d;
+                        if (ptr < DNS_PACKET_HEADER_SIZE || ptr >= saved_rindex) {
+                                r = -EBADMSG;
+                                goto fail;
+                        }
+
+                        return 0;
+                } else {
+                        r = -EBADMSG;
+                        goto fail;
+                }
+        }
+
+fail:
+        dns_packet_rewind(p, saved_rindex);
+        return r;
+}
+
+static int dns_packet_skip_rr(DnsPacket *p, uint16_t *ret_type) {
+        uint16_t type, rdlength;
+        size_t saved_rindex;
+        int r;
+
+        assert(p);
+
+        saved_rindex = p->rindex;
+
+        r = dns_packet_skip_name(p);
+        if (r < 0)
+                goto fail;
+
+        r = dns_packet_read_uint16(p, &type, NULL);
+        if (r < 0)
+                goto fail;
+
+        /* Class and TTL */
+        r = dns_packet_read(p, 6, NULL, NULL);
+        if (r < 0)
+                goto fail;
+
+        r = dns_packet_read_uint16(p, &rdlength, NULL);
+        if (r < 0)
+                goto fail;
+
+        r = dns_packet_read(p, rdlength, NULL, NULL);
+        if (r < 0)
+                goto fail;
+
+        if (ret_type)
+                *ret_type = type;
+
+        return 0;
+
+fail:
+        dns_packet_rewind(p, saved_rindex);
+        return r;
+}
+
+int dns_packet_name_equal(DnsPacket *p, size_t offset, const char *name) {
+        size_t jump_barrier = offset;
+        const uint8_t *d;
+        int r, q, k, w;
+
+        assert(p);
+        assert(name);
+
+        /* Compares the (possibly compressed) name at the specified
+         * offset with a name in textual form, label by label, without
+         * decompressing it first. Follows dns_name_equal() in
+         * everything else. */
+
+        d = DNS_PACKET_DATA(p);
+
+        for (;;) {
+                char la[DNS_LABEL_MAX+1], lb[DNS_LABEL_MAX+1];
+                uint8_t c;
+
+                if (offset >= p->size)
+                        return -EBADMSG;
+
+                c = d[offset++];
+
+                if (!p->refuse_compression && (c & 0xc0) == 0xc0) {
+                        uint16_t ptr;
+
+                        if (offset >= p->size)
+                                return -EBADMSG;
+
+                        ptr = (uint16_t) (c & ~0xc0) << 8 | (uint16_t) d[offset];
+                        if (ptr < DNS_PACKET_HEADER_SIZE || ptr >= jump_barrier)
+                                return -EBADMSG;
+
+                        jump_barrier = offset = ptr;
+                        continue;
+                }
+
+                if (c > 63)
+                        return -EBADMSG;
+
+                if (c == 0 && *name == 0)
+                        return true;
+
+                if (offset + c > p->size)
+                        return -EBADMSG;
+
+                memcpy(la, d + offset, c);
+                r = c;
+                offset += c;
+
+                k = dns_label_undo_idna(la, r, la, sizeof(la));
+                if (k < 0)
+                        return k;
+                if (k > 0)
+                        r = k;
+
+                q = dns_label_unescape(&name, lb, sizeof(lb));
+                if (q < 0)
+                        return q;
+                w = dns_label_undo_idna(lb, q, lb, sizeof(lb));
+                if (w < 0)
+                        return w;
+                if (w > 0)
+                        q = w;
+
+                la[r] = lb[q] = 0;
+                if (strcasecmp(la, lb))
+                        return false;
+
+                if (c == 0)
+                        return false;
+        }
+}
+
+int dns_packet_question_matches(DnsPacket *p, const DnsResourceKey *key) {
+        uint16_t type, class;
+        size_t saved_rindex;
+        int r;
+
+        assert(p);
+        assert(key);
+
+        /* Checks whether the packet asks exactly for the specified
+         * key, straight from the wire, so that replies to somebody
+         * else's question can be refused before they are parsed */
+
+        if (DNS_PACKET_QDCOUNT(p) != 1)
+                return false;
+
+        saved_rindex = p->rindex;
+        dns_packet_rewind(p, DNS_PACKET_HEADER_SIZE);
+
+        r = dns_packet_skip_name(p);
+        if (r < 0)
+                goto finish;
+
+        r = dns_packet_read_uint16(p, &type, NULL);
+        if (r < 0)
+                goto finish;
+
+        r = dns_packet_read_uint16(p, &class, NULL);
+        if (r < 0)
+                goto finish;
+
+        if (type != key->type || class != key->class) {
+                r = false;
+                goto finish;
+        }
+
+        r = dns_packet_name_equal(p, DNS_PACKET_HEADER_SIZE, DNS_RESOURCE_KEY_NAME(key));
+
+finish:
+        p->rindex = saved_rindex;
+        return r;
+}
+
 static int dns_packet_read_type_window(DnsPacket *p, Bitmap **types, size_t *start) {
         uint8_t window;
         uint8_t length;
@@ -1805,6 +2012,23 @@ int dns_packet_extract(DnsPacket *p) {
                 for (i = 0; i < n; i++) {
                         _cleanup_(dns_resource_record_unrefp) DnsResourceRecord *rr = NULL;
 
+                        /* Beyond the answer section only SOA RRs are
+                         * used (for negative caching), skip over the
+                         * rest without decoding them */
+                        if (i >= DNS_PACKET_ANCOUNT(p)) {
+                                size_t start = p->rindex;
+                                uint16_t type;
+
+                                r = dns_packet_skip_rr(p, &type);
+                                if (r < 0)
+                                        goto finish;
+
+                                if (type != DNS_TYPE_SOA)
+                                        continue;
+
+                                dns_packet_rewind(p, start);
+                        }
+
                         r = dns_packet_read_rr(p, &rr, NULL);
                         if (r < 0)
                                 goto finish;
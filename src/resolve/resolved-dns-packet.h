@@ -172,6 +172,9 @@ int dns_packet_read_name(DnsPacket *p, char **ret,
 int dns_packet_read_key(DnsPacket *p, DnsResourceKey **ret, size_t *start);
 int dns_packet_read_rr(DnsPacket *p, DnsResourceRecord **ret, size_t *start);
 
+int dns_packet_name_equal(DnsPacket *p, size_t offset, const char *name);
+int dns_packet_question_matches(DnsPacket *p, const DnsResourceKey *key);
+
 void dns_packet_rewind(DnsPacket *p, size_t idx);
 
 int dns_packet_skip_question(DnsPacket *p);
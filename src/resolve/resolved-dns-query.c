@@ -154,6 +154,13 @@ static int dns_query_add_transaction(DnsQuery *q, DnsScope *s, DnsResourceKey *k
                 r = dns_transaction_new(&t, s, key);
                 if (r < 0)
                         return r;
+
+                q->manager->n_transactions_total++;
+        } else if (!set_contains(t->queries, q)) {
+                /* Somebody else already asked the same question on
+                 * this scope, piggyback on their transaction */
+                log_debug("Coalescing query with existing transaction on scope %s.", dns_protocol_to_string(s->protocol));
+                q->manager->n_transactions_coalesced++;
         }
 
         r = set_ensure_allocated(&t->queries, NULL);
@@ -34,6 +34,7 @@ struct DnsQuestion {
 };
 
 DnsQuestion *dns_question_new(unsigned n);
+int dns_question_new_address(DnsQuestion **ret, int family, const char *name);
 DnsQuestion *dns_question_ref(DnsQuestion *q);
 DnsQuestion *dns_question_unref(DnsQuestion *q);
 
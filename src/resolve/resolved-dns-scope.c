@@ -53,6 +53,7 @@ int dns_scope_new(Manager *m, DnsScope **ret, Link *l, DnsProtocol protocol, int
         s->protocol = protocol;
         s->family = family;
         s->resend_timeout = MULTICAST_RESEND_TIMEOUT_MIN_USEC;
+        dns_scope_apply_cache_limits(s);
 
         LIST_PREPEND(scopes, m->dns_scopes, s);
 
@@ -67,6 +68,17 @@ int dns_scope_new(Manager *m, DnsScope **ret, Link *l, DnsProtocol protocol, int
         return 0;
 }
 
+void dns_scope_apply_cache_limits(DnsScope *s) {
+        assert(s);
+
+        s->cache.n_max = s->manager->cache_max_entries;
+        s->cache.bytes_max = s->manager->cache_max_bytes;
+
+        /* multicast answers are not worth asking for again */
+        s->cache.prefetch = s->manager->cache_prefetch && s->protocol == DNS_PROTOCOL_DNS;
+        s->cache.stale_max = s->protocol == DNS_PROTOCOL_DNS ? s->manager->cache_serve_stale_usec : 0;
+}
+
 DnsScope* dns_scope_free(DnsScope *s) {
         DnsTransaction *t;
         DnsResourceRecord *rr;
@@ -131,6 +143,39 @@ void dns_scope_next_dns_server(DnsScope *s) {
                 manager_next_dns_server(s->manager);
 }
 
+void dns_scope_reconsider_dns_server(DnsScope *s, usec_t t) {
+        assert(s);
+
+        if (s->protocol != DNS_PROTOCOL_DNS)
+                return;
+
+        if (s->link)
+                link_reconsider_dns_server(s->link, t);
+        else
+                manager_reconsider_dns_server(s->manager, t);
+}
+
+DnsServer *dns_scope_get_race_dns_server(DnsScope *s, usec_t t) {
+        DnsServer *current;
+
+        assert(s);
+
+        /* The runner-up to the current server, to send the same
+         * queries to in parallel */
+
+        if (s->protocol != DNS_PROTOCOL_DNS || !s->manager->race_dns)
+                return NULL;
+
+        current = dns_scope_get_dns_server(s);
+        if (!current)
+                return NULL;
+
+        if (s->link)
+                return dns_server_pick(s->link->dns_servers, current, t);
+        else
+                return dns_server_pick(current->type == DNS_SERVER_FALLBACK ? s->manager->fallback_dns_servers : s->manager->dns_servers, current, t);
+}
+
 void dns_scope_packet_received(DnsScope *s, usec_t rtt) {
         assert(s);
 
@@ -312,8 +357,10 @@ static int dns_scope_socket(DnsScope *s, int type, int family, const union in_ad
         return ret;
 }
 
-int dns_scope_udp_dns_socket(DnsScope *s, DnsServer **server) {
-        return dns_scope_socket(s, SOCK_DGRAM, AF_UNSPEC, NULL, 53, server);
+int dns_scope_udp_dns_server_socket(DnsScope *s, DnsServer *server) {
+        assert(server);
+
+        return dns_scope_socket(s, SOCK_DGRAM, server->family, &server->address, 53, NULL);
 }
 
 int dns_scope_tcp_socket(DnsScope *s, int family, const union in_addr_union *address, uint16_t port, DnsServer **server) {
@@ -20,13 +20,29 @@
 ***/
 
 #include "siphash24.h"
+#include "random-util.h"
 
 #include "resolved-dns-server.h"
+#include "resolved-dns-transaction.h"
 
 /* After how much time to repeat classic DNS requests */
 #define DNS_TIMEOUT_MIN_USEC (500 * USEC_PER_MSEC)
 #define DNS_TIMEOUT_MAX_USEC (5 * USEC_PER_SEC)
 
+/* A shared socket is replaced after this many transactions, so that
+ * the source port keeps changing over time */
+#define DNS_SERVER_SOCKET_TRANSACTIONS_MAX 64
+
+/* How many replies to read at most per wakeup of a shared socket */
+#define DNS_SERVER_SOCKET_READ_MAX 16
+
+/* How long to avoid a server after it didn't answer, if there are others */
+#define DNS_SERVER_FAILED_HOLDOFF_USEC (30 * USEC_PER_SEC)
+
+/* Only switch to a faster server if it's at least this many times faster,
+ * as every switch flushes the cache */
+#define DNS_SERVER_SWITCH_FACTOR 2
+
 int dns_server_new(
                 Manager *m,
                 DnsServer **ret,
@@ -91,10 +107,266 @@ DnsServer* dns_server_ref(DnsServer *s)  {
         return s;
 }
 
+static DnsServerSocket* dns_server_socket_free(DnsServerSocket *k) {
+        if (!k)
+                return NULL;
+
+        sd_event_source_unref(k->event_source);
+        safe_close(k->fd);
+        free(k);
+
+        return NULL;
+}
+
+static void dns_server_socket_retire(DnsServerSocket *k) {
+        unsigned i;
+
+        assert(k);
+
+        if (!k->server)
+                return;
+
+        for (i = 0; i < DNS_SERVER_SOCKETS_MAX; i++)
+                if (k->server->sockets[i] == k)
+                        k->server->sockets[i] = NULL;
+
+        k->server = NULL;
+
+        /* Transactions still waiting for replies keep it open */
+        if (k->n_ref <= 0)
+                dns_server_socket_free(k);
+}
+
+DnsServerSocket* dns_server_socket_ref(DnsServerSocket *k) {
+        if (!k)
+                return NULL;
+
+        k->n_ref ++;
+
+        return k;
+}
+
+DnsServerSocket* dns_server_socket_unref(DnsServerSocket *k) {
+        if (!k)
+                return NULL;
+
+        assert(k->n_ref > 0);
+
+        k->n_ref --;
+
+        /* Idle sockets stay in the pool for the next transactions */
+        if (k->n_ref <= 0 && !k->server)
+                dns_server_socket_free(k);
+
+        return NULL;
+}
+
+static int on_dns_server_socket_packet(sd_event_source *s, int fd, uint32_t revents, void *userdata) {
+        DnsServerSocket *k = userdata;
+        unsigned n;
+        int r;
+
+        assert(k);
+
+        /* Completing the last transaction on the socket must not
+         * close it while we're still reading from it */
+        dns_server_socket_ref(k);
+
+        /* Read what's queued up, so that a burst of replies doesn't
+         * take a trip through the event loop each */
+        for (n = 0; n < DNS_SERVER_SOCKET_READ_MAX; n++) {
+                _cleanup_(dns_packet_unrefp) DnsPacket *p = NULL;
+                DnsTransaction *t;
+
+                r = manager_recv(k->manager, fd, DNS_PROTOCOL_DNS, &p);
+                if (r < 0) {
+                        /* Probably an ICMP error from the server. Let
+                         * the transactions on it time out, but don't
+                         * start any new ones on this socket. */
+                        log_debug_errno(r, "Failed to read from DNS server socket, retiring it: %m");
+                        dns_server_socket_retire(k);
+                        break;
+                }
+                if (r == 0)
+                        break;
+
+                if (dns_packet_validate_reply(p) <= 0) {
+                        log_debug("Invalid DNS packet.");
+                        continue;
+                }
+
+                t = hashmap_get(k->manager->dns_transactions, UINT_TO_PTR(DNS_PACKET_ID(p)));
+                if (!t) {
+                        log_debug("Reply for unknown transaction %" PRIu16 ", ignoring.", be16toh(DNS_PACKET_ID(p)));
+                        continue;
+                }
+
+                dns_transaction_udp_reply(t, k, p);
+        }
+
+        dns_server_socket_unref(k);
+
+        return 0;
+}
+
+int dns_server_get_socket(DnsServer *s, DnsScope *scope, DnsServerSocket **ret) {
+        _cleanup_close_ int fd = -1;
+        DnsServerSocket *k;
+        unsigned i;
+        int r;
+
+        assert(s);
+        assert(scope);
+        assert(ret);
+
+        /* Transactions share a few sockets per server, instead of
+         * opening one each. Which one is used is random, and every
+         * socket is only used for a limited number of transactions,
+         * so that the source port stays hard to guess. Replies are
+         * told apart by the transaction ID. */
+
+        i = random_u32() % DNS_SERVER_SOCKETS_MAX;
+
+        k = s->sockets[i];
+        if (k && k->n_transactions >= DNS_SERVER_SOCKET_TRANSACTIONS_MAX) {
+                dns_server_socket_retire(k);
+                k = NULL;
+        }
+
+        if (!k) {
+                fd = dns_scope_udp_dns_server_socket(scope, s);
+                if (fd < 0)
+                        return fd;
+
+                k = new0(DnsServerSocket, 1);
+                if (!k)
+                        return -ENOMEM;
+
+                r = sd_event_add_io(s->manager->event, &k->event_source, fd, EPOLLIN, on_dns_server_socket_packet, k);
+                if (r < 0) {
+                        free(k);
+                        return r;
+                }
+
+                k->fd = fd;
+                fd = -1;
+                k->manager = s->manager;
+                k->server = s;
+                s->sockets[i] = k;
+        }
+
+        k->n_transactions++;
+        *ret = dns_server_socket_ref(k);
+
+        return 0;
+}
+
+static int on_dns_server_stream_packet(DnsStream *stream) {
+        _cleanup_(dns_packet_unrefp) DnsPacket *p = NULL;
+        DnsTransaction *t;
+        int r;
+
+        assert(stream);
+
+        r = dns_stream_take_read_packet(stream, &p);
+        if (r < 0)
+                return r;
+
+        if (dns_packet_validate_reply(p) <= 0) {
+                log_debug("Invalid DNS TCP packet.");
+                return 0;
+        }
+
+        /* Replies may come in any order, tell them apart by ID */
+        t = hashmap_get(stream->manager->dns_transactions, UINT_TO_PTR(DNS_PACKET_ID(p)));
+        if (!t || t->shared_stream != stream) {
+                log_debug("Reply for transaction %" PRIu16 " not waiting on this connection, ignoring.", be16toh(DNS_PACKET_ID(p)));
+                return 0;
+        }
+
+        /* Note that this might free the stream */
+        dns_transaction_stream_reply(t, p);
+
+        return 0;
+}
+
+static int on_dns_server_stream_complete(DnsStream *stream, int error) {
+        DnsTransaction *t;
+
+        assert(stream);
+
+        /* The connection failed, was closed by the server, or was
+         * idle for too long. The next query opens a new one, and
+         * the ones still waiting for replies are tried again. */
+
+        if (stream->server) {
+                stream->server->stream = NULL;
+                stream->server = NULL;
+        }
+
+        while ((t = set_first(stream->transactions)))
+                dns_transaction_stream_lost(t, error);
+
+        dns_stream_free(stream);
+
+        return 0;
+}
+
+int dns_server_get_stream(DnsServer *s, DnsScope *scope, DnsStream **ret) {
+        _cleanup_close_ int fd = -1;
+        DnsStream *stream;
+        int r;
+
+        assert(s);
+        assert(scope);
+        assert(ret);
+
+        if (s->stream) {
+                *ret = s->stream;
+                return 0;
+        }
+
+        fd = dns_scope_tcp_socket(scope, s->family, &s->address, 53, NULL);
+        if (fd < 0)
+                return fd;
+
+        r = dns_stream_new(s->manager, &stream, DNS_PROTOCOL_DNS, fd);
+        if (r < 0)
+                return r;
+
+        fd = -1;
+
+        stream->persistent = true;
+        stream->server = s;
+        stream->on_packet = on_dns_server_stream_packet;
+        stream->complete = on_dns_server_stream_complete;
+
+        /* The interface index is difficult to determine if we are
+         * connecting to the local host, hence fill this in right away
+         * instead of determining it from the socket */
+        if (scope->link)
+                stream->ifindex = scope->link->ifindex;
+
+        s->stream = stream;
+        *ret = stream;
+
+        return 0;
+}
+
 static DnsServer* dns_server_free(DnsServer *s)  {
+        unsigned i;
+
         if (!s)
                 return NULL;
 
+        for (i = 0; i < DNS_SERVER_SOCKETS_MAX; i++)
+                if (s->sockets[i])
+                        dns_server_socket_retire(s->sockets[i]);
+
+        /* Transactions keep their server referenced, so none can be
+         * waiting on the connection anymore */
+        dns_stream_free(s->stream);
+
         if (s->link && s->link->current_dns_server == s)
                 link_set_dns_server(s->link, NULL);
 
@@ -128,6 +400,14 @@ void dns_server_packet_received(DnsServer *s, usec_t rtt) {
                 s->resend_timeout = MIN(MAX(DNS_TIMEOUT_MIN_USEC, s->max_rtt * 2),
                                         DNS_TIMEOUT_MAX_USEC);
         }
+
+        /* Same weight as TCP gives new samples, see RFC 6298 */
+        if (s->srtt <= 0)
+                s->srtt = MAX(rtt, 1U);
+        else
+                s->srtt = MAX(s->srtt - s->srtt / 8 + rtt / 8, 1U);
+
+        s->failed_usec = 0;
 }
 
 void dns_server_packet_lost(DnsServer *s, usec_t usec) {
@@ -135,6 +415,67 @@ void dns_server_packet_lost(DnsServer *s, usec_t usec) {
 
         if (s->resend_timeout <= usec)
                 s->resend_timeout = MIN(s->resend_timeout * 2, DNS_TIMEOUT_MAX_USEC);
+
+        s->failed_usec = now(clock_boottime_or_monotonic());
+}
+
+bool dns_server_is_healthy(DnsServer *s, usec_t t) {
+        assert(s);
+
+        return s->failed_usec <= 0 || t >= s->failed_usec + DNS_SERVER_FAILED_HOLDOFF_USEC;
+}
+
+static bool dns_server_better(DnsServer *a, DnsServer *b) {
+        /* Servers we know the speed of go first, the others
+         * keep their configured order */
+
+        if (!b)
+                return true;
+        if (a->srtt <= 0)
+                return false;
+
+        return b->srtt <= 0 || a->srtt < b->srtt;
+}
+
+DnsServer *dns_server_pick(DnsServer *first, DnsServer *exclude, usec_t t) {
+        DnsServer *s, *best = NULL;
+
+        /* Returns the fastest healthy server in the list, or NULL if
+         * there is none except for the one to exclude */
+
+        LIST_FOREACH(servers, s, first) {
+                if (s == exclude)
+                        continue;
+
+                if (!dns_server_is_healthy(s, t))
+                        continue;
+
+                if (dns_server_better(s, best))
+                        best = s;
+        }
+
+        return best;
+}
+
+DnsServer *dns_server_pick_faster(DnsServer *first, DnsServer *current, usec_t t) {
+        DnsServer *best;
+
+        assert(current);
+
+        /* Returns a server that turned out to be clearly faster than
+         * the current one, or NULL if it's best to stay */
+
+        if (current->srtt <= 0)
+                return NULL;
+
+        best = dns_server_pick(first, current, t);
+        if (!best || best->srtt <= 0)
+                return NULL;
+
+        if (best->srtt * DNS_SERVER_SWITCH_FACTOR > current->srtt)
+                return NULL;
+
+        return best;
 }
 
 static unsigned long dns_server_hash_func(const void *p, const uint8_t hash_key[HASH_KEY_SIZE]) {
@@ -21,9 +21,12 @@
   along with systemd; If not, see <http://www.gnu.org/licenses/>.
 ***/
 
+#include "sd-event.h"
+
 #include "in-addr-util.h"
 
 typedef struct DnsServer DnsServer;
+typedef struct DnsServerSocket DnsServerSocket;
 typedef enum DnsServerSource DnsServerSource;
 
 typedef enum DnsServerType {
@@ -34,6 +37,24 @@ typedef enum DnsServerType {
 
 #include "resolved-link.h"
 
+/* How many UDP sockets the transactions talking to a server share at most */
+#define DNS_SERVER_SOCKETS_MAX 8
+
+struct DnsServerSocket {
+        Manager *manager;
+
+        unsigned n_ref;
+
+        /* NULL once the socket is retired from the server's pool */
+        DnsServer *server;
+
+        /* Transactions started on it so far */
+        unsigned n_transactions;
+
+        int fd;
+        sd_event_source *event_source;
+};
+
 struct DnsServer {
         Manager *manager;
 
@@ -49,6 +70,18 @@ struct DnsServer {
         usec_t resend_timeout;
         usec_t max_rtt;
 
+        /* Smoothed round-trip time, 0 if never measured */
+        usec_t srtt;
+        /* When the server last failed to answer, 0 if it answered since */
+        usec_t failed_usec;
+
+        /* Transactions pick one of these at random, so that the
+         * source port of the queries varies */
+        DnsServerSocket *sockets[DNS_SERVER_SOCKETS_MAX];
+
+        /* The TCP connection, kept open and shared by all transactions */
+        DnsStream *stream;
+
         bool marked:1;
 
         LIST_FIELDS(DnsServer, servers);
@@ -68,6 +101,16 @@ DnsServer* dns_server_unref(DnsServer *s);
 void dns_server_packet_received(DnsServer *s, usec_t rtt);
 void dns_server_packet_lost(DnsServer *s, usec_t usec);
 
+int dns_server_get_socket(DnsServer *s, DnsScope *scope, DnsServerSocket **ret);
+DnsServerSocket* dns_server_socket_ref(DnsServerSocket *k);
+DnsServerSocket* dns_server_socket_unref(DnsServerSocket *k);
+
+int dns_server_get_stream(DnsServer *s, DnsScope *scope, DnsStream **ret);
+
+bool dns_server_is_healthy(DnsServer *s, usec_t t);
+DnsServer *dns_server_pick(DnsServer *first, DnsServer *exclude, usec_t t);
+DnsServer *dns_server_pick_faster(DnsServer *first, DnsServer *current, usec_t t);
+
 DEFINE_TRIVIAL_CLEANUP_FUNC(DnsServer*, dns_server_unref);
 
 extern const struct hash_ops dns_server_hash_ops;
@@ -48,6 +48,34 @@ static int dns_stream_update_io(DnsStream *s) {
         return sd_event_source_set_io_events(s->io_event_source, f);
 }
 
+static int dns_stream_bump_timeout(DnsStream *s) {
+        assert(s);
+
+        /* Persistent streams only time out when idle */
+        if (!s->persistent)
+                return 0;
+
+        return sd_event_source_set_time(s->timeout_event_source, now(clock_boottime_or_monotonic()) + DNS_STREAM_TIMEOUT_USEC);
+}
+
+static int dns_stream_write_next(DnsStream *s) {
+        assert(s);
+
+        /* Move on to the next queued packet, if there is one */
+
+        s->write_packet = dns_packet_unref(s->write_packet);
+        s->n_written = 0;
+
+        if (s->n_write_queue > 0) {
+                s->write_packet = s->write_queue[0];
+                s->write_size = htobe16(s->write_packet->size);
+
+                memmove(s->write_queue, s->write_queue + 1, --s->n_write_queue * sizeof(DnsPacket*));
+        }
+
+        return dns_stream_update_io(s);
+}
+
 static int dns_stream_complete(DnsStream *s, int error) {
         assert(s);
 
@@ -225,9 +253,15 @@ static int on_stream_io(sd_event_source *es, int fd, uint32_t revents, void *use
                 } else
                         s->n_written += ss;
 
-                /* Are we done? If so, disable the event source for EPOLLOUT */
+                /* Are we done? If so, disable the event source for
+                 * EPOLLOUT, or continue with the next packet */
                 if (s->n_written >= sizeof(s->write_size) + s->write_packet->size) {
-                        r = dns_stream_update_io(s);
+                        if (s->persistent) {
+                                r = dns_stream_bump_timeout(s);
+                                if (r >= 0)
+                                        r = dns_stream_write_next(s);
+                        } else
+                                r = dns_stream_update_io(s);
                         if (r < 0)
                                 return dns_stream_complete(s, -r);
                 }
@@ -315,7 +349,8 @@ static int on_stream_io(sd_event_source *es, int fd, uint32_t revents, void *use
                 }
         }
 
-        if ((s->write_packet && s->n_written >= sizeof(s->write_size) + s->write_packet->size) &&
+        if (!s->persistent &&
+            (s->write_packet && s->n_written >= sizeof(s->write_size) + s->write_packet->size) &&
             (s->read_packet && s->n_read >= sizeof(s->read_size) + s->read_packet->size))
                 return dns_stream_complete(s, 0);
 
@@ -323,6 +358,8 @@ static int on_stream_io(sd_event_source *es, int fd, uint32_t revents, void *use
 }
 
 DnsStream *dns_stream_free(DnsStream *s) {
+        size_t i;
+
         if (!s)
                 return NULL;
 
@@ -336,6 +373,12 @@ DnsStream *dns_stream_free(DnsStream *s) {
         dns_packet_unref(s->write_packet);
         dns_packet_unref(s->read_packet);
 
+        for (i = 0; i < s->n_write_queue; i++)
+                dns_packet_unref(s->write_queue[i]);
+        free(s->write_queue);
+
+        set_free(s->transactions);
+
         free(s);
 
         return 0;
@@ -392,8 +435,18 @@ int dns_stream_new(Manager *m, DnsStream **ret, DnsProtocol protocol, int fd) {
 int dns_stream_write_packet(DnsStream *s, DnsPacket *p) {
         assert(s);
 
-        if (s->write_packet)
-                return -EBUSY;
+        if (s->write_packet) {
+                if (!s->persistent)
+                        return -EBUSY;
+
+                /* Queries are pipelined, the server may answer them
+                 * in any order */
+                if (!GREEDY_REALLOC(s->write_queue, s->n_write_queue_allocated, s->n_write_queue + 1))
+                        return -ENOMEM;
+
+                s->write_queue[s->n_write_queue++] = dns_packet_ref(p);
+                return 0;
+        }
 
         s->write_packet = dns_packet_ref(p);
         s->write_size = htobe16(p->size);
@@ -401,3 +454,26 @@ int dns_stream_write_packet(DnsStream *s, DnsPacket *p) {
 
         return dns_stream_update_io(s);
 }
+
+int dns_stream_take_read_packet(DnsStream *s, DnsPacket **ret) {
+        int r;
+
+        assert(s);
+        assert(ret);
+
+        /* Hands out the packet just read, for streams that shall
+         * continue with reading the next one */
+
+        if (!s->read_packet || s->n_read < sizeof(s->read_size) + s->read_packet->size)
+                return -EAGAIN;
+
+        *ret = s->read_packet;
+        s->read_packet = NULL;
+        s->n_read = 0;
+
+        r = dns_stream_bump_timeout(s);
+        if (r < 0)
+                return r;
+
+        return dns_stream_update_io(s);
+}
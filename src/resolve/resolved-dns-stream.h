@@ -54,6 +54,17 @@ struct DnsStream {
 
         DnsTransaction *transaction;
 
+        /* Streams to unicast DNS servers carry any number of queries
+         * and replies, and are only closed when idle for a while */
+        bool persistent;
+        DnsPacket **write_queue;
+        size_t n_write_queue, n_write_queue_allocated;
+
+        /* For persistent streams: the server, and the transactions
+         * waiting for replies */
+        DnsServer *server;
+        Set *transactions;
+
         LIST_FIELDS(DnsStream, streams);
 };
 
@@ -61,3 +72,4 @@ int dns_stream_new(Manager *m, DnsStream **s, DnsProtocol protocol, int fd);
 DnsStream *dns_stream_free(DnsStream *s);
 
 int dns_stream_write_packet(DnsStream *s, DnsPacket *p);
+int dns_stream_take_read_packet(DnsStream *s, DnsPacket **ret);
@@ -26,6 +26,16 @@
 #include "random-util.h"
 #include "dns-domain.h"
 
+static void dns_transaction_leave_stream(DnsTransaction *t) {
+        assert(t);
+
+        if (!t->shared_stream)
+                return;
+
+        set_remove(t->shared_stream->transactions, t);
+        t->shared_stream = NULL;
+}
+
 DnsTransaction* dns_transaction_free(DnsTransaction *t) {
         DnsQuery *q;
         DnsZoneItem *i;
@@ -39,11 +49,13 @@ DnsTransaction* dns_transaction_free(DnsTransaction *t) {
         dns_packet_unref(t->received);
         dns_answer_unref(t->cached);
 
-        sd_event_source_unref(t->dns_udp_event_source);
-        safe_close(t->dns_udp_fd);
+        dns_server_socket_unref(t->dns_socket);
+        dns_server_socket_unref(t->race_socket);
 
         dns_server_unref(t->server);
+        dns_server_unref(t->race_server);
         dns_stream_free(t->stream);
+        dns_transaction_leave_stream(t);
 
         if (t->scope) {
                 hashmap_remove(t->scope->transactions, t->key);
@@ -98,7 +110,6 @@ int dns_transaction_new(DnsTransaction **ret, DnsScope *s, DnsResourceKey *key)
         if (!t)
                 return -ENOMEM;
 
-        t->dns_udp_fd = -1;
         t->key = dns_resource_key_ref(key);
 
         /* Find a fresh, unused transaction id */
@@ -134,6 +145,7 @@ static void dns_transaction_stop(DnsTransaction *t) {
 
         t->timeout_event_source = sd_event_source_unref(t->timeout_event_source);
         t->stream = dns_stream_free(t->stream);
+        dns_transaction_leave_stream(t);
 }
 
 static void dns_transaction_tentative(DnsTransaction *t, DnsPacket *p) {
@@ -250,6 +262,49 @@ static int on_stream_complete(DnsStream *s, int error) {
         return 0;
 }
 
+static int dns_transaction_open_server_tcp(DnsTransaction *t) {
+        DnsServer *server;
+        DnsStream *stream;
+        int r;
+
+        assert(t);
+
+        /* Ask the server that sent the truncated reply, if there
+         * was one. Its TCP connection is kept open and shared by
+         * all transactions. */
+        server = t->server ?: dns_scope_get_dns_server(t->scope);
+        if (!server)
+                return -ESRCH;
+
+        r = dns_server_get_stream(server, t->scope, &stream);
+        if (r < 0)
+                return r;
+
+        r = set_ensure_allocated(&stream->transactions, NULL);
+        if (r < 0)
+                return r;
+
+        r = set_put(stream->transactions, t);
+        if (r < 0)
+                return r;
+
+        r = dns_stream_write_packet(stream, t->sent);
+        if (r < 0) {
+                set_remove(stream->transactions, t);
+                return r;
+        }
+
+        if (t->server != server) {
+                dns_server_unref(t->server);
+                t->server = dns_server_ref(server);
+        }
+
+        t->received = dns_packet_unref(t->received);
+        t->shared_stream = stream;
+
+        return 0;
+}
+
 static int dns_transaction_open_tcp(DnsTransaction *t) {
         DnsServer *server = NULL;
         _cleanup_close_ int fd = -1;
@@ -257,13 +312,12 @@ static int dns_transaction_open_tcp(DnsTransaction *t) {
 
         assert(t);
 
-        if (t->stream)
+        if (t->stream || t->shared_stream)
                 return 0;
 
         switch (t->scope->protocol) {
         case DNS_PROTOCOL_DNS:
-                fd = dns_scope_tcp_socket(t->scope, AF_UNSPEC, NULL, 53, &server);
-                break;
+                return dns_transaction_open_server_tcp(t);
 
         case DNS_PROTOCOL_LLMNR:
                 /* When we already received a reply to this (but it was truncated), send to its sender address */
@@ -328,8 +382,10 @@ static void dns_transaction_next_dns_server(DnsTransaction *t) {
         assert(t);
 
         t->server = dns_server_unref(t->server);
-        t->dns_udp_event_source = sd_event_source_unref(t->dns_udp_event_source);
-        t->dns_udp_fd = safe_close(t->dns_udp_fd);
+        t->dns_socket = dns_server_socket_unref(t->dns_socket);
+
+        t->race_server = dns_server_unref(t->race_server);
+        t->race_socket = dns_server_socket_unref(t->race_socket);
 
         dns_scope_next_dns_server(t->scope);
 }
@@ -405,6 +461,9 @@ void dns_transaction_process_reply(DnsTransaction *t, DnsPacket *p) {
 
                 dns_server_packet_received(t->server, ts - t->start_usec);
 
+                /* Maybe another server turned out to be faster */
+                dns_scope_reconsider_dns_server(t->scope, ts);
+
                 break;
         case DNS_PROTOCOL_LLMNR:
         case DNS_PROTOCOL_MDNS:
@@ -444,21 +503,24 @@ void dns_transaction_process_reply(DnsTransaction *t, DnsPacket *p) {
                 }
         }
 
-        /* Parse and update the cache */
-        r = dns_packet_extract(p);
-        if (r < 0) {
+        /* Only consider responses with equivalent query section to
+         * the request, checked before anything is decoded */
+        if (dns_packet_question_matches(p, t->key) <= 0) {
                 dns_transaction_complete(t, DNS_TRANSACTION_INVALID_REPLY);
                 return;
         }
 
-        /* Only consider responses with equivalent query section to the request */
-        if (p->question->n_keys != 1 || dns_resource_key_equal(p->question->keys[0], t->key) <= 0) {
+        /* Parse and update the cache */
+        r = dns_packet_extract(p);
+        if (r < 0) {
                 dns_transaction_complete(t, DNS_TRANSACTION_INVALID_REPLY);
                 return;
         }
 
-        /* According to RFC 4795, section 2.9. only the RRs from the answer section shall be cached */
-        dns_cache_put(&t->scope->cache, t->key, DNS_PACKET_RCODE(p), p->answer, DNS_PACKET_ANCOUNT(p), 0, p->family, &p->sender);
+        /* According to RFC 4795, section 2.9. only the RRs from the answer section shall be cached.
+         * A refresh that failed on the server side shouldn't replace what we might still serve stale. */
+        if (!t->prefetch || IN_SET(DNS_PACKET_RCODE(p), DNS_RCODE_SUCCESS, DNS_RCODE_NXDOMAIN))
+                dns_cache_put(&t->scope->cache, t->key, DNS_PACKET_RCODE(p), p->answer, DNS_PACKET_ANCOUNT(p), 0, p->family, &p->sender);
 
         if (DNS_PACKET_RCODE(p) == DNS_RCODE_SUCCESS)
                 dns_transaction_complete(t, DNS_TRANSACTION_SUCCESS);
@@ -466,25 +528,69 @@ void dns_transaction_process_reply(DnsTransaction *t, DnsPacket *p) {
                 dns_transaction_complete(t, DNS_TRANSACTION_FAILURE);
 }
 
-static int on_dns_packet(sd_event_source *s, int fd, uint32_t revents, void *userdata) {
-        _cleanup_(dns_packet_unrefp) DnsPacket *p = NULL;
-        DnsTransaction *t = userdata;
+static void dns_transaction_race_won(DnsTransaction *t) {
+        DnsServerSocket *sock;
+        DnsServer *server;
+
+        assert(t);
+
+        /* The runner-up answered first, so from now on it's the
+         * server this transaction talks to */
+
+        server = t->server;
+        t->server = t->race_server;
+        t->race_server = server;
+
+        sock = t->dns_socket;
+        t->dns_socket = t->race_socket;
+        t->race_socket = sock;
+}
+
+void dns_transaction_udp_reply(DnsTransaction *t, DnsServerSocket *sock, DnsPacket *p) {
+        assert(t);
+        assert(sock);
+        assert(p);
+
+        /* Replies are matched by their ID, but only count if they
+         * came in on a socket the transaction is currently waiting
+         * on. The other server of a race usually answers late. */
+        if (t->state != DNS_TRANSACTION_PENDING ||
+            (sock != t->dns_socket && sock != t->race_socket)) {
+                log_debug("Reply for transaction %" PRIu16 " on unexpected socket, ignoring.", be16toh(t->id));
+                return;
+        }
+
+        if (sock == t->race_socket)
+                dns_transaction_race_won(t);
+
+        dns_transaction_process_reply(t, p);
+}
+
+void dns_transaction_stream_reply(DnsTransaction *t, DnsPacket *p) {
+        assert(t);
+        assert(p);
+
+        if (t->state != DNS_TRANSACTION_PENDING)
+                return;
+
+        dns_transaction_process_reply(t, p);
+}
+
+void dns_transaction_stream_lost(DnsTransaction *t, int error) {
         int r;
 
         assert(t);
-        assert(t->scope);
 
-        r = manager_recv(t->scope->manager, fd, DNS_PROTOCOL_DNS, &p);
-        if (r <= 0)
-                return r;
+        /* Servers may close idle connections at any time, so a query
+         * sent just then deserves another try */
 
-        if (dns_packet_validate_reply(p) > 0 &&
-            DNS_PACKET_ID(p) == t->id)
-                dns_transaction_process_reply(t, p);
-        else
-                log_debug("Invalid DNS packet.");
+        log_debug_errno(error, "Connection to DNS server lost, retrying transaction %" PRIu16 ": %m", be16toh(t->id));
 
-        return 0;
+        dns_transaction_leave_stream(t);
+
+        r = dns_transaction_go(t);
+        if (r < 0)
+                dns_transaction_complete(t, DNS_TRANSACTION_RESOURCES);
 }
 
 static int dns_transaction_emit(DnsTransaction *t) {
@@ -493,26 +599,36 @@ static int dns_transaction_emit(DnsTransaction *t) {
         assert(t);
 
         if (t->scope->protocol == DNS_PROTOCOL_DNS && !t->server) {
-                DnsServer *server = NULL;
-                _cleanup_close_ int fd = -1;
+                DnsServer *server;
 
-                fd = dns_scope_udp_dns_socket(t->scope, &server);
-                if (fd < 0)
-                        return fd;
+                server = dns_scope_get_dns_server(t->scope);
+                if (!server)
+                        return -ESRCH;
 
-                r = sd_event_add_io(t->scope->manager->event, &t->dns_udp_event_source, fd, EPOLLIN, on_dns_packet, t);
+                r = dns_server_get_socket(server, t->scope, &t->dns_socket);
                 if (r < 0)
                         return r;
 
-                t->dns_udp_fd = fd;
-                fd = -1;
                 t->server = dns_server_ref(server);
+
+                server = dns_scope_get_race_dns_server(t->scope, t->start_usec);
+                if (server) {
+                        r = dns_server_get_socket(server, t->scope, &t->race_socket);
+                        if (r < 0)
+                                log_debug_errno(r, "Failed to open socket to second DNS server, not racing: %m");
+                        else
+                                t->race_server = dns_server_ref(server);
+                }
         }
 
-        r = dns_scope_emit(t->scope, t->dns_udp_fd, t->sent);
+        r = dns_scope_emit(t->scope, t->dns_socket ? t->dns_socket->fd : -1, t->sent);
         if (r < 0)
                 return r;
 
+        /* The race is a bonus, it doesn't matter if it can't be started */
+        if (t->race_socket)
+                (void) dns_scope_emit(t->scope, t->race_socket->fd, t->sent);
+
         return 0;
 }
 
@@ -523,15 +639,16 @@ static int on_transaction_timeout(sd_event_source *s, usec_t usec, void *userdat
         assert(s);
         assert(t);
 
-        /* Timeout reached? Try again, with a new server */
-        dns_transaction_next_dns_server(t);
-
-        /* ... and possibly increased timeout */
+        /* Timeout reached? Possibly increase the timeout, and
+         * remember that the server didn't answer... */
         if (t->server)
                 dns_server_packet_lost(t->server, usec - t->start_usec);
         else
                 dns_scope_packet_lost(t->scope, usec - t->start_usec);
 
+        /* ... and try again, with a new server */
+        dns_transaction_next_dns_server(t);
+
         r = dns_transaction_go(t);
         if (r < 0)
                 dns_transaction_complete(t, DNS_TRANSACTION_RESOURCES);
@@ -625,8 +742,9 @@ int dns_transaction_go(DnsTransaction *t) {
         t->cached_rcode = 0;
 
         /* Check the cache, but only if this transaction is not used
-         * for probing or verifying a zone item. */
-        if (set_isempty(t->zone_items)) {
+         * for probing or verifying a zone item, or refreshing the
+         * cache itself. */
+        if (set_isempty(t->zone_items) && !t->prefetch) {
 
                 /* Before trying the cache, let's make sure we figured out a
                  * server to use. Should this cause a change of server this
@@ -640,10 +758,24 @@ int dns_transaction_go(DnsTransaction *t) {
                 if (r < 0)
                         return r;
                 if (r > 0) {
+                        _cleanup_(dns_resource_key_unrefp) DnsResourceKey *key = NULL;
+                        DnsScope *scope = t->scope;
+
+                        if (dns_cache_take_prefetch(&scope->cache, t->key, ts))
+                                key = dns_resource_key_ref(t->key);
+
                         if (t->cached_rcode == DNS_RCODE_SUCCESS)
                                 dns_transaction_complete(t, DNS_TRANSACTION_SUCCESS);
                         else
                                 dns_transaction_complete(t, DNS_TRANSACTION_FAILURE);
+
+                        /* t is likely gone by now */
+                        if (key) {
+                                r = dns_transaction_prefetch(scope, key);
+                                if (r < 0)
+                                        log_debug_errno(r, "Failed to refresh cache entry, ignoring: %m");
+                        }
+
                         return 0;
                 }
         }
@@ -730,6 +862,35 @@ int dns_transaction_go(DnsTransaction *t) {
         return 1;
 }
 
+int dns_transaction_prefetch(DnsScope *s, DnsResourceKey *key) {
+        DnsTransaction *t;
+        int r;
+
+        assert(s);
+        assert(key);
+
+        /* Somebody still holds on to a transaction for the key, try
+         * again on one of the next cache hits */
+        if (hashmap_get(s->transactions, key))
+                return 0;
+
+        r = dns_transaction_new(&t, s, key);
+        if (r < 0)
+                return r;
+
+        t->prefetch = true;
+
+        /* Nobody waits for the result, the reply just ends up in the
+         * cache, and the transaction is freed once complete */
+        r = dns_transaction_go(t);
+        if (r < 0) {
+                dns_transaction_complete(t, DNS_TRANSACTION_RESOURCES);
+                return r;
+        }
+
+        return 1;
+}
+
 static const char* const dns_transaction_state_table[_DNS_TRANSACTION_STATE_MAX] = {
         [DNS_TRANSACTION_NULL] = "null",
         [DNS_TRANSACTION_PENDING] = "pending",
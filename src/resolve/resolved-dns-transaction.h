@@ -54,6 +54,10 @@ struct DnsTransaction {
 
         bool initial_jitter;
 
+        /* Refreshing a cache entry before it expires, so the cache
+         * must not answer it */
+        bool prefetch;
+
         DnsPacket *sent, *received;
         DnsAnswer *cached;
         int cached_rcode;
@@ -62,15 +66,22 @@ struct DnsTransaction {
         sd_event_source *timeout_event_source;
         unsigned n_attempts;
 
-        int dns_udp_fd;
-        sd_event_source *dns_udp_event_source;
-
-        /* The active server */
+        /* The active server, and the UDP socket shared with other
+         * transactions we talk to it on */
         DnsServer *server;
+        DnsServerSocket *dns_socket;
+
+        /* The runner-up server the query is raced against, if enabled */
+        DnsServer *race_server;
+        DnsServerSocket *race_socket;
 
         /* TCP connection logic, if we need it */
         DnsStream *stream;
 
+        /* The TCP connection to the server, shared with other
+         * transactions, if we need it */
+        DnsStream *shared_stream;
+
         /* Queries this transaction is referenced by and that shall be
          * notified about this specific transaction completing. */
         Set *queries;
@@ -89,8 +100,12 @@ DnsTransaction* dns_transaction_free(DnsTransaction *t);
 
 void dns_transaction_gc(DnsTransaction *t);
 int dns_transaction_go(DnsTransaction *t);
+int dns_transaction_prefetch(DnsScope *s, DnsResourceKey *key);
 
 void dns_transaction_process_reply(DnsTransaction *t, DnsPacket *p);
+void dns_transaction_udp_reply(DnsTransaction *t, DnsServerSocket *sock, DnsPacket *p);
+void dns_transaction_stream_reply(DnsTransaction *t, DnsPacket *p);
+void dns_transaction_stream_lost(DnsTransaction *t, int error);
 void dns_transaction_complete(DnsTransaction *t, DnsTransactionState state);
 
 const char* dns_transaction_state_to_string(DnsTransactionState p) _const_;
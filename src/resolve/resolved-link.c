@@ -341,11 +341,19 @@ DnsServer *link_get_dns_server(Link *l) {
 }
 
 void link_next_dns_server(Link *l) {
+        DnsServer *s;
+
         assert(l);
 
         if (!l->current_dns_server)
                 return;
 
+        s = dns_server_pick(l->dns_servers, l->current_dns_server, now(clock_boottime_or_monotonic()));
+        if (s) {
+                link_set_dns_server(l, s);
+                return;
+        }
+
         if (l->current_dns_server->servers_next) {
                 link_set_dns_server(l, l->current_dns_server->servers_next);
                 return;
@@ -354,6 +362,19 @@ void link_next_dns_server(Link *l) {
         link_set_dns_server(l, l->dns_servers);
 }
 
+void link_reconsider_dns_server(Link *l, usec_t t) {
+        DnsServer *s;
+
+        assert(l);
+
+        if (!l->current_dns_server)
+                return;
+
+        s = dns_server_pick_faster(l->dns_servers, l->current_dns_server, t);
+        if (s)
+                link_set_dns_server(l, s);
+}
+
 int link_address_new(Link *l, LinkAddress **ret, int family, const union in_addr_union *in_addr) {
         LinkAddress *a;
 
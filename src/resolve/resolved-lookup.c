@@ -0,0 +1,249 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <sys/stat.h>
+
+#include "socket-util.h"
+#include "dns-domain.h"
+#include "resolved-def.h"
+#include "resolved-lookup.h"
+
+static void lookup_query_complete(DnsQuery *q) {
+        assert(q);
+
+        /* The client was already told to ask via the bus, which
+         * joined this query's transactions. Nothing left to do. */
+
+        dns_query_free(q);
+}
+
+static size_t lookup_make_reply(DnsQuery *q, ResolveLookupReply *reply) {
+        const char *canonical = NULL;
+        size_t l;
+        unsigned i;
+
+        assert(reply);
+
+        reply->status = SD_RESOLVED_LOOKUP_MISS;
+        reply->n_addresses = 0;
+
+        if (!q)
+                goto miss;
+
+        if (q->state == DNS_TRANSACTION_FAILURE && q->answer_rcode == DNS_RCODE_NXDOMAIN) {
+                reply->status = SD_RESOLVED_LOOKUP_NXDOMAIN;
+                return sizeof(ResolveLookupReply);
+        }
+
+        if (q->state != DNS_TRANSACTION_SUCCESS || !q->answer)
+                goto miss;
+
+        for (i = 0; i < q->answer->n_rrs; i++) {
+                DnsResourceRecord *rr = q->answer->items[i].rr;
+                ResolveLookupAddress *a;
+
+                /* CNAME chains that need to be followed are left to
+                 * the bus */
+                if (dns_question_matches_rr(q->question, rr) <= 0)
+                        continue;
+
+                if (reply->n_addresses >= SD_RESOLVED_LOOKUP_ADDRESSES_MAX)
+                        goto miss;
+
+                a = reply->addresses + reply->n_addresses;
+                zero(*a);
+                a->ifindex = q->answer->items[i].ifindex;
+
+                if (rr->key->type == DNS_TYPE_A) {
+                        a->family = AF_INET;
+                        memcpy(a->address, &rr->a.in_addr, sizeof(struct in_addr));
+                } else if (rr->key->type == DNS_TYPE_AAAA) {
+                        a->family = AF_INET6;
+                        memcpy(a->address, &rr->aaaa.in6_addr, sizeof(struct in6_addr));
+                } else
+                        continue;
+
+                if (!canonical)
+                        canonical = DNS_RESOURCE_KEY_NAME(rr->key);
+
+                reply->n_addresses++;
+        }
+
+        if (!canonical)
+                goto miss;
+
+        l = strlen(canonical);
+        if (l > SD_RESOLVED_LOOKUP_NAME_MAX)
+                goto miss;
+
+        reply->status = SD_RESOLVED_LOOKUP_SUCCESS;
+        memcpy(reply->addresses + reply->n_addresses, canonical, l + 1);
+
+        return sizeof(ResolveLookupReply) + reply->n_addresses * sizeof(ResolveLookupAddress) + l + 1;
+
+miss:
+        reply->status = SD_RESOLVED_LOOKUP_MISS;
+        reply->n_addresses = 0;
+        return sizeof(ResolveLookupReply);
+}
+
+static DnsQuery *lookup_start_query(Manager *m, const ResolveLookupRequest *request) {
+        _cleanup_(dns_question_unrefp) DnsQuestion *question = NULL;
+        uint64_t flags;
+        DnsQuery *q;
+        int r;
+
+        assert(m);
+        assert(request);
+
+        /* Invalid requests are not answered here, the bus call will
+         * return a proper error for them */
+
+        if (request->ifindex < 0)
+                return NULL;
+
+        flags = request->flags;
+        if (flags & ~SD_RESOLVED_FLAGS_ALL)
+                return NULL;
+        if (flags == 0)
+                flags = SD_RESOLVED_FLAGS_DEFAULT;
+
+        if (dns_name_normalize(request->name, NULL) < 0)
+                return NULL;
+
+        r = dns_question_new_address(&question, request->family, request->name);
+        if (r < 0)
+                return NULL;
+
+        r = dns_query_new(m, &q, question, request->ifindex, flags);
+        if (r < 0)
+                return NULL;
+
+        /* Cache hits and synthesized records complete the query
+         * synchronously, before dns_query_go() returns */
+        r = dns_query_go(q);
+        if (r < 0) {
+                dns_query_free(q);
+                return NULL;
+        }
+
+        if (q->state == DNS_TRANSACTION_PENDING) {
+                /* Keep the lookup going, so that it is already
+                 * under way when the client falls back to the bus */
+                q->complete = lookup_query_complete;
+                return NULL;
+        }
+
+        return q;
+}
+
+static int on_lookup_request(sd_event_source *s, int fd, uint32_t revents, void *userdata) {
+        union {
+                ResolveLookupRequest request;
+                uint8_t buf[RESOLVE_LOOKUP_REQUEST_SIZE_MAX];
+        } request;
+        union {
+                ResolveLookupReply reply;
+                uint8_t buf[RESOLVE_LOOKUP_REPLY_SIZE_MAX];
+        } reply;
+        union sockaddr_union sa;
+        socklen_t salen = sizeof(sa);
+        Manager *m = userdata;
+        DnsQuery *q;
+        size_t size;
+        ssize_t n;
+
+        assert(m);
+
+        n = recvfrom(fd, &request, sizeof(request), MSG_DONTWAIT|MSG_TRUNC, &sa.sa, &salen);
+        if (n < 0) {
+                if (errno != EAGAIN && errno != EINTR)
+                        log_debug_errno(errno, "Failed to read lookup request, ignoring: %m");
+                return 0;
+        }
+
+        /* Anonymous senders cannot be replied to */
+        if (salen <= offsetof(struct sockaddr_un, sun_path))
+                return 0;
+
+        if ((size_t) n <= sizeof(ResolveLookupRequest) ||
+            (size_t) n > sizeof(request) ||
+            request.buf[n - 1] != 0 ||
+            strlen(request.request.name) != (size_t) n - sizeof(ResolveLookupRequest) - 1) {
+                log_debug("Received invalid lookup request, ignoring.");
+                return 0;
+        }
+
+        q = lookup_start_query(m, &request.request);
+        size = lookup_make_reply(q, &reply.reply);
+        dns_query_free(q);
+
+        if (sendto(fd, &reply, size, MSG_DONTWAIT|MSG_NOSIGNAL, &sa.sa, salen) < 0)
+                log_debug_errno(errno, "Failed to send lookup reply, ignoring: %m");
+
+        return 0;
+}
+
+int manager_lookup_start(Manager *m) {
+        union sockaddr_union sa = {
+                .un.sun_family = AF_UNIX,
+                .un.sun_path = SD_RESOLVED_LOOKUP_SOCKET,
+        };
+        int r;
+
+        assert(m);
+
+        if (m->lookup_fd >= 0)
+                return 0;
+
+        m->lookup_fd = socket(AF_UNIX, SOCK_DGRAM|SOCK_CLOEXEC|SOCK_NONBLOCK, 0);
+        if (m->lookup_fd < 0)
+                return -errno;
+
+        (void) unlink(sa.un.sun_path);
+
+        r = bind(m->lookup_fd, &sa.sa, offsetof(struct sockaddr_un, sun_path) + strlen(sa.un.sun_path));
+        if (r < 0) {
+                r = -errno;
+                goto fail;
+        }
+
+        /* Everybody may ask, just like on the bus */
+        if (chmod(sa.un.sun_path, 0666) < 0) {
+                r = -errno;
+                goto fail;
+        }
+
+        r = sd_event_add_io(m->event, &m->lookup_event_source, m->lookup_fd, EPOLLIN, on_lookup_request, m);
+        if (r < 0)
+                goto fail;
+
+        return 0;
+
+fail:
+        manager_lookup_stop(m);
+        return r;
+}
+
+void manager_lookup_stop(Manager *m) {
+        assert(m);
+
+        m->lookup_event_source = sd_event_source_unref(m->lookup_event_source);
+        m->lookup_fd = safe_close(m->lookup_fd);
+}
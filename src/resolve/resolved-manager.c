@@ -39,9 +39,12 @@
 #include "resolved-bus.h"
 #include "resolved-manager.h"
 #include "resolved-llmnr.h"
+#include "resolved-lookup.h"
 
 #define SEND_TIMEOUT_USEC (200 * USEC_PER_MSEC)
 
+#define CACHE_FILE "/run/systemd/resolve/cache"
+
 static int manager_process_link(sd_netlink *rtnl, sd_netlink_message *mm, void *userdata) {
         Manager *m = userdata;
         uint16_t type;
@@ -264,19 +267,39 @@ static int manager_rtnl_listen(Manager *m) {
 }
 
 static int on_network_event(sd_event_source *s, int fd, uint32_t revents, void *userdata) {
+        _cleanup_free_ int *ifindexes = NULL;
         Manager *m = userdata;
+        size_t n = 0, k;
         Iterator i;
         Link *l;
         int r;
 
         assert(m);
 
-        sd_network_monitor_flush(m->network_monitor);
+        r = sd_network_monitor_flush_links(m->network_monitor, &ifindexes, &n);
+        if (r < 0)
+                log_warning_errno(r, "Failed to flush network monitor: %m");
 
-        HASHMAP_FOREACH(l, m->links, i) {
-                r = link_update_monitor(l);
-                if (r < 0)
-                        log_warning_errno(r, "Failed to update monitor information for %i: %m", l->ifindex);
+        if (r != 0) {
+                HASHMAP_FOREACH(l, m->links, i) {
+                        r = link_update_monitor(l);
+                        if (r < 0)
+                                log_warning_errno(r, "Failed to update monitor information for %i: %m", l->ifindex);
+                }
+        } else {
+                /* Only the links whose state file changed need to be looked at */
+                if (n == 0)
+                        return 0;
+
+                for (k = 0; k < n; k++) {
+                        l = hashmap_get(m->links, INT_TO_PTR(ifindexes[k]));
+                        if (!l)
+                                continue;
+
+                        r = link_update_monitor(l);
+                        if (r < 0)
+                                log_warning_errno(r, "Failed to update monitor information for %i: %m", l->ifindex);
+                }
         }
 
         r = manager_write_resolv_conf(m);
@@ -467,10 +490,12 @@ int manager_new(Manager **ret) {
 
         m->llmnr_ipv4_udp_fd = m->llmnr_ipv6_udp_fd = -1;
         m->llmnr_ipv4_tcp_fd = m->llmnr_ipv6_tcp_fd = -1;
+        m->lookup_fd = -1;
         m->hostname_fd = -1;
 
         m->llmnr_support = SUPPORT_YES;
         m->read_resolv_conf = true;
+        m->cache_max_entries = DNS_CACHE_ENTRIES_MAX;
 
         r = manager_parse_dns_server(m, DNS_SERVER_FALLBACK, DNS_SERVERS);
         if (r < 0)
@@ -522,6 +547,10 @@ int manager_start(Manager *m) {
         if (r < 0)
                 return r;
 
+        r = manager_lookup_start(m);
+        if (r < 0)
+                log_warning_errno(r, "Failed to set up lookup socket, ignoring: %m");
+
         return 0;
 }
 
@@ -549,6 +578,7 @@ Manager *manager_free(Manager *m) {
         sd_network_monitor_unref(m->network_monitor);
 
         manager_llmnr_stop(m);
+        manager_lookup_stop(m);
 
         sd_bus_slot_unref(m->prepare_for_sleep_slot);
         sd_event_source_unref(m->bus_retry_event_source);
@@ -1235,7 +1265,16 @@ DnsServer *manager_get_dns_server(Manager *m) {
         return m->current_dns_server;
 }
 
+static DnsServer *manager_current_dns_servers(Manager *m) {
+        assert(m);
+        assert(m->current_dns_server);
+
+        return m->current_dns_server->type == DNS_SERVER_FALLBACK ? m->fallback_dns_servers : m->dns_servers;
+}
+
 void manager_next_dns_server(Manager *m) {
+        DnsServer *s;
+
         assert(m);
 
         /* If there's currently no DNS server set, then the next
@@ -1243,7 +1282,14 @@ void manager_next_dns_server(Manager *m) {
         if (!m->current_dns_server)
                 return;
 
-        /* Change to the next one */
+        /* Change to the fastest of the others that didn't fail lately */
+        s = dns_server_pick(manager_current_dns_servers(m), m->current_dns_server, now(clock_boottime_or_monotonic()));
+        if (s) {
+                manager_set_dns_server(m, s);
+                return;
+        }
+
+        /* Otherwise, change to the next one */
         if (m->current_dns_server->servers_next) {
                 manager_set_dns_server(m, m->current_dns_server->servers_next);
                 return;
@@ -1251,10 +1297,20 @@ void manager_next_dns_server(Manager *m) {
 
         /* If there was no next one, then start from the beginning of
          * the list */
-        if (m->current_dns_server->type == DNS_SERVER_FALLBACK)
-                manager_set_dns_server(m, m->fallback_dns_servers);
-        else
-                manager_set_dns_server(m, m->dns_servers);
+        manager_set_dns_server(m, manager_current_dns_servers(m));
+}
+
+void manager_reconsider_dns_server(Manager *m, usec_t t) {
+        DnsServer *s;
+
+        assert(m);
+
+        if (!m->current_dns_server)
+                return;
+
+        s = dns_server_pick_faster(manager_current_dns_servers(m), m->current_dns_server, t);
+        if (s)
+                manager_set_dns_server(m, s);
 }
 
 uint32_t manager_find_mtu(Manager *m) {
@@ -1456,3 +1512,131 @@ static const char* const support_table[_SUPPORT_MAX] = {
         [SUPPORT_RESOLVE] = "resolve",
 };
 DEFINE_STRING_TABLE_LOOKUP(support, Support);
+
+void manager_apply_cache_limits(Manager *m) {
+        DnsScope *s;
+
+        assert(m);
+
+        LIST_FOREACH(scopes, s, m->dns_scopes)
+                dns_scope_apply_cache_limits(s);
+}
+
+static DnsScope *manager_find_unicast_scope(Manager *m, int ifindex) {
+        DnsScope *s;
+
+        assert(m);
+
+        LIST_FOREACH(scopes, s, m->dns_scopes)
+                if (s->protocol == DNS_PROTOCOL_DNS && (s->link ? s->link->ifindex : 0) == ifindex)
+                        return s;
+
+        return NULL;
+}
+
+int manager_save_cache(Manager *m) {
+        _cleanup_free_ char *temp_path = NULL;
+        _cleanup_fclose_ FILE *f = NULL;
+        DnsScope *s;
+        int r;
+
+        assert(m);
+
+        /* Keep the unicast caches across restarts, so that clients
+         * don't notice, and the servers don't get flooded with the
+         * same queries again. Multicast answers are too short-lived
+         * to be worth it. */
+
+        r = fopen_temporary(CACHE_FILE, &f, &temp_path);
+        if (r < 0)
+                return r;
+
+        fchmod(fileno(f), 0600);
+
+        LIST_FOREACH(scopes, s, m->dns_scopes) {
+                char prefix[DECIMAL_STR_MAX(int)];
+
+                if (s->protocol != DNS_PROTOCOL_DNS)
+                        continue;
+
+                xsprintf(prefix, "%i", s->link ? s->link->ifindex : 0);
+
+                r = dns_cache_serialize(&s->cache, prefix, f);
+                if (r < 0)
+                        goto fail;
+        }
+
+        r = fflush_and_check(f);
+        if (r < 0)
+                goto fail;
+
+        if (rename(temp_path, CACHE_FILE) < 0) {
+                r = -errno;
+                goto fail;
+        }
+
+        return 0;
+
+fail:
+        (void) unlink(temp_path);
+        return r;
+}
+
+int manager_load_cache(Manager *m) {
+        _cleanup_fclose_ FILE *f = NULL;
+        char line[LINE_MAX];
+        unsigned n = 0;
+        DnsScope *s;
+        usec_t t;
+        int r;
+
+        assert(m);
+
+        f = fopen(CACHE_FILE, "re");
+        if (!f)
+                return errno == ENOENT ? 0 : -errno;
+
+        /* The file is only good for the very next start */
+        (void) unlink(CACHE_FILE);
+
+        /* Pick the servers first, as switching to one flushes the
+         * cache */
+        LIST_FOREACH(scopes, s, m->dns_scopes)
+                if (s->protocol == DNS_PROTOCOL_DNS)
+                        dns_scope_get_dns_server(s);
+
+        assert_se(sd_event_now(m->event, clock_boottime_or_monotonic(), &t) >= 0);
+
+        FOREACH_LINE(line, f, return -errno) {
+                size_t k;
+                int ifindex;
+
+                truncate_nl(line);
+
+                k = strcspn(line, WHITESPACE);
+                if (line[k] == '\0')
+                        continue;
+                line[k] = '\0';
+
+                if (safe_atoi(line, &ifindex) < 0)
+                        continue;
+
+                /* Links that went away meanwhile have no scope */
+                s = manager_find_unicast_scope(m, ifindex);
+                if (!s)
+                        continue;
+
+                r = dns_cache_deserialize_item(&s->cache, line + k + 1, t);
+                if (r < 0) {
+                        log_debug_errno(r, "Failed to restore cache entry, ignoring: %m");
+                        continue;
+                }
+
+                n++;
+        }
+
+        log_debug("Restored %u cache entries.", n);
+
+        return 0;
+}
+
@@ -47,6 +47,14 @@ struct Manager {
 
         Support llmnr_support;
 
+        /* Cache limits, applied to each scope separately */
+        unsigned cache_max_entries;
+        size_t cache_max_bytes;
+        bool cache_prefetch;
+        usec_t cache_serve_stale_usec;
+
+        bool race_dns;
+
         /* Network */
         Hashmap *links;
 
@@ -60,10 +68,16 @@ struct Manager {
         Hashmap *dns_transactions;
         LIST_HEAD(DnsQuery, dns_queries);
         unsigned n_dns_queries;
+        uint64_t n_transactions_total;
+        uint64_t n_transactions_coalesced;
 
         LIST_HEAD(DnsStream, dns_streams);
         unsigned n_dns_streams;
 
+        /* Fast path for nss-resolve */
+        int lookup_fd;
+        sd_event_source *lookup_event_source;
+
         /* Unicast dns */
         LIST_HEAD(DnsServer, dns_servers);
         LIST_HEAD(DnsServer, fallback_dns_servers);
@@ -119,6 +133,7 @@ DnsServer *manager_set_dns_server(Manager *m, DnsServer *s);
 DnsServer *manager_find_dns_server(Manager *m, int family, const union in_addr_union *in_addr);
 DnsServer *manager_get_dns_server(Manager *m);
 void manager_next_dns_server(Manager *m);
+void manager_reconsider_dns_server(Manager *m, usec_t t);
 
 uint32_t manager_find_mtu(Manager *m);
 
@@ -138,6 +153,10 @@ DnsScope* manager_find_scope(Manager *m, DnsPacket *p);
 void manager_verify_all(Manager *m);
 
 void manager_flush_dns_servers(Manager *m, DnsServerType t);
+void manager_apply_cache_limits(Manager *m);
+
+int manager_save_cache(Manager *m);
+int manager_load_cache(Manager *m);
 
 DEFINE_TRIVIAL_CLEANUP_FUNC(Manager*, manager_free);
 
@@ -89,6 +89,10 @@ int main(int argc, char *argv[]) {
                 goto finish;
         }
 
+        r = manager_load_cache(m);
+        if (r < 0)
+                log_warning_errno(r, "Failed to restore cache, ignoring: %m");
+
         /* Write finish default resolv.conf to avoid a dangling
          * symlink */
         r = manager_write_resolv_conf(m);
@@ -107,6 +111,10 @@ int main(int argc, char *argv[]) {
 
         sd_event_get_exit_code(m->event, &r);
 
+        r = manager_save_cache(m);
+        if (r < 0)
+                log_warning_errno(r, "Failed to save cache, ignoring: %m");
+
 finish:
         sd_notify(false,
                   "STOPPING=1\n"
@@ -0,0 +1,674 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <dlfcn.h>
+#include <netdb.h>
+#include <nss.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "sd-bus.h"
+#include "bus-util.h"
+#include "util.h"
+#include "fileio.h"
+#include "socket-util.h"
+#include "unaligned.h"
+#include "random-util.h"
+#include "process-util.h"
+
+/* Replays a query log against a running systemd-resolved, via the
+ * bus or via nss-resolve, and reports throughput, latency, the cache
+ * hit ratio and CPU time per query. Optionally answers resolved's
+ * upstream queries itself, so that runs do not depend on the
+ * network; resolved needs to be configured to use that address as
+ * its DNS= server then. */
+
+#define N_DEFAULT_QUERIES 256
+#define UPSTREAM_PACKET_MAX 512
+
+static const char *arg_log = NULL;
+static const char *arg_upstream = NULL;
+static unsigned arg_rounds = 3;
+static unsigned arg_depth = 1;
+static uint32_t arg_ttl = 3600;
+static bool arg_json = false;
+
+typedef enum Transport {
+        TRANSPORT_BUS,
+        TRANSPORT_NSS,
+} Transport;
+
+typedef struct Query {
+        char *name;
+        int family;
+} Query;
+
+typedef enum nss_status (*gethostbyname4_t)(
+                const char *name,
+                struct gaih_addrtuple **pat,
+                char *buffer, size_t buflen,
+                int *errnop, int *h_errnop,
+                int32_t *ttlp);
+
+typedef enum nss_status (*gethostbyname3_t)(
+                const char *name,
+                int af,
+                struct hostent *result,
+                char *buffer, size_t buflen,
+                int *errnop, int *h_errnop,
+                int32_t *ttlp,
+                char **canonp);
+
+typedef struct Bench Bench;
+
+typedef struct Slot {
+        Bench *bench;
+        usec_t start;
+} Slot;
+
+struct Bench {
+        Transport transport;
+        sd_bus *bus;
+
+        gethostbyname4_t gethostbyname4;
+        gethostbyname3_t gethostbyname3;
+
+        Query *queries;
+        unsigned n_queries;
+
+        usec_t *latencies;
+        unsigned n_sent, n_done, n_failed;
+
+        pid_t resolved_pid;
+        pid_t upstream_pid;
+        uint64_t *upstream_queries;
+};
+
+/* Same output format as test-bus-benchmark */
+static void print_header(void) {
+        if (!arg_json)
+                printf("TEST\tTRANSPORT\tPARAM\tMETRIC\tVALUE\n");
+}
+
+static void print_result(Transport transport, unsigned round, const char *metric, double value) {
+        const char *t = transport == TRANSPORT_BUS ? "bus" : "nss";
+
+        if (arg_json)
+                printf("{ \"test\" : \"resolved\", \"transport\" : \"%s\", \"param\" : %u, \"metric\" : \"%s\", \"value\" : %.3f }\n",
+                       t, round, metric, value);
+        else
+                printf("resolved\t%s\t%u\t%s\t%.3f\n", t, round, metric, value);
+
+        fflush(stdout);
+}
+
+static int parse_family(const char *s) {
+        if (isempty(s))
+                return AF_UNSPEC;
+        if (streq(s, "inet"))
+                return AF_INET;
+        if (streq(s, "inet6"))
+                return AF_INET6;
+
+        return -EINVAL;
+}
+
+static int load_queries(Bench *b) {
+        _cleanup_fclose_ FILE *f = NULL;
+        size_t allocated = 0;
+        char line[LINE_MAX];
+
+        assert(b);
+
+        if (!arg_log) {
+                uint32_t run = random_u32();
+
+                /* Names that are unique to this run, so that the
+                 * first round always starts out with a cold cache */
+
+                b->queries = new0(Query, N_DEFAULT_QUERIES);
+                if (!b->queries)
+                        return -ENOMEM;
+
+                for (b->n_queries = 0; b->n_queries < N_DEFAULT_QUERIES; b->n_queries++)
+                        if (asprintf(&b->queries[b->n_queries].name, "host%u.r%08x.bench.test", b->n_queries, run) < 0)
+                                return -ENOMEM;
+
+                return 0;
+        }
+
+        /* One query per line: a host name, optionally followed by
+         * "inet" or "inet6" */
+
+        f = fopen(arg_log, "re");
+        if (!f)
+                return -errno;
+
+        FOREACH_LINE(line, f, return -errno) {
+                _cleanup_free_ char *name = NULL, *family = NULL;
+                const char *p = line;
+                int af, r;
+
+                truncate_nl(line);
+
+                if (IN_SET(line[0], '\0', '#'))
+                        continue;
+
+                r = extract_first_word(&p, &name, NULL, 0);
+                if (r <= 0)
+                        continue;
+
+                r = extract_first_word(&p, &family, NULL, 0);
+                if (r < 0)
+                        return r;
+
+                af = parse_family(family);
+                if (af < 0)
+                        return log_error_errno(af, "Unknown address family '%s' for %s.", family, name);
+
+                if (!GREEDY_REALLOC(b->queries, allocated, b->n_queries + 1))
+                        return -ENOMEM;
+
+                b->queries[b->n_queries].name = name;
+                b->queries[b->n_queries].family = af;
+                b->n_queries++;
+                name = NULL;
+        }
+
+        if (b->n_queries == 0)
+                return -ENODATA;
+
+        return 0;
+}
+
+static ssize_t upstream_make_reply(uint8_t *buf, size_t n) {
+        size_t idx = 12;
+        uint16_t type, flags;
+
+        /* Turns a query into an answer in place: A and AAAA lookups
+         * get one record from the documentation ranges, everything
+         * else gets an empty reply */
+
+        if (n < 12 + 5)
+                return -EBADMSG;
+
+        if (unaligned_read_be16(buf + 4) != 1)
+                return -EBADMSG;
+
+        for (;;) {
+                uint8_t c;
+
+                if (idx >= n)
+                        return -EBADMSG;
+
+                c = buf[idx++];
+                if (c == 0)
+                        break;
+                if (c > 63)
+                        return -EBADMSG;
+
+                idx += c;
+        }
+
+        if (idx + 4 > n)
+                return -EBADMSG;
+
+        type = unaligned_read_be16(buf + idx);
+        idx += 4;
+
+        flags = unaligned_read_be16(buf + 2);
+        unaligned_write_be16(buf + 2, 0x8000 | (flags & 0x7900) | 0x0080);
+        unaligned_write_be16(buf + 8, 0);
+        unaligned_write_be16(buf + 10, 0);
+
+        if (!IN_SET(type, 1, 28)) {
+                unaligned_write_be16(buf + 6, 0);
+                return idx;
+        }
+
+        if (idx + 12 + 16 > UPSTREAM_PACKET_MAX)
+                return -EMSGSIZE;
+
+        unaligned_write_be16(buf + 6, 1);
+
+        /* Pointer to the question name, type, class, TTL */
+        unaligned_write_be16(buf + idx, 0xc00c);
+        unaligned_write_be16(buf + idx + 2, type);
+        unaligned_write_be16(buf + idx + 4, 1);
+        unaligned_write_be32(buf + idx + 6, arg_ttl);
+        idx += 10;
+
+        if (type == 1) {
+                static const uint8_t a[] = { 192, 0, 2, 1 };
+
+                unaligned_write_be16(buf + idx, sizeof(a));
+                memcpy(buf + idx + 2, a, sizeof(a));
+                idx += 2 + sizeof(a);
+        } else {
+                static const uint8_t aaaa[] = { 0x20, 0x01, 0x0d, 0xb8, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1 };
+
+                unaligned_write_be16(buf + idx, sizeof(aaaa));
+                memcpy(buf + idx + 2, aaaa, sizeof(aaaa));
+                idx += 2 + sizeof(aaaa);
+        }
+
+        return idx;
+}
+
+static noreturn void upstream_serve(int fd, uint64_t *counter) {
+        for (;;) {
+                uint8_t buf[UPSTREAM_PACKET_MAX];
+                union sockaddr_union sa;
+                socklen_t salen = sizeof(sa);
+                ssize_t n;
+
+                n = recvfrom(fd, buf, sizeof(buf), 0, &sa.sa, &salen);
+                if (n < 0) {
+                        if (errno == EINTR)
+                                continue;
+
+                        log_error_errno(errno, "Failed to receive upstream query: %m");
+                        _exit(EXIT_FAILURE);
+                }
+
+                n = upstream_make_reply(buf, n);
+                if (n < 0)
+                        continue;
+
+                (*counter)++;
+
+                (void) sendto(fd, buf, n, MSG_NOSIGNAL, &sa.sa, salen);
+        }
+}
+
+static int upstream_start(Bench *b) {
+        _cleanup_close_ int fd = -1;
+        SocketAddress a;
+        pid_t pid;
+        int r;
+
+        assert(b);
+
+        r = socket_address_parse(&a, arg_upstream);
+        if (r < 0)
+                return log_error_errno(r, "Failed to parse upstream address %s: %m", arg_upstream);
+
+        fd = socket(socket_address_family(&a), SOCK_DGRAM|SOCK_CLOEXEC, 0);
+        if (fd < 0)
+                return log_error_errno(errno, "Failed to create upstream socket: %m");
+
+        if (bind(fd, &a.sockaddr.sa, a.size) < 0)
+                return log_error_errno(errno, "Failed to bind upstream socket to %s: %m", arg_upstream);
+
+        /* The counter is shared with the child that answers */
+        b->upstream_queries = mmap(NULL, sizeof(uint64_t), PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+        if (b->upstream_queries == MAP_FAILED) {
+                b->upstream_queries = NULL;
+                return -errno;
+        }
+
+        pid = fork();
+        if (pid < 0)
+                return log_error_errno(errno, "Failed to fork: %m");
+        if (pid == 0)
+                upstream_serve(fd, b->upstream_queries);
+
+        b->upstream_pid = pid;
+
+        log_info("Answering upstream queries on %s, make sure resolved uses it as DNS server.", arg_upstream);
+        return 0;
+}
+
+static void upstream_stop(Bench *b) {
+        assert(b);
+
+        if (b->upstream_pid <= 0)
+                return;
+
+        (void) kill(b->upstream_pid, SIGTERM);
+        (void) wait_for_terminate(b->upstream_pid, NULL);
+        b->upstream_pid = 0;
+}
+
+static usec_t process_cpu_usec(pid_t pid) {
+        _cleanup_free_ char *stat = NULL;
+        unsigned long utime, stime;
+        const char *p;
+        char fn[strlen("/proc//stat") + DECIMAL_STR_MAX(pid_t) + 1];
+
+        /* User and system time from /proc/PID/stat, fields 14 and
+         * 15, after the command name which may contain anything */
+
+        if (pid == 0) {
+                struct rusage ru;
+
+                assert_se(getrusage(RUSAGE_SELF, &ru) >= 0);
+                return timeval_load(&ru.ru_utime) + timeval_load(&ru.ru_stime);
+        }
+
+        xsprintf(fn, "/proc/"PID_FMT"/stat", pid);
+        if (read_full_file(fn, &stat, NULL) < 0)
+                return USEC_INFINITY;
+
+        p = strrchr(stat, ')');
+        if (!p)
+                return USEC_INFINITY;
+
+        if (sscanf(p + 1, " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2)
+                return USEC_INFINITY;
+
+        return (usec_t) (utime + stime) * USEC_PER_SEC / sysconf(_SC_CLK_TCK);
+}
+
+static int get_cache_statistics(Bench *b, uint64_t *hit, uint64_t *miss) {
+        _cleanup_bus_error_free_ sd_bus_error error = SD_BUS_ERROR_NULL;
+        _cleanup_bus_message_unref_ sd_bus_message *reply = NULL;
+        uint64_t size;
+        int r;
+
+        assert(b);
+
+        r = sd_bus_get_property(b->bus,
+                                "org.freedesktop.resolve1",
+                                "/org/freedesktop/resolve1",
+                                "org.freedesktop.resolve1.Manager",
+                                "CacheStatistics",
+                                &error, &reply, "(ttt)");
+        if (r < 0)
+                return r;
+
+        return sd_bus_message_read(reply, "(ttt)", &size, hit, miss);
+}
+
+static int on_bus_reply(sd_bus_message *m, void *userdata, sd_bus_error *error);
+
+static int bus_send_next(Slot *s) {
+        Bench *b = s->bench;
+        const Query *q;
+        int r;
+
+        if (b->n_sent >= b->n_queries)
+                return 0;
+
+        q = b->queries + b->n_sent++;
+        s->start = now(CLOCK_MONOTONIC);
+
+        r = sd_bus_call_method_async(b->bus, NULL,
+                                     "org.freedesktop.resolve1",
+                                     "/org/freedesktop/resolve1",
+                                     "org.freedesktop.resolve1.Manager",
+                                     "ResolveHostname",
+                                     on_bus_reply, s,
+                                     "isit", 0, q->name, q->family, (uint64_t) 0);
+        if (r < 0)
+                return log_error_errno(r, "Failed to issue lookup: %m");
+
+        return 1;
+}
+
+static int on_bus_reply(sd_bus_message *m, void *userdata, sd_bus_error *error) {
+        Slot *s = userdata;
+        Bench *b = s->bench;
+
+        b->latencies[b->n_done++] = now(CLOCK_MONOTONIC) - s->start;
+
+        if (sd_bus_message_is_method_error(m, NULL))
+                b->n_failed++;
+
+        return bus_send_next(s);
+}
+
+static int run_bus(Bench *b) {
+        _cleanup_free_ Slot *slots = NULL;
+        unsigned i;
+        int r;
+
+        /* Keeps arg_depth lookups in flight at any time */
+
+        slots = new0(Slot, arg_depth);
+        if (!slots)
+                return -ENOMEM;
+
+        for (i = 0; i < arg_depth; i++) {
+                slots[i].bench = b;
+
+                r = bus_send_next(slots + i);
+                if (r < 0)
+                        return r;
+        }
+
+        while (b->n_done < b->n_queries) {
+                r = sd_bus_process(b->bus, NULL);
+                if (r < 0)
+                        return log_error_errno(r, "Failed to process bus: %m");
+                if (r > 0)
+                        continue;
+
+                r = sd_bus_wait(b->bus, (uint64_t) -1);
+                if (r < 0)
+                        return log_error_errno(r, "Failed to wait for bus: %m");
+        }
+
+        return 0;
+}
+
+static int run_nss(Bench *b) {
+        char buffer[4096];
+
+        /* NSS calls are synchronous, the depth does not apply */
+
+        for (; b->n_sent < b->n_queries; b->n_sent++) {
+                const Query *q = b->queries + b->n_sent;
+                enum nss_status status;
+                int errnop, h_errnop;
+                usec_t start;
+
+                start = now(CLOCK_MONOTONIC);
+
+                if (q->family == AF_UNSPEC) {
+                        struct gaih_addrtuple *pat = NULL;
+
+                        status = b->gethostbyname4(q->name, &pat, buffer, sizeof(buffer), &errnop, &h_errnop, NULL);
+                } else {
+                        struct hostent he;
+
+                        status = b->gethostbyname3(q->name, q->family, &he, buffer, sizeof(buffer), &errnop, &h_errnop, NULL, NULL);
+                }
+
+                b->latencies[b->n_done++] = now(CLOCK_MONOTONIC) - start;
+
+                if (status != NSS_STATUS_SUCCESS)
+                        b->n_failed++;
+        }
+
+        return 0;
+}
+
+static int compare_usec(const void *a, const void *b) {
+        const usec_t *x = a, *y = b;
+
+        return *x < *y ? -1 : *x > *y ? 1 : 0;
+}
+
+static int run_round(Bench *b, unsigned round) {
+        usec_t start, elapsed, cpu_client, cpu_resolved, cpu_upstream = USEC_INFINITY;
+        uint64_t hit = 0, miss = 0, hit_after, miss_after, upstream = 0;
+        bool have_statistics;
+        int r;
+
+        assert(b);
+
+        b->n_sent = b->n_done = b->n_failed = 0;
+
+        have_statistics = get_cache_statistics(b, &hit, &miss) >= 0;
+        if (b->upstream_queries)
+                upstream = *b->upstream_queries;
+        cpu_client = process_cpu_usec(0);
+        cpu_resolved = process_cpu_usec(b->resolved_pid);
+        if (b->upstream_pid > 0)
+                cpu_upstream = process_cpu_usec(b->upstream_pid);
+
+        start = now(CLOCK_MONOTONIC);
+
+        if (b->transport == TRANSPORT_BUS)
+                r = run_bus(b);
+        else
+                r = run_nss(b);
+        if (r < 0)
+                return r;
+
+        elapsed = now(CLOCK_MONOTONIC) - start;
+
+        qsort(b->latencies, b->n_done, sizeof(usec_t), compare_usec);
+
+        print_result(b->transport, round, "qps", (double) b->n_done * USEC_PER_SEC / MAX(elapsed, 1U));
+        print_result(b->transport, round, "p50-usec", b->latencies[b->n_done * 50 / 100]);
+        print_result(b->transport, round, "p99-usec", b->latencies[MIN(b->n_done * 99 / 100, b->n_done - 1)]);
+        print_result(b->transport, round, "failed", b->n_failed);
+
+        if (have_statistics &&
+            get_cache_statistics(b, &hit_after, &miss_after) >= 0 &&
+            hit_after + miss_after > hit + miss)
+                print_result(b->transport, round, "cache-hit-ratio",
+                             (double) (hit_after - hit) / (hit_after + miss_after - hit - miss));
+
+        if (b->upstream_queries)
+                print_result(b->transport, round, "upstream-queries", *b->upstream_queries - upstream);
+
+        /* CPU time per lookup, per component */
+        print_result(b->transport, round, "cpu-client-usec", (double) (process_cpu_usec(0) - cpu_client) / b->n_done);
+
+        if (cpu_resolved != USEC_INFINITY)
+                print_result(b->transport, round, "cpu-resolved-usec", (double) (process_cpu_usec(b->resolved_pid) - cpu_resolved) / b->n_done);
+
+        if (cpu_upstream != USEC_INFINITY)
+                print_result(b->transport, round, "cpu-upstream-usec", (double) (process_cpu_usec(b->upstream_pid) - cpu_upstream) / b->n_done);
+
+        return 0;
+}
+
+static int get_resolved_pid(Bench *b) {
+        _cleanup_bus_creds_unref_ sd_bus_creds *creds = NULL;
+        int r;
+
+        r = sd_bus_get_name_creds(b->bus, "org.freedesktop.resolve1", SD_BUS_CREDS_PID, &creds);
+        if (r < 0)
+                return r;
+
+        return sd_bus_creds_get_pid(creds, &b->resolved_pid);
+}
+
+int main(int argc, char *argv[]) {
+        Bench b = {
+                .transport = TRANSPORT_BUS,
+        };
+        unsigned i;
+        int r;
+
+        log_parse_environment();
+        log_open();
+
+        for (i = 1; i < (unsigned) argc; i++) {
+                const char *v;
+
+                if (streq(argv[i], "bus"))
+                        b.transport = TRANSPORT_BUS;
+                else if (streq(argv[i], "nss"))
+                        b.transport = TRANSPORT_NSS;
+                else if (streq(argv[i], "json"))
+                        arg_json = true;
+                else if ((v = startswith(argv[i], "log=")))
+                        arg_log = v;
+                else if ((v = startswith(argv[i], "upstream=")))
+                        arg_upstream = v;
+                else if ((v = startswith(argv[i], "rounds=")))
+                        assert_se(safe_atou(v, &arg_rounds) >= 0 && arg_rounds > 0);
+                else if ((v = startswith(argv[i], "depth=")))
+                        assert_se(safe_atou(v, &arg_depth) >= 0 && arg_depth > 0);
+                else if ((v = startswith(argv[i], "ttl=")))
+                        assert_se(safe_atou32(v, &arg_ttl) >= 0);
+                else {
+                        log_error("Usage: %s [bus|nss] [log=FILE] [upstream=ADDRESS:PORT] [rounds=N] [depth=N] [ttl=SEC] [json]", program_invocation_short_name);
+                        return EXIT_FAILURE;
+                }
+        }
+
+        r = load_queries(&b);
+        if (r < 0) {
+                log_error_errno(r, "Failed to load queries: %m");
+                return EXIT_FAILURE;
+        }
+
+        b.latencies = new(usec_t, b.n_queries);
+        assert_se(b.latencies);
+
+        /* The bus is needed for the statistics in any case */
+        r = sd_bus_open_system(&b.bus);
+        if (r < 0) {
+                log_notice_errno(r, "Cannot connect to system bus, skipping: %m");
+                return EXIT_TEST_SKIP;
+        }
+
+        r = get_resolved_pid(&b);
+        if (r < 0) {
+                log_notice_errno(r, "systemd-resolved is not running, skipping: %m");
+                return EXIT_TEST_SKIP;
+        }
+
+        if (b.transport == TRANSPORT_NSS) {
+                void *dl;
+
+                dl = dlopen("libnss_resolve.so.2", RTLD_LAZY|RTLD_NODELETE);
+                if (!dl) {
+                        log_notice("Cannot load nss-resolve, skipping: %s", dlerror());
+                        return EXIT_TEST_SKIP;
+                }
+
+                b.gethostbyname4 = (gethostbyname4_t) dlsym(dl, "_nss_resolve_gethostbyname4_r");
+                b.gethostbyname3 = (gethostbyname3_t) dlsym(dl, "_nss_resolve_gethostbyname3_r");
+                assert_se(b.gethostbyname4 && b.gethostbyname3);
+        }
+
+        if (arg_upstream) {
+                r = upstream_start(&b);
+                if (r < 0)
+                        return EXIT_FAILURE;
+        }
+
+        log_info("Replaying %u queries %u times.", b.n_queries, arg_rounds);
+
+        print_header();
+
+        for (i = 0; i < arg_rounds; i++) {
+                r = run_round(&b, i);
+                if (r < 0)
+                        break;
+        }
+
+        upstream_stop(&b);
+
+        for (i = 0; i < b.n_queries; i++)
+                free(b.queries[i].name);
+        free(b.queries);
+        free(b.latencies);
+        sd_bus_flush_close_unref(b.bus);
+
+        return r < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
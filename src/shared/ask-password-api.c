@@ -32,6 +32,7 @@
 #include <sys/signalfd.h>
 
 #include "util.h"
+#include "missing.h"
 #include "formats-util.h"
 #include "mkdir.h"
 #include "strv.h"
@@ -297,10 +298,147 @@ fail:
         return r;
 }
 
+#define KEYRING_TIMEOUT_USEC ((5 * USEC_PER_MINUTE) / 2)
+
+static int lookup_key(const char *keyname, key_serial_t *ret) {
+        key_serial_t serial;
+
+        assert(keyname);
+        assert(ret);
+
+        serial = request_key("user", keyname, NULL, 0);
+        if (serial == -1)
+                return -errno;
+
+        *ret = serial;
+        return 0;
+}
+
+static int retrieve_key(key_serial_t serial, char ***ret) {
+        _cleanup_free_ char *p = NULL;
+        long m = 100, n;
+        char **l;
+
+        assert(ret);
+
+        for (;;) {
+                p = new(char, m);
+                if (!p)
+                        return -ENOMEM;
+
+                n = keyctl(KEYCTL_READ, (unsigned long) serial, (unsigned long) p, (unsigned long) m, 0);
+                if (n < 0)
+                        return -errno;
+
+                if (n <= m)
+                        break;
+
+                /* The key grew, try again with a buffer of the new
+                 * size */
+                memzero(p, m);
+                p = mfree(p);
+                m = n;
+        }
+
+        l = strv_parse_nulstr(p, n);
+        memzero(p, n);
+        if (!l)
+                return -ENOMEM;
+
+        *ret = l;
+        return 0;
+}
+
+static int add_to_keyring(const char *keyname, char **passwords) {
+        _cleanup_strv_free_ char **l = NULL;
+        _cleanup_free_ char *p = NULL;
+        key_serial_t serial;
+        size_t n = 0;
+        char **i, *q;
+        int r;
+
+        assert(keyname);
+
+        if (strv_isempty(passwords))
+                return 0;
+
+        /* Merge with what is already cached, so that volumes with
+         * different passphrases can all be unlocked from the cache */
+        r = lookup_key(keyname, &serial);
+        if (r >= 0) {
+                r = retrieve_key(serial, &l);
+                if (r < 0)
+                        return r;
+        } else if (r != -ENOKEY)
+                return r;
+
+        r = strv_extend_strv(&l, passwords);
+        if (r < 0)
+                return r;
+
+        strv_uniq(l);
+
+        STRV_FOREACH(i, l)
+                n += strlen(*i) + 1;
+
+        p = new(char, n);
+        if (!p)
+                return -ENOMEM;
+
+        q = p;
+        STRV_FOREACH(i, l)
+                q = stpcpy(q, *i) + 1;
+
+        serial = add_key("user", keyname, p, n, KEY_SPEC_USER_KEYRING);
+        memzero(p, n);
+        if (serial == -1)
+                return -errno;
+
+        if (keyctl(KEYCTL_SET_TIMEOUT,
+                   (unsigned long) serial,
+                   (unsigned long) DIV_ROUND_UP(KEYRING_TIMEOUT_USEC, USEC_PER_SEC), 0, 0) < 0)
+                log_debug_errno(errno, "Failed to adjust timeout: %m");
+
+        /* Agents that wait for a passphrase with the same key name
+         * watch the directory for attribute changes, wake them up */
+        (void) utimensat(AT_FDCWD, "/run/systemd/ask-password", NULL, 0);
+
+        log_debug("Added key to keyring as %" PRIi32 ".", serial);
+
+        return 1;
+}
+
+static int add_to_keyring_and_log(const char *keyname, char **passwords) {
+        int r;
+
+        r = add_to_keyring(keyname, passwords);
+        if (r < 0)
+                return log_debug_errno(r, "Failed to add password to keyring: %m");
+
+        return 0;
+}
+
+static int ask_password_keyring(const char *keyname, char ***ret) {
+        key_serial_t serial;
+        int r;
+
+        assert(keyname);
+        assert(ret);
+
+        r = lookup_key(keyname, &serial);
+        if (r == -ENOSYS) /* when retrieving the distinction doesn't matter */
+                return -ENOKEY;
+        if (r < 0)
+                return r;
+
+        return retrieve_key(serial, ret);
+}
+
 int ask_password_agent(
                 const char *message,
                 const char *icon,
                 const char *id,
+                const char *keyname,
                 usec_t until,
                 bool echo,
                 bool accept_cached,
@@ -309,6 +447,7 @@ int ask_password_agent(
         enum {
                 FD_SOCKET,
                 FD_SIGNAL,
+                FD_INOTIFY,
                 _FD_MAX
         };
 
@@ -316,7 +455,7 @@ int ask_password_agent(
         char final[sizeof(temp)] = "";
         _cleanup_fclose_ FILE *f = NULL;
         _cleanup_free_ char *socket_name = NULL;
-        _cleanup_close_ int socket_fd = -1, signal_fd = -1, fd = -1;
+        _cleanup_close_ int socket_fd = -1, signal_fd = -1, notify = -1, fd = -1;
         sigset_t mask, oldmask;
         struct pollfd pollfd[_FD_MAX];
         int r;
@@ -329,6 +468,29 @@ int ask_password_agent(
 
         mkdir_p_label("/run/systemd/ask-password", 0755);
 
+        if (keyname && accept_cached) {
+                /* Watch for passphrases pushed to the keyring by
+                 * another instance before looking, so that we don't
+                 * miss one added in between */
+                notify = inotify_init1(IN_CLOEXEC|IN_NONBLOCK);
+                if (notify < 0) {
+                        r = log_error_errno(errno, "Failed to allocate inotify fd: %m");
+                        goto finish;
+                }
+
+                if (inotify_add_watch(notify, "/run/systemd/ask-password", IN_ATTRIB|IN_ONLYDIR) < 0) {
+                        r = log_error_errno(errno, "Failed to add inotify watch: %m");
+                        goto finish;
+                }
+
+                r = ask_password_keyring(keyname, _passphrases);
+                if (r >= 0) {
+                        r = 0;
+                        goto finish;
+                } else if (r != -ENOKEY)
+                        log_debug_errno(r, "Failed to query keyring, ignoring: %m");
+        }
+
         fd = mkostemp_safe(temp, O_WRONLY|O_CLOEXEC);
         if (fd < 0) {
                 r = log_error_errno(errno,
@@ -402,6 +564,8 @@ int ask_password_agent(
         pollfd[FD_SOCKET].events = POLLIN;
         pollfd[FD_SIGNAL].fd = signal_fd;
         pollfd[FD_SIGNAL].events = POLLIN;
+        pollfd[FD_INOTIFY].fd = notify;
+        pollfd[FD_INOTIFY].events = POLLIN;
 
         for (;;) {
                 char passphrase[LINE_MAX+1];
@@ -444,6 +608,20 @@ int ask_password_agent(
                         goto finish;
                 }
 
+                if (notify >= 0 && pollfd[FD_INOTIFY].revents != 0) {
+                        (void) flush_fd(notify);
+
+                        r = ask_password_keyring(keyname, _passphrases);
+                        if (r >= 0) {
+                                r = 0;
+                                goto finish;
+                        } else if (r != -ENOKEY)
+                                log_debug_errno(r, "Failed to query keyring, ignoring: %m");
+
+                        if (pollfd[FD_SOCKET].revents == 0)
+                                continue;
+                }
+
                 if (pollfd[FD_SOCKET].revents != POLLIN) {
                         log_error("Unexpected poll() event.");
                         r = -EIO;
@@ -512,6 +690,9 @@ int ask_password_agent(
                                 continue;
                         }
 
+                        if (keyname)
+                                (void) add_to_keyring_and_log(keyname, l);
+
                         *_passphrases = l;
 
                 } else if (passphrase[0] == '-') {
@@ -541,7 +722,7 @@ finish:
         return r;
 }
 
-int ask_password_auto(const char *message, const char *icon, const char *id,
+int ask_password_auto(const char *message, const char *icon, const char *id, const char *keyname,
                       usec_t until, bool accept_cached, char ***_passphrases) {
         assert(message);
         assert(_passphrases);
@@ -550,6 +731,14 @@ int ask_password_auto(const char *message, const char *icon, const char *id,
                 int r;
                 char *s = NULL, **l = NULL;
 
+                if (keyname && accept_cached) {
+                        r = ask_password_keyring(keyname, _passphrases);
+                        if (r >= 0)
+                                return 0;
+                        else if (r != -ENOKEY)
+                                log_debug_errno(r, "Failed to query keyring, ignoring: %m");
+                }
+
                 r = ask_password_tty(message, until, false, NULL, &s);
                 if (r < 0)
                         return r;
@@ -558,8 +747,11 @@ int ask_password_auto(const char *message, const char *icon, const char *id,
                 if (r < 0)
                         return r;
 
+                if (keyname)
+                        (void) add_to_keyring_and_log(keyname, l);
+
                 *_passphrases = l;
                 return r;
         } else
-                return ask_password_agent(message, icon, id, until, false, accept_cached, _passphrases);
+                return ask_password_agent(message, icon, id, keyname, until, false, accept_cached, _passphrases);
 }
@@ -24,8 +24,8 @@
 
 int ask_password_tty(const char *message, usec_t until, bool echo, const char *flag_file, char **_passphrase);
 
-int ask_password_agent(const char *message, const char *icon, const char *id,
+int ask_password_agent(const char *message, const char *icon, const char *id, const char *keyname,
                        usec_t until, bool echo, bool accept_cached, char ***_passphrases);
 
-int ask_password_auto(const char *message, const char *icon, const char *id,
+int ask_password_auto(const char *message, const char *icon, const char *id, const char *keyname,
                       usec_t until, bool accept_cached, char ***_passphrases);
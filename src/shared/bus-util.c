@@ -324,12 +324,145 @@ int bus_test_polkit(
 
 #ifdef ENABLE_POLKIT
 
+/* Positive answers of polkit are remembered for a short while, so
+ * that a client doing many privileged calls in a row doesn't cost a
+ * polkit round trip each. They are keyed by the unique name of the
+ * client, which is never reused on a bus, plus action and details.
+ * Temporary authorizations are not cached, since they may be revoked
+ * any time, and everything is forgotten when polkit announces that
+ * its configuration or authorizations changed. */
+#define POLKIT_CACHE_USEC (5 * USEC_PER_SEC)
+#define POLKIT_CACHE_MAX 256U
+
+typedef struct PolkitCacheEntry {
+        char *key;
+        usec_t until;
+} PolkitCacheEntry;
+
+/* The daemons use a single bus, the cache is only used for the
+ * first one it is used with */
+static sd_bus *polkit_cache_bus = NULL;
+static sd_bus_slot *polkit_cache_slot = NULL;
+static OrderedHashmap *polkit_cache = NULL;
+
+static PolkitCacheEntry *polkit_cache_entry_free(PolkitCacheEntry *e) {
+        if (!e)
+                return NULL;
+
+        free(e->key);
+        free(e);
+
+        return NULL;
+}
+
+static void polkit_cache_flush(void) {
+        PolkitCacheEntry *e;
+
+        while ((e = ordered_hashmap_steal_first(polkit_cache)))
+                polkit_cache_entry_free(e);
+}
+
+static int polkit_cache_changed(sd_bus_message *message, void *userdata, sd_bus_error *error) {
+        log_debug("polkit configuration or authorizations changed, flushing cached authorizations.");
+        polkit_cache_flush();
+        return 0;
+}
+
+static char *polkit_cache_key(const char *sender, const char *action, const char **details) {
+        _cleanup_free_ char *d = NULL;
+
+        d = strv_join((char**) details, "\n");
+        if (!d)
+                return NULL;
+
+        return strjoin(sender, "\n", action, "\n", d, NULL);
+}
+
+static bool polkit_cache_lookup(sd_bus *bus, const char *key) {
+        PolkitCacheEntry *e;
+
+        if (!key || bus != polkit_cache_bus)
+                return false;
+
+        e = ordered_hashmap_get(polkit_cache, key);
+        if (!e)
+                return false;
+
+        if (now(CLOCK_MONOTONIC) >= e->until) {
+                ordered_hashmap_remove(polkit_cache, key);
+                polkit_cache_entry_free(e);
+                return false;
+        }
+
+        return true;
+}
+
+static void polkit_cache_put(sd_bus *bus, const char *key) {
+        PolkitCacheEntry *e;
+        usec_t n;
+        int r;
+
+        if (!key)
+                return;
+
+        if (!polkit_cache_bus) {
+                /* Without the match we wouldn't know when to
+                 * forget, hence don't cache anything then */
+                r = sd_bus_add_match(bus,
+                                     &polkit_cache_slot,
+                                     "type='signal',"
+                                     "sender='org.freedesktop.PolicyKit1',"
+                                     "interface='org.freedesktop.PolicyKit1.Authority',"
+                                     "member='Changed',"
+                                     "path='/org/freedesktop/PolicyKit1/Authority'",
+                                     polkit_cache_changed, NULL);
+                if (r < 0) {
+                        log_debug_errno(r, "Failed to subscribe to polkit changes, not caching authorizations: %m");
+                        return;
+                }
+
+                polkit_cache_bus = bus;
+        } else if (bus != polkit_cache_bus)
+                return;
+
+        if (ordered_hashmap_ensure_allocated(&polkit_cache, &string_hash_ops) < 0)
+                return;
+
+        n = now(CLOCK_MONOTONIC);
+
+        /* Entries expire in the order they were added: drop the
+         * expired ones, and the oldest ones if there are too many */
+        polkit_cache_entry_free(ordered_hashmap_remove(polkit_cache, key));
+
+        while ((e = ordered_hashmap_first(polkit_cache)) &&
+               (e->until <= n || ordered_hashmap_size(polkit_cache) >= POLKIT_CACHE_MAX)) {
+                ordered_hashmap_remove(polkit_cache, e->key);
+                polkit_cache_entry_free(e);
+        }
+
+        e = new0(PolkitCacheEntry, 1);
+        if (!e)
+                return;
+
+        e->key = strdup(key);
+        if (!e->key) {
+                polkit_cache_entry_free(e);
+                return;
+        }
+
+        e->until = n + POLKIT_CACHE_USEC;
+
+        if (ordered_hashmap_put(polkit_cache, e->key, e) < 0)
+                polkit_cache_entry_free(e);
+}
+
 typedef struct AsyncPolkitQuery {
         sd_bus_message *request, *reply;
         sd_bus_message_handler_t callback;
         void *userdata;
         sd_bus_slot *slot;
         Hashmap *registry;
+        char *cache_key;
 } AsyncPolkitQuery;
 
 static void async_polkit_query_free(AsyncPolkitQuery *q) {
@@ -345,6 +478,7 @@ static void async_polkit_query_free(AsyncPolkitQuery *q) {
         sd_bus_message_unref(q->request);
         sd_bus_message_unref(q->reply);
 
+        free(q->cache_key);
         free(q);
 }
 
@@ -388,6 +522,7 @@ int bus_verify_polkit_async(
 
 #ifdef ENABLE_POLKIT
         _cleanup_bus_message_unref_ sd_bus_message *pk = NULL;
+        _cleanup_free_ char *cache_key = NULL;
         AsyncPolkitQuery *q;
         const char *sender, **k, **v;
         sd_bus_message_handler_t callback;
@@ -408,6 +543,7 @@ int bus_verify_polkit_async(
         q = hashmap_get(*registry, call);
         if (q) {
                 int authorized, challenge;
+                bool temporary = false;
 
                 /* This is the second invocation of this function, and
                  * there's already a response from polkit, let's
@@ -435,8 +571,24 @@ int bus_verify_polkit_async(
                 if (r < 0)
                         return r;
 
-                if (authorized)
+                if (authorized) {
+                        const char *key, *value;
+
+                        r = sd_bus_message_enter_container(q->reply, 'a', "{ss}");
+                        if (r < 0)
+                                return r;
+
+                        while ((r = sd_bus_message_read(q->reply, "{ss}", &key, &value)) > 0)
+                                if (streq(key, "polkit.temporary_authorization_id"))
+                                        temporary = true;
+                        if (r < 0)
+                                return r;
+
+                        if (!temporary)
+                                polkit_cache_put(call->bus, q->cache_key);
+
                         return 1;
+                }
 
                 if (challenge)
                         return sd_bus_error_set(error, SD_BUS_ERROR_INTERACTIVE_AUTHORIZATION_REQUIRED, "Interactive authentication required.");
@@ -465,6 +617,11 @@ int bus_verify_polkit_async(
         if (!sender)
                 return -EBADMSG;
 
+        /* If building the key fails we just don't use the cache */
+        cache_key = polkit_cache_key(sender, action, details);
+        if (polkit_cache_lookup(call->bus, cache_key))
+                return 1;
+
         c = sd_bus_message_get_allow_interactive_authorization(call);
         if (c < 0)
                 return c;
@@ -518,6 +675,8 @@ int bus_verify_polkit_async(
         q->request = sd_bus_message_ref(call);
         q->callback = callback;
         q->userdata = userdata;
+        q->cache_key = cache_key;
+        cache_key = NULL;
 
         r = hashmap_put(*registry, call, q);
         if (r < 0) {
@@ -547,6 +706,11 @@ void bus_verify_polkit_async_registry_free(Hashmap *registry) {
                 async_polkit_query_free(q);
 
         hashmap_free(registry);
+
+        polkit_cache_flush();
+        polkit_cache = ordered_hashmap_free(polkit_cache);
+        polkit_cache_slot = sd_bus_slot_unref(polkit_cache_slot);
+        polkit_cache_bus = NULL;
 #endif
 }
 
@@ -43,7 +43,18 @@ static int compare(const void *a, const void *b) {
         return 0;
 }
 
+static void show_pid_line(const char *prefix, unsigned pid_width, pid_t pid, const char *cmdline, bool extra, bool last) {
+        if (extra)
+                printf("%s%s ", prefix, draw_special_char(DRAW_TRIANGULAR_BULLET));
+        else
+                printf("%s%s", prefix, draw_special_char(last ? DRAW_TREE_RIGHT : DRAW_TREE_BRANCH));
+
+        printf("%*"PID_PRI" %s\n", pid_width, pid, strna(cmdline));
+}
+
 static void show_pid_array(pid_t pids[], unsigned n_pids, const char *prefix, unsigned n_columns, bool extra, bool more, bool kernel_threads, OutputFlags flags) {
+        _cleanup_free_ char *previous = NULL;
+        pid_t previous_pid = 0;
         unsigned i, j, pid_width;
 
         if (n_pids == 0)
@@ -68,18 +79,38 @@ static void show_pid_array(pid_t pids[], unsigned n_pids, const char *prefix, un
                 else
                         n_columns = 20;
         }
+
+        /* Kernel threads are recognized by their empty command line,
+         * from the same read that gets the line to show, rather than
+         * reading /proc/$PID/cmdline twice for each process. Hence
+         * whether a line is the last one is only known once the next
+         * one was read, so we print each line one step behind. */
         for (i = 0; i < n_pids; i++) {
                 _cleanup_free_ char *t = NULL;
+                int r;
 
-                get_process_cmdline(pids[i], n_columns, true, &t);
+                r = get_process_cmdline(pids[i], n_columns, false, &t);
+                if (r == -ENOENT) {
+                        _cleanup_free_ char *comm = NULL;
 
-                if (extra)
-                        printf("%s%s ", prefix, draw_special_char(DRAW_TRIANGULAR_BULLET));
-                else
-                        printf("%s%s", prefix, draw_special_char(((more || i < n_pids-1) ? DRAW_TREE_BRANCH : DRAW_TREE_RIGHT)));
+                        if (!kernel_threads)
+                                continue;
 
-                printf("%*"PID_PRI" %s\n", pid_width, pids[i], strna(t));
+                        if (get_process_comm(pids[i], &comm) >= 0)
+                                t = strjoin("[", comm, "]", NULL);
+                }
+
+                if (previous_pid > 0)
+                        show_pid_line(prefix, pid_width, previous_pid, previous, extra, false);
+
+                free(previous);
+                previous = t;
+                previous_pid = pids[i];
+                t = NULL;
         }
+
+        if (previous_pid > 0)
+                show_pid_line(prefix, pid_width, previous_pid, previous, extra, !more);
 }
 
 
@@ -103,9 +134,6 @@ static int show_cgroup_one_by_path(const char *path, const char *prefix, unsigne
 
         while ((r = cg_read_pid(f, &pid)) > 0) {
 
-                if (!kernel_threads && is_kernel_thread(pid) > 0)
-                        continue;
-
                 if (!GREEDY_REALLOC(pids, n_allocated, n + 1))
                         return -ENOMEM;
 
@@ -243,7 +271,7 @@ static int show_extra_pids(const char *controller, const char *path, const char
                 copy[j++] = pids[i];
         }
 
-        show_pid_array(copy, j, prefix, n_columns, true, false, false, flags);
+        show_pid_array(copy, j, prefix, n_columns, true, false, true, flags);
 
         return 0;
 }
@@ -90,14 +90,14 @@ int config_item_perf_lookup(
         if (!section)
                 p = lookup(lvalue, strlen(lvalue));
         else {
-                char *key;
-
-                key = strjoin(section, ".", lvalue, NULL);
-                if (!key)
-                        return -ENOMEM;
+                const char *key;
 
+                /* Both come from a single line, hence are bounded
+                 * by LINE_MAX and fine to put on the stack. This is
+                 * called for every assignment of every unit file, so
+                 * avoid the allocation. */
+                key = strjoina(section, ".", lvalue);
                 p = lookup(key, strlen(key));
-                free(key);
         }
 
         if (!p)
@@ -93,6 +93,8 @@ int tar_strip_suffixes(const char *name, char **ret) {
                 e = endswith(name, ".tar.gz");
         if (!e)
                 e = endswith(name, ".tar.bz2");
+        if (!e)
+                e = endswith(name, ".tar.zst");
         if (!e)
                 e = endswith(name, ".tgz");
         if (!e)
@@ -109,12 +111,40 @@ int tar_strip_suffixes(const char *name, char **ret) {
         return 0;
 }
 
+int btrfs_strip_suffixes(const char *name, char **ret) {
+        const char *e;
+        char *s;
+
+        e = endswith(name, ".btrfs");
+        if (!e)
+                e = endswith(name, ".btrfs.xz");
+        if (!e)
+                e = endswith(name, ".btrfs.gz");
+        if (!e)
+                e = endswith(name, ".btrfs.bz2");
+        if (!e)
+                e = endswith(name, ".btrfs.zst");
+        if (!e)
+                e = strchr(name, 0);
+
+        if (e <= name)
+                return -EINVAL;
+
+        s = strndup(name, e - name);
+        if (!s)
+                return -ENOMEM;
+
+        *ret = s;
+        return 0;
+}
+
 int raw_strip_suffixes(const char *p, char **ret) {
 
         static const char suffixes[] =
                 ".xz\0"
                 ".gz\0"
                 ".bz2\0"
+                ".zst\0"
                 ".raw\0"
                 ".qcow2\0"
                 ".img\0"
@@ -40,6 +40,7 @@ const char* import_verify_to_string(ImportVerify v) _const_;
 ImportVerify import_verify_from_string(const char *s) _pure_;
 
 int tar_strip_suffixes(const char *name, char **ret);
+int btrfs_strip_suffixes(const char *name, char **ret);
 int raw_strip_suffixes(const char *name, char **ret);
 
 bool dkr_name_is_valid(const char *name);
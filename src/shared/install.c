@@ -44,6 +44,17 @@ typedef struct {
         OrderedHashmap *have_installed;
 } InstallContext;
 
+/* All symlinks below one config path, resolved once, so that listing
+ * all unit files doesn't have to walk the config path per unit */
+typedef struct SymlinkIndex {
+        /* Unit names that a symlink is named after or points to */
+        Set *found;
+        /* Unit names with a same-name link in the config path itself */
+        Set *same_name;
+        /* First error hit while walking */
+        int error;
+} SymlinkIndex;
+
 static int in_search_path(const char *path, char **search) {
         _cleanup_free_ char *parent = NULL;
         int r;
@@ -462,9 +473,191 @@ static int find_symlinks(
         return find_symlinks_fd(name, fd, config_path, config_path, same_name_link);
 }
 
+static void symlink_index_done(SymlinkIndex *idx) {
+        assert(idx);
+
+        idx->found = set_free_free(idx->found);
+        idx->same_name = set_free_free(idx->same_name);
+        idx->error = 0;
+}
+
+static int symlink_index_put(Set **s, const char *name) {
+        char *n;
+        int r;
+
+        assert(s);
+        assert(name);
+
+        if (set_contains(*s, name))
+                return 0;
+
+        r = set_ensure_allocated(s, &string_hash_ops);
+        if (r < 0)
+                return r;
+
+        n = strdup(name);
+        if (!n)
+                return -ENOMEM;
+
+        return set_consume(*s, n);
+}
+
+static int symlink_index_add_fd(
+                SymlinkIndex *idx,
+                int fd,
+                const char *path,
+                const char *config_path) {
+
+        _cleanup_closedir_ DIR *d = NULL;
+        int r;
+
+        assert(idx);
+        assert(fd >= 0);
+        assert(path);
+        assert(config_path);
+
+        /* Same matching as find_symlinks_fd(), but for all unit names
+         * at once. Returns < 0 only on OOM, other errors are recorded
+         * in idx->error, like find_symlinks_fd() would return them. */
+
+        d = fdopendir(fd);
+        if (!d) {
+                safe_close(fd);
+                if (idx->error == 0)
+                        idx->error = -errno;
+                return 0;
+        }
+
+        for (;;) {
+                struct dirent *de;
+
+                errno = 0;
+                de = readdir(d);
+                if (!de && errno != 0) {
+                        if (idx->error == 0)
+                                idx->error = -errno;
+                        return 0;
+                }
+
+                if (!de)
+                        return 0;
+
+                if (hidden_file(de->d_name))
+                        continue;
+
+                dirent_ensure_type(d, de);
+
+                if (de->d_type == DT_DIR) {
+                        _cleanup_free_ char *p = NULL;
+                        int nfd;
+
+                        nfd = openat(fd, de->d_name, O_RDONLY|O_NONBLOCK|O_DIRECTORY|O_CLOEXEC|O_NOFOLLOW);
+                        if (nfd < 0) {
+                                if (errno != ENOENT && idx->error == 0)
+                                        idx->error = -errno;
+                                continue;
+                        }
+
+                        p = path_make_absolute(de->d_name, path);
+                        if (!p) {
+                                safe_close(nfd);
+                                return -ENOMEM;
+                        }
+
+                        /* This will close nfd, regardless whether it succeeds or not */
+                        r = symlink_index_add_fd(idx, nfd, p, config_path);
+                        if (r < 0)
+                                return r;
+
+                } else if (de->d_type == DT_LNK) {
+                        _cleanup_free_ char *p = NULL, *dest = NULL, *t = NULL;
+                        const char *target;
+
+                        p = path_make_absolute(de->d_name, path);
+                        if (!p)
+                                return -ENOMEM;
+
+                        r = readlink_and_canonicalize(p, &dest);
+                        if (r < 0) {
+                                if (r != -ENOENT && idx->error == 0)
+                                        idx->error = r;
+                                continue;
+                        }
+
+                        target = basename(dest);
+
+                        if (streq(de->d_name, target)) {
+                                /* Filter out same name links in the main
+                                 * config path */
+                                t = path_make_absolute(de->d_name, config_path);
+                                if (!t)
+                                        return -ENOMEM;
+
+                                if (path_equal(t, p))
+                                        r = symlink_index_put(&idx->same_name, de->d_name);
+                                else
+                                        r = symlink_index_put(&idx->found, de->d_name);
+                                if (r < 0)
+                                        return r;
+
+                                continue;
+                        }
+
+                        r = symlink_index_put(&idx->found, de->d_name);
+                        if (r < 0)
+                                return r;
+
+                        r = symlink_index_put(&idx->found, target);
+                        if (r < 0)
+                                return r;
+                }
+        }
+}
+
+static int symlink_index_build(
+                UnitFileScope scope,
+                bool runtime,
+                const char *root_dir,
+                SymlinkIndex *idx) {
+
+        _cleanup_free_ char *config_path = NULL;
+        int r, fd;
+
+        assert(idx);
+
+        r = get_config_path(scope, runtime, root_dir, &config_path);
+        if (r < 0)
+                return r;
+
+        fd = open(config_path, O_RDONLY|O_NONBLOCK|O_DIRECTORY|O_CLOEXEC|O_NOFOLLOW);
+        if (fd < 0) {
+                if (errno != ENOENT)
+                        idx->error = -errno;
+                return 0;
+        }
+
+        /* This takes possession of fd and closes it */
+        return symlink_index_add_fd(idx, fd, config_path, config_path);
+}
+
+static int symlink_index_find(SymlinkIndex *idx, const char *name, bool *same_name_link) {
+        assert(idx);
+        assert(name);
+        assert(same_name_link);
+
+        if (set_contains(idx->found, name))
+                return 1;
+
+        if (set_contains(idx->same_name, name))
+                *same_name_link = true;
+
+        return idx->error;
+}
+
 static int find_symlinks_in_scope(
                 UnitFileScope scope,
                 const char *root_dir,
+                SymlinkIndex *index,
                 const char *name,
                 UnitFileState *state) {
 
@@ -476,12 +669,19 @@ static int find_symlinks_in_scope(
         assert(scope < _UNIT_FILE_SCOPE_MAX);
         assert(name);
 
+        /* If index is non-NULL, it points to the prebuilt runtime and
+         * normal config path indexes, in this order */
+
         /* First look in runtime config path */
-        r = get_config_path(scope, true, root_dir, &normal_path);
-        if (r < 0)
-                return r;
+        if (index)
+                r = symlink_index_find(index + 0, name, &same_name_link_runtime);
+        else {
+                r = get_config_path(scope, true, root_dir, &normal_path);
+                if (r < 0)
+                        return r;
 
-        r = find_symlinks(name, normal_path, &same_name_link_runtime);
+                r = find_symlinks(name, normal_path, &same_name_link_runtime);
+        }
         if (r < 0)
                 return r;
         else if (r > 0) {
@@ -490,11 +690,15 @@ static int find_symlinks_in_scope(
         }
 
         /* Then look in the normal config path */
-        r = get_config_path(scope, false, root_dir, &runtime_path);
-        if (r < 0)
-                return r;
+        if (index)
+                r = symlink_index_find(index + 1, name, &same_name_link);
+        else {
+                r = get_config_path(scope, false, root_dir, &runtime_path);
+                if (r < 0)
+                        return r;
 
-        r = find_symlinks(name, runtime_path, &same_name_link);
+                r = find_symlinks(name, runtime_path, &same_name_link);
+        }
         if (r < 0)
                 return r;
         else if (r > 0) {
@@ -1839,7 +2043,7 @@ UnitFileState unit_file_lookup_state(
                         }
                 }
 
-                r = find_symlinks_in_scope(scope, root_dir, name, &state);
+                r = find_symlinks_in_scope(scope, root_dir, NULL, name, &state);
                 if (r < 0)
                         return r;
                 else if (r > 0)
@@ -2144,33 +2348,17 @@ static void unit_file_list_free_one(UnitFileList *f) {
 
 DEFINE_TRIVIAL_CLEANUP_FUNC(UnitFileList*, unit_file_list_free_one);
 
-int unit_file_get_list(
+static int unit_file_get_list_internal(
                 UnitFileScope scope,
                 const char *root_dir,
+                LookupPaths *paths,
+                SymlinkIndex *index,
                 Hashmap *h) {
 
-        _cleanup_lookup_paths_free_ LookupPaths paths = {};
         char **i;
         int r;
 
-        assert(scope >= 0);
-        assert(scope < _UNIT_FILE_SCOPE_MAX);
-        assert(h);
-
-        if (root_dir && scope != UNIT_FILE_SYSTEM)
-                return -EINVAL;
-
-        if (root_dir) {
-                r = access(root_dir, F_OK);
-                if (r < 0)
-                        return -errno;
-        }
-
-        r = lookup_paths_init_from_scope(&paths, scope, root_dir);
-        if (r < 0)
-                return r;
-
-        STRV_FOREACH(i, paths.unit_path) {
+        STRV_FOREACH(i, paths->unit_path) {
                 _cleanup_closedir_ DIR *d = NULL;
                 _cleanup_free_ char *units_dir;
 
@@ -2232,7 +2420,7 @@ int unit_file_get_list(
                                 goto found;
                         }
 
-                        r = find_symlinks_in_scope(scope, root_dir, de->d_name, &f->state);
+                        r = find_symlinks_in_scope(scope, root_dir, index, de->d_name, &f->state);
                         if (r < 0)
                                 return r;
                         else if (r > 0) {
@@ -2244,7 +2432,7 @@ int unit_file_get_list(
                         if (!path)
                                 return -ENOMEM;
 
-                        r = unit_file_can_install(&paths, root_dir, path, true, &also);
+                        r = unit_file_can_install(paths, root_dir, path, true, &also);
                         if (r == -EINVAL ||  /* Invalid setting? */
                             r == -EBADMSG || /* Invalid format? */
                             r == -ENOENT     /* Included file not found? */)
@@ -2267,6 +2455,51 @@ int unit_file_get_list(
         return 0;
 }
 
+int unit_file_get_list(
+                UnitFileScope scope,
+                const char *root_dir,
+                Hashmap *h) {
+
+        _cleanup_lookup_paths_free_ LookupPaths paths = {};
+        SymlinkIndex index[2] = {};
+        int r;
+
+        assert(scope >= 0);
+        assert(scope < _UNIT_FILE_SCOPE_MAX);
+        assert(h);
+
+        if (root_dir && scope != UNIT_FILE_SYSTEM)
+                return -EINVAL;
+
+        if (root_dir) {
+                r = access(root_dir, F_OK);
+                if (r < 0)
+                        return -errno;
+        }
+
+        r = lookup_paths_init_from_scope(&paths, scope, root_dir);
+        if (r < 0)
+                return r;
+
+        /* Walk the runtime and the normal config path once, instead
+         * of once per unit file */
+        r = symlink_index_build(scope, true, root_dir, index + 0);
+        if (r < 0)
+                goto finish;
+
+        r = symlink_index_build(scope, false, root_dir, index + 1);
+        if (r < 0)
+                goto finish;
+
+        r = unit_file_get_list_internal(scope, root_dir, &paths, index, h);
+
+finish:
+        symlink_index_done(index + 0);
+        symlink_index_done(index + 1);
+
+        return r;
+}
+
 static const char* const unit_file_state_table[_UNIT_FILE_STATE_MAX] = {
         [UNIT_FILE_ENABLED] = "enabled",
         [UNIT_FILE_ENABLED_RUNTIME] = "enabled-runtime",
@@ -486,6 +486,118 @@ static int output_verbose(
         return 0;
 }
 
+/* Entries for the export and JSON formats are assembled in one buffer
+ * and written out with a single fwrite(). The buffer starts out on the
+ * stack and only moves to the heap for unusually large entries, hence
+ * the common case doesn't allocate at all. */
+typedef struct OutputBuffer {
+        char *data;
+        size_t size;
+        size_t allocated;
+        bool oom;
+        union {
+                char chars[4096];
+                size_t align;
+        } initial;
+} OutputBuffer;
+
+static void output_buffer_init(OutputBuffer *b) {
+        assert(b);
+
+        b->data = b->initial.chars;
+        b->size = 0;
+        b->allocated = sizeof(b->initial);
+        b->oom = false;
+}
+
+static void output_buffer_done(OutputBuffer *b) {
+        assert(b);
+
+        if (b->data != b->initial.chars)
+                free(b->data);
+}
+
+static char* output_buffer_reserve(OutputBuffer *b, size_t l) {
+        size_t n;
+        char *p;
+
+        assert(b);
+
+        if (b->oom)
+                return NULL;
+
+        if (b->size + l <= b->allocated)
+                return b->data + b->size;
+
+        n = MAX(b->allocated * 2, b->size + l);
+
+        if (b->data == b->initial.chars) {
+                p = malloc(n);
+                if (p)
+                        memcpy(p, b->data, b->size);
+        } else
+                p = realloc(b->data, n);
+        if (!p) {
+                b->oom = true;
+                return NULL;
+        }
+
+        b->data = p;
+        b->allocated = n;
+
+        return b->data + b->size;
+}
+
+static void output_buffer_append(OutputBuffer *b, const void *d, size_t l) {
+        char *p;
+
+        p = output_buffer_reserve(b, l);
+        if (!p)
+                return;
+
+        memcpy(p, d, l);
+        b->size += l;
+}
+
+static void output_buffer_putc(OutputBuffer *b, char c) {
+        char *p;
+
+        p = output_buffer_reserve(b, 1);
+        if (!p)
+                return;
+
+        *p = c;
+        b->size ++;
+}
+
+static void output_buffer_puts(OutputBuffer *b, const char *s) {
+        output_buffer_append(b, s, strlen(s));
+}
+
+static void output_buffer_put_unsigned(OutputBuffer *b, uint64_t u) {
+        char buf[DECIMAL_STR_MAX(uint64_t)], *p = buf + sizeof(buf);
+
+        do {
+                *(--p) = '0' + u % 10;
+                u /= 10;
+        } while (u > 0);
+
+        output_buffer_append(b, p, buf + sizeof(buf) - p);
+}
+
+static int output_buffer_write(OutputBuffer *b, FILE *f) {
+        assert(b);
+        assert(f);
+
+        if (b->oom)
+                return log_oom();
+
+        fwrite(b->data, 1, b->size, f);
+        b->size = 0;
+
+        return 0;
+}
+
 static int output_export(
                 FILE *f,
                 sd_journal *j,
@@ -500,6 +612,7 @@ static int output_export(
         _cleanup_free_ char *cursor = NULL;
         const void *data;
         size_t length;
+        OutputBuffer b;
 
         assert(j);
 
@@ -517,15 +630,17 @@ static int output_export(
         if (r < 0)
                 return log_error_errno(r, "Failed to get cursor: %m");
 
-        fprintf(f,
-                "__CURSOR=%s\n"
-                "__REALTIME_TIMESTAMP="USEC_FMT"\n"
-                "__MONOTONIC_TIMESTAMP="USEC_FMT"\n"
-                "_BOOT_ID=%s\n",
-                cursor,
-                realtime,
-                monotonic,
-                sd_id128_to_string(boot_id, sid));
+        output_buffer_init(&b);
+
+        output_buffer_puts(&b, "__CURSOR=");
+        output_buffer_puts(&b, cursor);
+        output_buffer_puts(&b, "\n__REALTIME_TIMESTAMP=");
+        output_buffer_put_unsigned(&b, realtime);
+        output_buffer_puts(&b, "\n__MONOTONIC_TIMESTAMP=");
+        output_buffer_put_unsigned(&b, monotonic);
+        output_buffer_puts(&b, "\n_BOOT_ID=");
+        output_buffer_puts(&b, sd_id128_to_string(boot_id, sid));
+        output_buffer_putc(&b, '\n');
 
         JOURNAL_FOREACH_DATA_RETVAL(j, data, length, r) {
 
@@ -536,7 +651,7 @@ static int output_export(
                         continue;
 
                 if (utf8_is_printable_newline(data, length, false))
-                        fwrite(data, length, 1, f);
+                        output_buffer_append(&b, data, length);
                 else {
                         const char *c;
                         uint64_t le64;
@@ -544,25 +659,30 @@ static int output_export(
                         c = memchr(data, '=', length);
                         if (!c) {
                                 log_error("Invalid field.");
-                                return -EINVAL;
+                                r = -EINVAL;
+                                goto finish;
                         }
 
-                        fwrite(data, c - (const char*) data, 1, f);
-                        fputc('\n', f);
+                        output_buffer_append(&b, data, c - (const char*) data);
+                        output_buffer_putc(&b, '\n');
                         le64 = htole64(length - (c - (const char*) data) - 1);
-                        fwrite(&le64, sizeof(le64), 1, f);
-                        fwrite(c + 1, length - (c - (const char*) data) - 1, 1, f);
+                        output_buffer_append(&b, &le64, sizeof(le64));
+                        output_buffer_append(&b, c + 1, length - (c - (const char*) data) - 1);
                 }
 
-                fputc('\n', f);
+                output_buffer_putc(&b, '\n');
         }
 
         if (r < 0)
-                return r;
+                goto finish;
 
-        fputc('\n', f);
+        output_buffer_putc(&b, '\n');
 
-        return 0;
+        r = output_buffer_write(&b, f);
+
+finish:
+        output_buffer_done(&b);
+        return r;
 }
 
 void json_escape(
@@ -617,6 +737,83 @@ void json_escape(
         }
 }
 
+/* Same as json_escape(), but appends to an OutputBuffer */
+static void output_buffer_json_escape(
+                OutputBuffer *b,
+                const char* p,
+                size_t l,
+                OutputFlags flags) {
+
+        assert(b);
+        assert(p);
+
+        if (!(flags & OUTPUT_SHOW_ALL) && l >= JSON_THRESHOLD)
+                output_buffer_puts(b, "null");
+
+        else if (!utf8_is_printable(p, l)) {
+                bool not_first = false;
+
+                output_buffer_puts(b, "[ ");
+
+                while (l > 0) {
+                        if (not_first)
+                                output_buffer_puts(b, ", ");
+                        else
+                                not_first = true;
+
+                        output_buffer_put_unsigned(b, (uint8_t) *p);
+
+                        p++;
+                        l--;
+                }
+
+                output_buffer_puts(b, " ]");
+        } else {
+                const char *e;
+
+                output_buffer_putc(b, '\"');
+
+                while (l > 0) {
+                        /* Copy runs of characters that need no
+                         * escaping in one go */
+                        for (e = p; e < p + l; e++)
+                                if (*e == '"' || *e == '\\' || (uint8_t) *e < ' ')
+                                        break;
+
+                        output_buffer_append(b, p, e - p);
+                        l -= e - p;
+                        p = e;
+
+                        if (l == 0)
+                                break;
+
+                        if (*p == '"' || *p == '\\') {
+                                output_buffer_putc(b, '\\');
+                                output_buffer_putc(b, *p);
+                        } else if (*p == '\n')
+                                output_buffer_puts(b, "\\n");
+                        else {
+                                char u[7];
+
+                                xsprintf(u, "\\u%04x", (uint8_t) *p);
+                                output_buffer_puts(b, u);
+                        }
+
+                        p++;
+                        l--;
+                }
+
+                output_buffer_putc(b, '\"');
+        }
+}
+
+typedef struct JsonField {
+        size_t offset;
+        size_t length;
+        size_t name_length;
+        bool done;
+} JsonField;
+
 static int output_json(
                 FILE *f,
                 sd_journal *j,
@@ -627,12 +824,12 @@ static int output_json(
         uint64_t realtime, monotonic;
         _cleanup_free_ char *cursor = NULL;
         const void *data;
-        size_t length;
+        size_t length, n_fields, i, k;
         sd_id128_t boot_id;
-        char sid[33], *k;
+        char sid[33];
         int r;
-        Hashmap *h = NULL;
-        bool done, separator;
+        OutputBuffer b, values, fields;
+        JsonField *jf;
 
         assert(j);
 
@@ -650,41 +847,17 @@ static int output_json(
         if (r < 0)
                 return log_error_errno(r, "Failed to get cursor: %m");
 
-        if (mode == OUTPUT_JSON_PRETTY)
-                fprintf(f,
-                        "{\n"
-                        "\t\"__CURSOR\" : \"%s\",\n"
-                        "\t\"__REALTIME_TIMESTAMP\" : \""USEC_FMT"\",\n"
-                        "\t\"__MONOTONIC_TIMESTAMP\" : \""USEC_FMT"\",\n"
-                        "\t\"_BOOT_ID\" : \"%s\"",
-                        cursor,
-                        realtime,
-                        monotonic,
-                        sd_id128_to_string(boot_id, sid));
-        else {
-                if (mode == OUTPUT_JSON_SSE)
-                        fputs("data: ", f);
-
-                fprintf(f,
-                        "{ \"__CURSOR\" : \"%s\", "
-                        "\"__REALTIME_TIMESTAMP\" : \""USEC_FMT"\", "
-                        "\"__MONOTONIC_TIMESTAMP\" : \""USEC_FMT"\", "
-                        "\"_BOOT_ID\" : \"%s\"",
-                        cursor,
-                        realtime,
-                        monotonic,
-                        sd_id128_to_string(boot_id, sid));
-        }
-
-        h = hashmap_new(&string_hash_ops);
-        if (!h)
-                return log_oom();
+        output_buffer_init(&b);
+        output_buffer_init(&values);
+        output_buffer_init(&fields);
 
-        /* First round, iterate through the entry and count how often each field appears */
+        /* First round, copy all fields of the entry into the arena,
+         * since the data pointers are only valid until the next
+         * call. Fields that appear more than once are printed as
+         * arrays, at the position they first appear in. */
         JOURNAL_FOREACH_DATA_RETVAL(j, data, length, r) {
                 const char *eq;
-                char *n;
-                unsigned u;
+                JsonField *p;
 
                 if (length >= 9 &&
                     memcmp(data, "_BOOT_ID=", 9) == 0)
@@ -694,143 +867,105 @@ static int output_json(
                 if (!eq)
                         continue;
 
-                n = strndup(data, eq - (const char*) data);
-                if (!n) {
-                        r = log_oom();
-                        goto finish;
-                }
+                p = (JsonField*) output_buffer_reserve(&fields, sizeof(JsonField));
+                if (!p)
+                        break;
 
-                u = PTR_TO_UINT(hashmap_get(h, n));
-                if (u == 0) {
-                        r = hashmap_put(h, n, UINT_TO_PTR(1));
-                        if (r < 0) {
-                                free(n);
-                                log_oom();
-                                goto finish;
-                        }
-                } else {
-                        r = hashmap_update(h, n, UINT_TO_PTR(u + 1));
-                        free(n);
-                        if (r < 0) {
-                                log_oom();
-                                goto finish;
-                        }
-                }
+                *p = (JsonField) {
+                        .offset = values.size,
+                        .length = length,
+                        .name_length = eq - (const char*) data,
+                };
+                fields.size += sizeof(JsonField);
+
+                output_buffer_append(&values, data, length);
         }
 
         if (r < 0)
-                return r;
-
-        separator = true;
-        do {
-                done = true;
-
-                SD_JOURNAL_FOREACH_DATA(j, data, length) {
-                        const char *eq;
-                        char *kk, *n;
-                        size_t m;
-                        unsigned u;
-
-                        /* We already printed the boot id, from the data in
-                         * the header, hence let's suppress it here */
-                        if (length >= 9 &&
-                            memcmp(data, "_BOOT_ID=", 9) == 0)
-                                continue;
-
-                        eq = memchr(data, '=', length);
-                        if (!eq)
-                                continue;
-
-                        if (separator) {
-                                if (mode == OUTPUT_JSON_PRETTY)
-                                        fputs(",\n\t", f);
-                                else
-                                        fputs(", ", f);
-                        }
-
-                        m = eq - (const char*) data;
-
-                        n = strndup(data, m);
-                        if (!n) {
-                                r = log_oom();
-                                goto finish;
-                        }
-
-                        u = PTR_TO_UINT(hashmap_get2(h, n, (void**) &kk));
-                        if (u == 0) {
-                                /* We already printed this, let's jump to the next */
-                                free(n);
-                                separator = false;
-
-                                continue;
-                        } else if (u == 1) {
-                                /* Field only appears once, output it directly */
+                goto finish;
 
-                                json_escape(f, data, m, flags);
-                                fputs(" : ", f);
+        if (mode == OUTPUT_JSON_PRETTY)
+                output_buffer_puts(&b, "{\n\t\"__CURSOR\" : \"");
+        else {
+                if (mode == OUTPUT_JSON_SSE)
+                        output_buffer_puts(&b, "data: ");
 
-                                json_escape(f, eq + 1, length - m - 1, flags);
+                output_buffer_puts(&b, "{ \"__CURSOR\" : \"");
+        }
 
-                                hashmap_remove(h, n);
-                                free(kk);
-                                free(n);
+        output_buffer_puts(&b, cursor);
+        output_buffer_puts(&b, mode == OUTPUT_JSON_PRETTY ? "\",\n\t\"__REALTIME_TIMESTAMP\" : \"" : "\", \"__REALTIME_TIMESTAMP\" : \"");
+        output_buffer_put_unsigned(&b, realtime);
+        output_buffer_puts(&b, mode == OUTPUT_JSON_PRETTY ? "\",\n\t\"__MONOTONIC_TIMESTAMP\" : \"" : "\", \"__MONOTONIC_TIMESTAMP\" : \"");
+        output_buffer_put_unsigned(&b, monotonic);
+        output_buffer_puts(&b, mode == OUTPUT_JSON_PRETTY ? "\",\n\t\"_BOOT_ID\" : \"" : "\", \"_BOOT_ID\" : \"");
+        output_buffer_puts(&b, sd_id128_to_string(boot_id, sid));
+        output_buffer_putc(&b, '"');
 
-                                separator = true;
+        jf = (JsonField*) fields.data;
+        n_fields = fields.oom ? 0 : fields.size / sizeof(JsonField);
 
-                                continue;
+        for (i = 0; i < n_fields; i++) {
+                const char *d = values.data + jf[i].offset;
+                size_t m = jf[i].name_length;
+                bool multiple = false;
 
-                        } else {
-                                /* Field appears multiple times, output it as array */
-                                json_escape(f, data, m, flags);
-                                fputs(" : [ ", f);
-                                json_escape(f, eq + 1, length - m - 1, flags);
-
-                                /* Iterate through the end of the list */
+                if (jf[i].done)
+                        continue;
 
-                                while (sd_journal_enumerate_data(j, &data, &length) > 0) {
-                                        if (length < m + 1)
-                                                continue;
+                for (k = i + 1; k < n_fields; k++)
+                        if (jf[k].name_length == m &&
+                            memcmp(values.data + jf[k].offset, d, m) == 0) {
+                                multiple = true;
+                                break;
+                        }
 
-                                        if (memcmp(data, n, m) != 0)
-                                                continue;
+                output_buffer_puts(&b, mode == OUTPUT_JSON_PRETTY ? ",\n\t" : ", ");
 
-                                        if (((const char*) data)[m] != '=')
-                                                continue;
+                output_buffer_json_escape(&b, d, m, flags);
+                output_buffer_puts(&b, " : ");
 
-                                        fputs(", ", f);
-                                        json_escape(f, (const char*) data + m + 1, length - m - 1, flags);
-                                }
+                if (!multiple) {
+                        /* Field only appears once, output it directly */
+                        output_buffer_json_escape(&b, d + m + 1, jf[i].length - m - 1, flags);
+                        continue;
+                }
 
-                                fputs(" ]", f);
+                /* Field appears multiple times, output it as array */
+                output_buffer_puts(&b, "[ ");
+                output_buffer_json_escape(&b, d + m + 1, jf[i].length - m - 1, flags);
 
-                                hashmap_remove(h, n);
-                                free(kk);
-                                free(n);
+                for (; k < n_fields; k++) {
+                        const char *e = values.data + jf[k].offset;
 
-                                /* Iterate data fields form the beginning */
-                                done = false;
-                                separator = true;
+                        if (jf[k].name_length != m ||
+                            memcmp(e, d, m) != 0)
+                                continue;
 
-                                break;
-                        }
+                        output_buffer_puts(&b, ", ");
+                        output_buffer_json_escape(&b, e + m + 1, jf[k].length - m - 1, flags);
+                        jf[k].done = true;
                 }
 
-        } while (!done);
+                output_buffer_puts(&b, " ]");
+        }
 
         if (mode == OUTPUT_JSON_PRETTY)
-                fputs("\n}\n", f);
+                output_buffer_puts(&b, "\n}\n");
         else if (mode == OUTPUT_JSON_SSE)
-                fputs("}\n\n", f);
+                output_buffer_puts(&b, "}\n\n");
         else
-                fputs(" }\n", f);
+                output_buffer_puts(&b, " }\n");
 
-        r = 0;
+        if (values.oom || fields.oom)
+                r = log_oom();
+        else
+                r = output_buffer_write(&b, f);
 
 finish:
-        while ((k = hashmap_steal_first_key(h)))
-                free(k);
-
-        hashmap_free(h);
+        output_buffer_done(&b);
+        output_buffer_done(&values);
+        output_buffer_done(&fields);
 
         return r;
 }
@@ -33,7 +33,7 @@
 
 #include "machine-image.h"
 
-static const char image_search_path[] =
+const char image_search_path[] =
         "/var/lib/machines\0"
         "/var/lib/container\0" /* legacy */
         "/usr/local/lib/machines\0"
@@ -176,7 +176,6 @@ static int image_make(
                                 return r;
                         if (r) {
                                 BtrfsSubvolInfo info;
-                                BtrfsQuotaInfo quota;
 
                                 /* It's a btrfs subvolume */
 
@@ -195,14 +194,9 @@ static int image_make(
                                 if (r < 0)
                                         return r;
 
-                                r = btrfs_subvol_get_quota_fd(fd, &quota);
-                                if (r >= 0) {
-                                        (*ret)->usage = quota.referenced;
-                                        (*ret)->usage_exclusive = quota.exclusive;
-
-                                        (*ret)->limit = quota.referenced_max;
-                                        (*ret)->limit_exclusive = quota.exclusive_max;
-                                }
+                                /* The quota is comparatively
+                                 * expensive to query, it is left to
+                                 * image_read_usage() */
 
                                 return 1;
                         }
@@ -253,6 +247,7 @@ static int image_make(
 
                 (*ret)->usage = (*ret)->usage_exclusive = st.st_blocks * 512;
                 (*ret)->limit = (*ret)->limit_exclusive = st.st_size;
+                (*ret)->usage_timestamp = now(CLOCK_MONOTONIC);
 
                 return 1;
         }
@@ -325,13 +320,21 @@ int image_discover(Hashmap *h) {
 
                 FOREACH_DIRENT_ALL(de, d, return -errno) {
                         _cleanup_(image_unrefp) Image *image = NULL;
+                        const char *e;
 
                         if (!image_name_is_valid(de->d_name))
                                 continue;
 
+                        /* Images already in the map are left
+                         * alone, so that callers may keep the map
+                         * around and only fill in what is new */
                         if (hashmap_contains(h, de->d_name))
                                 continue;
 
+                        e = endswith(de->d_name, ".raw");
+                        if (e && hashmap_contains(h, strndupa(de->d_name, e - de->d_name)))
+                                continue;
+
                         r = image_make(NULL, dirfd(d), path, de->d_name, &image);
                         if (r == 0 || r == -ENOENT)
                                 continue;
@@ -364,6 +367,51 @@ int image_discover(Hashmap *h) {
         return 0;
 }
 
+int image_read_usage(Image *i) {
+        _cleanup_close_ int fd = -1;
+        BtrfsQuotaInfo quota;
+        struct stat st;
+        int r;
+
+        assert(i);
+
+        /* Also on failure, so that we don't retry right away, for
+         * example when quota is not enabled */
+        i->usage_timestamp = now(CLOCK_MONOTONIC);
+
+        switch (i->type) {
+
+        case IMAGE_SUBVOLUME:
+                fd = open(i->path, O_RDONLY|O_CLOEXEC|O_NOCTTY|O_DIRECTORY);
+                if (fd < 0)
+                        return -errno;
+
+                r = btrfs_subvol_get_quota_fd(fd, &quota);
+                if (r < 0)
+                        return r;
+
+                i->usage = quota.referenced;
+                i->usage_exclusive = quota.exclusive;
+
+                i->limit = quota.referenced_max;
+                i->limit_exclusive = quota.exclusive_max;
+                break;
+
+        case IMAGE_RAW:
+                if (stat(i->path, &st) < 0)
+                        return -errno;
+
+                i->usage = i->usage_exclusive = st.st_blocks * 512;
+                i->limit = i->limit_exclusive = st.st_size;
+                break;
+
+        default:
+                break;
+        }
+
+        return 0;
+}
+
 void image_hashmap_free(Hashmap *map) {
         Image *i;
 
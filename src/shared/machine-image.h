@@ -46,10 +46,13 @@ typedef struct Image {
         uint64_t usage_exclusive;
         uint64_t limit;
         uint64_t limit_exclusive;
+        usec_t usage_timestamp; /* CLOCK_MONOTONIC, 0 if not read yet */
 
         void *userdata;
 } Image;
 
+extern const char image_search_path[];
+
 Image *image_unref(Image *i);
 void image_hashmap_free(Hashmap *map);
 
@@ -58,6 +61,7 @@ DEFINE_TRIVIAL_CLEANUP_FUNC(Hashmap*, image_hashmap_free);
 
 int image_find(const char *name, Image **ret);
 int image_discover(Hashmap *map);
+int image_read_usage(Image *i);
 
 int image_remove(Image *i);
 int image_rename(Image *i, const char *new_name);
@@ -26,6 +26,7 @@
 #include <string.h>
 #include <netdb.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <unistd.h>
@@ -42,15 +43,35 @@
 
 #define BUFFER_SIZE (256 * 1024)
 #define CONNECTIONS_MAX 256
+#define THREADS_MAX 256
+#define PIPE_POOL_MAX 64
+
+/* How long a resolved remote address is used for new connections */
+#define REMOTE_ADDRESS_USEC (60 * USEC_PER_SEC)
 
 static const char *arg_remote_host = NULL;
+static unsigned arg_connections_max = CONNECTIONS_MAX;
+static unsigned arg_threads = 1;
+
+/* Connections of all threads, updated atomically */
+static unsigned n_connections = 0;
 
 typedef struct Context {
         sd_event *event;
         sd_resolve *resolve;
 
+        int n_listen_fds;
         Set *listen;
         Set *connections;
+
+        /* Empty pipes of closed connections, for reuse */
+        int pipe_pool[PIPE_POOL_MAX][2];
+        size_t pipe_pool_size[PIPE_POOL_MAX];
+        unsigned n_pipe_pool;
+
+        union sockaddr_union remote_address;
+        socklen_t remote_address_len;
+        usec_t remote_address_timestamp;
 } Context;
 
 typedef struct Connection {
@@ -68,6 +89,29 @@ typedef struct Connection {
         sd_resolve_query *resolve_query;
 } Connection;
 
+static void connection_release_pipe(Connection *c, int buffer[2], size_t sz, size_t full) {
+        Context *context;
+
+        assert(c);
+        assert(buffer);
+
+        context = c->context;
+
+        /* Keep empty pipes around for the next connections, instead
+         * of creating two new ones for each of them */
+        if (buffer[0] >= 0 && full == 0 && context && context->n_pipe_pool < PIPE_POOL_MAX) {
+                context->pipe_pool[context->n_pipe_pool][0] = buffer[0];
+                context->pipe_pool[context->n_pipe_pool][1] = buffer[1];
+                context->pipe_pool_size[context->n_pipe_pool] = sz;
+                context->n_pipe_pool++;
+
+                buffer[0] = buffer[1] = -1;
+                return;
+        }
+
+        safe_close_pair(buffer);
+}
+
 static void connection_free(Connection *c) {
         assert(c);
 
@@ -80,12 +124,14 @@ static void connection_free(Connection *c) {
         safe_close(c->server_fd);
         safe_close(c->client_fd);
 
-        safe_close_pair(c->server_to_client_buffer);
-        safe_close_pair(c->client_to_server_buffer);
+        connection_release_pipe(c, c->server_to_client_buffer, c->server_to_client_buffer_size, c->server_to_client_buffer_full);
+        connection_release_pipe(c, c->client_to_server_buffer, c->client_to_server_buffer_size, c->client_to_server_buffer_full);
 
         sd_resolve_query_unref(c->resolve_query);
 
         free(c);
+
+        __sync_fetch_and_sub(&n_connections, 1);
 }
 
 static void context_free(Context *context) {
@@ -103,6 +149,9 @@ static void context_free(Context *context) {
         set_free(context->listen);
         set_free(context->connections);
 
+        while (context->n_pipe_pool > 0)
+                safe_close_pair(context->pipe_pool[--context->n_pipe_pool]);
+
         sd_event_unref(context->event);
         sd_resolve_unref(context->resolve);
 }
@@ -117,6 +166,16 @@ static int connection_create_pipes(Connection *c, int buffer[2], size_t *sz) {
         if (buffer[0] >= 0)
                 return 0;
 
+        if (c->context->n_pipe_pool > 0) {
+                c->context->n_pipe_pool--;
+
+                buffer[0] = c->context->pipe_pool[c->context->n_pipe_pool][0];
+                buffer[1] = c->context->pipe_pool[c->context->n_pipe_pool][1];
+                *sz = c->context->pipe_pool_size[c->context->n_pipe_pool];
+
+                return 0;
+        }
+
         r = pipe2(buffer, O_CLOEXEC|O_NONBLOCK);
         if (r < 0)
                 return log_error_errno(errno, "Failed to allocate pipe buffer: %m");
@@ -313,6 +372,9 @@ static int connect_cb(sd_event_source *s, int fd, uint32_t revents, void *userda
 
         if (error != 0) {
                 log_error_errno(error, "Failed to connect to remote host: %m");
+
+                /* Maybe the host moved, look it up again next time */
+                c->context->remote_address_timestamp = 0;
                 goto fail;
         }
 
@@ -382,6 +444,12 @@ static int resolve_cb(sd_resolve_query *q, int ret, const struct addrinfo *ai, v
 
         c->resolve_query = sd_resolve_query_unref(c->resolve_query);
 
+        if (ai->ai_addrlen <= sizeof(c->context->remote_address)) {
+                memcpy(&c->context->remote_address, ai->ai_addr, ai->ai_addrlen);
+                c->context->remote_address_len = ai->ai_addrlen;
+                c->context->remote_address_timestamp = now(CLOCK_MONOTONIC);
+        }
+
         return connection_start(c, ai->ai_addr, ai->ai_addrlen);
 
 fail:
@@ -423,6 +491,11 @@ static int resolve_remote(Connection *c) {
                 return connection_start(c, &sa.sa, salen);
         }
 
+        /* Don't look up the remote host for every single connection */
+        if (c->context->remote_address_timestamp > 0 &&
+            c->context->remote_address_timestamp + REMOTE_ADDRESS_USEC > now(CLOCK_MONOTONIC))
+                return connection_start(c, &c->context->remote_address.sa, c->context->remote_address_len);
+
         service = strrchr(arg_remote_host, ':');
         if (service) {
                 node = strndupa(arg_remote_host, service - arg_remote_host);
@@ -453,7 +526,8 @@ static int add_connection_socket(Context *context, int fd) {
         assert(context);
         assert(fd >= 0);
 
-        if (set_size(context->connections) > CONNECTIONS_MAX) {
+        if (__sync_add_and_fetch(&n_connections, 1) > arg_connections_max) {
+                __sync_fetch_and_sub(&n_connections, 1);
                 log_warning("Hit connection limit, refusing connection.");
                 safe_close(fd);
                 return 0;
@@ -461,12 +535,16 @@ static int add_connection_socket(Context *context, int fd) {
 
         r = set_ensure_allocated(&context->connections, NULL);
         if (r < 0) {
+                __sync_fetch_and_sub(&n_connections, 1);
+                safe_close(fd);
                 log_oom();
                 return 0;
         }
 
         c = new0(Connection, 1);
         if (!c) {
+                __sync_fetch_and_sub(&n_connections, 1);
+                safe_close(fd);
                 log_oom();
                 return 0;
         }
@@ -479,7 +557,8 @@ static int add_connection_socket(Context *context, int fd) {
 
         r = set_put(context->connections, c);
         if (r < 0) {
-                free(c);
+                c->context = NULL;
+                connection_free(c);
                 log_oom();
                 return 0;
         }
@@ -499,7 +578,8 @@ static int accept_cb(sd_event_source *s, int fd, uint32_t revents, void *userdat
 
         nfd = accept4(fd, NULL, NULL, SOCK_NONBLOCK|SOCK_CLOEXEC);
         if (nfd < 0) {
-                if (errno != -EAGAIN)
+                /* Another thread might have been quicker */
+                if (errno != EAGAIN)
                         log_warning_errno(errno, "Failed to accept() socket: %m");
         } else {
                 getpeername_pretty(nfd, &peer);
@@ -572,7 +652,9 @@ static void help(void) {
                "%1$s [SOCKET]\n\n"
                "Bidirectionally proxy local sockets to another (possibly remote) socket.\n\n"
                "  -h --help              Show this help\n"
-               "     --version           Show package version\n",
+               "     --version           Show package version\n"
+               "     --connections-max=N Set the maximum number of connections to be accepted\n"
+               "     --threads=N         Serve connections from N event loop threads\n",
                program_invocation_short_name);
 }
 
@@ -580,16 +662,20 @@ static int parse_argv(int argc, char *argv[]) {
 
         enum {
                 ARG_VERSION = 0x100,
-                ARG_IGNORE_ENV
+                ARG_IGNORE_ENV,
+                ARG_CONNECTIONS_MAX,
+                ARG_THREADS,
         };
 
         static const struct option options[] = {
-                { "help",       no_argument, NULL, 'h'           },
-                { "version",    no_argument, NULL, ARG_VERSION   },
+                { "help",            no_argument,       NULL, 'h'                 },
+                { "version",         no_argument,       NULL, ARG_VERSION         },
+                { "connections-max", required_argument, NULL, ARG_CONNECTIONS_MAX },
+                { "threads",         required_argument, NULL, ARG_THREADS         },
                 {}
         };
 
-        int c;
+        int c, r;
 
         assert(argc >= 0);
         assert(argv);
@@ -607,6 +693,24 @@ static int parse_argv(int argc, char *argv[]) {
                         puts(SYSTEMD_FEATURES);
                         return 0;
 
+                case ARG_CONNECTIONS_MAX:
+                        r = safe_atou(optarg, &arg_connections_max);
+                        if (r < 0 || arg_connections_max < 1) {
+                                log_error("Connection limit is invalid: %s", optarg);
+                                return -EINVAL;
+                        }
+
+                        break;
+
+                case ARG_THREADS:
+                        r = safe_atou(optarg, &arg_threads);
+                        if (r < 0 || arg_threads < 1 || arg_threads > THREADS_MAX) {
+                                log_error("Number of threads is invalid: %s", optarg);
+                                return -EINVAL;
+                        }
+
+                        break;
+
                 case '?':
                         return -EINVAL;
 
@@ -628,9 +732,57 @@ static int parse_argv(int argc, char *argv[]) {
         return 1;
 }
 
+static int context_run(Context *context, bool watchdog) {
+        int r, fd;
+
+        assert(context);
+
+        /* Both are per thread */
+        r = sd_event_default(&context->event);
+        if (r < 0)
+                return log_error_errno(r, "Failed to allocate event loop: %m");
+
+        r = sd_resolve_default(&context->resolve);
+        if (r < 0)
+                return log_error_errno(r, "Failed to allocate resolver: %m");
+
+        r = sd_resolve_attach_event(context->resolve, context->event, 0);
+        if (r < 0)
+                return log_error_errno(r, "Failed to attach resolver: %m");
+
+        if (watchdog)
+                sd_event_set_watchdog(context->event, true);
+
+        /* Every thread watches all listening sockets, whichever
+         * wakes up first accepts the connection */
+        for (fd = SD_LISTEN_FDS_START; fd < SD_LISTEN_FDS_START + context->n_listen_fds; fd++) {
+                r = add_listen_socket(context, fd);
+                if (r < 0)
+                        return r;
+        }
+
+        r = sd_event_loop(context->event);
+        if (r < 0)
+                return log_error_errno(r, "Failed to run event loop: %m");
+
+        return 0;
+}
+
+static void* context_thread(void *p) {
+        Context context = {
+                .n_listen_fds = PTR_TO_INT(p),
+        };
+
+        (void) context_run(&context, false);
+        context_free(&context);
+
+        return NULL;
+}
+
 int main(int argc, char *argv[]) {
         Context context = {};
-        int r, n, fd;
+        unsigned i;
+        int r, n;
 
         log_parse_environment();
         log_open();
@@ -639,26 +791,6 @@ int main(int argc, char *argv[]) {
         if (r <= 0)
                 goto finish;
 
-        r = sd_event_default(&context.event);
-        if (r < 0) {
-                log_error_errno(r, "Failed to allocate event loop: %m");
-                goto finish;
-        }
-
-        r = sd_resolve_default(&context.resolve);
-        if (r < 0) {
-                log_error_errno(r, "Failed to allocate resolver: %m");
-                goto finish;
-        }
-
-        r = sd_resolve_attach_event(context.resolve, context.event, 0);
-        if (r < 0) {
-                log_error_errno(r, "Failed to attach resolver: %m");
-                goto finish;
-        }
-
-        sd_event_set_watchdog(context.event, true);
-
         n = sd_listen_fds(1);
         if (n < 0) {
                 log_error("Failed to receive sockets from parent.");
@@ -670,18 +802,23 @@ int main(int argc, char *argv[]) {
                 goto finish;
         }
 
-        for (fd = SD_LISTEN_FDS_START; fd < SD_LISTEN_FDS_START + n; fd++) {
-                r = add_listen_socket(&context, fd);
-                if (r < 0)
+        /* The main thread serves one event loop, any further ones
+         * get their own thread and go away with the process */
+        for (i = 1; i < arg_threads; i++) {
+                pthread_t t;
+
+                r = pthread_create(&t, NULL, context_thread, INT_TO_PTR(n));
+                if (r != 0) {
+                        r = log_error_errno(r, "Failed to start thread: %m");
                         goto finish;
-        }
+                }
 
-        r = sd_event_loop(context.event);
-        if (r < 0) {
-                log_error_errno(r, "Failed to run event loop: %m");
-                goto finish;
+                (void) pthread_detach(t);
         }
 
+        context.n_listen_fds = n;
+        r = context_run(&context, true);
+
 finish:
         context_free(&context);
 
@@ -89,6 +89,7 @@ static enum dependency {
 static const char *arg_job_mode = "replace";
 static UnitFileScope arg_scope = UNIT_FILE_SYSTEM;
 static bool arg_no_block = false;
+static bool arg_if_changed = false;
 static bool arg_no_legend = false;
 static bool arg_no_pager = false;
 static bool arg_no_wtmp = false;
@@ -512,7 +513,9 @@ static int get_unit_list(
         _cleanup_bus_message_unref_ sd_bus_message *m = NULL;
         _cleanup_bus_error_free_ sd_bus_error error = SD_BUS_ERROR_NULL;
         _cleanup_bus_message_unref_ sd_bus_message *reply = NULL;
+        _cleanup_strv_free_ char **type_patterns = NULL;
         size_t size = c;
+        char **t;
         int r;
         UnitInfo u;
 
@@ -520,14 +523,31 @@ static int get_unit_list(
         assert(unit_infos);
         assert(_reply);
 
+        /* Let the manager do the filtering by name, so that it only
+         * sends us what we show. Without patterns, the types can be
+         * expressed as patterns, too. Everything is checked again by
+         * output_show_unit() below, in case the manager is older and
+         * only knows ListUnitsFiltered(). */
+        if (strv_isempty(patterns))
+                STRV_FOREACH(t, arg_types) {
+                        char *p;
+
+                        p = strappend("*.", *t);
+                        if (!p)
+                                return log_oom();
+
+                        r = strv_consume(&type_patterns, p);
+                        if (r < 0)
+                                return log_oom();
+                }
+
         r = sd_bus_message_new_method_call(
                         bus,
                         &m,
                         "org.freedesktop.systemd1",
                         "/org/freedesktop/systemd1",
                         "org.freedesktop.systemd1.Manager",
-                        "ListUnitsFiltered");
-
+                        "ListUnitsByPatterns");
         if (r < 0)
                 return bus_log_create_error(r);
 
@@ -535,7 +555,31 @@ static int get_unit_list(
         if (r < 0)
                 return bus_log_create_error(r);
 
+        r = sd_bus_message_append_strv(m, strv_isempty(patterns) ? type_patterns : patterns);
+        if (r < 0)
+                return bus_log_create_error(r);
+
         r = sd_bus_call(bus, m, 0, &error, &reply);
+        if (r < 0 && sd_bus_error_has_name(&error, SD_BUS_ERROR_UNKNOWN_METHOD)) {
+                m = sd_bus_message_unref(m);
+                sd_bus_error_free(&error);
+
+                r = sd_bus_message_new_method_call(
+                                bus,
+                                &m,
+                                "org.freedesktop.systemd1",
+                                "/org/freedesktop/systemd1",
+                                "org.freedesktop.systemd1.Manager",
+                                "ListUnitsFiltered");
+                if (r < 0)
+                        return bus_log_create_error(r);
+
+                r = sd_bus_message_append_strv(m, arg_states);
+                if (r < 0)
+                        return bus_log_create_error(r);
+
+                r = sd_bus_call(bus, m, 0, &error, &reply);
+        }
         if (r < 0)
                 return log_error_errno(r, "Failed to list units: %s", bus_error_message(&error, r));
 
@@ -4300,16 +4344,14 @@ static int print_property(const char *name, sd_bus_message *m, const char *conte
         return 0;
 }
 
-static int show_one(
+static int show_one_reply(
                 const char *verb,
-                sd_bus *bus,
                 const char *path,
+                sd_bus_message *reply,
                 bool show_properties,
                 bool *new_line,
                 bool *ellipsized) {
 
-        _cleanup_bus_message_unref_ sd_bus_message *reply = NULL;
-        _cleanup_bus_error_free_ sd_bus_error error = SD_BUS_ERROR_NULL;
         UnitStatusInfo info = {
                 .memory_current = (uint64_t) -1,
                 .memory_limit = (uint64_t) -1,
@@ -4321,22 +4363,11 @@ static int show_one(
         int r;
 
         assert(path);
+        assert(reply);
         assert(new_line);
 
         log_debug("Showing one %s", path);
 
-        r = sd_bus_call_method(
-                        bus,
-                        "org.freedesktop.systemd1",
-                        path,
-                        "org.freedesktop.DBus.Properties",
-                        "GetAll",
-                        &error,
-                        &reply,
-                        "s", "");
-        if (r < 0)
-                return log_error_errno(r, "Failed to get properties: %s", bus_error_message(&error, r));
-
         r = sd_bus_message_enter_container(reply, SD_BUS_TYPE_ARRAY, "{sv}");
         if (r < 0)
                 return bus_log_parse_error(r);
@@ -4420,6 +4451,166 @@ static int show_one(
         return r;
 }
 
+static int show_one(
+                const char *verb,
+                sd_bus *bus,
+                const char *path,
+                bool show_properties,
+                bool *new_line,
+                bool *ellipsized) {
+
+        _cleanup_bus_message_unref_ sd_bus_message *reply = NULL;
+        _cleanup_bus_error_free_ sd_bus_error error = SD_BUS_ERROR_NULL;
+        int r;
+
+        assert(path);
+
+        r = sd_bus_call_method(
+                        bus,
+                        "org.freedesktop.systemd1",
+                        path,
+                        "org.freedesktop.DBus.Properties",
+                        "GetAll",
+                        &error,
+                        &reply,
+                        "s", "");
+        if (r < 0)
+                return log_error_errno(r, "Failed to get properties: %s", bus_error_message(&error, r));
+
+        return show_one_reply(verb, path, reply, show_properties, new_line, ellipsized);
+}
+
+/* Up to this many units are shown with one GetAll() call after the
+ * other, more are fetched with this many calls in flight at a time */
+#define SHOW_PIPELINE_MIN 4U
+#define SHOW_PIPELINE_MAX 64U
+
+typedef struct PendingGetAll {
+        sd_bus_slot *slot;
+        sd_bus_message *reply;
+        unsigned *n_pending;
+} PendingGetAll;
+
+static int on_get_all_reply(sd_bus_message *m, void *userdata, sd_bus_error *error) {
+        PendingGetAll *g = userdata;
+
+        assert(g);
+
+        g->reply = sd_bus_message_ref(m);
+        g->slot = sd_bus_slot_unref(g->slot);
+        (*g->n_pending)--;
+
+        return 0;
+}
+
+static int show_units(
+                const char *verb,
+                sd_bus *bus,
+                char **paths,
+                bool show_properties,
+                bool *new_line,
+                bool *ellipsized) {
+
+        unsigned n, k, n_paths, n_pending;
+        PendingGetAll *pending;
+        int r, ret = 0;
+
+        n_paths = strv_length(paths);
+
+        /* For a handful of units, simply ask for one after the
+         * other. Otherwise, issue the GetAll() calls in batches
+         * without waiting for each reply in between, so that
+         * "systemctl show '*'" doesn't pay one round trip per unit. */
+        if (n_paths <= SHOW_PIPELINE_MIN) {
+                for (n = 0; n < n_paths; n++) {
+                        r = show_one(verb, bus, paths[n], show_properties, new_line, ellipsized);
+                        if (r < 0)
+                                return r;
+                        else if (r > 0 && ret == 0)
+                                ret = r;
+                }
+
+                return ret;
+        }
+
+        pending = newa0(PendingGetAll, SHOW_PIPELINE_MAX);
+
+        for (n = 0; n < n_paths; n += SHOW_PIPELINE_MAX) {
+                unsigned n_batch = MIN(n_paths - n, SHOW_PIPELINE_MAX);
+
+                n_pending = 0;
+                for (k = 0; k < n_batch; k++) {
+                        _cleanup_bus_message_unref_ sd_bus_message *m = NULL;
+
+                        pending[k].n_pending = &n_pending;
+
+                        r = sd_bus_message_new_method_call(
+                                        bus,
+                                        &m,
+                                        "org.freedesktop.systemd1",
+                                        paths[n + k],
+                                        "org.freedesktop.DBus.Properties",
+                                        "GetAll");
+                        if (r < 0)
+                                goto fail;
+
+                        r = sd_bus_message_append(m, "s", "");
+                        if (r < 0)
+                                goto fail;
+
+                        r = sd_bus_call_async(bus, &pending[k].slot, m, on_get_all_reply, pending + k, 0);
+                        if (r < 0)
+                                goto fail;
+
+                        n_pending++;
+                }
+
+                while (n_pending > 0) {
+                        r = sd_bus_process(bus, NULL);
+                        if (r < 0)
+                                goto fail;
+                        if (r > 0)
+                                continue;
+
+                        r = sd_bus_wait(bus, (uint64_t) -1);
+                        if (r < 0)
+                                goto fail;
+                }
+
+                for (k = 0; k < n_batch; k++) {
+                        const sd_bus_error *e;
+
+                        e = sd_bus_message_get_error(pending[k].reply);
+                        if (e) {
+                                r = log_error_errno(sd_bus_error_get_errno(e), "Failed to get properties: %s",
+                                                    bus_error_message(e, sd_bus_error_get_errno(e)));
+                                goto finish;
+                        }
+
+                        r = show_one_reply(verb, paths[n + k], pending[k].reply, show_properties, new_line, ellipsized);
+                        if (r < 0)
+                                goto finish;
+                        else if (r > 0 && ret == 0)
+                                ret = r;
+
+                        pending[k].reply = sd_bus_message_unref(pending[k].reply);
+                }
+        }
+
+        return ret;
+
+fail:
+        log_error_errno(r, "Failed to get properties: %m");
+
+finish:
+        for (k = 0; k < SHOW_PIPELINE_MAX; k++) {
+                sd_bus_slot_unref(pending[k].slot);
+                sd_bus_message_unref(pending[k].reply);
+        }
+
+        return r;
+}
+
 static int get_unit_dbus_path_by_pid(
                 sd_bus *bus,
                 uint32_t pid,
@@ -4465,9 +4656,10 @@ static int show_all(
 
         _cleanup_bus_message_unref_ sd_bus_message *reply = NULL;
         _cleanup_free_ UnitInfo *unit_infos = NULL;
+        _cleanup_strv_free_ char **paths = NULL;
         const UnitInfo *u;
         unsigned c;
-        int r, ret = 0;
+        int r;
 
         r = get_unit_list(bus, NULL, NULL, &unit_infos, 0, &reply);
         if (r < 0)
@@ -4480,20 +4672,18 @@ static int show_all(
         qsort_safe(unit_infos, c, sizeof(UnitInfo), compare_unit_info);
 
         for (u = unit_infos; u < unit_infos + c; u++) {
-                _cleanup_free_ char *p = NULL;
+                char *p;
 
                 p = unit_dbus_path_from_name(u->id);
                 if (!p)
                         return log_oom();
 
-                r = show_one(verb, bus, p, show_properties, new_line, ellipsized);
+                r = strv_consume(&paths, p);
                 if (r < 0)
-                        return r;
-                else if (r > 0 && ret == 0)
-                        ret = r;
+                        return log_oom();
         }
 
-        return ret;
+        return show_units(verb, bus, paths, show_properties, new_line, ellipsized);
 }
 
 static int show_system_status(sd_bus *bus) {
@@ -4586,10 +4776,11 @@ static int show(sd_bus *bus, char **args) {
                         ret = show_all(args[0], bus, false, &new_line, &ellipsized);
         } else {
                 _cleanup_free_ char **patterns = NULL;
+                _cleanup_strv_free_ char **paths = NULL;
                 char **name;
 
                 STRV_FOREACH(name, args + 1) {
-                        _cleanup_free_ char *unit = NULL;
+                        char *unit = NULL;
                         uint32_t id;
 
                         if (safe_atou32(*name, &id) < 0) {
@@ -4611,12 +4802,9 @@ static int show(sd_bus *bus, char **args) {
                                 }
                         }
 
-                        r = show_one(args[0], bus, unit, show_properties,
-                                     &new_line, &ellipsized);
+                        r = strv_consume(&paths, unit);
                         if (r < 0)
-                                return r;
-                        else if (r > 0 && ret == 0)
-                                ret = r;
+                                return log_oom();
                 }
 
                 if (!strv_isempty(patterns)) {
@@ -4627,20 +4815,23 @@ static int show(sd_bus *bus, char **args) {
                                 log_error_errno(r, "Failed to expand names: %m");
 
                         STRV_FOREACH(name, names) {
-                                _cleanup_free_ char *unit;
+                                char *unit;
 
                                 unit = unit_dbus_path_from_name(*name);
                                 if (!unit)
                                         return log_oom();
 
-                                r = show_one(args[0], bus, unit, show_properties,
-                                             &new_line, &ellipsized);
+                                r = strv_consume(&paths, unit);
                                 if (r < 0)
-                                        return r;
-                                else if (r > 0 && ret == 0)
-                                        ret = r;
+                                        return log_oom();
                         }
                 }
+
+                r = show_units(args[0], bus, paths, show_properties, &new_line, &ellipsized);
+                if (r < 0)
+                        return r;
+                else if (r > 0 && ret == 0)
+                        ret = r;
         }
 
         if (ellipsized && !arg_quiet)
@@ -4906,6 +5097,7 @@ static int delete_snapshot(sd_bus *bus, char **args) {
 
 static int daemon_reload(sd_bus *bus, char **args) {
         _cleanup_bus_error_free_ sd_bus_error error = SD_BUS_ERROR_NULL;
+        _cleanup_bus_message_unref_ sd_bus_message *reply = NULL;
         const char *method;
         int r;
 
@@ -4931,6 +5123,9 @@ static int daemon_reload(sd_bus *bus, char **args) {
                                     /* "daemon-reload" */ "Reload";
         }
 
+        if (arg_if_changed && streq(method, "Reload"))
+                method = "ReloadIfChanged";
+
         r = sd_bus_call_method(
                         bus,
                         "org.freedesktop.systemd1",
@@ -4938,7 +5133,7 @@ static int daemon_reload(sd_bus *bus, char **args) {
                         "org.freedesktop.systemd1.Manager",
                         method,
                         &error,
-                        NULL,
+                        &reply,
                         NULL);
         if (r == -ENOENT && arg_action != ACTION_SYSTEMCTL)
                 /* There's always a fallback possible for
@@ -4950,6 +5145,16 @@ static int daemon_reload(sd_bus *bus, char **args) {
                 r = 0;
         else if (r < 0)
                 log_error("Failed to execute operation: %s", bus_error_message(&error, r));
+        else if (streq(method, "ReloadIfChanged")) {
+                int b;
+
+                r = sd_bus_message_read(reply, "b", &b);
+                if (r < 0)
+                        return bus_log_parse_error(r);
+
+                if (!b)
+                        log_debug("No unit files changed, reload skipped.");
+        }
 
         return r < 0 ? r : 0;
 }
@@ -6158,6 +6363,7 @@ static void systemctl_help(void) {
                "     --now            Start or stop unit in addition to enabling or disabling it\n"
                "  -q --quiet          Suppress output\n"
                "     --no-block       Do not wait until operation finished\n"
+               "     --if-changed     Only reload daemon if unit files changed\n"
                "     --no-wall        Don't send wall message before halt/power-off/reboot\n"
                "     --no-reload      Don't reload daemon after en-/dis-abling unit files\n"
                "     --no-legend      Do not print a legend (column headers and hints)\n"
@@ -6340,6 +6546,7 @@ static int systemctl_parse_argv(int argc, char *argv[]) {
                 ARG_SYSTEM,
                 ARG_GLOBAL,
                 ARG_NO_BLOCK,
+                ARG_IF_CHANGED,
                 ARG_NO_LEGEND,
                 ARG_NO_PAGER,
                 ARG_NO_WALL,
@@ -6380,6 +6587,7 @@ static int systemctl_parse_argv(int argc, char *argv[]) {
                 { "system",              no_argument,       NULL, ARG_SYSTEM              },
                 { "global",              no_argument,       NULL, ARG_GLOBAL              },
                 { "no-block",            no_argument,       NULL, ARG_NO_BLOCK            },
+                { "if-changed",          no_argument,       NULL, ARG_IF_CHANGED          },
                 { "no-legend",           no_argument,       NULL, ARG_NO_LEGEND           },
                 { "no-pager",            no_argument,       NULL, ARG_NO_PAGER            },
                 { "no-wall",             no_argument,       NULL, ARG_NO_WALL             },
@@ -6551,6 +6759,10 @@ static int systemctl_parse_argv(int argc, char *argv[]) {
                         arg_no_block = true;
                         break;
 
+                case ARG_IF_CHANGED:
+                        arg_if_changed = true;
+                        break;
+
                 case ARG_NO_LEGEND:
                         arg_no_legend = true;
                         break;
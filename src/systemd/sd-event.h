@@ -101,6 +101,14 @@ int sd_event_get_tid(sd_event *e, pid_t *tid);
 int sd_event_get_exit_code(sd_event *e, int *code);
 int sd_event_set_watchdog(sd_event *e, int b);
 int sd_event_get_watchdog(sd_event *e);
+int sd_event_set_dispatch_budget(sd_event *e, unsigned budget);
+int sd_event_get_dispatch_budget(sd_event *e, unsigned *budget);
+int sd_event_set_timer_wheel(sd_event *e, int b);
+int sd_event_get_timer_wheel(sd_event *e);
+int sd_event_set_io_uring(sd_event *e, int b);
+int sd_event_get_io_uring(sd_event *e);
+int sd_event_set_profile(sd_event *e, int b);
+int sd_event_get_profile(sd_event *e);
 
 sd_event_source* sd_event_source_ref(sd_event_source *s);
 sd_event_source* sd_event_source_unref(sd_event_source *s);
@@ -128,6 +128,10 @@ int sd_journal_query_unique(sd_journal *j, const char *field);
 int sd_journal_enumerate_unique(sd_journal *j, const void **data, size_t *l);
 void sd_journal_restart_unique(sd_journal *j);
 
+int sd_journal_query_column(sd_journal *j, const char *field, uint64_t since, uint64_t until);
+int sd_journal_enumerate_column(sd_journal *j, const void **data, size_t *l, uint64_t *n);
+void sd_journal_restart_column(sd_journal *j);
+
 int sd_journal_get_fd(sd_journal *j);
 int sd_journal_get_events(sd_journal *j);
 int sd_journal_get_timeout(sd_journal *j, uint64_t *timeout_usec);
@@ -154,6 +158,9 @@ int sd_journal_get_catalog_for_message_id(sd_id128_t id, char **text);
 #define SD_JOURNAL_FOREACH_UNIQUE(j, data, l)                           \
         for (sd_journal_restart_unique(j); sd_journal_enumerate_unique((j), &(data), &(l)) > 0; )
 
+#define SD_JOURNAL_FOREACH_COLUMN(j, data, l, n)                        \
+        for (sd_journal_restart_column(j); sd_journal_enumerate_column((j), &(data), &(l), &(n)) > 0; )
+
 _SD_END_DECLARATIONS;
 
 #endif
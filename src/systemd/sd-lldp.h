@@ -51,3 +51,5 @@ int sd_lldp_detach_event(sd_lldp *lldp);
 
 int sd_lldp_set_callback(sd_lldp *lldp, sd_lldp_cb_t cb, void *userdata);
 int sd_lldp_save(sd_lldp *lldp, const char *file);
+int sd_lldp_get_generation(sd_lldp *lldp, uint64_t *generation);
+int sd_lldp_get_neighbors(sd_lldp *lldp, uint64_t since, uint64_t *generation, char ***ret);
@@ -57,6 +57,9 @@ int sd_netlink_call_async_cancel(sd_netlink *nl, uint32_t serial);
 int sd_netlink_call(sd_netlink *nl, sd_netlink_message *message, uint64_t timeout,
                  sd_netlink_message **reply);
 
+int sd_netlink_batch_begin(sd_netlink *nl);
+int sd_netlink_batch_end(sd_netlink *nl);
+
 int sd_netlink_get_events(sd_netlink *nl);
 int sd_netlink_get_timeout(sd_netlink *nl, uint64_t *timeout);
 int sd_netlink_process(sd_netlink *nl, sd_netlink_message **ret);
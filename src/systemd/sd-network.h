@@ -141,6 +141,12 @@ sd_network_monitor* sd_network_monitor_unref(sd_network_monitor *m);
 /* Flushes the monitor */
 int sd_network_monitor_flush(sd_network_monitor *m);
 
+/* Flushes the monitor and returns the ifindexes of the links whose
+ * state changed, so that only those need to be looked at again.
+ * Returns 1 if the changes could not be tracked and all links have to
+ * be looked at, 0 otherwise. */
+int sd_network_monitor_flush_links(sd_network_monitor *m, int **ifindexes, size_t *n);
+
 /* Get FD from monitor */
 int sd_network_monitor_get_fd(sd_network_monitor *m);
 
@@ -79,6 +79,10 @@ int sd_resolve_wait(sd_resolve *resolve, uint64_t timeout_usec);
 
 int sd_resolve_get_tid(sd_resolve *resolve, pid_t *tid);
 
+/* Limit the number of worker threads started on demand */
+int sd_resolve_set_workers_max(sd_resolve *resolve, unsigned n);
+int sd_resolve_get_workers_max(sd_resolve *resolve, unsigned *n);
+
 int sd_resolve_attach_event(sd_resolve *resolve, sd_event *e, int priority);
 int sd_resolve_detach_event(sd_resolve *resolve);
 sd_event *sd_resolve_get_event(sd_resolve *resolve);
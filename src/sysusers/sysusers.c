@@ -76,6 +76,10 @@ static Hashmap *members = NULL;
 static Hashmap *database_uid = NULL, *database_user = NULL;
 static Hashmap *database_gid = NULL, *database_group = NULL;
 
+/* NSS lookups by numeric id, keyed by UID_TO_PTR(). The value is the
+ * name, or "" if NSS doesn't know the id. */
+static Hashmap *nss_uid_cache = NULL, *nss_gid_cache = NULL;
+
 static uid_t search_uid = UID_INVALID;
 static UidRange *uid_range = NULL;
 static unsigned n_uid_range = 0;
@@ -748,11 +752,66 @@ finish:
         return r;
 }
 
+static int nss_id_name(bool group, uid_t id, const char **ret) {
+        Hashmap **cache = group ? &nss_gid_cache : &nss_uid_cache;
+        _cleanup_free_ char *name = NULL;
+        const char *n;
+        int r;
+
+        assert(ret);
+
+        /* A candidate id is usually checked both as uid and as gid,
+         * and on LDAP or SSSD hosts every lookup may be a network
+         * round trip, hence ask NSS at most once per id and run. */
+
+        n = hashmap_get(*cache, UID_TO_PTR(id));
+        if (!n) {
+                errno = 0;
+                if (group) {
+                        struct group *g;
+
+                        g = getgrgid((gid_t) id);
+                        if (g)
+                                name = strdup(g->gr_name);
+                } else {
+                        struct passwd *p;
+
+                        p = getpwuid(id);
+                        if (p)
+                                name = strdup(p->pw_name);
+                }
+                if (!name) {
+                        if (!IN_SET(errno, 0, ENOENT))
+                                return -errno;
+
+                        name = strdup("");
+                }
+                if (!name)
+                        return -ENOMEM;
+
+                r = hashmap_ensure_allocated(cache, NULL);
+                if (r < 0)
+                        return r;
+
+                r = hashmap_put(*cache, UID_TO_PTR(id), name);
+                if (r < 0)
+                        return r;
+
+                n = name;
+                name = NULL;
+        }
+
+        if (isempty(n))
+                return 0;
+
+        *ret = n;
+        return 1;
+}
+
 static int uid_is_ok(uid_t uid, const char *name) {
-        struct passwd *p;
-        struct group *g;
         const char *n;
         Item *i;
+        int r;
 
         /* Let's see if we already have assigned the UID a second time */
         if (hashmap_get(todo_uids, UID_TO_PTR(uid)))
@@ -774,20 +833,15 @@ static int uid_is_ok(uid_t uid, const char *name) {
 
         /* Let's also check via NSS, to avoid UID clashes over LDAP and such, just in case */
         if (!arg_root) {
-                errno = 0;
-                p = getpwuid(uid);
-                if (p)
-                        return 0;
-                if (!IN_SET(errno, 0, ENOENT))
-                        return -errno;
+                r = nss_id_name(false, uid, &n);
+                if (r != 0)
+                        return r < 0 ? r : 0;
 
-                errno = 0;
-                g = getgrgid((gid_t) uid);
-                if (g) {
-                        if (!streq(g->gr_name, name))
-                                return 0;
-                } else if (!IN_SET(errno, 0, ENOENT))
-                        return -errno;
+                r = nss_id_name(true, (gid_t) uid, &n);
+                if (r < 0)
+                        return r;
+                if (r > 0 && !streq(n, name))
+                        return 0;
         }
 
         return 1;
@@ -975,8 +1029,8 @@ static int add_user(Item *i) {
 }
 
 static int gid_is_ok(gid_t gid) {
-        struct group *g;
-        struct passwd *p;
+        const char *n;
+        int r;
 
         if (hashmap_get(todo_gids, GID_TO_PTR(gid)))
                 return 0;
@@ -992,19 +1046,13 @@ static int gid_is_ok(gid_t gid) {
                 return 0;
 
         if (!arg_root) {
-                errno = 0;
-                g = getgrgid(gid);
-                if (g)
-                        return 0;
-                if (!IN_SET(errno, 0, ENOENT))
-                        return -errno;
+                r = nss_id_name(true, gid, &n);
+                if (r != 0)
+                        return r < 0 ? r : 0;
 
-                errno = 0;
-                p = getpwuid((uid_t) gid);
-                if (p)
-                        return 0;
-                if (!IN_SET(errno, 0, ENOENT))
-                        return -errno;
+                r = nss_id_name(false, (uid_t) gid, &n);
+                if (r != 0)
+                        return r < 0 ? r : 0;
         }
 
         return 1;
@@ -1898,6 +1946,9 @@ finish:
         hashmap_free(todo_uids);
         hashmap_free(todo_gids);
 
+        hashmap_free_free(nss_uid_cache);
+        hashmap_free_free(nss_gid_cache);
+
         free_database(database_user, database_uid);
         free_database(database_group, database_gid);
 
@@ -24,6 +24,8 @@
 #include "calendarspec.h"
 #include "util.h"
 
+#define N_SPECS 4000U
+
 static void test_one(const char *input, const char *output) {
         CalendarSpec *c;
         _cleanup_free_ char *p = NULL, *q = NULL;
@@ -50,6 +52,80 @@ static void test_one(const char *input, const char *output) {
         assert_se(streq(q, p));
 }
 
+static void test_next(const char *input, const char *new_tz, usec_t after, usec_t expect) {
+        CalendarSpec *c;
+        usec_t u;
+        char *old_tz;
+        char buf[FORMAT_TIMESTAMP_MAX];
+
+        old_tz = getenv("TZ");
+        if (old_tz)
+                old_tz = strdupa(old_tz);
+
+        if (!isempty(new_tz))
+                assert_se(setenv("TZ", new_tz, 1) >= 0);
+        else
+                assert_se(unsetenv("TZ") >= 0);
+        tzset();
+
+        assert_se(calendar_spec_from_string(input, &c) >= 0);
+
+        assert_se(calendar_spec_next_usec(c, after, &u) >= 0);
+        printf("\"%s\" (%s) → %s\n", input, strempty(new_tz), format_timestamp(buf, sizeof(buf), u));
+        calendar_spec_free(c);
+
+        assert_se(u == expect);
+
+        if (old_tz)
+                assert_se(setenv("TZ", old_tz, 1) >= 0);
+        else
+                assert_se(unsetenv("TZ") >= 0);
+        tzset();
+}
+
+static void test_benchmark(void) {
+        CalendarSpec *specs[N_SPECS];
+        unsigned i, j, n = 0;
+        usec_t ts, u;
+
+        /* Not a correctness test: reports how many next elapse
+         * times we compute per second, for a mix of the kind of
+         * specs per-tenant timers use */
+
+        for (i = 0; i < N_SPECS; i++) {
+                char spec[64];
+
+                switch (i % 4) {
+                case 0:
+                        xsprintf(spec, "*:%u/%u", i % 30, 1 + i % 30);
+                        break;
+                case 1:
+                        xsprintf(spec, "%u:%u", i % 24, i % 60);
+                        break;
+                case 2:
+                        xsprintf(spec, "Mon-Fri %u:00", i % 24);
+                        break;
+                default:
+                        xsprintf(spec, "*-*-%u %u:%u", 1 + i % 28, i % 24, i % 60);
+                }
+
+                assert_se(calendar_spec_from_string(spec, specs + i) >= 0);
+        }
+
+        ts = now(CLOCK_MONOTONIC);
+        for (j = 0; j < 10; j++)
+                for (i = 0; i < N_SPECS; i++) {
+                        assert_se(calendar_spec_next_usec(specs[i], now(CLOCK_REALTIME), &u) >= 0);
+                        n++;
+                }
+        ts = now(CLOCK_MONOTONIC) - ts;
+
+        log_info("%u next elapse calculations: %.0f/sec", n, (double) n * USEC_PER_SEC / MAX(ts, 1U));
+
+        for (i = 0; i < N_SPECS; i++)
+                calendar_spec_free(specs[i]);
+}
+
 int main(int argc, char* argv[]) {
         CalendarSpec *c;
 
@@ -83,10 +159,21 @@ int main(int argc, char* argv[]) {
         test_one("annually", "*-01-01 00:00:00");
         test_one("*:2/3", "*-*-* *:02/3:00");
 
+        test_next("2016-03-27 03:17:00", "", 12345, 1459048620000000);
+        test_next("2016-03-27 03:17:00", "Europe/Berlin", 12345, 1459041420000000);
+        test_next("daily", "UTC", 1459036800000000, 1459123200000000);
+        test_next("*-*-* 02:30:00", "Europe/Berlin", 1459036800000000, 1459125000000000);
+        test_next("*:0/15", "Europe/Berlin", 1459040000000000, 1459040400000000);
+        test_next("hourly", "America/New_York", 1478408400000000, 1478415600000000);
+        test_next("weekly", "Europe/Berlin", 1459036800000000, 1459116000000000);
+        test_next("Mon-Fri *-*-* 09:00:00", "Asia/Kolkata", 1459036800000000, 1459135800000000);
+
         assert_se(calendar_spec_from_string("test", &c) < 0);
         assert_se(calendar_spec_from_string("", &c) < 0);
         assert_se(calendar_spec_from_string("7", &c) < 0);
         assert_se(calendar_spec_from_string("121212:1:2", &c) < 0);
 
+        test_benchmark();
+
         return 0;
 }
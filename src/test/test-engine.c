@@ -25,6 +25,67 @@
 
 #include "manager.h"
 #include "bus-util.h"
+#include "target.h"
+
+#define N_BENCH_UNITS 10000U
+
+static void test_transaction_benchmark(Manager *m) {
+        _cleanup_free_ Unit **units = NULL;
+        char ts[FORMAT_TIMESPAN_MAX];
+        Job *j;
+        unsigned i;
+        usec_t t;
+
+        /* Builds a synthetic graph of targets: a binary tree of
+         * Wants=/After= dependencies, where every unit also pulls in
+         * one further unit later in the tree with Requires=, and times
+         * how long building and applying transactions over it takes. */
+
+        assert_se(units = new0(Unit*, N_BENCH_UNITS));
+
+        for (i = 0; i < N_BENCH_UNITS; i++) {
+                char name[sizeof("bench-.target") + DECIMAL_STR_MAX(unsigned)];
+
+                xsprintf(name, "bench-%u.target", i);
+
+                assert_se(units[i] = unit_new(m, sizeof(Target)));
+                assert_se(unit_add_name(units[i], name) >= 0);
+                units[i]->load_state = UNIT_LOADED;
+        }
+
+        for (i = 0; i < N_BENCH_UNITS; i++) {
+                unsigned c;
+
+                for (c = 2*i + 1; c <= 2*i + 2 && c < N_BENCH_UNITS; c++)
+                        assert_se(unit_add_two_dependencies(units[i], UNIT_WANTS, UNIT_BEFORE, units[c], true) >= 0);
+
+                c = (i * 7 + 3) % N_BENCH_UNITS;
+                if (c > i)
+                        assert_se(unit_add_two_dependencies(units[i], UNIT_REQUIRES, UNIT_BEFORE, units[c], true) >= 0);
+        }
+
+        units[0]->allow_isolate = true;
+
+        t = now(CLOCK_MONOTONIC);
+        assert_se(manager_add_job(m, JOB_START, units[0], JOB_REPLACE, false, NULL, &j) == 0);
+        log_info("Start transaction over %u units: %s", N_BENCH_UNITS,
+                 format_timespan(ts, sizeof(ts), now(CLOCK_MONOTONIC) - t, 1));
+        assert_se(hashmap_size(m->jobs) >= N_BENCH_UNITS);
+
+        t = now(CLOCK_MONOTONIC);
+        assert_se(manager_add_job(m, JOB_STOP, units[N_BENCH_UNITS - 1], JOB_REPLACE, false, NULL, &j) == 0);
+        log_info("Stop transaction: %s",
+                 format_timespan(ts, sizeof(ts), now(CLOCK_MONOTONIC) - t, 1));
+
+        manager_clear_jobs(m);
+
+        t = now(CLOCK_MONOTONIC);
+        assert_se(manager_add_job(m, JOB_START, units[0], JOB_ISOLATE, false, NULL, &j) == 0);
+        log_info("Isolate transaction over %u units: %s", N_BENCH_UNITS,
+                 format_timespan(ts, sizeof(ts), now(CLOCK_MONOTONIC) - t, 1));
+
+        manager_clear_jobs(m);
+}
 
 int main(int argc, char *argv[]) {
         _cleanup_bus_error_free_ sd_bus_error err = SD_BUS_ERROR_NULL;
@@ -106,6 +167,10 @@ int main(int argc, char *argv[]) {
         assert_se(manager_add_job(m, JOB_START, h, JOB_FAIL, false, NULL, &j) == 0);
         manager_dump_jobs(m, stdout, "\t");
 
+        printf("Benchmark:\n");
+        manager_clear_jobs(m);
+        test_transaction_benchmark(m);
+
         manager_free(m);
 
         return 0;
@@ -201,6 +201,73 @@ static void test_parse_multiline_env_file(void) {
         unlink(p);
 }
 
+static void test_parse_env_file_plain_lines(void) {
+        char t[] = "/tmp/test-fileio-plain-XXXXXX";
+        int fd, r;
+        _cleanup_free_ char *state = NULL, *user = NULL, *seat = NULL, *display = NULL, *type = NULL, *remote = NULL;
+        _cleanup_strv_free_ char **a = NULL;
+        char **i;
+
+        fd = mkostemp_safe(t, O_RDWR|O_CLOEXEC);
+        assert_se(fd >= 0);
+        close(fd);
+
+        /* Lines without quotes or escapes take a shortcut, make sure
+         * they still mix with those that don't */
+        r = write_string_file(t,
+                        "# This is private data. Do not parse.\n"
+                        "STATE=opening\r\n"
+                        "\n"
+                        "  USER =  lennart  \t\n"
+                        "SEAT=\n"
+                        "=odd=one\n"
+                        "DISPLAY=\"quoted \\\"one\\\"\"\n"
+                        "TYPE=x11\n"
+                        "no value\n"
+                        "DESKTOP=it's\n"
+                        "TYPE=wayland\n"
+                        "STATE=active\n"
+                        "REMOTE=0",
+                        WRITE_STRING_FILE_CREATE|WRITE_STRING_FILE_AVOID_NEWLINE);
+        assert_se(r == 0);
+
+        r = load_env_file(NULL, t, NULL, &a);
+        assert_se(r >= 0);
+
+        STRV_FOREACH(i, a)
+                log_info("Got: <%s>", *i);
+
+        assert_se(streq_ptr(a[0], "STATE=opening"));
+        assert_se(streq_ptr(a[1], "USER=lennart"));
+        assert_se(streq_ptr(a[2], "SEAT="));
+        assert_se(streq_ptr(a[3], "=odd=one"));
+        assert_se(streq_ptr(a[4], "DISPLAY=quoted \"one\""));
+        assert_se(streq_ptr(a[5], "TYPE=x11"));
+        assert_se(streq_ptr(a[6], "DESKTOP=it's"));
+        assert_se(streq_ptr(a[7], "TYPE=wayland"));
+        assert_se(streq_ptr(a[8], "STATE=active"));
+        assert_se(streq_ptr(a[9], "REMOTE=0"));
+        assert_se(a[10] == NULL);
+
+        r = parse_env_file(t, NEWLINE,
+                           "STATE", &state,
+                           "USER", &user,
+                           "SEAT", &seat,
+                           "DISPLAY", &display,
+                           "TYPE", &type,
+                           "REMOTE", &remote,
+                           NULL);
+        assert_se(r == 8);
+
+        assert_se(streq_ptr(state, "active"));
+        assert_se(streq_ptr(user, "lennart"));
+        assert_se(seat == NULL);
+        assert_se(streq_ptr(display, "quoted \"one\""));
+        assert_se(streq_ptr(type, "wayland"));
+        assert_se(streq_ptr(remote, "0"));
+
+        unlink(t);
+}
 
 static void test_executable_is_script(void) {
         char t[] = "/tmp/test-executable-XXXXXX";
@@ -409,6 +476,7 @@ int main(int argc, char *argv[]) {
 
         test_parse_env_file();
         test_parse_multiline_env_file();
+        test_parse_env_file_plain_lines();
         test_executable_is_script();
         test_status_field();
         test_capeff();
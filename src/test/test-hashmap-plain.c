@@ -740,6 +740,49 @@ static void test_hashmap_many(void) {
         }
 }
 
+static void test_hashmap_benchmark(void) {
+        Hashmap *h;
+        Iterator i;
+        unsigned k, n;
+        usec_t t;
+        void *v;
+
+        static const unsigned n_entries = 1 << 18;
+
+        /* Not a correctness test: reports insert, lookup and iteration
+         * throughput so that changes to the probing code can be compared. */
+
+        assert_se(h = hashmap_new(NULL));
+
+        t = now(CLOCK_MONOTONIC);
+        for (k = 1; k <= n_entries; k++)
+                assert_se(hashmap_put(h, UINT_TO_PTR(k), UINT_TO_PTR(k)) == 1);
+        t = now(CLOCK_MONOTONIC) - t;
+        log_info("insert: %u entries, %.0f ops/sec", n_entries, (double) n_entries * USEC_PER_SEC / MAX(t, 1U));
+
+        t = now(CLOCK_MONOTONIC);
+        for (k = 1; k <= n_entries; k++)
+                assert_se(PTR_TO_UINT(hashmap_get(h, UINT_TO_PTR(k))) == k);
+        t = now(CLOCK_MONOTONIC) - t;
+        log_info("lookup (hit): %.0f ops/sec", (double) n_entries * USEC_PER_SEC / MAX(t, 1U));
+
+        t = now(CLOCK_MONOTONIC);
+        for (k = n_entries + 1; k <= 2 * n_entries; k++)
+                assert_se(!hashmap_get(h, UINT_TO_PTR(k)));
+        t = now(CLOCK_MONOTONIC) - t;
+        log_info("lookup (miss): %.0f ops/sec", (double) n_entries * USEC_PER_SEC / MAX(t, 1U));
+
+        n = 0;
+        t = now(CLOCK_MONOTONIC);
+        HASHMAP_FOREACH(v, h, i)
+                n++;
+        t = now(CLOCK_MONOTONIC) - t;
+        assert_se(n == n_entries);
+        log_info("iterate: %.0f entries/sec", (double) n * USEC_PER_SEC / MAX(t, 1U));
+
+        hashmap_free(h);
+}
+
 static void test_hashmap_first(void) {
         _cleanup_hashmap_free_ Hashmap *m = NULL;
 
@@ -861,6 +904,7 @@ void test_hashmap_funcs(void) {
         test_hashmap_get2();
         test_hashmap_size();
         test_hashmap_many();
+        test_hashmap_benchmark();
         test_hashmap_first();
         test_hashmap_first_key();
         test_hashmap_steal_first_key();
@@ -19,6 +19,7 @@
 
 #include "util.h"
 #include "hashmap.h"
+#include "set.h"
 
 void test_hashmap_funcs(void);
 void test_ordered_hashmap_funcs(void);
@@ -56,6 +57,29 @@ static void test_string_compare_func(void) {
         assert_se(string_compare_func("fred", "fred") == 0);
 }
 
+static void test_fast_string_hash_ops(void) {
+        _cleanup_set_free_free_ Set *m = NULL;
+        static const uint8_t key[HASH_KEY_SIZE] = { 1, 2, 3, 4 };
+        char name[DECIMAL_STR_MAX(unsigned) + 9];
+        unsigned i;
+
+        assert_se(fast_string_hash_func("foo.service", key) == fast_string_hash_func("foo.service", key));
+
+        assert_se(m = set_new(&fast_string_hash_ops));
+
+        for (i = 0; i < 1000; i++) {
+                xsprintf(name, "%u.service", i);
+                assert_se(set_put_strdup(m, name) == 1);
+        }
+
+        for (i = 0; i < 1000; i++) {
+                xsprintf(name, "%u.service", i);
+                assert_se(streq_ptr(set_get(m, name), name));
+        }
+
+        assert_se(!set_get(m, "1000.service"));
+}
+
 int main(int argc, const char *argv[]) {
         test_hashmap_funcs();
         test_ordered_hashmap_funcs();
@@ -64,4 +88,5 @@ int main(int argc, const char *argv[]) {
         test_uint64_compare_func();
         test_trivial_compare_func();
         test_string_compare_func();
+        test_fast_string_hash_ops();
 }
@@ -0,0 +1,162 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <stdio.h>
+
+#include "sd-hwdb.h"
+
+#include "util.h"
+#include "strv.h"
+#include "conf-files.h"
+#include "hwdb-util.h"
+
+#define N_ROUNDS 8
+
+/* Turn a match pattern into a modalias it matches, roughly what
+ * the kernel would report for such a device. */
+static char *modalias_from_match(const char *match) {
+        char *modalias, *q;
+        const char *p;
+
+        modalias = new(char, strlen(match) + 1);
+        if (!modalias)
+                return NULL;
+
+        for (p = match, q = modalias; *p; p++)
+                switch (*p) {
+
+                case '*':
+                        break;
+
+                case '?':
+                        *q++ = '0';
+                        break;
+
+                case '[':
+                        if (p[1] == '\0' || p[1] == '!' || p[1] == '^') {
+                                free(modalias);
+                                return NULL;
+                        }
+
+                        *q++ = p[1];
+                        p = strchr(p + 1, ']');
+                        if (!p) {
+                                free(modalias);
+                                return NULL;
+                        }
+                        break;
+
+                default:
+                        *q++ = *p;
+                }
+
+        *q = '\0';
+        return modalias;
+}
+
+static int read_matches(const char *dir, char ***ret) {
+        _cleanup_strv_free_ char **files = NULL, **modaliases = NULL;
+        char **f;
+        int r;
+
+        r = conf_files_list(&files, ".hwdb", NULL, dir, NULL);
+        if (r < 0)
+                return r;
+
+        STRV_FOREACH(f, files) {
+                _cleanup_fclose_ FILE *file = NULL;
+                char line[LINE_MAX];
+
+                file = fopen(*f, "re");
+                if (!file)
+                        return -errno;
+
+                FOREACH_LINE(line, file, return -errno) {
+                        char *modalias;
+
+                        truncate_nl(line);
+
+                        /* properties are indented, comments and
+                         * blank lines separate the records */
+                        if (IN_SET(line[0], '\0', ' ', '#'))
+                                continue;
+
+                        modalias = modalias_from_match(line);
+                        if (!modalias)
+                                continue;
+
+                        r = strv_consume(&modaliases, modalias);
+                        if (r < 0)
+                                return r;
+                }
+        }
+
+        *ret = modaliases;
+        modaliases = NULL;
+
+        return 0;
+}
+
+static void test_benchmark(sd_hwdb *hwdb, const char *dir) {
+        _cleanup_strv_free_ char **modaliases = NULL;
+        unsigned n_lookups = 0, n_found = 0, i;
+        char **m;
+        usec_t ts;
+
+        /* Not a correctness test: reports the lookup rate over
+         * modaliases derived from the hwdb sources, so that changes
+         * to the trie layout can be compared */
+
+        assert_se(read_matches(dir, &modaliases) >= 0);
+
+        log_info("%u modaliases from %s", strv_length(modaliases), dir);
+
+        ts = now(CLOCK_MONOTONIC);
+        for (i = 0; i < N_ROUNDS; i++)
+                STRV_FOREACH(m, modaliases) {
+                        const char *key, *value;
+
+                        assert_se(sd_hwdb_seek(hwdb, *m) >= 0);
+                        if (sd_hwdb_enumerate(hwdb, &key, &value) > 0)
+                                n_found++;
+                        n_lookups++;
+                }
+        ts = now(CLOCK_MONOTONIC) - ts;
+
+        log_info("%u lookups, %u with properties: %.0f lookups/sec",
+                 n_lookups, n_found, (double) n_lookups * USEC_PER_SEC / MAX(ts, 1U));
+}
+
+int main(int argc, char *argv[]) {
+        _cleanup_hwdb_unref_ sd_hwdb *hwdb = NULL;
+        int r;
+
+        log_parse_environment();
+        log_open();
+
+        r = sd_hwdb_new(&hwdb);
+        if (r < 0) {
+                log_notice_errno(r, "Cannot open hwdb.bin, skipping: %m");
+                return EXIT_TEST_SKIP;
+        }
+
+        test_benchmark(hwdb, argc > 1 ? argv[1] : UDEVLIBEXECDIR "/hwdb.d");
+
+        return 0;
+}
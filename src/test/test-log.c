@@ -51,5 +51,14 @@ int main(int argc, char* argv[]) {
                    "SUFFIX=GOT IT",
                    NULL);
 
+        log_set_buffered(true);
+        log_info("Buffered PID="PID_FMT" 1", getpid());
+        log_info("Buffered PID="PID_FMT" 2", getpid());
+        log_struct(LOG_INFO,
+                   "MESSAGE=Buffered PID="PID_FMT" 3, flushing", getpid(),
+                   NULL);
+        log_info("Buffered PID="PID_FMT" 4", getpid());
+        log_set_buffered(false);
+
         return 0;
 }
@@ -0,0 +1,121 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include "mempool.h"
+#include "macro.h"
+#include "util.h"
+
+struct tile {
+        uint64_t a, b, c;
+};
+
+static void test_mempool_trim(void) {
+        static DEFINE_MEMPOOL(pool, struct tile, 4);
+        void *t[1000];
+        unsigned i;
+
+        for (i = 0; i < ELEMENTSOF(t); i++)
+                assert_se(t[i] = mempool_alloc0_tile(&pool));
+
+        /* Every tile in use, nothing to give back */
+        assert_se(mempool_trim(&pool) == 0);
+
+        for (i = 0; i < ELEMENTSOF(t); i += 2)
+                mempool_free_tile(&pool, t[i]);
+
+        /* Every pool still has tiles in use */
+        assert_se(mempool_trim(&pool) == 0);
+
+        for (i = 1; i < ELEMENTSOF(t); i += 2)
+                mempool_free_tile(&pool, t[i]);
+
+        assert_se(mempool_trim(&pool) > 0);
+        assert_se(!pool.first_pool);
+        assert_se(!pool.freelist);
+
+        /* The pool is usable again afterwards */
+        assert_se(t[0] = mempool_alloc_tile(&pool));
+        mempool_free_tile(&pool, t[0]);
+
+        mempool_drop(&pool);
+}
+
+static void test_mempool_trim_partial(void) {
+        static DEFINE_MEMPOOL(pool, struct tile, 4);
+        void *t[1000], *u;
+        unsigned i;
+
+        for (i = 0; i < ELEMENTSOF(t); i++)
+                assert_se(t[i] = mempool_alloc_tile(&pool));
+
+        /* Keep the most recently allocated tile, which lives in the
+         * newest and largest pool */
+        for (i = 0; i < ELEMENTSOF(t) - 1; i++)
+                mempool_free_tile(&pool, t[i]);
+
+        assert_se(mempool_trim(&pool) > 0);
+        assert_se(pool.first_pool);
+        assert_se(mempool_trim(&pool) == 0);
+
+        /* Tiles of the remaining pool are still handed out */
+        for (i = 0; i < ELEMENTSOF(t) - 1; i++) {
+                assert_se(u = mempool_alloc_tile(&pool));
+                assert_se(u != t[ELEMENTSOF(t) - 1]);
+                memset(u, 0xaa, sizeof(struct tile));
+        }
+
+        mempool_drop(&pool);
+}
+
+static void test_mempool_classes(void) {
+        static DEFINE_MEMPOOL_CLASSES(classes, 4);
+        static const size_t sizes[] = { 1, 8, 16, 17, 33, 64, 65, 100, 129, 200, 256, 257, 4096 };
+        void *p[ELEMENTSOF(sizes)];
+        unsigned i;
+
+        for (i = 0; i < ELEMENTSOF(sizes); i++) {
+                assert_se(p[i] = mempool_classes_alloc0(&classes, sizes[i]));
+                memset(p[i], 0xaa, sizes[i]);
+        }
+
+        for (i = 0; i + 1 < ELEMENTSOF(sizes); i++) {
+                assert_se(p[i] = mempool_classes_realloc(&classes, p[i], sizes[i], sizes[i + 1]));
+                assert_se(((uint8_t*) p[i])[sizes[i] - 1] == 0xaa);
+                memset(p[i], 0x55, sizes[i + 1]);
+        }
+
+        for (i = 0; i + 1 < ELEMENTSOF(sizes); i++)
+                mempool_classes_free(&classes, p[i], sizes[i + 1]);
+        mempool_classes_free(&classes, p[i], sizes[i]);
+
+        assert_se(mempool_classes_trim(&classes) > 0);
+
+        for (i = 0; i < _MEMPOOL_CLASS_MAX; i++)
+                assert_se(!classes.pools[i].first_pool);
+
+        mempool_classes_drop(&classes);
+}
+
+int main(int argc, char *argv[]) {
+        test_mempool_trim();
+        test_mempool_trim_partial();
+        test_mempool_classes();
+
+        return 0;
+}
@@ -166,10 +166,129 @@ static void test_struct(void) {
         set_free(s);
 }
 
+static void test_put_many(void) {
+        struct test t[SET_SIZE];
+        void *data[SET_SIZE];
+        unsigned *idx[SET_SIZE];
+        unsigned previous = 0, i, n;
+        Prioq *q;
+
+        srand(0);
+
+        q = prioq_new(test_compare);
+        assert_se(q);
+
+        for (i = 0; i < SET_SIZE; i++) {
+                t[i].value = (unsigned) rand();
+                data[i] = &t[i];
+                idx[i] = &t[i].idx;
+        }
+
+        /* A few items first, then a bulk that is inserted one by one,
+         * then one that is large enough to rebuild the whole queue */
+        assert_se(prioq_put_many(q, data, idx, 16) >= 0);
+        assert_se(prioq_put_many(q, data + 16, idx + 16, 8) >= 0);
+        assert_se(prioq_put_many(q, data + 24, idx + 24, SET_SIZE - 24) >= 0);
+        assert_se(prioq_size(q) == SET_SIZE);
+
+        for (i = 0; i < SET_SIZE; i++)
+                assert_se(prioq_remove(q, &t[i], &t[i].idx) == 1 &&
+                          prioq_put(q, &t[i], &t[i].idx) >= 0);
+
+        /* Change a few priorities, then all of them */
+        for (i = 0; i < 10; i++)
+                t[i * 7].value = (unsigned) rand();
+        for (i = 0; i < 10; i++)
+                assert_se(prioq_reshuffle_many(q, data + i * 7, idx + i * 7, 1) == 1);
+
+        for (i = 0; i < SET_SIZE; i++)
+                t[i].value = (unsigned) rand();
+        assert_se(prioq_reshuffle_many(q, data, idx, SET_SIZE) == SET_SIZE);
+
+        for (n = 0; n < SET_SIZE; n++) {
+                struct test *x;
+
+                x = prioq_pop(q);
+                assert_se(x);
+                assert_se(previous <= x->value);
+                previous = x->value;
+        }
+
+        assert_se(prioq_isempty(q));
+        prioq_free(q);
+}
+
+#define N_BENCHMARK (1U << 18)
+
+static void test_benchmark(void) {
+        struct test *t;
+        void **data;
+        unsigned **idx;
+        unsigned i;
+        usec_t ts;
+        Prioq *q;
+
+        /* Not a correctness test: reports throughput so that changes
+         * to the heap layout can be compared */
+
+        t = new(struct test, N_BENCHMARK);
+        data = new(void*, N_BENCHMARK);
+        idx = new(unsigned*, N_BENCHMARK);
+        assert_se(t && data && idx);
+
+        srand(0);
+        for (i = 0; i < N_BENCHMARK; i++) {
+                t[i].value = (unsigned) rand();
+                data[i] = &t[i];
+                idx[i] = &t[i].idx;
+        }
+
+        assert_se(q = prioq_new(test_compare));
+
+        ts = now(CLOCK_MONOTONIC);
+        for (i = 0; i < N_BENCHMARK; i++)
+                assert_se(prioq_put(q, &t[i], &t[i].idx) >= 0);
+        ts = now(CLOCK_MONOTONIC) - ts;
+        log_info("put: %.0f ops/sec", (double) N_BENCHMARK * USEC_PER_SEC / MAX(ts, 1U));
+
+        ts = now(CLOCK_MONOTONIC);
+        for (i = 0; i < N_BENCHMARK; i++) {
+                t[i].value = (unsigned) rand();
+                assert_se(prioq_reshuffle(q, &t[i], &t[i].idx) == 1);
+        }
+        ts = now(CLOCK_MONOTONIC) - ts;
+        log_info("reshuffle: %.0f ops/sec", (double) N_BENCHMARK * USEC_PER_SEC / MAX(ts, 1U));
+
+        for (i = 0; i < N_BENCHMARK; i++)
+                t[i].value = (unsigned) rand();
+        ts = now(CLOCK_MONOTONIC);
+        assert_se(prioq_reshuffle_many(q, data, idx, N_BENCHMARK) == N_BENCHMARK);
+        ts = now(CLOCK_MONOTONIC) - ts;
+        log_info("reshuffle_many: %.0f items/sec", (double) N_BENCHMARK * USEC_PER_SEC / MAX(ts, 1U));
+
+        ts = now(CLOCK_MONOTONIC);
+        for (i = 0; i < N_BENCHMARK; i++)
+                assert_se(prioq_pop(q));
+        ts = now(CLOCK_MONOTONIC) - ts;
+        log_info("pop: %.0f ops/sec", (double) N_BENCHMARK * USEC_PER_SEC / MAX(ts, 1U));
+
+        ts = now(CLOCK_MONOTONIC);
+        assert_se(prioq_put_many(q, data, idx, N_BENCHMARK) >= 0);
+        ts = now(CLOCK_MONOTONIC) - ts;
+        log_info("put_many: %.0f items/sec", (double) N_BENCHMARK * USEC_PER_SEC / MAX(ts, 1U));
+
+        prioq_free(q);
+        free(t);
+        free(data);
+        free(idx);
+}
+
 int main(int argc, char* argv[]) {
 
         test_unsigned();
         test_struct();
+        test_put_many();
+        test_benchmark();
 
         return 0;
 }
@@ -40,6 +40,7 @@ static void test_get_process_comm(void) {
         dev_t h;
         int r;
         pid_t me;
+        unsigned long long t1, t2;
 
         if (stat("/proc/1/comm", &st) == 0) {
                 assert_se(get_process_comm(1, &a) >= 0);
@@ -73,6 +74,11 @@ static void test_get_process_comm(void) {
 
         me = getpid();
 
+        assert_se(get_process_start_time(1, &t1) == 0);
+        assert_se(get_process_start_time(me, &t2) == 0);
+        log_info("pid1 start time: %llu, self start time: %llu", t1, t2);
+        assert_se(t1 <= t2);
+
         r = get_process_cwd(me, &cwd);
         assert_se(r >= 0 || r == -EACCES);
         log_info("pid1 cwd: '%s'", cwd);
@@ -385,6 +385,41 @@ static void test_strv_extendf(void) {
         assert_se(streq(b[0], "test3 bar foo 128"));
 }
 
+static void test_strv_builder(void) {
+        _cleanup_strv_builder_done_ StrvBuilder b = {};
+        _cleanup_strv_free_ char **l = NULL;
+        char buf[DECIMAL_STR_MAX(unsigned) + 4];
+        unsigned i;
+
+        assert_se(strv_isempty(strv_builder_get(&b)));
+
+        assert_se(strv_builder_add(&b, "one") >= 0);
+        assert_se(strv_builder_add(&b, NULL) >= 0);
+        assert_se(strv_builder_add_length(&b, "twoXXX", 3) >= 0);
+        assert_se(strv_builder_addf(&b, "%s=%u", "three", 3) >= 0);
+        assert_se(strv_builder_add_strv(&b, STRV_MAKE("four", "five")) >= 0);
+
+        assert_se(strv_equal(strv_builder_get(&b), STRV_MAKE("one", "two", "three=3", "four", "five")));
+
+        /* Enough to need a couple of chunks */
+        for (i = 0; i < 1000; i++) {
+                xsprintf(buf, "x%u", i);
+                assert_se(strv_builder_add(&b, buf) >= 0);
+        }
+
+        assert_se(b.n == 1005);
+        assert_se(streq(strv_builder_get(&b)[0], "one"));
+        assert_se(streq(strv_builder_get(&b)[1004], "x999"));
+
+        l = strv_builder_to_strv(&b);
+        assert_se(l);
+
+        strv_builder_done(&b);
+        assert_se(strv_length(l) == 1005);
+        assert_se(streq(l[2], "three=3"));
+        assert_se(streq(l[1004], "x999"));
+}
+
 static void test_strv_foreach(void) {
         _cleanup_strv_free_ char **a;
         unsigned i = 0;
@@ -620,6 +655,7 @@ int main(int argc, char *argv[]) {
         test_strv_extend_strv_concat();
         test_strv_extend();
         test_strv_extendf();
+        test_strv_builder();
         test_strv_from_stdarg_alloca();
         test_strv_push_prepend();
         test_strv_push();
@@ -0,0 +1,138 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <stdlib.h>
+
+#include "util.h"
+#include "timer-wheel.h"
+
+#define N_ENTRIES (1024*4)
+
+static void test_empty(void) {
+        TimerWheel *w;
+        TimerWheelEntry e;
+
+        w = timer_wheel_new();
+        assert_se(w);
+
+        assert_se(timer_wheel_isempty(w));
+        assert_se(!timer_wheel_peek(w));
+
+        timer_wheel_entry_init(&e);
+        assert_se(!timer_wheel_entry_linked(&e));
+
+        timer_wheel_put(w, &e, 4711);
+        assert_se(timer_wheel_entry_linked(&e));
+        assert_se(timer_wheel_size(w) == 1);
+        assert_se(timer_wheel_peek(w) == &e);
+
+        timer_wheel_remove(w, &e);
+        assert_se(!timer_wheel_entry_linked(&e));
+        assert_se(timer_wheel_isempty(w));
+        assert_se(!timer_wheel_peek(w));
+
+        /* Removing twice is a NOP */
+        timer_wheel_remove(w, &e);
+
+        timer_wheel_free(w);
+}
+
+static void test_order(void) {
+        static TimerWheelEntry entries[N_ENTRIES];
+        TimerWheel *w;
+        usec_t last = 0;
+        unsigned i;
+
+        srand(0);
+
+        w = timer_wheel_new();
+        assert_se(w);
+
+        /* Spread out the times over anything from microseconds to
+         * years, so that all levels get exercised */
+        for (i = 0; i < N_ENTRIES; i++) {
+                usec_t t;
+
+                t = ((usec_t) rand() << 31 | (usec_t) rand()) >> (rand() % 62);
+
+                timer_wheel_entry_init(entries + i);
+                timer_wheel_put(w, entries + i, t);
+        }
+
+        /* Remove every third one again */
+        for (i = 0; i < N_ENTRIES; i += 3)
+                timer_wheel_remove(w, entries + i);
+
+        assert_se(timer_wheel_size(w) == N_ENTRIES - (N_ENTRIES + 2) / 3);
+
+        for (i = 0; !timer_wheel_isempty(w); i++) {
+                TimerWheelEntry *e;
+
+                e = timer_wheel_peek(w);
+                assert_se(e);
+                assert_se(e->when >= last);
+                assert_se((e - entries) % 3 != 0);
+
+                last = e->when;
+                timer_wheel_remove(w, e);
+        }
+
+        assert_se(i == N_ENTRIES - (N_ENTRIES + 2) / 3);
+
+        timer_wheel_free(w);
+}
+
+static void test_late(void) {
+        TimerWheelEntry a, b, c;
+        TimerWheel *w;
+
+        w = timer_wheel_new();
+        assert_se(w);
+
+        timer_wheel_entry_init(&a);
+        timer_wheel_entry_init(&b);
+        timer_wheel_entry_init(&c);
+
+        timer_wheel_put(w, &a, 10 * USEC_PER_SEC);
+        timer_wheel_put(w, &b, 20 * USEC_PER_SEC);
+
+        /* Let the wheel advance to the first entry, then add one
+         * that is due even earlier */
+        assert_se(timer_wheel_peek(w) == &a);
+        timer_wheel_remove(w, &a);
+        assert_se(timer_wheel_peek(w) == &b);
+
+        timer_wheel_put(w, &c, 5 * USEC_PER_SEC);
+        assert_se(timer_wheel_peek(w) == &c);
+        timer_wheel_remove(w, &c);
+
+        assert_se(timer_wheel_peek(w) == &b);
+
+        /* Freeing unlinks what is left */
+        timer_wheel_free(w);
+        assert_se(!timer_wheel_entry_linked(&b));
+}
+
+int main(int argc, char **argv) {
+        test_empty();
+        test_order();
+        test_late();
+
+        return 0;
+}
@@ -0,0 +1,168 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include "macro.h"
+#include "utf8.h"
+#include "util.h"
+
+/* Not a correctness test: compares utf8_is_valid() and
+ * utf8_is_printable() with the plain character-at-a-time loops on a
+ * few kinds of log lines, and checks that both agree. */
+
+static unsigned arg_size = 120;
+static unsigned arg_iterations = 1000000;
+
+static bool reference_is_valid(const char *str) {
+        const char *p;
+
+        for (p = str; *p; ) {
+                int len;
+
+                len = utf8_encoded_valid_unichar(p);
+                if (len < 0)
+                        return false;
+
+                p += len;
+        }
+
+        return true;
+}
+
+static bool reference_is_printable(const char *str, size_t length) {
+        const char *p;
+
+        for (p = str; length;) {
+                int encoded_len, val;
+
+                encoded_len = utf8_encoded_valid_unichar(p);
+                if (encoded_len < 0 ||
+                    (size_t) encoded_len > length)
+                        return false;
+
+                val = utf8_encoded_to_unichar(p);
+                if (val < 0 ||
+                    (val < ' ' && val != '\t' && val != '\n') ||
+                    (0x7F <= val && val <= 0x9F))
+                        return false;
+
+                length -= encoded_len;
+                p += encoded_len;
+        }
+
+        return true;
+}
+
+static char *make_line(const char *alphabet) {
+        size_t l, i, n = 0;
+        char *s;
+
+        /* Repeat whole (possibly multi-byte) characters of the
+         * alphabet up to arg_size bytes */
+        l = strlen(alphabet);
+        s = new(char, arg_size + 1);
+        assert_se(s);
+
+        for (i = 0; n < arg_size; i = (i + 1) % l) {
+                size_t k = utf8_encoded_valid_unichar(alphabet + i);
+
+                if (n + k > arg_size)
+                        break;
+
+                memcpy(s + n, alphabet + i, k);
+                n += k;
+                i += k - 1;
+        }
+
+        s[n] = 0;
+        return s;
+}
+
+static double rate(usec_t t, size_t l) {
+        return (double) arg_iterations * l * USEC_PER_SEC / MAX(t, 1U) / (1024 * 1024);
+}
+
+static void benchmark(const char *name, const char *alphabet) {
+        _cleanup_free_ char *s = NULL;
+        /* So that the pure functions aren't hoisted out of the loops */
+        const char * volatile v;
+        usec_t t[4];
+        unsigned i, n[4] = {};
+        size_t l;
+
+        s = make_line(alphabet);
+        l = strlen(s);
+        v = s;
+
+        t[0] = now(CLOCK_MONOTONIC);
+        for (i = 0; i < arg_iterations; i++)
+                n[0] += reference_is_valid(v);
+        t[0] = now(CLOCK_MONOTONIC) - t[0];
+
+        t[1] = now(CLOCK_MONOTONIC);
+        for (i = 0; i < arg_iterations; i++)
+                n[1] += !!utf8_is_valid(v);
+        t[1] = now(CLOCK_MONOTONIC) - t[1];
+
+        t[2] = now(CLOCK_MONOTONIC);
+        for (i = 0; i < arg_iterations; i++)
+                n[2] += reference_is_printable(v, l);
+        t[2] = now(CLOCK_MONOTONIC) - t[2];
+
+        t[3] = now(CLOCK_MONOTONIC);
+        for (i = 0; i < arg_iterations; i++)
+                n[3] += utf8_is_printable(v, l);
+        t[3] = now(CLOCK_MONOTONIC) - t[3];
+
+        assert_se(n[0] == n[1]);
+        assert_se(n[2] == n[3]);
+
+        log_info("%-10s %4zu bytes: valid %7.1f -> %7.1f MB/s, printable %7.1f -> %7.1f MB/s",
+                 name, l,
+                 rate(t[0], l), rate(t[1], l),
+                 rate(t[2], l), rate(t[3], l));
+}
+
+int main(int argc, char *argv[]) {
+        unsigned i;
+
+        log_parse_environment();
+        log_open();
+
+        for (i = 1; i < (unsigned) argc; i++) {
+                const char *v;
+
+                if ((v = startswith(argv[i], "size=")))
+                        assert_se(safe_atou(v, &arg_size) >= 0 && arg_size > 0);
+                else if ((v = startswith(argv[i], "iterations=")))
+                        assert_se(safe_atou(v, &arg_iterations) >= 0 && arg_iterations > 0);
+                else {
+                        log_error("Usage: %s [size=BYTES] [iterations=N]", program_invocation_short_name);
+                        return EXIT_FAILURE;
+                }
+        }
+
+        benchmark("ascii", "Started Session 42 of user root, PID 1234 exited with status 0. ");
+        benchmark("tabs", "key=value\tother=value\tthird=value\t");
+        benchmark("multiline", "Traceback (most recent call last):\n  File \"foo.py\", line 1\n");
+        benchmark("latin", "Gerät \"sda\" wurde eingehängt, Prüfsumme ungültig. ");
+        benchmark("cjk", "サービスを開始しました。");
+        benchmark("control", "\033[0;1;31mFailed\033[0m to start service. ");
+
+        return 0;
+}
@@ -29,16 +29,61 @@ static void test_utf8_is_printable(void) {
         assert_se(utf8_is_printable("ąę", 4));
 }
 
+static void test_utf8_is_printable_long(void) {
+        char s[71] = {};
+        size_t n = sizeof(s) - 1, i;
+
+        /* Past the 16 byte chunks and the words the ASCII spans are
+         * checked in, with the odd byte at every position */
+        memset(s, 'a', n);
+        assert_se(utf8_is_printable(s, n));
+        assert_se(utf8_is_printable_newline(s, n, false));
+
+        for (i = 0; i < n; i++) {
+                s[i] = '\001';
+                assert_se(!utf8_is_printable(s, n));
+                assert_se(utf8_is_printable(s, i));
+
+                s[i] = 0x7F;
+                assert_se(!utf8_is_printable(s, n));
+
+                s[i] = '\t';
+                assert_se(utf8_is_printable(s, n));
+
+                s[i] = '\n';
+                assert_se(utf8_is_printable(s, n));
+                assert_se(!utf8_is_printable_newline(s, n, false));
+
+                s[i] = '\342';
+                assert_se(!utf8_is_printable(s, n));
+
+                if (i + 3 <= n) {
+                        memcpy(s + i, "\342\204\242", 3);
+                        assert_se(utf8_is_printable(s, n));
+                        memset(s + i, 'a', 3);
+                }
+
+                s[i] = 'a';
+        }
+}
+
 static void test_utf8_is_valid(void) {
         assert_se(utf8_is_valid("ascii is valid unicode"));
         assert_se(utf8_is_valid("\342\204\242"));
         assert_se(!utf8_is_valid("\341\204"));
+        assert_se(utf8_is_valid("0123456789abcdef0123456789abcdef\342\204\2420123456789abcdef"));
+        assert_se(!utf8_is_valid("0123456789abcdef0123456789abcdef\342\2040123456789abcdef"));
+        assert_se(!utf8_is_valid("0123456789abcdef0123456789abcdef0123456789abcdef0123456\377"));
+        assert_se(utf8_is_valid("0123456789abcdef0123456789abcdef\001\177\n\t0123456789abcdef"));
 }
 
 static void test_ascii_is_valid(void) {
         assert_se(ascii_is_valid("alsdjf\t\vbarr\nba z"));
         assert_se(!ascii_is_valid("\342\204\242"));
         assert_se(!ascii_is_valid("\341\204"));
+        assert_se(ascii_is_valid("0123456789abcdef0123456789abcdef0123456789abcdef"));
+        assert_se(!ascii_is_valid("0123456789abcdef0123456789abcdef0123456789abcde\200"));
+        assert_se(!ascii_is_valid("0123456789abcdef\200123456789abcdef0123456789abcdef"));
 }
 
 static void test_utf8_encoded_valid_unichar(void) {
@@ -108,6 +153,7 @@ static void test_utf16_to_utf8(void) {
 int main(int argc, char *argv[]) {
         test_utf8_is_valid();
         test_utf8_is_printable();
+        test_utf8_is_printable_long();
         test_ascii_is_valid();
         test_utf8_encoded_valid_unichar();
         test_utf8_escaping();
@@ -218,6 +218,48 @@ static void test_close_many(void) {
         unlink(name2);
 }
 
+static void test_close_all_fds(void) {
+        int fds[5], except[3], i;
+        pid_t pid;
+
+        for (i = 0; i < 5; i++)
+                assert_se((fds[i] = open("/dev/null", O_RDONLY|O_CLOEXEC)) >= 0);
+
+        /* Unsorted, with duplicates and stdio */
+        except[0] = fds[3];
+        except[1] = STDOUT_FILENO;
+        except[2] = fds[1];
+
+        pid = fork();
+        assert_se(pid >= 0);
+
+        if (pid == 0) {
+                if (close_all_fds(except, 3) < 0)
+                        _exit(EXIT_FAILURE);
+
+                if (fcntl(fds[0], F_GETFD) >= 0 ||
+                    fcntl(fds[1], F_GETFD) < 0 ||
+                    fcntl(fds[2], F_GETFD) >= 0 ||
+                    fcntl(fds[3], F_GETFD) < 0 ||
+                    fcntl(fds[4], F_GETFD) >= 0 ||
+                    fcntl(STDOUT_FILENO, F_GETFD) < 0)
+                        _exit(EXIT_FAILURE);
+
+                if (close_all_fds(NULL, 0) < 0)
+                        _exit(EXIT_FAILURE);
+
+                if (fcntl(fds[1], F_GETFD) >= 0 ||
+                    fcntl(fds[3], F_GETFD) >= 0)
+                        _exit(EXIT_FAILURE);
+
+                _exit(EXIT_SUCCESS);
+        }
+
+        assert_se(wait_for_terminate_and_warn("close_all_fds", pid, true) == EXIT_SUCCESS);
+
+        close_many(fds, 5);
+}
+
 static void test_parse_boolean(void) {
         assert_se(parse_boolean("1") == 1);
         assert_se(parse_boolean("y") == 1);
@@ -1454,6 +1496,10 @@ static void test_execute_directory(void) {
         char template_hi[] = "/tmp/test-readlink_and_make_absolute-hi.XXXXXXX";
         const char * dirs[] = {template_hi, template_lo, NULL};
         const char *name, *name2, *name3, *overridden, *override, *masked, *mask;
+        _cleanup_close_pair_ int timing[2] = { -1, -1 };
+        _cleanup_fclose_ FILE *f = NULL;
+        bool seen = false, seen2 = false;
+        char line[LINE_MAX];
 
         assert_se(mkdtemp(template_lo));
         assert_se(mkdtemp(template_hi));
@@ -1479,7 +1525,25 @@ static void test_execute_directory(void) {
         assert_se(chmod(masked, 0755) == 0);
         assert_se(touch(name3) >= 0);
 
-        execute_directories(dirs, DEFAULT_TIMEOUT_USEC, NULL);
+        assert_se(pipe2(timing, O_CLOEXEC) >= 0);
+
+        execute_directories(dirs, DEFAULT_TIMEOUT_USEC, NULL, timing[1]);
+
+        timing[1] = safe_close(timing[1]);
+        assert_se(f = fdopen(timing[0], "re"));
+        timing[0] = -1;
+
+        FOREACH_LINE(line, f, assert_not_reached("read failed")) {
+                log_info("timing: %s", strstrip(line));
+
+                if (startswith(line, "script "))
+                        seen = true;
+                else if (startswith(line, "script2 "))
+                        seen2 = true;
+
+                assert_se(!startswith(line, "masked "));
+        }
+        assert_se(seen && seen2);
 
         assert_se(chdir(template_lo) == 0);
         assert_se(access("it_works", F_OK) >= 0);
@@ -2216,6 +2280,7 @@ int main(int argc, char *argv[]) {
         test_div_round_up();
         test_first_word();
         test_close_many();
+        test_close_all_fds();
         test_parse_boolean();
         test_parse_pid();
         test_parse_uid();
@@ -95,6 +95,16 @@
 
 #define TIMEOUT_USEC (10*USEC_PER_SEC)
 
+/*
+ * Maximum number of addresses of the current server that are asked in
+ * one polling round. Pools resolve to several independent machines;
+ * comparing their answers lets us drop a bad or jittery one.
+ */
+#define NTP_MAX_SOURCES 4
+
+/* How long to wait for the replies of one polling round */
+#define NTP_COLLECT_USEC (2*USEC_PER_SEC)
+
 struct ntp_ts {
         be32_t sec;
         be32_t frac;
@@ -150,8 +160,18 @@ static int manager_timeout(sd_event_source *source, usec_t usec, void *userdata)
         return manager_connect(m);
 }
 
+static int manager_select(Manager *m, bool complete);
+
+static int manager_collect_timeout(sd_event_source *source, usec_t usec, void *userdata) {
+        Manager *m = userdata;
+
+        assert(m);
+
+        /* go with the replies we have */
+        return manager_select(m, false);
+}
+
 static int manager_send_request(Manager *m) {
-        _cleanup_free_ char *pretty = NULL;
         struct ntp_msg ntpmsg = {
                 /*
                  * "The client initializes the NTP message header, sends the request
@@ -162,6 +182,8 @@ static int manager_send_request(Manager *m) {
                  */
                 .field = NTP_FIELD(0, 4, NTP_MODE_CLIENT),
         };
+        ServerAddress *a;
+        unsigned n = 0;
         ssize_t len;
         int r;
 
@@ -175,30 +197,54 @@ static int manager_send_request(Manager *m) {
         if (r < 0)
                 return log_warning_errno(r, "Failed to setup connection socket: %m");
 
-        /*
-         * Set transmit timestamp, remember it; the server will send that back
-         * as the origin timestamp and we have an indication that this is the
-         * matching answer to our request.
-         *
-         * The actual value does not matter, We do not care about the correct
-         * NTP UINT_MAX fraction; we just pass the plain nanosecond value.
-         */
-        assert_se(clock_gettime(clock_boottime_or_monotonic(), &m->trans_time_mon) >= 0);
-        assert_se(clock_gettime(CLOCK_REALTIME, &m->trans_time) >= 0);
-        ntpmsg.trans_time.sec = htobe32(m->trans_time.tv_sec + OFFSET_1900_1970);
-        ntpmsg.trans_time.frac = htobe32(m->trans_time.tv_nsec);
+        LIST_FOREACH(addresses, a, m->current_server_name->addresses)
+                a->pending = a->sampled = false;
 
-        server_address_pretty(m->current_server_address, &pretty);
+        /* Ask the current address and the ones after it; those before
+         * it already failed us. The socket can only reach addresses of
+         * the same family. */
+        for (a = m->current_server_address; a && n < NTP_MAX_SOURCES; a = a->addresses_next) {
+                _cleanup_free_ char *pretty = NULL;
 
-        len = sendto(m->server_socket, &ntpmsg, sizeof(ntpmsg), MSG_DONTWAIT, &m->current_server_address->sockaddr.sa, m->current_server_address->socklen);
-        if (len == sizeof(ntpmsg)) {
-                m->pending = true;
-                log_debug("Sent NTP request to %s (%s).", strna(pretty), m->current_server_name->string);
-        } else {
-                log_debug_errno(errno, "Sending NTP request to %s (%s) failed: %m", strna(pretty), m->current_server_name->string);
-                return manager_connect(m);
+                if (a->sockaddr.sa.sa_family != m->current_server_address->sockaddr.sa.sa_family)
+                        continue;
+
+                /*
+                 * Set transmit timestamp, remember it; the server will send that back
+                 * as the origin timestamp and we have an indication that this is the
+                 * matching answer to our request.
+                 *
+                 * The actual value does not matter, We do not care about the correct
+                 * NTP UINT_MAX fraction; we just pass the plain nanosecond value.
+                 */
+                assert_se(clock_gettime(CLOCK_REALTIME, &a->trans_time) >= 0);
+                ntpmsg.trans_time.sec = htobe32(a->trans_time.tv_sec + OFFSET_1900_1970);
+                ntpmsg.trans_time.frac = htobe32(a->trans_time.tv_nsec);
+
+                server_address_pretty(a, &pretty);
+
+                len = sendto(m->server_socket, &ntpmsg, sizeof(ntpmsg), MSG_DONTWAIT, &a->sockaddr.sa, a->socklen);
+                if (len == sizeof(ntpmsg)) {
+                        a->pending = true;
+                        n++;
+                        log_debug("Sent NTP request to %s (%s).", strna(pretty), m->current_server_name->string);
+                } else
+                        log_debug_errno(errno, "Sending NTP request to %s (%s) failed: %m", strna(pretty), m->current_server_name->string);
         }
 
+        if (n == 0)
+                return manager_connect(m);
+
+        m->event_collect = sd_event_source_unref(m->event_collect);
+        r = sd_event_add_time(
+                        m->event,
+                        &m->event_collect,
+                        clock_boottime_or_monotonic(),
+                        now(clock_boottime_or_monotonic()) + NTP_COLLECT_USEC, 0,
+                        manager_collect_timeout, m);
+        if (r < 0)
+                return log_error_errno(r, "Failed to arm collect timer: %m");
+
         /* re-arm timer with increasing timeout, in case the packets never arrive back */
         if (m->retry_interval > 0) {
                 if (m->retry_interval < NTP_POLL_INTERVAL_MAX_SEC * USEC_PER_SEC)
@@ -466,6 +512,20 @@ static void manager_adjust_poll(Manager *m, double offset, bool spike) {
         }
 }
 
+/* Done with one address for this round, see whether all have answered */
+static int manager_sample_done(Manager *m) {
+        ServerAddress *a;
+
+        assert(m);
+        assert(m->current_server_name);
+
+        LIST_FOREACH(addresses, a, m->current_server_name->addresses)
+                if (a->pending)
+                        return 0;
+
+        return manager_select(m, true);
+}
+
 static int manager_receive_response(sd_event_source *source, int fd, uint32_t revents, void *userdata) {
         Manager *m = userdata;
         struct ntp_msg ntpmsg;
@@ -487,15 +547,12 @@ static int manager_receive_response(sd_event_source *source, int fd, uint32_t re
                 .msg_name = &server_addr,
                 .msg_namelen = sizeof(server_addr),
         };
+        _cleanup_free_ char *pretty = NULL;
         struct cmsghdr *cmsg;
         struct timespec *recv_time;
+        ServerAddress *a;
         ssize_t len;
         double origin, receive, trans, dest;
-        double delay, offset;
-        double root_distance;
-        bool spike;
-        int leap_sec;
-        int r;
 
         assert(source);
         assert(m);
@@ -520,9 +577,12 @@ static int manager_receive_response(sd_event_source *source, int fd, uint32_t re
                 return manager_connect(m);
         }
 
-        if (!m->current_server_name ||
-            !m->current_server_address ||
-            !sockaddr_equal(&server_addr, &m->current_server_address->sockaddr)) {
+        a = NULL;
+        if (m->current_server_name && m->current_server_address)
+                LIST_FOREACH(addresses, a, m->current_server_name->addresses)
+                        if (sockaddr_equal(&server_addr, &a->sockaddr))
+                                break;
+        if (!a) {
                 log_debug("Response from unknown server.");
                 return 0;
         }
@@ -543,64 +603,59 @@ static int manager_receive_response(sd_event_source *source, int fd, uint32_t re
                 return -EINVAL;
         }
 
-        if (!m->pending) {
+        if (!a->pending) {
                 log_debug("Unexpected reply. Ignoring.");
                 return 0;
         }
 
-        m->missed_replies = 0;
-
         /* check our "time cookie" (we just stored nanoseconds in the fraction field) */
-        if (be32toh(ntpmsg.origin_time.sec) != m->trans_time.tv_sec + OFFSET_1900_1970 ||
-            be32toh(ntpmsg.origin_time.frac) != m->trans_time.tv_nsec) {
+        if (be32toh(ntpmsg.origin_time.sec) != a->trans_time.tv_sec + OFFSET_1900_1970 ||
+            be32toh(ntpmsg.origin_time.frac) != a->trans_time.tv_nsec) {
                 log_debug("Invalid reply; not our transmit time. Ignoring.");
                 return 0;
         }
 
-        m->event_timeout = sd_event_source_unref(m->event_timeout);
+        /* From here on, this address is done for this round, whether
+         * its reply is any good or not */
+        a->pending = false;
+
+        server_address_pretty(a, &pretty);
 
         if (be32toh(ntpmsg.recv_time.sec) < TIME_EPOCH + OFFSET_1900_1970 ||
             be32toh(ntpmsg.trans_time.sec) < TIME_EPOCH + OFFSET_1900_1970) {
-                log_debug("Invalid reply, returned times before epoch. Ignoring.");
-                return manager_connect(m);
+                log_debug("Invalid reply from %s, returned times before epoch. Ignoring.", strna(pretty));
+                return manager_sample_done(m);
         }
 
         if (NTP_FIELD_LEAP(ntpmsg.field) == NTP_LEAP_NOTINSYNC ||
             ntpmsg.stratum == 0 || ntpmsg.stratum >= 16) {
-                log_debug("Server is not synchronized. Disconnecting.");
-                return manager_connect(m);
+                log_debug("Server %s is not synchronized. Ignoring.", strna(pretty));
+                return manager_sample_done(m);
         }
 
         if (!IN_SET(NTP_FIELD_VERSION(ntpmsg.field), 3, 4)) {
-                log_debug("Response NTPv%d. Disconnecting.", NTP_FIELD_VERSION(ntpmsg.field));
-                return manager_connect(m);
+                log_debug("Response NTPv%d from %s. Ignoring.", NTP_FIELD_VERSION(ntpmsg.field), strna(pretty));
+                return manager_sample_done(m);
         }
 
         if (NTP_FIELD_MODE(ntpmsg.field) != NTP_MODE_SERVER) {
-                log_debug("Unsupported mode %d. Disconnecting.", NTP_FIELD_MODE(ntpmsg.field));
-                return manager_connect(m);
+                log_debug("Unsupported mode %d from %s. Ignoring.", NTP_FIELD_MODE(ntpmsg.field), strna(pretty));
+                return manager_sample_done(m);
         }
 
-        root_distance = ntp_ts_short_to_d(&ntpmsg.root_delay) / 2 + ntp_ts_short_to_d(&ntpmsg.root_dispersion);
-        if (root_distance > NTP_MAX_ROOT_DISTANCE) {
-                log_debug("Server has too large root distance. Disconnecting.");
-                return manager_connect(m);
+        a->root_distance = ntp_ts_short_to_d(&ntpmsg.root_delay) / 2 + ntp_ts_short_to_d(&ntpmsg.root_dispersion);
+        if (a->root_distance > NTP_MAX_ROOT_DISTANCE) {
+                log_debug("Server %s has too large root distance. Ignoring.", strna(pretty));
+                return manager_sample_done(m);
         }
 
-        /* valid packet */
-        m->pending = false;
-        m->retry_interval = 0;
-
-        /* Stop listening */
-        manager_listen_stop(m);
-
         /* announce leap seconds */
         if (NTP_FIELD_LEAP(ntpmsg.field) & NTP_LEAP_PLUSSEC)
-                leap_sec = 1;
+                a->leap_sec = 1;
         else if (NTP_FIELD_LEAP(ntpmsg.field) & NTP_LEAP_MINUSSEC)
-                leap_sec = -1;
+                a->leap_sec = -1;
         else
-                leap_sec = 0;
+                a->leap_sec = 0;
 
         /*
          * "Timestamp Name          ID   When Generated
@@ -613,19 +668,16 @@ static int manager_receive_response(sd_event_source *source, int fd, uint32_t re
          *  The round-trip delay, d, and system clock offset, t, are defined as:
          *  d = (T4 - T1) - (T3 - T2)     t = ((T2 - T1) + (T3 - T4)) / 2"
          */
-        origin = ts_to_d(&m->trans_time) + OFFSET_1900_1970;
+        origin = ts_to_d(&a->trans_time) + OFFSET_1900_1970;
         receive = ntp_ts_to_d(&ntpmsg.recv_time);
         trans = ntp_ts_to_d(&ntpmsg.trans_time);
         dest = ts_to_d(recv_time) + OFFSET_1900_1970;
 
-        offset = ((receive - origin) + (trans - dest)) / 2;
-        delay = (dest - origin) - (trans - receive);
-
-        spike = manager_sample_spike_detection(m, offset, delay);
-
-        manager_adjust_poll(m, offset, spike);
+        a->offset = ((receive - origin) + (trans - dest)) / 2;
+        a->delay = (dest - origin) - (trans - receive);
+        a->sampled = true;
 
-        log_debug("NTP response:\n"
+        log_debug("NTP response from %s:\n"
                   "  leap         : %u\n"
                   "  version      : %u\n"
                   "  mode         : %u\n"
@@ -638,43 +690,196 @@ static int manager_receive_response(sd_event_source *source, int fd, uint32_t re
                   "  transmit     : %.3f\n"
                   "  dest         : %.3f\n"
                   "  offset       : %+.3f sec\n"
-                  "  delay        : %+.3f sec\n"
-                  "  packet count : %"PRIu64"\n"
-                  "  jitter       : %.3f%s\n"
-                  "  poll interval: " USEC_FMT "\n",
+                  "  delay        : %+.3f sec\n",
+                  strna(pretty),
                   NTP_FIELD_LEAP(ntpmsg.field),
                   NTP_FIELD_VERSION(ntpmsg.field),
                   NTP_FIELD_MODE(ntpmsg.field),
                   ntpmsg.stratum,
                   exp2(ntpmsg.precision), ntpmsg.precision,
-                  root_distance,
+                  a->root_distance,
                   ntpmsg.stratum == 1 ? ntpmsg.refid : "n/a",
                   origin - OFFSET_1900_1970,
                   receive - OFFSET_1900_1970,
                   trans - OFFSET_1900_1970,
                   dest - OFFSET_1900_1970,
-                  offset, delay,
-                  m->packet_count,
-                  m->samples_jitter, spike ? " spike" : "",
-                  m->poll_interval_usec / USEC_PER_SEC);
+                  a->offset, a->delay);
+
+        return manager_sample_done(m);
+}
+
+/* Largest error a sample can have: half its round trip plus whatever
+ * the server says it might be off itself */
+static double server_address_distance(ServerAddress *a) {
+        return MAX(a->delay / 2 + a->root_distance, 1e-6);
+}
+
+typedef struct SampleEdge {
+        double value;
+        int type; /* -1 for the lower end of an interval, 1 for the upper one */
+} SampleEdge;
+
+static int sample_edge_compare(const void *_a, const void *_b) {
+        const SampleEdge *a = _a, *b = _b;
+
+        if (a->value < b->value)
+                return -1;
+        if (a->value > b->value)
+                return 1;
+
+        /* intervals that merely touch still overlap */
+        return a->type - b->type;
+}
+
+/*
+ * Every sample says the true offset lies within its distance around
+ * the measured offset. Find the offset the most samples agree on
+ * (Marzullo's algorithm), drop the ones that disagree, and combine the
+ * rest weighted by their distance. Without a majority we cannot tell
+ * who is wrong, and go with the closest sample alone.
+ *
+ * Returns the number of samples used, the combined offset and the
+ * closest sample.
+ */
+static unsigned manager_combine_samples(Manager *m, double *ret_offset, ServerAddress **ret_best) {
+        SampleEdge edges[2 * NTP_MAX_SOURCES];
+        ServerAddress *a, *best = NULL;
+        unsigned n = 0, n_edges = 0, used = 0, i;
+        double lo = 0, hi = 0, sum = 0, weights = 0;
+        int count = 0, max = 0;
+
+        assert(m);
+        assert(ret_offset);
+        assert(ret_best);
+
+        LIST_FOREACH(addresses, a, m->current_server_name->addresses) {
+                if (!a->sampled || n_edges >= ELEMENTSOF(edges))
+                        continue;
+
+                edges[n_edges++] = (SampleEdge) { a->offset - server_address_distance(a), -1 };
+                edges[n_edges++] = (SampleEdge) { a->offset + server_address_distance(a), 1 };
+                n++;
+
+                if (!best || server_address_distance(a) < server_address_distance(best))
+                        best = a;
+        }
+
+        if (n == 0)
+                return 0;
+
+        qsort(edges, n_edges, sizeof(SampleEdge), sample_edge_compare);
+
+        for (i = 0; i < n_edges; i++) {
+                count -= edges[i].type;
+
+                if (count > max) {
+                        max = count;
+                        lo = edges[i].value;
+                        hi = edges[i + 1].value;
+                }
+        }
+
+        if ((unsigned) max * 2 <= n) {
+                log_debug("No majority among %u samples, using the closest one.", n);
+
+                *ret_offset = best->offset;
+                *ret_best = best;
+                return 1;
+        }
+
+        best = NULL;
+        LIST_FOREACH(addresses, a, m->current_server_name->addresses) {
+                double d;
+
+                if (!a->sampled)
+                        continue;
+
+                d = server_address_distance(a);
+
+                /* drop the ones not agreeing with the majority */
+                if (a->offset + d < lo || a->offset - d > hi) {
+                        _cleanup_free_ char *pretty = NULL;
+
+                        server_address_pretty(a, &pretty);
+                        log_debug("Sample of %s disagrees with the others (%+.3f sec). Ignoring.", strna(pretty), a->offset);
+                        continue;
+                }
+
+                sum += a->offset / d;
+                weights += 1 / d;
+                used++;
+
+                if (!best || d < server_address_distance(best))
+                        best = a;
+        }
+
+        assert(used > 0);
+
+        *ret_offset = sum / weights;
+        *ret_best = best;
+
+        return used;
+}
+
+/* Called when all addresses of the round answered, or when we gave up
+ * waiting for the rest */
+static int manager_select(Manager *m, bool complete) {
+        _cleanup_free_ char *pretty = NULL;
+        ServerAddress *a;
+        double offset;
+        unsigned used;
+        bool spike;
+        int r;
+
+        assert(m);
+        assert(m->current_server_name);
+
+        m->event_collect = sd_event_source_unref(m->event_collect);
+
+        used = manager_combine_samples(m, &offset, &a);
+        if (used == 0) {
+                /* everybody answered, but nothing was usable */
+                if (complete) {
+                        log_debug("No usable reply from %s. Disconnecting.", m->current_server_name->string);
+                        return manager_connect(m);
+                }
+
+                /* nobody answered, the retry timer will ask again */
+                return 0;
+        }
+
+        /* valid sample */
+        m->missed_replies = 0;
+        m->event_timeout = sd_event_source_unref(m->event_timeout);
+        m->retry_interval = 0;
+
+        /* the closest one is our server from now on; not switching via
+         * manager_set_server_address() since that disconnects */
+        m->current_server_address = a;
+
+        /* Stop listening */
+        manager_listen_stop(m);
+
+        spike = manager_sample_spike_detection(m, offset, a->delay);
+
+        manager_adjust_poll(m, offset, spike);
 
         if (!spike) {
                 m->sync = true;
-                r = manager_adjust_clock(m, offset, leap_sec);
+                r = manager_adjust_clock(m, offset, a->leap_sec);
                 if (r < 0)
                         log_error_errno(errno, "Failed to call clock_adjtime(): %m");
         }
 
-        log_debug("interval/delta/delay/jitter/drift " USEC_FMT "s/%+.3fs/%.3fs/%.3fs/%+ippm%s",
-                  m->poll_interval_usec / USEC_PER_SEC, offset, delay, m->samples_jitter, m->drift_ppm,
+        log_debug("interval/delta/delay/jitter/drift/samples " USEC_FMT "s/%+.3fs/%.3fs/%.3fs/%+ippm/%u%s",
+                  m->poll_interval_usec / USEC_PER_SEC, offset, a->delay, m->samples_jitter, m->drift_ppm, used,
                   spike ? " (ignored)" : "");
 
-        if (!m->good) {
-                _cleanup_free_ char *pretty = NULL;
+        server_address_pretty(a, &pretty);
 
+        if (!m->good) {
                 m->good = true;
 
-                server_address_pretty(m->current_server_address, &pretty);
                 log_info("Synchronized to time server %s (%s).", strna(pretty), m->current_server_name->string);
                 sd_notifyf(false, "STATUS=Synchronized to time server %s (%s).", strna(pretty), m->current_server_name->string);
         }
@@ -962,6 +1167,7 @@ void manager_disconnect(Manager *m) {
         m->clock_watch_fd = safe_close(m->clock_watch_fd);
 
         m->event_timeout = sd_event_source_unref(m->event_timeout);
+        m->event_collect = sd_event_source_unref(m->event_collect);
 
         sd_notifyf(false, "STATUS=Idle.");
 }
@@ -1046,13 +1252,20 @@ clear:
 }
 
 static int manager_network_event_handler(sd_event_source *s, int fd, uint32_t revents, void *userdata) {
+        _cleanup_free_ int *ifindexes = NULL;
         Manager *m = userdata;
         bool connected, online;
+        size_t n = 0;
         int r;
 
         assert(m);
 
-        sd_network_monitor_flush(m->network_monitor);
+        r = sd_network_monitor_flush_links(m->network_monitor, &ifindexes, &n);
+        if (r < 0)
+                log_warning_errno(r, "Failed to flush network monitor: %m");
+        else if (r == 0 && n == 0)
+                /* no link changed, nothing to re-read */
+                return 0;
 
         manager_network_read_link_servers(m);
 
@@ -57,11 +57,9 @@ struct Manager {
         sd_event_source *event_timeout;
         bool good;
 
-        /* last sent packet */
-        struct timespec trans_time_mon;
-        struct timespec trans_time;
+        /* last polling round */
+        sd_event_source *event_collect;
         usec_t retry_interval;
-        bool pending;
 
         /* poll timer */
         sd_event_source *event_timer;
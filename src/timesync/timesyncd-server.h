@@ -41,6 +41,17 @@ struct ServerAddress {
         union sockaddr_union sockaddr;
         socklen_t socklen;
 
+        /* request sent in the current polling round */
+        struct timespec trans_time;
+        bool pending;
+
+        /* its reply */
+        bool sampled;
+        double offset;
+        double delay;
+        double root_distance;
+        int leap_sec;
+
         LIST_FIELDS(ServerAddress, addresses);
 };
 
@@ -36,6 +36,7 @@
 #include <fnmatch.h>
 #include <sys/stat.h>
 #include <sys/xattr.h>
+#include <sys/wait.h>
 #include <linux/fs.h>
 
 #include "log.h"
@@ -124,8 +125,16 @@ typedef struct Item {
         bool force:1;
 
         bool done:1;
+
+        /* Index into config_timings[] */
+        unsigned config_file;
 } Item;
 
+typedef struct ConfigTiming {
+        char *path;
+        usec_t usec;
+} ConfigTiming;
+
 typedef struct ItemArray {
         Item *items;
         size_t count;
@@ -144,10 +153,14 @@ static char *arg_root = NULL;
 static const char conf_file_dirs[] = CONF_DIRS_NULSTR("tmpfiles");
 
 #define MAX_DEPTH 256
+#define CLEAN_WORKERS_MAX 8U
 
 static OrderedHashmap *items = NULL, *globs = NULL;
 static Set *unix_sockets = NULL;
 
+static ConfigTiming *config_timings = NULL;
+static size_t n_config_timings = 0, config_timings_allocated = 0;
+
 static const Specifier specifier_table[] = {
         { 'm', specifier_machine_id, NULL },
         { 'b', specifier_boot_id, NULL },
@@ -287,17 +300,21 @@ static bool unix_socket_alive(const char *fn) {
         return true;
 }
 
-static int dir_is_mount_point(DIR *d, const char *subdir) {
-
+static int dir_mount_id(DIR *d, int *ret) {
         union file_handle_union h = FILE_HANDLE_INIT;
-        int mount_id_parent, mount_id;
-        int r_p, r;
 
-        r_p = name_to_handle_at(dirfd(d), ".", &h.handle, &mount_id_parent, 0);
-        if (r_p < 0)
-                r_p = -errno;
+        if (name_to_handle_at(dirfd(d), ".", &h.handle, ret, 0) < 0)
+                return -errno;
+
+        return 0;
+}
+
+static int dir_is_mount_point(DIR *d, int r_p, int mount_id_parent, const char *subdir) {
+
+        union file_handle_union h = FILE_HANDLE_INIT;
+        int mount_id;
+        int r;
 
-        h.handle.handle_bytes = MAX_HANDLE_SZ;
         r = name_to_handle_at(dirfd(d), subdir, &h.handle, &mount_id, 0);
         if (r < 0)
                 r = -errno;
@@ -357,6 +374,8 @@ static int dir_cleanup(
         struct dirent *dent;
         struct timespec times[2];
         bool deleted = false;
+        int mount_id = 0, r_mount_id = 0;
+        bool mount_id_queried = false;
         int r = 0;
 
         while ((dent = readdir(d))) {
@@ -389,10 +408,19 @@ static int dir_cleanup(
                 /* Try to detect bind mounts of the same filesystem instance; they
                  * do not differ in device major/minors. This type of query is not
                  * supported on all kernels or filesystem types though. */
-                if (S_ISDIR(s.st_mode) && dir_is_mount_point(d, dent->d_name) > 0) {
-                        log_debug("Ignoring \"%s/%s\": different mount of the same filesystem.",
-                                  p, dent->d_name);
-                        continue;
+                if (S_ISDIR(s.st_mode)) {
+                        /* The mount id of the directory itself is
+                         * needed only once per level, not per entry */
+                        if (!mount_id_queried) {
+                                r_mount_id = dir_mount_id(d, &mount_id);
+                                mount_id_queried = true;
+                        }
+
+                        if (dir_is_mount_point(d, r_mount_id, mount_id, dent->d_name) > 0) {
+                                log_debug("Ignoring \"%s/%s\": different mount of the same filesystem.",
+                                          p, dent->d_name);
+                                continue;
+                        }
                 }
 
                 /* Do not delete read-only files owned by root */
@@ -632,8 +660,8 @@ static int path_set_perms(Item *i, const char *path) {
                         }
                 }
 
-                if ((i->uid != st.st_uid || i->gid != st.st_gid) &&
-                    (i->uid_set || i->gid_set)) {
+                if ((i->uid_set && i->uid != st.st_uid) ||
+                    (i->gid_set && i->gid != st.st_gid)) {
                         log_debug("chown \"%s\" to "UID_FMT"."GID_FMT,
                                   path,
                                   i->uid_set ? i->uid : UID_INVALID,
@@ -699,9 +727,17 @@ static int path_set_xattrs(Item *i, const char *path) {
         assert(path);
 
         STRV_FOREACH_PAIR(name, value, i->xattrs) {
-                int n;
+                _cleanup_free_ char *old = NULL;
+                int n, k;
 
                 n = strlen(*value);
+
+                k = getxattr_malloc(path, *name, &old, true);
+                if (k == n && memcmp(old, *value, n) == 0) {
+                        log_debug("Extended attribute '%s' on %s already set.", *name, path);
+                        continue;
+                }
+
                 log_debug("Setting extended attribute '%s=%s' on %s.", *name, *value, path);
                 if (lsetxattr(path, *name, *value, n, 0) < 0) {
                         log_error("Setting extended attribute %s=%s on %s failed: %m", *name, *value, path);
@@ -733,7 +769,7 @@ static int parse_acls_from_arg(Item *item) {
 #ifdef HAVE_ACL
 static int path_set_acl(const char *path, const char *pretty, acl_type_t type, acl_t acl, bool modify) {
         _cleanup_(acl_free_charpp) char *t = NULL;
-        _cleanup_(acl_freep) acl_t dup = NULL;
+        _cleanup_(acl_freep) acl_t dup = NULL, old = NULL;
         int r;
 
         /* Returns 0 for success, positive error if already warned,
@@ -760,6 +796,16 @@ static int path_set_acl(const char *path, const char *pretty, acl_type_t type, a
                 return r;
 
         t = acl_to_any_text(dup, NULL, ',', TEXT_ABBREVIATE);
+
+        /* Don't rewrite the ACL if it is already in place */
+        old = acl_get_file(path, type);
+        if (old && acl_cmp(old, dup) == 0) {
+                log_debug("%s ACL %s on %s already set.",
+                          type == ACL_TYPE_ACCESS ? "Access" : "Default",
+                          strna(t), pretty);
+                return 0;
+        }
+
         log_debug("Setting %s ACL %s on %s.",
                   type == ACL_TYPE_ACCESS ? "access" : "default",
                   strna(t), pretty);
@@ -1604,6 +1650,7 @@ static int process_item_array(ItemArray *array);
 static int process_item(Item *i) {
         int r, q, p, t = 0;
         _cleanup_free_ char *prefix = NULL;
+        usec_t ts;
 
         assert(i);
 
@@ -1629,10 +1676,15 @@ static int process_item(Item *i) {
                 }
         }
 
+        ts = now(CLOCK_MONOTONIC);
+
         r = arg_create ? create_item(i) : 0;
         q = arg_remove ? remove_item(i) : 0;
         p = arg_clean ? clean_item(i) : 0;
 
+        if (i->config_file < n_config_timings)
+                config_timings[i->config_file].usec += now(CLOCK_MONOTONIC) - ts;
+
         return t < 0 ? t :
                 r < 0 ? r :
                 q < 0 ? q :
@@ -1654,6 +1706,129 @@ static int process_item_array(ItemArray *array) {
         return r;
 }
 
+static void log_config_timings(void) {
+        size_t n;
+
+        for (n = 0; n < n_config_timings; n++) {
+                char ts[FORMAT_TIMESPAN_MAX];
+
+                log_debug("Applying \"%s\" took %s.",
+                          config_timings[n].path,
+                          format_timespan(ts, sizeof(ts), config_timings[n].usec, USEC_PER_MSEC/10));
+        }
+}
+
+static void config_timings_free(void) {
+        size_t n;
+
+        for (n = 0; n < n_config_timings; n++)
+                free(config_timings[n].path);
+
+        config_timings = mfree(config_timings);
+        n_config_timings = config_timings_allocated = 0;
+}
+
+static int clean_item_array_worker(ItemArray *array) {
+        unsigned n;
+        int r = 0, k;
+
+        assert(array);
+
+        for (n = 0; n < array->count; n++) {
+                k = clean_item(array->items + n);
+                if (k < 0 && r == 0)
+                        r = k;
+        }
+
+        return r;
+}
+
+static int clean_worker_reap(unsigned *n_workers, bool *failed) {
+        siginfo_t si = {};
+
+        assert(n_workers);
+        assert(*n_workers > 0);
+        assert(failed);
+
+        if (waitid(P_ALL, 0, &si, WEXITED) < 0)
+                return log_error_errno(errno, "Failed to wait for clean worker: %m");
+
+        if (si.si_code != CLD_EXITED || si.si_status != EXIT_SUCCESS)
+                *failed = true;
+
+        (*n_workers)--;
+        return 0;
+}
+
+static int clean_worker_spawn(ItemArray *array, unsigned n_max, unsigned *n_workers, bool *failed) {
+        pid_t pid;
+        int r;
+
+        assert(array);
+        assert(n_workers);
+        assert(failed);
+
+        if (*n_workers >= n_max) {
+                r = clean_worker_reap(n_workers, failed);
+                if (r < 0)
+                        return r;
+        }
+
+        pid = fork();
+        if (pid < 0) {
+                log_warning_errno(errno, "Failed to fork clean worker, cleaning synchronously: %m");
+                if (clean_item_array_worker(array) < 0)
+                        *failed = true;
+                return 0;
+        }
+        if (pid == 0)
+                _exit(clean_item_array_worker(array) < 0 ? EXIT_FAILURE : EXIT_SUCCESS);
+
+        (*n_workers)++;
+        return 0;
+}
+
+static int clean_items_parallel(void) {
+        unsigned n_workers = 0, n_max;
+        bool failed = false;
+        ItemArray *a;
+        Iterator iterator;
+        long ncpus;
+        int r;
+
+        /* Cleaning never creates anything, and an entry only removes
+         * files that no other entry covers, hence the entries are
+         * independent of each other and can be aged in parallel. Use
+         * one worker process per entry, but not more than a few at a
+         * time, as this is mostly bound by I/O. */
+
+        ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+        n_max = CLAMP(ncpus, 1, CLEAN_WORKERS_MAX);
+
+        /* Read /proc/net/unix once, not in every worker */
+        load_unix_sockets();
+
+        ORDERED_HASHMAP_FOREACH(a, items, iterator) {
+                r = clean_worker_spawn(a, n_max, &n_workers, &failed);
+                if (r < 0)
+                        return r;
+        }
+
+        ORDERED_HASHMAP_FOREACH(a, globs, iterator) {
+                r = clean_worker_spawn(a, n_max, &n_workers, &failed);
+                if (r < 0)
+                        return r;
+        }
+
+        while (n_workers > 0) {
+                r = clean_worker_reap(&n_workers, &failed);
+                if (r < 0)
+                        return r;
+        }
+
+        return failed ? -EIO : 0;
+}
+
 static void item_free_contents(Item *i) {
         assert(i);
         free(i->path);
@@ -2003,6 +2178,9 @@ static int parse_line(const char *fname, unsigned line, const char *buffer) {
                 i.age_set = true;
         }
 
+        /* Account the time spent on this item to the file it came from */
+        i.config_file = n_config_timings - 1;
+
         h = needs_glob(i.type) ? globs : items;
 
         existing = ordered_hashmap_get(h, i.path);
@@ -2165,6 +2343,14 @@ static int read_config_file(const char *fn, bool ignore_enoent) {
         }
         log_debug("Reading config file \"%s\".", fn);
 
+        if (!GREEDY_REALLOC(config_timings, config_timings_allocated, n_config_timings + 1))
+                return log_oom();
+
+        config_timings[n_config_timings].path = strdup(fn);
+        if (!config_timings[n_config_timings].path)
+                return log_oom();
+        config_timings[n_config_timings++].usec = 0;
+
         FOREACH_LINE(line, f, break) {
                 char *l;
                 int k;
@@ -2270,6 +2456,13 @@ int main(int argc, char *argv[]) {
                 }
         }
 
+        if (arg_clean && !arg_create && !arg_remove) {
+                k = clean_items_parallel();
+                if (k < 0 && r == 0)
+                        r = k;
+                goto finish;
+        }
+
         /* The non-globbing ones usually create things, hence we apply
          * them first */
         ORDERED_HASHMAP_FOREACH(a, items, iterator) {
@@ -2286,6 +2479,8 @@ int main(int argc, char *argv[]) {
                         r = k;
         }
 
+        log_config_timings();
+
 finish:
         while ((a = ordered_hashmap_steal_first(items)))
                 item_array_free(a);
@@ -2302,6 +2497,8 @@ finish:
 
         set_free_free(unix_sockets);
 
+        config_timings_free();
+
         mac_selinux_finish();
 
         return r < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
@@ -20,11 +20,39 @@
 #include <stdio.h>
 #include <string.h>
 #include <getopt.h>
+#include <sys/mman.h>
 
 #include "udev.h"
+#include "siphash24.h"
+#include "random-util.h"
+
+#define BUILTIN_CACHE_ENTRIES 2048
+
+/* The result of a builtin for one device, in memory shared by udevd and
+ * its workers. Readers and writers synchronize with the sequence number,
+ * which is odd while the entry is written. */
+struct builtin_cache_entry {
+        unsigned seq;
+        int ret;
+        size_t size;
+        char devpath[256];
+        char key[256]; /* the builtin command and the generation of the device */
+        char data[1024]; /* the properties the builtin set, "KEY=VALUE\0"... */
+};
+
+struct builtin_cache_capture {
+        char data[1024];
+        size_t size;
+        bool overflow;
+};
 
 static bool initialized;
 
+static struct builtin_cache_entry *cache;
+static bool cache_enabled[UDEV_BUILTIN_MAX];
+static uint8_t cache_hash_key[16];
+static struct builtin_cache_capture *capture;
+
 static const struct udev_builtin *builtins[] = {
 #ifdef HAVE_BLKID
         [UDEV_BUILTIN_BLKID] = &udev_builtin_blkid,
@@ -117,24 +145,257 @@ enum udev_builtin_cmd udev_builtin_lookup(const char *command) {
         return UDEV_BUILTIN_MAX;
 }
 
+int udev_builtin_cache_init(const char *list) {
+        const char *word, *state;
+        size_t l;
+
+        if (cache)
+                return 0;
+
+        FOREACH_WORD_SEPARATOR(word, l, list, ",", state) {
+                char name[l + 1];
+                enum udev_builtin_cmd cmd;
+
+                memcpy(name, word, l);
+                name[l] = '\0';
+
+                cmd = udev_builtin_lookup(name);
+                if (cmd >= UDEV_BUILTIN_MAX)
+                        return -EINVAL;
+
+                switch (cmd) {
+#ifdef HAVE_BLKID
+                case UDEV_BUILTIN_BLKID:
+#endif
+                case UDEV_BUILTIN_HWDB:
+                case UDEV_BUILTIN_NET_ID:
+                case UDEV_BUILTIN_PATH_ID:
+                        cache_enabled[cmd] = true;
+                        break;
+                default:
+                        /* only builtins which just set properties */
+                        return -EOPNOTSUPP;
+                }
+        }
+
+        /* created before the workers are forked, so all share it */
+        cache = mmap(NULL, BUILTIN_CACHE_ENTRIES * sizeof(struct builtin_cache_entry),
+                     PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+        if (cache == MAP_FAILED) {
+                cache = NULL;
+                return -errno;
+        }
+
+        random_bytes(cache_hash_key, sizeof(cache_hash_key));
+
+        return 0;
+}
+
+static bool cache_entry_lock(struct builtin_cache_entry *e, unsigned *seq) {
+        *seq = e->seq;
+        if (*seq & 1)
+                return false;
+
+        return __sync_bool_compare_and_swap(&e->seq, *seq, *seq + 1);
+}
+
+static void cache_entry_unlock(struct builtin_cache_entry *e, unsigned seq) {
+        __sync_synchronize();
+        e->seq = seq + 2;
+}
+
+static void cache_entry_clear(struct builtin_cache_entry *e) {
+        unsigned seq;
+
+        if (!cache_entry_lock(e, &seq))
+                return;
+
+        e->devpath[0] = '\0';
+        e->key[0] = '\0';
+        e->size = 0;
+
+        cache_entry_unlock(e, seq);
+}
+
+void udev_builtin_cache_flush(void) {
+        unsigned i;
+
+        if (!cache)
+                return;
+
+        for (i = 0; i < BUILTIN_CACHE_ENTRIES; i++)
+                cache_entry_clear(&cache[i]);
+}
+
+/* forget the results for the device and its children */
+void udev_builtin_cache_invalidate(const char *devpath) {
+        size_t l = strlen(devpath);
+        unsigned i;
+
+        if (!cache || l >= sizeof(cache->devpath))
+                return;
+
+        for (i = 0; i < BUILTIN_CACHE_ENTRIES; i++)
+                if (strncmp(cache[i].devpath, devpath, l) == 0 &&
+                    IN_SET(cache[i].devpath[l], '\0', '/'))
+                        cache_entry_clear(&cache[i]);
+}
+
+/* what has to stay the same for a cached result to be valid */
+static bool cache_key(struct udev_device *dev, enum udev_builtin_cmd cmd, const char *command, char *key, size_t size) {
+        switch (cmd) {
+#ifdef HAVE_BLKID
+        case UDEV_BUILTIN_BLKID:
+                /* content changes are caught by the inotify watch, see udev_builtin_cache_invalidate() */
+                return strscpyl(key, size, command, "|", strempty(udev_device_get_sysattr_value(dev, "size")), NULL) > 0;
+#endif
+        case UDEV_BUILTIN_HWDB:
+                return strscpyl(key, size, command, "|", strempty(udev_device_get_property_value(dev, "MODALIAS")), NULL) > 0;
+        case UDEV_BUILTIN_NET_ID:
+                return strscpyl(key, size, command, "|", strempty(udev_device_get_property_value(dev, "IFINDEX")),
+                                "|", strempty(udev_device_get_sysattr_value(dev, "address")), NULL) > 0;
+        case UDEV_BUILTIN_PATH_ID:
+                return strscpy(key, size, command) > 0;
+        default:
+                return false;
+        }
+}
+
+static struct builtin_cache_entry *cache_entry(const char *devpath, const char *key) {
+        uint64_t h;
+        size_t l = strlen(devpath);
+        char buf[l + 1 + strlen(key) + 1];
+
+        memcpy(buf, devpath, l);
+        buf[l] = '|';
+        strcpy(buf + l + 1, key);
+
+        siphash24((uint8_t*) &h, buf, sizeof(buf) - 1, cache_hash_key);
+
+        return &cache[h % BUILTIN_CACHE_ENTRIES];
+}
+
+static bool cache_lookup(struct udev_device *dev, const char *key, int *ret) {
+        struct builtin_cache_entry *e;
+        char data[sizeof(e->data)];
+        size_t size;
+        unsigned seq;
+        const char *devpath = udev_device_get_devpath(dev);
+        const char *p;
+        bool match;
+        int r;
+
+        e = cache_entry(devpath, key);
+
+        seq = e->seq;
+        if (seq & 1)
+                return false;
+        __sync_synchronize();
+
+        /* the entry might change under us, stay within its bounds */
+        match = strncmp(e->devpath, devpath, sizeof(e->devpath)) == 0 &&
+                strncmp(e->key, key, sizeof(e->key)) == 0;
+        size = MIN(e->size, sizeof(data));
+        r = e->ret;
+        memcpy(data, e->data, size);
+
+        __sync_synchronize();
+        if (!match || e->seq != seq)
+                return false;
+
+        for (p = data; p < data + size; p += strlen(p) + 1) {
+                char k[strlen(p) + 1];
+                char *v;
+
+                strcpy(k, p);
+                v = strchr(k, '=');
+                if (!v)
+                        continue;
+                *v++ = '\0';
+
+                udev_device_add_property(dev, k, v);
+        }
+
+        *ret = r;
+        return true;
+}
+
+static void cache_store(struct udev_device *dev, const char *key, struct builtin_cache_capture *c, int ret) {
+        struct builtin_cache_entry *e;
+        const char *devpath = udev_device_get_devpath(dev);
+        unsigned seq;
+
+        if (c->overflow || strlen(devpath) >= sizeof(e->devpath))
+                return;
+
+        e = cache_entry(devpath, key);
+
+        /* somebody else is writing it, never wait for them */
+        if (!cache_entry_lock(e, &seq))
+                return;
+
+        strscpy(e->devpath, sizeof(e->devpath), devpath);
+        strscpy(e->key, sizeof(e->key), key);
+        memcpy(e->data, c->data, c->size);
+        e->size = c->size;
+        e->ret = ret;
+
+        cache_entry_unlock(e, seq);
+}
+
 int udev_builtin_run(struct udev_device *dev, enum udev_builtin_cmd cmd, const char *command, bool test) {
         char arg[UTIL_PATH_SIZE];
+        char key[sizeof(cache->key)];
+        struct builtin_cache_capture c = {};
+        const char *action;
+        bool store = false;
         int argc;
         char *argv[128];
+        int r;
 
         if (!builtins[cmd])
                 return -EOPNOTSUPP;
 
+        /* only repeated events for the same device are answered from the
+         * cache, "add" always runs the builtin */
+        action = udev_device_get_action(dev);
+        if (cache && cache_enabled[cmd] && !test && !streq_ptr(action, "remove") &&
+            cache_key(dev, cmd, command, key, sizeof(key))) {
+                if (!streq_ptr(action, "add") && cache_lookup(dev, key, &r))
+                        return r;
+
+                store = true;
+                capture = &c;
+        }
+
         /* we need '0' here to reset the internal state */
         optind = 0;
         strscpy(arg, sizeof(arg), command);
         udev_build_argv(udev_device_get_udev(dev), arg, &argc, argv);
-        return builtins[cmd]->cmd(dev, argc, argv, test);
+        r = builtins[cmd]->cmd(dev, argc, argv, test);
+
+        if (store) {
+                capture = NULL;
+                cache_store(dev, key, &c, r);
+        }
+
+        return r;
 }
 
 int udev_builtin_add_property(struct udev_device *dev, bool test, const char *key, const char *val) {
         udev_device_add_property(dev, key, val);
 
+        if (capture && !capture->overflow) {
+                size_t l = strlen(key) + 1 + strlen(val) + 1;
+
+                if (capture->size + l > sizeof(capture->data))
+                        capture->overflow = true;
+                else {
+                        sprintf(capture->data + capture->size, "%s=%s", key, val);
+                        capture->size += l;
+                }
+        }
+
         if (test)
                 printf("%s=%s\n", key, val);
         return 0;
@@ -35,6 +35,8 @@ enum udev_ctrl_msg_type {
         UDEV_CTRL_SET_CHILDREN_MAX,
         UDEV_CTRL_PING,
         UDEV_CTRL_EXIT,
+        UDEV_CTRL_WRITE_RULES_STATS,
+        UDEV_CTRL_SETTLE,
 };
 
 struct udev_ctrl_msg_wire {
@@ -319,6 +321,14 @@ int udev_ctrl_send_exit(struct udev_ctrl *uctrl, int timeout) {
         return ctrl_send(uctrl, UDEV_CTRL_EXIT, 0, NULL, timeout);
 }
 
+int udev_ctrl_send_write_rules_stats(struct udev_ctrl *uctrl, int timeout) {
+        return ctrl_send(uctrl, UDEV_CTRL_WRITE_RULES_STATS, 0, NULL, timeout);
+}
+
+int udev_ctrl_send_settle(struct udev_ctrl *uctrl, const char *devpath, int timeout) {
+        return ctrl_send(uctrl, UDEV_CTRL_SETTLE, 0, strempty(devpath), timeout);
+}
+
 struct udev_ctrl_msg *udev_ctrl_receive_msg(struct udev_ctrl_connection *conn) {
         struct udev_ctrl_msg *uctrl_msg;
         ssize_t size;
@@ -458,3 +468,15 @@ int udev_ctrl_get_exit(struct udev_ctrl_msg *ctrl_msg) {
                 return 1;
         return -1;
 }
+
+int udev_ctrl_get_write_rules_stats(struct udev_ctrl_msg *ctrl_msg) {
+        if (ctrl_msg->ctrl_msg_wire.type == UDEV_CTRL_WRITE_RULES_STATS)
+                return 1;
+        return -1;
+}
+
+const char *udev_ctrl_get_settle(struct udev_ctrl_msg *ctrl_msg) {
+        if (ctrl_msg->ctrl_msg_wire.type == UDEV_CTRL_SETTLE)
+                return ctrl_msg->ctrl_msg_wire.buf;
+        return NULL;
+}
@@ -28,17 +28,31 @@
 #include <dirent.h>
 #include <fnmatch.h>
 #include <time.h>
+#include <sys/mman.h>
+
+#include "sd-id128.h"
 
 #include "udev.h"
 #include "path-util.h"
 #include "conf-files.h"
+#include "fileio.h"
+#include "hashmap.h"
+#include "siphash24.h"
 #include "strbuf.h"
 #include "strv.h"
 #include "util.h"
 #include "sysctl-util.h"
+#include "sd-device.h"
+#include "device-private.h"
 
 #define PREALLOC_TOKEN          2048
 
+/* The parsed token array and string buffer are stored here, and
+ * mapped on the next start instead of parsing the rules again */
+#define RULES_CACHE             "/run/udev/rules.cache"
+#define RULES_CACHE_MAGIC       "UDEVRC01"
+#define RULES_CACHE_HASH_KEY    SD_ID128_MAKE(7b,2d,4c,e0,95,19,4e,3a,b1,6f,58,d2,0c,83,a7,44)
+
 struct uid_gid {
         unsigned int name_off;
         union {
@@ -63,6 +77,25 @@ struct udev_rules {
         unsigned int token_cur;
         unsigned int token_max;
 
+        /* when loaded from the cache, tokens and strings point into this mapping */
+        void *cache_map;
+        size_t cache_size;
+
+        /* dispatch index, see rules_build_index() */
+        struct rule_info *rule_infos;
+        unsigned int rule_infos_count;
+        unsigned int *unfiltered;
+        unsigned int unfiltered_count;
+        Hashmap *by_subsystem;
+
+        /* the value of TAG== matches as returned by
+         * device_intern_string(), indexed by token, so that they can
+         * be compared to the tags of a device by pointer */
+        const char **interned;
+
+        /* per-rule counters, shared with the forked workers */
+        struct rule_stats *stats;
+
         /* all key strings are copied and de-duplicated in a single continuous string buffer */
         struct strbuf *strbuf;
 
@@ -177,6 +210,40 @@ enum token_type {
 };
 
 /* we try to pack stuff in a way that we take only 12 bytes per token */
+/* Actions known to the dispatch index, anything else is ACTION_OTHER */
+enum {
+        ACTION_ADD      = 1 << 0,
+        ACTION_REMOVE   = 1 << 1,
+        ACTION_CHANGE   = 1 << 2,
+        ACTION_MOVE     = 1 << 3,
+        ACTION_ONLINE   = 1 << 4,
+        ACTION_OFFLINE  = 1 << 5,
+        ACTION_BIND     = 1 << 6,
+        ACTION_UNBIND   = 1 << 7,
+        ACTION_OTHER    = 1 << 8,
+        ACTION_ALL      = (1 << 9) - 1,
+};
+
+/* What a rule requires of an event before any of its tokens need
+ * to be looked at */
+struct rule_info {
+        unsigned int token;
+        unsigned int action_mask;
+        unsigned int kernel_off;
+        unsigned int kernel_len;
+};
+
+struct rule_list {
+        unsigned int *rules;
+        unsigned int count;
+        size_t allocated;
+};
+
+struct rule_stats {
+        uint64_t evaluated;
+        uint64_t matched;
+};
+
 struct token {
         union {
                 unsigned char type;                /* same in rule and key */
@@ -1628,11 +1695,441 @@ static int parse_file(struct udev_rules *rules, const char *filename) {
         return 0;
 }
 
+static unsigned int action_to_mask(const char *action, size_t len) {
+        static const char * const actions[] = {
+                "add", "remove", "change", "move", "online", "offline", "bind", "unbind",
+        };
+        unsigned int i;
+
+        for (i = 0; i < ELEMENTSOF(actions); i++)
+                if (strlen(actions[i]) == len && strneq(actions[i], action, len))
+                        return 1 << i;
+
+        return ACTION_OTHER;
+}
+
+static unsigned int token_action_mask(struct udev_rules *rules, struct token *token) {
+        const char *v = rules_str(rules, token->key.value_off);
+        unsigned int mask = 0;
+
+        if (!IN_SET(token->key.glob, GL_PLAIN, GL_SPLIT))
+                return ACTION_ALL;
+
+        for (;;) {
+                size_t len = strcspn(v, "|");
+                unsigned int m;
+
+                m = action_to_mask(v, len);
+
+                /* An unknown action in a negative match says nothing
+                 * about the other unknown actions */
+                if (token->key.op == OP_MATCH)
+                        mask |= m;
+                else if (m != ACTION_OTHER)
+                        mask |= m;
+
+                if (v[len] == '\0')
+                        break;
+                v += len + 1;
+        }
+
+        if (token->key.op == OP_NOMATCH)
+                return ACTION_ALL & ~mask;
+
+        return mask;
+}
+
+static int rules_index_add(struct udev_rules *rules, const char *subsystem, size_t len, unsigned int rule) {
+        _cleanup_free_ char *key = NULL;
+        struct rule_list *l;
+        int r;
+
+        key = strndup(subsystem, len);
+        if (!key)
+                return -ENOMEM;
+
+        l = hashmap_get(rules->by_subsystem, key);
+        if (!l) {
+                l = new0(struct rule_list, 1);
+                if (!l)
+                        return -ENOMEM;
+
+                r = hashmap_put(rules->by_subsystem, key, l);
+                if (r < 0) {
+                        free(l);
+                        return r;
+                }
+                key = NULL;
+        }
+
+        /* A|A would add the rule twice */
+        if (l->count > 0 && l->rules[l->count - 1] == rule)
+                return 0;
+
+        if (!GREEDY_REALLOC(l->rules, l->allocated, l->count + 1))
+                return -ENOMEM;
+
+        l->rules[l->count++] = rule;
+        return 0;
+}
+
+/* Tokens of a rule are sorted with ACTION, KERNEL and SUBSYSTEM
+ * matches before anything with side effects, so a rule whose
+ * constant matches on these keys fail can be skipped without
+ * looking at it. Index the rules by the subsystem they require,
+ * rules without such a requirement are kept in a separate list,
+ * both in rule order. Applying the rules then merges the list for
+ * the event's subsystem with the unfiltered one. */
+static int rules_build_index(struct udev_rules *rules) {
+        unsigned int i, n = 0, k;
+        size_t unfiltered_allocated = 0;
+        int r;
+
+        for (i = 0; i < rules->token_cur; i++)
+                if (rules->tokens[i].type == TK_RULE)
+                        n++;
+
+        rules->by_subsystem = hashmap_new(&string_hash_ops);
+        if (!rules->by_subsystem)
+                return -ENOMEM;
+
+        rules->rule_infos = new0(struct rule_info, MAX(n, 1U));
+        if (!rules->rule_infos)
+                return -ENOMEM;
+
+        rules->interned = new0(const char*, MAX(rules->token_cur, 1U));
+        if (!rules->interned)
+                return -ENOMEM;
+
+        rules->stats = mmap(NULL, MAX(n, 1U) * sizeof(struct rule_stats), PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+        if (rules->stats == MAP_FAILED) {
+                rules->stats = NULL;
+                return -errno;
+        }
+
+        for (i = 0, k = 0; i < rules->token_cur; i++) {
+                struct token *rule = &rules->tokens[i], *t;
+                struct rule_info *info;
+                bool filtered = false;
+
+                if (rule->type != TK_RULE)
+                        continue;
+
+                info = &rules->rule_infos[k];
+                info->token = i;
+                info->action_mask = ACTION_ALL;
+
+                for (t = rule + 1; t < rule + rule->rule.token_count; t++) {
+                        const char *v;
+
+                        if (t->type == TK_M_ACTION)
+                                info->action_mask &= token_action_mask(rules, t);
+
+                        else if (t->type == TK_M_TAG) {
+                                r = device_intern_string(rules_str(rules, t->key.value_off), &rules->interned[t - rules->tokens]);
+                                if (r < 0)
+                                        return r;
+                        }
+
+                        else if (t->type == TK_M_KERNEL && info->kernel_len == 0 &&
+                                 t->key.op == OP_MATCH && IN_SET(t->key.glob, GL_PLAIN, GL_GLOB)) {
+                                v = rules_str(rules, t->key.value_off);
+                                info->kernel_off = t->key.value_off;
+                                info->kernel_len = strcspn(v, "*?[\\");
+
+                        } else if (t->type == TK_M_SUBSYSTEM && !filtered &&
+                                   t->key.op == OP_MATCH && IN_SET(t->key.glob, GL_PLAIN, GL_SPLIT)) {
+                                v = rules_str(rules, t->key.value_off);
+
+                                for (;;) {
+                                        size_t len = strcspn(v, "|");
+
+                                        r = rules_index_add(rules, v, len, k);
+                                        if (r < 0)
+                                                return r;
+
+                                        if (v[len] == '\0')
+                                                break;
+                                        v += len + 1;
+                                }
+
+                                filtered = true;
+                        }
+                }
+
+                if (!filtered) {
+                        if (!GREEDY_REALLOC(rules->unfiltered, unfiltered_allocated, rules->unfiltered_count + 1))
+                                return -ENOMEM;
+
+                        rules->unfiltered[rules->unfiltered_count++] = k;
+                }
+
+                k++;
+        }
+
+        rules->rule_infos_count = n;
+
+        log_debug("rules index: %u rules, %u without subsystem, %u subsystems",
+                  n, rules->unfiltered_count, hashmap_size(rules->by_subsystem));
+        return 0;
+}
+
+static void rules_free_index(struct udev_rules *rules) {
+        struct rule_list *l;
+        Iterator i;
+
+        HASHMAP_FOREACH(l, rules->by_subsystem, i)
+                free(l->rules);
+        hashmap_free_free_free(rules->by_subsystem);
+
+        free(rules->rule_infos);
+        free(rules->unfiltered);
+        free(rules->interned);
+
+        if (rules->stats)
+                munmap(rules->stats, MAX(rules->rule_infos_count, 1U) * sizeof(struct rule_stats));
+}
+
+struct rule_cursor {
+        const unsigned int *a, *b;
+        unsigned int a_count, b_count;
+        unsigned int action;
+        const char *sysname;
+};
+
+static bool rule_info_match(struct udev_rules *rules, struct rule_info *info, struct rule_cursor *c) {
+        if (!(info->action_mask & c->action))
+                return false;
+
+        if (info->kernel_len > 0 && !strneq(rules_str(rules, info->kernel_off), c->sysname, info->kernel_len))
+                return false;
+
+        return true;
+}
+
+/* Returns the first rule at or after token pos that may match, or
+ * the end token. Rules are only ever visited in ascending order, GOTO
+ * jumps forward too, hence the cursors never need to go back. */
+static struct token *rules_next_candidate(struct udev_rules *rules, struct rule_cursor *c, unsigned int pos, unsigned int *ret_rule) {
+        for (;;) {
+                unsigned int k;
+
+                while (c->a_count > 0 && rules->rule_infos[c->a[0]].token < pos) {
+                        c->a++;
+                        c->a_count--;
+                }
+                while (c->b_count > 0 && rules->rule_infos[c->b[0]].token < pos) {
+                        c->b++;
+                        c->b_count--;
+                }
+
+                if (c->a_count > 0 && (c->b_count == 0 || c->a[0] < c->b[0]))
+                        k = c->a[0];
+                else if (c->b_count > 0)
+                        k = c->b[0];
+                else
+                        return &rules->tokens[rules->token_cur - 1];
+
+                if (rule_info_match(rules, &rules->rule_infos[k], c)) {
+                        *ret_rule = k;
+                        return &rules->tokens[rules->rule_infos[k].token];
+                }
+
+                pos = rules->rule_infos[k].token + 1;
+        }
+}
+
+static void rule_stats_count(struct udev_rules *rules, unsigned int rule, bool matched) {
+        if (matched)
+                __sync_fetch_and_add(&rules->stats[rule].matched, 1);
+        else
+                __sync_fetch_and_add(&rules->stats[rule].evaluated, 1);
+}
+
+int udev_rules_write_stats(struct udev_rules *rules, FILE *f) {
+        unsigned int k;
+
+        assert(rules);
+        assert(f);
+
+        fputs("# evaluated matched file:line\n", f);
+
+        for (k = 0; k < rules->rule_infos_count; k++) {
+                struct token *rule = &rules->tokens[rules->rule_infos[k].token];
+
+                if (rules->stats[k].evaluated == 0)
+                        continue;
+
+                fprintf(f, "%" PRIu64 " %" PRIu64 " %s:%u\n",
+                        rules->stats[k].evaluated, rules->stats[k].matched,
+                        rules_str(rules, rule->rule.filename_off), rule->rule.filename_line);
+        }
+
+        return fflush_and_check(f);
+}
+
+struct rules_cache_header {
+        char magic[8];
+        uint8_t hash[8];
+        uint32_t token_size;
+        uint32_t token_count;
+        uint64_t strings_len;
+};
+
+/* Everything the parsed rules depend on: the rules files themselves,
+ * the user and group databases if names are resolved at parse time,
+ * and the layout of the tokens in this build. */
+static int rules_cache_hash(char **files, int resolve_names, uint8_t hash[8]) {
+        _cleanup_free_ char *buf = NULL;
+        _cleanup_fclose_ FILE *f = NULL;
+        const char *extra[] = { "/etc/passwd", "/etc/group", NULL };
+        const char **e;
+        size_t size = 0;
+        char **p;
+        int r;
+
+        f = open_memstream(&buf, &size);
+        if (!f)
+                return -ENOMEM;
+
+        fprintf(f, "%s %zu %i %i %i\n", PACKAGE_VERSION, sizeof(struct token), TK_END, UDEV_BUILTIN_MAX, resolve_names);
+
+        /* Hash the contents rather than the timestamps, files may be
+         * rewritten within the timestamp granularity. Reading them is
+         * still much cheaper than parsing them. */
+        STRV_FOREACH(p, files) {
+                _cleanup_free_ char *contents = NULL;
+                size_t l;
+
+                r = read_full_file(*p, &contents, &l);
+                if (r < 0)
+                        return r;
+
+                fprintf(f, "%s %zu\n", *p, l);
+                fwrite(contents, 1, l, f);
+        }
+
+        if (resolve_names > 0)
+                for (e = extra; *e; e++) {
+                        struct stat st;
+
+                        if (stat(*e, &st) >= 0)
+                                fprintf(f, "%s " NSEC_FMT "\n", *e, timespec_load_nsec(&st.st_mtim));
+                }
+
+        r = fflush_and_check(f);
+        if (r < 0)
+                return r;
+
+        siphash24(hash, buf, size, RULES_CACHE_HASH_KEY.bytes);
+        return 0;
+}
+
+static int rules_cache_load(struct udev_rules *rules, const uint8_t hash[8]) {
+        _cleanup_close_ int fd = -1;
+        const struct rules_cache_header *h;
+        const struct token *tokens;
+        const char *strings;
+        struct strbuf *sb;
+        struct stat st;
+        void *map;
+
+        fd = open(RULES_CACHE, O_RDONLY|O_CLOEXEC|O_NOCTTY);
+        if (fd < 0)
+                return -errno;
+
+        if (fstat(fd, &st) < 0)
+                return -errno;
+
+        if ((size_t) st.st_size < sizeof(struct rules_cache_header) + sizeof(struct token))
+                return -EBADMSG;
+
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED)
+                return -errno;
+
+        h = map;
+        tokens = (const struct token *) ((const uint8_t *) map + sizeof(struct rules_cache_header));
+        strings = (const char *) (tokens + h->token_count);
+
+        if (memcmp(h->magic, RULES_CACHE_MAGIC, sizeof(h->magic)) != 0 ||
+            memcmp(h->hash, hash, sizeof(h->hash)) != 0 ||
+            h->token_size != sizeof(struct token) ||
+            h->token_count == 0 ||
+            h->strings_len == 0 ||
+            sizeof(struct rules_cache_header) + (uint64_t) h->token_count * sizeof(struct token) + h->strings_len != (uint64_t) st.st_size ||
+            tokens[h->token_count - 1].type != TK_END ||
+            strings[h->strings_len - 1] != '\0') {
+                munmap(map, st.st_size);
+                return -ESTALE;
+        }
+
+        /* Only the buffer of the strbuf is used after parsing, point
+         * it into the mapping. Forked workers share the pages. */
+        sb = new0(struct strbuf, 1);
+        if (!sb) {
+                munmap(map, st.st_size);
+                return -ENOMEM;
+        }
+
+        sb->buf = (char *) strings;
+        sb->len = h->strings_len;
+
+        rules->strbuf = sb;
+        rules->tokens = (struct token *) tokens;
+        rules->token_cur = rules->token_max = h->token_count;
+        rules->cache_map = map;
+        rules->cache_size = st.st_size;
+
+        return 0;
+}
+
+static int rules_cache_save(struct udev_rules *rules, const uint8_t hash[8]) {
+        _cleanup_free_ char *t = NULL;
+        _cleanup_fclose_ FILE *f = NULL;
+        struct rules_cache_header h = {
+                .magic = RULES_CACHE_MAGIC,
+                .token_size = sizeof(struct token),
+                .token_count = rules->token_cur,
+                .strings_len = rules->strbuf->len,
+        };
+        int r;
+
+        memcpy(h.hash, hash, sizeof(h.hash));
+
+        r = fopen_temporary(RULES_CACHE, &f, &t);
+        if (r < 0)
+                return r;
+
+        (void) fchmod(fileno(f), 0644);
+
+        fwrite(&h, sizeof(h), 1, f);
+        fwrite(rules->tokens, sizeof(struct token), rules->token_cur, f);
+        fwrite(rules->strbuf->buf, 1, rules->strbuf->len, f);
+
+        r = fflush_and_check(f);
+        if (r < 0)
+                goto fail;
+
+        if (rename(t, RULES_CACHE) < 0) {
+                r = -errno;
+                goto fail;
+        }
+
+        return 0;
+
+fail:
+        unlink(t);
+        return r;
+}
+
 struct udev_rules *udev_rules_new(struct udev *udev, int resolve_names) {
         struct udev_rules *rules;
         struct udev_list file_list;
         struct token end_token;
         char **files, **f;
+        uint8_t hash[8];
+        bool have_hash;
         int r;
 
         rules = new0(struct udev_rules, 1);
@@ -1642,21 +2139,38 @@ struct udev_rules *udev_rules_new(struct udev *udev, int resolve_names) {
         rules->resolve_names = resolve_names;
         udev_list_init(udev, &file_list, true);
 
+        udev_rules_check_timestamp(rules);
+
+        r = conf_files_list_strv(&files, ".rules", NULL, rules_dirs);
+        if (r < 0) {
+                log_error_errno(r, "failed to enumerate rules files: %m");
+                return udev_rules_unref(rules);
+        }
+
+        have_hash = rules_cache_hash(files, resolve_names, hash) >= 0;
+        if (have_hash) {
+                r = rules_cache_load(rules, hash);
+                if (r >= 0) {
+                        log_debug("rules loaded from %s, %u tokens, %zu bytes strings",
+                                  RULES_CACHE, rules->token_cur, rules->strbuf->len);
+                        strv_free(files);
+                        goto finish;
+                }
+                if (r != -ENOENT)
+                        log_debug_errno(r, "not using %s: %m", RULES_CACHE);
+        }
+
         /* init token array and string buffer */
         rules->tokens = malloc(PREALLOC_TOKEN * sizeof(struct token));
-        if (rules->tokens == NULL)
+        if (rules->tokens == NULL) {
+                strv_free(files);
                 return udev_rules_unref(rules);
+        }
         rules->token_max = PREALLOC_TOKEN;
 
         rules->strbuf = strbuf_new();
-        if (!rules->strbuf)
-                return udev_rules_unref(rules);
-
-        udev_rules_check_timestamp(rules);
-
-        r = conf_files_list_strv(&files, ".rules", NULL, rules_dirs);
-        if (r < 0) {
-                log_error_errno(r, "failed to enumerate rules files: %m");
+        if (!rules->strbuf) {
+                strv_free(files);
                 return udev_rules_unref(rules);
         }
 
@@ -1692,6 +2206,19 @@ struct udev_rules *udev_rules_new(struct udev *udev, int resolve_names) {
         rules->gids_cur = 0;
         rules->gids_max = 0;
 
+        if (have_hash) {
+                r = rules_cache_save(rules, hash);
+                if (r < 0)
+                        log_debug_errno(r, "failed to write %s: %m", RULES_CACHE);
+        }
+
+finish:
+        r = rules_build_index(rules);
+        if (r < 0) {
+                log_error_errno(r, "failed to build rules index: %m");
+                return udev_rules_unref(rules);
+        }
+
         dump_rules(rules);
         return rules;
 }
@@ -1699,8 +2226,14 @@ struct udev_rules *udev_rules_new(struct udev *udev, int resolve_names) {
 struct udev_rules *udev_rules_unref(struct udev_rules *rules) {
         if (rules == NULL)
                 return NULL;
-        free(rules->tokens);
-        strbuf_cleanup(rules->strbuf);
+        rules_free_index(rules);
+        if (rules->cache_map) {
+                munmap(rules->cache_map, rules->cache_size);
+                free(rules->strbuf);
+        } else {
+                free(rules->tokens);
+                strbuf_cleanup(rules->strbuf);
+        }
         free(rules->uids);
         free(rules->gids);
         free(rules);
@@ -1849,24 +2382,56 @@ int udev_rules_apply_to_event(struct udev_rules *rules,
         struct token *cur;
         struct token *rule;
         enum escape_type esc = ESCAPE_UNSET;
-        bool can_set_name;
+        struct rule_cursor cursor = {};
+        struct rule_list *l;
+        const char *action, *subsystem;
+        unsigned int rule_idx = 0;
+        bool can_set_name, matching = false;
 
         if (rules->tokens == NULL)
                 return -1;
 
-        can_set_name = ((!streq(udev_device_get_action(event->dev), "remove")) &&
+        action = udev_device_get_action(event->dev);
+        can_set_name = ((!streq_ptr(action, "remove")) &&
                         (major(udev_device_get_devnum(event->dev)) > 0 ||
                          udev_device_get_ifindex(event->dev) > 0));
 
+        cursor.a = rules->unfiltered;
+        cursor.a_count = rules->unfiltered_count;
+        subsystem = udev_device_get_subsystem(event->dev);
+        l = subsystem ? hashmap_get(rules->by_subsystem, subsystem) : NULL;
+        if (l) {
+                cursor.b = l->rules;
+                cursor.b_count = l->count;
+        }
+        cursor.action = action ? action_to_mask(action, strlen(action)) : ACTION_OTHER;
+        cursor.sysname = strempty(udev_device_get_sysname(event->dev));
+
         /* loop through token list, match, run actions or forward to next rule */
         cur = &rules->tokens[0];
         rule = cur;
         for (;;) {
+                struct token *next;
+
                 dump_token(rules, cur);
                 switch (cur->type) {
                 case TK_RULE:
+                        /* the previous rule was walked to its end */
+                        if (matching)
+                                rule_stats_count(rules, rule_idx, true);
+                        matching = false;
+
+                        /* skip over the rules that can't match this event */
+                        next = rules_next_candidate(rules, &cursor, cur - rules->tokens, &rule_idx);
+                        if (next != cur) {
+                                cur = next;
+                                continue;
+                        }
+
                         /* current rule */
                         rule = cur;
+                        rule_stats_count(rules, rule_idx, false);
+                        matching = true;
                         /* possibly skip rules which want to set NAME, SYMLINK, OWNER, GROUP, MODE */
                         if (!can_set_name && rule->rule.can_set_name)
                                 goto nomatch;
@@ -1928,11 +2493,13 @@ int udev_rules_apply_to_event(struct udev_rules *rules,
                         break;
                 }
                 case TK_M_TAG: {
+                        const char *tag = rules->interned[cur - rules->tokens];
                         struct udev_list_entry *list_entry;
                         bool match = false;
 
+                        /* Tags of devices are interned, too */
                         udev_list_entry_foreach(list_entry, udev_device_get_tags_list_entry(event->dev)) {
-                                if (streq(rules_str(rules, cur->key.value_off), udev_list_entry_get_name(list_entry))) {
+                                if (udev_list_entry_get_name(list_entry) == tag) {
                                         match = true;
                                         break;
                                 }
@@ -2534,9 +3101,14 @@ int udev_rules_apply_to_event(struct udev_rules *rules,
                 case TK_A_GOTO:
                         if (cur->key.rule_goto == 0)
                                 break;
+                        if (matching)
+                                rule_stats_count(rules, rule_idx, true);
+                        matching = false;
                         cur = &rules->tokens[cur->key.rule_goto];
                         continue;
                 case TK_END:
+                        if (matching)
+                                rule_stats_count(rules, rule_idx, true);
                         return 0;
 
                 case TK_M_PARENTS_MIN:
@@ -2551,6 +3123,7 @@ int udev_rules_apply_to_event(struct udev_rules *rules,
                 continue;
         nomatch:
                 /* fast-forward to next rule */
+                matching = false;
                 cur = rule + rule->rule.token_count;
         }
 }
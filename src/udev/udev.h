@@ -66,6 +66,7 @@ struct udev_watch {
 };
 
 /* udev-rules.c */
+#define UDEV_RULES_STATS "/run/udev/rules-stats"
 struct udev_rules;
 struct udev_rules *udev_rules_new(struct udev *udev, int resolve_names);
 struct udev_rules *udev_rules_unref(struct udev_rules *rules);
@@ -74,6 +75,7 @@ int udev_rules_apply_to_event(struct udev_rules *rules, struct udev_event *event
                               usec_t timeout_usec, usec_t timeout_warn_usec,
                               struct udev_list *properties_list);
 int udev_rules_apply_static_dev_perms(struct udev_rules *rules);
+int udev_rules_write_stats(struct udev_rules *rules, FILE *f);
 
 /* udev-event.c */
 struct udev_event *udev_event_new(struct udev_device *dev);
@@ -124,6 +126,8 @@ int udev_ctrl_send_ping(struct udev_ctrl *uctrl, int timeout);
 int udev_ctrl_send_exit(struct udev_ctrl *uctrl, int timeout);
 int udev_ctrl_send_set_env(struct udev_ctrl *uctrl, const char *key, int timeout);
 int udev_ctrl_send_set_children_max(struct udev_ctrl *uctrl, int count, int timeout);
+int udev_ctrl_send_write_rules_stats(struct udev_ctrl *uctrl, int timeout);
+int udev_ctrl_send_settle(struct udev_ctrl *uctrl, const char *devpath, int timeout);
 struct udev_ctrl_connection;
 struct udev_ctrl_connection *udev_ctrl_get_connection(struct udev_ctrl *uctrl);
 struct udev_ctrl_connection *udev_ctrl_connection_ref(struct udev_ctrl_connection *conn);
@@ -139,6 +143,8 @@ int udev_ctrl_get_ping(struct udev_ctrl_msg *ctrl_msg);
 int udev_ctrl_get_exit(struct udev_ctrl_msg *ctrl_msg);
 const char *udev_ctrl_get_set_env(struct udev_ctrl_msg *ctrl_msg);
 int udev_ctrl_get_set_children_max(struct udev_ctrl_msg *ctrl_msg);
+int udev_ctrl_get_write_rules_stats(struct udev_ctrl_msg *ctrl_msg);
+const char *udev_ctrl_get_settle(struct udev_ctrl_msg *ctrl_msg);
 
 /* built-in commands */
 enum udev_builtin_cmd {
@@ -194,6 +200,9 @@ int udev_builtin_run(struct udev_device *dev, enum udev_builtin_cmd cmd, const c
 void udev_builtin_list(struct udev *udev);
 bool udev_builtin_validate(struct udev *udev);
 int udev_builtin_add_property(struct udev_device *dev, bool test, const char *key, const char *val);
+int udev_builtin_cache_init(const char *list);
+void udev_builtin_cache_flush(void);
+void udev_builtin_cache_invalidate(const char *devpath);
 int udev_builtin_hwdb_lookup(struct udev_device *dev, const char *prefix, const char *modalias,
                              const char *filter, bool test);
 
@@ -20,6 +20,7 @@
 #include <unistd.h>
 #include <getopt.h>
 
+#include "fileio.h"
 #include "udev.h"
 #include "udev-util.h"
 
@@ -35,6 +36,7 @@ static void print_help(void) {
                "  -R --reload              Reload rules and databases\n"
                "  -p --property=KEY=VALUE  Set a global property for all events\n"
                "  -m --children-max=N      Maximum number of children\n"
+               "     --rules-stats         Print how often each rule was evaluated and matched\n"
                "     --timeout=SECONDS     Maximum time to block for a reply\n"
                , program_invocation_short_name);
 }
@@ -54,6 +56,7 @@ static int adm_control(struct udev *udev, int argc, char *argv[]) {
                 { "property",         required_argument, NULL, 'p' },
                 { "env",              required_argument, NULL, 'p' }, /* alias for -p */
                 { "children-max",     required_argument, NULL, 'm' },
+                { "rules-stats",      no_argument,       NULL, 'r' },
                 { "timeout",          required_argument, NULL, 't' },
                 { "help",             no_argument,       NULL, 'h' },
                 {}
@@ -133,6 +136,18 @@ static int adm_control(struct udev *udev, int argc, char *argv[]) {
                                 rc = 0;
                         break;
                 }
+                case 'r': {
+                        _cleanup_free_ char *stats = NULL;
+
+                        if (udev_ctrl_send_write_rules_stats(uctrl, timeout) < 0 ||
+                            read_full_file(UDEV_RULES_STATS, &stats, NULL) < 0) {
+                                rc = 2;
+                                break;
+                        }
+                        fputs(stats, stdout);
+                        rc = 0;
+                        break;
+                }
                 case 't': {
                         int seconds;
 
@@ -266,8 +266,13 @@ struct trie_f {
         uint64_t nodes_count;
         uint64_t children_count;
         uint64_t values_count;
+        uint64_t indexes_count;
 };
 
+static bool trie_node_indexed(struct trie_node *node) {
+        return node->children_count >= TRIE_NODE_CHILDREN_INDEX_MIN;
+}
+
 /* calculate the storage space for the nodes, children arrays, value arrays */
 static void trie_store_nodes_size(struct trie_f *trie, struct trie_node *node) {
         uint64_t i;
@@ -280,6 +285,8 @@ static void trie_store_nodes_size(struct trie_f *trie, struct trie_node *node) {
                 trie->strings_off += sizeof(struct trie_child_entry_f);
         for (i = 0; i < node->values_count; i++)
                 trie->strings_off += sizeof(struct trie_value_entry_f);
+        if (trie_node_indexed(node))
+                trie->strings_off += TRIE_NODE_CHILDREN_INDEX_SIZE;
 }
 
 static int64_t trie_store_nodes(struct trie_f *trie, struct trie_node *node) {
@@ -287,6 +294,7 @@ static int64_t trie_store_nodes(struct trie_f *trie, struct trie_node *node) {
         struct trie_node_f n = {
                 .prefix_off = htole64(trie->strings_off + node->prefix_off),
                 .children_count = node->children_count,
+                .flags = trie_node_indexed(node) ? TRIE_NODE_CHILDREN_INDEX : 0,
                 .values_count = htole64(node->values_count),
         };
         struct trie_child_entry_f *children = NULL;
@@ -334,6 +342,17 @@ static int64_t trie_store_nodes(struct trie_f *trie, struct trie_node *node) {
                 trie->values_count++;
         }
 
+        /* append direct lookup table for dense nodes */
+        if (trie_node_indexed(node)) {
+                uint8_t index[TRIE_NODE_CHILDREN_INDEX_SIZE] = {};
+
+                for (i = 0; i < node->children_count; i++)
+                        index[node->children[i].c] = i + 1;
+
+                fwrite(index, sizeof(index), 1, trie->f);
+                trie->indexes_count++;
+        }
+
         return node_off;
 }
 
@@ -408,6 +427,8 @@ static int trie_store(struct trie *trie, const char *filename) {
                   t.children_count * sizeof(struct trie_child_entry_f), t.children_count);
         log_debug("value pointers:   %8"PRIu64" bytes (%8"PRIu64")",
                   t.values_count * sizeof(struct trie_value_entry_f), t.values_count);
+        log_debug("children indexes: %8"PRIu64" bytes (%8"PRIu64")",
+                  t.indexes_count * TRIE_NODE_CHILDREN_INDEX_SIZE, t.indexes_count);
         log_debug("string store:     %8zu bytes", trie->strings->len);
         log_debug("strings start:    %8"PRIu64, t.strings_off);
 
@@ -29,6 +29,7 @@
 #include "udev.h"
 #include "udev-util.h"
 #include "udevadm-util.h"
+#include "device-db-pack.h"
 
 static bool skip_attribute(const char *name) {
         static const char* const skip[] = {
@@ -221,6 +222,7 @@ static void cleanup_db(struct udev *udev) {
         DIR *dir;
 
         unlink("/run/udev/queue.bin");
+        unlink(DEVICE_DB_PACK);
 
         dir = opendir("/run/udev/data");
         if (dir != NULL) {
@@ -27,7 +27,10 @@
 #include <poll.h>
 
 #include "udev.h"
+#include "udev-util.h"
+#include "udevadm-util.h"
 #include "util.h"
+#include "strv.h"
 
 static void help(void) {
         printf("%s settle OPTIONS\n\n"
@@ -36,13 +39,45 @@ static void help(void) {
                "     --version              Show package version\n"
                "  -t --timeout=SECONDS      Maximum time to wait for events\n"
                "  -E --exit-if-exists=FILE  Stop waiting if file exists\n"
+               "     --device=DEVICE        Only wait for events of this device\n"
                , program_invocation_short_name);
 }
 
+/* Ask the daemon to hold the control connection until the events
+ * queued so far are handled, instead of watching the queue. */
+static int settle_daemon(struct udev *udev, char **devpaths, usec_t deadline) {
+        char **d;
+        int r;
+
+        STRV_FOREACH(d, devpaths ?: STRV_MAKE("")) {
+                _cleanup_udev_ctrl_unref_ struct udev_ctrl *uctrl = NULL;
+                usec_t n;
+
+                uctrl = udev_ctrl_new(udev);
+                if (!uctrl)
+                        return -ENOMEM;
+
+                n = now(CLOCK_MONOTONIC);
+                if (n >= deadline)
+                        return -ETIMEDOUT;
+
+                r = udev_ctrl_send_settle(uctrl, *d, DIV_ROUND_UP(deadline - n, USEC_PER_SEC));
+                if (r < 0)
+                        return r;
+        }
+
+        return 0;
+}
+
 static int adm_settle(struct udev *udev, int argc, char *argv[]) {
+        enum {
+                ARG_DEVICE = 0x100,
+        };
+
         static const struct option options[] = {
                 { "timeout",        required_argument, NULL, 't' },
                 { "exit-if-exists", required_argument, NULL, 'E' },
+                { "device",         required_argument, NULL, ARG_DEVICE },
                 { "help",           no_argument,       NULL, 'h' },
                 { "seq-start",      required_argument, NULL, 's' }, /* removed */
                 { "seq-end",        required_argument, NULL, 'e' }, /* removed */
@@ -55,6 +90,7 @@ static int adm_settle(struct udev *udev, int argc, char *argv[]) {
         struct pollfd pfd[1] = { {.fd = -1}, };
         int c;
         struct udev_queue *queue;
+        _cleanup_strv_free_ char **devpaths = NULL;
         int rc = EXIT_FAILURE;
 
         while ((c = getopt_long(argc, argv, "t:E:hs:e:q", options, NULL)) >= 0) {
@@ -76,6 +112,22 @@ static int adm_settle(struct udev *udev, int argc, char *argv[]) {
                         exists = optarg;
                         break;
 
+                case ARG_DEVICE: {
+                        _cleanup_udev_device_unref_ struct udev_device *dev = NULL;
+
+                        dev = find_device(udev, optarg, "/sys");
+                        if (!dev) {
+                                log_error("unknown device '%s'", optarg);
+                                return EXIT_FAILURE;
+                        }
+
+                        if (strv_extend(&devpaths, udev_device_get_devpath(dev)) < 0) {
+                                log_oom();
+                                return EXIT_FAILURE;
+                        }
+                        break;
+                }
+
                 case 'h':
                         help();
                         return EXIT_SUCCESS;
@@ -101,6 +153,23 @@ static int adm_settle(struct udev *udev, int argc, char *argv[]) {
 
         deadline = now(CLOCK_MONOTONIC) + timeout * USEC_PER_SEC;
 
+        /* the daemon releases us as soon as our events are handled,
+         * even if further ones keep arriving */
+        if (getuid() == 0 && !exists && timeout > 0) {
+                int r;
+
+                r = settle_daemon(udev, devpaths, deadline);
+                if (r == -ETIMEDOUT)
+                        return EXIT_FAILURE;
+                if (r < 0)
+                        log_debug_errno(r, "no connection to daemon: %m");
+
+                return EXIT_SUCCESS;
+        }
+
+        if (devpaths)
+                log_debug("cannot wait for single devices, waiting for all events");
+
         /* guarantee that the udev daemon isn't pre-processing */
         if (getuid() == 0) {
                 struct udev_ctrl *uctrl;
@@ -131,6 +200,8 @@ static int adm_settle(struct udev *udev, int argc, char *argv[]) {
         }
 
         for (;;) {
+                usec_t n;
+
                 if (exists && access(exists, F_OK) >= 0) {
                         rc = EXIT_SUCCESS;
                         break;
@@ -142,11 +213,18 @@ static int adm_settle(struct udev *udev, int argc, char *argv[]) {
                         break;
                 }
 
-                if (now(CLOCK_MONOTONIC) >= deadline)
+                n = now(CLOCK_MONOTONIC);
+                if (n >= deadline)
                         break;
 
-                /* wake up when queue is empty */
-                if (poll(pfd, 1, MSEC_PER_SEC) > 0 && pfd[0].revents & POLLIN)
+                /* wake up when queue is empty, the file to wait for
+                 * can only be checked periodically */
+                if (exists)
+                        n = MIN(deadline - n, USEC_PER_SEC);
+                else
+                        n = deadline - n;
+
+                if (poll(pfd, 1, DIV_ROUND_UP(n, USEC_PER_MSEC)) > 0 && pfd[0].revents & POLLIN)
                         udev_queue_flush(queue);
         }
 
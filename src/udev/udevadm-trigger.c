@@ -22,34 +22,314 @@
 #include <getopt.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
 
 #include "udev.h"
 #include "udev-util.h"
 #include "udevadm-util.h"
 #include "util.h"
+#include "hashmap.h"
+#include "strv.h"
+
+/* give up waiting for the events of triggered devices, if udevd did
+ * not send any for this long and its queue is empty */
+#define TRIGGER_IDLE_USEC (1 * USEC_PER_SEC)
 
 static int verbose;
 static int dry_run;
+static unsigned arg_max_in_flight;
+static char **arg_prioritized_subsystems;
+static bool arg_stats;
+
+struct trigger_device {
+        char *syspath;
+        char *subsystem;
+        unsigned priority;
+        unsigned index;
+        usec_t usec;
+};
+
+struct trigger_stats {
+        const char *subsystem;
+        unsigned n_devices;
+        usec_t total;
+        usec_t max;
+};
+
+struct trigger {
+        struct udev_monitor *monitor;
+        struct udev_queue *queue;
+        Hashmap *in_flight; /* syspath → struct trigger_device */
+        Hashmap *stats; /* subsystem → struct trigger_stats */
+};
+
+static int trigger_device_compare(const void *_a, const void *_b) {
+        const struct trigger_device *a = _a, *b = _b;
+
+        if (a->priority != b->priority)
+                return a->priority < b->priority ? -1 : 1;
+
+        return a->index < b->index ? -1 : a->index > b->index;
+}
+
+static int trigger_stats_compare(const void *_a, const void *_b) {
+        const struct trigger_stats *a = *(struct trigger_stats* const*) _a, *b = *(struct trigger_stats* const*) _b;
+
+        if (a->total != b->total)
+                return a->total > b->total ? -1 : 1;
+
+        return strcmp(a->subsystem, b->subsystem);
+}
+
+static void trigger_done(struct trigger *t, struct trigger_device *d) {
+        struct trigger_stats *stats;
+        usec_t usec;
+
+        hashmap_remove(t->in_flight, d->syspath);
+
+        if (!arg_stats)
+                return;
+
+        stats = hashmap_get(t->stats, d->subsystem);
+        if (!stats) {
+                stats = new0(struct trigger_stats, 1);
+                if (!stats)
+                        return;
+
+                stats->subsystem = d->subsystem;
+                if (hashmap_put(t->stats, stats->subsystem, stats) < 0) {
+                        free(stats);
+                        return;
+                }
+        }
+
+        usec = now(CLOCK_MONOTONIC) - d->usec;
+        stats->n_devices++;
+        stats->total += usec;
+        stats->max = MAX(stats->max, usec);
+}
+
+/* wait until fewer than max events are in flight */
+static void trigger_wait(struct trigger *t, unsigned max) {
+        usec_t idle = now(CLOCK_MONOTONIC);
+
+        while (hashmap_size(t->in_flight) > max) {
+                struct pollfd pfd = {
+                        .fd = udev_monitor_get_fd(t->monitor),
+                        .events = POLLIN,
+                };
+                struct udev_device *dev;
+                int r;
+
+                r = poll(&pfd, 1, 100);
+                if (r < 0) {
+                        if (errno == EINTR)
+                                continue;
+                        log_error_errno(errno, "failed to poll udev monitor: %m");
+                        return;
+                }
+
+                if (r == 0) {
+                        /* events of devices which vanished, or were renamed
+                         * behind our back, never show up; rely on the queue */
+                        if (now(CLOCK_MONOTONIC) - idle > TRIGGER_IDLE_USEC &&
+                            udev_queue_get_queue_is_empty(t->queue)) {
+                                struct trigger_device *d;
+                                Iterator i;
+
+                                log_debug("udev queue is empty, not waiting for %u devices", hashmap_size(t->in_flight));
+
+                                HASHMAP_FOREACH(d, t->in_flight, i)
+                                        trigger_done(t, d);
+                        }
+
+                        continue;
+                }
+
+                while ((dev = udev_monitor_receive_device(t->monitor))) {
+                        struct trigger_device *d;
+                        const char *old;
+
+                        d = hashmap_get(t->in_flight, udev_device_get_syspath(dev));
+                        if (!d) {
+                                /* renamed network interfaces */
+                                old = udev_device_get_property_value(dev, "DEVPATH_OLD");
+                                if (old)
+                                        d = hashmap_get(t->in_flight, strjoina("/sys", old));
+                        }
+
+                        if (d)
+                                trigger_done(t, d);
+
+                        udev_device_unref(dev);
+                }
+
+                idle = now(CLOCK_MONOTONIC);
+        }
+}
+
+static void trigger_print_stats(struct trigger *t) {
+        _cleanup_free_ struct trigger_stats **list = NULL;
+        struct trigger_stats *stats;
+        Iterator i;
+        unsigned n = 0, k;
+
+        list = new(struct trigger_stats*, hashmap_size(t->stats));
+        if (!list) {
+                log_oom();
+                return;
+        }
+
+        HASHMAP_FOREACH(stats, t->stats, i)
+                list[n++] = stats;
+
+        qsort_safe(list, n, sizeof(struct trigger_stats*), trigger_stats_compare);
+
+        printf("%-24s %8s %12s %12s\n", "SUBSYSTEM", "DEVICES", "TOTAL", "MAX");
+
+        for (k = 0; k < n; k++) {
+                char total[FORMAT_TIMESPAN_MAX], max[FORMAT_TIMESPAN_MAX];
+
+                printf("%-24s %8u %12s %12s\n", list[k]->subsystem, list[k]->n_devices,
+                       format_timespan(total, sizeof(total), list[k]->total, USEC_PER_MSEC),
+                       format_timespan(max, sizeof(max), list[k]->max, USEC_PER_MSEC));
+        }
+}
 
-static void exec_list(struct udev_enumerate *udev_enumerate, const char *action) {
+static unsigned subsystem_priority(const char *subsystem) {
+        unsigned n = 0;
+        char **s;
+
+        STRV_FOREACH(s, arg_prioritized_subsystems) {
+                if (streq_ptr(*s, subsystem))
+                        return n;
+                n++;
+        }
+
+        return n;
+}
+
+static int exec_list(struct udev *udev, struct udev_enumerate *udev_enumerate, const char *action) {
         struct udev_list_entry *entry;
+        struct trigger_device *devices = NULL;
+        struct trigger t = {};
+        size_t n_devices = 0, n_allocated = 0, i;
+        bool wait;
+        int r = 0;
+
+        wait = !dry_run && (arg_max_in_flight > 0 || arg_stats);
 
         udev_list_entry_foreach(entry, udev_enumerate_get_list_entry(udev_enumerate)) {
+                struct trigger_device *d;
+
+                if (!GREEDY_REALLOC0(devices, n_allocated, n_devices + 1)) {
+                        r = log_oom();
+                        goto finish;
+                }
+
+                d = &devices[n_devices];
+                d->index = n_devices++;
+
+                d->syspath = strdup(udev_list_entry_get_name(entry));
+                if (!d->syspath) {
+                        r = log_oom();
+                        goto finish;
+                }
+
+                if (arg_prioritized_subsystems || arg_stats) {
+                        _cleanup_udev_device_unref_ struct udev_device *dev = NULL;
+
+                        dev = udev_device_new_from_syspath(udev, d->syspath);
+                        d->subsystem = strdup(dev && udev_device_get_subsystem(dev) ? udev_device_get_subsystem(dev) : "-");
+                        if (!d->subsystem) {
+                                r = log_oom();
+                                goto finish;
+                        }
+
+                        d->priority = subsystem_priority(d->subsystem);
+                }
+        }
+
+        /* boot critical subsystems first, otherwise keep the order of the enumeration */
+        qsort_safe(devices, n_devices, sizeof(struct trigger_device), trigger_device_compare);
+
+        if (wait) {
+                t.in_flight = hashmap_new(&string_hash_ops);
+                t.stats = hashmap_new(&string_hash_ops);
+                if (!t.in_flight || !t.stats) {
+                        r = log_oom();
+                        goto finish;
+                }
+
+                t.queue = udev_queue_new(udev);
+                if (!t.queue) {
+                        r = log_oom();
+                        goto finish;
+                }
+
+                /* subscribe before triggering, to not miss any event */
+                t.monitor = udev_monitor_new_from_netlink(udev, "udev");
+                if (!t.monitor) {
+                        r = log_error_errno(errno, "error creating udev monitor: %m");
+                        goto finish;
+                }
+
+                r = udev_monitor_enable_receiving(t.monitor);
+                if (r < 0) {
+                        log_error_errno(r, "error enabling udev monitor: %m");
+                        goto finish;
+                }
+        }
+
+        for (i = 0; i < n_devices; i++) {
+                struct trigger_device *d = &devices[i];
                 char filename[UTIL_PATH_SIZE];
                 int fd;
 
                 if (verbose)
-                        printf("%s\n", udev_list_entry_get_name(entry));
+                        printf("%s\n", d->syspath);
                 if (dry_run)
                         continue;
-                strscpyl(filename, sizeof(filename), udev_list_entry_get_name(entry), "/uevent", NULL);
+
+                if (wait && arg_max_in_flight > 0)
+                        trigger_wait(&t, arg_max_in_flight - 1);
+
+                strscpyl(filename, sizeof(filename), d->syspath, "/uevent", NULL);
                 fd = open(filename, O_WRONLY|O_CLOEXEC);
                 if (fd < 0)
                         continue;
-                if (write(fd, action, strlen(action)) < 0)
+
+                if (wait) {
+                        d->usec = now(CLOCK_MONOTONIC);
+                        (void) hashmap_put(t.in_flight, d->syspath, d);
+                }
+
+                if (write(fd, action, strlen(action)) < 0) {
                         log_debug_errno(errno, "error writing '%s' to '%s': %m", action, filename);
+                        if (wait)
+                                hashmap_remove(t.in_flight, d->syspath);
+                }
                 close(fd);
         }
+
+        if (wait && arg_stats) {
+                trigger_wait(&t, 0);
+                trigger_print_stats(&t);
+        }
+
+finish:
+        udev_monitor_unref(t.monitor);
+        udev_queue_unref(t.queue);
+        hashmap_free(t.in_flight);
+        hashmap_free_free(t.stats);
+
+        for (i = 0; i < n_devices; i++) {
+                free(devices[i].syspath);
+                free(devices[i].subsystem);
+        }
+        free(devices);
+
+        return r;
 }
 
 static const char *keyval(const char *str, const char **val, char *buf, size_t size) {
@@ -85,12 +365,19 @@ static void help(void) {
                "  -y --sysname-match=NAME           Trigger devices with this /sys path\n"
                "     --name-match=NAME              Trigger devices with this /dev name\n"
                "  -b --parent-match=NAME            Trigger devices with that parent device\n"
+               "     --max-in-flight=N              Wait for udevd before triggering more than N devices\n"
+               "     --prioritized-subsystem=SUBSYSTEM[,SUBSYSTEM...]\n"
+               "                                    Trigger devices from these subsystems first\n"
+               "     --stats                        Wait for all events and show the time per subsystem\n"
                , program_invocation_short_name);
 }
 
 static int adm_trigger(struct udev *udev, int argc, char *argv[]) {
         enum {
                 ARG_NAME = 0x100,
+                ARG_MAX_IN_FLIGHT,
+                ARG_PRIORITIZED_SUBSYSTEM,
+                ARG_STATS,
         };
 
         static const struct option options[] = {
@@ -107,6 +394,9 @@ static int adm_trigger(struct udev *udev, int argc, char *argv[]) {
                 { "sysname-match",     required_argument, NULL, 'y'      },
                 { "name-match",        required_argument, NULL, ARG_NAME },
                 { "parent-match",      required_argument, NULL, 'b'      },
+                { "max-in-flight",     required_argument, NULL, ARG_MAX_IN_FLIGHT },
+                { "prioritized-subsystem", required_argument, NULL, ARG_PRIORITIZED_SUBSYSTEM },
+                { "stats",             no_argument,       NULL, ARG_STATS },
                 { "help",              no_argument,       NULL, 'h'      },
                 {}
         };
@@ -238,6 +528,29 @@ static int adm_trigger(struct udev *udev, int argc, char *argv[]) {
                         break;
                 }
 
+                case ARG_MAX_IN_FLIGHT:
+                        r = safe_atou(optarg, &arg_max_in_flight);
+                        if (r < 0) {
+                                log_error("invalid number of devices in flight '%s'", optarg);
+                                return 2;
+                        }
+                        break;
+
+                case ARG_PRIORITIZED_SUBSYSTEM: {
+                        _cleanup_strv_free_ char **l = NULL;
+
+                        l = strv_split(optarg, ",");
+                        if (!l || strv_extend_strv(&arg_prioritized_subsystems, l) < 0) {
+                                log_oom();
+                                return 1;
+                        }
+                        break;
+                }
+
+                case ARG_STATS:
+                        arg_stats = true;
+                        break;
+
                 case 'h':
                         help();
                         return 0;
@@ -267,15 +580,18 @@ static int adm_trigger(struct udev *udev, int argc, char *argv[]) {
         switch (device_type) {
         case TYPE_SUBSYSTEMS:
                 udev_enumerate_scan_subsystems(udev_enumerate);
-                exec_list(udev_enumerate, action);
-                return 0;
+                break;
         case TYPE_DEVICES:
                 udev_enumerate_scan_devices(udev_enumerate);
-                exec_list(udev_enumerate, action);
-                return 0;
+                break;
         default:
                 assert_not_reached("device_type");
         }
+
+        r = exec_list(udev, udev_enumerate, action);
+        arg_prioritized_subsystems = strv_free(arg_prioritized_subsystems);
+
+        return r < 0 ? 1 : 0;
 }
 
 const struct udevadm_cmd udevadm_trigger = {
@@ -56,11 +56,18 @@
 #include "udev-util.h"
 #include "formats-util.h"
 #include "hashmap.h"
+#include "list.h"
+#include "device-db-pack.h"
 
 static bool arg_debug = false;
 static int arg_daemonize = false;
 static int arg_resolve_names = 1;
 static unsigned arg_children_max;
+static bool arg_children_max_auto;
+static unsigned arg_children_min;
+static unsigned arg_worker_queue = 1;
+static unsigned arg_cpus = 1;
+static char *arg_builtin_cache;
 static int arg_exec_delay;
 static usec_t arg_event_timeout_usec = 180 * USEC_PER_SEC;
 static usec_t arg_event_timeout_warn_usec = 180 * USEC_PER_SEC / 3;
@@ -72,21 +79,34 @@ typedef struct Manager {
         struct udev_list_node events;
         const char *cgroup;
         pid_t pid; /* the process that originally allocated the manager object */
+        unsigned children_max; /* effective limit, when following the load */
+        usec_t children_max_usec;
 
         struct udev_rules *rules;
         struct udev_list properties;
 
+        /* queued and running events, indexed for is_devpath_busy() */
+        Hashmap *devpath_events;
+        Hashmap *devpath_children;
+        Hashmap *devnum_events;
+        Hashmap *ifindex_events;
+
         struct udev_monitor *monitor;
         struct udev_ctrl *ctrl;
         struct udev_ctrl_connection *ctrl_conn_blocking;
+        LIST_HEAD(struct settle_waiter, settle_waiters);
         int fd_inotify;
         int worker_watch[2];
 
         sd_event_source *ctrl_event;
         sd_event_source *uevent_event;
         sd_event_source *inotify_event;
+        sd_event_source *db_pack_event;
+
+        uint64_t db_pack_mtime; /* of /run/udev/data when it was last packed */
 
         usec_t last_usec;
+        unsigned long long int last_seqnum; /* of the latest queued event */
 
         bool stop_exec_queue:1;
         bool exit:1;
@@ -98,6 +118,25 @@ enum event_state {
         EVENT_RUNNING,
 };
 
+struct event;
+
+/* An event's entry in one of the lists of struct event_slot */
+struct event_link {
+        struct event *event;
+        struct event_slot *slot;
+        LIST_FIELDS(struct event_link, links);
+};
+
+/* All events sharing a key, ordered by seqnum, so the head is the
+ * earliest one */
+struct event_slot {
+        Hashmap *hashmap;
+        char *devpath;
+        uint64_t id;
+        LIST_HEAD(struct event_link, events);
+        struct event_link *tail;
+};
+
 struct event {
         struct udev_list_node node;
         Manager *manager;
@@ -106,7 +145,6 @@ struct event {
         struct udev_device *dev_kernel;
         struct worker *worker;
         enum event_state state;
-        unsigned long long int delaying_seqnum;
         unsigned long long int seqnum;
         const char *devpath;
         size_t devpath_len;
@@ -116,6 +154,26 @@ struct event {
         bool is_block;
         sd_event_source *timeout_warning;
         sd_event_source *timeout;
+
+        struct event_link devpath_link;
+        struct event_link devnum_link;
+        struct event_link ifindex_link;
+        /* one for each parent directory of devpath */
+        struct event_link *parent_links;
+        unsigned n_parent_links;
+
+        /* queued on a busy worker behind its current event */
+        LIST_FIELDS(struct event, pending);
+};
+
+/* A settle client, blocked until the events queued before it asked
+ * are handled; its connection is closed to release it */
+struct settle_waiter {
+        struct udev_ctrl_connection *conn;
+        unsigned long long int seqnum;
+        /* only wait for events of this device and its children */
+        char *devpath;
+        LIST_FIELDS(struct settle_waiter, waiters);
 };
 
 static inline struct event *node_to_event(struct udev_list_node *node) {
@@ -139,18 +197,173 @@ struct worker {
         struct udev_monitor *monitor;
         enum worker_state state;
         struct event *event;
+        /* events already sent to the worker, handled after the current one */
+        LIST_HEAD(struct event, pending);
+        struct event *pending_tail;
+        unsigned n_pending;
 };
 
 /* passed from worker to main process */
 struct worker_message {
 };
 
+static void event_unlink(struct event_link *link) {
+        struct event_slot *slot = link->slot;
+
+        if (!slot)
+                return;
+
+        if (slot->tail == link)
+                slot->tail = link->links_prev;
+        LIST_REMOVE(links, slot->events, link);
+        link->slot = NULL;
+
+        if (!slot->events) {
+                if (slot->devpath)
+                        hashmap_remove(slot->hashmap, slot->devpath);
+                else
+                        hashmap_remove(slot->hashmap, &slot->id);
+                free(slot->devpath);
+                free(slot);
+        }
+}
+
+static int event_link(Hashmap **h, const char *devpath, size_t len, uint64_t id, struct event *event, struct event_link *link) {
+        struct event_slot *slot;
+        struct event_link *prev;
+        int r;
+
+        if (devpath) {
+                const char *key = strndupa(devpath, len);
+
+                r = hashmap_ensure_allocated(h, &string_hash_ops);
+                if (r < 0)
+                        return r;
+
+                slot = hashmap_get(*h, key);
+        } else {
+                r = hashmap_ensure_allocated(h, &uint64_hash_ops);
+                if (r < 0)
+                        return r;
+
+                slot = hashmap_get(*h, &id);
+        }
+
+        if (!slot) {
+                slot = new0(struct event_slot, 1);
+                if (!slot)
+                        return -ENOMEM;
+
+                slot->hashmap = *h;
+                slot->id = id;
+
+                if (devpath) {
+                        slot->devpath = strndup(devpath, len);
+                        if (!slot->devpath) {
+                                free(slot);
+                                return -ENOMEM;
+                        }
+                        r = hashmap_put(*h, slot->devpath, slot);
+                } else
+                        r = hashmap_put(*h, &slot->id, slot);
+                if (r < 0) {
+                        free(slot->devpath);
+                        free(slot);
+                        return r;
+                }
+        }
+
+        link->event = event;
+        link->slot = slot;
+
+        /* Events are queued in seqnum order, so this is almost
+         * always an append */
+        for (prev = slot->tail; prev && prev->event->seqnum > event->seqnum; prev = prev->links_prev)
+                ;
+
+        if (prev) {
+                LIST_INSERT_AFTER(links, slot->events, prev, link);
+                if (prev == slot->tail)
+                        slot->tail = link;
+        } else {
+                LIST_PREPEND(links, slot->events, link);
+                if (!slot->tail)
+                        slot->tail = link;
+        }
+
+        return 0;
+}
+
+static void event_unindex(struct event *event) {
+        unsigned i;
+
+        event_unlink(&event->devpath_link);
+        event_unlink(&event->devnum_link);
+        event_unlink(&event->ifindex_link);
+
+        for (i = 0; i < event->n_parent_links; i++)
+                event_unlink(&event->parent_links[i]);
+
+        event->parent_links = mfree(event->parent_links);
+        event->n_parent_links = 0;
+}
+
+static int event_index(Manager *manager, struct event *event) {
+        const char *p;
+        unsigned n = 0;
+        int r;
+
+        r = event_link(&manager->devpath_events, event->devpath, event->devpath_len, 0, event, &event->devpath_link);
+        if (r < 0)
+                goto fail;
+
+        if (major(event->devnum) != 0) {
+                r = event_link(&manager->devnum_events, NULL, 0, ((uint64_t) event->devnum << 1) | event->is_block, event, &event->devnum_link);
+                if (r < 0)
+                        goto fail;
+        }
+
+        if (event->ifindex != 0) {
+                r = event_link(&manager->ifindex_events, NULL, 0, (uint64_t) event->ifindex, event, &event->ifindex_link);
+                if (r < 0)
+                        goto fail;
+        }
+
+        /* register with every parent, so that an event for a parent
+         * finds us as a child without walking the queue */
+        for (p = event->devpath + 1; (p = strchr(p, '/')); p++)
+                n++;
+
+        if (n > 0) {
+                event->parent_links = new0(struct event_link, n);
+                if (!event->parent_links) {
+                        r = -ENOMEM;
+                        goto fail;
+                }
+        }
+
+        for (p = event->devpath + 1; (p = strchr(p, '/')); p++) {
+                r = event_link(&manager->devpath_children, event->devpath, p - event->devpath, 0, event, &event->parent_links[event->n_parent_links]);
+                if (r < 0)
+                        goto fail;
+
+                event->n_parent_links++;
+        }
+
+        return 0;
+
+fail:
+        event_unindex(event);
+        return r;
+}
+
 static void event_free(struct event *event) {
         int r;
 
         if (!event)
                 return;
 
+        event_unindex(event);
         udev_list_node_remove(&event->node);
         udev_device_unref(event->dev);
         udev_device_unref(event->dev_kernel);
@@ -158,8 +371,18 @@ static void event_free(struct event *event) {
         sd_event_source_unref(event->timeout_warning);
         sd_event_source_unref(event->timeout);
 
-        if (event->worker)
-                event->worker->event = NULL;
+        if (event->worker) {
+                struct worker *worker = event->worker;
+
+                if (worker->event == event)
+                        worker->event = NULL;
+                else {
+                        if (worker->pending_tail == event)
+                                worker->pending_tail = event->pending_prev;
+                        LIST_REMOVE(pending, worker->pending, event);
+                        worker->n_pending--;
+                }
+        }
 
         assert(event->manager);
 
@@ -184,6 +407,8 @@ static void worker_free(struct worker *worker) {
         hashmap_remove(worker->manager->workers, UINT_TO_PTR(worker->pid));
         udev_monitor_unref(worker->monitor);
         event_free(worker->event);
+        while (worker->pending)
+                event_free(worker->pending);
 
         free(worker);
 }
@@ -258,20 +483,16 @@ static int on_event_timeout_warning(sd_event_source *s, uint64_t usec, void *use
         return 1;
 }
 
-static void worker_attach_event(struct worker *worker, struct event *event) {
+static void worker_start_event(struct worker *worker, struct event *event) {
         sd_event *e;
         uint64_t usec;
 
         assert(worker);
         assert(worker->manager);
         assert(event);
-        assert(!event->worker);
         assert(!worker->event);
 
-        worker->state = WORKER_RUNNING;
         worker->event = event;
-        event->state = EVENT_RUNNING;
-        event->worker = worker;
 
         e = worker->manager->event;
 
@@ -284,6 +505,140 @@ static void worker_attach_event(struct worker *worker, struct event *event) {
                                  usec + arg_event_timeout_usec, USEC_PER_SEC, on_event_timeout, event);
 }
 
+static void worker_attach_event(struct worker *worker, struct event *event) {
+        assert(worker);
+        assert(event);
+        assert(!event->worker);
+
+        event->state = EVENT_RUNNING;
+        event->worker = worker;
+
+        if (!worker->event) {
+                worker->state = WORKER_RUNNING;
+                worker_start_event(worker, event);
+                return;
+        }
+
+        /* the worker picks it up from its socket as soon as the
+         * current event is done, the timeouts start only then */
+        LIST_INSERT_AFTER(pending, worker->pending, worker->pending_tail, event);
+        worker->pending_tail = event;
+        worker->n_pending++;
+}
+
+/* the worker finished its current event, continue with the next one */
+static void worker_next_event(struct worker *worker) {
+        struct event *event;
+
+        assert(worker);
+        assert(!worker->event);
+
+        event = worker->pending;
+        if (!event) {
+                if (worker->state != WORKER_KILLED)
+                        worker->state = WORKER_IDLE;
+                return;
+        }
+
+        if (worker->pending_tail == event)
+                worker->pending_tail = NULL;
+        LIST_REMOVE(pending, worker->pending, event);
+        worker->n_pending--;
+
+        worker_start_event(worker, event);
+}
+
+/* put back events the worker will never handle */
+static void worker_requeue_pending(struct worker *worker) {
+        struct event *event;
+
+        assert(worker);
+
+        while ((event = worker->pending)) {
+                LIST_REMOVE(pending, worker->pending, event);
+                event->worker = NULL;
+                event->state = EVENT_QUEUED;
+
+                log_debug("seq %llu requeued", event->seqnum);
+        }
+
+        worker->pending_tail = NULL;
+        worker->n_pending = 0;
+}
+
+static struct settle_waiter *settle_waiter_free(struct settle_waiter *waiter) {
+        if (!waiter)
+                return NULL;
+
+        udev_ctrl_connection_unref(waiter->conn);
+        free(waiter->devpath);
+        free(waiter);
+
+        return NULL;
+}
+
+DEFINE_TRIVIAL_CLEANUP_FUNC(struct settle_waiter*, settle_waiter_free);
+
+static bool settle_waiter_is_done(Manager *manager, struct settle_waiter *waiter) {
+        struct udev_list_node *loop;
+        struct event_slot *slot;
+
+        if (!waiter->devpath) {
+                /* events are queued in seqnum order */
+                udev_list_node_foreach(loop, &manager->events)
+                        return node_to_event(loop)->seqnum > waiter->seqnum;
+
+                return true;
+        }
+
+        slot = hashmap_get(manager->devpath_events, waiter->devpath);
+        if (slot && slot->events->event->seqnum <= waiter->seqnum)
+                return false;
+
+        slot = hashmap_get(manager->devpath_children, waiter->devpath);
+        if (slot && slot->events->event->seqnum <= waiter->seqnum)
+                return false;
+
+        return true;
+}
+
+static void manager_release_settle_waiters(Manager *manager, bool all) {
+        struct settle_waiter *waiter, *next;
+
+        LIST_FOREACH_SAFE(waiters, waiter, next, manager->settle_waiters) {
+                if (!all && !settle_waiter_is_done(manager, waiter))
+                        continue;
+
+                LIST_REMOVE(waiters, manager->settle_waiters, waiter);
+                settle_waiter_free(waiter);
+        }
+}
+
+static int manager_add_settle_waiter(Manager *manager, struct udev_ctrl_connection *conn, const char *devpath) {
+        _cleanup_(settle_waiter_freep) struct settle_waiter *waiter = NULL;
+
+        waiter = new0(struct settle_waiter, 1);
+        if (!waiter)
+                return -ENOMEM;
+
+        waiter->seqnum = manager->last_seqnum;
+
+        if (!isempty(devpath)) {
+                waiter->devpath = strdup(devpath);
+                if (!waiter->devpath)
+                        return -ENOMEM;
+        }
+
+        if (settle_waiter_is_done(manager, waiter))
+                return 0;
+
+        waiter->conn = udev_ctrl_connection_ref(conn);
+        LIST_PREPEND(waiters, manager->settle_waiters, waiter);
+        waiter = NULL;
+
+        return 1;
+}
+
 static void manager_free(Manager *manager) {
         if (!manager)
                 return;
@@ -293,6 +648,7 @@ static void manager_free(Manager *manager) {
         sd_event_source_unref(manager->ctrl_event);
         sd_event_source_unref(manager->uevent_event);
         sd_event_source_unref(manager->inotify_event);
+        sd_event_source_unref(manager->db_pack_event);
 
         udev_unref(manager->udev);
         sd_event_unref(manager->event);
@@ -302,10 +658,17 @@ static void manager_free(Manager *manager) {
         udev_monitor_unref(manager->monitor);
         udev_ctrl_unref(manager->ctrl);
         udev_ctrl_connection_unref(manager->ctrl_conn_blocking);
+        manager_release_settle_waiters(manager, true);
 
         udev_list_cleanup(&manager->properties);
         udev_rules_unref(manager->rules);
 
+        /* emptied by event_queue_cleanup() */
+        hashmap_free(manager->devpath_events);
+        hashmap_free(manager->devpath_children);
+        hashmap_free(manager->devnum_events);
+        hashmap_free(manager->ifindex_events);
+
         safe_close(manager->fd_inotify);
         safe_close_pair(manager->worker_watch);
 
@@ -321,7 +684,7 @@ static int worker_send_message(int fd) {
 }
 
 static void worker_spawn(Manager *manager, struct event *event) {
-        struct udev *udev = event->udev;
+        struct udev *udev = manager->udev;
         _cleanup_udev_monitor_unref_ struct udev_monitor *worker_monitor = NULL;
         pid_t pid;
         int r = 0;
@@ -345,11 +708,14 @@ static void worker_spawn(Manager *manager, struct event *event) {
                 _cleanup_close_ int fd_signal = -1, fd_ep = -1;
                 struct epoll_event ep_signal = { .events = EPOLLIN };
                 struct epoll_event ep_monitor = { .events = EPOLLIN };
+                bool terminate = false;
                 sigset_t mask;
 
-                /* take initial device from queue */
-                dev = event->dev;
-                event->dev = NULL;
+                /* take initial device from queue, pool workers start idle */
+                if (event) {
+                        dev = event->dev;
+                        event->dev = NULL;
+                }
 
                 unsetenv("NOTIFY_SOCKET");
 
@@ -365,6 +731,7 @@ static void worker_spawn(Manager *manager, struct event *event) {
                 manager->ctrl_event = sd_event_source_unref(manager->ctrl_event);
                 manager->uevent_event = sd_event_source_unref(manager->uevent_event);
                 manager->inotify_event = sd_event_source_unref(manager->inotify_event);
+                manager->db_pack_event = sd_event_source_unref(manager->db_pack_event);
 
                 manager->event = sd_event_unref(manager->event);
 
@@ -401,7 +768,47 @@ static void worker_spawn(Manager *manager, struct event *event) {
                         struct udev_event *udev_event;
                         int fd_lock = -1;
 
-                        assert(dev);
+                        /* wait for device messages from main udevd, or term signal */
+                        while (dev == NULL) {
+                                struct epoll_event ev[4];
+                                int fdcount;
+                                int i;
+
+                                /* handle what was already sent to us before exiting */
+                                if (terminate) {
+                                        dev = udev_monitor_receive_device(worker_monitor);
+                                        if (!dev)
+                                                goto out;
+                                        break;
+                                }
+
+                                fdcount = epoll_wait(fd_ep, ev, ELEMENTSOF(ev), -1);
+                                if (fdcount < 0) {
+                                        if (errno == EINTR)
+                                                continue;
+                                        r = log_error_errno(errno, "failed to poll: %m");
+                                        goto out;
+                                }
+
+                                for (i = 0; i < fdcount; i++) {
+                                        if (ev[i].data.fd == fd_monitor && ev[i].events & EPOLLIN) {
+                                                dev = udev_monitor_receive_device(worker_monitor);
+                                                break;
+                                        } else if (ev[i].data.fd == fd_signal && ev[i].events & EPOLLIN) {
+                                                struct signalfd_siginfo fdsi;
+                                                ssize_t size;
+
+                                                size = read(fd_signal, &fdsi, sizeof(struct signalfd_siginfo));
+                                                if (size != sizeof(struct signalfd_siginfo))
+                                                        continue;
+                                                switch (fdsi.ssi_signo) {
+                                                case SIGTERM:
+                                                        terminate = true;
+                                                        break;
+                                                }
+                                        }
+                                }
+                        }
 
                         log_debug("seq %llu running", udev_device_get_seqnum(dev));
                         udev_event = udev_event_new(dev);
@@ -480,39 +887,6 @@ skip:
                         dev = NULL;
 
                         udev_event_unref(udev_event);
-
-                        /* wait for more device messages from main udevd, or term signal */
-                        while (dev == NULL) {
-                                struct epoll_event ev[4];
-                                int fdcount;
-                                int i;
-
-                                fdcount = epoll_wait(fd_ep, ev, ELEMENTSOF(ev), -1);
-                                if (fdcount < 0) {
-                                        if (errno == EINTR)
-                                                continue;
-                                        r = log_error_errno(errno, "failed to poll: %m");
-                                        goto out;
-                                }
-
-                                for (i = 0; i < fdcount; i++) {
-                                        if (ev[i].data.fd == fd_monitor && ev[i].events & EPOLLIN) {
-                                                dev = udev_monitor_receive_device(worker_monitor);
-                                                break;
-                                        } else if (ev[i].data.fd == fd_signal && ev[i].events & EPOLLIN) {
-                                                struct signalfd_siginfo fdsi;
-                                                ssize_t size;
-
-                                                size = read(fd_signal, &fdsi, sizeof(struct signalfd_siginfo));
-                                                if (size != sizeof(struct signalfd_siginfo))
-                                                        continue;
-                                                switch (fdsi.ssi_signo) {
-                                                case SIGTERM:
-                                                        goto out;
-                                                }
-                                        }
-                                }
-                        }
                 }
 out:
                 udev_device_unref(dev);
@@ -521,7 +895,8 @@ out:
                 _exit(r < 0 ? EXIT_FAILURE : EXIT_SUCCESS);
         }
         case -1:
-                event->state = EVENT_QUEUED;
+                if (event)
+                        event->state = EVENT_QUEUED;
                 log_error_errno(errno, "fork of child failed: %m");
                 break;
         default:
@@ -532,6 +907,12 @@ out:
                 if (r < 0)
                         return;
 
+                if (!event) {
+                        worker->state = WORKER_IDLE;
+                        log_debug("forked new idle worker ["PID_FMT"]", pid);
+                        break;
+                }
+
                 worker_attach_event(worker, event);
 
                 log_debug("seq %llu forked new worker ["PID_FMT"]", udev_device_get_seqnum(event->dev), pid);
@@ -540,39 +921,108 @@ out:
         }
 }
 
+static unsigned manager_children_max(Manager *manager) {
+        usec_t usec;
+        double load;
+
+        assert(manager);
+
+        if (!arg_children_max_auto)
+                return arg_children_max;
+
+        /* follow the system load, re-evaluated once a second at most */
+        assert_se(sd_event_now(manager->event, clock_boottime_or_monotonic(), &usec) >= 0);
+        if (manager->children_max_usec != 0 &&
+            usec - manager->children_max_usec < USEC_PER_SEC)
+                return manager->children_max;
+
+        manager->children_max_usec = usec;
+        manager->children_max = arg_children_max;
+
+        /* when the CPUs are saturated already, more workers only add
+         * to the contention, but keep one worker per CPU at least */
+        if (getloadavg(&load, 1) == 1 && load > arg_cpus) {
+                manager->children_max = MAX(arg_cpus, (unsigned) (arg_children_max * arg_cpus / load));
+                log_debug("load %.2f, limiting children_max to %u", load, manager->children_max);
+        }
+
+        return manager->children_max;
+}
+
+static bool worker_send_event(Manager *manager, struct worker *worker, struct event *event) {
+        ssize_t count;
+
+        count = udev_monitor_send_device(manager->monitor, worker->monitor, event->dev);
+        if (count < 0) {
+                log_error_errno(errno, "worker ["PID_FMT"] did not accept message %zi (%m), kill it",
+                                worker->pid, count);
+                kill(worker->pid, SIGKILL);
+                worker->state = WORKER_KILLED;
+                return false;
+        }
+
+        worker_attach_event(worker, event);
+        return true;
+}
+
 static void event_run(Manager *manager, struct event *event) {
-        struct worker *worker;
+        struct worker *worker, *shortest = NULL;
+        unsigned children_max;
         Iterator i;
 
         assert(manager);
         assert(event);
 
         HASHMAP_FOREACH(worker, manager->workers, i) {
-                ssize_t count;
-
                 if (worker->state != WORKER_IDLE)
                         continue;
 
-                count = udev_monitor_send_device(manager->monitor, worker->monitor, event->dev);
-                if (count < 0) {
-                        log_error_errno(errno, "worker ["PID_FMT"] did not accept message %zi (%m), kill it",
-                                        worker->pid, count);
-                        kill(worker->pid, SIGKILL);
-                        worker->state = WORKER_KILLED;
-                        continue;
-                }
-                worker_attach_event(worker, event);
-                return;
+                if (worker_send_event(manager, worker, event))
+                        return;
         }
 
-        if (hashmap_size(manager->workers) >= arg_children_max) {
-                if (arg_children_max > 1)
-                        log_debug("maximum number (%i) of children reached", hashmap_size(manager->workers));
+        children_max = manager_children_max(manager);
+        if (hashmap_size(manager->workers) < children_max) {
+                /* start new worker and pass initial device */
+                worker_spawn(manager, event);
                 return;
         }
 
-        /* start new worker and pass initial device */
-        worker_spawn(manager, event);
+        /* all workers are busy, queue the event behind the one with the
+         * fewest events; it does not depend on anything in flight, or
+         * is_devpath_busy() would have held it back */
+        if (arg_worker_queue > 1) {
+                HASHMAP_FOREACH(worker, manager->workers, i) {
+                        if (worker->state != WORKER_RUNNING)
+                                continue;
+
+                        if (worker->n_pending + 1 >= arg_worker_queue)
+                                continue;
+
+                        if (!shortest || worker->n_pending < shortest->n_pending)
+                                shortest = worker;
+                }
+
+                if (shortest && worker_send_event(manager, shortest, event))
+                        return;
+        }
+
+        if (children_max > 1)
+                log_debug("maximum number (%i) of children reached", hashmap_size(manager->workers));
+}
+
+static void manager_start_workers(Manager *manager) {
+        unsigned n, children_min;
+
+        assert(manager);
+
+        if (manager->exit || !manager->rules)
+                return;
+
+        children_min = MIN(arg_children_min, manager_children_max(manager));
+
+        for (n = hashmap_size(manager->workers); n < children_min; n++)
+                worker_spawn(manager, NULL);
 }
 
 static int event_queue_insert(Manager *manager, struct udev_device *dev) {
@@ -609,6 +1059,14 @@ static int event_queue_insert(Manager *manager, struct udev_device *dev) {
              udev_device_get_action(dev), udev_device_get_subsystem(dev));
 
         event->state = EVENT_QUEUED;
+        manager->last_seqnum = MAX(manager->last_seqnum, event->seqnum);
+
+        r = event_index(manager, event);
+        if (r < 0) {
+                udev_device_unref(event->dev_kernel);
+                free(event);
+                return r;
+        }
 
         if (udev_list_node_is_empty(&manager->events)) {
                 r = touch("/run/udev/queue");
@@ -636,75 +1094,83 @@ static void manager_kill_workers(Manager *manager) {
         }
 }
 
-/* lookup event for identical, parent, child device */
-static bool is_devpath_busy(Manager *manager, struct event *event) {
-        struct udev_list_node *loop;
-        size_t common;
+/* kill idle workers, but keep the given number of them around */
+static void manager_kill_idle_workers(Manager *manager, unsigned keep) {
+        struct worker *worker;
+        Iterator i;
 
-        /* check if queue contains events we depend on */
-        udev_list_node_foreach(loop, &manager->events) {
-                struct event *loop_event = node_to_event(loop);
+        assert(manager);
 
-                /* we already found a later event, earlier can not block us, no need to check again */
-                if (loop_event->seqnum < event->delaying_seqnum)
+        HASHMAP_FOREACH(worker, manager->workers, i) {
+                if (worker->state != WORKER_IDLE)
                         continue;
 
-                /* event we checked earlier still exists, no need to check again */
-                if (loop_event->seqnum == event->delaying_seqnum)
-                        return true;
+                if (keep > 0) {
+                        keep--;
+                        continue;
+                }
 
-                /* found ourself, no later event can block us */
-                if (loop_event->seqnum >= event->seqnum)
-                        break;
+                worker->state = WORKER_KILLED;
+                kill(worker->pid, SIGTERM);
+        }
+}
 
-                /* check major/minor */
-                if (major(event->devnum) != 0 && event->devnum == loop_event->devnum && event->is_block == loop_event->is_block)
-                        return true;
+/* lookup event for identical, parent, child device */
+static bool event_slot_has_earlier(Hashmap *h, const char *devpath, struct event *event) {
+        struct event_slot *slot;
 
-                /* check network device ifindex */
-                if (event->ifindex != 0 && event->ifindex == loop_event->ifindex)
-                        return true;
+        slot = hashmap_get(h, devpath);
 
-                /* check our old name */
-                if (event->devpath_old != NULL && streq(loop_event->devpath, event->devpath_old)) {
-                        event->delaying_seqnum = loop_event->seqnum;
-                        return true;
-                }
+        return slot && slot->events->event->seqnum < event->seqnum;
+}
 
-                /* compare devpath */
-                common = MIN(loop_event->devpath_len, event->devpath_len);
+static bool is_devpath_busy(Manager *manager, struct event *event) {
+        struct event_slot *slot;
+        struct event_link *link;
+        const char *p;
 
-                /* one devpath is contained in the other? */
-                if (memcmp(loop_event->devpath, event->devpath, common) != 0)
-                        continue;
+        /* check if queue contains earlier events we depend on, each
+         * check is a lookup in the index kept by event_index() */
 
-                /* identical device event found */
-                if (loop_event->devpath_len == event->devpath_len) {
-                        /* devices names might have changed/swapped in the meantime */
-                        if (major(event->devnum) != 0 && (event->devnum != loop_event->devnum || event->is_block != loop_event->is_block))
-                                continue;
-                        if (event->ifindex != 0 && event->ifindex != loop_event->ifindex)
-                                continue;
-                        event->delaying_seqnum = loop_event->seqnum;
-                        return true;
-                }
+        /* check major/minor */
+        slot = event->devnum_link.slot;
+        if (slot && slot->events->event->seqnum < event->seqnum)
+                return true;
 
-                /* parent device event found */
-                if (event->devpath[common] == '/') {
-                        event->delaying_seqnum = loop_event->seqnum;
-                        return true;
-                }
+        /* check network device ifindex */
+        slot = event->ifindex_link.slot;
+        if (slot && slot->events->event->seqnum < event->seqnum)
+                return true;
 
-                /* child device event found */
-                if (loop_event->devpath[common] == '/') {
-                        event->delaying_seqnum = loop_event->seqnum;
-                        return true;
-                }
+        /* check our old name */
+        if (event->devpath_old && event_slot_has_earlier(manager->devpath_events, event->devpath_old, event))
+                return true;
+
+        /* identical device event found */
+        LIST_FOREACH(links, link, event->devpath_link.slot->events) {
+                struct event *loop_event = link->event;
 
-                /* no matching device */
-                continue;
+                if (loop_event->seqnum >= event->seqnum)
+                        break;
+
+                /* devices names might have changed/swapped in the meantime */
+                if (major(event->devnum) != 0 && (event->devnum != loop_event->devnum || event->is_block != loop_event->is_block))
+                        continue;
+                if (event->ifindex != 0 && event->ifindex != loop_event->ifindex)
+                        continue;
+
+                return true;
         }
 
+        /* parent device event found */
+        for (p = event->devpath + 1; (p = strchr(p, '/')); p++)
+                if (event_slot_has_earlier(manager->devpath_events, strndupa(event->devpath, p - event->devpath), event))
+                        return true;
+
+        /* child device event found */
+        if (event_slot_has_earlier(manager->devpath_children, event->devpath, event))
+                return true;
+
         return false;
 }
 
@@ -766,6 +1232,7 @@ static void manager_reload(Manager *manager) {
         manager_kill_workers(manager);
         manager->rules = udev_rules_unref(manager->rules);
         udev_builtin_exit(manager->udev);
+        udev_builtin_cache_flush();
 
         sd_notify(false,
                   "READY=1\n"
@@ -801,6 +1268,8 @@ static void event_queue_start(Manager *manager) {
                         return;
         }
 
+        manager_start_workers(manager);
+
         udev_list_node_foreach(loop, &manager->events) {
                 struct event *event = node_to_event(loop);
 
@@ -887,11 +1356,10 @@ static int on_worker(sd_event_source *s, int fd, uint32_t revents, void *userdat
                         continue;
                 }
 
-                if (worker->state != WORKER_KILLED)
-                        worker->state = WORKER_IDLE;
-
                 /* worker returned */
                 event_free(worker->event);
+
+                worker_next_event(worker);
         }
 
         /* we have free workers, try to schedule events */
@@ -922,12 +1390,47 @@ static int on_uevent(sd_event_source *s, int fd, uint32_t revents, void *userdat
 }
 
 /* receive the udevd message from userspace */
+static int manager_write_rules_stats(Manager *manager) {
+        _cleanup_fclose_ FILE *f = NULL;
+        _cleanup_free_ char *t = NULL;
+        int r;
+
+        assert(manager);
+
+        /* The counters live in a shared mapping, so this includes
+         * the events the workers processed */
+
+        r = fopen_temporary(UDEV_RULES_STATS, &f, &t);
+        if (r < 0)
+                return r;
+
+        if (manager->rules)
+                r = udev_rules_write_stats(manager->rules, f);
+        else
+                r = fflush_and_check(f);
+        if (r < 0)
+                goto fail;
+
+        (void) fchmod(fileno(f), 0644);
+
+        if (rename(t, UDEV_RULES_STATS) < 0) {
+                r = -errno;
+                goto fail;
+        }
+
+        return 0;
+
+fail:
+        unlink(t);
+        return r;
+}
+
 static int on_ctrl_msg(sd_event_source *s, int fd, uint32_t revents, void *userdata) {
         Manager *manager = userdata;
         _cleanup_udev_ctrl_connection_unref_ struct udev_ctrl_connection *ctrl_conn = NULL;
         _cleanup_udev_ctrl_msg_unref_ struct udev_ctrl_msg *ctrl_msg = NULL;
         const char *str;
-        int i;
+        int i, r;
 
         assert(manager);
 
@@ -991,11 +1494,28 @@ static int on_ctrl_msg(sd_event_source *s, int fd, uint32_t revents, void *userd
         if (i >= 0) {
                 log_debug("udevd message (SET_MAX_CHILDREN) received, children_max=%i", i);
                 arg_children_max = i;
+                arg_children_max_auto = false;
         }
 
         if (udev_ctrl_get_ping(ctrl_msg) > 0)
                 log_debug("udevd message (SYNC) received");
 
+        if (udev_ctrl_get_write_rules_stats(ctrl_msg) > 0) {
+                log_debug("udevd message (WRITE_RULES_STATS) received");
+                r = manager_write_rules_stats(manager);
+                if (r < 0)
+                        log_warning_errno(r, "could not write %s: %m", UDEV_RULES_STATS);
+        }
+
+        str = udev_ctrl_get_settle(ctrl_msg);
+        if (str) {
+                log_debug("udevd message (SETTLE) received, devpath='%s'", str);
+                /* keep the client blocked until its events are handled */
+                r = manager_add_settle_waiter(manager, ctrl_conn, str);
+                if (r < 0)
+                        log_warning_errno(r, "could not block settle client, releasing it: %m");
+        }
+
         if (udev_ctrl_get_exit(ctrl_msg) > 0) {
                 log_debug("udevd message (EXIT) received");
                 manager_exit(manager);
@@ -1136,6 +1656,9 @@ static int on_inotify(sd_event_source *s, int fd, uint32_t revents, void *userda
 
                 log_debug("inotify event: %x for %s", e->mask, udev_device_get_devnode(dev));
                 if (e->mask & IN_CLOSE_WRITE) {
+                        /* the content changed, probe it again */
+                        udev_builtin_cache_invalidate(udev_device_get_devpath(dev));
+
                         synthesize_change(dev);
 
                         /* settle might be waiting on us to determine the queue
@@ -1216,6 +1739,9 @@ static int on_sigchld(sd_event_source *s, const struct signalfd_siginfo *si, voi
                                 /* forward kernel event without amending it */
                                 udev_monitor_send_device(manager->monitor, NULL, worker->event->dev_kernel);
                         }
+
+                        /* events queued behind the failed one were never started */
+                        worker_requeue_pending(worker);
                 }
 
                 worker_free(worker);
@@ -1227,27 +1753,97 @@ static int on_sigchld(sd_event_source *s, const struct signalfd_siginfo *si, voi
         return 1;
 }
 
+static int on_db_pack(sd_event_source *s, uint64_t usec, void *userdata) {
+        Manager *manager = userdata;
+        int r;
+
+        assert(manager);
+
+        manager->db_pack_event = sd_event_source_unref(manager->db_pack_event);
+
+        /* on_post() tries again once the queue is empty */
+        if (!udev_list_node_is_empty(&manager->events))
+                return 1;
+
+        r = device_db_pack_write(&manager->db_pack_mtime);
+        if (r == -EAGAIN)
+                log_debug("device database changed while packing it, trying again later");
+        else if (r < 0)
+                log_debug_errno(r, "failed to write %s: %m", DEVICE_DB_PACK);
+        else
+                log_debug("packed device database into %s", DEVICE_DB_PACK);
+
+        return 1;
+}
+
+/* pack the device database, once it did not change for a second */
+static void manager_schedule_db_pack(Manager *manager) {
+        uint64_t usec;
+
+        assert(manager);
+
+        if (manager->db_pack_event)
+                return;
+
+        if (device_db_pack_is_current(manager->db_pack_mtime) != 0)
+                return;
+
+        assert_se(sd_event_now(manager->event, clock_boottime_or_monotonic(), &usec) >= 0);
+
+        (void) sd_event_add_time(manager->event, &manager->db_pack_event, clock_boottime_or_monotonic(),
+                                 usec + USEC_PER_SEC, USEC_PER_SEC, on_db_pack, manager);
+}
+
 static int on_post(sd_event_source *s, void *userdata) {
         Manager *manager = userdata;
         int r;
 
         assert(manager);
 
+        if (manager->settle_waiters)
+                manager_release_settle_waiters(manager, false);
+
         if (udev_list_node_is_empty(&manager->events)) {
+                unsigned keep = manager->exit ? 0 : arg_children_min;
+
                 /* no pending events */
-                if (!hashmap_isempty(manager->workers)) {
+                if (hashmap_size(manager->workers) > keep) {
                         /* there are idle workers */
                         log_debug("cleanup idle workers");
-                        manager_kill_workers(manager);
+                        manager_kill_idle_workers(manager, keep);
                 } else {
                         /* we are idle */
                         if (manager->exit) {
                                 r = sd_event_exit(manager->event, 0);
                                 if (r < 0)
                                         return r;
-                        } else if (manager->cgroup)
+
+                                return 1;
+                        }
+
+                        manager_schedule_db_pack(manager);
+
+                        if (manager->cgroup) {
+                                _cleanup_set_free_ Set *pool = NULL;
+                                struct worker *worker;
+                                Iterator i;
+
+                                /* spare the idle worker pool */
+                                if (!hashmap_isempty(manager->workers)) {
+                                        pool = set_new(NULL);
+                                        if (!pool)
+                                                return log_oom();
+
+                                        HASHMAP_FOREACH(worker, manager->workers, i) {
+                                                r = set_put(pool, PID_TO_PTR(worker->pid));
+                                                if (r < 0)
+                                                        return log_oom();
+                                        }
+                                }
+
                                 /* cleanup possible left-over processes in our cgroup */
-                                cg_kill(SYSTEMD_CGROUP_CONTROLLER, manager->cgroup, SIGKILL, false, true, NULL);
+                                cg_kill(SYSTEMD_CGROUP_CONTROLLER, manager->cgroup, SIGKILL, false, true, pool);
+                        }
                 }
         }
 
@@ -1377,6 +1973,18 @@ static int parse_proc_cmdline_item(const char *key, const char *value) {
                 r = safe_atou(value, &arg_children_max);
                 if (r < 0)
                         goto invalid;
+        } else if (streq(key, "children-min")) {
+                r = safe_atou(value, &arg_children_min);
+                if (r < 0)
+                        goto invalid;
+        } else if (streq(key, "builtin-cache")) {
+                r = free_and_strdup(&arg_builtin_cache, value);
+                if (r < 0)
+                        return log_oom();
+        } else if (streq(key, "worker-queue")) {
+                r = safe_atou(value, &arg_worker_queue);
+                if (r < 0 || arg_worker_queue == 0)
+                        goto invalid;
         } else if (streq(key, "exec-delay")) {
                 r = safe_atoi(value, &arg_exec_delay);
                 if (r < 0)
@@ -1403,6 +2011,10 @@ static void help(void) {
                "     --daemon                 Detach and run in the background\n"
                "     --debug                  Enable debug output\n"
                "     --children-max=INT       Set maximum number of workers\n"
+               "     --children-min=INT       Keep a pool of idle workers\n"
+               "     --worker-queue=INT       Set number of events passed to a worker at once\n"
+               "     --builtin-cache=BUILTIN[,BUILTIN...]\n"
+               "                              Reuse the results of these builtins for repeated events\n"
                "     --exec-delay=SECONDS     Seconds to wait before executing RUN=\n"
                "     --event-timeout=SECONDS  Seconds to wait before terminating an event\n"
                "     --resolve-names=early|late|never\n"
@@ -1415,6 +2027,9 @@ static int parse_argv(int argc, char *argv[]) {
                 { "daemon",             no_argument,            NULL, 'd' },
                 { "debug",              no_argument,            NULL, 'D' },
                 { "children-max",       required_argument,      NULL, 'c' },
+                { "children-min",       required_argument,      NULL, 'm' },
+                { "worker-queue",       required_argument,      NULL, 'q' },
+                { "builtin-cache",      required_argument,      NULL, 'B' },
                 { "exec-delay",         required_argument,      NULL, 'e' },
                 { "event-timeout",      required_argument,      NULL, 't' },
                 { "resolve-names",      required_argument,      NULL, 'N' },
@@ -1428,7 +2043,7 @@ static int parse_argv(int argc, char *argv[]) {
         assert(argc >= 0);
         assert(argv);
 
-        while ((c = getopt_long(argc, argv, "c:de:Dt:N:hV", options, NULL)) >= 0) {
+        while ((c = getopt_long(argc, argv, "c:m:q:B:de:Dt:N:hV", options, NULL)) >= 0) {
                 int r;
 
                 switch (c) {
@@ -1441,6 +2056,26 @@ static int parse_argv(int argc, char *argv[]) {
                         if (r < 0)
                                 log_warning("Invalid --children-max ignored: %s", optarg);
                         break;
+                case 'm':
+                        r = safe_atou(optarg, &arg_children_min);
+                        if (r < 0)
+                                log_warning("Invalid --children-min ignored: %s", optarg);
+                        break;
+                case 'B':
+                        r = free_and_strdup(&arg_builtin_cache, optarg);
+                        if (r < 0)
+                                return log_oom();
+                        break;
+                case 'q': {
+                        unsigned q;
+
+                        r = safe_atou(optarg, &q);
+                        if (r < 0 || q == 0)
+                                log_warning("Invalid --worker-queue ignored: %s", optarg);
+                        else
+                                arg_worker_queue = q;
+                        break;
+                }
                 case 'e':
                         r = safe_atoi(optarg, &arg_exec_delay);
                         if (r < 0)
@@ -1618,6 +2253,9 @@ static int run(int fd_ctrl, int fd_uevent, const char *cgroup) {
         if (r < 0)
                 log_error_errno(r, "failed to apply permissions on static device nodes: %m");
 
+        /* fork the worker pool before coldplug floods us with events */
+        manager_start_workers(manager);
+
         (void) sd_notify(false,
                          "READY=1\n"
                          "STATUS=Processing...");
@@ -1641,6 +2279,7 @@ exit:
 
 int main(int argc, char *argv[]) {
         _cleanup_free_ char *cgroup = NULL;
+        cpu_set_t cpu_set;
         int r, fd_ctrl, fd_uevent;
 
         log_set_target(LOG_TARGET_AUTO);
@@ -1665,17 +2304,22 @@ int main(int argc, char *argv[]) {
                 goto exit;
         }
 
-        if (arg_children_max == 0) {
-                cpu_set_t cpu_set;
-
-                arg_children_max = 8;
+        if (sched_getaffinity(0, sizeof(cpu_set), &cpu_set) == 0)
+                arg_cpus = MAX(CPU_COUNT(&cpu_set), 1);
 
-                if (sched_getaffinity(0, sizeof(cpu_set), &cpu_set) == 0)
-                        arg_children_max += CPU_COUNT(&cpu_set) * 2;
+        if (arg_children_max == 0) {
+                arg_children_max = 8 + arg_cpus * 2;
+                arg_children_max_auto = true;
 
                 log_debug("set children_max to %u", arg_children_max);
         }
 
+        if (arg_builtin_cache) {
+                r = udev_builtin_cache_init(arg_builtin_cache);
+                if (r < 0)
+                        log_warning_errno(r, "failed to set up cache for builtins '%s', ignoring: %m", arg_builtin_cache);
+        }
+
         /* set umask before creating any file/directory */
         r = chdir("/");
         if (r < 0) {
@@ -1748,6 +2392,7 @@ int main(int argc, char *argv[]) {
         r = run(fd_ctrl, fd_uevent, cgroup);
 
 exit:
+        free(arg_builtin_cache);
         mac_selinux_finish();
         log_close();
         return r < 0 ? EXIT_FAILURE : EXIT_SUCCESS;